@@ -204,6 +204,9 @@
 #include "apache_probes.h"
 #else
 #include "apache_noprobes.h"
+#if defined(AP_ENABLE_USDT) && HAVE_SYS_SDT_H
+#include "apache_usdt.h"
+#endif
 #endif
 
 /* If APR has OTHER_CHILD logic, use reliable piped logs. */
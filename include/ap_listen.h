@@ -44,6 +44,23 @@ typedef apr_status_t (*accept_function)(void **csd, ap_listen_rec *lr, apr_pool_
 #define AP_LISTEN_FREEBIND        (0x0002)
 #define AP_LISTEN_REUSEPORT       (0x0004)
 #define AP_LISTEN_V6ONLY          (0x0008)
+#define AP_LISTEN_PRIORITY        (0x0010)
+
+/**
+ * The valued socket options of a Listen, set on the listening socket and
+ * inherited by the connections accepted on it. Zero (or NULL) leaves the
+ * system default.
+ */
+typedef struct ap_listen_sockopts_t {
+    /** The TCP_FASTOPEN queue length */
+    int fastopen;
+    /** TCP_NOTSENT_LOWAT, overriding SendLowat */
+    int notsent_lowat;
+    /** The SO_BUSY_POLL time, in microseconds */
+    int busy_poll;
+    /** The TCP_CONGESTION control algorithm */
+    const char *congestion;
+} ap_listen_sockopts_t;
 
 /**
  * @brief Apache's listeners record.
@@ -83,6 +100,11 @@ struct ap_listen_rec {
      * Various AP_LISTEN_* flags.
      */
     apr_uint32_t flags;
+
+    /**
+     * The valued socket options, or NULL if none.
+     */
+    ap_listen_sockopts_t *sockopts;
 };
 
 /**
@@ -150,6 +172,9 @@ AP_DECLARE_NONSTD(int) ap_close_selected_listeners(ap_slave_t *);
  */
 AP_DECLARE_NONSTD(const char *) ap_set_listenbacklog(cmd_parms *cmd, void *dummy, const char *arg);
 AP_DECLARE_NONSTD(const char *) ap_set_listencbratio(cmd_parms *cmd, void *dummy, const char *arg);
+AP_DECLARE_NONSTD(const char *) ap_set_listen_cpu_steering(cmd_parms *cmd,
+                                                           void *dummy,
+                                                           int flag);
 AP_DECLARE_NONSTD(const char *) ap_set_listener(cmd_parms *cmd, void *dummy,
                                                 int argc, char *const argv[]);
 AP_DECLARE_NONSTD(const char *) ap_set_send_buffer_size(cmd_parms *cmd, void *dummy,
@@ -157,6 +182,8 @@ AP_DECLARE_NONSTD(const char *) ap_set_send_buffer_size(cmd_parms *cmd, void *du
 AP_DECLARE_NONSTD(const char *) ap_set_receive_buffer_size(cmd_parms *cmd,
                                                            void *dummy,
                                                            const char *arg);
+AP_DECLARE_NONSTD(const char *) ap_set_send_lowat(cmd_parms *cmd, void *dummy,
+                                                  const char *arg);
 
 AP_DECLARE_NONSTD(const char *) ap_set_accept_errors_nonfatal(cmd_parms *cmd,
                                                            void *dummy,
@@ -176,12 +203,16 @@ AP_INIT_TAKE1("ListenBacklog", ap_set_listenbacklog, NULL, RSRC_CONF, \
   "Maximum length of the queue of pending connections, as used by listen(2)"), \
 AP_INIT_TAKE1("ListenCoresBucketsRatio", ap_set_listencbratio, NULL, RSRC_CONF, \
   "Ratio between the number of CPU cores (online) and the number of listeners buckets"), \
+AP_INIT_FLAG("ListenCPUSteering", ap_set_listen_cpu_steering, NULL, RSRC_CONF, \
+  "Steer the connections to the listeners bucket bound to the receiving CPU"), \
 AP_INIT_TAKE_ARGV("Listen", ap_set_listener, NULL, RSRC_CONF, \
   "A port number or a numeric IP address and a port number, and an optional protocol"), \
 AP_INIT_TAKE1("SendBufferSize", ap_set_send_buffer_size, NULL, RSRC_CONF, \
   "Send buffer size in bytes"), \
 AP_INIT_TAKE1("ReceiveBufferSize", ap_set_receive_buffer_size, NULL, \
               RSRC_CONF, "Receive buffer size in bytes"), \
+AP_INIT_TAKE1("SendLowat", ap_set_send_lowat, NULL, RSRC_CONF, \
+  "Maximum amount of unsent data in the TCP send buffer, in bytes"), \
 AP_INIT_FLAG("AcceptErrorsNonFatal", ap_set_accept_errors_nonfatal, NULL, \
               RSRC_CONF, "Some accept() errors are not fatal to the process")
 #ifdef __cplusplus
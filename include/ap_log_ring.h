@@ -0,0 +1,93 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file  ap_log_ring.h
+ * @brief Shared memory ring between httpd and its piped loggers
+ *
+ * @defgroup APACHE_CORE_LOG_RING Piped log ring
+ * @ingroup  APACHE_CORE_LOG
+ * @{
+ */
+
+#ifndef APACHE_AP_LOG_RING_H
+#define APACHE_AP_LOG_RING_H
+
+#include "apr.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * With PipedLogRing, httpd creates a named shared memory segment for each
+ * reliable piped log and passes its name to the logger program in the
+ * AP_LOG_RING_ENV environment variable. A logger which supports it (like
+ * rotatelogs) attaches to the segment, stores its pid in the consumer
+ * field and then reads the records from the ring, besides its stdin.
+ *
+ * The children (the producers) reserve a record by advancing head with a
+ * compare-and-swap, copy the data and then publish the record by setting
+ * its length word last. The consumer reads the published records from
+ * tail, zeroes them and advances tail. When no consumer is attached, when
+ * the ring is full or for large records, the producers write to the pipe
+ * as usual.
+ */
+
+/** The environment variable giving the name of the segment to the logger */
+#define AP_LOG_RING_ENV         "AP_PIPED_LOG_RING"
+
+/** ap_log_ring_t::magic */
+#define AP_LOG_RING_MAGIC       0x41504c52UL /* "APLR" */
+
+/** The offset of the data in the segment */
+#define AP_LOG_RING_HDR_LEN     64
+
+/** Length word of the padding record which skips to the end of the ring */
+#define AP_LOG_RING_PAD         0xffffffffUL
+
+/** The size in the ring of a record of @a len bytes, length word included */
+#define AP_LOG_RING_RECLEN(len) ((((len) + 4) + 3) & ~(apr_uint32_t)3)
+
+/**
+ * The header of the segment. The records of the ring follow at offset
+ * AP_LOG_RING_HDR_LEN, each one starting with a 32 bits length word which
+ * is zero until the record is published, then the number of data bytes
+ * plus one (or AP_LOG_RING_PAD). head and tail are free running counters,
+ * their offset in the ring is modulo size.
+ */
+typedef struct ap_log_ring_t {
+    /** AP_LOG_RING_MAGIC */
+    apr_uint32_t magic;
+    /** The size of the ring, a power of two */
+    apr_uint32_t size;
+    /** The pid of the attached logger, or zero */
+    volatile apr_uint32_t consumer;
+    /** The end of the records reserved by the producers */
+    volatile apr_uint32_t head;
+    /** The end of the records read by the consumer */
+    volatile apr_uint32_t tail;
+} ap_log_ring_t;
+
+/** The data of a ring */
+#define AP_LOG_RING_DATA(ring)  ((char *)(ring) + AP_LOG_RING_HDR_LEN)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* !APACHE_AP_LOG_RING_H */
+/** @} */
@@ -711,6 +711,76 @@
  *                         Add ap_assign_request_line()
  * 20211221.7 (2.5.1-dev)  Add ap_h1_append_header()
  * 20211221.8 (2.5.1-dev)  Add ap_sb_get_child_thread()
+ * 20211221.9 (2.5.1-dev)  Add queues_contention to process_score
+ * 20211221.10 (2.5.1-dev) Add ap_queue_pop_something_ex(), fd_queue_t waiters
+ * 20211221.11 (2.5.1-dev) Add ap_mpm_set_child_cpu_affinity(),
+ *                         ap_mpm_child_cpu_affinity(), ap_mpm_create_local_pool()
+ * 20211221.12 (2.5.1-dev) Add ap_regcomp_set_jit(), AP_REG_NO_JIT
+ * 20211221.13 (2.5.1-dev) Add ap_init_merge_cache()
+ * 20211221.14 (2.5.1-dev) Add ap_stat_cached()
+ * 20211221.15 (2.5.1-dev) Add req_time_hist and bytes_hist to worker_score,
+ *                         ap_sb_histogram, ap_sb_hist_add() and
+ *                         ap_sb_hist_percentile()
+ * 20211221.16 (2.5.1-dev) Add pad to worker_score, status_time to
+ *                         global_score and ExtendedStatus Lazy
+ * 20211221.17 (2.5.1-dev) Add enable_precompressed to core_dir_config
+ * 20211221.18 (2.5.1-dev) Add ap_sb_busy_percent()
+ * 20211221.19 (2.5.1-dev) Add prewarm, reused and connected to
+ *                         proxy_worker_shared
+ * 20211221.20 (2.5.1-dev) Add latency to proxy_worker_shared
+ * 20211221.21 (2.5.1-dev) Add flags to proxy_balancer_method and
+ *                         PROXY_LBMETHOD_F_CONCURRENT
+ * 20211221.22 (2.5.1-dev) Add errors and samples to proxy_worker_shared,
+ *                         latency to proxy_balancer_shared, outlier_* to
+ *                         proxy_balancer
+ * 20211221.23 (2.5.1-dev) Add hedge and hedge_set to proxy_balancer
+ * 20211221.24 (2.5.1-dev) Add AP_FCGI_REQUEST_COMPLETE and friends, and
+ *                         AP_FCGI_ERB_* offsets to util_fcgi.h
+ * 20211221.25 (2.5.1-dev) Add response_buffer_limit and
+ *                         response_buffer_limit_set to proxy_dir_conf
+ * 20211221.26 (2.5.1-dev) Add ap_scan_http_field_content_len()
+ * 20211221.27 (2.5.1-dev) Add headers_in_index to request_rec,
+ *                         ap_header_id_e, ap_get_request_header() and
+ *                         ap_get_request_header_name()
+ * 20211221.28 (2.5.1-dev) Add ap_filter_has_input_pending()
+ * 20211221.29 (2.5.1-dev) Add request_tables_autosize and
+ *                         request_tables_sizes to core_server_config
+ * 20211221.30 (2.5.1-dev) Add ap_set_send_lowat() and SendLowat to
+ *                         LISTEN_COMMANDS
+ * 20211221.31 (2.5.1-dev) Add util_ipset.h: ap_ipset_make(), ap_ipset_add(),
+ *                         ap_ipset_match() and ap_ipset_count()
+ * 20211221.32 (2.5.1-dev) Add search_cache_stale to util_ldap_state_t
+ * 20211221.33 (2.5.1-dev) Add ap_request_phase_*(), ap_time_monotonic(),
+ *                         phase_times and handler_end to
+ *                         core_request_config, phase_time and phase_count
+ *                         to worker_score
+ * 20211221.34 (2.5.1-dev) Add ap_request_phase_start(), proxy_backend_step_e
+ *                         and the proxy_hook_backend_step() optional hook
+ * 20211221.35 (2.5.1-dev) Add ap_time_thread_cpu(), ap_request_cpu_enter(),
+ *                         ap_request_cpu_leave(), ap_request_cpu_time() and
+ *                         the cpu_* fields of core_request_config
+ * 20211221.36 (2.5.1-dev) Add ap_preload_merge_cache()
+ * 20211221.37 (2.5.1-dev) Add ap_priority_workers, ap_mpm_set_priority_workers()
+ *                         and AP_LISTEN_PRIORITY
+ * 20211221.38 (2.5.1-dev) Add ap_queue_pop_something_timeout()
+ * 20211221.39 (2.5.1-dev) Add ap_set_error_log_async()
+ * 20211221.40 (2.5.1-dev) Add ap_piped_log_write(), ap_set_piped_log_ring()
+ *                         and ap_log_ring.h
+ * 20211221.41 (2.5.1-dev) Add etag_digest_cache to core_dir_config
+ * 20211221.42 (2.5.1-dev) Add early_hints to core_dir_config
+ * 20211221.43 (2.5.1-dev) Add ap_set_listen_cpu_steering() and
+ *                         ListenCPUSteering to LISTEN_COMMANDS,
+ *                         ap_mpm_cpu_bucket()
+ * 20211221.44 (2.5.1-dev) Add ap_listen_sockopts_t and sockopts to
+ *                         ap_listen_rec, fastopen to proxy_worker_shared
+ * 20211221.45 (2.5.1-dev) Add ap_watchdog_run_task optional function to
+ *                         mod_watchdog.h
+ * 20211221.46 (2.5.1-dev) Add ap_shm_set_flags(), ap_shm_advise(),
+ *                         AP_SHM_HUGEPAGES and AP_SHM_PREFAULT
+ * 20211221.47 (2.5.1-dev) Add flush_max_memory to core_server_config,
+ *                         setaside_bytes to process_score,
+ *                         ap_filter_conn_setaside_bytes() and
+ *                         ap_filter_child_setaside_bytes()
  */
 
 #define MODULE_MAGIC_COOKIE 0x41503235UL /* "AP25" */
@@ -718,7 +788,7 @@
 #ifndef MODULE_MAGIC_NUMBER_MAJOR
 #define MODULE_MAGIC_NUMBER_MAJOR 20211221
 #endif
-#define MODULE_MAGIC_NUMBER_MINOR 8             /* 0...n */
+#define MODULE_MAGIC_NUMBER_MINOR 47            /* 0...n */
 
 /**
  * Determine if the server's current MODULE_MAGIC_NUMBER is at least a
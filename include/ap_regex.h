@@ -89,6 +89,8 @@ extern "C" {
 
 #define AP_REG_NO_DEFAULT 0x400 /**< Don't implicitely add AP_REG_DEFAULT options */
 
+#define AP_REG_NO_JIT 0x800 /**< Don't JIT compile the pattern (PCRE2) */
+
 #define AP_REG_MATCH "MATCH_" /**< suggested prefix for ap_regname */
 
 #define AP_REG_DEFAULT (AP_REG_DOTALL|AP_REG_DOLLAR_ENDONLY)
@@ -143,6 +145,12 @@ AP_DECLARE(int) ap_regcomp_get_default_cflags(void);
  */
 AP_DECLARE(void) ap_regcomp_set_default_cflags(int cflags);
 
+/**
+ * Enable or disable JIT compilation of the patterns (PCRE2 only)
+ * @param onoff Whether ap_regcomp() should JIT compile the patterns
+ */
+AP_DECLARE(void) ap_regcomp_set_jit(int onoff);
+
 /**
  * Get the AP_REG_* corresponding to the string.
  * @param name The name (i.e. AP_REG_<name>)
@@ -153,6 +153,10 @@
 #define AP_HTTP_SCHEME_ENTRY_ENABLED() (0)
 #define AP_HTTP_SCHEME_RETURN(arg0)
 #define AP_HTTP_SCHEME_RETURN_ENABLED() (0)
+#define AP_INPUT_FILTER_ENTRY(arg0, arg1, arg2, arg3)
+#define AP_INPUT_FILTER_ENTRY_ENABLED() (0)
+#define AP_INPUT_FILTER_RETURN(arg0, arg1, arg2, arg3)
+#define AP_INPUT_FILTER_RETURN_ENABLED() (0)
 #define AP_INSERT_ALL_LIVEPROPS_DISPATCH_COMPLETE(arg0, arg1)
 #define AP_INSERT_ALL_LIVEPROPS_DISPATCH_COMPLETE_ENABLED() (0)
 #define AP_INSERT_ALL_LIVEPROPS_DISPATCH_INVOKE(arg0)
@@ -219,6 +223,10 @@
 #define AP_OPTIONAL_FN_RETRIEVE_ENTRY_ENABLED() (0)
 #define AP_OPTIONAL_FN_RETRIEVE_RETURN(arg0)
 #define AP_OPTIONAL_FN_RETRIEVE_RETURN_ENABLED() (0)
+#define AP_OUTPUT_FILTER_ENTRY(arg0, arg1, arg2)
+#define AP_OUTPUT_FILTER_ENTRY_ENABLED() (0)
+#define AP_OUTPUT_FILTER_RETURN(arg0, arg1, arg2)
+#define AP_OUTPUT_FILTER_RETURN_ENABLED() (0)
 #define AP_POST_CONFIG_DISPATCH_COMPLETE(arg0, arg1)
 #define AP_POST_CONFIG_DISPATCH_COMPLETE_ENABLED() (0)
 #define AP_POST_CONFIG_DISPATCH_INVOKE(arg0)
@@ -287,6 +295,14 @@
 #define AP_PROCESS_CONNECTION_ENTRY_ENABLED() (0)
 #define AP_PROCESS_CONNECTION_RETURN(arg0)
 #define AP_PROCESS_CONNECTION_RETURN_ENABLED() (0)
+#define AP_PROXY_ACQUIRE_ENTRY(arg0, arg1, arg2)
+#define AP_PROXY_ACQUIRE_ENTRY_ENABLED() (0)
+#define AP_PROXY_ACQUIRE_RETURN(arg0, arg1, arg2)
+#define AP_PROXY_ACQUIRE_RETURN_ENABLED() (0)
+#define AP_PROXY_CONNECT_ENTRY(arg0, arg1, arg2)
+#define AP_PROXY_CONNECT_ENTRY_ENABLED() (0)
+#define AP_PROXY_CONNECT_RETURN(arg0, arg1, arg2)
+#define AP_PROXY_CONNECT_RETURN_ENABLED() (0)
 #define AP_PROXY_RUN(arg0, arg1, arg2, arg3, arg4)
 #define AP_PROXY_RUN_ENABLED() (0)
 #define AP_PROXY_RUN_FINISHED(arg0, arg1, arg2)
@@ -323,6 +339,12 @@
 #define AP_TEST_CONFIG_ENTRY_ENABLED() (0)
 #define AP_TEST_CONFIG_RETURN(arg0)
 #define AP_TEST_CONFIG_RETURN_ENABLED() (0)
+#define AP_TIMEOUT_QUEUE_APPEND(arg0, arg1, arg2)
+#define AP_TIMEOUT_QUEUE_APPEND_ENABLED() (0)
+#define AP_TIMEOUT_QUEUE_EXPIRE(arg0, arg1)
+#define AP_TIMEOUT_QUEUE_EXPIRE_ENABLED() (0)
+#define AP_TIMEOUT_QUEUE_REMOVE(arg0, arg1, arg2)
+#define AP_TIMEOUT_QUEUE_REMOVE_ENABLED() (0)
 #define AP_TRANSLATE_NAME_DISPATCH_COMPLETE(arg0, arg1)
 #define AP_TRANSLATE_NAME_DISPATCH_COMPLETE_ENABLED() (0)
 #define AP_TRANSLATE_NAME_DISPATCH_INVOKE(arg0)
@@ -339,6 +361,10 @@
 #define AP_TYPE_CHECKER_ENTRY_ENABLED() (0)
 #define AP_TYPE_CHECKER_RETURN(arg0)
 #define AP_TYPE_CHECKER_RETURN_ENABLED() (0)
+#define AP_WORKER_QUEUE_POP(arg0, arg1, arg2)
+#define AP_WORKER_QUEUE_POP_ENABLED() (0)
+#define AP_WORKER_QUEUE_PUSH(arg0, arg1, arg2)
+#define AP_WORKER_QUEUE_PUSH_ENABLED() (0)
 
 #endif
 
@@ -0,0 +1,141 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * USDT probes, as found by systemtap, bpftrace or perf, for the explicit
+ * probes of apache_probes.d when DTrace is not used. They replace the
+ * empty ones of apache_noprobes.h, which must be included first.
+ *
+ * A probe is a single nop until a tracer attaches to it, and each has a
+ * semaphore (incremented by the tracer) so that the callers can test
+ * AP_*_ENABLED() before computing costly arguments.
+ */
+
+#ifndef _APACHE_USDT_H_
+#define _APACHE_USDT_H_
+
+#ifndef _SDT_HAS_SEMAPHORES
+#define _SDT_HAS_SEMAPHORES 1
+#endif
+#include <sys/sdt.h>
+
+#define AP_USDT_ENABLED(semaphore) __builtin_expect((semaphore), 0)
+
+AP_DECLARE_DATA extern unsigned short ap_input__filter__entry_semaphore;
+#undef AP_INPUT_FILTER_ENTRY
+#undef AP_INPUT_FILTER_ENTRY_ENABLED
+#define AP_INPUT_FILTER_ENTRY(arg0, arg1, arg2, arg3) \
+    STAP_PROBE4(ap, input__filter__entry, arg0, arg1, arg2, arg3)
+#define AP_INPUT_FILTER_ENTRY_ENABLED() \
+    AP_USDT_ENABLED(ap_input__filter__entry_semaphore)
+
+AP_DECLARE_DATA extern unsigned short ap_input__filter__return_semaphore;
+#undef AP_INPUT_FILTER_RETURN
+#undef AP_INPUT_FILTER_RETURN_ENABLED
+#define AP_INPUT_FILTER_RETURN(arg0, arg1, arg2, arg3) \
+    STAP_PROBE4(ap, input__filter__return, arg0, arg1, arg2, arg3)
+#define AP_INPUT_FILTER_RETURN_ENABLED() \
+    AP_USDT_ENABLED(ap_input__filter__return_semaphore)
+
+AP_DECLARE_DATA extern unsigned short ap_output__filter__entry_semaphore;
+#undef AP_OUTPUT_FILTER_ENTRY
+#undef AP_OUTPUT_FILTER_ENTRY_ENABLED
+#define AP_OUTPUT_FILTER_ENTRY(arg0, arg1, arg2) \
+    STAP_PROBE3(ap, output__filter__entry, arg0, arg1, arg2)
+#define AP_OUTPUT_FILTER_ENTRY_ENABLED() \
+    AP_USDT_ENABLED(ap_output__filter__entry_semaphore)
+
+AP_DECLARE_DATA extern unsigned short ap_output__filter__return_semaphore;
+#undef AP_OUTPUT_FILTER_RETURN
+#undef AP_OUTPUT_FILTER_RETURN_ENABLED
+#define AP_OUTPUT_FILTER_RETURN(arg0, arg1, arg2) \
+    STAP_PROBE3(ap, output__filter__return, arg0, arg1, arg2)
+#define AP_OUTPUT_FILTER_RETURN_ENABLED() \
+    AP_USDT_ENABLED(ap_output__filter__return_semaphore)
+
+AP_DECLARE_DATA extern unsigned short ap_proxy__acquire__entry_semaphore;
+#undef AP_PROXY_ACQUIRE_ENTRY
+#undef AP_PROXY_ACQUIRE_ENTRY_ENABLED
+#define AP_PROXY_ACQUIRE_ENTRY(arg0, arg1, arg2) \
+    STAP_PROBE3(ap, proxy__acquire__entry, arg0, arg1, arg2)
+#define AP_PROXY_ACQUIRE_ENTRY_ENABLED() \
+    AP_USDT_ENABLED(ap_proxy__acquire__entry_semaphore)
+
+AP_DECLARE_DATA extern unsigned short ap_proxy__acquire__return_semaphore;
+#undef AP_PROXY_ACQUIRE_RETURN
+#undef AP_PROXY_ACQUIRE_RETURN_ENABLED
+#define AP_PROXY_ACQUIRE_RETURN(arg0, arg1, arg2) \
+    STAP_PROBE3(ap, proxy__acquire__return, arg0, arg1, arg2)
+#define AP_PROXY_ACQUIRE_RETURN_ENABLED() \
+    AP_USDT_ENABLED(ap_proxy__acquire__return_semaphore)
+
+AP_DECLARE_DATA extern unsigned short ap_proxy__connect__entry_semaphore;
+#undef AP_PROXY_CONNECT_ENTRY
+#undef AP_PROXY_CONNECT_ENTRY_ENABLED
+#define AP_PROXY_CONNECT_ENTRY(arg0, arg1, arg2) \
+    STAP_PROBE3(ap, proxy__connect__entry, arg0, arg1, arg2)
+#define AP_PROXY_CONNECT_ENTRY_ENABLED() \
+    AP_USDT_ENABLED(ap_proxy__connect__entry_semaphore)
+
+AP_DECLARE_DATA extern unsigned short ap_proxy__connect__return_semaphore;
+#undef AP_PROXY_CONNECT_RETURN
+#undef AP_PROXY_CONNECT_RETURN_ENABLED
+#define AP_PROXY_CONNECT_RETURN(arg0, arg1, arg2) \
+    STAP_PROBE3(ap, proxy__connect__return, arg0, arg1, arg2)
+#define AP_PROXY_CONNECT_RETURN_ENABLED() \
+    AP_USDT_ENABLED(ap_proxy__connect__return_semaphore)
+
+AP_DECLARE_DATA extern unsigned short ap_timeout__queue__append_semaphore;
+#undef AP_TIMEOUT_QUEUE_APPEND
+#undef AP_TIMEOUT_QUEUE_APPEND_ENABLED
+#define AP_TIMEOUT_QUEUE_APPEND(arg0, arg1, arg2) \
+    STAP_PROBE3(ap, timeout__queue__append, arg0, arg1, arg2)
+#define AP_TIMEOUT_QUEUE_APPEND_ENABLED() \
+    AP_USDT_ENABLED(ap_timeout__queue__append_semaphore)
+
+AP_DECLARE_DATA extern unsigned short ap_timeout__queue__expire_semaphore;
+#undef AP_TIMEOUT_QUEUE_EXPIRE
+#undef AP_TIMEOUT_QUEUE_EXPIRE_ENABLED
+#define AP_TIMEOUT_QUEUE_EXPIRE(arg0, arg1) \
+    STAP_PROBE2(ap, timeout__queue__expire, arg0, arg1)
+#define AP_TIMEOUT_QUEUE_EXPIRE_ENABLED() \
+    AP_USDT_ENABLED(ap_timeout__queue__expire_semaphore)
+
+AP_DECLARE_DATA extern unsigned short ap_timeout__queue__remove_semaphore;
+#undef AP_TIMEOUT_QUEUE_REMOVE
+#undef AP_TIMEOUT_QUEUE_REMOVE_ENABLED
+#define AP_TIMEOUT_QUEUE_REMOVE(arg0, arg1, arg2) \
+    STAP_PROBE3(ap, timeout__queue__remove, arg0, arg1, arg2)
+#define AP_TIMEOUT_QUEUE_REMOVE_ENABLED() \
+    AP_USDT_ENABLED(ap_timeout__queue__remove_semaphore)
+
+AP_DECLARE_DATA extern unsigned short ap_worker__queue__pop_semaphore;
+#undef AP_WORKER_QUEUE_POP
+#undef AP_WORKER_QUEUE_POP_ENABLED
+#define AP_WORKER_QUEUE_POP(arg0, arg1, arg2) \
+    STAP_PROBE3(ap, worker__queue__pop, arg0, arg1, arg2)
+#define AP_WORKER_QUEUE_POP_ENABLED() \
+    AP_USDT_ENABLED(ap_worker__queue__pop_semaphore)
+
+AP_DECLARE_DATA extern unsigned short ap_worker__queue__push_semaphore;
+#undef AP_WORKER_QUEUE_PUSH
+#undef AP_WORKER_QUEUE_PUSH_ENABLED
+#define AP_WORKER_QUEUE_PUSH(arg0, arg1, arg2) \
+    STAP_PROBE3(ap, worker__queue__push, arg0, arg1, arg2)
+#define AP_WORKER_QUEUE_PUSH_ENABLED() \
+    AP_USDT_ENABLED(ap_worker__queue__push_semaphore)
+
+#endif
@@ -440,6 +440,26 @@ typedef struct {
     /** Should addition of charset= be suppressed for this request?
      */
     int suppress_charset;
+
+    /** The time spent in each phase of the request followed by the start
+     * of their first run, NULL until one is recorded, see
+     * ap_request_phase_time() and ap_request_phase_start()
+     */
+    apr_interval_time_t *phase_times;
+
+    /** The end of the handler, for the AP_REQUEST_PHASE_WRITE time */
+    apr_time_t handler_end;
+
+    /** The CPU time used by the handler and output filters, see
+     * ap_request_cpu_time()
+     */
+    apr_interval_time_t cpu_time;
+    /** The thread's CPU time when the outermost accounted call started */
+    apr_interval_time_t cpu_start;
+    /** The nesting of the accounted calls */
+    int cpu_depth;
+    /** The handler the CPU time goes to, NULL until some is accounted */
+    const char *cpu_handler;
 } core_request_config;
 
 /* Standard entries that are guaranteed to be accessible via
@@ -683,6 +703,25 @@ typedef struct {
     apr_hash_t *cgi_var_rules;
 
     apr_size_t read_buf_size;
+
+#define ENABLE_PRECOMPRESSED_OFF    (0)
+#define ENABLE_PRECOMPRESSED_ON     (1)
+#define ENABLE_PRECOMPRESSED_UNSET  (2)
+    /** EnablePrecompressed: serve a fresher .br or .gz sibling of the file */
+    unsigned int enable_precompressed : 2;
+
+#define ETAG_DIGEST_CACHE_OFF    (0)
+#define ETAG_DIGEST_CACHE_XATTR  (1)
+#define ETAG_DIGEST_CACHE_UNSET  (2)
+    /** FileETagDigestCache: keep the digest of FileETag Digest in an
+     * extended attribute of the file */
+    unsigned int etag_digest_cache : 2;
+
+#define EARLY_HINTS_OFF    (0)
+#define EARLY_HINTS_ON     (1)
+#define EARLY_HINTS_UNSET  (2)
+    /** EarlyHints: send the learned preload links in a 103 response */
+    unsigned int early_hints : 2;
 } core_dir_config;
 
 /* macro to implement off by default behaviour */
@@ -768,8 +807,17 @@ typedef struct {
  
     apr_size_t   flush_max_threshold;
     apr_int32_t  flush_max_pipelined;
+    /** FlushMaxMemory, for all the connections of a child */
+    apr_size_t   flush_max_memory;
     unsigned int strict_host_check;
     unsigned int merge_slashes;
+
+    /** RequestTablesAutoSize */
+    unsigned int request_tables_autosize;
+    /** Moving averages of the number of entries in the request tables,
+     *  updated at runtime when request_tables_autosize is on */
+#define AP_REQUEST_TABLES_NUM 4
+    apr_uint32_t *request_tables_sizes;
 } core_server_config;
 
 /* for AddOutputFiltersByType in core.c */
@@ -792,6 +840,18 @@ apr_status_t ap_core_input_filter(ap_filter_t *f, apr_bucket_brigade *b,
 apr_status_t ap_core_output_filter(ap_filter_t *f, apr_bucket_brigade *b);
 
 
+/**
+ * apr_stat() through the child's stat cache, if StatCache is enabled.
+ * The results (negative ones included) may be up to the StatCache TTL old.
+ * @param finfo Where to store the information about the file
+ * @param fname The name of the file to stat
+ * @param wanted The desired apr_finfo_t fields, as a bit flag of APR_FINFO_*
+ * @param p The pool to use for the returned information
+ * @return The status of the (possibly cached) apr_stat()
+ */
+AP_DECLARE(apr_status_t) ap_stat_cached(apr_finfo_t *finfo, const char *fname,
+                                        apr_int32_t wanted, apr_pool_t *p);
+
 AP_DECLARE(const char*) ap_get_server_protocol(server_rec* s);
 AP_DECLARE(void) ap_set_server_protocol(server_rec* s, const char* proto);
 
@@ -318,6 +318,18 @@ int ap_open_logs(apr_pool_t *pconf, apr_pool_t *plog,
  */
 void ap_logs_child_init(apr_pool_t *p, server_rec *s);
 
+#if APR_HAS_THREADS
+/**
+ * Set the ErrorLogAsync directive: whether (and how) the children of
+ * threaded MPMs queue the lines for the error log files to a writer thread.
+ * @note ap_set_error_log_async is not for use by modules; it is an
+ * internal core function
+ */
+const char *ap_set_error_log_async(cmd_parms *cmd, void *dummy,
+                                   const char *arg1, const char *arg2,
+                                   const char *arg3);
+#endif
+
 /*
  * The primary logging functions, ap_log_error, ap_log_rerror, ap_log_cerror,
  * and ap_log_perror use a printf style format string to build the log message.
@@ -816,6 +828,31 @@ AP_DECLARE(apr_file_t *) ap_piped_log_read_fd(piped_log *pl);
  */
 AP_DECLARE(apr_file_t *) ap_piped_log_write_fd(piped_log *pl);
 
+/**
+ * Write to a piped log, through its shared memory ring when the logging
+ * process reads one (see PipedLogRing), else through the pipe
+ * @param pl The piped log structure
+ * @param buf The data to write, one or more whole lines
+ * @param len The length of the data
+ * @return APR_SUCCESS, or the error of the write to the pipe
+ * @note Unlike the writes to ap_piped_log_write_fd(), the lines written by
+ * this function may reach the logging process in a different order than
+ * they were written, when the ring is full.
+ */
+AP_DECLARE(apr_status_t) ap_piped_log_write(piped_log *pl, const char *buf,
+                                            apr_size_t len);
+
+#if defined(AP_HAVE_RELIABLE_PIPED_LOGS) && APR_HAS_SHARED_MEMORY
+/**
+ * Set the PipedLogRing directive: the size of the shared memory ring
+ * created for each (reliable) piped log.
+ * @note ap_set_piped_log_ring is not for use by modules; it is an
+ * internal core function
+ */
+const char *ap_set_piped_log_ring(cmd_parms *cmd, void *dummy,
+                                  const char *arg);
+#endif
+
 /**
  * hook method to generate unique id for connection or request
  * @ingroup hooks
@@ -122,6 +122,55 @@ AP_DECLARE(void) ap_get_mime_headers(request_rec *r);
 AP_DECLARE(void) ap_get_mime_headers_core(request_rec *r,
                                           apr_bucket_brigade *bb);
 
+/**
+ * Well-known request header fields, looked up in constant time with
+ * ap_get_request_header().
+ */
+typedef enum {
+    AP_HDR_ACCEPT_ENCODING,
+    AP_HDR_AUTHORIZATION,
+    AP_HDR_CACHE_CONTROL,
+    AP_HDR_CONNECTION,
+    AP_HDR_CONTENT_LENGTH,
+    AP_HDR_CONTENT_TYPE,
+    AP_HDR_COOKIE,
+    AP_HDR_EXPECT,
+    AP_HDR_HOST,
+    AP_HDR_IF_MATCH,
+    AP_HDR_IF_MODIFIED_SINCE,
+    AP_HDR_IF_NONE_MATCH,
+    AP_HDR_IF_RANGE,
+    AP_HDR_IF_UNMODIFIED_SINCE,
+    AP_HDR_PRAGMA,
+    AP_HDR_RANGE,
+    AP_HDR_REFERER,
+    AP_HDR_TRANSFER_ENCODING,
+    AP_HDR_UPGRADE,
+    AP_HDR_USER_AGENT,
+    AP_HDR_VIA,
+    AP_HDR_COUNT            /* number of ids, not a header */
+} ap_header_id_e;
+
+/**
+ * Get a well-known field of r->headers_in, as apr_table_get() would.
+ * The positions of these fields are indexed when the headers are read
+ * (or on first use), so that the lookup is constant time while the table
+ * is unchanged. Changes made to the table by any means are detected and
+ * the index is rebuilt.
+ * @param r The current request
+ * @param id The header field
+ * @return The value of the (first) field, or NULL if absent
+ */
+AP_DECLARE(const char *) ap_get_request_header(request_rec *r,
+                                               ap_header_id_e id);
+
+/**
+ * Get the name of a well-known header field
+ * @param id The header field
+ * @return The name, e.g. "Host" for AP_HDR_HOST
+ */
+AP_DECLARE(const char *) ap_get_request_header_name(ap_header_id_e id);
+
 /**
  * Run post_read_request hook and validate.
  * @param r The current request
@@ -65,6 +65,106 @@ extern "C" {
  */
 AP_DECLARE(int) ap_process_request_internal(request_rec *r);
 
+/**
+ * The phases of a request whose durations are recorded, as given by
+ * ap_request_phase_time().
+ */
+typedef enum {
+    AP_REQUEST_PHASE_TRANSLATE,     /**< URI decoding, (pre_)translate_name */
+    AP_REQUEST_PHASE_MAP_TO_STORAGE,/**< map_to_storage and the walks */
+    AP_REQUEST_PHASE_HEADER_PARSER, /**< header_parser */
+    AP_REQUEST_PHASE_ACCESS,        /**< access_checker(_ex) */
+    AP_REQUEST_PHASE_AUTHN,         /**< check_user_id */
+    AP_REQUEST_PHASE_AUTHZ,         /**< auth_checker */
+    AP_REQUEST_PHASE_TYPE,          /**< type_checker */
+    AP_REQUEST_PHASE_FIXUPS,        /**< fixups */
+    AP_REQUEST_PHASE_HANDLER,       /**< handler, output filters included */
+    AP_REQUEST_PHASE_OUTPUT,        /**< output filters called by the handler */
+    AP_REQUEST_PHASE_WRITE,         /**< from the end of the handler until the
+                                     *   response is written to the client */
+    AP_REQUEST_PHASE_COUNT
+} ap_request_phase_e;
+
+/**
+ * Add the time elapsed since start to a phase of a request. The time of
+ * an internal redirect goes to the initial request, while a subrequest
+ * has its own.
+ * @param r The request
+ * @param phase The phase
+ * @param start The start of the phase, as given by ap_time_monotonic()
+ * @return The current time, as given by ap_time_monotonic()
+ */
+AP_DECLARE(apr_time_t) ap_request_phase_add(request_rec *r,
+                                            ap_request_phase_e phase,
+                                            apr_time_t start);
+
+/**
+ * Account the time elapsed since the end of the handler of a request to
+ * the AP_REQUEST_PHASE_WRITE phase, once its response is completely sent.
+ * @param r The request
+ */
+AP_DECLARE(void) ap_request_phase_sent(request_rec *r);
+
+/**
+ * Get the time spent in a phase of a request.
+ * @param r The request
+ * @param phase The phase
+ * @return The time in microseconds, or -1 if the phase did not run
+ */
+AP_DECLARE(apr_interval_time_t) ap_request_phase_time(const request_rec *r,
+                                                      ap_request_phase_e phase);
+
+/**
+ * Get the start of the first run of a phase of a request.
+ * @param r The request
+ * @param phase The phase
+ * @return The start, as given by ap_time_monotonic(), or 0 if the phase
+ *         did not run
+ */
+AP_DECLARE(apr_time_t) ap_request_phase_start(const request_rec *r,
+                                              ap_request_phase_e phase);
+
+/**
+ * Get the name of a phase of a request, as used in the logs.
+ * @param phase The phase
+ * @return The name, or NULL for an invalid phase
+ */
+AP_DECLARE(const char *) ap_request_phase_name(ap_request_phase_e phase);
+
+/**
+ * Get the phase of a request from its name.
+ * @param name The name, case insensitive
+ * @return The phase, or -1 if it's not known
+ */
+AP_DECLARE(int) ap_request_phase_lookup(const char *name);
+
+/**
+ * Start accounting the CPU time of the calling thread to a request, for
+ * the outermost of nested calls. Subrequests and internal redirects
+ * account to the initial request. Does nothing unless ExtendedStatus is
+ * on.
+ * @param r The request
+ */
+AP_DECLARE(void) ap_request_cpu_enter(request_rec *r);
+
+/**
+ * Stop accounting the CPU time of the calling thread to a request, see
+ * ap_request_cpu_enter().
+ * @param r The request
+ */
+AP_DECLARE(void) ap_request_cpu_leave(request_rec *r);
+
+/**
+ * Get the CPU time used by the handler and the output filters of a
+ * request.
+ * @param r The request
+ * @param handler Set to the handler the time goes to (empty if none ran),
+ *        may be NULL
+ * @return The time in microseconds, or -1 if none was accounted
+ */
+AP_DECLARE(apr_interval_time_t) ap_request_cpu_time(const request_rec *r,
+                                                    const char **handler);
+
 /**
  * Create a subrequest from the given URI.  This subrequest can be
  * inspected to find information about the requested URI
@@ -227,6 +327,29 @@ AP_DECLARE(void) ap_clear_auth_internal(void);
  */
 AP_DECLARE(void) ap_setup_auth_internal(apr_pool_t *ptemp);
 
+/**
+ * Set up the child's cache of merged configuration sections used by the
+ * location, directory, file and if walks.
+ * @param pchild The child pool the cache is allocated from
+ * @param s The first server of the configuration
+ * @param max_entries Maximum number of merges kept, 0 disables the cache
+ */
+AP_DECLARE(void) ap_init_merge_cache(apr_pool_t *pchild, server_rec *s,
+                                     int max_entries);
+
+/**
+ * Merge the configuration sections most requests use, in the parent after
+ * post_config, so that the children share these merges rather than doing
+ * them each.
+ * @param pconf The configuration pool the merges are allocated from
+ * @param ptemp Pool used for temporary allocations
+ * @param s The first server of the configuration
+ * @param max_entries Maximum number of merges preloaded, 0 disables it
+ */
+AP_DECLARE(void) ap_preload_merge_cache(apr_pool_t *pconf,
+                                        apr_pool_t *ptemp,
+                                        server_rec *s, int max_entries);
+
 /**
  * Register an authentication or authorization provider with the global
  * provider pool.
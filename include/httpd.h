@@ -1152,6 +1152,9 @@ struct request_rec {
      * to conclude that no body is there.
      */
     int body_indeterminate;
+    /** Positions of the well-known fields in headers_in, private to
+     * ap_get_request_header() */
+    struct ap_header_index_t *headers_in_index;
 };
 
 /**
@@ -1720,6 +1723,15 @@ AP_DECLARE(int) ap_find_etag_strong(apr_pool_t *p, const char *line, const char
  */
 AP_DECLARE(const char *) ap_scan_http_field_content(const char *ptr);
 
+/* Scan a buffer for field content chars, as ap_scan_http_field_content()
+ * but bounded by the given length rather than a NUL terminator
+ * @param ptr The buffer to scan
+ * @param len The length of the buffer
+ * @return The offset of the first (non-HT) ASCII ctrl character, or len.
+ */
+AP_DECLARE(apr_size_t) ap_scan_http_field_content_len(const char *ptr,
+                                                      apr_size_t len);
+
 /* Scan a string for token characters, as defined by RFC7230 section 3.2.6 
  * @param ptr The string to scan
  * @return A pointer to the first non-token character.
@@ -2569,6 +2581,28 @@ AP_DECLARE(void *) ap_realloc(void *ptr, size_t size)
                    AP_FN_ATTR_WARN_UNUSED_RESULT
                    AP_FN_ATTR_ALLOC_SIZE(2);
 
+/** Ask for the shared memory segments to use huge pages */
+#define AP_SHM_HUGEPAGES 0x01
+/** Fault in the pages of the shared memory segments when created */
+#define AP_SHM_PREFAULT  0x02
+
+/**
+ * Set how ap_shm_advise() prepares the shared memory segments, from the
+ * SharedMemoryOptions directive
+ * @param flags AP_SHM_HUGEPAGES and/or AP_SHM_PREFAULT, or zero
+ */
+AP_DECLARE(void) ap_shm_set_flags(int flags);
+
+/**
+ * Prepare a newly created shared memory segment as configured, before
+ * it is first written to
+ * @param base The base address of the segment
+ * @param size The size of the segment
+ * @note The huge pages are transparent huge pages, used only where the
+ * system enables them for shared memory on request (madvise).
+ */
+AP_DECLARE(void) ap_shm_advise(void *base, apr_size_t size);
+
 #if APR_HAS_THREADS
 
 /* apr_thread_create() wrapper that handles thread pool limits and
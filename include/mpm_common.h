@@ -383,6 +383,49 @@ AP_DECLARE_DATA extern apr_size_t ap_thread_stacksize;
 extern const char *ap_mpm_set_thread_stacksize(cmd_parms *cmd, void *dummy,
                                                const char *arg);
 
+/* The number of worker threads of each child which only accept the
+ * connections of the Listen options=priority listeners (PriorityWorkers) */
+AP_DECLARE_DATA extern int ap_priority_workers;
+extern const char *ap_mpm_set_priority_workers(cmd_parms *cmd, void *dummy,
+                                               const char *arg);
+
+extern const char *ap_mpm_set_child_cpu_affinity(cmd_parms *cmd, void *dummy,
+                                                 int argc,
+                                                 char *const argv[]);
+/**
+ * Bind the calling child process to its ChildCPUAffinity CPU set, if any.
+ * MPMs should call this before allocating the child's memory, so that the
+ * pages are first touched (hence allocated) on the bound NUMA node.
+ * @param s The server_rec for logging
+ * @param child_slot The child's scoreboard slot
+ * @param child_bucket The child's listeners bucket
+ * @param num_buckets The number of listeners buckets
+ * @return 1 if the child was bound, 0 otherwise
+ */
+extern int ap_mpm_child_cpu_affinity(server_rec *s, int child_slot,
+                                     int child_bucket, int num_buckets);
+
+/**
+ * Find the listeners bucket whose children ap_mpm_child_cpu_affinity()
+ * binds to a CPU set containing the given CPU. When several buckets are
+ * bound to that set, the CPUs of the set are spread across them.
+ * @param cpu The CPU number
+ * @param num_buckets The number of listeners buckets
+ * @return The bucket, or -1 without ChildCPUAffinity or when no bucket is
+ *         bound to the CPU
+ */
+extern int ap_mpm_cpu_bucket(int cpu, int num_buckets);
+
+/**
+ * Create a pool with its own (thread-safe) allocator, so that its memory
+ * is not recycled from the parent's but first touched by the caller.
+ * @param pool The new pool
+ * @param parent The parent pool
+ * @return APR_SUCCESS or an APR error
+ */
+extern apr_status_t ap_mpm_create_local_pool(apr_pool_t **pool,
+                                             apr_pool_t *parent);
+
 /* core's implementation of child_status hook */
 extern void ap_core_child_status(server_rec *s, pid_t pid, ap_generation_t gen,
                                  int slot, mpm_child_status status);
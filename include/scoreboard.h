@@ -33,6 +33,7 @@ extern "C" {
 
 #include "ap_config.h"
 #include "http_config.h"
+#include "http_request.h"
 #include "apr_thread_proc.h"
 #include "apr_portable.h"
 #include "apr_shm.h"
@@ -85,6 +86,36 @@ typedef enum {
     SB_SHARED = 2
 } ap_scoreboard_e;
 
+/* ExtendedStatus Lazy: the request, client, vhost and protocol strings
+ * of the workers are only updated for AP_SB_LAZY_STATUS_WINDOW after the
+ * status was last viewed (global_score.status_time).
+ */
+#define AP_EXTENDED_STATUS_LAZY 2
+#ifndef AP_SB_LAZY_STATUS_WINDOW
+#define AP_SB_LAZY_STATUS_WINDOW apr_time_from_sec(300)
+#endif
+
+/* The worker_score of each thread is written on every request, this is
+ * the size of the padding keeping those of the adjacent threads off the
+ * same cache lines.
+ */
+#ifndef AP_SB_CACHELINE_SIZE
+#define AP_SB_CACHELINE_SIZE 64
+#endif
+
+/* Histogram of the requests served by a worker, with buckets of
+ * increasing width: the values below 2^(AP_SB_HIST_SUB_BITS + 1) have
+ * their own bucket, and each power of two above is split in
+ * 2^AP_SB_HIST_SUB_BITS buckets, so that the values within a bucket are at
+ * most 25% apart.  The last bucket also counts the larger values.
+ */
+#define AP_SB_HIST_SUB_BITS 2
+#define AP_SB_HIST_BUCKETS  128
+
+typedef struct {
+    apr_uint32_t count[AP_SB_HIST_BUCKETS];
+} ap_sb_histogram;
+
 /* stuff which is worker specific */
 typedef struct worker_score worker_score;
 struct worker_score {
@@ -118,6 +149,12 @@ struct worker_score {
     char protocol[16];          /* What protocol is used on the connection? */
     char client64[64];
     apr_time_t duration;
+    ap_sb_histogram req_time_hist;  /* request time in microseconds */
+    ap_sb_histogram bytes_hist;     /* bytes sent per request */
+    /* time spent in each phase of the requests, and how many ran it */
+    apr_time_t phase_time[AP_REQUEST_PHASE_COUNT];
+    unsigned long phase_count[AP_REQUEST_PHASE_COUNT];
+    char pad[AP_SB_CACHELINE_SIZE];
 };
 
 typedef struct {
@@ -130,6 +167,9 @@ typedef struct {
 #ifdef HAVE_TIMES
     struct tms times;
 #endif
+    apr_time_t status_time;  /* last time the status of the workers was
+                              * viewed, for ExtendedStatus Lazy
+                              */
 } global_score;
 
 /* stuff which the parent generally writes and the children rarely read */
@@ -148,6 +188,12 @@ struct process_score {
     apr_uint32_t lingering_close;   /* async connections in lingering close */
     apr_uint32_t keep_alive;        /* async connections in keep alive */
     apr_uint32_t suspended;         /* connections suspended by some module */
+    apr_uint32_t queues_contention; /* contended timeout queues locks (for
+                                     * async MPMs)
+                                     */
+    apr_uint64_t setaside_bytes;    /* memory set aside by the connections'
+                                     * filters (for async MPMs)
+                                     */
 };
 
 /* Scoreboard is now in 'local' memory, since it isn't updated once created,
@@ -197,6 +243,33 @@ AP_DECLARE(int) ap_update_child_status_descr(ap_sb_handle_t *sbh, int status, co
 
 AP_DECLARE(void) ap_time_process_request(ap_sb_handle_t *sbh, int status);
 
+/**
+ * Count a value in a scoreboard histogram.  Each worker only updates its
+ * own histograms, so this does not synchronize.
+ * @param hist The histogram
+ * @param value The value
+ */
+AP_DECLARE(void) ap_sb_hist_add(ap_sb_histogram *hist, apr_uint64_t value);
+
+/**
+ * Estimate a percentile of the values counted in a histogram.
+ * @param hist The histogram, possibly the sum of those of several workers
+ * @param fraction The percentile as a fraction, e.g. 0.99 for p99
+ * @return The upper bound of the bucket holding the percentile, or 0 if
+ *         the histogram is empty
+ */
+AP_DECLARE(apr_uint64_t) ap_sb_hist_percentile(const ap_sb_histogram *hist,
+                                               double fraction);
+
+/**
+ * Return the share of the server's workers (MaxRequestWorkers) busy
+ * handling a connection or a request, from 0 to 100.  The scoreboard is
+ * walked at most every 100ms, so this is cheap enough to be called for
+ * each request, e.g. to shed optional work under load.
+ * @return The percentage of busy workers
+ */
+AP_DECLARE(int) ap_sb_busy_percent(void);
+
 AP_DECLARE(int) ap_update_global_status(void);
 
 AP_DECLARE(worker_score *) ap_get_scoreboard_worker(ap_sb_handle_t *sbh);
@@ -231,7 +304,8 @@ AP_DECLARE_DATA extern int ap_mod_status_reqtail;
  * Command handlers [internal]
  */
 const char *ap_set_scoreboard(cmd_parms *cmd, void *dummy, const char *arg);
-const char *ap_set_extended_status(cmd_parms *cmd, void *dummy, int arg);
+const char *ap_set_extended_status(cmd_parms *cmd, void *dummy,
+                                   const char *arg);
 const char *ap_set_reqtail(cmd_parms *cmd, void *dummy, int arg);
 
 /* Hooks */
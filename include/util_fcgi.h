@@ -143,6 +143,26 @@ typedef struct {
 #define AP_FCGI_BRB_RESERVED3_OFFSET    6
 #define AP_FCGI_BRB_RESERVED4_OFFSET    7
 
+/*
+ * Values for the protocolStatus component of the content data of the
+ * FastCGI record when the type is AP_FCGI_END_REQUEST
+ */
+#define AP_FCGI_REQUEST_COMPLETE  0
+#define AP_FCGI_CANT_MPX_CONN     1
+#define AP_FCGI_OVERLOADED        2
+#define AP_FCGI_UNKNOWN_ROLE      3
+
+/**
+ * Offsets of the various fields of the content data of the FastCGI
+ * record when the type is AP_FCGI_END_REQUEST
+ */
+#define AP_FCGI_ERB_APPSTATUSB3_OFFSET     0
+#define AP_FCGI_ERB_APPSTATUSB2_OFFSET     1
+#define AP_FCGI_ERB_APPSTATUSB1_OFFSET     2
+#define AP_FCGI_ERB_APPSTATUSB0_OFFSET     3
+#define AP_FCGI_ERB_PROTOCOLSTATUS_OFFSET  4
+#define AP_FCGI_ERB_LEN                    8
+
 /**
  * Pack ap_fcgi_header
  * @param h The header to read from
@@ -515,6 +515,9 @@ AP_DECLARE(ap_filter_rec_t *) ap_get_output_filter_handle(const char *name);
  * Remove an input filter from either the request or connection stack
  * it is associated with.
  * @param f The filter to remove
+ * @remark A filter which decides that it has nothing to do can remove
+ * itself while it's called, before calling ap_get_brigade(f->next, ...),
+ * so that it's not in the path of the next reads.
  */
 
 AP_DECLARE(void) ap_remove_input_filter(ap_filter_t *f);
@@ -523,6 +526,10 @@ AP_DECLARE(void) ap_remove_input_filter(ap_filter_t *f);
  * Remove an output filter from either the request or connection stack
  * it is associated with.
  * @param f The filter to remove
+ * @remark A filter which decides that it has nothing to do can remove
+ * itself while it's called, before calling ap_pass_brigade(f->next, ...),
+ * so that it's not in the path of the next brigades. This also discards
+ * what it may have set aside with ap_filter_setaside_brigade().
  */
 
 AP_DECLARE(void) ap_remove_output_filter(ap_filter_t *f);
@@ -644,6 +651,24 @@ AP_DECLARE(void) ap_filter_adopt_brigade(ap_filter_t *f,
  */
 AP_DECLARE(int) ap_filter_should_yield(ap_filter_t *f);
 
+/**
+ * Get the number of bytes in memory set aside by the filters of a
+ * connection, with ap_filter_setaside_brigade() or
+ * ap_filter_adopt_brigade(). FILE and opaque buckets are not counted.
+ *
+ * @param c The connection.
+ * @return The number of bytes.
+ */
+AP_DECLARE(apr_size_t) ap_filter_conn_setaside_bytes(conn_rec *c);
+
+/**
+ * Get the number of bytes in memory set aside by the filters of all the
+ * connections of the child, as limited by FlushMaxMemory.
+ *
+ * @return The number of bytes.
+ */
+AP_DECLARE(apr_uint64_t) ap_filter_child_setaside_bytes(void);
+
 /**
  * This function determines whether there is unwritten data in the output
  * filters, and if so, attempts to make a single write to each filter
@@ -667,6 +692,16 @@ AP_DECLARE_NONSTD(int) ap_filter_output_pending(conn_rec *c);
  */
 AP_DECLARE_NONSTD(int) ap_filter_input_pending(conn_rec *c);
 
+/**
+ * Same as ap_filter_input_pending(), but without recycling the filters
+ * removed from the connection, so that it can be called from a filter.
+ *
+ * @param c The connection.
+ * @return OK if some data are pending in the input filters, DECLINED
+ * otherwise.
+ */
+AP_DECLARE(int) ap_filter_has_input_pending(conn_rec *c);
+
 /**
  * Flush function for apr_brigade_* calls.  This calls ap_pass_brigade
  * to flush the brigade if the brigade buffer overflows.
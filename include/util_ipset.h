@@ -0,0 +1,90 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @file  util_ipset.h
+ * @brief Sets of IP subnets
+ *
+ * @defgroup APACHE_CORE_IPSET IP Subnet Sets
+ * @ingroup  APACHE_CORE
+ * @{
+ */
+
+#ifndef APACHE_UTIL_IPSET_H
+#define APACHE_UTIL_IPSET_H
+
+#include "httpd.h"
+#include "apr_network_io.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * A set of IPv4 and IPv6 subnets, as accepted by apr_ipsubnet_create(),
+ * which an address can be tested against in a time that does not depend
+ * on the number of subnets (but on the number of distinct prefix lengths).
+ */
+typedef struct ap_ipset_t ap_ipset_t;
+
+/**
+ * Create an empty set of subnets.
+ * @param p The pool to allocate the set and its subnets from
+ * @return The set
+ */
+AP_DECLARE(ap_ipset_t *) ap_ipset_make(apr_pool_t *p);
+
+/**
+ * Add a subnet to a set.
+ * @param set The set
+ * @param ipstr The IP address or partial address of the subnet, as for
+ *              apr_ipsubnet_create()
+ * @param mask_or_numbits The mask or the number of bits of the subnet,
+ *                        or NULL for the whole (partial) address
+ * @param data Some data associated with the subnet, as returned by
+ *             ap_ipset_match(); when the same address matches several
+ *             subnets of the set, the first one added is returned
+ * @return APR_SUCCESS, or the error returned by apr_ipsubnet_create()
+ */
+AP_DECLARE(apr_status_t) ap_ipset_add(ap_ipset_t *set, const char *ipstr,
+                                      const char *mask_or_numbits,
+                                      const void *data);
+
+/**
+ * Test whether an address is in one of the subnets of a set, with the
+ * same rules as apr_ipsubnet_test() (notably an IPv4-mapped IPv6 address
+ * matches the IPv4 subnets).
+ * @param set The set
+ * @param sa The address
+ * @param data If not NULL, set to the data of the matching subnet
+ * @return non-zero if the address matches, zero otherwise
+ */
+AP_DECLARE(int) ap_ipset_match(const ap_ipset_t *set, apr_sockaddr_t *sa,
+                               const void **data);
+
+/**
+ * Get the number of subnets in a set.
+ * @param set The set
+ * @return The number of subnets added to the set
+ */
+AP_DECLARE(int) ap_ipset_count(const ap_ipset_t *set);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* !APACHE_UTIL_IPSET_H */
+/** @} */
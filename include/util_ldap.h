@@ -180,6 +180,8 @@ typedef struct util_ldap_state_t {
     apr_interval_time_t connection_pool_ttl;
     int retries;                        /* number of retries for failed bind/search/compare */
     apr_interval_time_t retry_delay;    /* delay between retries of failed bind/search/compare */
+    long search_cache_stale;    /* how long expired search cache entries
+                                 * can be used when the server is down */
 } util_ldap_state_t;
 
 /* Used to store arrays of attribute labels/values. */
@@ -115,6 +115,20 @@ AP_DECLARE(apr_status_t) ap_recent_rfc822_date(char *date_str, apr_time_t t);
  */
 AP_DECLARE(void) ap_force_set_tz(apr_pool_t *p);
 
+/**
+ * Get the current time of a monotonic clock, unaffected by the changes
+ * of the system time, which is meaningful for measuring intervals only.
+ * @return The time in microseconds, from some unspecified point
+ * @note Falls back to apr_time_now() where no monotonic clock is available.
+ */
+AP_DECLARE(apr_time_t) ap_time_monotonic(void);
+
+/**
+ * Get the CPU time used so far by the calling thread.
+ * @return The time in microseconds, or -1 if it's not available
+ */
+AP_DECLARE(apr_interval_time_t) ap_time_thread_cpu(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -601,6 +601,14 @@ SOURCE=.\include\util_filter.h
 # End Source File
 # Begin Source File
 
+SOURCE=.\server\util_ipset.c
+# End Source File
+# Begin Source File
+
+SOURCE=.\include\util_ipset.h
+# End Source File
+# Begin Source File
+
 SOURCE=.\server\util_md5.c
 # End Source File
 # Begin Source File
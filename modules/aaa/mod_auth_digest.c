@@ -153,6 +153,7 @@ typedef struct digest_header_struct {
     int                   needed_auth;
     const char           *ha1;
     client_entry         *client;
+    unsigned long         client_nc;    /* the nonce-count of this request */
 } digest_header_rec;
 
 
@@ -173,6 +174,13 @@ static unsigned long  *opaque_cntr;
 static apr_time_t     *otn_counter;     /* one-time-nonce counter */
 static apr_global_mutex_t *client_lock = NULL;
 static apr_global_mutex_t *opaque_lock = NULL;
+
+/* The buckets of the client list are locked by stripes, client_lock only
+ * protects the allocations and the counters.
+ */
+#define NUM_BUCKET_LOCKS 8
+static apr_global_mutex_t *bucket_locks[NUM_BUCKET_LOCKS];
+#define BUCKET_LOCK(bucket) (bucket_locks[(bucket) % NUM_BUCKET_LOCKS])
 static const char     *client_mutex_type = "authdigest-client";
 static const char     *opaque_mutex_type = "authdigest-opaque";
 static const char     *client_shm_filename;
@@ -193,6 +201,8 @@ module AP_MODULE_DECLARE_DATA auth_digest_module;
 
 static apr_status_t cleanup_tables(void *not_used)
 {
+    int i;
+
     ap_log_error(APLOG_MARK, APLOG_INFO, 0, NULL, APLOGNO(01756)
                   "cleaning up shared memory");
 
@@ -216,6 +226,13 @@ static apr_status_t cleanup_tables(void *not_used)
         opaque_lock = NULL;
     }
 
+    for (i = 0; i < NUM_BUCKET_LOCKS; i++) {
+        if (bucket_locks[i]) {
+            apr_global_mutex_destroy(bucket_locks[i]);
+            bucket_locks[i] = NULL;
+        }
+    }
+
     client_list = NULL;
 
     return APR_SUCCESS;
@@ -256,6 +273,7 @@ static int initialize_tables(server_rec *s, apr_pool_t *ctx)
 {
     unsigned long idx;
     apr_status_t   sts;
+    int i;
 
     /* set up client list */
 
@@ -265,6 +283,9 @@ static int initialize_tables(server_rec *s, apr_pool_t *ctx)
     client_rmm = NULL;
     client_lock = NULL;
     opaque_lock = NULL;
+    for (i = 0; i < NUM_BUCKET_LOCKS; i++) {
+        bucket_locks[i] = NULL;
+    }
     client_list = NULL;
 
     /*
@@ -322,6 +343,15 @@ static int initialize_tables(server_rec *s, apr_pool_t *ctx)
         log_error_and_cleanup("failed to create lock (client_lock)", sts, s);
         return !OK;
     }
+    for (i = 0; i < NUM_BUCKET_LOCKS; i++) {
+        sts = ap_global_mutex_create(&bucket_locks[i], NULL, client_mutex_type,
+                                     apr_itoa(ctx, i), s, ctx, 0);
+        if (sts != APR_SUCCESS) {
+            log_error_and_cleanup("failed to create lock (bucket_locks)",
+                                  sts, s);
+            return !OK;
+        }
+    }
 
 
     /* setup opaque */
@@ -420,6 +450,7 @@ static int initialize_module(apr_pool_t *p, apr_pool_t *plog,
 static void initialize_child(apr_pool_t *p, server_rec *s)
 {
     apr_status_t sts;
+    int i;
 
     if (!client_shm) {
         return;
@@ -449,6 +480,16 @@ static void initialize_child(apr_pool_t *p, server_rec *s)
         log_error_and_cleanup("failed to create lock (opaque_lock)", sts, s);
         return;
     }
+    for (i = 0; i < NUM_BUCKET_LOCKS; i++) {
+        sts = apr_global_mutex_child_init(&bucket_locks[i],
+                                  apr_global_mutex_lockfile(bucket_locks[i]),
+                                  p);
+        if (sts != APR_SUCCESS) {
+            log_error_and_cleanup("failed to create lock (bucket_locks)",
+                                  sts, s);
+            return;
+        }
+    }
 }
 
 /*
@@ -745,10 +786,12 @@ static const command_rec digest_cmds[] =
 
 /*
  * Get the client given its client number (the key). Returns the entry,
- * or NULL if it's not found.
+ * or NULL if it's not found. If nc is not NULL, the nonce-count of the
+ * entry is incremented and its new value stored in *nc.
  *
- * Access to the list itself is synchronized via locks. However, access
- * to the entry returned by get_client() is NOT synchronized. This means
+ * Access to the list itself is synchronized via locks, per stripe of
+ * buckets. However, other accesses to the entry returned by get_client()
+ * are NOT synchronized. This means
  * that there are potentially problems if a client uses multiple,
  * simultaneous connections to access url's within the same protection
  * space. However, these problems are not new: when using multiple
@@ -756,7 +799,8 @@ static const command_rec digest_cmds[] =
  * processed anyway, so you have problems with the nonce-count and
  * one-time nonces anyway.
  */
-static client_entry *get_client(unsigned long key, const request_rec *r)
+static client_entry *get_client(unsigned long key, const request_rec *r,
+                                unsigned long *nc)
 {
     int bucket;
     client_entry *entry, *prev = NULL;
@@ -765,10 +809,10 @@ static client_entry *get_client(unsigned long key, const request_rec *r)
     if (!key || !client_shm)  return NULL;
 
     bucket = key % client_list->tbl_len;
-    entry  = client_list->table[bucket];
 
-    apr_global_mutex_lock(client_lock);
+    apr_global_mutex_lock(BUCKET_LOCK(bucket));
 
+    entry  = client_list->table[bucket];
     while (entry && key != entry->key) {
         prev  = entry;
         entry = entry->next;
@@ -780,7 +824,11 @@ static client_entry *get_client(unsigned long key, const request_rec *r)
         client_list->table[bucket] = entry;
     }
 
-    apr_global_mutex_unlock(client_lock);
+    if (entry && nc) {
+        *nc = ++entry->nonce_count;
+    }
+
+    apr_global_mutex_unlock(BUCKET_LOCK(bucket));
 
     if (entry) {
         ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(01764)
@@ -797,7 +845,8 @@ static client_entry *get_client(unsigned long key, const request_rec *r)
 
 /* A simple garbage-collecter to remove unused clients. It removes the
  * last entry in each bucket and updates the counters. Returns the
- * number of removed entries.
+ * number of removed entries. Called with client_lock held, it skips the
+ * buckets whose lock is busy rather than waiting for them.
  */
 static long gc(server_rec *s)
 {
@@ -807,11 +856,16 @@ static long gc(server_rec *s)
     /* garbage collect all last entries */
 
     for (idx = 0; idx < client_list->tbl_len; idx++) {
+        if (apr_global_mutex_trylock(BUCKET_LOCK(idx)) != APR_SUCCESS) {
+            continue;
+        }
+
         entry = client_list->table[idx];
         prev  = NULL;
 
         if (!entry) {
             /* This bucket is empty. */
+            apr_global_mutex_unlock(BUCKET_LOCK(idx));
             continue;
         }
 
@@ -825,6 +879,8 @@ static long gc(server_rec *s)
         else {
             client_list->table[idx] = NULL;
         }
+        apr_global_mutex_unlock(BUCKET_LOCK(idx));
+
         if (entry) {                    /* remove entry */
             apr_status_t err;
 
@@ -887,16 +943,20 @@ static client_entry *add_client(unsigned long key, client_entry *info,
         }
     }
 
+    client_list->num_created++;
+    client_list->num_entries++;
+
+    apr_global_mutex_unlock(client_lock);
+
     /* now add the entry */
 
     memcpy(entry, info, sizeof(client_entry));
     entry->key  = key;
+
+    apr_global_mutex_lock(BUCKET_LOCK(bucket));
     entry->next = client_list->table[bucket];
     client_list->table[bucket] = entry;
-    client_list->num_created++;
-    client_list->num_entries++;
-
-    apr_global_mutex_unlock(client_lock);
+    apr_global_mutex_unlock(BUCKET_LOCK(bucket));
 
     ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(01768)
                  "allocated new client %lu", key);
@@ -1057,10 +1117,8 @@ static int parse_hdr_and_update_nc(request_rec *r)
     ap_set_module_config(r->request_config, &auth_digest_module, resp);
 
     res = get_digest_rec(r, resp);
-    resp->client = get_client(resp->opaque_num, r);
-    if (res == OK && resp->client) {
-        resp->client->nonce_count++;
-    }
+    resp->client = get_client(resp->opaque_num, r,
+                              res == OK ? &resp->client_nc : NULL);
 
     return DECLINED;
 }
@@ -1409,11 +1467,10 @@ static int check_nc(const request_rec *r, const digest_header_rec *resp,
         return !OK;
     }
 
-    if (nc != resp->client->nonce_count) {
+    if (nc != resp->client_nc) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01774)
                       "Warning, possible replay attack: nonce-count "
-                      "check failed: %lu != %lu", nc,
-                      resp->client->nonce_count);
+                      "check failed: %lu != %lu", nc, resp->client_nc);
         return !OK;
     }
 
@@ -15,6 +15,10 @@
  */
 
 #include "apr_strings.h"
+#include "apr_hash.h"
+#if APR_HAS_THREADS
+#include "apr_thread_mutex.h"
+#endif
 
 #include "ap_config.h"
 #include "ap_provider.h"
@@ -29,8 +33,25 @@
 
 typedef struct {
     char *pwfile;
+    int index;
 } authn_file_config_rec;
 
+/* The password files indexed by this child (AuthUserFileIndex), each in its
+ * own pool which is replaced when the file changes.
+ */
+typedef struct {
+    apr_pool_t *pool;
+    apr_time_t mtime;
+    apr_off_t size;
+    apr_hash_t *users;
+} authn_file_index_t;
+
+static apr_pool_t *indexes_pool;
+static apr_hash_t *indexes;
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *indexes_mutex;
+#endif
+
 static APR_OPTIONAL_FN_TYPE(ap_authn_cache_store) *authn_cache_store = NULL;
 #define AUTHN_CACHE_STORE(r,user,realm,data) \
     if (authn_cache_store != NULL) \
@@ -41,6 +62,7 @@ static void *create_authn_file_dir_config(apr_pool_t *p, char *d)
     authn_file_config_rec *conf = apr_palloc(p, sizeof(*conf));
 
     conf->pwfile = NULL;     /* just to illustrate the default really */
+    conf->index = 0;
     return conf;
 }
 
@@ -49,35 +71,28 @@ static const command_rec authn_file_cmds[] =
     AP_INIT_TAKE1("AuthUserFile", ap_set_file_slot,
                   (void *)APR_OFFSETOF(authn_file_config_rec, pwfile),
                   OR_AUTHCFG, "text file containing user IDs and passwords"),
+    AP_INIT_FLAG("AuthUserFileIndex", ap_set_flag_slot,
+                 (void *)APR_OFFSETOF(authn_file_config_rec, index),
+                 OR_AUTHCFG, "Whether to keep the passwords of the "
+                 "AuthUserFile in memory, reloading it when it changes"),
     {NULL}
 };
 
 module AP_MODULE_DECLARE_DATA authn_file_module;
 
-static authn_status check_password(request_rec *r, const char *user,
-                                   const char *password)
+static apr_status_t scan_password(request_rec *r, const char *pwfile,
+                                  const char *user, char **file_password)
 {
-    authn_file_config_rec *conf = ap_get_module_config(r->per_dir_config,
-                                                       &authn_file_module);
     ap_configfile_t *f;
     char l[MAX_STRING_LEN];
     apr_status_t status;
-    char *file_password = NULL;
-
-    if (!conf->pwfile) {
-        ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01619)
-                      "AuthUserFile not specified in the configuration");
-        return AUTH_GENERAL_ERROR;
-    }
-
-    status = ap_pcfg_openfile(&f, r->pool, conf->pwfile);
 
+    status = ap_pcfg_openfile(&f, r->pool, pwfile);
     if (status != APR_SUCCESS) {
-        ap_log_rerror(APLOG_MARK, APLOG_ERR, status, r, APLOGNO(01620)
-                      "Could not open password file: %s", conf->pwfile);
-        return AUTH_GENERAL_ERROR;
+        return status;
     }
 
+    *file_password = NULL;
     while (!(ap_cfg_getline(l, MAX_STRING_LEN, f))) {
         const char *rpw, *w;
 
@@ -90,12 +105,133 @@ static authn_status check_password(request_rec *r, const char *user,
         w = ap_getword(r->pool, &rpw, ':');
 
         if (!strcmp(user, w)) {
-            file_password = ap_getword(r->pool, &rpw, ':');
+            *file_password = ap_getword(r->pool, &rpw, ':');
             break;
         }
     }
     ap_cfg_closefile(f);
 
+    return APR_SUCCESS;
+}
+
+/* Load the users of a password file, the first entry of a user wins as
+ * when scanning the file.
+ */
+static apr_status_t load_index(request_rec *r, const char *pwfile,
+                               authn_file_index_t *idx)
+{
+    ap_configfile_t *f;
+    char l[MAX_STRING_LEN];
+    apr_status_t status;
+
+    status = ap_pcfg_openfile(&f, idx->pool, pwfile);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+
+    while (!(ap_cfg_getline(l, MAX_STRING_LEN, f))) {
+        const char *rpw, *w;
+
+        /* Skip # or blank lines. */
+        if ((l[0] == '#') || (!l[0])) {
+            continue;
+        }
+
+        rpw = l;
+        w = ap_getword(idx->pool, &rpw, ':');
+
+        if (!apr_hash_get(idx->users, w, APR_HASH_KEY_STRING)) {
+            apr_hash_set(idx->users, w, APR_HASH_KEY_STRING,
+                         ap_getword(idx->pool, &rpw, ':'));
+        }
+    }
+    ap_cfg_closefile(f);
+
+    ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(10495)
+                  "Loaded %u users of password file %s",
+                  apr_hash_count(idx->users), pwfile);
+    return APR_SUCCESS;
+}
+
+/* Get the password of a user from the index of the password file, loading
+ * or reloading it as needed.
+ */
+static apr_status_t index_password(request_rec *r, const char *pwfile,
+                                   const char *user, char **file_password)
+{
+    authn_file_index_t *idx;
+    apr_finfo_t finfo;
+    apr_status_t status;
+    const char *pw;
+
+    status = apr_stat(&finfo, pwfile, APR_FINFO_MTIME | APR_FINFO_SIZE,
+                      r->pool);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(indexes_mutex);
+#endif
+    idx = apr_hash_get(indexes, pwfile, APR_HASH_KEY_STRING);
+    if (!idx || idx->mtime != finfo.mtime || idx->size != finfo.size) {
+        if (!idx) {
+            idx = apr_pcalloc(indexes_pool, sizeof(*idx));
+            apr_hash_set(indexes, apr_pstrdup(indexes_pool, pwfile),
+                         APR_HASH_KEY_STRING, idx);
+        }
+        else {
+            apr_pool_destroy(idx->pool);
+        }
+        apr_pool_create(&idx->pool, indexes_pool);
+        apr_pool_tag(idx->pool, "authn_file_index");
+        idx->users = apr_hash_make(idx->pool);
+        idx->mtime = finfo.mtime;
+        idx->size = finfo.size;
+
+        status = load_index(r, pwfile, idx);
+        if (status != APR_SUCCESS) {
+            /* retry next time */
+            idx->mtime = 0;
+        }
+    }
+    if (status == APR_SUCCESS) {
+        pw = apr_hash_get(idx->users, user, APR_HASH_KEY_STRING);
+        *file_password = pw ? apr_pstrdup(r->pool, pw) : NULL;
+    }
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(indexes_mutex);
+#endif
+
+    return status;
+}
+
+static authn_status check_password(request_rec *r, const char *user,
+                                   const char *password)
+{
+    authn_file_config_rec *conf = ap_get_module_config(r->per_dir_config,
+                                                       &authn_file_module);
+    apr_status_t status;
+    char *file_password = NULL;
+
+    if (!conf->pwfile) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01619)
+                      "AuthUserFile not specified in the configuration");
+        return AUTH_GENERAL_ERROR;
+    }
+
+    if (conf->index > 0 && indexes) {
+        status = index_password(r, conf->pwfile, user, &file_password);
+    }
+    else {
+        status = scan_password(r, conf->pwfile, user, &file_password);
+    }
+    if (status != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, status, r, APLOGNO(01620)
+                      "Could not open password file: %s", conf->pwfile);
+        return AUTH_GENERAL_ERROR;
+    }
+
     if (!file_password) {
         return AUTH_USER_NOT_FOUND;
     }
@@ -173,12 +309,31 @@ static void opt_retr(void)
 {
     authn_cache_store = APR_RETRIEVE_OPTIONAL_FN(ap_authn_cache_store);
 }
+static void authn_file_child_init(apr_pool_t *p, server_rec *s)
+{
+#if APR_HAS_THREADS
+    apr_status_t rv;
+
+    rv = apr_thread_mutex_create(&indexes_mutex, APR_THREAD_MUTEX_DEFAULT, p);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, rv, s, APLOGNO(10496)
+                     "could not create the mutex of the password files "
+                     "index, AuthUserFileIndex disabled");
+        return;
+    }
+#endif
+    apr_pool_create(&indexes_pool, p);
+    apr_pool_tag(indexes_pool, "authn_file_indexes");
+    indexes = apr_hash_make(indexes_pool);
+}
+
 static void register_hooks(apr_pool_t *p)
 {
     ap_register_auth_provider(p, AUTHN_PROVIDER_GROUP, "file",
                               AUTHN_PROVIDER_VERSION,
                               &authn_file_provider, AP_AUTH_INTERNAL_PER_CONF);
     ap_hook_optional_fn_retrieve(opt_retr, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_child_init(authn_file_child_init, NULL, NULL, APR_HOOK_MIDDLE);
 }
 
 AP_DECLARE_MODULE(authn_file) =
@@ -15,6 +15,7 @@
  */
 
 #include "apr_strings.h"
+#include "apr_sha1.h"
 
 #include "ap_config.h"
 #include "ap_provider.h"
@@ -37,6 +38,7 @@ typedef struct authn_cache_dircfg {
     apr_interval_time_t timeout;
     apr_array_header_t *providers;
     const char *context;
+    int verified;
 } authn_cache_dircfg;
 
 /* FIXME:
@@ -48,6 +50,13 @@ static ap_socache_instance_t *socache_instance = NULL;
 static const char *const authn_cache_id = "authn-socache";
 static int configured;
 
+/* The key of the HMACs of the verified credentials (AuthnCacheVerified),
+ * regenerated on each (re)start so that no entry outlives it.
+ */
+#define VERIFIED_SECRET_LEN 20
+#define VERIFIED_BLOCK_LEN  64
+static unsigned char verified_secret[VERIFIED_SECRET_LEN];
+
 static apr_status_t remove_lock(void *data)
 {
     if (authn_cache_mutex) {
@@ -114,14 +123,18 @@ static int authn_cache_post_config(apr_pool_t *pconf, apr_pool_t *plog,
         }
     }
 
-    rv = ap_global_mutex_create(&authn_cache_mutex, NULL,
-                                authn_cache_id, NULL, s, pconf, 0);
-    if (rv != APR_SUCCESS) {
-        ap_log_perror(APLOG_MARK, APLOG_CRIT, rv, plog, APLOGNO(01675)
-                      "failed to create %s mutex", authn_cache_id);
-        return 500; /* An HTTP status would be a misnomer! */
+    /* MP-safe providers need no mutex */
+    if (socache_provider->flags & AP_SOCACHE_FLAG_NOTMPSAFE) {
+        rv = ap_global_mutex_create(&authn_cache_mutex, NULL,
+                                    authn_cache_id, NULL, s, pconf, 0);
+        if (rv != APR_SUCCESS) {
+            ap_log_perror(APLOG_MARK, APLOG_CRIT, rv, plog, APLOGNO(01675)
+                          "failed to create %s mutex", authn_cache_id);
+            return 500; /* An HTTP status would be a misnomer! */
+        }
+        apr_pool_cleanup_register(pconf, NULL, remove_lock,
+                                  apr_pool_cleanup_null);
     }
-    apr_pool_cleanup_register(pconf, NULL, remove_lock, apr_pool_cleanup_null);
 
     rv = socache_provider->init(socache_instance, authn_cache_id,
                                 &authn_cache_hints, s, pconf);
@@ -131,6 +144,13 @@ static int authn_cache_post_config(apr_pool_t *pconf, apr_pool_t *plog,
         return 500; /* An HTTP status would be a misnomer! */
     }
     apr_pool_cleanup_register(pconf, (void*)s, destroy_cache, apr_pool_cleanup_null);
+
+    rv = apr_generate_random_bytes(verified_secret, VERIFIED_SECRET_LEN);
+    if (rv != APR_SUCCESS) {
+        ap_log_perror(APLOG_MARK, APLOG_CRIT, rv, plog, APLOGNO(10498)
+                      "failed to generate the %s secret", authn_cache_id);
+        return 500; /* An HTTP status would be a misnomer! */
+    }
     return OK;
 }
 
@@ -138,7 +158,7 @@ static void authn_cache_child_init(apr_pool_t *p, server_rec *s)
 {
     const char *lock;
     apr_status_t rv;
-    if (!configured) {
+    if (!configured || !authn_cache_mutex) {
         return;       /* don't waste the overhead of creating mutex & cache */
     }
     lock = apr_global_mutex_lockfile(authn_cache_mutex);
@@ -201,6 +221,7 @@ static void* authn_cache_dircfg_create(apr_pool_t *pool, char *s)
     ret->timeout = apr_time_from_sec(300);
     ret->providers = NULL;
     ret->context = directory;
+    ret->verified = -1;
     return ret;
 }
 
@@ -220,6 +241,9 @@ static void* authn_cache_dircfg_merge(apr_pool_t *pool, void *BASE, void *ADD)
     if (add->providers == NULL) {
         ret->providers = base->providers;
     }
+    if (add->verified == -1) {
+        ret->verified = base->verified;
+    }
     return ret;
 }
 
@@ -259,6 +283,10 @@ static const command_rec authn_cache_cmds[] =
     AP_INIT_TAKE1("AuthnCacheContext", ap_set_string_slot,
                   (void*)APR_OFFSETOF(authn_cache_dircfg, context),
                   ACCESS_CONF, "Context for authn cache"),
+    AP_INIT_FLAG("AuthnCacheVerified", ap_set_flag_slot,
+                 (void*)APR_OFFSETOF(authn_cache_dircfg, verified),
+                 OR_AUTHCFG, "Whether to also cache the passwords verified "
+                 "against the cached credentials"),
     {NULL}
 };
 
@@ -307,8 +335,9 @@ static void ap_authn_cache_store(request_rec *r, const char *module,
         return;
     }
 
-    /* OK, we're on.  Grab mutex to do our business */
-    rv = apr_global_mutex_trylock(authn_cache_mutex);
+    /* OK, we're on.  Grab mutex to do our business, if any */
+    rv = authn_cache_mutex ? apr_global_mutex_trylock(authn_cache_mutex)
+                           : APR_SUCCESS;
     if (APR_STATUS_IS_EBUSY(rv)) {
         /* don't wait around; just abandon it */
         ap_log_rerror(APLOG_MARK, APLOG_DEBUG, rv, r, APLOGNO(01679)
@@ -343,12 +372,82 @@ static void ap_authn_cache_store(request_rec *r, const char *module,
     }
 
     /* We're done with the mutex */
-    rv = apr_global_mutex_unlock(authn_cache_mutex);
+    rv = authn_cache_mutex ? apr_global_mutex_unlock(authn_cache_mutex)
+                           : APR_SUCCESS;
     if (rv != APR_SUCCESS) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01683) "Failed to release mutex!");
     }
 }
 
+/* The key of a verified (user, password, hash) in the cache: the HMAC-SHA1
+ * of them, so that neither the password nor anything usable to find it is
+ * stored, and a changed hash (or password) simply won't match.
+ */
+static const char *construct_verified_key(request_rec *r, const char *key,
+                                          const char *password,
+                                          const char *hash)
+{
+    unsigned char pad[VERIFIED_BLOCK_LEN];
+    unsigned char digest[APR_SHA1_DIGESTSIZE];
+    apr_sha1_ctx_t ctx;
+    char *vkey, *p;
+    int i;
+
+    memset(pad, 0x36, sizeof(pad));
+    for (i = 0; i < VERIFIED_SECRET_LEN; ++i) {
+        pad[i] ^= verified_secret[i];
+    }
+    apr_sha1_init(&ctx);
+    apr_sha1_update_binary(&ctx, pad, sizeof(pad));
+    /* the NULs separate the fields */
+    apr_sha1_update_binary(&ctx, (const unsigned char *)key, strlen(key) + 1);
+    apr_sha1_update_binary(&ctx, (const unsigned char *)password,
+                           strlen(password) + 1);
+    apr_sha1_update_binary(&ctx, (const unsigned char *)hash, strlen(hash));
+    apr_sha1_final(digest, &ctx);
+
+    memset(pad, 0x5c, sizeof(pad));
+    for (i = 0; i < VERIFIED_SECRET_LEN; ++i) {
+        pad[i] ^= verified_secret[i];
+    }
+    apr_sha1_init(&ctx);
+    apr_sha1_update_binary(&ctx, pad, sizeof(pad));
+    apr_sha1_update_binary(&ctx, digest, sizeof(digest));
+    apr_sha1_final(digest, &ctx);
+
+    vkey = p = apr_palloc(r->pool, sizeof("verified:") - 1
+                                   + 2 * APR_SHA1_DIGESTSIZE + 1);
+    memcpy(p, "verified:", sizeof("verified:") - 1);
+    p += sizeof("verified:") - 1;
+    ap_bin2hex(digest, APR_SHA1_DIGESTSIZE, p);
+
+    return vkey;
+}
+
+static void store_verified(request_rec *r, authn_cache_dircfg *dcfg,
+                           const char *vkey)
+{
+    apr_status_t rv;
+
+    /* as in ap_authn_cache_store(), don't wait for the mutex */
+    if (authn_cache_mutex
+        && apr_global_mutex_trylock(authn_cache_mutex) != APR_SUCCESS) {
+        return;
+    }
+    rv = socache_provider->store(socache_instance, r->server,
+                                 (unsigned char*)vkey, strlen(vkey),
+                                 apr_time_now() + dcfg->timeout,
+                                 (unsigned char*)"1", 1, r->pool);
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, rv, r, APLOGNO(10499)
+                      "Failed to cache verified authn credentials in %s",
+                      dcfg->context);
+    }
+    if (authn_cache_mutex) {
+        apr_global_mutex_unlock(authn_cache_mutex);
+    }
+}
+
 #define MAX_VAL_LEN 256
 static authn_status check_password(request_rec *r, const char *user,
                                    const char *password)
@@ -364,7 +463,7 @@ static authn_status check_password(request_rec *r, const char *user,
      * to no-longer-defined memory.  Hmmm ...
      */
     apr_status_t rv;
-    const char *key;
+    const char *key, *vkey = NULL;
     authn_cache_dircfg *dcfg;
     unsigned char val[MAX_VAL_LEN];
     unsigned int vallen = MAX_VAL_LEN - 1;
@@ -397,11 +496,28 @@ static authn_status check_password(request_rec *r, const char *user,
         return AUTH_USER_NOT_FOUND;
     }
 
+    if (dcfg->verified > 0) {
+        unsigned char found[1];
+        unsigned int foundlen = sizeof(found);
+
+        vkey = construct_verified_key(r, key, password, (char*) val);
+        rv = socache_provider->retrieve(socache_instance, r->server,
+                                        (unsigned char*)vkey, strlen(vkey),
+                                        found, &foundlen, r->pool);
+        if (rv == APR_SUCCESS) {
+            return AUTH_GRANTED;
+        }
+    }
+
     rv = ap_password_validate(r, user, password, (char*) val);
     if (rv != APR_SUCCESS) {
         return AUTH_DENIED;
     }
 
+    if (vkey) {
+        store_verified(r, dcfg, vkey);
+    }
+
     return AUTH_GRANTED;
 }
 
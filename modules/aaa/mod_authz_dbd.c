@@ -50,6 +50,14 @@ typedef struct {
     int redirect;
 } authz_dbd_cfg ;
 
+/* The results of the group queries done for a request (and its
+ * subrequests), by query label.
+ */
+typedef struct {
+    const char *user;
+    apr_array_header_t *groups;
+} authz_dbd_groups_t;
+
 static ap_dbd_t *(*dbd_handle)(request_rec*) = NULL;
 static void (*dbd_prepare)(server_rec*, const char*, const char*) = NULL;
 
@@ -210,7 +218,7 @@ static int authz_dbd_login(request_rec *r, authz_dbd_cfg *cfg,
 }
 
 static int authz_dbd_group_query(request_rec *r, authz_dbd_cfg *cfg,
-                                 apr_array_header_t *groups)
+                                 apr_array_header_t **pgroups)
 {
     /* SELECT user_group FROM authz WHERE user = %s */
     int rv;
@@ -219,12 +227,32 @@ static int authz_dbd_group_query(request_rec *r, authz_dbd_cfg *cfg,
     apr_dbd_prepared_t *query;
     apr_dbd_results_t *res = NULL;
     apr_dbd_row_t *row = NULL;
+    apr_array_header_t *groups;
+    request_rec *mr = r;
+    apr_hash_t *done;
+    authz_dbd_groups_t *cached;
 
     if (cfg->query == NULL) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01649)
                       "No query configured for dbd-group!");
         return HTTP_INTERNAL_SERVER_ERROR;
     }
+
+    /* Several Require dbd-group, or the subrequests, need the same groups */
+    while (mr->main) {
+        mr = mr->main;
+    }
+    done = ap_get_module_config(mr->request_config, &authz_dbd_module);
+    if (done == NULL) {
+        done = apr_hash_make(mr->pool);
+        ap_set_module_config(mr->request_config, &authz_dbd_module, done);
+    }
+    cached = apr_hash_get(done, cfg->query, APR_HASH_KEY_STRING);
+    if (cached && !strcmp(cached->user, r->user)) {
+        *pgroups = cached->groups;
+        return OK;
+    }
+    groups = apr_array_make(mr->pool, 4, sizeof(const char*));
     
     dbd = dbd_handle(r);
     if (dbd == NULL) {
@@ -248,7 +276,7 @@ static int authz_dbd_group_query(request_rec *r, authz_dbd_cfg *cfg,
              rv = apr_dbd_get_row(dbd->driver, r->pool, res, &row, -1)) {
             if (rv == 0) {
                 APR_ARRAY_PUSH(groups, const char *) =
-                    apr_pstrdup(r->pool,
+                    apr_pstrdup(mr->pool,
                                 apr_dbd_get_entry(dbd->driver, row, 0));
             }
             else {
@@ -267,6 +295,14 @@ static int authz_dbd_group_query(request_rec *r, authz_dbd_cfg *cfg,
                       r->user, message?message:noerror);
         return HTTP_INTERNAL_SERVER_ERROR;
     }
+
+    if (!cached) {
+        cached = apr_palloc(mr->pool, sizeof(*cached));
+        apr_hash_set(done, cfg->query, APR_HASH_KEY_STRING, cached);
+    }
+    cached->user = apr_pstrdup(mr->pool, r->user);
+    cached->groups = groups;
+    *pgroups = groups;
     return OK;
 }
 
@@ -290,8 +326,7 @@ static authz_status dbdgroup_check_authorization(request_rec *r,
         return AUTHZ_DENIED_NO_USER;
     }
 
-    groups = apr_array_make(r->pool, 4, sizeof(const char*));
-    rv = authz_dbd_group_query(r, cfg, groups);
+    rv = authz_dbd_group_query(r, cfg, &groups);
     if (rv != OK) {
         return AUTHZ_GENERAL_ERROR;
     }
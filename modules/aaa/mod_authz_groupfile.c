@@ -43,6 +43,10 @@
 
 #include "apr_strings.h"
 #include "apr_lib.h" /* apr_isspace */
+#include "apr_hash.h"
+#if APR_HAS_THREADS
+#include "apr_thread_mutex.h"
+#endif
 
 #include "ap_config.h"
 #include "ap_provider.h"
@@ -59,13 +63,31 @@
 
 typedef struct {
     char *groupfile;
+    int index;
 } authz_groupfile_config_rec;
 
+/* The group files indexed by this child (AuthGroupFileIndex), by user, each
+ * in its own pool which is replaced when the file changes.
+ */
+typedef struct {
+    apr_pool_t *pool;
+    apr_time_t mtime;
+    apr_off_t size;
+    apr_hash_t *users;  /* user -> array of group names */
+} authz_groupfile_index_t;
+
+static apr_pool_t *indexes_pool;
+static apr_hash_t *indexes;
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *indexes_mutex;
+#endif
+
 static void *create_authz_groupfile_dir_config(apr_pool_t *p, char *d)
 {
     authz_groupfile_config_rec *conf = apr_palloc(p, sizeof(*conf));
 
     conf->groupfile = NULL;
+    conf->index = 0;
     return conf;
 }
 
@@ -75,6 +97,10 @@ static const command_rec authz_groupfile_cmds[] =
                   (void *)APR_OFFSETOF(authz_groupfile_config_rec, groupfile),
                   OR_AUTHCFG,
                   "text file containing group names and member user IDs"),
+    AP_INIT_FLAG("AuthGroupFileIndex", ap_set_flag_slot,
+                 (void *)APR_OFFSETOF(authz_groupfile_config_rec, index),
+                 OR_AUTHCFG, "Whether to keep the groups of the "
+                 "AuthGroupFile in memory, reloading it when it changes"),
     {NULL}
 };
 
@@ -82,8 +108,112 @@ module AP_MODULE_DECLARE_DATA authz_groupfile_module;
 
 #define VARBUF_INIT_LEN 512
 #define VARBUF_MAX_LEN  (16*1024*1024)
+static apr_status_t load_index(const char *grpfile,
+                               authz_groupfile_index_t *idx)
+{
+    ap_configfile_t *f;
+    struct ap_varbuf vb;
+    const char *ll, *w;
+    char *group_name;
+    apr_status_t status;
+    apr_size_t group_len;
+
+    if ((status = ap_pcfg_openfile(&f, idx->pool, grpfile)) != APR_SUCCESS) {
+        return status;
+    }
+
+    ap_varbuf_init(idx->pool, &vb, VARBUF_INIT_LEN);
+
+    while (!(ap_varbuf_cfg_getline(&vb, f, VARBUF_MAX_LEN))) {
+        if ((vb.buf[0] == '#') || (!vb.buf[0])) {
+            continue;
+        }
+        ll = vb.buf;
+
+        group_name = ap_getword(idx->pool, &ll, ':');
+        group_len = strlen(group_name);
+
+        while (group_len && apr_isspace(*(group_name + group_len - 1))) {
+            --group_len;
+        }
+        group_name[group_len] = '\0';
+
+        while (ll[0]) {
+            apr_array_header_t *groups;
+
+            w = ap_getword_conf(idx->pool, &ll);
+            groups = apr_hash_get(idx->users, w, APR_HASH_KEY_STRING);
+            if (!groups) {
+                groups = apr_array_make(idx->pool, 1, sizeof(char *));
+                apr_hash_set(idx->users, w, APR_HASH_KEY_STRING, groups);
+            }
+            APR_ARRAY_PUSH(groups, char *) = group_name;
+        }
+    }
+    ap_cfg_closefile(f);
+    ap_varbuf_free(&vb);
+
+    return APR_SUCCESS;
+}
+
+/* Get the groups of a user from the index of the group file, loading or
+ * reloading it as needed.
+ */
+static apr_status_t index_groups(apr_pool_t *p, char *user, char *grpfile,
+                                 apr_table_t *grps)
+{
+    authz_groupfile_index_t *idx;
+    apr_finfo_t finfo;
+    apr_status_t status;
+
+    status = apr_stat(&finfo, grpfile, APR_FINFO_MTIME | APR_FINFO_SIZE, p);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(indexes_mutex);
+#endif
+    idx = apr_hash_get(indexes, grpfile, APR_HASH_KEY_STRING);
+    if (!idx || idx->mtime != finfo.mtime || idx->size != finfo.size) {
+        if (!idx) {
+            idx = apr_pcalloc(indexes_pool, sizeof(*idx));
+            apr_hash_set(indexes, apr_pstrdup(indexes_pool, grpfile),
+                         APR_HASH_KEY_STRING, idx);
+        }
+        else {
+            apr_pool_destroy(idx->pool);
+        }
+        apr_pool_create(&idx->pool, indexes_pool);
+        apr_pool_tag(idx->pool, "authz_groupfile_index");
+        idx->users = apr_hash_make(idx->pool);
+        idx->mtime = finfo.mtime;
+        idx->size = finfo.size;
+
+        status = load_index(grpfile, idx);
+        if (status != APR_SUCCESS) {
+            /* retry next time */
+            idx->mtime = 0;
+        }
+    }
+    if (status == APR_SUCCESS) {
+        apr_array_header_t *groups = apr_hash_get(idx->users, user,
+                                                  APR_HASH_KEY_STRING);
+        int i;
+
+        for (i = 0; groups && i < groups->nelts; ++i) {
+            apr_table_set(grps, APR_ARRAY_IDX(groups, i, char *), "in");
+        }
+    }
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(indexes_mutex);
+#endif
+
+    return status;
+}
+
 static apr_status_t groups_for_user(apr_pool_t *p, char *user, char *grpfile,
-                                    apr_table_t ** out)
+                                    int index, apr_table_t ** out)
 {
     ap_configfile_t *f;
     apr_table_t *grps = apr_table_make(p, 15);
@@ -93,6 +223,14 @@ static apr_status_t groups_for_user(apr_pool_t *p, char *user, char *grpfile,
     apr_status_t status;
     apr_size_t group_len;
 
+    if (index > 0 && indexes) {
+        status = index_groups(p, user, grpfile, grps);
+        if (status == APR_SUCCESS) {
+            *out = grps;
+        }
+        return status;
+    }
+
     if ((status = ap_pcfg_openfile(&f, p, grpfile)) != APR_SUCCESS) {
         return status ;
     }
@@ -162,8 +300,8 @@ static authz_status group_check_authorization(request_rec *r,
         return AUTHZ_DENIED;
     }
 
-    status = groups_for_user(r->pool, user, conf->groupfile,
-                                &grpstatus);
+    status = groups_for_user(r->pool, user, conf->groupfile, conf->index,
+                             &grpstatus);
 
     if (status != APR_SUCCESS) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, status, r, APLOGNO(01665)
@@ -230,7 +368,7 @@ static authz_status filegroup_check_authorization(request_rec *r,
         return AUTHZ_DENIED;
     }
 
-    status = groups_for_user(r->pool, user, conf->groupfile,
+    status = groups_for_user(r->pool, user, conf->groupfile, conf->index,
                              &grpstatus);
     if (status != APR_SUCCESS) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, status, r, APLOGNO(01669)
@@ -308,6 +446,24 @@ static void authz_groupfile_getfns(void)
     authz_owner_get_file_group = APR_RETRIEVE_OPTIONAL_FN(authz_owner_get_file_group);
 }
 
+static void authz_groupfile_child_init(apr_pool_t *p, server_rec *s)
+{
+#if APR_HAS_THREADS
+    apr_status_t rv;
+
+    rv = apr_thread_mutex_create(&indexes_mutex, APR_THREAD_MUTEX_DEFAULT, p);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, rv, s, APLOGNO(10497)
+                     "could not create the mutex of the group files index, "
+                     "AuthGroupFileIndex disabled");
+        return;
+    }
+#endif
+    apr_pool_create(&indexes_pool, p);
+    apr_pool_tag(indexes_pool, "authz_groupfile_indexes");
+    indexes = apr_hash_make(indexes_pool);
+}
+
 static void register_hooks(apr_pool_t *p)
 {
     ap_register_auth_provider(p, AUTHZ_PROVIDER_GROUP, "group",
@@ -319,6 +475,7 @@ static void register_hooks(apr_pool_t *p)
                               &authz_filegroup_provider,
                               AP_AUTH_INTERNAL_PER_CONF);
     ap_hook_optional_fn_retrieve(authz_groupfile_getfns, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_child_init(authz_groupfile_child_init, NULL, NULL, APR_HOOK_MIDDLE);
 }
 
 AP_DECLARE_MODULE(authz_groupfile) =
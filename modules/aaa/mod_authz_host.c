@@ -40,6 +40,7 @@
 #include "http_request.h"
 
 #include "mod_auth.h"
+#include "util_ipset.h"
 
 #if APR_HAVE_NETINET_IN_H
 #include <netinet/in.h>
@@ -47,7 +48,7 @@
 
 /*
  * To save memory if the same subnets are used in hundres of vhosts, we store
- * each subnet only once and use this temporary hash to find it again.
+ * each list of subnets only once and use this temporary hash to find it again.
  */
 static apr_hash_t *parsed_subnets;
 
@@ -88,8 +89,7 @@ static const char *ip_parse_config(cmd_parms *cmd,
                                    const void **parsed_require_line)
 {
     const char *t, *w;
-    int count = 0;
-    apr_ipsubnet_t **ip;
+    ap_ipset_t *ips;
     apr_pool_t *ptemp = cmd->temp_pool;
     apr_pool_t *p = cmd->pool;
 
@@ -97,15 +97,16 @@ static const char *ip_parse_config(cmd_parms *cmd,
         ip addresses to check rather than a single address.  This is different
         from the previous host based syntax. */
 
-    t = require_line;
-    while ((w = ap_getword_conf(ptemp, &t)) && w[0])
-        count++;
-
-    if (count == 0)
-        return "'require ip' requires an argument";
+    if (parsed_subnets &&
+        (ips = apr_hash_get(parsed_subnets, require_line,
+                            APR_HASH_KEY_STRING)) != NULL)
+    {
+        /* we already have parsed this list of subnets */
+        *parsed_require_line = ips;
+        return NULL;
+    }
 
-    ip = apr_pcalloc(p, sizeof(apr_ipsubnet_t *) * (count + 1));
-    *parsed_require_line = ip;
+    ips = ap_ipset_make(p);
 
     t = require_line;
     while ((w = ap_getword_conf(ptemp, &t)) && w[0]) {
@@ -113,18 +114,10 @@ static const char *ip_parse_config(cmd_parms *cmd,
         char *mask;
         apr_status_t rv;
 
-        if (parsed_subnets &&
-            (*ip = apr_hash_get(parsed_subnets, w, APR_HASH_KEY_STRING)) != NULL)
-        {
-            /* we already have parsed this subnet */
-            ip++;
-            continue;
-        }
-
         if ((mask = ap_strchr(addr, '/')))
             *mask++ = '\0';
 
-        rv = apr_ipsubnet_create(ip, addr, mask, p);
+        rv = ap_ipset_add(ips, addr, mask, NULL);
 
         if(APR_STATUS_IS_EINVAL(rv)) {
             /* looked nothing like an IP address */
@@ -134,12 +127,15 @@ static const char *ip_parse_config(cmd_parms *cmd,
             return apr_psprintf(p, "ip address '%s' appears to be invalid: %pm",
                                 w, &rv);
         }
-
-        if (parsed_subnets)
-            apr_hash_set(parsed_subnets, w, APR_HASH_KEY_STRING, *ip);
-        ip++;
     }
 
+    if (ap_ipset_count(ips) == 0)
+        return "'require ip' requires an argument";
+
+    if (parsed_subnets)
+        apr_hash_set(parsed_subnets, require_line, APR_HASH_KEY_STRING, ips);
+    *parsed_require_line = ips;
+
     return NULL;
 }
 
@@ -147,14 +143,10 @@ static authz_status ip_check_authorization(request_rec *r,
                                            const char *require_line,
                                            const void *parsed_require_line)
 {
-    /* apr_ipsubnet_test should accept const but doesn't */
-    apr_ipsubnet_t **ip = (apr_ipsubnet_t **)parsed_require_line;
+    const ap_ipset_t *ips = parsed_require_line;
 
-    while (*ip) {
-        if (apr_ipsubnet_test(*ip, r->useragent_addr))
-            return AUTHZ_GRANTED;
-        ip++;
-    }
+    if (ap_ipset_match(ips, r->useragent_addr, NULL))
+        return AUTHZ_GRANTED;
 
     /* authz_core will log the require line and the result at DEBUG */
     return AUTHZ_DENIED;
@@ -359,11 +351,9 @@ static int authz_host_pre_config(apr_pool_t *p, apr_pool_t *plog,
     parsed_subnets = apr_hash_make(ptemp);
 
     apr_ipsubnet_create(&localhost_v4, "127.0.0.0", "8", p);
-    apr_hash_set(parsed_subnets, "127.0.0.0/8", APR_HASH_KEY_STRING, localhost_v4);
 
 #if APR_HAVE_IPV6
     apr_ipsubnet_create(&localhost_v6, "::1", NULL, p);
-    apr_hash_set(parsed_subnets, "::1", APR_HASH_KEY_STRING, localhost_v6);
 #endif
 
     return OK;
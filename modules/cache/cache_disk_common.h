@@ -40,6 +40,26 @@
 #define AP_TEMPFILE_NAMELEN strlen(AP_TEMPFILE_BASE AP_TEMPFILE_SUFFIX)
 #define AP_TEMPFILE AP_TEMPFILE_PREFIX AP_TEMPFILE_BASE AP_TEMPFILE_SUFFIX
 
+/*
+ * The journal of the entities stored and removed, written by mod_cache_disk
+ * in the cache root when CacheDiskJournal is on, and consumed by
+ * htcacheclean -j. One line per event:
+ *
+ *   S <time> <header size> <data size> <expire> <response time> <name>
+ *   D <time> <name>
+ *   O
+ *
+ * where name is the path of the entity relative to the cache root, without
+ * suffix, and O means that the journal overflowed and later events were
+ * lost.
+ */
+#define CACHE_JOURNAL_FILE   "cache.journal"
+#define CACHE_JOURNAL_WORK   ".work"
+#define CACHE_JOURNAL_MAX    (64 * 1024 * 1024)
+#define CACHE_JOURNAL_STORE  'S'
+#define CACHE_JOURNAL_REMOVE 'D'
+#define CACHE_JOURNAL_OVERFLOW 'O'
+
 typedef struct {
     /* Indicates the format of the header struct stored on-disk. */
     apr_uint32_t format;
@@ -278,8 +278,8 @@ CACHE_DECLARE(apr_int64_t) ap_cache_current_age(cache_info *info,
  * no point is it possible for this lock to permanently deny access to
  * the backend.
  */
-apr_status_t cache_try_lock(cache_server_conf *conf, cache_request_rec *cache,
-        request_rec *r)
+static apr_status_t try_lock(cache_server_conf *conf,
+        cache_request_rec *cache, request_rec *r, int force)
 {
     apr_status_t status;
     const char *lockname;
@@ -292,7 +292,7 @@ apr_status_t cache_try_lock(cache_server_conf *conf, cache_request_rec *cache,
 
     finfo.mtime = 0;
 
-    if (!conf || !conf->lock || !conf->lockpath) {
+    if (!conf || (!conf->lock && !force) || !conf->lockpath) {
         /* no locks configured, leave */
         return APR_SUCCESS;
     }
@@ -377,6 +377,56 @@ apr_status_t cache_try_lock(cache_server_conf *conf, cache_request_rec *cache,
 
 }
 
+apr_status_t cache_try_lock(cache_server_conf *conf, cache_request_rec *cache,
+        request_rec *r)
+{
+    return try_lock(conf, cache, r, 0);
+}
+
+/* Interval of the checks of a cache lock held by another request */
+#define CACHE_LOCK_POLL apr_time_from_msec(10)
+
+/**
+ * Wait for the cache lock of another request to be removed.
+ */
+int cache_wait_lock(cache_server_conf *conf, cache_request_rec *cache,
+        request_rec *r)
+{
+    const char *lockname;
+    apr_finfo_t finfo;
+    apr_time_t until;
+    void *dummy;
+
+    if (!conf || !conf->lock || !conf->lockpath || conf->lockwait <= 0) {
+        return 0;
+    }
+
+    /* nothing to wait for if we hold the lock, or did not try */
+    apr_pool_userdata_get(&dummy, CACHE_LOCKFILE_KEY, r->pool);
+    if (dummy) {
+        return 0;
+    }
+    apr_pool_userdata_get(&dummy, CACHE_LOCKNAME_KEY, r->pool);
+    if (!dummy) {
+        return 0;
+    }
+    lockname = dummy;
+
+    until = apr_time_now() + conf->lockwait;
+    do {
+        apr_sleep(CACHE_LOCK_POLL);
+        if (apr_stat(&finfo, lockname, APR_FINFO_MTIME, r->pool)
+                != APR_SUCCESS) {
+            ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(10421)
+                    "Cache lock released while waiting, looking up "
+                    "the cache again: %s", r->uri);
+            return 1;
+        }
+    } while (apr_time_now() < until);
+
+    return 0;
+}
+
 /**
  * Remove the cache lock, if present.
  *
@@ -395,10 +445,17 @@ apr_status_t cache_remove_lock(cache_server_conf *conf,
     void *dummy;
     const char *lockname;
 
-    if (!conf || !conf->lock || !conf->lockpath) {
+    if (!conf || !conf->lockpath) {
         /* no locks configured, leave */
         return APR_SUCCESS;
     }
+    if (!conf->lock) {
+        /* only a stale-while-revalidate lock may be held */
+        apr_pool_userdata_get(&dummy, CACHE_LOCKFILE_KEY, r->pool);
+        if (!dummy) {
+            return APR_SUCCESS;
+        }
+    }
     if (bb) {
         apr_bucket *e;
         int eos_found = 0;
@@ -532,6 +589,41 @@ int ap_cache_check_no_store(cache_request_rec *cache, request_rec *r)
     return 1;
 }
 
+/*
+ * RFC 5861 stale-while-revalidate of the cached response, in seconds,
+ * or -1.  It is not part of cache_control_t, since that is part of the
+ * format of the entities stored by the providers.
+ */
+static apr_int64_t cache_stale_while_revalidate(cache_handle_t *h,
+                                                request_rec *r)
+{
+    const char *cc = apr_table_get(h->resp_hdrs, "Cache-Control");
+    char *header, *token, *last, *endp;
+    apr_int64_t value;
+
+    if (!cc || !ap_strcasestr(cc, "stale-while-revalidate")) {
+        return -1;
+    }
+
+    header = apr_pstrdup(r->pool, cc);
+    for (token = apr_strtok(header, ",", &last); token;
+         token = apr_strtok(NULL, ",", &last)) {
+        while (apr_isspace(*token)) {
+            token++;
+        }
+        if (!ap_cstr_casecmpn(token, "stale-while-revalidate=",
+                              sizeof("stale-while-revalidate=") - 1)) {
+            token += sizeof("stale-while-revalidate=") - 1;
+            value = apr_strtoi64(token, &endp, 10);
+            if (endp > token && value >= 0) {
+                return value;
+            }
+            break;
+        }
+    }
+    return -1;
+}
+
 int cache_check_freshness(cache_handle_t *h, cache_request_rec *cache,
         request_rec *r)
 {
@@ -740,6 +832,46 @@ int cache_check_freshness(cache_handle_t *h, cache_request_rec *cache,
         return 1;    /* Cache object is fresh (enough) */
     }
 
+    /*
+     * RFC 5861: within the stale-while-revalidate window of the response,
+     * a single request revalidates the entity while the others are served
+     * the stale one, whether or not CacheLock is enabled.
+     */
+    if (!h->cache_obj->info.control.must_revalidate
+            && !h->cache_obj->info.control.proxy_revalidate
+            && maxage_req == -1 && !minfresh) {
+        apr_int64_t swr = cache_stale_while_revalidate(h, r);
+        apr_int64_t lifetime = maxage_cresp;
+
+        if (lifetime == -1 && info->expire != APR_DATE_BAD) {
+            lifetime = apr_time_sec(info->expire - info->date);
+        }
+        if (swr > 0 && lifetime >= 0 && age < lifetime + swr) {
+            status = try_lock(conf, cache, r, 1);
+            if (APR_STATUS_IS_EEXIST(status)) {
+                ap_log_rerror(APLOG_MARK, APLOG_DEBUG, status, r,
+                        APLOGNO(10422) "Cache entity being revalidated "
+                        "within stale-while-revalidate, serving it "
+                        "stale: %s", r->unparsed_uri);
+
+                apr_table_set(h->resp_hdrs, "Age",
+                              apr_psprintf(r->pool, "%lu",
+                                           (unsigned long)age));
+                warn_head = apr_table_get(h->resp_hdrs, "Warning");
+                if ((warn_head == NULL) ||
+                        (ap_strstr_c(warn_head, "110") == NULL)) {
+                    apr_table_mergen(h->resp_hdrs, "Warning",
+                                     "110 Response is stale");
+                }
+                return 1;
+            }
+            if (APR_SUCCESS == status) {
+                /* we are the one revalidating */
+                return 0;
+            }
+        }
+    }
+
     /*
      * At this point we are stale, but: if we are under load, we may let
      * a significant number of stale requests through before the first
@@ -1364,3 +1496,59 @@ const char *cache_table_getm(apr_pool_t *p, const apr_table_t *t,
         return apr_array_pstrcat(p, state.merged, ',');
     }
 }
+
+void cache_normalize_encoding(request_rec *r)
+{
+    const char *field, *item;
+    int br = -1, gzip = -1, any = 0;
+
+    field = cache_table_getm(r->pool, r->headers_in, "Accept-Encoding");
+    if (!field) {
+        return;
+    }
+
+    while ((item = ap_get_list_item(r->pool, &field))) {
+        const char *params = item;
+        const char *coding = ap_getword(r->pool, &params, ';');
+        int acceptable = 1;
+
+        /* the only parameter defined for a coding is its q-value */
+        while (*params) {
+            const char *param = ap_getword(r->pool, &params, ';');
+            if (param[0] == 'q' && param[1] == '=') {
+                acceptable = (atof(param + 2) > 0);
+            }
+        }
+
+        if (!strcmp(coding, "br")) {
+            br = acceptable;
+        }
+        else if (!strcmp(coding, "gzip") || !strcmp(coding, "x-gzip")) {
+            gzip = acceptable;
+        }
+        else if (!strcmp(coding, "*")) {
+            any = acceptable;
+        }
+    }
+
+    /* a wildcard covers any coding not explicitly listed */
+    if (br < 0) {
+        br = any;
+    }
+    if (gzip < 0) {
+        gzip = any;
+    }
+
+    if (br && gzip) {
+        apr_table_setn(r->headers_in, "Accept-Encoding", "br, gzip");
+    }
+    else if (br) {
+        apr_table_setn(r->headers_in, "Accept-Encoding", "br");
+    }
+    else if (gzip) {
+        apr_table_setn(r->headers_in, "Accept-Encoding", "gzip");
+    }
+    else {
+        apr_table_unset(r->headers_in, "Accept-Encoding");
+    }
+}
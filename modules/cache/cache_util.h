@@ -96,6 +96,8 @@ extern "C" {
 #define DEFAULT_X_CACHE_DETAIL  0
 #define DEFAULT_CACHE_STALE_ON_ERROR 1
 #define DEFAULT_CACHE_LOCKPATH "mod_cache-lock"
+#define DEFAULT_CACHE_TAG_MAXSIZE 16384
+#define CACHE_TAG_HANDLER "cache-purge"
 #define CACHE_LOCKNAME_KEY "mod_cache-lockname"
 #define CACHE_LOCKFILE_KEY "mod_cache-lockfile"
 #define CACHE_CTX_KEY "mod_cache-ctx"
@@ -123,8 +125,12 @@ typedef struct {
     apr_array_header_t *ignore_headers;
     /** store the identifiers that should not be used for key calculation */
     apr_array_header_t *ignore_session_id;
+    /** the response headers listing the tags of an entity */
+    apr_array_header_t *tag_headers;
     const char *lockpath;
     apr_time_t lockmaxage;
+    /** how long a miss waits for the lock holder to fill the cache */
+    apr_interval_time_t lockwait;
     apr_uri_t *base_uri;
     /** ignore client's requests for uncached responses */
     unsigned int ignorecachecontrol:1;
@@ -136,6 +142,8 @@ typedef struct {
     unsigned int lock:1;
     unsigned int x_cache:1;
     unsigned int x_cache_detail:1;
+    /** normalise Accept-Encoding before lookup */
+    unsigned int normalize_encoding:1;
     /* flag if CacheIgnoreHeader has been set */
     #define CACHE_IGNORE_HEADERS_SET   1
     #define CACHE_IGNORE_HEADERS_UNSET 0
@@ -144,6 +152,7 @@ typedef struct {
     #define CACHE_IGNORE_SESSION_ID_SET   1
     #define CACHE_IGNORE_SESSION_ID_UNSET 0
     unsigned int ignore_session_id_set:1;
+    unsigned int tag_headers_set:1;
     unsigned int base_uri_set:1;
     unsigned int ignorecachecontrol_set:1;
     unsigned int ignorequerystring_set:1;
@@ -151,8 +160,10 @@ typedef struct {
     unsigned int lock_set:1;
     unsigned int lockpath_set:1;
     unsigned int lockmaxage_set:1;
+    unsigned int lockwait_set:1;
     unsigned int x_cache_set:1;
     unsigned int x_cache_detail_set:1;
+    unsigned int normalize_encoding_set:1;
 } cache_server_conf;
 
 typedef struct {
@@ -283,6 +294,18 @@ int cache_check_freshness(cache_handle_t *h, cache_request_rec *cache,
 apr_status_t cache_try_lock(cache_server_conf *conf, cache_request_rec *cache,
         request_rec *r);
 
+/**
+ * Wait for the cache lock obtained by another request to go away.
+ *
+ * Called after cache_try_lock() failed on a cache miss, so that the
+ * request can look up the entity cached by the lock holder rather than
+ * going to the backend as well.  Waits for up to CacheLockWait.
+ *
+ * @return 1 if the lock was removed in time, 0 otherwise
+ */
+int cache_wait_lock(cache_server_conf *conf, cache_request_rec *cache,
+        request_rec *r);
+
 /**
  * Remove the cache lock, if present.
  *
@@ -332,6 +355,13 @@ apr_table_t *cache_merge_headers_out(request_rec *r);
  */
 int cache_use_early_url(request_rec *r);
 
+/**
+ * Collapse the request's Accept-Encoding to the codings the server can
+ * produce itself (br and gzip), in a fixed order, so that responses
+ * varying on it are stored as at most one variant per coding.
+ */
+void cache_normalize_encoding(request_rec *r);
+
 #ifdef __cplusplus
 }
 #endif
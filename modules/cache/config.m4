@@ -132,6 +132,8 @@ fi
 
 APACHE_MODULE(socache_shmcb,  shmcb small object cache provider, , , most)
 APACHE_MODULE(socache_dbm, dbm small object cache provider, , , most)
+APACHE_MODULE(socache_slab, slab file object cache provider, , , most)
+APACHE_MODULE(socache_tiered, tiered small object cache provider, , , most)
 APACHE_MODULE(socache_memcache, memcache small object cache provider, , , most)
 APACHE_MODULE(socache_redis, redis small object cache provider, , , most)
 APACHE_MODULE(socache_dc, distcache small object cache provider, , , no, [
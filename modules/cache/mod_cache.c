@@ -19,6 +19,10 @@
 #include "cache_storage.h"
 #include "cache_util.h"
 
+#include "ap_provider.h"
+#include "ap_socache.h"
+#include "util_mutex.h"
+
 module AP_MODULE_DECLARE_DATA cache_module;
 APR_OPTIONAL_FN_TYPE(ap_cache_generate_key) *cache_generate_key;
 
@@ -166,6 +170,10 @@ static int cache_quick_handler(request_rec *r, int lookup)
     }
     }
 
+    if (conf->normalize_encoding) {
+        cache_normalize_encoding(r);
+    }
+
     /*
      * Try to serve this request from the cache.
      *
@@ -177,6 +185,13 @@ static int cache_quick_handler(request_rec *r, int lookup)
      *   return OK
      */
     rv = cache_select(cache, r);
+    if (rv == DECLINED && !lookup && !cache->stale_handle
+        && conf->lock && conf->lockwait > 0
+        && cache_try_lock(conf, cache, r) != APR_SUCCESS
+        && cache_wait_lock(conf, cache, r)) {
+        /* collapse with the request which was filling the cache */
+        rv = cache_select(cache, r);
+    }
     if (rv != OK) {
         if (rv == DECLINED) {
             if (!lookup) {
@@ -466,6 +481,10 @@ static int cache_handler(request_rec *r)
     }
     }
 
+    if (conf->normalize_encoding) {
+        cache_normalize_encoding(r);
+    }
+
     /*
      * Try to serve this request from the cache.
      *
@@ -477,6 +496,13 @@ static int cache_handler(request_rec *r)
      *   return OK
      */
     rv = cache_select(cache, r);
+    if (rv == DECLINED && !cache->stale_handle
+        && conf->lock && conf->lockwait > 0
+        && cache_try_lock(conf, cache, r) != APR_SUCCESS
+        && cache_wait_lock(conf, cache, r)) {
+        /* collapse with the request which was filling the cache */
+        rv = cache_select(cache, r);
+    }
     if (rv != OK) {
         if (rv == DECLINED) {
 
@@ -786,6 +812,353 @@ static int cache_header_cmp(apr_pool_t *pool, apr_table_t *left,
     return 0;
 }
 
+/*
+ * Tag index
+ * ---------
+ *
+ * With CacheTagSocache, the tags listed by the response headers named by
+ * CacheTagHeader (Surrogate-Key and Cache-Tag by default) are indexed in a
+ * shared object cache as each entity is stored. The record of a tag holds
+ * its expiry on the first line, then one line per tagged entity: the cache
+ * provider, the key and the request headers the entity varies on, each
+ * field url-encoded and separated by a space.
+ *
+ * A PURGE request to the cache-purge handler invalidates all the entities
+ * of the tags it lists in the same headers, replaying the request headers
+ * recorded for each of them so that the right variant is found.
+ */
+static ap_socache_provider_t *tag_socache = NULL;
+static ap_socache_instance_t *tag_instance = NULL;
+static const char *tag_socache_args = NULL;
+static apr_global_mutex_t *tag_mutex = NULL;
+static apr_size_t tag_maxsize = DEFAULT_CACHE_TAG_MAXSIZE;
+static int tag_purge_method = M_INVALID;
+
+/* the length of the expiry line of a record, in hex */
+#define CACHE_TAG_EXPIRY_LEN 16
+static const char *const cache_tag_id = "cache-tag";
+
+typedef struct {
+    apr_pool_t *pool;
+    apr_array_header_t *tags;
+    apr_array_header_t *names;
+} cache_tag_ctx;
+
+static int cache_tag_collect(void *baton, const char *key, const char *value)
+{
+    cache_tag_ctx *ctx = baton;
+    const char **name;
+    char *copy, *tag, *last;
+    int i;
+
+    for (i = 0, name = (const char **)ctx->names->elts; i < ctx->names->nelts;
+         ++i, ++name) {
+        if (!ap_cstr_casecmp(key, *name)) {
+            break;
+        }
+    }
+    if (i == ctx->names->nelts) {
+        return 1;
+    }
+
+    /* Surrogate-Key is space separated, Cache-Tag comma separated */
+    copy = apr_pstrdup(ctx->pool, value);
+    for (tag = apr_strtok(copy, " \t,", &last); tag;
+         tag = apr_strtok(NULL, " \t,", &last)) {
+        APR_ARRAY_PUSH(ctx->tags, const char *) = tag;
+    }
+    return 1;
+}
+
+static apr_array_header_t *cache_tag_get(request_rec *r,
+                                         cache_server_conf *conf,
+                                         apr_table_t *headers,
+                                         apr_table_t *err_headers)
+{
+    cache_tag_ctx ctx;
+
+    ctx.pool = r->pool;
+    ctx.tags = apr_array_make(r->pool, 4, sizeof(const char *));
+    ctx.names = conf->tag_headers;
+    if (ctx.names->nelts) {
+        apr_table_do(cache_tag_collect, &ctx, headers, NULL);
+        if (err_headers) {
+            apr_table_do(cache_tag_collect, &ctx, err_headers, NULL);
+        }
+    }
+    return ctx.tags;
+}
+
+/* The index line of the entity being stored */
+static const char *cache_tag_entry(request_rec *r, cache_request_rec *cache)
+{
+    const char *vary, *value;
+    char *copy, *name, *last;
+    apr_array_header_t *fields;
+
+    fields = apr_array_make(r->pool, 4, sizeof(const char *));
+    APR_ARRAY_PUSH(fields, const char *) =
+            ap_escape_urlencoded(r->pool, cache->provider_name);
+    APR_ARRAY_PUSH(fields, const char *) =
+            ap_escape_urlencoded(r->pool, cache->key);
+
+    vary = cache_table_getm(r->pool, r->headers_out, "Vary");
+    if (vary) {
+        copy = apr_pstrdup(r->pool, vary);
+        for (name = apr_strtok(copy, " \t,", &last); name;
+             name = apr_strtok(NULL, " \t,", &last)) {
+            value = apr_table_get(r->headers_in, name);
+            name = ap_escape_urlencoded(r->pool, name);
+            APR_ARRAY_PUSH(fields, const char *) = value
+                    ? apr_pstrcat(r->pool, name, "=",
+                                  ap_escape_urlencoded(r->pool, value), NULL)
+                    : name;
+        }
+    }
+
+    return apr_array_pstrcat(r->pool, fields, ' ');
+}
+
+static apr_status_t cache_tag_lock(request_rec *r)
+{
+    apr_status_t rv = apr_global_mutex_lock(tag_mutex);
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(10562)
+                "cache: could not acquire the tag index lock");
+    }
+    return rv;
+}
+
+/* Retrieve the record of a tag, NUL terminated, or NULL */
+static char *cache_tag_retrieve(request_rec *r, const char *tag,
+                                apr_size_t *len)
+{
+    unsigned int buflen = tag_maxsize;
+    unsigned char *buf = apr_palloc(r->pool, buflen + 1);
+
+    if (tag_socache->retrieve(tag_instance, r->server,
+                              (const unsigned char *)tag, strlen(tag),
+                              buf, &buflen, r->pool) != APR_SUCCESS
+            || !buflen || !memchr(buf, '\n', buflen)) {
+        return NULL;
+    }
+    buf[buflen] = '\0';
+    *len = buflen;
+    return (char *)buf;
+}
+
+/*
+ * Add the entity being stored to the records of its tags. The records are
+ * kept until CacheMaxExpire past the expiry of the last entity added, so
+ * that stale entities can still be purged; when one grows beyond
+ * CacheTagMaxSize, its oldest entries are dropped.
+ */
+static void cache_tag_store(request_rec *r, cache_request_rec *cache,
+                            cache_info *info)
+{
+    cache_server_conf *conf;
+    cache_dir_conf *dconf;
+    apr_array_header_t *tags;
+    const char *entry, *add, *old, *lines;
+    char *record;
+    apr_size_t len;
+    apr_time_t expiry, recexpiry;
+    apr_status_t rv;
+    int i, dropped;
+
+    if (!tag_instance) {
+        return;
+    }
+
+    conf = ap_get_module_config(r->server->module_config, &cache_module);
+    tags = cache_tag_get(r, conf, r->headers_out, r->err_headers_out);
+    if (!tags->nelts) {
+        return;
+    }
+
+    dconf = ap_get_module_config(r->per_dir_config, &cache_module);
+    expiry = info->expire + dconf->maxex;
+    entry = apr_pstrcat(r->pool, "\n", cache_tag_entry(r, cache), "\n", NULL);
+
+    if (cache_tag_lock(r) != APR_SUCCESS) {
+        return;
+    }
+
+    for (i = 0; i < tags->nelts; ++i) {
+        const char *tag = APR_ARRAY_IDX(tags, i, const char *);
+
+        /* the entries of the record start and end with a newline */
+        lines = "\n";
+        add = entry;
+        recexpiry = expiry;
+        old = cache_tag_retrieve(r, tag, &len);
+        if (old) {
+            apr_time_t oldexpiry = apr_strtoi64(old, NULL, 16);
+            lines = ap_strchr_c(old, '\n');
+            if (strstr(lines, entry)) {
+                if (oldexpiry >= expiry) {
+                    continue;
+                }
+                /* already listed, just extend the expiry */
+                add = "\n";
+            }
+            recexpiry = MAX(expiry, oldexpiry);
+        }
+
+        /* drop the oldest entries until the new one fits */
+        dropped = 0;
+        while (CACHE_TAG_EXPIRY_LEN + strlen(lines) + strlen(add) - 1
+                   > tag_maxsize
+               && lines[1] != '\0') {
+            lines = ap_strchr_c(lines + 1, '\n');
+            dropped++;
+        }
+        if (dropped) {
+            ap_log_rerror(APLOG_MARK, APLOG_INFO, 0, r, APLOGNO(10563)
+                    "cache: tag '%s' exceeds CacheTagMaxSize, the %d oldest "
+                    "entities won't be purged with it", tag, dropped);
+        }
+
+        record = apr_psprintf(r->pool, "%016" APR_UINT64_T_HEX_FMT "%s%s",
+                              (apr_uint64_t)recexpiry, lines, add + 1);
+        len = strlen(record);
+        if (len > tag_maxsize) {
+            continue;
+        }
+        rv = tag_socache->store(tag_instance, r->server,
+                                (const unsigned char *)tag, strlen(tag),
+                                recexpiry, (unsigned char *)record, len,
+                                r->pool);
+        if (rv != APR_SUCCESS) {
+            ap_log_rerror(APLOG_MARK, APLOG_DEBUG, rv, r, APLOGNO(10564)
+                    "cache: could not index entity %s with tag '%s'",
+                    cache->key, tag);
+        }
+    }
+
+    apr_global_mutex_unlock(tag_mutex);
+}
+
+/* Invalidate the entity of an index line, returns 1 if found */
+static int cache_tag_invalidate(request_rec *r, char *line)
+{
+    const cache_provider *provider;
+    cache_handle_t *h;
+    apr_table_t *headers_in;
+    char *name, *key, *field, *value, *last;
+    int found = 0;
+
+    name = apr_strtok(line, " ", &last);
+    key = apr_strtok(NULL, " ", &last);
+    if (!name || !key || ap_unescape_urlencoded(name) != OK
+            || ap_unescape_urlencoded(key) != OK) {
+        return 0;
+    }
+    provider = ap_lookup_provider(CACHE_PROVIDER_GROUP, name, "0");
+    if (!provider) {
+        return 0;
+    }
+
+    /* replay the request headers the entity varies on */
+    headers_in = r->headers_in;
+    r->headers_in = apr_table_copy(r->pool, headers_in);
+    while ((field = apr_strtok(NULL, " ", &last)) != NULL) {
+        value = strchr(field, '=');
+        if (value) {
+            *value++ = '\0';
+        }
+        if (ap_unescape_urlencoded(field) != OK
+                || (value && ap_unescape_urlencoded(value) != OK)) {
+            continue;
+        }
+        if (value) {
+            apr_table_setn(r->headers_in, field, value);
+        }
+        else {
+            apr_table_unset(r->headers_in, field);
+        }
+    }
+
+    h = apr_pcalloc(r->pool, sizeof(cache_handle_t));
+    if (provider->open_entity(h, r, key) == OK) {
+        provider->invalidate_entity(h, r);
+        found = 1;
+    }
+    ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(10565)
+            "cache: purged by tag, %s cached entity with key: %s",
+            found ? "invalidated" : "no", key);
+
+    r->headers_in = headers_in;
+    return found;
+}
+
+/*
+ * The cache-purge handler: PURGE invalidates the entities of all the tags
+ * listed in the request, and responds with their count.
+ */
+static int cache_tag_handler(request_rec *r)
+{
+    cache_server_conf *conf;
+    apr_array_header_t *tags;
+    char *record, *line, *last;
+    apr_size_t len;
+    int i, count = 0;
+
+    if (strcmp(r->handler, CACHE_TAG_HANDLER)) {
+        return DECLINED;
+    }
+
+    ap_allow_methods(r, REPLACE_ALLOW, "PURGE", NULL);
+    if (r->method_number != tag_purge_method) {
+        return HTTP_METHOD_NOT_ALLOWED;
+    }
+    if (!tag_instance) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(10566)
+                "cache: PURGE by tag needs CacheTagSocache");
+        return HTTP_NOT_IMPLEMENTED;
+    }
+
+    conf = ap_get_module_config(r->server->module_config, &cache_module);
+    tags = cache_tag_get(r, conf, r->headers_in, NULL);
+    if (!tags->nelts) {
+        ap_log_rerror(APLOG_MARK, APLOG_INFO, 0, r, APLOGNO(10567)
+                "cache: PURGE without any tag");
+        return HTTP_BAD_REQUEST;
+    }
+
+    for (i = 0; i < tags->nelts; ++i) {
+        const char *tag = APR_ARRAY_IDX(tags, i, const char *);
+
+        /* take the record out of the index, then invalidate its entities */
+        if (cache_tag_lock(r) != APR_SUCCESS) {
+            return HTTP_INTERNAL_SERVER_ERROR;
+        }
+        record = cache_tag_retrieve(r, tag, &len);
+        if (record) {
+            tag_socache->remove(tag_instance, r->server,
+                                (const unsigned char *)tag, strlen(tag),
+                                r->pool);
+        }
+        apr_global_mutex_unlock(tag_mutex);
+
+        if (!record) {
+            continue;
+        }
+        line = apr_strtok(record, "\n", &last); /* the expiry */
+        while ((line = apr_strtok(NULL, "\n", &last)) != NULL) {
+            count += cache_tag_invalidate(r, apr_pstrdup(r->pool, line));
+        }
+    }
+
+    ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(10568)
+            "cache: PURGE of %d tag(s) invalidated %d cached entities",
+            tags->nelts, count);
+
+    ap_set_content_type(r, "text/plain");
+    ap_rprintf(r, "%d\n", count);
+    return OK;
+}
+
 /*
  * CACHE_SAVE filter
  * ---------------
@@ -1485,6 +1858,9 @@ static apr_status_t cache_save_filter(ap_filter_t *f, apr_bucket_brigade *in)
      * later.
      */
     rv = cache->provider->store_headers(cache->handle, r, info);
+    if (rv == APR_SUCCESS) {
+        cache_tag_store(r, cache, info);
+    }
 
     /* Did we just update the cached headers on a revalidated response?
      *
@@ -2024,9 +2400,17 @@ static void * create_cache_config(apr_pool_t *p, server_rec *s)
     /* by default, run in the quick handler */
     ps->quick = 1;
     ps->quick_set = 0;
+    /* Accept-Encoding is passed through untouched by default */
+    ps->normalize_encoding = 0;
+    ps->normalize_encoding_set = 0;
     /* array of identifiers that should not be used for key calculation */
     ps->ignore_session_id = apr_array_make(p, 10, sizeof(char *));
     ps->ignore_session_id_set = CACHE_IGNORE_SESSION_ID_UNSET;
+    /* array of headers listing the tags of an entity */
+    ps->tag_headers = apr_array_make(p, 2, sizeof(char *));
+    APR_ARRAY_PUSH(ps->tag_headers, const char *) = "Surrogate-Key";
+    APR_ARRAY_PUSH(ps->tag_headers, const char *) = "Cache-Tag";
+    ps->tag_headers_set = 0;
     ps->lock = 0; /* thundering herd lock defaults to off */
     ps->lock_set = 0;
     ps->lockpath = ap_runtime_dir_relative(p, DEFAULT_CACHE_LOCKPATH);
@@ -2067,6 +2451,10 @@ static void * merge_cache_config(apr_pool_t *p, void *basev, void *overridesv)
         (overrides->ignore_session_id_set == CACHE_IGNORE_SESSION_ID_UNSET)
         ? base->ignore_session_id
         : overrides->ignore_session_id;
+    ps->tag_headers =
+        (overrides->tag_headers_set == 0)
+        ? base->tag_headers
+        : overrides->tag_headers;
     ps->lock =
         (overrides->lock_set == 0)
         ? base->lock
@@ -2079,10 +2467,18 @@ static void * merge_cache_config(apr_pool_t *p, void *basev, void *overridesv)
         (overrides->lockmaxage_set == 0)
         ? base->lockmaxage
         : overrides->lockmaxage;
+    ps->lockwait =
+        (overrides->lockwait_set == 0)
+        ? base->lockwait
+        : overrides->lockwait;
     ps->quick =
         (overrides->quick_set == 0)
         ? base->quick
         : overrides->quick;
+    ps->normalize_encoding =
+        (overrides->normalize_encoding_set == 0)
+        ? base->normalize_encoding
+        : overrides->normalize_encoding;
     ps->x_cache =
         (overrides->x_cache_set == 0)
         ? base->x_cache
@@ -2112,6 +2508,19 @@ static const char *set_cache_quick_handler(cmd_parms *parms, void *dummy,
 
 }
 
+static const char *set_cache_normalize_encoding(cmd_parms *parms,
+                                                void *dummy, int flag)
+{
+    cache_server_conf *conf;
+
+    conf =
+        (cache_server_conf *)ap_get_module_config(parms->server->module_config,
+                                                  &cache_module);
+    conf->normalize_encoding = flag;
+    conf->normalize_encoding_set = 1;
+    return NULL;
+}
+
 static const char *set_cache_ignore_no_last_mod(cmd_parms *parms, void *dummy,
                                                 int flag)
 {
@@ -2194,6 +2603,80 @@ static const char *add_ignore_header(cmd_parms *parms, void *dummy,
     return NULL;
 }
 
+static const char *add_tag_header(cmd_parms *parms, void *dummy,
+                                  const char *header)
+{
+    cache_server_conf *conf;
+
+    conf =
+        (cache_server_conf *)ap_get_module_config(parms->server->module_config,
+                                                  &cache_module);
+    if (!conf->tag_headers_set) {
+        /* replace the defaults */
+        conf->tag_headers = apr_array_make(parms->pool, 2, sizeof(char *));
+        conf->tag_headers_set = 1;
+    }
+    if (!strcasecmp(header, "None")) {
+        conf->tag_headers->nelts = 0;
+    }
+    else {
+        APR_ARRAY_PUSH(conf->tag_headers, const char *) = header;
+    }
+    return NULL;
+}
+
+static const char *set_cache_tag_socache(cmd_parms *parms, void *dummy,
+                                         const char *arg)
+{
+    const char *err, *sep, *name;
+
+    err = ap_check_cmd_context(parms, GLOBAL_ONLY);
+    if (err) {
+        return err;
+    }
+
+    /* Argument is of form 'name:args' or just 'name'. */
+    sep = ap_strchr_c(arg, ':');
+    if (sep) {
+        name = apr_pstrmemdup(parms->pool, arg, sep - arg);
+        tag_socache_args = sep + 1;
+    }
+    else {
+        name = arg;
+        tag_socache_args = NULL;
+    }
+
+    tag_socache = ap_lookup_provider(AP_SOCACHE_PROVIDER_GROUP, name,
+                                     AP_SOCACHE_PROVIDER_VERSION);
+    if (tag_socache == NULL) {
+        return apr_psprintf(parms->pool,
+                            "Unknown socache provider '%s'. Maybe you need "
+                            "to load the appropriate socache module "
+                            "(mod_socache_%s?)", name, name);
+    }
+    return NULL;
+}
+
+static const char *set_cache_tag_maxsize(cmd_parms *parms, void *dummy,
+                                         const char *arg)
+{
+    const char *err;
+    apr_off_t size;
+
+    err = ap_check_cmd_context(parms, GLOBAL_ONLY);
+    if (err) {
+        return err;
+    }
+
+    if (apr_strtoff(&size, arg, NULL, 10) != APR_SUCCESS
+            || size < 1024 || size > APR_INT32_MAX) {
+        return "CacheTagMaxSize argument must be the maximum size in bytes "
+               "of the index record of a tag, at least 1024";
+    }
+    tag_maxsize = (apr_size_t)size;
+    return NULL;
+}
+
 static const char *add_ignore_session_id(cmd_parms *parms, void *dummy,
                                          const char *identifier)
 {
@@ -2430,6 +2913,25 @@ static const char *set_cache_lock_maxage(cmd_parms *parms, void *dummy,
     return NULL;
 }
 
+static const char *set_cache_lock_wait(cmd_parms *parms, void *dummy,
+                                       const char *arg)
+{
+    cache_server_conf *conf;
+    apr_interval_time_t timeout;
+
+    conf =
+        (cache_server_conf *)ap_get_module_config(parms->server->module_config,
+                                                  &cache_module);
+    if (ap_timeout_parameter_parse(arg, &timeout, "ms") != APR_SUCCESS
+        || timeout < 0) {
+        return "CacheLockWait must be a positive timeout (in milliseconds "
+               "by default)";
+    }
+    conf->lockwait = timeout;
+    conf->lockwait_set = 1;
+    return NULL;
+}
+
 static const char *set_cache_x_cache(cmd_parms *parms, void *dummy, int flag)
 {
 
@@ -2508,9 +3010,45 @@ static const char *set_cache_stale_on_error(cmd_parms *parms, void *dummy,
     return NULL;
 }
 
+static int cache_pre_config(apr_pool_t *pconf, apr_pool_t *plog,
+                            apr_pool_t *ptemp)
+{
+    apr_status_t rv = ap_mutex_register(pconf, cache_tag_id, NULL,
+                                        APR_LOCK_DEFAULT, 0);
+    if (rv != APR_SUCCESS) {
+        ap_log_perror(APLOG_MARK, APLOG_CRIT, rv, plog, APLOGNO(10569)
+                "failed to register %s mutex", cache_tag_id);
+        return 500; /* An HTTP status would be a misnomer! */
+    }
+
+    tag_socache = NULL;
+    tag_socache_args = NULL;
+    tag_maxsize = DEFAULT_CACHE_TAG_MAXSIZE;
+    return OK;
+}
+
+static apr_status_t cache_tag_cleanup(void *data)
+{
+    server_rec *s = data;
+
+    if (tag_instance) {
+        tag_socache->destroy(tag_instance, s);
+        tag_instance = NULL;
+    }
+    if (tag_mutex) {
+        apr_global_mutex_destroy(tag_mutex);
+        tag_mutex = NULL;
+    }
+    return APR_SUCCESS;
+}
+
 static int cache_post_config(apr_pool_t *p, apr_pool_t *plog,
                              apr_pool_t *ptemp, server_rec *s)
 {
+    static struct ap_socache_hints tag_hints = { 32, 1024, 60000000 };
+    const char *errmsg;
+    apr_status_t rv;
+
     /* This is the means by which unusual (non-unix) os's may find alternate
      * means to run a given command (e.g. shebang/registry parsing on Win32)
      */
@@ -2518,9 +3056,57 @@ static int cache_post_config(apr_pool_t *p, apr_pool_t *plog,
     if (!cache_generate_key) {
         cache_generate_key = cache_generate_key_default;
     }
+
+    tag_purge_method = ap_method_register(p, "PURGE");
+
+    if (ap_state_query(AP_SQ_MAIN_STATE) == AP_SQ_MS_CREATE_PRE_CONFIG
+            || !tag_socache) {
+        return OK;
+    }
+
+    /* the records are read, modified and written back under the mutex */
+    rv = ap_global_mutex_create(&tag_mutex, NULL, cache_tag_id, NULL, s, p, 0);
+    if (rv != APR_SUCCESS) {
+        ap_log_perror(APLOG_MARK, APLOG_CRIT, rv, plog, APLOGNO(10570)
+                "failed to create %s mutex", cache_tag_id);
+        return 500; /* An HTTP status would be a misnomer! */
+    }
+    apr_pool_cleanup_register(p, s, cache_tag_cleanup, apr_pool_cleanup_null);
+
+    errmsg = tag_socache->create(&tag_instance, tag_socache_args, ptemp, p);
+    if (errmsg) {
+        ap_log_perror(APLOG_MARK, APLOG_CRIT, 0, plog, APLOGNO(10571)
+                "%s", errmsg);
+        return 500; /* An HTTP status would be a misnomer! */
+    }
+    rv = tag_socache->init(tag_instance, cache_tag_id, &tag_hints, s, p);
+    if (rv != APR_SUCCESS) {
+        ap_log_perror(APLOG_MARK, APLOG_CRIT, rv, plog, APLOGNO(10572)
+                "failed to initialise %s cache", cache_tag_id);
+        tag_instance = NULL;
+        return 500; /* An HTTP status would be a misnomer! */
+    }
+
     return OK;
 }
 
+static void cache_child_init(apr_pool_t *p, server_rec *s)
+{
+    const char *lock;
+    apr_status_t rv;
+
+    if (!tag_mutex) {
+        return;
+    }
+    lock = apr_global_mutex_lockfile(tag_mutex);
+    rv = apr_global_mutex_child_init(&tag_mutex, lock, p);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_CRIT, rv, s, APLOGNO(10573)
+                "failed to initialise the %s mutex in child_init",
+                cache_tag_id);
+    }
+}
+
 
 static const command_rec cache_cmds[] =
 {
@@ -2547,6 +3133,10 @@ static const command_rec cache_cmds[] =
     AP_INIT_FLAG("CacheQuickHandler", set_cache_quick_handler, NULL,
                  RSRC_CONF,
                  "Run the cache in the quick handler, default on"),
+    AP_INIT_FLAG("CacheNormalizeEncoding", set_cache_normalize_encoding, NULL,
+                 RSRC_CONF,
+                 "Reduce Accept-Encoding to br and gzip before the cache "
+                 "lookup, default off"),
     AP_INIT_FLAG("CacheIgnoreNoLastMod", set_cache_ignore_no_last_mod, NULL,
                  RSRC_CONF|ACCESS_CONF,
                  "Ignore Responses where there is no Last Modified Header"),
@@ -2566,6 +3156,15 @@ static const command_rec cache_cmds[] =
     AP_INIT_ITERATE("CacheIgnoreHeaders", add_ignore_header, NULL, RSRC_CONF,
                     "A space separated list of headers that should not be "
                     "stored by the cache"),
+    AP_INIT_ITERATE("CacheTagHeader", add_tag_header, NULL, RSRC_CONF,
+                    "A space separated list of the response headers listing "
+                    "the tags of an entity, Surrogate-Key and Cache-Tag by "
+                    "default"),
+    AP_INIT_TAKE1("CacheTagSocache", set_cache_tag_socache, NULL, RSRC_CONF,
+                  "The shared object cache indexing the cached entities "
+                  "by tag, for PURGE by tag"),
+    AP_INIT_TAKE1("CacheTagMaxSize", set_cache_tag_maxsize, NULL, RSRC_CONF,
+                  "The maximum size in bytes of the index record of a tag"),
     AP_INIT_FLAG("CacheIgnoreQueryString", set_cache_ignore_querystring,
                  NULL, RSRC_CONF,
                  "Ignore query-string when caching"),
@@ -2585,6 +3184,9 @@ static const command_rec cache_cmds[] =
                   "DefaultRuntimeDir setting."),
     AP_INIT_TAKE1("CacheLockMaxAge", set_cache_lock_maxage, NULL, RSRC_CONF,
                   "Maximum age of any thundering herd lock."),
+    AP_INIT_TAKE1("CacheLockWait", set_cache_lock_wait, NULL, RSRC_CONF,
+                  "How long a cache miss waits for the request holding the "
+                  "thundering herd lock to fill the cache."),
     AP_INIT_FLAG("CacheHeader", set_cache_x_cache, NULL, RSRC_CONF | ACCESS_CONF,
                  "Add a X-Cache header to responses. Default is off."),
     AP_INIT_FLAG("CacheDetailHeader", set_cache_x_cache_detail, NULL,
@@ -2605,6 +3207,8 @@ static void register_hooks(apr_pool_t *p)
     ap_hook_quick_handler(cache_quick_handler, NULL, NULL, APR_HOOK_FIRST);
     /* cache handler */
     ap_hook_handler(cache_handler, NULL, NULL, APR_HOOK_REALLY_FIRST);
+    /* PURGE by tag */
+    ap_hook_handler(cache_tag_handler, NULL, NULL, APR_HOOK_MIDDLE);
     /* cache status */
     cache_hook_cache_status(cache_status, NULL, NULL, APR_HOOK_MIDDLE);
     /* cache error handler */
@@ -2688,7 +3292,9 @@ static void register_hooks(apr_pool_t *p)
                                   cache_invalidate_filter,
                                   NULL,
                                   AP_FTYPE_PROTOCOL);
+    ap_hook_pre_config(cache_pre_config, NULL, NULL, APR_HOOK_MIDDLE);
     ap_hook_post_config(cache_post_config, NULL, NULL, APR_HOOK_REALLY_FIRST);
+    ap_hook_child_init(cache_child_init, NULL, NULL, APR_HOOK_MIDDLE);
 }
 
 AP_DECLARE_MODULE(cache) =
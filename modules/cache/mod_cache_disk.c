@@ -17,6 +17,12 @@
 #include "apr_lib.h"
 #include "apr_file_io.h"
 #include "apr_strings.h"
+#include "apr_hash.h"
+#if APR_HAS_THREADS
+#include "apr_thread_mutex.h"
+#include "apr_thread_cond.h"
+#include "apr_thread_proc.h"
+#endif
 #include "mod_cache.h"
 #include "mod_cache_disk.h"
 #include "http_config.h"
@@ -26,6 +32,7 @@
 #include "util_filter.h"
 #include "util_script.h"
 #include "util_charset.h"
+#include "ap_mpm.h"
 
 /*
  * mod_cache_disk: Disk Based HTTP 1.1 Cache.
@@ -67,6 +74,305 @@ static apr_status_t recall_body(cache_handle_t *h, apr_pool_t *p, apr_bucket_bri
 static apr_status_t read_array(request_rec *r, apr_array_header_t* arr,
                                apr_file_t *file);
 
+/*
+ * The in-memory tier (CacheDiskMemCache).
+ *
+ * Each child keeps the parsed headers of the most recently recalled
+ * entities, and their body when small enough, so that a hit only costs a
+ * stat() of the header file to check that it was not replaced or removed
+ * since.  The entities whose header file is a Vary list are not kept.
+ */
+typedef struct disk_cache_mem_entry disk_cache_mem_entry;
+struct disk_cache_mem_entry {
+    disk_cache_mem_entry *prev;  /* LRU list, most recent first */
+    disk_cache_mem_entry *next;
+    apr_pool_t *pool;
+    const char *file;            /* header file, the key */
+    apr_ino_t inode;             /* identity of the header file */
+    apr_dev_t device;
+    apr_time_t mtime;
+    apr_off_t size;
+    disk_cache_info_t disk_info;
+    apr_table_t *resp_hdrs;
+    apr_table_t *req_hdrs;
+    char *body;                  /* NULL if read from the data file */
+    apr_size_t body_len;
+};
+
+struct disk_cache_mem_hit {
+    apr_table_t *resp_hdrs;
+    apr_table_t *req_hdrs;
+    char *body;
+    apr_size_t body_len;
+    apr_pool_t *pool;            /* of the body */
+};
+
+#define DEFAULT_MEM_MAX_BODY 16384
+
+static int mem_max_entries = 0, mem_nelts;
+static apr_size_t mem_max_body = DEFAULT_MEM_MAX_BODY;
+static apr_hash_t *mem_entries;
+static disk_cache_mem_entry *mem_head, *mem_tail;
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *mem_mutex;
+#endif
+
+static void mem_lock(void)
+{
+#if APR_HAS_THREADS
+    if (mem_mutex) {
+        apr_thread_mutex_lock(mem_mutex);
+    }
+#endif
+}
+
+static void mem_unlock(void)
+{
+#if APR_HAS_THREADS
+    if (mem_mutex) {
+        apr_thread_mutex_unlock(mem_mutex);
+    }
+#endif
+}
+
+static apr_table_t *mem_copy_table(apr_pool_t *p, const apr_table_t *t)
+{
+    const apr_array_header_t *elts = apr_table_elts(t);
+    const apr_table_entry_t *e = (const apr_table_entry_t *)elts->elts;
+    apr_table_t *copy = apr_table_make(p, elts->nelts);
+    int i;
+
+    for (i = 0; i < elts->nelts; i++) {
+        apr_table_addn(copy, apr_pstrdup(p, e[i].key),
+                       apr_pstrdup(p, e[i].val));
+    }
+    return copy;
+}
+
+/* called with the lock held */
+static void mem_unlink(disk_cache_mem_entry *e)
+{
+    if (e->prev) {
+        e->prev->next = e->next;
+    }
+    else {
+        mem_head = e->next;
+    }
+    if (e->next) {
+        e->next->prev = e->prev;
+    }
+    else {
+        mem_tail = e->prev;
+    }
+    e->prev = e->next = NULL;
+}
+
+/* called with the lock held */
+static void mem_remove(disk_cache_mem_entry *e)
+{
+    mem_unlink(e);
+    apr_hash_set(mem_entries, e->file, APR_HASH_KEY_STRING, NULL);
+    mem_nelts--;
+    apr_pool_destroy(e->pool);
+}
+
+static void mem_forget(const char *file)
+{
+    disk_cache_mem_entry *e;
+
+    if (!mem_entries) {
+        return;
+    }
+    mem_lock();
+    e = apr_hash_get(mem_entries, file, APR_HASH_KEY_STRING);
+    if (e) {
+        mem_remove(e);
+    }
+    mem_unlock();
+}
+
+/*
+ * Look the header file up in the in-memory tier, copying the entity to
+ * the request if it is still the one on disk.
+ */
+static disk_cache_mem_hit *mem_lookup(request_rec *r, const char *file,
+                                     disk_cache_info_t *disk_info)
+{
+    disk_cache_mem_entry *e;
+    disk_cache_mem_hit *hit = NULL;
+    apr_finfo_t finfo;
+    apr_status_t rv;
+
+    if (!mem_entries) {
+        return NULL;
+    }
+
+    rv = apr_stat(&finfo, file, APR_FINFO_IDENT | APR_FINFO_MTIME
+                                | APR_FINFO_SIZE, r->pool);
+
+    mem_lock();
+    e = apr_hash_get(mem_entries, file, APR_HASH_KEY_STRING);
+    if (e) {
+        if (rv != APR_SUCCESS || finfo.inode != e->inode
+            || finfo.device != e->device || finfo.mtime != e->mtime
+            || finfo.size != e->size) {
+            /* replaced or removed */
+            mem_remove(e);
+        }
+        else {
+            hit = apr_palloc(r->pool, sizeof(*hit));
+            hit->resp_hdrs = mem_copy_table(r->pool, e->resp_hdrs);
+            hit->req_hdrs = mem_copy_table(r->pool, e->req_hdrs);
+            hit->pool = r->pool;
+            hit->body = e->body ? apr_pmemdup(r->pool, e->body, e->body_len)
+                                : NULL;
+            hit->body_len = e->body_len;
+            *disk_info = e->disk_info;
+
+            if (e != mem_head) {
+                mem_unlink(e);
+                e->next = mem_head;
+                mem_head->prev = e;
+                mem_head = e;
+            }
+        }
+    }
+    mem_unlock();
+
+    return hit;
+}
+
+/*
+ * Keep the entity just recalled from disk in the in-memory tier.
+ */
+static void mem_store(request_rec *r, cache_handle_t *h,
+                      disk_cache_object_t *dobj)
+{
+    disk_cache_mem_entry *e, *old;
+    apr_finfo_t finfo;
+    apr_pool_t *pool;
+    char *body = NULL;
+    apr_size_t body_len = 0;
+
+    if (!mem_entries || dobj->prefix) {
+        return;
+    }
+    if (apr_file_info_get(&finfo, APR_FINFO_IDENT | APR_FINFO_MTIME
+                                  | APR_FINFO_SIZE, dobj->hdrs.fd)
+            != APR_SUCCESS) {
+        return;
+    }
+
+    if (dobj->disk_info.has_body && dobj->data.fd
+        && dobj->file_size <= (apr_off_t)mem_max_body) {
+        apr_off_t offset = 0;
+
+        body_len = (apr_size_t)dobj->file_size;
+        body = apr_palloc(r->pool, body_len ? body_len : 1);
+        if (apr_file_read_full(dobj->data.fd, body, body_len, NULL)
+                != APR_SUCCESS) {
+            body = NULL;
+        }
+        apr_file_seek(dobj->data.fd, APR_SET, &offset);
+    }
+
+    /* a root pool, the entries are created and destroyed by any thread */
+    if (apr_pool_create(&pool, NULL) != APR_SUCCESS) {
+        return;
+    }
+    apr_pool_tag(pool, "mod_cache_disk (mem)");
+    e = apr_pcalloc(pool, sizeof(*e));
+    e->pool = pool;
+    e->file = apr_pstrdup(pool, dobj->hdrs.file);
+    e->inode = finfo.inode;
+    e->device = finfo.device;
+    e->mtime = finfo.mtime;
+    e->size = finfo.size;
+    e->disk_info = dobj->disk_info;
+    e->resp_hdrs = mem_copy_table(pool, h->resp_hdrs);
+    e->req_hdrs = mem_copy_table(pool, h->req_hdrs);
+    if (body) {
+        e->body = apr_pmemdup(pool, body, body_len ? body_len : 1);
+        e->body_len = body_len;
+    }
+
+    mem_lock();
+    old = apr_hash_get(mem_entries, e->file, APR_HASH_KEY_STRING);
+    if (old) {
+        mem_remove(old);
+    }
+    while (mem_nelts >= mem_max_entries && mem_tail) {
+        mem_remove(mem_tail);
+    }
+    apr_hash_set(mem_entries, e->file, APR_HASH_KEY_STRING, e);
+    e->next = mem_head;
+    if (mem_head) {
+        mem_head->prev = e;
+    }
+    else {
+        mem_tail = e;
+    }
+    mem_head = e;
+    mem_nelts++;
+    mem_unlock();
+}
+
+/*
+ * The journal (CacheDiskJournal), see cache_disk_common.h
+ */
+static void journal_write(request_rec *r, disk_cache_conf *conf, char event,
+                          const char *file, const char *fields)
+{
+    const char *name, *journal, *line;
+    apr_file_t *fd;
+    apr_finfo_t finfo;
+    apr_size_t len;
+    apr_status_t rv;
+
+    /* the name relative to the cache root, without the header suffix */
+    len = strlen(file);
+    if (len <= conf->cache_root_len + sizeof(CACHE_HEADER_SUFFIX)
+        || strncmp(file, conf->cache_root, conf->cache_root_len)) {
+        return;
+    }
+    name = apr_pstrmemdup(r->pool, file + conf->cache_root_len + 1,
+                          len - conf->cache_root_len - 1
+                          - (sizeof(CACHE_HEADER_SUFFIX) - 1));
+
+    line = apr_psprintf(r->pool, "%c %" APR_TIME_T_FMT " %s%s\n", event,
+                        apr_time_now(), fields ? fields : "", name);
+    len = strlen(line);
+
+    /* one open and one write per event, so that htcacheclean can rename
+     * the journal away at any time */
+    journal = apr_pstrcat(r->pool, conf->cache_root, "/" CACHE_JOURNAL_FILE,
+                          NULL);
+    rv = apr_file_open(&fd, journal, APR_FOPEN_WRITE | APR_FOPEN_CREATE
+                       | APR_FOPEN_APPEND | APR_FOPEN_BINARY,
+                       APR_FPROT_UREAD | APR_FPROT_UWRITE, r->pool);
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, rv, r, APLOGNO(10435)
+                "Cannot open the cache journal %s", journal);
+        return;
+    }
+    if (apr_file_info_get(&finfo, APR_FINFO_SIZE, fd) == APR_SUCCESS
+        && finfo.size + (apr_off_t)len >= CACHE_JOURNAL_MAX) {
+        /* htcacheclean is not keeping up, or not running: tell it to
+         * rescan, once */
+        if (finfo.size < CACHE_JOURNAL_MAX) {
+            line = apr_psprintf(r->pool, "%c\n", CACHE_JOURNAL_OVERFLOW);
+            len = strlen(line);
+        }
+        else {
+            len = 0;
+        }
+    }
+    if (len) {
+        apr_file_write_full(fd, line, len, NULL);
+    }
+    apr_file_close(fd);
+}
+
 /*
  * Local static functions
  */
@@ -211,6 +517,366 @@ static apr_status_t file_cache_create(disk_cache_conf *conf, disk_cache_file_t *
     return APR_SUCCESS;
 }
 
+/*
+ * The write behind (CacheDiskWriteBehind): the request copies the body to
+ * jobs queued to a writer thread of the child, which writes the data file
+ * and, after the last job, moves the data and header files in place. The
+ * copies not yet written are limited to wb_max bytes per child, an entity
+ * which would exceed it is not cached rather than waiting for the disk.
+ */
+struct disk_cache_wb_entity {
+    apr_pool_t *pool;            /* the writer's, for all of the below */
+    disk_cache_conf *conf;
+    const char *name;
+    apr_file_t *fd;              /* the data tempfile */
+    char *tempfile;
+    const char *file;
+    char *hdrs_tempfile;         /* NULL until committed */
+    const char *hdrs_file;
+    char *vary_tempfile;         /* NULL if no Vary */
+    const char *vary_file;
+    apr_status_t rv;             /* of the first failed write */
+};
+
+static apr_size_t wb_max = 0;
+
+#if APR_HAS_THREADS
+typedef struct disk_cache_wb_job disk_cache_wb_job;
+struct disk_cache_wb_job {
+    disk_cache_wb_job *next;
+    disk_cache_wb_entity *e;
+    apr_size_t len;              /* of the data following the job */
+    int commit;                  /* for the last job, with no data */
+};
+
+static server_rec *wb_server;
+static apr_pool_t *wb_pool;
+static apr_thread_t *wb_thread;
+static apr_thread_mutex_t *wb_mutex;
+static apr_thread_cond_t *wb_cond;
+static disk_cache_wb_job *wb_head, *wb_tail;
+static apr_size_t wb_inflight;
+static int wb_stopping;
+
+static void wb_queue(disk_cache_wb_job *job)
+{
+    job->next = NULL;
+    if (wb_tail) {
+        wb_tail->next = job;
+    }
+    else {
+        wb_head = job;
+    }
+    wb_tail = job;
+    apr_thread_cond_signal(wb_cond);
+}
+
+static void wb_end(disk_cache_wb_entity *e, int commit)
+{
+    disk_cache_wb_job *job = ap_malloc(sizeof(*job));
+
+    job->e = e;
+    job->len = 0;
+    job->commit = commit;
+
+    apr_thread_mutex_lock(wb_mutex);
+    wb_queue(job);
+    apr_thread_mutex_unlock(wb_mutex);
+}
+
+/* the entity goes away without being committed */
+static apr_status_t wb_entity_cleanup(void *data)
+{
+    disk_cache_object_t *dobj = data;
+
+    if (dobj->wb && wb_thread) {
+        wb_end(dobj->wb, 0);
+        dobj->wb = NULL;
+    }
+    return APR_SUCCESS;
+}
+
+static apr_status_t wb_open(disk_cache_conf *conf, disk_cache_object_t *dobj)
+{
+    disk_cache_wb_entity *e;
+    apr_finfo_t finfo;
+    apr_pool_t *pool;
+    apr_status_t rv;
+
+    if (!wb_thread) {
+        return APR_ENOTIMPL;
+    }
+
+    apr_pool_create(&pool, wb_pool);
+    apr_pool_tag(pool, "mod_cache_disk (write behind)");
+    e = apr_pcalloc(pool, sizeof(*e));
+    e->pool = pool;
+    e->conf = conf;
+    e->name = apr_pstrdup(pool, dobj->name);
+    e->tempfile = apr_pstrdup(pool, dobj->data.tempfile);
+    e->file = apr_pstrdup(pool, dobj->data.file);
+
+    rv = apr_file_mktemp(&e->fd, e->tempfile, APR_CREATE | APR_WRITE
+                         | APR_BINARY | APR_BUFFERED | APR_EXCL, pool);
+    if (rv == APR_SUCCESS) {
+        rv = apr_file_info_get(&finfo, APR_FINFO_IDENT, e->fd);
+        if (rv != APR_SUCCESS) {
+            apr_file_close(e->fd);
+            apr_file_remove(e->tempfile, pool);
+        }
+    }
+    if (rv != APR_SUCCESS) {
+        apr_pool_destroy(pool);
+        return rv;
+    }
+
+    dobj->file_size = 0;
+    dobj->disk_info.device = finfo.device;
+    dobj->disk_info.inode = finfo.inode;
+    dobj->disk_info.has_body = 1;
+    dobj->wb = e;
+    apr_pool_cleanup_register(dobj->data.pool, dobj, wb_entity_cleanup,
+                              apr_pool_cleanup_null);
+
+    return APR_SUCCESS;
+}
+
+static apr_status_t wb_write(disk_cache_object_t *dobj, const char *str,
+                             apr_size_t length)
+{
+    disk_cache_wb_job *job = ap_malloc(sizeof(*job) + length);
+
+    job->e = dobj->wb;
+    job->len = length;
+    job->commit = 0;
+    memcpy(job + 1, str, length);
+
+    apr_thread_mutex_lock(wb_mutex);
+    if (wb_inflight + length > wb_max) {
+        apr_thread_mutex_unlock(wb_mutex);
+        free(job);
+        return APR_ENOSPC;
+    }
+    wb_inflight += length;
+    wb_queue(job);
+    apr_thread_mutex_unlock(wb_mutex);
+
+    return APR_SUCCESS;
+}
+
+/* hand the header tempfiles, already written, over to the writer */
+static void wb_commit(disk_cache_object_t *dobj)
+{
+    disk_cache_wb_entity *e = dobj->wb;
+
+    if (dobj->hdrs.tempfd) {
+        e->hdrs_tempfile = apr_pstrdup(e->pool, dobj->hdrs.tempfile);
+        e->hdrs_file = apr_pstrdup(e->pool, dobj->hdrs.file);
+        dobj->hdrs.tempfd = NULL;
+    }
+    if (dobj->vary.tempfd) {
+        e->vary_tempfile = apr_pstrdup(e->pool, dobj->vary.tempfile);
+        e->vary_file = apr_pstrdup(e->pool, dobj->vary.file);
+        dobj->vary.tempfd = NULL;
+    }
+
+    dobj->wb = NULL;
+    wb_end(e, 1);
+}
+
+/* the data first, so that the headers never point to a partial body */
+static void wb_finish(disk_cache_wb_entity *e, int commit)
+{
+    char **temps[3];
+    const char *files[3];
+    apr_status_t rv;
+    int i, n = 0;
+
+    rv = apr_file_close(e->fd);
+    if (e->rv == APR_SUCCESS) {
+        e->rv = rv;
+    }
+
+    temps[n] = &e->tempfile;
+    files[n++] = e->file;
+    if (e->hdrs_tempfile) {
+        temps[n] = &e->hdrs_tempfile;
+        files[n++] = e->hdrs_file;
+    }
+    if (e->vary_tempfile) {
+        temps[n] = &e->vary_tempfile;
+        files[n++] = e->vary_file;
+    }
+
+    rv = e->rv;
+    for (i = 0; commit && rv == APR_SUCCESS && i < n; i++) {
+        rv = safe_file_rename(e->conf, *temps[i], files[i], e->pool);
+        if (rv != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_WARNING, rv, wb_server,
+                         APLOGNO(10588) "rename tempfile to file failed:"
+                         " %s -> %s", *temps[i], files[i]);
+            /* don't leave a part of the entity behind */
+            while (i--) {
+                apr_file_remove(files[i], e->pool);
+            }
+            break;
+        }
+        *temps[i] = NULL;
+    }
+    for (i = 0; i < n; i++) {
+        if (*temps[i]) {
+            apr_file_remove(*temps[i], e->pool);
+        }
+    }
+
+    if (commit && rv == APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, wb_server, APLOGNO(10589)
+                     "Headers and body for URL %s written behind.", e->name);
+    }
+
+    apr_pool_destroy(e->pool);
+}
+
+static void * APR_THREAD_FUNC wb_run(apr_thread_t *thd, void *data)
+{
+    disk_cache_wb_job *job;
+    disk_cache_wb_entity *e;
+
+    apr_thread_mutex_lock(wb_mutex);
+    for (;;) {
+        while (!wb_head && !wb_stopping) {
+            apr_thread_cond_wait(wb_cond, wb_mutex);
+        }
+        /* when stopping, the queue is drained first */
+        if (!(job = wb_head)) {
+            break;
+        }
+        if (!(wb_head = job->next)) {
+            wb_tail = NULL;
+        }
+        apr_thread_mutex_unlock(wb_mutex);
+
+        e = job->e;
+        if (job->len) {
+            if (e->rv == APR_SUCCESS) {
+                e->rv = apr_file_write_full(e->fd, job + 1, job->len, NULL);
+                if (e->rv != APR_SUCCESS) {
+                    ap_log_error(APLOG_MARK, APLOG_ERR, e->rv, wb_server,
+                                 APLOGNO(10590) "Error when writing cache "
+                                 "file for URL %s", e->name);
+                }
+            }
+        }
+        else {
+            wb_finish(e, job->commit);
+        }
+
+        apr_thread_mutex_lock(wb_mutex);
+        wb_inflight -= job->len;
+        free(job);
+    }
+    apr_thread_mutex_unlock(wb_mutex);
+
+    return NULL;
+}
+
+static apr_status_t wb_child_stop(void *data)
+{
+    apr_status_t rv;
+
+    apr_thread_mutex_lock(wb_mutex);
+    wb_stopping = 1;
+    apr_thread_cond_signal(wb_cond);
+    apr_thread_mutex_unlock(wb_mutex);
+
+    apr_thread_join(&rv, wb_thread);
+    wb_thread = NULL;
+    apr_pool_destroy(wb_pool);
+
+    return APR_SUCCESS;
+}
+
+static void wb_child_init(apr_pool_t *pchild, server_rec *s)
+{
+    apr_allocator_t *allocator;
+    apr_thread_mutex_t *mutex;
+    apr_status_t rv;
+
+    wb_thread = NULL;
+    wb_head = wb_tail = NULL;
+    wb_inflight = 0;
+    wb_stopping = 0;
+    if (!wb_max) {
+        return;
+    }
+    wb_server = s;
+
+    /* the requests create the entities' pools concurrently */
+    rv = apr_allocator_create(&allocator);
+    if (rv == APR_SUCCESS) {
+        rv = apr_thread_mutex_create(&mutex, APR_THREAD_MUTEX_DEFAULT,
+                                     pchild);
+        if (rv == APR_SUCCESS) {
+            apr_allocator_mutex_set(allocator, mutex);
+            rv = apr_pool_create_ex(&wb_pool, NULL, NULL, allocator);
+        }
+        if (rv != APR_SUCCESS) {
+            apr_allocator_destroy(allocator);
+        }
+    }
+    if (rv == APR_SUCCESS) {
+        apr_allocator_owner_set(allocator, wb_pool);
+        apr_pool_tag(wb_pool, "mod_cache_disk (writer)");
+        if ((rv = apr_thread_mutex_create(&wb_mutex, APR_THREAD_MUTEX_DEFAULT,
+                                          wb_pool)) == APR_SUCCESS
+            && (rv = apr_thread_cond_create(&wb_cond,
+                                            wb_pool)) == APR_SUCCESS) {
+            rv = apr_thread_create(&wb_thread, NULL, wb_run, NULL, wb_pool);
+        }
+        if (rv != APR_SUCCESS) {
+            wb_thread = NULL;
+            apr_pool_destroy(wb_pool);
+        }
+    }
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10591)
+                     "could not start the CacheDiskWriteBehind writer, "
+                     "the bodies are written by the requests");
+        return;
+    }
+
+    apr_pool_cleanup_register(pchild, NULL, wb_child_stop,
+                              apr_pool_cleanup_null);
+}
+#else
+static apr_status_t wb_open(disk_cache_conf *conf, disk_cache_object_t *dobj)
+{
+    return APR_ENOTIMPL;
+}
+
+static apr_status_t wb_write(disk_cache_object_t *dobj, const char *str,
+                             apr_size_t length)
+{
+    return APR_ENOTIMPL;
+}
+
+static void wb_commit(disk_cache_object_t *dobj)
+{
+}
+#endif
+
+static void disk_info_to_cache_info(cache_info *info,
+                                    const disk_cache_info_t *disk_info)
+{
+    info->status = disk_info->status;
+    info->date = disk_info->date;
+    info->expire = disk_info->expire;
+    info->request_time = disk_info->request_time;
+    info->response_time = disk_info->response_time;
+
+    memcpy(&info->control, &disk_info->control, sizeof(cache_control_t));
+}
+
 /* These two functions get and put state information into the data
  * file for an ap_cache_el, this state information will be read
  * and written transparent to clients of this module
@@ -230,13 +896,7 @@ static int file_cache_recall_mydata(apr_file_t *fd, cache_info *info,
     }
 
     /* Store it away so we can get it later. */
-    info->status = dobj->disk_info.status;
-    info->date = dobj->disk_info.date;
-    info->expire = dobj->disk_info.expire;
-    info->request_time = dobj->disk_info.request_time;
-    info->response_time = dobj->disk_info.response_time;
-
-    memcpy(&info->control, &dobj->disk_info.control, sizeof(cache_control_t));
+    disk_info_to_cache_info(info, &dobj->disk_info);
 
     /* Note that we could optimize this by conditionally doing the palloc
      * depending upon the size. */
@@ -401,6 +1061,71 @@ static int create_entity(cache_handle_t *h, request_rec *r, const char *key, apr
     return OK;
 }
 
+/*
+ * open_entity() for an entity of the in-memory tier, whose disk_info and
+ * headers were recalled by mem_lookup().
+ */
+static int open_mem_entity(cache_handle_t *h, request_rec *r,
+                           disk_cache_conf *conf, cache_object_t *obj,
+                           disk_cache_object_t *dobj, const char *key,
+                           int dataflags)
+{
+    apr_finfo_t finfo;
+    apr_status_t rc;
+    apr_pool_t *pool;
+
+    dobj->hdrs.file = dobj->vary.file;
+    obj->key = key;
+    dobj->key = key;
+    dobj->name = key;
+
+    apr_pool_create(&pool, r->pool);
+    apr_pool_tag(pool, "mod_cache (open_entity)");
+
+    file_cache_create(conf, &dobj->hdrs, pool);
+    file_cache_create(conf, &dobj->vary, pool);
+    file_cache_create(conf, &dobj->data, pool);
+
+    dobj->data.file = data_file(r->pool, conf, dobj, key);
+
+    disk_info_to_cache_info(&obj->info, &dobj->disk_info);
+
+    if (dobj->disk_info.header_only && !r->header_only) {
+        return DECLINED;
+    }
+
+    if (dobj->disk_info.has_body && dobj->mem->body) {
+        dobj->file_size = dobj->mem->body_len;
+    }
+    else if (dobj->disk_info.has_body) {
+        rc = apr_file_open(&dobj->data.fd, dobj->data.file, dataflags, 0,
+                           r->pool);
+        if (rc != APR_SUCCESS) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, rc, r, APLOGNO(10423)
+                    "Cannot open data file %s", dobj->data.file);
+            return DECLINED;
+        }
+        rc = apr_file_info_get(&finfo, APR_FINFO_SIZE | APR_FINFO_IDENT,
+                dobj->data.fd);
+        if (rc != APR_SUCCESS
+            || dobj->disk_info.inode != finfo.inode
+            || dobj->disk_info.device != finfo.device) {
+            apr_file_close(dobj->data.fd);
+            dobj->data.fd = NULL;
+            return DECLINED;
+        }
+        dobj->file_size = finfo.size;
+    }
+
+    ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(10424)
+            "Recalled cached URL info header %s from memory", dobj->name);
+
+    h->cache_obj = obj;
+    obj->vobj = dobj;
+
+    return OK;
+}
+
 static int open_entity(cache_handle_t *h, request_rec *r, const char *key)
 {
     apr_uint32_t format;
@@ -446,6 +1171,16 @@ static int open_entity(cache_handle_t *h, request_rec *r, const char *key)
     dobj->root_len = conf->cache_root_len;
 
     dobj->vary.file = header_file(r->pool, conf, dobj, key);
+
+    dobj->mem = mem_lookup(r, dobj->vary.file, &dobj->disk_info);
+    if (dobj->mem) {
+        flags = APR_READ | APR_BINARY;
+#ifdef APR_SENDFILE_ENABLED
+        flags |= AP_SENDFILE_ENABLED(coreconf->enable_sendfile);
+#endif
+        return open_mem_entity(h, r, conf, obj, dobj, key, flags);
+    }
+
     flags = APR_READ|APR_BINARY|APR_BUFFERED;
     rc = apr_file_open(&dobj->vary.fd, dobj->vary.file, flags, 0, r->pool);
     if (rc != APR_SUCCESS) {
@@ -636,9 +1371,18 @@ static int remove_url(cache_handle_t *h, request_rec *r)
 
     /* Delete headers file */
     if (dobj->hdrs.file) {
+        disk_cache_conf *conf = ap_get_module_config(r->server->module_config,
+                                                     &cache_disk_module);
+
         ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(00711)
                 "Deleting %s from cache.", dobj->hdrs.file);
 
+        mem_forget(dobj->hdrs.file);
+        if (conf->journal) {
+            journal_write(r, conf, CACHE_JOURNAL_REMOVE, dobj->hdrs.file,
+                          NULL);
+        }
+
         rc = apr_file_remove(dobj->hdrs.file, r->pool);
         if ((rc != APR_SUCCESS) && !APR_STATUS_IS_ENOENT(rc)) {
             /* Will only result in an output if httpd is started with -e debug.
@@ -866,6 +1610,13 @@ static apr_status_t recall_headers(cache_handle_t *h, request_rec *r)
 {
     disk_cache_object_t *dobj = (disk_cache_object_t *) h->cache_obj->vobj;
     apr_status_t rv;
+    int stored = 1;
+
+    if (dobj->mem) {
+        h->resp_hdrs = dobj->mem->resp_hdrs;
+        h->req_hdrs = dobj->mem->req_hdrs;
+        return APR_SUCCESS;
+    }
 
     /* This case should not happen... */
     if (!dobj->hdrs.fd) {
@@ -883,6 +1634,7 @@ static apr_status_t recall_headers(cache_handle_t *h, request_rec *r)
         ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(02987) 
                       "Error reading response headers from %s for %s",
                       dobj->hdrs.file, dobj->name);
+        stored = 0;
     }
     rv = read_table(h, r, h->req_hdrs, dobj->hdrs.fd);
     if (rv != APR_SUCCESS) { 
@@ -890,6 +1642,9 @@ static apr_status_t recall_headers(cache_handle_t *h, request_rec *r)
                       "Error reading request headers from %s for %s",
                       dobj->hdrs.file, dobj->name);
     }
+    else if (stored && mem_max_entries) {
+        mem_store(r, h, dobj);
+    }
 
     apr_file_close(dobj->hdrs.fd);
 
@@ -902,7 +1657,11 @@ static apr_status_t recall_body(cache_handle_t *h, apr_pool_t *p, apr_bucket_bri
 {
     disk_cache_object_t *dobj = (disk_cache_object_t*) h->cache_obj->vobj;
 
-    if (dobj->data.fd) {
+    if (dobj->mem && dobj->mem->body) {
+        APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_pool_create(dobj->mem->body,
+                dobj->mem->body_len, dobj->mem->pool, bb->bucket_alloc));
+    }
+    else if (dobj->data.fd) {
         apr_brigade_insert_file(bb, dobj->data.fd, 0, dobj->file_size, p);
     }
 
@@ -1141,6 +1900,8 @@ static apr_status_t store_body(cache_handle_t *h, request_rec *r,
     apr_status_t rv = APR_SUCCESS;
     disk_cache_object_t *dobj = (disk_cache_object_t *) h->cache_obj->vobj;
     disk_cache_dir_conf *dconf = ap_get_module_config(r->per_dir_config, &cache_disk_module);
+    disk_cache_conf *conf = ap_get_module_config(r->server->module_config,
+                                                 &cache_disk_module);
     int seen_eos = 0;
 
     if (!dobj->offset) {
@@ -1213,7 +1974,14 @@ static apr_status_t store_body(cache_handle_t *h, request_rec *r,
             /* Attempt to create the data file at the last possible moment, if
              * the body is empty, we don't write a file at all, and save an inode.
              */
-            if (!dobj->data.tempfd) {
+            if (!dobj->data.tempfd && !dobj->wb) {
+                rv = wb_open(conf, dobj);
+                if (rv != APR_SUCCESS && rv != APR_ENOTIMPL) {
+                    apr_pool_destroy(dobj->data.pool);
+                    return rv;
+                }
+            }
+            if (!dobj->data.tempfd && !dobj->wb) {
                 apr_finfo_t finfo;
                 rv = apr_file_mktemp(&dobj->data.tempfd, dobj->data.tempfile,
                         APR_CREATE | APR_WRITE | APR_BINARY | APR_BUFFERED
@@ -1234,9 +2002,21 @@ static apr_status_t store_body(cache_handle_t *h, request_rec *r,
                 dobj->disk_info.has_body = 1;
             }
 
-            /* write to the cache, leave if we fail */
-            rv = apr_file_write_full(dobj->data.tempfd, str, length, &written);
-            if (rv != APR_SUCCESS) {
+            /* write to the cache, or queue to the writer, leave if we fail */
+            if (dobj->wb) {
+                rv = wb_write(dobj, str, length);
+                if (rv != APR_SUCCESS) {
+                    ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(10592)
+                            "URL %s not cached, more than %" APR_SIZE_T_FMT
+                            " bytes are waiting to be written behind",
+                            h->cache_obj->key, wb_max);
+                    apr_pool_destroy(dobj->data.pool);
+                    return rv;
+                }
+                written = length;
+            }
+            else if ((rv = apr_file_write_full(dobj->data.tempfd, str, length,
+                                               &written)) != APR_SUCCESS) {
                 ap_log_rerror(
                         APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(00731) "Error when writing cache file for URL %s", h->cache_obj->key);
                 /* Remove the intermediate cache file and return non-APR_SUCCESS */
@@ -1324,6 +2104,24 @@ static apr_status_t store_body(cache_handle_t *h, request_rec *r,
     return APR_SUCCESS;
 }
 
+static void journal_store(cache_handle_t *h, request_rec *r,
+                          disk_cache_conf *conf, const char *hdrs)
+{
+    disk_cache_object_t *dobj = (disk_cache_object_t *) h->cache_obj->vobj;
+    apr_finfo_t finfo;
+
+    if (apr_stat(&finfo, hdrs, APR_FINFO_SIZE, r->pool) == APR_SUCCESS) {
+        journal_write(r, conf, CACHE_JOURNAL_STORE, dobj->hdrs.file,
+                apr_psprintf(r->pool, "%" APR_OFF_T_FMT " %"
+                        APR_OFF_T_FMT " %" APR_TIME_T_FMT " %"
+                        APR_TIME_T_FMT " ", finfo.size,
+                        dobj->disk_info.header_only
+                                ? (apr_off_t)0 : dobj->file_size,
+                        h->cache_obj->info.expire,
+                        h->cache_obj->info.response_time));
+    }
+}
+
 static apr_status_t commit_entity(cache_handle_t *h, request_rec *r)
 {
     disk_cache_conf *conf = ap_get_module_config(r->server->module_config,
@@ -1334,6 +2132,19 @@ static apr_status_t commit_entity(cache_handle_t *h, request_rec *r)
     /* write the headers to disk at the last possible moment */
     rv = write_headers(h, r);
 
+    /* the writer moves the files once it wrote the body */
+    if (APR_SUCCESS == rv && dobj->wb) {
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(10593)
+                "commit_entity: Headers and body for URL %s queued to be "
+                "written behind.", dobj->name);
+        if (conf->journal) {
+            journal_store(h, r, conf, dobj->hdrs.tempfile);
+        }
+        wb_commit(dobj);
+        apr_pool_destroy(dobj->data.pool);
+        return APR_SUCCESS;
+    }
+
     /* move header and data tempfiles to the final destination */
     if (APR_SUCCESS == rv) {
         rv = file_cache_el_final(conf, &dobj->hdrs, r);
@@ -1361,6 +2172,10 @@ static apr_status_t commit_entity(cache_handle_t *h, request_rec *r)
         ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(00737)
                 "commit_entity: Headers and body for URL %s cached.",
                 dobj->name);
+
+        if (conf->journal) {
+            journal_store(h, r, conf, dobj->hdrs.file);
+        }
     }
 
     apr_pool_destroy(dobj->data.pool);
@@ -1534,6 +2349,62 @@ static const char
     return NULL;
 }
 
+static const char *set_cache_mem(cmd_parms *parms, void *dummy,
+                                 const char *entries, const char *body)
+{
+    const char *err = ap_check_cmd_context(parms, GLOBAL_ONLY);
+    apr_off_t max_body;
+
+    if (err != NULL) {
+        return err;
+    }
+
+    mem_max_entries = atoi(entries);
+    if (mem_max_entries < 0) {
+        return "CacheDiskMemCache entries must be a non-negative integer";
+    }
+    if (body) {
+        if (apr_strtoff(&max_body, body, NULL, 10) != APR_SUCCESS
+            || max_body < 0 || max_body > APR_SIZE_MAX) {
+            return "CacheDiskMemCache body size must be a non-negative integer";
+        }
+        mem_max_body = (apr_size_t)max_body;
+    }
+    return NULL;
+}
+
+static const char *set_cache_write_behind(cmd_parms *parms, void *dummy,
+                                          const char *arg)
+{
+    const char *err = ap_check_cmd_context(parms, GLOBAL_ONLY);
+    apr_off_t max;
+
+    if (err != NULL) {
+        return err;
+    }
+    if (apr_strtoff(&max, arg, NULL, 10) != APR_SUCCESS
+        || max < 0 || max > APR_SIZE_MAX) {
+        return "CacheDiskWriteBehind must be a non-negative integer";
+    }
+#if !APR_HAS_THREADS
+    if (max) {
+        return "CacheDiskWriteBehind is not supported without threads";
+    }
+#endif
+    wb_max = (apr_size_t)max;
+    return NULL;
+}
+
+static const char
+*set_cache_journal(cmd_parms *parms, void *in_struct_ptr, int flag)
+{
+    disk_cache_conf *conf = ap_get_module_config(parms->server->module_config,
+                                                 &cache_disk_module);
+
+    conf->journal = flag;
+    return NULL;
+}
+
 static const command_rec disk_cache_cmds[] =
 {
     AP_INIT_TAKE1("CacheRoot", set_cache_root, NULL, RSRC_CONF,
@@ -1550,6 +2421,15 @@ static const command_rec disk_cache_cmds[] =
                   "The maximum quantity of data to attempt to read and cache in one go"),
     AP_INIT_TAKE1("CacheReadTime", set_cache_readtime, NULL, RSRC_CONF | ACCESS_CONF,
                   "The maximum time taken to attempt to read and cache in go"),
+    AP_INIT_FLAG("CacheDiskJournal", set_cache_journal, NULL, RSRC_CONF,
+                 "Whether to keep the journal of the stored and removed "
+                 "entities for htcacheclean -j"),
+    AP_INIT_TAKE12("CacheDiskMemCache", set_cache_mem, NULL, RSRC_CONF,
+                  "The number of entities each child keeps in memory, and "
+                  "optionally the largest body kept with them"),
+    AP_INIT_TAKE1("CacheDiskWriteBehind", set_cache_write_behind, NULL,
+                  RSRC_CONF, "The number of bytes each child may hold for "
+                  "the bodies written to disk by a thread, 0 to disable"),
     {NULL}
 };
 
@@ -1567,8 +2447,55 @@ static const cache_provider cache_disk_provider =
     &invalidate_entity
 };
 
+static int disk_cache_pre_config(apr_pool_t *pconf, apr_pool_t *plog,
+                                 apr_pool_t *ptemp)
+{
+    mem_max_entries = 0;
+    mem_max_body = DEFAULT_MEM_MAX_BODY;
+    mem_entries = NULL;
+    wb_max = 0;
+    return OK;
+}
+
+static void disk_cache_child_init(apr_pool_t *pchild, server_rec *s)
+{
+#if APR_HAS_THREADS
+    int threaded = 0;
+    apr_status_t rv;
+#endif
+
+#if APR_HAS_THREADS
+    wb_child_init(pchild, s);
+#endif
+
+    mem_nelts = 0;
+    mem_head = mem_tail = NULL;
+    if (!mem_max_entries) {
+        return;
+    }
+
+#if APR_HAS_THREADS
+    ap_mpm_query(AP_MPMQ_IS_THREADED, &threaded);
+    if (threaded) {
+        rv = apr_thread_mutex_create(&mem_mutex, APR_THREAD_MUTEX_DEFAULT,
+                                     pchild);
+        if (rv != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10425)
+                         "could not create the CacheDiskMemCache mutex, "
+                         "the in-memory tier is disabled");
+            return;
+        }
+    }
+#endif
+
+    mem_entries = apr_hash_make(pchild);
+}
+
 static void disk_cache_register_hook(apr_pool_t *p)
 {
+    ap_hook_pre_config(disk_cache_pre_config, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_child_init(disk_cache_child_init, NULL, NULL, APR_HOOK_MIDDLE);
+
     /* cache initializer */
     ap_register_provider(p, CACHE_PROVIDER_GROUP, "disk", "0",
                          &cache_disk_provider);
@@ -33,6 +33,10 @@ typedef struct {
     apr_file_t *tempfd;
 } disk_cache_file_t;
 
+/* An entity recalled from the in-memory tier (CacheDiskMemCache) */
+typedef struct disk_cache_mem_hit disk_cache_mem_hit;
+typedef struct disk_cache_wb_entity disk_cache_wb_entity;
+
 /*
  * disk_cache_object_t
  * Pointed to by cache_object_t::vobj
@@ -53,6 +57,8 @@ typedef struct disk_cache_object {
     apr_table_t *headers_out;    /* Output headers to save */
     apr_off_t offset;            /* Max size to set aside */
     apr_time_t timeout;          /* Max time to set aside */
+    disk_cache_mem_hit *mem;     /* Recalled from memory, if not NULL */
+    disk_cache_wb_entity *wb;    /* Body written behind, if not NULL */
     unsigned int done:1;         /* Is the attempt to cache complete? */
 } disk_cache_object_t;
 
@@ -74,6 +80,7 @@ typedef struct {
     apr_size_t cache_root_len;
     int dirlevels;               /* Number of levels of subdirectories */
     int dirlength;               /* Length of subdirectory names */
+    int journal;                 /* Write the journal for htcacheclean -j */
 } disk_cache_conf;
 
 typedef struct {
@@ -18,6 +18,10 @@
 #include "apr_file_io.h"
 #include "apr_strings.h"
 #include "apr_buckets.h"
+#include "apr_hash.h"
+#if APR_HAS_THREADS
+#include "apr_thread_mutex.h"
+#endif
 
 #include "apr_version.h"
 #if !APR_VERSION_AT_LEAST(2,0,0)
@@ -35,6 +39,7 @@
 #include "util_script.h"
 #include "util_charset.h"
 #include "util_mutex.h"
+#include "ap_mpm.h"
 
 #include "mod_cache.h"
 #include "mod_status.h"
@@ -51,6 +56,9 @@
  *      Use each header name (from .header) with our request values (headers_in) to
  *      regenerate key using HeaderName+HeaderValue+.../foo/bar/baz
  *      re-read in key (must be format #2)
+ *   The Vary headers of format #1 are remembered by each child for a
+ *   while, so that the next lookups of /foo/bar/baz regenerate the key
+ *   and fetch format #2 straight away.
  *
  * Format #1:
  *   apr_uint32_t format;
@@ -351,6 +359,113 @@ static void tokens_to_array(apr_pool_t *p, const char *data,
     qsort((void *) arr->elts, arr->nelts, sizeof(char *), array_alphasort);
 }
 
+/*
+ * The Vary headers last seen for a key, so that a lookup of a varying
+ * entity is a single retrieve. They are only used for a short while
+ * since another child may change them, and forgotten all at once when
+ * too many are remembered.
+ */
+#define VARY_DESC_MAX 1024
+#define VARY_DESC_MAXAGE apr_time_from_sec(60)
+
+typedef struct vary_desc_t
+{
+    apr_array_header_t *varray;
+    apr_time_t expire;
+} vary_desc_t;
+
+static apr_pool_t *vary_pool;
+static apr_hash_t *vary_descs;
+static int vary_stored;
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *vary_mutex;
+#endif
+
+static void vary_desc_lock(void)
+{
+#if APR_HAS_THREADS
+    if (vary_mutex) {
+        apr_thread_mutex_lock(vary_mutex);
+    }
+#endif
+}
+
+static void vary_desc_unlock(void)
+{
+#if APR_HAS_THREADS
+    if (vary_mutex) {
+        apr_thread_mutex_unlock(vary_mutex);
+    }
+#endif
+}
+
+static apr_array_header_t *vary_desc_get(request_rec *r, const char *key)
+{
+    apr_array_header_t *varray = NULL;
+    vary_desc_t *desc;
+
+    if (!vary_descs) {
+        return NULL;
+    }
+
+    vary_desc_lock();
+    desc = apr_hash_get(vary_descs, key, APR_HASH_KEY_STRING);
+    if (desc && desc->expire > r->request_time) {
+        int i;
+
+        varray = apr_array_make(r->pool, desc->varray->nelts, sizeof(char*));
+        for (i = 0; i < desc->varray->nelts; i++) {
+            *((const char **) apr_array_push(varray)) = apr_pstrdup(r->pool,
+                    APR_ARRAY_IDX(desc->varray, i, const char *));
+        }
+    }
+    vary_desc_unlock();
+
+    return varray;
+}
+
+static void vary_desc_set(request_rec *r, const char *key,
+        apr_array_header_t *varray, apr_time_t expire)
+{
+    vary_desc_t *desc;
+    int i;
+
+    if (!vary_descs) {
+        return;
+    }
+
+    vary_desc_lock();
+    if (++vary_stored > VARY_DESC_MAX) {
+        apr_pool_clear(vary_pool);
+        vary_descs = apr_hash_make(vary_pool);
+        vary_stored = 1;
+    }
+    desc = apr_palloc(vary_pool, sizeof(*desc));
+    desc->varray = apr_array_make(vary_pool, varray->nelts, sizeof(char*));
+    for (i = 0; i < varray->nelts; i++) {
+        *((const char **) apr_array_push(desc->varray)) = apr_pstrdup(vary_pool,
+                APR_ARRAY_IDX(varray, i, const char *));
+    }
+    desc->expire = r->request_time + VARY_DESC_MAXAGE;
+    if (desc->expire > expire) {
+        desc->expire = expire;
+    }
+    apr_hash_set(vary_descs, apr_pstrdup(vary_pool, key), APR_HASH_KEY_STRING,
+            desc);
+    vary_desc_unlock();
+}
+
+static void vary_desc_forget(const char *key)
+{
+    if (!vary_descs) {
+        return;
+    }
+
+    vary_desc_lock();
+    apr_hash_set(vary_descs, key, APR_HASH_KEY_STRING, NULL);
+    vary_desc_unlock();
+}
+
 /*
  * Hook and mod_cache callback functions
  */
@@ -457,6 +572,7 @@ static int open_entity(cache_handle_t *h, request_rec *r, const char *key)
     cache_object_t *obj;
     cache_info *info;
     cache_socache_object_t *sobj;
+    apr_array_header_t *known_varray;
     apr_size_t len;
 
     nkey = NULL;
@@ -482,6 +598,37 @@ static int open_entity(cache_handle_t *h, request_rec *r, const char *key)
     sobj->buffer = apr_palloc(sobj->pool, dconf->max);
     sobj->buffer_len = dconf->max;
 
+    /* with the Vary headers known, attempt to retrieve the variant first */
+    known_varray = vary_desc_get(r, key);
+    if (known_varray) {
+        nkey = regen_key(r->pool, r->headers_in, known_varray, key, &len);
+
+        rc = APR_SUCCESS;
+        if (socache_mutex) {
+            rc = apr_global_mutex_lock(socache_mutex);
+        }
+        if (rc == APR_SUCCESS) {
+            buffer_len = sobj->buffer_len;
+            rc = conf->provider->socache_provider->retrieve(
+                    conf->provider->socache_instance, r->server,
+                    (unsigned char *) nkey, len, sobj->buffer,
+                    &buffer_len, r->pool);
+            if (socache_mutex) {
+                apr_global_mutex_unlock(socache_mutex);
+            }
+        }
+        if (rc == APR_SUCCESS && buffer_len < sobj->buffer_len
+                && buffer_len >= sizeof(format)) {
+            memcpy(&format, sobj->buffer, sizeof(format));
+            if (format == CACHE_SOCACHE_DISK_FORMAT_VERSION) {
+                goto found;
+            }
+        }
+
+        /* the Vary headers may have changed, take the long way */
+        nkey = NULL;
+    }
+
     /* attempt to retrieve the cached entry */
     if (socache_mutex) {
         apr_status_t status = apr_global_mutex_lock(socache_mutex);
@@ -543,6 +690,7 @@ static int open_entity(cache_handle_t *h, request_rec *r, const char *key)
             return DECLINED;
         }
 
+        vary_desc_set(r, key, varray, expire);
         nkey = regen_key(r->pool, r->headers_in, varray, key, &len);
 
         /* attempt to retrieve the cached entry */
@@ -592,9 +740,13 @@ static int open_entity(cache_handle_t *h, request_rec *r, const char *key)
         goto fail;
     }
     else {
+        if (known_varray) {
+            vary_desc_forget(key);
+        }
         nkey = key;
     }
 
+found:
     obj->key = nkey;
     sobj->key = nkey;
     sobj->name = key;
@@ -871,6 +1023,7 @@ static apr_status_t store_headers(cache_handle_t *h, request_rec *r,
                 return rv;
             }
 
+            vary_desc_set(r, obj->key, varray, obj->info.expire);
             obj->key = sobj->key = regen_key(r->pool, sobj->headers_in, varray,
                                              sobj->name, NULL);
         }
@@ -1488,6 +1641,28 @@ static void socache_child_init(apr_pool_t *p, server_rec *s)
 {
     const char *lock;
     apr_status_t rv;
+#if APR_HAS_THREADS
+    int threaded = 0;
+
+    ap_mpm_query(AP_MPMQ_IS_THREADED, &threaded);
+    if (threaded) {
+        rv = apr_thread_mutex_create(&vary_mutex, APR_THREAD_MUTEX_DEFAULT, p);
+        if (rv != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10436)
+                    "failed to create the Vary headers mutex, lookups of "
+                    "varying entities will take two retrieves");
+            vary_mutex = NULL;
+        }
+    }
+    if (!threaded || vary_mutex)
+#endif
+    {
+        apr_pool_create(&vary_pool, p);
+        apr_pool_tag(vary_pool, "mod_cache_socache (vary)");
+        vary_descs = apr_hash_make(vary_pool);
+        vary_stored = 0;
+    }
+
     if (!socache_mutex) {
         return; /* don't waste the overhead of creating mutex & cache */
     }
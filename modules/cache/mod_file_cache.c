@@ -59,6 +59,17 @@
     There's no such thing as inheriting these files across vhosts or
     whatever... place the directives in the main server only.
 
+    Alternatively, CacheFileAuto caches the handles of static files on
+    demand, as they are requested:
+
+        CacheFileAuto 1000 5
+
+    keeps the handles of the 1000 most recently served files in each
+    child, and checks every 5 seconds at most that a file was not changed
+    or removed before using its handle again. Since the handles are
+    shared by all the threads of a child, an entry in use by a request is
+    only closed once that request is done with it.
+
     Known problems:
 
     Don't use Alias or RewriteRule to move these files around...  unless
@@ -78,6 +89,7 @@
 #include "apr_strings.h"
 #include "apr_hash.h"
 #include "apr_buckets.h"
+#include "apr_thread_mutex.h"
 
 #define APR_WANT_STRFUNC
 #include "apr_want.h"
@@ -92,6 +104,7 @@
 #include "http_protocol.h"
 #include "http_request.h"
 #include "http_core.h"
+#include "ap_mpm.h"
 
 module AP_MODULE_DECLARE_DATA file_cache_module;
 
@@ -113,6 +126,273 @@ typedef struct {
     apr_hash_t *fileht;
 } a_server_config;
 
+/*
+ * The files cached on demand (CacheFileAuto), per child.
+ *
+ * An entry stays referenced by the requests it was handed to, and its
+ * pool (closing the file) is only destroyed once it was both evicted
+ * and released by all of them.
+ */
+typedef struct auto_file auto_file;
+struct auto_file {
+    a_file file;            /* first, handed to the handler as an a_file */
+    auto_file *prev;        /* LRU list, most recent first */
+    auto_file *next;
+    apr_pool_t *pool;
+    apr_time_t checked;     /* last time the file was found unchanged */
+    int refcount;
+    int evicted;
+};
+
+#define DEFAULT_AUTO_INTERVAL apr_time_from_sec(5)
+
+static int auto_max_entries = 0, auto_nelts;
+static apr_interval_time_t auto_interval = DEFAULT_AUTO_INTERVAL;
+static int auto_mmap = 0;
+static apr_hash_t *auto_entries;
+static auto_file *auto_head, *auto_tail;
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *auto_mutex;
+#endif
+
+static void auto_lock(void)
+{
+#if APR_HAS_THREADS
+    if (auto_mutex) {
+        apr_thread_mutex_lock(auto_mutex);
+    }
+#endif
+}
+
+static void auto_unlock(void)
+{
+#if APR_HAS_THREADS
+    if (auto_mutex) {
+        apr_thread_mutex_unlock(auto_mutex);
+    }
+#endif
+}
+
+/* called with the lock held */
+static void auto_unlink(auto_file *e)
+{
+    if (e->prev) {
+        e->prev->next = e->next;
+    }
+    else {
+        auto_head = e->next;
+    }
+    if (e->next) {
+        e->next->prev = e->prev;
+    }
+    else {
+        auto_tail = e->prev;
+    }
+    e->prev = e->next = NULL;
+}
+
+/* called with the lock held */
+static void auto_push(auto_file *e)
+{
+    e->next = auto_head;
+    if (auto_head) {
+        auto_head->prev = e;
+    }
+    else {
+        auto_tail = e;
+    }
+    auto_head = e;
+}
+
+/* called with the lock held */
+static void auto_evict(auto_file *e)
+{
+    if (e->evicted) {
+        return;
+    }
+    auto_unlink(e);
+    apr_hash_set(auto_entries, e->file.filename, APR_HASH_KEY_STRING, NULL);
+    auto_nelts--;
+    e->evicted = 1;
+    if (!e->refcount) {
+        apr_pool_destroy(e->pool);
+    }
+}
+
+static apr_status_t auto_release(void *data)
+{
+    auto_file *e = data;
+
+    auto_lock();
+    if (!--e->refcount && e->evicted) {
+        apr_pool_destroy(e->pool);
+    }
+    auto_unlock();
+    return APR_SUCCESS;
+}
+
+/* called with the lock held, the entry is released with the request */
+static void auto_retain(request_rec *r, auto_file *e)
+{
+    e->refcount++;
+    apr_pool_cleanup_register(r->pool, e, auto_release,
+                              apr_pool_cleanup_null);
+}
+
+/*
+ * Find the file in the on demand cache, checking that it is unchanged on
+ * disk if it was not since CacheFileAuto's interval.
+ */
+static a_file *auto_lookup(request_rec *r)
+{
+    auto_file *e;
+    apr_finfo_t finfo;
+    apr_time_t now;
+    apr_status_t rv;
+
+    if (!auto_entries) {
+        return NULL;
+    }
+
+    now = apr_time_now();
+    auto_lock();
+    e = apr_hash_get(auto_entries, r->filename, APR_HASH_KEY_STRING);
+    if (!e) {
+        auto_unlock();
+        return NULL;
+    }
+    auto_retain(r, e);
+    if (e != auto_head) {
+        auto_unlink(e);
+        auto_push(e);
+    }
+    if (now - e->checked < auto_interval) {
+        auto_unlock();
+        return &e->file;
+    }
+    auto_unlock();
+
+    /* don't hold the lock while in the file system */
+    rv = apr_stat(&finfo, e->file.filename, APR_FINFO_MIN | APR_FINFO_IDENT,
+                  r->pool);
+
+    auto_lock();
+    if (rv != APR_SUCCESS || finfo.filetype != APR_REG
+        || finfo.inode != e->file.finfo.inode
+        || finfo.device != e->file.finfo.device
+        || finfo.mtime != e->file.finfo.mtime
+        || finfo.size != e->file.finfo.size) {
+        /* replaced, modified or removed, let the handler load it again */
+        ap_log_rerror(APLOG_MARK, APLOG_TRACE2, rv, r,
+                      "file_cache: %s changed, evicting", e->file.filename);
+        auto_evict(e);
+        e = NULL;
+    }
+    else {
+        e->checked = now;
+    }
+    auto_unlock();
+
+    return e ? &e->file : NULL;
+}
+
+/*
+ * Open the file just served by the handler and keep it in the on demand
+ * cache for the next requests.
+ */
+static a_file *auto_load(request_rec *r)
+{
+    core_dir_config *d;
+    auto_file *e, *old;
+    apr_pool_t *pool;
+    apr_file_t *fd;
+    apr_status_t rv;
+    int mmap = auto_mmap;
+
+#if !APR_HAS_SENDFILE
+    mmap = 1;
+#endif
+
+    if (r->finfo.filetype != APR_REG || (r->path_info && *r->path_info)
+        || r->finfo.size > AP_MAX_SENDFILE) {
+        return NULL;
+    }
+
+    /* a root pool, the entries are created and destroyed by any thread */
+    if (apr_pool_create(&pool, NULL) != APR_SUCCESS) {
+        return NULL;
+    }
+    apr_pool_tag(pool, "mod_file_cache (auto)");
+
+    d = ap_get_core_module_config(r->per_dir_config);
+    rv = apr_file_open(&fd, r->filename, APR_READ | APR_BINARY | APR_XTHREAD
+#if APR_HAS_SENDFILE
+                       | AP_SENDFILE_ENABLED(d->enable_sendfile)
+#endif
+                       , APR_OS_DEFAULT, pool);
+    if (rv != APR_SUCCESS) {
+        apr_pool_destroy(pool);
+        return NULL;
+    }
+
+    e = apr_pcalloc(pool, sizeof(*e));
+    e->pool = pool;
+
+    /* what is cached is what was opened, whatever r->finfo says */
+    rv = apr_file_info_get(&e->file.finfo, APR_FINFO_MIN | APR_FINFO_IDENT,
+                           fd);
+    if (rv != APR_SUCCESS || e->file.finfo.filetype != APR_REG) {
+        apr_pool_destroy(pool);
+        return NULL;
+    }
+
+#if APR_HAS_MMAP
+    if (mmap) {
+        rv = apr_mmap_create(&e->file.mm, fd, 0,
+                             (apr_size_t)e->file.finfo.size,
+                             APR_MMAP_READ, pool);
+        if (rv != APR_SUCCESS) {
+            ap_log_rerror(APLOG_MARK, APLOG_DEBUG, rv, r, APLOGNO(10437)
+                          "file_cache: unable to mmap %s, not cached",
+                          r->filename);
+            apr_pool_destroy(pool);
+            return NULL;
+        }
+        apr_file_close(fd);
+        e->file.is_mmapped = TRUE;
+    }
+#endif
+#if APR_HAS_SENDFILE
+    if (!mmap) {
+        e->file.is_mmapped = FALSE;
+        e->file.file = fd;
+    }
+#endif
+
+    e->file.filename = apr_pstrdup(pool, r->filename);
+    e->file.finfo.fname = e->file.filename;
+    apr_rfc822_date(e->file.mtimestr, e->file.finfo.mtime);
+    apr_snprintf(e->file.sizestr, sizeof e->file.sizestr, "%" APR_OFF_T_FMT,
+                 e->file.finfo.size);
+    e->checked = apr_time_now();
+
+    auto_lock();
+    old = apr_hash_get(auto_entries, e->file.filename, APR_HASH_KEY_STRING);
+    if (old) {
+        auto_evict(old);
+    }
+    while (auto_nelts >= auto_max_entries && auto_tail) {
+        auto_evict(auto_tail);
+    }
+    apr_hash_set(auto_entries, e->file.filename, APR_HASH_KEY_STRING, e);
+    auto_push(e);
+    auto_nelts++;
+    auto_retain(r, e);
+    auto_unlock();
+
+    return &e->file;
+}
+
 
 static void *create_server_config(apr_pool_t *p, server_rec *s)
 {
@@ -226,6 +506,59 @@ static const char *cachefilemmap(cmd_parms *cmd, void *dummy, const char *filena
     return NULL;
 }
 
+static const char *cachefileauto(cmd_parms *cmd, void *dummy,
+                                 const char *entries, const char *interval,
+                                 const char *mode)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+
+    if (err != NULL) {
+        return err;
+    }
+
+    auto_max_entries = atoi(entries);
+    if (auto_max_entries < 0) {
+        return "CacheFileAuto entries must be a non-negative integer";
+    }
+    if (interval) {
+        if (ap_timeout_parameter_parse(interval, &auto_interval, "s")
+                != APR_SUCCESS || auto_interval < 0) {
+            return "CacheFileAuto interval must be a non-negative time";
+        }
+    }
+    if (mode) {
+        if (!ap_cstr_casecmp(mode, "mmap")) {
+#if APR_HAS_MMAP
+            auto_mmap = 1;
+#else
+            return "CacheFileAuto mmap: MMAP is not supported by this OS";
+#endif
+        }
+        else if (!ap_cstr_casecmp(mode, "sendfile")) {
+#if APR_HAS_SENDFILE
+            auto_mmap = 0;
+#else
+            return "CacheFileAuto sendfile: Sendfile is not supported on "
+                   "this OS";
+#endif
+        }
+        else {
+            return "CacheFileAuto mode must be 'mmap' or 'sendfile'";
+        }
+    }
+    return NULL;
+}
+
+static int file_cache_pre_config(apr_pool_t *pconf, apr_pool_t *plog,
+                                 apr_pool_t *ptemp)
+{
+    auto_max_entries = 0;
+    auto_interval = DEFAULT_AUTO_INTERVAL;
+    auto_mmap = 0;
+    auto_entries = NULL;
+    return OK;
+}
+
 static int file_cache_post_config(apr_pool_t *p, apr_pool_t *plog,
                                    apr_pool_t *ptemp, server_rec *s)
 {
@@ -233,6 +566,36 @@ static int file_cache_post_config(apr_pool_t *p, apr_pool_t *plog,
     return OK;
 }
 
+static void file_cache_child_init(apr_pool_t *pchild, server_rec *s)
+{
+#if APR_HAS_THREADS
+    int threaded = 0;
+    apr_status_t rv;
+#endif
+
+    auto_nelts = 0;
+    auto_head = auto_tail = NULL;
+    if (!auto_max_entries) {
+        return;
+    }
+
+#if APR_HAS_THREADS
+    ap_mpm_query(AP_MPMQ_IS_THREADED, &threaded);
+    if (threaded) {
+        rv = apr_thread_mutex_create(&auto_mutex, APR_THREAD_MUTEX_DEFAULT,
+                                     pchild);
+        if (rv != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10438)
+                         "could not create the CacheFileAuto mutex, "
+                         "files are not cached on demand");
+            return;
+        }
+    }
+#endif
+
+    auto_entries = apr_hash_make(pchild);
+}
+
 /* If it's one of ours, fill in r->finfo now to avoid extra stat()... this is a
  * bit of a kludge, because we really want to run after core_translate runs.
  */
@@ -244,8 +607,10 @@ static int file_cache_xlat(request_rec *r)
 
     sconf = ap_get_module_config(r->server->module_config, &file_cache_module);
 
-    /* we only operate when at least one cachefile directive was used */
-    if (!apr_hash_count(sconf->fileht)) {
+    /* we only operate when at least one cachefile directive was used,
+     * or when files are cached on demand
+     */
+    if (!apr_hash_count(sconf->fileht) && !auto_entries) {
         return DECLINED;
     }
 
@@ -256,7 +621,7 @@ static int file_cache_xlat(request_rec *r)
 
     /* search the cache */
     match = (a_file *) apr_hash_get(sconf->fileht, r->filename, APR_HASH_KEY_STRING);
-    if (match == NULL)
+    if (match == NULL && !(match = auto_lookup(r)))
         return DECLINED;
 
     /* pass search results to handler */
@@ -322,11 +687,14 @@ static int file_cache_handler(request_rec *r)
     /* we don't handle anything but GET */
     if (r->method_number != M_GET) return DECLINED;
 
-    /* did xlat phase find the file? */
+    /* did xlat phase find the file? if not, cache it now if we may */
     match = ap_get_module_config(r->request_config, &file_cache_module);
 
     if (match == NULL) {
-        return DECLINED;
+        if (!auto_entries || !(match = auto_load(r))) {
+            return DECLINED;
+        }
+        r->finfo = match->finfo;
     }
 
     /* note that we would handle GET on this resource */
@@ -386,13 +754,18 @@ AP_INIT_ITERATE("cachefile", cachefilehandle, NULL, RSRC_CONF,
      "A space separated list of files to add to the file handle cache at config time"),
 AP_INIT_ITERATE("mmapfile", cachefilemmap, NULL, RSRC_CONF,
      "A space separated list of files to mmap at config time"),
+AP_INIT_TAKE123("CacheFileAuto", cachefileauto, NULL, RSRC_CONF,
+     "The number of files each child caches on demand, optionally how often "
+     "they are checked for changes and whether they are mmapped"),
     {NULL}
 };
 
 static void register_hooks(apr_pool_t *p)
 {
     ap_hook_handler(file_cache_handler, NULL, NULL, APR_HOOK_LAST);
+    ap_hook_pre_config(file_cache_pre_config, NULL, NULL, APR_HOOK_MIDDLE);
     ap_hook_post_config(file_cache_post_config, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_child_init(file_cache_child_init, NULL, NULL, APR_HOOK_MIDDLE);
     ap_hook_translate_name(file_cache_xlat, NULL, NULL, APR_HOOK_MIDDLE);
     /* This trick doesn't work apparently because the translate hooks
        are single shot. If the core_hook returns OK, then our hook is
@@ -52,6 +52,7 @@ module AP_MODULE_DECLARE_DATA socache_memcache_module;
 
 typedef struct {
     apr_uint32_t ttl;
+    int smax;
 } socache_mc_svr_cfg;
 
 struct ap_socache_instance_t {
@@ -85,6 +86,7 @@ static apr_status_t socache_mc_init(ap_socache_instance_t *ctx,
 {
     apr_status_t rv;
     int thread_limit = 0;
+    int smax;
     apr_uint16_t nservers = 0;
     char *cache_config;
     char *split;
@@ -95,6 +97,12 @@ static apr_status_t socache_mc_init(ap_socache_instance_t *ctx,
 
     ap_mpm_query(AP_MPMQ_HARD_LIMIT_THREADS, &thread_limit);
 
+    /* the connections kept can't be more than the ones allowed */
+    smax = sconf->smax;
+    if (smax > thread_limit) {
+        smax = thread_limit;
+    }
+
     /* Find all the servers in the first run to get a total count */
     cache_config = apr_pstrdup(p, ctx->servers);
     split = apr_strtok(cache_config, ",", &tok);
@@ -141,7 +149,7 @@ static apr_status_t socache_mc_init(ap_socache_instance_t *ctx,
         rv = apr_memcache_server_create(p,
                                         host_str, port,
                                         MC_DEFAULT_SERVER_MIN,
-                                        MC_DEFAULT_SERVER_SMAX,
+                                        smax,
                                         thread_limit,
                                         sconf->ttl,
                                         &st);
@@ -367,6 +375,7 @@ static void *create_server_config(apr_pool_t *p, server_rec *s)
     socache_mc_svr_cfg *sconf = apr_pcalloc(p, sizeof(socache_mc_svr_cfg));
     
     sconf->ttl = MC_DEFAULT_SERVER_TTL;
+    sconf->smax = MC_DEFAULT_SERVER_SMAX;
 
     return sconf;
 }
@@ -394,6 +403,23 @@ static const char *socache_mc_set_ttl(cmd_parms *cmd, void *dummy,
     return NULL;
 }
 
+static const char *socache_mc_set_smax(cmd_parms *cmd, void *dummy,
+                                       const char *arg)
+{
+    socache_mc_svr_cfg *sconf = ap_get_module_config(cmd->server->module_config,
+                                                     &socache_memcache_module);
+    char *end;
+    long smax = strtol(arg, &end, 10);
+
+    if (*end || smax < 0 || smax > 65535) {
+        return apr_pstrcat(cmd->pool, cmd->cmd->name,
+                           " must be a number of connections.", NULL);
+    }
+    sconf->smax = (int)smax;
+
+    return NULL;
+}
+
 static void register_hooks(apr_pool_t *p)
 {
     ap_register_provider(p, AP_SOCACHE_PROVIDER_GROUP, "memcache",
@@ -404,6 +430,9 @@ static void register_hooks(apr_pool_t *p)
 static const command_rec socache_memcache_cmds[] = {
     AP_INIT_TAKE1("MemcacheConnTTL", socache_mc_set_ttl, NULL, RSRC_CONF,
                   "TTL used for the connection with the memcache server(s)"),
+    AP_INIT_TAKE1("MemcacheConnPoolIdleMax", socache_mc_set_smax, NULL, RSRC_CONF,
+                  "Number of idle connections per server kept beyond the "
+                  "TTL in each process (default 1)"),
     { NULL }
 };
 
@@ -30,6 +30,7 @@
 typedef struct {
     apr_uint32_t ttl;
     apr_uint32_t rwto;
+    int smax;
 } socache_rd_svr_cfg;
 
 /* apr_redis support requires >= 1.6 */
@@ -97,6 +98,7 @@ static apr_status_t socache_rd_init(ap_socache_instance_t *ctx,
 {
     apr_status_t rv;
     int thread_limit = 0;
+    int smax;
     apr_uint16_t nservers = 0;
     char *cache_config;
     char *split;
@@ -107,6 +109,12 @@ static apr_status_t socache_rd_init(ap_socache_instance_t *ctx,
 
     ap_mpm_query(AP_MPMQ_HARD_LIMIT_THREADS, &thread_limit);
 
+    /* the connections kept can't be more than the ones allowed */
+    smax = sconf->smax;
+    if (smax > thread_limit) {
+        smax = thread_limit;
+    }
+
     /* Find all the servers in the first run to get a total count */
     cache_config = apr_pstrdup(p, ctx->servers);
     split = apr_strtok(cache_config, ",", &tok);
@@ -153,7 +161,7 @@ static apr_status_t socache_rd_init(ap_socache_instance_t *ctx,
         rv = apr_redis_server_create(p,
                                      host_str, port,
                                      RD_DEFAULT_SERVER_MIN,
-                                     RD_DEFAULT_SERVER_SMAX,
+                                     smax,
                                      thread_limit,
                                      sconf->ttl,
                                      sconf->rwto,
@@ -405,6 +413,7 @@ static void* create_server_config(apr_pool_t* p, server_rec* s)
 
     sconf->ttl = RD_DEFAULT_SERVER_TTL;
     sconf->rwto = RD_DEFAULT_SERVER_RWTO;
+    sconf->smax = RD_DEFAULT_SERVER_SMAX;
 
     return sconf;
 }
@@ -455,6 +464,23 @@ static const char *socache_rd_set_rwto(cmd_parms *cmd, void *dummy,
     return NULL;
 }
 
+static const char *socache_rd_set_smax(cmd_parms *cmd, void *dummy,
+                                       const char *arg)
+{
+    socache_rd_svr_cfg *sconf = ap_get_module_config(cmd->server->module_config,
+                                                     &socache_redis_module);
+    char *end;
+    long smax = strtol(arg, &end, 10);
+
+    if (*end || smax < 0 || smax > 65535) {
+        return apr_pstrcat(cmd->pool, cmd->cmd->name,
+                           " must be a number of connections.", NULL);
+    }
+    sconf->smax = (int)smax;
+
+    return NULL;
+}
+
 static void register_hooks(apr_pool_t *p)
 {
 #ifdef HAVE_APU_REDIS
@@ -471,6 +497,9 @@ static const command_rec socache_redis_cmds[] =
                   "TTL used for the connection pool with the Redis server(s)"),
     AP_INIT_TAKE1("RedisTimeout", socache_rd_set_rwto, NULL, RSRC_CONF,
                   "R/W timeout used for the connection with the Redis server(s)"),
+    AP_INIT_TAKE1("RedisConnPoolIdleMax", socache_rd_set_smax, NULL, RSRC_CONF,
+                  "Number of idle connections per server kept beyond the "
+                  "TTL in each process (default 1)"),
     {NULL}
 };
 
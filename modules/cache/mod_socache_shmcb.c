@@ -19,12 +19,15 @@
 #include "http_request.h"
 #include "http_protocol.h"
 #include "http_config.h"
+#include "http_core.h"
 #include "mod_status.h"
 
 #include "apr.h"
 #include "apr_strings.h"
 #include "apr_time.h"
+#include "apr_hash.h"
 #include "apr_shm.h"
+#include "apr_atomic.h"
 #define APR_WANT_STRFUNC
 #include "apr_want.h"
 #include "apr_general.h"
@@ -52,19 +55,30 @@
 #define ALIGNED_SUBCACHE_SIZE APR_ALIGN_DEFAULT(sizeof(SHMCBSubcache))
 #define ALIGNED_INDEX_SIZE APR_ALIGN_DEFAULT(sizeof(SHMCBIndex))
 
+/* How many times a writer spins on a subcache lock before sleeping, and
+ * how long it sleeps then */
+#define SHMCB_LOCK_SPINS 100
+#define SHMCB_LOCK_SLEEP 100
+/* After how many seconds a subcache lock is considered abandoned by a
+ * dead process, and taken over */
+#define SHMCB_LOCK_TIMEOUT 5
+/* How many times a reader retries when writers get in its way, before
+ * giving up with a miss */
+#define SHMCB_READ_RETRIES 64
+
 /*
  * Header structure - the start of the shared-mem segment
  */
 typedef struct {
-    /* Stats for cache operations */
-    unsigned long stat_stores;
-    unsigned long stat_replaced;
-    unsigned long stat_expiries;
-    unsigned long stat_scrolled;
-    unsigned long stat_retrieves_hit;
-    unsigned long stat_retrieves_miss;
-    unsigned long stat_removes_hit;
-    unsigned long stat_removes_miss;
+    /* Stats for cache operations, updated atomically */
+    apr_uint32_t stat_stores;
+    apr_uint32_t stat_replaced;
+    apr_uint32_t stat_expiries;
+    apr_uint32_t stat_scrolled;
+    apr_uint32_t stat_retrieves_hit;
+    apr_uint32_t stat_retrieves_miss;
+    apr_uint32_t stat_removes_hit;
+    apr_uint32_t stat_removes_miss;
     /* Number of subcaches */
     unsigned int subcache_num;
     /* How many indexes each subcache's queue has */
@@ -82,6 +96,11 @@ typedef struct {
  * indexes then data
  */
 typedef struct {
+    /* The writers' lock: 0 when free, else (about) the time in seconds
+     * it was taken */
+    apr_uint32_t lock;
+    /* The sequence count, odd while a writer is changing the subcache */
+    apr_uint32_t seq;
     /* The start position and length of the cyclic buffer of indexes */
     unsigned int idx_pos, idx_used;
     /* Same for the data area */
@@ -110,8 +129,34 @@ struct ap_socache_instance_t {
     apr_size_t shm_size;
     apr_shm_t *shm;
     SHMCBHeader *header;
+    /* Whether shm is kept across restarts, see below */
+    int retained;
 };
 
+/*
+ * With SOCacheShmcbRetain on, the segments are created in the process
+ * pool rather than the configuration pool and handed over to the next
+ * generation, by data file, so that a restart doesn't flush the caches.
+ * A segment is only reused when the new configuration gives it the same
+ * size and layout, since the children of the old generation may still
+ * be using it; otherwise it is replaced.  Those not used anymore by the
+ * new generation are destroyed at the end of its post_config.
+ */
+#define SHMCB_RETAINED_KEY "mod_socache_shmcb-retained"
+
+typedef struct {
+    apr_shm_t *shm;
+    /* The last configuration generation which used it */
+    int generation;
+} shmcb_retained_segment;
+
+typedef struct {
+    /* The shmcb_retained_segment(s), by data file */
+    apr_hash_t *segments;
+} shmcb_retained_data;
+
+static int shmcb_retain = 0;
+
 /* The SHM data segment is of fixed size and stores data as follows.
  *
  *   [ SHMCBHeader | Subcaches ]
@@ -124,7 +169,7 @@ struct ap_socache_instance_t {
  * SHMCBSubcache structure has a fixed size (header->subcache_size),
  * which is determined at creation time, and looks like the following:
  *
- *   [ SHMCBSubcache | Indexes | Data ]
+ *   [ SHMCBSubcache | Indexes | Fingerprints | Data ]
  *
  * Each subcache is prefixed by the SHMCBSubcache structure.
  *
@@ -139,6 +184,11 @@ struct ap_socache_instance_t {
  * index of the first in use, subcache->idx_used gives the number in
  * use.  Both ->idx_* values have a range of [0, header->index_num)
  *
+ * "Fingerprints" is an array of header->index_num bytes, parallel to
+ * the indexes, holding a hash of the id of each object.  Lookups scan
+ * it (with memchr(), which compares many bytes at a time) and only look
+ * at the indexes and compare the ids where the fingerprint matches.
+ *
  * Each in-use SHMCBIndex structure represents a single cached object.
  * The ID and data segment are stored consecutively in the subcache's
  * cyclic data buffer.  The "Data" segment can thus be seen to
@@ -152,6 +202,19 @@ struct ap_socache_instance_t {
  * idx1 = { data_pos = 0, data_used = 3, id_len = 1, ...}
  * idx2 = { data_pos = 3, data_used = 3, id_len = 1, ...}
  * ...
+ *
+ * The cache is safe for concurrent use without an external mutex; each
+ * subcache is a seqlock.  Writers (store, remove, expiry) take the
+ * subcache's spinlock and make its sequence count odd while they change
+ * it, readers (retrieve) take no lock at all: they copy the object out
+ * and retry if the sequence count was odd or has changed meanwhile.  A
+ * lock left behind by a process which died while holding it is taken
+ * over after SHMCB_LOCK_TIMEOUT, and the subcache is then emptied since
+ * it may have been left inconsistent.
+ *
+ * This relies on apr_atomic operations being native and so working
+ * across processes, which is the case on all platforms with atomic CPU
+ * instructions.
  */
 
 /* This macro takes a pointer to the header and a zero-based index and returns
@@ -178,6 +241,12 @@ struct ap_socache_instance_t {
                         ALIGNED_SUBCACHE_SIZE + \
                         (num) * ALIGNED_INDEX_SIZE)
 
+/* This macro takes a pointer to the header and a subcache and returns a
+ * pointer to the corresponding fingerprints. */
+#define SHMCB_FINGERPRINTS(pHeader, pSubcache) \
+                ((unsigned char *)(pSubcache) + ALIGNED_SUBCACHE_SIZE + \
+                        (pHeader)->index_num * ALIGNED_INDEX_SIZE)
+
 /* This macro takes a pointer to the header and a subcache and returns a
  * pointer to the corresponding data area. */
 #define SHMCB_DATA(pHeader, pSubcache) \
@@ -228,6 +297,46 @@ static void shmcb_cyclic_cton_memcpy(unsigned int buf_size, unsigned char *dest,
     }
 }
 
+/* The fingerprint of an id, from all its bytes (the subcache is chosen
+ * from the first one only). */
+static APR_INLINE unsigned char shmcb_fingerprint(const unsigned char *id,
+                                                  unsigned int idlen)
+{
+    apr_uint32_t h = 2166136261U; /* FNV-1a */
+
+    while (idlen--) {
+        h = (h ^ *id++) * 16777619U;
+    }
+    return (unsigned char)(h ^ (h >> 8) ^ (h >> 16) ^ (h >> 24));
+}
+
+/* Find the first of the n fingerprints starting at pos in the cyclic
+ * array of num fingerprints which is fp, returning its distance from pos,
+ * or n if there is none. */
+static unsigned int shmcb_fingerprint_find(const unsigned char *fps,
+                                           unsigned int num,
+                                           unsigned int pos, unsigned int n,
+                                           unsigned char fp)
+{
+    unsigned int first = num - pos;
+    const unsigned char *hit;
+
+    if (first > n) {
+        first = n;
+    }
+    hit = memchr(fps + pos, fp, first);
+    if (hit) {
+        return hit - (fps + pos);
+    }
+    if (n > first) {
+        hit = memchr(fps, fp, n - first);
+        if (hit) {
+            return first + (hit - fps);
+        }
+    }
+    return n;
+}
+
 /* A memcmp against a cyclic data buffer.  Compares SRC of length
  * SRC_LEN against the contents of cyclic buffer DATA (which is of
  * size BUF_SIZE), starting at offset DEST_OFFSET. Got that?  Good. */
@@ -252,6 +361,59 @@ static int shmcb_cyclic_memcmp(unsigned int buf_size, unsigned char *data,
     }
 }
 
+/*
+ * Subcache locking
+ */
+
+/* Take the writers' lock of a subcache, and start a write sequence */
+static void shmcb_subcache_lock(SHMCBSubcache *subcache)
+{
+    apr_uint32_t stamp = (apr_uint32_t)apr_time_sec(apr_time_now()) | 1;
+    int spins = 0;
+
+    for (;;) {
+        apr_uint32_t held = apr_atomic_cas32(&subcache->lock, stamp, 0);
+
+        if (held == 0) {
+            break;
+        }
+        if ((apr_int32_t)(stamp - held) > SHMCB_LOCK_TIMEOUT
+            && apr_atomic_cas32(&subcache->lock, stamp, held) == held) {
+            /* abandoned, ours now */
+            break;
+        }
+        if (++spins >= SHMCB_LOCK_SPINS) {
+            apr_sleep(SHMCB_LOCK_SLEEP);
+            stamp = (apr_uint32_t)apr_time_sec(apr_time_now()) | 1;
+            spins = 0;
+        }
+    }
+
+    if (apr_atomic_read32(&subcache->seq) & 1) {
+        /* The previous writer died midway, don't trust anything there;
+         * the sequence count is left odd for our own write. */
+        subcache->idx_pos = subcache->idx_used = 0;
+        subcache->data_pos = subcache->data_used = 0;
+    }
+    else {
+        apr_atomic_inc32(&subcache->seq);
+    }
+}
+
+/* End the write sequence and release the writers' lock of a subcache */
+static void shmcb_subcache_unlock(SHMCBSubcache *subcache)
+{
+    apr_atomic_inc32(&subcache->seq);
+    apr_atomic_xchg32(&subcache->lock, 0);
+}
+
+/* Read the sequence count of a subcache, with a full barrier (the CAS
+ * never changes the value) so that the reads of the subcache are not
+ * reordered around it. */
+static APR_INLINE apr_uint32_t shmcb_subcache_seq(SHMCBSubcache *subcache)
+{
+    return apr_atomic_cas32(&subcache->seq, 0, 0);
+}
 
 /* Prototypes for low-level subcache operations */
 static void shmcb_subcache_expire(server_rec *, SHMCBHeader *, SHMCBSubcache *,
@@ -345,13 +507,91 @@ static const char *socache_shmcb_create(ap_socache_instance_t **context,
 static apr_status_t socache_shmcb_cleanup(void *arg)
 {
     ap_socache_instance_t *ctx = arg;
-    if (ctx->shm) {
+    if (ctx->shm && !ctx->retained) {
         apr_shm_destroy(ctx->shm);
-        ctx->shm = NULL;
     }
+    ctx->shm = NULL;
+    return APR_SUCCESS;
+}
+
+static shmcb_retained_data *shmcb_retained_get(server_rec *s)
+{
+    shmcb_retained_data *retained;
+
+    retained = ap_retained_data_get(SHMCB_RETAINED_KEY);
+    if (!retained) {
+        retained = ap_retained_data_create(SHMCB_RETAINED_KEY,
+                                           sizeof(*retained));
+        retained->segments = apr_hash_make(s->process->pool);
+    }
+    return retained;
+}
+
+/* Compute the layout of the subcaches in a segment of shm_segsize bytes
+ * into header, with the statistics zeroed */
+static apr_status_t shmcb_layout(SHMCBHeader *header, apr_size_t shm_segsize,
+                                 const struct ap_socache_hints *hints,
+                                 server_rec *s)
+{
+    unsigned int num_subcache, num_idx;
+    apr_size_t avg_obj_size, avg_id_len;
+
+    if (shm_segsize < (5 * ALIGNED_HEADER_SIZE)) {
+        /* the segment is ridiculously small, bail out */
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, s, APLOGNO(00820)
+                     "shared memory segment too small");
+        return APR_ENOSPC;
+    }
+    /* Discount the header */
+    shm_segsize -= ALIGNED_HEADER_SIZE;
+    /* Select index size based on average object size hints, if given. */
+    avg_obj_size = hints && hints->avg_obj_size ? hints->avg_obj_size : 150;
+    avg_id_len = hints && hints->avg_id_len ? hints->avg_id_len : 30;
+    num_idx = (shm_segsize) / (avg_obj_size + avg_id_len);
+    num_subcache = 256;
+    while ((num_idx / num_subcache) < (2 * num_subcache))
+        num_subcache /= 2;
+    num_idx /= num_subcache;
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(00822)
+                 "for %" APR_SIZE_T_FMT " bytes (%" APR_SIZE_T_FMT
+                 " including header), recommending %u subcaches, "
+                 "%u indexes each", shm_segsize,
+                 shm_segsize + ALIGNED_HEADER_SIZE,
+                 num_subcache, num_idx);
+    if (num_idx < 5) {
+        /* we're still too small, bail out */
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, s, APLOGNO(00823)
+                     "shared memory segment too small");
+        return APR_ENOSPC;
+    }
+    memset(header, 0, sizeof(*header));
+    header->subcache_num = num_subcache;
+    /* Convert the subcache size (in bytes) to a value that is suitable for
+     * structure alignment on the host platform, by rounding down if necessary. */
+    header->subcache_size = (size_t)(shm_segsize / num_subcache);
+    if (header->subcache_size != APR_ALIGN_DEFAULT(header->subcache_size)) {
+        header->subcache_size = APR_ALIGN_DEFAULT(header->subcache_size) -
+                                APR_ALIGN_DEFAULT(1);
+    }
+    header->subcache_data_offset = ALIGNED_SUBCACHE_SIZE +
+                                   num_idx * ALIGNED_INDEX_SIZE +
+                                   APR_ALIGN_DEFAULT(num_idx);
+    header->subcache_data_size = header->subcache_size -
+                                 header->subcache_data_offset;
+    header->index_num = num_idx;
+
     return APR_SUCCESS;
 }
 
+static int shmcb_same_layout(const SHMCBHeader *a, const SHMCBHeader *b)
+{
+    return a->subcache_num == b->subcache_num
+           && a->index_num == b->index_num
+           && a->subcache_size == b->subcache_size
+           && a->subcache_data_offset == b->subcache_data_offset
+           && a->subcache_data_size == b->subcache_data_size;
+}
+
 static apr_status_t socache_shmcb_init(ap_socache_instance_t *ctx,
                                        const char *namespace,
                                        const struct ap_socache_hints *hints,
@@ -360,9 +600,11 @@ static apr_status_t socache_shmcb_init(ap_socache_instance_t *ctx,
     void *shm_segment;
     apr_size_t shm_segsize;
     apr_status_t rv;
-    SHMCBHeader *header;
-    unsigned int num_subcache, num_idx, loop;
-    apr_size_t avg_obj_size, avg_id_len;
+    SHMCBHeader *header, layout;
+    shmcb_retained_segment *seg = NULL;
+    apr_pool_t *shm_pool = p;
+    int generation = 0;
+    unsigned int loop;
 
     /* Create shared memory segment */
     if (ctx->data_file == NULL) {
@@ -372,8 +614,51 @@ static apr_status_t socache_shmcb_init(ap_socache_instance_t *ctx,
         ctx->data_file = ap_runtime_dir_relative(p, path);
     }
 
+    /* Take over the segment of the previous generation if any, the dry
+     * run of the initial startup doesn't keep anything. */
+    if (shmcb_retain && ctx->data_file
+        && ap_state_query(AP_SQ_MAIN_STATE) != AP_SQ_MS_CREATE_PRE_CONFIG) {
+        shmcb_retained_data *retained = shmcb_retained_get(s);
+
+        generation = ap_state_query(AP_SQ_CONFIG_GEN);
+        seg = apr_hash_get(retained->segments, ctx->data_file,
+                           APR_HASH_KEY_STRING);
+        if (seg && seg->shm && seg->generation == generation) {
+            /* already used by another cache of this generation */
+            seg = NULL;
+        }
+        else if (seg && seg->shm) {
+            header = apr_shm_baseaddr_get(seg->shm);
+            if (apr_shm_size_get(seg->shm) == ctx->shm_size
+                && shmcb_layout(&layout, ctx->shm_size, hints,
+                                s) == APR_SUCCESS
+                && shmcb_same_layout(&layout, header)) {
+                seg->generation = generation;
+                ctx->shm = seg->shm;
+                ctx->header = header;
+                ctx->retained = 1;
+                ap_log_error(APLOG_MARK, APLOG_INFO, 0, s, APLOGNO(10525)
+                             "Shared memory socache '%s' retained from the "
+                             "previous generation", namespace);
+                return APR_SUCCESS;
+            }
+            /* The layout changed, start over with a new segment */
+            apr_shm_destroy(seg->shm);
+            seg->shm = NULL;
+        }
+        else if (!seg) {
+            seg = apr_pcalloc(s->process->pool, sizeof(*seg));
+            apr_hash_set(retained->segments,
+                         apr_pstrdup(s->process->pool, ctx->data_file),
+                         APR_HASH_KEY_STRING, seg);
+        }
+        if (seg) {
+            shm_pool = s->process->pool;
+        }
+    }
+
     /* Use anonymous shm by default, fall back on name-based. */
-    rv = apr_shm_create(&ctx->shm, ctx->shm_size, NULL, p);
+    rv = apr_shm_create(&ctx->shm, ctx->shm_size, NULL, shm_pool);
     if (APR_STATUS_IS_ENOTIMPL(rv)) {
         /* If anon shm isn't supported, fail if no named file was
          * configured successfully; the ap_runtime_dir_relative call
@@ -390,7 +675,8 @@ static apr_status_t socache_shmcb_init(ap_socache_instance_t *ctx,
          * previous unclean shutdown. */
         apr_shm_remove(ctx->data_file, p);
 
-        rv = apr_shm_create(&ctx->shm, ctx->shm_size, ctx->data_file, p);
+        rv = apr_shm_create(&ctx->shm, ctx->shm_size, ctx->data_file,
+                            shm_pool);
     }
 
     if (rv != APR_SUCCESS) {
@@ -400,66 +686,30 @@ static apr_status_t socache_shmcb_init(ap_socache_instance_t *ctx,
         ctx->shm = NULL;
         return rv;
     }
-    apr_pool_cleanup_register(ctx->pool, ctx, socache_shmcb_cleanup,
-                              apr_pool_cleanup_null); 
+    if (seg) {
+        seg->shm = ctx->shm;
+        seg->generation = generation;
+        ctx->retained = 1;
+    }
+    else {
+        apr_pool_cleanup_register(ctx->pool, ctx, socache_shmcb_cleanup,
+                                  apr_pool_cleanup_null);
+    }
 
     shm_segment = apr_shm_baseaddr_get(ctx->shm);
     shm_segsize = apr_shm_size_get(ctx->shm);
-    if (shm_segsize < (5 * ALIGNED_HEADER_SIZE)) {
-        /* the segment is ridiculously small, bail out */
-        ap_log_error(APLOG_MARK, APLOG_ERR, 0, s, APLOGNO(00820)
-                     "shared memory segment too small");
-        return APR_ENOSPC;
-    }
+    ap_shm_advise(shm_segment, shm_segsize);
     ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(00821)
                  "shmcb_init allocated %" APR_SIZE_T_FMT
                  " bytes of shared memory",
                  shm_segsize);
-    /* Discount the header */
-    shm_segsize -= ALIGNED_HEADER_SIZE;
-    /* Select index size based on average object size hints, if given. */
-    avg_obj_size = hints && hints->avg_obj_size ? hints->avg_obj_size : 150;
-    avg_id_len = hints && hints->avg_id_len ? hints->avg_id_len : 30;
-    num_idx = (shm_segsize) / (avg_obj_size + avg_id_len);
-    num_subcache = 256;
-    while ((num_idx / num_subcache) < (2 * num_subcache))
-        num_subcache /= 2;
-    num_idx /= num_subcache;
-    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(00822)
-                 "for %" APR_SIZE_T_FMT " bytes (%" APR_SIZE_T_FMT
-                 " including header), recommending %u subcaches, "
-                 "%u indexes each", shm_segsize,
-                 shm_segsize + ALIGNED_HEADER_SIZE,
-                 num_subcache, num_idx);
-    if (num_idx < 5) {
-        /* we're still too small, bail out */
-        ap_log_error(APLOG_MARK, APLOG_ERR, 0, s, APLOGNO(00823)
-                     "shared memory segment too small");
-        return APR_ENOSPC;
+    rv = shmcb_layout(&layout, shm_segsize, hints, s);
+    if (rv != APR_SUCCESS) {
+        return rv;
     }
     /* OK, we're sorted */
     ctx->header = header = shm_segment;
-    header->stat_stores = 0;
-    header->stat_replaced = 0;
-    header->stat_expiries = 0;
-    header->stat_scrolled = 0;
-    header->stat_retrieves_hit = 0;
-    header->stat_retrieves_miss = 0;
-    header->stat_removes_hit = 0;
-    header->stat_removes_miss = 0;
-    header->subcache_num = num_subcache;
-    /* Convert the subcache size (in bytes) to a value that is suitable for
-     * structure alignment on the host platform, by rounding down if necessary. */
-    header->subcache_size = (size_t)(shm_segsize / num_subcache);
-    if (header->subcache_size != APR_ALIGN_DEFAULT(header->subcache_size)) {
-        header->subcache_size = APR_ALIGN_DEFAULT(header->subcache_size) -
-                                APR_ALIGN_DEFAULT(1);
-    }
-    header->subcache_data_offset = ALIGNED_SUBCACHE_SIZE +
-                                   num_idx * ALIGNED_INDEX_SIZE;
-    header->subcache_data_size = header->subcache_size -
-                                 header->subcache_data_offset;
-    header->index_num = num_idx;
+    *header = layout;
 
     /* Output trace info */
     ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(00824)
@@ -477,6 +727,7 @@ static apr_status_t socache_shmcb_init(ap_socache_instance_t *ctx,
     /* The header is done, make the caches empty */
     for (loop = 0; loop < header->subcache_num; loop++) {
         SHMCBSubcache *subcache = SHMCB_SUBCACHE(header, loop);
+        subcache->lock = subcache->seq = 0;
         subcache->idx_pos = subcache->idx_used = 0;
         subcache->data_pos = subcache->data_used = 0;
     }
@@ -514,18 +765,21 @@ static apr_status_t socache_shmcb_store(ap_socache_instance_t *ctx,
                 "(%u bytes)", idlen);
         return APR_EINVAL;
     }
+    shmcb_subcache_lock(subcache);
     tryreplace = shmcb_subcache_remove(s, header, subcache, id, idlen);
     if (shmcb_subcache_store(s, header, subcache, encoded,
                              len_encoded, id, idlen, expiry)) {
+        shmcb_subcache_unlock(subcache);
         ap_log_error(APLOG_MARK, APLOG_ERR, 0, s, APLOGNO(00833)
                      "can't store an socache entry!");
         return APR_ENOSPC;
     }
+    shmcb_subcache_unlock(subcache);
     if (tryreplace == 0) {
-        header->stat_replaced++;
+        apr_atomic_inc32(&header->stat_replaced);
     }
     else {
-        header->stat_stores++;
+        apr_atomic_inc32(&header->stat_stores);
     }
     ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(00834)
                  "leaving socache_shmcb_store successfully");
@@ -550,9 +804,9 @@ static apr_status_t socache_shmcb_retrieve(ap_socache_instance_t *ctx,
     rv = shmcb_subcache_retrieve(s, header, subcache, id, idlen,
                                  dest, destlen);
     if (rv == 0)
-        header->stat_retrieves_hit++;
+        apr_atomic_inc32(&header->stat_retrieves_hit);
     else
-        header->stat_retrieves_miss++;
+        apr_atomic_inc32(&header->stat_retrieves_miss);
     ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(00836)
                  "leaving socache_shmcb_retrieve successfully");
 
@@ -575,11 +829,14 @@ static apr_status_t socache_shmcb_remove(ap_socache_instance_t *ctx,
                 "(%u bytes)", idlen);
         return APR_EINVAL;
     }
-    if (shmcb_subcache_remove(s, header, subcache, id, idlen) == 0) {
-        header->stat_removes_hit++;
+    shmcb_subcache_lock(subcache);
+    rv = shmcb_subcache_remove(s, header, subcache, id, idlen);
+    shmcb_subcache_unlock(subcache);
+    if (rv == 0) {
+        apr_atomic_inc32(&header->stat_removes_hit);
         rv = APR_SUCCESS;
     } else {
-        header->stat_removes_miss++;
+        apr_atomic_inc32(&header->stat_removes_miss);
         rv = APR_NOTFOUND;
     }
     ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(00839)
@@ -601,12 +858,13 @@ static void socache_shmcb_status(ap_socache_instance_t *ctx,
 
     AP_DEBUG_ASSERT(header->subcache_num > 0);
     ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(00840) "inside shmcb_status");
-    /* Perform the iteration inside the mutex to avoid corruption or invalid
-     * pointer arithmetic. The rest of our logic uses read-only header data so
-     * doesn't need the lock. */
+    /* Lock each subcache while it is looked at, to avoid corruption or
+     * invalid pointer arithmetic. The rest of our logic uses read-only
+     * header data so doesn't need the lock. */
     /* Iterate over the subcaches */
     for (loop = 0; loop < header->subcache_num; loop++) {
         SHMCBSubcache *subcache = SHMCB_SUBCACHE(header, loop);
+        shmcb_subcache_lock(subcache);
         shmcb_subcache_expire(s, header, subcache, now);
         total += subcache->idx_used;
         cache_total += subcache->data_used;
@@ -621,6 +879,7 @@ static void socache_shmcb_status(ap_socache_instance_t *ctx,
             else
                 min_expiry = ((idx_expiry < min_expiry) ? idx_expiry : min_expiry);
         }
+        shmcb_subcache_unlock(subcache);
     }
     index_pct = (100 * total) / (header->index_num *
                                  header->subcache_num);
@@ -647,19 +906,19 @@ static void socache_shmcb_status(ap_socache_instance_t *ctx,
 
         ap_rprintf(r, "index usage: <b>%d%%</b>, cache usage: <b>%d%%</b><br>",
                    index_pct, cache_pct);
-        ap_rprintf(r, "total entries stored since starting: <b>%lu</b><br>",
+        ap_rprintf(r, "total entries stored since starting: <b>%u</b><br>",
                    header->stat_stores);
-        ap_rprintf(r, "total entries replaced since starting: <b>%lu</b><br>",
+        ap_rprintf(r, "total entries replaced since starting: <b>%u</b><br>",
                    header->stat_replaced);
-        ap_rprintf(r, "total entries expired since starting: <b>%lu</b><br>",
+        ap_rprintf(r, "total entries expired since starting: <b>%u</b><br>",
                    header->stat_expiries);
         ap_rprintf(r, "total (pre-expiry) entries scrolled out of the cache: "
-                   "<b>%lu</b><br>", header->stat_scrolled);
-        ap_rprintf(r, "total retrieves since starting: <b>%lu</b> hit, "
-                   "<b>%lu</b> miss<br>", header->stat_retrieves_hit,
+                   "<b>%u</b><br>", header->stat_scrolled);
+        ap_rprintf(r, "total retrieves since starting: <b>%u</b> hit, "
+                   "<b>%u</b> miss<br>", header->stat_retrieves_hit,
                    header->stat_retrieves_miss);
-        ap_rprintf(r, "total removes since starting: <b>%lu</b> hit, "
-                   "<b>%lu</b> miss<br>", header->stat_removes_hit,
+        ap_rprintf(r, "total removes since starting: <b>%u</b> hit, "
+                   "<b>%u</b> miss<br>", header->stat_removes_hit,
                    header->stat_removes_miss);
     }
     else {
@@ -680,14 +939,14 @@ static void socache_shmcb_status(ap_socache_instance_t *ctx,
 
         ap_rprintf(r, "CacheIndexUsage: %d%%\n", index_pct);
         ap_rprintf(r, "CacheUsage: %d%%\n", cache_pct);
-        ap_rprintf(r, "CacheStoreCount: %lu\n", header->stat_stores);
-        ap_rprintf(r, "CacheReplaceCount: %lu\n", header->stat_replaced);
-        ap_rprintf(r, "CacheExpireCount: %lu\n", header->stat_expiries);
-        ap_rprintf(r, "CacheDiscardCount: %lu\n", header->stat_scrolled);
-        ap_rprintf(r, "CacheRetrieveHitCount: %lu\n", header->stat_retrieves_hit);
-        ap_rprintf(r, "CacheRetrieveMissCount: %lu\n", header->stat_retrieves_miss);
-        ap_rprintf(r, "CacheRemoveHitCount: %lu\n", header->stat_removes_hit);
-        ap_rprintf(r, "CacheRemoveMissCount: %lu\n", header->stat_removes_miss);
+        ap_rprintf(r, "CacheStoreCount: %u\n", header->stat_stores);
+        ap_rprintf(r, "CacheReplaceCount: %u\n", header->stat_replaced);
+        ap_rprintf(r, "CacheExpireCount: %u\n", header->stat_expiries);
+        ap_rprintf(r, "CacheDiscardCount: %u\n", header->stat_scrolled);
+        ap_rprintf(r, "CacheRetrieveHitCount: %u\n", header->stat_retrieves_hit);
+        ap_rprintf(r, "CacheRetrieveMissCount: %u\n", header->stat_retrieves_miss);
+        ap_rprintf(r, "CacheRemoveHitCount: %u\n", header->stat_removes_hit);
+        ap_rprintf(r, "CacheRemoveMissCount: %u\n", header->stat_removes_miss);
     }
     ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(00841) "leaving shmcb_status");
 }
@@ -704,14 +963,16 @@ static apr_status_t socache_shmcb_iterate(ap_socache_instance_t *instance,
     apr_size_t buflen = 0;
     unsigned char *buf = NULL;
 
-    /* Perform the iteration inside the mutex to avoid corruption or invalid
-     * pointer arithmetic. The rest of our logic uses read-only header data so
-     * doesn't need the lock. */
+    /* Lock each subcache while it is iterated, to avoid corruption or
+     * invalid pointer arithmetic. The rest of our logic uses read-only
+     * header data so doesn't need the lock. */
     /* Iterate over the subcaches */
     for (loop = 0; loop < header->subcache_num && rv == APR_SUCCESS; loop++) {
         SHMCBSubcache *subcache = SHMCB_SUBCACHE(header, loop);
+        shmcb_subcache_lock(subcache);
         rv = shmcb_subcache_iterate(instance, s, userctx, header, subcache,
                                     iterator, &buf, &buflen, pool, now);
+        shmcb_subcache_unlock(subcache);
     }
     return rv;
 }
@@ -761,7 +1022,7 @@ static void shmcb_subcache_expire(server_rec *s, SHMCBHeader *header,
         subcache->data_used -= diff;
         subcache->data_pos = idx->data_pos;
     }
-    header->stat_expiries += expired;
+    apr_atomic_add32(&header->stat_expiries, expired);
     ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(00843)
                  "we now have %u socache entries", subcache->idx_used);
 }
@@ -817,7 +1078,7 @@ static int shmcb_subcache_store(server_rec *s, SHMCBHeader *header,
                                                       header->subcache_data_size);
             subcache->data_pos = idx2->data_pos;
             /* Stats */
-            header->stat_scrolled++;
+            apr_atomic_inc32(&header->stat_scrolled);
             /* Loop admin */
             idx = idx2;
             loop++;
@@ -858,6 +1119,8 @@ static int shmcb_subcache_store(server_rec *s, SHMCBHeader *header,
     idx->data_used = total_len;
     idx->id_len = id_len;
     idx->removed = 0;
+    SHMCB_FINGERPRINTS(header, subcache)[new_idx] = shmcb_fingerprint(id,
+                                                                     id_len);
     subcache->idx_used++;
     ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(00847)
                  "insert happened at idx=%d, data=(%u:%u)", new_idx,
@@ -870,42 +1133,67 @@ static int shmcb_subcache_store(server_rec *s, SHMCBHeader *header,
     return 0;
 }
 
-static int shmcb_subcache_retrieve(server_rec *s, SHMCBHeader *header,
-                                   SHMCBSubcache *subcache,
-                                   const unsigned char *id, unsigned int idlen,
-                                   unsigned char *dest, unsigned int *destlen)
+/* One lookup in a subcache, without any lock: everything is read once and
+ * bounded so that the concurrent changes of a writer can't take us out of
+ * the subcache, the caller checks the sequence count afterward to know
+ * whether the result can be trusted.  Returns zero if found, non-zero
+ * otherwise. */
+static int shmcb_subcache_lookup(server_rec *s, SHMCBHeader *header,
+                                 SHMCBSubcache *subcache,
+                                 const unsigned char *id, unsigned int idlen,
+                                 unsigned char *dest, unsigned int *destlen,
+                                 apr_time_t now)
 {
-    unsigned int pos;
+    unsigned char *fps = SHMCB_FINGERPRINTS(header, subcache);
+    unsigned char fp = shmcb_fingerprint(id, idlen);
+    unsigned int pos = subcache->idx_pos;
+    unsigned int used = subcache->idx_used;
     unsigned int loop = 0;
-    apr_time_t now = apr_time_now();
 
-    pos = subcache->idx_pos;
+    if (pos >= header->index_num || used > header->index_num) {
+        return -1;
+    }
 
-    while (loop < subcache->idx_used) {
-        SHMCBIndex *idx = SHMCB_INDEX(subcache, pos);
+    while (loop < used) {
+        SHMCBIndex *idx;
+        unsigned int data_pos, data_used, id_len;
+        unsigned int skip = shmcb_fingerprint_find(fps, header->index_num,
+                                                   pos, used - loop, fp);
+
+        if (skip == used - loop) {
+            break;
+        }
+        loop += skip;
+        pos = SHMCB_CYCLIC_INCREMENT(pos, skip, header->index_num);
+
+        idx = SHMCB_INDEX(subcache, pos);
+        data_pos = idx->data_pos;
+        data_used = idx->data_used;
+        id_len = idx->id_len;
 
         /* Only consider 'idx' if the id matches, and the "removed"
          * flag isn't set, and the record is not expired.
          * Check the data length too to avoid a buffer overflow
-         * in case of corruption, which should be impossible,
-         * but it's cheap to be safe. */
+         * in case of corruption, or of a concurrent change. */
         if (!idx->removed
-            && idx->id_len == idlen
-            && (idx->data_used - idx->id_len) <= *destlen
+            && id_len == idlen
+            && data_pos < header->subcache_data_size
+            && data_used <= header->subcache_data_size
+            && id_len <= data_used
+            && (data_used - id_len) <= *destlen
             && shmcb_cyclic_memcmp(header->subcache_data_size,
                                    SHMCB_DATA(header, subcache),
-                                   idx->data_pos, id, idx->id_len) == 0) {
+                                   data_pos, id, id_len) == 0) {
             ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(00849)
-                         "match at idx=%d, data=%d", pos, idx->data_pos);
+                         "match at idx=%d, data=%d", pos, data_pos);
             if (idx->expires > now) {
                 unsigned int data_offset;
 
                 /* Find the offset of the data segment, after the id */
-                data_offset = SHMCB_CYCLIC_INCREMENT(idx->data_pos,
-                                                     idx->id_len,
+                data_offset = SHMCB_CYCLIC_INCREMENT(data_pos, id_len,
                                                      header->subcache_data_size);
 
-                *destlen = idx->data_used - idx->id_len;
+                *destlen = data_used - id_len;
 
                 /* Copy out the data */
                 shmcb_cyclic_cton_memcpy(header->subcache_data_size,
@@ -915,11 +1203,10 @@ static int shmcb_subcache_retrieve(server_rec *s, SHMCBHeader *header,
                 return 0;
             }
             else {
-                /* Already stale, quietly remove and treat as not-found */
-                idx->removed = 1;
-                header->stat_expiries++;
+                /* Already stale, treat as not-found; the next writer
+                 * will reclaim it */
                 ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(00850)
-                             "shmcb_subcache_retrieve discarding expired entry");
+                             "shmcb_subcache_retrieve ignoring expired entry");
                 return -1;
             }
         }
@@ -928,8 +1215,41 @@ static int shmcb_subcache_retrieve(server_rec *s, SHMCBHeader *header,
         pos = SHMCB_CYCLIC_INCREMENT(pos, 1, header->index_num);
     }
 
-    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(00851)
-                 "shmcb_subcache_retrieve found no match");
+    return -1;
+}
+
+static int shmcb_subcache_retrieve(server_rec *s, SHMCBHeader *header,
+                                   SHMCBSubcache *subcache,
+                                   const unsigned char *id, unsigned int idlen,
+                                   unsigned char *dest, unsigned int *destlen)
+{
+    unsigned int size = *destlen;
+    apr_time_t now = apr_time_now();
+    int retries;
+
+    for (retries = 0; retries < SHMCB_READ_RETRIES; ++retries) {
+        apr_uint32_t seq = shmcb_subcache_seq(subcache);
+        int rv;
+
+        if (seq & 1) {
+            /* a writer is at work */
+            continue;
+        }
+        *destlen = size;
+        rv = shmcb_subcache_lookup(s, header, subcache, id, idlen,
+                                   dest, destlen, now);
+        if (shmcb_subcache_seq(subcache) == seq) {
+            if (rv) {
+                ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(00851)
+                             "shmcb_subcache_retrieve found no match");
+            }
+            return rv;
+        }
+    }
+
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(10517)
+                 "shmcb_subcache_retrieve gave up on a busy subcache");
+    *destlen = size;
     return -1;
 }
 
@@ -938,12 +1258,25 @@ static int shmcb_subcache_remove(server_rec *s, SHMCBHeader *header,
                                  const unsigned char *id,
                                  unsigned int idlen)
 {
+    unsigned char *fps = SHMCB_FINGERPRINTS(header, subcache);
+    unsigned char fp = shmcb_fingerprint(id, idlen);
     unsigned int pos;
     unsigned int loop = 0;
 
     pos = subcache->idx_pos;
     while (loop < subcache->idx_used) {
-        SHMCBIndex *idx = SHMCB_INDEX(subcache, pos);
+        SHMCBIndex *idx;
+        unsigned int skip = shmcb_fingerprint_find(fps, header->index_num,
+                                                   pos,
+                                                   subcache->idx_used - loop,
+                                                   fp);
+
+        if (skip == subcache->idx_used - loop) {
+            break;
+        }
+        loop += skip;
+        pos = SHMCB_CYCLIC_INCREMENT(pos, skip, header->index_num);
+        idx = SHMCB_INDEX(subcache, pos);
 
         /* Only consider 'idx' if the id matches, and the "removed"
          * flag isn't set. */
@@ -1041,7 +1374,7 @@ static apr_status_t shmcb_subcache_iterate(ap_socache_instance_t *instance,
             else {
                 /* Already stale, quietly remove and treat as not-found */
                 idx->removed = 1;
-                header->stat_expiries++;
+                apr_atomic_inc32(&header->stat_expiries);
                 ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(00856)
                              "shmcb_subcache_iterate discarding expired entry");
             }
@@ -1056,7 +1389,7 @@ static apr_status_t shmcb_subcache_iterate(ap_socache_instance_t *instance,
 
 static const ap_socache_provider_t socache_shmcb = {
     "shmcb",
-    AP_SOCACHE_FLAG_NOTMPSAFE,
+    0,
     socache_shmcb_create,
     socache_shmcb_init,
     socache_shmcb_destroy,
@@ -1067,8 +1400,64 @@ static const ap_socache_provider_t socache_shmcb = {
     socache_shmcb_iterate
 };
 
+/* Destroy the retained segments which the new generation didn't take
+ * over, once all the modules had a chance to */
+static int shmcb_post_config(apr_pool_t *pconf, apr_pool_t *plog,
+                             apr_pool_t *ptemp, server_rec *s)
+{
+    shmcb_retained_data *retained;
+    apr_hash_index_t *hi;
+    int generation;
+
+    if (ap_state_query(AP_SQ_MAIN_STATE) == AP_SQ_MS_CREATE_PRE_CONFIG) {
+        return OK;
+    }
+    retained = ap_retained_data_get(SHMCB_RETAINED_KEY);
+    if (!retained) {
+        return OK;
+    }
+    generation = ap_state_query(AP_SQ_CONFIG_GEN);
+    for (hi = apr_hash_first(ptemp, retained->segments); hi;
+         hi = apr_hash_next(hi)) {
+        shmcb_retained_segment *seg = apr_hash_this_val(hi);
+
+        if (seg->shm && (!shmcb_retain || seg->generation != generation)) {
+            apr_shm_destroy(seg->shm);
+            seg->shm = NULL;
+        }
+    }
+    return OK;
+}
+
+static int shmcb_pre_config(apr_pool_t *pconf, apr_pool_t *plog,
+                            apr_pool_t *ptemp)
+{
+    shmcb_retain = 0;
+    return OK;
+}
+
+static const char *set_shmcb_retain(cmd_parms *cmd, void *dummy, int flag)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+
+    if (err) {
+        return err;
+    }
+    shmcb_retain = flag;
+    return NULL;
+}
+
+static const command_rec shmcb_cmds[] = {
+    AP_INIT_FLAG("SOCacheShmcbRetain", set_shmcb_retain, NULL, RSRC_CONF,
+                 "Whether the shmcb caches are kept across restarts"),
+    {NULL}
+};
+
 static void register_hooks(apr_pool_t *p)
 {
+    ap_hook_pre_config(shmcb_pre_config, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_post_config(shmcb_post_config, NULL, NULL, APR_HOOK_REALLY_LAST);
+
     ap_register_provider(p, AP_SOCACHE_PROVIDER_GROUP, "shmcb",
                          AP_SOCACHE_PROVIDER_VERSION,
                          &socache_shmcb);
@@ -1082,6 +1471,7 @@ static void register_hooks(apr_pool_t *p)
 
 AP_DECLARE_MODULE(socache_shmcb) = {
     STANDARD20_MODULE_STUFF,
-    NULL, NULL, NULL, NULL, NULL,
+    NULL, NULL, NULL, NULL,
+    shmcb_cmds,
     register_hooks
 };
@@ -0,0 +1,738 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * mod_socache_slab: a shared object cache stored in one large slab file
+ * plus a memory mapped index, instead of one or more files per object.
+ *
+ * The slab file is split into size classes of fixed size slots (4KB,
+ * 8KB, ... doubling), and each class is written as a ring: a store
+ * always takes the next slot of the smallest class the object fits in,
+ * silently evicting whatever lived there.  The index is a set
+ * associative table of the object hashes, the record at the head of
+ * each slot repeats the hash and id of its object so that index entries
+ * left pointing to an overwritten slot are detected, and dropped, when
+ * they are next looked up.  Nothing ever needs to be scanned or
+ * unlinked to reclaim space.
+ *
+ * Both files survive restarts when their geometry did not change.
+ */
+
+#include "httpd.h"
+#include "http_log.h"
+#include "http_request.h"
+#include "http_protocol.h"
+#include "http_config.h"
+#include "mod_status.h"
+
+#include "apr.h"
+#include "apr_strings.h"
+#include "apr_time.h"
+#include "apr_file_io.h"
+#include "apr_mmap.h"
+#define APR_WANT_STRFUNC
+#define APR_WANT_IOVEC
+#include "apr_want.h"
+
+#include "ap_socache.h"
+
+#define DEFAULT_SLAB_PREFIX "socache-slab-"
+#define DEFAULT_SLAB_SIZE ((apr_off_t)64 * 1024 * 1024) /* 64MB */
+#define SLAB_INDEX_SUFFIX ".idx"
+
+#define SLAB_MAGIC 0x534c4142 /* "SLAB" */
+#define SLAB_VERSION 1
+
+/* smallest slot, and the number of (doubling) size classes */
+#define SLAB_MIN_SLOT 4096
+#define SLAB_MAX_CLASSES 12
+/* index entries per set */
+#define SLAB_SET_SIZE 8
+
+#define SLAB_FILE_MODE (APR_UREAD | APR_UWRITE | APR_GREAD)
+
+/*
+ * A size class: a ring of nslots slots of slot_size bytes, starting at
+ * offset in the slab file.
+ */
+typedef struct {
+    apr_uint64_t offset;
+    apr_uint32_t slot_size;
+    apr_uint32_t nslots;
+    apr_uint32_t next;           /* the slot the next store goes to */
+    apr_uint32_t wrapped;        /* how many times the ring wrapped */
+    apr_uint64_t stores;
+} slab_class_t;
+
+/*
+ * The head of the index file, followed by nsets sets of SLAB_SET_SIZE
+ * entries.
+ */
+typedef struct {
+    apr_uint32_t magic;
+    apr_uint32_t version;
+    apr_uint64_t data_size;
+    apr_uint32_t nclasses;
+    apr_uint32_t nsets;
+    apr_uint64_t retrieves;
+    apr_uint64_t hits;
+    apr_uint64_t stale;          /* entries found pointing to reused slots */
+    apr_uint64_t removes;
+    slab_class_t classes[SLAB_MAX_CLASSES];
+} slab_header_t;
+
+typedef struct {
+    apr_uint64_t hash;           /* 0 if the entry is free */
+    apr_time_t expiry;
+    apr_uint32_t slot;
+    apr_uint32_t klass;
+} slab_entry_t;
+
+/*
+ * The record at the head of each used slot, followed by the id and the
+ * data.
+ */
+typedef struct {
+    apr_uint64_t hash;
+    apr_time_t expiry;
+    apr_uint32_t idlen;
+    apr_uint32_t datalen;
+} slab_record_t;
+
+#define ALIGNED_HEADER_SIZE APR_ALIGN_DEFAULT(sizeof(slab_header_t))
+
+/* Use of the context structure must be thread-safe after the initial
+ * create/init; callers must hold the mutex. */
+struct ap_socache_instance_t {
+    const char *data_file;
+    const char *index_file;
+    apr_off_t data_size;
+    apr_file_t *data;
+    apr_file_t *index;
+    apr_mmap_t *mm;
+    slab_header_t *header;
+    slab_entry_t *entries;
+};
+
+static const char *slab_parse_size(const char *arg, apr_off_t *size)
+{
+    char *end;
+
+    if (apr_strtoff(size, arg, &end, 10) != APR_SUCCESS || *size <= 0) {
+        return "Invalid argument: cache size not numerical";
+    }
+    switch (*end) {
+    case 'T': case 't':
+        *size *= 1024;
+        /* fall through */
+    case 'G': case 'g':
+        *size *= 1024;
+        /* fall through */
+    case 'M': case 'm':
+        *size *= 1024;
+        /* fall through */
+    case 'K': case 'k':
+        *size *= 1024;
+        end++;
+        break;
+    }
+    if (*end) {
+        return "Invalid argument: cache size not numerical";
+    }
+    if (*size < (apr_off_t)SLAB_MIN_SLOT * 256) {
+        return "Invalid argument: size has to be >= 1M";
+    }
+    return NULL;
+}
+
+static const char *socache_slab_create(ap_socache_instance_t **context,
+                                       const char *arg,
+                                       apr_pool_t *tmp, apr_pool_t *p)
+{
+    ap_socache_instance_t *ctx;
+    char *path, *cp, *cp2;
+    const char *err;
+
+    *context = ctx = apr_pcalloc(p, sizeof *ctx);
+    ctx->data_size = DEFAULT_SLAB_SIZE;
+
+    if (!arg || *arg == '\0') {
+        /* Use defaults. */
+        return NULL;
+    }
+
+    ctx->data_file = path = ap_runtime_dir_relative(p, arg);
+    if (!path) {
+        return apr_psprintf(tmp, "Invalid cache file path %s", arg);
+    }
+
+    cp = strrchr(path, '(');
+    cp2 = path + strlen(path) - 1;
+    if (cp) {
+        if (*cp2 != ')') {
+            return "Invalid argument: no closing parenthesis or cache size "
+                   "missing after pathname with parenthesis";
+        }
+        *cp++ = '\0';
+        *cp2  = '\0';
+
+        if ((err = slab_parse_size(cp, &ctx->data_size))) {
+            return err;
+        }
+    }
+    else if (cp2 >= path && *cp2 == ')') {
+        return "Invalid argument: no opening parenthesis";
+    }
+
+    return NULL;
+}
+
+/* FNV-1a, never 0 which marks a free entry */
+static apr_uint64_t slab_hash(const unsigned char *id, unsigned int idlen)
+{
+    apr_uint64_t hash = APR_UINT64_C(0xcbf29ce484222325);
+    unsigned int i;
+
+    for (i = 0; i < idlen; i++) {
+        hash ^= id[i];
+        hash *= APR_UINT64_C(0x100000001b3);
+    }
+    return hash ? hash : 1;
+}
+
+/*
+ * Split the slab file in equally sized regions, one per size class,
+ * dropping the largest classes as long as they would hold less than 16
+ * slots.
+ */
+static void slab_geometry(slab_header_t *geo, apr_off_t data_size)
+{
+    apr_uint64_t region, total = 0;
+    apr_uint32_t nclasses = SLAB_MAX_CLASSES, i;
+
+    memset(geo, 0, sizeof(*geo));
+    while (nclasses > 1
+           && (apr_uint64_t)data_size / nclasses
+              < (apr_uint64_t)16 * (SLAB_MIN_SLOT << (nclasses - 1))) {
+        nclasses--;
+    }
+    region = (apr_uint64_t)data_size / nclasses;
+    region -= region % (SLAB_MIN_SLOT << (nclasses - 1));
+
+    geo->magic = SLAB_MAGIC;
+    geo->version = SLAB_VERSION;
+    geo->data_size = (apr_uint64_t)data_size;
+    geo->nclasses = nclasses;
+    for (i = 0; i < nclasses; i++) {
+        slab_class_t *cls = &geo->classes[i];
+        cls->offset = i * region;
+        cls->slot_size = SLAB_MIN_SLOT << i;
+        cls->nslots = (apr_uint32_t)(region / cls->slot_size);
+        total += cls->nslots;
+    }
+    geo->nsets = (apr_uint32_t)((total + SLAB_SET_SIZE - 1) / SLAB_SET_SIZE);
+}
+
+static apr_status_t slab_open(apr_file_t **file, const char *path,
+                              apr_off_t size, int *reset, server_rec *s,
+                              apr_pool_t *p)
+{
+    apr_finfo_t finfo;
+    apr_status_t rv;
+
+    rv = apr_file_open(file, path, APR_FOPEN_READ | APR_FOPEN_WRITE
+                                   | APR_FOPEN_CREATE | APR_FOPEN_BINARY,
+                       SLAB_FILE_MODE, p);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10426)
+                     "Cannot open slab socache file `%s'", path);
+        return rv;
+    }
+    rv = apr_file_info_get(&finfo, APR_FINFO_SIZE, *file);
+    if (rv == APR_SUCCESS && finfo.size != size) {
+        /* (re)size it, and start over from an empty cache */
+        rv = apr_file_trunc(*file, 0);
+        if (rv == APR_SUCCESS) {
+            rv = apr_file_trunc(*file, size);
+        }
+        *reset = 1;
+    }
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10427)
+                     "Cannot size slab socache file `%s' to %" APR_OFF_T_FMT
+                     " bytes", path, size);
+        apr_file_close(*file);
+        *file = NULL;
+    }
+    return rv;
+}
+
+static apr_status_t socache_slab_init(ap_socache_instance_t *ctx,
+                                      const char *namespace,
+                                      const struct ap_socache_hints *hints,
+                                      server_rec *s, apr_pool_t *p)
+{
+#if APR_HAS_MMAP
+    slab_header_t geo;
+    apr_size_t index_len;
+    apr_status_t rv;
+    int reset = 0;
+
+    if (ctx->data_file == NULL) {
+        const char *path = apr_pstrcat(p, DEFAULT_SLAB_PREFIX, namespace,
+                                       NULL);
+
+        ctx->data_file = ap_runtime_dir_relative(p, path);
+        if (ctx->data_file == NULL) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, 0, s, APLOGNO(10428)
+                         "could not use default path '%s' for slab socache",
+                         path);
+            return APR_EINVAL;
+        }
+    }
+    ctx->index_file = apr_pstrcat(p, ctx->data_file, SLAB_INDEX_SUFFIX, NULL);
+
+    slab_geometry(&geo, ctx->data_size);
+    index_len = ALIGNED_HEADER_SIZE
+                + (apr_size_t)geo.nsets * SLAB_SET_SIZE * sizeof(slab_entry_t);
+
+    rv = slab_open(&ctx->data, ctx->data_file, ctx->data_size, &reset, s, p);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+    rv = slab_open(&ctx->index, ctx->index_file, (apr_off_t)index_len,
+                   &reset, s, p);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+
+    rv = apr_mmap_create(&ctx->mm, ctx->index, 0, index_len,
+                         APR_MMAP_READ | APR_MMAP_WRITE, p);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10429)
+                     "Cannot map slab socache index `%s'", ctx->index_file);
+        return rv;
+    }
+    ctx->header = ctx->mm->mm;
+    ctx->entries = (slab_entry_t *)((char *)ctx->mm->mm + ALIGNED_HEADER_SIZE);
+
+    if (reset || ctx->header->magic != geo.magic
+        || ctx->header->version != geo.version
+        || ctx->header->data_size != geo.data_size
+        || ctx->header->nclasses != geo.nclasses
+        || ctx->header->nsets != geo.nsets) {
+        memset(ctx->mm->mm, 0, index_len);
+        memcpy(ctx->header, &geo, sizeof(geo));
+        reset = 1;
+    }
+
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(10430)
+                 "slab socache `%s' %s: %u size classes, %u index sets",
+                 ctx->data_file, reset ? "initialised" : "reused",
+                 geo.nclasses, geo.nsets);
+
+    return APR_SUCCESS;
+#else
+    ap_log_error(APLOG_MARK, APLOG_ERR, APR_ENOTIMPL, s, APLOGNO(10431)
+                 "slab socache requires mmap support");
+    return APR_ENOTIMPL;
+#endif
+}
+
+static void socache_slab_destroy(ap_socache_instance_t *ctx, server_rec *s)
+{
+    /* the files are kept, to be reused after a restart */
+#if APR_HAS_MMAP
+    if (ctx->mm) {
+        apr_mmap_delete(ctx->mm);
+        ctx->mm = NULL;
+    }
+#endif
+    ctx->header = NULL;
+    ctx->entries = NULL;
+    if (ctx->index) {
+        apr_file_close(ctx->index);
+        ctx->index = NULL;
+    }
+    if (ctx->data) {
+        apr_file_close(ctx->data);
+        ctx->data = NULL;
+    }
+}
+
+static APR_INLINE slab_entry_t *slab_set(ap_socache_instance_t *ctx,
+                                         apr_uint64_t hash)
+{
+    return ctx->entries + (hash % ctx->header->nsets) * SLAB_SET_SIZE;
+}
+
+static APR_INLINE apr_off_t slab_offset(ap_socache_instance_t *ctx,
+                                        const slab_entry_t *entry)
+{
+    const slab_class_t *cls = &ctx->header->classes[entry->klass];
+
+    return (apr_off_t)(cls->offset
+                       + (apr_uint64_t)entry->slot * cls->slot_size);
+}
+
+/*
+ * Read the record of the entry and check it is still the one of id,
+ * returning APR_NOTFOUND if the slot was reused.
+ */
+static apr_status_t slab_read_record(ap_socache_instance_t *ctx,
+                                     const slab_entry_t *entry,
+                                     const unsigned char *id,
+                                     unsigned int idlen,
+                                     slab_record_t *rec, apr_pool_t *p)
+{
+    apr_off_t offset = slab_offset(ctx, entry);
+    apr_size_t len = sizeof(*rec);
+    unsigned char *stored;
+    apr_status_t rv;
+
+    rv = apr_file_seek(ctx->data, APR_SET, &offset);
+    if (rv == APR_SUCCESS) {
+        rv = apr_file_read_full(ctx->data, rec, len, NULL);
+    }
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+    if (rec->hash != entry->hash || rec->expiry != entry->expiry
+        || (id && rec->idlen != idlen)
+        || sizeof(*rec) + (apr_uint64_t)rec->idlen + rec->datalen
+               > ctx->header->classes[entry->klass].slot_size) {
+        return APR_NOTFOUND;
+    }
+    if (id) {
+        stored = apr_palloc(p, idlen ? idlen : 1);
+        rv = apr_file_read_full(ctx->data, stored, idlen, NULL);
+        if (rv != APR_SUCCESS) {
+            return rv;
+        }
+        if (memcmp(stored, id, idlen)) {
+            return APR_NOTFOUND;
+        }
+    }
+    return APR_SUCCESS;
+}
+
+static slab_entry_t *slab_find(ap_socache_instance_t *ctx,
+                               apr_uint64_t hash,
+                               const unsigned char *id, unsigned int idlen,
+                               slab_record_t *rec, apr_pool_t *p)
+{
+    slab_entry_t *set = slab_set(ctx, hash);
+    apr_time_t now = apr_time_now();
+    int i;
+
+    for (i = 0; i < SLAB_SET_SIZE; i++) {
+        slab_entry_t *entry = &set[i];
+
+        if (entry->hash != hash) {
+            continue;
+        }
+        if (entry->expiry <= now) {
+            entry->hash = 0;
+            continue;
+        }
+        switch (slab_read_record(ctx, entry, id, idlen, rec, p)) {
+        case APR_SUCCESS:
+            return entry;
+        case APR_NOTFOUND:
+            if (rec->hash != hash) {
+                /* the slot was taken by another object */
+                ctx->header->stale++;
+                entry->hash = 0;
+            }
+            break;
+        default:
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+static apr_status_t socache_slab_store(ap_socache_instance_t *ctx,
+                                       server_rec *s, const unsigned char *id,
+                                       unsigned int idlen, apr_time_t expiry,
+                                       unsigned char *data,
+                                       unsigned int datalen, apr_pool_t *p)
+{
+    apr_uint64_t hash = slab_hash(id, idlen);
+    apr_uint64_t len = sizeof(slab_record_t) + (apr_uint64_t)idlen + datalen;
+    slab_entry_t *set, *entry, *victim = NULL;
+    slab_class_t *cls = NULL;
+    slab_record_t rec;
+    struct iovec vec[3];
+    apr_off_t offset;
+    apr_size_t written;
+    apr_status_t rv;
+    apr_uint32_t k;
+    int i;
+
+    for (k = 0; k < ctx->header->nclasses; k++) {
+        if (len <= ctx->header->classes[k].slot_size) {
+            cls = &ctx->header->classes[k];
+            break;
+        }
+    }
+    if (!cls) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(10432)
+                     "data size too large for slab socache: %" APR_UINT64_T_FMT
+                     " > %u", len,
+                     ctx->header->classes[ctx->header->nclasses - 1].slot_size);
+        return APR_ENOSPC;
+    }
+
+    /* forget any previous version of the object */
+    while ((entry = slab_find(ctx, hash, id, idlen, &rec, p))) {
+        entry->hash = 0;
+    }
+
+    /* append to the ring of the class */
+    rec.hash = hash;
+    rec.expiry = expiry;
+    rec.idlen = idlen;
+    rec.datalen = datalen;
+    vec[0].iov_base = (void *)&rec;
+    vec[0].iov_len = sizeof(rec);
+    vec[1].iov_base = (void *)id;
+    vec[1].iov_len = idlen;
+    vec[2].iov_base = (void *)data;
+    vec[2].iov_len = datalen;
+
+    offset = (apr_off_t)(cls->offset
+                         + (apr_uint64_t)cls->next * cls->slot_size);
+    rv = apr_file_seek(ctx->data, APR_SET, &offset);
+    if (rv == APR_SUCCESS) {
+        rv = apr_file_writev_full(ctx->data, vec, 3, &written);
+    }
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10433)
+                     "Cannot store socache object to slab file `%s'",
+                     ctx->data_file);
+        return rv;
+    }
+
+    /* index it, in a free entry of the set or instead of the one which
+     * expires first */
+    set = slab_set(ctx, hash);
+    for (i = 0; i < SLAB_SET_SIZE; i++) {
+        if (!set[i].hash) {
+            victim = &set[i];
+            break;
+        }
+        if (!victim || set[i].expiry < victim->expiry) {
+            victim = &set[i];
+        }
+    }
+    victim->hash = hash;
+    victim->expiry = expiry;
+    victim->klass = k;
+    victim->slot = cls->next;
+
+    cls->stores++;
+    if (++cls->next == cls->nslots) {
+        cls->next = 0;
+        cls->wrapped++;
+    }
+
+    return APR_SUCCESS;
+}
+
+static apr_status_t socache_slab_retrieve(ap_socache_instance_t *ctx,
+                                          server_rec *s,
+                                          const unsigned char *id,
+                                          unsigned int idlen,
+                                          unsigned char *dest,
+                                          unsigned int *destlen,
+                                          apr_pool_t *p)
+{
+    apr_uint64_t hash = slab_hash(id, idlen);
+    slab_entry_t *entry;
+    slab_record_t rec;
+    apr_status_t rv;
+
+    ctx->header->retrieves++;
+
+    entry = slab_find(ctx, hash, id, idlen, &rec, p);
+    if (!entry) {
+        return APR_NOTFOUND;
+    }
+    if (rec.datalen > *destlen) {
+        return APR_ENOSPC;
+    }
+
+    /* the file offset is right after the id */
+    rv = apr_file_read_full(ctx->data, dest, rec.datalen, NULL);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10434)
+                     "Cannot read socache object from slab file `%s'",
+                     ctx->data_file);
+        return rv;
+    }
+    *destlen = rec.datalen;
+    ctx->header->hits++;
+
+    return APR_SUCCESS;
+}
+
+static apr_status_t socache_slab_remove(ap_socache_instance_t *ctx,
+                                        server_rec *s,
+                                        const unsigned char *id,
+                                        unsigned int idlen, apr_pool_t *p)
+{
+    apr_uint64_t hash = slab_hash(id, idlen);
+    slab_entry_t *entry;
+    slab_record_t rec;
+
+    /* the slot itself is reclaimed when the ring comes back to it */
+    while ((entry = slab_find(ctx, hash, id, idlen, &rec, p))) {
+        entry->hash = 0;
+        ctx->header->removes++;
+    }
+
+    return APR_SUCCESS;
+}
+
+static void socache_slab_status(ap_socache_instance_t *ctx, request_rec *r,
+                                int flags)
+{
+    const slab_header_t *header = ctx->header;
+    apr_uint64_t nentries = (apr_uint64_t)header->nsets * SLAB_SET_SIZE, i;
+    apr_uint64_t used = 0;
+    apr_uint32_t k;
+
+    for (i = 0; i < nentries; i++) {
+        if (ctx->entries[i].hash) {
+            used++;
+        }
+    }
+
+    if (!(flags & AP_STATUS_SHORT)) {
+        ap_rprintf(r, "cache type: <b>SLAB</b>, slab file: <b>%"
+                   APR_OFF_T_FMT "</b> bytes, current entries: <b>%"
+                   APR_UINT64_T_FMT "</b> of <b>%" APR_UINT64_T_FMT
+                   "</b><br>", ctx->data_size, used, nentries);
+        ap_rprintf(r, "retrieves: <b>%" APR_UINT64_T_FMT "</b>, hits: <b>%"
+                   APR_UINT64_T_FMT "</b>, evicted on lookup: <b>%"
+                   APR_UINT64_T_FMT "</b>, removes: <b>%" APR_UINT64_T_FMT
+                   "</b><br>", header->retrieves, header->hits,
+                   header->stale, header->removes);
+        for (k = 0; k < header->nclasses; k++) {
+            const slab_class_t *cls = &header->classes[k];
+            ap_rprintf(r, "size class <b>%u</b> bytes: <b>%u</b> slots, "
+                       "stores: <b>%" APR_UINT64_T_FMT "</b>, wrapped: "
+                       "<b>%u</b> times<br>", cls->slot_size, cls->nslots,
+                       cls->stores, cls->wrapped);
+        }
+    }
+    else {
+        ap_rputs("CacheType: SLAB\n", r);
+        ap_rprintf(r, "CacheSlabSize: %" APR_OFF_T_FMT "\n", ctx->data_size);
+        ap_rprintf(r, "CacheIndexes: %" APR_UINT64_T_FMT "\n", nentries);
+        ap_rprintf(r, "CacheIndexesUsed: %" APR_UINT64_T_FMT "\n", used);
+        ap_rprintf(r, "CacheRetrieves: %" APR_UINT64_T_FMT "\n",
+                   header->retrieves);
+        ap_rprintf(r, "CacheHits: %" APR_UINT64_T_FMT "\n", header->hits);
+        ap_rprintf(r, "CacheEvictedOnLookup: %" APR_UINT64_T_FMT "\n",
+                   header->stale);
+        ap_rprintf(r, "CacheRemoves: %" APR_UINT64_T_FMT "\n",
+                   header->removes);
+        for (k = 0; k < header->nclasses; k++) {
+            const slab_class_t *cls = &header->classes[k];
+            ap_rprintf(r, "CacheClass%uStores: %" APR_UINT64_T_FMT "\n",
+                       cls->slot_size, cls->stores);
+        }
+    }
+}
+
+static apr_status_t socache_slab_iterate(ap_socache_instance_t *ctx,
+                                         server_rec *s, void *userctx,
+                                         ap_socache_iterator_t *iterator,
+                                         apr_pool_t *pool)
+{
+    apr_uint64_t nentries = (apr_uint64_t)ctx->header->nsets * SLAB_SET_SIZE;
+    apr_uint64_t i;
+    apr_time_t now = apr_time_now();
+    apr_status_t rv = APR_SUCCESS;
+    apr_pool_t *p;
+
+    apr_pool_create(&p, pool);
+    apr_pool_tag(p, "socache_slab_iterate");
+
+    for (i = 0; i < nentries && rv == APR_SUCCESS; i++) {
+        slab_entry_t *entry = &ctx->entries[i];
+        slab_record_t rec;
+        unsigned char *buf;
+
+        if (!entry->hash || entry->expiry <= now) {
+            continue;
+        }
+        apr_pool_clear(p);
+        rv = slab_read_record(ctx, entry, NULL, 0, &rec, p);
+        if (rv == APR_NOTFOUND) {
+            rv = APR_SUCCESS;
+            continue;
+        }
+        if (rv != APR_SUCCESS) {
+            break;
+        }
+        /* id and data, with a trailing null char for convenience */
+        buf = apr_palloc(p, rec.idlen + rec.datalen + 2);
+        rv = apr_file_read_full(ctx->data, buf, rec.idlen, NULL);
+        if (rv == APR_SUCCESS) {
+            rv = apr_file_read_full(ctx->data, buf + rec.idlen + 1,
+                                    rec.datalen, NULL);
+        }
+        if (rv != APR_SUCCESS) {
+            break;
+        }
+        buf[rec.idlen] = '\0';
+        buf[rec.idlen + 1 + rec.datalen] = '\0';
+        rv = iterator(ctx, s, userctx, buf, rec.idlen,
+                      buf + rec.idlen + 1, rec.datalen, p);
+    }
+
+    apr_pool_destroy(p);
+    return rv;
+}
+
+static const ap_socache_provider_t socache_slab = {
+    "slab",
+    AP_SOCACHE_FLAG_NOTMPSAFE,
+    socache_slab_create,
+    socache_slab_init,
+    socache_slab_destroy,
+    socache_slab_store,
+    socache_slab_retrieve,
+    socache_slab_remove,
+    socache_slab_status,
+    socache_slab_iterate
+};
+
+static void register_hooks(apr_pool_t *p)
+{
+    ap_register_provider(p, AP_SOCACHE_PROVIDER_GROUP, "slab",
+                         AP_SOCACHE_PROVIDER_VERSION,
+                         &socache_slab);
+}
+
+AP_DECLARE_MODULE(socache_slab) = {
+    STANDARD20_MODULE_STUFF,
+    NULL, NULL, NULL, NULL, NULL,
+    register_hooks
+};
@@ -0,0 +1,489 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * mod_socache_tiered: a socache provider made of two other providers, a
+ * (small, local) front tier which answers the hot lookups and a (large,
+ * usually remote) back tier which holds the authoritative copy, e.g.:
+ *
+ *   SSLSessionCache tiered:shmcb:/path/to/cache(512000),redis:host1,host2
+ *
+ * The configuration string is split at the first comma, so the back
+ * tier is free to use commas of its own.  Stores and removes go to both
+ * tiers, retrieves go to the back tier only when the front misses, and
+ * the objects found there are copied to the front.  Objects are kept in
+ * the front tier for SOCacheTieredFrontTTL at most, which bounds how long
+ * a change made through another front (another host) can go unnoticed.
+ *
+ * The provider is MP-safe: when one of the tiers is not, the accesses to
+ * that tier only are serialized with a mutex of ours, so that a lookup
+ * in the front never waits for a network round trip to the back.
+ */
+
+#include "httpd.h"
+#include "http_config.h"
+#include "http_log.h"
+#include "http_protocol.h"
+#include "mod_status.h"
+#include "util_mutex.h"
+
+#include "apr.h"
+#include "apr_strings.h"
+#include "apr_time.h"
+#include "apr_global_mutex.h"
+
+#include "ap_socache.h"
+#include "ap_provider.h"
+
+#ifndef TIERED_DEFAULT_FRONT_TTL
+#define TIERED_DEFAULT_FRONT_TTL apr_time_from_sec(30)
+#endif
+
+module AP_MODULE_DECLARE_DATA socache_tiered_module;
+
+static const char *const tiered_mutex_type = "socache-tiered";
+
+typedef struct {
+    apr_interval_time_t front_ttl;
+} socache_tiered_svr_cfg;
+
+/* One of the two tiers, with the mutex serializing it if needed. */
+typedef struct {
+    const char *name;
+    const ap_socache_provider_t *provider;
+    ap_socache_instance_t *instance;
+    apr_global_mutex_t *mutex;
+} tiered_tier_t;
+
+struct ap_socache_instance_t {
+    tiered_tier_t front;
+    tiered_tier_t back;
+    apr_interval_time_t front_ttl;
+};
+
+/* The instances initialized in this generation, whose mutexes must be
+ * reopened by the children. */
+static apr_array_header_t *tiered_instances;
+
+static const char *tiered_create_tier(tiered_tier_t *tier, const char *arg,
+                                      apr_pool_t *tmp, apr_pool_t *p)
+{
+    const char *sep = ap_strchr_c(arg, ':');
+    const char *err;
+
+    tier->name = sep ? apr_pstrmemdup(p, arg, sep - arg) : arg;
+    if (!strcmp(tier->name, "tiered")) {
+        return "A tiered socache can't be a tier of itself";
+    }
+    tier->provider = ap_lookup_provider(AP_SOCACHE_PROVIDER_GROUP, tier->name,
+                                        AP_SOCACHE_PROVIDER_VERSION);
+    if (!tier->provider) {
+        return apr_psprintf(tmp, "Unknown socache provider '%s' for a tier "
+                            "(maybe you need to load mod_socache_%s?)",
+                            tier->name, tier->name);
+    }
+
+    err = tier->provider->create(&tier->instance, sep ? sep + 1 : NULL,
+                                 tmp, p);
+    if (err) {
+        return apr_psprintf(tmp, "%s tier: %s", tier->name, err);
+    }
+
+    return NULL;
+}
+
+static const char *socache_tiered_create(ap_socache_instance_t **context,
+                                         const char *arg,
+                                         apr_pool_t *tmp, apr_pool_t *p)
+{
+    ap_socache_instance_t *ctx;
+    const char *comma, *err;
+
+    *context = ctx = apr_pcalloc(p, sizeof *ctx);
+
+    if (!arg || !(comma = ap_strchr_c(arg, ',')) || comma == arg
+        || !comma[1]) {
+        return "A front and a back socache provider are required to create "
+               "a tiered socache, e.g. tiered:shmcb:path(size),redis:host";
+    }
+
+    err = tiered_create_tier(&ctx->front, apr_pstrmemdup(p, arg, comma - arg),
+                             tmp, p);
+    if (!err) {
+        err = tiered_create_tier(&ctx->back, comma + 1, tmp, p);
+    }
+
+    return err;
+}
+
+static apr_status_t tiered_init_tier(tiered_tier_t *tier, const char *which,
+                                     const char *namespace,
+                                     const struct ap_socache_hints *hints,
+                                     server_rec *s, apr_pool_t *p)
+{
+    apr_status_t rv;
+
+    if (tier->provider->flags & AP_SOCACHE_FLAG_NOTMPSAFE) {
+        rv = ap_global_mutex_create(&tier->mutex, NULL, tiered_mutex_type,
+                                    apr_pstrcat(p, namespace, "-", which,
+                                                NULL),
+                                    s, p, 0);
+        if (rv != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_CRIT, rv, s, APLOGNO(10513)
+                         "failed to create the %s mutex of the %s tier",
+                         tiered_mutex_type, which);
+            return rv;
+        }
+    }
+
+    rv = tier->provider->init(tier->instance, namespace, hints, s, p);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_CRIT, rv, s, APLOGNO(10514)
+                     "failed to initialise the %s tier (%s)",
+                     which, tier->name);
+    }
+
+    return rv;
+}
+
+static apr_status_t socache_tiered_init(ap_socache_instance_t *ctx,
+                                        const char *namespace,
+                                        const struct ap_socache_hints *hints,
+                                        server_rec *s, apr_pool_t *p)
+{
+    socache_tiered_svr_cfg *sconf = ap_get_module_config(s->module_config,
+                                                 &socache_tiered_module);
+    apr_status_t rv;
+
+    ctx->front_ttl = sconf->front_ttl;
+
+    rv = tiered_init_tier(&ctx->front, "front", namespace, hints, s, p);
+    if (rv == APR_SUCCESS) {
+        rv = tiered_init_tier(&ctx->back, "back", namespace, hints, s, p);
+    }
+    if (rv == APR_SUCCESS && (ctx->front.mutex || ctx->back.mutex)) {
+        APR_ARRAY_PUSH(tiered_instances, ap_socache_instance_t *) = ctx;
+    }
+
+    return rv;
+}
+
+static void socache_tiered_destroy(ap_socache_instance_t *ctx, server_rec *s)
+{
+    if (ctx->back.instance) {
+        ctx->back.provider->destroy(ctx->back.instance, s);
+    }
+    if (ctx->front.instance) {
+        ctx->front.provider->destroy(ctx->front.instance, s);
+    }
+}
+
+static APR_INLINE void tiered_lock(tiered_tier_t *tier)
+{
+    if (tier->mutex) {
+        apr_global_mutex_lock(tier->mutex);
+    }
+}
+
+static APR_INLINE void tiered_unlock(tiered_tier_t *tier)
+{
+    if (tier->mutex) {
+        apr_global_mutex_unlock(tier->mutex);
+    }
+}
+
+static apr_status_t tiered_store_front(ap_socache_instance_t *ctx,
+                                       server_rec *s,
+                                       const unsigned char *id,
+                                       unsigned int idlen,
+                                       apr_time_t expiry,
+                                       unsigned char *data,
+                                       unsigned int datalen,
+                                       apr_pool_t *p)
+{
+    apr_time_t front_expiry = apr_time_now() + ctx->front_ttl;
+    apr_status_t rv;
+
+    if (ctx->front_ttl <= 0) {
+        return APR_SUCCESS;
+    }
+    if (expiry > front_expiry) {
+        expiry = front_expiry;
+    }
+
+    tiered_lock(&ctx->front);
+    rv = ctx->front.provider->store(ctx->front.instance, s, id, idlen,
+                                    expiry, data, datalen, p);
+    tiered_unlock(&ctx->front);
+
+    return rv;
+}
+
+static apr_status_t socache_tiered_store(ap_socache_instance_t *ctx,
+                                         server_rec *s,
+                                         const unsigned char *id,
+                                         unsigned int idlen,
+                                         apr_time_t expiry,
+                                         unsigned char *data,
+                                         unsigned int datalen,
+                                         apr_pool_t *p)
+{
+    apr_status_t rv;
+
+    tiered_lock(&ctx->back);
+    rv = ctx->back.provider->store(ctx->back.instance, s, id, idlen,
+                                   expiry, data, datalen, p);
+    tiered_unlock(&ctx->back);
+
+    if (rv == APR_SUCCESS) {
+        /* the front is only a copy, failing to fill it is no error */
+        tiered_store_front(ctx, s, id, idlen, expiry, data, datalen, p);
+    }
+    else {
+        /* don't let the front serve an object the back doesn't have */
+        tiered_lock(&ctx->front);
+        ctx->front.provider->remove(ctx->front.instance, s, id, idlen, p);
+        tiered_unlock(&ctx->front);
+    }
+
+    return rv;
+}
+
+static apr_status_t socache_tiered_retrieve(ap_socache_instance_t *ctx,
+                                            server_rec *s,
+                                            const unsigned char *id,
+                                            unsigned int idlen,
+                                            unsigned char *dest,
+                                            unsigned int *destlen,
+                                            apr_pool_t *p)
+{
+    unsigned int size = *destlen;
+    apr_status_t rv;
+
+    if (ctx->front_ttl > 0) {
+        tiered_lock(&ctx->front);
+        rv = ctx->front.provider->retrieve(ctx->front.instance, s, id, idlen,
+                                           dest, destlen, p);
+        tiered_unlock(&ctx->front);
+        if (rv == APR_SUCCESS) {
+            return APR_SUCCESS;
+        }
+        *destlen = size;
+    }
+
+    tiered_lock(&ctx->back);
+    rv = ctx->back.provider->retrieve(ctx->back.instance, s, id, idlen,
+                                      dest, destlen, p);
+    tiered_unlock(&ctx->back);
+
+    if (rv == APR_SUCCESS) {
+        apr_status_t srv;
+
+        /* the back tier does not tell the expiry, so the front TTL is
+         * the only bound here */
+        srv = tiered_store_front(ctx, s, id, idlen, apr_time_now()
+                                 + ctx->front_ttl, dest, *destlen, p);
+        if (srv != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_TRACE1, srv, s,
+                         "socache_tiered: object not copied to the "
+                         "front tier (%s)", ctx->front.name);
+        }
+    }
+
+    return rv;
+}
+
+static apr_status_t socache_tiered_remove(ap_socache_instance_t *ctx,
+                                          server_rec *s,
+                                          const unsigned char *id,
+                                          unsigned int idlen, apr_pool_t *p)
+{
+    apr_status_t rv;
+
+    tiered_lock(&ctx->front);
+    ctx->front.provider->remove(ctx->front.instance, s, id, idlen, p);
+    tiered_unlock(&ctx->front);
+
+    tiered_lock(&ctx->back);
+    rv = ctx->back.provider->remove(ctx->back.instance, s, id, idlen, p);
+    tiered_unlock(&ctx->back);
+
+    return rv;
+}
+
+static void socache_tiered_status(ap_socache_instance_t *ctx, request_rec *r,
+                                  int flags)
+{
+    if (!(flags & AP_STATUS_SHORT)) {
+        ap_rprintf(r, "<b>Front tier</b> (%s, TTL %" APR_TIME_T_FMT
+                   " seconds):<br />\n", ctx->front.name,
+                   apr_time_sec(ctx->front_ttl));
+    }
+    else {
+        ap_rprintf(r, "FrontTier: %s\n", ctx->front.name);
+    }
+    tiered_lock(&ctx->front);
+    ctx->front.provider->status(ctx->front.instance, r, flags);
+    tiered_unlock(&ctx->front);
+
+    if (!(flags & AP_STATUS_SHORT)) {
+        ap_rprintf(r, "<b>Back tier</b> (%s):<br />\n", ctx->back.name);
+    }
+    else {
+        ap_rprintf(r, "BackTier: %s\n", ctx->back.name);
+    }
+    tiered_lock(&ctx->back);
+    ctx->back.provider->status(ctx->back.instance, r, flags);
+    tiered_unlock(&ctx->back);
+}
+
+static apr_status_t socache_tiered_iterate(ap_socache_instance_t *ctx,
+                                           server_rec *s, void *userctx,
+                                           ap_socache_iterator_t *iterator,
+                                           apr_pool_t *pool)
+{
+    apr_status_t rv;
+
+    /* the back tier has all the objects */
+    tiered_lock(&ctx->back);
+    rv = ctx->back.provider->iterate(ctx->back.instance, s, userctx,
+                                     iterator, pool);
+    tiered_unlock(&ctx->back);
+
+    return rv;
+}
+
+static const ap_socache_provider_t socache_tiered = {
+    "tiered",
+    0,
+    socache_tiered_create,
+    socache_tiered_init,
+    socache_tiered_destroy,
+    socache_tiered_store,
+    socache_tiered_retrieve,
+    socache_tiered_remove,
+    socache_tiered_status,
+    socache_tiered_iterate
+};
+
+static int socache_tiered_pre_config(apr_pool_t *pconf, apr_pool_t *plog,
+                                     apr_pool_t *ptmp)
+{
+    apr_status_t rv = ap_mutex_register(pconf, tiered_mutex_type, NULL,
+                                        APR_LOCK_DEFAULT, 0);
+    if (rv != APR_SUCCESS) {
+        ap_log_perror(APLOG_MARK, APLOG_CRIT, rv, plog, APLOGNO(10515)
+                      "failed to register %s mutex", tiered_mutex_type);
+        return 500; /* An HTTP status would be a misnomer! */
+    }
+
+    tiered_instances = apr_array_make(pconf, 2,
+                                      sizeof(ap_socache_instance_t *));
+
+    return OK;
+}
+
+static void socache_tiered_child_init(apr_pool_t *p, server_rec *s)
+{
+    int i;
+
+    for (i = 0; i < tiered_instances->nelts; ++i) {
+        ap_socache_instance_t *ctx = APR_ARRAY_IDX(tiered_instances, i,
+                                                   ap_socache_instance_t *);
+        tiered_tier_t *tiers[2];
+        int j;
+
+        tiers[0] = &ctx->front;
+        tiers[1] = &ctx->back;
+        for (j = 0; j < 2; ++j) {
+            apr_status_t rv;
+            const char *lock;
+
+            if (!tiers[j]->mutex) {
+                continue;
+            }
+            lock = apr_global_mutex_lockfile(tiers[j]->mutex);
+            rv = apr_global_mutex_child_init(&tiers[j]->mutex, lock, p);
+            if (rv != APR_SUCCESS) {
+                ap_log_error(APLOG_MARK, APLOG_CRIT, rv, s, APLOGNO(10516)
+                             "failed to initialise the %s mutex of the %s "
+                             "tier in child_init", tiered_mutex_type,
+                             tiers[j]->name);
+            }
+        }
+    }
+}
+
+static void *create_server_config(apr_pool_t *p, server_rec *s)
+{
+    socache_tiered_svr_cfg *sconf = apr_pcalloc(p, sizeof(*sconf));
+
+    sconf->front_ttl = TIERED_DEFAULT_FRONT_TTL;
+
+    return sconf;
+}
+
+static const char *socache_tiered_set_front_ttl(cmd_parms *cmd, void *dummy,
+                                                const char *arg)
+{
+    apr_interval_time_t ttl;
+    socache_tiered_svr_cfg *sconf = ap_get_module_config(
+                                            cmd->server->module_config,
+                                            &socache_tiered_module);
+
+    if (ap_timeout_parameter_parse(arg, &ttl, "s") != APR_SUCCESS) {
+        return apr_pstrcat(cmd->pool, cmd->cmd->name,
+                           " has wrong format", NULL);
+    }
+
+    if ((ttl < apr_time_from_sec(0)) || (ttl > apr_time_from_sec(3600))) {
+        return apr_pstrcat(cmd->pool, cmd->cmd->name,
+                           " can only be 0 or up to one hour.", NULL);
+    }
+
+    sconf->front_ttl = ttl;
+
+    return NULL;
+}
+
+static void register_hooks(apr_pool_t *p)
+{
+    ap_register_provider(p, AP_SOCACHE_PROVIDER_GROUP, "tiered",
+                         AP_SOCACHE_PROVIDER_VERSION,
+                         &socache_tiered);
+    ap_hook_pre_config(socache_tiered_pre_config, NULL, NULL,
+                       APR_HOOK_MIDDLE);
+    ap_hook_child_init(socache_tiered_child_init, NULL, NULL,
+                       APR_HOOK_MIDDLE);
+}
+
+static const command_rec socache_tiered_cmds[] = {
+    AP_INIT_TAKE1("SOCacheTieredFrontTTL", socache_tiered_set_front_ttl,
+                  NULL, RSRC_CONF,
+                  "Maximum time objects are kept in the front tier of "
+                  "tiered socaches (0 disables the front tier)"),
+    { NULL }
+};
+
+AP_DECLARE_MODULE(socache_tiered) = {
+    STANDARD20_MODULE_STUFF,
+    NULL,                     /* create per-dir    config structures */
+    NULL,                     /* merge  per-dir    config structures */
+    create_server_config,     /* create per-server config structures */
+    NULL,                     /* merge  per-server config structures */
+    socache_tiered_cmds,      /* table of config file commands       */
+    register_hooks            /* register hooks                      */
+};
@@ -179,18 +179,6 @@ static apr_status_t hm_update(void* mem, void *data, apr_pool_t *p)
     }
     return APR_SUCCESS;
 }
-/* Read the id corresponding to the entry in the slotmem */
-static apr_status_t hm_readid(void* mem, void *data, apr_pool_t *p)
-{
-    hm_slot_server_t *old = (hm_slot_server_t *) mem;
-    hm_slot_server_ctx_t *s = (hm_slot_server_ctx_t *) data;
-    hm_server_t *new = s->s;
-    if (strcmp(old->ip, new->ip)==0) {
-        s->found = 1;
-        s->item_id = old->id;
-    }
-    return APR_SUCCESS;
-}
 /* update the entry or create it if not existing */
 static  apr_status_t  hm_slotmem_update_stat(hm_server_t *s, apr_pool_t *pool)
 {
@@ -214,17 +202,6 @@ static  apr_status_t  hm_slotmem_update_stat(hm_server_t *s, apr_pool_t *pool)
     }
     return APR_SUCCESS;
 }
-static  apr_status_t  hm_slotmem_remove_stat(hm_server_t *s, apr_pool_t *pool)
-{
-    hm_slot_server_ctx_t ctx;
-    ctx.s = s;
-    ctx.found = 0;
-    storage->doall(slotmem, hm_readid, &ctx, pool);
-    if (ctx.found) {
-        storage->release(slotmem, ctx.item_id);
-    }
-    return APR_SUCCESS;
-}
 static apr_status_t hm_file_update_stat(hm_ctx_t *ctx, hm_server_t *s, apr_pool_t *pool)
 {
     apr_status_t rv;
@@ -474,28 +451,76 @@ static apr_status_t hm_file_update_stats(hm_ctx_t *ctx, apr_pool_t *p)
 
     return APR_SUCCESS;
 }
-/* Store in a slotmem */
+typedef struct hm_slot_batch_ctx_t {
+  hm_ctx_t *ctx;
+  apr_time_t now;
+  apr_hash_t *found;            /* the servers already in a slot */
+  apr_array_header_t *stale;    /* the slots to release */
+} hm_slot_batch_ctx_t;
+
+/* Update (or mark for release) the slot of a known server */
+static apr_status_t hm_update_batch(void* mem, void *data, apr_pool_t *p)
+{
+    hm_slot_server_t *old = (hm_slot_server_t *) mem;
+    hm_slot_batch_ctx_t *b = (hm_slot_batch_ctx_t *) data;
+    hm_server_t *s = apr_hash_get(b->ctx->servers, old->ip,
+                                  APR_HASH_KEY_STRING);
+
+    if (s) {
+        apr_hash_set(b->found, s->ip, APR_HASH_KEY_STRING, s);
+        if (apr_time_sec(b->now - s->seen) > SEEN_TIMEOUT) {
+            APR_ARRAY_PUSH(b->stale, unsigned int) = old->id;
+        }
+        else {
+            old->busy = s->busy;
+            old->ready = s->ready;
+            old->seen = s->seen;
+        }
+    }
+    return APR_SUCCESS;
+}
+
+/* Store in a slotmem: a single pass over the slots updates all the
+ * servers already there, then the new ones are added */
 static apr_status_t hm_slotmem_update_stats(hm_ctx_t *ctx, apr_pool_t *p)
 {
-    apr_status_t rv;
-    apr_time_t now;
+    hm_slot_batch_ctx_t b;
     apr_hash_index_t *hi;
-    now = apr_time_now();
+    int i;
+
+    b.ctx = ctx;
+    b.now = apr_time_now();
+    b.found = apr_hash_make(p);
+    b.stale = apr_array_make(p, 4, sizeof(unsigned int));
+    storage->doall(slotmem, hm_update_batch, &b, p);
+
+    for (i = 0; i < b.stale->nelts; i++) {
+        storage->release(slotmem, APR_ARRAY_IDX(b.stale, i, unsigned int));
+    }
+
     for (hi = apr_hash_first(p, ctx->servers);
          hi != NULL; hi = apr_hash_next(hi)) {
         hm_server_t *s = NULL;
-        apr_time_t seen;
+        hm_slot_server_t hmserver;
+        unsigned int id;
+
         apr_hash_this(hi, NULL, NULL, (void **) &s);
-        seen = apr_time_sec(now - s->seen);
-        if (seen > SEEN_TIMEOUT) {
-            /* remove it */
-            rv = hm_slotmem_remove_stat(s, p);
-        } else {
-            /* update it */
-            rv = hm_slotmem_update_stat(s, p);
+        if (apr_hash_get(b.found, s->ip, APR_HASH_KEY_STRING)
+            || apr_time_sec(b.now - s->seen) > SEEN_TIMEOUT) {
+            continue;
         }
-        if (rv !=APR_SUCCESS)
-            return rv;
+        if (storage->grab(slotmem, &id) != APR_SUCCESS) {
+            /* full, as logged by the storage */
+            break;
+        }
+        memset(&hmserver, 0, sizeof(hmserver));
+        apr_cpystrn(hmserver.ip, s->ip, sizeof(hmserver.ip));
+        hmserver.busy = s->busy;
+        hmserver.ready = s->ready;
+        hmserver.seen = s->seen;
+        hmserver.id = id;
+        storage->put(slotmem, id, (unsigned char *)&hmserver,
+                     sizeof(hmserver));
     }
     return APR_SUCCESS;
 }
@@ -527,38 +552,61 @@ static hm_server_t *hm_get_server(hm_ctx_t *ctx, const char *ip, const int port)
     return s;
 }
 
+/* Parse a heartbeat in place (what mod_heartbeat sends has nothing
+ * to unescape), without the table of qs_to_table(); returns non-zero
+ * if the mandatory fields are there. */
+static int hm_parsemsg(char *buf, int *busy, int *ready, int *port)
+{
+    char *key, *strtok_state;
+    int seen = 0;
+
+    for (key = apr_strtok(buf, "&", &strtok_state); key;
+         key = apr_strtok(NULL, "&", &strtok_state)) {
+        char *value = strchr(key, '=');
+
+        if (value) {
+            *value++ = '\0';
+        }
+        if (strcmp(key, "v") == 0) {
+            seen |= 1;
+        }
+        else if (value && strcmp(key, "busy") == 0) {
+            *busy = atoi(value);
+            seen |= 2;
+        }
+        else if (value && strcmp(key, "ready") == 0) {
+            *ready = atoi(value);
+            seen |= 4;
+        }
+        else if (value && strcmp(key, "port") == 0) {
+            *port = atoi(value);
+        }
+    }
+
+    return seen == 7;
+}
+
 /* Process a message received from a backend node */
 static void hm_processmsg(hm_ctx_t *ctx, apr_pool_t *p,
                           apr_sockaddr_t *from, char *buf, apr_size_t len)
 {
-    apr_table_t *tbl;
+    int busy = 0, ready = 0, port = 80;
 
     buf[len] = '\0';
 
-    tbl = apr_table_make(p, 10);
-
-    qs_to_table(buf, tbl, p);
-
-    if (apr_table_get(tbl, "v") != NULL &&
-        apr_table_get(tbl, "busy") != NULL &&
-        apr_table_get(tbl, "ready") != NULL) {
+    if (hm_parsemsg(buf, &busy, &ready, &port)) {
         char *ip;
-        int port = 80;
         hm_server_t *s;
-        /* TODO: REMOVE ME BEFORE PRODUCTION (????) */
-        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ctx->s, APLOGNO(02086)
-                     "%pI busy=%s ready=%s", from,
-                     apr_table_get(tbl, "busy"), apr_table_get(tbl, "ready"));
 
-        apr_sockaddr_ip_get(&ip, from);
+        ap_log_error(APLOG_MARK, APLOG_TRACE1, 0, ctx->s, APLOGNO(02086)
+                     "%pI busy=%d ready=%d", from, busy, ready);
 
-        if (apr_table_get(tbl, "port") != NULL)
-            port = atoi(apr_table_get(tbl, "port"));
+        apr_sockaddr_ip_get(&ip, from);
 
         s = hm_get_server(ctx, ip, port);
 
-        s->busy = atoi(apr_table_get(tbl, "busy"));
-        s->ready = atoi(apr_table_get(tbl, "ready"));
+        s->busy = busy;
+        s->ready = ready;
         s->seen = apr_time_now();
     }
     else {
@@ -568,29 +616,41 @@ static void hm_processmsg(hm_ctx_t *ctx, apr_pool_t *p,
     }
 
 }
-/* Read message from multicast socket */
+/* Read the messages queued on the multicast socket */
 #define MAX_MSG_LEN (1000)
+#ifndef HM_MAX_RECV
+/* How many messages are read per wakeup at most */
+#define HM_MAX_RECV (256)
+#endif
 static apr_status_t hm_recv(hm_ctx_t *ctx, apr_pool_t *p)
 {
     char buf[MAX_MSG_LEN + 1];
     apr_sockaddr_t from;
-    apr_size_t len = MAX_MSG_LEN;
-    apr_status_t rv;
+    apr_status_t rv = APR_SUCCESS;
+    int n;
 
     from.pool = p;
 
-    rv = apr_socket_recvfrom(&from, ctx->sock, 0, buf, &len);
+    /* drain the socket rather than poll() again for each message */
+    for (n = 0; n < HM_MAX_RECV; n++) {
+        apr_size_t len = MAX_MSG_LEN;
 
-    if (APR_STATUS_IS_EAGAIN(rv)) {
-        ap_log_error(APLOG_MARK, APLOG_CRIT, rv, ctx->s, APLOGNO(02088) "would block");
-        return APR_SUCCESS;
-    }
-    else if (rv) {
-        ap_log_error(APLOG_MARK, APLOG_CRIT, rv, ctx->s, APLOGNO(02089) "recvfrom failed");
-        return rv;
-    }
+        rv = apr_socket_recvfrom(&from, ctx->sock, 0, buf, &len);
 
-    hm_processmsg(ctx, p, &from, buf, len);
+        if (APR_STATUS_IS_EAGAIN(rv)) {
+            if (!n) {
+                ap_log_error(APLOG_MARK, APLOG_DEBUG, rv, ctx->s,
+                             APLOGNO(02088) "would block");
+            }
+            return APR_SUCCESS;
+        }
+        else if (rv) {
+            ap_log_error(APLOG_MARK, APLOG_CRIT, rv, ctx->s, APLOGNO(02089) "recvfrom failed");
+            return rv;
+        }
+
+        hm_processmsg(ctx, p, &from, buf, len);
+    }
 
     return rv;
 }
@@ -26,11 +26,16 @@
 #include "util_mutex.h"
 
 #include "apr_atomic.h"
+#include "apr_thread_cond.h"
+#include "apr_thread_pool.h"
 
 #define AP_WATCHDOG_PGROUP    "watchdog"
 #define AP_WATCHDOG_PVERSION  "parent"
 #define AP_WATCHDOG_CVERSION  "child"
 
+/* Default maximum number of threads running watchdog tasks */
+#define AP_WD_TASK_THREADS    4
+
 typedef struct watchdog_list_t watchdog_list_t;
 
 struct watchdog_list_t
@@ -39,7 +44,7 @@ struct watchdog_list_t
     ap_watchdog_t *wd;
     apr_status_t status;
     apr_interval_time_t interval;
-    apr_interval_time_t step;
+    apr_time_t deadline;
     const void *data;
     ap_watchdog_callback_fn_t *callback_fn;
 };
@@ -53,9 +58,12 @@ struct ap_watchdog_t
     apr_uint32_t          is_running;
     int                   singleton;
     int                   active;
-    apr_interval_time_t   step;
+    apr_time_t            deadline;
     apr_thread_t         *thread;
     apr_pool_t           *pool;
+    apr_thread_mutex_t   *wait_mutex;
+    apr_thread_cond_t    *wait_cond;
+    int                   wakeup;
 };
 
 typedef struct wd_server_conf_t wd_server_conf_t;
@@ -65,12 +73,80 @@ struct wd_server_conf_t
     int parent_workers;
     apr_pool_t *pool;
     server_rec *s;
+    apr_thread_mutex_t *tasks_mutex;
+    apr_thread_pool_t *tasks;
+    apr_pool_t *tasks_pool;
 };
 
 static wd_server_conf_t *wd_server_conf = NULL;
 static apr_interval_time_t wd_interval = AP_WD_TM_INTERVAL;
 static int mpm_is_forked = AP_MPMQ_NOT_SUPPORTED;
 static const char *wd_proc_mutex_type = "watchdog-callback";
+static int wd_task_threads = AP_WD_TASK_THREADS;
+
+/* Wake up the watchdog thread, to stop or to look at its
+ * deadlines again
+ */
+static void wd_wakeup(ap_watchdog_t *w)
+{
+    if (w->wait_mutex) {
+        apr_thread_mutex_lock(w->wait_mutex);
+        w->wakeup = 1;
+        apr_thread_cond_signal(w->wait_cond);
+        apr_thread_mutex_unlock(w->wait_mutex);
+    }
+}
+
+/* Sleep until the earliest deadline or a wakeup */
+static void wd_wait(ap_watchdog_t *w)
+{
+    watchdog_list_t *wl;
+    apr_time_t deadline = 0;
+
+    if (w->callbacks) {
+        for (wl = w->callbacks; wl; wl = wl->next) {
+            if (wl->status == APR_SUCCESS
+                && (!deadline || wl->deadline < deadline)) {
+                deadline = wl->deadline;
+            }
+        }
+    }
+    else {
+        deadline = w->deadline;
+    }
+
+    apr_thread_mutex_lock(w->wait_mutex);
+    while (!w->wakeup && apr_atomic_read32(&w->is_running)) {
+        if (!deadline) {
+            /* All the callbacks stopped, until one is
+             * given a new interval
+             */
+            apr_thread_cond_wait(w->wait_cond, w->wait_mutex);
+        }
+        else {
+            apr_time_t now = apr_time_now();
+            if (deadline <= now
+                || apr_thread_cond_timedwait(w->wait_cond, w->wait_mutex,
+                                             deadline - now) == APR_TIMEUP) {
+                break;
+            }
+        }
+    }
+    w->wakeup = 0;
+    apr_thread_mutex_unlock(w->wait_mutex);
+}
+
+/* Advance a deadline by interval, without drifting by the time
+ * the callbacks take unless it fell behind
+ */
+static void wd_schedule(apr_time_t *deadline, apr_interval_time_t interval,
+                        apr_time_t now)
+{
+    *deadline += interval;
+    if (*deadline <= now) {
+        *deadline = now + interval;
+    }
+}
 
 static apr_status_t wd_worker_cleanup(void *data)
 {
@@ -83,6 +159,7 @@ static apr_status_t wd_worker_cleanup(void *data)
 
     AP_DEBUG_ASSERT(w->thread);
     apr_atomic_set32(&w->is_running, 0);
+    wd_wakeup(w);
     apr_thread_join(&rv, w->thread);
     w->thread = NULL;
     return rv;
@@ -138,6 +215,7 @@ static void* APR_THREAD_FUNC wd_worker(apr_thread_t *thread, void *data)
 
     if (apr_atomic_read32(&w->is_running)) {
         watchdog_list_t *wl = w->callbacks;
+        apr_time_t now;
         ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, wd_server_conf->s,
                      APLOGNO(02972) "%sWatchdog (%s) running",
                      w->singleton ? "Singleton " : "", w->name);
@@ -155,43 +233,46 @@ static void* APR_THREAD_FUNC wd_worker(apr_thread_t *thread, void *data)
             ap_run_watchdog_init(wd_server_conf->s, w->name, w->pool);
             inited = 1;
         }
+        now = apr_time_now();
+        for (wl = w->callbacks; wl; wl = wl->next) {
+            wl->deadline = now + wl->interval;
+        }
+        w->deadline = now + wd_interval;
     }
 
     /* Main execution loop */
     while (apr_atomic_read32(&w->is_running)) {
-        apr_time_t curr;
-        watchdog_list_t *wl = w->callbacks;
+        watchdog_list_t *wl;
+        apr_time_t now = apr_time_now();
+        /* Run at once whatever is due within the slack, rather
+         * than waking up again for each deadline
+         */
+        apr_time_t due = now + AP_WD_TM_SLICE;
 
-        apr_sleep(AP_WD_TM_SLICE);
-        if (!apr_atomic_read32(&w->is_running)) {
-            break;
-        }
-        curr = apr_time_now() - AP_WD_TM_SLICE;
-        while (wl && apr_atomic_read32(&w->is_running)) {
-            if (wl->status == APR_SUCCESS) {
-                wl->step += (apr_time_now() - curr);
-                if (wl->step >= wl->interval) {
-                    wl->step = 0;
-                    /* Execute watchdog callback */
-                    wl->status = (*wl->callback_fn)(AP_WATCHDOG_STATE_RUNNING,
-                                                    (void *)wl->data, temp_pool);
-                }
+        for (wl = w->callbacks; wl && apr_atomic_read32(&w->is_running);
+             wl = wl->next) {
+            if (wl->status == APR_SUCCESS && wl->deadline <= due) {
+                /* Scheduled before the call, which may set
+                 * a new interval itself
+                 */
+                wd_schedule(&wl->deadline, wl->interval, now);
+                /* Execute watchdog callback */
+                wl->status = (*wl->callback_fn)(AP_WATCHDOG_STATE_RUNNING,
+                                                (void *)wl->data, temp_pool);
             }
-            wl = wl->next;
         }
-        if (apr_atomic_read32(&w->is_running) && w->callbacks == NULL) {
+        if (apr_atomic_read32(&w->is_running) && w->callbacks == NULL
+            && w->deadline <= due) {
             /* This is hook mode watchdog
              * running on WatchogInterval
              */
-            w->step += (apr_time_now() - curr);
-            if (w->step >= wd_interval) {
-                w->step = 0;
-                /* Run watchdog step hook */
-                ap_run_watchdog_step(wd_server_conf->s, w->name, temp_pool);
-            }
+            wd_schedule(&w->deadline, wd_interval, now);
+            /* Run watchdog step hook */
+            ap_run_watchdog_step(wd_server_conf->s, w->name, temp_pool);
         }
 
         apr_pool_clear(temp_pool);
+        wd_wait(w);
     }
 
     apr_pool_destroy(temp_pool);
@@ -233,6 +314,14 @@ static apr_status_t wd_startup(ap_watchdog_t *w, apr_pool_t *p)
     apr_status_t rc;
 
     apr_atomic_set32(&w->thread_started, 0);
+    w->wakeup = 0;
+
+    rc = apr_thread_mutex_create(&w->wait_mutex, APR_THREAD_MUTEX_DEFAULT, p);
+    if (rc != APR_SUCCESS)
+        return rc;
+    rc = apr_thread_cond_create(&w->wait_cond, p);
+    if (rc != APR_SUCCESS)
+        return rc;
 
     if (w->singleton) {
         /* Initialize singleton mutex in child */
@@ -296,9 +385,10 @@ static apr_status_t ap_watchdog_set_callback_interval(ap_watchdog_t *w,
              * callback and continue execution if stopped earlier.
              */
             c->interval = interval;
-            c->step     = 0;
+            c->deadline = apr_time_now() + interval;
             c->status   = APR_SUCCESS;
             rv          = APR_SUCCESS;
+            wd_wakeup(w);
             break;
         }
         c = c->next;
@@ -327,7 +417,7 @@ static apr_status_t ap_watchdog_register_callback(ap_watchdog_t *w,
     c->data        = data;
     c->callback_fn = callback;
     c->interval    = interval;
-    c->step        = 0;
+    c->deadline    = 0;
     c->status      = APR_EINIT;
 
     c->wd          = w;
@@ -338,6 +428,37 @@ static apr_status_t ap_watchdog_register_callback(ap_watchdog_t *w,
     return APR_SUCCESS;
 }
 
+static apr_status_t ap_watchdog_run_task(ap_watchdog_t *w,
+                                         apr_thread_start_t func,
+                                         void *data)
+{
+    apr_status_t rv = APR_SUCCESS;
+
+    if (!apr_atomic_read32(&w->is_running)) {
+        return APR_EOF;
+    }
+    apr_thread_mutex_lock(wd_server_conf->tasks_mutex);
+    if (!wd_server_conf->tasks) {
+        /* Created on first use, its threads exit when idle */
+        apr_pool_create(&wd_server_conf->tasks_pool, wd_server_conf->pool);
+        apr_pool_tag(wd_server_conf->tasks_pool, "wd_tasks");
+        rv = apr_thread_pool_create(&wd_server_conf->tasks, 0,
+                                    wd_task_threads,
+                                    wd_server_conf->tasks_pool);
+        if (rv != APR_SUCCESS) {
+            apr_pool_destroy(wd_server_conf->tasks_pool);
+            wd_server_conf->tasks_pool = NULL;
+            wd_server_conf->tasks = NULL;
+        }
+    }
+    if (rv == APR_SUCCESS) {
+        rv = apr_thread_pool_push(wd_server_conf->tasks, func, data,
+                                  APR_THREAD_TASK_PRIORITY_NORMAL, w);
+    }
+    apr_thread_mutex_unlock(wd_server_conf->tasks_mutex);
+    return rv;
+}
+
 /*--------------------------------------------------------------------------*/
 /*                                                                          */
 /* Pre config hook.                                                         */
@@ -353,6 +474,7 @@ static int wd_pre_config_hook(apr_pool_t *pconf, apr_pool_t *plog,
     ap_watchdog_t *w;
 
     ap_mpm_query(AP_MPMQ_IS_FORKED, &mpm_is_forked);
+    wd_task_threads = AP_WD_TASK_THREADS;
     if ((rv = ap_watchdog_get_instance(&w,
                 AP_WATCHDOG_SINGLETON, 0, 1, pconf)) != APR_SUCCESS) {
         return rv;
@@ -403,6 +525,11 @@ static int wd_post_config_hook(apr_pool_t *pconf, apr_pool_t *plog,
             return APR_ENOMEM;
         apr_pool_create(&wd_server_conf->pool, ppconf);
         apr_pool_tag(wd_server_conf->pool, "wd_server_conf");
+        rv = apr_thread_mutex_create(&wd_server_conf->tasks_mutex,
+                                     APR_THREAD_MUTEX_DEFAULT,
+                                     wd_server_conf->pool);
+        if (rv != APR_SUCCESS)
+            return rv;
         apr_pool_userdata_set(wd_server_conf, pk, apr_pool_cleanup_null, ppconf);
     }
     ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(010033)
@@ -575,6 +702,7 @@ static void wd_child_stopping(apr_pool_t *pool, int graceful)
                                                   wn[i].provider_name,
                                                   AP_WATCHDOG_CVERSION);
             apr_atomic_set32(&w->is_running, 0);
+            wd_wakeup(w);
         }
     }
 }
@@ -610,6 +738,13 @@ static void wd_child_stopped(apr_pool_t *pool, int graceful)
             wd_worker_cleanup(w);
         }
     }
+    if (wd_server_conf->tasks) {
+        /* Waits for the tasks still running */
+        apr_thread_pool_destroy(wd_server_conf->tasks);
+        apr_pool_destroy(wd_server_conf->tasks_pool);
+        wd_server_conf->tasks = NULL;
+        wd_server_conf->tasks_pool = NULL;
+    }
     ap_log_error(APLOG_MARK, APLOG_TRACE1, 0, wd_server_conf->s,
                  "child stopped, watchdogs stopped");
 }
@@ -639,6 +774,26 @@ static const char *wd_cmd_watchdog_int(cmd_parms *cmd, void *dummy,
     return NULL;
 }
 
+/*--------------------------------------------------------------------------*/
+/*                                                                          */
+/* WatchdogTaskThreads directive                                            */
+/*                                                                          */
+/*--------------------------------------------------------------------------*/
+static const char *wd_cmd_task_threads(cmd_parms *cmd, void *dummy,
+                                       const char *arg)
+{
+    const char *errs = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+
+    if (errs != NULL)
+        return errs;
+    wd_task_threads = atoi(arg);
+    if (wd_task_threads < 1) {
+        return "WatchdogTaskThreads must be a positive number";
+    }
+
+    return NULL;
+}
+
 /*--------------------------------------------------------------------------*/
 /*                                                                          */
 /* List of directives specific to our module.                               */
@@ -653,6 +808,13 @@ static const command_rec wd_directives[] =
         RSRC_CONF,                          /* where available              */
         "Watchdog interval in seconds"
     ),
+    AP_INIT_TAKE1(
+        "WatchdogTaskThreads",              /* directive name               */
+        wd_cmd_task_threads,                /* config action routine        */
+        NULL,                               /* argument to include in call  */
+        RSRC_CONF,                          /* where available              */
+        "Maximum number of threads running watchdog tasks"
+    ),
     {NULL}
 };
 
@@ -708,6 +870,7 @@ static void wd_register_hooks(apr_pool_t *p)
     APR_REGISTER_OPTIONAL_FN(ap_watchdog_get_instance);
     APR_REGISTER_OPTIONAL_FN(ap_watchdog_register_callback);
     APR_REGISTER_OPTIONAL_FN(ap_watchdog_set_callback_interval);
+    APR_REGISTER_OPTIONAL_FN(ap_watchdog_run_task);
 }
 
 /*--------------------------------------------------------------------------*/
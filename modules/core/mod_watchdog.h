@@ -67,7 +67,8 @@ extern "C" {
 #define AP_WD_TM_INTERVAL           APR_TIME_C(1000000)  /* 1 second     */
 
 /**
- * Watchdog thread timer resolution
+ * Watchdog timer slack, the callbacks due within this time
+ * of each other are run together
  */
 #define AP_WD_TM_SLICE              APR_TIME_C(100000)   /* 100 ms       */
 
@@ -152,6 +153,22 @@ APR_DECLARE_OPTIONAL_FN(apr_status_t, ap_watchdog_set_callback_interval,
                         (ap_watchdog_t *w, apr_interval_time_t interval,
                          const void *data, ap_watchdog_callback_fn_t *callback));
 
+/**
+ * Run a task on the watchdog thread pool.
+ * @param w Watchdog the task belongs to
+ * @param func The function to run
+ * @param data The data to pass to the function
+ * @return APR_SUCCESS if the task was queued, APR_EOF if the watchdog is
+ *         stopping, or the error creating the thread pool.
+ * @remark The watchdog instances of a process share a pool of at most
+ *         WatchdogTaskThreads threads. A callback can hand a long job to
+ *         it instead of delaying the other callbacks of its watchdog.
+ *         The tasks still running when the child stops are waited for.
+ */
+APR_DECLARE_OPTIONAL_FN(apr_status_t, ap_watchdog_run_task,
+                        (ap_watchdog_t *w, apr_thread_start_t func,
+                         void *data));
+
 /**
  * Watchdog require hook.
  * @param s The server record
@@ -63,6 +63,7 @@ struct dav_db {
     apr_hash_t *uri_index;      /* map URIs to (1-based) table indices */
 
     dav_buffer wb_key;          /* work buffer for dav_gdbm_key */
+    apr_pool_t *scratch;        /* for the values stored, cleared each time */
 
     apr_datum_t iter;           /* iteration key */
 };
@@ -187,6 +188,12 @@ static dav_error * dav_dbm_open(apr_pool_t * p, const dav_resource *resource,
     const char *fname;
     const char *pathname;
 
+    /* Nothing to open read-only if the walk found no database */
+    if (ro && !dav_fs_may_have_propdb(resource)) {
+        *pdb = NULL;
+        return NULL;
+    }
+
     /* Get directory and filename for resource */
     /* ### should test this result value... */
     (void) dav_fs_dir_file_name(resource, &dirpath, &fname);
@@ -645,7 +652,16 @@ static dav_error * dav_propdb_store(dav_db *db, const dav_prop_name *name,
 
     /* Note: mapping->ns_map was set up in dav_propdb_map_namespaces() */
 
-    /* ### use a db- subpool for these values? clear on exit? */
+    /* The text blob is copied by the store, so it can go with the next
+     * one rather than accumulate with the size of the request.
+     */
+    if (db->scratch == NULL) {
+        apr_pool_create(&db->scratch, db->pool);
+        apr_pool_tag(db->scratch, "dav_propdb_store");
+    }
+    else {
+        apr_pool_clear(db->scratch);
+    }
 
     /* quote all the values in the element */
     /* ### be nice to do this without affecting the element itself */
@@ -653,7 +669,7 @@ static dav_error * dav_propdb_store(dav_db *db, const dav_prop_name *name,
     apr_xml_quote_elem(db->pool, (apr_xml_elem *)elem);
 
     /* generate a text blob for the xml:lang plus the contents */
-    apr_xml_to_text(db->pool, elem, APR_XML_X2T_LANG_INNER, NULL,
+    apr_xml_to_text(db->scratch, elem, APR_XML_X2T_LANG_INNER, NULL,
                     mapping->ns_map,
                     (const char **)&value.dptr, &value.dsize);
 
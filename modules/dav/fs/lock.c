@@ -182,8 +182,10 @@ struct dav_lockdb_private
     request_rec *r;                  /* for accessing the uuid state */
     apr_pool_t *pool;                /* a pool to use */
     const char *lockdb_path;         /* where is the lock database? */
+    int shards;                      /* in how many files is it split? */
 
     int opened;                      /* we opened the database */
+    int shard;                       /* which file of it is opened */
     dav_db *db;                      /* if non-NULL, the lock database */
 };
 typedef struct
@@ -295,17 +297,42 @@ static int dav_fs_compare_locktoken(
 /*
 ** dav_fs_really_open_lockdb:
 **
-** If the database hasn't been opened yet, then open the thing.
+** If the database (holding KEY, when sharded) hasn't been opened yet, then
+** open the thing.
+**
+** Only one shard is opened at a time, so that a request never waits on
+** another one's shard while holding its own.
 */
-static dav_error * dav_fs_really_open_lockdb(dav_lockdb *lockdb)
+static dav_error * dav_fs_really_open_lockdb(dav_lockdb *lockdb,
+                                             const apr_datum_t *key)
 {
+    dav_lockdb_private *info = lockdb->info;
+    const char *pathname = info->lockdb_path;
+    int shard = 0;
     dav_error *err;
 
-    if (lockdb->info->opened)
-        return NULL;
+    if (info->shards > 1 && key != NULL) {
+        apr_ssize_t klen = key->dsize;
+        shard = apr_hashfunc_default(key->dptr, &klen) % info->shards;
+    }
+
+    if (info->opened) {
+        if (shard == info->shard)
+            return NULL;
+
+        if (info->db != NULL) {
+            dav_dbm_close(info->db);
+            info->db = NULL;
+        }
+        info->opened = 0;
+    }
+
+    if (info->shards > 1) {
+        pathname = apr_psprintf(info->pool, "%s.%d", pathname, shard);
+    }
 
     err = dav_dbm_open_direct(lockdb->info->pool,
-                              lockdb->info->lockdb_path,
+                              pathname,
                               lockdb->ro,
                               &lockdb->info->db);
     if (err != NULL) {
@@ -318,6 +345,7 @@ static dav_error * dav_fs_really_open_lockdb(dav_lockdb *lockdb)
 
     /* all right. it is opened now. */
     lockdb->info->opened = 1;
+    lockdb->info->shard = shard;
 
     return NULL;
 }
@@ -350,13 +378,14 @@ static dav_error * dav_fs_open_lockdb(request_rec *r, int ro, int force,
                              "DAVLockDB directive. One must be specified "
                              "to use the locking functionality.");
     }
+    comb->priv.shards = dav_get_lockdb_shards(r);
 
     /* done initializing. return it. */
     *lockdb = &comb->pub;
 
     if (force) {
         /* ### add a higher-level comment? */
-        return dav_fs_really_open_lockdb(*lockdb);
+        return dav_fs_really_open_lockdb(*lockdb, NULL);
     }
 
     return NULL;
@@ -431,7 +460,7 @@ static dav_error * dav_fs_save_lock_record(dav_lockdb *lockdb, apr_datum_t key,
     }
 #endif
 
-    if ((err = dav_fs_really_open_lockdb(lockdb)) != NULL) {
+    if ((err = dav_fs_really_open_lockdb(lockdb, &key)) != NULL) {
         /* ### add a higher-level error? */
         return err;
     }
@@ -537,7 +566,7 @@ static dav_error * dav_fs_load_lock_record(dav_lockdb *lockdb, apr_datum_t key,
         *indirect = NULL;
     }
 
-    if ((err = dav_fs_really_open_lockdb(lockdb)) != NULL) {
+    if ((err = dav_fs_really_open_lockdb(lockdb, &key)) != NULL) {
         /* ### add a higher-level error? */
         return err;
     }
@@ -1138,7 +1167,9 @@ static dav_error * dav_fs_has_locks(dav_lockdb *lockdb,
 
     *locks_present = 0;
 
-    if ((err = dav_fs_really_open_lockdb(lockdb)) != NULL) {
+    key = dav_fs_build_key(lockdb->info->pool, resource);
+
+    if ((err = dav_fs_really_open_lockdb(lockdb, &key)) != NULL) {
         /* ### insert a higher-level error description */
         return err;
     }
@@ -1150,8 +1181,6 @@ static dav_error * dav_fs_has_locks(dav_lockdb *lockdb,
     if (lockdb->info->db == NULL)
         return NULL;
 
-    key = dav_fs_build_key(lockdb->info->pool, resource);
-
     *locks_present = dav_dbm_exists(lockdb->info->db, key);
 
     return NULL;
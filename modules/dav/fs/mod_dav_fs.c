@@ -27,6 +27,7 @@
 /* per-server configuration */
 typedef struct {
     const char *lockdb_path;
+    int lockdb_shards;
 
 } dav_fs_server_conf;
 
@@ -36,6 +37,8 @@ extern module AP_MODULE_DECLARE_DATA dav_fs_module;
 #define DEFAULT_DAV_LOCKDB "davlockdb"
 #endif
 
+#define DAV_LOCKDB_MAX_SHARDS 256
+
 const char *dav_get_lockdb_path(const request_rec *r)
 {
     dav_fs_server_conf *conf;
@@ -44,6 +47,14 @@ const char *dav_get_lockdb_path(const request_rec *r)
     return conf->lockdb_path;
 }
 
+int dav_get_lockdb_shards(const request_rec *r)
+{
+    dav_fs_server_conf *conf;
+
+    conf = ap_get_module_config(r->server->module_config, &dav_fs_module);
+    return conf->lockdb_shards ? conf->lockdb_shards : 1;
+}
+
 static void *dav_fs_create_server_config(apr_pool_t *p, server_rec *s)
 {
     return apr_pcalloc(p, sizeof(dav_fs_server_conf));
@@ -60,6 +71,8 @@ static void *dav_fs_merge_server_config(apr_pool_t *p,
 
     newconf->lockdb_path =
         child->lockdb_path ? child->lockdb_path : parent->lockdb_path;
+    newconf->lockdb_shards =
+        child->lockdb_shards ? child->lockdb_shards : parent->lockdb_shards;
 
     return newconf;
 }
@@ -101,11 +114,31 @@ static const char *dav_fs_cmd_davlockdb(cmd_parms *cmd, void *config,
     return NULL;
 }
 
+static const char *dav_fs_cmd_davlockdbshards(cmd_parms *cmd, void *config,
+                                              const char *arg1)
+{
+    dav_fs_server_conf *conf;
+    conf = ap_get_module_config(cmd->server->module_config,
+                                &dav_fs_module);
+    conf->lockdb_shards = atoi(arg1);
+
+    if (conf->lockdb_shards < 1
+        || conf->lockdb_shards > DAV_LOCKDB_MAX_SHARDS) {
+        return apr_psprintf(cmd->pool, "DAVLockDBShards must be between "
+                            "1 and %d", DAV_LOCKDB_MAX_SHARDS);
+    }
+
+    return NULL;
+}
+
 static const command_rec dav_fs_cmds[] =
 {
     /* per server */
     AP_INIT_TAKE1("DAVLockDB", dav_fs_cmd_davlockdb, NULL, RSRC_CONF,
                   "specify a lock database"),
+    AP_INIT_TAKE1("DAVLockDBShards", dav_fs_cmd_davlockdbshards, NULL,
+                  RSRC_CONF, "the number of files to split the lock "
+                  "database into"),
 
     { NULL }
 };
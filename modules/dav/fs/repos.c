@@ -24,7 +24,14 @@
 #include "apr_buckets.h"
 
 #if APR_HAVE_UNISTD_H
-#include <unistd.h>             /* for getpid() */
+#include <unistd.h>             /* for getpid() and copy_file_range() */
+#endif
+#if APR_HAVE_ERRNO_H
+#include <errno.h>
+#endif
+#ifdef HAVE_LINUX_FS_H
+#include <sys/ioctl.h>
+#include <linux/fs.h>           /* for FICLONE */
 #endif
 
 #include "httpd.h"
@@ -40,6 +47,7 @@
 #define DEBUG_GET_HANDLER       0
 
 #define DAV_FS_COPY_BLOCKSIZE   16384   /* copy 16k at a time */
+#define DAV_FS_COPY_RANGE       (1 << 30) /* in the kernel, 1G at a time */
 
 /* context needed to identify a resource */
 struct dav_resource_private {
@@ -47,6 +55,8 @@ struct dav_resource_private {
     const char *pathname;   /* full pathname to resource */
     apr_finfo_t finfo;       /* filesystem info */
     request_rec *r;
+    apr_hash_t *state_files; /* the property databases of the directory,
+                                when known by the walk */
 };
 
 /* private context for doing a filesystem walk */
@@ -229,6 +239,61 @@ apr_pool_t *dav_fs_pool(const dav_resource *resource)
     return resource->info->pool;
 }
 
+int dav_fs_may_have_propdb(const dav_resource *resource)
+{
+    const dav_resource_private *ctx = resource->info;
+    const char *fname;
+
+    /* only the walks know, and only for the existing members */
+    if (ctx->state_files == NULL || !resource->exists
+        || resource->collection) {
+        return 1;
+    }
+    fname = ap_strrchr_c(ctx->pathname, '/');
+    fname = fname ? fname + 1 : ctx->pathname;
+
+    return apr_hash_get(ctx->state_files, fname, APR_HASH_KEY_STRING) != NULL;
+}
+
+/* Read the names of the property databases in the state directory of
+ * DIRPATH (with a trailing slash), keyed by the name of their resource,
+ * or NULL if that can't be told.
+ */
+static apr_hash_t *dav_fs_read_state_files(apr_pool_t *p, const char *dirpath)
+{
+    apr_hash_t *names = apr_hash_make(p);
+    const char *suffix, *unused;
+    apr_size_t slen;
+    apr_finfo_t dirent;
+    apr_dir_t *dirp;
+    apr_status_t status;
+
+    status = apr_dir_open(&dirp, apr_pstrcat(p, dirpath, DAV_FS_STATE_DIR,
+                                             NULL), p);
+    if (status != APR_SUCCESS) {
+        /* no state directory, no properties */
+        return APR_STATUS_IS_ENOENT(status) ? names : NULL;
+    }
+
+    /* the name (first one for sdbm) of the database of an empty fname
+     * is what the DBM driver appends
+     */
+    dav_dbm_get_statefiles(p, "", &suffix, &unused);
+    slen = strlen(suffix);
+
+    while (apr_dir_read(&dirent, APR_FINFO_DIRENT, dirp) == APR_SUCCESS) {
+        apr_size_t len = strlen(dirent.name);
+
+        if (len > slen && !strcmp(dirent.name + len - slen, suffix)) {
+            apr_hash_set(names, apr_pstrmemdup(p, dirent.name, len - slen),
+                         APR_HASH_KEY_STRING, "");
+        }
+    }
+    apr_dir_close(dirp);
+
+    return names;
+}
+
 const char *dav_fs_pathname(const dav_resource *resource)
 {
     return resource->info->pathname;
@@ -323,6 +388,55 @@ static void dav_format_time(int style, apr_time_t sec, char *buf, apr_size_t buf
 /* Copy or move src to dst; src_finfo is used to propagate permissions
  * bits across if non-NULL; dst_finfo must be non-NULL iff dst already
  * exists. */
+/* Copy all of INF to OUTF in the kernel, sharing the extents where the
+ * filesystem supports it.  APR_ENOTIMPL is returned when it can't be done
+ * (before anything is written), for the caller to copy in userspace.
+ */
+static apr_status_t dav_fs_copy_kernel(apr_file_t *inf, apr_file_t *outf)
+{
+#if defined(FICLONE) || defined(HAVE_COPY_FILE_RANGE)
+    apr_os_file_t infd, outfd;
+
+    apr_os_file_get(&infd, inf);
+    apr_os_file_get(&outfd, outf);
+#endif
+
+#ifdef FICLONE
+    if (ioctl(outfd, FICLONE, infd) == 0) {
+        return APR_SUCCESS;
+    }
+#endif
+
+#ifdef HAVE_COPY_FILE_RANGE
+    {
+        int copied = 0;
+
+        for (;;) {
+            ssize_t n = copy_file_range(infd, NULL, outfd, NULL,
+                                        DAV_FS_COPY_RANGE, 0);
+            if (n > 0) {
+                copied = 1;
+            }
+            else if (n == 0) {
+                return APR_SUCCESS;
+            }
+            else if (errno != EINTR) {
+                /* fall back for unsupported cases, across devices
+                 * notably (before Linux 5.3)
+                 */
+                if (!copied && (errno == EXDEV || errno == ENOSYS
+                                || errno == EINVAL || errno == EOPNOTSUPP)) {
+                    return APR_ENOTIMPL;
+                }
+                return APR_FROM_OS_ERROR(errno);
+            }
+        }
+    }
+#else
+    return APR_ENOTIMPL;
+#endif
+}
+
 static dav_error * dav_fs_copymove_file(
     int is_move,
     apr_pool_t * p,
@@ -377,56 +491,81 @@ static dav_error * dav_fs_copymove_file(
                              "Could not open file for writing");
     }
 
-    while (1) {
-        apr_size_t len = DAV_FS_COPY_BLOCKSIZE;
-
-        status = apr_file_read(inf, pbuf->buf, &len);
-        if (status != APR_SUCCESS && status != APR_EOF) {
-            apr_status_t lcl_status;
-
-            apr_file_close(inf);
-            apr_file_close(outf);
+    status = dav_fs_copy_kernel(inf, outf);
+    if (status != APR_SUCCESS && !APR_STATUS_IS_ENOTIMPL(status)) {
+        apr_status_t lcl_status;
 
-            if ((lcl_status = apr_file_remove(dst, p)) != APR_SUCCESS) {
-                /* ### ACK! Inconsistent state... */
+        apr_file_close(inf);
+        apr_file_close(outf);
 
-                /* ### use something besides 500? */
-                return dav_new_error(p, HTTP_INTERNAL_SERVER_ERROR, 0,
-                                     lcl_status,
-                                     "Could not delete output after read "
-                                     "failure. Server is now in an "
-                                     "inconsistent state.");
-            }
+        if ((lcl_status = apr_file_remove(dst, p)) != APR_SUCCESS) {
+            /* ### ACK! Inconsistent state... */
 
             /* ### use something besides 500? */
-            return dav_new_error(p, HTTP_INTERNAL_SERVER_ERROR, 0, status,
-                                 "Could not read input file");
+            return dav_new_error(p, HTTP_INTERNAL_SERVER_ERROR, 0,
+                                 lcl_status,
+                                 "Could not delete output after copy "
+                                 "failure. Server is now in an "
+                                 "inconsistent state.");
         }
 
-        if (status == APR_EOF)
-            break;
+        return dav_new_error(p, MAP_IO2HTTP(status), 0, status,
+                             "Could not copy file");
+    }
 
-        /* write any bytes that were read */
-        status = apr_file_write_full(outf, pbuf->buf, len, NULL);
-        if (status != APR_SUCCESS) {
-            apr_status_t lcl_status;
+    /* otherwise copy it here */
+    if (APR_STATUS_IS_ENOTIMPL(status)) {
+        while (1) {
+            apr_size_t len = DAV_FS_COPY_BLOCKSIZE;
 
-            apr_file_close(inf);
-            apr_file_close(outf);
+            status = apr_file_read(inf, pbuf->buf, &len);
+            if (status != APR_SUCCESS && status != APR_EOF) {
+                apr_status_t lcl_status;
 
-            if ((lcl_status = apr_file_remove(dst, p)) != APR_SUCCESS) {
-                /* ### ACK! Inconsistent state... */
+                apr_file_close(inf);
+                apr_file_close(outf);
+
+                if ((lcl_status = apr_file_remove(dst, p)) != APR_SUCCESS) {
+                    /* ### ACK! Inconsistent state... */
+
+                    /* ### use something besides 500? */
+                    return dav_new_error(p, HTTP_INTERNAL_SERVER_ERROR, 0,
+                                         lcl_status,
+                                         "Could not delete output after read "
+                                         "failure. Server is now in an "
+                                         "inconsistent state.");
+                }
 
                 /* ### use something besides 500? */
-                return dav_new_error(p, HTTP_INTERNAL_SERVER_ERROR, 0,
-                                     lcl_status,
-                                     "Could not delete output after write "
-                                     "failure. Server is now in an "
-                                     "inconsistent state.");
+                return dav_new_error(p, HTTP_INTERNAL_SERVER_ERROR, 0, status,
+                                     "Could not read input file");
             }
 
-            return dav_new_error(p, MAP_IO2HTTP(status), 0, status,
-                                 "Could not write output file");
+            if (status == APR_EOF)
+                break;
+
+            /* write any bytes that were read */
+            status = apr_file_write_full(outf, pbuf->buf, len, NULL);
+            if (status != APR_SUCCESS) {
+                apr_status_t lcl_status;
+
+                apr_file_close(inf);
+                apr_file_close(outf);
+
+                if ((lcl_status = apr_file_remove(dst, p)) != APR_SUCCESS) {
+                    /* ### ACK! Inconsistent state... */
+
+                    /* ### use something besides 500? */
+                    return dav_new_error(p, HTTP_INTERNAL_SERVER_ERROR, 0,
+                                         lcl_status,
+                                         "Could not delete output after write "
+                                         "failure. Server is now in an "
+                                         "inconsistent state.");
+                }
+
+                return dav_new_error(p, MAP_IO2HTTP(status), 0, status,
+                                     "Could not write output file");
+            }
         }
     }
 
@@ -1509,6 +1648,8 @@ static dav_error * dav_fs_walker(dav_fs_walker_context *fsctx, int depth)
     int isdir = fsctx->res1.collection;
     apr_finfo_t dirent;
     apr_dir_t *dirp;
+    apr_pool_t *statepool;
+    apr_hash_t *parent_state_files;
 
     /* ensure the context is prepared properly, then call the func */
     err = (*params->func)(&fsctx->wres,
@@ -1550,6 +1691,15 @@ static dav_error * dav_fs_walker(dav_fs_walker_context *fsctx, int depth)
         /* ### need a better error */
         return dav_new_error(pool, HTTP_NOT_FOUND, 0, status, NULL);
     }
+
+    /* read the state directory once for all the members, rather than
+       have each of them try to open its property database */
+    parent_state_files = fsctx->info1.state_files;
+    apr_pool_create(&statepool, pool);
+    apr_pool_tag(statepool, "dav_fs_walk_state");
+    fsctx->info1.state_files = dav_fs_read_state_files(statepool,
+                                                       fsctx->path1.buf);
+
     while ((apr_dir_read(&dirent, APR_FINFO_DIRENT, dirp)) == APR_SUCCESS) {
         apr_size_t len;
 
@@ -1657,6 +1807,9 @@ static dav_error * dav_fs_walker(dav_fs_walker_context *fsctx, int depth)
     /* ### check the return value of this? */
     apr_dir_close(dirp);
 
+    fsctx->info1.state_files = parent_state_files;
+    apr_pool_destroy(statepool);
+
     if (err != NULL)
         return err;
 
@@ -45,6 +45,10 @@ dav_error * dav_fs_dir_file_name(const dav_resource *resource,
                                  const char **dirpath,
                                  const char **fname);
 
+/* return whether a resource may have a property database (i.e. unless
+   walking its directory told otherwise) */
+int dav_fs_may_have_propdb(const dav_resource *resource);
+
 /* return the list of locknull members in this resource's directory */
 dav_error * dav_fs_get_locknull_members(const dav_resource *resource,
                                         dav_buffer *pbuf);
@@ -67,6 +71,9 @@ void dav_dbm_close(dav_db *db);
 /* where is the lock database located? */
 const char *dav_get_lockdb_path(const request_rec *r);
 
+/* in how many files (shards) is it split? */
+int dav_get_lockdb_shards(const request_rec *r);
+
 const dav_hooks_locks *dav_fs_get_lock_hooks(request_rec *r);
 const dav_hooks_propdb *dav_fs_get_propdb_hooks(request_rec *r);
 
@@ -177,8 +177,10 @@ struct dav_lockdb_private
     request_rec *r; /* for accessing the uuid state */
     apr_pool_t *pool; /* a pool to use */
     const char *lockdb_path; /* where is the lock database? */
+    int shards; /* in how many files is it split? */
 
     int opened; /* we opened the database */
+    int shard; /* which file of it is opened */
     apr_dbm_t *db; /* if non-NULL, the lock database */
 };
 
@@ -313,19 +315,43 @@ static int dav_generic_compare_locktoken(const dav_locktoken *lt1,
 /*
  * dav_generic_really_open_lockdb:
  *
- * If the database hasn't been opened yet, then open the thing.
+ * If the database (holding KEY, when sharded) hasn't been opened yet, then
+ * open the thing.
+ *
+ * Only one shard is opened at a time, so that a request never waits on
+ * another one's shard while holding its own.
  */
-static dav_error * dav_generic_really_open_lockdb(dav_lockdb *lockdb)
+static dav_error * dav_generic_really_open_lockdb(dav_lockdb *lockdb,
+                                                  const apr_datum_t *key)
 {
 #if APU_MAJOR_VERSION > 1 || (APU_MAJOR_VERSION == 1 && APU_MINOR_VERSION >= 7)
     const apr_dbm_driver_t *driver;
     const apu_err_t *er;
 #endif
+    dav_lockdb_private *info = lockdb->info;
+    const char *pathname = info->lockdb_path;
+    int shard = 0;
     dav_error *err;
     apr_status_t status;
 
-    if (lockdb->info->opened) {
-        return NULL;
+    if (info->shards > 1 && key != NULL) {
+        apr_ssize_t klen = key->dsize;
+        shard = apr_hashfunc_default(key->dptr, &klen) % info->shards;
+    }
+
+    if (info->opened) {
+        if (shard == info->shard) {
+            return NULL;
+        }
+        if (info->db != NULL) {
+            apr_dbm_close(info->db);
+            info->db = NULL;
+        }
+        info->opened = 0;
+    }
+
+    if (info->shards > 1) {
+        pathname = apr_psprintf(info->pool, "%s.%d", pathname, shard);
     }
 
 #if APU_MAJOR_VERSION > 1 || (APU_MAJOR_VERSION == 1 && APU_MINOR_VERSION >= 7)
@@ -339,11 +365,11 @@ static dav_error * dav_generic_really_open_lockdb(dav_lockdb *lockdb)
                 status, "Could not load library for property database.");
     }
 
-    status = apr_dbm_open2(&lockdb->info->db, driver, lockdb->info->lockdb_path,
+    status = apr_dbm_open2(&lockdb->info->db, driver, pathname,
                           lockdb->ro ? APR_DBM_READONLY : APR_DBM_RWCREATE,
                           APR_OS_DEFAULT, lockdb->info->pool);
 #else
-    status = apr_dbm_open(&lockdb->info->db, lockdb->info->lockdb_path,
+    status = apr_dbm_open(&lockdb->info->db, pathname,
                           lockdb->ro ? APR_DBM_READONLY : APR_DBM_RWCREATE,
                           APR_OS_DEFAULT, lockdb->info->pool);
 #endif
@@ -360,6 +386,7 @@ static dav_error * dav_generic_really_open_lockdb(dav_lockdb *lockdb)
 
     /* all right. it is opened now. */
     lockdb->info->opened = 1;
+    lockdb->info->shard = shard;
 
     return NULL;
 }
@@ -392,13 +419,14 @@ static dav_error * dav_generic_open_lockdb(request_rec *r, int ro, int force,
                              "DAVGenericLockDB directive. One must be "
                              "specified to use the locking functionality.");
     }
+    comb->priv.shards = dav_generic_get_lockdb_shards(r);
 
     /* done initializing. return it. */
     *lockdb = &comb->pub;
 
     if (force) {
         /* ### add a higher-level comment? */
-        return dav_generic_really_open_lockdb(*lockdb);
+        return dav_generic_really_open_lockdb(*lockdb, NULL);
     }
 
     return NULL;
@@ -478,7 +506,7 @@ static dav_error * dav_generic_save_lock_record(dav_lockdb *lockdb,
     }
 #endif
 
-    if ((err = dav_generic_really_open_lockdb(lockdb)) != NULL) {
+    if ((err = dav_generic_really_open_lockdb(lockdb, &key)) != NULL) {
         /* ### add a higher-level error? */
         return err;
     }
@@ -594,7 +622,7 @@ static dav_error * dav_generic_load_lock_record(dav_lockdb *lockdb,
         *indirect = NULL;
     }
 
-    if ((err = dav_generic_really_open_lockdb(lockdb)) != NULL) {
+    if ((err = dav_generic_really_open_lockdb(lockdb, &key)) != NULL) {
         /* ### add a higher-level error? */
         return err;
     }
@@ -957,7 +985,9 @@ static dav_error * dav_generic_has_locks(dav_lockdb *lockdb,
 
     *locks_present = 0;
 
-    if ((err = dav_generic_really_open_lockdb(lockdb)) != NULL) {
+    key = dav_generic_build_key(lockdb->info->pool, resource);
+
+    if ((err = dav_generic_really_open_lockdb(lockdb, &key)) != NULL) {
         /* ### insert a higher-level error description */
         return err;
     }
@@ -969,8 +999,6 @@ static dav_error * dav_generic_has_locks(dav_lockdb *lockdb,
     if (lockdb->info->db == NULL)
         return NULL;
 
-    key = dav_generic_build_key(lockdb->info->pool, resource);
-
     *locks_present = apr_dbm_exists(lockdb->info->db, key);
 
     return NULL;
@@ -28,6 +28,9 @@
 /* where is the lock database located? */
 const char *dav_generic_get_lockdb_path(const request_rec *r);
 
+/* in how many files (shards) is it split? */
+int dav_generic_get_lockdb_shards(const request_rec *r);
+
 #endif /* _DAV_LOCK_LOCKS_H_ */
 /** @} */
 
@@ -25,8 +25,11 @@
 /* per-dir configuration */
 typedef struct {
     const char *lockdb_path;
+    int lockdb_shards;
 } dav_lock_dir_conf;
 
+#define DAV_LOCKDB_MAX_SHARDS 256
+
 extern const dav_hooks_locks dav_hooks_locks_generic;
 
 extern module AP_MODULE_DECLARE_DATA dav_lock_module;
@@ -39,6 +42,14 @@ const char *dav_generic_get_lockdb_path(const request_rec *r)
     return conf->lockdb_path;
 }
 
+int dav_generic_get_lockdb_shards(const request_rec *r)
+{
+    dav_lock_dir_conf *conf;
+
+    conf = ap_get_module_config(r->per_dir_config, &dav_lock_module);
+    return conf->lockdb_shards ? conf->lockdb_shards : 1;
+}
+
 static void *dav_lock_create_dir_config(apr_pool_t *p, char *dir)
 {
     return apr_pcalloc(p, sizeof(dav_lock_dir_conf));
@@ -55,6 +66,8 @@ static void *dav_lock_merge_dir_config(apr_pool_t *p,
 
     newconf->lockdb_path =
         child->lockdb_path ? child->lockdb_path : parent->lockdb_path;
+    newconf->lockdb_shards =
+        child->lockdb_shards ? child->lockdb_shards : parent->lockdb_shards;
 
     return newconf;
 }
@@ -77,11 +90,33 @@ static const char *dav_lock_cmd_davlockdb(cmd_parms *cmd, void *config,
     return NULL;
 }
 
+/*
+ * Command handler for the DAVGenericLockDBShards directive, which is TAKE1
+ */
+static const char *dav_lock_cmd_davlockdbshards(cmd_parms *cmd, void *config,
+                                                const char *arg1)
+{
+    dav_lock_dir_conf *conf = config;
+
+    conf->lockdb_shards = atoi(arg1);
+
+    if (conf->lockdb_shards < 1
+        || conf->lockdb_shards > DAV_LOCKDB_MAX_SHARDS) {
+        return apr_psprintf(cmd->pool, "DAVGenericLockDBShards must be "
+                            "between 1 and %d", DAV_LOCKDB_MAX_SHARDS);
+    }
+
+    return NULL;
+}
+
 static const command_rec dav_lock_cmds[] =
 {
     /* per server */
     AP_INIT_TAKE1("DAVGenericLockDB", dav_lock_cmd_davlockdb, NULL, ACCESS_CONF,
                   "specify a lock database"),
+    AP_INIT_TAKE1("DAVGenericLockDBShards", dav_lock_cmd_davlockdbshards,
+                  NULL, ACCESS_CONF,
+                  "the number of files to split the lock database into"),
 
     { NULL }
 };
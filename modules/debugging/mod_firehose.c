@@ -38,6 +38,9 @@
 #include "apr_strings.h"
 #include "apr_portable.h"
 #include "apr_uuid.h"
+#include "apr_atomic.h"
+#include "apr_thread_proc.h"
+#include "ap_log_ring.h"
 #include "mod_proxy.h"
 
 #if APR_HAVE_SYS_SYSLIMITS_H
@@ -70,6 +73,20 @@ typedef enum direction_enum
     FIREHOSE_IN = '<', FIREHOSE_OUT = '>'
 } direction_enum;
 
+/*
+ * With FirehoseBufferSize, the fragments of a firehose are put in a ring of
+ * the child process, shared by the firehoses of all the servers writing to
+ * the same file, and a thread of the child writes them out. The filters never
+ * wait: when the ring is full, the fragment is dropped.
+ */
+typedef struct firehose_buffer_t
+{
+    const char *filename;
+    apr_file_t *file;
+    ap_log_ring_t *ring;
+    apr_uint32_t dropped;
+} firehose_buffer_t;
+
 typedef struct firehose_conn_t
 {
     const char *filename;
@@ -79,13 +96,32 @@ typedef struct firehose_conn_t
     request_enum request;
     int suppress;
     apr_int32_t nonblock;
+    firehose_buffer_t *buffer;
 } firehose_conn_t;
 
 typedef struct firehose_conf_t
 {
     apr_array_header_t *firehoses;
+    apr_uint32_t sample;
+    unsigned int sample_set:1;
 } firehose_conf_t;
 
+/* FirehoseSample is in parts per million */
+#define FIREHOSE_SAMPLE_ALL 1000000
+
+/* How long the drain thread sleeps when the rings are empty */
+#define FIREHOSE_DRAIN_INTERVAL apr_time_from_msec(10)
+
+/* How often the drain thread logs the number of dropped fragments */
+#define FIREHOSE_DROP_REPORT apr_time_from_sec(60)
+
+static apr_size_t firehose_buffer_size;
+#if APR_HAS_THREADS
+static apr_array_header_t *firehose_buffers;
+static apr_thread_t *firehose_drain_thread;
+static volatile apr_uint32_t firehose_stopping;
+#endif
+
 typedef struct firehose_ctx_t
 {
     firehose_conf_t *conf;
@@ -104,6 +140,68 @@ typedef struct firehose_ctx_t
 #define BODY_LEN (PIPE_BUF - HEADER_LEN - 2)
 #define HEADER_FMT "%" APR_UINT64_T_HEX_FMT " %" APR_UINT64_T_HEX_FMT " %c %s %" APR_UINT64_T_HEX_FMT CRLF
 
+/*
+ * Put a fragment in the ring, returns zero if it is full (see
+ * ap_log_ring.h for the protocol, the drain thread is the consumer).
+ */
+static int firehose_ring_put(ap_log_ring_t *ring, struct iovec *vec, int nvec)
+{
+    char *data = AP_LOG_RING_DATA(ring);
+    apr_uint32_t need, head, tail, pos, pad;
+    apr_size_t len = 0, off;
+    int i;
+
+    for (i = 0; i < nvec; i++) {
+        len += vec[i].iov_len;
+    }
+    if (len > ring->size / 4) {
+        return 0;
+    }
+
+    need = AP_LOG_RING_RECLEN(len);
+    do {
+        head = apr_atomic_read32(&ring->head);
+        tail = apr_atomic_read32(&ring->tail);
+        pos = head & (ring->size - 1);
+        /* records don't wrap, pad to the end of the ring if needed */
+        pad = (ring->size - pos < need) ? ring->size - pos : 0;
+        if (head - tail + pad + need > ring->size) {
+            return 0;
+        }
+    } while (apr_atomic_cas32(&ring->head, head + pad + need, head) != head);
+
+    if (pad) {
+        apr_atomic_set32((apr_uint32_t *)(data + pos), AP_LOG_RING_PAD);
+        pos = 0;
+    }
+    off = pos + 4;
+    for (i = 0; i < nvec; i++) {
+        memcpy(data + off, vec[i].iov_base, vec[i].iov_len);
+        off += vec[i].iov_len;
+    }
+    /* publish the record, last */
+    apr_atomic_set32((apr_uint32_t *)(data + pos), (apr_uint32_t)len + 1);
+    return 1;
+}
+
+/*
+ * Write a fragment to the firehose, or queue it in the firehose's buffer.
+ * A dropped fragment is not an error, its count goes missing in the stream.
+ */
+static apr_status_t firehose_write(firehose_conn_t *conn, struct iovec *vec,
+                                   int nvec)
+{
+    apr_size_t bytes;
+
+    if (conn->buffer) {
+        if (!firehose_ring_put(conn->buffer->ring, vec, nvec)) {
+            apr_atomic_inc32(&conn->buffer->dropped);
+        }
+        return APR_SUCCESS;
+    }
+    return apr_file_writev_full(conn->file, vec, nvec, &bytes);
+}
+
 static apr_status_t filter_output_cleanup(void *dummy)
 {
     ap_filter_t *f = (ap_filter_t *) dummy;
@@ -127,6 +225,7 @@ static apr_status_t pumpit_cleanup(void *dummy)
     apr_status_t rv;
     apr_size_t hdr_len;
     char header[HEADER_LEN + 1];
+    struct iovec vec[1];
 
     if (!ctx->count) {
         return APR_SUCCESS;
@@ -137,7 +236,9 @@ static apr_status_t pumpit_cleanup(void *dummy)
             ctx->uuid, ctx->count);
     ap_xlate_proto_to_ascii(header, hdr_len);
 
-    rv = apr_file_write_full(ctx->conn->file, header, hdr_len, NULL);
+    vec[0].iov_base = header;
+    vec[0].iov_len = hdr_len;
+    rv = firehose_write(ctx->conn, vec, 1);
     if (APR_SUCCESS != rv) {
         if (ctx->conn->suppress) {
             /* ignore the error */
@@ -192,7 +293,6 @@ static apr_status_t pumpit(ap_filter_t *f, apr_bucket *b, firehose_ctx_t *ctx)
                 char header[HEADER_LEN + 1];
                 apr_size_t hdr_len;
                 apr_size_t body_len = nbytes < BODY_LEN ? nbytes : BODY_LEN;
-                apr_size_t bytes;
                 struct iovec vec[3];
 
                 /*
@@ -211,7 +311,7 @@ static apr_status_t pumpit(ap_filter_t *f, apr_bucket *b, firehose_ctx_t *ctx)
                 vec[2].iov_base = CRLF;
                 vec[2].iov_len = 2;
 
-                rv = apr_file_writev_full(ctx->conn->file, vec, 3, &bytes);
+                rv = firehose_write(ctx->conn, vec, 3);
                 if (APR_SUCCESS != rv) {
                     if (ctx->conn->suppress) {
                         /* ignore the error */
@@ -401,10 +501,18 @@ static int firehose_pre_conn(conn_rec *c, void *csd)
     conf = ap_get_module_config(c->base_server->module_config,
             &firehose_module);
 
-    if (conf->firehoses->nelts) {
-        apr_uuid_get(&uuid);
+    if (!conf->firehoses->nelts) {
+        return OK;
+    }
+
+    /* sample the connections, all firehoses or none */
+    if (conf->sample_set && conf->sample < FIREHOSE_SAMPLE_ALL
+            && ap_random_pick(0, FIREHOSE_SAMPLE_ALL - 1) >= conf->sample) {
+        return OK;
     }
 
+    apr_uuid_get(&uuid);
+
     conn = (firehose_conn_t *) conf->firehoses->elts;
     for (i = 0; i < conf->firehoses->nelts; i++) {
 
@@ -482,6 +590,170 @@ static int firehose_open_logs(apr_pool_t *p, apr_pool_t *plog,
     return OK;
 }
 
+#if APR_HAS_THREADS
+/*
+ * Write out the fragments published in the ring, one write each so that
+ * they stay atomic in a pipe. Returns the number of fragments read.
+ */
+static int firehose_drain_ring(firehose_buffer_t *buffer)
+{
+    ap_log_ring_t *ring = buffer->ring;
+    char *data = AP_LOG_RING_DATA(ring);
+    apr_uint32_t head = apr_atomic_read32(&ring->head);
+    apr_uint32_t tail = ring->tail;
+    int n = 0;
+
+    while (tail != head) {
+        apr_uint32_t pos = tail & (ring->size - 1);
+        apr_uint32_t word = apr_atomic_read32((apr_uint32_t *)(data + pos));
+        apr_uint32_t reclen;
+
+        if (!word) {
+            /* not published yet */
+            break;
+        }
+        if (word == AP_LOG_RING_PAD) {
+            reclen = ring->size - pos;
+        }
+        else {
+            if (APR_SUCCESS != apr_file_write_full(buffer->file,
+                    data + pos + 4, word - 1, NULL)) {
+                apr_atomic_inc32(&buffer->dropped);
+            }
+            reclen = AP_LOG_RING_RECLEN(word - 1);
+            n++;
+        }
+        /* the writers expect zeroes where they reserve */
+        memset(data + pos, 0, reclen);
+        tail += reclen;
+        apr_atomic_set32(&ring->tail, tail);
+    }
+    return n;
+}
+
+static void * APR_THREAD_FUNC firehose_drain(apr_thread_t *thd, void *dummy)
+{
+    firehose_buffer_t **buffers = (firehose_buffer_t **) firehose_buffers->elts;
+    apr_time_t reported = apr_time_now();
+    apr_uint32_t dropped;
+    int i, n, stopping;
+
+    do {
+        stopping = apr_atomic_read32(&firehose_stopping);
+        n = 0;
+        for (i = 0; i < firehose_buffers->nelts; i++) {
+            n += firehose_drain_ring(buffers[i]);
+        }
+        if (apr_time_now() - reported > FIREHOSE_DROP_REPORT) {
+            for (i = 0; i < firehose_buffers->nelts; i++) {
+                dropped = apr_atomic_xchg32(&buffers[i]->dropped, 0);
+                if (dropped) {
+                    ap_log_error(APLOG_MARK, APLOG_WARNING, 0, ap_server_conf, APLOGNO(10583)
+                            "mod_firehose: %u fragments dropped for '%s', the buffer was full or the writes failed",
+                            dropped, buffers[i]->filename);
+                }
+            }
+            reported = apr_time_now();
+        }
+        if (!n && !stopping) {
+            apr_sleep(FIREHOSE_DRAIN_INTERVAL);
+        }
+    } while (!stopping || n);
+
+    apr_thread_exit(thd, APR_SUCCESS);
+    return NULL;
+}
+
+static apr_status_t firehose_drain_stop(void *dummy)
+{
+    apr_status_t rv;
+
+    if (firehose_drain_thread) {
+        apr_atomic_set32(&firehose_stopping, 1);
+        apr_thread_join(&rv, firehose_drain_thread);
+        firehose_drain_thread = NULL;
+    }
+    return APR_SUCCESS;
+}
+
+/*
+ * Create the buffers of the child, one per firehose file, and the thread
+ * which drains them.
+ */
+static void firehose_child_init(apr_pool_t *p, server_rec *s)
+{
+    apr_hash_t *files;
+    firehose_conf_t *conf;
+    firehose_conn_t *conn;
+    firehose_buffer_t *buffer;
+    server_rec *vs;
+    apr_status_t rv;
+    int i;
+
+    if (!firehose_buffer_size) {
+        return;
+    }
+
+    files = apr_hash_make(p);
+    firehose_buffers = apr_array_make(p, 2, sizeof(firehose_buffer_t *));
+    for (vs = s; vs; vs = vs->next) {
+        conf = ap_get_module_config(vs->module_config, &firehose_module);
+        conn = (firehose_conn_t *) conf->firehoses->elts;
+        for (i = 0; i < conf->firehoses->nelts; i++, conn++) {
+            if (!conn->file) {
+                continue;
+            }
+            buffer = apr_hash_get(files, conn->filename, APR_HASH_KEY_STRING);
+            if (!buffer) {
+                buffer = apr_pcalloc(p, sizeof(firehose_buffer_t));
+                buffer->filename = conn->filename;
+                buffer->file = conn->file;
+                buffer->ring = apr_pcalloc(p, AP_LOG_RING_HDR_LEN
+                        + firehose_buffer_size);
+                buffer->ring->magic = AP_LOG_RING_MAGIC;
+                buffer->ring->size = (apr_uint32_t) firehose_buffer_size;
+                apr_hash_set(files, conn->filename, APR_HASH_KEY_STRING, buffer);
+                APR_ARRAY_PUSH(firehose_buffers, firehose_buffer_t *) = buffer;
+            }
+        }
+    }
+    if (!firehose_buffers->nelts) {
+        return;
+    }
+
+    firehose_stopping = 0;
+    rv = apr_thread_create(&firehose_drain_thread, NULL, firehose_drain,
+            NULL, p);
+    if (APR_SUCCESS != rv) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10584)
+                "mod_firehose: could not create the buffer drain thread, writing directly");
+        firehose_drain_thread = NULL;
+        return;
+    }
+    apr_pool_cleanup_register(p, NULL, firehose_drain_stop,
+            apr_pool_cleanup_null);
+
+    /* from now on the filters only queue */
+    for (vs = s; vs; vs = vs->next) {
+        conf = ap_get_module_config(vs->module_config, &firehose_module);
+        conn = (firehose_conn_t *) conf->firehoses->elts;
+        for (i = 0; i < conf->firehoses->nelts; i++, conn++) {
+            if (conn->file) {
+                conn->buffer = apr_hash_get(files, conn->filename,
+                        APR_HASH_KEY_STRING);
+            }
+        }
+    }
+}
+#endif
+
+static int firehose_pre_config(apr_pool_t *pconf, apr_pool_t *plog,
+        apr_pool_t *ptemp)
+{
+    firehose_buffer_size = 0;
+    return OK;
+}
+
 static void firehose_register_hooks(apr_pool_t *p)
 {
     /*
@@ -493,7 +765,11 @@ static void firehose_register_hooks(apr_pool_t *p)
     ap_register_input_filter("FIREHOSE_IN", firehose_input_filter, NULL,
             AP_FTYPE_CONNECTION + 3);
 
+    ap_hook_pre_config(firehose_pre_config, NULL, NULL, APR_HOOK_MIDDLE);
     ap_hook_open_logs(firehose_open_logs, NULL, NULL, APR_HOOK_LAST);
+#if APR_HAS_THREADS
+    ap_hook_child_init(firehose_child_init, NULL, NULL, APR_HOOK_MIDDLE);
+#endif
     ap_hook_pre_connection(firehose_pre_conn, NULL, NULL, APR_HOOK_MIDDLE);
     ap_hook_create_request(firehose_create_request, NULL, NULL,
             APR_HOOK_REALLY_LAST + 1);
@@ -517,6 +793,8 @@ static void *firehose_merge_sconfig(apr_pool_t *p, void *basev,
 
     cconf->firehoses = apr_array_append(p, overrides->firehoses,
             base->firehoses);
+    cconf->sample = overrides->sample_set ? overrides->sample : base->sample;
+    cconf->sample_set = overrides->sample_set || base->sample_set;
 
     return cconf;
 }
@@ -653,6 +931,54 @@ static const char *firehose_enable_proxy_connection_output(cmd_parms *cmd,
 
 }
 
+static const char *firehose_set_sample(cmd_parms *cmd, void *dummy,
+        const char *arg)
+{
+    firehose_conf_t *ptr = ap_get_module_config(cmd->server->module_config,
+            &firehose_module);
+    char *end;
+    double percent = strtod(arg, &end);
+
+    if (*end || end == arg || percent < 0 || percent > 100) {
+        return "FirehoseSample must be a percentage between 0 and 100";
+    }
+    ptr->sample = (apr_uint32_t) (percent * (FIREHOSE_SAMPLE_ALL / 100));
+    ptr->sample_set = 1;
+
+    return NULL;
+}
+
+static const char *firehose_set_buffer_size(cmd_parms *cmd, void *dummy,
+        const char *arg)
+{
+    apr_off_t size;
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+    if (err != NULL) {
+        return err;
+    }
+
+    if (APR_SUCCESS != apr_strtoff(&size, arg, NULL, 10) || size < 0
+            || size > APR_INT32_MAX) {
+        return "FirehoseBufferSize must be a size in bytes";
+    }
+#if !APR_HAS_THREADS
+    if (size) {
+        return "FirehoseBufferSize requires thread support";
+    }
+#endif
+
+    /* a power of two, large enough for some fragments */
+    firehose_buffer_size = 0;
+    if (size) {
+        firehose_buffer_size = 65536;
+        while (firehose_buffer_size < (apr_size_t) size) {
+            firehose_buffer_size <<= 1;
+        }
+    }
+
+    return NULL;
+}
+
 static const command_rec firehose_cmds[] =
 {
         AP_INIT_TAKE12("FirehoseConnectionInput", firehose_enable_connection_input, NULL,
@@ -667,6 +993,10 @@ static const command_rec firehose_cmds[] =
                 RSRC_CONF, "Enable firehose on proxied connection input data written to the given file/pipe"),
         AP_INIT_TAKE12("FirehoseProxyConnectionOutput", firehose_enable_proxy_connection_output, NULL,
                 RSRC_CONF, "Enable firehose on proxied connection output data written to the given file/pipe"),
+        AP_INIT_TAKE1("FirehoseSample", firehose_set_sample, NULL,
+                RSRC_CONF, "Percentage of the connections recorded by the firehoses"),
+        AP_INIT_TAKE1("FirehoseBufferSize", firehose_set_buffer_size, NULL,
+                RSRC_CONF, "Size of the buffer of each firehose in a child, 0 to write directly"),
         { NULL }
 };
 
@@ -15,12 +15,24 @@
  */
 
 #include "httpd.h"
+#include "http_config.h"
 #include "http_core.h"
 #include "http_log.h"
+#include "scoreboard.h"
+#include "apr_lib.h"
 #include "apr_strings.h"
+#include "apr_base64.h"
 
 #include <brotli/encode.h>
 
+/* Compression dictionary transport (RFC 9842) needs the prepared
+ * dictionaries of Brotli 1.1.0 or later.
+ */
+#ifdef HAVE_BROTLIENCODERPREPAREDICTIONARY
+#define BROTLI_HAS_DICTIONARIES 1
+#include <brotli/shared_dictionary.h>
+#endif
+
 module AP_MODULE_DECLARE_DATA brotli_module;
 
 typedef enum {
@@ -29,8 +41,32 @@ typedef enum {
     ETAG_MODE_REMOVE = 2
 } etag_mode_e;
 
+#ifdef BROTLI_HAS_DICTIONARIES
+/* "dcb" streams start with this magic, followed by the dictionary hash */
+#define DCB_MAGIC "\xff\x44\x43\x42"
+#define DCB_MAGIC_LEN 4
+#define DCB_HASH_LEN 32
+
+typedef struct brotli_dict_t {
+    const char *file;
+    const char *match;
+    const char *use_as;     /* the Use-As-Dictionary header */
+    const char *data;
+    apr_size_t len;
+    unsigned char hash[DCB_HASH_LEN];
+    BrotliEncoderPreparedDictionary *prepared;
+} brotli_dict_t;
+#endif
+
 typedef struct brotli_server_config_t {
+    apr_array_header_t *dicts;
     int quality;
+    /* responses of at least large_size bytes use large_quality */
+    apr_off_t large_size;
+    int large_quality;
+    /* with at least busy_percent busy workers, use busy_quality (-1: off) */
+    int busy_percent;
+    int busy_quality;
     int lgwin;
     int lgblock;
     etag_mode_e etag_mode;
@@ -52,6 +88,7 @@ static void *create_server_config(apr_pool_t *p, server_rec *s)
      * else unchanged.  See https://quixdb.github.io/squash-benchmark/
      */
     conf->quality = 5;
+    conf->large_size = -1;
     conf->lgwin = 18;
     /* Zero is a special value for BROTLI_PARAM_LGBLOCK that allows
      * Brotli to automatically select the optimal input block size based
@@ -63,6 +100,243 @@ static void *create_server_config(apr_pool_t *p, server_rec *s)
     return conf;
 }
 
+#ifdef BROTLI_HAS_DICTIONARIES
+#define SHA256_ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static const apr_uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static void sha256_block(apr_uint32_t h[8], const unsigned char *p)
+{
+    apr_uint32_t w[64], v[8], t1, t2;
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        w[i] = ((apr_uint32_t)p[4 * i] << 24) | ((apr_uint32_t)p[4 * i + 1] << 16)
+               | ((apr_uint32_t)p[4 * i + 2] << 8) | p[4 * i + 3];
+    }
+    for (i = 16; i < 64; i++) {
+        w[i] = w[i - 16] + w[i - 7]
+               + (SHA256_ROTR(w[i - 15], 7) ^ SHA256_ROTR(w[i - 15], 18)
+                  ^ (w[i - 15] >> 3))
+               + (SHA256_ROTR(w[i - 2], 17) ^ SHA256_ROTR(w[i - 2], 19)
+                  ^ (w[i - 2] >> 10));
+    }
+
+    memcpy(v, h, sizeof(v));
+    for (i = 0; i < 64; i++) {
+        t1 = v[7] + (SHA256_ROTR(v[4], 6) ^ SHA256_ROTR(v[4], 11)
+                     ^ SHA256_ROTR(v[4], 25))
+             + ((v[4] & v[5]) ^ (~v[4] & v[6])) + sha256_k[i] + w[i];
+        t2 = (SHA256_ROTR(v[0], 2) ^ SHA256_ROTR(v[0], 13)
+              ^ SHA256_ROTR(v[0], 22))
+             + ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+        memmove(v + 1, v, 7 * sizeof(*v));
+        v[4] += t1;
+        v[0] = t1 + t2;
+    }
+    for (i = 0; i < 8; i++) {
+        h[i] += v[i];
+    }
+}
+
+static void sha256(const unsigned char *data, apr_size_t len,
+                   unsigned char digest[32])
+{
+    apr_uint32_t h[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    unsigned char tail[128];
+    apr_uint64_t bits = (apr_uint64_t)len * 8;
+    apr_size_t rest, n;
+    int i;
+
+    for (; len >= 64; data += 64, len -= 64) {
+        sha256_block(h, data);
+    }
+
+    /* pad the remainder with 0x80, zeros and the length in bits */
+    memset(tail, 0, sizeof(tail));
+    memcpy(tail, data, len);
+    tail[len] = 0x80;
+    rest = (len + 9 <= 64) ? 64 : 128;
+    for (i = 0; i < 8; i++) {
+        tail[rest - 1 - i] = (unsigned char)(bits >> (8 * i));
+    }
+    for (n = 0; n < rest; n += 64) {
+        sha256_block(h, tail + n);
+    }
+
+    for (i = 0; i < 8; i++) {
+        digest[4 * i] = (unsigned char)(h[i] >> 24);
+        digest[4 * i + 1] = (unsigned char)(h[i] >> 16);
+        digest[4 * i + 2] = (unsigned char)(h[i] >> 8);
+        digest[4 * i + 3] = (unsigned char)h[i];
+    }
+}
+
+static const char *set_dictionary(cmd_parms *cmd, void *dummy,
+                                  const char *arg1, const char *arg2)
+{
+    brotli_server_config_t *conf =
+        ap_get_module_config(cmd->server->module_config, &brotli_module);
+    brotli_dict_t *dict;
+    apr_file_t *fd;
+    apr_finfo_t finfo;
+    apr_status_t rv;
+    char *data;
+
+    dict = apr_pcalloc(cmd->pool, sizeof(*dict));
+    dict->file = ap_server_root_relative(cmd->pool, arg1);
+    if (!dict->file) {
+        return apr_pstrcat(cmd->pool, "Invalid BrotliDictionary path ",
+                           arg1, NULL);
+    }
+    dict->match = arg2;
+    dict->use_as = apr_psprintf(cmd->pool, "match=\"%s\"", arg2);
+
+    rv = apr_file_open(&fd, dict->file, APR_READ | APR_BINARY,
+                       APR_OS_DEFAULT, cmd->temp_pool);
+    if (rv == APR_SUCCESS) {
+        rv = apr_file_info_get(&finfo, APR_FINFO_SIZE, fd);
+    }
+    if (rv == APR_SUCCESS) {
+        if (finfo.size <= 0 || finfo.size > APR_SIZE_MAX) {
+            apr_file_close(fd);
+            return apr_pstrcat(cmd->pool, "BrotliDictionary ", dict->file,
+                               " is empty or too large", NULL);
+        }
+        dict->len = (apr_size_t)finfo.size;
+        data = apr_palloc(cmd->pool, dict->len);
+        rv = apr_file_read_full(fd, data, dict->len, NULL);
+        apr_file_close(fd);
+        dict->data = data;
+    }
+    if (rv != APR_SUCCESS) {
+        return apr_psprintf(cmd->pool, "Can't read BrotliDictionary %s: %pm",
+                            dict->file, &rv);
+    }
+
+    sha256((const unsigned char *)dict->data, dict->len, dict->hash);
+
+    if (!conf->dicts) {
+        conf->dicts = apr_array_make(cmd->pool, 2, sizeof(brotli_dict_t *));
+    }
+    APR_ARRAY_PUSH(conf->dicts, brotli_dict_t *) = dict;
+    return NULL;
+}
+
+static apr_status_t cleanup_dict(void *data)
+{
+    brotli_dict_t *dict = data;
+
+    BrotliEncoderDestroyPreparedDictionary(dict->prepared);
+    dict->prepared = NULL;
+    return APR_SUCCESS;
+}
+
+/*
+ * Prepare the dictionaries in the parent, so that their (read-only)
+ * encoder tables are shared by all the children.
+ */
+static int brotli_post_config(apr_pool_t *pconf, apr_pool_t *plog,
+                              apr_pool_t *ptemp, server_rec *s)
+{
+    for (; s; s = s->next) {
+        brotli_server_config_t *conf =
+            ap_get_module_config(s->module_config, &brotli_module);
+        int i;
+
+        if (!conf->dicts) {
+            continue;
+        }
+        for (i = 0; i < conf->dicts->nelts; i++) {
+            brotli_dict_t *dict = APR_ARRAY_IDX(conf->dicts, i,
+                                                brotli_dict_t *);
+
+            if (dict->prepared) {
+                continue;
+            }
+            dict->prepared = BrotliEncoderPrepareDictionary(
+                    BROTLI_SHARED_DICTIONARY_RAW, dict->len,
+                    (const uint8_t *)dict->data, conf->quality,
+                    NULL, NULL, NULL);
+            if (!dict->prepared) {
+                ap_log_error(APLOG_MARK, APLOG_CRIT, 0, s, APLOGNO(10439)
+                             "Unable to prepare BrotliDictionary %s",
+                             dict->file);
+                return HTTP_INTERNAL_SERVER_ERROR;
+            }
+            apr_pool_cleanup_register(pconf, dict, cleanup_dict,
+                                      apr_pool_cleanup_null);
+        }
+    }
+    return OK;
+}
+
+/*
+ * Find the dictionary the client announced with Available-Dictionary,
+ * a structured field byte sequence holding its SHA-256 hash.
+ */
+static brotli_dict_t *find_dictionary(request_rec *r,
+                                      brotli_server_config_t *conf)
+{
+    const char *available;
+    char *encoded;
+    unsigned char hash[DCB_HASH_LEN + 3];
+    apr_size_t len;
+    int i;
+
+    available = apr_table_get(r->headers_in, "Available-Dictionary");
+    if (!available) {
+        return NULL;
+    }
+    while (apr_isspace(*available)) {
+        available++;
+    }
+    len = strlen(available);
+    while (len && apr_isspace(available[len - 1])) {
+        len--;
+    }
+    if (len < 2 || available[0] != ':' || available[len - 1] != ':') {
+        return NULL;
+    }
+    encoded = apr_pstrmemdup(r->pool, available + 1, len - 2);
+    if (apr_base64_decode_len(encoded) > (int)sizeof(hash)
+        || apr_base64_decode((char *)hash, encoded) != DCB_HASH_LEN) {
+        return NULL;
+    }
+
+    for (i = 0; i < conf->dicts->nelts; i++) {
+        brotli_dict_t *dict = APR_ARRAY_IDX(conf->dicts, i, brotli_dict_t *);
+
+        if (dict->prepared && !memcmp(dict->hash, hash, DCB_HASH_LEN)) {
+            return dict;
+        }
+    }
+    return NULL;
+}
+#else
+static const char *set_dictionary(cmd_parms *cmd, void *dummy,
+                                  const char *arg1, const char *arg2)
+{
+    return "BrotliDictionary requires mod_brotli to be built with "
+           "Brotli 1.1.0 or later";
+}
+#endif /* BROTLI_HAS_DICTIONARIES */
+
 static const char *set_filter_note(cmd_parms *cmd, void *dummy,
                                    const char *arg1, const char *arg2)
 {
@@ -106,6 +380,60 @@ static const char *set_compression_quality(cmd_parms *cmd, void *dummy,
     return NULL;
 }
 
+static const char *set_compression_quality_large(cmd_parms *cmd, void *dummy,
+                                                 const char *arg1,
+                                                 const char *arg2)
+{
+    brotli_server_config_t *conf =
+        ap_get_module_config(cmd->server->module_config, &brotli_module);
+    char *end;
+    int val;
+
+    if (apr_strtoff(&conf->large_size, arg1, &end, 10) != APR_SUCCESS
+        || *end || conf->large_size < 0) {
+        return "BrotliCompressionQualityLarge size must be a non-negative "
+               "integer";
+    }
+
+    val = atoi(arg2);
+    if (val < 0 || val > 11) {
+        return "BrotliCompressionQualityLarge quality must be between 0 "
+               "and 11";
+    }
+
+    conf->large_quality = val;
+    return NULL;
+}
+
+static const char *set_compression_quality_busy(cmd_parms *cmd, void *dummy,
+                                                const char *arg1,
+                                                const char *arg2)
+{
+    brotli_server_config_t *conf =
+        ap_get_module_config(cmd->server->module_config, &brotli_module);
+    int val = atoi(arg1);
+
+    if (val < 1 || val > 100) {
+        return "BrotliCompressionQualityBusy percentage must be between 1 "
+               "and 100";
+    }
+    conf->busy_percent = val;
+
+    if (ap_cstr_casecmp(arg2, "off") == 0) {
+        conf->busy_quality = -1;
+        return NULL;
+    }
+
+    val = atoi(arg2);
+    if (val < 0 || val > 11) {
+        return "BrotliCompressionQualityBusy quality must be between 0 "
+               "and 11, or 'off'";
+    }
+
+    conf->busy_quality = val;
+    return NULL;
+}
+
 static const char *set_compression_lgwin(cmd_parms *cmd, void *dummy,
                                          const char *arg)
 {
@@ -327,6 +655,54 @@ static const char *get_content_encoding(request_rec *r)
     return encoding;
 }
 
+/*
+ * Whether the request's Accept-Encoding has the given coding, with a
+ * non-zero qvalue.
+ */
+static int accepts_coding(request_rec *r, const char *coding)
+{
+    const char *accepts;
+    const char *token;
+    const char *q = NULL;
+
+    accepts = apr_table_get(r->headers_in, "Accept-Encoding");
+    if (!accepts) {
+        return 0;
+    }
+
+    /* Do we have Accept-Encoding: <coding>? */
+    token = ap_get_token(r->pool, &accepts, 0);
+    while (token && token[0] && ap_cstr_casecmp(token, coding) != 0) {
+        while (*accepts == ';') {
+            ++accepts;
+            ap_get_token(r->pool, &accepts, 1);
+        }
+
+        if (*accepts == ',') {
+            ++accepts;
+        }
+        token = (*accepts) ? ap_get_token(r->pool, &accepts, 0) : NULL;
+    }
+
+    /* Find the qvalue, if provided */
+    if (*accepts) {
+        while (*accepts == ';') {
+            ++accepts;
+        }
+        q = ap_get_token(r->pool, &accepts, 1);
+        ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r,
+                      "token: '%s' - q: '%s'", token ? token : "NULL", q);
+    }
+
+    /* No acceptable token found or q=0 */
+    if (!token || token[0] == '\0' ||
+        (q && strlen(q) >= 3 && strncmp("q=0.000", q, strlen(q)) == 0)) {
+        return 0;
+    }
+
+    return 1;
+}
+
 static apr_status_t compress_filter(ap_filter_t *f, apr_bucket_brigade *bb)
 {
     request_rec *r = f->r;
@@ -343,8 +719,27 @@ static apr_status_t compress_filter(ap_filter_t *f, apr_bucket_brigade *bb)
     if (!ctx) {
         const char *encoding;
         const char *token;
-        const char *accepts;
-        const char *q = NULL;
+        const char *coding = "br";
+        int quality;
+#ifdef BROTLI_HAS_DICTIONARIES
+        brotli_dict_t *dict = NULL;
+
+        /* Tell the client to keep the dictionaries we serve. */
+        if (conf->dicts && !r->main && r->filename) {
+            int i;
+
+            for (i = 0; i < conf->dicts->nelts; i++) {
+                brotli_dict_t *d = APR_ARRAY_IDX(conf->dicts, i,
+                                                 brotli_dict_t *);
+
+                if (!strcmp(r->filename, d->file)) {
+                    apr_table_setn(r->headers_out, "Use-As-Dictionary",
+                                   d->use_as);
+                    break;
+                }
+            }
+        }
+#endif
 
         /* Only work on main request, not subrequests, that are not
          * a 204 response with no content, and are not tagged with the
@@ -392,48 +787,66 @@ static apr_status_t compress_filter(ap_filter_t *f, apr_bucket_brigade *bb)
          */
         apr_table_mergen(r->headers_out, "Vary", "Accept-Encoding");
 
-        accepts = apr_table_get(r->headers_in, "Accept-Encoding");
-        if (!accepts) {
+#ifdef BROTLI_HAS_DICTIONARIES
+        /* Compress against the dictionary the client already has, if it
+         * is one of ours.
+         */
+        if (conf->dicts) {
+            apr_table_mergen(r->headers_out, "Vary", "Available-Dictionary");
+            if (accepts_coding(r, "dcb")) {
+                dict = find_dictionary(r, conf);
+            }
+        }
+        if (dict) {
+            coding = "dcb";
+        }
+        else
+#endif
+        if (!accepts_coding(r, "br")) {
             ap_remove_output_filter(f);
             return ap_pass_brigade(f->next, bb);
         }
 
-        /* Do we have Accept-Encoding: br? */
-        token = ap_get_token(r->pool, &accepts, 0);
-        while (token && token[0] && ap_cstr_casecmp(token, "br") != 0) {
-            while (*accepts == ';') {
-                ++accepts;
-                ap_get_token(r->pool, &accepts, 1);
+        /* Use a lower quality for large responses, and when the server is
+         * busy (possibly not compressing at all), so that we do not spend
+         * CPU time that is needed elsewhere.
+         */
+        quality = conf->quality;
+        if (conf->large_size >= 0) {
+            const char *clength = apr_table_get(r->headers_out,
+                                                "Content-Length");
+            apr_off_t length = -1;
+
+            if (clength) {
+                if (!ap_parse_strict_length(&length, clength)) {
+                    length = -1;
+                }
             }
-
-            if (*accepts == ',') {
-                ++accepts;
+            else if (APR_BUCKET_IS_EOS(APR_BRIGADE_LAST(bb))) {
+                apr_brigade_length(bb, 0, &length);
             }
-            token = (*accepts) ? ap_get_token(r->pool, &accepts, 0) : NULL;
-        }
-
-        /* Find the qvalue, if provided */
-        if (*accepts) {
-            while (*accepts == ';') {
-                ++accepts;
+            if (length >= conf->large_size) {
+                quality = conf->large_quality;
             }
-            q = ap_get_token(r->pool, &accepts, 1);
-            ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r,
-                          "token: '%s' - q: '%s'", token ? token : "NULL", q);
         }
-
-        /* No acceptable token found or q=0 */
-        if (!token || token[0] == '\0' ||
-            (q && strlen(q) >= 3 && strncmp("q=0.000", q, strlen(q)) == 0)) {
-            ap_remove_output_filter(f);
-            return ap_pass_brigade(f->next, bb);
+        if (conf->busy_percent
+            && ap_sb_busy_percent() >= conf->busy_percent) {
+            if (conf->busy_quality < 0) {
+                ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r,
+                              "Not compressing (server busy)");
+                ap_remove_output_filter(f);
+                return ap_pass_brigade(f->next, bb);
+            }
+            if (conf->busy_quality < quality) {
+                quality = conf->busy_quality;
+            }
         }
 
         /* If the entire Content-Encoding is "identity", we can replace it. */
         if (!encoding || ap_cstr_casecmp(encoding, "identity") == 0) {
-            apr_table_setn(r->headers_out, "Content-Encoding", "br");
+            apr_table_setn(r->headers_out, "Content-Encoding", coding);
         } else {
-            apr_table_mergen(r->headers_out, "Content-Encoding", "br");
+            apr_table_mergen(r->headers_out, "Content-Encoding", coding);
         }
 
         if (r->content_encoding) {
@@ -464,7 +877,8 @@ static apr_status_t compress_filter(ap_filter_t *f, apr_bucket_brigade *bb)
 
                 if (len > 2 && etag[len - 1] == '"') {
                     etag = apr_pstrmemdup(r->pool, etag, len - 1);
-                    etag = apr_pstrcat(r->pool, etag, "-br\"", NULL);
+                    etag = apr_pstrcat(r->pool, etag, "-", coding, "\"",
+                                       NULL);
                     apr_table_setn(r->headers_out, "ETag", etag);
                 }
             }
@@ -476,9 +890,31 @@ static apr_status_t compress_filter(ap_filter_t *f, apr_bucket_brigade *bb)
             return ap_pass_brigade(f->next, bb);
         }
 
-        ctx = create_ctx(conf->quality, conf->lgwin, conf->lgblock,
+        ctx = create_ctx(quality, conf->lgwin, conf->lgblock,
                          f->c->bucket_alloc, r->pool);
         f->ctx = ctx;
+
+#ifdef BROTLI_HAS_DICTIONARIES
+        if (dict) {
+            char header[DCB_MAGIC_LEN + DCB_HASH_LEN];
+            apr_bucket *b;
+
+            if (!BrotliEncoderAttachPreparedDictionary(ctx->state,
+                                                       dict->prepared)) {
+                ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(10440)
+                              "Unable to attach BrotliDictionary %s",
+                              dict->file);
+                return APR_EGENERAL;
+            }
+
+            memcpy(header, DCB_MAGIC, DCB_MAGIC_LEN);
+            memcpy(header + DCB_MAGIC_LEN, dict->hash, DCB_HASH_LEN);
+            b = apr_bucket_heap_create(header, sizeof(header), NULL,
+                                       f->c->bucket_alloc);
+            APR_BRIGADE_INSERT_TAIL(ctx->bb, b);
+            ctx->total_out += sizeof(header);
+        }
+#endif
     }
 
     while (!APR_BRIGADE_EMPTY(bb)) {
@@ -572,6 +1008,9 @@ static void register_hooks(apr_pool_t *p)
 {
     ap_register_output_filter("BROTLI_COMPRESS", compress_filter, NULL,
                               AP_FTYPE_CONTENT_SET);
+#ifdef BROTLI_HAS_DICTIONARIES
+    ap_hook_post_config(brotli_post_config, NULL, NULL, APR_HOOK_MIDDLE);
+#endif
 }
 
 static const command_rec cmds[] = {
@@ -582,6 +1021,14 @@ static const command_rec cmds[] = {
                   NULL, RSRC_CONF,
                   "Compression quality between 0 and 11 (higher quality means "
                   "slower compression)"),
+    AP_INIT_TAKE2("BrotliCompressionQualityLarge",
+                  set_compression_quality_large, NULL, RSRC_CONF,
+                  "Response size from which responses of known length are "
+                  "compressed at the given quality (0-11)"),
+    AP_INIT_TAKE2("BrotliCompressionQualityBusy",
+                  set_compression_quality_busy, NULL, RSRC_CONF,
+                  "Percentage of busy workers from which the given quality "
+                  "(0-11) or 'off' is used"),
     AP_INIT_TAKE1("BrotliCompressionWindow", set_compression_lgwin,
                   NULL, RSRC_CONF,
                   "Sliding window size between 10 and 24 (larger windows can "
@@ -594,6 +1041,10 @@ static const command_rec cmds[] = {
                   NULL, RSRC_CONF,
                   "Set how mod_brotli should modify ETag response headers: "
                   "'AddSuffix' (default), 'NoChange', 'Remove'"),
+    AP_INIT_TAKE2("BrotliDictionary", set_dictionary,
+                  NULL, RSRC_CONF,
+                  "A file used as a compression dictionary, and the URL "
+                  "pattern of the responses it applies to"),
     {NULL}
 };
 
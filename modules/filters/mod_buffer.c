@@ -36,9 +36,14 @@ module AP_MODULE_DECLARE_DATA buffer_module;
 
 #define DEFAULT_BUFFER_SIZE 128*1024
 
+/* the largest slab, when BufferSize is larger */
+#define MAX_SLAB_SIZE 4*1024*1024
+
 typedef struct buffer_conf {
     apr_off_t size; /* size of the buffer */
     int size_set; /* has the size been set */
+    int slab; /* accumulate into slabs */
+    int slab_set; /* has slab been set */
 } buffer_conf;
 
 typedef struct buffer_ctx {
@@ -47,8 +52,81 @@ typedef struct buffer_ctx {
     buffer_conf *conf;
     apr_off_t remaining;
     int seen_eos;
+    char *slab; /* the slab being filled, if any */
+    apr_size_t slab_len; /* bytes used in the slab */
+    apr_size_t slab_size; /* size of the slab */
 } buffer_ctx;
 
+/**
+ * Append the slab being filled to the buffer, as a single heap bucket.
+ *
+ * The slabs come from the bucket allocator of the connection, whose
+ * allocator recycles the blocks of the requests it served before, so
+ * filling them costs no more than a copy.
+ */
+static void buffer_slab_close(buffer_ctx *ctx)
+{
+    if (ctx->slab) {
+        if (ctx->slab_len) {
+            APR_BRIGADE_INSERT_TAIL(ctx->bb,
+                    apr_bucket_heap_create(ctx->slab, ctx->slab_len,
+                                           apr_bucket_free,
+                                           ctx->bb->bucket_alloc));
+        }
+        else {
+            apr_bucket_free(ctx->slab);
+        }
+        ctx->slab = NULL;
+        ctx->slab_len = 0;
+    }
+}
+
+/**
+ * Copy data into slabs of BufferSize bytes (at most MAX_SLAB_SIZE), which
+ * are appended to the buffer as they fill up.
+ */
+static void buffer_slab_write(buffer_ctx *ctx, const char *data,
+                              apr_size_t size)
+{
+    while (size) {
+        apr_size_t n;
+
+        if (!ctx->slab) {
+            ctx->slab_size = (ctx->conf->size > MAX_SLAB_SIZE)
+                ? MAX_SLAB_SIZE : (apr_size_t)ctx->conf->size;
+            ctx->slab = apr_bucket_alloc(ctx->slab_size,
+                                         ctx->bb->bucket_alloc);
+            ctx->slab_len = 0;
+        }
+
+        n = ctx->slab_size - ctx->slab_len;
+        if (n > size) {
+            n = size;
+        }
+        memcpy(ctx->slab + ctx->slab_len, data, n);
+        ctx->slab_len += n;
+        data += n;
+        size -= n;
+
+        if (ctx->slab_len == ctx->slab_size) {
+            buffer_slab_close(ctx);
+        }
+    }
+}
+
+/**
+ * Buffer data, in slabs or in the heap buckets of the brigade.
+ */
+static void buffer_write(buffer_ctx *ctx, const char *data, apr_size_t size)
+{
+    if (ctx->conf->slab) {
+        buffer_slab_write(ctx, data, size);
+    }
+    else {
+        apr_brigade_write(ctx->bb, NULL, NULL, data, size);
+    }
+}
+
 /**
  * Buffer buckets being written to the output filter stack.
  */
@@ -82,8 +160,9 @@ static apr_status_t buffer_out_filter(ap_filter_t *f, apr_bucket_brigade *bb)
         return ap_pass_brigade(f->next, bb);
     }
 
-    /* Empty buffer means we can potentially optimise below */
-    if (APR_BRIGADE_EMPTY(ctx->bb)) {
+    /* Empty buffer means we can potentially optimise below, unless the
+     * data go to slabs */
+    if (APR_BRIGADE_EMPTY(ctx->bb) && !ctx->slab && !ctx->conf->slab) {
         move = 1;
     }
 
@@ -100,6 +179,7 @@ static apr_status_t buffer_out_filter(ap_filter_t *f, apr_bucket_brigade *bb)
             /* should we add an etag? */
 
             /* pass the EOS across */
+            buffer_slab_close(ctx);
             APR_BUCKET_REMOVE(e);
             APR_BRIGADE_INSERT_TAIL(ctx->bb, e);
 
@@ -112,6 +192,7 @@ static apr_status_t buffer_out_filter(ap_filter_t *f, apr_bucket_brigade *bb)
         if (APR_BUCKET_IS_FLUSH(e)) {
 
             /* pass the flush bucket across */
+            buffer_slab_close(ctx);
             APR_BUCKET_REMOVE(e);
             APR_BRIGADE_INSERT_TAIL(ctx->bb, e);
 
@@ -126,6 +207,7 @@ static apr_status_t buffer_out_filter(ap_filter_t *f, apr_bucket_brigade *bb)
              * Remove meta data bucket from old brigade and insert into the
              * new.
              */
+            buffer_slab_close(ctx);
             APR_BUCKET_REMOVE(e);
             APR_BRIGADE_INSERT_TAIL(ctx->bb, e);
             continue;
@@ -136,9 +218,10 @@ static apr_status_t buffer_out_filter(ap_filter_t *f, apr_bucket_brigade *bb)
          * gets full, we can no longer compute a content length.
          */
         apr_brigade_length(ctx->bb, 1, &len);
-        if (len > ctx->conf->size) {
+        if (len + (apr_off_t)ctx->slab_len > ctx->conf->size) {
 
             /* pass what we have down the chain */
+            buffer_slab_close(ctx);
             rv = ap_pass_brigade(f->next, ctx->bb);
             if (rv) {
                 /* should break out of the loop, since our write to the client
@@ -171,7 +254,7 @@ static apr_status_t buffer_out_filter(ap_filter_t *f, apr_bucket_brigade *bb)
                     move = 0;
                 }
             } else {
-                apr_brigade_write(ctx->bb, NULL, NULL, data, size);
+                buffer_write(ctx, data, size);
                 apr_bucket_delete(e);
             }
 
@@ -235,6 +318,7 @@ static apr_status_t buffer_in_filter(ap_filter_t *f, apr_bucket_brigade *bb,
                  * underlying filter.
                  */
                 if (rv != APR_SUCCESS || APR_BRIGADE_EMPTY(ctx->tmp)) {
+                    buffer_slab_close(ctx);
                     return rv;
                 }
             }
@@ -244,6 +328,7 @@ static apr_status_t buffer_in_filter(ap_filter_t *f, apr_bucket_brigade *bb,
 
                 /* if we see an EOS, we are done */
                 if (APR_BUCKET_IS_EOS(e)) {
+                    buffer_slab_close(ctx);
                     APR_BUCKET_REMOVE(e);
                     APR_BRIGADE_INSERT_TAIL(ctx->bb, e);
                     ctx->seen_eos = 1;
@@ -252,6 +337,7 @@ static apr_status_t buffer_in_filter(ap_filter_t *f, apr_bucket_brigade *bb,
 
                 /* flush buckets clear the buffer */
                 if (APR_BUCKET_IS_FLUSH(e)) {
+                    buffer_slab_close(ctx);
                     APR_BUCKET_REMOVE(e);
                     APR_BRIGADE_INSERT_TAIL(ctx->bb, e);
                     seen_flush = 1;
@@ -260,6 +346,7 @@ static apr_status_t buffer_in_filter(ap_filter_t *f, apr_bucket_brigade *bb,
 
                 /* pass metadata buckets through */
                 if (APR_BUCKET_IS_METADATA(e)) {
+                    buffer_slab_close(ctx);
                     APR_BUCKET_REMOVE(e);
                     APR_BRIGADE_INSERT_TAIL(ctx->bb, e);
                     continue;
@@ -268,15 +355,18 @@ static apr_status_t buffer_in_filter(ap_filter_t *f, apr_bucket_brigade *bb,
                 /* read the bucket in, pack it into the buffer */
                 if (APR_SUCCESS == (rv = apr_bucket_read(e, &data, &size,
                                                          APR_BLOCK_READ))) {
-                    apr_brigade_write(ctx->bb, NULL, NULL, data, size);
+                    buffer_write(ctx, data, size);
                     ctx->remaining -= size;
                     apr_bucket_delete(e);
                 } else {
+                    buffer_slab_close(ctx);
                     return rv;
                 }
 
             } while (!APR_BRIGADE_EMPTY(ctx->tmp));
         }
+
+        buffer_slab_close(ctx);
     }
 
     /* give the caller the data they asked for from the buffer */
@@ -313,6 +403,8 @@ static void *merge_buffer_config(apr_pool_t *p, void *basev, void *addv)
 
     new->size = (add->size_set == 0) ? base->size : add->size;
     new->size_set = add->size_set || base->size_set;
+    new->slab = (add->slab_set == 0) ? base->slab : add->slab;
+    new->slab_set = add->slab_set || base->slab_set;
 
     return new;
 }
@@ -330,9 +422,22 @@ static const char *set_buffer_size(cmd_parms *cmd, void *dconf, const char *arg)
     return NULL;
 }
 
+static const char *set_buffer_slab(cmd_parms *cmd, void *dconf, int flag)
+{
+    buffer_conf *conf = dconf;
+
+    conf->slab = flag;
+    conf->slab_set = 1;
+
+    return NULL;
+}
+
 static const command_rec buffer_cmds[] = { AP_INIT_TAKE1("BufferSize",
         set_buffer_size, NULL, ACCESS_CONF,
-        "Maximum size of the buffer used by the buffer filter"), { NULL } };
+        "Maximum size of the buffer used by the buffer filter"),
+        AP_INIT_FLAG("BufferSlab", set_buffer_slab, NULL,
+        RSRC_CONF | ACCESS_CONF,
+        "Buffer into contiguous slabs of BufferSize bytes"), { NULL } };
 
 static void register_hooks(apr_pool_t *p)
 {
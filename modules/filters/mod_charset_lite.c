@@ -851,6 +851,10 @@ static apr_status_t xlate_out_filter(ap_filter_t *f, apr_bucket_brigade *bb)
     }
 
     if (ctx->noop) {
+        /* Nothing to translate, get out of the way of the next brigades
+         * (a noop instance has no say in chk_filter_chain() either).
+         */
+        ap_remove_output_filter(f);
         return ap_pass_brigade(f->next, bb);
     }
 
@@ -1035,6 +1039,8 @@ static apr_status_t xlate_in_filter(ap_filter_t *f, apr_bucket_brigade *bb,
     }
 
     if (ctx->noop) {
+        /* Nothing to translate, get out of the way of the next reads */
+        ap_remove_input_filter(f);
         return ap_get_brigade(f->next, bb, mode, block, readbytes);
     }
 
@@ -111,8 +111,28 @@ typedef struct crypto_ctx
     int seen_eos:1;
     int encrypt:1;
     int clength:1;
+    int out_bucket:1;      /* ctx->out is handed to a heap bucket when full */
 } crypto_ctx;
 
+/**
+ * The key last imported on a connection, reused by its next requests
+ * when they have the same secret.
+ */
+typedef struct crypto_conn_key
+{
+    apr_pool_t *pool;
+    const apr_crypto_t *crypto;
+    apr_crypto_key_t *key;
+    apr_crypto_block_key_type_e type;
+    apr_crypto_block_key_mode_e mode;
+    int pad;
+    unsigned char *secret;
+    apr_size_t secretLen;
+} crypto_conn_key;
+
+/* The output buffers start with their size, for crypto_buffer_free() */
+#define CRYPTO_BUFFER_HDR APR_ALIGN_DEFAULT(sizeof(apr_size_t))
+
 static const char *parse_pass_conf_binary(cmd_parms *cmd,
                                           pass_conf * pass,
                                           const char *arg)
@@ -467,6 +487,115 @@ init_cipher(request_rec *r,
     return APR_SUCCESS;
 }
 
+/**
+ * Import the key of rec, or reuse the one imported by the previous
+ * request of the connection if it is the same. The key schedule is then
+ * set up once per connection rather than for each request.
+ */
+static apr_status_t crypto_conn_key_get(ap_filter_t * f,
+                                        const apr_crypto_key_rec_t * rec,
+                                        const apr_crypto_t * crypto,
+                                        apr_crypto_key_t ** key)
+{
+    conn_rec *c = f->c;
+    crypto_conn_key *ckey = ap_get_module_config(c->conn_config,
+                                                 &crypto_module);
+    apr_status_t rv;
+
+    if (ckey && ckey->key && ckey->crypto == crypto && ckey->type == rec->type
+        && ckey->mode == rec->mode && ckey->pad == rec->pad
+        && ckey->secretLen == rec->k.secret.secretLen
+        && !memcmp(ckey->secret, rec->k.secret.secret, ckey->secretLen)) {
+        *key = ckey->key;
+        return APR_SUCCESS;
+    }
+
+    if (!ckey) {
+        ckey = apr_pcalloc(c->pool, sizeof(*ckey));
+        apr_pool_create(&ckey->pool, c->pool);
+        apr_pool_tag(ckey->pool, "crypto_conn_key");
+        ap_set_module_config(c->conn_config, &crypto_module, ckey);
+    }
+    else {
+        /* replace the key of the previous request, which is done */
+        ckey->key = NULL;
+        apr_pool_clear(ckey->pool);
+    }
+
+    rv = apr_crypto_key(key, rec, crypto, ckey->pool);
+    if (APR_SUCCESS != rv) {
+        return rv;
+    }
+
+    ckey->secret = apr_pmemdup(ckey->pool, rec->k.secret.secret,
+                               rec->k.secret.secretLen);
+    apr_crypto_clear(ckey->pool, ckey->secret, rec->k.secret.secretLen);
+    ckey->secretLen = rec->k.secret.secretLen;
+    ckey->crypto = crypto;
+    ckey->type = rec->type;
+    ckey->mode = rec->mode;
+    ckey->pad = rec->pad;
+    ckey->key = *key;
+
+    return APR_SUCCESS;
+}
+
+static void crypto_buffer_free(void *data)
+{
+    char *buf = (char *) data - CRYPTO_BUFFER_HDR;
+
+    apr_crypto_memzero(buf, *(apr_size_t *) buf);
+    apr_bucket_free(buf);
+}
+
+/**
+ * Allocate an output buffer which can be handed to a heap bucket.
+ */
+static unsigned char *crypto_buffer_alloc(ap_filter_t * f, apr_size_t size)
+{
+    char *buf;
+
+    size += CRYPTO_BUFFER_HDR;
+    buf = apr_bucket_alloc(size, f->c->bucket_alloc);
+    *(apr_size_t *) buf = size;
+
+    return (unsigned char *) buf + CRYPTO_BUFFER_HDR;
+}
+
+/**
+ * Pass ctx->out on in a heap bucket instead of copying it, the next
+ * call to do_crypto() allocates a new buffer.
+ */
+static void crypto_buffer_pass(ap_filter_t * f, apr_size_t len)
+{
+    crypto_ctx *ctx = f->ctx;
+    apr_bucket *e;
+
+    if (!ctx->out) {
+        return;
+    }
+    if (!len) {
+        crypto_buffer_free(ctx->out);
+    }
+    else {
+        e = apr_bucket_heap_create((const char *) ctx->out, len,
+                                   crypto_buffer_free, f->c->bucket_alloc);
+        APR_BRIGADE_INSERT_TAIL(ctx->bb, e);
+    }
+    ctx->out = NULL;
+}
+
+static apr_status_t crypto_ctx_cleanup(void *data)
+{
+    crypto_ctx *ctx = data;
+
+    if (ctx->out_bucket && ctx->out) {
+        crypto_buffer_free(ctx->out);
+        ctx->out = NULL;
+    }
+    return APR_SUCCESS;
+}
+
 static apr_status_t init_crypt(ap_filter_t * f)
 {
     apr_status_t rv;
@@ -526,7 +655,7 @@ static apr_status_t init_crypt(ap_filter_t * f)
     }
 
     /* attempt to import the key */
-    rv = apr_crypto_key(&ctx->key, rec, *conf->crypto, f->r->pool);
+    rv = crypto_conn_key_get(f, rec, *conf->crypto, &ctx->key);
     if (APR_STATUS_IS_ENOKEY(rv)) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, f->r,
                       APLOGNO(03417) "key could not be loaded");
@@ -622,10 +751,16 @@ do_crypto(ap_filter_t * f, unsigned char *in, apr_off_t size, int finish)
                 ctx->osize += blockSize;
             }
 
-            out = ctx->out = apr_palloc(f->r->pool,
+            if (ctx->out_bucket) {
+                out = ctx->out = crypto_buffer_alloc(f,
                                         ctx->osize + ctx->cipher->blocksize);
-            apr_crypto_clear(f->r->pool, ctx->out,
-                             ctx->osize + ctx->cipher->blocksize);
+            }
+            else {
+                out = ctx->out = apr_palloc(f->r->pool,
+                                        ctx->osize + ctx->cipher->blocksize);
+                apr_crypto_clear(f->r->pool, ctx->out,
+                                 ctx->osize + ctx->cipher->blocksize);
+            }
 
             /* no precomputed iv? write the generated iv as the first block of the stream */
             if (need_iv && ctx->iv) {
@@ -664,10 +799,16 @@ do_crypto(ap_filter_t * f, unsigned char *in, apr_off_t size, int finish)
     else {
 
         if (!ctx->out) {
-            out = ctx->out = apr_palloc(f->r->pool,
+            if (ctx->out_bucket) {
+                out = ctx->out = crypto_buffer_alloc(f,
                                         ctx->osize + ctx->cipher->blocksize);
-            apr_crypto_clear(f->r->pool, ctx->out,
-                             ctx->osize + ctx->cipher->blocksize);
+            }
+            else {
+                out = ctx->out = apr_palloc(f->r->pool,
+                                        ctx->osize + ctx->cipher->blocksize);
+                apr_crypto_clear(f->r->pool, ctx->out,
+                                 ctx->osize + ctx->cipher->blocksize);
+            }
         }
         else {
             out = ctx->out + (ctx->osize - ctx->remaining);
@@ -745,6 +886,11 @@ crypto_out_filter(ap_filter_t * f, apr_bucket_brigade * bb)
     if (!ctx->clength) {
         ctx->clength = 1;
         apr_table_unset(f->r->headers_out, "Content-Length");
+
+        /* the full buffers are passed on as is */
+        ctx->out_bucket = 1;
+        apr_pool_cleanup_register(f->r->pool, ctx, crypto_ctx_cleanup,
+                                  apr_pool_cleanup_null);
     }
 
     /* make sure we fit in the buffer snugly */
@@ -763,8 +909,7 @@ crypto_out_filter(ap_filter_t * f, apr_bucket_brigade * bb)
 
             /* handle any leftovers */
             do_crypto(f, NULL, 0, 1);
-            apr_brigade_write(ctx->bb, NULL, NULL, (const char *) ctx->out,
-                              ctx->conf->size - ctx->remaining);
+            crypto_buffer_pass(f, ctx->conf->size - ctx->remaining);
             ctx->remaining = ctx->osize;
             ctx->written = 0;
             apr_brigade_partition(bb, ctx->remaining, &after);
@@ -816,8 +961,7 @@ crypto_out_filter(ap_filter_t * f, apr_bucket_brigade * bb)
             apr_bucket_delete(e);
 
             if (!ctx->remaining) {
-                apr_brigade_write(ctx->bb, NULL, NULL,
-                                  (const char *) ctx->out, ctx->written);
+                crypto_buffer_pass(f, ctx->written);
                 ctx->remaining = ctx->osize;
                 ctx->written = 0;
                 apr_brigade_partition(bb, ctx->remaining, &after);
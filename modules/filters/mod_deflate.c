@@ -46,6 +46,9 @@
 #include "http_protocol.h"
 #include "http_request.h"
 #include "http_ssl.h"
+#include "scoreboard.h"
+#include "ap_mpm.h"
+#include "apr_thread_mutex.h"
 #define APR_WANT_STRFUNC
 #include "apr_want.h"
 
@@ -66,6 +69,12 @@ typedef struct deflate_filter_config_t
     int windowSize;
     int memlevel;
     int compressionlevel;
+    /* responses of at least large_size bytes use large_level */
+    apr_off_t large_size;
+    int large_level;
+    /* with at least busy_percent busy workers, use busy_level (0: off) */
+    int busy_percent;
+    int busy_level;
     int bufferSize;
     const char *note_ratio_name;
     const char *note_input_name;
@@ -214,6 +223,8 @@ static void *create_deflate_server_config(apr_pool_t *p, server_rec *s)
     c->windowSize = DEFAULT_WINDOWSIZE;
     c->bufferSize = DEFAULT_BUFFERSIZE;
     c->compressionlevel = DEFAULT_COMPRESSION;
+    c->large_size = -1;
+    c->busy_percent = 0;
     c->etag_opt = AP_DEFLATE_ETAG_ADDSUFFIX;
 
     return c;
@@ -342,6 +353,60 @@ static const char *deflate_set_compressionlevel(cmd_parms *cmd, void *dummy,
 }
 
 
+static const char *deflate_set_compressionlevel_large(cmd_parms *cmd,
+                                                     void *dummy,
+                                                     const char *arg1,
+                                                     const char *arg2)
+{
+    deflate_filter_config *c = ap_get_module_config(cmd->server->module_config,
+                                                    &deflate_module);
+    char *end;
+    int i;
+
+    if (apr_strtoff(&c->large_size, arg1, &end, 10) != APR_SUCCESS || *end
+        || c->large_size < 0) {
+        return "DeflateCompressionLevelLarge size must be a non-negative "
+               "integer";
+    }
+
+    i = atoi(arg2);
+    if (i < 1 || i > 9)
+        return "Compression Level must be between 1 and 9";
+
+    c->large_level = i;
+
+    return NULL;
+}
+
+static const char *deflate_set_compressionlevel_busy(cmd_parms *cmd,
+                                                    void *dummy,
+                                                    const char *arg1,
+                                                    const char *arg2)
+{
+    deflate_filter_config *c = ap_get_module_config(cmd->server->module_config,
+                                                    &deflate_module);
+    int i;
+
+    i = atoi(arg1);
+    if (i < 1 || i > 100)
+        return "DeflateCompressionLevelBusy percentage must be between 1 "
+               "and 100";
+    c->busy_percent = i;
+
+    if (!ap_cstr_casecmp(arg2, "off")) {
+        c->busy_level = 0;
+        return NULL;
+    }
+
+    i = atoi(arg2);
+    if (i < 1 || i > 9)
+        return "Compression Level must be between 1 and 9, or 'off'";
+
+    c->busy_level = i;
+
+    return NULL;
+}
+
 static const char *deflate_set_inflate_limit(cmd_parms *cmd, void *dirconf,
                                       const char *arg)
 {
@@ -392,7 +457,7 @@ static const char *deflate_set_inflate_ratio_burst(cmd_parms *cmd,
 
 typedef struct deflate_ctx_t
 {
-    z_stream stream;
+    z_stream *stream;
     unsigned char *buffer;
     unsigned long crc;
     apr_bucket_brigade *bb, *proc_bb;
@@ -435,8 +500,8 @@ static void consume_buffer(deflate_ctx *ctx, deflate_filter_config *c,
                                bb->bucket_alloc);
     APR_BRIGADE_INSERT_TAIL(bb, b);
 
-    ctx->stream.next_out = ctx->buffer;
-    ctx->stream.avail_out = c->bufferSize;
+    ctx->stream->next_out = ctx->buffer;
+    ctx->stream->avail_out = c->bufferSize;
 }
 
 static int flush_libz_buffer(deflate_ctx *ctx, deflate_filter_config *c,
@@ -448,7 +513,7 @@ static int flush_libz_buffer(deflate_ctx *ctx, deflate_filter_config *c,
     int deflate_len;
 
     for (;;) {
-         deflate_len = c->bufferSize - ctx->stream.avail_out;
+         deflate_len = c->bufferSize - ctx->stream->avail_out;
          if (deflate_len > 0) {
              consume_buffer(ctx, c, deflate_len, crc, ctx->bb);
          }
@@ -456,7 +521,7 @@ static int flush_libz_buffer(deflate_ctx *ctx, deflate_filter_config *c,
          if (done)
              break;
 
-         zRC = libz_func(&ctx->stream, flush);
+         zRC = libz_func(ctx->stream, flush);
 
          /*
           * We can ignore Z_BUF_ERROR because:
@@ -475,7 +540,7 @@ static int flush_libz_buffer(deflate_ctx *ctx, deflate_filter_config *c,
              break;
          }
 
-         done = (ctx->stream.avail_out != 0 || zRC == Z_STREAM_END);
+         done = (ctx->stream->avail_out != 0 || zRC == Z_STREAM_END);
 
          if (zRC != Z_OK && zRC != Z_STREAM_END)
              break;
@@ -488,10 +553,119 @@ static apr_status_t deflate_ctx_cleanup(void *data)
     deflate_ctx *ctx = (deflate_ctx *)data;
 
     if (ctx)
-        ctx->libz_end_func(&ctx->stream);
+        ctx->libz_end_func(ctx->stream);
     return APR_SUCCESS;
 }
 
+/*
+ * Deflate streams are kept for reuse by later responses of the child
+ * (DeflateStreamCache), so that compressing a small response does not
+ * cost the allocation of zlib's window and hash tables each time.
+ * A stream is handed to the next response with the same parameters
+ * once deflateReset() has returned it to its initial state.
+ */
+typedef struct deflate_stream_t deflate_stream;
+struct deflate_stream_t {
+    z_stream stream;             /* first, see deflate_stream_release() */
+    deflate_stream *next;
+    int level;
+    int windowSize;
+    int memlevel;
+};
+
+static int stream_max = 0, stream_nelts;
+static deflate_stream *stream_free;
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *stream_mutex;
+#endif
+
+static void stream_lock(void)
+{
+#if APR_HAS_THREADS
+    if (stream_mutex) {
+        apr_thread_mutex_lock(stream_mutex);
+    }
+#endif
+}
+
+static void stream_unlock(void)
+{
+#if APR_HAS_THREADS
+    if (stream_mutex) {
+        apr_thread_mutex_unlock(stream_mutex);
+    }
+#endif
+}
+
+static int deflate_stream_acquire(deflate_ctx *ctx, deflate_filter_config *c,
+                                  int level)
+{
+    deflate_stream *ds = NULL, **prev;
+    int zRC;
+
+    if (stream_max) {
+        stream_lock();
+        for (prev = &stream_free; *prev; prev = &(*prev)->next) {
+            if ((*prev)->level == level
+                && (*prev)->windowSize == c->windowSize
+                && (*prev)->memlevel == c->memlevel) {
+                ds = *prev;
+                *prev = ds->next;
+                stream_nelts--;
+                break;
+            }
+        }
+        stream_unlock();
+        if (ds) {
+            ctx->stream = &ds->stream;
+            return Z_OK;
+        }
+    }
+
+    ds = ap_calloc(1, sizeof(*ds));
+    ds->level = level;
+    ds->windowSize = c->windowSize;
+    ds->memlevel = c->memlevel;
+
+    zRC = deflateInit2(&ds->stream, level, Z_DEFLATED, c->windowSize,
+                       c->memlevel, Z_DEFAULT_STRATEGY);
+    if (zRC != Z_OK) {
+        deflateEnd(&ds->stream);
+        free(ds);
+        return zRC;
+    }
+
+    ctx->stream = &ds->stream;
+    return Z_OK;
+}
+
+/* The libz_end_func of streams from deflate_stream_acquire() */
+static int deflate_stream_release(z_streamp strm)
+{
+    deflate_stream *ds = (deflate_stream *)strm;
+
+    if (stream_max && deflateReset(strm) == Z_OK) {
+        strm->next_in = strm->next_out = NULL;
+        strm->avail_in = strm->avail_out = 0;
+
+        stream_lock();
+        if (stream_nelts < stream_max) {
+            ds->next = stream_free;
+            stream_free = ds;
+            stream_nelts++;
+            ds = NULL;
+        }
+        stream_unlock();
+        if (!ds) {
+            return Z_OK;
+        }
+    }
+
+    deflateEnd(strm);
+    free(ds);
+    return Z_OK;
+}
+
 /* ETag must be unique among the possible representations, so a change
  * to content-encoding requires a corresponding change to the ETag.
  * This routine appends -transform (e.g., -gzip) to the entity-tag
@@ -537,8 +711,8 @@ static void deflate_check_etag(request_rec *r, const char *transform, int etag_o
 static int check_ratio(request_rec *r, deflate_ctx *ctx,
                        const deflate_dirconf_t *dc)
 {
-    if (ctx->stream.total_in) {
-        int ratio = ctx->stream.total_out / ctx->stream.total_in;
+    if (ctx->stream->total_in) {
+        int ratio = ctx->stream->total_out / ctx->stream->total_in;
         if (ratio < dc->ratio_limit) {
             ctx->ratio_hits = 0;
         }
@@ -588,6 +762,7 @@ static apr_status_t deflate_out_filter(ap_filter_t *f,
     if (!ctx) {
         char *token;
         const char *encoding;
+        int level;
 
         if (have_ssl_compression(r)) {
             ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r,
@@ -789,6 +964,40 @@ static apr_status_t deflate_out_filter(ap_filter_t *f,
                           "Forcing compression (force-gzip set)");
         }
 
+        /* Lower the level for large responses, and when the server is busy
+         * (possibly down to not compressing at all) so that overload does
+         * not get worse for the CPU time we spend here.
+         */
+        level = c->compressionlevel;
+        if (c->large_size >= 0) {
+            const char *clength = apr_table_get(r->headers_out,
+                                                "Content-Length");
+            apr_off_t length = -1;
+
+            if (clength) {
+                if (!ap_parse_strict_length(&length, clength)) {
+                    length = -1;
+                }
+            }
+            else if (APR_BUCKET_IS_EOS(APR_BRIGADE_LAST(bb))) {
+                apr_brigade_length(bb, 0, &length);
+            }
+            if (length >= c->large_size) {
+                level = c->large_level;
+            }
+        }
+        if (c->busy_percent && ap_sb_busy_percent() >= c->busy_percent) {
+            if (!c->busy_level) {
+                ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r,
+                              "Not compressing (server busy)");
+                ap_remove_output_filter(f);
+                return ap_pass_brigade(f->next, bb);
+            }
+            if (c->busy_level < level) {
+                level = c->busy_level;
+            }
+        }
+
         /* At this point we have decided to filter the content. Let's try to
          * to initialize zlib (except for 304 responses, where we will only
          * send out the headers).
@@ -797,14 +1006,11 @@ static apr_status_t deflate_out_filter(ap_filter_t *f,
         if (r->status != HTTP_NOT_MODIFIED) {
             ctx->bb = apr_brigade_create(r->pool, f->c->bucket_alloc);
             ctx->buffer = apr_palloc(r->pool, c->bufferSize);
-            ctx->libz_end_func = deflateEnd;
+            ctx->libz_end_func = deflate_stream_release;
 
-            zRC = deflateInit2(&ctx->stream, c->compressionlevel, Z_DEFLATED,
-                               c->windowSize, c->memlevel,
-                               Z_DEFAULT_STRATEGY);
+            zRC = deflate_stream_acquire(ctx, c, level);
 
             if (zRC != Z_OK) {
-                deflateEnd(&ctx->stream);
                 ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01383)
                               "unable to init Zlib: "
                               "deflateInit2 returned %d: URL %s",
@@ -865,8 +1071,8 @@ static apr_status_t deflate_out_filter(ap_filter_t *f,
         APR_BRIGADE_INSERT_TAIL(ctx->bb, e);
 
         /* initialize deflate output buffer */
-        ctx->stream.next_out = ctx->buffer;
-        ctx->stream.avail_out = c->bufferSize;
+        ctx->stream->next_out = ctx->buffer;
+        ctx->stream->avail_out = c->bufferSize;
     } else if (!ctx->filter_init) {
         /* Hmm.  We've run through the filter init before as we have a ctx,
          * but we never initialized.  We probably have a dangling ref.  Bail.
@@ -896,13 +1102,13 @@ static apr_status_t deflate_out_filter(ap_filter_t *f,
         if (APR_BUCKET_IS_EOS(e)) {
             char *buf;
 
-            ctx->stream.avail_in = 0; /* should be zero already anyway */
+            ctx->stream->avail_in = 0; /* should be zero already anyway */
             /* flush the remaining data from the zlib buffers */
             flush_libz_buffer(ctx, c, deflate, Z_FINISH, NO_UPDATE_CRC);
 
             buf = apr_palloc(r->pool, VALIDATION_SIZE);
             putLong((unsigned char *)&buf[0], ctx->crc);
-            putLong((unsigned char *)&buf[4], ctx->stream.total_in);
+            putLong((unsigned char *)&buf[4], ctx->stream->total_in);
 
             b = apr_bucket_pool_create(buf, VALIDATION_SIZE, r->pool,
                                        f->c->bucket_alloc);
@@ -910,39 +1116,42 @@ static apr_status_t deflate_out_filter(ap_filter_t *f,
             ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(01384)
                           "Zlib: Compressed %" APR_UINT64_T_FMT
                           " to %" APR_UINT64_T_FMT " : URL %s",
-                          (apr_uint64_t)ctx->stream.total_in,
-                          (apr_uint64_t)ctx->stream.total_out, r->uri);
+                          (apr_uint64_t)ctx->stream->total_in,
+                          (apr_uint64_t)ctx->stream->total_out, r->uri);
 
             /* leave notes for logging */
             if (c->note_input_name) {
                 apr_table_setn(r->notes, c->note_input_name,
-                               (ctx->stream.total_in > 0)
+                               (ctx->stream->total_in > 0)
                                 ? apr_off_t_toa(r->pool,
-                                                ctx->stream.total_in)
+                                                ctx->stream->total_in)
                                 : "-");
             }
 
             if (c->note_output_name) {
                 apr_table_setn(r->notes, c->note_output_name,
-                               (ctx->stream.total_out > 0)
+                               (ctx->stream->total_out > 0)
                                 ? apr_off_t_toa(r->pool,
-                                                ctx->stream.total_out)
+                                                ctx->stream->total_out)
                                 : "-");
             }
 
             if (c->note_ratio_name) {
                 apr_table_setn(r->notes, c->note_ratio_name,
-                               (ctx->stream.total_in > 0)
+                               (ctx->stream->total_in > 0)
                                 ? apr_itoa(r->pool,
-                                           (int)(ctx->stream.total_out
+                                           (int)(ctx->stream->total_out
                                                  * 100
-                                                 / ctx->stream.total_in))
+                                                 / ctx->stream->total_in))
                                 : "-");
             }
 
-            deflateEnd(&ctx->stream);
+            deflate_stream_release(ctx->stream);
             /* No need for cleanup any longer */
             apr_pool_cleanup_kill(r->pool, ctx, deflate_ctx_cleanup);
+            /* The stream may be someone else's now */
+            ctx->stream = NULL;
+            ctx->filter_init = 0;
 
             /* Remove EOS from the old list, and insert into the new. */
             APR_BUCKET_REMOVE(e);
@@ -963,7 +1172,7 @@ static apr_status_t deflate_out_filter(ap_filter_t *f,
             if (zRC != Z_OK) {
                 ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01385)
                               "Zlib error %d flushing zlib output buffer (%s)",
-                              zRC, ctx->stream.msg);
+                              zRC, ctx->stream->msg);
                 return APR_EGENERAL;
             }
 
@@ -1008,13 +1217,13 @@ static apr_status_t deflate_out_filter(ap_filter_t *f,
         ctx->crc = crc32(ctx->crc, (const Bytef *)data, len);
 
         /* write */
-        ctx->stream.next_in = (unsigned char *)data; /* We just lost const-ness,
-                                                      * but we'll just have to
-                                                      * trust zlib */
-        ctx->stream.avail_in = (int)len;
+        ctx->stream->next_in = (unsigned char *)data; /* We just lost const-ness,
+                                                       * but we'll just have to
+                                                       * trust zlib */
+        ctx->stream->avail_in = (int)len;
 
-        while (ctx->stream.avail_in != 0) {
-            if (ctx->stream.avail_out == 0) {
+        while (ctx->stream->avail_in != 0) {
+            if (ctx->stream->avail_out == 0) {
                 consume_buffer(ctx, c, c->bufferSize, NO_UPDATE_CRC, ctx->bb);
 
                 /* Send what we have right now to the next filter. */
@@ -1025,12 +1234,12 @@ static apr_status_t deflate_out_filter(ap_filter_t *f,
                 }
             }
 
-            zRC = deflate(&(ctx->stream), Z_NO_FLUSH);
+            zRC = deflate(ctx->stream, Z_NO_FLUSH);
 
             if (zRC != Z_OK) {
                 ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01386)
                               "Zlib error %d deflating data (%s)", zRC,
-                              ctx->stream.msg);
+                              ctx->stream->msg);
                 return APR_EGENERAL;
             }
         }
@@ -1184,6 +1393,7 @@ static apr_status_t deflate_in_filter(ap_filter_t *f,
             }
 
             f->ctx = ctx = apr_pcalloc(f->r->pool, sizeof(*ctx));
+            ctx->stream = apr_pcalloc(r->pool, sizeof(*ctx->stream));
             ctx->bb = apr_brigade_create(r->pool, f->c->bucket_alloc);
             ctx->proc_bb = apr_brigade_create(r->pool, f->c->bucket_alloc);
             ctx->buffer = apr_palloc(r->pool, c->bufferSize);
@@ -1250,11 +1460,11 @@ static apr_status_t deflate_in_filter(ap_filter_t *f,
             return APR_EGENERAL;
         }
 
-        zRC = inflateInit2(&ctx->stream, c->windowSize);
+        zRC = inflateInit2(ctx->stream, c->windowSize);
 
         if (zRC != Z_OK) {
             f->ctx = NULL;
-            inflateEnd(&ctx->stream);
+            inflateEnd(ctx->stream);
             ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01389)
                           "unable to init Zlib: "
                           "inflateInit2 returned %d: URL %s",
@@ -1264,8 +1474,8 @@ static apr_status_t deflate_in_filter(ap_filter_t *f,
         }
 
         /* initialize deflate output buffer */
-        ctx->stream.next_out = ctx->buffer;
-        ctx->stream.avail_out = c->bufferSize;
+        ctx->stream->next_out = ctx->buffer;
+        ctx->stream->avail_out = c->bufferSize;
 
         apr_brigade_cleanup(ctx->bb);
     }
@@ -1288,7 +1498,7 @@ static apr_status_t deflate_in_filter(ap_filter_t *f,
             return rv;
         }
         if (rv != APR_SUCCESS) {
-            inflateEnd(&ctx->stream);
+            inflateEnd(ctx->stream);
             return rv;
         }
 
@@ -1301,7 +1511,7 @@ static apr_status_t deflate_in_filter(ap_filter_t *f,
 
             if (APR_BUCKET_IS_EOS(bkt)) {
                 if (!ctx->done) {
-                    inflateEnd(&ctx->stream);
+                    inflateEnd(ctx->stream);
                     ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(02481)
                                   "Encountered premature end-of-stream while inflating");
                     return APR_EGENERAL;
@@ -1317,19 +1527,19 @@ static apr_status_t deflate_in_filter(ap_filter_t *f,
                 apr_bucket *tmp_b;
 
                 if (!ctx->done) {
-                    ctx->inflate_total += ctx->stream.avail_out;
-                    zRC = inflate(&(ctx->stream), Z_SYNC_FLUSH);
-                    ctx->inflate_total -= ctx->stream.avail_out;
+                    ctx->inflate_total += ctx->stream->avail_out;
+                    zRC = inflate(ctx->stream, Z_SYNC_FLUSH);
+                    ctx->inflate_total -= ctx->stream->avail_out;
                     if (zRC != Z_OK) {
-                        inflateEnd(&ctx->stream);
+                        inflateEnd(ctx->stream);
                         ap_log_rerror(APLOG_MARK, APLOG_WARNING, 0, r, APLOGNO(01391)
                                       "Zlib error %d inflating data (%s)", zRC,
-                                      ctx->stream.msg);
+                                      ctx->stream->msg);
                         return APR_EGENERAL;
                     }
  
                     if (inflate_limit && ctx->inflate_total > inflate_limit) { 
-                        inflateEnd(&ctx->stream);
+                        inflateEnd(ctx->stream);
                         ap_log_rerror(APLOG_MARK, APLOG_WARNING, 0, r, APLOGNO(02647)
                                       "Inflated content length of %" APR_OFF_T_FMT
                                       " is larger than the configured limit"
@@ -1339,7 +1549,7 @@ static apr_status_t deflate_in_filter(ap_filter_t *f,
                     }
 
                     if (!check_ratio(r, ctx, dc)) {
-                        inflateEnd(&ctx->stream);
+                        inflateEnd(ctx->stream);
                         ap_log_rerror(APLOG_MARK, APLOG_WARNING, 0, r, APLOGNO(02805)
                                       "Inflated content ratio is larger than the "
                                       "configured limit %i by %i time(s)",
@@ -1347,7 +1557,7 @@ static apr_status_t deflate_in_filter(ap_filter_t *f,
                         return APR_EINVAL;
                     }
 
-                    consume_buffer(ctx, c, c->bufferSize - ctx->stream.avail_out,
+                    consume_buffer(ctx, c, c->bufferSize - ctx->stream->avail_out,
                                    UPDATE_CRC, ctx->proc_bb);
                 }
 
@@ -1389,29 +1599,29 @@ static apr_status_t deflate_in_filter(ap_filter_t *f,
             }
 
             /* pass through zlib inflate. */
-            ctx->stream.next_in = (unsigned char *)data;
-            ctx->stream.avail_in = (int)len;
+            ctx->stream->next_in = (unsigned char *)data;
+            ctx->stream->avail_in = (int)len;
 
             if (!ctx->validation_buffer) {
-                while (ctx->stream.avail_in != 0) {
-                    if (ctx->stream.avail_out == 0) {
+                while (ctx->stream->avail_in != 0) {
+                    if (ctx->stream->avail_out == 0) {
                         consume_buffer(ctx, c, c->bufferSize, UPDATE_CRC,
                                        ctx->proc_bb);
                     }
 
-                    ctx->inflate_total += ctx->stream.avail_out;
-                    zRC = inflate(&ctx->stream, Z_NO_FLUSH);
-                    ctx->inflate_total -= ctx->stream.avail_out;
+                    ctx->inflate_total += ctx->stream->avail_out;
+                    zRC = inflate(ctx->stream, Z_NO_FLUSH);
+                    ctx->inflate_total -= ctx->stream->avail_out;
                     if (zRC != Z_OK && zRC != Z_STREAM_END) {
-                        inflateEnd(&ctx->stream);
+                        inflateEnd(ctx->stream);
                         ap_log_rerror(APLOG_MARK, APLOG_WARNING, 0, r, APLOGNO(01392)
                                       "Zlib error %d inflating data (%s)", zRC,
-                                      ctx->stream.msg);
+                                      ctx->stream->msg);
                         return APR_EGENERAL;
                     }
 
                     if (inflate_limit && ctx->inflate_total > inflate_limit) { 
-                        inflateEnd(&ctx->stream);
+                        inflateEnd(ctx->stream);
                         ap_log_rerror(APLOG_MARK, APLOG_WARNING, 0, r, APLOGNO(02648)
                                 "Inflated content length of %" APR_OFF_T_FMT
                                 " is larger than the configured limit"
@@ -1421,7 +1631,7 @@ static apr_status_t deflate_in_filter(ap_filter_t *f,
                     }
 
                     if (!check_ratio(r, ctx, dc)) {
-                        inflateEnd(&ctx->stream);
+                        inflateEnd(ctx->stream);
                         ap_log_rerror(APLOG_MARK, APLOG_WARNING, 0, r, APLOGNO(02649)
                                 "Inflated content ratio is larger than the "
                                 "configured limit %i by %i time(s)",
@@ -1442,7 +1652,7 @@ static apr_status_t deflate_in_filter(ap_filter_t *f,
                 apr_size_t avail, valid;
                 unsigned char *buf = ctx->validation_buffer;
 
-                avail = ctx->stream.avail_in;
+                avail = ctx->stream->avail_in;
                 valid = (apr_size_t)VALIDATION_SIZE -
                          ctx->validation_buffer_length;
 
@@ -1453,46 +1663,46 @@ static apr_status_t deflate_in_filter(ap_filter_t *f,
                  */
                 if (avail < valid) {
                     memcpy(buf + ctx->validation_buffer_length,
-                           ctx->stream.next_in, avail);
+                           ctx->stream->next_in, avail);
                     ctx->validation_buffer_length += avail;
                     continue;
                 }
                 memcpy(buf + ctx->validation_buffer_length,
-                       ctx->stream.next_in, valid);
+                       ctx->stream->next_in, valid);
                 ctx->validation_buffer_length += valid;
 
                 ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(01393)
                               "Zlib: Inflated %" APR_UINT64_T_FMT
                               " to %" APR_UINT64_T_FMT " : URL %s",
-                              (apr_uint64_t)ctx->stream.total_in,
-                              (apr_uint64_t)ctx->stream.total_out, r->uri);
+                              (apr_uint64_t)ctx->stream->total_in,
+                              (apr_uint64_t)ctx->stream->total_out, r->uri);
 
-                consume_buffer(ctx, c, c->bufferSize - ctx->stream.avail_out,
+                consume_buffer(ctx, c, c->bufferSize - ctx->stream->avail_out,
                                UPDATE_CRC, ctx->proc_bb);
 
                 {
                     unsigned long compCRC, compLen;
                     compCRC = getLong(buf);
                     if (ctx->crc != compCRC) {
-                        inflateEnd(&ctx->stream);
+                        inflateEnd(ctx->stream);
                         ap_log_rerror(APLOG_MARK, APLOG_WARNING, 0, r, APLOGNO(01394)
                                       "Zlib: CRC error inflating data");
                         return APR_EGENERAL;
                     }
                     compLen = getLong(buf + VALIDATION_SIZE / 2);
                     /* gzip stores original size only as 4 byte value */
-                    if ((ctx->stream.total_out & 0xFFFFFFFF) != compLen) {
-                        inflateEnd(&ctx->stream);
+                    if ((ctx->stream->total_out & 0xFFFFFFFF) != compLen) {
+                        inflateEnd(ctx->stream);
                         ap_log_rerror(APLOG_MARK, APLOG_WARNING, 0, r, APLOGNO(01395)
                                       "Zlib: Length %" APR_UINT64_T_FMT
                                       " of inflated data does not match"
                                       " expected value %ld",
-                                      (apr_uint64_t)ctx->stream.total_out, compLen);
+                                      (apr_uint64_t)ctx->stream->total_out, compLen);
                         return APR_EGENERAL;
                     }
                 }
 
-                inflateEnd(&ctx->stream);
+                inflateEnd(ctx->stream);
 
                 ctx->done = 1;
 
@@ -1513,8 +1723,8 @@ static apr_status_t deflate_in_filter(ap_filter_t *f,
      */
     if (block == APR_BLOCK_READ &&
             APR_BRIGADE_EMPTY(ctx->proc_bb) &&
-            ctx->stream.avail_out < c->bufferSize) {
-        consume_buffer(ctx, c, c->bufferSize - ctx->stream.avail_out,
+            ctx->stream->avail_out < c->bufferSize) {
+        consume_buffer(ctx, c, c->bufferSize - ctx->stream->avail_out,
                        UPDATE_CRC, ctx->proc_bb);
     }
 
@@ -1592,17 +1802,18 @@ static apr_status_t inflate_out_filter(ap_filter_t *f,
         }
 
         f->ctx = ctx = apr_pcalloc(f->r->pool, sizeof(*ctx));
+        ctx->stream = apr_pcalloc(r->pool, sizeof(*ctx->stream));
         ctx->bb = apr_brigade_create(r->pool, f->c->bucket_alloc);
         ctx->buffer = apr_palloc(r->pool, c->bufferSize);
         ctx->libz_end_func = inflateEnd;
         ctx->validation_buffer = NULL;
         ctx->validation_buffer_length = 0;
 
-        zRC = inflateInit2(&ctx->stream, c->windowSize);
+        zRC = inflateInit2(ctx->stream, c->windowSize);
 
         if (zRC != Z_OK) {
             f->ctx = NULL;
-            inflateEnd(&ctx->stream);
+            inflateEnd(ctx->stream);
             ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01397)
                           "unable to init Zlib: "
                           "inflateInit2 returned %d: URL %s",
@@ -1624,8 +1835,8 @@ static apr_status_t inflate_out_filter(ap_filter_t *f,
                                   apr_pool_cleanup_null);
 
         /* initialize inflate output buffer */
-        ctx->stream.next_out = ctx->buffer;
-        ctx->stream.avail_out = c->bufferSize;
+        ctx->stream->next_out = ctx->buffer;
+        ctx->stream->avail_out = c->bufferSize;
     }
 
     while (!APR_BRIGADE_EMPTY(bb))
@@ -1643,7 +1854,7 @@ static apr_status_t inflate_out_filter(ap_filter_t *f,
              */
             ap_remove_output_filter(f);
             /* should be zero already anyway */
-            ctx->stream.avail_in = 0;
+            ctx->stream->avail_in = 0;
             /*
              * Flush the remaining data from the zlib buffers. It is correct
              * to use Z_SYNC_FLUSH in this case and not Z_FINISH as in the
@@ -1656,8 +1867,8 @@ static apr_status_t inflate_out_filter(ap_filter_t *f,
             ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(01398)
                           "Zlib: Inflated %" APR_UINT64_T_FMT 
                           " to %" APR_UINT64_T_FMT " : URL %s",
-                          (apr_uint64_t)ctx->stream.total_in,
-                          (apr_uint64_t)ctx->stream.total_out, r->uri);
+                          (apr_uint64_t)ctx->stream->total_in,
+                          (apr_uint64_t)ctx->stream->total_out, r->uri);
 
             if (ctx->validation_buffer_length == VALIDATION_SIZE) {
                 unsigned long compCRC, compLen;
@@ -1670,7 +1881,7 @@ static apr_status_t inflate_out_filter(ap_filter_t *f,
                 ctx->validation_buffer += VALIDATION_SIZE / 2;
                 compLen = getLong(ctx->validation_buffer);
                 /* gzip stores original size only as 4 byte value */
-                if ((ctx->stream.total_out & 0xFFFFFFFF) != compLen) {
+                if ((ctx->stream->total_out & 0xFFFFFFFF) != compLen) {
                     ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01400)
                                   "Zlib: Length of inflated stream invalid");
                     return APR_EGENERAL;
@@ -1682,7 +1893,7 @@ static apr_status_t inflate_out_filter(ap_filter_t *f,
                 return APR_EGENERAL;
             }
 
-            inflateEnd(&ctx->stream);
+            inflateEnd(ctx->stream);
             /* No need for cleanup any longer */
             apr_pool_cleanup_kill(r->pool, ctx, deflate_ctx_cleanup);
 
@@ -1711,7 +1922,7 @@ static apr_status_t inflate_out_filter(ap_filter_t *f,
             else if (zRC != Z_OK) {
                 ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01402)
                               "Zlib error %d flushing inflate buffer (%s)",
-                              zRC, ctx->stream.msg);
+                              zRC, ctx->stream->msg);
                 return APR_EGENERAL;
             }
 
@@ -1803,39 +2014,39 @@ static apr_status_t inflate_out_filter(ap_filter_t *f,
         }
 
         /* pass through zlib inflate. */
-        ctx->stream.next_in = (unsigned char *)data;
-        ctx->stream.avail_in = len;
+        ctx->stream->next_in = (unsigned char *)data;
+        ctx->stream->avail_in = len;
 
         if (ctx->validation_buffer) {
             if (ctx->validation_buffer_length < VALIDATION_SIZE) {
                 apr_size_t copy_size;
 
                 copy_size = VALIDATION_SIZE - ctx->validation_buffer_length;
-                if (copy_size > ctx->stream.avail_in)
-                    copy_size = ctx->stream.avail_in;
+                if (copy_size > ctx->stream->avail_in)
+                    copy_size = ctx->stream->avail_in;
                 memcpy(ctx->validation_buffer + ctx->validation_buffer_length,
-                       ctx->stream.next_in, copy_size);
+                       ctx->stream->next_in, copy_size);
                 /* Saved copy_size bytes */
-                ctx->stream.avail_in -= copy_size;
+                ctx->stream->avail_in -= copy_size;
                 ctx->validation_buffer_length += copy_size;
             }
-            if (ctx->stream.avail_in) {
+            if (ctx->stream->avail_in) {
                 ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(01407)
                               "Zlib: %d bytes of garbage at the end of "
-                              "compressed stream.", ctx->stream.avail_in);
+                              "compressed stream.", ctx->stream->avail_in);
                 /*
                  * There is nothing worth consuming for zlib left, because it is
                  * either garbage data or the data has been copied to the
                  * validation buffer (processing validation data is no business
-                 * for zlib). So set ctx->stream.avail_in to zero to indicate
+                 * for zlib). So set ctx->stream->avail_in to zero to indicate
                  * this to the following while loop.
                  */
-                ctx->stream.avail_in = 0;
+                ctx->stream->avail_in = 0;
             }
         }
 
-        while (ctx->stream.avail_in != 0) {
-            if (ctx->stream.avail_out == 0) {
+        while (ctx->stream->avail_in != 0) {
+            if (ctx->stream->avail_out == 0) {
                 consume_buffer(ctx, c, c->bufferSize, UPDATE_CRC, ctx->bb);
 
                 /* Send what we have right now to the next filter. */
@@ -1846,12 +2057,12 @@ static apr_status_t inflate_out_filter(ap_filter_t *f,
                 }
             }
 
-            zRC = inflate(&ctx->stream, Z_NO_FLUSH);
+            zRC = inflate(ctx->stream, Z_NO_FLUSH);
 
             if (zRC != Z_OK && zRC != Z_STREAM_END) {
                 ap_log_rerror(APLOG_MARK, APLOG_WARNING, 0, r, APLOGNO(01409)
                               "Zlib error %d inflating data (%s)", zRC,
-                              ctx->stream.msg);
+                              ctx->stream->msg);
                 return APR_EGENERAL;
             }
 
@@ -1872,18 +2083,18 @@ static apr_status_t inflate_out_filter(ap_filter_t *f,
                  */
                 ctx->validation_buffer = apr_pcalloc(f->r->pool,
                                                      VALIDATION_SIZE);
-                if (ctx->stream.avail_in > VALIDATION_SIZE) {
+                if (ctx->stream->avail_in > VALIDATION_SIZE) {
                     ctx->validation_buffer_length = VALIDATION_SIZE;
                     ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(01408)
                                   "Zlib: %d bytes of garbage at the end of "
                                   "compressed stream.",
-                                  ctx->stream.avail_in - VALIDATION_SIZE);
+                                  ctx->stream->avail_in - VALIDATION_SIZE);
                 }
-                else if (ctx->stream.avail_in > 0) {
-                    ctx->validation_buffer_length = ctx->stream.avail_in;
+                else if (ctx->stream->avail_in > 0) {
+                    ctx->validation_buffer_length = ctx->stream->avail_in;
                 }
                 if (ctx->validation_buffer_length)
-                    memcpy(ctx->validation_buffer, ctx->stream.next_in,
+                    memcpy(ctx->validation_buffer, ctx->stream->next_in,
                            ctx->validation_buffer_length);
                 break;
             }
@@ -1895,12 +2106,64 @@ static apr_status_t inflate_out_filter(ap_filter_t *f,
     return APR_SUCCESS;
 }
 
+static const char *deflate_set_stream_cache(cmd_parms *cmd, void *dummy,
+                                            const char *arg)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+
+    if (err != NULL) {
+        return err;
+    }
+
+    stream_max = atoi(arg);
+    if (stream_max < 0) {
+        return "DeflateStreamCache must be a non-negative integer";
+    }
+
+    return NULL;
+}
+
+static int mod_deflate_pre_config(apr_pool_t *pconf, apr_pool_t *plog,
+                                  apr_pool_t *ptemp)
+{
+    stream_max = 0;
+    return OK;
+}
+
 static int mod_deflate_post_config(apr_pool_t *pconf, apr_pool_t *plog,
                                    apr_pool_t *ptemp, server_rec *s)
 {
     return OK;
 }
 
+static void mod_deflate_child_init(apr_pool_t *pchild, server_rec *s)
+{
+#if APR_HAS_THREADS
+    int threaded = 0;
+    apr_status_t rv;
+#endif
+
+    stream_nelts = 0;
+    stream_free = NULL;
+    if (!stream_max) {
+        return;
+    }
+
+#if APR_HAS_THREADS
+    ap_mpm_query(AP_MPMQ_IS_THREADED, &threaded);
+    if (threaded) {
+        rv = apr_thread_mutex_create(&stream_mutex, APR_THREAD_MUTEX_DEFAULT,
+                                     pchild);
+        if (rv != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10444)
+                         "could not create the DeflateStreamCache mutex, "
+                         "streams will not be reused");
+            stream_max = 0;
+        }
+    }
+#endif
+}
+
 
 #define PROTO_FLAGS AP_FILTER_PROTO_CHANGE|AP_FILTER_PROTO_CHANGE_LENGTH
 static void register_hooks(apr_pool_t *p)
@@ -1911,7 +2174,9 @@ static void register_hooks(apr_pool_t *p)
                               AP_FTYPE_RESOURCE-1);
     ap_register_input_filter(deflateFilterName, deflate_in_filter, NULL,
                               AP_FTYPE_CONTENT_SET);
+    ap_hook_pre_config(mod_deflate_pre_config, NULL, NULL, APR_HOOK_MIDDLE);
     ap_hook_post_config(mod_deflate_post_config, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_child_init(mod_deflate_child_init, NULL, NULL, APR_HOOK_MIDDLE);
 }
 
 static const command_rec deflate_filter_cmds[] = {
@@ -1925,6 +2190,12 @@ static const command_rec deflate_filter_cmds[] = {
                   "Set the Deflate Memory Level (1-9)"),
     AP_INIT_TAKE1("DeflateCompressionLevel", deflate_set_compressionlevel, NULL, RSRC_CONF,
                   "Set the Deflate Compression Level (1-9)"),
+    AP_INIT_TAKE2("DeflateCompressionLevelLarge", deflate_set_compressionlevel_large, NULL, RSRC_CONF,
+                  "Set the size from which responses of known length are compressed at the given level (1-9)"),
+    AP_INIT_TAKE2("DeflateCompressionLevelBusy", deflate_set_compressionlevel_busy, NULL, RSRC_CONF,
+                  "Set the percentage of busy workers from which the given level (1-9) or 'off' is used"),
+    AP_INIT_TAKE1("DeflateStreamCache", deflate_set_stream_cache, NULL, RSRC_CONF,
+                  "Set the number of deflate streams each child keeps for reuse"),
     AP_INIT_TAKE1("DeflateAlterEtag", deflate_set_etag, NULL, RSRC_CONF,
                   "Set how mod_deflate should modify ETAG response headers: 'AddSuffix' (default), 'NoChange' (2.2.x behavior), 'Remove'"),
     AP_INIT_TAKE1("DeflateInflateLimitRequestBody", deflate_set_inflate_limit, NULL, OR_ALL,
@@ -21,6 +21,9 @@
 #include "apr_user.h"
 #include "apr_lib.h"
 #include "apr_optional.h"
+#if APR_HAS_THREADS
+#include "apr_thread_mutex.h"
+#endif
 
 #define APR_WANT_STRFUNC
 #define APR_WANT_MEMFUNC
@@ -196,6 +199,9 @@ struct ssi_internal_ctx {
     const char   *undefined_echo;
     apr_size_t    undefined_echo_len;
 
+    int           literal;       /* LITERAL_* state of the document */
+    apr_time_t    literal_mtime; /* mtime of the document if candidate */
+
     char         legacy_expr;     /* use ap_expr or legacy mod_include
                                     expression parser? */
 
@@ -469,6 +475,28 @@ static const char lazy_eval_sentinel = '\0';
 
 #define UNSET -1
 
+/* Documents without any directive, per child process: the next time they
+ * are served unchanged their file is passed through as is, instead of
+ * being scanned again (and read into memory rather than sent).
+ */
+#define LITERAL_NONE      0  /* not cacheable (e.g. generated content) */
+#define LITERAL_CANDIDATE 1  /* the raw file, parse and record if literal */
+#define LITERAL_PASS      2  /* known literal, pass it through */
+
+#define LITERAL_DOCS_MAX 1024
+
+typedef struct {
+    apr_time_t mtime;
+    apr_off_t size;
+    const char *start_seq;
+} literal_doc_t;
+
+static apr_pool_t *literal_docs_pool;
+static apr_hash_t *literal_docs;
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *literal_docs_mutex;
+#endif
+
 #ifdef XBITHACK
 #define DEFAULT_XBITHACK XBITHACK_FULL
 #else
@@ -3385,6 +3413,68 @@ static apr_size_t find_argument(include_ctx_t *ctx, const char *data,
 /*
  * This is the main loop over the current bucket brigade.
  */
+/*
+ * Determine whether the first brigade is the whole raw file of the request
+ * (as sent by the default handler), and if so whether it's a known literal
+ * document.
+ */
+static int literal_doc_state(request_rec *r, apr_bucket_brigade *bb,
+                             const char *start_seq)
+{
+    apr_bucket *e = APR_BRIGADE_FIRST(bb);
+    literal_doc_t *doc;
+    int state = LITERAL_CANDIDATE;
+
+    if (!literal_docs || !r->filename || r->finfo.filetype != APR_REG
+        || (r->finfo.valid & (APR_FINFO_MTIME | APR_FINFO_SIZE))
+           != (APR_FINFO_MTIME | APR_FINFO_SIZE)
+        || e == APR_BRIGADE_SENTINEL(bb) || !APR_BUCKET_IS_FILE(e)
+        || e->start != 0 || (apr_off_t)e->length != r->finfo.size
+        || !APR_BUCKET_IS_EOS(APR_BUCKET_NEXT(e))) {
+        return LITERAL_NONE;
+    }
+
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(literal_docs_mutex);
+#endif
+    doc = apr_hash_get(literal_docs, r->filename, APR_HASH_KEY_STRING);
+    if (doc && doc->mtime == r->finfo.mtime && doc->size == r->finfo.size
+            && !strcmp(doc->start_seq, start_seq)) {
+        state = LITERAL_PASS;
+    }
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(literal_docs_mutex);
+#endif
+
+    return state;
+}
+
+static void literal_doc_record(request_rec *r, struct ssi_internal_ctx *intern)
+{
+    literal_doc_t *doc;
+
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(literal_docs_mutex);
+#endif
+    doc = apr_hash_get(literal_docs, r->filename, APR_HASH_KEY_STRING);
+    if (!doc) {
+        if (apr_hash_count(literal_docs) >= LITERAL_DOCS_MAX) {
+            /* start over rather than tracking the usage of the entries */
+            apr_pool_clear(literal_docs_pool);
+            literal_docs = apr_hash_make(literal_docs_pool);
+        }
+        doc = apr_palloc(literal_docs_pool, sizeof(*doc));
+        apr_hash_set(literal_docs, apr_pstrdup(literal_docs_pool, r->filename),
+                     APR_HASH_KEY_STRING, doc);
+    }
+    doc->mtime = intern->literal_mtime;
+    doc->size = r->finfo.size;
+    doc->start_seq = intern->start_seq;
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(literal_docs_mutex);
+#endif
+}
+
 static apr_status_t send_parsed_content(ap_filter_t *f, apr_bucket_brigade *bb)
 {
     include_ctx_t *ctx = f->ctx;
@@ -3524,6 +3614,7 @@ static apr_status_t send_parsed_content(ap_filter_t *f, apr_bucket_brigade *bb)
 
             if (index < len) {
                 apr_bucket_split(b, index);
+                intern->literal = LITERAL_NONE;
             }
 
             newb = APR_BUCKET_NEXT(b);
@@ -3771,6 +3862,10 @@ static apr_status_t send_parsed_content(ap_filter_t *f, apr_bucket_brigade *bb)
                           "missing closing endif directive in parsed document"
                           " %s", r->filename);
         }
+        else if (intern->literal == LITERAL_CANDIDATE
+                 && PARSE_PRE_HEAD == intern->state) {
+            literal_doc_record(r, intern);
+        }
 
         /* cleanup our temporary memory */
         apr_brigade_destroy(intern->tmp_bb);
@@ -3885,6 +3980,9 @@ static apr_status_t includes_filter(ap_filter_t *f, apr_bucket_brigade *b)
         intern->undefined_echo = conf->undefined_echo ? conf->undefined_echo :
                                  DEFAULT_UNDEFINED_ECHO;
         intern->undefined_echo_len = strlen(intern->undefined_echo);
+
+        intern->literal = literal_doc_state(r, b, intern->start_seq);
+        intern->literal_mtime = r->finfo.mtime;
     }
 
     if ((parent = ap_get_module_config(r->request_config, &include_module))) {
@@ -3964,6 +4062,11 @@ static apr_status_t includes_filter(ap_filter_t *f, apr_bucket_brigade *b)
                   ap_escape_shell_cmd(r->pool, arg_copy));
     }
 
+    if (((include_ctx_t *)f->ctx)->intern->literal == LITERAL_PASS) {
+        ap_remove_output_filter(f);
+        return ap_pass_brigade(f->next, b);
+    }
+
     return send_parsed_content(f, b);
 }
 
@@ -4180,6 +4283,25 @@ static int include_post_config(apr_pool_t *p, apr_pool_t *plog,
     return OK;
 }
 
+static void include_child_init(apr_pool_t *p, server_rec *s)
+{
+#if APR_HAS_THREADS
+    apr_status_t rv;
+
+    rv = apr_thread_mutex_create(&literal_docs_mutex,
+                                 APR_THREAD_MUTEX_DEFAULT, p);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, rv, s, APLOGNO(10494)
+                     "mod_include: could not create the mutex of the "
+                     "literal documents cache, not caching");
+        return;
+    }
+#endif
+    apr_pool_create(&literal_docs_pool, p);
+    apr_pool_tag(literal_docs_pool, "include_literal_docs");
+    literal_docs = apr_hash_make(literal_docs_pool);
+}
+
 static const command_rec includes_cmds[] =
 {
     AP_INIT_TAKE1("XBitHack", set_xbithack, NULL, OR_OPTIONS,
@@ -4222,6 +4344,7 @@ static void register_hooks(apr_pool_t *p)
     APR_REGISTER_OPTIONAL_FN(ap_register_include_handler);
     ap_hook_post_config(include_post_config, NULL, NULL, APR_HOOK_REALLY_FIRST);
     ap_hook_fixups(include_fixup, NULL, NULL, APR_HOOK_LAST);
+    ap_hook_child_init(include_child_init, NULL, NULL, APR_HOOK_MIDDLE);
     ap_register_output_filter("INCLUDES", includes_filter, includes_setup,
                               AP_FTYPE_RESOURCE);
 }
@@ -116,7 +116,24 @@ typedef struct {
     int strip_comments;
     int interp;
     int enabled;
+    int tokenizer;
 } proxy_html_conf;
+/* literal URL maps, indexed by the case-folded bytes of their from string */
+typedef struct urltrie {
+    struct urltrie *child;
+    struct urltrie *sibling;
+    urlmap *map;            /* first map in config order ending here */
+    int order;
+    char key;
+} urltrie;
+/* an attribute of a start tag, pointing into the tokenized document */
+typedef struct {
+    const char *name;
+    const char *val;        /* NULL for an attribute without a value */
+    apr_size_t nlen;
+    apr_size_t vlen;
+} tokattr;
+typedef enum { TOK_TEXT, TOK_COMMENT, TOK_RAWTEXT } tokstate_t;
 typedef struct {
     ap_filter_t *f;
     proxy_html_conf *cfg;
@@ -131,6 +148,17 @@ typedef struct {
     char rbuf[4];
     apr_size_t rlen;
     apr_size_t rmin;
+    urltrie *trie;
+    /* ProxyHTMLTokenizer state */
+    tokstate_t tstate;
+    const char *rawend;     /* end tag of the script or style element */
+    apr_size_t tmatch;      /* bytes of the end marker seen so far */
+    apr_bucket_brigade *tbb;    /* the rewritten tags */
+    apr_array_header_t *tattrs;
+    apr_array_header_t *tlinks; /* linkattrs of the tag */
+    int tfirst;             /* first attribute of the tag to rewrite */
+    char *hold;             /* start of a tag split across buckets */
+    apr_size_t holdlen;
 } saxctxt;
 
 
@@ -393,30 +421,254 @@ static void pendElement(void *ctxt, const xmlChar *uname)
     }
 }
 
-static void pstartElement(void *ctxt, const xmlChar *uname,
-                          const xmlChar** uattrs)
+/* Is the attribute of an element with the given linkattrs a link, an event
+ * or neither?
+ */
+static rewrite_t attr_type(saxctxt *ctx, apr_array_header_t *linkattrs,
+                           const char *attr)
+{
+    int i;
+    if (linkattrs) {
+        tattr *attrs = (tattr*) linkattrs->elts;
+        for (i=0; i < linkattrs->nelts; ++i) {
+            if (!strcmp(attr, attrs[i].val)) {
+                return ATTR_URI;
+            }
+        }
+    }
+    if (ctx->cfg->extfix && (ctx->cfg->events != NULL)) {
+        tattr *attrs = (tattr*) ctx->cfg->events->elts;
+        for (i=0; i < ctx->cfg->events->nelts; ++i) {
+            if (!strcmp(attr, attrs[i].val)) {
+                return ATTR_EVENT;
+            }
+        }
+    }
+    return ATTR_IGNORE;
+}
+
+/* Replaces the start of ctx->buf, matched by the literal map m */
+static void subst_prefix(saxctxt *ctx, urlmap *m)
+{
+    size_t s_from = strlen(m->from.c);
+    size_t s_to = strlen(m->to);
+    size_t len = strlen(ctx->buf);
+#ifndef GO_FASTER
+    int verbose = APLOGrtrace1(ctx->f->r);
+#endif
+
+    VERBOSE(ap_log_rerror(APLOG_MARK, APLOG_TRACE3, 0, ctx->f->r,
+                          "H: matched %s, substituting %s",
+                          m->from.c, m->to));
+    if (s_to > s_from) {
+        preserve(ctx, s_to - s_from);
+        memmove(ctx->buf+s_to, ctx->buf+s_from, len + 1 - s_from);
+        memcpy(ctx->buf, m->to, s_to);
+    }
+    else {     /* it fits in the existing space */
+        memcpy(ctx->buf, m->to, s_to);
+        memmove(ctx->buf+s_to, ctx->buf+s_from, len + 1 - s_from);
+    }
+}
+
+/* Looks up the first literal map (in configuration order) whose from
+ * string is a case-insensitive prefix of str.
+ */
+static urlmap *urltrie_match(const urltrie *node, const char *str)
+{
+    urlmap *m = node->map;
+    int order = node->order;
+
+    while (*str) {
+        char c = apr_tolower(*str++);
+        for (node = node->child; node && node->key != c;
+             node = node->sibling);
+        if (!node)
+            break;
+        if (node->map && (!m || node->order < order)) {
+            m = node->map;
+            order = node->order;
+        }
+    }
+    return m;
+}
+
+/* Applies the URL maps to the attribute value in ctx->buf */
+static void rewrite_attr(saxctxt *ctx, rewrite_t is_uri)
 {
-    int required_attrs;
     int num_match;
     size_t offs, len;
     char *subs;
-    rewrite_t is_uri;
-    const char** a;
     urlmap *m;
     size_t s_to, s_from, match;
     char *found;
-    saxctxt *ctx = (saxctxt*) ctxt;
     size_t nmatch;
     ap_regmatch_t pmatch[10];
 #ifndef GO_FASTER
     int verbose = APLOGrtrace1(ctx->f->r);
 #endif
+    urlmap *themap = ctx->map;
+
+    switch (is_uri) {
+    case ATTR_URI:
+        if (ctx->trie) {
+            /* all maps are literal: at most the first matching one applies */
+            m = urltrie_match(ctx->trie, ctx->buf);
+            if (m)
+                subst_prefix(ctx, m);
+            break;
+        }
+        num_match = 0;
+        for (m = themap; m; m = m->next) {
+            if (!(m->flags & M_HTML))
+                continue;
+            if (m->flags & M_REGEX) {
+                nmatch = 10;
+                if (!ap_regexec(m->from.r, ctx->buf, nmatch,
+                                pmatch, 0)) {
+                    ++num_match;
+                    offs = match = pmatch[0].rm_so;
+                    s_from = pmatch[0].rm_eo - match;
+                    subs = ap_pregsub(ctx->f->r->pool, m->to,
+                                      ctx->buf, nmatch, pmatch);
+                    VERBOSE({
+                        const char *f;
+                        f = apr_pstrndup(ctx->f->r->pool,
+                                         ctx->buf + offs, s_from);
+                        ap_log_rerror(APLOG_MARK, APLOG_TRACE3, 0,
+                                      ctx->f->r,
+                             "H/RX: match at %s, substituting %s",
+                                      f, subs);
+                    })
+                    s_to = strlen(subs);
+                    len = strlen(ctx->buf);
+                    if (s_to > s_from) {
+                        preserve(ctx, s_to - s_from);
+                        memmove(ctx->buf+offs+s_to,
+                                ctx->buf+offs+s_from,
+                                len + 1 - s_from - offs);
+                        memcpy(ctx->buf+offs, subs, s_to);
+                    }
+                    else {
+                        memcpy(ctx->buf + offs, subs, s_to);
+                        memmove(ctx->buf+offs+s_to,
+                                ctx->buf+offs+s_from,
+                                len + 1 - s_from - offs);
+                    }
+                }
+            } else {
+                s_from = strlen(m->from.c);
+                if (!strncasecmp(ctx->buf, m->from.c, s_from)) {
+                    subst_prefix(ctx, m);
+                    break;
+                }
+            }
+            /* URIs only want one match unless overridden in the config */
+            if ((num_match > 0) && !(m->flags & M_NOTLAST))
+                break;
+        }
+        break;
+    case ATTR_EVENT:
+        for (m = themap; m; m = m->next) {
+            num_match = 0;        /* reset here since we're working per-rule */
+            if (!(m->flags & M_EVENTS))
+                continue;
+            if (m->flags & M_REGEX) {
+                nmatch = 10;
+                offs = 0;
+                while (!ap_regexec(m->from.r, ctx->buf+offs,
+                                   nmatch, pmatch, 0)) {
+                    match = pmatch[0].rm_so;
+                    s_from = pmatch[0].rm_eo - match;
+                    subs = ap_pregsub(ctx->f->r->pool, m->to, ctx->buf+offs,
+                                        nmatch, pmatch);
+                    VERBOSE({
+                        const char *f;
+                        f = apr_pstrndup(ctx->f->r->pool,
+                                         ctx->buf + offs, s_from);
+                        ap_log_rerror(APLOG_MARK, APLOG_TRACE3, 0,
+                                      ctx->f->r,
+                               "E/RX: match at %s, substituting %s",
+                                      f, subs);
+                    })
+                    s_to = strlen(subs);
+                    offs += match;
+                    len = strlen(ctx->buf);
+                    if (s_to > s_from) {
+                        preserve(ctx, s_to - s_from);
+                        memmove(ctx->buf+offs+s_to,
+                                ctx->buf+offs+s_from,
+                                len + 1 - s_from - offs);
+                        memcpy(ctx->buf+offs, subs, s_to);
+                    }
+                    else {
+                        memcpy(ctx->buf + offs, subs, s_to);
+                        memmove(ctx->buf+offs+s_to,
+                                ctx->buf+offs+s_from,
+                                len + 1 - s_from - offs);
+                    }
+                    offs += s_to;
+                    ++num_match;
+                }
+            }
+            else {
+                found = strstr(ctx->buf, m->from.c);
+                if ((m->flags & M_ATSTART) && (found != ctx->buf))
+                    continue;
+                while (found) {
+                    s_from = strlen(m->from.c);
+                    s_to = strlen(m->to);
+                    match = found - ctx->buf;
+                    if ((s_from < strlen(found))
+                        && (m->flags & M_ATEND)) {
+                        found = strstr(ctx->buf+match+s_from,
+                                       m->from.c);
+                        continue;
+                    }
+                    else {
+                        found = strstr(ctx->buf+match+s_to,
+                                       m->from.c);
+                    }
+                    VERBOSE(ap_log_rerror(APLOG_MARK, APLOG_TRACE3,
+                                          0, ctx->f->r,
+                                  "E: matched %s, substituting %s",
+                                          m->from.c, m->to));
+                    len = strlen(ctx->buf);
+                    if (s_to > s_from) {
+                        preserve(ctx, s_to - s_from);
+                        memmove(ctx->buf+match+s_to,
+                                ctx->buf+match+s_from,
+                                len + 1 - s_from - match);
+                        memcpy(ctx->buf+match, m->to, s_to);
+                    }
+                    else {
+                        memcpy(ctx->buf+match, m->to, s_to);
+                        memmove(ctx->buf+match+s_to,
+                                ctx->buf+match+s_from,
+                                len + 1 - s_from - match);
+                    }
+                    ++num_match;
+                }
+            }
+            if (num_match && (m->flags & M_LAST))
+                break;
+        }
+        break;
+    case ATTR_IGNORE:
+        break;
+    }
+}
+
+static void pstartElement(void *ctxt, const xmlChar *uname,
+                          const xmlChar** uattrs)
+{
+    int required_attrs;
+    const char** a;
+    saxctxt *ctx = (saxctxt*) ctxt;
     apr_array_header_t *linkattrs;
-    int i;
     const char *name = (const char*) uname;
     const char** attrs = (const char**) uattrs;
     const htmlElemDesc* desc = htmlTagLookup(uname);
-    urlmap *themap = ctx->map;
     const char *accept_charset = NULL;
 
 
@@ -497,184 +749,7 @@ static void pstartElement(void *ctxt, const xmlChar *uname,
             ctx->offset = 0;
             if (a[1]) {
                 pappend(ctx, a[1], strlen(a[1])+1);
-                is_uri = ATTR_IGNORE;
-                if (linkattrs) {
-                    tattr *attrs = (tattr*) linkattrs->elts;
-                    for (i=0; i < linkattrs->nelts; ++i) {
-                        if (!strcmp(*a, attrs[i].val)) {
-                            is_uri = ATTR_URI;
-                            break;
-                        }
-                    }
-                }
-                if ((is_uri == ATTR_IGNORE) && ctx->cfg->extfix
-                    && (ctx->cfg->events != NULL)) {
-                    for (i=0; i < ctx->cfg->events->nelts; ++i) {
-                        tattr *attrs = (tattr*) ctx->cfg->events->elts;
-                        if (!strcmp(*a, attrs[i].val)) {
-                            is_uri = ATTR_EVENT;
-                            break;
-                        }
-                    }
-                }
-                switch (is_uri) {
-                case ATTR_URI:
-                    num_match = 0;
-                    for (m = themap; m; m = m->next) {
-                        if (!(m->flags & M_HTML))
-                            continue;
-                        if (m->flags & M_REGEX) {
-                            nmatch = 10;
-                            if (!ap_regexec(m->from.r, ctx->buf, nmatch,
-                                            pmatch, 0)) {
-                                ++num_match;
-                                offs = match = pmatch[0].rm_so;
-                                s_from = pmatch[0].rm_eo - match;
-                                subs = ap_pregsub(ctx->f->r->pool, m->to,
-                                                  ctx->buf, nmatch, pmatch);
-                                VERBOSE({
-                                    const char *f;
-                                    f = apr_pstrndup(ctx->f->r->pool,
-                                                     ctx->buf + offs, s_from);
-                                    ap_log_rerror(APLOG_MARK, APLOG_TRACE3, 0,
-                                                  ctx->f->r,
-                                         "H/RX: match at %s, substituting %s",
-                                                  f, subs);
-                                })
-                                s_to = strlen(subs);
-                                len = strlen(ctx->buf);
-                                if (s_to > s_from) {
-                                    preserve(ctx, s_to - s_from);
-                                    memmove(ctx->buf+offs+s_to,
-                                            ctx->buf+offs+s_from,
-                                            len + 1 - s_from - offs);
-                                    memcpy(ctx->buf+offs, subs, s_to);
-                                }
-                                else {
-                                    memcpy(ctx->buf + offs, subs, s_to);
-                                    memmove(ctx->buf+offs+s_to,
-                                            ctx->buf+offs+s_from,
-                                            len + 1 - s_from - offs);
-                                }
-                            }
-                        } else {
-                            s_from = strlen(m->from.c);
-                            if (!strncasecmp(ctx->buf, m->from.c, s_from)) {
-                                ++num_match;
-                                s_to = strlen(m->to);
-                                len = strlen(ctx->buf);
-                                VERBOSE(ap_log_rerror(APLOG_MARK, APLOG_TRACE3,
-                                                      0, ctx->f->r,
-                                              "H: matched %s, substituting %s",
-                                                      m->from.c, m->to));
-                                if (s_to > s_from) {
-                                    preserve(ctx, s_to - s_from);
-                                    memmove(ctx->buf+s_to, ctx->buf+s_from,
-                                            len + 1 - s_from);
-                                    memcpy(ctx->buf, m->to, s_to);
-                                }
-                                else {     /* it fits in the existing space */
-                                    memcpy(ctx->buf, m->to, s_to);
-                                    memmove(ctx->buf+s_to, ctx->buf+s_from,
-                                            len + 1 - s_from);
-                                }
-                                break;
-                            }
-                        }
-                        /* URIs only want one match unless overridden in the config */
-                        if ((num_match > 0) && !(m->flags & M_NOTLAST))
-                            break;
-                    }
-                    break;
-                case ATTR_EVENT:
-                    for (m = themap; m; m = m->next) {
-                        num_match = 0;        /* reset here since we're working per-rule */
-                        if (!(m->flags & M_EVENTS))
-                            continue;
-                        if (m->flags & M_REGEX) {
-                            nmatch = 10;
-                            offs = 0;
-                            while (!ap_regexec(m->from.r, ctx->buf+offs,
-                                               nmatch, pmatch, 0)) {
-                                match = pmatch[0].rm_so;
-                                s_from = pmatch[0].rm_eo - match;
-                                subs = ap_pregsub(ctx->f->r->pool, m->to, ctx->buf+offs,
-                                                    nmatch, pmatch);
-                                VERBOSE({
-                                    const char *f;
-                                    f = apr_pstrndup(ctx->f->r->pool,
-                                                     ctx->buf + offs, s_from);
-                                    ap_log_rerror(APLOG_MARK, APLOG_TRACE3, 0,
-                                                  ctx->f->r,
-                                           "E/RX: match at %s, substituting %s",
-                                                  f, subs);
-                                })
-                                s_to = strlen(subs);
-                                offs += match;
-                                len = strlen(ctx->buf);
-                                if (s_to > s_from) {
-                                    preserve(ctx, s_to - s_from);
-                                    memmove(ctx->buf+offs+s_to,
-                                            ctx->buf+offs+s_from,
-                                            len + 1 - s_from - offs);
-                                    memcpy(ctx->buf+offs, subs, s_to);
-                                }
-                                else {
-                                    memcpy(ctx->buf + offs, subs, s_to);
-                                    memmove(ctx->buf+offs+s_to,
-                                            ctx->buf+offs+s_from,
-                                            len + 1 - s_from - offs);
-                                }
-                                offs += s_to;
-                                ++num_match;
-                            }
-                        }
-                        else {
-                            found = strstr(ctx->buf, m->from.c);
-                            if ((m->flags & M_ATSTART) && (found != ctx->buf))
-                                continue;
-                            while (found) {
-                                s_from = strlen(m->from.c);
-                                s_to = strlen(m->to);
-                                match = found - ctx->buf;
-                                if ((s_from < strlen(found))
-                                    && (m->flags & M_ATEND)) {
-                                    found = strstr(ctx->buf+match+s_from,
-                                                   m->from.c);
-                                    continue;
-                                }
-                                else {
-                                    found = strstr(ctx->buf+match+s_to,
-                                                   m->from.c);
-                                }
-                                VERBOSE(ap_log_rerror(APLOG_MARK, APLOG_TRACE3,
-                                                      0, ctx->f->r,
-                                              "E: matched %s, substituting %s",
-                                                      m->from.c, m->to));
-                                len = strlen(ctx->buf);
-                                if (s_to > s_from) {
-                                    preserve(ctx, s_to - s_from);
-                                    memmove(ctx->buf+match+s_to,
-                                            ctx->buf+match+s_from,
-                                            len + 1 - s_from - match);
-                                    memcpy(ctx->buf+match, m->to, s_to);
-                                }
-                                else {
-                                    memcpy(ctx->buf+match, m->to, s_to);
-                                    memmove(ctx->buf+match+s_to,
-                                            ctx->buf+match+s_from,
-                                            len + 1 - s_from - match);
-                                }
-                                ++num_match;
-                            }
-                        }
-                        if (num_match && (m->flags & M_LAST))
-                            break;
-                    }
-                    break;
-                case ATTR_IGNORE:
-                    break;
-                }
+                rewrite_attr(ctx, attr_type(ctx, linkattrs, *a));
             }
             if (!a[1])
                 ap_fputstrs(ctx->f->next, ctx->bb, " ", a[0], NULL);
@@ -874,6 +949,55 @@ static void fixup_rules(saxctxt *ctx)
         prev->next = NULL;
 }
 
+/* Indexes the literal HTML maps by the case-folded from strings, so that
+ * a link is looked up in one walk rather than a comparison per map.  Not
+ * done when a regexp applies to links, since its substitution would change
+ * what the following maps see.
+ */
+static urltrie *urltrie_make(apr_pool_t *pool, urlmap *map)
+{
+    urltrie *root;
+    urlmap *m;
+    int order;
+    int n = 0;
+
+    for (m = map; m; m = m->next) {
+        if (!(m->flags & M_HTML))
+            continue;
+        if (m->flags & M_REGEX)
+            return NULL;
+        ++n;
+    }
+    if (n < 2)
+        return NULL;
+
+    root = apr_pcalloc(pool, sizeof(urltrie));
+    for (m = map, order = 0; m; m = m->next, ++order) {
+        urltrie *node = root;
+        const char *s;
+        if (!(m->flags & M_HTML))
+            continue;
+        for (s = m->from.c; *s; ++s) {
+            char c = apr_tolower(*s);
+            urltrie *child;
+            for (child = node->child; child && child->key != c;
+                 child = child->sibling);
+            if (!child) {
+                child = apr_pcalloc(pool, sizeof(urltrie));
+                child->key = c;
+                child->sibling = node->child;
+                node->child = child;
+            }
+            node = child;
+        }
+        if (!node->map) {
+            node->map = m;
+            node->order = order;
+        }
+    }
+    return root;
+}
+
 static saxctxt *check_filter_init (ap_filter_t *f)
 {
     saxctxt *fctx;
@@ -920,6 +1044,12 @@ static saxctxt *check_filter_init (ap_filter_t *f)
             fixup_rules(fctx);
         else
             fctx->map = cfg->map;
+        fctx->trie = urltrie_make(f->r->pool, fctx->map);
+        if (cfg->tokenizer) {
+            fctx->tbb = apr_brigade_create(f->r->pool,
+                                           f->r->connection->bucket_alloc);
+            fctx->tattrs = apr_array_make(f->r->pool, 8, sizeof(tokattr));
+        }
         /* defer dealing with charset_out until after sniffing charset_in
          * so we can support setting one to t'other.
          */
@@ -938,6 +1068,392 @@ static void prepend_rbuf(saxctxt *ctxt, apr_bucket_brigade *bb)
     }
 }
 
+/* ProxyHTMLTokenizer: rather than parsing the document, find the start
+ * tags in it and rewrite just those with links.  Everything else, and the
+ * tags whose links don't change, is passed on in the buckets it came in.
+ */
+#define TOK_MORE        0   /* the construct goes on past the data */
+#define TOK_PASS        1   /* the construct is passed on as it is */
+#define TOK_REWRITE     2   /* the tag has links to rewrite */
+
+/* Copies a name, lowercased, to buf; fails if it doesn't fit */
+static int tok_name(char *buf, apr_size_t bufsz, const char *name,
+                    apr_size_t len)
+{
+    apr_size_t i;
+    if (len >= bufsz)
+        return 0;
+    for (i = 0; i < len; ++i)
+        buf[i] = apr_tolower(name[i]);
+    buf[len] = '\0';
+    return 1;
+}
+
+static rewrite_t tok_type(saxctxt *ctx, const tokattr *a)
+{
+    char name[64];
+    if (!a->val || !tok_name(name, sizeof(name), a->name, a->nlen))
+        return ATTR_IGNORE;
+    return attr_type(ctx, ctx->tlinks, name);
+}
+
+/* Rewrites the value of a into ctx->buf; returns whether it changed */
+static int tok_value(saxctxt *ctx, const tokattr *a, rewrite_t type)
+{
+    char c = 0;
+    if (memchr(a->val, '\0', a->vlen))
+        return 0;
+    ctx->offset = 0;
+    pappend(ctx, a->val, a->vlen);
+    pappend(ctx, &c, 1);
+    rewrite_attr(ctx, type);
+    if (ctx->cfg->flags != 0)
+        normalise(ctx->cfg->flags, ctx->buf);
+    return strlen(ctx->buf) != a->vlen || memcmp(ctx->buf, a->val, a->vlen);
+}
+
+/* Tokenizes the start tag at buf, and sees whether it needs rewriting */
+static int tok_tag(saxctxt *ctx, const char *buf, apr_size_t len,
+                   apr_size_t *end)
+{
+    const char *p = buf + 1;
+    const char *e = buf + len;
+    const char *name = p;
+    char lname[32];
+    tokattr *a;
+    int i;
+
+    while (p < e && !apr_isspace(*p) && *p != '/' && *p != '>')
+        ++p;
+    if (!tok_name(lname, sizeof(lname), name, p - name))
+        lname[0] = '\0';
+
+    ctx->tattrs->nelts = 0;
+    for (;;) {
+        while (p < e && (apr_isspace(*p) || *p == '/'))
+            ++p;
+        if (p == e)
+            return TOK_MORE;
+        if (*p == '>')
+            break;
+        a = apr_array_push(ctx->tattrs);
+        a->name = p++;      /* a leading '=' belongs to the name */
+        while (p < e && !apr_isspace(*p) && *p != '/' && *p != '>'
+               && *p != '=')
+            ++p;
+        a->nlen = p - a->name;
+        a->val = NULL;
+        a->vlen = 0;
+        while (p < e && apr_isspace(*p))
+            ++p;
+        if (p == e || *p != '=')
+            continue;
+        ++p;
+        while (p < e && apr_isspace(*p))
+            ++p;
+        if (p == e)
+            return TOK_MORE;
+        if (*p == '"' || *p == '\'') {
+            const char *q = memchr(p + 1, *p, e - p - 1);
+            if (!q)
+                return TOK_MORE;
+            a->val = p + 1;
+            a->vlen = q - a->val;
+            p = q + 1;
+        }
+        else if (*p != '>') {
+            a->val = p;
+            while (p < e && !apr_isspace(*p) && *p != '>')
+                ++p;
+            a->vlen = p - a->val;
+        }
+    }
+    *end = p + 1 - buf;
+
+    /* the content of these is not markup */
+    if (!strcmp(lname, "script") || !strcmp(lname, "style")) {
+        ctx->tstate = TOK_RAWTEXT;
+        ctx->rawend = (lname[1] == 'c') ? "</script" : "</style";
+        ctx->tmatch = 0;
+    }
+
+    ctx->tlinks = apr_hash_get(ctx->cfg->links, lname, APR_HASH_KEY_STRING);
+    if (!ctx->tlinks && !(ctx->cfg->extfix && ctx->cfg->events))
+        return TOK_PASS;
+    a = (tokattr *) ctx->tattrs->elts;
+    for (i = 0; i < ctx->tattrs->nelts; ++i) {
+        rewrite_t type = tok_type(ctx, &a[i]);
+        if ((type != ATTR_IGNORE) && tok_value(ctx, &a[i], type)) {
+            ctx->tfirst = i;
+            return TOK_REWRITE;
+        }
+    }
+    return TOK_PASS;
+}
+
+/* Sees what the markup starting with '<' at buf is */
+static int tok_construct(saxctxt *ctx, const char *buf, apr_size_t len,
+                         apr_size_t *end)
+{
+    if (len < 2)
+        return TOK_MORE;
+    if (apr_isalpha(buf[1]))
+        return tok_tag(ctx, buf, len, end);
+    if ((buf[1] == '!') && ((len < 3) || (buf[2] == '-'))) {
+        if (len < 4)
+            return TOK_MORE;
+        if (buf[3] == '-') {
+            ctx->tstate = TOK_COMMENT;
+            ctx->tmatch = 0;
+            *end = 4;
+            return TOK_PASS;
+        }
+    }
+    /* anything else, an end tag included, has no links */
+    *end = 1;
+    return TOK_PASS;
+}
+
+static void tok_escape(saxctxt *ctx, const char *str, char quote)
+{
+    const char *p;
+    for (p = ap_strchr_c(str, quote); p;
+         str = p + 1, p = ap_strchr_c(str, quote)) {
+        apr_brigade_write(ctx->tbb, NULL, NULL, str, p - str);
+        apr_brigade_puts(ctx->tbb, NULL, NULL,
+                         (quote == '"') ? "&quot;" : "&#39;");
+    }
+    apr_brigade_puts(ctx->tbb, NULL, NULL, str);
+}
+
+/* Writes out the tag found by tok_tag, with its links rewritten.  The
+ * output goes to a brigade of its own: written directly to ctx->bb it may
+ * be appended to one of the original heap buckets passed on there.
+ */
+static void tok_write(saxctxt *ctx, const char *buf, apr_size_t len)
+{
+    tokattr *a = (tokattr *) ctx->tattrs->elts;
+    const char *p = buf;
+    int i;
+
+    for (i = ctx->tfirst; i < ctx->tattrs->nelts; ++i) {
+        if (i > ctx->tfirst) {
+            rewrite_t type = tok_type(ctx, &a[i]);
+            if ((type == ATTR_IGNORE) || !tok_value(ctx, &a[i], type))
+                continue;
+        }
+        /* ctx->buf now holds the new value */
+        apr_brigade_write(ctx->tbb, NULL, NULL, p, a[i].val - p);
+        if ((a[i].val[-1] == '"') || (a[i].val[-1] == '\'')) {
+            tok_escape(ctx, ctx->buf, a[i].val[-1]);
+        }
+        else {
+            apr_brigade_putc(ctx->tbb, NULL, NULL, '"');
+            tok_escape(ctx, ctx->buf, '"');
+            apr_brigade_putc(ctx->tbb, NULL, NULL, '"');
+        }
+        p = a[i].val + a[i].vlen;
+    }
+    apr_brigade_write(ctx->tbb, NULL, NULL, p, buf + len - p);
+    APR_BRIGADE_CONCAT(ctx->bb, ctx->tbb);
+}
+
+static void tok_hold_flush(saxctxt *ctx, apr_size_t len)
+{
+    apr_brigade_write(ctx->tbb, NULL, NULL, ctx->hold, len);
+    APR_BRIGADE_CONCAT(ctx->bb, ctx->tbb);
+    ctx->holdlen = 0;
+}
+
+/* Passes the first n bytes of b on unchanged, or drops them, and returns
+ * the bucket with the rest, if any.
+ */
+static apr_bucket *tok_split(saxctxt *ctx, apr_bucket *b, apr_size_t n,
+                             int pass)
+{
+    apr_bucket *rest = NULL;
+    if (n == 0)
+        return b;
+    if (n < b->length) {
+        apr_bucket_split(b, n);
+        rest = APR_BUCKET_NEXT(b);
+    }
+    if (pass) {
+        APR_BUCKET_REMOVE(b);
+        APR_BRIGADE_INSERT_TAIL(ctx->bb, b);
+    }
+    else {
+        apr_bucket_delete(b);
+    }
+    return rest;
+}
+
+/* Tokenizes the data of b, moving it to ctx->bb */
+static void tok_bucket(saxctxt *ctx, apr_bucket *b, const char *buf,
+                       apr_size_t len)
+{
+    apr_size_t holdsz = ctx->cfg->bufsz > 0 ? ctx->cfg->bufsz : 0;
+    apr_size_t pos = 0;
+    apr_size_t end;
+    const char *p;
+    int rv;
+
+    if (ctx->holdlen) {
+        /* first complete the construct held over from the last bucket */
+        apr_size_t held = ctx->holdlen;
+        apr_size_t n = holdsz - held;
+        if (n > len)
+            n = len;
+        memcpy(ctx->hold + held, buf, n);
+        ctx->holdlen += n;
+        rv = tok_construct(ctx, ctx->hold, ctx->holdlen, &end);
+        if (rv == TOK_MORE) {
+            if (ctx->holdlen < holdsz) {
+                apr_bucket_delete(b);
+                return;
+            }
+            /* too long for a tag we'd rewrite */
+            end = ctx->holdlen;
+            tok_hold_flush(ctx, end);
+        }
+        else if (rv == TOK_REWRITE) {
+            tok_write(ctx, ctx->hold, end);
+            ctx->holdlen = 0;
+        }
+        else {
+            tok_hold_flush(ctx, end);
+        }
+        pos = end - held;
+        b = tok_split(ctx, b, pos, 0);
+        if (!b)
+            return;
+        buf += pos;
+        len -= pos;
+        pos = 0;
+    }
+
+    while (pos < len) {
+        switch (ctx->tstate) {
+        case TOK_TEXT:
+            p = memchr(buf + pos, '<', len - pos);
+            if (!p) {
+                pos = len;
+                break;
+            }
+            pos = p - buf;
+            rv = tok_construct(ctx, p, len - pos, &end);
+            if (rv == TOK_MORE) {
+                if (len - pos < holdsz) {
+                    /* hold it back until the next bucket */
+                    if (!ctx->hold)
+                        ctx->hold = apr_palloc(ctx->f->r->pool, holdsz);
+                    memcpy(ctx->hold, p, len - pos);
+                    ctx->holdlen = len - pos;
+                    b = tok_split(ctx, b, pos, 1);
+                    apr_bucket_delete(b);
+                    return;
+                }
+                ++pos;
+            }
+            else if (rv == TOK_REWRITE) {
+                b = tok_split(ctx, b, pos, 1);
+                tok_write(ctx, p, end);
+                b = tok_split(ctx, b, end, 0);
+                if (!b)
+                    return;
+                buf += pos + end;
+                len -= pos + end;
+                pos = 0;
+            }
+            else {
+                pos += end;
+            }
+            break;
+        case TOK_COMMENT:
+            while (pos < len) {
+                char c;
+                if (!ctx->tmatch) {
+                    p = memchr(buf + pos, '-', len - pos);
+                    if (!p) {
+                        pos = len;
+                        break;
+                    }
+                    pos = p - buf;
+                }
+                c = buf[pos++];
+                if (c == '-') {
+                    ++ctx->tmatch;
+                }
+                else if ((c == '>') && (ctx->tmatch >= 2)) {
+                    ctx->tstate = TOK_TEXT;
+                    break;
+                }
+                else {
+                    ctx->tmatch = 0;
+                }
+            }
+            break;
+        case TOK_RAWTEXT:
+            while (pos < len) {
+                char c;
+                if (!ctx->tmatch) {
+                    p = memchr(buf + pos, '<', len - pos);
+                    if (!p) {
+                        pos = len;
+                        break;
+                    }
+                    pos = p - buf;
+                }
+                c = apr_tolower(buf[pos++]);
+                if (c == ctx->rawend[ctx->tmatch]) {
+                    if (!ctx->rawend[++ctx->tmatch]) {
+                        ctx->tstate = TOK_TEXT;
+                        break;
+                    }
+                }
+                else {
+                    ctx->tmatch = (c == '<');
+                }
+            }
+            break;
+        }
+    }
+    APR_BUCKET_REMOVE(b);
+    APR_BRIGADE_INSERT_TAIL(ctx->bb, b);
+}
+
+static apr_status_t proxy_html_tokenize(saxctxt *ctx, apr_bucket_brigade *bb)
+{
+    apr_status_t rv;
+
+    while (!APR_BRIGADE_EMPTY(bb)) {
+        apr_bucket *b = APR_BRIGADE_FIRST(bb);
+
+        if (APR_BUCKET_IS_METADATA(b)) {
+            if (APR_BUCKET_IS_EOS(b) && ctx->holdlen) {
+                tok_hold_flush(ctx, ctx->holdlen);
+            }
+            APR_BUCKET_REMOVE(b);
+            APR_BRIGADE_INSERT_TAIL(ctx->bb, b);
+        }
+        else {
+            const char *buf;
+            apr_size_t bytes;
+            rv = apr_bucket_read(b, &buf, &bytes, APR_BLOCK_READ);
+            if (rv != APR_SUCCESS) {
+                ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, ctx->f->r,
+                              APLOGNO(10550) "Error in bucket read");
+                return rv;
+            }
+            tok_bucket(ctx, b, buf, bytes);
+        }
+    }
+    /* nothing is held in ctx->bb, its buckets may be transient */
+    rv = ap_pass_brigade(ctx->f->next, ctx->bb);
+    apr_brigade_cleanup(ctx->bb);
+    return rv;
+}
+
 static apr_status_t proxy_html_filter(ap_filter_t *f, apr_bucket_brigade *bb)
 {
     xmlCharEncoding enc;
@@ -953,6 +1469,9 @@ static apr_status_t proxy_html_filter(ap_filter_t *f, apr_bucket_brigade *bb)
         ap_remove_output_filter(f);
         return ap_pass_brigade(f->next, bb);
     }
+    if (ctxt->cfg->tokenizer) {
+        return proxy_html_tokenize(ctxt, bb);
+    }
 
     while (!APR_BRIGADE_EMPTY(bb)) {
         apr_bucket *b = APR_BRIGADE_FIRST(bb);
@@ -1133,6 +1652,7 @@ static void *proxy_html_merge(apr_pool_t *pool, void *BASE, void *ADD)
         conf->interp = add->interp;
         conf->strip_comments = add->strip_comments;
         conf->enabled = add->enabled;
+        conf->tokenizer = add->tokenizer;
     }
     else {
         conf->flags = base->flags | add->flags;
@@ -1141,6 +1661,7 @@ static void *proxy_html_merge(apr_pool_t *pool, void *BASE, void *ADD)
         conf->interp = base->interp | add->interp;
         conf->strip_comments = base->strip_comments | add->strip_comments;
         conf->enabled = add->enabled | base->enabled;
+        conf->tokenizer = add->tokenizer | base->tokenizer;
     }
     return conf;
 }
@@ -1354,6 +1875,10 @@ static const command_rec proxy_html_cmds[] = {
                  (void*)APR_OFFSETOF(proxy_html_conf, enabled),
                  RSRC_CONF|ACCESS_CONF,
                  "Enable proxy-html and xml2enc filters"),
+    AP_INIT_FLAG("ProxyHTMLTokenizer", ap_set_flag_slot,
+                 (void*)APR_OFFSETOF(proxy_html_conf, tokenizer),
+                 RSRC_CONF|ACCESS_CONF,
+                 "Rewrite links in the tags only, without parsing the HTML"),
     { NULL }
 };
 static int mod_proxy_html(apr_pool_t *p, apr_pool_t *p1, apr_pool_t *p2)
@@ -1386,7 +1911,8 @@ static void proxy_html_insert(request_rec *r)
     proxy_html_conf *cfg;
     cfg = ap_get_module_config(r->per_dir_config, &proxy_html_module);
     if (cfg->enabled) {
-        if (xml2enc_filter)
+        /* the tokenizer works on the document's own charset */
+        if (xml2enc_filter && !cfg->tokenizer)
             xml2enc_filter(r, NULL, ENCIO_INPUT_CHECKS);
         ap_add_output_filter("proxy-html", NULL, r, r->connection);
     }
@@ -16,14 +16,57 @@
 
 #include "httpd.h"
 #include "http_config.h"
+#include "http_core.h"
 #include "http_log.h"
+#include "http_main.h"
+#include "http_request.h"
 #include "util_filter.h"
+#include "ap_expr.h"
+
+#include "apr_atomic.h"
+#include "apr_hash.h"
+#include "apr_shm.h"
+#include "apr_strings.h"
 
 #include "mod_ratelimit.h"
 
 #define RATE_LIMIT_FILTER_NAME "RATE_LIMIT"
 #define RATE_INTERVAL_MS (200)
 
+module AP_MODULE_DECLARE_DATA ratelimit_module;
+
+/* A limit shared by all the children, as a token bucket: using the generic
+ * cell rate algorithm, the state of a bucket is a single time (the
+ * "theoretical arrival time" of the next unit once the previous ones are
+ * paid for), each unit costing 1/rate second and the bucket holding up to
+ * tolerance worth of units in advance.  It's updated with a compare and
+ * swap on the shared table below, with no lock.
+ */
+typedef struct rl_limit_t
+{
+    apr_int64_t rate;               /* units (requests or bytes) / second */
+    apr_interval_time_t tolerance;  /* burst allowance */
+} rl_limit_t;
+
+typedef struct rl_dir_conf
+{
+    ap_expr_info_t *key;    /* NULL for the client IP address */
+    rl_limit_t *requests;
+    rl_limit_t *bandwidth;
+    unsigned int requests_set:1;
+    unsigned int bandwidth_set:1;
+} rl_dir_conf;
+
+/* The buckets are found by hashing the key with the limit in a fixed size
+ * table, which is approximate whenever two keys collide: they then share a
+ * bucket, which can only limit them sooner.
+ */
+#define RATE_LIMIT_DEFAULT_SLOTS (4096)
+static apr_uint32_t rl_num_slots;
+static int rl_shared_used;
+static apr_uint64_t *rl_slots;
+static ap_filter_rec_t *rl_filter_handle;
+
 typedef enum rl_state_e
 {
     RATE_LIMIT,
@@ -37,6 +80,8 @@ typedef struct rl_ctx_t
     int burst;
     int do_sleep;
     rl_state_e state;
+    const rl_limit_t *shared;   /* RateLimitBandwidth, if not rate-limit */
+    apr_uint64_t *slot;
     apr_bucket_brigade *tmpbb;
     apr_bucket_brigade *holdingbb;
 } rl_ctx_t;
@@ -56,6 +101,72 @@ static void brigade_dump(request_rec *r, apr_bucket_brigade *bb)
 }
 #endif /* RLFDEBUG */
 
+/* The bucket of limit for the key of r, or NULL if the shared table is not
+ * available.
+ */
+static apr_uint64_t *rl_slot_get(request_rec *r, const rl_dir_conf *conf,
+                                 const rl_limit_t *limit)
+{
+    const char *key = r->useragent_ip;
+    apr_ssize_t len;
+    unsigned int hash;
+
+    if (!rl_slots) {
+        return NULL;
+    }
+    if (conf->key) {
+        const char *err = NULL;
+        key = ap_expr_str_exec(r, conf->key, &err);
+        if (err) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(10537)
+                          "rl: can't evaluate RateLimitKey: %s", err);
+            return NULL;
+        }
+    }
+    if (!key) {
+        key = "";
+    }
+
+    /* limits are allocated at configuration time, so they have the same
+     * address in all the children: a distinct bucket per limit and key.
+     */
+    len = strlen(key);
+    hash = apr_hashfunc_default(key, &len);
+    hash ^= (unsigned int)((apr_uintptr_t)limit >> 4) * 2654435761u;
+    return &rl_slots[hash % rl_num_slots];
+}
+
+/* Take units from the bucket.  Returns how long the caller has to wait
+ * before they are available: zero when they are, otherwise they are only
+ * taken if debt is allowed.
+ */
+static apr_interval_time_t rl_take(apr_uint64_t *slot,
+                                   const rl_limit_t *limit,
+                                   apr_off_t units, int debt)
+{
+    apr_time_t now = apr_time_now();
+    apr_uint64_t tat, base, wait;
+    apr_uint64_t cost = units * APR_USEC_PER_SEC / limit->rate;
+
+    for (;;) {
+        tat = apr_atomic_read64(slot);
+        base = (tat > (apr_uint64_t)now) ? tat : (apr_uint64_t)now;
+        wait = base - now;
+        if (wait <= (apr_uint64_t)limit->tolerance) {
+            wait = 0;
+        }
+        else {
+            wait -= limit->tolerance;
+            if (!debt) {
+                return wait;
+            }
+        }
+        if (apr_atomic_cas64(slot, base + cost, tat) == tat) {
+            return wait;
+        }
+    }
+}
+
 static apr_status_t
 rate_limit_filter(ap_filter_t *f, apr_bucket_brigade *bb)
 {
@@ -66,6 +177,8 @@ rate_limit_filter(ap_filter_t *f, apr_bucket_brigade *bb)
     /* Set up our rl_ctx_t on first use */
     if (ctx == NULL) {
         const char *rl = NULL;
+        const rl_limit_t *shared = NULL;
+        apr_uint64_t *slot = NULL;
         int ratelimit;
         int burst = 0;
 
@@ -79,12 +192,22 @@ rate_limit_filter(ap_filter_t *f, apr_bucket_brigade *bb)
         rl = apr_table_get(f->r->subprocess_env, "rate-limit");
 
         if (rl == NULL) {
-            ap_remove_output_filter(f);
-            return ap_pass_brigade(f->next, bb);
+            rl_dir_conf *conf = ap_get_module_config(f->r->per_dir_config,
+                                                     &ratelimit_module);
+            if (conf->bandwidth) {
+                slot = rl_slot_get(f->r, conf, conf->bandwidth);
+            }
+            if (slot == NULL) {
+                ap_remove_output_filter(f);
+                return ap_pass_brigade(f->next, bb);
+            }
+            shared = conf->bandwidth;
+            ratelimit = (int)shared->rate;
+        }
+        else {
+            /* rl is in kilo bytes / second  */
+            ratelimit = atoi(rl) * 1024;
         }
-        
-        /* rl is in kilo bytes / second  */
-        ratelimit = atoi(rl) * 1024;
         if (ratelimit <= 0) {
             /* remove ourselves */
             ap_log_rerror(APLOG_MARK, APLOG_INFO, 0, f->r,
@@ -93,8 +216,13 @@ rate_limit_filter(ap_filter_t *f, apr_bucket_brigade *bb)
             return ap_pass_brigade(f->next, bb);
         }
 
-        /* Configuration: optional initial burst */
-        rl = apr_table_get(f->r->subprocess_env, "rate-initial-burst");
+        /* Configuration: optional initial burst (the shared bucket has
+         * its own)
+         */
+        rl = NULL;
+        if (!shared) {
+            rl = apr_table_get(f->r->subprocess_env, "rate-initial-burst");
+        }
         if (rl != NULL) {
             burst = atoi(rl) * 1024;
             if (burst <= 0) {
@@ -111,6 +239,8 @@ rate_limit_filter(ap_filter_t *f, apr_bucket_brigade *bb)
         ctx->speed = ratelimit;
         ctx->burst = burst;
         ctx->do_sleep = 0;
+        ctx->shared = shared;
+        ctx->slot = slot;
 
         /* calculate how many bytes / interval we want to send */
         /* speed is bytes / second, so, how many  (speed / 1000 % interval) */
@@ -220,7 +350,17 @@ rate_limit_filter(ap_filter_t *f, apr_bucket_brigade *bb)
                 brigade_dump(f->r, bb);
 #endif /* RLFDEBUG */
 
-                if (ctx->do_sleep) {
+                if (ctx->shared) {
+                    /* Pay for len with the other responses of the key,
+                     * waiting for our turn if the bucket is in debt.
+                     */
+                    apr_interval_time_t wait;
+                    wait = rl_take(ctx->slot, ctx->shared, len, 1);
+                    if (wait > 0) {
+                        apr_sleep(wait);
+                    }
+                }
+                else if (ctx->do_sleep) {
                     apr_sleep(RATE_INTERVAL_MS * 1000);
                 }
                 else {
@@ -322,19 +462,229 @@ AP_RL_DECLARE_DATA const apr_bucket_type_t ap_rl_bucket_type_start = {
 
 
 
+/* RateLimitRequests: refuse the requests above the rate right away, no
+ * worker waits for the bucket to refill.
+ */
+static int rl_fixups(request_rec *r)
+{
+    rl_dir_conf *conf;
+    apr_uint64_t *slot;
+    apr_interval_time_t wait;
+
+    /* count the requests of the clients only */
+    if (r->main || r->prev) {
+        return DECLINED;
+    }
+    conf = ap_get_module_config(r->per_dir_config, &ratelimit_module);
+    if (!conf->requests
+            || !(slot = rl_slot_get(r, conf, conf->requests))) {
+        return DECLINED;
+    }
+
+    wait = rl_take(slot, conf->requests, 1, 0);
+    if (wait > 0) {
+        apr_table_setn(r->err_headers_out, "Retry-After",
+                       apr_psprintf(r->pool, "%" APR_TIME_T_FMT,
+                                    apr_time_sec(wait + APR_USEC_PER_SEC
+                                                 - 1)));
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(10538)
+                      "rl: RateLimitRequests exceeded, request refused");
+        return HTTP_TOO_MANY_REQUESTS;
+    }
+    return DECLINED;
+}
+
+/* RateLimitBandwidth: no SetOutputFilter needed */
+static void rl_insert_filter(request_rec *r)
+{
+    rl_dir_conf *conf;
+
+    if (r->main) {
+        return;
+    }
+    conf = ap_get_module_config(r->per_dir_config, &ratelimit_module);
+    if (conf->bandwidth) {
+        ap_filter_t *of;
+
+        /* unless it's already there */
+        for (of = r->output_filters; of; of = of->next) {
+            if (of->frec == rl_filter_handle) {
+                return;
+            }
+        }
+        ap_add_output_filter_handle(rl_filter_handle, NULL, r, r->connection);
+    }
+}
+
+static int rl_pre_config(apr_pool_t *pconf, apr_pool_t *plog,
+                         apr_pool_t *ptemp)
+{
+    rl_num_slots = RATE_LIMIT_DEFAULT_SLOTS;
+    rl_shared_used = 0;
+    return OK;
+}
+
+static int rl_post_config(apr_pool_t *pconf, apr_pool_t *plog,
+                          apr_pool_t *ptemp, server_rec *s)
+{
+    rl_slots = NULL;
+    if (ap_state_query(AP_SQ_MAIN_STATE) != AP_SQ_MS_CREATE_PRE_CONFIG
+            && rl_shared_used) {
+        apr_size_t size = rl_num_slots * sizeof(apr_uint64_t);
+        apr_shm_t *shm;
+        apr_status_t rv;
+
+        /* inherited by the children, new buckets on every restart */
+        rv = apr_shm_create(&shm, size, NULL, pconf);
+        if (rv != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_WARNING, rv, s, APLOGNO(10539)
+                         "rl: could not create the shared memory of the "
+                         "rate limits, RateLimitRequests and "
+                         "RateLimitBandwidth won't apply");
+        }
+        else {
+            rl_slots = apr_shm_baseaddr_get(shm);
+            memset(rl_slots, 0, size);
+        }
+    }
+    return OK;
+}
+
+static void *rl_create_dir_config(apr_pool_t *p, char *dummy)
+{
+    return apr_pcalloc(p, sizeof(rl_dir_conf));
+}
+
+static void *rl_merge_dir_config(apr_pool_t *p, void *basev, void *addv)
+{
+    rl_dir_conf *base = basev, *add = addv;
+    rl_dir_conf *conf = apr_palloc(p, sizeof(rl_dir_conf));
+
+    conf->key = add->key ? add->key : base->key;
+    conf->requests = add->requests_set ? add->requests : base->requests;
+    conf->requests_set = add->requests_set || base->requests_set;
+    conf->bandwidth = add->bandwidth_set ? add->bandwidth : base->bandwidth;
+    conf->bandwidth_set = add->bandwidth_set || base->bandwidth_set;
+    return conf;
+}
+
+static const char *set_limit(cmd_parms *cmd, rl_limit_t **plimit,
+                             const char *arg_rate, const char *arg_burst,
+                             apr_int64_t unit)
+{
+    rl_limit_t *limit;
+    apr_int64_t rate, burst = 0;
+    char *end;
+
+    rate = apr_strtoi64(arg_rate, &end, 10);
+    if (*end || rate < 0 || rate > APR_INT32_MAX / unit) {
+        return apr_pstrcat(cmd->pool, cmd->cmd->name,
+                           ": invalid rate ", arg_rate, NULL);
+    }
+    if (arg_burst) {
+        burst = apr_strtoi64(arg_burst, &end, 10);
+        if (*end || burst < 0 || burst > APR_INT32_MAX / unit) {
+            return apr_pstrcat(cmd->pool, cmd->cmd->name,
+                               ": invalid burst ", arg_burst, NULL);
+        }
+    }
+    if (rate == 0) {
+        /* "0" disables an inherited limit */
+        *plimit = NULL;
+        return NULL;
+    }
+
+    /* the limit is the bucket (with the key): same limit, same buckets */
+    limit = apr_palloc(cmd->pool, sizeof(rl_limit_t));
+    limit->rate = rate * unit;
+    limit->tolerance = burst * unit * APR_USEC_PER_SEC / limit->rate;
+    *plimit = limit;
+    rl_shared_used = 1;
+    return NULL;
+}
+
+static const char *set_requests(cmd_parms *cmd, void *dconf,
+                                const char *rate, const char *burst)
+{
+    rl_dir_conf *conf = dconf;
+    conf->requests_set = 1;
+    return set_limit(cmd, &conf->requests, rate, burst, 1);
+}
+
+static const char *set_bandwidth(cmd_parms *cmd, void *dconf,
+                                 const char *rate, const char *burst)
+{
+    rl_dir_conf *conf = dconf;
+    conf->bandwidth_set = 1;
+    return set_limit(cmd, &conf->bandwidth, rate, burst, 1024);
+}
+
+static const char *set_key(cmd_parms *cmd, void *dconf, const char *arg)
+{
+    rl_dir_conf *conf = dconf;
+    const char *err = NULL;
+
+    conf->key = ap_expr_parse_cmd(cmd, arg, AP_EXPR_FLAG_STRING_RESULT,
+                                  &err, NULL);
+    if (err) {
+        return apr_pstrcat(cmd->pool, "Can't parse RateLimitKey: ", err,
+                           NULL);
+    }
+    return NULL;
+}
+
+static const char *set_slots(cmd_parms *cmd, void *dummy, const char *arg)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+    int n;
+    if (err != NULL) {
+        return err;
+    }
+
+    n = atoi(arg);
+    if (n <= 0) {
+        return "RateLimitSlots must be a positive number";
+    }
+    rl_num_slots = n;
+    return NULL;
+}
+
+static const command_rec rl_cmds[] =
+{
+    AP_INIT_TAKE1("RateLimitKey", set_key, NULL, RSRC_CONF|ACCESS_CONF,
+                  "An expression whose value selects the shared rate limits "
+                  "buckets, the client IP address by default"),
+    AP_INIT_TAKE12("RateLimitRequests", set_requests, NULL,
+                   RSRC_CONF|ACCESS_CONF,
+                   "Requests per second for each key, and optional burst "
+                   "(in extra requests), above which 429 is returned"),
+    AP_INIT_TAKE12("RateLimitBandwidth", set_bandwidth, NULL,
+                   RSRC_CONF|ACCESS_CONF,
+                   "Bandwidth in KiB/s shared by the responses of each key, "
+                   "and optional burst (in KiB)"),
+    AP_INIT_TAKE1("RateLimitSlots", set_slots, NULL, RSRC_CONF,
+                  "Number of shared rate limits buckets"),
+    {NULL}
+};
+
 static void register_hooks(apr_pool_t *p)
 {
     /* run after mod_deflate etc etc, but not at connection level, ie, mod_ssl. */
-    ap_register_output_filter(RATE_LIMIT_FILTER_NAME, rate_limit_filter,
-                              NULL, AP_FTYPE_CONNECTION - 1);
+    rl_filter_handle =
+        ap_register_output_filter(RATE_LIMIT_FILTER_NAME, rate_limit_filter,
+                                  NULL, AP_FTYPE_CONNECTION - 1);
+    ap_hook_pre_config(rl_pre_config, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_post_config(rl_post_config, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_fixups(rl_fixups, NULL, NULL, APR_HOOK_REALLY_FIRST);
+    ap_hook_insert_filter(rl_insert_filter, NULL, NULL, APR_HOOK_MIDDLE);
 }
 
 AP_DECLARE_MODULE(ratelimit) = {
     STANDARD20_MODULE_STUFF,
-    NULL,                       /* create per-directory config structure */
-    NULL,                       /* merge per-directory config structures */
+    rl_create_dir_config,       /* create per-directory config structure */
+    rl_merge_dir_config,        /* merge per-directory config structures */
     NULL,                       /* create per-server config structure */
     NULL,                       /* merge per-server config structures */
-    NULL,                       /* command apr_table_t */
+    rl_cmds,                    /* command apr_table_t */
     register_hooks
 };
@@ -52,6 +52,7 @@ typedef struct subst_pattern_t {
     apr_size_t replen;
     apr_size_t patlen;
     int flatten;
+    int icase;
     const char *from;
     ap_expr_info_t* expr_replacement;
 } subst_pattern_t;
@@ -61,14 +62,42 @@ typedef struct {
     apr_size_t max_line_length;
     int max_line_length_set;
     int inherit_before;
+    int multi_pattern;
 } subst_dir_conf;
 
+/*
+ * With SubstituteMultiPattern, the literal patterns are looked up at once in
+ * a prefix tree keyed on their case-folded bytes, for the longest one which
+ * matches at each position of the (unflattened) body.
+ */
+typedef struct subst_trie_node_t subst_trie_node_t;
+struct subst_trie_node_t {
+    subst_trie_node_t *child;       /* first child */
+    subst_trie_node_t *sibling;     /* next child of the parent */
+    int patterns;                   /* first pattern ending here, or -1 */
+    unsigned char key;              /* case-folded byte */
+};
+
+typedef struct {
+    subst_trie_node_t *root[256];   /* by (unfolded) first byte */
+    int *next;                      /* next pattern ending on the same node */
+    const subst_pattern_t *scripts;
+    apr_size_t maxlen;              /* longest literal pattern */
+} subst_trie_t;
+
 typedef struct {
     apr_bucket_brigade *linebb;
     apr_bucket_brigade *linesbb;
     apr_bucket_brigade *passbb;
     apr_bucket_brigade *pattbb;
     apr_pool_t *tpool;
+    /* SubstituteMultiPattern */
+    subst_trie_t *trie;
+    apr_bucket_brigade *streambb;   /* output of the literal patterns */
+    char *hold;                     /* bytes of a possible match, pending */
+    apr_size_t holdlen;
+    int nout;                       /* buckets in streambb */
+    int nregexps;                   /* regex patterns still run per line */
 } substitute_module_ctx;
 
 typedef struct { 
@@ -85,6 +114,7 @@ static void *create_substitute_dcfg(apr_pool_t *p, char *d)
     dcfg->max_line_length = AP_SUBST_MAX_LINE_LENGTH;
     dcfg->max_line_length_set = 0;
     dcfg->inherit_before = -1;
+    dcfg->multi_pattern = -1;
     return dcfg;
 }
 
@@ -116,6 +146,9 @@ static void *merge_substitute_dcfg(apr_pool_t *p, void *basev, void *overv)
                              over->max_line_length : base->max_line_length;
     a->max_line_length_set = over->max_line_length_set
                            | base->max_line_length_set;
+    a->multi_pattern = (over->multi_pattern != -1)
+                            ? over->multi_pattern
+                            : base->multi_pattern;
     return a;
 }
 
@@ -152,6 +185,7 @@ static apr_status_t do_pattmatch(ap_filter_t *f, apr_bucket *inb,
     subst_req_t *rconf = 
     (subst_req_t*) ap_get_module_config(f->r->request_config, 
                                         &substitute_module);
+    substitute_module_ctx *ctx = f->ctx;
 
     APR_BRIGADE_INSERT_TAIL(mybb, inb);
     ap_varbuf_init(pool, &vb, 0);
@@ -161,12 +195,17 @@ static apr_status_t do_pattmatch(ap_filter_t *f, apr_bucket *inb,
      * Simple optimization. If we only have one pattern, then
      * we can safely avoid the overhead of flattening
      */
-    if (cfg->patterns->nelts == 1) {
+    if ((ctx->trie ? ctx->nregexps : cfg->patterns->nelts) == 1) {
        force_quick = 1;
     }
     for (i = 0; i < cfg->patterns->nelts; i++) {
         const char *replacement = script->replacement;
         apr_size_t replen = script->replen;
+        if (ctx->trie && script->pattern) {
+            /* Already applied by substitute_stream() */
+            script++;
+            continue;
+        }
         if (script->expr_replacement) { 
             if (!rconf) { 
                 rconf = apr_pcalloc(f->r->pool, sizeof(*rconf));
@@ -410,6 +449,371 @@ static apr_status_t do_pattmatch(ap_filter_t *f, apr_bucket *inb,
     return APR_SUCCESS;
 }
 
+static subst_trie_t *subst_trie_make(apr_pool_t *p, subst_dir_conf *cfg)
+{
+    const subst_pattern_t *script = (subst_pattern_t *)cfg->patterns->elts;
+    subst_trie_t *trie = apr_pcalloc(p, sizeof(*trie));
+    int i, c;
+
+    trie->scripts = script;
+    trie->next = apr_palloc(p, cfg->patterns->nelts * sizeof(int));
+    for (i = 0; i < cfg->patterns->nelts; i++) {
+        subst_trie_node_t **pn, *node = NULL;
+        apr_size_t k;
+        int *last;
+
+        trie->next[i] = -1;
+        if (!script[i].pattern) {
+            continue;
+        }
+        pn = &trie->root[apr_tolower((unsigned char)script[i].from[0])];
+        for (k = 0; k < script[i].patlen; k++) {
+            unsigned char key = apr_tolower((unsigned char)script[i].from[k]);
+            if (k) {
+                pn = &node->child;
+            }
+            while (*pn && (*pn)->key != key) {
+                pn = &(*pn)->sibling;
+            }
+            if (!*pn) {
+                *pn = apr_pcalloc(p, sizeof(**pn));
+                (*pn)->key = key;
+                (*pn)->patterns = -1;
+            }
+            node = *pn;
+        }
+        /* Keep the configuration order among the same case-folded ones */
+        for (last = &node->patterns; *last >= 0; last = &trie->next[*last]);
+        *last = i;
+        if (trie->maxlen < script[i].patlen) {
+            trie->maxlen = script[i].patlen;
+        }
+    }
+    /* Lookup the first byte case-insensitively without folding it */
+    for (c = 0; c < 256; c++) {
+        if (apr_tolower(c) != c) {
+            trie->root[c] = trie->root[apr_tolower(c)];
+        }
+    }
+    return trie;
+}
+
+/*
+ * Longest literal pattern matching at the start of buf, returning its index
+ * (or -1) and setting *mlen. Sets *more if the len bytes of buf don't suffice
+ * to tell whether a longer one matches.
+ */
+static int subst_trie_match(const subst_trie_t *trie, const char *buf,
+                            apr_size_t len, apr_size_t *mlen, int *more)
+{
+    const subst_trie_node_t *node = trie->root[(unsigned char)buf[0]];
+    apr_size_t n = 1;
+    int best = -1;
+
+    *more = 0;
+    while (node) {
+        int i;
+        for (i = node->patterns; i >= 0; i = trie->next[i]) {
+            if (trie->scripts[i].icase || !memcmp(buf, trie->scripts[i].from,
+                                                  n)) {
+                best = i;
+                *mlen = n;
+                break;
+            }
+        }
+        if (!node->child) {
+            break;
+        }
+        if (n == len) {
+            *more = 1;
+            break;
+        }
+        for (node = node->child;
+             node && node->key != apr_tolower((unsigned char)buf[n]);
+             node = node->sibling);
+        n++;
+    }
+    return best;
+}
+
+/*
+ * Finds the first literal match starting in buf[pos..stop), whose bytes may
+ * go up to len. Returns APR_SUCCESS with *at, *mlen and *idx set, APR_INCOMPLETE
+ * with *at set to where more bytes are needed (unless eos), or APR_NOTFOUND.
+ */
+static apr_status_t subst_trie_find(const subst_trie_t *trie, const char *buf,
+                                    apr_size_t len, apr_size_t pos,
+                                    apr_size_t stop, int eos, apr_size_t *at,
+                                    apr_size_t *mlen, int *idx)
+{
+    for (; pos < stop; pos++) {
+        int more;
+        if (!trie->root[(unsigned char)buf[pos]]) {
+            continue;
+        }
+        *idx = subst_trie_match(trie, buf + pos, len - pos, mlen, &more);
+        if (more && !eos) {
+            *at = pos;
+            return APR_INCOMPLETE;
+        }
+        if (*idx >= 0) {
+            *at = pos;
+            return APR_SUCCESS;
+        }
+    }
+    return APR_NOTFOUND;
+}
+
+/* The replacement of the i-th pattern, its expression evaluated once per
+ * request.
+ */
+static apr_status_t subst_replacement(ap_filter_t *f, subst_dir_conf *cfg,
+                                      int i, const char **repl,
+                                      apr_size_t *replen)
+{
+    const subst_pattern_t *script = &((subst_pattern_t *)cfg->patterns->elts)[i];
+    subst_req_t *rconf;
+
+    if (!script->expr_replacement) {
+        *repl = script->replacement;
+        *replen = script->replen;
+        return APR_SUCCESS;
+    }
+
+    rconf = ap_get_module_config(f->r->request_config, &substitute_module);
+    if (!rconf) {
+        rconf = apr_pcalloc(f->r->pool, sizeof(*rconf));
+        rconf->expcache     = apr_pcalloc(f->r->pool, sizeof(const char*) * cfg->patterns->nelts);
+        rconf->expcache_len = apr_pcalloc(f->r->pool, sizeof(int) * cfg->patterns->nelts);
+        ap_set_module_config(f->r->request_config, &substitute_module, rconf);
+    }
+    if (!rconf->expcache[i]) {
+        const char *err = NULL;
+        rconf->expcache[i] = ap_expr_str_exec(f->r, script->expr_replacement,
+                                              &err);
+        if (err) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, f->r, APLOGNO(10549)
+                          "error evaluating expression: %s", err);
+            rconf->expcache[i] = NULL;
+            return APR_EINVAL;
+        }
+        rconf->expcache_len[i] = strlen(rconf->expcache[i]);
+    }
+    *repl = rconf->expcache[i];
+    *replen = rconf->expcache_len[i];
+    return APR_SUCCESS;
+}
+
+/*
+ * Replaces the literal matches starting in buf[0..stop) (possibly ending
+ * beyond, up to len), copying the result to outbb. *end is set to where
+ * it stopped, the remaining bytes being pending (or not scanned yet).
+ */
+static apr_status_t subst_stream_buf(ap_filter_t *f, subst_dir_conf *cfg,
+                                     const char *buf, apr_size_t len,
+                                     apr_size_t stop, int eos,
+                                     apr_bucket_brigade *outbb,
+                                     apr_size_t *end)
+{
+    substitute_module_ctx *ctx = f->ctx;
+    apr_bucket_alloc_t *ba = f->c->bucket_alloc;
+    apr_size_t pos = 0, at, mlen;
+    apr_status_t rv;
+    int idx;
+
+    while (pos < stop) {
+        const char *repl;
+        apr_size_t replen;
+
+        rv = subst_trie_find(ctx->trie, buf, len, pos, stop, eos,
+                             &at, &mlen, &idx);
+        if (rv == APR_NOTFOUND) {
+            at = stop;
+        }
+        if (at > pos) {
+            ctx->nout++;
+            APR_BRIGADE_INSERT_TAIL(outbb,
+                    apr_bucket_heap_create(buf + pos, at - pos, NULL, ba));
+        }
+        pos = at;
+        if (rv != APR_SUCCESS) {
+            break;
+        }
+        rv = subst_replacement(f, cfg, idx, &repl, &replen);
+        if (rv != APR_SUCCESS) {
+            return rv;
+        }
+        ctx->nout++;
+        APR_BRIGADE_INSERT_TAIL(outbb,
+                apr_bucket_transient_create(repl, replen, ba));
+        pos += mlen;
+    }
+    *end = pos;
+    return APR_SUCCESS;
+}
+
+/*
+ * Same as subst_stream_buf() for the data bucket b (of the given bytes,
+ * the first skip of which are already replaced), splitting it rather than
+ * copying. What may start a match ending in the next bucket is held back.
+ */
+static apr_status_t subst_stream_bucket(ap_filter_t *f, subst_dir_conf *cfg,
+                                        apr_bucket *b, const char *buf,
+                                        apr_size_t bytes, apr_size_t skip,
+                                        apr_bucket_brigade *outbb)
+{
+    substitute_module_ctx *ctx = f->ctx;
+    apr_size_t pos = skip, at, mlen;
+    apr_bucket *tmp_b = NULL;
+    apr_status_t rv;
+    int idx;
+
+    if (skip) {
+        apr_bucket_split(b, skip);
+        tmp_b = APR_BUCKET_NEXT(b);
+        apr_bucket_delete(b);
+        b = tmp_b;
+    }
+    while (pos < bytes) {
+        const char *repl;
+        apr_size_t replen;
+
+        rv = subst_trie_find(ctx->trie, buf, bytes, pos, bytes, 0,
+                             &at, &mlen, &idx);
+        if (rv == APR_NOTFOUND) {
+            ctx->nout++;
+            APR_BUCKET_REMOVE(b);
+            APR_BRIGADE_INSERT_TAIL(outbb, b);
+            return APR_SUCCESS;
+        }
+        if (at > pos) {
+            apr_bucket_split(b, at - pos);
+            tmp_b = APR_BUCKET_NEXT(b);
+            ctx->nout++;
+            APR_BUCKET_REMOVE(b);
+            APR_BRIGADE_INSERT_TAIL(outbb, b);
+            b = tmp_b;
+        }
+        if (rv == APR_INCOMPLETE) {
+            memcpy(ctx->hold, buf + at, bytes - at);
+            ctx->holdlen = bytes - at;
+            apr_bucket_delete(b);
+            return APR_SUCCESS;
+        }
+        rv = subst_replacement(f, cfg, idx, &repl, &replen);
+        if (rv != APR_SUCCESS) {
+            return rv;
+        }
+        pos = at + mlen;
+        tmp_b = NULL;
+        if (pos < bytes) {
+            apr_bucket_split(b, mlen);
+            tmp_b = APR_BUCKET_NEXT(b);
+        }
+        apr_bucket_delete(b);
+        ctx->nout++;
+        APR_BRIGADE_INSERT_TAIL(outbb,
+                apr_bucket_transient_create(repl, replen, f->c->bucket_alloc));
+        b = tmp_b;
+    }
+    return APR_SUCCESS;
+}
+
+/*
+ * Applies all the literal patterns in a single pass over the data buckets
+ * of bb, moved to outbb, without looking for lines: at each position the
+ * longest pattern which matches is replaced, and the replacement is not
+ * matched again. Only the bytes which may start a match spanning buckets
+ * are copied, and held back until the next ones.
+ */
+static apr_status_t substitute_stream(ap_filter_t *f,
+                                      apr_bucket_brigade *bb,
+                                      apr_bucket_brigade *outbb)
+{
+    subst_dir_conf *cfg =
+    (subst_dir_conf *) ap_get_module_config(f->r->per_dir_config,
+                                             &substitute_module);
+    substitute_module_ctx *ctx = f->ctx;
+    apr_size_t maxlen = ctx->trie->maxlen;
+    apr_size_t bytes, end;
+    const char *buff;
+    apr_bucket *b;
+    apr_status_t rv;
+
+    while (!APR_BRIGADE_EMPTY(bb)) {
+        b = APR_BRIGADE_FIRST(bb);
+        if (APR_BUCKET_IS_METADATA(b)) {
+            if (APR_BUCKET_IS_EOS(b) && ctx->holdlen) {
+                rv = subst_stream_buf(f, cfg, ctx->hold, ctx->holdlen,
+                                      ctx->holdlen, 1, outbb, &end);
+                if (rv != APR_SUCCESS) {
+                    return rv;
+                }
+                ctx->holdlen = 0;
+            }
+            APR_BUCKET_REMOVE(b);
+            APR_BRIGADE_INSERT_TAIL(outbb, b);
+            continue;
+        }
+
+        rv = apr_bucket_read(b, &buff, &bytes, APR_BLOCK_READ);
+        if (rv != APR_SUCCESS || bytes == 0) {
+            apr_bucket_delete(b);
+            continue;
+        }
+
+        if (ctx->holdlen && bytes < maxlen) {
+            /* Small enough to be held back too */
+            memcpy(ctx->hold + ctx->holdlen, buff, bytes);
+            ctx->holdlen += bytes;
+            apr_bucket_delete(b);
+            rv = subst_stream_buf(f, cfg, ctx->hold, ctx->holdlen,
+                                  ctx->holdlen, 0, outbb, &end);
+            if (rv != APR_SUCCESS) {
+                return rv;
+            }
+            ctx->holdlen -= end;
+            memmove(ctx->hold, ctx->hold + end, ctx->holdlen);
+            continue;
+        }
+
+        end = 0;
+        if (ctx->holdlen) {
+            /* Enough of this bucket to complete the matches starting in
+             * what was held back (no more can be pending then).
+             */
+            memcpy(ctx->hold + ctx->holdlen, buff, maxlen - 1);
+            rv = subst_stream_buf(f, cfg, ctx->hold,
+                                  ctx->holdlen + maxlen - 1, ctx->holdlen,
+                                  0, outbb, &end);
+            if (rv != APR_SUCCESS) {
+                return rv;
+            }
+            end -= ctx->holdlen;
+            ctx->holdlen = 0;
+        }
+        rv = subst_stream_bucket(f, cfg, b, buff, bytes, end, outbb);
+        if (rv != APR_SUCCESS) {
+            return rv;
+        }
+
+        /* Same safety measure as for the lines in substitute_filter(),
+         * when nothing is left to do on outbb.
+         */
+        if (!ctx->nregexps && ctx->nout > AP_MAX_BUCKETS) {
+            APR_BRIGADE_INSERT_TAIL(outbb,
+                    apr_bucket_flush_create(f->c->bucket_alloc));
+            rv = ap_pass_brigade(f->next, outbb);
+            apr_brigade_cleanup(outbb);
+            ctx->nout = 0;
+            if (rv != APR_SUCCESS) {
+                return rv;
+            }
+        }
+    }
+    return APR_SUCCESS;
+}
+
 static apr_status_t substitute_filter(ap_filter_t *f, apr_bucket_brigade *bb)
 {
     apr_size_t bytes;
@@ -452,6 +856,26 @@ static apr_status_t substitute_filter(ap_filter_t *f, apr_bucket_brigade *bb)
         apr_pool_create(&(ctx->tpool), f->r->pool);
         apr_pool_tag(ctx->tpool, "substitute_tpool");
         apr_table_unset(f->r->headers_out, "Content-Length");
+
+        if (cfg->multi_pattern == 1) {
+            subst_pattern_t *script = (subst_pattern_t *)cfg->patterns->elts;
+            int i, nliterals = 0;
+
+            for (i = 0; i < cfg->patterns->nelts; i++) {
+                if (script[i].pattern) {
+                    nliterals++;
+                }
+                else {
+                    ctx->nregexps++;
+                }
+            }
+            if (nliterals) {
+                ctx->trie = subst_trie_make(f->r->pool, cfg);
+                ctx->hold = apr_palloc(f->r->pool, 2 * ctx->trie->maxlen);
+                ctx->streambb = apr_brigade_create(f->r->pool,
+                                                   f->c->bucket_alloc);
+            }
+        }
     }
 
     /*
@@ -460,6 +884,29 @@ static apr_status_t substitute_filter(ap_filter_t *f, apr_bucket_brigade *bb)
     if (APR_BRIGADE_EMPTY(bb))
         return APR_SUCCESS;
 
+    /*
+     * With SubstituteMultiPattern, the literal patterns are applied first
+     * in a single (streaming) pass, and the regex ones line by line on its
+     * output, if any.
+     */
+    if (ctx->trie) {
+        rv = substitute_stream(f, bb, ctx->streambb);
+        if (rv != APR_SUCCESS)
+            goto err;
+        if (!ctx->nregexps) {
+            if (!APR_BRIGADE_EMPTY(ctx->streambb)
+                && APR_BUCKET_IS_EOS(APR_BRIGADE_LAST(ctx->streambb))) {
+                ap_remove_output_filter(f);
+            }
+            rv = ap_pass_brigade(f->next, ctx->streambb);
+            apr_brigade_cleanup(ctx->streambb);
+            ctx->nout = 0;
+            return rv;
+        }
+        bb = ctx->streambb;
+        ctx->nout = 0;
+    }
+
     /*
      * Here's the concept:
      *  Read in the data and look for newlines. Once we
@@ -730,6 +1177,7 @@ static const char *set_pattern(cmd_parms *cmd, void *cfg, const char *line)
     nscript->regexp = NULL;
     nscript->replacement = NULL;
     nscript->patlen = 0;
+    nscript->icase = ignore_case;
     nscript->from = from;
 
     if (is_pattern) {
@@ -813,6 +1261,9 @@ static const command_rec substitute_cmds[] = {
     AP_INIT_FLAG("SubstituteInheritBefore", ap_set_flag_slot,
                  (void *)APR_OFFSETOF(subst_dir_conf, inherit_before), OR_FILEINFO,
                  "Apply inherited patterns before those of the current context"),
+    AP_INIT_FLAG("SubstituteMultiPattern", ap_set_flag_slot,
+                 (void *)APR_OFFSETOF(subst_dir_conf, multi_pattern), OR_FILEINFO,
+                 "Apply all the literal patterns at once, in a single pass"),
     {NULL}
 };
 
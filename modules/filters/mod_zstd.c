@@ -0,0 +1,770 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * mod_zstd: the ZSTD_COMPRESS output filter, compressing responses with
+ * Zstandard (RFC 8878) when the client accepts the "zstd" coding.
+ *
+ * It follows mod_brotli closely: same eligibility rules, ETag modes and
+ * filter notes.  On top of that, responses whose length is known up front
+ * can be compressed at a different level, and large ones by several
+ * worker threads (when libzstd was built with multithreading).
+ */
+
+#include "httpd.h"
+#include "http_config.h"
+#include "http_core.h"
+#include "http_log.h"
+#include "scoreboard.h"
+#include "apr_strings.h"
+
+#define ZSTD_STATIC_LINKING_ONLY /* ZSTD_customMem, ZSTD_getCParams() */
+#include <zstd.h>
+
+module AP_MODULE_DECLARE_DATA zstd_module;
+
+typedef enum {
+    ETAG_MODE_ADDSUFFIX = 0,
+    ETAG_MODE_NOCHANGE = 1,
+    ETAG_MODE_REMOVE = 2
+} etag_mode_e;
+
+/* RFC 8878 section 3.1.1.1.2 recommends windows of at most 8MB for HTTP */
+#define ZSTD_MAX_WINDOWLOG 23
+
+typedef struct zstd_server_config_t {
+    int level;
+    int windowlog;
+    /* responses of at least large_size bytes use large_level */
+    apr_off_t large_size;
+    int large_level;
+    /* with at least busy_percent busy workers, use busy_level (0: off) */
+    int busy_percent;
+    int busy_level;
+    /* responses of at least workers_size bytes use that many threads */
+    int workers;
+    apr_off_t workers_size;
+    etag_mode_e etag_mode;
+    const char *note_ratio_name;
+    const char *note_input_name;
+    const char *note_output_name;
+} zstd_server_config_t;
+
+static void *create_server_config(apr_pool_t *p, server_rec *s)
+{
+    zstd_server_config_t *conf = apr_pcalloc(p, sizeof(*conf));
+
+    /* Level 3 is libzstd's own default, which compresses about as well
+     * as zlib's level 6 at a fraction of the cost.
+     */
+    conf->level = ZSTD_CLEVEL_DEFAULT;
+    /* Zero for the level's own window, at most ZSTD_MAX_WINDOWLOG */
+    conf->windowlog = 0;
+    conf->large_size = -1;
+    conf->large_level = ZSTD_CLEVEL_DEFAULT;
+    conf->workers = 0;
+    conf->workers_size = 1024 * 1024;
+    conf->etag_mode = ETAG_MODE_ADDSUFFIX;
+
+    return conf;
+}
+
+static const char *set_filter_note(cmd_parms *cmd, void *dummy,
+                                   const char *arg1, const char *arg2)
+{
+    zstd_server_config_t *conf =
+        ap_get_module_config(cmd->server->module_config, &zstd_module);
+
+    if (!arg2) {
+        conf->note_ratio_name = arg1;
+        return NULL;
+    }
+
+    if (ap_cstr_casecmp(arg1, "Ratio") == 0) {
+        conf->note_ratio_name = arg2;
+    }
+    else if (ap_cstr_casecmp(arg1, "Input") == 0) {
+        conf->note_input_name = arg2;
+    }
+    else if (ap_cstr_casecmp(arg1, "Output") == 0) {
+        conf->note_output_name = arg2;
+    }
+    else {
+        return apr_psprintf(cmd->pool, "Unknown ZstdFilterNote type '%s'",
+                            arg1);
+    }
+
+    return NULL;
+}
+
+static const char *parse_level(cmd_parms *cmd, const char *arg, int *level)
+{
+    int val = atoi(arg);
+
+    if (val < 1 || val > ZSTD_maxCLevel()) {
+        return apr_psprintf(cmd->pool, "%s level must be between 1 and %d",
+                            cmd->cmd->name, ZSTD_maxCLevel());
+    }
+
+    *level = val;
+    return NULL;
+}
+
+static const char *parse_size(cmd_parms *cmd, const char *arg,
+                              apr_off_t *size)
+{
+    char *end;
+
+    if (apr_strtoff(size, arg, &end, 10) != APR_SUCCESS || *end
+        || *size < 0) {
+        return apr_pstrcat(cmd->pool, cmd->cmd->name,
+                           " size must be a non-negative integer", NULL);
+    }
+
+    return NULL;
+}
+
+static const char *set_compression_level(cmd_parms *cmd, void *dummy,
+                                         const char *arg)
+{
+    zstd_server_config_t *conf =
+        ap_get_module_config(cmd->server->module_config, &zstd_module);
+
+    return parse_level(cmd, arg, &conf->level);
+}
+
+static const char *set_compression_window(cmd_parms *cmd, void *dummy,
+                                          const char *arg)
+{
+    zstd_server_config_t *conf =
+        ap_get_module_config(cmd->server->module_config, &zstd_module);
+    int val = atoi(arg);
+
+    if (val && (val < ZSTD_WINDOWLOG_MIN || val > ZSTD_MAX_WINDOWLOG)) {
+        return apr_psprintf(cmd->pool,
+                            "ZstdCompressionWindow must be 0 or between %d "
+                            "and %d",
+                            ZSTD_WINDOWLOG_MIN, ZSTD_MAX_WINDOWLOG);
+    }
+
+    conf->windowlog = val;
+    return NULL;
+}
+
+static const char *set_large_level(cmd_parms *cmd, void *dummy,
+                                   const char *arg1, const char *arg2)
+{
+    zstd_server_config_t *conf =
+        ap_get_module_config(cmd->server->module_config, &zstd_module);
+    const char *err;
+
+    if ((err = parse_size(cmd, arg1, &conf->large_size))) {
+        return err;
+    }
+    return parse_level(cmd, arg2, &conf->large_level);
+}
+
+static const char *set_busy_level(cmd_parms *cmd, void *dummy,
+                                  const char *arg1, const char *arg2)
+{
+    zstd_server_config_t *conf =
+        ap_get_module_config(cmd->server->module_config, &zstd_module);
+    int val = atoi(arg1);
+
+    if (val < 1 || val > 100) {
+        return "ZstdCompressionLevelBusy percentage must be between 1 "
+               "and 100";
+    }
+    conf->busy_percent = val;
+
+    if (ap_cstr_casecmp(arg2, "off") == 0) {
+        conf->busy_level = 0;
+        return NULL;
+    }
+    return parse_level(cmd, arg2, &conf->busy_level);
+}
+
+static const char *set_workers(cmd_parms *cmd, void *dummy,
+                               const char *arg1, const char *arg2)
+{
+    zstd_server_config_t *conf =
+        ap_get_module_config(cmd->server->module_config, &zstd_module);
+    int val = atoi(arg1);
+
+    if (val < 0 || val > 64) {
+        return "ZstdWorkers must be between 0 and 64";
+    }
+    conf->workers = val;
+
+    if (arg2) {
+        return parse_size(cmd, arg2, &conf->workers_size);
+    }
+    return NULL;
+}
+
+static const char *set_etag_mode(cmd_parms *cmd, void *dummy,
+                                 const char *arg)
+{
+    zstd_server_config_t *conf =
+        ap_get_module_config(cmd->server->module_config, &zstd_module);
+
+    if (ap_cstr_casecmp(arg, "AddSuffix") == 0) {
+        conf->etag_mode = ETAG_MODE_ADDSUFFIX;
+    }
+    else if (ap_cstr_casecmp(arg, "NoChange") == 0) {
+        conf->etag_mode = ETAG_MODE_NOCHANGE;
+    }
+    else if (ap_cstr_casecmp(arg, "Remove") == 0) {
+        conf->etag_mode = ETAG_MODE_REMOVE;
+    }
+    else {
+        return "ZstdAlterETag accepts only 'AddSuffix', 'NoChange' and 'Remove'";
+    }
+
+    return NULL;
+}
+
+typedef struct zstd_ctx_t {
+    ZSTD_CCtx *cctx;
+    apr_bucket_brigade *bb;
+    char *buffer;
+    apr_size_t buffer_size;
+    apr_off_t total_in;
+    apr_off_t total_out;
+} zstd_ctx_t;
+
+static void *alloc_func(void *opaque, size_t size)
+{
+    return apr_bucket_alloc(size, opaque);
+}
+
+static void free_func(void *opaque, void *block)
+{
+    if (block) {
+        apr_bucket_free(block);
+    }
+}
+
+static apr_status_t cleanup_ctx(void *data)
+{
+    zstd_ctx_t *ctx = data;
+
+    ZSTD_freeCCtx(ctx->cctx);
+    ctx->cctx = NULL;
+    return APR_SUCCESS;
+}
+
+static zstd_ctx_t *create_ctx(request_rec *r, zstd_server_config_t *conf,
+                              apr_off_t length, int exact, int busy,
+                              apr_bucket_alloc_t *alloc)
+{
+    zstd_ctx_t *ctx = apr_pcalloc(r->pool, sizeof(*ctx));
+    int level = conf->level;
+    int workers = conf->workers;
+    size_t rv;
+
+    /* Extra threads would only compete with the busy workers. */
+    if (busy) {
+        workers = 0;
+    }
+
+    if (workers) {
+        /* The workers are threads of libzstd's own, they can't allocate
+         * from the (unsynchronized) bucket allocator.
+         */
+        ctx->cctx = ZSTD_createCCtx();
+    }
+    else {
+        ZSTD_customMem mem = { alloc_func, free_func, alloc };
+
+        ctx->cctx = ZSTD_createCCtx_advanced(mem);
+    }
+    if (!ctx->cctx) {
+        return NULL;
+    }
+    apr_pool_cleanup_register(r->pool, ctx, cleanup_ctx,
+                              apr_pool_cleanup_null);
+
+    if (length >= 0) {
+        if (conf->large_size >= 0 && length >= conf->large_size) {
+            level = conf->large_level;
+        }
+        /* Let libzstd size its tables and window for the actual input,
+         * which must then match exactly.
+         */
+        if (exact) {
+            ZSTD_CCtx_setPledgedSrcSize(ctx->cctx,
+                                        (unsigned long long)length);
+        }
+    }
+    if (busy && conf->busy_level < level) {
+        level = conf->busy_level;
+    }
+    ZSTD_CCtx_setParameter(ctx->cctx, ZSTD_c_compressionLevel, level);
+    if (conf->windowlog) {
+        ZSTD_CCtx_setParameter(ctx->cctx, ZSTD_c_windowLog, conf->windowlog);
+    }
+    else {
+        ZSTD_compressionParameters cparams;
+
+        cparams = ZSTD_getCParams(level, length >= 0 ? length : 0, 0);
+        if (cparams.windowLog > ZSTD_MAX_WINDOWLOG) {
+            ZSTD_CCtx_setParameter(ctx->cctx, ZSTD_c_windowLog,
+                                   ZSTD_MAX_WINDOWLOG);
+        }
+    }
+
+    if (workers && length >= conf->workers_size) {
+        rv = ZSTD_CCtx_setParameter(ctx->cctx, ZSTD_c_nbWorkers, workers);
+        if (ZSTD_isError(rv)) {
+            /* libzstd was built without multithreading */
+            ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(10441)
+                          "Unable to use %d zstd workers: %s",
+                          workers, ZSTD_getErrorName(rv));
+        }
+    }
+
+    ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r,
+                  "zstd: level %d for %" APR_OFF_T_FMT " bytes", level,
+                  length);
+
+    ctx->buffer_size = ZSTD_CStreamOutSize();
+    ctx->buffer = apr_palloc(r->pool, ctx->buffer_size);
+    ctx->bb = apr_brigade_create(r->pool, alloc);
+    ctx->total_in = 0;
+    ctx->total_out = 0;
+
+    return ctx;
+}
+
+/*
+ * Feed the data to the compressor with the given directive, passing the
+ * output down as it fills the buffer.  With ZSTD_e_continue, all of the
+ * input is consumed; with ZSTD_e_flush and ZSTD_e_end, all of the pending
+ * output is also produced.
+ */
+static apr_status_t process_chunk(zstd_ctx_t *ctx,
+                                  const void *data,
+                                  apr_size_t len,
+                                  ZSTD_EndDirective mode,
+                                  ap_filter_t *f)
+{
+    ZSTD_inBuffer in = { data, len, 0 };
+
+    while (1) {
+        ZSTD_outBuffer out = { ctx->buffer, ctx->buffer_size, 0 };
+        size_t remaining;
+
+        remaining = ZSTD_compressStream2(ctx->cctx, &out, &in, mode);
+        if (ZSTD_isError(remaining)) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, f->r, APLOGNO(10442)
+                          "Error while compressing data: %s",
+                          ZSTD_getErrorName(remaining));
+            return APR_EGENERAL;
+        }
+
+        if (out.pos) {
+            apr_bucket *b;
+
+            ctx->total_out += out.pos;
+
+            /* The buffer is reused by the next call, so copy the data
+             * when it might be set aside by a flush or the end of the
+             * stream; otherwise pass it down right away.
+             */
+            if (mode == ZSTD_e_continue) {
+                apr_status_t rv;
+
+                b = apr_bucket_transient_create(ctx->buffer, out.pos,
+                                                ctx->bb->bucket_alloc);
+                APR_BRIGADE_INSERT_TAIL(ctx->bb, b);
+
+                rv = ap_pass_brigade(f->next, ctx->bb);
+                apr_brigade_cleanup(ctx->bb);
+                if (rv != APR_SUCCESS) {
+                    return rv;
+                }
+            }
+            else {
+                b = apr_bucket_heap_create(ctx->buffer, out.pos, NULL,
+                                           ctx->bb->bucket_alloc);
+                APR_BRIGADE_INSERT_TAIL(ctx->bb, b);
+            }
+        }
+
+        if (mode == ZSTD_e_continue ? in.pos == in.size : !remaining) {
+            break;
+        }
+    }
+
+    ctx->total_in += len;
+    return APR_SUCCESS;
+}
+
+static const char *get_content_encoding(request_rec *r)
+{
+    const char *encoding;
+
+    encoding = apr_table_get(r->headers_out, "Content-Encoding");
+    if (encoding) {
+        const char *err_enc;
+
+        err_enc = apr_table_get(r->err_headers_out, "Content-Encoding");
+        if (err_enc) {
+            encoding = apr_pstrcat(r->pool, encoding, ",", err_enc, NULL);
+        }
+    }
+    else {
+        encoding = apr_table_get(r->err_headers_out, "Content-Encoding");
+    }
+
+    if (r->content_encoding) {
+        encoding = encoding ? apr_pstrcat(r->pool, encoding, ",",
+                                          r->content_encoding, NULL)
+                            : r->content_encoding;
+    }
+
+    return encoding;
+}
+
+/*
+ * The length of the response when known before compressing it, -1 if not.
+ * It is exact when all of the response is already here, otherwise it is
+ * only as announced by Content-Length.
+ */
+static apr_off_t get_response_length(request_rec *r, apr_bucket_brigade *bb,
+                                     int *exact)
+{
+    const char *clength = apr_table_get(r->headers_out, "Content-Length");
+    apr_off_t length;
+
+    *exact = 0;
+    if (APR_BUCKET_IS_EOS(APR_BRIGADE_LAST(bb))
+        && apr_brigade_length(bb, 0, &length) == APR_SUCCESS
+        && length >= 0) {
+        *exact = 1;
+        return length;
+    }
+    if (clength && ap_parse_strict_length(&length, clength)) {
+        return length;
+    }
+    return -1;
+}
+
+static apr_status_t compress_filter(ap_filter_t *f, apr_bucket_brigade *bb)
+{
+    request_rec *r = f->r;
+    zstd_ctx_t *ctx = f->ctx;
+    apr_status_t rv;
+    zstd_server_config_t *conf;
+
+    if (APR_BRIGADE_EMPTY(bb)) {
+        return APR_SUCCESS;
+    }
+
+    conf = ap_get_module_config(r->server->module_config, &zstd_module);
+
+    if (!ctx) {
+        const char *encoding;
+        const char *token;
+        const char *accepts;
+        const char *q = NULL;
+        apr_off_t length;
+        int exact;
+        int busy;
+
+        /* Only work on main request, not subrequests, that are not
+         * a 204 response with no content, and are not tagged with the
+         * no-zstd env variable, and are not a partial response to
+         * a Range request.
+         *
+         * Note that responding to 304 is handled separately to set
+         * the required headers (such as ETag) per RFC7232, 4.1.
+         */
+        if (r->main || r->status == HTTP_NO_CONTENT
+            || apr_table_get(r->subprocess_env, "no-zstd")
+            || apr_table_get(r->headers_out, "Content-Range")) {
+            ap_remove_output_filter(f);
+            return ap_pass_brigade(f->next, bb);
+        }
+
+        /* Let's see what our current Content-Encoding is. */
+        encoding = get_content_encoding(r);
+
+        if (encoding) {
+            const char *tmp = encoding;
+
+            token = ap_get_token(r->pool, &tmp, 0);
+            while (token && *token) {
+                if (strcmp(token, "identity") != 0 &&
+                    strcmp(token, "7bit") != 0 &&
+                    strcmp(token, "8bit") != 0 &&
+                    strcmp(token, "binary") != 0) {
+                    /* The data is already encoded, do nothing. */
+                    ap_remove_output_filter(f);
+                    return ap_pass_brigade(f->next, bb);
+                }
+
+                if (*tmp) {
+                    ++tmp;
+                }
+                token = (*tmp) ? ap_get_token(r->pool, &tmp, 0) : NULL;
+            }
+        }
+
+        /* Even if we don't accept this request based on it not having
+         * the Accept-Encoding, we need to note that we were looking
+         * for this header and downstream proxies should be aware of
+         * that.
+         */
+        apr_table_mergen(r->headers_out, "Vary", "Accept-Encoding");
+
+        accepts = apr_table_get(r->headers_in, "Accept-Encoding");
+        if (!accepts) {
+            ap_remove_output_filter(f);
+            return ap_pass_brigade(f->next, bb);
+        }
+
+        /* Do we have Accept-Encoding: zstd? */
+        token = ap_get_token(r->pool, &accepts, 0);
+        while (token && token[0] && ap_cstr_casecmp(token, "zstd") != 0) {
+            while (*accepts == ';') {
+                ++accepts;
+                ap_get_token(r->pool, &accepts, 1);
+            }
+
+            if (*accepts == ',') {
+                ++accepts;
+            }
+            token = (*accepts) ? ap_get_token(r->pool, &accepts, 0) : NULL;
+        }
+
+        /* Find the qvalue, if provided */
+        if (*accepts) {
+            while (*accepts == ';') {
+                ++accepts;
+            }
+            q = ap_get_token(r->pool, &accepts, 1);
+            ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r,
+                          "token: '%s' - q: '%s'", token ? token : "NULL", q);
+        }
+
+        /* No acceptable token found or q=0 */
+        if (!token || token[0] == '\0' ||
+            (q && strlen(q) >= 3 && strncmp("q=0.000", q, strlen(q)) == 0)) {
+            ap_remove_output_filter(f);
+            return ap_pass_brigade(f->next, bb);
+        }
+
+        /* Compress less, or not at all, when the server is busy. */
+        busy = conf->busy_percent
+               && ap_sb_busy_percent() >= conf->busy_percent;
+        if (busy && !conf->busy_level) {
+            ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r,
+                          "Not compressing (server busy)");
+            ap_remove_output_filter(f);
+            return ap_pass_brigade(f->next, bb);
+        }
+
+        /* Must be done before Content-Length is removed */
+        length = get_response_length(r, bb, &exact);
+
+        /* If the entire Content-Encoding is "identity", we can replace it. */
+        if (!encoding || ap_cstr_casecmp(encoding, "identity") == 0) {
+            apr_table_setn(r->headers_out, "Content-Encoding", "zstd");
+        } else {
+            apr_table_mergen(r->headers_out, "Content-Encoding", "zstd");
+        }
+
+        if (r->content_encoding) {
+            r->content_encoding = apr_table_get(r->headers_out,
+                                                "Content-Encoding");
+        }
+
+        apr_table_unset(r->headers_out, "Content-Length");
+        apr_table_unset(r->headers_out, "Content-MD5");
+
+        /* ETag must be unique among the possible representations, so a
+         * change to content-encoding requires a corresponding change to the
+         * ETag, as done by DeflateAlterETag and BrotliAlterETag.
+         */
+        if (conf->etag_mode == ETAG_MODE_REMOVE) {
+            apr_table_unset(r->headers_out, "ETag");
+        }
+        else if (conf->etag_mode == ETAG_MODE_ADDSUFFIX) {
+            const char *etag = apr_table_get(r->headers_out, "ETag");
+
+            if (etag) {
+                apr_size_t len = strlen(etag);
+
+                if (len > 2 && etag[len - 1] == '"') {
+                    etag = apr_pstrmemdup(r->pool, etag, len - 1);
+                    etag = apr_pstrcat(r->pool, etag, "-zstd\"", NULL);
+                    apr_table_setn(r->headers_out, "ETag", etag);
+                }
+            }
+        }
+
+        /* For 304 responses, we only need to send out the headers. */
+        if (r->status == HTTP_NOT_MODIFIED) {
+            ap_remove_output_filter(f);
+            return ap_pass_brigade(f->next, bb);
+        }
+
+        ctx = create_ctx(r, conf, length, exact, busy,
+                         f->c->bucket_alloc);
+        if (!ctx) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(10443)
+                          "Unable to create a zstd compression context");
+            return APR_EGENERAL;
+        }
+        f->ctx = ctx;
+    }
+
+    while (!APR_BRIGADE_EMPTY(bb)) {
+        apr_bucket *e = APR_BRIGADE_FIRST(bb);
+
+        /* Optimization: If we are a HEAD request and bytes_sent is not zero
+         * it means that we have passed the content-length filter once and
+         * have more data to send.  This means that the content-length filter
+         * could not determine our content-length for the response to the
+         * HEAD request anyway (the associated GET request would deliver the
+         * body in chunked encoding) and we can stop compressing.
+         */
+        if (r->header_only && r->bytes_sent) {
+            ap_remove_output_filter(f);
+            return ap_pass_brigade(f->next, bb);
+        }
+
+        if (APR_BUCKET_IS_EOS(e)) {
+            rv = process_chunk(ctx, NULL, 0, ZSTD_e_end, f);
+            if (rv != APR_SUCCESS) {
+                return rv;
+            }
+
+            /* Leave notes for logging. */
+            if (conf->note_input_name) {
+                apr_table_setn(r->notes, conf->note_input_name,
+                               apr_off_t_toa(r->pool, ctx->total_in));
+            }
+            if (conf->note_output_name) {
+                apr_table_setn(r->notes, conf->note_output_name,
+                               apr_off_t_toa(r->pool, ctx->total_out));
+            }
+            if (conf->note_ratio_name) {
+                if (ctx->total_in > 0) {
+                    int ratio = (int) (ctx->total_out * 100 / ctx->total_in);
+
+                    apr_table_setn(r->notes, conf->note_ratio_name,
+                                   apr_itoa(r->pool, ratio));
+                }
+                else {
+                    apr_table_setn(r->notes, conf->note_ratio_name, "-");
+                }
+            }
+
+            APR_BUCKET_REMOVE(e);
+            APR_BRIGADE_INSERT_TAIL(ctx->bb, e);
+
+            rv = ap_pass_brigade(f->next, ctx->bb);
+            apr_brigade_cleanup(ctx->bb);
+            apr_pool_cleanup_run(r->pool, ctx, cleanup_ctx);
+            return rv;
+        }
+        else if (APR_BUCKET_IS_FLUSH(e)) {
+            rv = process_chunk(ctx, NULL, 0, ZSTD_e_flush, f);
+            if (rv != APR_SUCCESS) {
+                return rv;
+            }
+
+            APR_BUCKET_REMOVE(e);
+            APR_BRIGADE_INSERT_TAIL(ctx->bb, e);
+
+            rv = ap_pass_brigade(f->next, ctx->bb);
+            apr_brigade_cleanup(ctx->bb);
+            if (rv != APR_SUCCESS) {
+                return rv;
+            }
+        }
+        else if (APR_BUCKET_IS_METADATA(e)) {
+            APR_BUCKET_REMOVE(e);
+            APR_BRIGADE_INSERT_TAIL(ctx->bb, e);
+        }
+        else {
+            const char *data;
+            apr_size_t len;
+
+            rv = apr_bucket_read(e, &data, &len, APR_BLOCK_READ);
+            if (rv != APR_SUCCESS) {
+                return rv;
+            }
+            rv = process_chunk(ctx, data, len, ZSTD_e_continue, f);
+            if (rv != APR_SUCCESS) {
+                return rv;
+            }
+            apr_bucket_delete(e);
+        }
+    }
+    return APR_SUCCESS;
+}
+
+static void register_hooks(apr_pool_t *p)
+{
+    ap_register_output_filter("ZSTD_COMPRESS", compress_filter, NULL,
+                              AP_FTYPE_CONTENT_SET);
+}
+
+static const command_rec cmds[] = {
+    AP_INIT_TAKE12("ZstdFilterNote", set_filter_note,
+                   NULL, RSRC_CONF,
+                   "Set a note to report on compression ratio"),
+    AP_INIT_TAKE1("ZstdCompressionLevel", set_compression_level,
+                  NULL, RSRC_CONF,
+                  "Compression level (higher levels mean slower "
+                  "compression)"),
+    AP_INIT_TAKE1("ZstdCompressionWindow", set_compression_window,
+                  NULL, RSRC_CONF,
+                  "Base 2 logarithm of the largest window size (larger "
+                  "windows can improve compression, but require more "
+                  "memory)"),
+    AP_INIT_TAKE2("ZstdCompressionLevelLarge", set_large_level,
+                  NULL, RSRC_CONF,
+                  "The size from which responses of known length are "
+                  "compressed with the given level instead"),
+    AP_INIT_TAKE2("ZstdCompressionLevelBusy", set_busy_level,
+                  NULL, RSRC_CONF,
+                  "Percentage of busy workers from which responses are "
+                  "compressed with at most the given level, or 'off'"),
+    AP_INIT_TAKE12("ZstdWorkers", set_workers,
+                   NULL, RSRC_CONF,
+                   "Number of threads compressing responses of known length, "
+                   "and the size from which they are used (default 1M)"),
+    AP_INIT_TAKE1("ZstdAlterETag", set_etag_mode,
+                  NULL, RSRC_CONF,
+                  "Set how mod_zstd should modify ETag response headers: "
+                  "'AddSuffix' (default), 'NoChange', 'Remove'"),
+    {NULL}
+};
+
+AP_DECLARE_MODULE(zstd) = {
+    STANDARD20_MODULE_STUFF,
+    NULL,                      /* create per-directory config structure */
+    NULL,                      /* merge per-directory config structures */
+    create_server_config,      /* create per-server config structure */
+    NULL,                      /* merge per-server config structures */
+    cmds,                      /* command apr_table_t */
+    register_hooks             /* register hooks */
+};
@@ -29,6 +29,10 @@
 #include "apr_fnmatch.h"
 #include "apr_strings.h"
 #include "apr_lib.h"
+#include "apr_hash.h"
+#if APR_HAS_THREADS
+#include "apr_thread_mutex.h"
+#endif
 
 #define APR_WANT_STRFUNC
 #include "apr_want.h"
@@ -72,7 +76,8 @@ module AP_MODULE_DECLARE_DATA autoindex_module;
 #define EMIT_XHTML          (1 << 17)
 #define SHOW_FORBIDDEN      (1 << 18)
 #define ADDALTCLASS         (1 << 19)
-#define OPTION_UNSET        (1 << 20)
+#define FAST_LISTING        (1 << 20)
+#define OPTION_UNSET        (1 << 21)
 
 #define K_NOADJUST 0
 #define K_ADJUST 1
@@ -103,6 +108,13 @@ module AP_MODULE_DECLARE_DATA autoindex_module;
 #define DEFAULT_NAME_WIDTH 23
 #define DEFAULT_DESC_WIDTH 23
 
+/*
+ * How many directories FastListing keeps read per child, and how old (in
+ * seconds) a directory must be for its listing to be kept.
+ */
+#define LISTING_CACHE_MAX 16
+#define LISTING_CACHE_MIN_AGE 2
+
 struct item {
     char *type;
     char *apply_to;
@@ -404,6 +416,9 @@ static const char *add_opts(cmd_parms *cmd, void *d, int argc, char *const argv[
         else if (!strcasecmp(w, "AddAltClass")) {
             option = ADDALTCLASS;
         }
+        else if (!strcasecmp(w, "FastListing")) {
+            option = FAST_LISTING;
+        }
         else if (!strcasecmp(w, "None")) {
             if (action != '\0') {
                 return "Cannot combine '+' or '-' with 'None' keyword";
@@ -1254,6 +1269,222 @@ static char *find_title(request_rec *r)
     return NULL;
 }
 
+/*
+ * The FastListing directory reads, kept per child and per directory until
+ * the directory's mtime changes.  A listing is only destroyed once no
+ * request uses it anymore.
+ */
+
+typedef struct {
+    const char *name;
+    apr_off_t size;
+    apr_time_t mtime;
+    apr_filetype_e filetype;
+} listing_ent;
+
+typedef struct {
+    apr_pool_t *pool;
+    const char *dirname;
+    apr_time_t mtime;
+    apr_time_t used;
+    listing_ent *ents;
+    int nelts;
+    int refs;
+    int stale;
+} listing_rec;
+
+static apr_pool_t *listing_pool;
+static apr_hash_t *listing_cache;
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *listing_mutex;
+#define listing_lock() apr_thread_mutex_lock(listing_mutex)
+#define listing_unlock() apr_thread_mutex_unlock(listing_mutex)
+#else
+#define listing_lock()
+#define listing_unlock()
+#endif
+
+/*
+ * Read the next entry of a directory, exploding symlinks.  fullpath holds
+ * the directory name (dirpathlen long) and room for the entry's name.
+ * Returns APR_INCOMPLETE for the entries which can't be stat()ed.
+ */
+static apr_status_t read_dirent(apr_finfo_t *dirent, apr_dir_t *thedir,
+                                char *fullpath, apr_size_t dirpathlen,
+                                apr_pool_t *p)
+{
+    apr_status_t status;
+
+    status = apr_dir_read(dirent, APR_FINFO_MIN | APR_FINFO_NAME, thedir);
+    if (status != APR_SUCCESS) {
+        return APR_STATUS_IS_INCOMPLETE(status) ? APR_INCOMPLETE : status;
+    }
+
+    /* We want to explode symlinks here. */
+    if (dirent->filetype == APR_LNK) {
+        const char *savename;
+        apr_finfo_t fi;
+        /* We *must* have FNAME. */
+        savename = dirent->name;
+        apr_cpystrn(fullpath + dirpathlen, dirent->name,
+                    APR_PATH_MAX - dirpathlen);
+        status = apr_stat(&fi, fullpath, dirent->valid & ~(APR_FINFO_NAME), p);
+        if (status != APR_SUCCESS) {
+            /* Something bad happened, skip this file. */
+            return APR_INCOMPLETE;
+        }
+        memcpy(dirent, &fi, sizeof(fi));
+        dirent->name = savename;
+        dirent->valid |= APR_FINFO_NAME;
+    }
+    return APR_SUCCESS;
+}
+
+/* Called with the lock held */
+static void evict_listing(listing_rec *l)
+{
+    if (!l->stale) {
+        apr_hash_set(listing_cache, l->dirname, APR_HASH_KEY_STRING, NULL);
+        l->stale = 1;
+    }
+    if (!l->refs) {
+        apr_pool_destroy(l->pool);
+    }
+}
+
+static apr_status_t release_listing(void *data)
+{
+    listing_rec *l = data;
+
+    listing_lock();
+    if (!--l->refs && l->stale) {
+        apr_pool_destroy(l->pool);
+    }
+    listing_unlock();
+    return APR_SUCCESS;
+}
+
+static apr_status_t read_listing(listing_rec *l, apr_pool_t *ptemp)
+{
+    apr_array_header_t *ents;
+    apr_finfo_t dirent;
+    apr_dir_t *thedir;
+    apr_status_t status;
+    char *fullpath;
+    apr_size_t dirpathlen;
+
+    if ((status = apr_dir_open(&thedir, l->dirname, ptemp)) != APR_SUCCESS) {
+        return status;
+    }
+    fullpath = apr_palloc(ptemp, APR_PATH_MAX);
+    dirpathlen = strlen(l->dirname);
+    memcpy(fullpath, l->dirname, dirpathlen);
+
+    ents = apr_array_make(l->pool, 64, sizeof(listing_ent));
+    while ((status = read_dirent(&dirent, thedir, fullpath, dirpathlen,
+                                 ptemp)) == APR_SUCCESS
+           || status == APR_INCOMPLETE) {
+        listing_ent *e;
+
+        /* only the types which a subrequest would let through */
+        if (status != APR_SUCCESS
+            || (dirent.filetype != APR_DIR && dirent.filetype != APR_REG)) {
+            continue;
+        }
+        e = apr_array_push(ents);
+        e->name = apr_pstrdup(l->pool, dirent.name);
+        e->size = dirent.size;
+        e->mtime = dirent.mtime;
+        e->filetype = dirent.filetype;
+    }
+    apr_dir_close(thedir);
+
+    l->ents = (listing_ent *)ents->elts;
+    l->nelts = ents->nelts;
+    return APR_SUCCESS;
+}
+
+/*
+ * Get the (possibly cached) listing of the directory of r, released
+ * with r's pool.
+ */
+static apr_status_t get_listing(request_rec *r, listing_rec **listing)
+{
+    apr_time_t now = apr_time_now();
+    listing_rec *l;
+    apr_allocator_t *allocator;
+    apr_pool_t *lp;
+    apr_status_t status;
+
+    listing_lock();
+    l = apr_hash_get(listing_cache, r->filename, APR_HASH_KEY_STRING);
+    if (l && l->mtime == r->finfo.mtime) {
+        l->refs++;
+        l->used = now;
+        listing_unlock();
+        apr_pool_cleanup_register(r->pool, l, release_listing,
+                                  apr_pool_cleanup_null);
+        *listing = l;
+        return APR_SUCCESS;
+    }
+    if (l) {
+        evict_listing(l);
+    }
+    /* with its own allocator, read unlocked (this is the slow part) */
+    apr_allocator_create(&allocator);
+    apr_pool_create_ex(&lp, listing_pool, NULL, allocator);
+    apr_allocator_owner_set(allocator, lp);
+    listing_unlock();
+
+    apr_pool_tag(lp, "autoindex_listing");
+    l = apr_pcalloc(lp, sizeof(*l));
+    l->pool = lp;
+    l->dirname = apr_pstrdup(lp, r->filename);
+    l->mtime = r->finfo.mtime;
+    l->used = now;
+    l->refs = 1;
+    status = read_listing(l, r->pool);
+
+    listing_lock();
+    if (status != APR_SUCCESS) {
+        apr_pool_destroy(lp);
+        listing_unlock();
+        return status;
+    }
+    /* a directory changed that recently may change again unnoticed
+     * within the mtime's resolution, don't keep it
+     */
+    if (apr_time_sec(now) - apr_time_sec(l->mtime) < LISTING_CACHE_MIN_AGE) {
+        l->stale = 1;
+    }
+    else {
+        listing_rec *old;
+
+        if ((old = apr_hash_get(listing_cache, l->dirname,
+                                APR_HASH_KEY_STRING))) {
+            evict_listing(old);
+        }
+        else if (apr_hash_count(listing_cache) >= LISTING_CACHE_MAX) {
+            apr_hash_index_t *hi;
+
+            for (hi = apr_hash_first(r->pool, listing_cache); hi;
+                 hi = apr_hash_next(hi)) {
+                listing_rec *cur = apr_hash_this_val(hi);
+                if (!old || cur->used < old->used) {
+                    old = cur;
+                }
+            }
+            evict_listing(old);
+        }
+        apr_hash_set(listing_cache, l->dirname, APR_HASH_KEY_STRING, l);
+    }
+    listing_unlock();
+    apr_pool_cleanup_register(r->pool, l, release_listing,
+                              apr_pool_cleanup_null);
+    *listing = l;
+    return APR_SUCCESS;
+}
+
 static struct ent *make_parent_entry(apr_int32_t autoindex_opts,
                                      autoindex_config_rec *d,
                                      request_rec *r, char keyid,
@@ -1307,39 +1538,45 @@ static struct ent *make_parent_entry(apr_int32_t autoindex_opts,
     return p;
 }
 
-static struct ent *make_autoindex_entry(const apr_finfo_t *dirent,
-                                        int autoindex_opts,
-                                        autoindex_config_rec *d,
-                                        request_rec *r, char keyid,
-                                        char direction,
-                                        const char *pattern)
+/* Whether an entry is not to be listed, by name */
+static int skip_entry(const char *name, autoindex_config_rec *d,
+                      request_rec *r, const char *pattern)
 {
-    request_rec *rr;
-    struct ent *p;
-    int show_forbidden = 0;
-
     /* Dot is ignored, Parent is handled by make_parent_entry() */
-    if ((dirent->name[0] == '.') && (!dirent->name[1]
-        || ((dirent->name[1] == '.') && !dirent->name[2])))
-        return (NULL);
+    if ((name[0] == '.') && (!name[1]
+        || ((name[1] == '.') && !name[2])))
+        return 1;
 
     /*
      * On some platforms, the match must be case-blind.  This is really
      * a factor of the filesystem involved, but we can't detect that
      * reliably - so we have to granularise at the OS level.
      */
-    if (pattern && (apr_fnmatch(pattern, dirent->name,
+    if (pattern && (apr_fnmatch(pattern, name,
                                 APR_FNM_NOESCAPE | APR_FNM_PERIOD
 #ifdef CASE_BLIND_FILESYSTEM
                                 | APR_FNM_CASE_BLIND
 #endif
                                 )
                     != APR_SUCCESS)) {
-        return (NULL);
+        return 1;
     }
 
-    if (ignore_entry(d, ap_make_full_path(r->pool,
-                                          r->filename, dirent->name))) {
+    return ignore_entry(d, ap_make_full_path(r->pool, r->filename, name));
+}
+
+static struct ent *make_autoindex_entry(const apr_finfo_t *dirent,
+                                        int autoindex_opts,
+                                        autoindex_config_rec *d,
+                                        request_rec *r, char keyid,
+                                        char direction,
+                                        const char *pattern)
+{
+    request_rec *rr;
+    struct ent *p;
+    int show_forbidden = 0;
+
+    if (skip_entry(dirent->name, d, r, pattern)) {
         return (NULL);
     }
 
@@ -1423,6 +1660,71 @@ static struct ent *make_autoindex_entry(const apr_finfo_t *dirent,
     return (p);
 }
 
+/*
+ * The FastListing flavor of make_autoindex_entry(), from the directory
+ * read alone: no subrequest, so no access check nor type or encoding of
+ * the entry (only the AddIcon, AddAlt and AddDescription by name apply).
+ */
+static struct ent *make_listing_entry(const listing_ent *dirent,
+                                      int autoindex_opts,
+                                      autoindex_config_rec *d,
+                                      request_rec *r, char keyid,
+                                      char direction,
+                                      const char *pattern)
+{
+    struct ent *p;
+    char *path;
+
+    if (skip_entry(dirent->name, d, r, pattern)) {
+        return (NULL);
+    }
+
+    p = (struct ent *) apr_pcalloc(r->pool, sizeof(struct ent));
+    if (dirent->filetype == APR_DIR) {
+        p->name = apr_pstrcat(r->pool, dirent->name, "/", NULL);
+    }
+    else {
+        p->name = (char *)dirent->name;
+    }
+    p->size = -1;
+    p->lm = -1;
+    p->key = apr_toupper(keyid);
+    p->ascending = (apr_toupper(direction) == D_ASCENDING);
+    p->version_sort = !!(autoindex_opts & VERSION_SORT);
+    p->ignore_case = !!(autoindex_opts & IGNORE_CASE);
+
+    if (autoindex_opts & (FANCY_INDEXING | TABLE_INDEXING)) {
+        p->lm = dirent->mtime;
+        path = ap_make_full_path(r->pool, r->filename, dirent->name);
+        if (dirent->filetype == APR_DIR) {
+            if (autoindex_opts & FOLDERS_FIRST) {
+                p->isdir = 1;
+            }
+            if (!(p->icon = find_default_icon(d, path))) {
+                p->icon = find_default_icon(d, "^^DIRECTORY^^");
+            }
+            if (!(p->alt = find_default_alt(d, path))) {
+                if (!(p->alt = find_default_alt(d, "^^DIRECTORY^^"))) {
+                    p->alt = "DIR";
+                }
+            }
+        }
+        else {
+            p->icon = find_default_icon(d, path);
+            p->alt = find_default_alt(d, path);
+            p->size = dirent->size;
+        }
+
+        p->desc = find_desc(d, path);
+    }
+    if (keyid == K_LAST_MOD) {
+        if (p->lm < 0) {
+            p->lm = 0;
+        }
+    }
+    return (p);
+}
+
 static char *terminate_description(autoindex_config_rec *d, char *desc,
                                    apr_int32_t autoindex_opts, int desc_width)
 {
@@ -2025,7 +2327,8 @@ static int index_directory(request_rec *r,
     char *name = r->filename;
     char *pstring = NULL;
     apr_finfo_t dirent;
-    apr_dir_t *thedir;
+    apr_dir_t *thedir = NULL;
+    listing_rec *listing = NULL;
     apr_status_t status;
     int num_ent = 0, x;
     struct ent *head, *p;
@@ -2040,7 +2343,13 @@ static int index_directory(request_rec *r,
     char *ctype = "text/html";
     char *charset;
 
-    if ((status = apr_dir_open(&thedir, name, r->pool)) != APR_SUCCESS) {
+    if (autoindex_opts & FAST_LISTING) {
+        status = get_listing(r, &listing);
+    }
+    else {
+        status = apr_dir_open(&thedir, name, r->pool);
+    }
+    if (status != APR_SUCCESS) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, status, r, APLOGNO(01275)
                       "Can't open directory for index: %s", r->filename);
         return HTTP_FORBIDDEN;
@@ -2073,7 +2382,9 @@ static int index_directory(request_rec *r,
         ap_set_etag(r);
     }
     if (r->header_only) {
-        apr_dir_close(thedir);
+        if (thedir) {
+            apr_dir_close(thedir);
+        }
         return 0;
     }
 
@@ -2222,45 +2533,42 @@ static int index_directory(request_rec *r,
         head = p;
         num_ent++;
     }
-    fullpath = apr_palloc(r->pool, APR_PATH_MAX);
-    dirpathlen = strlen(name);
-    memcpy(fullpath, name, dirpathlen);
-
-    do {
-        status = apr_dir_read(&dirent, APR_FINFO_MIN | APR_FINFO_NAME, thedir);
-        if (APR_STATUS_IS_INCOMPLETE(status)) {
-            continue; /* ignore un-stat()able files */
-        }
-        else if (status != APR_SUCCESS) {
-            break;
+    if (listing) {
+        for (x = 0; x < listing->nelts; ++x) {
+            p = make_listing_entry(&listing->ents[x], autoindex_opts,
+                                   autoindex_conf, r, keyid, direction,
+                                   pstring);
+            if (p != NULL) {
+                p->next = head;
+                head = p;
+                num_ent++;
+            }
         }
+    }
+    else {
+        fullpath = apr_palloc(r->pool, APR_PATH_MAX);
+        dirpathlen = strlen(name);
+        memcpy(fullpath, name, dirpathlen);
 
-        /* We want to explode symlinks here. */
-        if (dirent.filetype == APR_LNK) {
-            const char *savename;
-            apr_finfo_t fi;
-            /* We *must* have FNAME. */
-            savename = dirent.name;
-            apr_cpystrn(fullpath + dirpathlen, dirent.name,
-                        APR_PATH_MAX - dirpathlen);
-            status = apr_stat(&fi, fullpath,
-                              dirent.valid & ~(APR_FINFO_NAME), r->pool);
-            if (status != APR_SUCCESS) {
-                /* Something bad happened, skip this file. */
-                continue;
-            }
-            memcpy(&dirent, &fi, sizeof(fi));
-            dirent.name = savename;
-            dirent.valid |= APR_FINFO_NAME;
-        }
-        p = make_autoindex_entry(&dirent, autoindex_opts, autoindex_conf, r,
-                                 keyid, direction, pstring);
-        if (p != NULL) {
-            p->next = head;
-            head = p;
-            num_ent++;
-        }
-    } while (1);
+        do {
+            status = read_dirent(&dirent, thedir, fullpath, dirpathlen,
+                                 r->pool);
+            if (status == APR_INCOMPLETE) {
+                continue; /* ignore un-stat()able files */
+            }
+            else if (status != APR_SUCCESS) {
+                break;
+            }
+            p = make_autoindex_entry(&dirent, autoindex_opts, autoindex_conf,
+                                     r, keyid, direction, pstring);
+            if (p != NULL) {
+                p->next = head;
+                head = p;
+                num_ent++;
+            }
+        } while (1);
+        apr_dir_close(thedir);
+    }
 
     if (num_ent > 0) {
         ar = (struct ent **) apr_palloc(r->pool,
@@ -2277,7 +2585,6 @@ static int index_directory(request_rec *r,
     }
     output_directories(ar, num_ent, autoindex_conf, r, autoindex_opts,
                        keyid, direction, colargs);
-    apr_dir_close(thedir);
 
     emit_tail(r, autoindex_conf->readme,
               autoindex_opts & SUPPRESS_PREAMBLE);
@@ -2341,9 +2648,25 @@ static int handle_autoindex(request_rec *r)
     }
 }
 
+static void autoindex_child_init(apr_pool_t *p, server_rec *s)
+{
+    apr_allocator_t *allocator;
+
+    apr_allocator_create(&allocator);
+    apr_pool_create_ex(&listing_pool, p, NULL, allocator);
+    apr_allocator_owner_set(allocator, listing_pool);
+    apr_pool_tag(listing_pool, "autoindex_listings");
+    listing_cache = apr_hash_make(listing_pool);
+#if APR_HAS_THREADS
+    apr_thread_mutex_create(&listing_mutex, APR_THREAD_MUTEX_DEFAULT,
+                            listing_pool);
+#endif
+}
+
 static void register_hooks(apr_pool_t *p)
 {
     ap_hook_handler(handle_autoindex,NULL,NULL,APR_HOOK_MIDDLE);
+    ap_hook_child_init(autoindex_child_init, NULL, NULL, APR_HOOK_MIDDLE);
 }
 
 AP_DECLARE_MODULE(autoindex) =
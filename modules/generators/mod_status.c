@@ -59,18 +59,26 @@
 #include "http_core.h"
 #include "http_protocol.h"
 #include "http_main.h"
+#include "http_request.h"
 #include "ap_mpm.h"
 #include "util_script.h"
 #include <time.h>
 #include "scoreboard.h"
 #include "http_log.h"
+#include "util_time.h"
 #include "mod_status.h"
 #if APR_HAVE_UNISTD_H
 #include <unistd.h>
 #endif
 #define APR_WANT_STRFUNC
+#define APR_WANT_MEMFUNC
 #include "apr_want.h"
 #include "apr_strings.h"
+#include "apr_lib.h"
+#include "apr_atomic.h"
+#include "apr_hash.h"
+#include "apr_shm.h"
+#include "apr_version.h"
 
 #define STATUS_MAXLINE 64
 
@@ -95,6 +103,13 @@ APR_IMPLEMENT_OPTIONAL_HOOK_RUN_ALL(ap, STATUS, int, status_hook,
                                     (r, flags),
                                     OK, DECLINED)
 
+/* Implement 'ap_run_status_metrics'. */
+APR_IMPLEMENT_OPTIONAL_HOOK_RUN_ALL(ap, STATUS, int, status_metrics,
+                                    (request_rec *r,
+                                     apr_array_header_t *metrics),
+                                    (r, metrics),
+                                    OK, DECLINED)
+
 #ifdef HAVE_TIMES
 /* ugh... need to know if we're running with a pthread implementation
  * such as linuxthreads that treats individual threads as distinct
@@ -158,6 +173,7 @@ static void show_time(request_rec *r, apr_uint32_t tsecs)
 #define STAT_OPT_REFRESH  0
 #define STAT_OPT_NOTABLE  1
 #define STAT_OPT_AUTO     2
+#define STAT_OPT_METRICS  3
 
 struct stat_opt {
     int id;
@@ -170,6 +186,7 @@ static const struct stat_opt status_options[] = /* see #defines above */
     {STAT_OPT_REFRESH, "refresh", "Refresh"},
     {STAT_OPT_NOTABLE, "notable", NULL},
     {STAT_OPT_AUTO, "auto", NULL},
+    {STAT_OPT_METRICS, "metrics", NULL},
     {STAT_OPT_END, NULL, NULL}
 };
 
@@ -179,13 +196,428 @@ static const struct stat_opt status_options[] = /* see #defines above */
 
 static char status_flags[MOD_STATUS_NUM_STATUS];
 
+/* The state labels of the OpenMetrics report, indexed like status_flags */
+static const char *status_names[MOD_STATUS_NUM_STATUS] = {
+    "dead", "starting", "ready", "read", "write", "keepalive", "logging",
+    "dns", "closing", "graceful", "idle_kill", "disabled"
+};
+
+/*
+ * The CPU time used by the handlers and output filters of the requests
+ * (with ExtendedStatus On), per virtual host and handler since the last
+ * restart, in a table of shared memory updated with atomic operations.
+ * The rows which don't fit go to the last slot, counted as "*".
+ */
+#ifndef STATUS_CPU_SLOTS
+#define STATUS_CPU_SLOTS 1024
+#endif
+
+/* Slots probed for a row before it goes to the last one */
+#define STATUS_CPU_PROBES 32
+
+#define STATUS_CPU_VHOST_LEN 64
+#define STATUS_CPU_HANDLER_LEN 48
+
+#define STATUS_CPU_FREE 0
+#define STATUS_CPU_BUSY 1       /* its row is being set */
+#define STATUS_CPU_USED 2
+
+typedef struct {
+    apr_uint32_t state;
+    apr_uint32_t hash;
+    char vhost[STATUS_CPU_VHOST_LEN];
+    char handler[STATUS_CPU_HANDLER_LEN];
+    apr_uint64_t requests;
+    apr_uint64_t cpu_time;      /* microseconds */
+} status_cpu_slot;
+
+typedef struct {
+    const char *vhost;
+    const char *handler;
+    apr_uint64_t requests;
+    apr_uint64_t cpu_time;
+} status_cpu_row;
+
+#if APR_VERSION_AT_LEAST(1,7,0)
+#define cpu_counter_add(c, v)   apr_atomic_add64(&(c), (v))
+#define cpu_counter_read(c)     apr_atomic_read64(&(c))
+#else
+/* racy without 64bit atomics, they are estimates anyway */
+#define cpu_counter_add(c, v)   ((c) += (v))
+#define cpu_counter_read(c)     (c)
+#endif
+
+static status_cpu_slot *cpu_slots;
+
+static status_cpu_slot *find_cpu_slot(const char *vhost, const char *handler)
+{
+    char v[STATUS_CPU_VHOST_LEN], h[STATUS_CPU_HANDLER_LEN];
+    apr_uint32_t hash = 2166136261U, state;
+    const char *c;
+    int i, n;
+
+    apr_cpystrn(v, vhost, sizeof(v));
+    apr_cpystrn(h, handler, sizeof(h));
+    for (c = v; *c; ++c) {
+        hash = (hash ^ (unsigned char)*c) * 16777619U;
+    }
+    hash *= 16777619U;
+    for (c = h; *c; ++c) {
+        hash = (hash ^ (unsigned char)*c) * 16777619U;
+    }
+
+    n = hash % (STATUS_CPU_SLOTS - 1);
+    for (i = 0; i < STATUS_CPU_PROBES; ++i) {
+        status_cpu_slot *slot = &cpu_slots[n];
+
+        state = apr_atomic_read32(&slot->state);
+        if (state == STATUS_CPU_FREE) {
+            state = apr_atomic_cas32(&slot->state, STATUS_CPU_BUSY,
+                                     STATUS_CPU_FREE);
+            if (state == STATUS_CPU_FREE) {
+                slot->hash = hash;
+                memcpy(slot->vhost, v, sizeof(v));
+                memcpy(slot->handler, h, sizeof(h));
+                apr_atomic_set32(&slot->state, STATUS_CPU_USED);
+                return slot;
+            }
+        }
+        /* a row being set elsewhere may end up twice, merged when shown */
+        if (state == STATUS_CPU_USED && slot->hash == hash
+                && !strcmp(slot->vhost, v) && !strcmp(slot->handler, h)) {
+            return slot;
+        }
+        n = (n + 1) % (STATUS_CPU_SLOTS - 1);
+    }
+    return &cpu_slots[STATUS_CPU_SLOTS - 1];
+}
+
+static int status_log_cpu(request_rec *r)
+{
+    status_cpu_slot *slot;
+    apr_interval_time_t cpu;
+    const char *handler;
+
+    if (!cpu_slots || (cpu = ap_request_cpu_time(r, &handler)) < 0) {
+        return DECLINED;
+    }
+    slot = find_cpu_slot(r->server->server_hostname
+                         ? r->server->server_hostname : "-",
+                         *handler ? handler : "-");
+    cpu_counter_add(slot->requests, 1);
+    cpu_counter_add(slot->cpu_time, cpu);
+
+    return OK;
+}
+
+static int cmp_cpu_rows(const void *a, const void *b)
+{
+    const status_cpu_row *ra = *(status_cpu_row *const *)a;
+    const status_cpu_row *rb = *(status_cpu_row *const *)b;
+
+    return (ra->cpu_time < rb->cpu_time) ? 1
+           : (ra->cpu_time > rb->cpu_time) ? -1 : 0;
+}
+
+/* The rows of the CPU table (status_cpu_row *) by decreasing CPU time */
+static apr_array_header_t *get_cpu_rows(request_rec *r)
+{
+    apr_array_header_t *rows = apr_array_make(r->pool, 16,
+                                              sizeof(status_cpu_row *));
+    apr_hash_t *merged = apr_hash_make(r->pool);
+    int i;
+
+    for (i = 0; cpu_slots && i < STATUS_CPU_SLOTS; ++i) {
+        status_cpu_slot *slot = &cpu_slots[i];
+        apr_uint64_t requests = cpu_counter_read(slot->requests);
+        status_cpu_row *row;
+        const char *key;
+
+        if (apr_atomic_read32(&slot->state) != STATUS_CPU_USED
+                || !requests) {
+            continue;
+        }
+        /* no space in server names */
+        key = apr_pstrcat(r->pool, slot->vhost, " ", slot->handler, NULL);
+        row = apr_hash_get(merged, key, APR_HASH_KEY_STRING);
+        if (!row) {
+            row = apr_pcalloc(r->pool, sizeof(*row));
+            row->vhost = apr_pstrdup(r->pool, slot->vhost);
+            row->handler = apr_pstrdup(r->pool, slot->handler);
+            APR_ARRAY_PUSH(rows, status_cpu_row *) = row;
+            apr_hash_set(merged, key, APR_HASH_KEY_STRING, row);
+        }
+        row->requests += requests;
+        row->cpu_time += cpu_counter_read(slot->cpu_time);
+    }
+    qsort(rows->elts, rows->nelts, sizeof(status_cpu_row *), cmp_cpu_rows);
+
+    return rows;
+}
+
+static const char *metric_label_escape(apr_pool_t *p, const char *s)
+{
+    const char *c;
+    char *e, *q;
+
+    for (c = s; *c && *c != '"' && *c != '\\' && *c != '\n'; ++c)
+        ;
+    if (!*c) {
+        return s;
+    }
+    q = e = apr_palloc(p, 2 * strlen(s) + 1);
+    for (c = s; *c; ++c) {
+        if (*c == '"' || *c == '\\') {
+            *q++ = '\\';
+            *q++ = *c;
+        }
+        else if (*c == '\n') {
+            *q++ = '\\';
+            *q++ = 'n';
+        }
+        else {
+            *q++ = *c;
+        }
+    }
+    *q = '\0';
+
+    return e;
+}
+
+static void add_metric(apr_array_header_t *metrics, const char *name,
+                       int type, const char *help, const char *suffix,
+                       const char *labels, double value)
+{
+    ap_status_metric *m = apr_array_push(metrics);
+
+    m->name = name;
+    m->type = type;
+    m->help = help;
+    m->suffix = suffix;
+    m->labels = labels;
+    m->value = value;
+}
+
+/*
+ * The OpenMetrics report (?metrics).  Only the counters of the workers
+ * are read from the scoreboard, not their request strings, and the
+ * status_hook are not run; the modules provide their metrics through the
+ * status_metrics hook instead.
+ */
+static int status_metrics_handler(request_rec *r)
+{
+    static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    apr_array_header_t *metrics;
+    ap_status_metric *m;
+    const char *family = NULL;
+    ap_generation_t mpm_generation;
+    apr_uint64_t count = 0, bytes = 0;
+    apr_time_t duration = 0;
+    ap_sb_histogram *duration_hist;
+    apr_time_t phase_time[AP_REQUEST_PHASE_COUNT];
+    apr_uint64_t phase_count[AP_REQUEST_PHASE_COUNT];
+    apr_array_header_t *cpu_rows;
+    const char **cpu_labels;
+    int states[MOD_STATUS_NUM_STATUS];
+    apr_uint64_t connections = 0, write_completion = 0, keep_alive = 0,
+                 lingering_close = 0, suspended = 0;
+    int ready = 0, busy = 0;
+    int i, j, h, res;
+
+    ap_mpm_query(AP_MPMQ_GENERATION, &mpm_generation);
+    duration_hist = apr_pcalloc(r->pool, sizeof *duration_hist);
+    memset(phase_time, 0, sizeof(phase_time));
+    memset(phase_count, 0, sizeof(phase_count));
+    memset(states, 0, sizeof(states));
+
+    for (i = 0; i < server_limit; ++i) {
+        process_score *ps_record = ap_get_scoreboard_process(i);
+
+        for (j = 0; j < thread_limit; ++j) {
+            worker_score *ws_record =
+                ap_get_scoreboard_worker_from_indexes(i, j);
+
+            res = ws_record->status;
+            if ((i >= max_servers || j >= threads_per_child)
+                && (res == SERVER_DEAD)) {
+                states[SERVER_DISABLED]++;
+                continue;
+            }
+            states[res]++;
+
+            if (!ps_record->quiescing && ps_record->pid) {
+                if (res == SERVER_READY) {
+                    if (ps_record->generation == mpm_generation)
+                        ready++;
+                }
+                else if (res != SERVER_DEAD &&
+                         res != SERVER_STARTING &&
+                         res != SERVER_IDLE_KILL) {
+                    busy++;
+                }
+            }
+
+            if (ap_extended_status && ws_record->access_count) {
+                count += ws_record->access_count;
+                bytes += ws_record->bytes_served;
+                duration += ws_record->duration;
+                for (h = 0; h < AP_SB_HIST_BUCKETS; ++h) {
+                    duration_hist->count[h] +=
+                        ws_record->req_time_hist.count[h];
+                }
+                for (h = 0; h < AP_REQUEST_PHASE_COUNT; ++h) {
+                    phase_time[h] += ws_record->phase_time[h];
+                    phase_count[h] += ws_record->phase_count[h];
+                }
+            }
+        }
+
+        if (is_async && ps_record->pid) {
+            connections += ps_record->connections;
+            write_completion += ps_record->write_completion;
+            keep_alive += ps_record->keep_alive;
+            lingering_close += ps_record->lingering_close;
+            suspended += ps_record->suspended;
+        }
+    }
+
+    metrics = apr_array_make(r->pool, 64, sizeof(ap_status_metric));
+
+    add_metric(metrics, "apache_uptime_seconds", AP_STATUS_METRIC_GAUGE,
+               "Time since the server was started", NULL, NULL,
+               (double)apr_time_sec(apr_time_now() -
+                                    ap_scoreboard_image->global->restart_time));
+    add_metric(metrics, "apache_workers", AP_STATUS_METRIC_GAUGE,
+               "Number of busy and idle workers", NULL, "state=\"busy\"",
+               busy);
+    add_metric(metrics, "apache_workers", AP_STATUS_METRIC_GAUGE, NULL,
+               NULL, "state=\"idle\"", ready);
+    for (i = 0; i < MOD_STATUS_NUM_STATUS; ++i) {
+        add_metric(metrics, "apache_scoreboard", AP_STATUS_METRIC_GAUGE,
+                   "Number of scoreboard slots per state", NULL,
+                   apr_psprintf(r->pool, "state=\"%s\"", status_names[i]),
+                   states[i]);
+    }
+    if (is_async) {
+        add_metric(metrics, "apache_connections", AP_STATUS_METRIC_GAUGE,
+                   "Number of connections of the async MPM", NULL,
+                   "state=\"total\"", (double)connections);
+        add_metric(metrics, "apache_connections", AP_STATUS_METRIC_GAUGE,
+                   NULL, NULL, "state=\"write_completion\"",
+                   (double)write_completion);
+        add_metric(metrics, "apache_connections", AP_STATUS_METRIC_GAUGE,
+                   NULL, NULL, "state=\"keepalive\"", (double)keep_alive);
+        add_metric(metrics, "apache_connections", AP_STATUS_METRIC_GAUGE,
+                   NULL, NULL, "state=\"closing\"",
+                   (double)lingering_close);
+        add_metric(metrics, "apache_connections", AP_STATUS_METRIC_GAUGE,
+                   NULL, NULL, "state=\"suspended\"", (double)suspended);
+    }
+    if (ap_extended_status) {
+        add_metric(metrics, "apache_sent_bytes", AP_STATUS_METRIC_COUNTER,
+                   "Bytes sent by the current workers", NULL, NULL,
+                   (double)bytes);
+        for (i = 0; i < (int)(sizeof(quantiles) / sizeof(quantiles[0]));
+             ++i) {
+            add_metric(metrics, "apache_request_duration_seconds",
+                       AP_STATUS_METRIC_SUMMARY,
+                       "Duration of the requests served by the current "
+                       "workers", NULL,
+                       apr_psprintf(r->pool, "quantile=\"%g\"",
+                                    quantiles[i]),
+                       ap_sb_hist_percentile(duration_hist, quantiles[i])
+                       / (double)APR_USEC_PER_SEC);
+        }
+        add_metric(metrics, "apache_request_duration_seconds",
+                   AP_STATUS_METRIC_SUMMARY, NULL, "_count", NULL,
+                   (double)count);
+        add_metric(metrics, "apache_request_duration_seconds",
+                   AP_STATUS_METRIC_SUMMARY, NULL, "_sum", NULL,
+                   (double)duration / APR_USEC_PER_SEC);
+        for (i = 0; i < AP_REQUEST_PHASE_COUNT; ++i) {
+            const char *labels = apr_psprintf(r->pool, "phase=\"%s\"",
+                                              ap_request_phase_name(i));
+
+            add_metric(metrics, "apache_request_phase_seconds",
+                       AP_STATUS_METRIC_SUMMARY,
+                       i ? NULL : "Time spent in each phase of the requests "
+                                  "served by the current workers",
+                       "_count", labels, (double)phase_count[i]);
+            add_metric(metrics, "apache_request_phase_seconds",
+                       AP_STATUS_METRIC_SUMMARY, NULL, "_sum", labels,
+                       (double)phase_time[i] / APR_USEC_PER_SEC);
+        }
+
+        cpu_rows = get_cpu_rows(r);
+        cpu_labels = apr_palloc(r->pool, (cpu_rows->nelts + 1)
+                                         * sizeof(const char *));
+        for (i = 0; i < cpu_rows->nelts; ++i) {
+            status_cpu_row *row = APR_ARRAY_IDX(cpu_rows, i,
+                                                status_cpu_row *);
+
+            cpu_labels[i] = apr_pstrcat(r->pool, "vhost=\"",
+                                        metric_label_escape(r->pool,
+                                                            row->vhost),
+                                        "\",handler=\"",
+                                        metric_label_escape(r->pool,
+                                                            row->handler),
+                                        "\"", NULL);
+            add_metric(metrics, "apache_handler_cpu_seconds",
+                       AP_STATUS_METRIC_COUNTER,
+                       i ? NULL : "CPU time used by the handlers and output "
+                                  "filters, per virtual host and handler",
+                       NULL, cpu_labels[i],
+                       (double)row->cpu_time / APR_USEC_PER_SEC);
+        }
+        for (i = 0; i < cpu_rows->nelts; ++i) {
+            status_cpu_row *row = APR_ARRAY_IDX(cpu_rows, i,
+                                                status_cpu_row *);
+
+            add_metric(metrics, "apache_handler_requests",
+                       AP_STATUS_METRIC_COUNTER,
+                       i ? NULL : "Requests of apache_handler_cpu_seconds",
+                       NULL, cpu_labels[i], (double)row->requests);
+        }
+    }
+
+    ap_run_status_metrics(r, metrics);
+
+    ap_set_content_type(r, "application/openmetrics-text; version=1.0.0; "
+                           "charset=utf-8");
+    apr_table_setn(r->headers_out, "Cache-Control", "no-cache");
+
+    m = (ap_status_metric *)metrics->elts;
+    for (i = 0; i < metrics->nelts; ++i, ++m) {
+        if (!family || strcmp(family, m->name)) {
+            family = m->name;
+            ap_rprintf(r, "# TYPE %s %s\n", m->name,
+                       m->type == AP_STATUS_METRIC_COUNTER ? "counter" :
+                       m->type == AP_STATUS_METRIC_SUMMARY ? "summary" :
+                                                             "gauge");
+            if (m->help) {
+                ap_rprintf(r, "# HELP %s %s\n", m->name, m->help);
+            }
+        }
+        ap_rvputs(r, m->name,
+                  m->type == AP_STATUS_METRIC_COUNTER ? "_total" : "",
+                  m->suffix ? m->suffix : "", NULL);
+        if (m->labels) {
+            ap_rvputs(r, "{", m->labels, "}", NULL);
+        }
+        ap_rprintf(r, " %.15g\n", m->value);
+    }
+    ap_rputs("# EOF\n", r);
+
+    return OK;
+}
+
 static int status_handler(request_rec *r)
 {
     const char *loc;
     apr_time_t nowtime;
     apr_uint32_t up_time;
     ap_loadavg_t t;
-    int j, i, res, written;
+    int j, i, h, res, written;
     int ready;
     int busy;
     unsigned long count;
@@ -195,6 +627,9 @@ static int status_handler(request_rec *r)
     long req_time;
     apr_time_t duration_global;
     apr_time_t duration_slot;
+    ap_sb_histogram *duration_hist, *bytes_hist;
+    apr_time_t phase_time[AP_REQUEST_PHASE_COUNT];
+    unsigned long phase_count[AP_REQUEST_PHASE_COUNT];
     int short_report;
     int no_table_report;
     global_score *global_record;
@@ -237,6 +672,8 @@ static int status_handler(request_rec *r)
     bcount = 0;
     kbcount = 0;
     duration_global = 0;
+    memset(phase_time, 0, sizeof(phase_time));
+    memset(phase_count, 0, sizeof(phase_count));
     short_report = 0;
     no_table_report = 0;
 
@@ -300,6 +737,8 @@ static int status_handler(request_rec *r)
                     ap_set_content_type(r, "text/plain; charset=ISO-8859-1");
                     short_report = 1;
                     break;
+                case STAT_OPT_METRICS:
+                    return status_metrics_handler(r);
                 }
             }
 
@@ -307,7 +746,12 @@ static int status_handler(request_rec *r)
         }
     }
 
+    /* For ExtendedStatus Lazy, have the workers update their strings */
+    ap_scoreboard_image->global->status_time = nowtime;
+
     ws_record = apr_palloc(r->pool, sizeof *ws_record);
+    duration_hist = apr_pcalloc(r->pool, sizeof *duration_hist);
+    bytes_hist = apr_pcalloc(r->pool, sizeof *bytes_hist);
 
     for (i = 0; i < server_limit; ++i) {
 #ifdef HAVE_TIMES
@@ -390,6 +834,16 @@ static int status_handler(request_rec *r)
                     bcount += bytes;
                     duration_global += ws_record->duration;
 
+                    for (h = 0; h < AP_SB_HIST_BUCKETS; ++h) {
+                        duration_hist->count[h] +=
+                            ws_record->req_time_hist.count[h];
+                        bytes_hist->count[h] += ws_record->bytes_hist.count[h];
+                    }
+                    for (h = 0; h < AP_REQUEST_PHASE_COUNT; ++h) {
+                        phase_time[h] += ws_record->phase_time[h];
+                        phase_count[h] += ws_record->phase_count[h];
+                    }
+
                     if (bcount >= KBYTE) {
                         kbcount += (bcount >> 10);
                         bcount = bcount & 0x3ff;
@@ -504,6 +958,38 @@ static int status_handler(request_rec *r)
                            KBYTE * (float) kbcount / (float) count);
                 ap_rprintf(r, "DurationPerReq: %g\n",
                            (float) apr_time_as_msec(duration_global) / (float) count);
+                ap_rprintf(r, "DurationP50: %g\nDurationP99: %g\n"
+                           "DurationP999: %g\n",
+                           ap_sb_hist_percentile(duration_hist, 0.5) / 1000.,
+                           ap_sb_hist_percentile(duration_hist, 0.99) / 1000.,
+                           ap_sb_hist_percentile(duration_hist, 0.999) / 1000.);
+                ap_rprintf(r, "BytesP50: %" APR_UINT64_T_FMT "\nBytesP99: %"
+                           APR_UINT64_T_FMT "\nBytesP999: %" APR_UINT64_T_FMT
+                           "\n",
+                           ap_sb_hist_percentile(bytes_hist, 0.5),
+                           ap_sb_hist_percentile(bytes_hist, 0.99),
+                           ap_sb_hist_percentile(bytes_hist, 0.999));
+                for (i = 0; i < AP_REQUEST_PHASE_COUNT; ++i) {
+                    const char *name = ap_request_phase_name(i);
+
+                    if (!phase_count[i]) {
+                        continue;
+                    }
+                    /* CamelCase the name, e.g. PhaseMapToStoragePerReq */
+                    ap_rputs("Phase", r);
+                    while (*name) {
+                        ap_rputc(apr_toupper(*name++), r);
+                        while (*name && *name != '_') {
+                            ap_rputc(*name++, r);
+                        }
+                        if (*name) {
+                            ++name;
+                        }
+                    }
+                    ap_rprintf(r, "PerReq: %g\n",
+                               (float) phase_time[i] / 1000.
+                               / (float) phase_count[i]);
+                }
             }
         }
         else { /* !short_report */
@@ -544,6 +1030,24 @@ static int status_handler(request_rec *r)
             }
 
             ap_rputs("</dt>\n", r);
+
+            if (count > 0) {
+                ap_rprintf(r, "<dt>Request duration: p50 %g ms - "
+                           "p99 %g ms - p99.9 %g ms</dt>\n",
+                           ap_sb_hist_percentile(duration_hist, 0.5) / 1000.,
+                           ap_sb_hist_percentile(duration_hist, 0.99) / 1000.,
+                           ap_sb_hist_percentile(duration_hist, 0.999) / 1000.);
+
+                ap_rputs("<dt>Request phases (ms/request):", r);
+                for (i = 0; i < AP_REQUEST_PHASE_COUNT; ++i) {
+                    if (phase_count[i]) {
+                        ap_rprintf(r, " %s %.3g", ap_request_phase_name(i),
+                                   (float) phase_time[i] / 1000.
+                                   / (float) phase_count[i]);
+                    }
+                }
+                ap_rputs("</dt>\n", r);
+            }
         } /* short_report */
     } /* ap_extended_status */
 
@@ -559,6 +1063,8 @@ static int status_handler(request_rec *r)
     if (is_async) {
         int write_completion = 0, lingering_close = 0, keep_alive = 0,
             connections = 0, stopping = 0, procs = 0;
+        apr_uint32_t queues_contention = 0;
+        apr_uint64_t setaside_bytes = 0;
         /*
          * These differ from 'busy' and 'ready' in how gracefully finishing
          * threads are counted. XXX: How to make this clear in the html?
@@ -571,7 +1077,8 @@ static int status_handler(request_rec *r)
                          "<th rowspan=\"2\">Stopping</th>"
                          "<th colspan=\"2\">Connections</th>\n"
                          "<th colspan=\"2\">Threads</th>"
-                         "<th colspan=\"3\">Async connections</th></tr>\n"
+                         "<th colspan=\"3\">Async connections</th>"
+                         "<th rowspan=\"2\">Buffered</th></tr>\n"
                      "<tr><th>total</th><th>accepting</th>"
                          "<th>busy</th><th>idle</th>"
                          "<th>writing</th><th>keep-alive</th><th>closing</th></tr>\n", r);
@@ -582,6 +1089,8 @@ static int status_handler(request_rec *r)
                 write_completion += ps_record->write_completion;
                 keep_alive       += ps_record->keep_alive;
                 lingering_close  += ps_record->lingering_close;
+                queues_contention += ps_record->queues_contention;
+                setaside_bytes   += ps_record->setaside_bytes;
                 busy_workers     += thread_busy_buffer[i];
                 idle_workers     += thread_idle_buffer[i];
                 procs++;
@@ -601,7 +1110,7 @@ static int status_handler(request_rec *r)
                                       "<td>%u</td><td>%s</td>"
                                       "<td>%u</td><td>%u</td>"
                                       "<td>%u</td><td>%u</td><td>%u</td>"
-                                      "</tr>\n",
+                                      "<td>",
                                i, ps_record->pid,
                                dying, old,
                                ps_record->connections,
@@ -611,6 +1120,8 @@ static int status_handler(request_rec *r)
                                ps_record->write_completion,
                                ps_record->keep_alive,
                                ps_record->lingering_close);
+                    format_byte_out(r, (apr_off_t)ps_record->setaside_bytes);
+                    ap_rputs("</td></tr>\n", r);
                 }
             }
         }
@@ -619,12 +1130,13 @@ static int status_handler(request_rec *r)
                           "<td>%d</td><td>%d</td>"
                           "<td>%d</td><td>&nbsp;</td>"
                           "<td>%d</td><td>%d</td>"
-                          "<td>%d</td><td>%d</td><td>%d</td>"
-                          "</tr>\n</table>\n",
+                          "<td>%d</td><td>%d</td><td>%d</td><td>",
                           procs, stopping,
                           connections,
                           busy_workers, idle_workers,
                           write_completion, keep_alive, lingering_close);
+            format_byte_out(r, (apr_off_t)setaside_bytes);
+            ap_rputs("</td></tr>\n</table>\n", r);
         }
         else {
             ap_rprintf(r, "Processes: %d\n"
@@ -634,11 +1146,14 @@ static int status_handler(request_rec *r)
                           "ConnsTotal: %d\n"
                           "ConnsAsyncWriting: %d\n"
                           "ConnsAsyncKeepAlive: %d\n"
-                          "ConnsAsyncClosing: %d\n",
+                          "ConnsAsyncClosing: %d\n"
+                          "AsyncQueuesContention: %u\n"
+                          "ConnsBufferedBytes: %" APR_UINT64_T_FMT "\n",
                           procs, stopping,
                           busy_workers, idle_workers,
                           connections,
-                          write_completion, keep_alive, lingering_close);
+                          write_completion, keep_alive, lingering_close,
+                          queues_contention, setaside_bytes);
         }
     }
 
@@ -957,6 +1472,44 @@ static int status_handler(request_rec *r)
 <tr><th>Slot</th><td>Total megabytes transferred this slot</td></tr>\n \
 </table>\n", r);
         }
+
+        if (cpu_slots) {
+            apr_array_header_t *cpu_rows = get_cpu_rows(r);
+
+            ap_rputs("<hr /><h2>CPU usage by virtual host and handler</h2>\n",
+                     r);
+            if (!no_table_report) {
+                ap_rputs("<table border=\"0\"><tr><th>Vhost</th>"
+                         "<th>Handler</th><th>Requests</th><th>CPU (s)</th>"
+                         "<th>ms/request</th></tr>\n", r);
+            }
+            for (i = 0; i < cpu_rows->nelts; ++i) {
+                status_cpu_row *row = APR_ARRAY_IDX(cpu_rows, i,
+                                                    status_cpu_row *);
+                double cpu = (double)row->cpu_time / APR_USEC_PER_SEC;
+                double per_req = (double)row->cpu_time / row->requests
+                                 / 1000;
+
+                if (no_table_report) {
+                    ap_rprintf(r, "<b>%s %s</b> %" APR_UINT64_T_FMT
+                               " requests, %.3f s CPU, %.3f ms/request<br />\n",
+                               ap_escape_html(r->pool, row->vhost),
+                               ap_escape_html(r->pool, row->handler),
+                               row->requests, cpu, per_req);
+                }
+                else {
+                    ap_rprintf(r, "<tr><td>%s</td><td>%s</td>"
+                               "<td>%" APR_UINT64_T_FMT "</td>"
+                               "<td>%.3f</td><td>%.3f</td></tr>\n",
+                               ap_escape_html(r->pool, row->vhost),
+                               ap_escape_html(r->pool, row->handler),
+                               row->requests, cpu, per_req);
+                }
+            }
+            if (!no_table_report) {
+                ap_rputs("</table>\n", r);
+            }
+        }
     } /* if (ap_extended_status && !short_report) */
     else {
 
@@ -1019,6 +1572,33 @@ static int status_init(apr_pool_t *p, apr_pool_t *plog, apr_pool_t *ptemp,
         threads_per_child = 1;
     ap_mpm_query(AP_MPMQ_MAX_DAEMONS, &max_servers);
     ap_mpm_query(AP_MPMQ_IS_ASYNC, &is_async);
+
+    cpu_slots = NULL;
+    if (ap_state_query(AP_SQ_MAIN_STATE) != AP_SQ_MS_CREATE_PRE_CONFIG
+            && ap_extended_status
+            && ap_time_thread_cpu() >= 0) {
+        apr_size_t size = STATUS_CPU_SLOTS * sizeof(status_cpu_slot);
+        apr_shm_t *shm;
+        apr_status_t rv;
+
+        /* inherited by the children, a new table on every restart */
+        rv = apr_shm_create(&shm, size, NULL, p);
+        if (rv != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_WARNING, rv, s, APLOGNO(10524)
+                         "could not create the shared memory of the CPU "
+                         "usage by virtual host and handler, which won't "
+                         "be available");
+        }
+        else {
+            cpu_slots = apr_shm_baseaddr_get(shm);
+            memset(cpu_slots, 0, size);
+            apr_cpystrn(cpu_slots[STATUS_CPU_SLOTS - 1].vhost, "*",
+                        STATUS_CPU_VHOST_LEN);
+            apr_cpystrn(cpu_slots[STATUS_CPU_SLOTS - 1].handler, "*",
+                        STATUS_CPU_HANDLER_LEN);
+            cpu_slots[STATUS_CPU_SLOTS - 1].state = STATUS_CPU_USED;
+        }
+    }
     return OK;
 }
 
@@ -1034,6 +1614,7 @@ static void register_hooks(apr_pool_t *p)
     ap_hook_handler(status_handler, NULL, NULL, APR_HOOK_MIDDLE);
     ap_hook_pre_config(status_pre_config, NULL, NULL, APR_HOOK_LAST);
     ap_hook_post_config(status_init, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_log_transaction(status_log_cpu, NULL, NULL, APR_HOOK_MIDDLE);
 #ifdef HAVE_TIMES
     ap_hook_child_init(status_child_init, NULL, NULL, APR_HOOK_MIDDLE);
 #endif
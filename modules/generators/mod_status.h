@@ -60,5 +60,32 @@
  * return OK or DECLINED. */
 APR_DECLARE_EXTERNAL_HOOK(ap, STATUS, int, status_hook,
                           (request_rec *r, int flags))
+
+/* Types of the metrics of the OpenMetrics report (?metrics) */
+#define AP_STATUS_METRIC_COUNTER 1
+#define AP_STATUS_METRIC_GAUGE   2
+#define AP_STATUS_METRIC_SUMMARY 3
+
+/* A sample of the OpenMetrics report.  The samples of a metric family
+ * must be added one after the other, the first one giving its type and
+ * help text.
+ */
+typedef struct ap_status_metric {
+    const char *name;   /* family name, e.g. "apache_ssl_sessions" */
+    const char *suffix; /* appended to the sample name (e.g. "_count" for
+                         * summaries), "_total" is added for counters */
+    const char *labels; /* e.g. "cache=\"shmcb\"", or NULL */
+    const char *help;
+    int type;           /* AP_STATUS_METRIC_* */
+    double value;
+} ap_status_metric;
+
+/* Optional hooks which can add their metrics to the OpenMetrics report,
+ * by pushing ap_status_metric samples to the METRICS array.  Unlike
+ * status_hook, they should not generate any content themselves and are
+ * run without a scan of the scoreboard; each hook should return OK or
+ * DECLINED. */
+APR_DECLARE_EXTERNAL_HOOK(ap, STATUS, int, status_metrics,
+                          (request_rec *r, apr_array_header_t *metrics))
 #endif
 /** @} */
@@ -83,7 +83,7 @@ static int ap_set_byterange(request_rec *r, apr_off_t clength,
 {
     const char *range;
     const char *ct;
-    char *cur;
+    char *cur, *next;
     apr_array_header_t *merged;
     int num_ranges = 0, unsatisfiable = 0;
     apr_off_t ostart = 0, oend = 0, sum_lengths = 0;
@@ -100,7 +100,7 @@ static int ap_set_byterange(request_rec *r, apr_off_t clength,
         return 0;
     }
 
-    range = apr_table_get(r->headers_in, "Range");
+    range = ap_get_request_header(r, AP_HDR_RANGE);
     if (!range || ap_cstr_casecmpn(range, "bytes=", 6) || r->status != HTTP_OK) {
         return 0;
     }
@@ -135,12 +135,22 @@ static int ap_set_byterange(request_rec *r, apr_off_t clength,
         ranges = MAX_PREALLOC_RANGES;
     }
     *indexes = apr_array_make(r->pool, ranges, sizeof(indexes_t));
-    while ((cur = ap_getword(r->pool, &range, ','))) {
+    /* split a single copy of the header in place, skipping empty specs
+     * between commas as ap_getword() would
+     */
+    for (cur = apr_pstrdup(r->pool, range); *cur; cur = next) {
         char *dash;
         apr_off_t number, start, end;
 
-        if (!*cur)
-            break;
+        if ((next = strchr(cur, ','))) {
+            *next++ = '\0';
+            while (*next == ',') {
+                ++next;
+            }
+        }
+        else {
+            next = cur + strlen(cur);
+        }
 
         /*
          * Per RFC 2616 14.35.1: If there is at least one syntactically invalid
@@ -285,10 +295,18 @@ static int ap_set_byterange(request_rec *r, apr_off_t clength,
 
 #define BYTERANGE_FMT "%" APR_OFF_T_FMT "-%" APR_OFF_T_FMT "/%" APR_OFF_T_FMT
 
+/*
+ * Copies the buckets of bb holding the bytes start to end into bbout.
+ * *hint and *hint_pos, when set, are a bucket of bb and its offset from
+ * which to look for start, if it is after; they are updated to the first
+ * bucket copied, so that ascending ranges don't rescan bb each time.
+ */
 static apr_status_t copy_brigade_range(apr_bucket_brigade *bb,
                                        apr_bucket_brigade *bbout,
                                        apr_off_t start,
-                                       apr_off_t end)
+                                       apr_off_t end,
+                                       apr_bucket **hint,
+                                       apr_uint64_t *hint_pos)
 {
     apr_bucket *first = NULL, *last = NULL, *out_first = NULL, *e;
     apr_uint64_t pos = 0, off_first = 0, off_last = 0;
@@ -307,7 +325,12 @@ static apr_status_t copy_brigade_range(apr_bucket_brigade *bb,
     if (start < 0 || end < 0 || start64 > end64)
         return APR_EINVAL;
 
-    for (e = APR_BRIGADE_FIRST(bb);
+    e = APR_BRIGADE_FIRST(bb);
+    if (*hint && *hint_pos <= start64) {
+        e = *hint;
+        pos = *hint_pos;
+    }
+    for (;
          e != APR_BRIGADE_SENTINEL(bb);
          e = APR_BUCKET_NEXT(e))
     {
@@ -328,6 +351,8 @@ static apr_status_t copy_brigade_range(apr_bucket_brigade *bb,
     }
     if (!first || !last)
         return APR_EINVAL;
+    *hint = first;
+    *hint_pos = off_first;
 
     e = first;
     while (1)
@@ -411,6 +436,8 @@ AP_CORE_DECLARE_NONSTD(apr_status_t) ap_byterange_filter(ap_filter_t *f,
     int found = 0;
     int num_ranges;
     char *bound_head = NULL;
+    apr_bucket *hint = NULL;
+    apr_uint64_t hint_pos = 0;
     apr_array_header_t *indexes;
     indexes_t *idx;
     int i;
@@ -492,7 +519,6 @@ AP_CORE_DECLARE_NONSTD(apr_status_t) ap_byterange_filter(ap_filter_t *f,
                                      CRLF "Content-range: bytes ",
                                      NULL);
         }
-        ap_xlate_proto_to_ascii(bound_head, strlen(bound_head));
     }
 
     tmpbb = apr_brigade_create(r->pool, c->bucket_alloc);
@@ -502,7 +528,8 @@ AP_CORE_DECLARE_NONSTD(apr_status_t) ap_byterange_filter(ap_filter_t *f,
         range_start = idx->start;
         range_end = idx->end;
 
-        rv = copy_brigade_range(bb, tmpbb, range_start, range_end);
+        rv = copy_brigade_range(bb, tmpbb, range_start, range_end,
+                                &hint, &hint_pos);
         if (rv != APR_SUCCESS ) {
             ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01584)
                           "copy_brigade_range() failed [%" APR_OFF_T_FMT
@@ -523,16 +550,16 @@ AP_CORE_DECLARE_NONSTD(apr_status_t) ap_byterange_filter(ap_filter_t *f,
         }
         else {
             char *ts;
+            apr_size_t len;
 
-            e = apr_bucket_pool_create(bound_head, strlen(bound_head),
-                                       r->pool, c->bucket_alloc);
-            APR_BRIGADE_INSERT_TAIL(bsend, e);
-
-            ts = apr_psprintf(r->pool, BYTERANGE_FMT CRLF CRLF,
-                              range_start, range_end, clength);
-            ap_xlate_proto_to_ascii(ts, strlen(ts));
-            e = apr_bucket_pool_create(ts, strlen(ts), r->pool,
-                                       c->bucket_alloc);
+            /* the whole part header in one bucket, so one iovec when the
+             * part's file bucket is sent with sendfile
+             */
+            ts = apr_psprintf(r->pool, "%s" BYTERANGE_FMT CRLF CRLF,
+                              bound_head, range_start, range_end, clength);
+            len = strlen(ts);
+            ap_xlate_proto_to_ascii(ts, len);
+            e = apr_bucket_pool_create(ts, len, r->pool, c->bucket_alloc);
             APR_BRIGADE_INSERT_TAIL(bsend, e);
         }
 
@@ -43,10 +43,15 @@
 
 APLOG_USE_MODULE(http);
 
+/* Data passed down in smaller pieces than this, without a FLUSH or EOS,
+ * is set aside and sent in the next chunk rather than in one of its own.
+ */
+#define CHUNK_MIN_BYTES 4096
 
 typedef struct chunk_out_ctx {
     int bad_gateway_seen;
     apr_table_t *trailers;
+    apr_bucket_brigade *pending;
 } chunk_out_ctx;
 
 
@@ -62,10 +67,16 @@ apr_status_t ap_http_chunk_filter(ap_filter_t *f, apr_bucket_brigade *b)
         ctx = f->ctx = apr_pcalloc(f->r->pool, sizeof(*ctx));
     }
 
+    /* Resume with what was set aside last time */
+    if (ctx->pending && !APR_BRIGADE_EMPTY(ctx->pending)) {
+        APR_BRIGADE_PREPEND(b, ctx->pending);
+    }
+
     for (more = tmp = NULL; b; b = more, more = NULL) {
         apr_off_t bytes = 0;
         apr_bucket *eos = NULL;
         apr_bucket *flush = NULL;
+        int metadata_seen = 0;
         /* XXX: chunk_hdr must remain at this scope since it is used in a
          *      transient bucket.
          */
@@ -77,6 +88,7 @@ apr_status_t ap_http_chunk_filter(ap_filter_t *f, apr_bucket_brigade *b)
              e = APR_BUCKET_NEXT(e))
         {
             if (APR_BUCKET_IS_METADATA(e)) {
+                metadata_seen = 1;
                 if (APR_BUCKET_IS_EOS(e)) {
                     /* there shouldn't be anything after the eos */
                     ap_log_rerror(APLOG_MARK, APLOG_TRACE2, 0, f->r,
@@ -147,10 +159,19 @@ apr_status_t ap_http_chunk_filter(ap_filter_t *f, apr_bucket_brigade *b)
         }
 
         /*
-         * XXX: if there aren't very many bytes at this point it may
-         * be a good idea to set them aside and return for more,
-         * unless we haven't finished counting this brigade yet.
+         * If there aren't very many bytes at this point, set them aside
+         * and return for more, unless we haven't finished counting this
+         * brigade yet or something else than plain data was seen (the
+         * chunk must not be held back past a FLUSH or EOS).
          */
+        if (bytes > 0 && bytes < CHUNK_MIN_BYTES
+                && !metadata_seen && !more) {
+            ap_log_rerror(APLOG_MARK, APLOG_TRACE3, 0, f->r,
+                          "ap_http_chunk_filter setting aside %"
+                          APR_OFF_T_FMT " bytes", bytes);
+            return ap_save_brigade(f, &ctx->pending, &b, f->r->pool);
+        }
+
         /* if there are content bytes, then wrap them in a chunk */
         if (bytes > 0) {
             apr_size_t hdr_len;
@@ -290,7 +290,7 @@ static int h1_post_read_request(request_rec *r)
 
     if (!r->main && !r->prev && r->proto_num <= HTTP_VERSION(1,1)) {
         if (r->proto_num >= HTTP_VERSION(1,0)) {
-            tenc = apr_table_get(r->headers_in, "Transfer-Encoding");
+            tenc = ap_get_request_header(r, AP_HDR_TRANSFER_ENCODING);
             if (tenc) {
                 r->body_indeterminate = 1;
 
@@ -313,7 +313,7 @@ static int h1_post_read_request(request_rec *r)
                  * Transfer-Encoding overrides the Content-Length. ... A sender
                  * MUST remove the received Content-Length field".
                  */
-                if (apr_table_get(r->headers_in, "Content-Length")) {
+                if (ap_get_request_header(r, AP_HDR_CONTENT_LENGTH)) {
                     apr_table_unset(r->headers_in, "Content-Length");
 
                     /* Don't reuse this connection anyway to avoid confusion with
@@ -100,6 +100,48 @@ static apr_status_t parse_chunk_size(http_ctx_t *ctx, const char *buffer,
 {
     apr_size_t i = 0;
 
+#if !APR_CHARSET_EBCDIC
+    /* Fast path for the usual chunk line made of hex digits and CRLF only,
+     * read at once (without extension nor BWS). Anything else, including
+     * errors and overflows, is left to the state machine below.
+     */
+    if (ctx->state == BODY_CHUNK && len > 2 && len <= (apr_size_t)linelimit
+            && buffer[len - 2] == CR && buffer[len - 1] == LF) {
+        apr_size_t end = len - 2, digits_max = (sizeof(apr_off_t) * 8 - 4) / 4;
+        apr_off_t remaining = 0;
+
+        /* ignore leading zeros */
+        while (i < end && buffer[i] == '0') {
+            i++;
+        }
+        if (end - i <= digits_max) {
+            for (; i < end; ++i) {
+                int xvalue;
+                char c = buffer[i];
+
+                if (c >= '0' && c <= '9') {
+                    xvalue = c - '0';
+                }
+                else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+                    xvalue = (c | 0x20) - 'a' + 0xa;
+                }
+                else {
+                    break;
+                }
+                remaining = (remaining << 4) | xvalue;
+            }
+            if (i == end) {
+                ctx->remaining = remaining;
+                ctx->chunk_used = len;
+                ctx->chunk_bws = 0;
+                ctx->state = remaining ? BODY_CHUNK_DATA : BODY_CHUNK_TRAILER;
+                return APR_SUCCESS;
+            }
+        }
+        i = 0;
+    }
+#endif
+
     while (i < len) {
         char c = buffer[i];
 
@@ -929,6 +971,10 @@ static void fixup_vary(request_rec *r)
 {
     apr_array_header_t *varies;
 
+    if (!apr_table_get(r->headers_out, "Vary")) {
+        return;
+    }
+
     varies = apr_array_make(r->pool, 5, sizeof(char *));
 
     /* Extract all Vary fields from the headers_out, separate each into
@@ -1504,7 +1550,7 @@ cleanup:
 
 AP_DECLARE(int) ap_setup_client_block(request_rec *r, int read_policy)
 {
-    const char *lenp = apr_table_get(r->headers_in, "Content-Length");
+    const char *lenp = ap_get_request_header(r, AP_HDR_CONTENT_LENGTH);
     apr_off_t limit_req_body = ap_get_limit_req_body(r);
 
     r->read_body = read_policy;
@@ -1764,66 +1810,123 @@ apr_status_t ap_http_outerror_filter(ap_filter_t *f,
 }
 
 
-/* fill "bb" with a barebones/initial HTTP/1.x response header */
+/* Number of header fields whose lengths are kept on the stack while
+ * serializing the response head, more are allocated from the pool */
+#define H1_HEAD_FIELDS_STACK 32
+
+/* fill "bb" with the HTTP/1.x response head: the Status-Line, the Date and
+ * Server fields, the other fields and the terminating empty line, all sized
+ * first and then written in a single heap bucket */
 static void h1_append_response_head(request_rec *r,
                                     ap_bucket_response *resp,
                                     const char *protocol,
                                     apr_bucket_brigade *bb)
 {
-    const char *date = NULL;
-    const char *server = NULL;
+    const apr_array_header_t *elts = apr_table_elts(resp->headers);
+    const apr_table_entry_t *t_elt = (const apr_table_entry_t *)elts->elts;
+    apr_size_t stack_lens[2 * H1_HEAD_FIELDS_STACK], *lens = stack_lens;
+    const char *date = NULL, *server = NULL;
+    apr_size_t date_len = 0, server_len = 0;
     const char *status_line;
-    struct iovec vec[4];
+    char status_buf[16];
+    apr_size_t proto_len, status_len, reason_len = 0, len;
+    char *buf, *pos;
+    int i;
 
     if (r->assbackwards) {
         /* there are no headers to send */
         return;
     }
 
-    /* Output the HTTP/1.x Status-Line and the Date and Server fields */
+    /* The Status-Line */
     if (resp->reason) {
-        status_line =  apr_psprintf(r->pool, "%d %s", resp->status, resp->reason);
+        status_len = apr_snprintf(status_buf, sizeof(status_buf), "%d ",
+                                  resp->status);
+        status_line = status_buf;
+        reason_len = strlen(resp->reason);
     }
     else {
         status_line = ap_get_status_line_ex(r->pool, resp->status);
+        status_len = strlen(status_line);
     }
+    proto_len = strlen(protocol);
+    len = proto_len + 1 + status_len + reason_len + 2;
 
-    vec[0].iov_base = (void *)protocol;
-    vec[0].iov_len  = strlen(protocol);
-    vec[1].iov_base = (void *)" ";
-    vec[1].iov_len  = sizeof(" ") - 1;
-    vec[2].iov_base = (void *)(status_line);
-    vec[2].iov_len  = strlen(status_line);
-    vec[3].iov_base = (void *)CRLF;
-    vec[3].iov_len  = sizeof(CRLF) - 1;
-#if APR_CHARSET_EBCDIC
-    {
-        char *tmp;
-        apr_size_t len;
-        tmp = apr_pstrcatv(r->pool, vec, 4, &len);
-        ap_xlate_proto_to_ascii(tmp, len);
-        apr_brigade_write(bb, NULL, NULL, tmp, len);
+    /* The fields, with Date and Server written first and second, just
+     * because we always did and some quirky clients might rely on that.
+     * Only the first of each is sent.
+     */
+    if (elts->nelts > H1_HEAD_FIELDS_STACK) {
+        lens = apr_palloc(r->pool, 2 * elts->nelts * sizeof(*lens));
     }
-#else
-    apr_brigade_writev(bb, NULL, NULL, vec, 4);
-#endif
+    for (i = 0; i < elts->nelts; ++i) {
+        const char *key = t_elt[i].key, *val = t_elt[i].val;
 
-    date = apr_table_get(resp->headers, "Date");
-    server = apr_table_get(resp->headers, "Server");
+        lens[2 * i] = 0;
+        if (!key || !val) {
+            continue;
+        }
+        if (!ap_cstr_casecmp(key, "Date")) {
+            if (!date) {
+                date = val;
+                date_len = strlen(val);
+            }
+            continue;
+        }
+        if (!ap_cstr_casecmp(key, "Server")) {
+            if (!server) {
+                server = val;
+                server_len = strlen(val);
+            }
+            continue;
+        }
+        lens[2 * i] = strlen(key);
+        lens[2 * i + 1] = strlen(val);
+        len += lens[2 * i] + 2 + lens[2 * i + 1] + 2;
+    }
     if (date) {
-        /* We always write that as first, just because we
-         * always did and some quirky clients might rely on that.
-         */
-        ap_h1_append_header(bb, r->pool, "Date", date);
-        apr_table_unset(resp->headers, "Date");
+        len += sizeof("Date: " CRLF) - 1 + date_len;
     }
     if (server) {
-        /* We always write that second, just because we
-         * always did and some quirky clients might rely on that.
-         */
-        ap_h1_append_header(bb, r->pool, "Server", server);
-        apr_table_unset(resp->headers, "Server");
+        len += sizeof("Server: " CRLF) - 1 + server_len;
     }
+    len += 2; /* the empty line */
+
+    buf = pos = apr_bucket_alloc(len, bb->bucket_alloc);
+#define H1_HEAD_PUT(s, n) (memcpy(pos, (s), (n)), pos += (n))
+    H1_HEAD_PUT(protocol, proto_len);
+    *pos++ = ' ';
+    H1_HEAD_PUT(status_line, status_len);
+    if (resp->reason) {
+        H1_HEAD_PUT(resp->reason, reason_len);
+    }
+    H1_HEAD_PUT(CRLF, 2);
+    if (date) {
+        H1_HEAD_PUT("Date: ", 6);
+        H1_HEAD_PUT(date, date_len);
+        H1_HEAD_PUT(CRLF, 2);
+    }
+    if (server) {
+        H1_HEAD_PUT("Server: ", 8);
+        H1_HEAD_PUT(server, server_len);
+        H1_HEAD_PUT(CRLF, 2);
+    }
+    for (i = 0; i < elts->nelts; ++i) {
+        if (lens[2 * i]) {
+            H1_HEAD_PUT(t_elt[i].key, lens[2 * i]);
+            H1_HEAD_PUT(": ", 2);
+            H1_HEAD_PUT(t_elt[i].val, lens[2 * i + 1]);
+            H1_HEAD_PUT(CRLF, 2);
+        }
+    }
+    H1_HEAD_PUT(CRLF, 2);
+#undef H1_HEAD_PUT
+    AP_DEBUG_ASSERT(pos == buf + len);
+
+    ap_xlate_proto_to_ascii(buf, len);
+    APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_heap_create(buf, len,
+                                                       apr_bucket_free,
+                                                       bb->bucket_alloc));
 
     if (APLOGrtrace3(r)) {
         ap_log_rerror(APLOG_MARK, APLOG_TRACE3, 0, r,
@@ -1841,6 +1944,14 @@ static void h1_append_response_head(request_rec *r,
         if (server)
             ap_log_rerror(APLOG_MARK, APLOG_TRACE5, 0, r, "  Server: %s",
                           server);
+        if (APLOGrtrace4(r)) {
+            for (i = 0; i < elts->nelts; ++i) {
+                if (lens[2 * i]) {
+                    ap_log_rerror(APLOG_MARK, APLOG_TRACE4, 0, r, "  %s: %s",
+                                  t_elt[i].key, t_elt[i].val);
+                }
+            }
+        }
     }
 }
 
@@ -1944,8 +2055,6 @@ AP_CORE_DECLARE_NONSTD(apr_status_t) ap_h1_response_out_filter(ap_filter_t *f,
                         proto = "HTTP/1.0";
                     }
                     h1_append_response_head(r, resp, proto, b);
-                    ap_h1_append_headers(b, r, resp->headers);
-                    ap_h1_terminate_header(b);
                     apr_bucket_delete(e);
 
                     if (ctx->final_response_sent && r->chunked) {
@@ -227,7 +227,7 @@ int ap_h1_set_keepalive(request_rec *r, ap_bucket_response *resp)
     wimpy = ap_find_token(r->pool,
                           apr_table_get(resp->headers, "Connection"),
                           "close");
-    conn = apr_table_get(r->headers_in, "Connection");
+    conn = ap_get_request_header(r, AP_HDR_CONNECTION);
 
     /* The following convoluted conditional determines whether or not
      * the current connection should remain persistent after this response
@@ -275,7 +275,7 @@ int ap_h1_set_keepalive(request_rec *r, ap_bucket_response *resp)
         && !wimpy
         && !ap_find_token(r->pool, conn, "close")
         && (!apr_table_get(r->subprocess_env, "nokeepalive")
-            || apr_table_get(r->headers_in, "Via"))
+            || ap_get_request_header(r, AP_HDR_VIA))
         && ((ka_sent = ap_find_token(r->pool, conn, "keep-alive"))
             || (r->proto_num >= HTTP_VERSION(1,1)))
         && is_mpm_running()) {
@@ -349,7 +349,7 @@ AP_DECLARE(ap_condition_e) ap_condition_if_match(request_rec *r,
     /* A server MUST use the strong comparison function (see section 13.3.3)
      * to compare the entity tags in If-Match.
      */
-    if ((if_match = apr_table_get(r->headers_in, "If-Match")) != NULL) {
+    if ((if_match = ap_get_request_header(r, AP_HDR_IF_MATCH)) != NULL) {
         if (if_match[0] == '*'
                 || ((etag = apr_table_get(headers, "ETag")) != NULL
                         && ap_find_etag_strong(r->pool, if_match, etag))) {
@@ -368,7 +368,7 @@ AP_DECLARE(ap_condition_e) ap_condition_if_unmodified_since(request_rec *r,
 {
     const char *if_unmodified;
 
-    if_unmodified = apr_table_get(r->headers_in, "If-Unmodified-Since");
+    if_unmodified = ap_get_request_header(r, AP_HDR_IF_UNMODIFIED_SINCE);
     if (if_unmodified) {
         apr_int64_t mtime, reqtime;
 
@@ -391,7 +391,7 @@ AP_DECLARE(ap_condition_e) ap_condition_if_unmodified_since(request_rec *r,
 
         if ((ius != APR_DATE_BAD) && (mtime > ius)) {
             if (reqtime < mtime + 60) {
-                if (apr_table_get(r->headers_in, "Range")) {
+                if (ap_get_request_header(r, AP_HDR_RANGE)) {
                     /* weak matches not allowed with Range requests */
                     return AP_CONDITION_NOMATCH;
                 }
@@ -416,7 +416,7 @@ AP_DECLARE(ap_condition_e) ap_condition_if_none_match(request_rec *r,
 {
     const char *if_nonematch, *etag;
 
-    if_nonematch = apr_table_get(r->headers_in, "If-None-Match");
+    if_nonematch = ap_get_request_header(r, AP_HDR_IF_NONE_MATCH);
     if (if_nonematch != NULL) {
 
         if (if_nonematch[0] == '*') {
@@ -429,7 +429,7 @@ AP_DECLARE(ap_condition_e) ap_condition_if_none_match(request_rec *r,
          */
         if (r->method_number == M_GET) {
             if ((etag = apr_table_get(headers, "ETag")) != NULL) {
-                if (apr_table_get(r->headers_in, "Range")) {
+                if (ap_get_request_header(r, AP_HDR_RANGE)) {
                     if (ap_find_etag_strong(r->pool, if_nonematch, etag)) {
                         return AP_CONDITION_STRONG;
                     }
@@ -457,7 +457,7 @@ AP_DECLARE(ap_condition_e) ap_condition_if_modified_since(request_rec *r,
 {
     const char *if_modified_since;
 
-    if ((if_modified_since = apr_table_get(r->headers_in, "If-Modified-Since"))
+    if ((if_modified_since = ap_get_request_header(r, AP_HDR_IF_MODIFIED_SINCE))
             != NULL) {
         apr_int64_t mtime;
         apr_int64_t ims, reqtime;
@@ -482,7 +482,7 @@ AP_DECLARE(ap_condition_e) ap_condition_if_modified_since(request_rec *r,
 
         if (ims >= mtime && ims <= reqtime) {
             if (reqtime < mtime + 60) {
-                if (apr_table_get(r->headers_in, "Range")) {
+                if (ap_get_request_header(r, AP_HDR_RANGE)) {
                     /* weak matches not allowed with Range requests */
                     return AP_CONDITION_NOMATCH;
                 }
@@ -507,8 +507,8 @@ AP_DECLARE(ap_condition_e) ap_condition_if_range(request_rec *r,
 {
     const char *if_range, *etag;
 
-    if ((if_range = apr_table_get(r->headers_in, "If-Range"))
-            && apr_table_get(r->headers_in, "Range")) {
+    if ((if_range = ap_get_request_header(r, AP_HDR_IF_RANGE))
+            && ap_get_request_header(r, AP_HDR_RANGE)) {
         if (if_range[0] == '"') {
 
             if ((etag = apr_table_get(headers, "ETag"))
@@ -1068,7 +1068,7 @@ static const char *get_canned_error_string(int status,
                "request-header field overlap the current extent\n"
                "of the selected resource.</p>\n");
     case HTTP_EXPECTATION_FAILED:
-        s1 = apr_table_get(r->headers_in, "Expect");
+        s1 = ap_get_request_header(r, AP_HDR_EXPECT);
         if (s1)
             s1 = apr_pstrcat(p,
                      "<p>The expectation given in the Expect request-header\n"
@@ -802,6 +802,12 @@ static content_type *analyze_ct(request_rec *r, const char *s)
     return (ctp);
 }
 
+/* Whether the media type has no parameters nor whitespace to normalize */
+static int is_plain_type(const char *type)
+{
+    return ap_strchr_c(type, '/') && !type[strcspn(type, "; \t\r\n")];
+}
+
 /*
  * find_ct is the hook routine for determining content-type and other
  * MIME-related metadata.  It assumes that r->filename has already been
@@ -1003,7 +1009,11 @@ static int find_ct(request_rec *r)
                        (void *)exception_list);
     }
 
-    if (r->content_type) {
+    /* A plain "type/subtype" (as all of the TypesConfig ones are) would
+     * be rebuilt identical by analyze_ct(), so unless a charset is to be
+     * added it is left as is.
+     */
+    if (r->content_type && (charset || !is_plain_type(r->content_type))) {
         content_type *ctp;
         int override = 0;
 
@@ -167,6 +167,9 @@ dnl # nghttp2 >= 1.15.0: don't keep info on closed streams
 dnl # nghttp2 >= 1.50.0: rfc9113 leading/trailing whitespec strictness
       AC_CHECK_FUNCS([nghttp2_option_set_no_rfc9113_leading_and_trailing_ws_validation],
         [APR_ADDTO(MOD_CPPFLAGS, ["-DH2_NG2_RFC9113_STRICTNESS"])], [])
+dnl # nghttp2 >= 1.49.0: rfc9218 extensible priorities with rfc7540 fallback
+      AC_CHECK_FUNCS([nghttp2_option_set_server_fallback_rfc7540_priorities],
+        [APR_ADDTO(MOD_CPPFLAGS, ["-DH2_NG2_EXTPRI"])], [])
     else
       AC_MSG_WARN([nghttp2 version is too old])
     fi
@@ -179,6 +179,7 @@ typedef struct h2_stream *h2_stream_get_fn(struct h2_session *session, int strea
 /* Note key to attach stream id to conn_rec/request_rec instances */
 #define H2_HDR_CONFORMANCE      "http2-hdr-conformance"
 #define H2_HDR_CONFORMANCE_UNSAFE      "unsafe"
+#define H2_HDR_CONFORMANCE_CHECKED     "checked"
 #define H2_PUSH_MODE_NOTE       "http2-push-mode"
 
 
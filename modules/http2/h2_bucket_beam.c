@@ -396,6 +396,35 @@ void h2_beam_close(h2_bucket_beam *beam, conn_rec *c)
     apr_thread_mutex_unlock(beam->lock);
 }
 
+/* A file bucket shared with others (refcount > 1, e.g. split by the
+ * byterange filter) can not be passed to the receiver, but a new bucket
+ * on the same file opened anew can, since it has its own handle (and
+ * offset) then. Returns NULL if the file can't be reopened as is.
+ */
+static apr_bucket *reopen_file_bucket(h2_bucket_beam *beam, apr_bucket *b)
+{
+    apr_bucket_file *bf = b->data;
+    apr_finfo_t finfo, nfinfo;
+    const char *fname;
+    apr_file_t *fd;
+
+    if (apr_file_name_get(&fname, bf->fd) != APR_SUCCESS || !fname
+        || apr_file_info_get(&finfo, APR_FINFO_IDENT, bf->fd) != APR_SUCCESS
+        || apr_file_open(&fd, fname, (APR_FOPEN_READ | APR_FOPEN_BINARY
+                                      | APR_FOPEN_SENDFILE_ENABLED),
+                         APR_OS_DEFAULT, beam->pool) != APR_SUCCESS) {
+        return NULL;
+    }
+    /* make sure it's still the same file */
+    if (apr_file_info_get(&nfinfo, APR_FINFO_IDENT, fd) != APR_SUCCESS
+        || nfinfo.inode != finfo.inode || nfinfo.device != finfo.device) {
+        apr_file_close(fd);
+        return NULL;
+    }
+    return apr_bucket_file_create(fd, b->start, b->length, beam->pool,
+                                  b->list);
+}
+
 static apr_status_t append_bucket(h2_bucket_beam *beam,
                                   apr_bucket_brigade *bb,
                                   apr_read_type_e block,
@@ -450,6 +479,15 @@ static apr_status_t append_bucket(h2_bucket_beam *beam,
          * transport. */
         apr_bucket_file *bf = b->data;
         can_beam = !beam->copy_files && (bf->refcount.refcount == 1);
+        if (!beam->copy_files && !can_beam && b->length > 0) {
+            apr_bucket *b2 = reopen_file_bucket(beam, b);
+            if (b2) {
+                apr_bucket_delete(b);
+                b = b2;
+                APR_BRIGADE_INSERT_HEAD(bb, b);
+                can_beam = 1;
+            }
+        }
     }
     else if (bucket_is_mmap(b)) {
         can_beam = !beam->copy_files;
@@ -365,6 +365,42 @@ static apr_status_t beam_out(conn_rec *c2, h2_conn_ctx_t *conn_ctx, apr_bucket_b
     return rv;
 }
 
+/* Check the response header fields while still on the worker, so that
+ * the primary connection, which serves all streams, can skip it when it
+ * submits the response (H2_HDR_CONFORMANCE_CHECKED).
+ */
+static void check_response_headers(apr_bucket_brigade *bb)
+{
+    apr_table_t *headers, *notes;
+    apr_bucket *b;
+
+    for (b = APR_BRIGADE_FIRST(bb);
+         b != APR_BRIGADE_SENTINEL(bb);
+         b = APR_BUCKET_NEXT(b)) {
+#if AP_HAS_RESPONSE_BUCKETS
+        if (AP_BUCKET_IS_RESPONSE(b)) {
+            ap_bucket_response *resp = b->data;
+            headers = resp->headers;
+            notes = resp->notes;
+        }
+#else
+        if (H2_BUCKET_IS_HEADERS(b)) {
+            h2_headers *resp = h2_bucket_headers_get(b);
+            headers = resp->headers;
+            notes = resp->notes;
+        }
+#endif /* AP_HAS_RESPONSE_BUCKETS */
+        else {
+            continue;
+        }
+        if (notes && !apr_table_get(notes, H2_HDR_CONFORMANCE)
+            && h2_res_check_headers(headers) == APR_SUCCESS) {
+            apr_table_setn(notes, H2_HDR_CONFORMANCE,
+                           H2_HDR_CONFORMANCE_CHECKED);
+        }
+    }
+}
+
 static apr_status_t h2_c2_filter_out(ap_filter_t* f, apr_bucket_brigade* bb)
 {
     h2_conn_ctx_t *conn_ctx = h2_conn_ctx_get(f->c);
@@ -392,6 +428,7 @@ static apr_status_t h2_c2_filter_out(ap_filter_t* f, apr_bucket_brigade* bb)
         }
     }
 #endif /* AP_HAS_RESPONSE_BUCKETS */
+    check_response_headers(bb);
     rv = beam_out(f->c, conn_ctx, bb);
 
     ap_log_cerror(APLOG_MARK, APLOG_TRACE2, rv, f->c,
@@ -76,6 +76,7 @@ typedef struct h2_config {
     int output_buffered;
     apr_interval_time_t stream_timeout;/* beam timeout */
     int header_strictness;           /* which rfc to follow when verifying header */
+    int ext_priorities;              /* use RFC 9218 extensible priorities */
 } h2_config;
 
 typedef struct h2_dir_config {
@@ -112,6 +113,7 @@ static h2_config defconf = {
     1,                      /* stream output buffered */
     -1,                     /* beam timeout */
     7540,                   /* header strictness */
+    1,                      /* RFC 9218 priorities */
 };
 
 static h2_dir_config defdconf = {
@@ -156,6 +158,7 @@ void *h2_config_create_svr(apr_pool_t *pool, server_rec *s)
     conf->output_buffered      = DEF_VAL;
     conf->stream_timeout       = DEF_VAL;
     conf->header_strictness    = DEF_VAL;
+    conf->ext_priorities       = DEF_VAL;
     return conf;
 }
 
@@ -199,6 +202,7 @@ static void *h2_config_merge(apr_pool_t *pool, void *basev, void *addv)
     n->padding_always       = H2_CONFIG_GET(add, base, padding_always);
     n->stream_timeout       = H2_CONFIG_GET(add, base, stream_timeout);
     n->header_strictness    = H2_CONFIG_GET(add, base, header_strictness);
+    n->ext_priorities       = H2_CONFIG_GET(add, base, ext_priorities);
     return n;
 }
 
@@ -284,6 +288,8 @@ static apr_int64_t h2_srv_config_geti64(const h2_config *conf, h2_config_var_t v
             return H2_CONFIG_GET(conf, &defconf, stream_timeout);
         case H2_CONF_HEADER_STRICTNESS:
             return H2_CONFIG_GET(conf, &defconf, header_strictness);
+        case H2_CONF_EXT_PRIORITIES:
+            return H2_CONFIG_GET(conf, &defconf, ext_priorities);
         default:
             return DEF_VAL;
     }
@@ -346,6 +352,9 @@ static void h2_srv_config_seti(h2_config *conf, h2_config_var_t var, int val)
         case H2_CONF_HEADER_STRICTNESS:
             H2_CONFIG_SET(conf, header_strictness, val);
             break;
+        case H2_CONF_EXT_PRIORITIES:
+            H2_CONFIG_SET(conf, ext_priorities, val);
+            break;
         default:
             break;
     }
@@ -882,6 +891,20 @@ static const char *h2_conf_set_output_buffer(cmd_parms *cmd,
     return "value must be On or Off";
 }
 
+static const char *h2_conf_set_ext_priorities(cmd_parms *cmd,
+                                              void *dirconf, const char *value)
+{
+    if (!strcasecmp(value, "On")) {
+        CONFIG_CMD_SET(cmd, dirconf, H2_CONF_EXT_PRIORITIES, 1);
+        return NULL;
+    }
+    else if (!strcasecmp(value, "Off")) {
+        CONFIG_CMD_SET(cmd, dirconf, H2_CONF_EXT_PRIORITIES, 0);
+        return NULL;
+    }
+    return "value must be On or Off";
+}
+
 static const char *h2_conf_set_stream_timeout(cmd_parms *cmd,
                                             void *dirconf, const char *value)
 {
@@ -963,6 +986,8 @@ const command_rec h2_cmds[] = {
                   RSRC_CONF, "set stream timeout"),
     AP_INIT_TAKE1("H2HeaderStrictness", h2_conf_set_header_strictness, NULL,
                   RSRC_CONF, "set strictness of header value checks"),
+    AP_INIT_TAKE1("H2ExtensiblePriorities", h2_conf_set_ext_priorities, NULL,
+                  RSRC_CONF, "on to use RFC 9218 stream priorities"),
     AP_END_CMD
 };
 
@@ -43,7 +43,8 @@ typedef enum {
     H2_CONF_PADDING_ALWAYS,
     H2_CONF_OUTPUT_BUFFER,
     H2_CONF_STREAM_TIMEOUT,
-    H2_CONF_HEADER_STRICTNESS
+    H2_CONF_HEADER_STRICTNESS,
+    H2_CONF_EXT_PRIORITIES
 } h2_config_var_t;
 
 struct apr_hash_t;
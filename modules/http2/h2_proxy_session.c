@@ -1508,6 +1508,21 @@ static int send_loop(h2_proxy_session *session)
     return 0;
 }
 
+static int block_expired(h2_proxy_session *session)
+{
+    apr_socket_t *socket = ap_get_conn_socket(session->c);
+    apr_interval_time_t timeout = 0;
+    apr_time_t now = apr_time_now();
+
+    if (!session->block_start) {
+        session->block_start = now - session->max_block;
+    }
+    if (socket) {
+        apr_socket_timeout_get(socket, &timeout);
+    }
+    return (timeout <= 0 || now - session->block_start >= timeout);
+}
+
 apr_status_t h2_proxy_session_process(h2_proxy_session *session)
 {
     apr_status_t status;
@@ -1554,12 +1569,21 @@ run_loop:
                  * configured via ProxyTimeout in our socket. There is
                  * nothing we want to send or check until we get more data
                  * from the backend. */
-                status = h2_proxy_session_read(session, 1, 0);
+                status = h2_proxy_session_read(session, 1, session->max_block);
                 if (status == APR_SUCCESS) {
+                    session->block_start = 0;
                     have_read = 1;
                     dispatch_event(session, H2_PROXYS_EV_DATA_READ, 0, NULL);
                 }
+                else if (session->max_block && APR_STATUS_IS_TIMEUP(status)
+                         && !block_expired(session)) {
+                    /* Return, so that others may use the session in
+                     * between. The socket timeout still applies to the
+                     * whole wait. */
+                    return APR_SUCCESS;
+                }
                 else {
+                    session->block_start = 0;
                     dispatch_event(session, H2_PROXYS_EV_CONN_ERROR, status, NULL);
                     return status;
                 }
@@ -1647,6 +1671,54 @@ void h2_proxy_session_cancel_all(h2_proxy_session *session)
     }
 }
 
+typedef struct {
+    request_rec *r;
+    h2_proxy_stream *stream;
+} find_iter_ctx;
+
+static int find_iter(void *udata, void *val)
+{
+    find_iter_ctx *ctx = udata;
+    h2_proxy_stream *stream = val;
+
+    if (stream->r == ctx->r) {
+        ctx->stream = stream;
+        return 0;
+    }
+    return 1;
+}
+
+void h2_proxy_session_cancel(h2_proxy_session *session, request_rec *r)
+{
+    find_iter_ctx ctx;
+
+    ctx.r = r;
+    ctx.stream = NULL;
+    h2_proxy_ihash_iter(session->streams, find_iter, &ctx);
+    if (ctx.stream) {
+        h2_proxy_stream *stream = ctx.stream;
+
+        ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, session->c, APLOGNO(10445)
+                      "h2_proxy_session(%s): cancel stream %d",
+                      session->id, stream->id);
+        if (session->ngh2) {
+            nghttp2_submit_rst_stream(session->ngh2, NGHTTP2_FLAG_NONE,
+                                      stream->id, NGHTTP2_CANCEL);
+            nghttp2_session_set_stream_user_data(session->ngh2, stream->id,
+                                                 NULL);
+        }
+        h2_proxy_ihash_remove(session->streams, stream->id);
+        h2_proxy_iq_remove(session->suspended, stream->id);
+    }
+}
+
+int h2_proxy_session_is_open(h2_proxy_session *session)
+{
+    return (!session->aborted && session->ngh2
+            && (session->state == H2_PROXYS_ST_INIT
+                || is_accepting_streams(session)));
+}
+
 static int done_iter(void *udata, void *val)
 {
     cleanup_iter_ctx *ctx = udata;
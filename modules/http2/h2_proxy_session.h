@@ -102,6 +102,9 @@ struct h2_proxy_session {
     h2_ping_state_t ping_state;
     apr_time_t ping_timeout;
     apr_time_t save_timeout;
+
+    apr_interval_time_t max_block; /* longest blocking read, 0 for no limit */
+    apr_time_t block_start;        /* start of the current wait for backend */
 };
 
 h2_proxy_session *h2_proxy_session_setup(const char *id, proxy_conn_rec *p_conn,
@@ -126,6 +129,21 @@ apr_status_t h2_proxy_session_process(h2_proxy_session *s);
 
 void h2_proxy_session_cancel_all(h2_proxy_session *s);
 
+/**
+ * Cancel the stream of a request, leaving the other streams of the session
+ * running. The request is not reported as done and the stream is forgotten,
+ * so the request may go away.
+ * @param s the session
+ * @param r the request to cancel
+ */
+void h2_proxy_session_cancel(h2_proxy_session *s, request_rec *r);
+
+/**
+ * @param s the session
+ * @return != 0 iff new streams may be submitted to the session
+ */
+int h2_proxy_session_is_open(h2_proxy_session *s);
+
 void h2_proxy_session_cleanup(h2_proxy_session *s, h2_proxy_request_done *done);
 
 #define H2_PROXY_REQ_URL_NOTE   "h2-proxy-req-url"
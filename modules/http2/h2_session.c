@@ -159,11 +159,37 @@ static int spri_cmp(int sid1, nghttp2_stream *s1,
     return spri_cmp(sid1, p1, sid2, p2, session);
 }
 
+#ifdef H2_NG2_EXTPRI
+/**
+ * Determine the RFC 9218 priority order of streams: lower urgency first,
+ * then in order of the stream identifiers, non-incremental responses being
+ * served one after the other.
+ */
+static int extpri_cmp(int sid1, int sid2, h2_session *session)
+{
+    nghttp2_extpri p1, p2;
+
+    p1.urgency = p2.urgency = NGHTTP2_EXTPRI_DEFAULT_URGENCY;
+    p1.inc = p2.inc = 0;
+    nghttp2_session_get_extpri_stream_priority(session->ngh2, &p1, sid1);
+    nghttp2_session_get_extpri_stream_priority(session->ngh2, &p2, sid2);
+    if (p1.urgency != p2.urgency) {
+        return (int)p1.urgency - (int)p2.urgency;
+    }
+    return sid1 - sid2;
+}
+#endif
+
 static int stream_pri_cmp(int sid1, int sid2, void *ctx)
 {
     h2_session *session = ctx;
     nghttp2_stream *s1, *s2;
     
+#ifdef H2_NG2_EXTPRI
+    if (session->ext_prio) {
+        return extpri_cmp(sid1, sid2, session);
+    }
+#endif
     s1 = nghttp2_session_find_stream(session->ngh2, sid1);
     s2 = nghttp2_session_find_stream(session->ngh2, sid2);
 
@@ -391,6 +417,18 @@ static int on_frame_recv_cb(nghttp2_session *ng2s,
                           frame->priority.pri_spec.stream_id,
                           frame->priority.pri_spec.exclusive);
             break;
+#ifdef H2_NG2_EXTPRI
+        case NGHTTP2_PRIORITY_UPDATE: {
+            nghttp2_ext_priority_update *pu = frame->ext.payload;
+            session->reprioritize = 1;
+            ap_log_cerror(APLOG_MARK, APLOG_TRACE2, 0, session->c1,
+                          H2_SSSN_STRM_MSG(session, pu->stream_id,
+                          "PRIORITY_UPDATE priority=%.*s"),
+                          (int)H2MIN(pu->field_valuelen, 80),
+                          (const char *)pu->field_value);
+            break;
+        }
+#endif
         case NGHTTP2_WINDOW_UPDATE:
             ap_log_cerror(APLOG_MARK, APLOG_TRACE2, 0, session->c1,
                           H2_SSSN_STRM_MSG(session, frame->hd.stream_id,
@@ -429,6 +467,15 @@ static int on_frame_recv_cb(nghttp2_session *ng2s,
         case NGHTTP2_SETTINGS:
             ap_log_cerror(APLOG_MARK, APLOG_TRACE2, 0, session->c1,
                           H2_SSSN_MSG(session, "SETTINGS, len=%ld"), (long)frame->hd.length);
+#ifdef H2_NG2_EXTPRI
+            if (!(frame->hd.flags & NGHTTP2_FLAG_ACK)
+                && h2_config_sgeti(session->s, H2_CONF_EXT_PRIORITIES)) {
+                /* we announced NO_RFC7540_PRIORITIES, nghttp2 falls back
+                 * to the RFC 7540 tree unless the client does the same */
+                session->ext_prio = (nghttp2_session_get_remote_settings(
+                    session->ngh2, NGHTTP2_SETTINGS_NO_RFC7540_PRIORITIES) == 1);
+            }
+#endif
             break;
         default:
             if (APLOGctrace2(session->c1)) {
@@ -963,6 +1010,15 @@ apr_status_t h2_session_create(h2_session **psession, conn_rec *c, request_rec *
                   h2_config_sgeti(s, H2_CONF_HEADER_STRICTNESS));
     nghttp2_option_set_no_rfc9113_leading_and_trailing_ws_validation(options,
         h2_config_sgeti(s, H2_CONF_HEADER_STRICTNESS) < 9113);
+#endif
+#ifdef H2_NG2_EXTPRI
+    if (h2_config_sgeti(s, H2_CONF_EXT_PRIORITIES)) {
+        /* RFC 9218 urgency/incremental from the "priority" request header
+         * and PRIORITY_UPDATE frames, for clients that announce it too. */
+        nghttp2_option_set_builtin_recv_extension_type(options,
+                                                       NGHTTP2_PRIORITY_UPDATE);
+        nghttp2_option_set_server_fallback_rfc7540_priorities(options, 1);
+    }
 #endif
     rv = nghttp2_session_server_new2(&session->ngh2, callbacks,
                                      session, options);
@@ -1069,6 +1125,13 @@ static apr_status_t h2_session_start(h2_session *session, int *rv)
         settings[slen].value = win_size;
         ++slen;
     }
+#ifdef H2_NG2_EXTPRI
+    if (h2_config_sgeti(session->s, H2_CONF_EXT_PRIORITIES)) {
+        settings[slen].settings_id = NGHTTP2_SETTINGS_NO_RFC7540_PRIORITIES;
+        settings[slen].value = 1;
+        ++slen;
+    }
+#endif
     
     ap_log_cerror(APLOG_MARK, APLOG_DEBUG, status, session->c1,
                   H2_SSSN_LOG(APLOGNO(03201), session, 
@@ -1137,6 +1137,25 @@ static apr_status_t buffer_output_process_headers(h2_stream *stream)
             stream->pref_priority = h2_stream_get_priority(stream, resp);
         }
         h2_session_set_prio(stream->session, stream, stream->pref_priority);
+#ifdef H2_NG2_EXTPRI
+        if (stream->session->ext_prio) {
+            /* RFC 9218, ch. 8: a "priority" response header from the server
+             * takes precedence over the client's signal for the stream */
+            const char *val = apr_table_get(resp->headers, "priority");
+            nghttp2_extpri extpri;
+
+            if (val && !nghttp2_session_get_extpri_stream_priority(
+                                stream->session->ngh2, &extpri, stream->id)
+                && !nghttp2_extpri_parse_priority(&extpri,
+                                (const uint8_t *)val, strlen(val))) {
+                ap_log_cerror(APLOG_MARK, APLOG_TRACE1, 0, c1,
+                              H2_STRM_MSG(stream, "response priority u=%d%s"),
+                              (int)extpri.urgency, extpri.inc? ", i" : "");
+                nghttp2_session_change_extpri_stream_priority(
+                    stream->session->ngh2, stream->id, &extpri, 1);
+            }
+        }
+#endif
 
         if (resp->status == 103
             && !h2_config_sgeti(stream->session->s, H2_CONF_EARLY_HINTS)) {
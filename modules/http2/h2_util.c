@@ -1467,6 +1467,24 @@ static int add_table_header(void *ctx, const char *key, const char *value)
     return 1;
 }
 
+static int check_table_header(void *ctx, const char *key, const char *value)
+{
+    if (!h2_util_ignore_header(key)
+        && (inv_field_name_chr(key) || inv_field_value_chr(value))) {
+        *(apr_status_t *)ctx = APR_EINVAL;
+        return 0;
+    }
+    return 1;
+}
+
+apr_status_t h2_res_check_headers(apr_table_t *headers)
+{
+    apr_status_t status = APR_SUCCESS;
+
+    apr_table_do(check_table_header, &status, headers, NULL);
+    return status;
+}
+
 static apr_status_t ngheader_create(h2_ngheader **ph, apr_pool_t *p,
                                     int unsafe, size_t key_count,
                                     const char *keys[], const char *values[],
@@ -1508,7 +1526,9 @@ static apr_status_t ngheader_create(h2_ngheader **ph, apr_pool_t *p,
 static int is_unsafe(ap_bucket_response *h)
 {
     const char *v = h->notes? apr_table_get(h->notes, H2_HDR_CONFORMANCE) : NULL;
-    return (v && !strcmp(v, H2_HDR_CONFORMANCE_UNSAFE));
+    /* unsafe by configuration, or already checked by the worker */
+    return (v && (!strcmp(v, H2_HDR_CONFORMANCE_UNSAFE)
+                  || !strcmp(v, H2_HDR_CONFORMANCE_CHECKED)));
 }
 
 apr_status_t h2_res_create_ngtrailer(h2_ngheader **ph, apr_pool_t *p,
@@ -1536,7 +1556,9 @@ apr_status_t h2_res_create_ngheader(h2_ngheader **ph, apr_pool_t *p,
 static int is_unsafe(h2_headers *h)
 {
     const char *v = h->notes? apr_table_get(h->notes, H2_HDR_CONFORMANCE) : NULL;
-    return (v && !strcmp(v, H2_HDR_CONFORMANCE_UNSAFE));
+    /* unsafe by configuration, or already checked by the worker */
+    return (v && (!strcmp(v, H2_HDR_CONFORMANCE_UNSAFE)
+                  || !strcmp(v, H2_HDR_CONFORMANCE_CHECKED)));
 }
 
 apr_status_t h2_res_create_ngtrailer(h2_ngheader **ph, apr_pool_t *p,
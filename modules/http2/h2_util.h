@@ -400,6 +400,15 @@ typedef struct h2_ngheader {
     apr_size_t nvlen;
 } h2_ngheader;
 
+/**
+ * Check that the names and values of the response header fields would
+ * be accepted by h2_res_create_ngheader(). Done on the worker, this spares
+ * the primary connection the check when it submits the response.
+ * @param headers the response header fields
+ * @return APR_SUCCESS when all are valid, APR_EINVAL otherwise
+ */
+apr_status_t h2_res_check_headers(apr_table_t *headers);
+
 #if AP_HAS_RESPONSE_BUCKETS
 apr_status_t h2_res_create_ngtrailer(h2_ngheader **ph, apr_pool_t *p,
                                      ap_bucket_headers *headers);
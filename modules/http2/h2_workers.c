@@ -36,6 +36,7 @@
 typedef enum {
     PROD_IDLE,
     PROD_ACTIVE,
+    PROD_POLLING,   /* a slot is asking for the next conn, off the rings */
     PROD_JOINED,
 } prod_state_t;
 
@@ -48,6 +49,7 @@ struct ap_conn_producer_t {
     ap_conn_producer_shutdown *fn_shutdown;
     volatile prod_state_t state;
     volatile int conns_active;
+    volatile int more_work;     /* activated while PROD_POLLING */
 };
 
 
@@ -195,31 +197,51 @@ static void wake_idle_worker(h2_workers *workers, ap_conn_producer_t *prod)
 
 /**
  * Get the next connection to work on.
+ * The producer is asked without holding the workers' lock (it has its own),
+ * so that other slots can meanwhile get connections from other producers.
+ * While being asked the producer is in no ring (PROD_POLLING) and counts
+ * one more active connection, which holds off h2_workers_join().
  */
 static conn_rec *get_next(h2_slot *slot)
 {
     h2_workers *workers = slot->workers;
     conn_rec *c = NULL;
     ap_conn_producer_t *prod;
-    int has_more;
+    int has_more = 0;
 
     slot->prod = NULL;
-    if (!APR_RING_EMPTY(&workers->prod_active, ap_conn_producer_t, link)) {
+    while (!c && !APR_RING_EMPTY(&workers->prod_active, ap_conn_producer_t, link)) {
         slot->prod = prod = APR_RING_FIRST(&workers->prod_active);
         APR_RING_REMOVE(prod, link);
+        APR_RING_ELEM_INIT(prod, link);
         AP_DEBUG_ASSERT(PROD_ACTIVE == prod->state);
+        prod->state = PROD_POLLING;
+        prod->more_work = 0;
+        ++prod->conns_active;
 
+        apr_thread_mutex_unlock(workers->lock);
         c = prod->fn_next(prod->baton, &has_more);
-        if (c && has_more) {
+        apr_thread_mutex_lock(workers->lock);
+
+        if (PROD_JOINED == prod->state) {
+            /* h2_workers_join() is waiting for us, a conn we got
+             * is still processed (and accounted for) though */
+        }
+        else if ((c && has_more) || prod->more_work) {
+            prod->state = PROD_ACTIVE;
             APR_RING_INSERT_TAIL(&workers->prod_active, prod, ap_conn_producer_t, link);
-            wake_idle_worker(workers, slot->prod);
+            wake_idle_worker(workers, prod);
         }
         else {
             prod->state = PROD_IDLE;
             APR_RING_INSERT_TAIL(&workers->prod_idle, prod, ap_conn_producer_t, link);
         }
-        if (c) {
-            ++prod->conns_active;
+        if (!c) {
+            /* nothing after all, try the next one */
+            if (--prod->conns_active <= 0) {
+                apr_thread_cond_broadcast(workers->prod_done);
+            }
+            slot->prod = NULL;
         }
     }
 
@@ -304,6 +326,9 @@ static void* APR_THREAD_FUNC slot_run(apr_thread_t *thread, void *wctx)
                     slot->prod->state = PROD_ACTIVE;
                     APR_RING_INSERT_TAIL(&workers->prod_active, slot->prod, ap_conn_producer_t, link);
                 }
+                else if (slot->prod->state == PROD_POLLING) {
+                    slot->prod->more_work = 1;
+                }
 
             } while (!workers->aborted && !slot->should_shutdown);
             APR_RING_REMOVE(slot, link); /* no longer busy */
@@ -595,8 +620,11 @@ apr_status_t h2_workers_join(h2_workers *workers, ap_conn_producer_t *prod)
         rv = APR_EINVAL;
     }
     else {
-        AP_DEBUG_ASSERT(PROD_ACTIVE == prod->state || PROD_IDLE == prod->state);
-        APR_RING_REMOVE(prod, link);
+        AP_DEBUG_ASSERT(PROD_ACTIVE == prod->state || PROD_IDLE == prod->state
+                        || PROD_POLLING == prod->state);
+        if (PROD_POLLING != prod->state) {
+            APR_RING_REMOVE(prod, link);
+        }
         prod->state = PROD_JOINED; /* prevent further activations */
         while (prod->conns_active > 0) {
             apr_thread_cond_wait(workers->prod_done, workers->lock);
@@ -617,6 +645,10 @@ apr_status_t h2_workers_activate(h2_workers *workers, ap_conn_producer_t *prod)
         APR_RING_INSERT_TAIL(&workers->prod_active, prod, ap_conn_producer_t, link);
         wake_idle_worker(workers, prod);
     }
+    else if (PROD_POLLING == prod->state) {
+        /* a slot is asking it right now, make it ask again */
+        prod->more_work = 1;
+    }
     else if (PROD_JOINED == prod->state) {
         rv = APR_EINVAL;
     }
@@ -66,6 +66,7 @@ typedef struct {
     unsigned int sha256 : 1;
     unsigned int inv_headers : 1;
     unsigned int dyn_windows : 1;
+    unsigned int ext_prio : 1;
 } features;
 
 static features myfeats;
@@ -105,6 +106,9 @@ static int h2_post_config(apr_pool_t *p, apr_pool_t *plog,
 #ifdef H2_NG2_LOCAL_WIN_SIZE
     myfeats.dyn_windows = 1;
 #endif
+#ifdef H2_NG2_EXTPRI
+    myfeats.ext_prio = 1;
+#endif
     
     apr_pool_userdata_get(&data, mod_h2_init_key, s->process->pool);
     if ( data == NULL ) {
@@ -117,12 +121,13 @@ static int h2_post_config(apr_pool_t *p, apr_pool_t *plog,
     
     ngh2 = nghttp2_version(0);
     ap_log_error( APLOG_MARK, APLOG_INFO, 0, s, APLOGNO(03090)
-                 "mod_http2 (v%s, feats=%s%s%s%s, nghttp2 %s), initializing...",
+                 "mod_http2 (v%s, feats=%s%s%s%s%s, nghttp2 %s), initializing...",
                  MOD_HTTP2_VERSION, 
                  myfeats.change_prio? "CHPRIO"  : "", 
                  myfeats.sha256?      "+SHA256" : "",
                  myfeats.inv_headers? "+INVHD"  : "",
                  myfeats.dyn_windows? "+DWINS"  : "",
+                 myfeats.ext_prio?    "+EXTPRI" : "",
                  ngh2?                ngh2->version_str : "unknown");
     
     if (!h2_mpm_supported() && !mpm_warned) {
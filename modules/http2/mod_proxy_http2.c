@@ -17,8 +17,11 @@
 #include <nghttp2/nghttp2.h>
 
 #include <ap_mmn.h>
+#include <ap_mpm.h>
 #include <httpd.h>
 #include <mod_proxy.h>
+#include <apr_thread_cond.h>
+#include <apr_thread_mutex.h>
 #include "mod_http2.h"
 
 
@@ -32,13 +35,40 @@
 
 static void register_hook(apr_pool_t *p);
 
+/* Number of requests of a child that may share a backend session */
+static int session_streams = 1;
+
+static const char *h2_proxy_set_session_streams(cmd_parms *cmd, void *dummy,
+                                                const char *arg)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+
+    if (err != NULL) {
+        return err;
+    }
+
+    session_streams = atoi(arg);
+    if (session_streams < 1) {
+        return "H2ProxySessionStreams must be a positive integer";
+    }
+    return NULL;
+}
+
+static const command_rec h2_proxy_cmds[] = {
+    AP_INIT_TAKE1("H2ProxySessionStreams", h2_proxy_set_session_streams,
+                  NULL, RSRC_CONF,
+                  "number of requests of a child process that may share "
+                  "one HTTP/2 connection to a backend (default: 1)"),
+    { NULL }
+};
+
 AP_DECLARE_MODULE(proxy_http2) = {
     STANDARD20_MODULE_STUFF,
     NULL,              /* create per-directory config structure */
     NULL,              /* merge per-directory config structures */
     NULL,              /* create per-server config structure */
     NULL,              /* merge per-server config structures */
-    NULL,              /* command apr_table_t */
+    h2_proxy_cmds,     /* command apr_table_t */
     register_hook,     /* register hooks */
 #if defined(AP_MODULE_FLAG_NONE)
     AP_MODULE_FLAG_ALWAYS_MERGE
@@ -72,6 +102,13 @@ typedef struct h2_proxy_ctx {
     h2_proxy_session *session; /* current http2 session against backend */
 } h2_proxy_ctx;
 
+static int h2_proxy_pre_config(apr_pool_t *pconf, apr_pool_t *plog,
+                               apr_pool_t *ptemp)
+{
+    session_streams = 1;
+    return OK;
+}
+
 static int h2_proxy_post_config(apr_pool_t *p, apr_pool_t *plog,
                                 apr_pool_t *ptemp, server_rec *s)
 {
@@ -186,19 +223,18 @@ static int proxy_http2_canon(request_rec *r, char *url)
 
 static apr_status_t add_request(h2_proxy_session *session, request_rec *r)
 {
-    h2_proxy_ctx *ctx = session->user_data;
     const char *url;
     apr_status_t status;
 
     url = apr_table_get(r->notes, H2_PROXY_REQ_URL_NOTE);
     apr_table_setn(r->notes, "proxy-source-port", apr_psprintf(r->pool, "%hu",
-                   ctx->p_conn->connection->local_addr->port));
+                   session->p_conn->connection->local_addr->port));
     status = h2_proxy_session_submit(session, url, r, 1);
     if (status != APR_SUCCESS) {
         ap_log_cerror(APLOG_MARK, APLOG_ERR, status, r->connection, APLOGNO(03351)
                       "pass request body failed to %pI (%s) from %s (%s)",
-                      ctx->p_conn->addr, ctx->p_conn->hostname ? 
-                      ctx->p_conn->hostname: "", session->c->client_ip, 
+                      session->p_conn->addr, session->p_conn->hostname ? 
+                      session->p_conn->hostname: "", session->c->client_ip, 
                       session->c->remote_host ? session->c->remote_host: "");
     }
     return status;
@@ -221,7 +257,13 @@ static void request_done(h2_proxy_ctx *ctx, request_rec *r,
 static void session_req_done(h2_proxy_session *session, request_rec *r,
                              apr_status_t status, int touched)
 {
-    request_done(session->user_data, r, status, touched);
+    /* The session may carry the requests of others, each has its ctx
+     * on its connection. */
+    h2_proxy_ctx *ctx = ap_get_module_config(r->connection->conn_config,
+                                             &proxy_http2_module);
+    if (ctx) {
+        request_done(ctx, r, status, touched);
+    }
 }
 
 static apr_status_t ctx_run(h2_proxy_ctx *ctx) {
@@ -284,6 +326,268 @@ out:
     return status;
 }
 
+#if APR_HAS_THREADS
+/*
+ * Sessions shared by the requests of a child (H2ProxySessionStreams).
+ *
+ * A request joins a session to the same worker with room for another
+ * stream, or brings its own connection into a new one. The thread of any
+ * request on the session may process it, one at a time: the others wait,
+ * and submit their streams in between processing steps. A processing
+ * step that waits on the backend is kept short (max_block), so that
+ * streams submitted meanwhile do not wait for the responses of others.
+ */
+typedef struct h2_proxy_shared h2_proxy_shared;
+struct h2_proxy_shared {
+    h2_proxy_shared *next;
+    apr_pool_t *pool;
+    proxy_worker *worker;
+    proxy_server_conf *conf;
+    int h2_front;
+    const char *proxy_func;
+    server_rec *server;
+    proxy_conn_rec *p_conn;
+    h2_proxy_session *session;
+    apr_thread_mutex_t *mutex;   /* for all of the session's use */
+    apr_thread_cond_t *cond;     /* signaled when the session is free */
+    int processing;              /* a request is processing the session */
+    int submitting;              /* requests waiting to submit a stream */
+    int streams;                 /* requests on the session, shared_mutex */
+    int closing;                 /* gone from the list, shared_mutex */
+};
+
+static h2_proxy_shared *shared_list;
+static apr_thread_mutex_t *shared_mutex;
+
+#define SHARED_MAX_BLOCK    apr_time_from_msec(100)
+
+static int shared_has_room(h2_proxy_shared *sh)
+{
+    return (sh->streams < session_streams
+            && (!sh->session->remote_max_concurrent
+                || sh->streams < (int)sh->session->remote_max_concurrent));
+}
+
+static h2_proxy_shared *shared_join(h2_proxy_ctx *ctx, int h2_front)
+{
+    h2_proxy_shared *sh;
+
+    apr_thread_mutex_lock(shared_mutex);
+    for (sh = shared_list; sh; sh = sh->next) {
+        if (sh->worker == ctx->worker && sh->conf == ctx->conf
+            && sh->h2_front == h2_front && shared_has_room(sh)) {
+            sh->streams++;
+            break;
+        }
+    }
+    apr_thread_mutex_unlock(shared_mutex);
+    return sh;
+}
+
+/* Take the connection of ctx into a new shared session */
+static h2_proxy_shared *shared_create(h2_proxy_ctx *ctx, int h2_front)
+{
+    h2_proxy_shared *sh;
+    apr_pool_t *pool;
+
+    if (apr_pool_create(&pool, NULL) != APR_SUCCESS) {
+        return NULL;
+    }
+    apr_pool_tag(pool, "h2_proxy_shared");
+    sh = apr_pcalloc(pool, sizeof(*sh));
+    sh->pool = pool;
+    if (apr_thread_mutex_create(&sh->mutex, APR_THREAD_MUTEX_DEFAULT,
+                                pool) != APR_SUCCESS
+        || apr_thread_cond_create(&sh->cond, pool) != APR_SUCCESS) {
+        apr_pool_destroy(pool);
+        return NULL;
+    }
+
+    sh->session = h2_proxy_session_setup(ctx->id, ctx->p_conn, ctx->conf,
+                                         h2_front, 30,
+                                         h2_proxy_log2((int)ctx->req_buffer_size),
+                                         session_req_done);
+    if (!sh->session) {
+        apr_pool_destroy(pool);
+        return NULL;
+    }
+    sh->session->max_block = SHARED_MAX_BLOCK;
+    sh->worker = ctx->worker;
+    sh->conf = ctx->conf;
+    sh->h2_front = h2_front;
+    sh->proxy_func = ctx->proxy_func;
+    sh->server = ctx->server;
+    sh->p_conn = ctx->p_conn;
+    sh->streams = 1;
+    ctx->p_conn = NULL;
+
+    apr_thread_mutex_lock(shared_mutex);
+    sh->next = shared_list;
+    shared_list = sh;
+    apr_thread_mutex_unlock(shared_mutex);
+    return sh;
+}
+
+/* Take sh out of the list, called with sh->mutex and shared_mutex held */
+static void shared_unlink(h2_proxy_shared *sh)
+{
+    h2_proxy_shared **psh;
+
+    for (psh = &shared_list; *psh; psh = &(*psh)->next) {
+        if (*psh == sh) {
+            *psh = sh->next;
+            break;
+        }
+    }
+    sh->closing = 1;
+}
+
+static void shared_close(h2_proxy_shared *sh)
+{
+    apr_thread_mutex_lock(shared_mutex);
+    shared_unlink(sh);
+    apr_thread_mutex_unlock(shared_mutex);
+}
+
+/* Leave sh, called with sh->mutex held which is released */
+static void shared_leave(h2_proxy_ctx *ctx, h2_proxy_shared *sh)
+{
+    h2_proxy_shared *other;
+    int last;
+
+#if AP_MODULE_MAGIC_AT_LEAST(20140207, 2)
+    proxy_run_detach_backend(ctx->r, sh->p_conn);
+#endif
+    apr_thread_mutex_lock(shared_mutex);
+    last = (--sh->streams == 0);
+    if (last && !sh->closing) {
+        /* Keep an idle session only if no other one has room */
+        for (other = shared_list; other; other = other->next) {
+            if (other != sh && other->worker == sh->worker
+                && shared_has_room(other)) {
+                shared_unlink(sh);
+                break;
+            }
+        }
+    }
+    last = last && sh->closing;
+    apr_thread_mutex_unlock(shared_mutex);
+    apr_thread_mutex_unlock(sh->mutex);
+
+    if (last) {
+        sh->p_conn->close = 1;
+        ap_proxy_release_connection(sh->proxy_func, sh->p_conn, sh->server);
+        apr_pool_destroy(sh->pool);
+    }
+}
+
+/* Run the request of ctx on sh, APR_EAGAIN if sh is not usable */
+static apr_status_t shared_run(h2_proxy_ctx *ctx, h2_proxy_shared *sh,
+                               int joined)
+{
+    apr_status_t status = APR_SUCCESS;
+
+    apr_thread_mutex_lock(sh->mutex);
+    sh->submitting++;
+    while (sh->processing) {
+        apr_thread_cond_wait(sh->cond, sh->mutex);
+    }
+    sh->submitting--;
+    apr_thread_cond_broadcast(sh->cond);
+
+    if (sh->closing || !h2_proxy_session_is_open(sh->session)) {
+        if (!sh->closing) {
+            shared_close(sh);
+        }
+        shared_leave(ctx, sh);
+        return APR_EAGAIN;
+    }
+    if (joined) {
+        /* checks the backend's liveness, if the session was idle */
+        h2_proxy_session_setup(ctx->id, sh->p_conn, ctx->conf, sh->h2_front,
+                               30, h2_proxy_log2((int)ctx->req_buffer_size),
+                               session_req_done);
+    }
+
+    ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, ctx->owner, APLOGNO(10447)
+                  "eng(%s): run on shared session %s (%d requests)",
+                  ctx->id, sh->session->id, sh->streams);
+    ctx->session = sh->session;
+    ctx->r_done = 0;
+    if (add_request(sh->session, ctx->r) != APR_SUCCESS) {
+        goto leave;
+    }
+
+    for (;;) {
+        if (sh->processing || sh->submitting) {
+            apr_thread_cond_timedwait(sh->cond, sh->mutex, SHARED_MAX_BLOCK);
+            continue;
+        }
+        if (ctx->r_done) {
+            break;
+        }
+        if (ctx->master->aborted) {
+            /* master connection gone, leave the other streams running */
+            h2_proxy_session_cancel(sh->session, ctx->r);
+            break;
+        }
+
+        sh->processing = 1;
+        apr_thread_mutex_unlock(sh->mutex);
+        status = h2_proxy_session_process(sh->session);
+        apr_thread_mutex_lock(sh->mutex);
+        sh->processing = 0;
+        apr_thread_cond_broadcast(sh->cond);
+
+        if (status != APR_SUCCESS) {
+            ap_log_cerror(APLOG_MARK, APLOG_DEBUG, status, ctx->owner,
+                          APLOGNO(10448) "eng(%s): end of shared session %s",
+                          ctx->id, sh->session->id);
+            /* Report all of the session's open streams as failed */
+            h2_proxy_session_cleanup(sh->session, session_req_done);
+            shared_close(sh);
+            break;
+        }
+    }
+
+leave:
+    ctx->session = NULL;
+    shared_leave(ctx, sh);
+    return status;
+}
+
+static apr_status_t shared_cleanup(void *dummy)
+{
+    shared_list = NULL;
+    shared_mutex = NULL;
+    return APR_SUCCESS;
+}
+
+static void h2_proxy_child_init(apr_pool_t *pchild, server_rec *s)
+{
+    int threaded = 0;
+    apr_status_t rv;
+
+    if (session_streams <= 1) {
+        return;
+    }
+    ap_mpm_query(AP_MPMQ_IS_THREADED, &threaded);
+    if (!threaded) {
+        return;
+    }
+    rv = apr_thread_mutex_create(&shared_mutex, APR_THREAD_MUTEX_DEFAULT,
+                                 pchild);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10446)
+                     "could not create the H2ProxySessionStreams mutex, "
+                     "backend sessions will not be shared");
+        return;
+    }
+    apr_pool_cleanup_register(pchild, NULL, shared_cleanup,
+                              apr_pool_cleanup_null);
+}
+#endif
+
 static int proxy_http2_handler(request_rec *r, 
                                proxy_worker *worker,
                                proxy_server_conf *conf,
@@ -350,6 +654,22 @@ static int proxy_http2_handler(request_rec *r,
 run_connect:    
     if (ctx->master->aborted) goto cleanup;
 
+#if APR_HAS_THREADS
+    if (shared_mutex) {
+        /* Step Zero: Multiplex the request onto an HTTP/2 session to the
+         * worker's backend that other requests of this child are using. */
+        h2_proxy_shared *sh;
+        int h2_front = is_h2? is_h2(ctx->owner) : 0;
+
+        while ((sh = shared_join(ctx, h2_front)) != NULL) {
+            status = shared_run(ctx, sh, 1);
+            if (status != APR_EAGAIN) {
+                goto run_done;
+            }
+        }
+    }
+#endif
+
     /* Get a proxy_conn_rec from the worker, might be a new one, might
      * be one still open from another request, or it might fail if the
      * worker is stopped or in error. */
@@ -401,8 +721,22 @@ run_connect:
     }
 
     if (ctx->master->aborted) goto cleanup;
+#if APR_HAS_THREADS
+    if (shared_mutex) {
+        h2_proxy_shared *sh;
+        int h2_front = is_h2? is_h2(ctx->owner) : 0;
+
+        if ((sh = shared_create(ctx, h2_front)) != NULL) {
+            status = shared_run(ctx, sh, 0);
+            goto run_done;
+        }
+    }
+#endif
     status = ctx_run(ctx);
 
+#if APR_HAS_THREADS
+run_done:
+#endif
     if (ctx->r_status != APR_SUCCESS && ctx->r_may_retry && !ctx->master->aborted) {
         /* Not successfully processed, but may retry, tear down old conn and start over */
         if (ctx->p_conn) {
@@ -443,7 +777,11 @@ cleanup:
 
 static void register_hook(apr_pool_t *p)
 {
+    ap_hook_pre_config(h2_proxy_pre_config, NULL, NULL, APR_HOOK_MIDDLE);
     ap_hook_post_config(h2_proxy_post_config, NULL, NULL, APR_HOOK_MIDDLE);
+#if APR_HAS_THREADS
+    ap_hook_child_init(h2_proxy_child_init, NULL, NULL, APR_HOOK_MIDDLE);
+#endif
 
     proxy_hook_scheme_handler(proxy_http2_handler, NULL, NULL, APR_HOOK_FIRST);
     proxy_hook_canon_handler(proxy_http2_canon, NULL, NULL, APR_HOOK_FIRST);
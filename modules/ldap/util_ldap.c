@@ -823,6 +823,18 @@ static util_ldap_connection_t *
             }
             break;
         }
+
+        /* While at it, close the idle connections which would be unbound
+         * anyway when reused, so that they don't hold connections to the
+         * LDAP server meanwhile.
+         */
+        if (st->connection_pool_ttl > 0 && l->bound
+            && (now - l->last_backend_conn) > st->connection_pool_ttl) {
+            ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r,
+                          "Closing idle LDAP connection last used %" APR_TIME_T_FMT " seconds ago",
+                          (now - l->last_backend_conn) / APR_USEC_PER_SEC);
+            uldap_connection_unbind(l);
+        }
 #if APR_HAS_THREADS
             /* If this connection didn't match the criteria, then we
              * need to unlock the mutex so it is available to be reused.
@@ -1724,6 +1736,24 @@ static int uldap_cache_check_subgroups(request_rec *r,
 }
 
 
+/*
+ * Remove an expired entry of the search cache kept for LDAPCacheStaleTTL,
+ * once the server answered that it is not valid anymore.
+ */
+static void remove_stale_search(util_ldap_state_t *st, request_rec *r,
+                                util_url_node_t *curl, const char *filter)
+{
+    util_search_node_t the_search_node, *search_nodep;
+
+    ldap_cache_lock(st, r);
+    the_search_node.username = filter;
+    search_nodep = util_ald_cache_fetch(curl->search_cache, &the_search_node);
+    if (search_nodep != NULL) {
+        util_ald_cache_remove(curl->search_cache, search_nodep);
+    }
+    ldap_cache_unlock(st, r);
+}
+
 static int uldap_cache_checkuserid(request_rec *r, util_ldap_connection_t *ldc,
                                    const char *url, const char *basedn,
                                    int scope, char **attrs, const char *filter,
@@ -1742,6 +1772,8 @@ static int uldap_cache_checkuserid(request_rec *r, util_ldap_connection_t *ldc,
     util_search_node_t *search_nodep;   /* Cached search node */
     util_search_node_t the_search_node;
     apr_time_t curtime;
+    const char *stale_dn = NULL;        /* expired but usable (LDAPCacheStaleTTL) */
+    const char **stale_vals = NULL;
 
     util_ldap_state_t *st =
         (util_ldap_state_t *)ap_get_module_config(r->server->module_config,
@@ -1774,8 +1806,29 @@ static int uldap_cache_checkuserid(request_rec *r, util_ldap_connection_t *ldc,
              * authentication.
              */
             if ((curtime - search_nodep->lastbind) > st->search_cache_ttl) {
-                /* ...but entry is too old */
-                util_ald_cache_remove(curl->search_cache, search_nodep);
+                /* ...but entry is too old, it can still be used if the
+                 * server is down for a while though.
+                 */
+                if (st->search_cache_stale > 0 && st->search_cache_ttl > 0
+                    && (curtime - search_nodep->lastbind)
+                       <= st->search_cache_ttl + st->search_cache_stale
+                    && search_nodep->bindpw
+                    && search_nodep->bindpw[0] != '\0'
+                    && strcmp(search_nodep->bindpw, bindpw) == 0) {
+                    stale_dn = apr_pstrdup(r->pool, search_nodep->dn);
+                    if (attrs) {
+                        int i;
+                        stale_vals = apr_palloc(r->pool, sizeof(char *)
+                                                * search_nodep->numvals);
+                        for (i = 0; i < search_nodep->numvals; i++) {
+                            stale_vals[i] = apr_pstrdup(r->pool,
+                                                        search_nodep->vals[i]);
+                        }
+                    }
+                }
+                else {
+                    util_ald_cache_remove(curl->search_cache, search_nodep);
+                }
             }
             else if (   (search_nodep->bindpw)
                      && (search_nodep->bindpw[0] != '\0')
@@ -1808,6 +1861,9 @@ static int uldap_cache_checkuserid(request_rec *r, util_ldap_connection_t *ldc,
      */
 start_over:
     if (failures > st->retries) {
+        if (stale_dn) {
+            goto use_stale;
+        }
         return result;
     }
 
@@ -1816,6 +1872,10 @@ start_over:
     }
 
     if (LDAP_SUCCESS != (result = uldap_connection_open(r, ldc))) {
+        if (stale_dn && (AP_LDAP_IS_SERVER_DOWN(result)
+                         || result == LDAP_TIMEOUT)) {
+            goto use_stale;
+        }
         return result;
     }
 
@@ -1845,6 +1905,9 @@ start_over:
     /* if there is an error (including LDAP_NO_SUCH_OBJECT) return now */
     if (result != LDAP_SUCCESS) {
         ldc->reason = "ldap_search_ext_s() for user failed";
+        if (stale_dn) {
+            remove_stale_search(st, r, curl, filter);
+        }
         return result;
     }
 
@@ -1862,6 +1925,9 @@ start_over:
             ldc->reason = "User is not unique (search found two "
                           "or more matches)";
         ldap_msgfree(res);
+        if (stale_dn) {
+            remove_stale_search(st, r, curl, filter);
+        }
         return LDAP_NO_SUCH_OBJECT;
     }
 
@@ -1912,6 +1978,9 @@ start_over:
         ldc->reason = "ldap_simple_bind() to check user credentials failed";
         ldap_msgfree(res);
         uldap_connection_unbind(ldc);
+        if (stale_dn) {
+            remove_stale_search(st, r, curl, filter);
+        }
         return result;
     }
     else {
@@ -1992,6 +2061,17 @@ start_over:
 
     ldc->reason = "Authentication successful";
     return LDAP_SUCCESS;
+
+use_stale:
+    ap_log_rerror(APLOG_MARK, APLOG_WARNING, 0, r, APLOGNO(10500)
+                  "LDAP server unavailable (%s), using the expired cached "
+                  "credentials of %s", ldap_err2string(result), stale_dn);
+    *binddn = stale_dn;
+    if (attrs) {
+        *retvals = stale_vals;
+    }
+    ldc->reason = "Authentication successful (stale cache)";
+    return LDAP_SUCCESS;
 }
 
 /*
@@ -2289,6 +2369,27 @@ static const char *util_ldap_set_cache_ttl(cmd_parms *cmd, void *dummy,
     return NULL;
 }
 
+static const char *util_ldap_set_cache_stale_ttl(cmd_parms *cmd, void *dummy,
+                                                 const char *ttl)
+{
+    util_ldap_state_t *st =
+        (util_ldap_state_t *)ap_get_module_config(cmd->server->module_config,
+                                                  &ldap_module);
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+
+    if (err != NULL) {
+        return err;
+    }
+
+    st->search_cache_stale = atol(ttl) * 1000000;
+
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, cmd->server, APLOGNO(10501)
+                 "ldap cache: Setting cache stale TTL to %ld microseconds.",
+                 st->search_cache_stale);
+
+    return NULL;
+}
+
 static const char *util_ldap_set_cache_entries(cmd_parms *cmd, void *dummy,
                                                const char *size)
 {
@@ -2937,6 +3038,7 @@ static void *util_ldap_merge_config(apr_pool_t *p, void *basev,
         shared memory cache. */
     st->cache_bytes = base->cache_bytes;
     st->search_cache_ttl = base->search_cache_ttl;
+    st->search_cache_stale = base->search_cache_stale;
     st->search_cache_size = base->search_cache_size;
     st->compare_cache_ttl = base->compare_cache_ttl;
     st->compare_cache_size = base->compare_cache_size;
@@ -3206,6 +3308,12 @@ static const command_rec util_ldap_cmds[] = {
                   "cached in the LDAP search cache. Use 0 for no limit. "
                   "(default 600)"),
 
+    AP_INIT_TAKE1("LDAPCacheStaleTTL", util_ldap_set_cache_stale_ttl,
+                  NULL, RSRC_CONF,
+                  "Set the time (in seconds) after LDAPCacheTTL during which "
+                  "an item of the LDAP search cache can still be used if the "
+                  "LDAP server is unavailable. (default 0)"),
+
     AP_INIT_TAKE1("LDAPOpCacheEntries", util_ldap_set_opcache_entries,
                   NULL, RSRC_CONF,
                   "Set the maximum number of entries that are possible "
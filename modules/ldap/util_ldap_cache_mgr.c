@@ -288,7 +288,9 @@ util_url_node_t *util_ald_create_caches(util_ldap_state_t *st, const char *url)
     /* create the three caches */
     search_cache = util_ald_create_cache(st,
                       st->search_cache_size,
-                      st->search_cache_ttl,
+                      /* keep the entries which may be used stale */
+                      st->search_cache_ttl ? st->search_cache_ttl
+                                             + st->search_cache_stale : 0,
                       util_ldap_search_node_hash,
                       util_ldap_search_node_compare,
                       util_ldap_search_node_copy,
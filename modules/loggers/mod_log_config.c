@@ -151,6 +151,10 @@
 #include "apr_hash.h"
 #include "apr_optional.h"
 #include "apr_anylock.h"
+#if APR_HAS_THREADS
+#include "apr_thread_proc.h"
+#include "apr_thread_cond.h"
+#endif
 
 #define APR_WANT_STRFUNC
 #include "apr_want.h"
@@ -162,6 +166,7 @@
 #include "http_core.h"          /* For REMOTE_NAME */
 #include "http_log.h"
 #include "http_protocol.h"
+#include "http_request.h"
 #include "http_ssl.h"
 #include "util_time.h"
 #include "ap_mpm.h"
@@ -173,6 +178,9 @@
 #ifdef HAVE_LIMITS_H
 #include <limits.h>
 #endif
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 
 #define DEFAULT_LOG_FORMAT "%h %l %u %t \"%r\" %>s %b"
 
@@ -204,6 +212,10 @@ static ap_log_writer *ap_log_set_writer(ap_log_writer *handle);
 static ap_log_writer *log_writer = ap_default_log_writer;
 static ap_log_writer_init *log_writer_init = ap_default_log_writer_init;
 static int buffered_logs = 0; /* default unbuffered */
+static int async_logs = 0;    /* BufferedLogs Async */
+#ifdef HAVE_ZLIB
+static apr_size_t compress_frame = 0; /* BufferedLogsCompress */
+#endif
 static apr_array_header_t *all_buffered_logs = NULL;
 
 /* POSIX.1 defines PIPE_BUF as the maximum number of bytes that is
@@ -254,11 +266,70 @@ typedef struct {
  * set to a opaque structure (usually a fd) after it is opened.
 
  */
+#if APR_HAS_THREADS
+/*
+ * With BufferedLogs Async, the full buffers are copied to chunks queued
+ * for a writer thread of the log, which writes them (batched with writev()
+ * for files) while the request threads keep on filling the buffer.
+ */
+typedef struct log_chunk log_chunk;
+struct log_chunk {
+    log_chunk *next;
+    apr_size_t len;
+    char data[LOG_BUFSIZE];
+};
+
+/* Chunks waiting for the writer thread before the request threads wait */
+#ifndef LOG_ASYNC_MAX_QUEUED
+#define LOG_ASYNC_MAX_QUEUED 64
+#endif
+
+/* Chunks per writev() */
+#ifndef LOG_ASYNC_IOVECS
+#define LOG_ASYNC_IOVECS 16
+#endif
+
 typedef struct {
-    apr_file_t *handle;
+    apr_thread_t *thread;
+    apr_thread_mutex_t *mutex; /* protects all the fields below */
+    apr_thread_cond_t *cond;   /* chunks queued, room in the queue, exit */
+    log_chunk *queue;
+    log_chunk **tail;
+    log_chunk *spare;
+    int queued;
+    int exiting;
+} log_async;
+#endif
+
+typedef struct default_log_writer default_log_writer;
+
+#ifdef HAVE_ZLIB
+/*
+ * With BufferedLogsCompress, the lines of the file logs are gathered in
+ * frames which are written as whole gzip members, each with a single
+ * write() in append mode so that the children don't mix them up.
+ */
+typedef struct {
+    z_stream zs;
+    char *in;                  /* the lines of the current frame */
+    apr_size_t inlen;
+    char *out;                 /* a gzip member of a whole frame */
+    apr_size_t outsize;
+} log_gzip;
+#endif
+
+typedef struct {
+    default_log_writer *writer;
+    int is_pipe;
     apr_size_t outcnt;
     char outbuf[LOG_BUFSIZE];
     apr_anylock_t mutex;
+#if APR_HAS_THREADS
+    log_async *async;          /* NULL unless BufferedLogs Async */
+#endif
+#ifdef HAVE_ZLIB
+    log_gzip *gz;              /* NULL unless BufferedLogsCompress */
+#endif
 } buffered_log;
 
 typedef struct {
@@ -286,12 +357,29 @@ typedef struct {
  * Note that many of these could have ap_sprintfs replaced with static buffers.
  */
 
+/*
+ * The most common items are formatted directly into a scratch buffer on
+ * the stack of config_log_transaction(), rather than through their handler
+ * and the request pool.
+ */
+#define LOG_FAST_NONE           0
+#define LOG_FAST_STATUS         1   /* %s, %>s */
+#define LOG_FAST_BYTES          2   /* %B */
+#define LOG_FAST_BYTES_CLF      3   /* %b */
+#define LOG_FAST_DURATION       4   /* %D */
+#define LOG_FAST_TIME_CLF       5   /* %t */
+
+/* Scratch space of the fast items, and the fragments kept on the stack */
+#define LOG_FAST_SCRATCH_SIZE   1024
+#define LOG_FAST_ITEMS          64
+
 typedef struct {
     ap_log_handler_fn_t *func;
     char *arg;
     int condition_sense;
     int want_orig;
     apr_array_header_t *conditions;
+    int fast;                   /* LOG_FAST_* */
 } log_format_item;
 
 /*
@@ -318,10 +406,20 @@ enum default_log_writer_type {
  * Abstract struct to allow multiple types of log writers to be created
  * by ap_default_log_writer_init function.
  */
-typedef struct {
+struct default_log_writer {
     enum default_log_writer_type type;
     void *log_writer;
-} default_log_writer;
+    piped_log *piped;          /* the piped log of a LOG_WRITER_FD, if any */
+};
+
+static apr_status_t log_write_fd(default_log_writer *writer,
+                                 const char *str, apr_size_t len)
+{
+    if (writer->piped) {
+        return ap_piped_log_write(writer->piped, str, len);
+    }
+    return apr_file_write_full(writer->log_writer, str, len, NULL);
+}
 
 static char *pfmt(apr_pool_t *p, int i)
 {
@@ -675,6 +773,48 @@ static apr_time_t get_request_end_time(request_rec *r)
 }
 
 
+/* Fills in *cached_time with the CLF string of request_time */
+static const char *clf_request_time(apr_time_t request_time,
+                                    cached_request_time *cached_time)
+{
+    /* This code uses the same technique as ap_explode_recent_localtime():
+     * optimistic caching with logic to detect and correct race conditions.
+     * See the comments in server/util_time.c for more information.
+     */
+    unsigned t_seconds = (unsigned)apr_time_sec(request_time);
+    unsigned i = t_seconds & TIME_CACHE_MASK;
+    *cached_time = request_time_cache[i];
+    if ((t_seconds != cached_time->t) ||
+        (t_seconds != cached_time->t_validate)) {
+
+        /* Invalid or old snapshot, so compute the proper time string
+         * and store it in the cache
+         */
+        apr_time_exp_t xt;
+        char sign;
+        int timz;
+
+        ap_explode_recent_localtime(&xt, request_time);
+        timz = xt.tm_gmtoff;
+        if (timz < 0) {
+            timz = -timz;
+            sign = '-';
+        }
+        else {
+            sign = '+';
+        }
+        cached_time->t = t_seconds;
+        apr_snprintf(cached_time->timestr, DEFAULT_REQUEST_TIME_SIZE,
+                     "[%02d/%s/%d:%02d:%02d:%02d %c%.2d%.2d]",
+                     xt.tm_mday, apr_month_snames[xt.tm_mon],
+                     xt.tm_year+1900, xt.tm_hour, xt.tm_min, xt.tm_sec,
+                     sign, timz / (60*60), (timz % (60*60)) / 60);
+        cached_time->t_validate = t_seconds;
+        request_time_cache[i] = *cached_time;
+    }
+    return cached_time->timestr;
+}
+
 static const char *log_request_time(request_rec *r, char *a)
 {
     apr_time_exp_t xt;
@@ -770,43 +910,9 @@ static const char *log_request_time(request_rec *r, char *a)
         return log_request_time_custom(r, a, &xt);
     }
     else {                                   /* CLF format */
-        /* This code uses the same technique as ap_explode_recent_localtime():
-         * optimistic caching with logic to detect and correct race conditions.
-         * See the comments in server/util_time.c for more information.
-         */
         cached_request_time* cached_time = apr_palloc(r->pool,
                                                       sizeof(*cached_time));
-        unsigned t_seconds = (unsigned)apr_time_sec(request_time);
-        unsigned i = t_seconds & TIME_CACHE_MASK;
-        *cached_time = request_time_cache[i];
-        if ((t_seconds != cached_time->t) ||
-            (t_seconds != cached_time->t_validate)) {
-
-            /* Invalid or old snapshot, so compute the proper time string
-             * and store it in the cache
-             */
-            char sign;
-            int timz;
-
-            ap_explode_recent_localtime(&xt, request_time);
-            timz = xt.tm_gmtoff;
-            if (timz < 0) {
-                timz = -timz;
-                sign = '-';
-            }
-            else {
-                sign = '+';
-            }
-            cached_time->t = t_seconds;
-            apr_snprintf(cached_time->timestr, DEFAULT_REQUEST_TIME_SIZE,
-                         "[%02d/%s/%d:%02d:%02d:%02d %c%.2d%.2d]",
-                         xt.tm_mday, apr_month_snames[xt.tm_mon],
-                         xt.tm_year+1900, xt.tm_hour, xt.tm_min, xt.tm_sec,
-                         sign, timz / (60*60), (timz % (60*60)) / 60);
-            cached_time->t_validate = t_seconds;
-            request_time_cache[i] = *cached_time;
-        }
-        return cached_time->timestr;
+        return clf_request_time(request_time, cached_time);
     }
 }
 
@@ -834,6 +940,39 @@ static const char *log_request_duration_scaled(request_rec *r, char *a)
     return apr_psprintf(r->pool, "%" APR_TIME_T_FMT, duration);
 }
 
+static const char *log_request_phase_time(request_rec *r, char *a)
+{
+    apr_interval_time_t t;
+    int phase;
+
+    if (!*a) {
+        /* all the phases which ran, as "name=usec,..." */
+        char *res = NULL;
+
+        for (phase = 0; phase < AP_REQUEST_PHASE_COUNT; ++phase) {
+            if ((t = ap_request_phase_time(r, phase)) >= 0) {
+                const char *item = apr_psprintf(r->pool,
+                                                "%s=%" APR_TIME_T_FMT,
+                                                ap_request_phase_name(phase),
+                                                t);
+                res = res ? apr_pstrcat(r->pool, res, ",", item, NULL)
+                          : (char *)item;
+            }
+        }
+        return res;
+    }
+
+    phase = ap_request_phase_lookup(a);
+    if (phase < 0) {
+        /* bogus format */
+        return a;
+    }
+    if ((t = ap_request_phase_time(r, phase)) < 0) {
+        return NULL;
+    }
+    return apr_psprintf(r->pool, "%" APR_TIME_T_FMT, t);
+}
+
 /* These next two routines use the canonical name:port so that log
  * parsers don't need to duplicate all the vhost parsing crud.
  */
@@ -1107,16 +1246,39 @@ static char *parse_log_item(apr_pool_t *p, log_format_item *it, const char **sa)
     return "Ran off end of LogFormat parsing args to some directive";
 }
 
+static int fast_item_type(const log_format_item *it)
+{
+    if (it->func == log_status) {
+        return LOG_FAST_STATUS;
+    }
+    if (it->func == log_bytes_sent) {
+        return LOG_FAST_BYTES;
+    }
+    if (it->func == clf_log_bytes_sent) {
+        return LOG_FAST_BYTES_CLF;
+    }
+    if (it->func == log_request_duration_microseconds) {
+        return LOG_FAST_DURATION;
+    }
+    if (it->func == log_request_time && !*it->arg) {
+        return LOG_FAST_TIME_CLF;
+    }
+    return LOG_FAST_NONE;
+}
+
 static apr_array_header_t *parse_log_string(apr_pool_t *p, const char *s, const char **err)
 {
     apr_array_header_t *a = apr_array_make(p, 30, sizeof(log_format_item));
+    log_format_item *it;
     char *res;
 
     while (*s) {
-        if ((res = parse_log_item(p, (log_format_item *) apr_array_push(a), &s))) {
+        it = (log_format_item *) apr_array_push(a);
+        if ((res = parse_log_item(p, it, &s))) {
             *err = res;
             return NULL;
         }
+        it->fast = fast_item_type(it);
     }
 
     s = APR_EOL_STR;
@@ -1129,13 +1291,9 @@ static apr_array_header_t *parse_log_string(apr_pool_t *p, const char *s, const
  * Actually logging.
  */
 
-static const char *process_item(request_rec *r, request_rec *orig,
-                          log_format_item *item)
+/* Whether the status conditions of the item let it be logged */
+static int item_applies(request_rec *r, log_format_item *item)
 {
-    const char *cp;
-
-    /* First, see if we need to process this thing at all... */
-
     if (item->conditions && item->conditions->nelts != 0) {
         int i;
         int *conds = (int *) item->conditions->elts;
@@ -1150,8 +1308,95 @@ static const char *process_item(request_rec *r, request_rec *orig,
 
         if ((item->condition_sense && in_list)
             || (!item->condition_sense && !in_list)) {
-            return "-";
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Formats the decimal n to the left of end, returns the first digit */
+static char *fast_ntoa(char *end, apr_uint64_t n)
+{
+    do {
+        *--end = '0' + (char)(n % 10);
+        n /= 10;
+    } while (n);
+    return end;
+}
+
+/*
+ * Formats a fast item in the scratch space at *scratch, which it advances,
+ * returns the length or -1 if there was no room left (the caller falls
+ * back to the handler).
+ */
+static int process_fast_item(request_rec *r, log_format_item *item,
+                             const char **str, char **scratch, char *end)
+{
+    char *s = *scratch;
+    char *d;
+
+    if (end - s < DEFAULT_REQUEST_TIME_SIZE) {
+        return -1;
+    }
+
+    switch (item->fast) {
+    case LOG_FAST_STATUS:
+        if (r->status <= 0) {
+            *str = "-";
+            return 1;
+        }
+        d = fast_ntoa(s + 20, (apr_uint64_t)r->status);
+        break;
+    case LOG_FAST_BYTES:
+    case LOG_FAST_BYTES_CLF:
+        if (!r->sent_bodyct || !r->bytes_sent) {
+            *str = (item->fast == LOG_FAST_BYTES) ? "0" : "-";
+            return 1;
         }
+        if (r->bytes_sent < 0) {
+            return -1;
+        }
+        d = fast_ntoa(s + 20, (apr_uint64_t)r->bytes_sent);
+        break;
+    case LOG_FAST_DURATION: {
+        apr_time_t duration = get_request_end_time(r) - r->request_time;
+        if (duration < 0) {
+            return -1;
+        }
+        d = fast_ntoa(s + 20, (apr_uint64_t)duration);
+        break;
+    }
+    case LOG_FAST_TIME_CLF: {
+        cached_request_time cached_time;
+        apr_size_t len;
+
+        clf_request_time(r->request_time, &cached_time);
+        len = strlen(cached_time.timestr);
+        memcpy(s, cached_time.timestr, len);
+        *str = s;
+        *scratch = s + len;
+        return (int)len;
+    }
+    default:
+        return -1;
+    }
+
+    /* the digits end at s + 20, move them to the start */
+    memmove(s, d, s + 20 - d);
+    *str = s;
+    *scratch = s + (s + 20 - d);
+    return (int)(s + 20 - d);
+}
+
+static const char *process_item(request_rec *r, request_rec *orig,
+                          log_format_item *item)
+{
+    const char *cp;
+
+    /* First, see if we need to process this thing at all... */
+
+    if (!item_applies(r, item)) {
+        return "-";
     }
 
     /* We do.  Do it... */
@@ -1160,11 +1405,219 @@ static const char *process_item(request_rec *r, request_rec *orig,
     return cp ? cp : "-";
 }
 
+#if APR_HAS_THREADS
+/* Hand the buffer over to the writer thread, called with buf->mutex held */
+static int queue_log_chunk(buffered_log *buf)
+{
+    log_async *async = buf->async;
+    log_chunk *chunk;
+
+    apr_thread_mutex_lock(async->mutex);
+    while (async->queued >= LOG_ASYNC_MAX_QUEUED && !async->exiting) {
+        apr_thread_cond_wait(async->cond, async->mutex);
+    }
+    if (async->exiting) {
+        apr_thread_mutex_unlock(async->mutex);
+        return 0;
+    }
+    chunk = async->spare;
+    if (chunk) {
+        async->spare = chunk->next;
+    }
+    else if (!(chunk = malloc(sizeof(*chunk)))) {
+        apr_thread_mutex_unlock(async->mutex);
+        return 0;
+    }
+    memcpy(chunk->data, buf->outbuf, buf->outcnt);
+    chunk->len = buf->outcnt;
+    chunk->next = NULL;
+    *async->tail = chunk;
+    async->tail = &chunk->next;
+    async->queued++;
+    apr_thread_cond_broadcast(async->cond);
+    apr_thread_mutex_unlock(async->mutex);
+
+    return 1;
+}
+
+static void * APR_THREAD_FUNC log_writer_thread(apr_thread_t *thd, void *data)
+{
+    buffered_log *buf = data;
+    log_async *async = buf->async;
+    apr_file_t *fd = buf->writer->log_writer;
+    struct iovec vec[LOG_ASYNC_IOVECS];
+    log_chunk *batch, *chunk, *last;
+    int n;
+
+    apr_thread_mutex_lock(async->mutex);
+    for (;;) {
+        while (!async->queue && !async->exiting) {
+            apr_thread_cond_wait(async->cond, async->mutex);
+        }
+        if (!async->queue) {
+            break;
+        }
+        batch = async->queue;
+        async->queue = NULL;
+        async->tail = &async->queue;
+        async->queued = 0;
+        apr_thread_cond_broadcast(async->cond);
+        apr_thread_mutex_unlock(async->mutex);
+
+        /* XXX: error handling */
+        last = chunk = batch;
+        while (chunk) {
+            if (buf->is_pipe) {
+                /* write() is only atomic up to PIPE_BUF on pipes */
+                log_write_fd(buf->writer, chunk->data, chunk->len);
+                last = chunk;
+                chunk = chunk->next;
+                continue;
+            }
+            for (n = 0; chunk && n < LOG_ASYNC_IOVECS; ++n) {
+                vec[n].iov_base = chunk->data;
+                vec[n].iov_len = chunk->len;
+                last = chunk;
+                chunk = chunk->next;
+            }
+            apr_file_writev_full(fd, vec, n, NULL);
+        }
+
+        apr_thread_mutex_lock(async->mutex);
+        last->next = async->spare;
+        async->spare = batch;
+    }
+    apr_thread_mutex_unlock(async->mutex);
+
+    apr_thread_exit(thd, APR_SUCCESS);
+    return NULL;
+}
+
+static apr_status_t free_log_chunks(void *data)
+{
+    log_async *async = data;
+    log_chunk *chunk;
+
+    while ((chunk = async->spare)) {
+        async->spare = chunk->next;
+        free(chunk);
+    }
+    return APR_SUCCESS;
+}
+
+static void start_log_writer(apr_pool_t *p, server_rec *s, buffered_log *buf)
+{
+    log_async *async = apr_pcalloc(p, sizeof(*async));
+    apr_status_t rv;
+
+    async->tail = &async->queue;
+    rv = apr_thread_mutex_create(&async->mutex, APR_THREAD_MUTEX_DEFAULT, p);
+    if (rv == APR_SUCCESS) {
+        rv = apr_thread_cond_create(&async->cond, p);
+    }
+    if (rv == APR_SUCCESS) {
+        apr_pool_cleanup_register(p, async, free_log_chunks,
+                                  apr_pool_cleanup_null);
+        buf->async = async;
+        rv = apr_thread_create(&async->thread, NULL, log_writer_thread,
+                               buf, p);
+    }
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10420)
+                     "could not start the buffered log writer thread, "
+                     "the log will be written by the request threads");
+        buf->async = NULL;
+    }
+}
+
+static void stop_log_writer(buffered_log *buf)
+{
+    log_async *async = buf->async;
+    apr_status_t rv;
+
+    apr_thread_mutex_lock(async->mutex);
+    async->exiting = 1;
+    apr_thread_cond_broadcast(async->cond);
+    apr_thread_mutex_unlock(async->mutex);
+
+    apr_thread_join(&rv, async->thread);
+    buf->async = NULL;
+}
+#endif
+
+#ifdef HAVE_ZLIB
+/* Write data as one gzip member, to out if it's large enough */
+static apr_status_t write_log_gzip(buffered_log *buf, const char *data,
+                                   apr_size_t len, char *out,
+                                   apr_size_t outsize)
+{
+    log_gzip *gz = buf->gz;
+    int zrv;
+
+    deflateReset(&gz->zs);
+    gz->zs.next_in = (Bytef *)data;
+    gz->zs.avail_in = len;
+    gz->zs.next_out = (Bytef *)out;
+    gz->zs.avail_out = outsize;
+    zrv = deflate(&gz->zs, Z_FINISH);
+    if (zrv != Z_STREAM_END) {
+        return APR_EGENERAL;
+    }
+    return apr_file_write_full(buf->writer->log_writer, out,
+                               outsize - gz->zs.avail_out, NULL);
+}
+
+static apr_status_t cleanup_log_gzip(void *data)
+{
+    log_gzip *gz = data;
+
+    deflateEnd(&gz->zs);
+    return APR_SUCCESS;
+}
+
+static void init_log_gzip(apr_pool_t *p, server_rec *s, buffered_log *buf)
+{
+    log_gzip *gz = apr_pcalloc(p, sizeof(*gz));
+
+    /* 16 + MAX_WBITS: with a gzip header and trailer */
+    if (deflateInit2(&gz->zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                     16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, s, APLOGNO(10559)
+                     "could not initialize the log compression, the log "
+                     "is written uncompressed");
+        return;
+    }
+    apr_pool_cleanup_register(p, gz, cleanup_log_gzip,
+                              apr_pool_cleanup_null);
+    gz->in = apr_palloc(p, compress_frame);
+    gz->outsize = deflateBound(&gz->zs, compress_frame);
+    gz->out = apr_palloc(p, gz->outsize);
+    buf->gz = gz;
+}
+#endif
+
 static void flush_log(buffered_log *buf)
 {
-    if (buf->outcnt && buf->handle != NULL) {
+#ifdef HAVE_ZLIB
+    if (buf->gz) {
+        if (buf->gz->inlen) {
+            /* XXX: error handling */
+            write_log_gzip(buf, buf->gz->in, buf->gz->inlen, buf->gz->out,
+                           buf->gz->outsize);
+            buf->gz->inlen = 0;
+        }
+        return;
+    }
+#endif
+    if (buf->outcnt && buf->writer != NULL) {
+#if APR_HAS_THREADS
+        if (buf->async && queue_log_chunk(buf)) {
+            buf->outcnt = 0;
+            return;
+        }
+#endif
         /* XXX: error handling */
-        apr_file_write_full(buf->handle, buf->outbuf, buf->outcnt, NULL);
+        log_write_fd(buf->writer, buf->outbuf, buf->outcnt);
         buf->outcnt = 0;
     }
 }
@@ -1176,8 +1629,12 @@ static int config_log_transaction(request_rec *r, config_log_state *cls,
     log_format_item *items;
     const char **strs;
     int *strl;
+    const char *strs_fast[LOG_FAST_ITEMS];
+    int strl_fast[LOG_FAST_ITEMS];
+    char scratch[LOG_FAST_SCRATCH_SIZE];
+    char *sp = scratch;
     request_rec *orig;
-    int i;
+    int i, n;
     apr_size_t len = 0;
     apr_array_header_t *format;
     char *envar;
@@ -1216,8 +1673,15 @@ static int config_log_transaction(request_rec *r, config_log_state *cls,
 
     format = cls->format ? cls->format : default_format;
 
-    strs = apr_palloc(r->pool, sizeof(char *) * (format->nelts));
-    strl = apr_palloc(r->pool, sizeof(int) * (format->nelts));
+    /* The fragments only need to live until the log writer returns */
+    if (format->nelts <= LOG_FAST_ITEMS) {
+        strs = strs_fast;
+        strl = strl_fast;
+    }
+    else {
+        strs = apr_palloc(r->pool, sizeof(char *) * (format->nelts));
+        strl = apr_palloc(r->pool, sizeof(int) * (format->nelts));
+    }
     items = (log_format_item *) format->elts;
 
     orig = r;
@@ -1229,7 +1693,19 @@ static int config_log_transaction(request_rec *r, config_log_state *cls,
     }
 
     for (i = 0; i < format->nelts; ++i) {
-        strs[i] = process_item(r, orig, &items[i]);
+        if (items[i].func == constant_item && !items[i].conditions) {
+            strs[i] = items[i].arg;
+        }
+        else if (items[i].fast && item_applies(r, &items[i])
+                 && (n = process_fast_item(items[i].want_orig ? orig : r,
+                                           &items[i], &strs[i], &sp,
+                                           scratch + sizeof(scratch))) >= 0) {
+            len += strl[i] = n;
+            continue;
+        }
+        else {
+            strs[i] = process_item(r, orig, &items[i]);
+        }
         len += strl[i] = strlen(strs[i]);
     }
 
@@ -1436,9 +1912,29 @@ static const char *set_transfer_log(cmd_parms *cmd, void *dummy,
     return add_custom_log(cmd, dummy, fn, NULL, NULL);
 }
 
-static const char *set_buffered_logs_on(cmd_parms *parms, void *dummy, int flag)
+static const char *set_buffered_logs_on(cmd_parms *parms, void *dummy,
+                                        const char *arg)
 {
-    buffered_logs = flag;
+    if (!strcasecmp(arg, "On")) {
+        buffered_logs = 1;
+        async_logs = 0;
+    }
+    else if (!strcasecmp(arg, "Off")) {
+        buffered_logs = 0;
+        async_logs = 0;
+    }
+    else if (!strcasecmp(arg, "Async")) {
+#if APR_HAS_THREADS
+        buffered_logs = 1;
+        async_logs = 1;
+#else
+        return "BufferedLogs Async requires thread support";
+#endif
+    }
+    else {
+        return "BufferedLogs must be On, Off or Async";
+    }
+
     if (buffered_logs) {
         ap_log_set_writer_init(ap_buffered_log_writer_init);
         ap_log_set_writer(ap_buffered_log_writer);
@@ -1449,6 +1945,29 @@ static const char *set_buffered_logs_on(cmd_parms *parms, void *dummy, int flag)
     }
     return NULL;
 }
+static const char *set_buffered_logs_compress(cmd_parms *parms, void *dummy,
+                                              const char *arg)
+{
+#ifdef HAVE_ZLIB
+    apr_off_t size;
+
+    if (!strcasecmp(arg, "Off")) {
+        compress_frame = 0;
+    }
+    else if (!ap_parse_strict_length(&size, arg)
+             || size < LOG_BUFSIZE || size > 64 * 1024 * 1024) {
+        return apr_psprintf(parms->pool, "BufferedLogsCompress must be Off "
+                            "or a size between %d and %d bytes",
+                            LOG_BUFSIZE, 64 * 1024 * 1024);
+    }
+    else {
+        compress_frame = (apr_size_t)size;
+    }
+    return NULL;
+#else
+    return "BufferedLogsCompress requires httpd to be built with zlib";
+#endif
+}
 static const command_rec config_log_cmds[] =
 {
 AP_INIT_TAKE23("CustomLog", add_custom_log, NULL, RSRC_CONF,
@@ -1460,8 +1979,12 @@ AP_INIT_TAKE1("TransferLog", set_transfer_log, NULL, RSRC_CONF,
      "the filename of the access log"),
 AP_INIT_TAKE12("LogFormat", log_format, NULL, RSRC_CONF,
      "a log format string (see docs) and an optional format name"),
-AP_INIT_FLAG("BufferedLogs", set_buffered_logs_on, NULL, RSRC_CONF,
-                 "Enable Buffered Logging (experimental)"),
+AP_INIT_TAKE1("BufferedLogs", set_buffered_logs_on, NULL, RSRC_CONF,
+              "Enable Buffered Logging (experimental), On, Off or Async "
+              "to write the buffers from a separate thread"),
+AP_INIT_TAKE1("BufferedLogsCompress", set_buffered_logs_compress, NULL,
+              RSRC_CONF, "Off or the size (bytes) of the frames of the "
+              "buffered file logs to compress with gzip"),
     {NULL}
 };
 
@@ -1574,6 +2097,20 @@ static apr_status_t flush_all_logs(void *data)
             }
         }
     }
+
+#if APR_HAS_THREADS
+    /* the writers drain their queue before exiting */
+    if (async_logs) {
+        buffered_log **array = (buffered_log **)all_buffered_logs->elts;
+
+        for (i = 0; i < all_buffered_logs->nelts; i++) {
+            if (array[i]->async) {
+                stop_log_writer(array[i]);
+            }
+        }
+    }
+#endif
+
     return APR_SUCCESS;
 }
 
@@ -1607,13 +2144,10 @@ static void init_child(apr_pool_t *p, server_rec *s)
 
     ap_mpm_query(AP_MPMQ_MAX_THREADS, &mpm_threads);
 
-    /* Now register the last buffer flush with the cleanup engine */
     if (buffered_logs) {
         int i;
         buffered_log **array = (buffered_log **)all_buffered_logs->elts;
 
-        apr_pool_cleanup_register(p, s, flush_all_logs, flush_all_logs);
-
         for (i = 0; i < all_buffered_logs->nelts; i++) {
             buffered_log *this = array[i];
 
@@ -1637,7 +2171,25 @@ static void init_child(apr_pool_t *p, server_rec *s)
             {
                 this->mutex.type = apr_anylock_none;
             }
+
+#if APR_HAS_THREADS
+            if (async_logs && this->writer->type == LOG_WRITER_FD
+#ifdef HAVE_ZLIB
+                && !this->gz
+#endif
+                ) {
+                start_log_writer(p, s, this);
+            }
+#endif
         }
+
+        /* Now register the last buffer flush with the cleanup engine,
+         * after the writer threads so that it runs before their own
+         * cleanups.  A forked child has no writer threads to hand over to.
+         */
+        apr_pool_cleanup_register(p, s, flush_all_logs,
+                                  async_logs ? apr_pool_cleanup_null
+                                             : flush_all_logs);
     }
 }
 
@@ -1692,8 +2244,7 @@ static apr_status_t ap_default_log_writer( request_rec *r,
     }
 
     if (log_writer->type == LOG_WRITER_FD) {
-        rv = apr_file_write_full((apr_file_t*)log_writer->log_writer, str,
-                                 len, NULL);
+        rv = log_write_fd(log_writer, str, len);
     }
     else {
         errorlog_provider_data *data = log_writer->log_writer;
@@ -1740,6 +2291,7 @@ static void *ap_default_log_writer_init(apr_pool_t *p, server_rec *s,
         log_writer = apr_pcalloc(p, sizeof(default_log_writer));
         log_writer->type = LOG_WRITER_FD;
         log_writer->log_writer = ap_piped_log_write_fd(pl);
+        log_writer->piped = pl;
         if (!log_writer->log_writer) {
             return NULL;
         }
@@ -1793,9 +2345,18 @@ static void *ap_buffered_log_writer_init(apr_pool_t *p, server_rec *s,
 {
     buffered_log *b;
     b = apr_pcalloc(p, sizeof(buffered_log));
-    b->handle = ap_default_log_writer_init(p, s, name);
+    b->writer = ap_default_log_writer_init(p, s, name);
+    b->is_pipe = (*name == '|');
+
+#ifdef HAVE_ZLIB
+    /* Only the files are compressed, not the pipes nor the providers */
+    if (compress_frame && b->writer && !b->is_pipe
+            && b->writer->type == LOG_WRITER_FD) {
+        init_log_gzip(p, s, b);
+    }
+#endif
 
-    if (b->handle) {
+    if (b->writer) {
         *(buffered_log **)apr_array_push(all_buffered_logs) = b;
         return b;
     }
@@ -1816,10 +2377,48 @@ static apr_status_t ap_buffered_log_writer(request_rec *r,
     apr_status_t rv;
     buffered_log *buf = (buffered_log*)handle;
 
+    /* Only the file descriptors are buffered, not the providers */
+    if (buf->writer->type != LOG_WRITER_FD) {
+        return ap_default_log_writer(r, buf->writer, strs, strl, nelts, len);
+    }
+
     if ((rv = APR_ANYLOCK_LOCK(&buf->mutex)) != APR_SUCCESS) {
         return rv;
     }
 
+#ifdef HAVE_ZLIB
+    if (buf->gz) {
+        log_gzip *gz = buf->gz;
+
+        if (len + gz->inlen > compress_frame) {
+            flush_log(buf);
+        }
+        if (len > compress_frame) {
+            /* a member of its own */
+            apr_size_t outsize = deflateBound(&gz->zs, len);
+
+            str = apr_palloc(r->pool, len + 1);
+            for (i = 0, s = str; i < nelts; ++i) {
+                memcpy(s, strs[i], strl[i]);
+                s += strl[i];
+            }
+            rv = write_log_gzip(buf, str, len, apr_palloc(r->pool, outsize),
+                                outsize);
+        }
+        else {
+            for (i = 0, s = gz->in + gz->inlen; i < nelts; ++i) {
+                memcpy(s, strs[i], strl[i]);
+                s += strl[i];
+            }
+            gz->inlen += len;
+            rv = APR_SUCCESS;
+        }
+
+        APR_ANYLOCK_UNLOCK(&buf->mutex);
+        return rv;
+    }
+#endif
+
     if (len + buf->outcnt > LOG_BUFSIZE) {
         flush_log(buf);
     }
@@ -1836,7 +2435,7 @@ static apr_status_t ap_buffered_log_writer(request_rec *r,
             s += strl[i];
         }
         w = len;
-        rv = apr_file_write_full(buf->handle, str, w, NULL);
+        rv = log_write_fd(buf->writer, str, w);
 
     }
     else {
@@ -1891,6 +2490,7 @@ static int log_pre_config(apr_pool_t *p, apr_pool_t *plog, apr_pool_t *ptemp)
         log_pfn_register(p, "s", log_status, 1);
         log_pfn_register(p, "R", log_handler, 1);
 
+        log_pfn_register(p, "^PT", log_request_phase_time, 0);
         log_pfn_register(p, "^ti", log_trailer_in, 0);
         log_pfn_register(p, "^to", log_trailer_out, 0);
 
@@ -1906,6 +2506,10 @@ static int log_pre_config(apr_pool_t *p, apr_pool_t *plog, apr_pool_t *ptemp)
     ap_log_set_writer_init(ap_default_log_writer_init);
     ap_log_set_writer(ap_default_log_writer);
     buffered_logs = 0;
+    async_logs = 0;
+#ifdef HAVE_ZLIB
+    compress_frame = 0;
+#endif
 
     return OK;
 }
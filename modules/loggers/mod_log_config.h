@@ -42,6 +42,7 @@ typedef void *ap_log_writer_init(apr_pool_t *p, server_rec *s,
                                  const char *name);
 /**
  * callback which gets called where there is a log line to write.
+ * The portions are only valid until the callback returns.
  */
 typedef apr_status_t ap_log_writer(
                             request_rec *r,
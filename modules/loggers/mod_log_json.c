@@ -26,143 +26,236 @@
 
 #include "apr_strings.h"
 
-/* jansson thinks everyone compiles with the platform's cc in its fullest capabilities
- * when undefining their INLINEs, we get static, unused functions, arg 
- */
-#if defined(__GNUC__)
-#if __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 6)
-#pragma GCC diagnostic push
-#endif
-#pragma GCC diagnostic ignored "-Wunused-function"
-#pragma GCC diagnostic ignored "-Wunreachable-code"
-#elif defined(__clang__)
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wunused-function"
-#endif
-
-#include <jansson_config.h>
-#undef  JSON_INLINE
-#define JSON_INLINE
-#include <jansson.h>
-
 APLOG_USE_MODULE(log_json);
 
 module AP_MODULE_DECLARE_DATA log_json_module;
 
 static APR_OPTIONAL_FN_TYPE(ap_register_log_handler) *log_json_register = NULL;
 
-static const char *crit_error =
-    "{\"mod_log_json_error\": \"critical error during serialization: see error "
-    "log\"}";
+/*
+ * The JSON object is encoded as it goes into a single buffer of the
+ * request pool, without building a tree first.  The output is compact and
+ * ASCII only, non ASCII characters are escaped as \uXXXX (UTF-16 surrogate
+ * pairs above the BMP) and the bytes which are not valid UTF-8 as \u00XX.
+ */
+#define LOG_JSON_INITIAL_SIZE 512
 
-static int
-log_json_dump_bb(const char *buffer, size_t size, void *baton)
+typedef struct {
+    apr_pool_t *pool;
+    char *buf;
+    apr_size_t len;
+    apr_size_t size;
+} log_json_out;
+
+static void
+log_json_grow(log_json_out *out, apr_size_t n)
 {
-    apr_bucket_brigade *bb = baton;
-    apr_brigade_write(bb, NULL, NULL, buffer, size);
-    return 0;
+    apr_size_t size = out->size;
+    char *buf;
+
+    while (out->len + n + 1 > size) {
+        size *= 2;
+    }
+    buf = apr_palloc(out->pool, size);
+    memcpy(buf, out->buf, out->len);
+    out->buf = buf;
+    out->size = size;
 }
 
-static const char *
-log_json(request_rec *r, char *a)
+static APR_INLINE void
+log_json_put(log_json_out *out, const char *s, apr_size_t n)
 {
-    apr_size_t olen;
-    apr_status_t rv;
-    int err;
-    char *out;
-    apr_bucket_brigade *bb;
-    json_t *obj;
-    json_t *hdrs;
-
-    obj = json_object();
-
-    json_object_set_new_nocheck(obj, "log_id",
-        r->log_id != NULL ? json_string(r->log_id) : json_null());
-    json_object_set_new_nocheck(
-        obj, "vhost", json_string(r->server->server_hostname));
-    json_object_set_new_nocheck(
-        obj, "status", json_string(apr_itoa(r->pool, r->status)));
-    json_object_set_new_nocheck(obj, "proto", json_string(r->protocol));
-    json_object_set_new_nocheck(obj, "method", json_string(r->method));
-    json_object_set_new_nocheck(obj, "uri", json_string(r->uri));
-    json_object_set_new_nocheck(obj, "srcip", json_string(r->useragent_ip));
-    json_object_set_new_nocheck(obj, "bytes_sent", json_integer(r->bytes_sent));
-
-    if (r->user != NULL) {
-        json_object_set_new_nocheck(obj, "user", json_string(r->user));
+    if (out->len + n + 1 > out->size) {
+        log_json_grow(out, n);
     }
+    memcpy(out->buf + out->len, s, n);
+    out->len += n;
+}
 
-    hdrs = json_object();
-    json_object_set_new_nocheck(hdrs, "user-agent",
-        json_string(apr_table_get(r->headers_in, "User-Agent")));
-    json_object_set_new_nocheck(obj, "hdrs", hdrs);
+static void
+log_json_escape_u(log_json_out *out, unsigned int c)
+{
+    static const char hex[] = "0123456789abcdef";
+    char u[6];
 
-    if (ap_ssl_conn_is_ssl(r->connection)) {
-        json_t *tls = json_object();
-
-        json_object_set_new_nocheck(tls, "v",
-            json_string(ap_ssl_var_lookup(
-                r->pool, r->server, r->connection, r, "SSL_PROTOCOL")));
-        json_object_set_new_nocheck(tls, "cipher",
-            json_string(ap_ssl_var_lookup(
-                r->pool, r->server, r->connection, r, "SSL_CIPHER")));
-        json_object_set_new_nocheck(tls, "client_verify",
-            json_string(ap_ssl_var_lookup(
-                r->pool, r->server, r->connection, r, "SSL_CLIENT_VERIFY")));
-        json_object_set_new_nocheck(tls, "sni",
-            json_string(ap_ssl_var_lookup(
-                r->pool, r->server, r->connection, r, "SSL_TLS_SNI")));
-
-        json_object_set_new_nocheck(obj, "tls", tls);
+    u[0] = '\\';
+    u[1] = 'u';
+    u[2] = hex[(c >> 12) & 0xf];
+    u[3] = hex[(c >> 8) & 0xf];
+    u[4] = hex[(c >> 4) & 0xf];
+    u[5] = hex[c & 0xf];
+    log_json_put(out, u, 6);
+}
+
+/* Length of the valid UTF-8 sequence at s, its code point in *cp, or 0 */
+static apr_size_t
+log_json_utf8(const unsigned char *s, unsigned int *cp)
+{
+    unsigned int c = s[0], min;
+    apr_size_t n, i;
+
+    if (c >= 0xc2 && c <= 0xdf) {
+        n = 2; c &= 0x1f; min = 0x80;
+    }
+    else if (c >= 0xe0 && c <= 0xef) {
+        n = 3; c &= 0x0f; min = 0x800;
+    }
+    else if (c >= 0xf0 && c <= 0xf4) {
+        n = 4; c &= 0x07; min = 0x10000;
+    }
+    else {
+        return 0;
+    }
+    for (i = 1; i < n; i++) {
+        if ((s[i] & 0xc0) != 0x80) {
+            return 0;
+        }
+        c = (c << 6) | (s[i] & 0x3f);
     }
+    if (c < min || c > 0x10ffff || (c >= 0xd800 && c <= 0xdfff)) {
+        return 0;
+    }
+    *cp = c;
+    return n;
+}
 
-    bb = apr_brigade_create(r->pool, r->connection->bucket_alloc);
-    err = json_dump_callback(
-        obj, log_json_dump_bb, bb, JSON_ENSURE_ASCII | JSON_COMPACT);
-    if (err != 0) {
-        ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r,
-            APLOGNO(10125) "json_dump_callback failed: %d", err);
-        apr_brigade_destroy(bb);
-        return crit_error;
+static void
+log_json_string(log_json_out *out, const char *str)
+{
+    const unsigned char *s = (const unsigned char *)str;
+    const unsigned char *run;
+    unsigned int cp;
+    apr_size_t n;
+
+    log_json_put(out, "\"", 1);
+    for (;;) {
+        /* copy the longest run which needs no escaping at once */
+        for (run = s; *s >= 0x20 && *s < 0x7f && *s != '"' && *s != '\\';
+             s++)
+            ;
+        if (s > run) {
+            log_json_put(out, (const char *)run, s - run);
+        }
+        if (!*s) {
+            break;
+        }
+        switch (*s) {
+        case '"':  log_json_put(out, "\\\"", 2); s++; continue;
+        case '\\': log_json_put(out, "\\\\", 2); s++; continue;
+        case '\b': log_json_put(out, "\\b", 2); s++; continue;
+        case '\f': log_json_put(out, "\\f", 2); s++; continue;
+        case '\n': log_json_put(out, "\\n", 2); s++; continue;
+        case '\r': log_json_put(out, "\\r", 2); s++; continue;
+        case '\t': log_json_put(out, "\\t", 2); s++; continue;
+        }
+        if (*s < 0x80) {
+            log_json_escape_u(out, *s++);
+        }
+        else if ((n = log_json_utf8(s, &cp)) == 0) {
+            log_json_escape_u(out, *s++);
+        }
+        else {
+            if (cp >= 0x10000) {
+                cp -= 0x10000;
+                log_json_escape_u(out, 0xd800 | (cp >> 10));
+                log_json_escape_u(out, 0xdc00 | (cp & 0x3ff));
+            }
+            else {
+                log_json_escape_u(out, cp);
+            }
+            s += n;
+        }
     }
+    log_json_put(out, "\"", 1);
+}
 
-    rv = apr_brigade_pflatten(bb, &out, &olen, r->pool);
-    if (rv != APR_SUCCESS) {
-        ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r,
-            APLOGNO(10126) "apr_brigade_pflatten failed");
-        apr_brigade_destroy(bb);
-        return crit_error;
+/* Starts the member key of the current object, the key needs no escaping */
+static void
+log_json_key(log_json_out *out, const char *key)
+{
+    char c = out->buf[out->len - 1];
+
+    if (c != '{') {
+        log_json_put(out, ",", 1);
     }
-    apr_brigade_destroy(bb);
-    return out;
+    log_json_put(out, "\"", 1);
+    log_json_put(out, key, strlen(key));
+    log_json_put(out, "\":", 2);
 }
 
-static int
-log_json_pre_config(apr_pool_t *p, apr_pool_t *plog, apr_pool_t *ptemp)
+/* Members with a NULL value are omitted */
+static void
+log_json_member(log_json_out *out, const char *key, const char *value)
 {
-    log_json_register = APR_RETRIEVE_OPTIONAL_FN(ap_register_log_handler);
-    log_json_register(p, "^JS", log_json, 0);
-    return OK;
+    if (value != NULL) {
+        log_json_key(out, key);
+        log_json_string(out, value);
+    }
 }
 
-static int
-log_json_post_config(
-    apr_pool_t *p, apr_pool_t *plog, apr_pool_t *ptemp, server_rec *s)
+static const char *
+log_json(request_rec *r, char *a)
 {
-    void *userdata_data = NULL;
-    const char *userdata_key = "log_json_init";
-
-    apr_pool_userdata_get(&userdata_data, userdata_key, s->process->pool);
-    if (userdata_data == NULL) {
-        apr_pool_userdata_set((const void *)1, userdata_key,
-            apr_pool_cleanup_null, s->process->pool);
-        return OK;
+    log_json_out out;
+    char num[APR_OFF_T_STRFN_SIZE];
+
+    out.pool = r->pool;
+    out.size = LOG_JSON_INITIAL_SIZE;
+    out.buf = apr_palloc(r->pool, out.size);
+    out.len = 0;
+
+    log_json_put(&out, "{", 1);
+
+    log_json_key(&out, "log_id");
+    if (r->log_id != NULL) {
+        log_json_string(&out, r->log_id);
+    }
+    else {
+        log_json_put(&out, "null", 4);
+    }
+    log_json_member(&out, "vhost", r->server->server_hostname);
+    log_json_member(&out, "status", apr_itoa(r->pool, r->status));
+    log_json_member(&out, "proto", r->protocol);
+    log_json_member(&out, "method", r->method);
+    log_json_member(&out, "uri", r->uri);
+    log_json_member(&out, "srcip", r->useragent_ip);
+    log_json_key(&out, "bytes_sent");
+    apr_snprintf(num, sizeof(num), "%" APR_OFF_T_FMT, r->bytes_sent);
+    log_json_put(&out, num, strlen(num));
+
+    log_json_member(&out, "user", r->user);
+
+    log_json_key(&out, "hdrs");
+    log_json_put(&out, "{", 1);
+    log_json_member(&out, "user-agent",
+                    apr_table_get(r->headers_in, "User-Agent"));
+    log_json_put(&out, "}", 1);
+
+    if (ap_ssl_conn_is_ssl(r->connection)) {
+        log_json_key(&out, "tls");
+        log_json_put(&out, "{", 1);
+        log_json_member(&out, "v", ap_ssl_var_lookup(
+            r->pool, r->server, r->connection, r, "SSL_PROTOCOL"));
+        log_json_member(&out, "cipher", ap_ssl_var_lookup(
+            r->pool, r->server, r->connection, r, "SSL_CIPHER"));
+        log_json_member(&out, "client_verify", ap_ssl_var_lookup(
+            r->pool, r->server, r->connection, r, "SSL_CLIENT_VERIFY"));
+        log_json_member(&out, "sni", ap_ssl_var_lookup(
+            r->pool, r->server, r->connection, r, "SSL_TLS_SNI"));
+        log_json_put(&out, "}", 1);
     }
 
-    /* http://jansson.readthedocs.io/en/2.8/portability.html#portability-thread-safety
-     */
-    json_object_seed(0);
+    log_json_put(&out, "}", 1);
+    out.buf[out.len] = '\0';
 
+    return out.buf;
+}
+
+static int
+log_json_pre_config(apr_pool_t *p, apr_pool_t *plog, apr_pool_t *ptemp)
+{
+    log_json_register = APR_RETRIEVE_OPTIONAL_FN(ap_register_log_handler);
+    log_json_register(p, "^JS", log_json, 0);
     return OK;
 }
 
@@ -172,7 +265,6 @@ static void
 register_hooks(apr_pool_t *pool)
 {
     ap_hook_pre_config(log_json_pre_config, NULL, NULL, APR_HOOK_MIDDLE);
-    ap_hook_post_config(log_json_post_config, NULL, NULL, APR_HOOK_MIDDLE);
 }
 
 module AP_MODULE_DECLARE_DATA log_json_module = {STANDARD20_MODULE_STUFF, NULL,
@@ -0,0 +1,789 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * mod_log_trace: sampled tracing of the requests, propagated with the
+ * traceparent header of the W3C Trace Context.
+ *
+ * A sampled request (TraceSampleRate percent of them, or those received
+ * with a sampled traceparent) is written to the TraceLog as spans, one JSON
+ * object per line:
+ *   - the request itself, child of the received traceparent if any,
+ *   - the phases of the request which ran (translate, access, handler...),
+ *   - the calls of mod_proxy to the backends, which get a traceparent
+ *     naming their span, with the connect, TLS handshake, send and wait
+ *     (time to first byte) steps reported by mod_proxy_http.
+ * The spans of a child are written in batches by a thread of its own,
+ * every TraceBatchInterval or sooner when they pile up, so the requests
+ * never wait for the log (spans are dropped if it can't keep up).
+ */
+
+#include "apr_strings.h"
+#include "apr_thread_proc.h"
+#include "apr_thread_mutex.h"
+#include "apr_thread_cond.h"
+
+#define APR_WANT_STRFUNC
+#define APR_WANT_MEMFUNC
+#define APR_WANT_IOVEC
+#include "apr_want.h"
+
+#include "httpd.h"
+#include "http_config.h"
+#include "http_core.h"
+#include "http_log.h"
+#include "http_request.h"
+#include "util_time.h"
+
+#include "mod_proxy.h"
+
+module AP_MODULE_DECLARE_DATA log_trace_module;
+
+#define TRACE_ID_SIZE 16
+#define SPAN_ID_SIZE 8
+
+/* "00-" trace-id "-" parent-id "-" flags */
+#define TRACEPARENT_LEN (3 + 2 * TRACE_ID_SIZE + 1 + 2 * SPAN_ID_SIZE + 3)
+
+/* Bytes of spans queued before the writer is woken up ahead of time */
+#ifndef TRACE_BATCH_SIZE
+#define TRACE_BATCH_SIZE (64 * 1024)
+#endif
+
+/* Bytes of spans queued before the new ones are dropped */
+#ifndef TRACE_MAX_QUEUED
+#define TRACE_MAX_QUEUED (4 * 1024 * 1024)
+#endif
+
+/* Chunks per writev() */
+#ifndef TRACE_IOVECS
+#define TRACE_IOVECS 16
+#endif
+
+/* The spans of the steps of the calls to the backends */
+#define TRACE_CALL_STEPS 4
+
+typedef struct {
+    double sample_rate;         /* percent of the requests, -1 if unset */
+} trace_server_conf;
+
+/* A call of mod_proxy to a backend */
+typedef struct {
+    const char *worker;
+    unsigned char span_id[SPAN_ID_SIZE];
+    apr_time_t steps[PROXY_BACKEND_DONE + 1]; /* 0 until reached */
+} trace_call;
+
+/* A sampled request, in the request_config of the initial request */
+typedef struct {
+    apr_pool_t *pool;
+    unsigned char trace_id[TRACE_ID_SIZE];
+    unsigned char span_id[SPAN_ID_SIZE];
+    unsigned char parent_id[SPAN_ID_SIZE];
+    int has_parent;
+    apr_array_header_t *calls;  /* trace_call */
+} trace_ctx;
+
+typedef struct trace_chunk trace_chunk;
+struct trace_chunk {
+    trace_chunk *next;
+    apr_size_t len;
+    char data[1];
+};
+
+static const char *trace_log_name;
+static apr_file_t *trace_log;
+static int trace_log_is_pipe;
+static apr_interval_time_t trace_batch_interval;
+
+#if APR_HAS_THREADS
+static struct {
+    apr_thread_t *thread;
+    apr_thread_mutex_t *mutex; /* protects all the fields below */
+    apr_thread_cond_t *cond;   /* a batch is ready, exit */
+    trace_chunk *queue;
+    trace_chunk **tail;
+    apr_size_t queued;
+    apr_size_t dropped;
+    int exiting;
+} writer;
+#endif
+
+static void *create_trace_server_config(apr_pool_t *p, server_rec *s)
+{
+    trace_server_conf *conf = apr_pcalloc(p, sizeof *conf);
+
+    conf->sample_rate = -1;
+
+    return conf;
+}
+
+static void *merge_trace_server_config(apr_pool_t *p, void *basev,
+                                       void *addv)
+{
+    trace_server_conf *base = basev;
+    trace_server_conf *add = addv;
+    trace_server_conf *conf = apr_pcalloc(p, sizeof *conf);
+
+    conf->sample_rate = (add->sample_rate >= 0) ? add->sample_rate
+                                                : base->sample_rate;
+
+    return conf;
+}
+
+static int hex_decode(const char *s, unsigned char *buf, apr_size_t size)
+{
+    apr_size_t i;
+
+    for (i = 0; i < 2 * size; ++i) {
+        unsigned char c = s[i], v;
+
+        /* lowercase only */
+        if (c >= '0' && c <= '9') {
+            v = c - '0';
+        }
+        else if (c >= 'a' && c <= 'f') {
+            v = c - 'a' + 10;
+        }
+        else {
+            return 0;
+        }
+        if (i % 2) {
+            buf[i / 2] |= v;
+        }
+        else {
+            buf[i / 2] = v << 4;
+        }
+    }
+    return 1;
+}
+
+static int is_zero(const unsigned char *buf, apr_size_t size)
+{
+    while (size--) {
+        if (*buf++) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Parse a traceparent into ctx, return its flags or -1 if it's invalid */
+static int parse_traceparent(const char *tp, trace_ctx *ctx)
+{
+    unsigned char version, flags;
+    apr_size_t len = strlen(tp);
+
+    if (len < TRACEPARENT_LEN || tp[2] != '-'
+            || tp[3 + 2 * TRACE_ID_SIZE] != '-'
+            || tp[TRACEPARENT_LEN - 3] != '-'
+            || !hex_decode(tp, &version, 1) || version == 0xff
+            /* the later versions may append fields */
+            || (len > TRACEPARENT_LEN
+                && (version == 0 || tp[TRACEPARENT_LEN] != '-'))
+            || !hex_decode(tp + 3, ctx->trace_id, TRACE_ID_SIZE)
+            || !hex_decode(tp + 4 + 2 * TRACE_ID_SIZE, ctx->parent_id,
+                           SPAN_ID_SIZE)
+            || !hex_decode(tp + TRACEPARENT_LEN - 2, &flags, 1)
+            || is_zero(ctx->trace_id, TRACE_ID_SIZE)
+            || is_zero(ctx->parent_id, SPAN_ID_SIZE)) {
+        return -1;
+    }
+    return flags;
+}
+
+static char *make_traceparent(apr_pool_t *p, const trace_ctx *ctx,
+                              const unsigned char *span_id)
+{
+    char *tp = apr_palloc(p, TRACEPARENT_LEN + 1);
+
+    memcpy(tp, "00-", 3);
+    ap_bin2hex(ctx->trace_id, TRACE_ID_SIZE, tp + 3);
+    tp[3 + 2 * TRACE_ID_SIZE] = '-';
+    ap_bin2hex(span_id, SPAN_ID_SIZE, tp + 4 + 2 * TRACE_ID_SIZE);
+    memcpy(tp + TRACEPARENT_LEN - 3, "-01", 4);
+
+    return tp;
+}
+
+/* The trace of the initial request of r, if sampled */
+static trace_ctx *get_trace_ctx(request_rec *r)
+{
+    if (!trace_log) {
+        return NULL;
+    }
+    for (;;) {
+        if (r->prev) {
+            r = r->prev;
+        }
+        else if (r->main) {
+            r = r->main;
+        }
+        else {
+            break;
+        }
+    }
+    return r->request_config
+           ? ap_get_module_config(r->request_config, &log_trace_module)
+           : NULL;
+}
+
+static int trace_post_read_request(request_rec *r)
+{
+    trace_server_conf *conf;
+    trace_ctx tmp, *ctx;
+    const char *tp;
+    char *trace_id;
+    int flags = -1;
+
+    if (!trace_log || r->prev || r->main) {
+        return DECLINED;
+    }
+
+    tp = apr_table_get(r->headers_in, "traceparent");
+    if (tp) {
+        flags = parse_traceparent(tp, &tmp);
+    }
+    if (flags >= 0) {
+        /* follow the sampling decision of the caller */
+        if (!(flags & 0x01)) {
+            return DECLINED;
+        }
+        tmp.has_parent = 1;
+    }
+    else {
+        conf = ap_get_module_config(r->server->module_config,
+                                    &log_trace_module);
+        if (conf->sample_rate <= 0
+                || (conf->sample_rate < 100
+                    && ap_random_pick(0, 999999)
+                       >= conf->sample_rate * 10000)) {
+            return DECLINED;
+        }
+        ap_random_insecure_bytes(tmp.trace_id, TRACE_ID_SIZE);
+        tmp.has_parent = 0;
+    }
+
+    ctx = apr_pmemdup(r->pool, &tmp, sizeof tmp);
+    ctx->pool = r->pool;
+    ctx->calls = NULL;
+    ap_random_insecure_bytes(ctx->span_id, SPAN_ID_SIZE);
+    ap_set_module_config(r->request_config, &log_trace_module, ctx);
+
+    trace_id = apr_palloc(r->pool, 2 * TRACE_ID_SIZE + 1);
+    ap_bin2hex(ctx->trace_id, TRACE_ID_SIZE, trace_id);
+    apr_table_setn(r->notes, "trace-id", trace_id);
+
+    return DECLINED;
+}
+
+static int trace_backend_step(request_rec *r, proxy_worker *worker,
+                              proxy_backend_step_e step)
+{
+    trace_ctx *ctx = get_trace_ctx(r);
+    trace_call *call;
+
+    if (!ctx) {
+        return DECLINED;
+    }
+    if (step == PROXY_BACKEND_START) {
+        if (!ctx->calls) {
+            ctx->calls = apr_array_make(ctx->pool, 1, sizeof(trace_call));
+        }
+        call = apr_array_push(ctx->calls);
+        memset(call, 0, sizeof *call);
+        call->worker = apr_pstrdup(ctx->pool, worker->s->name);
+        ap_random_insecure_bytes(call->span_id, SPAN_ID_SIZE);
+    }
+    else if (!ctx->calls || !ctx->calls->nelts) {
+        return DECLINED;
+    }
+    else {
+        call = &APR_ARRAY_IDX(ctx->calls, ctx->calls->nelts - 1, trace_call);
+    }
+    call->steps[step] = ap_time_monotonic();
+
+    return OK;
+}
+
+/* Name the span of the current call in the request to the backend */
+static int trace_proxy_fixups(request_rec *r)
+{
+    trace_ctx *ctx = get_trace_ctx(r);
+    trace_call *call;
+
+    if (!ctx || !ctx->calls || !ctx->calls->nelts) {
+        return DECLINED;
+    }
+    call = &APR_ARRAY_IDX(ctx->calls, ctx->calls->nelts - 1, trace_call);
+    apr_table_setn(r->headers_in, "traceparent",
+                   make_traceparent(r->pool, ctx, call->span_id));
+
+    return OK;
+}
+
+/* Escape s for a JSON string, any control or non-ASCII byte as \u00XX */
+static const char *json_escape(apr_pool_t *p, const char *s)
+{
+    const unsigned char *c;
+    apr_size_t n = 0, len;
+    char *e, *q;
+
+    for (c = (const unsigned char *)s; *c; ++c) {
+        if (*c < 0x20 || *c >= 0x7f || *c == '"' || *c == '\\') {
+            n += 5;
+        }
+    }
+    len = (const char *)c - s;
+    if (!n) {
+        return s;
+    }
+
+    q = e = apr_palloc(p, len + n + 1);
+    for (c = (const unsigned char *)s; *c; ++c) {
+        if (*c < 0x20 || *c >= 0x7f || *c == '"' || *c == '\\') {
+            memcpy(q, "\\u00", 4);
+            ap_bin2hex(c, 1, q + 4);
+            q += 6;
+        }
+        else {
+            *q++ = *c;
+        }
+    }
+    *q = '\0';
+
+    return e;
+}
+
+static void add_span(apr_array_header_t *spans, apr_pool_t *p,
+                     const trace_ctx *ctx, const unsigned char *span_id,
+                     const unsigned char *parent_id, const char *name,
+                     const char *kind, apr_time_t start,
+                     apr_interval_time_t duration, const char *attrs)
+{
+    char trace_hex[2 * TRACE_ID_SIZE + 1];
+    char span_hex[2 * SPAN_ID_SIZE + 1];
+    char parent_hex[2 * SPAN_ID_SIZE + 1];
+
+    ap_bin2hex(ctx->trace_id, TRACE_ID_SIZE, trace_hex);
+    ap_bin2hex(span_id, SPAN_ID_SIZE, span_hex);
+    if (parent_id) {
+        ap_bin2hex(parent_id, SPAN_ID_SIZE, parent_hex);
+    }
+    APR_ARRAY_PUSH(spans, const char *) = apr_psprintf(p,
+            "{\"trace_id\":\"%s\",\"span_id\":\"%s\",%s%s%s"
+            "\"name\":\"%s\",\"kind\":\"%s\","
+            "\"start_us\":%" APR_TIME_T_FMT ","
+            "\"duration_us\":%" APR_TIME_T_FMT "%s%s%s}\n",
+            trace_hex, span_hex,
+            parent_id ? "\"parent_id\":\"" : "",
+            parent_id ? parent_hex : "",
+            parent_id ? "\"," : "",
+            name, kind, start, duration,
+            attrs ? ",\"attributes\":{" : "",
+            attrs ? attrs : "",
+            attrs ? "}" : "");
+}
+
+static void write_spans(const char *data, apr_size_t len)
+{
+#if APR_HAS_THREADS
+    if (writer.thread) {
+        trace_chunk *chunk;
+
+        chunk = malloc(APR_OFFSETOF(trace_chunk, data) + len);
+        if (!chunk) {
+            return;
+        }
+        memcpy(chunk->data, data, len);
+        chunk->len = len;
+        chunk->next = NULL;
+
+        apr_thread_mutex_lock(writer.mutex);
+        if (writer.exiting || writer.queued + len > TRACE_MAX_QUEUED) {
+            writer.dropped++;
+            apr_thread_mutex_unlock(writer.mutex);
+            free(chunk);
+            return;
+        }
+        *writer.tail = chunk;
+        writer.tail = &chunk->next;
+        writer.queued += len;
+        if (writer.queued >= TRACE_BATCH_SIZE) {
+            apr_thread_cond_signal(writer.cond);
+        }
+        apr_thread_mutex_unlock(writer.mutex);
+        return;
+    }
+#endif
+    /* XXX: error handling */
+    apr_file_write_full(trace_log, data, len, NULL);
+}
+
+static int trace_log_transaction(request_rec *r)
+{
+    static const struct {
+        const char *name;
+        proxy_backend_step_e from, to;
+    } call_steps[TRACE_CALL_STEPS] = {
+        { "connect", PROXY_BACKEND_CONNECT, PROXY_BACKEND_CONNECTED },
+        { "tls", PROXY_BACKEND_CONNECTED, PROXY_BACKEND_HANDSHAKEN },
+        { "send", PROXY_BACKEND_START, PROXY_BACKEND_REQUEST_SENT },
+        { "wait", PROXY_BACKEND_REQUEST_SENT, PROXY_BACKEND_RESPONSE }
+    };
+    request_rec *first = r;
+    trace_ctx *ctx = get_trace_ctx(r);
+    apr_array_header_t *spans;
+    unsigned char *ids, *id;
+    apr_time_t now, mono, offset;
+    const char *data;
+    int i, j, ncalls;
+
+    if (!ctx) {
+        return DECLINED;
+    }
+    while (first->prev) {
+        first = first->prev;
+    }
+
+    now = apr_time_now();
+    mono = ap_time_monotonic();
+    /* to turn the monotonic times into wall clock ones */
+    offset = now - mono;
+
+    ncalls = ctx->calls ? ctx->calls->nelts : 0;
+    id = ids = apr_palloc(r->pool, (AP_REQUEST_PHASE_COUNT
+                                    + ncalls * TRACE_CALL_STEPS)
+                                   * SPAN_ID_SIZE);
+    ap_random_insecure_bytes(ids, (AP_REQUEST_PHASE_COUNT
+                                   + ncalls * TRACE_CALL_STEPS)
+                                  * SPAN_ID_SIZE);
+    spans = apr_array_make(r->pool, 2 + AP_REQUEST_PHASE_COUNT
+                                    + ncalls * (1 + TRACE_CALL_STEPS),
+                           sizeof(const char *));
+
+    add_span(spans, r->pool, ctx, ctx->span_id,
+             ctx->has_parent ? ctx->parent_id : NULL,
+             json_escape(r->pool, apr_pstrcat(r->pool, first->method, " ",
+                                              first->uri, NULL)),
+             "server", first->request_time, now - first->request_time,
+             apr_psprintf(r->pool,
+                          "\"http.method\":\"%s\",\"http.target\":\"%s\","
+                          "\"http.host\":\"%s\",\"http.status_code\":%d,"
+                          "\"http.response_size\":%" APR_OFF_T_FMT ","
+                          "\"server.name\":\"%s\"",
+                          json_escape(r->pool, first->method),
+                          json_escape(r->pool, first->uri),
+                          json_escape(r->pool, r->hostname ? r->hostname
+                                                           : ""),
+                          r->status, r->bytes_sent,
+                          json_escape(r->pool,
+                                      r->server->server_hostname)));
+
+    for (i = 0; i < AP_REQUEST_PHASE_COUNT; ++i, id += SPAN_ID_SIZE) {
+        apr_interval_time_t t = ap_request_phase_time(first, i);
+
+        if (t < 0) {
+            continue;
+        }
+        add_span(spans, r->pool, ctx, id, ctx->span_id,
+                 ap_request_phase_name(i), "internal",
+                 ap_request_phase_start(first, i) + offset, t, NULL);
+    }
+
+    for (i = 0; i < ncalls; ++i) {
+        trace_call *call = &APR_ARRAY_IDX(ctx->calls, i, trace_call);
+        apr_time_t *steps = call->steps;
+        apr_time_t end = steps[PROXY_BACKEND_DONE] ? steps[PROXY_BACKEND_DONE]
+                                                   : mono;
+        const char *worker = json_escape(r->pool, call->worker);
+
+        add_span(spans, r->pool, ctx, call->span_id, ctx->span_id,
+                 apr_pstrcat(r->pool, "proxy ", worker, NULL), "client",
+                 steps[PROXY_BACKEND_START] + offset,
+                 end - steps[PROXY_BACKEND_START],
+                 apr_pstrcat(r->pool, "\"proxy.worker\":\"", worker, "\"",
+                             NULL));
+
+        for (j = 0; j < TRACE_CALL_STEPS; ++j, id += SPAN_ID_SIZE) {
+            apr_time_t from = steps[call_steps[j].from];
+            apr_time_t to = steps[call_steps[j].to];
+
+            if (call_steps[j].to == PROXY_BACKEND_REQUEST_SENT) {
+                /* the request is sent once the connection is ready */
+                if (steps[PROXY_BACKEND_HANDSHAKEN]) {
+                    from = steps[PROXY_BACKEND_HANDSHAKEN];
+                }
+                else if (steps[PROXY_BACKEND_CONNECTED]) {
+                    from = steps[PROXY_BACKEND_CONNECTED];
+                }
+            }
+            if (!from || !to || to < from) {
+                continue;
+            }
+            add_span(spans, r->pool, ctx, id, call->span_id,
+                     call_steps[j].name, "internal", from + offset,
+                     to - from, NULL);
+        }
+    }
+
+    data = apr_array_pstrcat(r->pool, spans, '\0');
+    write_spans(data, strlen(data));
+
+    return OK;
+}
+
+#if APR_HAS_THREADS
+static void * APR_THREAD_FUNC trace_writer_thread(apr_thread_t *thd,
+                                                  void *data)
+{
+    server_rec *s = data;
+    struct iovec vec[TRACE_IOVECS];
+    trace_chunk *batch, *chunk, *next;
+    apr_size_t dropped;
+    int exiting, n;
+
+    apr_thread_mutex_lock(writer.mutex);
+    for (;;) {
+        if (!writer.exiting && writer.queued < TRACE_BATCH_SIZE) {
+            apr_thread_cond_timedwait(writer.cond, writer.mutex,
+                                      trace_batch_interval);
+        }
+        batch = writer.queue;
+        writer.queue = NULL;
+        writer.tail = &writer.queue;
+        writer.queued = 0;
+        dropped = writer.dropped;
+        writer.dropped = 0;
+        exiting = writer.exiting;
+        apr_thread_mutex_unlock(writer.mutex);
+
+        if (dropped) {
+            ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s, APLOGNO(10520)
+                         "dropped the spans of %" APR_SIZE_T_FMT " traced "
+                         "requests, the trace log could not keep up",
+                         dropped);
+        }
+
+        /* XXX: error handling */
+        chunk = batch;
+        while (chunk) {
+            if (trace_log_is_pipe) {
+                /* write() is only atomic up to PIPE_BUF on pipes */
+                apr_file_write_full(trace_log, chunk->data, chunk->len, NULL);
+                chunk = chunk->next;
+                continue;
+            }
+            for (n = 0; chunk && n < TRACE_IOVECS; ++n) {
+                vec[n].iov_base = chunk->data;
+                vec[n].iov_len = chunk->len;
+                chunk = chunk->next;
+            }
+            apr_file_writev_full(trace_log, vec, n, NULL);
+        }
+        for (chunk = batch; chunk; chunk = next) {
+            next = chunk->next;
+            free(chunk);
+        }
+
+        if (exiting) {
+            break;
+        }
+        apr_thread_mutex_lock(writer.mutex);
+    }
+
+    apr_thread_exit(thd, APR_SUCCESS);
+    return NULL;
+}
+
+static apr_status_t stop_trace_writer(void *data)
+{
+    apr_status_t rv;
+
+    apr_thread_mutex_lock(writer.mutex);
+    writer.exiting = 1;
+    apr_thread_cond_signal(writer.cond);
+    apr_thread_mutex_unlock(writer.mutex);
+
+    apr_thread_join(&rv, writer.thread);
+    writer.thread = NULL;
+
+    return APR_SUCCESS;
+}
+#endif
+
+static void trace_child_init(apr_pool_t *p, server_rec *s)
+{
+#if APR_HAS_THREADS
+    apr_status_t rv;
+
+    if (!trace_log) {
+        return;
+    }
+
+    memset(&writer, 0, sizeof writer);
+    writer.tail = &writer.queue;
+    rv = apr_thread_mutex_create(&writer.mutex, APR_THREAD_MUTEX_DEFAULT, p);
+    if (rv == APR_SUCCESS) {
+        rv = apr_thread_cond_create(&writer.cond, p);
+    }
+    if (rv == APR_SUCCESS) {
+        rv = apr_thread_create(&writer.thread, NULL, trace_writer_thread,
+                               s, p);
+    }
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10521)
+                     "could not start the trace log writer thread, the "
+                     "spans will be written by the request threads");
+        writer.thread = NULL;
+        return;
+    }
+    /* before the thread's pool goes away */
+    apr_pool_pre_cleanup_register(p, NULL, stop_trace_writer);
+#endif
+}
+
+static int trace_pre_config(apr_pool_t *pconf, apr_pool_t *plog,
+                            apr_pool_t *ptemp)
+{
+    trace_log_name = NULL;
+    trace_log = NULL;
+    trace_log_is_pipe = 0;
+    trace_batch_interval = apr_time_from_sec(1);
+
+    return OK;
+}
+
+static int trace_open_logs(apr_pool_t *pconf, apr_pool_t *plog,
+                           apr_pool_t *ptemp, server_rec *s)
+{
+    apr_status_t rv;
+
+    if (!trace_log_name) {
+        return OK;
+    }
+
+    if (*trace_log_name == '|') {
+        piped_log *pl;
+        const char *pname = ap_server_root_relative(pconf,
+                                                    trace_log_name + 1);
+
+        pl = ap_open_piped_log(pconf, pname);
+        if (pl == NULL) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, 0, s, APLOGNO(10522)
+                         "couldn't spawn trace log pipe %s", trace_log_name);
+            return HTTP_INTERNAL_SERVER_ERROR;
+        }
+        trace_log = ap_piped_log_write_fd(pl);
+        trace_log_is_pipe = 1;
+    }
+    else {
+        const char *fname = ap_server_root_relative(pconf, trace_log_name);
+
+        if ((rv = apr_file_open(&trace_log, fname,
+                                APR_WRITE | APR_APPEND | APR_CREATE,
+                                APR_OS_DEFAULT, pconf)) != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10523)
+                         "could not open trace log file %s.", fname);
+            return HTTP_INTERNAL_SERVER_ERROR;
+        }
+    }
+
+    return OK;
+}
+
+static const char *set_trace_log(cmd_parms *cmd, void *dummy, const char *arg)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+
+    if (err != NULL) {
+        return err;
+    }
+    trace_log_name = arg;
+
+    return NULL;
+}
+
+static const char *set_sample_rate(cmd_parms *cmd, void *dummy,
+                                   const char *arg)
+{
+    trace_server_conf *conf = ap_get_module_config(cmd->server->module_config,
+                                                   &log_trace_module);
+    char *end;
+    double rate = strtod(arg, &end);
+
+    if (end == arg || *end || rate < 0 || rate > 100) {
+        return "TraceSampleRate must be a percentage between 0 and 100";
+    }
+    conf->sample_rate = rate;
+
+    return NULL;
+}
+
+static const char *set_batch_interval(cmd_parms *cmd, void *dummy,
+                                      const char *arg)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+    apr_interval_time_t interval;
+
+    if (err != NULL) {
+        return err;
+    }
+    if (ap_timeout_parameter_parse(arg, &interval, "s") != APR_SUCCESS
+            || interval <= 0) {
+        return "TraceBatchInterval must be a positive time";
+    }
+    trace_batch_interval = interval;
+
+    return NULL;
+}
+
+static const command_rec trace_cmds[] =
+{
+    AP_INIT_TAKE1("TraceLog", set_trace_log, NULL, RSRC_CONF,
+                  "the filename of the trace log, or a pipe"),
+    AP_INIT_TAKE1("TraceSampleRate", set_sample_rate, NULL, RSRC_CONF,
+                  "the percentage of the requests to trace"),
+    AP_INIT_TAKE1("TraceBatchInterval", set_batch_interval, NULL, RSRC_CONF,
+                  "the maximum time the spans wait to be written (1s)"),
+    { NULL }
+};
+
+static void register_hooks(apr_pool_t *p)
+{
+    ap_hook_pre_config(trace_pre_config, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_open_logs(trace_open_logs, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_child_init(trace_child_init, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_post_read_request(trace_post_read_request, NULL, NULL,
+                              APR_HOOK_REALLY_FIRST);
+    ap_hook_log_transaction(trace_log_transaction, NULL, NULL,
+                            APR_HOOK_MIDDLE);
+    APR_OPTIONAL_HOOK(proxy, backend_step, trace_backend_step, NULL, NULL,
+                      APR_HOOK_MIDDLE);
+    APR_OPTIONAL_HOOK(proxy, fixups, trace_proxy_fixups, NULL, NULL,
+                      APR_HOOK_MIDDLE);
+}
+
+AP_DECLARE_MODULE(log_trace) =
+{
+    STANDARD20_MODULE_STUFF,
+    NULL,                       /* create per-dir config */
+    NULL,                       /* merge per-dir config */
+    create_trace_server_config, /* server config */
+    merge_trace_server_config,  /* merge server config */
+    trace_cmds,                 /* command apr_table_t */
+    register_hooks              /* register hooks */
+};
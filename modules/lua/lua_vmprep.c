@@ -21,6 +21,8 @@
 #include "apr_file_info.h"
 #include "mod_auth.h"
 
+#include <stdlib.h>
+
 APLOG_USE_MODULE(lua);
 
 #ifndef AP_LUA_MODULE_EXT
@@ -39,6 +41,28 @@ APLOG_USE_MODULE(lua);
     apr_thread_mutex_t *ap_lua_mutex;
 #endif
 extern apr_global_mutex_t *lua_ivm_mutex;
+
+/* Scripts compiled by the child, shared by the VMs of all the scopes so that
+ * each file is parsed once until it changes.
+ */
+typedef struct {
+    apr_time_t modified;
+    apr_off_t size;
+    char *bytecode;     /* malloc()ed, replaced when the file changes */
+    apr_size_t len;
+} lua_compiled_file;
+
+typedef struct {
+    char *data;
+    apr_size_t len;
+    apr_size_t alloc;
+} lua_dump_buffer;
+
+static apr_pool_t *compiled_files_pool;
+static apr_hash_t *compiled_files;
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *compiled_files_mutex;
+#endif
     
 void ap_lua_init_mutex(apr_pool_t *pool, server_rec *s) 
 {
@@ -57,7 +81,12 @@ void ap_lua_init_mutex(apr_pool_t *pool, server_rec *s)
     /* Server pool mutex */
 #if APR_HAS_THREADS
     apr_thread_mutex_create(&ap_lua_mutex, APR_THREAD_MUTEX_DEFAULT, pool);
+    apr_thread_mutex_create(&compiled_files_mutex, APR_THREAD_MUTEX_DEFAULT,
+                            pool);
 #endif
+    apr_pool_create(&compiled_files_pool, pool);
+    apr_pool_tag(compiled_files_pool, "lua_compiled_files");
+    compiled_files = apr_hash_make(compiled_files_pool);
 }
 
 /* forward dec'l from this file */
@@ -236,6 +265,100 @@ void ap_lua_load_apache2_lmodule(lua_State *L)
 
 /*  END library functions */
 
+static int compiled_file_writer(lua_State *L, const void *b, size_t size,
+                                void *ud)
+{
+    lua_dump_buffer *buf = ud;
+    (void)L;
+
+    if (buf->len + size > buf->alloc) {
+        apr_size_t alloc = buf->alloc ? buf->alloc * 2 : 4096;
+        char *data;
+
+        while (alloc < buf->len + size) {
+            alloc *= 2;
+        }
+        data = realloc(buf->data, alloc);
+        if (data == NULL) {
+            return 1;
+        }
+        buf->data = data;
+        buf->alloc = alloc;
+    }
+    memcpy(buf->data + buf->len, b, size);
+    buf->len += size;
+    return 0;
+}
+
+/*
+ * Load a script file onto the stack of the lua_State, like luaL_loadfile()
+ * but reusing the bytecode already compiled by this child if the file did
+ * not change (LuaCodeCache never still loads it from the source each time).
+ */
+static int load_lua_file(lua_State *L, const char *file, int codecache,
+                         apr_pool_t *pool)
+{
+    lua_compiled_file *cf;
+    lua_dump_buffer buf;
+    apr_finfo_t finfo;
+    int rc;
+
+    if (codecache == AP_LUA_CACHE_NEVER || compiled_files == NULL
+        || apr_stat(&finfo, file, APR_FINFO_MTIME | APR_FINFO_SIZE,
+                    pool) != APR_SUCCESS) {
+        return luaL_loadfile(L, file);
+    }
+
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(compiled_files_mutex);
+#endif
+    cf = apr_hash_get(compiled_files, file, APR_HASH_KEY_STRING);
+    if (cf && cf->modified == finfo.mtime && cf->size == finfo.size) {
+        rc = luaL_loadbuffer(L, cf->bytecode, cf->len, file);
+#if APR_HAS_THREADS
+        apr_thread_mutex_unlock(compiled_files_mutex);
+#endif
+        return rc;
+    }
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(compiled_files_mutex);
+#endif
+
+    rc = luaL_loadfile(L, file);
+    if (rc != 0) {
+        return rc;
+    }
+
+    memset(&buf, 0, sizeof(buf));
+    if (lua_dump(L, compiled_file_writer, &buf) != 0) {
+        /* the script is loaded anyway, just not cached */
+        free(buf.data);
+        return 0;
+    }
+
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(compiled_files_mutex);
+#endif
+    cf = apr_hash_get(compiled_files, file, APR_HASH_KEY_STRING);
+    if (cf == NULL) {
+        cf = apr_palloc(compiled_files_pool, sizeof(*cf));
+        apr_hash_set(compiled_files, apr_pstrdup(compiled_files_pool, file),
+                     APR_HASH_KEY_STRING, cf);
+    }
+    else {
+        free(cf->bytecode);
+    }
+    cf->modified = finfo.mtime;
+    cf->size = finfo.size;
+    cf->bytecode = buf.data;
+    cf->len = buf.len;
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(compiled_files_mutex);
+#endif
+
+    return 0;
+}
+
 /* callback for cleaning up a lua vm when pool is closed */
 static apr_status_t cleanup_lua(void *l)
 {
@@ -369,7 +492,7 @@ static apr_status_t vm_construct(lua_State **vm, void *params, apr_pool_t *lifec
         int rc;
         ap_log_perror(APLOG_MARK, APLOG_DEBUG, 0, lifecycle_pool, APLOGNO(01481)
             "loading lua file %s", spec->file);
-        rc = luaL_loadfile(L, spec->file);
+        rc = load_lua_file(L, spec->file, spec->codecache, lifecycle_pool);
         if (rc != 0) {
             ap_log_perror(APLOG_MARK, APLOG_ERR, 0, lifecycle_pool, APLOGNO(01482)
                           "Error loading %s: %s", spec->file,
@@ -399,7 +522,8 @@ static ap_lua_vm_spec* copy_vm_spec(apr_pool_t* pool, ap_lua_vm_spec* spec)
 {
     ap_lua_vm_spec* copied_spec = apr_pcalloc(pool, sizeof(ap_lua_vm_spec));
     copied_spec->bytecode_len = spec->bytecode_len;
-    copied_spec->bytecode = apr_pstrdup(pool, spec->bytecode);
+    copied_spec->bytecode = apr_pmemdup(pool, spec->bytecode,
+                                        spec->bytecode_len);
     copied_spec->cb = spec->cb;
     copied_spec->cb_arg = NULL;
     copied_spec->file = apr_pstrdup(pool, spec->file);
@@ -537,7 +661,7 @@ lua_State *ap_lua_get_lua_state(apr_pool_t *lifecycle_pool,
         int rc;
         ap_log_perror(APLOG_MARK, APLOG_DEBUG, 0, lifecycle_pool, APLOGNO(02332)
             "(re)loading lua file %s", spec->file);
-        rc = luaL_loadfile(L, spec->file);
+        rc = load_lua_file(L, spec->file, spec->codecache, lifecycle_pool);
         if (rc != 0) {
             ap_log_perror(APLOG_MARK, APLOG_ERR, 0, lifecycle_pool, APLOGNO(02333)
                           "Error loading %s: %s", spec->file,
@@ -25,6 +25,10 @@
 #include "apr_strings.h"
 #include "apr_file_io.h"
 #include "apr_lib.h"
+#include "apr_hash.h"
+#if APR_HAS_THREADS
+#include "apr_thread_mutex.h"
+#endif
 
 #define APR_WANT_STRFUNC
 #include "apr_want.h"
@@ -48,6 +52,7 @@
 typedef struct {
     int forcelangpriority;
     apr_array_header_t *language_priority;
+    int cache;                  /* NegotiationCache, -1 if unset */
 } neg_dir_config;
 
 /* forcelangpriority flags
@@ -73,6 +78,7 @@ static void *create_neg_dir_config(apr_pool_t *p, char *dummy)
 
     new->forcelangpriority = FLP_UNDEF;
     new->language_priority = NULL;
+    new->cache = -1;
     return new;
 }
 
@@ -90,6 +96,7 @@ static void *merge_neg_dir_configs(apr_pool_t *p, void *basev, void *addv)
     new->language_priority = add->language_priority
                                 ? add->language_priority
                                 : base->language_priority;
+    new->cache = (add->cache != -1) ? add->cache : base->cache;
     return new;
 }
 
@@ -147,6 +154,14 @@ static const char *cache_negotiated_docs(cmd_parms *cmd, void *dummy,
     return NULL;
 }
 
+static const char *set_negotiation_cache(cmd_parms *cmd, void *n_, int arg)
+{
+    neg_dir_config *n = n_;
+
+    n->cache = arg;
+    return NULL;
+}
+
 static int do_cache_negotiated_docs(server_rec *s)
 {
     return (ap_get_module_config(s->module_config,
@@ -164,6 +179,10 @@ static const command_rec negotiation_cmds[] =
                     OR_FILEINFO,
                     "Force LanguagePriority elections, either None, or "
                     "Fallback and/or Prefer"),
+    AP_INIT_FLAG("NegotiationCache", set_negotiation_cache, NULL,
+                 RSRC_CONF|ACCESS_CONF,
+                 "Either 'on' or 'off' (default), to cache the variants of "
+                 "type maps and MultiViews"),
     {NULL}
 };
 
@@ -229,6 +248,7 @@ typedef struct var_rec {
     apr_off_t bytes;            /* content length, if known */
     int lang_index;             /* Index into LanguagePriority list */
     int is_pseudo_html;         /* text/html, *or* the INCLUDES_MAGIC_TYPEs */
+    int has_handler;            /* MultiViews variant with a handler */
 
     /* Above are all written-once properties of the variant.  The
      * three fields below are changed during negotiation:
@@ -270,6 +290,10 @@ typedef struct {
     int send_alternates;      /* 1 if we want to send an Alternates header */
     int may_choose;           /* 1 if we may choose a variant for the client */
     int use_rvsa;             /* 1 if we must use RVSA/1.0 negotiation algo */
+
+    int cached;               /* 1 if the variants come from the cache */
+    int skip_cache;           /* 1 to find the variants without the cache */
+    int variant_failed;       /* 1 if the chosen variant's lookup failed */
 } negotiation_state;
 
 /* A few functions to manipulate var_recs.
@@ -288,6 +312,7 @@ static void clean_var_rec(var_rec *mime_info)
     mime_info->description = "";
 
     mime_info->is_pseudo_html = 0;
+    mime_info->has_handler = 0;
     mime_info->level = 0.0f;
     mime_info->level_matched = 0.0f;
     mime_info->bytes = -1;
@@ -931,6 +956,180 @@ static char *lcase_header_name_return_body(char *header, request_rec *r)
     return cp;
 }
 
+/*****************************************************************
+ *
+ * The cache of the variants read from type maps and found by
+ * MultiViews, per child process.  A type map entry is valid as long
+ * as the map's mtime and size match, a MultiViews entry as long as
+ * the directory's mtime does.  The entries are copied to and from
+ * the request pool, so they can be replaced while in use.
+ */
+
+#define NEG_CACHE_MAX_ENTRIES 1024
+
+typedef struct {
+    apr_pool_t *pool;
+    apr_time_t mtime;
+    apr_off_t size;
+    apr_array_header_t *vars;   /* var_recs, without sub_req */
+    int count_multiviews_variants;
+} neg_cache_entry;
+
+static apr_pool_t *neg_cache_pool;
+static apr_hash_t *neg_cache;
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *neg_cache_mutex;
+#endif
+
+static apr_status_t neg_cache_cleanup(void *dummy)
+{
+    apr_pool_destroy(neg_cache_pool);
+    neg_cache_pool = NULL;
+    neg_cache = NULL;
+    return APR_SUCCESS;
+}
+
+static void neg_child_init(apr_pool_t *pchild, server_rec *s)
+{
+    apr_allocator_t *allocator;
+    apr_status_t rv;
+
+    /* The cache has its own allocator, the entries' pools are created
+     * from the request threads under the mutex only.
+     */
+    rv = apr_allocator_create(&allocator);
+    if (rv == APR_SUCCESS) {
+        rv = apr_pool_create_ex(&neg_cache_pool, NULL, NULL, allocator);
+        if (rv != APR_SUCCESS) {
+            apr_allocator_destroy(allocator);
+        }
+    }
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10586)
+                     "could not create the negotiation cache");
+        return;
+    }
+    apr_allocator_owner_set(allocator, neg_cache_pool);
+    apr_pool_tag(neg_cache_pool, "neg_cache");
+#if APR_HAS_THREADS
+    rv = apr_thread_mutex_create(&neg_cache_mutex, APR_THREAD_MUTEX_DEFAULT,
+                                 pchild);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10587)
+                     "could not create the negotiation cache mutex");
+        apr_pool_destroy(neg_cache_pool);
+        neg_cache_pool = NULL;
+        return;
+    }
+#endif
+    neg_cache = apr_hash_make(neg_cache_pool);
+    apr_pool_cleanup_register(pchild, NULL, neg_cache_cleanup,
+                              apr_pool_cleanup_null);
+}
+
+static apr_array_header_t *copy_languages(apr_pool_t *p,
+                                          const apr_array_header_t *langs)
+{
+    apr_array_header_t *copy;
+    int i;
+
+    if (!langs) {
+        return NULL;
+    }
+    copy = apr_array_make(p, langs->nelts, sizeof(char *));
+    for (i = 0; i < langs->nelts; ++i) {
+        *(char **)apr_array_push(copy) = apr_pstrdup(p,
+                                             APR_ARRAY_IDX(langs, i, char *));
+    }
+    return copy;
+}
+
+/* Copy the variants of src to the array dst, with their strings
+ * allocated from p and no subrequest.
+ */
+static void copy_variants(apr_pool_t *p, apr_array_header_t *dst,
+                          const apr_array_header_t *src)
+{
+    int i;
+
+    for (i = 0; i < src->nelts; ++i) {
+        const var_rec *from = &APR_ARRAY_IDX(src, i, var_rec);
+        var_rec *to = apr_array_push(dst);
+
+        memcpy(to, from, sizeof(var_rec));
+        to->sub_req = NULL;
+        to->mime_type = apr_pstrdup(p, from->mime_type);
+        to->file_name = apr_pstrdup(p, from->file_name);
+        to->content_encoding = apr_pstrdup(p, from->content_encoding);
+        to->content_languages = copy_languages(p, from->content_languages);
+        to->content_charset = apr_pstrdup(p, from->content_charset);
+        to->description = apr_pstrdup(p, from->description);
+    }
+}
+
+static int neg_cache_enabled(negotiation_state *neg)
+{
+    return neg->conf->cache == 1 && neg_cache && !neg->skip_cache;
+}
+
+/* Look up key, and copy its variants to neg->avail_vars if it is still
+ * valid for mtime and size.
+ */
+static int neg_cache_get(negotiation_state *neg, const char *key,
+                         apr_time_t mtime, apr_off_t size)
+{
+    neg_cache_entry *e;
+    int found = 0;
+
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(neg_cache_mutex);
+#endif
+    e = apr_hash_get(neg_cache, key, APR_HASH_KEY_STRING);
+    if (e && e->mtime == mtime && e->size == size) {
+        copy_variants(neg->pool, neg->avail_vars, e->vars);
+        neg->count_multiviews_variants = e->count_multiviews_variants;
+        neg->cached = 1;
+        found = 1;
+    }
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(neg_cache_mutex);
+#endif
+    return found;
+}
+
+static void neg_cache_set(negotiation_state *neg, const char *key,
+                          apr_time_t mtime, apr_off_t size)
+{
+    neg_cache_entry *e;
+    apr_pool_t *p;
+
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(neg_cache_mutex);
+#endif
+    e = apr_hash_get(neg_cache, key, APR_HASH_KEY_STRING);
+    if (e) {
+        apr_hash_set(neg_cache, key, APR_HASH_KEY_STRING, NULL);
+        apr_pool_destroy(e->pool);
+    }
+    else if (apr_hash_count(neg_cache) >= NEG_CACHE_MAX_ENTRIES) {
+        /* Start over rather than tracking the use of the entries */
+        apr_pool_clear(neg_cache_pool);
+        neg_cache = apr_hash_make(neg_cache_pool);
+    }
+    apr_pool_create(&p, neg_cache_pool);
+    e = apr_palloc(p, sizeof(*e));
+    e->pool = p;
+    e->mtime = mtime;
+    e->size = size;
+    e->vars = apr_array_make(p, neg->avail_vars->nelts, sizeof(var_rec));
+    copy_variants(p, e->vars, neg->avail_vars);
+    e->count_multiviews_variants = neg->count_multiviews_variants;
+    apr_hash_set(neg_cache, apr_pstrdup(p, key), APR_HASH_KEY_STRING, e);
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(neg_cache_mutex);
+#endif
+}
+
 static int read_type_map(apr_file_t **map, negotiation_state *neg,
                          request_rec *rr)
 {
@@ -941,6 +1140,8 @@ static int read_type_map(apr_file_t **map, negotiation_state *neg,
     enum header_state hstate;
     struct var_rec mime_info;
     int has_content;
+    const char *cache_key = NULL;
+    apr_finfo_t finfo;
 
     if (!map)
         map = &map_;
@@ -960,6 +1161,18 @@ static int read_type_map(apr_file_t **map, negotiation_state *neg,
         }
     }
 
+    if (neg_cache_enabled(neg)
+        && apr_file_info_get(&finfo, APR_FINFO_MTIME | APR_FINFO_SIZE,
+                             *map) == APR_SUCCESS) {
+        cache_key = apr_pstrcat(neg->pool, "map:", rr->filename, NULL);
+        if (neg_cache_get(neg, cache_key, finfo.mtime, finfo.size)) {
+            if (map_)
+                apr_file_close(map_);
+            set_vlist_validator(r, rr);
+            return OK;
+        }
+    }
+
     clean_var_rec(&mime_info);
     has_content = 0;
 
@@ -1052,6 +1265,10 @@ static int read_type_map(apr_file_t **map, negotiation_state *neg,
     if (map_)
         apr_file_close(map_);
 
+    if (cache_key) {
+        neg_cache_set(neg, cache_key, finfo.mtime, finfo.size);
+    }
+
     set_vlist_validator(r, rr);
 
     return OK;
@@ -1094,6 +1311,9 @@ static int read_types_multi(negotiation_state *neg)
     struct accept_rec accept_info;
     void *new_var;
     int anymatch = 0;
+    const char *cache_key = NULL;
+    apr_finfo_t finfo;
+    int cacheable = 1;
 
     clean_var_rec(&mime_info);
 
@@ -1109,6 +1329,20 @@ static int read_types_multi(negotiation_state *neg)
     ++filp;
     prefix_len = strlen(filp);
 
+    /* The variants depend on the configuration, which may differ by
+     * server and URI for the same file name.
+     */
+    if (neg_cache_enabled(neg)
+        && apr_stat(&finfo, neg->dir_name, APR_FINFO_MTIME,
+                    neg->pool) == APR_SUCCESS) {
+        cache_key = apr_psprintf(neg->pool, "multi:%pp:%s:%s", r->server,
+                                 r->uri, r->filename);
+        if (neg_cache_get(neg, cache_key, finfo.mtime, 0)) {
+            set_vlist_validator(r, r);
+            return OK;
+        }
+    }
+
     if ((status = apr_dir_open(&dirp, neg->dir_name,
                                neg->pool)) != APR_SUCCESS) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, status, r, APLOGNO(00686)
@@ -1232,7 +1466,12 @@ static int read_types_multi(negotiation_state *neg)
         /*
          * If we failed the subrequest, or don't
          * know what we are serving, then continue.
+         * The failure may be specific to this request (access
+         * control), so don't cache what was found.
          */
+        if (sub_req->status != HTTP_OK) {
+            cacheable = 0;
+        }
         if (sub_req->status != HTTP_OK || (!sub_req->content_type)) {
             ap_destroy_sub_req(sub_req);
             continue;
@@ -1257,6 +1496,7 @@ static int read_types_multi(negotiation_state *neg)
         /* Have reasonable variant --- gather notes. */
 
         mime_info.sub_req = sub_req;
+        mime_info.has_handler = (sub_req->handler != NULL);
         mime_info.file_name = apr_pstrdup(neg->pool, dirent.name);
         if (sub_req->content_encoding) {
             mime_info.content_encoding = sub_req->content_encoding;
@@ -1303,6 +1543,10 @@ static int read_types_multi(negotiation_state *neg)
     qsort((void *) neg->avail_vars->elts, neg->avail_vars->nelts,
           sizeof(var_rec), (int (*)(const void *, const void *)) variantsortf);
 
+    if (cache_key && cacheable) {
+        neg_cache_set(neg, cache_key, finfo.mtime, 0);
+    }
+
     return OK;
 }
 
@@ -1746,8 +1990,8 @@ static apr_off_t find_content_length(negotiation_state *neg, var_rec *variant)
             char *fullname = ap_make_full_path(neg->pool, neg->dir_name,
                                                variant->file_name);
 
-            if (apr_stat(&statb, fullname,
-                         APR_FINFO_SIZE, neg->pool) == APR_SUCCESS) {
+            if (ap_stat_cached(&statb, fullname,
+                               APR_FINFO_SIZE, neg->pool) == APR_SUCCESS) {
                 variant->bytes = statb.size;
             }
         }
@@ -2573,7 +2817,8 @@ static void set_neg_headers(request_rec *r, negotiation_state *neg,
          * (without breaking things if the type map specifies a
          * content-length, which currently leads to the correct result).
          */
-        if (!(variant->sub_req && variant->sub_req->handler)
+        if (!(variant->has_handler
+              || (variant->sub_req && variant->sub_req->handler))
             && (len = find_content_length(neg, variant)) >= 0) {
 
             *((const char **) apr_array_push(arr)) = " {length ";
@@ -2705,6 +2950,7 @@ static int setup_choice_response(request_rec *r, negotiation_state *neg,
         if (status != HTTP_OK &&
             !apr_table_get(sub_req->err_headers_out, "TCN")) {
             ap_destroy_sub_req(sub_req);
+            neg->variant_failed = 1;
             return status;
         }
         variant->sub_req = sub_req;
@@ -3085,6 +3331,7 @@ static int handle_multi(request_rec *r)
 
     neg = parse_accept_headers(r);
 
+  find_variants:
     if ((res = read_types_multi(neg))) {
       return_from_multi:
         /* free all allocated memory from subrequests */
@@ -3104,18 +3351,25 @@ static int handle_multi(request_rec *r)
     res = do_negotiation(r, neg, &best,
                          (r->method_number != M_GET) || r->args ||
                          (r->path_info && *r->path_info));
-    if (res != 0)
+    if (res != 0) {
+        if (neg->cached && neg->variant_failed) {
+            goto find_uncached;
+        }
         goto return_from_multi;
+    }
 
     if (!(sub_req = best->sub_req)) {
-        /* We got this out of a map file, so we don't actually have
-         * a sub_req structure yet.  Get one now.
+        /* We got this out of a map file or the cache, so we don't
+         * actually have a sub_req structure yet.  Get one now.
          */
 
         sub_req = ap_sub_req_lookup_file(best->file_name, r, r->output_filters);
         if (sub_req->status != HTTP_OK) {
             res = sub_req->status;
             ap_destroy_sub_req(sub_req);
+            if (neg->cached) {
+                goto find_uncached;
+            }
             goto return_from_multi;
         }
     }
@@ -3143,6 +3397,15 @@ static int handle_multi(request_rec *r)
         }
     }
     return OK;
+
+  find_uncached:
+    /* The cached variant is not available to this request, choose among
+     * the ones it can access, as found by their subrequests.
+     */
+    apr_table_unset(r->err_headers_out, "Alternates");
+    neg = parse_accept_headers(r);
+    neg->skip_cache = 1;
+    goto find_variants;
 }
 
 /**********************************************************************
@@ -3209,6 +3472,7 @@ static void register_hooks(apr_pool_t *p)
     ap_hook_fixups(fix_encoding,NULL,NULL,APR_HOOK_MIDDLE);
     ap_hook_type_checker(handle_multi,NULL,NULL,APR_HOOK_FIRST);
     ap_hook_handler(handle_map_file,NULL,NULL,APR_HOOK_MIDDLE);
+    ap_hook_child_init(neg_child_init,NULL,NULL,APR_HOOK_MIDDLE);
 }
 
 AP_DECLARE_MODULE(negotiation) =
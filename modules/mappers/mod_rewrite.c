@@ -54,6 +54,7 @@
 #include "apr_global_mutex.h"
 #include "apr_dbm.h"
 #include "apr_dbd.h"
+#include "apr_mmap.h"
 
 #include "apr_version.h"
 #if !APR_VERSION_AT_LEAST(2,0,0)
@@ -91,6 +92,8 @@
 #include "http_ssl.h"
 #include "http_vhost.h"
 #include "util_mutex.h"
+#include "ap_socache.h"
+#include "ap_mpm.h"
 
 #include "mod_rewrite.h"
 #include "ap_expr.h"
@@ -189,6 +192,7 @@ static const char* really_last_key = "rewrite_really_last";
 #define MAPTYPE_RND                 (1<<4)
 #define MAPTYPE_DBD                 (1<<5)
 #define MAPTYPE_DBD_CACHE           (1<<6)
+#define MAPTYPE_IDX                 (1<<7)
 
 #define ENGINE_DISABLED             (1<<0)
 #define ENGINE_ENABLED              (1<<1)
@@ -215,6 +219,28 @@ static const char* really_last_key = "rewrite_really_last";
 #define REWRITE_MAX_TXT_MAP_LINE 1024
 #endif
 
+/* layout of the idx: map files written by httxt2dbm -f IDX (keep in sync
+ * with support/httxt2dbm.c): a header, a power of two sized table of
+ * (hash, offset) slots probed linearly, then the "key\0value\0" records.
+ * Offset 0 marks an empty slot. Everything is in host byte order.
+ */
+#define REWRITE_IDX_MAGIC     "RWMAPIDX"
+#define REWRITE_IDX_BYTEORDER 0x01020304
+#define REWRITE_IDX_VERSION   1
+
+typedef struct {
+    char        magic[8];
+    apr_uint32_t byteorder;
+    apr_uint32_t version;
+    apr_uint32_t nslots;
+    apr_uint32_t nkeys;
+} rewrite_idx_header;
+
+typedef struct {
+    apr_uint32_t hash;
+    apr_uint32_t offset;
+} rewrite_idx_slot;
+
 /* buffer length for prg rewrite maps */
 #ifndef REWRITE_PRG_MAP_BUF
 #define REWRITE_PRG_MAP_BUF 1024
@@ -257,6 +283,7 @@ typedef struct {
     const char *dbmtype;           /* dbm type for dbm map data files     */
     const char *checkfile;         /* filename to check for map existence */
     const char *cachename;         /* for cached maps (txt/rnd/dbm)       */
+    const char *shcachename;       /* for the shared cache, config stable */
     int   type;                    /* the type of the map                 */
     apr_file_t *fpin;              /* in  file pointer for program maps   */
     apr_file_t *fpout;             /* out file pointer for program maps   */
@@ -269,6 +296,10 @@ typedef struct {
                                       NULL if only one file               */
     const char *user;              /* run RewriteMap program as this user */
     const char *group;             /* run RewriteMap program as this group */
+#if APR_HAS_MMAP
+    apr_mmap_t *idxmap;            /* idx map mapped at config time       */
+    apr_time_t idxmtime;           /* mtime of the file when it was mapped */
+#endif
 } rewritemap_entry;
 
 /* special pattern types for RewriteCond */
@@ -324,6 +355,9 @@ typedef struct {
     int        skip;                 /* number of next rules to skip          */
     int        maxrounds;            /* limit on number of loops with N flag  */
     char       *escapes;             /* specific backref escapes              */
+    char       *prefix;              /* literal the uri must start with       */
+    apr_size_t  prefix_len;          /* (NULL/0 if the pattern isn't anchored)*/
+    int         prefix_nocase;       /* prefix compared case insensitively    */
 } rewriterule_entry;
 
 typedef struct {
@@ -415,6 +449,21 @@ static apr_hash_t *mapfunc_hash;
 /* the cache */
 static cache *cachep;
 
+/* the cross-process cache (RewriteMapCache), retained across restarts */
+typedef struct {
+    const char *args;              /* provider[:args] it was created with */
+    ap_socache_provider_t *provider;
+    ap_socache_instance_t *instance;
+    apr_global_mutex_t *mutex;     /* if the provider is not MP safe      */
+} rewrite_shcache;
+static rewrite_shcache *shcache;
+static const char *shcache_args;
+static apr_interval_time_t shcache_ttl;
+static apr_interval_time_t shcache_negttl;
+static const char *rewritemapcache_mutex_type = "rewrite-mapcache";
+#define REWRITE_SHCACHE_TTL     apr_time_from_sec(300)
+#define REWRITE_SHCACHE_VALMAX  HUGE_STRING_LEN
+
 /* whether proxy module is available or not */
 static int proxy_available;
 
@@ -1047,8 +1096,8 @@ static char *subst_prefix_path(request_rec *r, char *input, const char *match,
  * +-------------------------------------------------------+
  */
 
-static void set_cache_value(const char *name, apr_time_t t, char *key,
-                            char *val)
+static void set_local_cache_value(const char *name, apr_time_t t, char *key,
+                                  char *val)
 {
     cachedmap *map;
 
@@ -1100,8 +1149,8 @@ static void set_cache_value(const char *name, apr_time_t t, char *key,
     return;
 }
 
-static char *get_cache_value(const char *name, apr_time_t t, char *key,
-                             apr_pool_t *p)
+static char *get_local_cache_value(const char *name, apr_time_t t, char *key,
+                                   apr_pool_t *p)
 {
     cachedmap *map;
     char *val = NULL;
@@ -1138,6 +1187,90 @@ static char *get_cache_value(const char *name, apr_time_t t, char *key,
     return val;
 }
 
+/* The shared cache keys are "<shcachename>:<mtime>:<key>", so that they
+ * don't depend on this generation's pointers and outdated map files' ones
+ * won't be found anymore.
+ */
+static const char *shared_cache_key(request_rec *r, rewritemap_entry *s,
+                                    apr_time_t t, const char *key)
+{
+    return apr_psprintf(r->pool, "%s:%" APR_TIME_T_FMT ":%s",
+                        s->shcachename, t, key);
+}
+
+static APR_INLINE void shared_cache_lock(request_rec *r)
+{
+    if (shcache->mutex) {
+        apr_status_t rv = apr_global_mutex_lock(shcache->mutex);
+        if (rv != APR_SUCCESS) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(10410)
+                          "mod_rewrite: can't lock the map cache");
+        }
+    }
+}
+
+static APR_INLINE void shared_cache_unlock(request_rec *r)
+{
+    if (shcache->mutex) {
+        apr_global_mutex_unlock(shcache->mutex);
+    }
+}
+
+static void set_cache_value(request_rec *r, rewritemap_entry *s,
+                            apr_time_t t, char *key, char *val)
+{
+    set_local_cache_value(s->cachename, t, key, val);
+
+    if (shcache && shcache->instance) {
+        const char *id = shared_cache_key(r, s, t, key);
+        apr_size_t len = strlen(val);
+        apr_time_t expiry;
+        apr_status_t rv;
+
+        if (len >= REWRITE_SHCACHE_VALMAX) {
+            return;
+        }
+        expiry = apr_time_now() + (*val ? shcache_ttl : shcache_negttl);
+
+        shared_cache_lock(r);
+        rv = shcache->provider->store(shcache->instance, r->server,
+                                      (unsigned char *)id, strlen(id),
+                                      expiry, (unsigned char *)val, len,
+                                      r->pool);
+        shared_cache_unlock(r);
+        if (rv != APR_SUCCESS) {
+            rewritelog(r, 5, NULL, "shared cache store failed: key=%s", id);
+        }
+    }
+}
+
+static char *get_cache_value(request_rec *r, rewritemap_entry *s,
+                             apr_time_t t, char *key)
+{
+    char *val = get_local_cache_value(s->cachename, t, key, r->pool);
+
+    if (!val && shcache && shcache->instance) {
+        const char *id = shared_cache_key(r, s, t, key);
+        unsigned char buf[REWRITE_SHCACHE_VALMAX];
+        unsigned int len = sizeof(buf) - 1;
+        apr_status_t rv;
+
+        shared_cache_lock(r);
+        rv = shcache->provider->retrieve(shcache->instance, r->server,
+                                         (unsigned char *)id, strlen(id),
+                                         buf, &len, r->pool);
+        shared_cache_unlock(r);
+        if (rv == APR_SUCCESS) {
+            val = apr_pstrmemdup(r->pool, (char *)buf, len);
+            rewritelog(r, 6, NULL, "shared cache lookup OK: key=%s", id);
+            /* Don't go through the shared cache for this child anymore */
+            set_local_cache_value(s->cachename, t, key, val);
+        }
+    }
+
+    return val;
+}
+
 static int init_cache(apr_pool_t *p)
 {
     cachep = apr_palloc(p, sizeof(cache));
@@ -1441,6 +1574,117 @@ static char *lookup_map_dbmfile(request_rec *r, const char *file,
 
     return value;
 }
+#if APR_HAS_MMAP
+/* FNV-1a, the same as httxt2dbm uses when building the index */
+static apr_uint32_t idx_hash(const char *key, apr_size_t len)
+{
+    apr_uint32_t h = 2166136261U;
+
+    while (len--) {
+        h ^= (unsigned char)*key++;
+        h *= 16777619U;
+    }
+
+    return h;
+}
+
+/*
+ * Map an index file and validate its header, so that lookups only have to
+ * bounds check the records they touch.
+ */
+static apr_status_t idx_map(apr_pool_t *p, const char *file,
+                            apr_mmap_t **mm, apr_time_t *mtime,
+                            const char **err)
+{
+    const rewrite_idx_header *hdr;
+    apr_file_t *fp;
+    apr_finfo_t finfo;
+    apr_status_t rv;
+
+    *err = NULL;
+
+    rv = apr_file_open(&fp, file, APR_READ, APR_OS_DEFAULT, p);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+    rv = apr_file_info_get(&finfo, APR_FINFO_SIZE | APR_FINFO_MTIME, fp);
+    if (rv == APR_SUCCESS
+        && finfo.size < (apr_off_t)sizeof(rewrite_idx_header)) {
+        *err = "file too short";
+        rv = APR_EINVAL;
+    }
+    if (rv == APR_SUCCESS) {
+        rv = apr_mmap_create(mm, fp, 0, (apr_size_t)finfo.size,
+                             APR_MMAP_READ, p);
+    }
+    apr_file_close(fp);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+
+    hdr = (*mm)->mm;
+    if (memcmp(hdr->magic, REWRITE_IDX_MAGIC, sizeof(hdr->magic))) {
+        *err = "not an httxt2dbm index";
+    }
+    else if (hdr->byteorder != REWRITE_IDX_BYTEORDER) {
+        *err = "index was built on a host with another byte order";
+    }
+    else if (hdr->version != REWRITE_IDX_VERSION) {
+        *err = "unsupported index version";
+    }
+    else if (!hdr->nslots || (hdr->nslots & (hdr->nslots - 1))
+             || (apr_uint64_t)hdr->nslots * sizeof(rewrite_idx_slot)
+                > (*mm)->size - sizeof(*hdr)) {
+        *err = "corrupt slot table";
+    }
+    if (*err) {
+        apr_mmap_delete(*mm);
+        *mm = NULL;
+        return APR_EINVAL;
+    }
+
+    *mtime = finfo.mtime;
+    return APR_SUCCESS;
+}
+
+static char *lookup_map_idx(request_rec *r, apr_mmap_t *mm, const char *key)
+{
+    const char *base = mm->mm;
+    const rewrite_idx_header *hdr = mm->mm;
+    const rewrite_idx_slot *slots = (const rewrite_idx_slot *)(hdr + 1);
+    apr_size_t klen = strlen(key);
+    apr_uint32_t mask = hdr->nslots - 1;
+    apr_uint32_t h = idx_hash(key, klen);
+    apr_uint32_t i;
+
+    for (i = 0; i <= mask; ++i) {
+        const rewrite_idx_slot *slot = &slots[(h + i) & mask];
+        apr_size_t avail;
+        const char *val, *end;
+
+        if (!slot->offset) {
+            break;
+        }
+        if (slot->hash != h || slot->offset >= mm->size
+            || mm->size - slot->offset <= klen + 1
+            || memcmp(base + slot->offset, key, klen)
+            || base[slot->offset + klen]) {
+            continue;
+        }
+
+        val = base + slot->offset + klen + 1;
+        avail = mm->size - (slot->offset + klen + 1);
+        end = memchr(val, '\0', avail);
+        if (!end || end == val) {
+            return NULL;
+        }
+        return apr_pstrmemdup(r->pool, val, end - val);
+    }
+
+    return NULL;
+}
+#endif /* APR_HAS_MMAP */
+
 static char *lookup_map_dbd(request_rec *r, char *key, const char *label)
 {
     apr_status_t rv;
@@ -1698,7 +1942,7 @@ static char *lookup_map(request_rec *r, char *name, char *key)
             return NULL;
         }
 
-        value = get_cache_value(s->cachename, st.mtime, key, r->pool);
+        value = get_cache_value(r, s, st.mtime, key);
         if (!value) {
             rewritelog(r, 6, NULL,
                        "cache lookup FAILED, forcing new map lookup");
@@ -1707,13 +1951,13 @@ static char *lookup_map(request_rec *r, char *name, char *key)
             if (!value) {
                 rewritelog(r, 5, NULL, "map lookup FAILED: map=%s[txt] key=%s",
                            name, key);
-                set_cache_value(s->cachename, st.mtime, key, "");
+                set_cache_value(r, s, st.mtime, key, "");
                 return NULL;
             }
 
             rewritelog(r, 5, NULL, "map lookup OK: map=%s[txt] key=%s -> val=%s",
                        name, key, value);
-            set_cache_value(s->cachename, st.mtime, key, value);
+            set_cache_value(r, s, st.mtime, key, value);
         }
         else {
             rewritelog(r, 5, NULL, "cache lookup OK: map=%s[txt] key=%s -> val=%s",
@@ -1754,7 +1998,7 @@ static char *lookup_map(request_rec *r, char *name, char *key)
             return NULL;
         }
 
-        value = get_cache_value(s->cachename, st.mtime, key, r->pool);
+        value = get_cache_value(r, s, st.mtime, key);
         if (!value) {
             rewritelog(r, 6, NULL,
                        "cache lookup FAILED, forcing new map lookup");
@@ -1763,14 +2007,14 @@ static char *lookup_map(request_rec *r, char *name, char *key)
             if (!value) {
                 rewritelog(r, 5, NULL, "map lookup FAILED: map=%s[dbm] key=%s",
                            name, key);
-                set_cache_value(s->cachename, st.mtime, key, "");
+                set_cache_value(r, s, st.mtime, key, "");
                 return NULL;
             }
 
             rewritelog(r, 5, NULL, "map lookup OK: map=%s[dbm] key=%s -> "
                        "val=%s", name, key, value);
 
-            set_cache_value(s->cachename, st.mtime, key, value);
+            set_cache_value(r, s, st.mtime, key, value);
             return value;
         }
 
@@ -1778,6 +2022,53 @@ static char *lookup_map(request_rec *r, char *name, char *key)
                    name, key, value);
         return *value ? value : NULL;
 
+#if APR_HAS_MMAP
+    /*
+     * Memory mapped index, shared by all children
+     */
+    case MAPTYPE_IDX: {
+        apr_mmap_t *mm = s->idxmap;
+
+        rv = apr_stat(&st, s->checkfile, APR_FINFO_MIN, r->pool);
+        if (rv != APR_SUCCESS) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(10416)
+                          "mod_rewrite: can't access idx RewriteMap file %s",
+                          s->checkfile);
+            return NULL;
+        }
+
+        /* The file was replaced since the (re)start: map the new one for
+         * this request only, the shared mapping is renewed on restart.
+         */
+        if (st.mtime != s->idxmtime) {
+            const char *err;
+            apr_time_t mtime;
+
+            rewritelog(r, 6, NULL, "idx map %s changed, mapping it for "
+                       "this request", name);
+            rv = idx_map(r->pool, s->datafile, &mm, &mtime, &err);
+            if (rv != APR_SUCCESS) {
+                ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(10417)
+                              "mod_rewrite: can't map idx RewriteMap "
+                              "file %s%s%s", s->datafile,
+                              err ? ": " : "", err ? err : "");
+                return NULL;
+            }
+        }
+
+        value = lookup_map_idx(r, mm, key);
+        if (!value) {
+            rewritelog(r, 5, NULL, "map lookup FAILED: map=%s[idx] key=%s",
+                       name, key);
+            return NULL;
+        }
+
+        rewritelog(r, 5, NULL, "map lookup OK: map=%s[idx] key=%s -> val=%s",
+                   name, key, value);
+        return value;
+    }
+#endif
+
     /*
      * SQL map without cache
      */
@@ -1798,7 +2089,7 @@ static char *lookup_map(request_rec *r, char *name, char *key)
      * SQL map with cache
      */
     case MAPTYPE_DBD_CACHE:
-        value = get_cache_value(s->cachename, 0, key, r->pool);
+        value = get_cache_value(r, s, 0, key);
         if (!value) {
             rewritelog(r, 6, NULL,
                        "cache lookup FAILED, forcing new map lookup");
@@ -1807,14 +2098,14 @@ static char *lookup_map(request_rec *r, char *name, char *key)
             if (!value) {
                 rewritelog(r, 5, NULL, "SQL map lookup FAILED: map %s key=%s",
                            name, key);
-                set_cache_value(s->cachename, 0, key, "");
+                set_cache_value(r, s, 0, key, "");
                 return NULL;
             }
 
             rewritelog(r, 5, NULL, "SQL map lookup OK: map %s key=%s, val=%s",
                        name, key, value);
 
-            set_cache_value(s->cachename, 0, key, value);
+            set_cache_value(r, s, 0, key, value);
             return value;
         }
 
@@ -3209,6 +3500,33 @@ static const char *cmd_rewritemap(cmd_parms *cmd, void *dconf, const char *a1,
                                newmap->dbmtype, " is invalid", NULL);
         }
     }
+    else if (strncasecmp(a2, "idx:", 4) == 0) {
+#if APR_HAS_MMAP
+        const char *err;
+        apr_status_t rv;
+
+        if ((fname = ap_server_root_relative(cmd->pool, a2+4)) == NULL) {
+            return apr_pstrcat(cmd->pool, "RewriteMap: bad path to idx map: ",
+                               a2+4, NULL);
+        }
+
+        newmap->type      = MAPTYPE_IDX;
+        newmap->datafile  = fname;
+        newmap->checkfile = fname;
+
+        /* mapped once here in the parent, the children share the pages */
+        rv = idx_map(cmd->pool, fname, &newmap->idxmap, &newmap->idxmtime,
+                     &err);
+        if (rv != APR_SUCCESS) {
+            return apr_psprintf(cmd->pool, "RewriteMap: can't map idx map "
+                                "%s: %s", fname,
+                                err ? err : apr_psprintf(cmd->pool, "%pm",
+                                                         &rv));
+        }
+#else
+        return "RewriteMap: idx maps are not supported on this platform";
+#endif
+    }
     else if ((strncasecmp(a2, "dbd:", 4) == 0)
              || (strncasecmp(a2, "fastdbd:", 8) == 0)) {
         if (dbd_prepare == NULL) {
@@ -3277,11 +3595,50 @@ static const char *cmd_rewritemap(cmd_parms *cmd, void *dconf, const char *a1,
                            " not found:", newmap->checkfile, NULL);
     }
 
+    if (newmap->cachename) {
+        newmap->shcachename = apr_psprintf(cmd->pool, "%s:%u:%s:%s",
+                                           cmd->server->defn_name
+                                           ? cmd->server->defn_name : "",
+                                           cmd->server->defn_line_number,
+                                           a1, a2);
+    }
+
     apr_hash_set(sconf->rewritemaps, a1, APR_HASH_KEY_STRING, newmap);
 
     return NULL;
 }
 
+static const char *cmd_rewritemapcache(cmd_parms *cmd, void *dconf,
+                                       const char *a1, const char *a2,
+                                       const char *a3)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+    apr_interval_time_t ttl;
+
+    if (err != NULL) {
+        return err;
+    }
+
+    shcache_args = a1;
+    shcache_ttl = shcache_negttl = REWRITE_SHCACHE_TTL;
+    if (a2) {
+        if (ap_timeout_parameter_parse(a2, &ttl, "s") != APR_SUCCESS
+                || ttl <= 0) {
+            return "RewriteMapCache: invalid TTL";
+        }
+        shcache_ttl = shcache_negttl = ttl;
+    }
+    if (a3) {
+        if (ap_timeout_parameter_parse(a3, &ttl, "s") != APR_SUCCESS
+                || ttl <= 0) {
+            return "RewriteMapCache: invalid negative TTL";
+        }
+        shcache_negttl = ttl;
+    }
+
+    return NULL;
+}
+
 static const char *cmd_rewritebase(cmd_parms *cmd, void *in_dconf,
                                    const char *a1)
 {
@@ -3814,6 +4171,56 @@ static const char *cmd_rewriterule_setflag(apr_pool_t *p, void *_cfg,
     return NULL;
 }
 
+/* Extract the literal prefix of an anchored ('^...') pattern, any uri the
+ * pattern matches has to start with it, so that apply_rewrite_rule() can
+ * avoid running the regex for an uri which doesn't.
+ */
+static void rewriterule_prefix(apr_pool_t *p, rewriterule_entry *rule)
+{
+    const char *pat = rule->pattern;
+    char *prefix;
+    apr_size_t len = 0;
+
+    rule->prefix = NULL;
+    rule->prefix_len = 0;
+    if (*pat++ != '^' || ap_strchr_c(pat, '|')) {
+        /* Not anchored, or alternatives */
+        return;
+    }
+
+    prefix = apr_palloc(p, strlen(pat) + 1);
+    while (*pat) {
+        char ch = *pat;
+        if (ch == '\\') {
+            /* An escaped non-alphanumeric is a literal */
+            if (!pat[1] || apr_isalnum(pat[1])) {
+                break;
+            }
+            ch = pat[1];
+            pat += 2;
+        }
+        else if (ap_strchr_c(".[]()*+?{}^$", ch)) {
+            break;
+        }
+        else {
+            pat++;
+        }
+        if (*pat == '*' || *pat == '?' || *pat == '{') {
+            /* Quantified, thus optional */
+            break;
+        }
+        prefix[len++] = ch;
+    }
+    if (len) {
+        prefix[len] = '\0';
+        rule->prefix = prefix;
+        rule->prefix_len = len;
+        rule->prefix_nocase = ((rule->flags & RULEFLAG_NOCASE)
+                               || (ap_regcomp_get_default_cflags()
+                                   & AP_REG_ICASE));
+    }
+}
+
 static const char *cmd_rewriterule(cmd_parms *cmd, void *in_dconf,
                                    const char *in_str)
 {
@@ -3877,6 +4284,7 @@ static const char *cmd_rewriterule(cmd_parms *cmd, void *in_dconf,
 
     newrule->pattern = a1;
     newrule->regexp  = regexp;
+    rewriterule_prefix(cmd->pool, newrule);
 
     /* arg2: the output string */
     newrule->output = a2;
@@ -4188,7 +4596,16 @@ static int apply_rewrite_rule(rewriterule_entry *p, rewrite_ctx *ctx)
     rewritelog(r, 3, ctx->perdir, "applying pattern '%s' to uri '%s'",
                 p->pattern, ctx->uri);
 
-    rc = !ap_regexec(p->regexp, ctx->uri, AP_MAX_REG_MATCH, regmatch, 0);
+    if (p->prefix_len
+            && (p->prefix_nocase
+                ? ap_cstr_casecmpn(ctx->uri, p->prefix, p->prefix_len)
+                : strncmp(ctx->uri, p->prefix, p->prefix_len))) {
+        /* Can't match, save the regex */
+        rc = 0;
+    }
+    else {
+        rc = !ap_regexec(p->regexp, ctx->uri, AP_MAX_REG_MATCH, regmatch, 0);
+    }
     if (! (( rc && !(p->flags & RULEFLAG_NOTMATCH)) ||
            (!rc &&  (p->flags & RULEFLAG_NOTMATCH))   ) ) {
         return 0;
@@ -4566,6 +4983,9 @@ static int pre_config(apr_pool_t *pconf,
 
     rewrite_lock_needed = 0; 
     ap_mutex_register(pconf, rewritemap_mutex_type, NULL, APR_LOCK_DEFAULT, 0);
+    ap_mutex_register(pconf, rewritemapcache_mutex_type, NULL,
+                      APR_LOCK_DEFAULT, 0);
+    shcache_args = NULL;
 
     /* register int: rewritemap handlers */
     map_pfn_register = APR_RETRIEVE_OPTIONAL_FN(ap_register_rewrite_mapfunc);
@@ -4580,12 +5000,89 @@ static int pre_config(apr_pool_t *pconf,
     return OK;
 }
 
+/* Create the RewriteMapCache once and for all (i.e. in the process pool),
+ * so that it remains warm across restarts.
+ */
+static int init_shared_cache(server_rec *s, apr_pool_t *ptemp)
+{
+    static struct ap_socache_hints hints = {64, 64, 0};
+    apr_pool_t *pproc = s->process->pool;
+    const char *name, *sep, *err;
+    apr_status_t rv;
+
+    if (!shcache) {
+        shcache = ap_retained_data_get("mod_rewrite-mapcache");
+        if (!shcache) {
+            shcache = ap_retained_data_create("mod_rewrite-mapcache",
+                                              sizeof(*shcache));
+        }
+    }
+    if (!shcache_args) {
+        /* Keep it for a later generation that wants it again */
+        return OK;
+    }
+    if (shcache->instance) {
+        if (strcmp(shcache->args, shcache_args)) {
+            ap_log_error(APLOG_MARK, APLOG_NOTICE, 0, s, APLOGNO(10411)
+                         "mod_rewrite: RewriteMapCache %s still used, "
+                         "a full restart is required for %s",
+                         shcache->args, shcache_args);
+        }
+        return OK;
+    }
+
+    sep = ap_strchr_c(shcache_args, ':');
+    name = sep ? apr_pstrmemdup(ptemp, shcache_args, sep++ - shcache_args)
+               : shcache_args;
+    shcache->provider = ap_lookup_provider(AP_SOCACHE_PROVIDER_GROUP, name,
+                                           AP_SOCACHE_PROVIDER_VERSION);
+    if (!shcache->provider) {
+        ap_log_error(APLOG_MARK, APLOG_CRIT, 0, s, APLOGNO(10412)
+                     "mod_rewrite: unknown RewriteMapCache provider '%s', "
+                     "maybe you need to load mod_socache_%s?", name, name);
+        return HTTP_INTERNAL_SERVER_ERROR;
+    }
+    if ((err = shcache->provider->create(&shcache->instance, sep,
+                                         ptemp, pproc))) {
+        ap_log_error(APLOG_MARK, APLOG_CRIT, 0, s, APLOGNO(10413)
+                     "mod_rewrite: RewriteMapCache: %s", err);
+        shcache->instance = NULL;
+        return HTTP_INTERNAL_SERVER_ERROR;
+    }
+    if (shcache->provider->flags & AP_SOCACHE_FLAG_NOTMPSAFE) {
+        rv = ap_global_mutex_create(&shcache->mutex, NULL,
+                                    rewritemapcache_mutex_type, NULL,
+                                    s, pproc, 0);
+        if (rv != APR_SUCCESS) {
+            shcache->instance = NULL;
+            return HTTP_INTERNAL_SERVER_ERROR;
+        }
+    }
+    hints.expiry_interval = shcache_ttl;
+    rv = shcache->provider->init(shcache->instance, "mod_rewrite-mapcache",
+                                 &hints, s, pproc);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_CRIT, rv, s, APLOGNO(10414)
+                     "mod_rewrite: could not initialize RewriteMapCache");
+        shcache->instance = NULL;
+        return HTTP_INTERNAL_SERVER_ERROR;
+    }
+    shcache->args = apr_pstrdup(pproc, shcache_args);
+
+    return OK;
+}
+
 static int post_config(apr_pool_t *p,
                        apr_pool_t *plog,
                        apr_pool_t *ptemp,
                        server_rec *s)
 {
     apr_status_t rv;
+    int rc;
+
+    if ((rc = init_shared_cache(s, ptemp)) != OK) {
+        return rc;
+    }
 
     /* check if proxy module is available */
     proxy_available = (ap_find_linked_module("mod_proxy.c") != NULL);
@@ -4628,6 +5125,20 @@ static void init_child(apr_pool_t *p, server_rec *s)
         }
     }
 
+    if (shcache && shcache->mutex) {
+        rv = apr_global_mutex_child_init(&shcache->mutex,
+                 apr_global_mutex_lockfile(shcache->mutex), p);
+        if (rv != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_CRIT, rv, s, APLOGNO(10415)
+                         "mod_rewrite: could not init the RewriteMapCache "
+                         "mutex in child");
+        }
+    }
+    if (shcache && !shcache_args) {
+        /* Not configured for this generation */
+        shcache = NULL;
+    }
+
     /* create the lookup cache */
     if (!init_cache(p)) {
         ap_log_error(APLOG_MARK, APLOG_CRIT, rv, s, APLOGNO(00667)
@@ -5412,6 +5923,10 @@ static const command_rec command_table[] = {
                      "an URL-applied regexp-pattern and a substitution URL"),
     AP_INIT_TAKE23(   "RewriteMap",      cmd_rewritemap,      NULL, RSRC_CONF,
                      "a mapname and a filename and options"),
+    AP_INIT_TAKE123(  "RewriteMapCache", cmd_rewritemapcache, NULL, RSRC_CONF,
+                     "a socache provider[:args] to share the maps' lookups "
+                     "between the children, optionally followed by the TTL "
+                     "and negative TTL (default 300 seconds)"),
     { NULL }
 };
 
@@ -39,7 +39,13 @@
 #include "apr_lib.h"
 
 #define APR_WANT_STRFUNC
+#define APR_WANT_IOVEC
 #include "apr_want.h"
+#include "apr_hash.h"
+#include "apr_ring.h"
+#if APR_HAS_THREADS
+#include "apr_thread_mutex.h"
+#endif
 
 #include "httpd.h"
 #include "http_config.h"
@@ -59,6 +65,55 @@ typedef enum {
     VHOST_ALIAS_UNSET, VHOST_ALIAS_NONE, VHOST_ALIAS_NAME, VHOST_ALIAS_IP
 } mva_mode_e;
 
+/*
+ * The format strings are compiled by vhost_alias_set() into a list of
+ * operations, run by vhost_alias_interpolate() for each request.
+ */
+typedef enum {
+    MVA_OP_TEXT,    /* copy text */
+    MVA_OP_PORT,    /* %p */
+    MVA_OP_PART     /* %N.M */
+} mva_op_e;
+
+typedef struct mva_op_t {
+    mva_op_e type;
+    const char *text;
+    apr_size_t len;
+    int N, M, Np, Mp, Nd, Md;
+} mva_op_t;
+
+/*
+ * The interpolated roots of a child, per name, in least recently used
+ * order (the most recent first).
+ */
+typedef struct mva_entry_t mva_entry_t;
+struct mva_entry_t {
+    APR_RING_ENTRY(mva_entry_t) link;
+    const char *key;
+    apr_size_t klen;
+    const char *root;
+};
+
+typedef struct mva_cache_t {
+    apr_hash_t *entries;
+    APR_RING_HEAD(mva_lru_t, mva_entry_t) lru;
+    int count;
+#if APR_HAS_THREADS
+    apr_thread_mutex_t *mutex;
+#endif
+} mva_cache_t;
+
+typedef struct mva_prog_t {
+    const mva_op_t *ops;
+    int nops;
+    int has_port;
+    mva_cache_t *cache;
+} mva_prog_t;
+
+/* VirtualAliasCacheSize */
+#define MVA_DEFAULT_CACHE_SIZE 1024
+static int mva_cache_size = MVA_DEFAULT_CACHE_SIZE;
+
 /*
  * Per-server module config record.
  */
@@ -67,6 +122,8 @@ typedef struct mva_sconf_t {
     const char *cgi_root;
     mva_mode_e doc_root_mode;
     mva_mode_e cgi_root_mode;
+    mva_prog_t *doc_root_prog;
+    mva_prog_t *cgi_root_prog;
 } mva_sconf_t;
 
 static void *mva_create_server_config(apr_pool_t *p, server_rec *s)
@@ -91,18 +148,22 @@ static void *mva_merge_server_config(apr_pool_t *p, void *parentv, void *childv)
     if (child->doc_root_mode == VHOST_ALIAS_UNSET) {
         conf->doc_root_mode = parent->doc_root_mode;
         conf->doc_root = parent->doc_root;
+        conf->doc_root_prog = parent->doc_root_prog;
     }
     else {
         conf->doc_root_mode = child->doc_root_mode;
         conf->doc_root = child->doc_root;
+        conf->doc_root_prog = child->doc_root_prog;
     }
     if (child->cgi_root_mode == VHOST_ALIAS_UNSET) {
         conf->cgi_root_mode = parent->cgi_root_mode;
         conf->cgi_root = parent->cgi_root;
+        conf->cgi_root_prog = parent->cgi_root_prog;
     }
     else {
         conf->cgi_root_mode = child->cgi_root_mode;
         conf->cgi_root = child->cgi_root;
+        conf->cgi_root_prog = child->cgi_root_prog;
     }
     return conf;
 }
@@ -117,12 +178,107 @@ static int vhost_alias_set_doc_root_ip,
     vhost_alias_set_doc_root_name,
     vhost_alias_set_cgi_root_name;
 
+static mva_op_t *vhost_alias_push_op(apr_array_header_t *ops, mva_op_e type)
+{
+    mva_op_t *op = apr_array_push(ops);
+
+    memset(op, 0, sizeof(*op));
+    op->type = type;
+    return op;
+}
+
+static const char *vhost_alias_compile(apr_pool_t *pool, const char *map,
+                                       mva_prog_t **pprog)
+{
+    apr_array_header_t *ops = apr_array_make(pool, 8, sizeof(mva_op_t));
+    mva_prog_t *prog;
+    mva_op_t *op;
+    const char *p, *text;
+
+    p = map;
+    while (*p != '\0') {
+        if (*p != '%') {
+            /* normal characters, up to the next '%' */
+            text = p;
+            while (*p && *p != '%') {
+                ++p;
+            }
+            op = vhost_alias_push_op(ops, MVA_OP_TEXT);
+            op->text = text;
+            op->len = p - text;
+            continue;
+        }
+        /* we just found a '%' */
+        ++p;
+        if (*p == '%') {
+            op = vhost_alias_push_op(ops, MVA_OP_TEXT);
+            op->text = p++;
+            op->len = 1;
+            continue;
+        }
+        if (*p == 'p') {
+            ++p;
+            vhost_alias_push_op(ops, MVA_OP_PORT);
+            continue;
+        }
+        op = vhost_alias_push_op(ops, MVA_OP_PART);
+        /* optional dash */
+        if (*p == '-') {
+            ++p, op->Nd = 1;
+        }
+        /* digit N */
+        if (apr_isdigit(*p)) {
+            op->N = *p++ - '0';
+        }
+        else {
+            return "syntax error in format string";
+        }
+        /* optional plus */
+        if (*p == '+') {
+            ++p, op->Np = 1;
+        }
+        /* do we end here? */
+        if (*p != '.') {
+            continue;
+        }
+        ++p;
+        /* optional dash */
+        if (*p == '-') {
+            ++p, op->Md = 1;
+        }
+        /* digit M */
+        if (apr_isdigit(*p)) {
+            op->M = *p++ - '0';
+        }
+        else {
+            return "syntax error in format string";
+        }
+        /* optional plus */
+        if (*p == '+') {
+            ++p, op->Mp = 1;
+        }
+    }
+
+    prog = apr_pcalloc(pool, sizeof(*prog));
+    prog->ops = (const mva_op_t *)ops->elts;
+    prog->nops = ops->nelts;
+    for (op = (mva_op_t *)ops->elts; op < (mva_op_t *)ops->elts + ops->nelts;
+         ++op) {
+        if (op->type == MVA_OP_PORT) {
+            prog->has_port = 1;
+        }
+    }
+    *pprog = prog;
+    return NULL;
+}
+
 static const char *vhost_alias_set(cmd_parms *cmd, void *dummy, const char *map)
 {
     mva_sconf_t *conf;
     mva_mode_e mode, *pmode;
+    mva_prog_t **pprog;
     const char **pmap;
-    const char *p;
+    const char *err;
 
     conf = (mva_sconf_t *) ap_get_module_config(cmd->server->module_config,
                                                 &vhost_alias_module);
@@ -131,21 +287,25 @@ static const char *vhost_alias_set(cmd_parms *cmd, void *dummy, const char *map)
         mode = VHOST_ALIAS_IP;
         pmap = &conf->doc_root;
         pmode = &conf->doc_root_mode;
+        pprog = &conf->doc_root_prog;
     }
     else if (&vhost_alias_set_cgi_root_ip == cmd->info) {
         mode = VHOST_ALIAS_IP;
         pmap = &conf->cgi_root;
         pmode = &conf->cgi_root_mode;
+        pprog = &conf->cgi_root_prog;
     }
     else if (&vhost_alias_set_doc_root_name == cmd->info) {
         mode = VHOST_ALIAS_NAME;
         pmap = &conf->doc_root;
         pmode = &conf->doc_root_mode;
+        pprog = &conf->doc_root_prog;
     }
     else if (&vhost_alias_set_cgi_root_name == cmd->info) {
         mode = VHOST_ALIAS_NAME;
         pmap = &conf->cgi_root;
         pmode = &conf->cgi_root_mode;
+        pprog = &conf->cgi_root_prog;
     }
     else {
         return "INTERNAL ERROR: unknown command info";
@@ -157,61 +317,34 @@ static const char *vhost_alias_set(cmd_parms *cmd, void *dummy, const char *map)
         }
         *pmap = NULL;
         *pmode = VHOST_ALIAS_NONE;
+        *pprog = NULL;
         return NULL;
     }
 
-    /* sanity check */
-    p = map;
-    while (*p != '\0') {
-        if (*p++ != '%') {
-            continue;
-        }
-        /* we just found a '%' */
-        if (*p == 'p' || *p == '%') {
-            ++p;
-            continue;
-        }
-        /* optional dash */
-        if (*p == '-') {
-            ++p;
-        }
-        /* digit N */
-        if (apr_isdigit(*p)) {
-            ++p;
-        }
-        else {
-            return "syntax error in format string";
-        }
-        /* optional plus */
-        if (*p == '+') {
-            ++p;
-        }
-        /* do we end here? */
-        if (*p != '.') {
-            continue;
-        }
-        ++p;
-        /* optional dash */
-        if (*p == '-') {
-            ++p;
-        }
-        /* digit M */
-        if (apr_isdigit(*p)) {
-            ++p;
-        }
-        else {
-            return "syntax error in format string";
-        }
-        /* optional plus */
-        if (*p == '+') {
-            ++p;
-        }
+    /* syntax check and compilation */
+    if ((err = vhost_alias_compile(cmd->pool, map, pprog))) {
+        return err;
     }
     *pmap = map;
     *pmode = mode;
     return NULL;
 }
 
+static const char *vhost_alias_set_cache_size(cmd_parms *cmd, void *dummy,
+                                              const char *arg)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+    if (err != NULL) {
+        return err;
+    }
+
+    mva_cache_size = atoi(arg);
+    if (mva_cache_size < 0) {
+        return "VirtualAliasCacheSize must be a positive number, or zero";
+    }
+    return NULL;
+}
+
 static const command_rec mva_commands[] =
 {
     AP_INIT_TAKE1("VirtualScriptAlias", vhost_alias_set,
@@ -226,43 +359,29 @@ static const command_rec mva_commands[] =
     AP_INIT_TAKE1("VirtualDocumentRootIP", vhost_alias_set,
                   &vhost_alias_set_doc_root_ip, RSRC_CONF,
                   "how to create the DocumentRoot based on the host"),
+    AP_INIT_TAKE1("VirtualAliasCacheSize", vhost_alias_set_cache_size,
+                  NULL, RSRC_CONF,
+                  "number of interpolated roots each child caches per "
+                  "format string, or 0"),
     { NULL }
 };
 
 
-/*
- * This really wants to be a nested function
- * but C is too feeble to support them.
- */
-static APR_INLINE void vhost_alias_checkspace(request_rec *r, char *buf,
-                                             char **pdest, int size)
-{
-    /* XXX: what if size > HUGE_STRING_LEN? */
-    if (*pdest + size > buf + HUGE_STRING_LEN) {
-        **pdest = '\0';
-        if (r->filename) {
-            r->filename = apr_pstrcat(r->pool, r->filename, buf, NULL);
-        }
-        else {
-            r->filename = apr_pstrdup(r->pool, buf);
-        }
-        *pdest = buf;
-    }
-}
-
-static void vhost_alias_interpolate(request_rec *r, const char *name,
-                                    const char *map, const char *uri)
+static const char *vhost_alias_interpolate(request_rec *r, const char *name,
+                                           const mva_prog_t *prog)
 {
     /* 0..9 9..0 */
     enum { MAXDOTS = 19 };
     const char *dots[MAXDOTS+1];
     int ndots;
 
-    char buf[HUGE_STRING_LEN];
-    char *dest;
-    const char *docroot;
+    struct iovec *vec;
+    char port[7];
+    apr_size_t partlen;
+    char *parts, *dest;
+    const mva_op_t *op;
+    int i;
 
-    int N, M, Np, Mp, Nd, Md;
     const char *start, *end;
 
     const char *p;
@@ -276,50 +395,25 @@ static void vhost_alias_interpolate(request_rec *r, const char *name,
     }
     dots[ndots] = p;
 
-    r->filename = NULL;
+    /* the parts of the name are lowercased, at most the whole name each */
+    vec = apr_palloc(r->pool, prog->nops * sizeof(*vec));
+    partlen = (p - name) + 1;
+    dest = parts = apr_palloc(r->pool, partlen * prog->nops);
 
-    dest = buf;
-    while (*map) {
-        if (*map != '%') {
-            /* normal characters */
-            vhost_alias_checkspace(r, buf, &dest, 1);
-            *dest++ = *map++;
-            continue;
-        }
-        /* we are in a format specifier */
-        ++map;
-        /* %% -> % */
-        if (*map == '%') {
-            ++map;
-            vhost_alias_checkspace(r, buf, &dest, 1);
-            *dest++ = '%';
+    for (i = 0, op = prog->ops; i < prog->nops; ++i, ++op) {
+        int N = op->N, M = op->M;
+
+        if (op->type == MVA_OP_TEXT) {
+            vec[i].iov_base = (void *)op->text;
+            vec[i].iov_len = op->len;
             continue;
         }
-        /* port number */
-        if (*map == 'p') {
-            ++map;
-            /* no. of decimal digits in a short plus one */
-            vhost_alias_checkspace(r, buf, &dest, 7);
-            dest += apr_snprintf(dest, 7, "%d", ap_get_server_port(r));
+        if (op->type == MVA_OP_PORT) {
+            vec[i].iov_base = port;
+            vec[i].iov_len = apr_snprintf(port, sizeof(port), "%d",
+                                          ap_get_server_port(r));
             continue;
         }
-        /* deal with %-N+.-M+ -- syntax is already checked */
-        M = 0;   /* value */
-        Np = Mp = 0; /* is there a plus? */
-        Nd = Md = 0; /* is there a dash? */
-        if (*map == '-') ++map, Nd = 1;
-        N = *map++ - '0';
-        if (*map == '+') ++map, Np = 1;
-        if (*map == '.') {
-            ++map;
-            if (*map == '-') {
-                ++map, Md = 1;
-            }
-            M = *map++ - '0';
-            if (*map == '+') {
-                ++map, Mp = 1;
-            }
-        }
         /* note that N and M are one-based indices, not zero-based */
         start = dots[0]+1; /* ptr to the first character */
         end = dots[ndots]; /* ptr to the character after the last one */
@@ -328,14 +422,14 @@ static void vhost_alias_interpolate(request_rec *r, const char *name,
                 start = "_";
                 end = start+1;
             }
-            else if (!Nd) {
+            else if (!op->Nd) {
                 start = dots[N-1]+1;
-                if (!Np) {
+                if (!op->Np) {
                     end = dots[N];
                 }
             }
             else {
-                if (!Np) {
+                if (!op->Np) {
                     start = dots[ndots-N]+1;
                 }
                 end = dots[ndots-N+1];
@@ -346,43 +440,153 @@ static void vhost_alias_interpolate(request_rec *r, const char *name,
                 start = "_";
                 end = start+1;
             }
-            else if (!Md) {
+            else if (!op->Md) {
                 start = start+M-1;
-                if (!Mp) {
+                if (!op->Mp) {
                     end = start+1;
                 }
             }
             else {
-                if (!Mp) {
+                if (!op->Mp) {
                     start = end-M;
                 }
                 end = end-M+1;
             }
         }
-        vhost_alias_checkspace(r, buf, &dest, end - start);
+        vec[i].iov_base = dest;
+        vec[i].iov_len = end - start;
         for (p = start; p < end; ++p) {
             *dest++ = apr_tolower(*p);
         }
     }
     /* no double slashes */
-    if (dest - buf > 0 && dest[-1] == '/') {
-        --dest;
+    for (i = prog->nops - 1; i >= 0 && vec[i].iov_len == 0; --i)
+        ;
+    if (i >= 0 && ((const char *)vec[i].iov_base)[vec[i].iov_len - 1] == '/') {
+        vec[i].iov_len--;
     }
-    *dest = '\0';
 
-    if (r->filename)
-        docroot = apr_pstrcat(r->pool, r->filename, buf, NULL);
-    else
-        docroot = apr_pstrdup(r->pool, buf);
-    r->filename = apr_pstrcat(r->pool, docroot, uri, NULL);
-    ap_set_context_info(r, NULL, docroot);
-    ap_set_document_root(r, docroot);
+    return apr_pstrcatv(r->pool, vec, prog->nops, NULL);
+}
+
+static void vhost_alias_cache_init(apr_pool_t *p, mva_prog_t *prog)
+{
+    mva_cache_t *cache;
+
+    if (!prog || prog->cache) {
+        return;
+    }
+
+    cache = apr_pcalloc(p, sizeof(*cache));
+#if APR_HAS_THREADS
+    if (apr_thread_mutex_create(&cache->mutex, APR_THREAD_MUTEX_DEFAULT,
+                                p) != APR_SUCCESS) {
+        return;
+    }
+#endif
+    cache->entries = apr_hash_make(p);
+    APR_RING_INIT(&cache->lru, mva_entry_t, link);
+    prog->cache = cache;
+}
+
+static void mva_child_init(apr_pool_t *p, server_rec *s)
+{
+    if (!mva_cache_size) {
+        return;
+    }
+    for (; s; s = s->next) {
+        mva_sconf_t *conf = ap_get_module_config(s->module_config,
+                                                 &vhost_alias_module);
+        vhost_alias_cache_init(p, conf->doc_root_prog);
+        vhost_alias_cache_init(p, conf->cgi_root_prog);
+    }
+}
+
+/*
+ * The interpolated root of name, from the cache when possible. The entries
+ * are malloc()ed to be freed when they are evicted.
+ */
+static const char *vhost_alias_root(request_rec *r, const char *name,
+                                    mva_prog_t *prog)
+{
+    mva_cache_t *cache = prog->cache;
+    mva_entry_t *entry;
+    const char *key, *root;
+    apr_size_t klen, rlen;
+
+    if (!cache) {
+        return vhost_alias_interpolate(r, name, prog);
+    }
+
+    key = prog->has_port ? apr_psprintf(r->pool, "%s:%u", name,
+                                        ap_get_server_port(r))
+                         : name;
+    klen = strlen(key);
+
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(cache->mutex);
+#endif
+    entry = apr_hash_get(cache->entries, key, klen);
+    if (entry) {
+        APR_RING_REMOVE(entry, link);
+        APR_RING_INSERT_HEAD(&cache->lru, entry, mva_entry_t, link);
+        root = apr_pstrdup(r->pool, entry->root);
+    }
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(cache->mutex);
+#endif
+    if (entry) {
+        return root;
+    }
+
+    root = vhost_alias_interpolate(r, name, prog);
+
+    rlen = strlen(root);
+    entry = ap_malloc(sizeof(*entry) + klen + rlen + 2);
+    entry->key = (char *)(entry + 1);
+    entry->klen = klen;
+    entry->root = entry->key + klen + 1;
+    memcpy((char *)entry->key, key, klen + 1);
+    memcpy((char *)entry->root, root, rlen + 1);
+
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(cache->mutex);
+#endif
+    if (apr_hash_get(cache->entries, key, klen)) {
+        /* added by another thread meanwhile */
+        free(entry);
+    }
+    else {
+        if (cache->count >= mva_cache_size) {
+            mva_entry_t *last = APR_RING_LAST(&cache->lru);
+            APR_RING_REMOVE(last, link);
+            apr_hash_set(cache->entries, last->key, last->klen, NULL);
+            free(last);
+            cache->count--;
+        }
+        APR_RING_INSERT_HEAD(&cache->lru, entry, mva_entry_t, link);
+        apr_hash_set(cache->entries, entry->key, entry->klen, entry);
+        cache->count++;
+    }
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(cache->mutex);
+#endif
+
+    return root;
+}
+
+static int mva_pre_config(apr_pool_t *pconf, apr_pool_t *plog,
+                          apr_pool_t *ptemp)
+{
+    mva_cache_size = MVA_DEFAULT_CACHE_SIZE;
+    return OK;
 }
 
 static int mva_translate(request_rec *r)
 {
     mva_sconf_t *conf;
-    const char *name, *map, *uri;
+    const char *name, *uri, *docroot;
+    mva_prog_t *prog;
     mva_mode_e mode;
     const char *cgi;
 
@@ -397,12 +601,12 @@ static int mva_translate(request_rec *r)
     }
     if (cgi) {
         mode = conf->cgi_root_mode;
-        map = conf->cgi_root;
+        prog = conf->cgi_root_prog;
         uri = cgi + strlen("cgi-bin");
     }
     else if (r->uri[0] == '/') {
         mode = conf->doc_root_mode;
-        map = conf->doc_root;
+        prog = conf->doc_root_prog;
         uri = r->uri;
     }
     else {
@@ -425,7 +629,10 @@ static int mva_translate(request_rec *r)
      * canonical_path buffer.
      */
     r->canonical_filename = "";
-    vhost_alias_interpolate(r, name, map, uri);
+    docroot = vhost_alias_root(r, name, prog);
+    r->filename = apr_pstrcat(r->pool, docroot, uri, NULL);
+    ap_set_context_info(r, NULL, docroot);
+    ap_set_document_root(r, docroot);
 
     if (cgi) {
         /* see is_scriptaliased() in mod_cgi */
@@ -441,6 +648,8 @@ static void register_hooks(apr_pool_t *p)
 {
     static const char * const aszPre[]={ "mod_alias.c","mod_userdir.c",NULL };
 
+    ap_hook_pre_config(mva_pre_config, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_child_init(mva_child_init, NULL, NULL, APR_HOOK_MIDDLE);
     ap_hook_translate_name(mva_translate, aszPre, NULL, APR_HOOK_MIDDLE);
 }
 
@@ -107,6 +107,17 @@ int md_acme_problem_is_input_related(const char *problem) {
     return 0;
 }
 
+int md_acme_problem_is_rate_limited(const char *problem) {
+    if (!problem) return 0;
+    if (strstr(problem, "urn:ietf:params:") == problem) {
+        problem += strlen("urn:ietf:params:");
+    }
+    else if (strstr(problem, "urn:") == problem) {
+        problem += strlen("urn:");
+    }
+    return !apr_strnatcasecmp(problem, "acme:error:rateLimited");
+}
+
 /**************************************************************************************************/
 /* acme requests */
 
@@ -314,4 +314,10 @@ apr_status_t md_acme_protos_add(struct apr_hash_t *protos, apr_pool_t *p);
  */
 int md_acme_problem_is_input_related(const char *problem);
 
+/**
+ * Return != 0 iff the given problem identifier is the ACME error string
+ * of a CA rate limit being exceeded.
+ */
+int md_acme_problem_is_rate_limited(const char *problem);
+
 #endif /* md_acme_h */
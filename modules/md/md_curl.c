@@ -253,6 +253,8 @@ static apr_status_t internals_setup(md_http_request_t *req)
             rv = APR_EGENERAL;
             goto leave;
         }
+        /* renewals may run in several threads, no signals for timeouts */
+        curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
         curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_cb);
         curl_easy_setopt(curl, CURLOPT_HEADERDATA, NULL);
         curl_easy_setopt(curl, CURLOPT_READFUNCTION, req_data_cb);
@@ -44,6 +44,7 @@ struct md_reg_t {
     struct md_store_t *store;
     struct apr_hash_t *protos;
     struct apr_hash_t *certs;
+    struct apr_hash_t *cert_pools; /* of certs reloaded after freezing, by MD name */
     int can_http;
     int can_https;
     const char *proxy_url;
@@ -96,6 +97,7 @@ apr_status_t md_reg_create(md_reg_t **preg, apr_pool_t *p, struct md_store_t *st
     reg->store = store;
     reg->protos = apr_hash_make(p);
     reg->certs = apr_hash_make(p);
+    reg->cert_pools = apr_hash_make(p);
     reg->can_http = 1;
     reg->can_https = 1;
     reg->proxy_url = proxy_url? apr_pstrdup(p, proxy_url) : NULL;
@@ -1240,6 +1242,53 @@ apr_status_t md_reg_load_staging(md_reg_t *reg, const md_t *md, apr_table_t *env
     return md_util_pool_vdo(run_load_staging, reg, p, md, env, result, NULL);
 }
 
+static void pubcerts_reload(md_reg_t *reg, const md_t *md)
+{
+    apr_pool_t *p, *oldp;
+    const md_pubcert_t *pubcert;
+    const char *name;
+    apr_status_t rv;
+    int i;
+
+    /* The certificates of the md are loaded into a pool of their own, which
+     * replaces the previous one, so that the frozen cache does not grow on
+     * every activation. Entries are removed before setting them again, as
+     * the hash would otherwise keep the key from the old pool. */
+    oldp = apr_hash_get(reg->cert_pools, md->name, APR_HASH_KEY_STRING);
+    if (APR_SUCCESS != apr_pool_create(&p, reg->p)) return;
+    apr_pool_tag(p, "md_pubcerts");
+    for (i = 0; i < md_cert_count(md); ++i) {
+        name = apr_psprintf(p, "%s[%d]", md->name, i);
+        apr_hash_set(reg->certs, name, (apr_ssize_t)strlen(name), NULL);
+        pubcert = NULL;
+        rv = md_util_pool_vdo(pubcert_load, reg, p, &pubcert, MD_SG_DOMAINS, md, i, NULL);
+        if (APR_SUCCESS != rv || !pubcert) {
+            /* cache it missing with an empty record */
+            pubcert = apr_pcalloc(p, sizeof(*pubcert));
+        }
+        apr_hash_set(reg->certs, name, (apr_ssize_t)strlen(name), pubcert);
+    }
+    if (!oldp) {
+        apr_hash_set(reg->cert_pools, apr_pstrdup(reg->p, md->name), APR_HASH_KEY_STRING, p);
+    }
+    else {
+        apr_hash_set(reg->cert_pools, md->name, APR_HASH_KEY_STRING, p);
+        apr_pool_destroy(oldp);
+    }
+}
+
+apr_status_t md_reg_activate_staging(md_reg_t *reg, const md_t *md, apr_table_t *env,
+                                     md_result_t *result, apr_pool_t *p)
+{
+    apr_status_t rv;
+
+    rv = md_util_pool_vdo(run_load_staging, reg, p, md, env, result, NULL);
+    if (APR_SUCCESS == rv && reg->domains_frozen) {
+        pubcerts_reload(reg, md);
+    }
+    return rv;
+}
+
 apr_status_t md_reg_load_stagings(md_reg_t *reg, apr_array_header_t *mds,
                                   apr_table_t *env, apr_pool_t *p)
 {
@@ -278,6 +278,17 @@ apr_status_t md_reg_renew(md_reg_t *reg, const md_t *md,
 apr_status_t md_reg_load_staging(md_reg_t *reg, const md_t *md, struct apr_table_t *env, 
                                  struct md_result_t *result, apr_pool_t *p);
 
+/**
+ * Like md_reg_load_staging(), but also when the domains of the registry are
+ * frozen, i.e. while the server is running. The cached public certificates
+ * of the MDomain are then loaded again from DOMAINS.
+ * This needs to run in the process with write access to the store.
+ *
+ * @return APR_SUCCESS on loading new data, APR_ENOENT when nothing is staged, error otherwise.
+ */
+apr_status_t md_reg_activate_staging(md_reg_t *reg, const md_t *md, struct apr_table_t *env,
+                                     struct md_result_t *result, apr_pool_t *p);
+
 /**
  * Check given MDomains for new data in staging areas and, if it exists, load
  * the new credentials. On encountering errors, leave the credentails as
@@ -195,9 +195,17 @@ static apr_status_t notify(md_job_t *job, const char *reason,
                 return rv;
             }
         }
-        md_log_perror(MD_LOG_MARK, MD_LOG_NOTICE, 0, p, APLOGNO(10059)
-                     "The Managed Domain %s has been setup and changes "
-                     "will be activated on next (graceful) server restart.", job->mdomain);
+        if (mc->hot_activation) {
+            md_log_perror(MD_LOG_MARK, MD_LOG_NOTICE, 0, p, APLOGNO(10484)
+                         "The Managed Domain %s has been setup and changes "
+                         "will be activated shortly, without a server restart.",
+                         job->mdomain);
+        }
+        else {
+            md_log_perror(MD_LOG_MARK, MD_LOG_NOTICE, 0, p, APLOGNO(10059)
+                         "The Managed Domain %s has been setup and changes "
+                         "will be activated on next (graceful) server restart.", job->mdomain);
+        }
     }
     if (mc->message_cmd) {
         cmdline = apr_psprintf(p, "%s %s %s", mc->message_cmd, reason, job->mdomain);
@@ -1012,6 +1020,85 @@ leave:
     return rv;
 }
 
+/**************************************************************************************************/
+/* hot activation */
+
+/* How often the parent looks for renewals to activate with MDHotActivation */
+#define MD_HOT_ACTIVATION_INTERVAL     apr_time_from_sec(30)
+
+static apr_time_t hot_activation_next;
+
+static void hot_activate(md_mod_conf_t *mc, const md_t *md, server_rec *s, apr_pool_t *p)
+{
+    md_result_t *result;
+    md_job_t *job;
+    apr_status_t rv;
+
+    result = md_result_md_make(p, md->name);
+    rv = md_reg_activate_staging(mc->reg, md, mc->env, result, p);
+    if (APR_SUCCESS != rv) {
+        if (!APR_STATUS_IS_ENOENT(rv)) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10482)
+                         "%s: error activating staged set", md->name);
+        }
+        return;
+    }
+    ap_log_error(APLOG_MARK, APLOG_NOTICE, 0, s, APLOGNO(10483)
+                 "%s: staged set activated without restart", md->name);
+
+    /* The children can't read DOMAINS and still know the previous
+     * certificate. Leave them a job in STAGING which does not run before
+     * the renewal of the new one is due. */
+    job = md_reg_job_make(mc->reg, md->name, p);
+    job->next_run = md_reg_renew_at(mc->reg, md, p);
+    md_job_save(job, NULL, p);
+}
+
+/* Runs in the parent process, which may write DOMAINS, unlike the child
+ * with the watchdog that renewed the certificates. */
+static int md_monitor(apr_pool_t *p, server_rec *s)
+{
+    md_srv_conf_t *sc = md_config_get(s);
+    md_mod_conf_t *mc;
+    apr_pool_t *ptemp, *pmd;
+    apr_time_t now;
+    md_job_t *job;
+    const md_t *md;
+    int i, locked = 0;
+
+    if (!sc || !(mc = sc->mc) || !mc->hot_activation || !mc->reg || mc->dry_run) {
+        return DECLINED;
+    }
+    now = apr_time_now();
+    if (now < hot_activation_next) return DECLINED;
+    hot_activation_next = now + MD_HOT_ACTIVATION_INTERVAL;
+
+    apr_pool_create(&ptemp, p);
+    apr_pool_tag(ptemp, "md_monitor");
+    apr_pool_create(&pmd, ptemp);
+    for (i = 0; i < mc->mds->nelts; ++i) {
+        md = APR_ARRAY_IDX(mc->mds, i, const md_t *);
+        if (!md_will_renew_cert(md)) continue;
+
+        /* The renewal is done once the 'renewed' notification was handled,
+         * which also honours MDActivationDelay. */
+        job = md_reg_job_make(mc->reg, md->name, pmd);
+        if (APR_SUCCESS == md_job_load(job) && job->finished && job->notified_renewed) {
+            if (!locked) {
+                if (APR_SUCCESS != md_reg_lock_global(mc->reg, ptemp)) break;
+                locked = 1;
+            }
+            hot_activate(mc, md, s, pmd);
+        }
+        apr_pool_clear(pmd);
+    }
+    if (locked) {
+        md_reg_unlock_global(mc->reg, ptemp);
+    }
+    apr_pool_destroy(ptemp);
+    return DECLINED;
+}
+
 /**************************************************************************************************/
 /* connection context */
 
@@ -1507,6 +1594,10 @@ static void md_hooks(apr_pool_t *pool)
      */
     ap_hook_child_init(md_child_init, NULL, mod_ssl, APR_HOOK_MIDDLE);
 
+    /* Run at intervals in the parent process
+     */
+    ap_hook_monitor(md_monitor, NULL, NULL, APR_HOOK_MIDDLE);
+
     /* answer challenges *very* early, before any configured authentication may strike */
     ap_hook_post_read_request(md_require_https_maybe, mod_ssl, NULL, APR_HOOK_MIDDLE);
     ap_hook_post_read_request(md_http_challenge_pr, NULL, NULL, APR_HOOK_MIDDLE);
@@ -88,6 +88,9 @@ static md_mod_conf_t defmc = {
     13,                        /* retry_failover after 14 errors, with 5s delay ~ half a day */
     0,                         /* store locks, disabled by default */
     apr_time_from_sec(5),      /* max time to wait to obaint a store lock */
+    0,                         /* hot activation, disabled by default */
+    1,                         /* renew concurrency, one MD after the other */
+    0,                         /* renew concurrency per CA, not limited */
 };
 
 static md_timeslice_t def_renew_window = {
@@ -679,6 +682,44 @@ static const char *md_config_set_store_locks(cmd_parms *cmd, void *dc, const cha
     return NULL;
 }
 
+static const char *md_config_set_hot_activation(cmd_parms *cmd, void *dc, const char *value)
+{
+    md_srv_conf_t *sc = md_config_get(cmd->server);
+    const char *err;
+
+    (void)dc;
+    if ((err = md_conf_check_location(cmd, MD_LOC_NOT_MD))) {
+        return err;
+    }
+    return set_on_off(&sc->mc->hot_activation, value, cmd->pool);
+}
+
+static const char *md_config_set_renew_concurrency(cmd_parms *cmd, void *dc,
+                                                   const char *v1, const char *v2)
+{
+    md_srv_conf_t *sc = md_config_get(cmd->server);
+    const char *err;
+    int n, per_ca = 0;
+
+    (void)dc;
+    if ((err = md_conf_check_location(cmd, MD_LOC_NOT_MD))) {
+        return err;
+    }
+    n = atoi(v1);
+    if (n <= 0) {
+        return "invalid argument, must be a number > 0";
+    }
+    if (v2) {
+        per_ca = atoi(v2);
+        if (per_ca <= 0) {
+            return "invalid per CA argument, must be a number > 0";
+        }
+    }
+    sc->mc->renew_concurrency = n;
+    sc->mc->renew_ca_concurrency = per_ca;
+    return NULL;
+}
+
 static const char *md_config_set_require_https(cmd_parms *cmd, void *dc, const char *value)
 {
     md_srv_conf_t *config = md_config_get(cmd->server);
@@ -1249,6 +1290,10 @@ const command_rec md_cmds[] = {
                   "The number of errors before a failover to another CA is triggered."),
     AP_INIT_TAKE1("MDStoreLocks", md_config_set_store_locks, NULL, RSRC_CONF,
                   "Configure locking of store for updates."),
+    AP_INIT_TAKE12("MDRenewConcurrency", md_config_set_renew_concurrency, NULL, RSRC_CONF,
+                   "The number of MDs renewed at the same time, in total and per CA."),
+    AP_INIT_TAKE1("MDHotActivation", md_config_set_hot_activation, NULL, RSRC_CONF,
+                  "On to activate renewed certificates without a server restart."),
 
     AP_INIT_TAKE1(NULL, NULL, NULL, RSRC_CONF, NULL)
 };
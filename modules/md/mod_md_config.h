@@ -74,6 +74,9 @@ struct md_mod_conf_t {
     int retry_failover;                /* number of errors to trigger CA failover */
     int use_store_locks;               /* use locks when updating store */
     apr_time_t lock_wait_timeout;      /* fail after this time when unable to obtain lock */
+    int hot_activation;                /* activate renewed certificates without a restart */
+    int renew_concurrency;             /* max number of MDs renewed at the same time */
+    int renew_ca_concurrency;          /* max number of those using the same CA, 0 for no limit */
 };
 
 typedef struct md_srv_conf_t {
@@ -19,6 +19,9 @@
 #include <apr_hash.h>
 #include <apr_strings.h>
 #include <apr_date.h>
+#include <apr_thread_proc.h>
+#include <apr_thread_mutex.h>
+#include <apr_thread_cond.h>
 
 #include <httpd.h>
 #include <http_core.h>
@@ -60,6 +63,15 @@ static APR_OPTIONAL_FN_TYPE(ap_watchdog_get_instance) *wd_get_instance;
 static APR_OPTIONAL_FN_TYPE(ap_watchdog_register_callback) *wd_register_callback;
 static APR_OPTIONAL_FN_TYPE(ap_watchdog_set_callback_interval) *wd_set_interval;
 
+/* The jobs of a concurrent run which renew with the same CA */
+typedef struct md_renew_ca_t {
+    const char *url;
+    apr_array_header_t *jobs;  /* md_job_t* due in this run */
+    int next;                  /* index of the next job to drive */
+    int active;                /* number of jobs being driven */
+    apr_time_t retry_at;       /* != 0 once the CA rate limited us */
+} md_renew_ca_t;
+
 struct md_renew_ctx_t {
     apr_pool_t *p;
     server_rec *s;
@@ -67,17 +79,33 @@ struct md_renew_ctx_t {
     ap_watchdog_t *watchdog;
     
     apr_array_header_t *jobs;
+
+    /* for MDRenewConcurrency > 1 */
+    apr_thread_mutex_t *mutex;
+    apr_thread_cond_t *cond;
+    apr_array_header_t *cas;   /* md_renew_ca_t* of the current run */
+    int ca_turn;               /* where to start looking for the next job */
 };
 
-static void process_drive_job(md_renew_ctx_t *dctx, md_job_t *job, apr_pool_t *ptemp)
+/* Drive the job, return != 0 if the CA refused it with a rate limit. */
+static int process_drive_job(md_renew_ctx_t *dctx, md_job_t *djob, apr_pool_t *ptemp)
 {
     const md_t *md;
+    md_job_t *job;
     md_result_t *result = NULL;
+    int rate_limited = 0;
     apr_status_t rv;
     
+    /* Work on an instance loaded from the store, allocated from ptemp. The
+     * job kept in dctx only remembers when to run next, this keeps the runs
+     * from growing its pool and the jobs driven in parallel apart. */
+    job = md_reg_job_make(dctx->mc->reg, djob->mdomain, ptemp);
     md_job_load(job);
     /* Evaluate again on loaded value. Values will change when watchdog switches child process */
-    if (apr_time_now() < job->next_run) return;
+    if (apr_time_now() < job->next_run) {
+        djob->next_run = job->next_run;
+        return 0;
+    }
     
     job->next_run = 0;
     if (job->finished && job->notified_renewed) {
@@ -108,7 +136,7 @@ static void process_drive_job(md_renew_ctx_t *dctx, md_job_t *job, apr_pool_t *p
         ap_log_error( APLOG_MARK, APLOG_DEBUG, 0, dctx->s, APLOGNO(10052) 
                      "md(%s): state=%d, driving", job->mdomain, md->state);
 
-        if (!md_reg_should_renew(dctx->mc->reg, md, dctx->p)) {
+        if (!md_reg_should_renew(dctx->mc->reg, md, ptemp)) {
             ap_log_error( APLOG_MARK, APLOG_DEBUG, 0, dctx->s, APLOGNO(10053) 
                          "md(%s): no need to renew", job->mdomain);
             goto expiry;
@@ -144,6 +172,7 @@ static void process_drive_job(md_renew_ctx_t *dctx, md_job_t *job, apr_pool_t *p
         else {
             ap_log_error( APLOG_MARK, APLOG_ERR, result->status, dctx->s, APLOGNO(10056) 
                          "processing %s: %s", job->mdomain, result->detail);
+            rate_limited = md_acme_problem_is_rate_limited(result->problem);
             md_job_log_append(job, "renewal-error", result->problem, result->detail);
             md_event_holler("errored", job->mdomain, job, result, ptemp);
             ap_log_error(APLOG_MARK, APLOG_INFO, 0, dctx->s, APLOGNO(10057) 
@@ -154,7 +183,7 @@ static void process_drive_job(md_renew_ctx_t *dctx, md_job_t *job, apr_pool_t *p
     }
 
 expiry:
-    if (!job->finished && md_reg_should_warn(dctx->mc->reg, md, dctx->p)) {
+    if (!job->finished && md_reg_should_warn(dctx->mc->reg, md, ptemp)) {
         ap_log_error( APLOG_MARK, APLOG_TRACE1, 0, dctx->s,
                      "md(%s): warn about expiration", md->name);
         md_job_start_run(job, result, md_reg_store_get(dctx->mc->reg));
@@ -167,6 +196,8 @@ leave:
         rv = md_job_save(job, result, ptemp);
         ap_log_error(APLOG_MARK, APLOG_TRACE1, rv, dctx->s, "%s: saving job props", job->mdomain);
     }
+    djob->next_run = job->next_run;
+    return rate_limited;
 }
 
 int md_will_renew_cert(const md_t *md)
@@ -186,10 +217,170 @@ static apr_time_t next_run_default(void)
     return apr_time_now() + apr_time_from_sec(MD_SECS_PER_DAY / 2);
 }
 
+/**************************************************************************************************/
+/* concurrent runs */
+
+static const char *job_ca_url(md_renew_ctx_t *dctx, md_job_t *job)
+{
+    const md_t *md = md_get_by_name(dctx->mc->mds, job->mdomain);
+
+    if (md && md->ca_effective) return md->ca_effective;
+    if (md && md->ca_urls && md->ca_urls->nelts) {
+        return APR_ARRAY_IDX(md->ca_urls, 0, const char*);
+    }
+    return "";
+}
+
+/* Get the next job to drive and its CA, waiting while the CAs with jobs left
+ * are all at their MDRenewConcurrency limit. NULL when no job is left. */
+static md_job_t *next_drive_job(md_renew_ctx_t *dctx, md_renew_ca_t **pca)
+{
+    md_renew_ca_t *ca;
+    md_job_t *job = NULL;
+    int i, n, waiting;
+
+    apr_thread_mutex_lock(dctx->mutex);
+    for (;;) {
+        waiting = 0;
+        n = dctx->cas->nelts;
+        for (i = 0; i < n && !job; ++i) {
+            /* take turns between the CAs */
+            ca = APR_ARRAY_IDX(dctx->cas, (dctx->ca_turn + i) % n, md_renew_ca_t*);
+            if (ca->retry_at || ca->next >= ca->jobs->nelts) continue;
+            if (dctx->mc->renew_ca_concurrency > 0
+                && ca->active >= dctx->mc->renew_ca_concurrency) {
+                waiting = 1;
+                continue;
+            }
+            job = APR_ARRAY_IDX(ca->jobs, ca->next++, md_job_t*);
+            ++ca->active;
+            dctx->ca_turn = (dctx->ca_turn + i + 1) % n;
+            *pca = ca;
+        }
+        if (job || !waiting) break;
+        apr_thread_cond_wait(dctx->cond, dctx->mutex);
+    }
+    apr_thread_mutex_unlock(dctx->mutex);
+    return job;
+}
+
+static void drive_job_done(md_renew_ctx_t *dctx, md_renew_ca_t *ca, md_job_t *job,
+                           int rate_limited, apr_pool_t *ptemp)
+{
+    int i;
+
+    apr_thread_mutex_lock(dctx->mutex);
+    --ca->active;
+    if (rate_limited && !ca->retry_at) {
+        /* Do not start other renewals with this CA in this run, retry them
+         * when the job that hit the limit retries. */
+        ca->retry_at = job->next_run? job->next_run : next_run_default();
+        for (i = ca->next; i < ca->jobs->nelts; ++i) {
+            APR_ARRAY_IDX(ca->jobs, i, md_job_t*)->next_run = ca->retry_at;
+        }
+        ap_log_error(APLOG_MARK, APLOG_WARNING, 0, dctx->s, APLOGNO(10579)
+                     "%s: rate limited by CA <%s>, postponing the %d renewals "
+                     "left with it by %s", job->mdomain, ca->url,
+                     ca->jobs->nelts - ca->next,
+                     md_duration_print(ptemp, ca->retry_at - apr_time_now()));
+    }
+    apr_thread_cond_broadcast(dctx->cond);
+    apr_thread_mutex_unlock(dctx->mutex);
+}
+
+static void drive_jobs(md_renew_ctx_t *dctx)
+{
+    apr_allocator_t *allocator;
+    apr_pool_t *ptemp;
+    md_renew_ca_t *ca;
+    md_job_t *job;
+    int rate_limited;
+
+    /* Each thread allocates from a pool of its own, cleared after each job */
+    if (apr_allocator_create(&allocator) != APR_SUCCESS) return;
+    apr_allocator_max_free_set(allocator, 1);
+    if (apr_pool_create_ex(&ptemp, NULL, NULL, allocator) != APR_SUCCESS) {
+        apr_allocator_destroy(allocator);
+        return;
+    }
+    apr_allocator_owner_set(allocator, ptemp);
+    apr_pool_tag(ptemp, "md_renew_drive");
+
+    while ((job = next_drive_job(dctx, &ca)) != NULL) {
+        rate_limited = process_drive_job(dctx, job, ptemp);
+        drive_job_done(dctx, ca, job, rate_limited, ptemp);
+        apr_pool_clear(ptemp);
+    }
+    apr_pool_destroy(ptemp);
+}
+
+static void * APR_THREAD_FUNC drive_thread(apr_thread_t *thread, void *baton)
+{
+    drive_jobs(baton);
+    apr_thread_exit(thread, APR_SUCCESS);
+    return NULL;
+}
+
+/* Drive the jobs due with up to MDRenewConcurrency threads, grouped by CA so
+ * that each CA gets at most its share of them. Returns when all are done. */
+static void drive_concurrently(md_renew_ctx_t *dctx, apr_array_header_t *due,
+                               apr_pool_t *ptemp)
+{
+    apr_hash_t *cas = apr_hash_make(ptemp);
+    apr_thread_t **threads;
+    apr_status_t rv, trv;
+    md_renew_ca_t *ca;
+    md_job_t *job;
+    const char *url;
+    int i, n;
+
+    dctx->cas = apr_array_make(ptemp, 5, sizeof(md_renew_ca_t*));
+    dctx->ca_turn = 0;
+    for (i = 0; i < due->nelts; ++i) {
+        job = APR_ARRAY_IDX(due, i, md_job_t*);
+        url = job_ca_url(dctx, job);
+        ca = apr_hash_get(cas, url, APR_HASH_KEY_STRING);
+        if (!ca) {
+            ca = apr_pcalloc(ptemp, sizeof(*ca));
+            ca->url = url;
+            ca->jobs = apr_array_make(ptemp, 10, sizeof(md_job_t*));
+            apr_hash_set(cas, url, APR_HASH_KEY_STRING, ca);
+            APR_ARRAY_PUSH(dctx->cas, md_renew_ca_t*) = ca;
+        }
+        APR_ARRAY_PUSH(ca->jobs, md_job_t*) = job;
+    }
+
+    n = dctx->mc->renew_concurrency;
+    if (n > due->nelts) n = due->nelts;
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, dctx->s, APLOGNO(10580)
+                 "driving %d mds with %d CAs in %d threads",
+                 due->nelts, dctx->cas->nelts, n);
+
+    threads = apr_pcalloc(ptemp, (apr_size_t)n * sizeof(apr_thread_t*));
+    for (i = 0; i < n; ++i) {
+        rv = apr_thread_create(&threads[i], NULL, drive_thread, dctx, ptemp);
+        if (APR_SUCCESS != rv) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, rv, dctx->s, APLOGNO(10581)
+                         "creating md renew thread %d of %d", i + 1, n);
+            break;
+        }
+    }
+    if (i == 0) {
+        /* no thread, do it ourself */
+        drive_jobs(dctx);
+    }
+    while (i-- > 0) {
+        apr_thread_join(&trv, threads[i]);
+    }
+    dctx->cas = NULL;
+}
+
 static apr_status_t run_watchdog(int state, void *baton, apr_pool_t *ptemp)
 {
     md_renew_ctx_t *dctx = baton;
     md_job_t *job;
+    apr_array_header_t *due;
+    apr_pool_t *jobp;
     apr_time_t next_run, wait_time;
     int i;
     
@@ -212,13 +403,32 @@ static apr_status_t run_watchdog(int state, void *baton, apr_pool_t *ptemp)
              * as next_run to indicate that it wants to participate in the normal
              * regular runs. */
             next_run = next_run_default();
+            if (dctx->mutex) {
+                due = apr_array_make(ptemp, dctx->jobs->nelts, sizeof(md_job_t *));
+                for (i = 0; i < dctx->jobs->nelts; ++i) {
+                    job = APR_ARRAY_IDX(dctx->jobs, i, md_job_t *);
+                    if (apr_time_now() >= job->next_run) {
+                        APR_ARRAY_PUSH(due, md_job_t *) = job;
+                    }
+                }
+                if (due->nelts) {
+                    drive_concurrently(dctx, due, ptemp);
+                }
+            }
+            else if (APR_SUCCESS == apr_pool_create(&jobp, ptemp)) {
+                apr_pool_tag(jobp, "md_renew_job");
+                for (i = 0; i < dctx->jobs->nelts; ++i) {
+                    job = APR_ARRAY_IDX(dctx->jobs, i, md_job_t *);
+                    if (apr_time_now() >= job->next_run) {
+                        process_drive_job(dctx, job, jobp);
+                        apr_pool_clear(jobp);
+                    }
+                }
+                apr_pool_destroy(jobp);
+            }
+
             for (i = 0; i < dctx->jobs->nelts; ++i) {
                 job = APR_ARRAY_IDX(dctx->jobs, i, md_job_t *);
-                
-                if (apr_time_now() >= job->next_run) {
-                    process_drive_job(dctx, job, ptemp);
-                }
-                
                 if (job->next_run && job->next_run < next_run) {
                     next_run = job->next_run;
                 }
@@ -332,6 +542,16 @@ apr_status_t md_renew_start_watching(md_mod_conf_t *mc, server_rec *s, apr_pool_
         apr_pool_destroy(dctx->p);
         return APR_SUCCESS;
     }
+
+    if (mc->renew_concurrency > 1 && dctx->jobs->nelts > 1) {
+        if (APR_SUCCESS != (rv = apr_thread_mutex_create(&dctx->mutex, 
+                                                         APR_THREAD_MUTEX_DEFAULT, dctx->p))
+            || APR_SUCCESS != (rv = apr_thread_cond_create(&dctx->cond, dctx->p))) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10582)
+                         "md_renew_watchdog: create mutex, renewing sequentially");
+            dctx->mutex = NULL;
+        }
+    }
     
     if (APR_SUCCESS != (rv = wd_get_instance(&dctx->watchdog, MD_RENEW_WATCHDOG_NAME, 0, 1, dctx->p))) {
         ap_log_error(APLOG_MARK, APLOG_CRIT, rv, s, APLOGNO(10066) 
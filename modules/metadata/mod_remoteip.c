@@ -26,6 +26,7 @@
 #include "http_protocol.h"
 #include "http_log.h"
 #include "http_main.h"
+#include "util_ipset.h"
 #include "apr_strings.h"
 #include "apr_lib.h"
 #define APR_WANT_BYTEFUNC
@@ -35,13 +36,6 @@
 
 module AP_MODULE_DECLARE_DATA remoteip_module;
 
-typedef struct {
-    /** A proxy IP mask to match */
-    apr_ipsubnet_t *ip;
-    /** Flagged if internal, otherwise an external trusted proxy */
-    void  *internal;
-} remoteip_proxymatch_t;
-
 typedef struct remoteip_addr_info {
     struct remoteip_addr_info *next;
     apr_sockaddr_t *addr;
@@ -56,10 +50,10 @@ typedef struct {
      * from the proxy-via IP header value list)
      */
     const char *proxies_header_name;
-    /** A list of trusted proxies, ideally configured
-     *  with the most commonly encountered listed first
+    /** The set of trusted proxies, with the internal flag (cmd->info)
+     *  of the directive as data
      */
-    apr_array_header_t *proxymatch_ip;
+    ap_ipset_t *proxymatch_ip;
 
     remoteip_addr_info *proxy_protocol_enabled;
     remoteip_addr_info *proxy_protocol_disabled;
@@ -220,7 +214,6 @@ static const char *proxies_set(cmd_parms *cmd, void *cfg,
 {
     remoteip_config_t *config = ap_get_module_config(cmd->server->module_config,
                                                      &remoteip_module);
-    remoteip_proxymatch_t *match;
     apr_status_t rv;
     char *ip = apr_pstrdup(cmd->temp_pool, arg);
     char *s = ap_strchr(ip, '/');
@@ -229,14 +222,12 @@ static const char *proxies_set(cmd_parms *cmd, void *cfg,
     }
 
     if (!config->proxymatch_ip) {
-        config->proxymatch_ip = apr_array_make(cmd->pool, 1, sizeof(*match));
+        config->proxymatch_ip = ap_ipset_make(cmd->pool);
     }
-    match = (remoteip_proxymatch_t *) apr_array_push(config->proxymatch_ip);
-    match->internal = cmd->info;
 
     if (looks_like_ip(ip)) {
         /* Note s may be null, that's fine (explicit host) */
-        rv = apr_ipsubnet_create(&match->ip, ip, s, cmd->pool);
+        rv = ap_ipset_add(config->proxymatch_ip, ip, s, cmd->info);
     }
     else
     {
@@ -253,13 +244,10 @@ static const char *proxies_set(cmd_parms *cmd, void *cfg,
         while (rv == APR_SUCCESS)
         {
             apr_sockaddr_ip_get(&ip, temp_sa);
-            rv = apr_ipsubnet_create(&match->ip, ip, NULL, cmd->pool);
+            rv = ap_ipset_add(config->proxymatch_ip, ip, NULL, cmd->info);
             if (!(temp_sa = temp_sa->next)) {
                 break;
             }
-            match = (remoteip_proxymatch_t *)
-                    apr_array_push(config->proxymatch_ip);
-            match->internal = cmd->info;
         }
     }
 
@@ -584,24 +572,18 @@ static int remoteip_modify_request(request_rec *r)
         /* verify user agent IP against the trusted proxy list
          */
         if (config->proxymatch_ip) {
-            int i;
-            remoteip_proxymatch_t *match;
-            match = (remoteip_proxymatch_t *)config->proxymatch_ip->elts;
-            for (i = 0; i < config->proxymatch_ip->nelts; ++i) {
-                if (apr_ipsubnet_test(match[i].ip, temp_sa)) {
-                    if (internal) {
-                        /* Allow an internal proxy to present an external proxy,
-                           but do not allow an external proxy to present an internal proxy.
-                           In this case, the presented internal proxy will be considered external.
-                         */
-                        internal = match[i].internal;
-                    }
-                    break;
-                }
-            }
-            if (i && i >= config->proxymatch_ip->nelts) {
+            const void *match_internal;
+            if (!ap_ipset_match(config->proxymatch_ip, temp_sa,
+                                &match_internal)) {
                 break;
             }
+            if (internal) {
+                /* Allow an internal proxy to present an external proxy,
+                   but do not allow an external proxy to present an internal proxy.
+                   In this case, the presented internal proxy will be considered external.
+                 */
+                internal = (void *)match_internal;
+            }
         }
 
         if ((parse_remote = strrchr(remote, ',')) == NULL) {
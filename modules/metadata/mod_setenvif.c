@@ -502,6 +502,9 @@ static const command_rec setenvif_module_cmds[] =
  * signal which call it is by having the earlier one pass a flag to the
  * later one.
  */
+/* Number of request header values remembered by match_headers() */
+#define SEI_HEADERS_SEEN 16
+
 static int match_headers(request_rec *r)
 {
     sei_cfg_rec *sconf;
@@ -514,6 +517,11 @@ static int match_headers(request_rec *r)
     char *last_name;
     ap_regmatch_t regm[AP_MAX_REG_MATCH];
     int do_early = 0;
+    struct {
+        const char *name;
+        const char *val;
+    } seen[SEI_HEADERS_SEEN];
+    int nseen = 0;
    
     rconf = ap_get_module_config(r->request_config, &setenvif_module);
 
@@ -590,10 +598,29 @@ static int match_headers(request_rec *r)
                         }
                     }
                     else {
-                        /* Not matching against a regex */
-                        val = apr_table_get(r->headers_in, b->name);
-                        if (val == NULL) {
-                            val = apr_table_get(r->subprocess_env, b->name);
+                        /* Not matching against a regex. The request headers
+                         * are not modified by the conditionals (unlike the
+                         * environment), so remember the ones already found
+                         * for the non-consecutive entries using them.
+                         */
+                        for (j = 0; j < nseen; ++j) {
+                            if (seen[j].name == b->name) {
+                                break;
+                            }
+                        }
+                        if (j < nseen) {
+                            val = seen[j].val;
+                        }
+                        else {
+                            val = apr_table_get(r->headers_in, b->name);
+                            if (val == NULL) {
+                                val = apr_table_get(r->subprocess_env,
+                                                    b->name);
+                            }
+                            else if (nseen < SEI_HEADERS_SEEN) {
+                                seen[nseen].name = b->name;
+                                seen[nseen++].val = val;
+                            }
                         }
                     }
                 }
@@ -28,6 +28,7 @@
 
 #ifdef APR_HAS_THREADS
 #include "apr_atomic.h"     /* for apr_atomic_inc32 */
+#include "apr_thread_mutex.h"
 #include "mpm_common.h"     /* for ap_mpm_query */
 #endif
 
@@ -110,12 +111,9 @@ typedef struct {
  * Sun Jun  7 05:43:49 CEST 1998 -- Alvaro
  * More comments:
  * 1) The UUencoding procedure is now done in a general way, avoiding the problems
- * with sizes and paddings that can arise depending on the architecture. Now the
- * offsets and sizes of the elements of the unique_id_rec structure are calculated
- * in unique_id_global_init; and then used to duplicate the structure without the
- * paddings that might exist. The multithreaded server fix should be now very easy:
- * just add a new "tid" field to the unique_id_rec structure, and increase by one
- * UNIQUE_ID_REC_MAX.
+ * with sizes and paddings that can arise depending on the architecture. The
+ * elements of the unique_id_rec structure are copied in network byte order to
+ * a buffer without the paddings that might exist (see gen_default_id).
  * 2) unique_id_rec.stamp has been changed from "time_t" to "unsigned int", because
  * its size is 64bits on some platforms (linux/alpha), and this caused problems with
  * htonl/ntohl. Well, this shouldn't be a problem till year 2106.
@@ -125,7 +123,9 @@ typedef struct {
  * XXX: We should have a per-thread counter and not use cur_unique_id.counter
  * XXX: in all threads, because this is bad for performance on multi-processor
  * XXX: systems: Writing to the same address from several CPUs causes cache
- * XXX: thrashing.
+ * XXX: thrashing. The thread_index is not enough to make it per-thread, with
+ * XXX: the event MPM connections may share an id. The UUIDv7 and ULID formats
+ * XXX: use per-thread state only.
  */
 static unique_id_rec cur_unique_id;
 static apr_uint32_t cur_unique_counter;
@@ -134,35 +134,99 @@ static int is_threaded_mpm;
 #endif
 
 /*
- * Number of elements in the structure unique_id_rec.
+ * The size of unique_id_rec without the paddings of the structure, and
+ * once encoded.
  */
-#define UNIQUE_ID_REC_MAX 4
+#define UNIQUE_ID_REC_SIZE      (4 + ROOT_SIZE + 2 + 4)
+#define UNIQUE_ID_REC_SIZE_UU   ((UNIQUE_ID_REC_SIZE * 8 + 5) / 6)
 
-static unsigned short unique_id_rec_offset[UNIQUE_ID_REC_MAX],
-                      unique_id_rec_size[UNIQUE_ID_REC_MAX],
-                      unique_id_rec_total_size,
-                      unique_id_rec_size_uu;
+/* The longest id, a formatted UUID */
+#define UNIQUE_ID_MAX_LEN       36
+
+/*
+ * UniqueIdFormat
+ */
+#define UNIQUE_ID_FORMAT_DEFAULT    0
+#define UNIQUE_ID_FORMAT_UUIDV7     1
+#define UNIQUE_ID_FORMAT_ULID       2
+
+static int unique_id_format = UNIQUE_ID_FORMAT_DEFAULT;
+
+/*
+ * The UUIDv7 and ULID formats are 48 bits of milliseconds since the epoch,
+ * so that they sort by time, followed by random bits (and for UUIDv7 the
+ * version and variant). They don't use the shared counter: each thread
+ * draws them from its own generator, seeded once from
+ * ap_random_insecure_bytes(), with a counter in the random bits which
+ * orders the ids minted by a thread during the same millisecond (the
+ * "rand_a" of UUIDv7, or the increment of the random part of ULID).
+ * The generation is bumped by each child_init, so that a thread state
+ * inherited across a fork is seeded again.
+ */
+typedef struct {
+    apr_uint32_t generation;
+    apr_uint16_t seq;
+    apr_uint16_t rand_hi;
+    apr_uint64_t rand_lo;
+    apr_uint64_t last_ms;
+    apr_uint64_t rng;
+} unique_id_thread_t;
+
+static apr_uint32_t unique_id_generation;
+
+#if AP_HAS_THREAD_LOCAL
+static AP_THREAD_LOCAL unique_id_thread_t thread_state;
+#else
+/* Without thread local storage, a single state is shared by the threads */
+static unique_id_thread_t thread_state;
+#ifdef APR_HAS_THREADS
+static apr_thread_mutex_t *thread_state_mutex;
+#endif
+#endif
+
+/* Use the base64url encoding per RFC 4648, avoiding characters which
+ * are not safe in URLs.  ### TODO: can switch to apr_encode_*. */
+static const char uuencoder[64] = {
+    'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M',
+    'N', 'O', 'P', 'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X', 'Y', 'Z',
+    'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm',
+    'n', 'o', 'p', 'q', 'r', 's', 't', 'u', 'v', 'w', 'x', 'y', 'z',
+    '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', '-', '_',
+};
+
+/* Crockford's base32 alphabet, used by ULID */
+static const char ulid_encoder[32] = {
+    '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C',
+    'D', 'E', 'F', 'G', 'H', 'J', 'K', 'M', 'N', 'P', 'Q', 'R', 'S',
+    'T', 'V', 'W', 'X', 'Y', 'Z',
+};
+
+static const char hex_encoder[16] = {
+    '0', '1', '2', '3', '4', '5', '6', '7',
+    '8', '9', 'a', 'b', 'c', 'd', 'e', 'f',
+};
+
+/*
+ * The base64url encoding of all the 12 bits values, so that each group of
+ * three bytes is encoded with two lookups.
+ */
+static char uuencoder_pairs[4096][2];
+
+static int unique_id_pre_config(apr_pool_t *pconf, apr_pool_t *plog,
+                                apr_pool_t *ptemp)
+{
+    unique_id_format = UNIQUE_ID_FORMAT_DEFAULT;
+    return OK;
+}
 
 static int unique_id_global_init(apr_pool_t *p, apr_pool_t *plog, apr_pool_t *ptemp, server_rec *main_server)
 {
-    /*
-     * Calculate the sizes and offsets in cur_unique_id.
-     */
-    unique_id_rec_offset[0] = APR_OFFSETOF(unique_id_rec, stamp);
-    unique_id_rec_size[0] = sizeof(cur_unique_id.stamp);
-    unique_id_rec_offset[1] = APR_OFFSETOF(unique_id_rec, root);
-    unique_id_rec_size[1] = sizeof(cur_unique_id.root);
-    unique_id_rec_offset[2] = APR_OFFSETOF(unique_id_rec, counter);
-    unique_id_rec_size[2] = sizeof(cur_unique_id.counter);
-    unique_id_rec_offset[3] = APR_OFFSETOF(unique_id_rec, thread_index);
-    unique_id_rec_size[3] = sizeof(cur_unique_id.thread_index);
-    unique_id_rec_total_size = unique_id_rec_size[0] + unique_id_rec_size[1] +
-                               unique_id_rec_size[2] + unique_id_rec_size[3];
+    int i;
 
-    /*
-     * Calculate the size of the structure when encoded.
-     */
-    unique_id_rec_size_uu = (unique_id_rec_total_size*8+5)/6;
+    for (i = 0; i < 4096; i++) {
+        uuencoder_pairs[i][0] = uuencoder[i >> 6];
+        uuencoder_pairs[i][1] = uuencoder[i & 0x3f];
+    }
 
     return OK;
 }
@@ -172,8 +236,19 @@ static void unique_id_child_init(apr_pool_t *p, server_rec *s)
 #ifdef APR_HAS_THREADS
     is_threaded_mpm = 0;
     ap_mpm_query(AP_MPMQ_IS_THREADED, &is_threaded_mpm);
+#if !AP_HAS_THREAD_LOCAL
+    if (is_threaded_mpm && unique_id_format != UNIQUE_ID_FORMAT_DEFAULT) {
+        apr_thread_mutex_create(&thread_state_mutex,
+                                APR_THREAD_MUTEX_DEFAULT, p);
+    }
+#endif
 #endif
 
+    /* Never zero, which is the generation of an unseeded thread state */
+    if (++unique_id_generation == 0) {
+        ++unique_id_generation;
+    }
+
     ap_random_insecure_bytes(&cur_unique_id.root,
                              sizeof(cur_unique_id.root));
 
@@ -186,80 +261,191 @@ static void unique_id_child_init(apr_pool_t *p, server_rec *s)
                              sizeof(cur_unique_counter));
 }
 
-/* Use the base64url encoding per RFC 4648, avoiding characters which
- * are not safe in URLs.  ### TODO: can switch to apr_encode_*. */
-static const char uuencoder[64] = {
-    'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M',
-    'N', 'O', 'P', 'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X', 'Y', 'Z',
-    'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm',
-    'n', 'o', 'p', 'q', 'r', 's', 't', 'u', 'v', 'w', 'x', 'y', 'z',
-    '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', '-', '_',
-};
-
 #ifndef APR_UINT16_MAX
 #define APR_UINT16_MAX 0xffffu
 #endif
 
-static const char *gen_unique_id(const request_rec *r)
+/*
+ * The layout of unique_id_rec, in network byte order and without the
+ * paddings of the structure: stamp, root, counter, thread_index.
+ */
+static const char *gen_default_id(const request_rec *r)
 {
-    char *str;
-    /*
-     * Buffer padded with two final bytes, used to copy the unique_id_rec
-     * structure without the internal paddings that it could have.
-     */
-    unique_id_rec new_unique_id;
-    struct {
-        unique_id_rec foo;
-        unsigned char pad[2];
-    } paddedbuf;
-    apr_uint32_t counter;
-    unsigned char *x,*y;
-    int i,j,k;
-
-    memcpy(&new_unique_id.root, &cur_unique_id.root, ROOT_SIZE);
-    new_unique_id.stamp = htonl((unsigned int)apr_time_sec(r->request_time));
-    new_unique_id.thread_index = htonl((unsigned int)r->connection->id);
+    unsigned char x[UNIQUE_ID_REC_SIZE];
+    apr_uint32_t stamp, thread_index, counter;
+    const unsigned char *y;
+    char *str, *s;
+
+    stamp = (apr_uint32_t)apr_time_sec(r->request_time);
+    thread_index = (apr_uint32_t)r->connection->id;
 #ifdef APR_HAS_THREADS
     if (is_threaded_mpm)
         counter = apr_atomic_inc32(&cur_unique_counter);
     else
 #endif
         counter = cur_unique_counter++;
-
-    /* The counter is two bytes for the uuencoded unique id, in network
-     * byte order.
+    counter %= APR_UINT16_MAX;
+
+    x[0] = (unsigned char)(stamp >> 24);
+    x[1] = (unsigned char)(stamp >> 16);
+    x[2] = (unsigned char)(stamp >> 8);
+    x[3] = (unsigned char)stamp;
+    memcpy(x + 4, cur_unique_id.root, ROOT_SIZE);
+    x[4 + ROOT_SIZE] = (unsigned char)(counter >> 8);
+    x[5 + ROOT_SIZE] = (unsigned char)counter;
+    x[6 + ROOT_SIZE] = (unsigned char)(thread_index >> 24);
+    x[7 + ROOT_SIZE] = (unsigned char)(thread_index >> 16);
+    x[8 + ROOT_SIZE] = (unsigned char)(thread_index >> 8);
+    x[9 + ROOT_SIZE] = (unsigned char)thread_index;
+
+    /* The groups of three bytes, then the last two bytes (without padding,
+     * 20 bytes give 27 characters).
      */
-    new_unique_id.counter = htons(counter % APR_UINT16_MAX);
-
-    /* we'll use a temporal buffer to avoid uuencoding the possible internal
-     * paddings of the original structure */
-    x = (unsigned char *) &paddedbuf;
-    k = 0;
-    for (i = 0; i < UNIQUE_ID_REC_MAX; i++) {
-        y = ((unsigned char *) &new_unique_id) + unique_id_rec_offset[i];
-        for (j = 0; j < unique_id_rec_size[i]; j++, k++) {
-            x[k] = y[j];
+    s = str = apr_palloc(r->pool, UNIQUE_ID_REC_SIZE_UU + 1);
+    for (y = x; y + 3 <= x + UNIQUE_ID_REC_SIZE; y += 3) {
+        apr_uint32_t v = ((apr_uint32_t)y[0] << 16) | (y[1] << 8) | y[2];
+        memcpy(s, uuencoder_pairs[v >> 12], 2);
+        memcpy(s + 2, uuencoder_pairs[v & 0xfff], 2);
+        s += 4;
+    }
+    *s++ = uuencoder[y[0] >> 2];
+    *s++ = uuencoder[((y[0] & 0x03) << 4) | (y[1] >> 4)];
+    *s++ = uuencoder[(y[1] & 0x0f) << 2];
+    *s = '\0';
+
+    return str;
+}
+
+/* splitmix64, fast and good enough for ids which are not secrets */
+static apr_uint64_t thread_random(unique_id_thread_t *t)
+{
+    apr_uint64_t z = (t->rng += APR_UINT64_C(0x9e3779b97f4a7c15));
+    z = (z ^ (z >> 30)) * APR_UINT64_C(0xbf58476d1ce4e5b9);
+    z = (z ^ (z >> 27)) * APR_UINT64_C(0x94d049bb133111eb);
+    return z ^ (z >> 31);
+}
+
+/*
+ * Returns the timestamp of the id in milliseconds, and whether the thread
+ * already minted an id during this millisecond (in *same).
+ */
+static apr_uint64_t thread_stamp(unique_id_thread_t *t, const request_rec *r,
+                                 int *same)
+{
+    apr_uint64_t ms = (apr_uint64_t)apr_time_as_msec(r->request_time);
+
+    if (t->generation != unique_id_generation) {
+        ap_random_insecure_bytes(&t->rng, sizeof(t->rng));
+        t->generation = unique_id_generation;
+        t->last_ms = 0;
+    }
+    *same = (ms == t->last_ms);
+    t->last_ms = ms;
+
+    return ms & APR_UINT64_C(0xffffffffffff);
+}
+
+/*
+ * RFC 9562 UUIDv7: unix_ts_ms (48), ver (4), rand_a (12) used as a counter
+ * starting at a random value below 2048 on each millisecond, var (2),
+ * rand_b (62). Formatted in lowercase hexadecimal, 8-4-4-4-12.
+ */
+static void gen_uuidv7(unique_id_thread_t *t, const request_rec *r,
+                       char *str)
+{
+    unsigned char x[16];
+    apr_uint64_t ms, rnd;
+    int i, same;
+    char *s;
+
+    ms = thread_stamp(t, r, &same);
+    rnd = thread_random(t);
+    if (same) {
+        t->seq = (t->seq + 1) & 0xfff;
+    }
+    else {
+        t->seq = (apr_uint16_t)(rnd >> 53);
+        rnd = thread_random(t);
+    }
+
+    for (i = 0; i < 6; i++) {
+        x[i] = (unsigned char)(ms >> (40 - 8 * i));
+    }
+    x[6] = (unsigned char)(0x70 | (t->seq >> 8));
+    x[7] = (unsigned char)t->seq;
+    x[8] = (unsigned char)(0x80 | ((rnd >> 56) & 0x3f));
+    for (i = 9; i < 16; i++) {
+        x[i] = (unsigned char)(rnd >> (120 - 8 * i));
+    }
+
+    for (i = 0, s = str; i < 16; i++) {
+        if (i == 4 || i == 6 || i == 8 || i == 10) {
+            *s++ = '-';
         }
+        *s++ = hex_encoder[x[i] >> 4];
+        *s++ = hex_encoder[x[i] & 0x0f];
     }
-    /*
-     * We reset two more bytes just in case padding is needed for the uuencoding.
-     */
-    x[k++] = '\0';
-    x[k++] = '\0';
-
-    /* alloc str and do the uuencoding */
-    str = (char *)apr_palloc(r->pool, unique_id_rec_size_uu + 1);
-    k = 0;
-    for (i = 0; i < unique_id_rec_total_size; i += 3) {
-        y = x + i;
-        str[k++] = uuencoder[y[0] >> 2];
-        str[k++] = uuencoder[((y[0] & 0x03) << 4) | ((y[1] & 0xf0) >> 4)];
-        if (k == unique_id_rec_size_uu) break;
-        str[k++] = uuencoder[((y[1] & 0x0f) << 2) | ((y[2] & 0xc0) >> 6)];
-        if (k == unique_id_rec_size_uu) break;
-        str[k++] = uuencoder[y[2] & 0x3f];
+    *s = '\0';
+}
+
+/*
+ * ULID: 48 bits of milliseconds and 80 random bits, incremented for each
+ * id minted by the thread during the same millisecond. Formatted in
+ * Crockford's base32, 10 characters for the time and 16 for the random.
+ */
+static void gen_ulid(unique_id_thread_t *t, const request_rec *r, char *str)
+{
+    apr_uint64_t ms, hi, lo;
+    int i, same;
+
+    ms = thread_stamp(t, r, &same);
+    if (same) {
+        if (++t->rand_lo == 0) {
+            t->rand_hi++;
+        }
     }
-    str[k++] = '\0';
+    else {
+        t->rand_lo = thread_random(t);
+        t->rand_hi = (apr_uint16_t)thread_random(t);
+    }
+
+    for (i = 0; i < 10; i++) {
+        str[i] = ulid_encoder[(ms >> (45 - 5 * i)) & 0x1f];
+    }
+    hi = ((apr_uint64_t)t->rand_hi << 24) | (t->rand_lo >> 40);
+    lo = t->rand_lo & APR_UINT64_C(0xffffffffff);
+    for (i = 0; i < 8; i++) {
+        str[10 + i] = ulid_encoder[(hi >> (35 - 5 * i)) & 0x1f];
+        str[18 + i] = ulid_encoder[(lo >> (35 - 5 * i)) & 0x1f];
+    }
+    str[26] = '\0';
+}
+
+static const char *gen_unique_id(const request_rec *r)
+{
+    char *str;
+
+    if (unique_id_format == UNIQUE_ID_FORMAT_DEFAULT) {
+        return gen_default_id(r);
+    }
+
+    str = apr_palloc(r->pool, UNIQUE_ID_MAX_LEN + 1);
+#if !AP_HAS_THREAD_LOCAL && defined(APR_HAS_THREADS)
+    if (thread_state_mutex) {
+        apr_thread_mutex_lock(thread_state_mutex);
+    }
+#endif
+    if (unique_id_format == UNIQUE_ID_FORMAT_UUIDV7) {
+        gen_uuidv7(&thread_state, r, str);
+    }
+    else {
+        gen_ulid(&thread_state, r, str);
+    }
+#if !AP_HAS_THREAD_LOCAL && defined(APR_HAS_THREADS)
+    if (thread_state_mutex) {
+        apr_thread_mutex_unlock(thread_state_mutex);
+    }
+#endif
 
     return str;
 }
@@ -317,8 +503,40 @@ static int set_unique_id(request_rec *r)
     return DECLINED;
 }
 
+static const char *set_unique_id_format(cmd_parms *cmd, void *dummy,
+                                        const char *arg)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+    if (err != NULL) {
+        return err;
+    }
+
+    if (!ap_cstr_casecmp(arg, "Default")) {
+        unique_id_format = UNIQUE_ID_FORMAT_DEFAULT;
+    }
+    else if (!ap_cstr_casecmp(arg, "UUIDv7")) {
+        unique_id_format = UNIQUE_ID_FORMAT_UUIDV7;
+    }
+    else if (!ap_cstr_casecmp(arg, "ULID")) {
+        unique_id_format = UNIQUE_ID_FORMAT_ULID;
+    }
+    else {
+        return apr_pstrcat(cmd->pool, cmd->cmd->name,
+                           " must be one of Default, UUIDv7 or ULID", NULL);
+    }
+
+    return NULL;
+}
+
+static const command_rec unique_id_cmds[] = {
+    AP_INIT_TAKE1("UniqueIdFormat", set_unique_id_format, NULL, RSRC_CONF,
+                  "The format of UNIQUE_ID: Default, UUIDv7 or ULID"),
+    {NULL}
+};
+
 static void register_hooks(apr_pool_t *p)
 {
+    ap_hook_pre_config(unique_id_pre_config, NULL, NULL, APR_HOOK_MIDDLE);
     ap_hook_post_config(unique_id_global_init, NULL, NULL, APR_HOOK_MIDDLE);
     ap_hook_child_init(unique_id_child_init, NULL, NULL, APR_HOOK_MIDDLE);
     ap_hook_post_read_request(set_unique_id, NULL, NULL, APR_HOOK_MIDDLE);
@@ -331,6 +549,6 @@ AP_DECLARE_MODULE(unique_id) = {
     NULL,                       /* dir merger --- default is to override */
     NULL,                       /* server config */
     NULL,                       /* merge server configs */
-    NULL,                       /* command apr_table_t */
+    unique_id_cmds,             /* command apr_table_t */
     register_hooks              /* register hooks */
 };
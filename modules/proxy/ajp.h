@@ -121,6 +121,8 @@ struct ajp_msg
     int         server_side;
     /** The size of the buffer */
     apr_size_t max_size;
+    /** The allocator of the buffer, when it can be handed to a bucket */
+    apr_bucket_alloc_t *bucket_alloc;
 };
 
 /**
@@ -332,6 +334,33 @@ apr_status_t ajp_msg_get_bytes(ajp_msg_t *msg, apr_byte_t **rvalue,
  */
 apr_status_t ajp_msg_create(apr_pool_t *pool, apr_size_t size, ajp_msg_t **rmsg);
 
+/**
+ * Create an AJP Message whose buffer comes from a bucket allocator, so that
+ * ajp_msg_bucket_create() can hand it over to a bucket. The buffer in use
+ * is freed when the pool is cleaned up.
+ *
+ * @param pool      memory pool to allocate AJP message from
+ * @param list      bucket allocator to allocate the buffer from
+ * @param size      size of the buffer to create
+ * @param rmsg      Pointer to newly created AJP message
+ * @return          APR_SUCCESS or error
+ */
+apr_status_t ajp_msg_create_ba(apr_pool_t *pool, apr_bucket_alloc_t *list,
+                               apr_size_t size, ajp_msg_t **rmsg);
+
+/**
+ * Make a heap bucket of bytes in the buffer of an AJP Message created with
+ * ajp_msg_create_ba(), without copying them. The bucket takes the buffer
+ * over and the message gets a new one.
+ *
+ * @param msg       AJP Message
+ * @param data      start of the bytes, within the buffer of msg
+ * @param len       number of bytes
+ * @return          the bucket
+ */
+apr_bucket *ajp_msg_bucket_create(ajp_msg_t *msg, const char *data,
+                                  apr_size_t len);
+
 /**
  * Recopy an AJP Message to another
  *
@@ -413,12 +442,14 @@ apr_status_t ajp_ilink_receive(apr_socket_t *sock, ajp_msg_t *msg);
  * @param buffsize  max size of the AJP packet.
  * @param uri       requested uri
  * @param secret    authentication secret
+ * @param msg       AJP message to reuse, or NULL to create a new one
  * @return          APR_SUCCESS or error
  */
 apr_status_t ajp_send_header(apr_socket_t *sock, request_rec *r,
                              apr_size_t buffsize,
                              apr_uri_t *uri,
-                             const char *secret);
+                             const char *secret,
+                             ajp_msg_t **msg);
 
 /**
  * Read the ajp message and return the type of the message.
@@ -438,7 +469,7 @@ apr_status_t ajp_read_header(apr_socket_t *sock,
  * @param pool      pool to allocate from
  * @param ptr       data buffer
  * @param len       the length of allocated data buffer
- * @param msg       returned AJP message
+ * @param msg       AJP message to reuse, or NULL to create a new one
  * @return          APR_SUCCESS or error
  */
 apr_status_t  ajp_alloc_data_msg(apr_pool_t *pool, char **ptr,
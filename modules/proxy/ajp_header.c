@@ -672,17 +672,24 @@ apr_status_t ajp_send_header(apr_socket_t *sock,
                              request_rec *r,
                              apr_size_t buffsize,
                              apr_uri_t *uri,
-                             const char *secret)
+                             const char *secret,
+                             ajp_msg_t **rmsg)
 {
     ajp_msg_t *msg;
     apr_status_t rc;
 
-    rc = ajp_msg_create(r->pool, buffsize, &msg);
+    if (*rmsg) {
+        rc = ajp_msg_reuse(*rmsg);
+    }
+    else {
+        rc = ajp_msg_create(r->pool, buffsize, rmsg);
+    }
     if (rc != APR_SUCCESS) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(00987)
                "ajp_send_header: ajp_msg_create failed");
         return rc;
     }
+    msg = *rmsg;
 
     rc = ajp_marshal_into_msgb(msg, r, uri, secret);
     if (rc != APR_SUCCESS) {
@@ -860,7 +867,11 @@ apr_status_t  ajp_alloc_data_msg(apr_pool_t *pool, char **ptr, apr_size_t *len,
 {
     apr_status_t rc;
 
-    if ((rc = ajp_msg_create(pool, *len, msg)) != APR_SUCCESS)
+    if (*msg) {
+        if ((rc = ajp_msg_reuse(*msg)) != APR_SUCCESS)
+            return rc;
+    }
+    else if ((rc = ajp_msg_create(pool, *len, msg)) != APR_SUCCESS)
         return rc;
     ajp_msg_reset(*msg);
     *ptr = (char *)&((*msg)->buf[6]);
@@ -206,11 +206,15 @@ apr_status_t ajp_msg_reuse(ajp_msg_t *msg)
     apr_byte_t *buf;
     apr_size_t max_size;
 
+    apr_bucket_alloc_t *bucket_alloc;
+
     buf = msg->buf;
     max_size = msg->max_size;
+    bucket_alloc = msg->bucket_alloc;
     memset(msg, 0, sizeof(ajp_msg_t));
     msg->buf = buf;
     msg->max_size = max_size;
+    msg->bucket_alloc = bucket_alloc;
     msg->header_len = AJP_HEADER_LEN;
     ajp_msg_reset(msg);
     return APR_SUCCESS;
@@ -573,6 +577,69 @@ apr_status_t ajp_msg_create(apr_pool_t *pool, apr_size_t size, ajp_msg_t **rmsg)
     return APR_SUCCESS;
 }
 
+static apr_status_t ajp_msg_free_buf(void *data)
+{
+    ajp_msg_t *msg = data;
+
+    apr_bucket_free(msg->buf);
+    msg->buf = NULL;
+    return APR_SUCCESS;
+}
+
+/**
+ * Create an AJP Message with a buffer from a bucket allocator
+ *
+ * @param pool      memory pool to allocate AJP message from
+ * @param list      bucket allocator to allocate the buffer from
+ * @param size      size of the buffer to create
+ * @param rmsg      Pointer to newly created AJP message
+ * @return          APR_SUCCESS or error
+ */
+apr_status_t ajp_msg_create_ba(apr_pool_t *pool, apr_bucket_alloc_t *list,
+                               apr_size_t size, ajp_msg_t **rmsg)
+{
+    ajp_msg_t *msg = (ajp_msg_t *)apr_pcalloc(pool, sizeof(ajp_msg_t));
+
+    msg->server_side = 0;
+
+    msg->buf = (apr_byte_t *)apr_bucket_alloc(size, list);
+    msg->len = 0;
+    msg->header_len = AJP_HEADER_LEN;
+    msg->max_size = size;
+    msg->bucket_alloc = list;
+    apr_pool_cleanup_register(pool, msg, ajp_msg_free_buf,
+                              apr_pool_cleanup_null);
+    *rmsg = msg;
+
+    return APR_SUCCESS;
+}
+
+/**
+ * Hand the buffer of an AJP Message over to a heap bucket
+ *
+ * @param msg       AJP Message created with ajp_msg_create_ba()
+ * @param data      start of the bytes, within the buffer of msg
+ * @param len       number of bytes
+ * @return          the bucket
+ */
+apr_bucket *ajp_msg_bucket_create(ajp_msg_t *msg, const char *data,
+                                  apr_size_t len)
+{
+    apr_bucket *e;
+
+    /* The heap bucket frees the whole buffer, its data start at the
+     * offset of the chunk. The next packet goes to a buffer recycled
+     * by the bucket allocator.
+     */
+    e = apr_bucket_heap_create((const char *)msg->buf, msg->max_size,
+                               apr_bucket_free, msg->bucket_alloc);
+    e->start = (apr_off_t)(data - (const char *)msg->buf);
+    e->length = len;
+    msg->buf = (apr_byte_t *)apr_bucket_alloc(msg->max_size,
+                                              msg->bucket_alloc);
+    return e;
+}
+
 /**
  * Recopy an AJP Message to another
  *
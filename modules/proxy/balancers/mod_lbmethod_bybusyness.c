@@ -28,8 +28,8 @@ static APR_OPTIONAL_FN_TYPE(proxy_balancer_get_best_worker)
 static int is_best_bybusyness(proxy_worker *current, proxy_worker *prev_best, void *baton)
 {
     int *total_factor = (int *)baton;
+    int lbstatus = PROXY_WORKER_LBSTATUS_ADD(current, current->s->lbfactor);
 
-    current->s->lbstatus += current->s->lbfactor;
     *total_factor += current->s->lbfactor;
 
     return (
@@ -37,7 +37,7 @@ static int is_best_bybusyness(proxy_worker *current, proxy_worker *prev_best, vo
         || (current->s->busy < prev_best->s->busy)
         || (
             (current->s->busy == prev_best->s->busy)
-            && (current->s->lbstatus > prev_best->s->lbstatus)
+            && (lbstatus > prev_best->s->lbstatus)
         )
     );
 }
@@ -51,7 +51,7 @@ static proxy_worker *find_best_bybusyness(proxy_balancer *balancer,
                                           &total_factor);
 
     if (worker) {
-        worker->s->lbstatus -= total_factor;
+        (void)PROXY_WORKER_LBSTATUS_ADD(worker, -total_factor);
     }
 
     return worker;
@@ -82,7 +82,8 @@ static const proxy_balancer_method bybusyness =
     NULL,
     &reset,
     &age,
-    NULL
+    NULL,
+    PROXY_LBMETHOD_F_CONCURRENT
 };
 
 /* post_config hook: */
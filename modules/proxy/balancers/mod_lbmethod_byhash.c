@@ -0,0 +1,378 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Consistent hashing load balancing: each member owns points on a hash
+ * ring (in proportion to its loadfactor), and a request goes to the
+ * owner of the first point following the hash of its key. Adding or
+ * removing a member thus only moves the keys of its own points, which
+ * keeps the caches of the other members warm. Members busier than the
+ * configured bound are skipped (consistent hashing with bounded loads).
+ */
+
+#include "mod_proxy.h"
+#include "ap_expr.h"
+
+module AP_MODULE_DECLARE_DATA lbmethod_byhash_module;
+
+static APR_OPTIONAL_FN_TYPE(proxy_balancer_get_best_worker)
+                            *ap_proxy_balancer_get_best_worker_fn = NULL;
+static APR_OPTIONAL_FN_TYPE(ap_proxy_retry_worker)
+                            *ap_proxy_retry_worker_fn = NULL;
+
+/* Points on the ring per loadfactor unit (lbfactor 100) */
+#define HASH_POINTS 40
+
+/* Default bound of a member's load relative to the average (x100) */
+#define HASH_DEFAULT_BOUND 125
+
+typedef struct {
+    ap_expr_info_t *key;
+    int bound;
+    unsigned int key_set:1,
+                 bound_set:1;
+} byhash_dir_conf;
+
+typedef struct {
+    unsigned int hash;
+    int index;
+} byhash_point;
+
+/* Per-process ring of a balancer, in balancer->context */
+typedef struct {
+    apr_pool_t *pool;
+    apr_time_t wupdated;
+    int nelts;
+    int npoints;
+    byhash_point *points;
+} byhash_ring;
+
+static int point_cmp(const void *a, const void *b)
+{
+    unsigned int ha = ((const byhash_point *)a)->hash,
+                 hb = ((const byhash_point *)b)->hash;
+    return (ha > hb) - (ha < hb);
+}
+
+/* assumed to be mutex protected by caller */
+static byhash_ring *get_ring(proxy_balancer *balancer, server_rec *s)
+{
+    byhash_ring *ring = balancer->context;
+    proxy_worker **workers = (proxy_worker **)balancer->workers->elts;
+    int i, j, n;
+
+    if (ring && ring->wupdated == balancer->wupdated
+             && ring->nelts == balancer->workers->nelts) {
+        return ring;
+    }
+
+    /* (Re)build it when the members change, which includes any edit
+     * from the balancer-manager.
+     */
+    if (!ring) {
+        ring = apr_pcalloc(s->process->pconf, sizeof(*ring));
+        apr_pool_create(&ring->pool, s->process->pconf);
+        apr_pool_tag(ring->pool, "lbmethod_byhash_ring");
+        balancer->context = ring;
+    }
+    else {
+        apr_pool_clear(ring->pool);
+    }
+
+    n = 0;
+    for (i = 0; i < balancer->workers->nelts; i++) {
+        n += workers[i]->s->lbfactor * HASH_POINTS / 100 + 1;
+    }
+    ring->points = apr_palloc(ring->pool, n * sizeof(byhash_point));
+    ring->npoints = 0;
+    for (i = 0; i < balancer->workers->nelts; i++) {
+        proxy_worker *worker = workers[i];
+        int m = worker->s->lbfactor * HASH_POINTS / 100 + 1;
+        char buf[PROXY_WORKER_MAX_NAME_SIZE + 16];
+
+        for (j = 0; j < m; j++) {
+            byhash_point *point = &ring->points[ring->npoints++];
+            apr_snprintf(buf, sizeof(buf), "%s#%d",
+                         *worker->s->route ? worker->s->route
+                                           : worker->s->name, j);
+            point->hash = ap_proxy_hashfunc(buf, PROXY_HASHFUNC_DEFAULT);
+            point->index = i;
+        }
+    }
+    qsort(ring->points, ring->npoints, sizeof(byhash_point), point_cmp);
+
+    ring->wupdated = balancer->wupdated;
+    ring->nelts = balancer->workers->nelts;
+
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(10454)
+                 "%s: built hash ring of %d points for %d members",
+                 balancer->s->name, ring->npoints, ring->nelts);
+    return ring;
+}
+
+static int is_eligible(proxy_worker *worker)
+{
+    return (PROXY_WORKER_IS_USABLE(worker)
+            && !PROXY_WORKER_IS_DRAINING(worker)
+            && !PROXY_WORKER_IS_SPARE(worker)
+            && !PROXY_WORKER_IS_STANDBY(worker));
+}
+
+static int is_best_byhash(proxy_worker *current, proxy_worker *prev_best,
+                          void *baton)
+{
+    return !prev_best || current->s->busy < prev_best->s->busy;
+}
+
+static proxy_worker *find_best_byhash(proxy_balancer *balancer,
+                                      request_rec *r)
+{
+    byhash_dir_conf *conf = ap_get_module_config(r->per_dir_config,
+                                                 &lbmethod_byhash_module);
+    proxy_worker **workers = (proxy_worker **)balancer->workers->elts;
+    proxy_worker *worker, *first = NULL, *best = NULL;
+    apr_size_t cap = 0;
+    byhash_ring *ring;
+    const char *key;
+    unsigned int hash;
+    int lo, hi, i;
+
+    if (conf->key) {
+        const char *err = NULL;
+        key = ap_expr_str_exec(r, conf->key, &err);
+        if (err) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(10455)
+                          "%s: could not evaluate the hash key: %s",
+                          balancer->s->name, err);
+            key = NULL;
+        }
+    }
+    else {
+        key = r->unparsed_uri;
+    }
+
+    ring = get_ring(balancer, r->server);
+    if (!key || !ring->npoints) {
+        return ap_proxy_balancer_get_best_worker_fn(balancer, r,
+                                                    is_best_byhash, NULL);
+    }
+
+    /* Find the first point at or after the hash, wrapping around */
+    hash = ap_proxy_hashfunc(key, PROXY_HASHFUNC_DEFAULT);
+    lo = 0;
+    hi = ring->npoints;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (ring->points[mid].hash < hash) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+
+    /* Give the owner a chance to come back from error, it's the one
+     * which should have this key.
+     */
+    worker = workers[ring->points[lo % ring->npoints].index];
+    if (!PROXY_WORKER_IS_USABLE(worker) && ap_proxy_retry_worker_fn) {
+        ap_proxy_retry_worker_fn("BALANCER", worker, r->server);
+    }
+
+    for (i = 0; i < ring->npoints; i++) {
+        worker = workers[ring->points[(lo + i) % ring->npoints].index];
+        if (!is_eligible(worker)) {
+            continue;
+        }
+        if (!first) {
+            first = worker;
+        }
+        if (!conf->bound || !worker->s->busy) {
+            best = worker;
+            break;
+        }
+        if (!cap) {
+            /* Bound: ceil(bound * (total + 1) / members) */
+            apr_size_t total = 1;
+            int j, n = 0;
+            for (j = 0; j < balancer->workers->nelts; j++) {
+                if (is_eligible(workers[j])) {
+                    total += workers[j]->s->busy;
+                    n++;
+                }
+            }
+            cap = (total * conf->bound + n * 100 - 1) / (n * 100);
+        }
+        if (worker->s->busy < cap) {
+            best = worker;
+            break;
+        }
+    }
+    if (!best) {
+        best = first;
+    }
+    if (!best) {
+        /* No member on the ring, let spares and standbys in */
+        best = ap_proxy_balancer_get_best_worker_fn(balancer, r,
+                                                    is_best_byhash, NULL);
+    }
+
+    ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r,
+                  "%s: key '%s' (%u) maps to %s", balancer->s->name, key,
+                  hash, best ? best->s->name : "no member");
+    return best;
+}
+
+/* assumed to be mutex protected by caller */
+static apr_status_t reset(proxy_balancer *balancer, server_rec *s)
+{
+    byhash_ring *ring = balancer->context;
+
+    if (ring) {
+        /* Force a rebuild */
+        ring->nelts = -1;
+    }
+    return APR_SUCCESS;
+}
+
+static apr_status_t age(proxy_balancer *balancer, server_rec *s)
+{
+    return APR_SUCCESS;
+}
+
+static const proxy_balancer_method byhash =
+{
+    "byhash",
+    &find_best_byhash,
+    NULL,
+    &reset,
+    &age,
+    NULL
+};
+
+static void *create_byhash_dir_config(apr_pool_t *p, char *dummy)
+{
+    byhash_dir_conf *conf = apr_pcalloc(p, sizeof(*conf));
+
+    conf->bound = HASH_DEFAULT_BOUND;
+
+    return conf;
+}
+
+static void *merge_byhash_dir_config(apr_pool_t *p, void *basev, void *addv)
+{
+    byhash_dir_conf *new = apr_pcalloc(p, sizeof(*new));
+    byhash_dir_conf *add = addv;
+    byhash_dir_conf *base = basev;
+
+    new->key = (add->key_set) ? add->key : base->key;
+    new->key_set = add->key_set || base->key_set;
+    new->bound = (add->bound_set) ? add->bound : base->bound;
+    new->bound_set = add->bound_set || base->bound_set;
+
+    return new;
+}
+
+static const char *set_hash_key(cmd_parms *cmd, void *dconf, const char *arg)
+{
+    byhash_dir_conf *conf = dconf;
+    const char *err = NULL;
+
+    conf->key = ap_expr_parse_cmd(cmd, arg, AP_EXPR_FLAG_STRING_RESULT,
+                                  &err, NULL);
+    if (err) {
+        return apr_psprintf(cmd->pool, "Could not parse hash key '%s': %s",
+                            arg, err);
+    }
+    conf->key_set = 1;
+
+    return NULL;
+}
+
+static const char *set_hash_bound(cmd_parms *cmd, void *dconf, const char *arg)
+{
+    byhash_dir_conf *conf = dconf;
+    double bound;
+
+    if (!strcasecmp(arg, "off")) {
+        conf->bound = 0;
+    }
+    else {
+        bound = atof(arg);
+        if (bound < 1.0 || bound > 100.0) {
+            return "BalancerHashBound must be 'off' or a number between "
+                   "1.0 and 100.0";
+        }
+        conf->bound = (int)(bound * 100.0);
+    }
+    conf->bound_set = 1;
+
+    return NULL;
+}
+
+static const command_rec byhash_cmds[] =
+{
+    AP_INIT_TAKE1("BalancerHashKey", set_hash_key, NULL,
+                  RSRC_CONF|ACCESS_CONF,
+                  "Expression of the key used to place requests on the "
+                  "hash ring, the request URI by default"),
+    AP_INIT_TAKE1("BalancerHashBound", set_hash_bound, NULL,
+                  RSRC_CONF|ACCESS_CONF,
+                  "Maximum load of a member relative to the average load, "
+                  "or 'off'"),
+    {NULL}
+};
+
+/* post_config hook: */
+static int lbmethod_byhash_post_config(apr_pool_t *pconf, apr_pool_t *plog,
+        apr_pool_t *ptemp, server_rec *s)
+{
+
+    /* lbmethod_byhash_post_config() will be called twice during startup.  So, don't
+     * set up the static data the 1st time through. */
+    if (ap_state_query(AP_SQ_MAIN_STATE) == AP_SQ_MS_CREATE_PRE_CONFIG) {
+        return OK;
+    }
+
+    ap_proxy_balancer_get_best_worker_fn =
+                 APR_RETRIEVE_OPTIONAL_FN(proxy_balancer_get_best_worker);
+    if (!ap_proxy_balancer_get_best_worker_fn) {
+        ap_log_error(APLOG_MARK, APLOG_EMERG, 0, s, APLOGNO(10453)
+                     "mod_proxy must be loaded for mod_lbmethod_byhash");
+        return !OK;
+    }
+    ap_proxy_retry_worker_fn =
+                 APR_RETRIEVE_OPTIONAL_FN(ap_proxy_retry_worker);
+
+    return OK;
+}
+
+static void register_hook(apr_pool_t *p)
+{
+    ap_register_provider(p, PROXY_LBMETHOD, "byhash", "0", &byhash);
+    ap_hook_post_config(lbmethod_byhash_post_config, NULL, NULL, APR_HOOK_MIDDLE);
+}
+
+AP_DECLARE_MODULE(lbmethod_byhash) = {
+    STANDARD20_MODULE_STUFF,
+    create_byhash_dir_config, /* create per-directory config structure */
+    merge_byhash_dir_config,  /* merge per-directory config structures */
+    NULL,       /* create per-server config structure */
+    NULL,       /* merge per-server config structures */
+    byhash_cmds, /* command apr_table_t */
+    register_hook /* register hooks */
+};
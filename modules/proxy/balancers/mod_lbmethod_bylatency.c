@@ -0,0 +1,160 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Latency aware "power of two choices" load balancing: two members are
+ * picked at random and the request goes to the one with the lowest
+ * response time average weighted by the number of requests it is busy
+ * with. This avoids scanning all the members on each request, the usual
+ * scan being used only as a fallback when the picks are not eligible.
+ * The response time average of the members is maintained by
+ * mod_proxy_balancer.
+ */
+
+#include "mod_proxy.h"
+#include "apr_atomic.h"
+
+module AP_MODULE_DECLARE_DATA lbmethod_bylatency_module;
+
+static APR_OPTIONAL_FN_TYPE(proxy_balancer_get_best_worker)
+                            *ap_proxy_balancer_get_best_worker_fn = NULL;
+
+static apr_uint64_t worker_score(proxy_worker *worker)
+{
+    apr_uint64_t score;
+
+    /* A member never measured yet (latency 0) is tried first */
+    score = (apr_uint64_t)apr_atomic_read32(&worker->s->latency) *
+            (worker->s->busy + 1);
+    if (worker->s->lbfactor > 0) {
+        score = score * 100 / worker->s->lbfactor;
+    }
+    return score;
+}
+
+static int is_best_bylatency(proxy_worker *current, proxy_worker *prev_best,
+                             void *baton)
+{
+    return !prev_best || worker_score(current) < worker_score(prev_best);
+}
+
+/* Whether a randomly picked member can be elected without a full scan,
+ * that is one which would be considered first by it too.
+ */
+static int is_eligible(proxy_worker *worker)
+{
+    return (PROXY_WORKER_IS_USABLE(worker)
+            && !PROXY_WORKER_IS_DRAINING(worker)
+            && !PROXY_WORKER_IS_SPARE(worker)
+            && !PROXY_WORKER_IS_STANDBY(worker)
+            && worker->s->lbset == 0);
+}
+
+static proxy_worker *find_best_bylatency(proxy_balancer *balancer,
+                                         request_rec *r)
+{
+    proxy_worker **workers = (proxy_worker **)balancer->workers->elts;
+    int nelts = balancer->workers->nelts;
+    proxy_worker *worker = NULL;
+
+    if (nelts > 1) {
+        apr_uint32_t i = ap_random_pick(0, nelts - 1),
+                     j = ap_random_pick(0, nelts - 2);
+        if (j >= i) {
+            j++;
+        }
+        if (is_eligible(workers[i]) && is_eligible(workers[j])) {
+            worker = (worker_score(workers[j]) < worker_score(workers[i]))
+                     ? workers[j] : workers[i];
+        }
+    }
+    if (!worker) {
+        /* Unlucky picks, this applies lbset, spares, standbys and retries */
+        worker = ap_proxy_balancer_get_best_worker_fn(balancer, r,
+                                                      is_best_bylatency,
+                                                      NULL);
+    }
+
+    return worker;
+}
+
+/* assumed to be mutex protected by caller */
+static apr_status_t reset(proxy_balancer *balancer, server_rec *s)
+{
+    int i;
+    proxy_worker **worker;
+    worker = (proxy_worker **)balancer->workers->elts;
+    for (i = 0; i < balancer->workers->nelts; i++, worker++) {
+        (*worker)->s->lbstatus = 0;
+        apr_atomic_set32(&(*worker)->s->latency, 0);
+    }
+    return APR_SUCCESS;
+}
+
+static apr_status_t age(proxy_balancer *balancer, server_rec *s)
+{
+    return APR_SUCCESS;
+}
+
+static const proxy_balancer_method bylatency =
+{
+    "bylatency",
+    &find_best_bylatency,
+    NULL,
+    &reset,
+    &age,
+    NULL,
+    PROXY_LBMETHOD_F_CONCURRENT
+};
+
+/* post_config hook: */
+static int lbmethod_bylatency_post_config(apr_pool_t *pconf, apr_pool_t *plog,
+        apr_pool_t *ptemp, server_rec *s)
+{
+
+    /* lbmethod_bylatency_post_config() will be called twice during startup.  So, don't
+     * set up the static data the 1st time through. */
+    if (ap_state_query(AP_SQ_MAIN_STATE) == AP_SQ_MS_CREATE_PRE_CONFIG) {
+        return OK;
+    }
+
+    ap_proxy_balancer_get_best_worker_fn =
+                 APR_RETRIEVE_OPTIONAL_FN(proxy_balancer_get_best_worker);
+    if (!ap_proxy_balancer_get_best_worker_fn) {
+        ap_log_error(APLOG_MARK, APLOG_EMERG, 0, s, APLOGNO(10452)
+                     "mod_proxy must be loaded for mod_lbmethod_bylatency");
+        return !OK;
+    }
+
+    return OK;
+}
+
+static void register_hook(apr_pool_t *p)
+{
+    ap_register_provider(p, PROXY_LBMETHOD, "bylatency", "0", &bylatency);
+    ap_hook_post_config(lbmethod_bylatency_post_config, NULL, NULL, APR_HOOK_MIDDLE);
+}
+
+AP_DECLARE_MODULE(lbmethod_bylatency) = {
+    STANDARD20_MODULE_STUFF,
+    NULL,       /* create per-directory config structure */
+    NULL,       /* merge per-directory config structures */
+    NULL,       /* create per-server config structure */
+    NULL,       /* merge per-server config structures */
+    NULL,       /* command apr_table_t */
+    register_hook /* register hooks */
+};
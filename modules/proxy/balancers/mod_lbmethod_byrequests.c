@@ -28,11 +28,11 @@ static APR_OPTIONAL_FN_TYPE(proxy_balancer_get_best_worker)
 static int is_best_byrequests(proxy_worker *current, proxy_worker *prev_best, void *baton)
 {
     int *total_factor = (int *)baton;
+    int lbstatus = PROXY_WORKER_LBSTATUS_ADD(current, current->s->lbfactor);
 
-    current->s->lbstatus += current->s->lbfactor;
     *total_factor += current->s->lbfactor;
 
-    return (!prev_best || (current->s->lbstatus > prev_best->s->lbstatus));
+    return (!prev_best || (lbstatus > prev_best->s->lbstatus));
 }
 
 /*
@@ -87,7 +87,7 @@ static proxy_worker *find_best_byrequests(proxy_balancer *balancer,
     proxy_worker *worker = ap_proxy_balancer_get_best_worker_fn(balancer, r, is_best_byrequests, &total_factor);
 
     if (worker) {
-        worker->s->lbstatus -= total_factor;
+        (void)PROXY_WORKER_LBSTATUS_ADD(worker, -total_factor);
     }
 
     return worker;
@@ -123,7 +123,8 @@ static const proxy_balancer_method byrequests =
     NULL,
     &reset,
     &age,
-    NULL
+    NULL,
+    PROXY_LBMETHOD_F_CONCURRENT
 };
 
 /* post_config hook: */
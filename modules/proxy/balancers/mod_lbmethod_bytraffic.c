@@ -93,7 +93,8 @@ static const proxy_balancer_method bytraffic =
     NULL,
     &reset,
     &age,
-    NULL
+    NULL,
+    PROXY_LBMETHOD_F_CONCURRENT
 };
 
 /* post_config hook: */
@@ -29,6 +29,13 @@
 #define LBM_HEARTBEAT_MAX_LASTSEEN (10)
 #endif
 
+#ifndef LBM_HEARTBEAT_CACHE_INTERVAL
+/* How often (in seconds) the children check whether the HeartbeatStorage
+ * file changed, between which they use the servers they parsed last.
+ */
+#define LBM_HEARTBEAT_CACHE_INTERVAL (1)
+#endif
+
 module AP_MODULE_DECLARE_DATA lbmethod_heartbeat_module;
 
 static int (*ap_proxy_retry_worker_fn)(const char *proxy_function,
@@ -61,6 +68,26 @@ typedef struct ctx_servers {
     apr_hash_t *servers;
 } ctx_servers_t;
 
+/*
+ * The servers of the HeartbeatStorage file, parsed again by each child only
+ * when the modification time, size or inode of the file change.
+ */
+typedef struct hb_cache_t {
+    apr_pool_t *parent;
+    apr_pool_t *pool;           /* the servers, replaced on changes */
+    apr_hash_t *servers;
+    apr_time_t checked;         /* when the file was checked last */
+    apr_time_t mtime;
+    apr_off_t size;
+    apr_ino_t inode;
+    apr_status_t rv;            /* the result of the last read */
+#if APR_HAS_THREADS
+    apr_thread_mutex_t *mutex;
+#endif
+} hb_cache_t;
+
+static hb_cache_t *hb_cache = NULL;
+
 static void
 argstr_to_table(apr_pool_t *p, char *str, apr_table_t *parms)
 {
@@ -242,6 +269,105 @@ static apr_status_t readslot_heartbeats(ctx_servers_t *ctx,
 }
 
 
+static apr_status_t refresh_cache_heartbeats(hb_cache_t *cache,
+                                             const char *path,
+                                             apr_time_t now,
+                                             apr_pool_t *pool)
+{
+    apr_finfo_t fi;
+    apr_pool_t *ptemp, *p;
+    apr_hash_t *servers;
+    apr_hash_index_t *hi;
+    apr_status_t rv;
+
+    cache->checked = now;
+
+    rv = apr_stat(&fi, path, APR_FINFO_MTIME | APR_FINFO_SIZE |
+                  APR_FINFO_INODE, pool);
+    if (rv != APR_SUCCESS && !APR_STATUS_IS_INCOMPLETE(rv)) {
+        return rv;
+    }
+    if (cache->servers && fi.mtime == cache->mtime && fi.size == cache->size
+            && fi.inode == cache->inode) {
+        return APR_SUCCESS;
+    }
+
+    /* parse in a scratch pool, which closes the file, then keep a copy */
+    apr_pool_create(&ptemp, pool);
+    apr_pool_tag(ptemp, "lb_heartbeat_parse");
+    servers = apr_hash_make(ptemp);
+    rv = readfile_heartbeats(path, servers, ptemp);
+    if (rv) {
+        apr_pool_destroy(ptemp);
+        return rv;
+    }
+
+    apr_pool_create(&p, cache->parent);
+    apr_pool_tag(p, "lb_heartbeat_cache");
+    cache->servers = apr_hash_make(p);
+    for (hi = apr_hash_first(ptemp, servers); hi; hi = apr_hash_next(hi)) {
+        hb_server_t *server = apr_pmemdup(p, apr_hash_this_val(hi),
+                                          sizeof(hb_server_t));
+        server->ip = apr_pstrdup(p, server->ip);
+        apr_hash_set(cache->servers, server->ip, APR_HASH_KEY_STRING, server);
+    }
+    apr_pool_destroy(ptemp);
+
+    if (cache->pool) {
+        apr_pool_destroy(cache->pool);
+    }
+    cache->pool = p;
+    cache->mtime = fi.mtime;
+    cache->size = fi.size;
+    cache->inode = fi.inode;
+
+    return APR_SUCCESS;
+}
+
+static apr_status_t cache_heartbeats(hb_cache_t *cache, const char *path,
+                                     apr_hash_t *servers, apr_pool_t *pool)
+{
+    apr_time_t now = apr_time_now();
+    apr_hash_index_t *hi;
+    apr_status_t rv;
+
+    if (!path) {
+        return APR_SUCCESS;
+    }
+
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(cache->mutex);
+#endif
+
+    if (!cache->servers || now < cache->checked
+            || now - cache->checked >=
+               apr_time_from_sec(LBM_HEARTBEAT_CACHE_INTERVAL)) {
+        cache->rv = refresh_cache_heartbeats(cache, path, now, pool);
+    }
+
+    rv = cache->rv;
+    if (rv == APR_SUCCESS) {
+        /* the lastseen of the file ages with the file */
+        int age = (int)apr_time_sec(now - cache->mtime);
+
+        for (hi = apr_hash_first(pool, cache->servers); hi;
+             hi = apr_hash_next(hi)) {
+            hb_server_t *server = apr_pmemdup(pool, apr_hash_this_val(hi),
+                                              sizeof(hb_server_t));
+            if (server->seen >= 0 && age > 0) {
+                server->seen += age;
+            }
+            apr_hash_set(servers, server->ip, APR_HASH_KEY_STRING, server);
+        }
+    }
+
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(cache->mutex);
+#endif
+
+    return rv;
+}
+
 static apr_status_t read_heartbeats(const char *path, apr_hash_t *servers,
                                         apr_pool_t *pool)
 {
@@ -251,7 +377,9 @@ static apr_status_t read_heartbeats(const char *path, apr_hash_t *servers,
         ctx.now = apr_time_now();
         ctx.servers = servers;
         rv = readslot_heartbeats(&ctx, pool);
-    } else
+    } else if (hb_cache)
+        rv = cache_heartbeats(hb_cache, path, servers, pool);
+    else
         rv = readfile_heartbeats(path, servers, pool);
     return rv;
 }
@@ -398,11 +526,30 @@ static int lb_hb_init(apr_pool_t *p, apr_pool_t *plog,
     return OK;
 }
 
+static void lb_hb_child_init(apr_pool_t *p, server_rec *s)
+{
+    hb_cache = NULL;
+    if (hm_serversmem) {
+        return;
+    }
+
+    hb_cache = apr_pcalloc(p, sizeof(hb_cache_t));
+    hb_cache->parent = p;
+#if APR_HAS_THREADS
+    if (apr_thread_mutex_create(&hb_cache->mutex, APR_THREAD_MUTEX_DEFAULT,
+                                p) != APR_SUCCESS) {
+        /* read the file on each request, as without the cache */
+        hb_cache = NULL;
+    }
+#endif
+}
+
 static void register_hooks(apr_pool_t *p)
 {
     static const char * const aszPred[]={ "mod_heartmonitor.c", NULL };
     ap_register_provider(p, PROXY_LBMETHOD, "heartbeat", "0", &heartbeat);
     ap_hook_post_config(lb_hb_init, aszPred, NULL, APR_HOOK_MIDDLE);
+    ap_hook_child_init(lb_hb_child_init, NULL, NULL, APR_HOOK_MIDDLE);
 }
 
 static void *lb_hb_create_config(apr_pool_t *p, server_rec *s)
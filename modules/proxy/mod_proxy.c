@@ -143,6 +143,15 @@ static const char *set_worker_param(apr_pool_t *p,
             return "Min must be a positive number";
         worker->s->min = ival;
     }
+    else if (!strcasecmp(key, "prewarm")) {
+        /* Number of connections to establish when the child
+         * process starts
+         */
+        ival = atoi(val);
+        if (ival < 0)
+            return "Prewarm must be a positive number";
+        worker->s->prewarm = ival;
+    }
     else if (!strcasecmp(key, "max")) {
         /* Maximum number of connections to remote
          */
@@ -209,6 +218,16 @@ static const char *set_worker_param(apr_pool_t *p,
             return "KeepAlive must be On|Off";
         worker->s->keepalive_set = 1;
     }
+    else if (!strcasecmp(key, "fastopen")) {
+        /* Send the first data in the SYN (TCP Fast Open)
+         */
+        if (!strcasecmp(val, "on"))
+            worker->s->fastopen = 1;
+        else if (!strcasecmp(val, "off"))
+            worker->s->fastopen = 0;
+        else
+            return "FastOpen must be On|Off";
+    }
     else if (!strcasecmp(key, "disablereuse")) {
         if (!strcasecmp(val, "on"))
             worker->s->disablereuse = 1;
@@ -484,6 +503,37 @@ static const char *set_balancer_param(proxy_server_conf *conf,
             return "failontimeout must be On|Off";
         balancer->failontimeout_set = 1;
     }
+    else if (!strcasecmp(key, "outlierlatency")) {
+        /* Put members whose average response time exceeds this
+         * many times the balancer's average in error state.
+         */
+        ival = atoi(val);
+        if (ival < 0)
+            return "outlierlatency must be a positive number (or 0 for off)";
+        balancer->outlier_latency = ival;
+        balancer->outlier_latency_set = 1;
+    }
+    else if (!strcasecmp(key, "outliererrors")) {
+        /* Put members whose rate of 5xx responses exceeds this
+         * percentage in error state.
+         */
+        ival = atoi(val);
+        if (ival < 0 || ival > 100)
+            return "outliererrors must be a percentage between 0 and 100";
+        balancer->outlier_errors = ival;
+        balancer->outlier_errors_set = 1;
+    }
+    else if (!strcasecmp(key, "hedge")) {
+        /* Resend idempotent requests to another member if the elected
+         * one did not respond after this many times its average
+         * response time.
+         */
+        ival = atoi(val);
+        if (ival < 0)
+            return "hedge must be a positive number (or 0 for off)";
+        balancer->hedge = ival;
+        balancer->hedge_set = 1;
+    }
     else if (!strcasecmp(key, "nonce")) {
         if (!strcasecmp(val, "None")) {
             *balancer->s->nonce = '\0';
@@ -1468,10 +1518,12 @@ static int proxy_handler(request_rec *r)
                                       "Using proxy auth creds %s", ents[i].creds);
                     }
 
+                    proxy_run_backend_step(r, worker, PROXY_BACKEND_START);
                     access_status = proxy_run_scheme_handler(r, worker,
                                                              conf, url,
                                                              ents[i].hostname,
                                                              ents[i].port);
+                    proxy_run_backend_step(r, worker, PROXY_BACKEND_DONE);
 
                     if (ents[i].creds) apr_table_unset(r->notes, "proxy-basic-creds");
 
@@ -1522,8 +1574,10 @@ static int proxy_handler(request_rec *r)
                       "Running scheme %s handler (attempt %d)",
                       scheme, attempts);
         AP_PROXY_RUN(r, worker, conf, url, attempts);
+        proxy_run_backend_step(r, worker, PROXY_BACKEND_START);
         access_status = proxy_run_scheme_handler(r, worker, conf,
                                                  url, NULL, 0);
+        proxy_run_backend_step(r, worker, PROXY_BACKEND_DONE);
         if (access_status == OK
                 || apr_table_get(r->notes, "proxy-error-override"))
             break;
@@ -1729,6 +1783,18 @@ static apr_array_header_t *merge_balancers(apr_pool_t *p,
                     b2->failontimeout_set = tmp.failontimeout_set;
                     b2->failontimeout = tmp.failontimeout;
                 }
+                if (tmp.outlier_latency_set) {
+                    b2->outlier_latency_set = tmp.outlier_latency_set;
+                    b2->outlier_latency = tmp.outlier_latency;
+                }
+                if (tmp.outlier_errors_set) {
+                    b2->outlier_errors_set = tmp.outlier_errors_set;
+                    b2->outlier_errors = tmp.outlier_errors;
+                }
+                if (tmp.hedge_set) {
+                    b2->hedge_set = tmp.hedge_set;
+                    b2->hedge = tmp.hedge;
+                }
                 if (!apr_is_empty_array(tmp.errstatuses)) {
                     apr_array_cat(tmp.errstatuses, b2->errstatuses);
                     b2->errstatuses = tmp.errstatuses;
@@ -1922,6 +1988,11 @@ static void *merge_proxy_dir_config(apr_pool_t *p, void *basev, void *addv)
                                            : add->async_idle_timeout;
     new->async_idle_timeout_set = add->async_idle_timeout_set
                                   || base->async_idle_timeout_set;
+    new->response_buffer_limit =
+        (add->response_buffer_limit_set == 0) ? base->response_buffer_limit
+                                              : add->response_buffer_limit;
+    new->response_buffer_limit_set = add->response_buffer_limit_set
+                                     || base->response_buffer_limit_set;
 
     return new;
 }
@@ -2530,6 +2601,20 @@ static const char *
     return NULL;
 }
 
+static const char *
+    set_response_buffer_limit(cmd_parms *parms, void *dconf, const char *arg)
+{
+    proxy_dir_conf *conf = dconf;
+    char *end;
+    if (apr_strtoff(&conf->response_buffer_limit, arg, &end, 10)
+            || *end || conf->response_buffer_limit < 0) {
+        return "ProxyResponseBufferLimit must be a positive number of bytes "
+               "(or 0 to disable)";
+    }
+    conf->response_buffer_limit_set = 1;
+    return NULL;
+}
+
 static const char *
     set_recv_buffer_size(cmd_parms *parms, void *dummy, const char *arg)
 {
@@ -3135,6 +3220,10 @@ static const command_rec proxy_cmds[] =
      "Amount of time to poll before going asynchronous"),
     AP_INIT_TAKE1("ProxyAsyncIdleTimeout", set_proxy_async_idle, NULL, RSRC_CONF|ACCESS_CONF,
      "Timeout for asynchronous inactivity, ProxyTimeout by default"),
+    AP_INIT_TAKE1("ProxyResponseBufferLimit", set_response_buffer_limit, NULL,
+     RSRC_CONF|ACCESS_CONF,
+     "Maximum number of response bytes buffered for a slow client before "
+     "reading from the backend is paused, 0 (default) for no limit"),
     {NULL}
 };
 
@@ -3540,6 +3629,10 @@ APR_IMPLEMENT_OPTIONAL_HOOK_RUN_ALL(proxy, PROXY, int, request_status,
 APR_IMPLEMENT_OPTIONAL_HOOK_RUN_ALL(proxy, PROXY, int, detach_backend,
                                     (request_rec *r, proxy_conn_rec *backend),
                                     (r, backend), OK, DECLINED)
+APR_IMPLEMENT_OPTIONAL_HOOK_RUN_ALL(proxy, PROXY, int, backend_step,
+                                    (request_rec *r, proxy_worker *worker,
+                                     proxy_backend_step_e step),
+                                    (r, worker, step), OK, DECLINED)
 APR_IMPLEMENT_EXTERNAL_HOOK_RUN_ALL(proxy, PROXY, int, tunnel_forward,
                                     (proxy_tunnel_rec *tunnel,
                                      conn_rec *c_i, conn_rec *c_o,
@@ -47,6 +47,7 @@
 #include "util_mutex.h"
 #include "apr_global_mutex.h"
 #include "apr_thread_mutex.h"
+#include "apr_atomic.h"
 
 #include "httpd.h"
 #include "http_config.h"
@@ -254,6 +255,9 @@ typedef struct {
     apr_interval_time_t async_idle_timeout;
     unsigned int async_delay_set:1;
     unsigned int async_idle_timeout_set:1;
+
+    apr_off_t response_buffer_limit;
+    unsigned int response_buffer_limit_set:1;
 } proxy_dir_conf;
 
 /* if we interpolate env vars per-request, we'll need a per-request
@@ -482,6 +486,13 @@ typedef struct {
     unsigned int     was_malloced:1;
     unsigned int     is_name_matchable:1;
     unsigned int     response_field_size_set:1;
+    int             prewarm;    /* connections to open at child startup */
+    apr_size_t      reused;     /* Number of times a pooled connection was reused */
+    apr_size_t      connected;  /* Number of new connections to the backend */
+    apr_uint32_t    latency;    /* moving average of the response time (us) */
+    apr_uint32_t    errors;     /* moving average of the 5xx rate (ppm) */
+    apr_uint32_t    samples;    /* responses accounted in the averages (capped) */
+    unsigned int     fastopen:1; /* TCP Fast Open to the backend */
 } proxy_worker_shared;
 
 #define ALIGNED_PROXY_WORKER_SHARED_SIZE (APR_ALIGN_DEFAULT(sizeof(proxy_worker_shared)))
@@ -537,6 +548,7 @@ typedef struct {
     unsigned int    sticky_force_set:1; 
     unsigned int    nonce_set:1;
     unsigned int    sticky_separator_set:1;
+    apr_uint32_t    latency;    /* moving average of the members' response time (us) */
 } proxy_balancer_shared;
 
 #define ALIGNED_PROXY_BALANCER_SHARED_SIZE (APR_ALIGN_DEFAULT(sizeof(proxy_balancer_shared)))
@@ -559,9 +571,15 @@ struct proxy_balancer {
     void            *context;    /* general purpose storage */
     proxy_balancer_shared *s;    /* Shared data */
     int failontimeout;           /* Whether to mark a member in Err if IO timeout occurs */
+    int outlier_latency;         /* Put in Err members slower than this many times the average */
+    int outlier_errors;          /* Put in Err members answering 5xx more than this percentage */
+    int hedge;                   /* Hedge requests after this many times the average response time */
     unsigned int failontimeout_set:1;
     unsigned int growth_set:1;
     unsigned int lbmethod_set:1;
+    unsigned int outlier_latency_set:1;
+    unsigned int outlier_errors_set:1;
+    unsigned int hedge_set:1;
     ap_conf_vector_t *section_config; /* <Proxy>-section wherein defined */
 };
 
@@ -573,8 +591,21 @@ struct proxy_balancer_method {
     apr_status_t (*reset)(proxy_balancer *balancer, server_rec *s);
     apr_status_t (*age)(proxy_balancer *balancer, server_rec *s);
     apr_status_t (*updatelbstatus)(proxy_balancer *balancer, proxy_worker *elected, server_rec *s);
+    unsigned int flags;          /* PROXY_LBMETHOD_F_* */
 };
 
+/* The finder and updatelbstatus may run concurrently for the same balancer,
+ * hence they are not called with the balancer thread lock held.
+ */
+#define PROXY_LBMETHOD_F_CONCURRENT (1u << 0)
+
+/* Atomically add delta (possibly negative) to the lbstatus of worker w,
+ * for lbmethods running concurrently. Evaluates to the new lbstatus.
+ */
+#define PROXY_WORKER_LBSTATUS_ADD(w, delta) \
+    ((int)(apr_atomic_add32((volatile apr_uint32_t *)&(w)->s->lbstatus, \
+                            (apr_uint32_t)(delta)) + (apr_uint32_t)(delta)))
+
 #if APR_HAS_THREADS
 #define PROXY_THREAD_LOCK(x)      ( (x) && (x)->tmutex ? apr_thread_mutex_lock((x)->tmutex) : APR_SUCCESS)
 #define PROXY_THREAD_UNLOCK(x)    ( (x) && (x)->tmutex ? apr_thread_mutex_unlock((x)->tmutex) : APR_SUCCESS)
@@ -658,6 +689,31 @@ PROXY_DECLARE_OPTIONAL_HOOK(proxy, PROXY, int, fixups, (request_rec *r))
 PROXY_DECLARE_OPTIONAL_HOOK(proxy, PROXY, int, detach_backend,
                             (request_rec *r, proxy_conn_rec *backend))
 
+/**
+ * The steps of a request to a backend, see proxy_hook_backend_step().
+ * The scheme handlers which don't report the intermediate ones only run
+ * PROXY_BACKEND_START and PROXY_BACKEND_DONE (from mod_proxy).
+ */
+typedef enum {
+    PROXY_BACKEND_START,        /* the scheme handler is called */
+    PROXY_BACKEND_CONNECT,      /* a new connection is being established */
+    PROXY_BACKEND_CONNECTED,    /* it is connected */
+    PROXY_BACKEND_HANDSHAKEN,   /* its TLS handshake is complete */
+    PROXY_BACKEND_REQUEST_SENT, /* the request is sent */
+    PROXY_BACKEND_RESPONSE,     /* the status line of the response is read */
+    PROXY_BACKEND_DONE          /* the scheme handler returned */
+} proxy_backend_step_e;
+
+/**
+ * Let modules time the requests to the backends, e.g. to trace them.
+ * @param r The client request
+ * @param worker The worker of the backend
+ * @param step The step reached
+ */
+PROXY_DECLARE_OPTIONAL_HOOK(proxy, PROXY, int, backend_step,
+                            (request_rec *r, proxy_worker *worker,
+                             proxy_backend_step_e step))
+
 /**
  * pre request hook.
  * It will return the most suitable worker at the moment
@@ -134,6 +134,30 @@ static apr_off_t get_content_length(request_rec * r)
     return len;
 }
 
+/*
+ * The packet of the request header and the data packets of the request
+ * body are built one after the other in the same buffer, which is kept
+ * with the backend connection (its socket pool) and recycled by the
+ * next requests on it, as long as their packet size is the same.
+ */
+#define AJP_SEND_MSG_KEY "proxy_ajp_send_msg"
+
+static ajp_msg_t *get_send_msg(proxy_conn_rec *conn, apr_size_t maxsize)
+{
+    void *msg = NULL;
+
+    apr_pool_userdata_get(&msg, AJP_SEND_MSG_KEY, conn->scpool);
+    if (!msg) {
+        ajp_msg_create(conn->scpool, maxsize, (ajp_msg_t **)&msg);
+        apr_pool_userdata_setn(msg, AJP_SEND_MSG_KEY, NULL, conn->scpool);
+    }
+    else if (((ajp_msg_t *)msg)->max_size != maxsize) {
+        /* let ajp_send_header() create one from the request pool */
+        msg = NULL;
+    }
+    return msg;
+}
+
 /*
  * XXX: AJP Auto Flushing
  *
@@ -208,7 +232,8 @@ static int ap_proxy_ajp_request(apr_pool_t *p, request_rec *r,
      */
 
     /* send request headers */
-    status = ajp_send_header(conn->sock, r, maxsize, uri, secret);
+    msg = get_send_msg(conn, maxsize);
+    status = ajp_send_header(conn->sock, r, maxsize, uri, secret, &msg);
     if (status != APR_SUCCESS) {
         conn->close = 1;
         ap_log_rerror(APLOG_MARK, APLOG_ERR, status, r, APLOGNO(00868)
@@ -231,7 +256,7 @@ static int ap_proxy_ajp_request(apr_pool_t *p, request_rec *r,
         }
     }
 
-    /* allocate an AJP message to store the data of the buckets */
+    /* reuse the AJP message to store the data of the buckets */
     bufsiz = maxsize;
     status = ajp_alloc_data_msg(r->pool, &buff, &bufsiz, &msg);
     if (status != APR_SUCCESS) {
@@ -341,8 +366,9 @@ static int ap_proxy_ajp_request(apr_pool_t *p, request_rec *r,
         }
     }
 
-    /* read the response */
-    conn->data = NULL;
+    /* read the response, in a buffer that the body chunks can take over */
+    ajp_msg_create_ba(r->pool, r->connection->bucket_alloc, maxsize,
+                      (ajp_msg_t **)&(conn->data));
     status = ajp_read_header(conn->sock, r, maxsize,
                              (ajp_msg_t **)&(conn->data));
     if (status != APR_SUCCESS) {
@@ -515,8 +541,10 @@ static int ap_proxy_ajp_request(apr_pool_t *p, request_rec *r,
                                 r->status_line = original_status_line;
                             }
 
-                            e = apr_bucket_transient_create(send_body_chunk_buff, size,
-                                                        r->connection->bucket_alloc);
+                            /* no copy, the bucket takes the packet over */
+                            e = ajp_msg_bucket_create(conn->data,
+                                                      send_body_chunk_buff,
+                                                      size);
                             APR_BRIGADE_INSERT_TAIL(output_brigade, e);
 
                             if ((conn->worker->s->flush_packets == flush_on) ||
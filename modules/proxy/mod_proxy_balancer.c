@@ -24,6 +24,7 @@
 #include "apr_date.h"
 #include "apr_escape.h"
 #include "mod_watchdog.h"
+#include "apr_atomic.h"
 
 static const char *balancer_mutex_type = "proxy-balancer-shm";
 ap_slotmem_provider_t *storage = NULL;
@@ -39,6 +40,40 @@ static APR_OPTIONAL_FN_TYPE(hc_show_exprs) *hc_show_exprs_f = NULL;
 static APR_OPTIONAL_FN_TYPE(hc_select_exprs) *hc_select_exprs_f = NULL;
 static APR_OPTIONAL_FN_TYPE(hc_valid_expr) *hc_valid_expr_f = NULL;
 
+/*
+ * The elected and busy counters of a worker are apr_size_t, which can be
+ * updated atomically if it's 32bit or if APR provides 64bit atomics.
+ * Only then may PROXY_LBMETHOD_F_CONCURRENT lbmethods be run without
+ * the balancer thread lock.
+ */
+#if APR_SIZEOF_VOIDP == 4
+#define BALANCER_ATOMIC_COUNTERS 1
+#define counter_read(c)         apr_atomic_read32((volatile apr_uint32_t *)(c))
+#define counter_inc(c)          apr_atomic_inc32((volatile apr_uint32_t *)(c))
+#define counter_cas(c, n, o)    apr_atomic_cas32((volatile apr_uint32_t *)(c), \
+                                                 (n), (o))
+#elif APR_VERSION_AT_LEAST(1,7,0)
+#define BALANCER_ATOMIC_COUNTERS 1
+#define counter_read(c)         apr_atomic_read64((volatile apr_uint64_t *)(c))
+#define counter_inc(c)          apr_atomic_inc64((volatile apr_uint64_t *)(c))
+#define counter_cas(c, n, o)    apr_atomic_cas64((volatile apr_uint64_t *)(c), \
+                                                 (n), (o))
+#else
+#define BALANCER_ATOMIC_COUNTERS 0
+#define counter_read(c)         (*(c))
+#define counter_inc(c)          ((*(c))++)
+#endif
+
+static APR_INLINE int balancer_needs_lock(proxy_balancer *balancer)
+{
+#if BALANCER_ATOMIC_COUNTERS
+    return (!balancer->lbmethod
+            || !(balancer->lbmethod->flags & PROXY_LBMETHOD_F_CONCURRENT));
+#else
+    return 1;
+#endif
+}
+
 
 /*
  * Register our mutex type before the config is read so we
@@ -344,10 +379,11 @@ static proxy_worker *find_best_worker(proxy_balancer *balancer,
                                       request_rec *r)
 {
     proxy_worker *candidate = NULL;
+    int locked = balancer_needs_lock(balancer);
     apr_status_t rv;
 
 #if APR_HAS_THREADS
-    if ((rv = PROXY_THREAD_LOCK(balancer)) != APR_SUCCESS) {
+    if (locked && (rv = PROXY_THREAD_LOCK(balancer)) != APR_SUCCESS) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01163)
                       "%s: Lock failed for find_best_worker()",
                       balancer->s->name);
@@ -358,10 +394,10 @@ static proxy_worker *find_best_worker(proxy_balancer *balancer,
     candidate = (*balancer->lbmethod->finder)(balancer, r);
 
     if (candidate)
-        candidate->s->elected++;
+        counter_inc(&candidate->s->elected);
 
 #if APR_HAS_THREADS
-    if ((rv = PROXY_THREAD_UNLOCK(balancer)) != APR_SUCCESS) {
+    if (locked && (rv = PROXY_THREAD_UNLOCK(balancer)) != APR_SUCCESS) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01164)
                       "%s: Unlock failed for find_best_worker()",
                       balancer->s->name);
@@ -465,14 +501,136 @@ static void force_recovery(proxy_balancer *balancer, server_rec *s)
 static apr_status_t decrement_busy_count(void *worker_)
 {
     proxy_worker *worker = worker_;
+#if BALANCER_ATOMIC_COUNTERS
+    apr_size_t busy;
+
+    do {
+        busy = counter_read(&worker->s->busy);
+    } while (busy && counter_cas(&worker->s->busy, busy - 1, busy) != busy);
+#else
     
     if (worker->s->busy) {
         worker->s->busy--;
     }
+#endif
 
     return APR_SUCCESS;
 }
 
+/* Weight of a new sample in the moving averages (1/2^SHIFT) */
+#define LATENCY_EWMA_SHIFT  3
+#define ERRORS_EWMA_SHIFT   5
+/* Members are not considered outliers before this many responses */
+#define OUTLIER_MIN_SAMPLES 20
+
+typedef struct {
+    proxy_worker *worker;
+    apr_time_t start;
+} balancer_req_t;
+
+/* Lock-free update of a moving average in shared memory, seeded with the
+ * first sample if asked to.
+ */
+static apr_uint32_t ewma_update(volatile apr_uint32_t *avg,
+                                apr_uint32_t sample, int shift, int seed)
+{
+    apr_uint32_t old, new;
+
+    do {
+        old = apr_atomic_read32(avg);
+        if (old || !seed) {
+            new = old - (old >> shift) + (sample >> shift);
+        }
+        else {
+            new = sample;
+        }
+    } while (apr_atomic_cas32(avg, new, old) != old);
+
+    return new;
+}
+
+/*
+ * Account for the response time and status of the member, and put it in
+ * error state if it's an outlier (much slower or failing much more than
+ * configured for the balancer).
+ */
+static void account_response(proxy_balancer *balancer, proxy_worker *worker,
+                             request_rec *r, apr_interval_time_t elapsed)
+{
+    int failed = (r->status >= HTTP_INTERNAL_SERVER_ERROR);
+    apr_uint32_t sample, penalty, latency, errors, average;
+    const char *why;
+    int i, unusable = 0;
+
+    if (elapsed >= APR_UINT32_MAX) {
+        sample = APR_UINT32_MAX;
+    }
+    else {
+        sample = (elapsed > 0) ? (apr_uint32_t)elapsed : 1;
+    }
+    average = ewma_update(&balancer->s->latency, sample,
+                          LATENCY_EWMA_SHIFT, 1);
+    if (failed) {
+        /* Don't let a member attract requests by failing fast */
+        latency = apr_atomic_read32(&worker->s->latency);
+        penalty = (latency < APR_UINT32_MAX / 2) ? latency * 2
+                                                 : APR_UINT32_MAX;
+        if (sample < penalty) {
+            sample = penalty;
+        }
+    }
+    latency = ewma_update(&worker->s->latency, sample,
+                          LATENCY_EWMA_SHIFT, 1);
+    errors = ewma_update(&worker->s->errors, failed ? 1000000 : 0,
+                         ERRORS_EWMA_SHIFT, 0);
+
+    if (apr_atomic_read32(&worker->s->samples) < OUTLIER_MIN_SAMPLES) {
+        apr_atomic_inc32(&worker->s->samples);
+        return;
+    }
+    if ((!balancer->outlier_latency && !balancer->outlier_errors)
+            || (worker->s->status & PROXY_WORKER_IGNORE_ERRORS)
+            || !PROXY_WORKER_IS_USABLE(worker)) {
+        return;
+    }
+    if (balancer->outlier_latency && (apr_uint64_t)latency >
+            (apr_uint64_t)average * balancer->outlier_latency) {
+        why = "response time";
+    }
+    else if (balancer->outlier_errors
+             && errors > (apr_uint32_t)balancer->outlier_errors * 10000) {
+        why = "rate of 5xx responses";
+    }
+    else {
+        return;
+    }
+
+    /* Don't eject more than half of the members */
+    for (i = 0; i < balancer->workers->nelts; i++) {
+        if (!PROXY_WORKER_IS_USABLE(APR_ARRAY_IDX(balancer->workers, i,
+                                                  proxy_worker *))) {
+            unusable++;
+        }
+    }
+    if ((unusable + 1) * 2 > balancer->workers->nelts) {
+        return;
+    }
+
+    ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(10461)
+                  "%s: Forcing worker (%s) into error state as an outlier "
+                  "due to its %s (%uus vs %uus average, %u.%02u%% 5xx)",
+                  balancer->s->name, ap_proxy_worker_name(r->pool, worker),
+                  why, latency, average,
+                  errors / 10000, (errors % 10000) / 100);
+    worker->s->status |= PROXY_WORKER_IN_ERROR;
+    worker->s->error_time = apr_time_now();
+
+    /* Start afresh once it's back */
+    apr_atomic_set32(&worker->s->latency, average);
+    apr_atomic_set32(&worker->s->errors, 0);
+    apr_atomic_set32(&worker->s->samples, 0);
+}
+
 static int proxy_balancer_pre_request(proxy_worker **worker,
                                       proxy_balancer **balancer,
                                       request_rec *r,
@@ -482,6 +640,8 @@ static int proxy_balancer_pre_request(proxy_worker **worker,
     proxy_worker *runtime;
     char *route = NULL;
     const char *sticky = NULL;
+    balancer_req_t *req;
+    int locked;
     apr_status_t rv;
 
     *worker = NULL;
@@ -494,11 +654,15 @@ static int proxy_balancer_pre_request(proxy_worker **worker,
         !(*balancer = ap_proxy_get_balancer(r->pool, conf, *url, 1)))
         return DECLINED;
 
-    /* Step 2: Lock the LoadBalancer
+    /* Step 2: Lock the LoadBalancer, unless the lbmethod can run
+     * concurrently and the member list is up to date (the lock is
+     * needed to sync it).
      * XXX: perhaps we need the process lock here
      */
+    locked = (balancer_needs_lock(*balancer)
+              || (*balancer)->s->wupdated > (*balancer)->wupdated);
 #if APR_HAS_THREADS
-    if ((rv = PROXY_THREAD_LOCK(*balancer)) != APR_SUCCESS) {
+    if (locked && (rv = PROXY_THREAD_LOCK(*balancer)) != APR_SUCCESS) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01166)
                       "%s: Lock failed for pre_request", (*balancer)->s->name);
         return DECLINED;
@@ -511,6 +675,16 @@ static int proxy_balancer_pre_request(proxy_worker **worker,
     /* Step 3.5: Update member list for the balancer */
     /* TODO: Implement as provider! */
     ap_proxy_sync_balancer(*balancer, r->server, conf);
+    if (locked && !balancer_needs_lock(*balancer)) {
+#if APR_HAS_THREADS
+        if ((rv = PROXY_THREAD_UNLOCK(*balancer)) != APR_SUCCESS) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(10456)
+                          "%s: Unlock failed for pre_request",
+                          (*balancer)->s->name);
+        }
+#endif
+        locked = 0;
+    }
 
     /* Step 4: find the session route */
     runtime = find_session_route(*balancer, r, &route, &sticky, url);
@@ -533,14 +707,15 @@ static int proxy_balancer_pre_request(proxy_worker **worker,
                  * not in error state or not disabled.
                  */
                 if (PROXY_WORKER_IS_USABLE(*workers)) {
-                    (*workers)->s->lbstatus += (*workers)->s->lbfactor;
+                    (void)PROXY_WORKER_LBSTATUS_ADD(*workers,
+                                                    (*workers)->s->lbfactor);
                     total_factor += (*workers)->s->lbfactor;
                 }
                 workers++;
             }
-            runtime->s->lbstatus -= total_factor;
+            (void)PROXY_WORKER_LBSTATUS_ADD(runtime, -total_factor);
         }
-        runtime->s->elected++;
+        counter_inc(&runtime->s->elected);
 
         *worker = runtime;
     }
@@ -565,7 +740,7 @@ static int proxy_balancer_pre_request(proxy_worker **worker,
                           "%s: All workers are in error state for route (%s)",
                           (*balancer)->s->name, route);
 #if APR_HAS_THREADS
-            if ((rv = PROXY_THREAD_UNLOCK(*balancer)) != APR_SUCCESS) {
+            if (locked && (rv = PROXY_THREAD_UNLOCK(*balancer)) != APR_SUCCESS) {
                 ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01168)
                               "%s: Unlock failed for pre_request",
                               (*balancer)->s->name);
@@ -576,7 +751,7 @@ static int proxy_balancer_pre_request(proxy_worker **worker,
     }
 
 #if APR_HAS_THREADS
-    if ((rv = PROXY_THREAD_UNLOCK(*balancer)) != APR_SUCCESS) {
+    if (locked && (rv = PROXY_THREAD_UNLOCK(*balancer)) != APR_SUCCESS) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01169)
                       "%s: Unlock failed for pre_request",
                       (*balancer)->s->name);
@@ -611,7 +786,7 @@ static int proxy_balancer_pre_request(proxy_worker **worker,
         *worker = runtime;
     }
 
-    (*worker)->s->busy++;
+    counter_inc(&(*worker)->s->busy);
     apr_pool_cleanup_register(r->pool, *worker, decrement_busy_count,
                               apr_pool_cleanup_null);
 
@@ -644,6 +819,15 @@ static int proxy_balancer_pre_request(proxy_worker **worker,
                   "%s: worker (%s) rewritten to %s",
                   (*balancer)->s->name, (*worker)->s->name, *url);
 
+    /* For account_response() in post_request */
+    req = ap_get_module_config(r->request_config, &proxy_balancer_module);
+    if (!req) {
+        req = apr_pcalloc(r->pool, sizeof(*req));
+        ap_set_module_config(r->request_config, &proxy_balancer_module, req);
+    }
+    req->worker = *worker;
+    req->start = apr_time_now();
+
     return access_status;
 }
 
@@ -653,10 +837,12 @@ static int proxy_balancer_post_request(proxy_worker *worker,
                                        proxy_server_conf *conf)
 {
 
+    int locked = balancer_needs_lock(balancer);
+    balancer_req_t *req;
     apr_status_t rv;
 
 #if APR_HAS_THREADS
-    if ((rv = PROXY_THREAD_LOCK(balancer)) != APR_SUCCESS) {
+    if (locked && (rv = PROXY_THREAD_LOCK(balancer)) != APR_SUCCESS) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01173)
                       "%s: Lock failed for post_request",
                       balancer->s->name);
@@ -695,11 +881,18 @@ static int proxy_balancer_post_request(proxy_worker *worker,
 
     }
 #if APR_HAS_THREADS
-    if ((rv = PROXY_THREAD_UNLOCK(balancer)) != APR_SUCCESS) {
+    if (locked && (rv = PROXY_THREAD_UNLOCK(balancer)) != APR_SUCCESS) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01175)
                       "%s: Unlock failed for post_request", balancer->s->name);
     }
 #endif
+
+    req = ap_get_module_config(r->request_config, &proxy_balancer_module);
+    if (req && req->worker == worker && req->start) {
+        account_response(balancer, worker, r, apr_time_now() - req->start);
+        req->start = 0;
+    }
+
     ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(01176)
                   "proxy_balancer_post_request for (%s)", balancer->s->name);
 
@@ -1131,8 +1324,11 @@ static int balancer_process_balancer_worker(request_rec *r, proxy_server_conf *c
             ival = fval * 100.0;
             if (ival >= 100 && ival <= 10000) {
                 wsel->s->lbfactor = ival;
-                if (bsel)
+                if (bsel) {
                     recalc_factors(bsel);
+                    /* Let the lbmethods depending on it resync */
+                    bsel->s->wupdated = apr_time_now();
+                }
             }
         }
         if ((val = apr_table_get(params, "w_wr"))) {
@@ -1140,6 +1336,8 @@ static int balancer_process_balancer_worker(request_rec *r, proxy_server_conf *c
                 strcpy(wsel->s->route, val);
             else
                 *wsel->s->route = '\0';
+            if (bsel)
+                bsel->s->wupdated = apr_time_now();
         }
         if ((val = apr_table_get(params, "w_rr"))) {
             if (*val && strlen(val) < sizeof(wsel->s->redirect))
@@ -1489,6 +1687,8 @@ static void balancer_display_page(request_rec *r, proxy_server_conf *conf,
                            worker->s->smax);
                 ap_rprintf(r, "          <httpd:max>%d</httpd:max>\n",
                            worker->s->hmax);
+                ap_rprintf(r, "          <httpd:prewarm>%d</httpd:prewarm>\n",
+                           worker->s->prewarm);
                 ap_rprintf(r,
                            "          <httpd:ttl>%" APR_TIME_T_FMT "</httpd:ttl>\n",
                            apr_time_sec(worker->s->ttl));
@@ -1552,6 +1752,12 @@ static void balancer_display_page(request_rec *r, proxy_server_conf *conf,
                 ap_rprintf(r,
                            "          <httpd:busy>%" APR_SIZE_T_FMT "</httpd:busy>\n",
                            worker->s->busy);
+                ap_rprintf(r,
+                           "          <httpd:reused>%" APR_SIZE_T_FMT "</httpd:reused>\n",
+                           worker->s->reused);
+                ap_rprintf(r,
+                           "          <httpd:connected>%" APR_SIZE_T_FMT "</httpd:connected>\n",
+                           worker->s->connected);
                 ap_rprintf(r, "          <httpd:lbset>%d</httpd:lbset>\n",
                            worker->s->lbset);
                 /* End proxy_worker_stat */
@@ -1697,7 +1903,8 @@ static void balancer_display_page(request_rec *r, proxy_server_conf *conf,
                 "<th>Worker URL</th>"
                 "<th>Route</th><th>RouteRedir</th>"
                 "<th>Factor</th><th>Set</th><th>Status</th>"
-                "<th>Elected</th><th>Busy</th><th>Load</th><th>To</th><th>From</th>", r);
+                "<th>Elected</th><th>Busy</th><th>Load</th><th>To</th><th>From</th>"
+                "<th>Reused</th>", r);
             if (set_worker_hc_param_f) {
                 ap_rputs("<th>HC Method</th><th>HC Interval</th><th>Passes</th><th>Fails</th><th>HC uri</th><th>HC Expr</th>", r);
             }
@@ -1729,6 +1936,14 @@ static void balancer_display_page(request_rec *r, proxy_server_conf *conf,
                 ap_rputs(apr_strfsize(worker->s->transferred, fbuf), r);
                 ap_rputs("</td><td>", r);
                 ap_rputs(apr_strfsize(worker->s->read, fbuf), r);
+                ap_rputs("</td><td>", r);
+                if (worker->s->reused + worker->s->connected) {
+                    ap_rprintf(r, "%d%%", (int)(worker->s->reused * 100 /
+                               (worker->s->reused + worker->s->connected)));
+                }
+                else {
+                    ap_rputs("-", r);
+                }
                 if (set_worker_hc_param_f) {
                     ap_rprintf(r, "</td><td>%s</td>", ap_proxy_show_hcmethod(worker->s->method));
                     ap_rprintf(r, "<td>%" APR_TIME_T_FMT "ms</td>", apr_time_as_msec(worker->s->interval));
@@ -2050,6 +2265,18 @@ static void balancer_child_init(apr_pool_t *p, server_rec *s)
                 exit(1); /* Ugly, but what else? */
             }
             init_balancer_members(p, s, balancer);
+
+            /* Members may be elected while ap_proxy_sync_balancer() adds
+             * new ones, so make room for all of them upfront such that the
+             * array is never reallocated under the readers' feet.
+             */
+            if (balancer->workers->nalloc < balancer->max_workers) {
+                apr_array_header_t *workers;
+                workers = apr_array_make(p, balancer->max_workers,
+                                         sizeof(proxy_worker *));
+                apr_array_cat(workers, balancer->workers);
+                balancer->workers = workers;
+            }
         }
         s = s->next;
     }
@@ -26,12 +26,55 @@ module AP_MODULE_DECLARE_DATA proxy_express_module;
 
 static int proxy_available = 0;
 
+/* How often the DBM file is checked for changes */
+#define EXPRESS_CHECK_INTERVAL apr_time_from_sec(1)
+
+/* Past this many names, the cached lookups are dropped */
+#define EXPRESS_CACHE_MAX_ENTRIES 4096
+
+/*
+ * The lookups of a child in the DBM file, cached until the file changes,
+ * including the names which are not in the file (backend is NULL).
+ */
+typedef struct {
+    const char *backend;
+} express_entry;
+
+typedef struct {
+    apr_pool_t *pool;           /* the child pool */
+    apr_pool_t *entries_pool;   /* the entries, replaced on changes */
+    apr_hash_t *entries;        /* name -> express_entry */
+    const char *used1, *used2;  /* the files of the DBM */
+    apr_time_t checked;         /* when the DBM was checked last */
+    apr_time_t mtime1, mtime2;
+#if APR_HAS_THREADS
+    apr_thread_mutex_t *mutex;
+#endif
+} express_cache;
+
 typedef struct {
     const char *dbmfile;
     const char *dbmtype;
     int enabled;
+    express_cache *cache;
 } express_server_conf;
 
+/*
+ * The workers created by the child for the backends, reused by the
+ * following requests (with their connections), as if they were declared
+ * by ProxyPass.
+ */
+static apr_hash_t *express_workers = NULL;
+static apr_pool_t *express_workers_pool = NULL;
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *express_workers_mutex = NULL;
+#endif
+
+typedef struct {
+    const char *backend;
+    proxy_worker *worker;
+} express_req;
+
 static const char *set_dbmfile(cmd_parms *cmd,
                                void *dconf,
                                const char *arg)
@@ -95,6 +138,7 @@ static void *server_merge(apr_pool_t *p, void *basev, void *overridesv)
     a->dbmfile = (overrides->dbmfile) ? overrides->dbmfile : base->dbmfile;
     a->dbmtype = (overrides->dbmtype) ? overrides->dbmtype : base->dbmtype;
     a->enabled = (overrides->enabled) ? overrides->enabled : base->enabled;
+    a->cache = NULL;
 
     return (void *)a;
 }
@@ -109,17 +153,214 @@ static int post_config(apr_pool_t *p,
 }
 
 
+static void child_init(apr_pool_t *p, server_rec *main_s)
+{
+    server_rec *s;
+
+    if (!proxy_available) {
+        return;
+    }
+
+    express_workers_pool = p;
+    express_workers = apr_hash_make(p);
+#if APR_HAS_THREADS
+    if (apr_thread_mutex_create(&express_workers_mutex,
+                                APR_THREAD_MUTEX_DEFAULT, p) != APR_SUCCESS) {
+        express_workers = NULL;
+    }
+#endif
+
+    for (s = main_s; s; s = s->next) {
+        express_server_conf *sconf;
+        express_cache *cache;
+
+        sconf = ap_get_module_config(s->module_config, &proxy_express_module);
+        if (!sconf->enabled || !sconf->dbmfile || sconf->cache) {
+            continue;
+        }
+
+        cache = apr_pcalloc(p, sizeof(*cache));
+        cache->pool = p;
+#if APR_HAS_THREADS
+        if (apr_thread_mutex_create(&cache->mutex, APR_THREAD_MUTEX_DEFAULT,
+                                    p) != APR_SUCCESS) {
+            continue;
+        }
+#endif
+        if (apr_dbm_get_usednames_ex(p, sconf->dbmtype, sconf->dbmfile,
+                                     &cache->used1, &cache->used2)
+                != APR_SUCCESS) {
+            cache->used1 = sconf->dbmfile;
+            cache->used2 = NULL;
+        }
+        sconf->cache = cache;
+    }
+}
+
+static apr_time_t dbm_mtime(const char *fname, apr_pool_t *p)
+{
+    apr_finfo_t fi;
+
+    if (fname && apr_stat(&fi, fname, APR_FINFO_MTIME, p) == APR_SUCCESS) {
+        return fi.mtime;
+    }
+    return 0;
+}
+
+/*
+ * Look up name in the cache, dropping the entries first when the DBM has
+ * changed. Returns 1 and the backend (or NULL) when cached.
+ */
+static int cache_lookup(express_cache *cache, request_rec *r,
+                        const char *name, const char **backend)
+{
+    express_entry *entry = NULL;
+    apr_time_t now = apr_time_now();
+
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(cache->mutex);
+#endif
+    if (now < cache->checked || now - cache->checked >= EXPRESS_CHECK_INTERVAL) {
+        apr_time_t mtime1 = dbm_mtime(cache->used1, r->pool),
+                   mtime2 = dbm_mtime(cache->used2, r->pool);
+
+        cache->checked = now;
+        if (mtime1 != cache->mtime1 || mtime2 != cache->mtime2) {
+            if (cache->entries_pool) {
+                apr_pool_destroy(cache->entries_pool);
+                cache->entries_pool = NULL;
+                cache->entries = NULL;
+            }
+            cache->mtime1 = mtime1;
+            cache->mtime2 = mtime2;
+        }
+    }
+    if (cache->entries) {
+        entry = apr_hash_get(cache->entries, name, APR_HASH_KEY_STRING);
+        if (entry) {
+            *backend = entry->backend
+                       ? apr_pstrdup(r->pool, entry->backend) : NULL;
+        }
+    }
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(cache->mutex);
+#endif
+
+    return entry != NULL;
+}
+
+static void cache_store(express_cache *cache, const char *name,
+                        const char *backend)
+{
+    express_entry *entry;
+
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(cache->mutex);
+#endif
+    if (cache->entries
+            && apr_hash_count(cache->entries) >= EXPRESS_CACHE_MAX_ENTRIES) {
+        apr_pool_destroy(cache->entries_pool);
+        cache->entries_pool = NULL;
+        cache->entries = NULL;
+    }
+    if (!cache->entries) {
+        apr_pool_create(&cache->entries_pool, cache->pool);
+        apr_pool_tag(cache->entries_pool, "proxy_express_cache");
+        cache->entries = apr_hash_make(cache->entries_pool);
+    }
+    entry = apr_palloc(cache->entries_pool, sizeof(*entry));
+    entry->backend = backend ? apr_pstrdup(cache->entries_pool, backend) : NULL;
+    apr_hash_set(cache->entries, apr_pstrdup(cache->entries_pool, name),
+                 APR_HASH_KEY_STRING, entry);
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(cache->mutex);
+#endif
+}
+
+/*
+ * The worker of the child for backend, created on first use.
+ */
+static proxy_worker *get_worker(request_rec *r, const char *backend)
+{
+    proxy_worker *worker;
+
+    if (!express_workers || !ap_cstr_casecmpn(backend, "unix:", 5)
+            || ap_proxy_valid_balancer_name((char *)backend, 0)) {
+        return NULL;
+    }
+
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(express_workers_mutex);
+#endif
+    worker = apr_hash_get(express_workers, backend, APR_HASH_KEY_STRING);
+    if (!worker) {
+        char *err;
+        apr_status_t rv;
+
+        err = ap_proxy_define_worker_ex(express_workers_pool, &worker, NULL,
+                                        NULL, backend, 0);
+        if (err) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(10560)
+                          "proxy_express: can't create a worker for %s: %s",
+                          backend, err);
+            worker = NULL;
+        }
+        else if ((rv = ap_proxy_initialize_worker(worker, r->server,
+                                       express_workers_pool)) != APR_SUCCESS) {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(10561)
+                          "proxy_express: can't initialize the worker of %s",
+                          backend);
+            worker = NULL;
+        }
+        else {
+            apr_hash_set(express_workers,
+                         apr_pstrdup(express_workers_pool, backend),
+                         APR_HASH_KEY_STRING, worker);
+        }
+    }
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(express_workers_mutex);
+#endif
+
+    return worker;
+}
+
+/*
+ * Use the worker of the backend, unless a worker is configured for the url.
+ */
+static int express_pre_request(proxy_worker **worker,
+                               proxy_balancer **balancer,
+                               request_rec *r,
+                               proxy_server_conf *conf, char **url)
+{
+    express_req *req = ap_get_module_config(r->request_config,
+                                            &proxy_express_module);
+
+    if (!req || *balancer || !req->worker
+            || strncmp(*url, req->backend, strlen(req->backend)) != 0
+            || ap_proxy_get_worker_ex(r->pool, NULL, conf, *url, 0)) {
+        return DECLINED;
+    }
+
+    ap_log_rerror(APLOG_MARK, APLOG_TRACE2, 0, r,
+                  "proxy_express: using worker %s for %s",
+                  req->worker->s->name, *url);
+    *worker = req->worker;
+    return OK;
+}
+
 static int xlate_name(request_rec *r)
 {
     int i;
     const char *name;
-    char *backend = NULL;
+    const char *backend = NULL;
     apr_dbm_t *db;
     apr_status_t rv;
     apr_datum_t key, val;
     struct proxy_alias *ralias;
     proxy_dir_conf *dconf;
     express_server_conf *sconf;
+    express_req *req;
 #if APU_MAJOR_VERSION > 1 || (APU_MAJOR_VERSION == 1 && APU_MINOR_VERSION >= 7)
     const apr_dbm_driver_t *driver;
     const apu_err_t *err;
@@ -138,6 +379,17 @@ static int xlate_name(request_rec *r)
         return DECLINED;
     }
 
+    name = ap_get_server_name(r);
+    if (sconf->cache && cache_lookup(sconf->cache, r, name, &backend)) {
+        ap_log_rerror(APLOG_MARK, APLOG_TRACE2, 0, r,
+                      "proxy_express: cached %s -> %s",
+                      name, backend ? backend : "(none)");
+        if (!backend) {
+            return DECLINED;
+        }
+        goto found;
+    }
+
     ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(01002)
                   "proxy_express: Opening DBM file: %s (%s)",
                   sconf->dbmfile, sconf->dbmtype);
@@ -167,23 +419,32 @@ static int xlate_name(request_rec *r)
     }
 #endif
 
-    name = ap_get_server_name(r);
     ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(01003)
                   "proxy_express: looking for %s", name);
     key.dptr = (char *)name;
     key.dsize = strlen(key.dptr);
 
     rv = apr_dbm_fetch(db, key, &val);
-    if (rv == APR_SUCCESS) {
+    if (rv == APR_SUCCESS && val.dptr) {
         backend = apr_pstrmemdup(r->pool, val.dptr, val.dsize);
     }
     apr_dbm_close(db);
+    if (rv == APR_SUCCESS && sconf->cache) {
+        cache_store(sconf->cache, name, backend);
+    }
     if (rv != APR_SUCCESS || !backend) {
         return DECLINED;
     }
 
     ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(01004)
                   "proxy_express: found %s -> %s", name, backend);
+
+found:
+    req = apr_palloc(r->pool, sizeof(*req));
+    req->backend = backend;
+    req->worker = get_worker(r, backend);
+    ap_set_module_config(r->request_config, &proxy_express_module, req);
+
     r->filename = apr_pstrcat(r->pool, "proxy:", backend, r->uri, NULL);
     r->handler = "proxy-server";
     r->proxyreq = PROXYREQ_REVERSE;
@@ -233,7 +494,9 @@ static const command_rec command_table[] = {
 static void register_hooks(apr_pool_t *p)
 {
     ap_hook_post_config(post_config, NULL, NULL, APR_HOOK_LAST);
+    ap_hook_child_init(child_init, NULL, NULL, APR_HOOK_MIDDLE);
     ap_hook_translate_name(xlate_name, NULL, NULL, APR_HOOK_FIRST);
+    proxy_hook_pre_request(express_pre_request, NULL, NULL, APR_HOOK_MIDDLE);
 }
 
 /* the main config structure */
@@ -39,6 +39,13 @@ typedef enum {
 } fcgi_backend_t;
 
 
+/* Max iovecs per FCGI_PARAMS record (header + 3 per envvar) */
+#if !defined(APR_MAX_IOVEC_SIZE) || APR_MAX_IOVEC_SIZE >= 64
+#define FCGI_ENV_NVEC 64
+#else
+#define FCGI_ENV_NVEC APR_MAX_IOVEC_SIZE
+#endif
+
 #define FCGI_MAY_BE_FPM(dconf)                              \
         (dconf &&                                           \
         ((dconf->backend_type == BACKEND_DEFAULT_UNKNOWN) || \
@@ -318,18 +325,18 @@ static apr_status_t send_begin_request(proxy_conn_rec *conn,
 }
 
 static apr_status_t send_environment(proxy_conn_rec *conn, request_rec *r,
-                                     apr_pool_t *temp_pool,
                                      apr_uint16_t request_id)
 {
     const apr_array_header_t *envarr;
     const apr_table_entry_t *elts;
-    struct iovec vec[2];
+    struct iovec vec[FCGI_ENV_NVEC];
+    unsigned char lens[FCGI_ENV_NVEC / 2 * 8];
     ap_fcgi_header header;
     unsigned char farray[AP_FCGI_HEADER_LEN];
-    char *body;
+    unsigned char earray[AP_FCGI_HEADER_LEN];
     apr_status_t rv;
-    apr_size_t avail_len, len, required_len;
-    int next_elem, starting_elem;
+    apr_size_t avail_len, len, record_len;
+    int i, nvec, nlens;
     fcgi_req_config_t *rconf = ap_get_module_config(r->request_config, &proxy_fcgi_module);
     fcgi_dirconf_t *dconf = ap_get_module_config(r->per_dir_config, &proxy_fcgi_module);
 
@@ -390,8 +397,6 @@ static apr_status_t send_environment(proxy_conn_rec *conn, request_rec *r,
     elts = (const apr_table_entry_t *) envarr->elts;
 
     if (APLOGrtrace8(r)) {
-        int i;
-
         for (i = 0; i < envarr->nelts; ++i) {
             ap_log_rerror(APLOG_MARK, APLOG_TRACE8, 0, r, APLOGNO(01062)
                           "sending env var '%s' value '%s'",
@@ -399,66 +404,113 @@ static apr_status_t send_environment(proxy_conn_rec *conn, request_rec *r,
         }
     }
 
-    /* Send envvars over in as many FastCGI records as it takes, */
-    next_elem = 0; /* starting with the first one */
-
+    /* Send envvars over in as many FastCGI records as it takes, encoding
+     * the name/value lengths in place and pointing the iovec directly at
+     * the table's strings, so that nothing is copied nor pre-computed.
+     */
     avail_len = 16 * 1024; /* our limit per record, which could have been up
                             * to AP_FCGI_MAX_CONTENT_LEN
                             */
 
-    while (next_elem < envarr->nelts) {
-        starting_elem = next_elem;
-        required_len = ap_fcgi_encoded_env_len(r->subprocess_env,
-                                               avail_len,
-                                               &next_elem);
+    /* Empty FCGI_PARAMS record, saying we're done */
+    ap_fcgi_fill_in_header(&header, AP_FCGI_PARAMS, request_id, 0, 0);
+    ap_fcgi_header_to_array(&header, earray);
+
+    nvec = 1; /* vec[0] is the record header */
+    nlens = 0;
+    record_len = 0;
+    for (i = 0; i <= envarr->nelts; ++i) {
+        apr_size_t keylen = 0, vallen = 0, prelen = 0;
+        unsigned char *itr;
 
-        if (!required_len) {
-            if (next_elem < envarr->nelts) {
+        if (i < envarr->nelts) {
+            if (!elts[i].key) {
+                continue;
+            }
+            keylen = strlen(elts[i].key);
+            vallen = elts[i].val ? strlen(elts[i].val) : 0;
+            prelen = (keylen >> 7 == 0 ? 1 : 4) + (vallen >> 7 == 0 ? 1 : 4);
+            if (prelen + keylen + vallen > avail_len) {
                 ap_log_rerror(APLOG_MARK, APLOG_WARNING, 0, r,
                               APLOGNO(02536) "couldn't encode envvar '%s' in %"
                               APR_SIZE_T_FMT " bytes",
-                              elts[next_elem].key, avail_len);
+                              elts[i].key, avail_len);
                 /* skip this envvar and continue */
-                ++next_elem;
                 continue;
             }
-            /* only an unused element at the end of the array */
-            break;
         }
 
-        body = apr_palloc(temp_pool, required_len);
-        rv = ap_fcgi_encode_env(r, r->subprocess_env, body, required_len,
-                                &starting_elem);
-        /* we pre-compute, so we can't run out of space */
-        ap_assert(rv == APR_SUCCESS);
-        /* compute and encode must be in sync */
-        ap_assert(starting_elem == next_elem);
-
-        ap_fcgi_fill_in_header(&header, AP_FCGI_PARAMS, request_id,
-                               (apr_uint16_t)required_len, 0);
-        ap_fcgi_header_to_array(&header, farray);
+        /* Flush the current record if this envvar doesn't fit in, or
+         * at the end (along with the terminating empty record).
+         */
+        if (i == envarr->nelts
+                || record_len + prelen + keylen + vallen > avail_len
+                || nvec + 3 > FCGI_ENV_NVEC) {
+            int last = (i == envarr->nelts);
 
-        vec[0].iov_base = (void *)farray;
-        vec[0].iov_len = sizeof(farray);
-        vec[1].iov_base = body;
-        vec[1].iov_len = required_len;
+            if (last && record_len == 0) {
+                nvec = 0; /* only the terminating record */
+            }
+            else {
+                ap_fcgi_fill_in_header(&header, AP_FCGI_PARAMS, request_id,
+                                       (apr_uint16_t)record_len, 0);
+                ap_fcgi_header_to_array(&header, farray);
+                vec[0].iov_base = (void *)farray;
+                vec[0].iov_len = sizeof(farray);
+            }
+            if (last) {
+                vec[nvec].iov_base = (void *)earray;
+                vec[nvec].iov_len = sizeof(earray);
+                ++nvec;
+            }
 
-        rv = send_data(conn, vec, 2, &len);
-        apr_pool_clear(temp_pool);
+            rv = send_data(conn, vec, nvec, &len);
+            if (rv != APR_SUCCESS || last) {
+                return rv;
+            }
 
-        if (rv) {
-            return rv;
+            nvec = 1;
+            nlens = 0;
+            record_len = 0;
         }
-    }
 
-    /* Envvars sent, so say we're done */
-    ap_fcgi_fill_in_header(&header, AP_FCGI_PARAMS, request_id, 0, 0);
-    ap_fcgi_header_to_array(&header, farray);
+        itr = lens + nlens;
+        if (keylen >> 7 == 0) {
+            *itr++ = keylen & 0xff;
+        }
+        else {
+            *itr++ = ((keylen >> 24) & 0xff) | 0x80;
+            *itr++ = ((keylen >> 16) & 0xff);
+            *itr++ = ((keylen >> 8) & 0xff);
+            *itr++ = ((keylen) & 0xff);
+        }
+        if (vallen >> 7 == 0) {
+            *itr++ = vallen & 0xff;
+        }
+        else {
+            *itr++ = ((vallen >> 24) & 0xff) | 0x80;
+            *itr++ = ((vallen >> 16) & 0xff);
+            *itr++ = ((vallen >> 8) & 0xff);
+            *itr++ = ((vallen) & 0xff);
+        }
 
-    vec[0].iov_base = (void *)farray;
-    vec[0].iov_len = sizeof(farray);
+        vec[nvec].iov_base = (void *)(lens + nlens);
+        vec[nvec].iov_len = prelen;
+        ++nvec;
+        vec[nvec].iov_base = (void *)elts[i].key;
+        vec[nvec].iov_len = keylen;
+        ++nvec;
+        if (vallen) {
+            vec[nvec].iov_base = (void *)elts[i].val;
+            vec[nvec].iov_len = vallen;
+            ++nvec;
+        }
+        nlens += prelen;
+        record_len += prelen + keylen + vallen;
+    }
 
-    return send_data(conn, vec, 1, &len);
+    /* not reached */
+    return APR_SUCCESS;
 }
 
 enum {
@@ -719,7 +771,13 @@ static apr_status_t dispatch(proxy_conn_rec *conn, proxy_dir_conf *conf,
                 break;
             }
 
-            if (rid != request_id) {
+            /* Management records (request id 0) may be sent at any time
+             * by the application, e.g. FCGI_UNKNOWN_TYPE, they are not
+             * for us but must be consumed to keep the connection usable.
+             */
+            if (rid != request_id
+                && (rid != 0 || (type != AP_FCGI_GET_VALUES_RESULT
+                                 && type != AP_FCGI_UNKNOWN_TYPE))) {
                 ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01069)
                               "Got bogus rid %d, expected %d",
                               rid, request_id);
@@ -738,7 +796,13 @@ recv_again:
              * recv call, this will eventually change when we move to real
              * nonblocking recv calls. */
             if (readbuflen != 0) {
-                rv = get_data(conn, iobuf, &readbuflen);
+                if (type == AP_FCGI_STDOUT || type == AP_FCGI_STDERR) {
+                    rv = get_data(conn, iobuf, &readbuflen);
+                }
+                else {
+                    /* Other records are parsed (or skipped) as a whole */
+                    rv = get_data_full(conn, iobuf, readbuflen);
+                }
                 if (rv != APR_SUCCESS) {
                     *err = "reading response body";
                     break;
@@ -895,12 +959,51 @@ recv_again:
                 break;
 
             case AP_FCGI_END_REQUEST:
+                if (readbuflen < AP_FCGI_ERB_LEN || clen > readbuflen) {
+                    ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(10464)
+                                  "Got bogus end request record of length %d",
+                                  (int)clen);
+                    rv = APR_EINVAL;
+                    break;
+                }
+                if (iobuf[AP_FCGI_ERB_PROTOCOLSTATUS_OFFSET]
+                        != AP_FCGI_REQUEST_COMPLETE) {
+                    ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(10465)
+                                  "FastCGI application rejected the request "
+                                  "(protocol status %d)",
+                                  (int)(unsigned char)
+                                      iobuf[AP_FCGI_ERB_PROTOCOLSTATUS_OFFSET]);
+                    /* Overloaded/unsupported backend, don't insist on it. */
+                    conn->close = 1;
+                    if (!*has_responded && !seen_end_of_headers) {
+                        *err = "request rejected by the application";
+                        rv = APR_EGENERAL;
+                        break;
+                    }
+                }
                 done = 1;
                 break;
 
+            case AP_FCGI_GET_VALUES_RESULT:
+            case AP_FCGI_UNKNOWN_TYPE:
+                if (rid == 0) {
+                    ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r,
+                                  "Skipping management record %d", type);
+                    if (clen > readbuflen) {
+                        clen -= readbuflen;
+                        goto recv_again;
+                    }
+                    break;
+                }
+                /* fall through */
             default:
                 ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01072)
                               "Got bogus record %d", type);
+                /* Skip its content to stay in sync with the application */
+                if (clen > readbuflen) {
+                    clen -= readbuflen;
+                    goto recv_again;
+                }
                 break;
             }
             /* Leave on above switch's inner error. */
@@ -959,7 +1062,10 @@ static int fcgi_do_request(apr_pool_t *p, request_rec *r,
      * single request. This would allow multiplex/pipelining of
      * multiple requests to the same FastCGI connection, but
      * we don't support that, and always use a value of '1' to
-     * keep things simple. */
+     * keep things simple. Sequential requests can still share a
+     * connection (FCGI_KEEP_CONN) provided that each exchange is
+     * fully consumed, up to its FCGI_END_REQUEST record, otherwise
+     * the connection is closed. */
     apr_uint16_t request_id = 1;
     apr_status_t rv;
     apr_pool_t *temp_pool;
@@ -980,7 +1086,7 @@ static int fcgi_do_request(apr_pool_t *p, request_rec *r,
     apr_pool_tag(temp_pool, "proxy_fcgi_do_request");
 
     /* Step 2: Send Environment via FCGI_PARAMS */
-    rv = send_environment(conn, r, temp_pool, request_id);
+    rv = send_environment(conn, r, request_id);
     if (rv != APR_SUCCESS) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01074)
                       "Failed writing Environment to %s:", server_portstr);
@@ -17,6 +17,7 @@
 #include "mod_watchdog.h"
 #include "ap_slotmem.h"
 #include "ap_expr.h"
+#include "apr_poll.h"
 #if APR_HAS_THREADS
 #include "apr_thread_pool.h"
 #endif
@@ -66,6 +67,8 @@ typedef struct {
     const char *req;    /* pre-formatted HTTP/AJP request */
     proxy_worker *w;    /* Pointer to the actual worker */
     const char *protocol; /* HTTP 1.0 or 1.1? */
+    apr_socket_t *idle;   /* kept alive connection of the polled checks */
+    apr_pool_t *idlep;    /* and its pool */
 } wctx_t;
 
 typedef struct {
@@ -96,6 +99,9 @@ static ap_watchdog_t *watchdog;
 static apr_thread_pool_t *hctp;
 static int tpsize;
 #endif
+/* Checks multiplexed in the watchdog thread, see hc_poll_run() */
+static apr_pollset_t *hcps;
+static int pollsize;
 
 /*
  * This serves double duty by not only validating (and creating)
@@ -336,6 +342,19 @@ static const char *set_hc_tpsize (cmd_parms *cmd, void *dummy, const char *arg)
 }
 #endif
 
+static const char *set_hc_pollsize(cmd_parms *cmd, void *dummy, const char *arg)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+    if (err)
+        return err;
+
+    pollsize = atoi(arg);
+    if (pollsize < 0)
+        return "Invalid ProxyHCPollsize parameter. Parameter must be "
+               ">= 0";
+    return NULL;
+}
+
 /*
  * Create a dummy request rec, simply so we can use ap_expr.
  * Use our short-lived pool for bucket_alloc so that we can simply move
@@ -897,28 +916,15 @@ static apr_status_t hc_check_http(baton_t *baton, apr_thread_t *thread)
     return backend_cleanup("HCOH", backend, ctx->s, status);
 }
 
-static void * APR_THREAD_FUNC hc_check(apr_thread_t *thread, void *b)
+/*
+ * Account for the result of the check, then release the baton
+ */
+static void hc_check_done(baton_t *baton, apr_status_t rv, const char *how)
 {
-    baton_t *baton = (baton_t *)b;
     server_rec *s = baton->ctx->s;
     proxy_worker *worker = baton->worker;
     proxy_worker *hc = baton->hc;
     apr_time_t now;
-    apr_status_t rv;
-
-    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(03256)
-                 "%sHealth checking %s", (thread ? "Threaded " : ""),
-                 worker->s->name);
-
-    if (hc->s->method == TCP) {
-        rv = hc_check_tcp(baton);
-    }
-    else if (hc->s->method == CPING) {
-        rv = hc_check_cping(baton, thread);
-    }
-    else {
-        rv = hc_check_http(baton, thread);
-    }
 
     now = apr_time_now();
     if (rv == APR_ENOTIMPL) {
@@ -935,7 +941,7 @@ static void * APR_THREAD_FUNC hc_check(apr_thread_t *thread, void *b)
                 ap_proxy_set_wstatus(PROXY_WORKER_IN_ERROR_FLAG, 0, worker);
                 worker->s->pcount = 0;
                 ap_log_error(APLOG_MARK, APLOG_INFO, 0, s, APLOGNO(03302)
-                             "%sHealth check ENABLING %s", (thread ? "Threaded " : ""),
+                             "%sHealth check ENABLING %s", how,
                              worker->s->name);
 
             }
@@ -949,7 +955,7 @@ static void * APR_THREAD_FUNC hc_check(apr_thread_t *thread, void *b)
                 ap_proxy_set_wstatus(PROXY_WORKER_HC_FAIL_FLAG, 1, worker);
                 worker->s->fcount = 0;
                 ap_log_error(APLOG_MARK, APLOG_INFO, 0, s, APLOGNO(03303)
-                             "%sHealth check DISABLING %s", (thread ? "Threaded " : ""),
+                             "%sHealth check DISABLING %s", how,
                              worker->s->name);
             }
         }
@@ -959,10 +965,452 @@ static void * APR_THREAD_FUNC hc_check(apr_thread_t *thread, void *b)
     }
     apr_pool_destroy(baton->ptemp);
     worker->s->updated = now;
+}
+
+static void * APR_THREAD_FUNC hc_check(apr_thread_t *thread, void *b)
+{
+    baton_t *baton = (baton_t *)b;
+    server_rec *s = baton->ctx->s;
+    proxy_worker *worker = baton->worker;
+    proxy_worker *hc = baton->hc;
+    apr_status_t rv;
+
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(03256)
+                 "%sHealth checking %s", (thread ? "Threaded " : ""),
+                 worker->s->name);
+
+    if (hc->s->method == TCP) {
+        rv = hc_check_tcp(baton);
+    }
+    else if (hc->s->method == CPING) {
+        rv = hc_check_cping(baton, thread);
+    }
+    else {
+        rv = hc_check_http(baton, thread);
+    }
+
+    hc_check_done(baton, rv, (thread ? "Threaded " : ""));
 
     return NULL;
 }
 
+/*
+ * Polled checks: TCP checks and plain HTTP checks without a condition
+ * are run by the watchdog thread itself, using non-blocking sockets
+ * multiplexed in the hcps pollset, so that checking many workers does
+ * not need as many (blocked) threads. HTTP/1.1 connections are kept
+ * alive (in the wctx_t of the hc worker) for the next check when the
+ * response allows it.
+ */
+typedef enum {
+    HC_PROBE_CONNECT,
+    HC_PROBE_WRITE,
+    HC_PROBE_READ_HEAD,
+    HC_PROBE_READ_BODY
+} hc_probe_state_e;
+
+typedef struct hc_probe_t hc_probe_t;
+struct hc_probe_t {
+    hc_probe_t *next;
+    baton_t *baton;
+    apr_pool_t *sockp;          /* pool of the socket (outlives the probe) */
+    apr_socket_t *sock;
+    apr_sockaddr_t *addr;
+    apr_pollfd_t pfd;
+    hc_probe_state_e state;
+    apr_time_t deadline;
+    apr_size_t written;
+    apr_off_t remaining;        /* body bytes still to be read */
+    apr_size_t len;
+    char buf[HUGE_STRING_LEN];  /* response head */
+    unsigned int reused:1;
+    unsigned int keepalive:1;
+};
+
+static hc_probe_t *hc_probes;   /* in flight */
+static int hc_nprobes;
+
+static apr_interval_time_t hc_probe_timeout(hc_probe_t *probe)
+{
+    proxy_worker *hc = probe->baton->hc;
+
+    if (probe->state == HC_PROBE_CONNECT && hc->s->conn_timeout_set) {
+        return hc->s->conn_timeout;
+    }
+    if (hc->s->timeout_set) {
+        return hc->s->timeout;
+    }
+    return probe->baton->ctx->s->timeout;
+}
+
+static apr_status_t hc_probe_wait(hc_probe_t *probe, apr_int16_t events)
+{
+    if (probe->pfd.reqevents) {
+        if (probe->pfd.reqevents == events) {
+            return APR_SUCCESS;
+        }
+        apr_pollset_remove(hcps, &probe->pfd);
+    }
+    probe->pfd.p = probe->sockp;
+    probe->pfd.desc_type = APR_POLL_SOCKET;
+    probe->pfd.desc.s = probe->sock;
+    probe->pfd.reqevents = events;
+    probe->pfd.client_data = probe;
+    return apr_pollset_add(hcps, &probe->pfd);
+}
+
+static void hc_probe_close(hc_probe_t *probe)
+{
+    if (probe->pfd.reqevents) {
+        apr_pollset_remove(hcps, &probe->pfd);
+        probe->pfd.reqevents = 0;
+    }
+    if (probe->sockp) {
+        apr_pool_destroy(probe->sockp); /* closes the socket */
+        probe->sockp = NULL;
+        probe->sock = NULL;
+    }
+}
+
+static apr_status_t hc_probe_connect(hc_probe_t *probe)
+{
+    baton_t *baton = probe->baton;
+    apr_status_t rv;
+
+    if (hc_determine_connection(baton->ctx, baton->hc, &probe->addr,
+                                baton->ptemp) != OK) {
+        return APR_EGENERAL;
+    }
+    apr_pool_create(&probe->sockp, baton->ctx->p);
+    apr_pool_tag(probe->sockp, "hc_socket");
+    rv = apr_socket_create(&probe->sock, probe->addr->family, SOCK_STREAM,
+                           APR_PROTO_TCP, probe->sockp);
+    if (rv == APR_SUCCESS) {
+        apr_socket_opt_set(probe->sock, APR_SO_NONBLOCK, 1);
+        apr_socket_timeout_set(probe->sock, 0);
+        rv = apr_socket_connect(probe->sock, probe->addr);
+    }
+    probe->reused = 0;
+    probe->state = HC_PROBE_CONNECT;
+    probe->deadline = apr_time_now() + hc_probe_timeout(probe);
+    if (rv == APR_SUCCESS || APR_STATUS_IS_EINPROGRESS(rv)) {
+        /* connected (or not) once writable */
+        return hc_probe_wait(probe, APR_POLLOUT);
+    }
+    return rv;
+}
+
+/*
+ * Parse the response head once complete, and tell whether there is a
+ * body to drain before the connection can be reused.
+ */
+static apr_status_t hc_probe_parse(hc_probe_t *probe, char *end)
+{
+    baton_t *baton = probe->baton;
+    wctx_t *wctx = baton->hc->context;
+    int header_only = (*wctx->method != 'G');
+    int status, http11, chunked = 0;
+    apr_off_t clen = -1;
+    char *line, *last;
+
+    *end = '\0';
+    if (!apr_date_checkmask(probe->buf, "HTTP/1.# ###*")) {
+        return APR_EGENERAL;
+    }
+    http11 = (probe->buf[7] != '0') && (wctx->protocol[7] == '1');
+    status = atoi(&probe->buf[9]);
+    ap_log_error(APLOG_MARK, APLOG_TRACE2, 0, baton->ctx->s,
+                 "Polled response status %i for %s (%s)", status,
+                 baton->hc->s->name, baton->worker->s->name);
+
+    probe->keepalive = http11;
+    line = apr_strtok(probe->buf, CRLF, &last); /* status line */
+    while ((line = apr_strtok(NULL, CRLF, &last))) {
+        char *value = strchr(line, ':');
+        if (!value) {
+            continue;
+        }
+        *value++ = '\0';
+        while (apr_isspace(*value)) {
+            ++value;
+        }
+        if (!ap_cstr_casecmp(line, "Content-Length")) {
+            char *endp;
+            if (apr_strtoff(&clen, value, &endp, 10) || *endp || clen < 0) {
+                probe->keepalive = 0;
+            }
+        }
+        else if (!ap_cstr_casecmp(line, "Transfer-Encoding")) {
+            chunked = 1;
+        }
+        else if (!ap_cstr_casecmp(line, "Connection")
+                 && ap_find_token(baton->ptemp, value, "close")) {
+            probe->keepalive = 0;
+        }
+    }
+    if (header_only || status == 204 || status == 304) {
+        clen = 0;
+    }
+    if (chunked || clen < 0) {
+        probe->keepalive = 0;
+    }
+    else {
+        /* What we already read past the head is body */
+        apr_size_t head = end + 4 - probe->buf;
+        probe->remaining = clen - (apr_off_t)(probe->len - head);
+        if (probe->remaining < 0) {
+            probe->keepalive = 0; /* pipelined garbage? */
+        }
+    }
+
+    return (status >= 200 && status <= 399) ? APR_SUCCESS : APR_EGENERAL;
+}
+
+static void hc_probe_done(hc_probe_t *probe, apr_status_t rv)
+{
+    hc_probe_t **pp;
+    baton_t *baton = probe->baton;
+    proxy_worker *hc = baton->hc;
+    wctx_t *wctx = hc->context;
+
+    for (pp = &hc_probes; *pp; pp = &(*pp)->next) {
+        if (*pp == probe) {
+            *pp = probe->next;
+            hc_nprobes--;
+            break;
+        }
+    }
+    if (probe->pfd.reqevents) {
+        apr_pollset_remove(hcps, &probe->pfd);
+        probe->pfd.reqevents = 0;
+    }
+    if (rv == APR_SUCCESS && probe->keepalive && !wctx->idle
+            && hc->s->is_address_reusable && !hc->s->disablereuse) {
+        wctx->idle = probe->sock;
+        wctx->idlep = probe->sockp;
+        probe->sockp = NULL;
+    }
+    else {
+        hc_probe_close(probe);
+    }
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, rv, baton->ctx->s, APLOGNO(10457)
+                 "Polled health check %s Status (%d) for %s.",
+                 ap_proxy_show_hcmethod(hc->s->method),
+                 rv == APR_SUCCESS ? OK : !OK, hc->s->name);
+    hc_check_done(baton, rv, "Polled ");
+}
+
+/*
+ * A kept alive connection may have been closed by the backend in the
+ * meantime, if so retry once with a new one.
+ */
+static int hc_probe_retry(hc_probe_t *probe)
+{
+    if (!probe->reused || probe->len) {
+        return 0;
+    }
+    hc_probe_close(probe);
+    probe->written = 0;
+    return (hc_probe_connect(probe) == APR_SUCCESS);
+}
+
+static void hc_probe_run(hc_probe_t *probe)
+{
+    wctx_t *wctx = probe->baton->hc->context;
+    apr_status_t rv = APR_SUCCESS;
+    apr_size_t len;
+    char *end;
+
+    for (;;) {
+        switch (probe->state) {
+        case HC_PROBE_CONNECT:
+            /* Completes or reports the pending connect() */
+            rv = apr_socket_connect(probe->sock, probe->addr);
+            if (rv != APR_SUCCESS) {
+                break;
+            }
+            if (probe->baton->hc->s->method == TCP) {
+                hc_probe_done(probe, APR_SUCCESS);
+                return;
+            }
+            probe->state = HC_PROBE_WRITE;
+            probe->deadline = apr_time_now() + hc_probe_timeout(probe);
+            continue;
+
+        case HC_PROBE_WRITE:
+            len = strlen(wctx->req) - probe->written;
+            rv = apr_socket_send(probe->sock, wctx->req + probe->written,
+                                 &len);
+            probe->written += len;
+            if (APR_STATUS_IS_EAGAIN(rv)) {
+                rv = hc_probe_wait(probe, APR_POLLOUT);
+                if (rv == APR_SUCCESS) {
+                    return;
+                }
+            }
+            if (rv != APR_SUCCESS) {
+                break;
+            }
+            if (!wctx->req[probe->written]) {
+                probe->state = HC_PROBE_READ_HEAD;
+                probe->len = 0;
+            }
+            continue;
+
+        case HC_PROBE_READ_HEAD:
+            len = sizeof(probe->buf) - 1 - probe->len;
+            if (!len) {
+                rv = APR_ENOSPC;
+                break;
+            }
+            rv = apr_socket_recv(probe->sock, probe->buf + probe->len, &len);
+            probe->len += len;
+            if (rv != APR_SUCCESS) {
+                if (APR_STATUS_IS_EAGAIN(rv)) {
+                    rv = hc_probe_wait(probe, APR_POLLIN);
+                    if (rv == APR_SUCCESS) {
+                        return;
+                    }
+                }
+                break;
+            }
+            probe->buf[probe->len] = '\0';
+            if (!(end = strstr(probe->buf, CRLF CRLF))) {
+                continue;
+            }
+            rv = hc_probe_parse(probe, end);
+            if (rv != APR_SUCCESS || !probe->keepalive || !probe->remaining) {
+                hc_probe_done(probe, rv);
+                return;
+            }
+            probe->state = HC_PROBE_READ_BODY;
+            continue;
+
+        case HC_PROBE_READ_BODY:
+            /* Drain the body for the connection to be reusable */
+            len = sizeof(probe->buf);
+            rv = apr_socket_recv(probe->sock, probe->buf, &len);
+            probe->remaining -= len;
+            if (rv == APR_SUCCESS && probe->remaining > 0) {
+                continue;
+            }
+            if (APR_STATUS_IS_EAGAIN(rv)) {
+                rv = hc_probe_wait(probe, APR_POLLIN);
+                if (rv == APR_SUCCESS) {
+                    return;
+                }
+            }
+            /* The check passed already, just don't reuse on error */
+            if (rv != APR_SUCCESS || probe->remaining < 0) {
+                probe->keepalive = 0;
+            }
+            hc_probe_done(probe, APR_SUCCESS);
+            return;
+        }
+        break;
+    }
+
+    if (probe->state != HC_PROBE_CONNECT && hc_probe_retry(probe)) {
+        return;
+    }
+    hc_probe_done(probe, rv);
+}
+
+/*
+ * Start a polled check if possible, returns APR_SUCCESS if the check is
+ * taken care of (the baton is then owned by the probe).
+ */
+static apr_status_t hc_probe_start(baton_t *baton)
+{
+    proxy_worker *hc = baton->hc;
+    wctx_t *wctx = hc->context;
+    hc_probe_t *probe;
+    apr_status_t rv;
+
+    if (!hcps || hc_nprobes >= pollsize) {
+        return APR_EAGAIN;
+    }
+    if (hc->s->method != TCP) {
+        /* Conditions need the full response, and TLS a blocking conn_rec */
+        if (!wctx->req || *baton->worker->s->hcexpr
+                || strcmp(hc->s->scheme, "https") == 0
+                || strcmp(hc->s->scheme, "wss") == 0) {
+            return APR_ENOTIMPL;
+        }
+    }
+
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, baton->ctx->s, APLOGNO(10458)
+                 "Polled health checking %s", baton->worker->s->name);
+
+    probe = apr_pcalloc(baton->ptemp, sizeof(hc_probe_t));
+    probe->baton = baton;
+    probe->next = hc_probes;
+    hc_probes = probe;
+    hc_nprobes++;
+
+    if (wctx->idle && hc->s->method != TCP) {
+        probe->sock = wctx->idle;
+        probe->sockp = wctx->idlep;
+        wctx->idle = NULL;
+        wctx->idlep = NULL;
+        probe->reused = 1;
+        probe->state = HC_PROBE_WRITE;
+        probe->deadline = apr_time_now() + hc_probe_timeout(probe);
+        hc_probe_run(probe);
+        return APR_SUCCESS;
+    }
+
+    rv = hc_probe_connect(probe);
+    if (rv != APR_SUCCESS) {
+        hc_probe_done(probe, rv);
+    }
+    return APR_SUCCESS;
+}
+
+/*
+ * Run the polled checks for (up to) the given time
+ */
+static void hc_poll_run(server_rec *s, apr_interval_time_t budget)
+{
+    apr_time_t until = apr_time_now() + budget;
+
+    while (hc_probes) {
+        const apr_pollfd_t *pfds;
+        apr_int32_t i, n = 0;
+        hc_probe_t *probe, *next;
+        apr_interval_time_t timeout;
+        apr_time_t now = apr_time_now();
+        apr_status_t rv;
+
+        timeout = (until > now) ? until - now : 0;
+        for (probe = hc_probes; probe; probe = probe->next) {
+            if (probe->deadline - now < timeout) {
+                timeout = (probe->deadline > now) ? probe->deadline - now : 0;
+            }
+        }
+        rv = apr_pollset_poll(hcps, timeout, &n, &pfds);
+        if (rv != APR_SUCCESS && !APR_STATUS_IS_TIMEUP(rv)
+                && !APR_STATUS_IS_EINTR(rv)) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10459)
+                         "apr_pollset_poll() failed for health checks");
+            break;
+        }
+        for (i = 0; i < n; i++) {
+            hc_probe_run(pfds[i].client_data);
+        }
+
+        now = apr_time_now();
+        for (probe = hc_probes; probe; probe = next) {
+            next = probe->next;
+            if (now >= probe->deadline) {
+                hc_probe_done(probe, APR_TIMEUP);
+            }
+        }
+        if (now >= until) {
+            break;
+        }
+    }
+}
 static apr_status_t hc_watchdog_callback(int state, void *data,
                                          apr_pool_t *pool)
 {
@@ -998,6 +1446,17 @@ static apr_status_t hc_watchdog_callback(int state, void *data,
                 hctp = NULL;
             }
 #endif
+            if (pollsize && hcps == NULL) {
+                rv = apr_pollset_create(&hcps, pollsize, ctx->p, 0);
+                if (rv != APR_SUCCESS) {
+                    ap_log_error(APLOG_MARK, APLOG_INFO, rv, s, APLOGNO(10460)
+                                 "apr_pollset_create() for %d polled checks failed",
+                                 pollsize);
+                    /* we can continue on without polling */
+                    hcps = NULL;
+                    rv = APR_SUCCESS;
+                }
+            }
             break;
 
         case AP_WATCHDOG_STATE_RUNNING:
@@ -1044,15 +1503,17 @@ static apr_status_t hc_watchdog_callback(int state, void *data,
                             baton->worker = worker;
                             baton->ptemp = ptemp;
                             baton->hc = hc_get_hcworker(ctx, worker, ptemp);
+                            if (hc_probe_start(baton) == APR_SUCCESS) {
+                                /* see hc_poll_run() below */
+                            }
 #if HC_USE_THREADS
-                            if (hctp) {
+                            else if (hctp) {
                                 apr_thread_pool_push(hctp, hc_check, (void *)baton,
                                                      APR_THREAD_TASK_PRIORITY_NORMAL,
                                                      NULL);
                             }
-                            else
 #endif
-                            {
+                            else {
                                 baton->now = &now;
                                 hc_check(NULL, baton);
                             }
@@ -1060,6 +1521,9 @@ static apr_status_t hc_watchdog_callback(int state, void *data,
                         workers++;
                     }
                 }
+                if (hc_probes) {
+                    hc_poll_run(s, AP_WD_TM_SLICE / 2);
+                }
             }
             break;
 
@@ -1077,6 +1541,19 @@ static apr_status_t hc_watchdog_callback(int state, void *data,
                 hctp = NULL;
             }
 #endif
+            if (hcps) {
+                /* Abandon the polled checks in flight, they'll be redone */
+                while (hc_probes) {
+                    hc_probe_t *probe = hc_probes;
+                    hc_probes = probe->next;
+                    hc_probe_close(probe);
+                    probe->baton->worker->s->updated = apr_time_now();
+                    apr_pool_destroy(probe->baton->ptemp);
+                }
+                hc_nprobes = 0;
+                apr_pollset_destroy(hcps);
+                hcps = NULL;
+            }
             break;
     }
     return rv;
@@ -1088,6 +1565,8 @@ static int hc_pre_config(apr_pool_t *pconf, apr_pool_t *plog,
     hctp = NULL;
     tpsize = HC_THREADPOOL_SIZE;
 #endif
+    hcps = NULL;
+    pollsize = 0;
     return OK;
 }
 static int hc_post_config(apr_pool_t *p, apr_pool_t *plog,
@@ -1316,6 +1795,8 @@ static const command_rec command_table[] = {
     AP_INIT_TAKE1("ProxyHCTPsize", set_hc_tpsize, NULL, RSRC_CONF,
                      "Set size of health check thread pool"),
 #endif
+    AP_INIT_TAKE1("ProxyHCPollsize", set_hc_pollsize, NULL, RSRC_CONF,
+                     "Set maximum number of health checks polled by the watchdog thread"),
     { NULL }
 };
 
@@ -254,6 +254,9 @@ static void add_cl(apr_pool_t *p,
 
 typedef enum {
     PROXY_HTTP_REQ_HAVE_HEADER = 0,
+    PROXY_HTTP_REQ_BODY,
+    PROXY_HTTP_REQ_SENT,
+    PROXY_HTTP_RESP_BODY,
 
     PROXY_HTTP_TUNNELING
 } proxy_http_state;
@@ -282,7 +285,7 @@ typedef struct {
     apr_bucket_brigade *input_brigade;
 
     char *old_cl_val, *old_te_val;
-    apr_off_t cl_val;
+    apr_off_t cl_val, bytes_streamed;
 
     proxy_http_state state;
     rb_methods rb_method;
@@ -291,14 +294,27 @@ typedef struct {
     proxy_tunnel_rec *tunnel;
 
     apr_pool_t *async_pool;
+    apr_array_header_t *pfds;
     apr_interval_time_t idle_timeout;
 
+    apr_bucket_brigade *resp_bb, *resp_pass_bb;
+    apr_off_t resp_pending;
+
     unsigned int can_go_async           :1,
+                 body_async             :1,
+                 backend_broke          :1,
                  do_100_continue        :1,
                  prefetch_nonblocking   :1,
                  force10                :1;
 } proxy_http_req_t;
 
+int ap_proxy_http_process_response(proxy_http_req_t *req);
+static int proxy_http_stream_response(proxy_http_req_t *req);
+static int proxy_http_wait_response(proxy_http_req_t *req);
+static int stream_reqbody(proxy_http_req_t *req);
+static void proxy_http_async_cb(void *baton);
+static void proxy_http_async_cancel_cb(void *baton);
+
 static void proxy_http_async_finish(proxy_http_req_t *req)
 { 
     conn_rec *c = req->r->connection;
@@ -323,6 +339,165 @@ static void proxy_http_async_finish(proxy_http_req_t *req)
     ap_mpm_resume_suspended(c);
 }
 
+/* Complete a request which was suspended while waiting for the response
+ * from the backend, with the given status (as returned by the handler).
+ */
+static void proxy_http_async_respond(proxy_http_req_t *req, int status)
+{
+    request_rec *r = req->r;
+    conn_rec *c = r->connection;
+
+    ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r,
+                  "proxy %s: finish async response (%i)",
+                  req->proto, status);
+
+    if (req->backend) {
+        proxy_run_detach_backend(r, req->backend);
+        if (status != OK) {
+            req->backend->close = 1;
+        }
+        ap_proxy_release_connection(req->proto, req->backend, r->server);
+        req->backend = NULL;
+    }
+
+    if (status == DONE) {
+        status = OK;
+    }
+    if (status == OK) {
+        ap_finalize_request_protocol(r);
+    }
+    else {
+        ap_die(status, r);
+    }
+    ap_process_request_after_handler(r);
+    /* don't touch req or r from here */
+
+    ap_mpm_resume_suspended(c);
+}
+
+/* Wait for the backend to respond (PROXY_HTTP_REQ_SENT), and if it does not
+ * within ProxyAsyncDelay let the MPM poll for it so that this thread can be
+ * reused in the meantime. Returns SUSPENDED when it has to be waited
+ * asynchronously, OK to read the response synchronously.
+ */
+static int proxy_http_wait_response(proxy_http_req_t *req)
+{
+    proxy_conn_rec *backend = req->backend;
+    apr_pollfd_t pfd;
+    apr_int32_t nfds;
+    apr_status_t rv;
+
+    /* Not for an upgrade or 100-continue which both need the response
+     * synchronously, nor if something is already buffered by the filters.
+     */
+    if (!req->can_go_async || req->upgrade || req->do_100_continue
+            || !backend->sock || ap_run_input_pending(req->origin) == OK) {
+        return OK;
+    }
+
+    /* Fast responses are handled synchronously, this saves a round trip
+     * through the MPM and keeps the balancer failover possible.
+     */
+    memset(&pfd, 0, sizeof(pfd));
+    pfd.p = req->p;
+    pfd.desc_type = APR_POLL_SOCKET;
+    pfd.reqevents = APR_POLLIN;
+    pfd.desc.s = backend->sock;
+    do {
+        rv = apr_poll(&pfd, 1, &nfds, req->dconf->async_delay);
+    } while (APR_STATUS_IS_EINTR(rv));
+    if (!APR_STATUS_IS_TIMEUP(rv)) {
+        return OK;
+    }
+
+    if (!req->async_pool) {
+        apr_pool_create(&req->async_pool, req->p);
+    }
+    req->state = PROXY_HTTP_REQ_SENT;
+    req->pfds = apr_array_make(req->p, 1, sizeof(apr_pollfd_t));
+    APR_ARRAY_PUSH(req->pfds, apr_pollfd_t) = pfd;
+
+    ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, req->r,
+                  "proxy %s: waiting for response, going async",
+                  req->proto);
+
+    ap_mpm_register_poll_callback_timeout(req->async_pool, req->pfds,
+                                          proxy_http_async_cb,
+                                          proxy_http_async_cancel_cb,
+                                          req, req->idle_timeout);
+    return SUSPENDED;
+}
+
+/* Stop reading the response body from the backend until the client can
+ * take more of it (PROXY_HTTP_RESP_BODY), letting the MPM poll for it so
+ * that this thread can be reused in the meantime.
+ */
+static int proxy_http_pause_response(proxy_http_req_t *req)
+{
+    conn_rec *c = req->r->connection;
+    apr_pollfd_t *pfd;
+
+    if (!req->async_pool) {
+        apr_pool_create(&req->async_pool, req->p);
+    }
+    req->state = PROXY_HTTP_RESP_BODY;
+    if (!req->pfds) {
+        req->pfds = apr_array_make(req->p, 1, sizeof(apr_pollfd_t));
+    }
+    apr_array_clear(req->pfds);
+    pfd = apr_array_push(req->pfds);
+    memset(pfd, 0, sizeof(*pfd));
+    pfd->p = req->p;
+    pfd->desc_type = APR_POLL_SOCKET;
+    pfd->reqevents = APR_POLLOUT;
+    pfd->desc.s = ap_get_conn_socket(c);
+
+    ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, req->r,
+                  "proxy %s: client is slow, pausing the response",
+                  req->proto);
+
+    ap_mpm_register_poll_callback_timeout(req->async_pool, req->pfds,
+                                          proxy_http_async_cb,
+                                          proxy_http_async_cancel_cb,
+                                          req, req->r->server->timeout);
+    return SUSPENDED;
+}
+
+/* Stop forwarding the request body to the backend until the client sends
+ * more of it (PROXY_HTTP_REQ_BODY), letting the MPM poll for it so that
+ * this thread can be reused in the meantime.
+ */
+static int proxy_http_pause_request(proxy_http_req_t *req)
+{
+    conn_rec *c = req->r->connection;
+    apr_pollfd_t *pfd;
+
+    if (!req->async_pool) {
+        apr_pool_create(&req->async_pool, req->p);
+    }
+    req->state = PROXY_HTTP_REQ_BODY;
+    if (!req->pfds) {
+        req->pfds = apr_array_make(req->p, 1, sizeof(apr_pollfd_t));
+    }
+    apr_array_clear(req->pfds);
+    pfd = apr_array_push(req->pfds);
+    memset(pfd, 0, sizeof(*pfd));
+    pfd->p = req->p;
+    pfd->desc_type = APR_POLL_SOCKET;
+    pfd->reqevents = APR_POLLIN;
+    pfd->desc.s = ap_get_conn_socket(c);
+
+    ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, req->r,
+                  "proxy %s: client is slow, waiting for the request body",
+                  req->proto);
+
+    ap_mpm_register_poll_callback_timeout(req->async_pool, req->pfds,
+                                          proxy_http_async_cb,
+                                          proxy_http_async_cancel_cb,
+                                          req, req->r->server->timeout);
+    return SUSPENDED;
+}
+
 /* If neither socket becomes readable in the specified timeout,
  * this callback will kill the request.
  * We do not have to worry about having a cancel and a IO both queued.
@@ -334,6 +509,30 @@ static void proxy_http_async_cancel_cb(void *baton)
     ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, req->r,
                   "proxy %s: cancel async", req->proto);
 
+    if (req->state == PROXY_HTTP_REQ_BODY) {
+        ap_log_rerror(APLOG_MARK, APLOG_INFO, 0, req->r, APLOGNO(10532)
+                      "Timeout reading the request body for %s from the "
+                      "client", req->backend->hostname);
+        req->r->connection->keepalive = AP_CONN_CLOSE;
+        proxy_http_async_respond(req, HTTP_REQUEST_TIME_OUT);
+        return;
+    }
+    if (req->state == PROXY_HTTP_REQ_SENT) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, req->r, APLOGNO(10449)
+                      "Timeout waiting for the response of %s",
+                      req->backend->hostname);
+        proxy_http_async_respond(req, HTTP_GATEWAY_TIME_OUT);
+        return;
+    }
+    if (req->state == PROXY_HTTP_RESP_BODY) {
+        ap_log_rerror(APLOG_MARK, APLOG_INFO, 0, req->r, APLOGNO(10466)
+                      "Timeout writing the response of %s to the client",
+                      req->backend->hostname);
+        req->r->connection->aborted = 1;
+        proxy_http_async_respond(req, DONE);
+        return;
+    }
+
     req->r->connection->keepalive = AP_CONN_CLOSE;
     req->backend->close = 1;
     proxy_http_async_finish(req);
@@ -354,6 +553,55 @@ static void proxy_http_async_cb(void *baton)
     }
 
     switch (req->state) {
+    case PROXY_HTTP_REQ_BODY:
+        /* The client is readable, forward the rest of the body and wait for
+         * the response as usual (no hedging with a body).
+         */
+        status = stream_reqbody(req);
+        if (status == OK) {
+            req->body_async = 0;
+            proxy_run_backend_step(req->r, req->worker,
+                                   PROXY_BACKEND_REQUEST_SENT);
+            status = proxy_http_wait_response(req);
+            if (status == OK) {
+                status = ap_proxy_http_process_response(req);
+            }
+        }
+        if (status != SUSPENDED) {
+            proxy_http_async_respond(req, status);
+        }
+        return;
+
+    case PROXY_HTTP_REQ_SENT:
+        /* The backend is readable, process its response as usual */
+        status = ap_proxy_http_process_response(req);
+        if (status != SUSPENDED) {
+            proxy_http_async_respond(req, status);
+        }
+        return;
+
+    case PROXY_HTTP_RESP_BODY:
+        /* The client is writable, let the output filters write what they
+         * hold and resume reading from the backend when they are done.
+         */
+        status = ap_filter_output_pending(req->r->connection);
+        if (status == OK) {
+            status = proxy_http_pause_response(req);
+        }
+        else if (status == DECLINED) {
+            status = proxy_http_stream_response(req);
+        }
+        else {
+            req->backend->close = 1;
+            status = DONE;
+        }
+        if (status != SUSPENDED) {
+            proxy_http_async_respond(req, (req->r->connection->aborted
+                                           || req->backend_broke)
+                                          ? DONE : OK);
+        }
+        return;
+
     case PROXY_HTTP_TUNNELING:
         /* Pump both ends until they'd block and then start over again */
         status = ap_proxy_tunnel_run(req->tunnel);
@@ -397,6 +645,69 @@ static void proxy_http_async_cb(void *baton)
     }
 }
 
+/* Read the next part of the request body like ap_proxy_read_input(), but
+ * when the client has nothing more for now (after ProxyAsyncDelay) flush
+ * the backend and return SUSPENDED with the request waiting for the client
+ * to be readable.
+ */
+static int read_input_async(proxy_http_req_t *req)
+{
+    request_rec *r = req->r;
+    conn_rec *c = r->connection;
+    proxy_conn_rec *backend = req->backend;
+    apr_bucket_brigade *bb = req->input_brigade;
+    apr_status_t status;
+    int rv, flushed = 0;
+
+    for (;;) {
+        apr_pollfd_t pfd;
+        apr_int32_t nfds;
+
+        apr_brigade_cleanup(bb);
+        status = ap_get_brigade(r->input_filters, bb, AP_MODE_READBYTES,
+                                APR_NONBLOCK_READ, HUGE_STRING_LEN);
+        if (!(status == APR_SUCCESS && APR_BRIGADE_EMPTY(bb))
+                && !APR_STATUS_IS_EAGAIN(status)) {
+            break;
+        }
+
+        if (!flushed) {
+            /* Let the backend have what it got so far */
+            apr_brigade_cleanup(bb);
+            rv = ap_proxy_pass_brigade(req->bucket_alloc, r, backend,
+                                       backend->connection, bb, 1);
+            if (rv != OK) {
+                return rv;
+            }
+            flushed = 1;
+        }
+
+        /* Wait a bit before going async, like for the response */
+        memset(&pfd, 0, sizeof(pfd));
+        pfd.p = req->p;
+        pfd.desc_type = APR_POLL_SOCKET;
+        pfd.reqevents = APR_POLLIN;
+        pfd.desc.s = ap_get_conn_socket(c);
+        do {
+            status = apr_poll(&pfd, 1, &nfds, req->dconf->async_delay);
+        } while (APR_STATUS_IS_EINTR(status));
+        if (APR_STATUS_IS_TIMEUP(status)) {
+            return proxy_http_pause_request(req);
+        }
+    }
+
+    if (status != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, status, r, APLOGNO(10533)
+                      "read request body failed to %pI (%s)"
+                      " from %s (%s)", backend->addr,
+                      backend->hostname ? backend->hostname : "",
+                      c->client_ip, c->remote_host ? c->remote_host : "");
+        return ap_map_http_request_error(status, HTTP_BAD_REQUEST);
+    }
+
+    return OK;
+}
+
 static int stream_reqbody(proxy_http_req_t *req)
 {
     request_rec *r = req->r;
@@ -409,14 +720,19 @@ static int stream_reqbody(proxy_http_req_t *req)
     apr_bucket_brigade *header_brigade = req->header_brigade;
     apr_bucket_brigade *input_brigade = req->input_brigade;
     rb_methods rb_method = req->rb_method;
-    apr_off_t bytes, bytes_streamed = 0;
+    apr_off_t bytes;
     apr_bucket *e;
 
     do {
         if (APR_BRIGADE_EMPTY(input_brigade)
                 && APR_BRIGADE_EMPTY(header_brigade)) {
-            rv = ap_proxy_read_input(r, p_conn, input_brigade,
-                                     HUGE_STRING_LEN);
+            if (req->body_async) {
+                rv = read_input_async(req);
+            }
+            else {
+                rv = ap_proxy_read_input(r, p_conn, input_brigade,
+                                         HUGE_STRING_LEN);
+            }
             if (rv != OK) {
                 return rv;
             }
@@ -433,7 +749,7 @@ static int stream_reqbody(proxy_http_req_t *req)
             }
 
             apr_brigade_length(input_brigade, 1, &bytes);
-            bytes_streamed += bytes;
+            req->bytes_streamed += bytes;
 
             if (rb_method == RB_STREAM_CHUNKED) {
                 if (bytes) {
@@ -459,8 +775,8 @@ static int stream_reqbody(proxy_http_req_t *req)
                 }
             }
             else if (rb_method == RB_STREAM_CL
-                     && (bytes_streamed > req->cl_val
-                         || (seen_eos && bytes_streamed < req->cl_val))) {
+                     && (req->bytes_streamed > req->cl_val
+                         || (seen_eos && req->bytes_streamed < req->cl_val))) {
                 /* C-L != bytes streamed?!?
                  *
                  * Prevent HTTP Request/Response Splitting.
@@ -478,8 +794,9 @@ static int stream_reqbody(proxy_http_req_t *req)
                               "read %s bytes of request body than expected "
                               "(got %" APR_OFF_T_FMT ", expected "
                               "%" APR_OFF_T_FMT ")",
-                              bytes_streamed > req->cl_val ? "more" : "less",
-                              bytes_streamed, req->cl_val);
+                              req->bytes_streamed > req->cl_val ? "more"
+                                                                : "less",
+                              req->bytes_streamed, req->cl_val);
                 return HTTP_INTERNAL_SERVER_ERROR;
             }
 
@@ -706,7 +1023,15 @@ static int ap_proxy_http_request(proxy_http_req_t *req)
                                        req->origin, req->header_brigade, 1);
         }
         else {
+            /* Don't hold this thread for a slow client's body (the MPM
+             * can only poll for the socket of a main connection).
+             */
+            req->body_async = (req->can_go_async && !req->upgrade
+                               && !r->connection->master);
             rv = stream_reqbody(req);
+            if (rv != SUSPENDED) {
+                req->body_async = 0;
+            }
         }
         break;
 
@@ -716,6 +1041,9 @@ static int ap_proxy_http_request(proxy_http_req_t *req)
         break;
     }
 
+    if (rv == SUSPENDED) {
+        return SUSPENDED;
+    }
     if (rv != OK) {
         conn_rec *c = r->connection;
         /* apr_status_t value has been logged in lower level method */
@@ -731,6 +1059,204 @@ static int ap_proxy_http_request(proxy_http_req_t *req)
     return OK;
 }
 
+/* Pick the member to hedge the request to: the usable one with the lowest
+ * average response time weighted by its number of active requests, among
+ * the ones which could have been elected in the first place.
+ */
+static proxy_worker *proxy_http_hedge_worker(proxy_worker *worker)
+{
+    proxy_balancer *balancer = worker->balancer;
+    proxy_worker *best = NULL;
+    apr_uint64_t score, best_score = 0;
+    int i;
+
+    for (i = 0; i < balancer->workers->nelts; i++) {
+        proxy_worker *w = APR_ARRAY_IDX(balancer->workers, i, proxy_worker *);
+        if (w == worker
+                || !PROXY_WORKER_IS_USABLE(w)
+                || PROXY_WORKER_IS_DRAINING(w)
+                || PROXY_WORKER_IS_SPARE(w)
+                || PROXY_WORKER_IS_STANDBY(w)
+                || w->s->lbset != worker->s->lbset
+                || strcmp(w->s->scheme, worker->s->scheme) != 0) {
+            continue;
+        }
+        score = (apr_uint64_t)apr_atomic_read32(&w->s->latency) *
+                (w->s->busy + 1);
+        if (!best || score < best_score) {
+            best = w;
+            best_score = score;
+        }
+    }
+    return best;
+}
+
+/* Hedging (balancer's hedge= parameter): if the member does not start to
+ * respond to an idempotent and bodyless request within hedge times its
+ * average response time, send the same request to another member and
+ * continue with whichever starts to respond first, the other connection
+ * being closed. On return, req->worker/backend/origin are the chosen ones.
+ */
+static void proxy_http_hedge(proxy_http_req_t *req, const char *url,
+                             const char *proxyname, apr_port_t proxyport)
+{
+    request_rec *r = req->r;
+    proxy_worker *worker = req->worker;
+    proxy_http_req_t *hreq;
+    proxy_conn_rec *backend = NULL;
+    proxy_http_req_t *winner, *loser;
+    apr_interval_time_t delay, timeout;
+    apr_pollfd_t pfds[2];
+    const apr_pollfd_t *ready;
+    apr_int32_t nfds;
+    apr_uri_t *uri;
+    const char *path;
+    char *hurl;
+    apr_status_t rv;
+    int status;
+
+    if (!worker->balancer || worker->balancer->hedge <= 0
+            || r->method_number != M_GET
+            || req->rb_method != RB_STREAM_CL || req->cl_val
+            || req->old_te_val || req->upgrade || req->do_100_continue
+            || !req->backend->sock
+            || ap_run_input_pending(req->origin) == OK) {
+        return;
+    }
+    delay = (apr_interval_time_t)apr_atomic_read32(&worker->s->latency);
+    if (!delay) {
+        /* Not measured yet */
+        return;
+    }
+    delay *= worker->balancer->hedge;
+
+    memset(pfds, 0, sizeof(pfds));
+    pfds[0].p = req->p;
+    pfds[0].desc_type = APR_POLL_SOCKET;
+    pfds[0].reqevents = APR_POLLIN;
+    pfds[0].desc.s = req->backend->sock;
+    pfds[0].client_data = req;
+    do {
+        rv = apr_poll(pfds, 1, &nfds, delay);
+    } while (APR_STATUS_IS_EINTR(rv));
+    if (!APR_STATUS_IS_TIMEUP(rv)) {
+        return;
+    }
+    if (!(worker = proxy_http_hedge_worker(req->worker))) {
+        return;
+    }
+    ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(10462)
+                  "%s: no response from %s after %" APR_TIME_T_FMT "us, "
+                  "hedging to %s", worker->balancer->s->name,
+                  req->worker->s->name, delay, worker->s->name);
+
+    /* The same request, to the other member */
+    hreq = apr_pmemdup(req->p, req, sizeof(*req));
+    hreq->worker = worker;
+    hreq->origin = NULL;
+    hreq->old_cl_val = hreq->old_te_val = NULL;
+    if (ap_proxy_acquire_connection(req->proto, &backend, worker,
+                                    r->server) != OK) {
+        return;
+    }
+    backend->is_ssl = req->backend->is_ssl;
+    hreq->backend = backend;
+
+    path = ap_strstr_c(url, "://");
+    if (path) {
+        path = ap_strchr_c(path + 3, '/');
+    }
+    hurl = apr_pstrcat(req->p, worker->s->name, path, NULL);
+    uri = apr_palloc(req->p, sizeof(*uri));
+    hreq->header_brigade = apr_brigade_create(req->p, req->bucket_alloc);
+    hreq->input_brigade = apr_brigade_create(req->p, req->bucket_alloc);
+    APR_BRIGADE_INSERT_TAIL(hreq->input_brigade,
+                            apr_bucket_eos_create(req->bucket_alloc));
+    status = ap_proxy_determine_connection(req->p, r, req->sconf, worker,
+                                           backend, uri, &hurl, proxyname,
+                                           proxyport, hreq->server_portstr,
+                                           sizeof(hreq->server_portstr));
+    if (status != OK) {
+        goto failed;
+    }
+    status = ap_proxy_create_hdrbrgd(req->p, hreq->header_brigade, r,
+                                     backend, worker, req->sconf, uri, hurl,
+                                     hreq->server_portstr, &hreq->old_cl_val,
+                                     &hreq->old_te_val);
+    if (status != OK) {
+        goto failed;
+    }
+    terminate_headers(hreq);
+    if (ap_proxy_check_connection(req->proto, backend, r->server, 1,
+                                  PROXY_CHECK_CONN_EMPTY)
+            && ap_proxy_connect_backend(req->proto, backend, worker,
+                                        r->server)) {
+        goto failed;
+    }
+    status = ap_proxy_connection_create_ex(req->proto, backend, r);
+    if (status != OK) {
+        goto failed;
+    }
+    hreq->origin = backend->connection;
+    status = stream_reqbody(hreq);
+    if (status != OK) {
+        goto failed;
+    }
+
+    /* Whichever responds first */
+    pfds[1] = pfds[0];
+    pfds[1].desc.s = backend->sock;
+    pfds[1].client_data = hreq;
+    if (worker->s->timeout_set) {
+        timeout = worker->s->timeout;
+    }
+    else if (req->sconf->timeout_set) {
+        timeout = req->sconf->timeout;
+    }
+    else {
+        timeout = r->server->timeout;
+    }
+    do {
+        rv = apr_poll(pfds, 2, &nfds, timeout);
+    } while (APR_STATUS_IS_EINTR(rv));
+    winner = req;
+    if (rv == APR_SUCCESS && nfds) {
+        /* Prefer the first member if both responded */
+        ready = (pfds[0].rtnevents ? &pfds[0] : &pfds[1]);
+        winner = ready->client_data;
+    }
+    loser = (winner == req) ? hreq : req;
+
+    ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r,
+                  "proxy %s: hedged request answered by %s",
+                  req->proto, winner->worker->s->name);
+    proxy_run_detach_backend(r, loser->backend);
+    loser->backend->close = 1;
+    ap_proxy_release_connection(req->proto, loser->backend, r->server);
+
+    if (winner != req) {
+        req->worker = winner->worker;
+        req->backend = winner->backend;
+        req->origin = winner->origin;
+        apr_table_setn(r->subprocess_env, "BALANCER_WORKER_NAME",
+                       winner->worker->s->name);
+        apr_table_setn(r->subprocess_env, "BALANCER_WORKER_ROUTE",
+                       winner->worker->s->route);
+    }
+    apr_table_setn(r->subprocess_env, "BALANCER_HEDGED", "1");
+    return;
+
+failed:
+    ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(10463)
+                  "%s: hedging to %s failed",
+                  worker->balancer->s->name, worker->s->name);
+    if (hreq->origin) {
+        proxy_run_detach_backend(r, backend);
+    }
+    backend->close = 1;
+    ap_proxy_release_connection(req->proto, backend, r->server);
+}
+
 /*
  * If the date is a valid RFC 850 date or asctime() date, then it
  * is converted to the RFC 1123 format.
@@ -1029,6 +1555,215 @@ static int send_continue_body(proxy_http_req_t *req)
     return status;
 }
 
+/* Relay the response body from the backend to the client, until the end
+ * or until the client is too slow to take it (with ProxyResponseBufferLimit
+ * and an MPM that can poll) in which case SUSPENDED is returned and this is
+ * resumed by proxy_http_async_cb().
+ */
+static int proxy_http_stream_response(proxy_http_req_t *req)
+{
+    request_rec *r = req->r;
+    conn_rec *c = r->connection;
+    proxy_conn_rec *backend = req->backend;
+    apr_bucket_brigade *bb = req->resp_bb;
+    apr_bucket_brigade *pass_bb = req->resp_pass_bb;
+    apr_off_t limit = req->dconf->response_buffer_limit;
+    apr_read_type_e mode;
+    apr_bucket *e;
+    int finish;
+
+    req->state = PROXY_HTTP_RESP_BODY;
+
+    mode = APR_NONBLOCK_READ;
+    finish = FALSE;
+    do {
+        apr_off_t readbytes;
+        apr_status_t rv;
+
+        rv = ap_get_brigade(backend->r->input_filters, bb,
+                            AP_MODE_READBYTES, mode,
+                            req->sconf->io_buffer_size);
+
+        /* ap_get_brigade will return success with an empty brigade
+         * for a non-blocking read which would block: */
+        if (mode == APR_NONBLOCK_READ
+            && (APR_STATUS_IS_EAGAIN(rv)
+                || (rv == APR_SUCCESS && APR_BRIGADE_EMPTY(bb)))) {
+            /* flush to the client and switch to blocking mode */
+            e = apr_bucket_flush_create(c->bucket_alloc);
+            APR_BRIGADE_INSERT_TAIL(bb, e);
+            if (ap_pass_brigade(r->output_filters, bb)
+                || c->aborted) {
+                backend->close = 1;
+                break;
+            }
+            apr_brigade_cleanup(bb);
+            mode = APR_BLOCK_READ;
+            continue;
+        }
+        if (rv == APR_EOF) {
+            backend->close = 1;
+            break;
+        }
+        if (rv != APR_SUCCESS || APR_BRIGADE_EMPTY(bb)) {
+            int error_status = HTTP_BAD_GATEWAY;
+            if (rv == APR_ENOSPC) {
+                ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(02475)
+                              "Response chunk/line was too large to parse");
+            }
+            else if (rv == APR_ENOTIMPL) {
+                ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(02476)
+                              "Response Transfer-Encoding was not recognised");
+            }
+            else if (rv != APR_SUCCESS) {
+                ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01110)
+                              "Network error reading response");
+            }
+            else {
+                ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(10293)
+                              "Unexpected empty data reading response");
+                error_status = HTTP_INTERNAL_SERVER_ERROR;
+            }
+
+            /* In this case, we are in real trouble because
+             * our backend bailed on us. Given we're half way
+             * through a response, our only option is to
+             * disconnect the client too.
+             */
+            apr_brigade_cleanup(bb);
+            ap_proxy_fill_error_brigade(r, error_status, bb, 1);
+            ap_pass_brigade(r->output_filters, bb);
+
+            req->backend_broke = 1;
+            backend->close = 1;
+            break;
+        }
+        /* next time try a non-blocking read */
+        mode = APR_NONBLOCK_READ;
+
+        if (!apr_is_empty_table(backend->r->trailers_in)) {
+            apr_table_do(add_trailers, r->trailers_out,
+                    backend->r->trailers_in, NULL);
+            apr_table_clear(backend->r->trailers_in);
+        }
+
+        apr_brigade_length(bb, 0, &readbytes);
+        backend->worker->s->read += readbytes;
+#if DEBUGGING
+        {
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(01111)
+                      "readbytes: %#x", readbytes);
+        }
+#endif
+
+        /* Switch the allocator lifetime of the buckets */
+        rv = ap_proxy_buckets_lifetime_transform(r, bb, pass_bb);
+        if (rv != APR_SUCCESS) {
+            /* Same, half way through a response, our only option is
+             * to notice the output filters and then disconnect the
+             * client and backend.
+             */
+            if (!APR_BRIGADE_EMPTY(pass_bb)) {
+                /* Pass what we have still */
+                ap_pass_brigade(r->output_filters, pass_bb);
+                apr_brigade_cleanup(pass_bb);
+            }
+            ap_proxy_fill_error_brigade(r, HTTP_INTERNAL_SERVER_ERROR,
+                                        pass_bb, 1);
+            ap_pass_brigade(r->output_filters, pass_bb);
+            apr_brigade_cleanup(pass_bb);
+
+            req->backend_broke = 1;
+            backend->close = 1;
+            break;
+        }
+
+        /* found the last brigade? */
+        if (APR_BUCKET_IS_EOS(APR_BRIGADE_LAST(pass_bb))) {
+
+            /* signal that we must leave */
+            finish = TRUE;
+
+            /* the brigade may contain transient buckets that contain
+             * data that lives only as long as the backend connection.
+             * Force a setaside so these transient buckets become heap
+             * buckets that live as long as the request.
+             */
+            for (e = APR_BRIGADE_FIRST(pass_bb); e
+                    != APR_BRIGADE_SENTINEL(pass_bb); e
+                    = APR_BUCKET_NEXT(e)) {
+                apr_bucket_setaside(e, r->pool);
+            }
+
+            /* finally it is safe to clean up the brigade from the
+             * connection pool, as we have forced a setaside on all
+             * buckets.
+             */
+            apr_brigade_cleanup(bb);
+
+            /* make sure we release the backend connection as soon
+             * as we know we are done, so that the backend isn't
+             * left waiting for a slow client to eventually
+             * acknowledge the data.
+             */
+            proxy_run_detach_backend(r, backend);
+            ap_proxy_release_connection(backend->worker->s->scheme,
+                    backend, r->server);
+            /* Ensure that the backend is not reused */
+            req->backend = NULL;
+
+        }
+
+        /* try send what we read */
+        if (ap_pass_brigade(r->output_filters, pass_bb) != APR_SUCCESS
+            || c->aborted) {
+            /* Ack! Phbtt! Die! User aborted! */
+            /* Only close backend if we haven't got all from the
+             * backend. Furthermore if req->backend is NULL it is no
+             * longer safe to fiddle around with backend as it might
+             * be already in use by another thread.
+             */
+            if (req->backend) {
+                /* this causes socket close below */
+                req->backend->close = 1;
+            }
+            finish = TRUE;
+        }
+
+        /* make sure we always clean up after ourselves */
+        apr_brigade_cleanup(pass_bb);
+        apr_brigade_cleanup(bb);
+
+        /* Flow control: stop reading from the backend while the output
+         * filters hold more than ProxyResponseBufferLimit bytes that the
+         * client did not take yet.
+         */
+        if (!finish && limit > 0) {
+            if (!ap_filter_should_yield(r->output_filters)) {
+                req->resp_pending = 0;
+            }
+            else if ((req->resp_pending += readbytes) > limit) {
+                req->resp_pending = 0;
+                if (req->can_go_async) {
+                    return proxy_http_pause_response(req);
+                }
+
+                /* Synchronous, so block until it's written */
+                e = apr_bucket_flush_create(c->bucket_alloc);
+                APR_BRIGADE_INSERT_TAIL(pass_bb, e);
+                if (ap_pass_brigade(r->output_filters, pass_bb) != APR_SUCCESS
+                    || c->aborted) {
+                    backend->close = 1;
+                    finish = TRUE;
+                }
+                apr_brigade_cleanup(pass_bb);
+            }
+        }
+    } while (!finish);
+
+    return OK;
+}
+
 static
 int ap_proxy_http_process_response(proxy_http_req_t *req)
 {
@@ -1122,6 +1857,9 @@ int ap_proxy_http_process_response(proxy_http_req_t *req)
             rc = ap_proxygetline(backend->tmp_bb, buffer, response_field_size,
                                  backend->r, 0, &len);
         }
+        if (len > 0 && !interim_response) {
+            proxy_run_backend_step(r, worker, PROXY_BACKEND_RESPONSE);
+        }
         if (len <= 0) {
             ap_log_rerror(APLOG_MARK, APLOG_ERR, rc, r, APLOGNO(01102)
                           "error reading status line from remote "
@@ -1642,9 +2380,6 @@ int ap_proxy_http_process_response(proxy_http_req_t *req)
 
         /* send body - but only if a body is expected */
         if (!r->header_only && !AP_STATUS_IS_HEADER_ONLY(proxy_status)) {
-            apr_read_type_e mode;
-            int finish;
-
             /* We need to copy the output headers and treat them as input
              * headers as well.  BUT, we need to do this before we remove
              * TE, so that they are preserved accordingly for
@@ -1676,167 +2411,14 @@ int ap_proxy_http_process_response(proxy_http_req_t *req)
                 r->status_line = original_status_line;
             }
 
-            mode = APR_NONBLOCK_READ;
-            finish = FALSE;
-            do {
-                apr_off_t readbytes;
-                apr_status_t rv;
-
-                rv = ap_get_brigade(backend->r->input_filters, bb,
-                                    AP_MODE_READBYTES, mode,
-                                    req->sconf->io_buffer_size);
-
-                /* ap_get_brigade will return success with an empty brigade
-                 * for a non-blocking read which would block: */
-                if (mode == APR_NONBLOCK_READ
-                    && (APR_STATUS_IS_EAGAIN(rv)
-                        || (rv == APR_SUCCESS && APR_BRIGADE_EMPTY(bb)))) {
-                    /* flush to the client and switch to blocking mode */
-                    e = apr_bucket_flush_create(c->bucket_alloc);
-                    APR_BRIGADE_INSERT_TAIL(bb, e);
-                    if (ap_pass_brigade(r->output_filters, bb)
-                        || c->aborted) {
-                        backend->close = 1;
-                        break;
-                    }
-                    apr_brigade_cleanup(bb);
-                    mode = APR_BLOCK_READ;
-                    continue;
-                }
-                if (rv == APR_EOF) {
-                    backend->close = 1;
-                    break;
-                }
-                if (rv != APR_SUCCESS || APR_BRIGADE_EMPTY(bb)) {
-                    int error_status = HTTP_BAD_GATEWAY;
-                    if (rv == APR_ENOSPC) {
-                        ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(02475)
-                                      "Response chunk/line was too large to parse");
-                    }
-                    else if (rv == APR_ENOTIMPL) {
-                        ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(02476)
-                                      "Response Transfer-Encoding was not recognised");
-                    }
-                    else if (rv != APR_SUCCESS) {
-                        ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01110)
-                                      "Network error reading response");
-                    }
-                    else {
-                        ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(10293)
-                                      "Unexpected empty data reading response");
-                        error_status = HTTP_INTERNAL_SERVER_ERROR;
-                    }
-
-                    /* In this case, we are in real trouble because
-                     * our backend bailed on us. Given we're half way
-                     * through a response, our only option is to
-                     * disconnect the client too.
-                     */
-                    apr_brigade_cleanup(bb);
-                    ap_proxy_fill_error_brigade(r, error_status, bb, 1);
-                    ap_pass_brigade(r->output_filters, bb);
-
-                    backend_broke = 1;
-                    backend->close = 1;
-                    break;
-                }
-                /* next time try a non-blocking read */
-                mode = APR_NONBLOCK_READ;
-
-                if (!apr_is_empty_table(backend->r->trailers_in)) {
-                    apr_table_do(add_trailers, r->trailers_out,
-                            backend->r->trailers_in, NULL);
-                    apr_table_clear(backend->r->trailers_in);
-                }
-
-                apr_brigade_length(bb, 0, &readbytes);
-                backend->worker->s->read += readbytes;
-#if DEBUGGING
-                {
-                ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(01111)
-                              "readbytes: %#x", readbytes);
-                }
-#endif
-
-                /* Switch the allocator lifetime of the buckets */
-                rv = ap_proxy_buckets_lifetime_transform(r, bb, pass_bb);
-                if (rv != APR_SUCCESS) {
-                    /* Same, half way through a response, our only option is
-                     * to notice the output filters and then disconnect the
-                     * client and backend.
-                     */
-                    if (!APR_BRIGADE_EMPTY(pass_bb)) {
-                        /* Pass what we have still */
-                        ap_pass_brigade(r->output_filters, pass_bb);
-                        apr_brigade_cleanup(pass_bb);
-                    }
-                    ap_proxy_fill_error_brigade(r, HTTP_INTERNAL_SERVER_ERROR,
-                                                pass_bb, 1);
-                    ap_pass_brigade(r->output_filters, pass_bb);
-                    apr_brigade_cleanup(pass_bb);
-
-                    backend_broke = 1;
-                    backend->close = 1;
-                    break;
-                }
-
-                /* found the last brigade? */
-                if (APR_BUCKET_IS_EOS(APR_BRIGADE_LAST(pass_bb))) {
-
-                    /* signal that we must leave */
-                    finish = TRUE;
-
-                    /* the brigade may contain transient buckets that contain
-                     * data that lives only as long as the backend connection.
-                     * Force a setaside so these transient buckets become heap
-                     * buckets that live as long as the request.
-                     */
-                    for (e = APR_BRIGADE_FIRST(pass_bb); e
-                            != APR_BRIGADE_SENTINEL(pass_bb); e
-                            = APR_BUCKET_NEXT(e)) {
-                        apr_bucket_setaside(e, r->pool);
-                    }
-
-                    /* finally it is safe to clean up the brigade from the
-                     * connection pool, as we have forced a setaside on all
-                     * buckets.
-                     */
-                    apr_brigade_cleanup(bb);
-
-                    /* make sure we release the backend connection as soon
-                     * as we know we are done, so that the backend isn't
-                     * left waiting for a slow client to eventually
-                     * acknowledge the data.
-                     */
-                    proxy_run_detach_backend(r, backend);
-                    ap_proxy_release_connection(backend->worker->s->scheme,
-                            backend, r->server);
-                    /* Ensure that the backend is not reused */
-                    req->backend = NULL;
-
-                }
-
-                /* try send what we read */
-                if (ap_pass_brigade(r->output_filters, pass_bb) != APR_SUCCESS
-                    || c->aborted) {
-                    /* Ack! Phbtt! Die! User aborted! */
-                    /* Only close backend if we haven't got all from the
-                     * backend. Furthermore if req->backend is NULL it is no
-                     * longer safe to fiddle around with backend as it might
-                     * be already in use by another thread.
-                     */
-                    if (req->backend) {
-                        /* this causes socket close below */
-                        req->backend->close = 1;
-                    }
-                    finish = TRUE;
-                }
-
-                /* make sure we always clean up after ourselves */
-                apr_brigade_cleanup(pass_bb);
-                apr_brigade_cleanup(bb);
-
-            } while (!finish);
+            req->resp_bb = bb;
+            req->resp_pass_bb = pass_bb;
+            req->resp_pending = 0;
+            status = proxy_http_stream_response(req);
+            if (status == SUSPENDED) {
+                return SUSPENDED;
+            }
+            backend_broke = req->backend_broke;
 
             ap_log_rerror(APLOG_MARK, APLOG_TRACE2, 0, r, "end body send");
         }
@@ -1910,6 +2492,7 @@ static int proxy_http_handler(request_rec *r, proxy_worker *worker,
     int retry = 0;
     char *locurl = url;
     int toclose = 0;
+    int fresh;
     /*
      * Use a shorter-lived pool to reduce memory usage
      * and avoid a memory leak
@@ -2095,15 +2678,20 @@ static int proxy_http_handler(request_rec *r, proxy_worker *worker,
         }
 
         /* Step Two: Make the Connection */
+        fresh = 0;
         if (ap_proxy_check_connection(scheme, backend, r->server, 1,
-                                      PROXY_CHECK_CONN_EMPTY)
-                && ap_proxy_connect_backend(scheme, backend, worker,
-                                            r->server)) {
-            ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01114)
-                          "HTTP: failed to make connection to backend: %s",
-                          backend->hostname);
-            status = HTTP_SERVICE_UNAVAILABLE;
-            break;
+                                      PROXY_CHECK_CONN_EMPTY)) {
+            proxy_run_backend_step(r, worker, PROXY_BACKEND_CONNECT);
+            if (ap_proxy_connect_backend(scheme, backend, worker,
+                                         r->server)) {
+                ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01114)
+                              "HTTP: failed to make connection to backend: %s",
+                              backend->hostname);
+                status = HTTP_SERVICE_UNAVAILABLE;
+                break;
+            }
+            proxy_run_backend_step(r, worker, PROXY_BACKEND_CONNECTED);
+            fresh = 1;
         }
 
         /* Step Three: Create conn_rec */
@@ -2111,6 +2699,28 @@ static int proxy_http_handler(request_rec *r, proxy_worker *worker,
             break;
         req->origin = backend->connection;
 
+        /* Handshake a new TLS connection now rather than on the first write
+         * of the request, so that its time is told apart from the request's
+         */
+        if (fresh && backend->is_ssl) {
+            apr_status_t rv;
+
+            rv = ap_get_brigade(req->origin->input_filters, backend->tmp_bb,
+                                AP_MODE_INIT, APR_BLOCK_READ, 0);
+            apr_brigade_cleanup(backend->tmp_bb);
+            if (rv != APR_SUCCESS) {
+                ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(10519)
+                              "HTTP: TLS handshake failed with backend: %s",
+                              backend->hostname);
+                backend->close = 1;
+                status = ap_proxyerror(r, HTTP_INTERNAL_SERVER_ERROR,
+                                       "Error during SSL Handshake with"
+                                       " remote server");
+                break;
+            }
+            proxy_run_backend_step(r, worker, PROXY_BACKEND_HANDSHAKEN);
+        }
+
         /* Don't recycle the connection if prefetch (above) told not to do so */
         if (toclose) {
             backend->close = 1;
@@ -2122,6 +2732,9 @@ static int proxy_http_handler(request_rec *r, proxy_worker *worker,
          * kinda HTTP ping test, allow for retries
          */
         status = ap_proxy_http_request(req);
+        if (status == SUSPENDED) {
+            return SUSPENDED;
+        }
         if (status != OK) {
             proxy_run_detach_backend(r, backend);
             if (req->do_100_continue && status == HTTP_SERVICE_UNAVAILABLE) {
@@ -2136,7 +2749,13 @@ static int proxy_http_handler(request_rec *r, proxy_worker *worker,
             break;
         }
 
+        proxy_run_backend_step(r, worker, PROXY_BACKEND_REQUEST_SENT);
+
         /* Step Five: Receive the Response... Fall thru to cleanup */
+        proxy_http_hedge(req, url, proxyname, proxyport);
+        if (proxy_http_wait_response(req) == SUSPENDED) {
+            return SUSPENDED;
+        }
         status = ap_proxy_http_process_response(req);
         if (status == SUSPENDED) {
             return SUSPENDED;
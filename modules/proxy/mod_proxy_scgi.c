@@ -84,6 +84,7 @@ typedef struct {
 typedef struct {
     apr_socket_t *sock;
     apr_off_t *counter;
+    apr_off_t remaining;    /* bytes left of a length-delimited body or -1 */
 } socket_ex_data;
 
 static apr_bucket *bucket_socket_ex_create(socket_ex_data *data,
@@ -106,8 +107,20 @@ static apr_status_t bucket_socket_ex_read(apr_bucket *a, const char **str,
     }
 
     *str = NULL;
+    if (data->remaining == 0) {
+        /* the body is complete, the connection may be reused */
+        if (block == APR_NONBLOCK_READ) {
+            apr_socket_timeout_set(p, timeout);
+        }
+        a = apr_bucket_immortal_make(a, "", 0);
+        *str = a->data;
+        return APR_SUCCESS;
+    }
     *len = APR_BUCKET_BUFF_SIZE;
     buf = apr_bucket_alloc(*len, a->list);
+    if (data->remaining > 0 && data->remaining < (apr_off_t)*len) {
+        *len = (apr_size_t)data->remaining;
+    }
 
     rv = apr_socket_recv(p, buf, len);
 
@@ -125,6 +138,9 @@ static apr_status_t bucket_socket_ex_read(apr_bucket *a, const char **str,
 
         /* count for stats */
         *data->counter += *len;
+        if (data->remaining > 0) {
+            data->remaining -= *len;
+        }
 
         /* Change the current bucket to refer to what we read */
         a = apr_bucket_heap_make(a, buf, *len, apr_bucket_free);
@@ -355,6 +371,44 @@ static int send_request_body(request_rec *r, proxy_conn_rec *conn)
 }
 
 
+/*
+ * With enablereuse=on, a response with a Content-Length is read up to the
+ * end of its body only, so that the connection can serve the next request
+ * (SCGI itself says nothing about it, the backend has to keep the
+ * connection open for this to help). Anything else is read until the
+ * backend closes the connection, as usual.
+ */
+static void limit_response_body(request_rec *r, proxy_conn_rec *conn,
+                                apr_bucket_brigade *bb,
+                                socket_ex_data *sock_data)
+{
+    proxy_worker *worker = conn->worker;
+    const char *clen;
+    apr_off_t len, buffered = 0;
+    apr_bucket *b;
+
+    if (!worker->s->disablereuse_set || worker->s->disablereuse
+        || r->header_only
+        || r->status == HTTP_NO_CONTENT || r->status == HTTP_NOT_MODIFIED
+        || !(clen = apr_table_get(r->headers_out, "Content-Length"))
+        || !ap_parse_strict_length(&len, clen)) {
+        return;
+    }
+
+    /* the start of the body may have been read with the headers */
+    for (b = APR_BRIGADE_FIRST(bb);
+         b != APR_BRIGADE_SENTINEL(bb) && b->type != &bucket_type_socket_ex;
+         b = APR_BUCKET_NEXT(b)) {
+        if (b->length == (apr_size_t)-1) {
+            return;
+        }
+        buffered += b->length;
+    }
+    if (b != APR_BRIGADE_SENTINEL(bb) && buffered <= len) {
+        sock_data->remaining = len - buffered;
+    }
+}
+
 /*
  * Fetch response from backend and pass back to the front
  */
@@ -370,6 +424,7 @@ static int pass_response(request_rec *r, proxy_conn_rec *conn)
     sock_data = apr_palloc(r->pool, sizeof(*sock_data));
     sock_data->sock = conn->sock;
     sock_data->counter = &conn->worker->s->read;
+    sock_data->remaining = -1;
 
     bb = apr_brigade_create(r->pool, r->connection->bucket_alloc);
     b = bucket_socket_ex_create(sock_data, r->connection->bucket_alloc);
@@ -451,10 +506,18 @@ static int pass_response(request_rec *r, proxy_conn_rec *conn)
         }
     }
 
+    limit_response_body(r, conn, bb, sock_data);
+
     if (ap_pass_brigade(r->output_filters, bb)) {
         return AP_FILTER_ERROR;
     }
 
+    if (sock_data->remaining == 0) {
+        /* read up to the end of the body and no further, the backend
+         * can take the next request on this connection */
+        conn->close = 0;
+    }
+
     return OK;
 }
 
@@ -556,8 +619,16 @@ static int scgi_handler(request_rec *r, proxy_worker *worker,
         goto cleanup;
     }
 
+    /* Close the connection after the response, unless pass_response()
+     * finds it reusable (enablereuse=on and a length-delimited body).
+     */
+    backend->close = 1;
+
     /* Step Two: Make the Connection */
-    if (ap_proxy_connect_backend(PROXY_FUNCTION, backend, worker, r->server)) {
+    if (ap_proxy_check_connection(PROXY_FUNCTION, backend, r->server, 0,
+                                  PROXY_CHECK_CONN_EMPTY)
+            && ap_proxy_connect_backend(PROXY_FUNCTION, backend, worker,
+                                        r->server)) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(00866)
                       "failed to make connection to backend: %s:%u",
                       backend->hostname, backend->port);
@@ -575,7 +646,6 @@ static int scgi_handler(request_rec *r, proxy_worker *worker,
 
 cleanup:
     if (backend) {
-        backend->close = 1; /* always close the socket */
         ap_proxy_release_connection(PROXY_FUNCTION, backend, r->server);
     }
     return status;
@@ -246,7 +246,8 @@ static request_rec *make_fake_req(conn_rec *c, request_rec *r)
     apr_pool_t *pool;
     request_rec *rp;
 
-    apr_pool_create(&pool, c->pool);
+    /* from the request pool, the backend connection may outlive it */
+    apr_pool_create(&pool, r->pool);
     apr_pool_tag(pool, "proxy_uwsgi_rp");
 
     rp = apr_pcalloc(pool, sizeof(*r));
@@ -278,6 +279,35 @@ static request_rec *make_fake_req(conn_rec *c, request_rec *r)
     return rp;
 }
 
+/*
+ * With enablereuse=on, a response with a Content-Length and without
+ * "Connection: close" is read up to the end of its body only, so that the
+ * connection can serve the next request. Returns the length of the body
+ * to read, or -1 to read until the backend closes the connection.
+ */
+static apr_off_t uwsgi_body_length(request_rec *r, proxy_conn_rec *backend,
+                                   int http_10)
+{
+    proxy_worker *worker = backend->worker;
+    const char *val;
+    apr_off_t len;
+
+    if (!worker->s->disablereuse_set || worker->s->disablereuse
+        || r->header_only
+        || r->status == HTTP_NO_CONTENT || r->status == HTTP_NOT_MODIFIED
+        || apr_table_get(r->headers_out, "Transfer-Encoding")
+        || !(val = apr_table_get(r->headers_out, "Content-Length"))
+        || !ap_parse_strict_length(&len, val)) {
+        return -1;
+    }
+    val = apr_table_get(r->headers_out, "Connection");
+    if (http_10 ? !(val && ap_find_token(r->pool, val, "keep-alive"))
+                : (val && ap_find_token(r->pool, val, "close"))) {
+        return -1;
+    }
+    return len;
+}
+
 static int uwsgi_response(request_rec *r, proxy_conn_rec * backend,
                           proxy_server_conf * conf)
 {
@@ -296,6 +326,8 @@ static int uwsgi_response(request_rec *r, proxy_conn_rec * backend,
     apr_status_t rv;
     apr_bucket *e;
     apr_read_type_e mode = APR_NONBLOCK_READ;
+    apr_off_t remaining;
+    int http_10 = 1;
     apr_bucket_brigade *pass_bb;
     apr_bucket_brigade *bb;
     proxy_dir_conf *dconf;
@@ -322,9 +354,11 @@ static int uwsgi_response(request_rec *r, proxy_conn_rec * backend,
     /* Position of http status code */
     if (apr_date_checkmask(buffer, "HTTP/#.# ###*")) {
         status_start = 9;
+        http_10 = !strncmp(buffer, "HTTP/1.0", 8);
     }
     else if (apr_date_checkmask(buffer, "HTTP/# ###*")) {
         status_start = 7;
+        http_10 = 1;
     }
     else {
         /* oops */
@@ -382,10 +416,20 @@ static int uwsgi_response(request_rec *r, proxy_conn_rec * backend,
         return status;
     }
 
+    remaining = uwsgi_body_length(r, backend, http_10);
+    if (remaining == 0) {
+        finish = 1;
+    }
+
     while (!finish) {
+        apr_off_t readlen = conf->io_buffer_size;
+
+        if (remaining > 0 && remaining < readlen) {
+            readlen = remaining;
+        }
         apr_brigade_cleanup(bb);
         rv = ap_get_brigade(rp->input_filters, bb,
-                            AP_MODE_READBYTES, mode, conf->io_buffer_size);
+                            AP_MODE_READBYTES, mode, readlen);
         if (APR_STATUS_IS_EAGAIN(rv)
             || (rv == APR_SUCCESS && APR_BRIGADE_EMPTY(bb))) {
             e = apr_bucket_flush_create(c->bucket_alloc);
@@ -420,6 +464,13 @@ static int uwsgi_response(request_rec *r, proxy_conn_rec * backend,
         mode = APR_NONBLOCK_READ;
         apr_brigade_length(bb, 0, &readbytes);
         backend->worker->s->read += readbytes;
+        if (remaining > 0) {
+            remaining -= readbytes;
+            if (remaining == 0) {
+                /* the whole body, nothing more to wait for */
+                finish = 1;
+            }
+        }
 
         rv = ap_proxy_buckets_lifetime_transform(r, bb, pass_bb);
         if (rv != APR_SUCCESS) {
@@ -453,6 +504,11 @@ static int uwsgi_response(request_rec *r, proxy_conn_rec * backend,
         return DONE;
     }
 
+    if (remaining == 0) {
+        /* the backend can take the next request on this connection */
+        backend->close = 0;
+    }
+
     return OK;
 }
 
@@ -510,8 +566,16 @@ static int uwsgi_handler(request_rec *r, proxy_worker * worker,
     }
 
 
+    /* Close the connection after the response, unless uwsgi_response()
+     * finds it reusable (enablereuse=on and a length-delimited body).
+     */
+    backend->close = 1;
+
     /* Step Two: Make the Connection */
-    if (ap_proxy_connect_backend(UWSGI_SCHEME, backend, worker, r->server)) {
+    if (ap_proxy_check_connection(UWSGI_SCHEME, backend, r->server, 0,
+                                  PROXY_CHECK_CONN_EMPTY)
+            && ap_proxy_connect_backend(UWSGI_SCHEME, backend, worker,
+                                        r->server)) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(10101)
                       "failed to make connection to backend: %s:%u",
                       backend->hostname, backend->port);
@@ -535,7 +599,6 @@ static int uwsgi_handler(request_rec *r, proxy_worker * worker,
 
   cleanup:
     if (backend) {
-        backend->close = 1;     /* always close the socket */
         ap_proxy_release_connection(UWSGI_SCHEME, backend, r->server);
     }
     return status;
@@ -17,15 +17,18 @@
 #include "mod_proxy.h"
 #include "http_config.h"
 #include "ap_mpm.h"
+#include "mpm_common.h"
 
 module AP_MODULE_DECLARE_DATA proxy_wstunnel_module;
 
 typedef struct {
     unsigned int fallback_to_proxy_http     :1,
-                 fallback_to_proxy_http_set :1;
+                 fallback_to_proxy_http_set :1,
+                 idle_max_free_set          :1;
     int mpm_can_poll;
     apr_time_t idle_timeout;
     apr_time_t async_delay;
+    apr_uint32_t idle_max_free;
 } proxyws_dir_conf;
 
 typedef struct ws_baton_t {
@@ -40,6 +43,36 @@ static int can_fallback_to_proxy_http;
 
 static void proxy_wstunnel_callback(void *b);
 
+static apr_status_t restore_max_free(void *data)
+{
+    apr_allocator_max_free_set(data, ap_max_mem_free);
+    return APR_SUCCESS;
+}
+
+/* An asynchronous tunnel spends most of its life idle, with nothing in
+ * its brigades, but the allocator of the client connection keeps what
+ * the last messages needed (up to MaxMemFree).  With
+ * ProxyWebsocketIdleMaxFree, it gives back what's above that limit to the
+ * system instead.  Only done when the allocator is the connection's own,
+ * as with the event MPM, and until the request is done so that a recycled
+ * transaction pool finds its MaxMemFree again.
+ */
+static void proxy_wstunnel_limit_free(ws_baton_t *baton,
+                                      proxyws_dir_conf *dconf)
+{
+    apr_pool_t *pool = baton->r->connection->pool;
+    apr_allocator_t *allocator = apr_pool_allocator_get(pool);
+    apr_pool_t *owner = apr_allocator_owner_get(allocator);
+
+    if (!dconf->idle_max_free_set
+            || (owner != pool && owner != apr_pool_parent_get(pool))) {
+        return;
+    }
+    apr_allocator_max_free_set(allocator, dconf->idle_max_free);
+    apr_pool_cleanup_register(baton->r->pool, allocator, restore_max_free,
+                              apr_pool_cleanup_null);
+}
+
 static int proxy_wstunnel_pump(ws_baton_t *baton, int async)
 {
     int status = ap_proxy_tunnel_run(baton->tunnel);
@@ -292,6 +325,7 @@ static int proxy_wstunnel_request(apr_pool_t *p, request_rec *r,
              * round (above) to avoid leaks.
              */
             apr_pool_create(&baton->async_pool, baton->r->pool);
+            proxy_wstunnel_limit_free(baton, dconf);
 
             rv = ap_mpm_register_poll_callback_timeout(
                          baton->async_pool,
@@ -456,6 +490,10 @@ static void *merge_proxyws_dir_config(apr_pool_t *p, void *vbase, void *vadd)
     new->mpm_can_poll = add->mpm_can_poll;
     new->idle_timeout = add->idle_timeout;
     new->async_delay = add->async_delay;
+    new->idle_max_free = (add->idle_max_free_set) ? add->idle_max_free
+                                                  : base->idle_max_free;
+    new->idle_max_free_set = (add->idle_max_free_set
+                              || base->idle_max_free_set);
 
     return new;
 }
@@ -476,6 +514,21 @@ static const char * proxyws_set_asynch_delay(cmd_parms *cmd, void *conf, const c
     return NULL;
 }
 
+static const char * proxyws_set_idle_max_free(cmd_parms *cmd, void *conf,
+                                              const char *val)
+{
+    proxyws_dir_conf *dconf = conf;
+    long value;
+
+    errno = 0;
+    value = strtol(val, NULL, 10);
+    if (value < 1 || value > APR_UINT32_MAX / 1024 || errno == ERANGE)
+        return "ProxyWebsocketIdleMaxFree must be a positive number of KBytes";
+    dconf->idle_max_free = (apr_uint32_t)value * 1024;
+    dconf->idle_max_free_set = 1;
+    return NULL;
+}
+
 static const char * proxyws_fallback_to_proxy_http(cmd_parms *cmd, void *conf, int arg)
 {
     proxyws_dir_conf *dconf = conf;
@@ -508,6 +561,11 @@ static const command_rec ws_proxy_cmds[] =
                  RSRC_CONF|ACCESS_CONF,
                  "amount of time to poll before going asynchronous"),
 
+    AP_INIT_TAKE1("ProxyWebsocketIdleMaxFree", proxyws_set_idle_max_free, NULL,
+                  RSRC_CONF|ACCESS_CONF,
+                  "free memory in KBytes an asynchronous tunnel's client "
+                  "connection may keep, MaxMemFree by default"),
+
     {NULL}
 };
 
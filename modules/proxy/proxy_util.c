@@ -34,6 +34,12 @@
 #if APR_HAVE_SYS_UN_H
 #include <sys/un.h>
 #endif
+#if APR_HAVE_NETINET_TCP_H
+#include <netinet/tcp.h>    /* for TCP_FASTOPEN_CONNECT */
+#endif
+#ifdef HAVE_SPLICE
+#include <fcntl.h>          /* for splice() and pipe2() */
+#endif
 #if (APR_MAJOR_VERSION < 2)
 #include "apr_support.h"        /* for apr_wait_for_io_or_timeout() */
 #endif
@@ -2095,11 +2101,106 @@ PROXY_DECLARE(apr_status_t) ap_proxy_share_worker(proxy_worker *worker, proxy_wo
     return APR_SUCCESS;
 }
 
+/*
+ * Open the prewarm= connections of a worker and put them in its pool, so
+ * that the first requests of a new child don't pay for the DNS lookup and
+ * the connect() to the backend. Only the TCP connection is established, the
+ * TLS handshake (if any) still happens on first use.
+ */
+static void prewarm_worker(proxy_worker *worker, server_rec *s)
+{
+    const char *scheme = worker->s->scheme;
+    proxy_conn_rec **conns;
+    apr_pool_t *ptemp;
+    int i, n = worker->s->prewarm;
+
+    if (n <= 0 || !worker->s->is_address_reusable || worker->s->disablereuse
+            || *worker->s->uds_path || !*worker->s->hostname_ex) {
+        return;
+    }
+    /* Health checks said no (or not yet) */
+    if (!PROXY_WORKER_IS_USABLE(worker)) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(10450)
+                     "%s: not prewarming unusable worker for (%s:%d)",
+                     scheme, worker->s->hostname_ex, (int)worker->s->port);
+        return;
+    }
+    if (!worker->s->hmax || !worker->cp->res) {
+        n = 1;
+    }
+    else if (n > worker->s->smax) {
+        n = worker->s->smax;
+    }
+
+    apr_pool_create(&ptemp, worker->cp->pool);
+    apr_pool_tag(ptemp, "proxy_worker_prewarm");
+    conns = apr_pcalloc(ptemp, n * sizeof(proxy_conn_rec *));
+
+    for (i = 0; i < n; ++i) {
+        proxy_conn_rec *conn;
+
+        if (ap_proxy_acquire_connection(scheme, &conns[i], worker, s) != OK) {
+            break;
+        }
+        conn = conns[i];
+
+        /* Mimic ap_proxy_determine_connection() for a reverse proxy use
+         * of the worker, so that the connection is not closed on reuse.
+         */
+        if (!conn->hostname) {
+            conn->hostname = apr_pstrdup(conn->pool, worker->s->hostname_ex);
+            conn->port = worker->s->port;
+        }
+        if (!worker->cp->addr) {
+            apr_sockaddr_t *addr;
+
+            if (PROXY_THREAD_LOCK(worker) != APR_SUCCESS) {
+                break;
+            }
+            if (!AP_VOLATILIZE_T(apr_sockaddr_t *, worker->cp->addr)
+                    && apr_sockaddr_info_get(&addr, conn->hostname,
+                                             APR_UNSPEC, conn->port, 0,
+                                             worker->cp->dns_pool)
+                       == APR_SUCCESS) {
+                worker->cp->addr = addr;
+            }
+            PROXY_THREAD_UNLOCK(worker);
+            if (!worker->cp->addr) {
+                break;
+            }
+        }
+        conn->addr = worker->cp->addr;
+        if (!ap_cstr_casecmp(scheme, "https")
+                || !ap_cstr_casecmp(scheme, "wss")
+                || !ap_cstr_casecmp(scheme, "h2")) {
+            if (!conn->ssl_hostname) {
+                conn->ssl_hostname = apr_pstrdup(conn->scpool,
+                                                 conn->hostname);
+            }
+        }
+
+        if (ap_proxy_connect_backend(scheme, conn, worker, s) != OK) {
+            break;
+        }
+    }
+
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(10451)
+                 "%s: prewarmed %d/%d connection(s) in child %" APR_PID_T_FMT
+                 " for (%s:%d)", scheme, i, n, getpid(),
+                 worker->s->hostname_ex, (int)worker->s->port);
+
+    /* Give them all back to the pool, including a failed one (if any) */
+    for (i = 0; i < n && conns[i]; ++i) {
+        ap_proxy_release_connection(scheme, conns[i], s);
+    }
+    apr_pool_destroy(ptemp);
+}
+
 PROXY_DECLARE(apr_status_t) ap_proxy_initialize_worker(proxy_worker *worker, server_rec *s, apr_pool_t *p)
 {
     APR_OPTIONAL_FN_TYPE(http2_get_num_workers) *get_h2_num_workers;
     apr_status_t rv = APR_SUCCESS;
-    int max_threads, minw, maxw;
+    int max_threads, minw, maxw, prewarm = 0;
 
     if (worker->s->status & PROXY_WORKER_INITIALIZED) {
         /* The worker is already initialized */
@@ -2223,6 +2324,7 @@ PROXY_DECLARE(apr_status_t) ap_proxy_initialize_worker(proxy_worker *worker, ser
             }
             if (rv == APR_SUCCESS) {
                 worker->local_status |= (PROXY_WORKER_INITIALIZED);
+                prewarm = 1;
             }
         }
         apr_global_mutex_unlock(proxy_mutex);
@@ -2230,6 +2332,9 @@ PROXY_DECLARE(apr_status_t) ap_proxy_initialize_worker(proxy_worker *worker, ser
     }
     if (rv == APR_SUCCESS) {
         worker->s->status |= (PROXY_WORKER_INITIALIZED);
+        if (prewarm) {
+            prewarm_worker(worker, s);
+        }
     }
     return rv;
 }
@@ -2488,6 +2593,9 @@ PROXY_DECLARE(int) ap_proxy_acquire_connection(const char *proxy_function,
 {
     apr_status_t rv;
 
+    AP_PROXY_ACQUIRE_ENTRY((uintptr_t)worker, worker->s->hostname_ex,
+                           (int)worker->s->port);
+
     if (!PROXY_WORKER_IS_USABLE(worker)) {
         /* Retry the worker */
         ap_proxy_retry_worker(proxy_function, worker, s);
@@ -2497,6 +2605,8 @@ PROXY_DECLARE(int) ap_proxy_acquire_connection(const char *proxy_function,
                          "%s: disabled connection for (%s:%d)",
                          proxy_function, worker->s->hostname_ex,
                          (int)worker->s->port);
+            AP_PROXY_ACQUIRE_RETURN((uintptr_t)worker, 0,
+                                    HTTP_SERVICE_UNAVAILABLE);
             return HTTP_SERVICE_UNAVAILABLE;
         }
     }
@@ -2521,6 +2631,8 @@ PROXY_DECLARE(int) ap_proxy_acquire_connection(const char *proxy_function,
                      "%s: failed to acquire connection for (%s:%d)",
                      proxy_function, worker->s->hostname_ex,
                      (int)worker->s->port);
+        AP_PROXY_ACQUIRE_RETURN((uintptr_t)worker, 0,
+                                HTTP_SERVICE_UNAVAILABLE);
         return HTTP_SERVICE_UNAVAILABLE;
     }
     ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(00942)
@@ -2532,6 +2644,7 @@ PROXY_DECLARE(int) ap_proxy_acquire_connection(const char *proxy_function,
     (*conn)->close  = 0;
     (*conn)->inreslist = 0;
 
+    AP_PROXY_ACQUIRE_RETURN((uintptr_t)worker, (uintptr_t)*conn, OK);
     return OK;
 }
 
@@ -3084,6 +3197,7 @@ PROXY_DECLARE(apr_status_t) ap_proxy_check_connection(const char *scheme,
     }
 
     if (rv == APR_SUCCESS) {
+        worker->s->reused++;
         if (APLOGtrace2(server)) {
             apr_sockaddr_t *local_addr = NULL;
             apr_socket_addr_get(&local_addr, APR_LOCAL, conn->sock);
@@ -3134,14 +3248,20 @@ PROXY_DECLARE(int) ap_proxy_connect_backend(const char *proxy_function,
     /* the local address to use for the outgoing connection */
     apr_sockaddr_t *local_addr;
     apr_socket_t *newsock;
+    int fresh;
     void *sconf = s->module_config;
     proxy_server_conf *conf =
         (proxy_server_conf *) ap_get_module_config(sconf, &proxy_module);
 
+    AP_PROXY_CONNECT_ENTRY((uintptr_t)conn, (char *)conn->hostname,
+                           (int)conn->port);
+
     rv = ap_proxy_check_connection(proxy_function, conn, s, 0, 0);
     if (rv == APR_EINVAL) {
+        AP_PROXY_CONNECT_RETURN((uintptr_t)conn, DECLINED, 0);
         return DECLINED;
     }
+    fresh = (rv != APR_SUCCESS);
 
     while (rv != APR_SUCCESS && (backend_addr || conn->uds_path)) {
 #if APR_HAVE_SYS_UN_H
@@ -3243,6 +3363,25 @@ PROXY_DECLARE(int) ap_proxy_connect_backend(const char *proxy_function,
                                  " Keepalive");
                 }
             }
+#ifdef TCP_FASTOPEN_CONNECT
+            /* With TCP Fast Open, connect() returns immediately and the
+             * first write to the backend (request or TLS ClientHello) goes
+             * in the SYN, once the backend's cookie is cached by the kernel.
+             * Connect errors are then reported by that write.
+             */
+            if (worker->s->fastopen) {
+                apr_os_sock_t fd;
+                int one = 1;
+                apr_os_sock_get(&fd, newsock);
+                if (setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT,
+                               (void *)&one, sizeof(one)) < 0) {
+                    rv = apr_get_netos_error();
+                    ap_log_error(APLOG_MARK, APLOG_WARNING, rv, s, APLOGNO(10578)
+                                 "setsockopt(TCP_FASTOPEN_CONNECT): Failed to"
+                                 " set FastOpen");
+                }
+            }
+#endif
             ap_log_error(APLOG_MARK, APLOG_TRACE2, 0, s,
                          "%s: fam %d socket created to connect to %s:%d",
                          proxy_function, backend_addr->family,
@@ -3353,6 +3492,9 @@ PROXY_DECLARE(int) ap_proxy_connect_backend(const char *proxy_function,
             }
             worker->s->error_time = 0;
             worker->s->retries = 0;
+            if (fresh) {
+                worker->s->connected++;
+            }
         }
     }
     else {
@@ -3367,6 +3509,8 @@ PROXY_DECLARE(int) ap_proxy_connect_backend(const char *proxy_function,
         rv = APR_EINVAL;
     }
 
+    AP_PROXY_CONNECT_RETURN((uintptr_t)conn, rv == APR_SUCCESS ? OK : DECLINED,
+                            fresh);
     return rv == APR_SUCCESS ? OK : DECLINED;
 }
 
@@ -3748,24 +3892,37 @@ PROXY_DECLARE(apr_status_t) ap_proxy_sync_balancer(proxy_balancer *b, server_rec
             }
         }
         if (!found) {
-            proxy_worker **runtime;
-            /* XXX: a thread mutex is maybe enough here */
-            apr_global_mutex_lock(proxy_mutex);
-            runtime = apr_array_push(b->workers);
-            *runtime = apr_pcalloc(conf->pool, sizeof(proxy_worker));
-            apr_global_mutex_unlock(proxy_mutex);
-            (*runtime)->hash = shm->hash;
-            (*runtime)->balancer = b;
-            (*runtime)->s = shm;
+            proxy_worker *runtime;
+            runtime = apr_pcalloc(conf->pool, sizeof(proxy_worker));
+            runtime->hash = shm->hash;
+            runtime->balancer = b;
+            runtime->s = shm;
 
-            rv = ap_proxy_initialize_worker(*runtime, s, conf->pool);
+            rv = ap_proxy_initialize_worker(runtime, s, conf->pool);
             if (rv != APR_SUCCESS) {
                 ap_log_error(APLOG_MARK, APLOG_EMERG, rv, s, APLOGNO(00966) "Cannot init worker");
                 return rv;
             }
+
+            /* Publish the worker only once initialized, since concurrent
+             * lbmethods walk b->workers without the balancer lock. The
+             * array has room for max_workers (see balancer_child_init),
+             * so storing the new entry before incrementing nelts is safe.
+             * XXX: a thread mutex is maybe enough here
+             */
+            apr_global_mutex_lock(proxy_mutex);
+            if (b->workers->nelts < b->workers->nalloc) {
+                APR_ARRAY_IDX(b->workers, b->workers->nelts,
+                              proxy_worker *) = runtime;
+                apr_atomic_inc32((volatile apr_uint32_t *)&b->workers->nelts);
+            }
+            else {
+                APR_ARRAY_PUSH(b->workers, proxy_worker *) = runtime;
+            }
+            apr_global_mutex_unlock(proxy_mutex);
             ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(02403)
                          "grabbing shm[%d] (0x%pp) for worker: %s", i, (void *)shm,
-                         (*runtime)->s->name);
+                         runtime->s->name);
         }
     }
     if (b->s->need_reset) {
@@ -4739,9 +4896,21 @@ struct proxy_tunnel_conn {
               bytes_out;
 
     unsigned int down_in:1,
-                 down_out:1;
+                 down_out:1,
+                 no_splice:1;
+
+#ifdef HAVE_SPLICE
+    /* Relay of this side's input to the other side, in the kernel */
+    int pipe[2];
+    apr_size_t piped;
+#endif
 };
 
+#ifdef HAVE_SPLICE
+static APR_OPTIONAL_FN_TYPE(ap_logio_add_bytes_in) *tunnel_logio_add_bytes_in;
+static APR_OPTIONAL_FN_TYPE(ap_logio_add_bytes_out) *tunnel_logio_add_bytes_out;
+#endif
+
 PROXY_DECLARE(apr_off_t) ap_proxy_tunnel_conn_bytes_in(
                                 const proxy_tunnel_conn_t *tc)
 {
@@ -4826,6 +4995,16 @@ PROXY_DECLARE(apr_status_t) ap_proxy_tunnel_create(proxy_tunnel_rec **ptunnel,
         tunnel->nohalfclose = 1;
     }
 
+#ifdef HAVE_SPLICE
+    tunnel->client->pipe[0] = tunnel->client->pipe[1] = -1;
+    tunnel->origin->pipe[0] = tunnel->origin->pipe[1] = -1;
+    if (apr_table_get(r->subprocess_env, "proxy-nosplice")) {
+        tunnel->client->no_splice = tunnel->origin->no_splice = 1;
+    }
+    tunnel_logio_add_bytes_in = APR_RETRIEVE_OPTIONAL_FN(ap_logio_add_bytes_in);
+    tunnel_logio_add_bytes_out = APR_RETRIEVE_OPTIONAL_FN(ap_logio_add_bytes_out);
+#endif
+
     /* Start with POLLOUT and let ap_proxy_tunnel_run() schedule both
      * directions when there are no output data pending (anymore).
      */
@@ -4893,6 +5072,157 @@ static void del_pollset(apr_pollset_t *pollset, apr_pollfd_t *pfd,
     }
 }
 
+#ifdef HAVE_SPLICE
+
+static apr_status_t tunnel_pipe_cleanup(void *data)
+{
+    proxy_tunnel_conn_t *tc = data;
+    close(tc->pipe[0]);
+    close(tc->pipe[1]);
+    return APR_SUCCESS;
+}
+
+/* Can the data from in be relayed by the kernel, with splice() through a
+ * pipe?  Only when both sockets are plain ones with no filters on the way
+ * but the core's (and mod_logio's input counter, which we can feed), no
+ * data buffered in these filters, and no tunnel_forward hook to see the
+ * data.
+ */
+static int tunnel_can_splice(proxy_tunnel_rec *tunnel, proxy_tunnel_conn_t *in)
+{
+    proxy_tunnel_conn_t *out = in->other;
+    apr_array_header_t *hooks;
+    ap_filter_t *f;
+
+    if (in->piped) {
+        /* keep going, whatever is in the pipe comes first */
+        return 1;
+    }
+    if (in->no_splice) {
+        return 0;
+    }
+
+    f = in->c->input_filters;
+    if (f && !ap_cstr_casecmp(f->frec->name, "log_input_output")) {
+        f = f->next;
+    }
+    hooks = proxy_hook_get_tunnel_forward();
+    if ((hooks && hooks->nelts)
+            || !f || f->frec != ap_core_input_filter_handle
+            || out->c->output_filters->frec != ap_core_output_filter_handle) {
+        in->no_splice = 1;
+        return 0;
+    }
+    if (ap_filter_input_pending(in->c) == OK
+            || ap_filter_output_pending(out->c) != DECLINED) {
+        return 0;
+    }
+
+    if (in->pipe[0] < 0) {
+        if (pipe2(in->pipe, O_NONBLOCK | O_CLOEXEC) < 0) {
+            ap_log_rerror(APLOG_MARK, APLOG_DEBUG, errno, tunnel->r,
+                          APLOGNO(10551) "proxy: %s: can't create %s pipe, "
+                          "not splicing", tunnel->scheme, in->name);
+            in->pipe[0] = in->pipe[1] = -1;
+            in->no_splice = 1;
+            return 0;
+        }
+        apr_pool_cleanup_register(tunnel->r->pool, in, tunnel_pipe_cleanup,
+                                  apr_pool_cleanup_null);
+    }
+    return 1;
+}
+
+/* Flushes the pipe of in to the other side: APR_SUCCESS once it's empty,
+ * EAGAIN if the other side is not writable (anymore).
+ */
+static apr_status_t tunnel_splice_out(proxy_tunnel_conn_t *in)
+{
+    proxy_tunnel_conn_t *out = in->other;
+    apr_os_sock_t sd;
+
+    apr_os_sock_get(&sd, out->pfd->desc.s);
+    while (in->piped) {
+        ssize_t n = splice(in->pipe[0], NULL, sd, NULL, in->piped,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return APR_FROM_OS_ERROR(errno);
+        }
+        in->piped -= n;
+        out->bytes_out += n;
+        if (tunnel_logio_add_bytes_out) {
+            tunnel_logio_add_bytes_out(out->c, n);
+        }
+    }
+    return APR_SUCCESS;
+}
+
+/* Same as proxy_transfer() with the tunnel's flags, but the data don't
+ * leave the kernel.
+ */
+static apr_status_t tunnel_splice(proxy_tunnel_rec *tunnel,
+                                  proxy_tunnel_conn_t *in)
+{
+    unsigned int num_reads = 0;
+    apr_os_sock_t sd;
+    apr_status_t rv;
+
+    apr_os_sock_get(&sd, in->pfd->desc.s);
+    for (;;) {
+        rv = tunnel_splice_out(in);
+        if (rv != APR_SUCCESS) {
+            if (APR_STATUS_IS_EAGAIN(rv)) {
+                /* wait writable */
+                return APR_INCOMPLETE;
+            }
+            ap_log_rerror(APLOG_MARK, APLOG_DEBUG, rv, tunnel->r,
+                          APLOGNO(10552) "proxy: %s: can't splice to %s",
+                          tunnel->scheme, in->other->name);
+            return rv;
+        }
+
+        if (++num_reads > PROXY_TRANSFER_MAX_READS) {
+            return APR_SUCCESS;
+        }
+        for (;;) {
+            ssize_t n = splice(sd, NULL, in->pipe[1], NULL,
+                               tunnel->read_buf_size,
+                               SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n > 0) {
+                in->piped = n;
+                in->bytes_in += n;
+                if (tunnel_logio_add_bytes_in) {
+                    tunnel_logio_add_bytes_in(in->c, n);
+                }
+                break;
+            }
+            if (n == 0) {
+                return APR_EOF;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            rv = APR_FROM_OS_ERROR(errno);
+            if (APR_STATUS_IS_EAGAIN(rv)) {
+                /* nothing more to read for now */
+                return APR_SUCCESS;
+            }
+            ap_log_rerror(APLOG_MARK, APLOG_DEBUG, rv, tunnel->r,
+                          APLOGNO(10553) "proxy: %s: can't splice from %s",
+                          tunnel->scheme, in->name);
+            return rv;
+        }
+        ap_log_rerror(APLOG_MARK, APLOG_TRACE2, 0, tunnel->r,
+                      "proxy: %s: spliced %" APR_SIZE_T_FMT " bytes from %s",
+                      tunnel->scheme, in->piped, in->name);
+    }
+}
+
+#endif /* HAVE_SPLICE */
+
 static int proxy_tunnel_transfer(proxy_tunnel_rec *tunnel,
                                  proxy_tunnel_conn_t *in)
 {
@@ -4903,6 +5233,12 @@ static int proxy_tunnel_transfer(proxy_tunnel_rec *tunnel,
                   "proxy: %s: %s input ready",
                   tunnel->scheme, in->name);
 
+#ifdef HAVE_SPLICE
+    if (tunnel_can_splice(tunnel, in)) {
+        rv = tunnel_splice(tunnel, in);
+    }
+    else
+#endif
     rv = proxy_transfer(tunnel->r,
                         in->c, out->c,
                         in->bb, out->bb,
@@ -5042,6 +5378,23 @@ PROXY_DECLARE(int) ap_proxy_tunnel_run(proxy_tunnel_rec *tunnel)
                               "proxy: %s: %s output ready",
                               scheme, out->name);
 
+#ifdef HAVE_SPLICE
+                /* What's been spliced from the other side first */
+                if (in->piped) {
+                    rv = tunnel_splice_out(in);
+                    if (APR_STATUS_IS_EAGAIN(rv)) {
+                        /* Keep polling out (only) */
+                        continue;
+                    }
+                    if (rv != APR_SUCCESS) {
+                        ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r,
+                                      APLOGNO(10554) "proxy: %s: %s "
+                                      "splicing failed", scheme, out->name);
+                        status = HTTP_INTERNAL_SERVER_ERROR;
+                        goto done;
+                    }
+                }
+#endif
                 rc = ap_filter_output_pending(out->c);
                 if (rc == OK) {
                     /* Keep polling out (only) */
@@ -18,6 +18,7 @@ dnl
 session_cookie_objects='mod_session_cookie.lo'
 session_crypto_objects='mod_session_crypto.lo'
 session_dbd_objects='mod_session_dbd.lo'
+session_socache_objects='mod_session_socache.lo'
 
 case "$host" in
   *os2*)
@@ -26,6 +27,7 @@ case "$host" in
     session_cookie_objects="$session_cookie_objects mod_session.la"
     session_crypto_objects="$session_crypto_objects mod_session.la"
     session_dbd_objects="$session_dbd_objects mod_session.la"
+    session_socache_objects="$session_socache_objects mod_session.la"
     ;;
 esac
 
@@ -61,6 +63,7 @@ fi
 ],session)
 
 APACHE_MODULE(session_dbd, session dbd module, $session_dbd_objects, , $session_mods_enable,,session)
+APACHE_MODULE(session_socache, session socache module, $session_socache_objects, , $session_mods_enable,,session)
 
 APR_ADDTO(INCLUDES, [-I\$(top_srcdir)/$modpath_current])
 
@@ -312,6 +312,12 @@ static apr_status_t ap_session_set(request_rec * r, session_rec * z,
         }
     }
     if (z) {
+        const char *old = apr_table_get(z->entries, key);
+
+        /* setting the same value again doesn't need the session saved */
+        if (value ? (old && !strcmp(old, value)) : !old) {
+            return APR_SUCCESS;
+        }
         if (value) {
             apr_table_set(z->entries, key, value);
         }
@@ -481,11 +487,19 @@ static apr_status_t session_output_filter(ap_filter_t * f,
                 override = apr_table_get(r->headers_out, conf->header);
             }
             if (override) {
+                /* the application may send back the session it was given
+                 * (SessionEnv) unchanged
+                 */
+                const char *given = apr_table_get(r->subprocess_env,
+                                                  HTTP_SESSION);
+
                 apr_table_unset(r->err_headers_out, conf->header);
                 apr_table_unset(r->headers_out, conf->header);
-                z->encoded = override;
-                z->dirty = 1;
-                session_identity_decode(r, z);
+                if (!given || strcmp(given, override)) {
+                    z->encoded = override;
+                    z->dirty = 1;
+                    session_identity_decode(r, z);
+                }
             }
         }
 
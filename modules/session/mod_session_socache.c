@@ -0,0 +1,652 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mod_session.h"
+#include "apr_lib.h"
+#include "apr_strings.h"
+#include "http_log.h"
+#include "util_cookies.h"
+#include "util_mutex.h"
+#include "ap_socache.h"
+#include "ap_provider.h"
+
+#define MOD_SESSION_SOCACHE "mod_session_socache"
+
+/* The largest session stored, and the lifetime of the sessions without
+ * SessionMaxAge.
+ */
+#define SESSION_SOCACHE_MAX_LEN (16 * 1024)
+#define SESSION_SOCACHE_TIMEOUT apr_time_from_sec(86400)
+
+module AP_MODULE_DECLARE_DATA session_socache_module;
+
+/**
+ * Structure to carry the per-dir session config.
+ */
+typedef struct {
+    const char *name;
+    int name_set;
+    const char *name_attrs;
+    const char *name2;
+    int name2_set;
+    const char *name2_attrs;
+    int peruser;
+    int peruser_set;
+    int remove;
+    int remove_set;
+} session_socache_dir_conf;
+
+static const char *const session_socache_id = "session-socache";
+static ap_socache_provider_t *socache_provider = NULL;
+static ap_socache_instance_t *socache_instance = NULL;
+static apr_global_mutex_t *session_socache_mutex = NULL;
+static int configured;
+static int initialised;
+
+static apr_status_t remove_lock(void *data)
+{
+    if (session_socache_mutex) {
+        apr_global_mutex_destroy(session_socache_mutex);
+        session_socache_mutex = NULL;
+    }
+    return APR_SUCCESS;
+}
+
+static apr_status_t destroy_cache(void *data)
+{
+    if (socache_instance) {
+        socache_provider->destroy(socache_instance, (server_rec *)data);
+        socache_instance = NULL;
+    }
+    return APR_SUCCESS;
+}
+
+/* The provider is not MP safe (shmcb, dbm...), serialize its use */
+static APR_INLINE void socache_lock(void)
+{
+    if (session_socache_mutex) {
+        apr_global_mutex_lock(session_socache_mutex);
+    }
+}
+
+static APR_INLINE void socache_unlock(void)
+{
+    if (session_socache_mutex) {
+        apr_global_mutex_unlock(session_socache_mutex);
+    }
+}
+
+/**
+ * Load the session by the key specified.
+ *
+ * The session value is allocated using the passed apr_pool_t.
+ */
+static apr_status_t socache_load(apr_pool_t *p, request_rec *r,
+                                 const char *key, const char **val)
+{
+    apr_status_t rv;
+    unsigned char *buf = apr_palloc(r->pool, SESSION_SOCACHE_MAX_LEN);
+    unsigned int buflen = SESSION_SOCACHE_MAX_LEN;
+
+    socache_lock();
+    rv = socache_provider->retrieve(socache_instance, r->server,
+                                    (unsigned char *)key, strlen(key),
+                                    buf, &buflen, r->pool);
+    socache_unlock();
+
+    if (rv == APR_SUCCESS) {
+        *val = apr_pstrmemdup(p, (char *)buf, buflen);
+    }
+    else if (!APR_STATUS_IS_NOTFOUND(rv)) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(10502)
+                      "error retrieving session '%s' from the cache", key);
+        return rv;
+    }
+
+    return APR_SUCCESS;
+}
+
+/**
+ * Load the session from the cache.
+ *
+ * If the session is anonymous, the session key will be extracted from
+ * the cookie specified.
+ *
+ * If the session is keyed by the username, the session will be extracted
+ * by that.
+ *
+ * If no session is found, an empty session will be created.
+ *
+ * On success, this returns OK.
+ */
+static apr_status_t session_socache_load(request_rec *r, session_rec **z)
+{
+    session_socache_dir_conf *conf = ap_get_module_config(r->per_dir_config,
+                                                    &session_socache_module);
+
+    apr_status_t ret = APR_SUCCESS;
+    session_rec *zz = NULL;
+    const char *name = NULL;
+    const char *note = NULL;
+    const char *val = NULL;
+    const char *key = NULL;
+    request_rec *m = r->main ? r->main : r;
+
+    if (!initialised) {
+        return DECLINED;
+    }
+
+    /* is our session in a cookie? */
+    if (conf->name2_set) {
+        name = conf->name2;
+    }
+    else if (conf->name_set) {
+        name = conf->name;
+    }
+    else if (conf->peruser_set && r->user) {
+        name = r->user;
+    }
+    else {
+        return DECLINED;
+    }
+
+    /* first look in the notes */
+    note = apr_pstrcat(m->pool, MOD_SESSION_SOCACHE, name, NULL);
+    zz = (session_rec *)apr_table_get(m->notes, note);
+    if (zz) {
+        *z = zz;
+        return OK;
+    }
+
+    /* load anonymous sessions */
+    if (conf->name_set || conf->name2_set) {
+
+        /* load an RFC2109 or RFC2965 compliant cookie */
+        ap_cookie_read(r, name, &key, conf->remove);
+        if (key) {
+            ret = socache_load(m->pool, r, key, &val);
+            if (ret != APR_SUCCESS) {
+                return ret;
+            }
+        }
+
+    }
+
+    /* load named session */
+    else if (conf->peruser) {
+        if (r->user) {
+            ret = socache_load(m->pool, r, r->user, &val);
+            if (ret != APR_SUCCESS) {
+                return ret;
+            }
+        }
+    }
+
+    /* otherwise not for us */
+    else {
+        return DECLINED;
+    }
+
+    /* create a new session and return it */
+    zz = (session_rec *) apr_pcalloc(m->pool, sizeof(session_rec));
+    zz->pool = m->pool;
+    zz->entries = apr_table_make(zz->pool, 10);
+    if (key && val) {
+        apr_uuid_t *uuid = apr_pcalloc(zz->pool, sizeof(apr_uuid_t));
+        if (APR_SUCCESS == apr_uuid_parse(uuid, key)) {
+            zz->uuid = uuid;
+        }
+    }
+    zz->encoded = val;
+    *z = zz;
+
+    /* put the session in the notes so we don't have to parse it again */
+    apr_table_setn(m->notes, note, (char *)zz);
+
+    /* don't cache pages with a session */
+    apr_table_addn(r->headers_out, "Cache-Control", "no-cache, private");
+
+    return OK;
+}
+
+/**
+ * Save the session by the key specified, replacing the one of oldkey.
+ */
+static apr_status_t socache_save(request_rec *r, const char *oldkey,
+                                 const char *newkey, const char *val,
+                                 apr_time_t expiry)
+{
+    apr_status_t rv = APR_SUCCESS;
+    apr_size_t len = strlen(val);
+
+    if (len > SESSION_SOCACHE_MAX_LEN) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(10503)
+                      "session '%s' too large to be cached (%" APR_SIZE_T_FMT
+                      " bytes), session not saved", newkey, len);
+        return APR_EGENERAL;
+    }
+    if (!expiry) {
+        expiry = apr_time_now() + SESSION_SOCACHE_TIMEOUT;
+    }
+
+    socache_lock();
+    if (oldkey && strcmp(oldkey, newkey)) {
+        socache_provider->remove(socache_instance, r->server,
+                                 (unsigned char *)oldkey, strlen(oldkey),
+                                 r->pool);
+    }
+    rv = socache_provider->store(socache_instance, r->server,
+                                 (unsigned char *)newkey, strlen(newkey),
+                                 expiry, (unsigned char *)val, len, r->pool);
+    socache_unlock();
+
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(10504)
+                      "error storing session '%s' in the cache", newkey);
+    }
+
+    return rv;
+}
+
+/**
+ * Remove the session by the key specified.
+ */
+static apr_status_t socache_remove(request_rec *r, const char *key)
+{
+    apr_status_t rv;
+
+    if (!key) {
+        return APR_SUCCESS;
+    }
+
+    socache_lock();
+    rv = socache_provider->remove(socache_instance, r->server,
+                                  (unsigned char *)key, strlen(key),
+                                  r->pool);
+    socache_unlock();
+
+    if (rv != APR_SUCCESS && !APR_STATUS_IS_NOTFOUND(rv)) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(10505)
+                      "error removing session '%s' from the cache", key);
+        return rv;
+    }
+
+    return APR_SUCCESS;
+}
+
+/**
+ * Save the session in the cache.
+ *
+ * If the session is anonymous, save the session and write a cookie
+ * containing the uuid.
+ *
+ * If the session is keyed to the username, save the session using
+ * the username as a key.
+ *
+ * On success, this method will return APR_SUCCESS.
+ *
+ * @param r The request pointer.
+ * @param z A pointer to where the session will be written.
+ */
+static apr_status_t session_socache_save(request_rec *r, session_rec *z)
+{
+    apr_status_t ret = APR_SUCCESS;
+    session_socache_dir_conf *conf = ap_get_module_config(r->per_dir_config,
+                                                    &session_socache_module);
+
+    if (!initialised) {
+        return DECLINED;
+    }
+
+    /* support anonymous sessions */
+    if (conf->name_set || conf->name2_set) {
+        char *oldkey = NULL, *newkey = NULL;
+
+        /* if the session is new or changed, make a new session ID */
+        if (z->uuid) {
+            oldkey = apr_pcalloc(r->pool, APR_UUID_FORMATTED_LENGTH + 1);
+            apr_uuid_format(oldkey, z->uuid);
+        }
+        if (z->dirty || !oldkey) {
+            z->uuid = apr_pcalloc(z->pool, sizeof(apr_uuid_t));
+            apr_uuid_get(z->uuid);
+            newkey = apr_pcalloc(r->pool, APR_UUID_FORMATTED_LENGTH + 1);
+            apr_uuid_format(newkey, z->uuid);
+        }
+        else {
+            newkey = oldkey;
+        }
+
+        /* save the session with the uuid as key */
+        if (z->encoded && z->encoded[0]) {
+            ret = socache_save(r, oldkey, newkey, z->encoded, z->expiry);
+        }
+        else {
+            ret = socache_remove(r, oldkey);
+        }
+        if (ret != APR_SUCCESS) {
+            return ret;
+        }
+
+        /* create RFC2109 compliant cookie */
+        if (conf->name_set) {
+            ap_cookie_write(r, conf->name, newkey, conf->name_attrs, z->maxage,
+                            r->headers_out, r->err_headers_out, NULL);
+        }
+
+        /* create RFC2965 compliant cookie */
+        if (conf->name2_set) {
+            ap_cookie_write2(r, conf->name2, newkey, conf->name2_attrs, z->maxage,
+                             r->headers_out, r->err_headers_out, NULL);
+        }
+
+        return OK;
+
+    }
+
+    /* save named session */
+    else if (conf->peruser) {
+
+        /* don't cache pages with a session */
+        apr_table_addn(r->headers_out, "Cache-Control", "no-cache, private");
+
+        if (r->user) {
+            if (z->encoded && z->encoded[0]) {
+                ret = socache_save(r, NULL, r->user, z->encoded, z->expiry);
+            }
+            else {
+                ret = socache_remove(r, r->user);
+            }
+            if (ret != APR_SUCCESS) {
+                return ret;
+            }
+            return OK;
+        }
+        else {
+            ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(10506)
+                          "peruser sessions can only be saved if a user is "
+                          "logged in, session not saved: %s", r->uri);
+        }
+    }
+
+    return DECLINED;
+}
+
+static int session_socache_pre_config(apr_pool_t *pconf, apr_pool_t *plog,
+                                      apr_pool_t *ptmp)
+{
+    apr_status_t rv = ap_mutex_register(pconf, session_socache_id,
+                                        NULL, APR_LOCK_DEFAULT, 0);
+    if (rv != APR_SUCCESS) {
+        ap_log_perror(APLOG_MARK, APLOG_CRIT, rv, plog, APLOGNO(10507)
+                      "failed to register %s mutex", session_socache_id);
+        return 500; /* An HTTP status would be a misnomer! */
+    }
+    socache_provider = ap_lookup_provider(AP_SOCACHE_PROVIDER_GROUP,
+                                          AP_SOCACHE_DEFAULT_PROVIDER,
+                                          AP_SOCACHE_PROVIDER_VERSION);
+    socache_instance = NULL;
+    session_socache_mutex = NULL;
+    configured = 0;
+    initialised = 0;
+    return OK;
+}
+
+static int session_socache_post_config(apr_pool_t *pconf, apr_pool_t *plog,
+                                       apr_pool_t *ptmp, server_rec *s)
+{
+    apr_status_t rv;
+    static struct ap_socache_hints session_socache_hints =
+        {APR_UUID_FORMATTED_LENGTH, 256, 300000000};
+    const char *errmsg;
+
+    if (!configured) {
+        return OK;    /* don't waste the overhead of creating mutex & cache */
+    }
+    if (socache_provider == NULL) {
+        ap_log_perror(APLOG_MARK, APLOG_CRIT, 0, plog, APLOGNO(10508)
+                      "Please select a socache provider with SessionSOCache "
+                      "(no default found on this platform). Maybe you need to "
+                      "load mod_socache_shmcb or another socache module first");
+        return 500; /* An HTTP status would be a misnomer! */
+    }
+
+    if (socache_instance == NULL) {
+        errmsg = socache_provider->create(&socache_instance, NULL,
+                                          ptmp, pconf);
+        if (errmsg) {
+            ap_log_perror(APLOG_MARK, APLOG_CRIT, 0, plog, APLOGNO(10509)
+                          "failed to create the default socache instance: %s",
+                          errmsg);
+            return 500;
+        }
+    }
+
+    if (socache_provider->flags & AP_SOCACHE_FLAG_NOTMPSAFE) {
+        rv = ap_global_mutex_create(&session_socache_mutex, NULL,
+                                    session_socache_id, NULL, s, pconf, 0);
+        if (rv != APR_SUCCESS) {
+            ap_log_perror(APLOG_MARK, APLOG_CRIT, rv, plog, APLOGNO(10510)
+                          "failed to create %s mutex", session_socache_id);
+            return 500; /* An HTTP status would be a misnomer! */
+        }
+        apr_pool_cleanup_register(pconf, NULL, remove_lock,
+                                  apr_pool_cleanup_null);
+    }
+
+    rv = socache_provider->init(socache_instance, session_socache_id,
+                                &session_socache_hints, s, pconf);
+    if (rv != APR_SUCCESS) {
+        ap_log_perror(APLOG_MARK, APLOG_CRIT, rv, plog, APLOGNO(10511)
+                      "failed to initialise %s cache", session_socache_id);
+        return 500; /* An HTTP status would be a misnomer! */
+    }
+    apr_pool_cleanup_register(pconf, (void *)s, destroy_cache,
+                              apr_pool_cleanup_null);
+    initialised = 1;
+    return OK;
+}
+
+static void session_socache_child_init(apr_pool_t *p, server_rec *s)
+{
+    const char *lock;
+    apr_status_t rv;
+
+    if (!session_socache_mutex) {
+        return;
+    }
+    lock = apr_global_mutex_lockfile(session_socache_mutex);
+    rv = apr_global_mutex_child_init(&session_socache_mutex, lock, p);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_CRIT, rv, s, APLOGNO(10512)
+                     "failed to initialise mutex in child_init");
+    }
+}
+
+static void *create_session_socache_dir_config(apr_pool_t *p, char *dummy)
+{
+    session_socache_dir_conf *new =
+    (session_socache_dir_conf *) apr_pcalloc(p, sizeof(session_socache_dir_conf));
+
+    new->remove = 1;
+
+    return (void *) new;
+}
+
+static void *merge_session_socache_dir_config(apr_pool_t *p, void *basev,
+                                              void *addv)
+{
+    session_socache_dir_conf *new = (session_socache_dir_conf *) apr_pcalloc(p, sizeof(session_socache_dir_conf));
+    session_socache_dir_conf *add = (session_socache_dir_conf *) addv;
+    session_socache_dir_conf *base = (session_socache_dir_conf *) basev;
+
+    new->name = (add->name_set == 0) ? base->name : add->name;
+    new->name_attrs = (add->name_set == 0) ? base->name_attrs : add->name_attrs;
+    new->name_set = add->name_set || base->name_set;
+    new->name2 = (add->name2_set == 0) ? base->name2 : add->name2;
+    new->name2_attrs = (add->name2_set == 0) ? base->name2_attrs : add->name2_attrs;
+    new->name2_set = add->name2_set || base->name2_set;
+    new->peruser = (add->peruser_set == 0) ? base->peruser : add->peruser;
+    new->peruser_set = add->peruser_set || base->peruser_set;
+    new->remove = (add->remove_set == 0) ? base->remove : add->remove;
+    new->remove_set = add->remove_set || base->remove_set;
+
+    return new;
+}
+
+/**
+ * Sanity check a given string that it exists, is not empty,
+ * and does not contain special characters.
+ */
+static const char *check_string(cmd_parms * cmd, const char *string)
+{
+    if (APR_SUCCESS != ap_cookie_check_string(string)) {
+        return apr_pstrcat(cmd->pool, cmd->directive->directive,
+                           " cannot be empty, or contain '=', ';' or '&'.",
+                           NULL);
+    }
+    return NULL;
+}
+
+static const char *set_socache(cmd_parms *cmd, void *dconf, const char *arg)
+{
+    const char *errmsg = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+    const char *sep, *name;
+
+    if (errmsg)
+        return errmsg;
+
+    /* Argument is of form 'name:args' or just 'name'. */
+    sep = ap_strchr_c(arg, ':');
+    if (sep) {
+        name = apr_pstrmemdup(cmd->pool, arg, sep - arg);
+        sep++;
+    }
+    else {
+        name = arg;
+    }
+
+    socache_provider = ap_lookup_provider(AP_SOCACHE_PROVIDER_GROUP, name,
+                                          AP_SOCACHE_PROVIDER_VERSION);
+    if (socache_provider == NULL) {
+        errmsg = apr_psprintf(cmd->pool,
+                              "Unknown socache provider '%s'. Maybe you need "
+                              "to load the appropriate socache module "
+                              "(mod_socache_%s?)", arg, arg);
+    }
+    else {
+        errmsg = socache_provider->create(&socache_instance, sep,
+                                          cmd->temp_pool, cmd->pool);
+    }
+
+    if (errmsg) {
+        errmsg = apr_psprintf(cmd->pool, "SessionSOCache: %s", errmsg);
+    }
+    configured = 1;
+    return errmsg;
+}
+
+static const char *
+     set_socache_peruser(cmd_parms * parms, void *dconf, int flag)
+{
+    session_socache_dir_conf *conf = dconf;
+
+    conf->peruser = flag;
+    conf->peruser_set = 1;
+    configured = 1;
+
+    return NULL;
+}
+
+static const char *
+     set_socache_cookie_remove(cmd_parms * parms, void *dconf, int flag)
+{
+    session_socache_dir_conf *conf = dconf;
+
+    conf->remove = flag;
+    conf->remove_set = 1;
+
+    return NULL;
+}
+
+static const char *set_cookie_name(cmd_parms * cmd, void *config, const char *args)
+{
+    char *last;
+    char *line = apr_pstrdup(cmd->pool, args);
+    session_socache_dir_conf *conf = (session_socache_dir_conf *) config;
+    char *cookie = apr_strtok(line, " \t", &last);
+    conf->name = cookie;
+    conf->name_set = 1;
+    configured = 1;
+    while (apr_isspace(*last)) {
+        last++;
+    }
+    conf->name_attrs = last;
+    return check_string(cmd, cookie);
+}
+
+static const char *set_cookie_name2(cmd_parms * cmd, void *config, const char *args)
+{
+    char *last;
+    char *line = apr_pstrdup(cmd->pool, args);
+    session_socache_dir_conf *conf = (session_socache_dir_conf *) config;
+    char *cookie = apr_strtok(line, " \t", &last);
+    conf->name2 = cookie;
+    conf->name2_set = 1;
+    configured = 1;
+    while (apr_isspace(*last)) {
+        last++;
+    }
+    conf->name2_attrs = last;
+    return check_string(cmd, cookie);
+}
+
+static const command_rec session_socache_cmds[] =
+{
+    AP_INIT_TAKE1("SessionSOCache", set_socache, NULL, RSRC_CONF,
+                  "The socache provider (and its arguments) used to store "
+                  "the sessions"),
+    AP_INIT_FLAG("SessionSOCachePerUser", set_socache_peruser, NULL, RSRC_CONF|OR_AUTHCFG,
+                 "Save the session per user"),
+    AP_INIT_FLAG("SessionSOCacheCookieRemove", set_socache_cookie_remove, NULL, RSRC_CONF|OR_AUTHCFG,
+                 "Remove the session cookie after session load. On by default."),
+    AP_INIT_RAW_ARGS("SessionSOCacheCookieName", set_cookie_name, NULL, RSRC_CONF|OR_AUTHCFG,
+                 "The name of the RFC2109 cookie carrying the session key"),
+    AP_INIT_RAW_ARGS("SessionSOCacheCookieName2", set_cookie_name2, NULL, RSRC_CONF|OR_AUTHCFG,
+                 "The name of the RFC2965 cookie carrying the session key"),
+    {NULL}
+};
+
+static void register_hooks(apr_pool_t * p)
+{
+    ap_hook_pre_config(session_socache_pre_config, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_post_config(session_socache_post_config, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_child_init(session_socache_child_init, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_session_load(session_socache_load, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_session_save(session_socache_save, NULL, NULL, APR_HOOK_MIDDLE);
+}
+
+AP_DECLARE_MODULE(session_socache) =
+{
+    STANDARD20_MODULE_STUFF,
+    create_session_socache_dir_config, /* dir config creater */
+    merge_session_socache_dir_config,  /* dir merger --- default is to
+                                        * override */
+    NULL,                              /* server config */
+    NULL,                              /* merge server config */
+    session_socache_cmds,              /* command apr_table_t */
+    register_hooks                     /* register hooks */
+};
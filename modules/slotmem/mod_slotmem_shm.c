@@ -27,6 +27,8 @@
 #include "http_main.h"
 #include "ap_mpm.h" /* for ap_mpm_query() */
 
+#include "apr_atomic.h"
+
 #define AP_SLOTMEM_IS_PREGRAB(t)    (t->desc->type & AP_SLOTMEM_TYPE_PREGRAB)
 #define AP_SLOTMEM_IS_PERSIST(t)    (t->desc->type & AP_SLOTMEM_TYPE_PERSIST)
 #define AP_SLOTMEM_IS_CLEARINUSE(t) (t->desc->type & AP_SLOTMEM_TYPE_CLEARINUSE)
@@ -41,6 +43,11 @@ typedef struct {
 #define AP_SLOTMEM_OFFSET (APR_ALIGN_DEFAULT(sizeof(sharedslotdesc_t)))
 #define AP_UNSIGNEDINT_OFFSET (APR_ALIGN_DEFAULT(sizeof(unsigned int)))
 
+/* Slots per word of the in-use bitmap */
+#define AP_SLOTMEM_BITS 32
+#define AP_SLOTMEM_BITMAP_WORDS(num) (((num) + AP_SLOTMEM_BITS - 1) / \
+                                      AP_SLOTMEM_BITS)
+
 struct ap_slotmem_instance_t {
     char                 *name;       /* file based SHM path/name */
     char                 *pname;      /* persisted file path/name */
@@ -49,7 +56,8 @@ struct ap_slotmem_instance_t {
     void                 *base;       /* data set start */
     apr_pool_t           *gpool;      /* per segment pool (generation cleared) */
     char                 *inuse;      /* in-use flag table*/
-    unsigned int         *num_free;   /* slot free count for this instance */
+    apr_uint32_t         *bitmap;     /* in-use bitmap, for atomic updates */
+    apr_uint32_t         *num_free;   /* slot free count for this instance */
     void                 *persist;    /* persist dataset start */
     const sharedslotdesc_t *desc;     /* per slot desc */
     struct ap_slotmem_instance_t  *next;       /* location of next allocated segment */
@@ -66,6 +74,13 @@ struct ap_slotmem_instance_t {
  *          |                                               |/     |
  *          |                                         ^     v      |
  *          |_____________________ File (mem->persist +  [meta]) __|
+ *
+ * The SHM is followed by the in-use bitmap, which is not persisted but
+ * rebuilt from the in-use array: the grabs and releases claim and free
+ * slots by atomic updates of its bits (then set the in-use flag, which
+ * readers like doall use), and keep num_free up to date atomically too,
+ * so that no caller's mutex is needed for that and the free slots are
+ * counted in constant time.
  */
 
 /* global pool and list of slotmem we are handling */
@@ -131,6 +146,72 @@ static int slotmem_filenames(apr_pool_t *pool,
     return (fname != NULL);
 }
 
+/* Offset of the in-use bitmap from the start of the SHM */
+static APR_INLINE apr_size_t slotmem_bitmap_offset(apr_size_t item_size,
+                                                   unsigned int item_num)
+{
+    return APR_ALIGN_DEFAULT(AP_SLOTMEM_OFFSET + AP_UNSIGNEDINT_OFFSET +
+                             item_size * item_num + item_num);
+}
+
+/* Atomically set the bit of a slot, returning whether it was clear */
+static int slotmem_bit_set(ap_slotmem_instance_t *slot, unsigned int id)
+{
+    apr_uint32_t *word = slot->bitmap + id / AP_SLOTMEM_BITS;
+    apr_uint32_t bit = (apr_uint32_t)1 << (id % AP_SLOTMEM_BITS);
+    apr_uint32_t old;
+
+    do {
+        old = apr_atomic_read32(word);
+        if (old & bit) {
+            return 0;
+        }
+    } while (apr_atomic_cas32(word, old | bit, old) != old);
+
+    return 1;
+}
+
+/* Atomically clear the bit of a slot, returning whether it was set */
+static int slotmem_bit_clear(ap_slotmem_instance_t *slot, unsigned int id)
+{
+    apr_uint32_t *word = slot->bitmap + id / AP_SLOTMEM_BITS;
+    apr_uint32_t bit = (apr_uint32_t)1 << (id % AP_SLOTMEM_BITS);
+    apr_uint32_t old;
+
+    do {
+        old = apr_atomic_read32(word);
+        if (!(old & bit)) {
+            return 0;
+        }
+    } while (apr_atomic_cas32(word, old & ~bit, old) != old);
+
+    return 1;
+}
+
+/* Build the bitmap and the free count from the in-use array; the bits
+ * past the last slot are set, so that they are never grabbed. */
+static void slotmem_init_bitmap(ap_slotmem_instance_t *slot)
+{
+    unsigned int i, num = slot->desc->num, nfree = 0;
+
+    memset(slot->bitmap, 0,
+           AP_SLOTMEM_BITMAP_WORDS(num) * sizeof(apr_uint32_t));
+    for (i = 0; i < num; i++) {
+        if (slot->inuse[i]) {
+            slot->bitmap[i / AP_SLOTMEM_BITS] |=
+                (apr_uint32_t)1 << (i % AP_SLOTMEM_BITS);
+        }
+        else {
+            nfree++;
+        }
+    }
+    for (; i % AP_SLOTMEM_BITS; i++) {
+        slot->bitmap[i / AP_SLOTMEM_BITS] |=
+            (apr_uint32_t)1 << (i % AP_SLOTMEM_BITS);
+    }
+    *slot->num_free = nfree;
+}
+
 static void slotmem_clearinuse(ap_slotmem_instance_t *slot)
 {
     unsigned int i;
@@ -145,7 +226,9 @@ static void slotmem_clearinuse(ap_slotmem_instance_t *slot)
     for (i = 0; i < slot->desc->num; i++, inuse++) {
         if (*inuse) {
             *inuse = 0;
-            (*slot->num_free)++;
+            if (slotmem_bit_clear(slot, i)) {
+                apr_atomic_inc32(slot->num_free);
+            }
         }
     }
 }
@@ -341,7 +424,6 @@ static apr_status_t slotmem_create(ap_slotmem_instance_t **new,
                                    ap_slotmem_type_t type, apr_pool_t *pool)
 {
     int fbased = 1;
-    int restored = 0;
     char *ptr;
     sharedslotdesc_t *desc;
     ap_slotmem_instance_t *res;
@@ -349,8 +431,10 @@ static apr_status_t slotmem_create(ap_slotmem_instance_t **new,
     const char *fname, *pname = NULL;
     apr_shm_t *shm;
     apr_size_t basesize = (item_size * item_num);
-    apr_size_t size = AP_SLOTMEM_OFFSET + AP_UNSIGNEDINT_OFFSET +
-                      (item_num * sizeof(char)) + basesize;
+    apr_size_t persist_size = AP_SLOTMEM_OFFSET + AP_UNSIGNEDINT_OFFSET +
+                              (item_num * sizeof(char)) + basesize;
+    apr_size_t size = slotmem_bitmap_offset(item_size, item_num) +
+                      AP_SLOTMEM_BITMAP_WORDS(item_num) * sizeof(apr_uint32_t);
     int persist = (type & AP_SLOTMEM_TYPE_PERSIST) != 0;
     apr_status_t rv;
 
@@ -415,6 +499,9 @@ static apr_status_t slotmem_create(ap_slotmem_instance_t **new,
         }
 
         desc = (sharedslotdesc_t *)apr_shm_baseaddr_get(shm);
+        if (!fbased || !is_child_process()) {
+            ap_shm_advise(desc, size);
+        }
         memset(desc, 0, size);
         desc->size = item_size;
         desc->num = item_num;
@@ -427,16 +514,13 @@ static apr_status_t slotmem_create(ap_slotmem_instance_t **new,
          * but NOTICE in the log.
          */
         if (persist) {
-            rv = restore_slotmem(desc, pname, size, pool);
-            if (rv == APR_SUCCESS) {
-                restored = 1;
-            }
-            else {
+            rv = restore_slotmem(desc, pname, persist_size, pool);
+            if (rv != APR_SUCCESS) {
                 /* just in case, re-zero */
                 ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf,
                              APLOGNO(02554) "could not restore %s", fname);
                 memset((char *)desc + AP_SLOTMEM_OFFSET, 0,
-                       size - AP_SLOTMEM_OFFSET);
+                       persist_size - AP_SLOTMEM_OFFSET);
             }
         }
     }
@@ -450,16 +534,16 @@ static apr_status_t slotmem_create(ap_slotmem_instance_t **new,
     res->fbased = fbased;
     res->shm = shm;
     res->persist = (void *)ptr;
-    res->num_free = (unsigned int *)ptr;
+    res->num_free = (apr_uint32_t *)ptr;
     ptr += AP_UNSIGNEDINT_OFFSET;
-    if (!restored) {
-        *res->num_free = item_num;
-    }
     res->base = (void *)ptr;
     res->desc = desc;
     res->gpool = gpool;
     res->next = NULL;
     res->inuse = ptr + basesize;
+    res->bitmap = (apr_uint32_t *)((char *)desc +
+                                   slotmem_bitmap_offset(item_size, item_num));
+    slotmem_init_bitmap(res);
     if (fbased) {
         if (globallistmem == NULL) {
             globallistmem = res;
@@ -532,12 +616,15 @@ static apr_status_t slotmem_attach(ap_slotmem_instance_t **new,
     res->fbased = 1;
     res->shm = shm;
     res->persist = (void *)ptr;
-    res->num_free = (unsigned int *)ptr;
+    res->num_free = (apr_uint32_t *)ptr;
     ptr += AP_UNSIGNEDINT_OFFSET;
     res->base = (void *)ptr;
     res->desc = desc;
     res->gpool = gpool;
     res->inuse = ptr + (desc->size * desc->num);
+    res->bitmap = (apr_uint32_t *)((char *)desc +
+                                   slotmem_bitmap_offset(desc->size,
+                                                         desc->num));
     res->next = NULL;
 
     *new = res;
@@ -592,7 +679,12 @@ static apr_status_t slotmem_get(ap_slotmem_instance_t *slot, unsigned int id,
     if (ret != APR_SUCCESS) {
         return ret;
     }
-    *inuse = 1;
+    if (!*inuse) {
+        if (slotmem_bit_set(slot, id)) {
+            apr_atomic_dec32(slot->num_free);
+        }
+        *inuse = 1;
+    }
     memcpy(dest, ptr, dest_len); /* bounds check? */
     return APR_SUCCESS;
 }
@@ -619,7 +711,12 @@ static apr_status_t slotmem_put(ap_slotmem_instance_t *slot, unsigned int id,
     if (ret != APR_SUCCESS) {
         return ret;
     }
-    *inuse=1;
+    if (!*inuse) {
+        if (slotmem_bit_set(slot, id)) {
+            apr_atomic_dec32(slot->num_free);
+        }
+        *inuse = 1;
+    }
     memcpy(ptr, src, src_len); /* bounds check? */
     return APR_SUCCESS;
 }
@@ -631,17 +728,7 @@ static unsigned int slotmem_num_slots(ap_slotmem_instance_t *slot)
 
 static unsigned int slotmem_num_free_slots(ap_slotmem_instance_t *slot)
 {
-    if (AP_SLOTMEM_IS_PREGRAB(slot))
-        return *slot->num_free;
-    else {
-        unsigned int i, counter=0;
-        char *inuse = slot->inuse;
-        for (i=0; i<slot->desc->num; i++, inuse++) {
-            if (!*inuse)
-                counter++;
-        }
-        return counter;
-    }
+    return apr_atomic_read32(slot->num_free);
 }
 
 static apr_size_t slotmem_slot_size(ap_slotmem_instance_t *slot)
@@ -651,31 +738,41 @@ static apr_size_t slotmem_slot_size(ap_slotmem_instance_t *slot)
 
 static apr_status_t slotmem_grab(ap_slotmem_instance_t *slot, unsigned int *id)
 {
-    unsigned int i;
-    char *inuse;
+    unsigned int w, nwords;
 
     if (!slot) {
         return APR_ENOSHMAVAIL;
     }
 
-    inuse = slot->inuse;
+    nwords = AP_SLOTMEM_BITMAP_WORDS(slot->desc->num);
+    for (w = 0; w < nwords; w++) {
+        apr_uint32_t *word = slot->bitmap + w;
+        apr_uint32_t old;
 
-    for (i = 0; i < slot->desc->num; i++, inuse++) {
-        if (!*inuse) {
-            break;
+        while ((old = apr_atomic_read32(word)) != ~(apr_uint32_t)0) {
+            unsigned int b = 0;
+
+            while (old & ((apr_uint32_t)1 << b)) {
+                b++;
+            }
+            if (apr_atomic_cas32(word, old | ((apr_uint32_t)1 << b),
+                                 old) == old) {
+                unsigned int i = w * AP_SLOTMEM_BITS + b;
+
+                /* ours now, whatever the others do */
+                slot->inuse[i] = 1;
+                apr_atomic_dec32(slot->num_free);
+                *id = i;
+                return APR_SUCCESS;
+            }
         }
     }
-    if (i >= slot->desc->num) {
-        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf, APLOGNO(02293)
-                     "slotmem(%s) grab failed. Num %u/num_free %u",
-                     slot->name, slotmem_num_slots(slot),
-                     slotmem_num_free_slots(slot));
-        return APR_EINVAL;
-    }
-    *inuse = 1;
-    *id = i;
-    (*slot->num_free)--;
-    return APR_SUCCESS;
+
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf, APLOGNO(02293)
+                 "slotmem(%s) grab failed. Num %u/num_free %u",
+                 slot->name, slotmem_num_slots(slot),
+                 slotmem_num_free_slots(slot));
+    return APR_EINVAL;
 }
 
 static apr_status_t slotmem_fgrab(ap_slotmem_instance_t *slot, unsigned int id)
@@ -695,10 +792,10 @@ static apr_status_t slotmem_fgrab(ap_slotmem_instance_t *slot, unsigned int id)
     }
     inuse = slot->inuse + id;
 
-    if (!*inuse) {
-        *inuse = 1;
-        (*slot->num_free)--;
+    if (slotmem_bit_set(slot, id)) {
+        apr_atomic_dec32(slot->num_free);
     }
+    *inuse = 1;
     return APR_SUCCESS;
 }
 
@@ -713,7 +810,7 @@ static apr_status_t slotmem_release(ap_slotmem_instance_t *slot,
 
     inuse = slot->inuse;
 
-    if (id >= slot->desc->num || !inuse[id] ) {
+    if (id >= slot->desc->num || !inuse[id]) {
         ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf, APLOGNO(02294)
                      "slotmem(%s) release failed. Num %u/inuse[%u] %d",
                      slot->name, slotmem_num_slots(slot),
@@ -724,8 +821,12 @@ static apr_status_t slotmem_release(ap_slotmem_instance_t *slot,
             return APR_NOTFOUND;
         }
     }
+    /* clear the flag before the bit, which frees the slot for the next
+     * grab */
     inuse[id] = 0;
-    (*slot->num_free)++;
+    if (slotmem_bit_clear(slot, id)) {
+        apr_atomic_inc32(slot->num_free);
+    }
     return APR_SUCCESS;
 }
 
@@ -27,6 +27,7 @@ ssl_engine_log.lo dnl
 ssl_engine_mutex.lo dnl
 ssl_engine_pphrase.lo dnl
 ssl_engine_rand.lo dnl
+ssl_engine_reload.lo dnl
 ssl_engine_vars.lo dnl
 ssl_scache.lo dnl
 ssl_util_stapling.lo dnl
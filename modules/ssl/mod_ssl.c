@@ -29,6 +29,8 @@
 #include "mod_ssl_openssl.h"
 #include "util_md5.h"
 #include "util_mutex.h"
+#include "ap_mpm.h"
+#include "mpm_common.h"
 #include "ap_provider.h"
 #include "http_config.h"
 
@@ -95,6 +97,23 @@ static const command_rec ssl_config_cmds[] = {
                 "SSL external Crypto Device usage "
                 "('builtin', '...')")
 #endif
+#ifdef HAVE_TLS_SESSION_TICKETS
+    SSL_CMD_SRV(SessionTicketKeyRotation, TAKE12,
+                "Rotate the TLS session ticket keys shared by the child "
+                "processes ('off', or 'seconds [previous]')")
+#endif
+#ifdef HAVE_SSL_CERT_RELOAD
+    SSL_CMD_SRV(CertificateReload, TAKE12,
+                "Reload changed certificates and keys in the running child "
+                "processes ('off', or 'seconds [shm-size]')")
+    SSL_CMD_SRV(CertificateLazyLoad, TAKE12,
+                "Load the certificates and keys of a server in a child "
+                "process on first use ('on [max]', or 'off')")
+#endif
+    SSL_CMD_SRV(HandshakeLimit, TAKE12,
+                "Maximum number of TLS handshakes processed concurrently "
+                "by the workers of a child process, and of new connections "
+                "waiting for one ('unlimited', or 'max [queued]')")
     SSL_CMD_SRV(RandomSeed, TAKE23,
                 "SSL Pseudo Random Number Generator (PRNG) seeding source "
                 "('startup|connect builtin|file:/path|exec:/path [bytes]')")
@@ -175,6 +194,16 @@ static const command_rec ssl_config_cmds[] = {
     SSL_CMD_SRV(SessionTickets, FLAG,
                 "Enable or disable TLS session tickets"
                 "(`on', `off')")
+    SSL_CMD_SRV(KTLS, FLAG,
+                "Offload TLS encryption of the responses to the kernel "
+                "(`on', `off')")
+    SSL_CMD_SRV(DynamicRecordSizing, FLAG,
+                "Use small TLS records at the start of the responses, "
+                "and full ones for bulk data (`on', `off')")
+    SSL_CMD_SRV(AsyncHandshake, FLAG,
+                "Do not hold a worker thread while the TLS handshake waits "
+                "for the client or for offloaded key operations "
+                "(`on', `off')")
     SSL_CMD_SRV(InsecureRenegotiation, FLAG,
                 "Enable support for insecure renegotiation")
     SSL_CMD_ALL(UserName, TAKE1,
@@ -240,6 +269,9 @@ static const command_rec ssl_config_cmds[] = {
     SSL_CMD_PXY(ProxyCheckPeerName, FLAG,
                 "SSL Proxy: check the peer certificate's name "
                 "(must be present in subjectAltName extension or CN")
+    SSL_CMD_PXY(ProxySessionReuse, FLAG,
+                "SSL Proxy: resume the sessions of the remote servers "
+                "from the SSLSessionCache")
 
     /*
      * Per-directory context configuration directives
@@ -310,6 +342,9 @@ static const command_rec ssl_config_cmds[] = {
                 "SSL stapling option for OCSP Response Error Cache Lifetime")
     SSL_CMD_SRV(StaplingForceURL, TAKE1,
                 "SSL stapling option to Force the OCSP Stapling URL")
+    SSL_CMD_SRV(StaplingBackgroundRefresh, FLAG,
+                "SSL stapling option to refresh responses in the background "
+                "instead of during handshakes (`on', `off')")
 #endif
 
 #ifdef HAVE_SSL_CONF_CMD
@@ -501,6 +536,7 @@ static SSLConnRec *ssl_init_connection_ctx(conn_rec *c,
     }
 
     if (need_setup) {
+        sslconn->c = c;
         sslconn->server = c->base_server;
         sslconn->verify_depth = UNSET;
         if (c->outgoing) {
@@ -692,6 +728,284 @@ static int ssl_hook_pre_connection(conn_rec *c, void *csd)
     return ssl_init_ssl_connection(c, NULL);
 }
 
+/*
+ * SSLHandshakeLimit: the workers of a child process run at most
+ * handshake_limit handshakes at a time, so that a reconnection storm can't
+ * take them all from the established connections. New connections over the
+ * limit wait in a FIFO, suspended in the (async) MPM, and are refused when
+ * handshake_queue of them are already waiting or when they waited more than
+ * the Timeout. A slot is held only while a worker runs the handshake, i.e.
+ * not while an async handshake waits for the client or for offloaded crypto.
+ */
+APR_RING_HEAD(ssl_handshake_ring_t, SSLConnRec);
+static struct {
+#if APR_HAS_THREADS
+    apr_thread_mutex_t *mutex;
+#endif
+    struct ssl_handshake_ring_t waiting;
+    int active;
+    int queued;
+    int can_queue;
+} handshakes;
+
+static void ssl_handshakes_lock(void)
+{
+#if APR_HAS_THREADS
+    if (handshakes.mutex) {
+        apr_thread_mutex_lock(handshakes.mutex);
+    }
+#endif
+}
+
+static void ssl_handshakes_unlock(void)
+{
+#if APR_HAS_THREADS
+    if (handshakes.mutex) {
+        apr_thread_mutex_unlock(handshakes.mutex);
+    }
+#endif
+}
+
+static void ssl_handshakes_child_init(apr_pool_t *p, server_rec *s)
+{
+    SSLModConfigRec *mc = myModConfig(s);
+    int async_mpm = 0;
+
+    if (mc->handshake_limit <= 0) {
+        return;
+    }
+#if APR_HAS_THREADS
+    apr_thread_mutex_create(&handshakes.mutex, APR_THREAD_MUTEX_DEFAULT, p);
+#endif
+    APR_RING_INIT(&handshakes.waiting, SSLConnRec, handshake_link);
+    if (ap_mpm_query(AP_MPMQ_IS_ASYNC, &async_mpm) == APR_SUCCESS) {
+        handshakes.can_queue = async_mpm;
+    }
+}
+
+static void ssl_handshake_queue_cb(void *baton)
+{
+    conn_rec *c = baton;
+    SSLConnRec *sslconn = myConnConfig(c);
+
+    if (sslconn->handshake_slot) {
+        /* Our turn, the clogging input filters will bring us back to
+         * ssl_hook_process_connection() from the MPM */
+        c->cs->sense = CONN_SENSE_WANT_WRITE;
+    }
+    else {
+        ap_log_cerror(APLOG_MARK, APLOG_INFO, 0, c, APLOGNO(10470)
+                      "SSL handshake timed out waiting for a slot "
+                      "(SSLHandshakeLimit), closing connection");
+        c->aborted = 1;
+        c->cs->state = CONN_STATE_LINGER;
+    }
+    ap_mpm_resume_suspended(c);
+}
+
+/* Release the slot of the calling connection, handing it over to the first
+ * connection waiting (if any), and refuse the ones which waited too long.
+ */
+static void ssl_handshake_slot_put(void)
+{
+    struct ssl_handshake_ring_t expired;
+    SSLConnRec *next = NULL, *w;
+    apr_time_t now = apr_time_now();
+
+    APR_RING_INIT(&expired, SSLConnRec, handshake_link);
+
+    ssl_handshakes_lock();
+    while (!APR_RING_EMPTY(&handshakes.waiting, SSLConnRec, handshake_link)) {
+        w = APR_RING_FIRST(&handshakes.waiting);
+        APR_RING_REMOVE(w, handshake_link);
+        handshakes.queued--;
+        if (now - w->handshake_queued > w->server->timeout) {
+            w->handshake_queued = 0;
+            APR_RING_INSERT_TAIL(&expired, w, SSLConnRec, handshake_link);
+            continue;
+        }
+        w->handshake_queued = 0;
+        w->handshake_slot = 1;
+        next = w;
+        break;
+    }
+    if (!next) {
+        handshakes.active--;
+    }
+    ssl_handshakes_unlock();
+
+    /* Resumed connections are handled by the MPM from the listener,
+     * once the worker which suspended them is done with them.
+     */
+    while (!APR_RING_EMPTY(&expired, SSLConnRec, handshake_link)) {
+        w = APR_RING_FIRST(&expired);
+        APR_RING_REMOVE(w, handshake_link);
+        ap_mpm_register_timed_callback(0, ssl_handshake_queue_cb, w->c);
+    }
+    if (next) {
+        ap_mpm_register_timed_callback(0, ssl_handshake_queue_cb, next->c);
+    }
+}
+
+static apr_status_t ssl_handshake_slot_cleanup(void *data)
+{
+    SSLConnRec *sslconn = data;
+
+    if (sslconn->handshake_queued) {
+        ssl_handshakes_lock();
+        if (sslconn->handshake_queued) {
+            APR_RING_REMOVE(sslconn, handshake_link);
+            sslconn->handshake_queued = 0;
+            handshakes.queued--;
+        }
+        ssl_handshakes_unlock();
+    }
+    if (sslconn->handshake_slot) {
+        sslconn->handshake_slot = 0;
+        ssl_handshake_slot_put();
+    }
+    return APR_SUCCESS;
+}
+
+/* Returns OK if the connection can handshake now, SUSPENDED if it has to
+ * wait for its turn, or DECLINED if it is refused.
+ */
+static int ssl_handshake_slot_get(conn_rec *c, SSLConnRec *sslconn,
+                                  SSLModConfigRec *mc)
+{
+    int max_queued = (mc->handshake_queue != UNSET) ? mc->handshake_queue
+                                                    : mc->handshake_limit;
+    int rc = DECLINED;
+
+    if (!sslconn->handshake_link.next) {
+        /* First time, don't let the connection go with a slot or queued */
+        APR_RING_ELEM_INIT(sslconn, handshake_link);
+        apr_pool_cleanup_register(c->pool, sslconn,
+                                  ssl_handshake_slot_cleanup,
+                                  apr_pool_cleanup_null);
+    }
+
+    ssl_handshakes_lock();
+    if (handshakes.active < mc->handshake_limit) {
+        handshakes.active++;
+        sslconn->handshake_slot = 1;
+        rc = OK;
+    }
+    else if (handshakes.can_queue && c->cs
+             && handshakes.queued < max_queued) {
+        handshakes.queued++;
+        sslconn->handshake_queued = apr_time_now();
+        APR_RING_INSERT_TAIL(&handshakes.waiting, sslconn,
+                             SSLConnRec, handshake_link);
+        rc = SUSPENDED;
+    }
+    ssl_handshakes_unlock();
+
+    return rc;
+}
+
+#ifdef HAVE_SSL_ASYNC
+static void ssl_async_handshake_cb(void *baton)
+{
+    conn_rec *c = baton;
+    SSLConnRec *sslconn = myConnConfig(c);
+
+    /* Clear MPM's temporary data */
+    apr_pool_clear(sslconn->async_pool);
+
+    /* The job can be resumed, the clogging input filters will bring us
+     * back to ssl_hook_process_connection() from the MPM */
+    c->cs->sense = CONN_SENSE_WANT_WRITE;
+    ap_mpm_resume_suspended(c);
+}
+
+static void ssl_async_handshake_timeout_cb(void *baton)
+{
+    conn_rec *c = baton;
+    SSLConnRec *sslconn = myConnConfig(c);
+
+    apr_pool_clear(sslconn->async_pool);
+
+    ap_log_cerror(APLOG_MARK, APLOG_INFO, 0, c, APLOGNO(10467)
+                  "SSL handshake timed out waiting for an asynchronous "
+                  "crypto operation, closing connection");
+    c->aborted = 1;
+    c->cs->state = CONN_STATE_LINGER;
+    ap_mpm_resume_suspended(c);
+}
+
+/* The handshake's ASYNC job is paused until an offloaded crypto operation
+ * (e.g. the signature by a QAT engine or a remote signer) completes, which
+ * is notified by the engine/provider through the job's wait fds: suspend
+ * the connection and have the MPM poll them instead of blocking a worker.
+ */
+static int ssl_async_handshake_wait(conn_rec *c, SSLConnRec *sslconn)
+{
+    apr_array_header_t *pfds;
+    OSSL_ASYNC_FD *fds;
+    size_t numfds = 0, i;
+    apr_status_t rv;
+
+    if (!SSL_get_all_async_fds(sslconn->ssl, NULL, &numfds) || !numfds) {
+        /* No wait fds (the engine expects to be polled), so just retry
+         * once the socket has been through the MPM */
+        c->cs->state = CONN_STATE_WRITE_COMPLETION;
+        c->cs->sense = CONN_SENSE_WANT_WRITE;
+        return OK;
+    }
+
+    if (!sslconn->async_pool) {
+        apr_pool_create(&sslconn->async_pool, c->pool);
+        apr_pool_tag(sslconn->async_pool, "ssl_async_handshake");
+    }
+    fds = apr_palloc(sslconn->async_pool, numfds * sizeof(*fds));
+    SSL_get_all_async_fds(sslconn->ssl, fds, &numfds);
+
+    pfds = apr_array_make(sslconn->async_pool, (int)numfds,
+                          sizeof(apr_pollfd_t));
+    for (i = 0; i < numfds; i++) {
+        apr_pollfd_t *pfd = apr_array_push(pfds);
+        apr_os_file_t osfd = fds[i];
+
+        memset(pfd, 0, sizeof(*pfd));
+        pfd->p = sslconn->async_pool;
+        pfd->desc_type = APR_POLL_FILE;
+        pfd->reqevents = APR_POLLIN;
+        /* The fd is owned by the engine, apr_os_file_put() won't close it */
+        apr_os_file_put(&pfd->desc.f, &osfd, APR_FOPEN_READ,
+                        sslconn->async_pool);
+    }
+
+    rv = ap_mpm_register_poll_callback_timeout(sslconn->async_pool, pfds,
+                                               ssl_async_handshake_cb,
+                                               ssl_async_handshake_timeout_cb,
+                                               c, sslconn->server->timeout);
+    if (rv != APR_SUCCESS) {
+        ap_log_cerror(APLOG_MARK, APLOG_ERR, rv, c, APLOGNO(10468)
+                      "SSL handshake: can't poll the asynchronous "
+                      "job's fds, closing connection");
+        apr_pool_clear(sslconn->async_pool);
+        c->cs->state = CONN_STATE_LINGER;
+        return OK;
+    }
+
+    ap_log_cerror(APLOG_MARK, APLOG_TRACE3, 0, c,
+                  "SSL handshake: waiting for %" APR_SIZE_T_FMT
+                  " asynchronous job fd(s)", numfds);
+    c->cs->state = CONN_STATE_SUSPENDED;
+    return OK;
+}
+#endif
+
+static void ssl_hook_suspend_connection(conn_rec *c, request_rec *r)
+{
+    /* Entering the keep-alive queue, nothing to hold for the next
+     * request until it arrives. */
+    if (!r && c->cs && c->cs->state == CONN_STATE_CHECK_REQUEST_LINE_READABLE) {
+        ssl_io_filter_idle(c);
+    }
+}
+
 static int ssl_hook_process_connection(conn_rec* c)
 {
     SSLConnRec *sslconn = myConnConfig(c);
@@ -701,19 +1015,92 @@ static int ssl_hook_process_connection(conn_rec* c)
          * themselves which triggers the handshake, which again triggers
          * all kinds of useful things such as SNI and ALPN.
          */
+        SSLSrvConfigRec *sc = mySrvConfig(sslconn->server);
+        SSLModConfigRec *mc = myModConfig(c->base_server);
+        apr_read_type_e block = APR_BLOCK_READ;
         apr_bucket_brigade* temp;
         apr_status_t rv;
+        int limited = 0;
+
+        /* With SSLAsyncHandshake and an MPM which can poll the connection
+         * for us, don't wait for the client's handshake records (nor for
+         * offloaded crypto operations) in a worker thread. Once handshaked
+         * this is a noop anyway.
+         */
+        if (c->cs && (sc->async_handshake == TRUE || sslconn->async_handshake)
+                && sslconn->ssl && !SSL_is_init_finished(sslconn->ssl)) {
+            block = APR_NONBLOCK_READ;
+        }
+
+        if (mc->handshake_limit > 0
+                && sslconn->ssl && !SSL_is_init_finished(sslconn->ssl)) {
+            if (!sslconn->handshake_slot) {
+                switch (ssl_handshake_slot_get(c, sslconn, mc)) {
+                case OK:
+                    break;
+                case SUSPENDED:
+                    /* Clog for the MPM to call us back once resumed */
+                    sslconn->async_handshake = 1;
+                    c->clogging_input_filters = 1;
+                    c->cs->state = CONN_STATE_SUSPENDED;
+                    return OK;
+                default:
+                    ap_log_cerror(APLOG_MARK, APLOG_INFO, 0, c, APLOGNO(10469)
+                                  "SSL handshake refused, too many in "
+                                  "progress (SSLHandshakeLimit), closing "
+                                  "connection");
+                    if (c->cs) {
+                        c->cs->state = CONN_STATE_LINGER;
+                    }
+                    return OK;
+                }
+            }
+            limited = 1;
+        }
 
         temp = apr_brigade_create(c->pool, c->bucket_alloc);
         rv = ap_get_brigade(c->input_filters, temp,
-                            AP_MODE_INIT, APR_BLOCK_READ, 0);
+                            AP_MODE_INIT, block, 0);
         apr_brigade_destroy(temp);
 
-        if (APR_SUCCESS != APR_SUCCESS) {
+        if (limited) {
+            sslconn->handshake_slot = 0;
+            ssl_handshake_slot_put();
+        }
+
+        if (block == APR_NONBLOCK_READ) {
+            if (APR_STATUS_IS_EAGAIN(rv) && !c->aborted) {
+                /* Let the MPM call us back when the connection can make
+                 * progress, which it does for clogging input filters.
+                 */
+                sslconn->async_handshake = 1;
+                c->clogging_input_filters = 1;
+#ifdef HAVE_SSL_ASYNC
+                if (sslconn->ssl && SSL_waiting_for_async(sslconn->ssl)) {
+                    return ssl_async_handshake_wait(c, sslconn);
+                }
+#endif
+                c->cs->state = CONN_STATE_WRITE_COMPLETION;
+                c->cs->sense = CONN_SENSE_WANT_READ;
+                return OK;
+            }
+            if (sslconn->async_handshake) {
+                /* Done, back to the usual processing */
+                sslconn->async_handshake = 0;
+                c->clogging_input_filters = 0;
+                c->cs->state = CONN_STATE_READ_REQUEST_LINE;
+                c->cs->sense = CONN_SENSE_DEFAULT;
+            }
+        }
+
+        /* On HTTP spoken on HTTPS port, the SSL filters are disabled and
+         * will feed a fake request for the error page to be returned.
+         */
+        if (rv != APR_SUCCESS && sslconn->non_ssl_request == NON_SSL_OK) {
             if (c->cs) {
                 c->cs->state = CONN_STATE_LINGER;
             }
-            ap_log_cerror(APLOG_MARK, APLOG_ERR, rv, c, APLOGNO(10373)
+            ap_log_cerror(APLOG_MARK, APLOG_INFO, rv, c, APLOGNO(10373)
                           "SSL handshake was not completed, "
                           "closing connection");
             return OK;
@@ -742,6 +1129,8 @@ static void ssl_register_hooks(apr_pool_t *p)
     ssl_io_filter_register(p);
 
     ap_hook_pre_connection(ssl_hook_pre_connection,NULL,NULL, APR_HOOK_MIDDLE);
+    ap_hook_suspend_connection(ssl_hook_suspend_connection,
+                               NULL, NULL, APR_HOOK_MIDDLE);
     ap_hook_process_connection(ssl_hook_process_connection, 
                                                    NULL, NULL, APR_HOOK_MIDDLE);
     ap_hook_test_config   (ssl_hook_ConfigTest,    NULL,NULL, APR_HOOK_MIDDLE);
@@ -750,6 +1139,10 @@ static void ssl_register_hooks(apr_pool_t *p)
     ap_hook_default_port  (ssl_hook_default_port,  NULL,NULL, APR_HOOK_MIDDLE);
     ap_hook_pre_config    (ssl_hook_pre_config,    NULL,NULL, APR_HOOK_MIDDLE);
     ap_hook_child_init    (ssl_init_Child,         NULL,NULL, APR_HOOK_MIDDLE);
+    ap_hook_child_init    (ssl_handshakes_child_init, NULL,NULL, APR_HOOK_MIDDLE);
+#ifdef HAVE_SSL_CERT_RELOAD
+    ap_hook_monitor       (ssl_reload_monitor,     NULL,NULL, APR_HOOK_MIDDLE);
+#endif
     ap_hook_post_read_request(ssl_hook_ReadReq, pre_prr,NULL, APR_HOOK_MIDDLE);
     ap_hook_check_access  (ssl_hook_Access,        NULL,NULL, APR_HOOK_MIDDLE,
                            AP_AUTH_INTERNAL_PER_CONF);
@@ -66,6 +66,20 @@ static SSLModConfigRec *ssl_config_global_create(apr_pool_t *pool, server_rec *s
 #ifdef HAVE_FIPS
     mc->fips = UNSET;
 #endif
+    mc->handshake_limit        = 0;
+    mc->handshake_queue        = UNSET;
+#ifdef HAVE_TLS_SESSION_TICKETS
+    mc->ticket_key_rotation    = 0;
+    mc->ticket_key_previous    = 2;
+#endif
+#ifdef HAVE_OCSP_STAPLING
+    mc->stapling_refresh_background = FALSE;
+#endif
+#ifdef HAVE_SSL_CERT_RELOAD
+    mc->cert_reload            = 0;
+    mc->cert_reload_size       = MODSSL_RELOAD_SIZE_DEFAULT;
+    mc->cert_lazy              = 0;
+#endif
 
     mc->retained = ap_retained_data_get(MODSSL_RETAINED_KEY);
     if (!mc->retained) {
@@ -117,6 +131,11 @@ static void modssl_ctx_init(modssl_ctx_t *mctx, apr_pool_t *p)
     mctx->ticket_key          = NULL;
 #endif
 
+#ifdef HAVE_SSL_CERT_RELOAD
+    mctx->reload              = NULL;
+    mctx->lazy_certs          = 0;
+#endif
+
     mctx->protocol            = SSL_PROTOCOL_DEFAULT;
     mctx->protocol_set        = 0;
 
@@ -183,6 +202,7 @@ static void modssl_ctx_init(modssl_ctx_t *mctx, apr_pool_t *p)
     mctx->ssl_check_peer_cn     = UNSET;
     mctx->ssl_check_peer_name   = UNSET;
     mctx->ssl_check_peer_expire = UNSET;
+    mctx->ssl_session_reuse     = UNSET;
 }
 
 static void modssl_ctx_init_server(SSLSrvConfigRec *sc,
@@ -221,6 +241,9 @@ static SSLSrvConfigRec *ssl_config_server_new(apr_pool_t *p)
     sc->compression            = UNSET;
 #endif
     sc->session_tickets        = UNSET;
+    sc->ktls                   = UNSET;
+    sc->async_handshake        = UNSET;
+    sc->dynamic_records        = UNSET;
 
     modssl_ctx_init_server(sc, p);
 
@@ -317,6 +340,7 @@ static void modssl_ctx_cfg_merge(apr_pool_t *p,
     cfgMergeBool(ssl_check_peer_cn);
     cfgMergeBool(ssl_check_peer_name);
     cfgMergeBool(ssl_check_peer_expire);
+    cfgMergeBool(ssl_session_reuse);
 }
 
 static void modssl_ctx_cfg_merge_server(apr_pool_t *p,
@@ -355,6 +379,9 @@ void *ssl_config_server_merge(apr_pool_t *p, void *basev, void *addv)
     cfgMergeBool(compression);
 #endif
     cfgMergeBool(session_tickets);
+    cfgMergeBool(ktls);
+    cfgMergeBool(async_handshake);
+    cfgMergeBool(dynamic_records);
 
     modssl_ctx_cfg_merge_server(p, base->server, add->server, mrg->server);
 
@@ -833,6 +860,47 @@ const char *ssl_cmd_SSLEngine(cmd_parms *cmd, void *dcfg, const char *arg)
     return "Argument must be On, Off, or Optional";
 }
 
+const char *ssl_cmd_SSLHandshakeLimit(cmd_parms *cmd, void *dcfg,
+                                      const char *arg1, const char *arg2)
+{
+    SSLModConfigRec *mc = myModConfig(cmd->server);
+    const char *err;
+    int limit, queue = UNSET;
+
+    if ((err = ap_check_cmd_context(cmd, GLOBAL_ONLY))) {
+        return err;
+    }
+    if (!mc) {
+        return "SSLHandshakeLimit: cannot be used inside SSLPolicyDefine";
+    }
+
+    if (strcEQ(arg1, "unlimited")) {
+        if (arg2) {
+            return "SSLHandshakeLimit: no queue can be configured when "
+                   "unlimited";
+        }
+        limit = 0;
+    }
+    else {
+        limit = atoi(arg1);
+        if (limit <= 0) {
+            return "SSLHandshakeLimit: must be 'unlimited' or a positive "
+                   "number";
+        }
+        if (arg2) {
+            queue = atoi(arg2);
+            if (queue < 0 || (queue == 0 && !apr_isdigit(*arg2))) {
+                return "SSLHandshakeLimit: the queue size must be zero or "
+                       "a positive number";
+            }
+        }
+    }
+
+    mc->handshake_limit = limit;
+    mc->handshake_queue = queue;
+    return NULL;
+}
+
 const char *ssl_cmd_SSLFIPS(cmd_parms *cmd, void *dcfg, int flag)
 {
 #ifdef HAVE_FIPS
@@ -974,6 +1042,33 @@ const char *ssl_cmd_SSLSessionTickets(cmd_parms *cmd, void *dcfg, int flag)
     return NULL;
 }
 
+const char *ssl_cmd_SSLKTLS(cmd_parms *cmd, void *dcfg, int flag)
+{
+#ifdef HAVE_SSL_KTLS_TX
+    SSLSrvConfigRec *sc = mySrvConfig(cmd->server);
+    sc->ktls = flag ? TRUE : FALSE;
+    return NULL;
+#else
+    return "SSLKTLS unsupported; kernel TLS needs OpenSSL 3.0 or later "
+           "with KTLS support, on Linux";
+#endif
+}
+
+const char *ssl_cmd_SSLAsyncHandshake(cmd_parms *cmd, void *dcfg, int flag)
+{
+    SSLSrvConfigRec *sc = mySrvConfig(cmd->server);
+    sc->async_handshake = flag ? TRUE : FALSE;
+    return NULL;
+}
+
+const char *ssl_cmd_SSLDynamicRecordSizing(cmd_parms *cmd, void *dcfg,
+                                           int flag)
+{
+    SSLSrvConfigRec *sc = mySrvConfig(cmd->server);
+    sc->dynamic_records = flag ? TRUE : FALSE;
+    return NULL;
+}
+
 const char *ssl_cmd_SSLInsecureRenegotiation(cmd_parms *cmd, void *dcfg, int flag)
 {
 #ifdef SSL_OP_ALLOW_UNSAFE_LEGACY_RENEGOTIATION
@@ -1076,6 +1171,125 @@ const char *ssl_cmd_SSLSessionTicketKeyFile(cmd_parms *cmd,
 
     return NULL;
 }
+
+const char *ssl_cmd_SSLSessionTicketKeyRotation(cmd_parms *cmd,
+                                                void *dcfg,
+                                                const char *arg1,
+                                                const char *arg2)
+{
+    SSLModConfigRec *mc = myModConfig(cmd->server);
+    const char *err;
+    int interval, previous = 2;
+
+    if ((err = ap_check_cmd_context(cmd, GLOBAL_ONLY))) {
+        return err;
+    }
+    if (!mc) {
+        return "SSLSessionTicketKeyRotation: cannot be used inside "
+               "SSLPolicyDefine";
+    }
+
+    if (strcEQ(arg1, "off")) {
+        interval = 0;
+    }
+    else {
+        interval = atoi(arg1);
+        if (interval < 60) {
+            return "SSLSessionTicketKeyRotation: the interval must be 'off' "
+                   "or at least 60 seconds";
+        }
+    }
+    if (arg2) {
+        previous = atoi(arg2);
+        if (previous < 0 || previous > MODSSL_TICKET_RKEYS_MAX - 2
+            || (previous == 0 && !apr_isdigit(*arg2))) {
+            return apr_psprintf(cmd->pool, "SSLSessionTicketKeyRotation: "
+                                "the number of previous keys must be "
+                                "between 0 and %d",
+                                MODSSL_TICKET_RKEYS_MAX - 2);
+        }
+    }
+
+    mc->ticket_key_rotation = interval;
+    mc->ticket_key_previous = previous;
+    return NULL;
+}
+#endif
+
+#ifdef HAVE_SSL_CERT_RELOAD
+const char *ssl_cmd_SSLCertificateReload(cmd_parms *cmd,
+                                         void *dcfg,
+                                         const char *arg1,
+                                         const char *arg2)
+{
+    SSLModConfigRec *mc = myModConfig(cmd->server);
+    const char *err;
+    apr_off_t size = MODSSL_RELOAD_SIZE_DEFAULT;
+    int interval;
+
+    if ((err = ap_check_cmd_context(cmd, GLOBAL_ONLY))) {
+        return err;
+    }
+    if (!mc) {
+        return "SSLCertificateReload: cannot be used inside SSLPolicyDefine";
+    }
+
+    if (strcEQ(arg1, "off")) {
+        interval = 0;
+    }
+    else {
+        interval = atoi(arg1);
+        if (interval < 1) {
+            return "SSLCertificateReload: the interval must be 'off' "
+                   "or a number of seconds";
+        }
+    }
+    if (arg2) {
+        if (apr_strtoff(&size, arg2, NULL, 10) != APR_SUCCESS
+            || size < 65536 || size > APR_UINT32_MAX / 2) {
+            return "SSLCertificateReload: the size must be a number of "
+                   "bytes, at least 65536";
+        }
+    }
+
+    mc->cert_reload = apr_time_from_sec(interval);
+    mc->cert_reload_size = (apr_size_t)size;
+    return NULL;
+}
+
+const char *ssl_cmd_SSLCertificateLazyLoad(cmd_parms *cmd,
+                                           void *dcfg,
+                                           const char *arg1,
+                                           const char *arg2)
+{
+    SSLModConfigRec *mc = myModConfig(cmd->server);
+    const char *err;
+    int max = MODSSL_LAZY_MAX_DEFAULT;
+
+    if ((err = ap_check_cmd_context(cmd, GLOBAL_ONLY))) {
+        return err;
+    }
+    if (!mc) {
+        return "SSLCertificateLazyLoad: cannot be used inside SSLPolicyDefine";
+    }
+
+    if (strcEQ(arg1, "off")) {
+        if (arg2) {
+            return "SSLCertificateLazyLoad: no maximum with 'off'";
+        }
+        mc->cert_lazy = 0;
+        return NULL;
+    }
+    if (!strcEQ(arg1, "on")) {
+        return "SSLCertificateLazyLoad: must be 'on' or 'off'";
+    }
+    if (arg2 && (max = atoi(arg2)) < 1) {
+        return "SSLCertificateLazyLoad: the maximum must be a positive "
+               "number of server contexts";
+    }
+    mc->cert_lazy = max;
+    return NULL;
+}
 #endif
 
 #define NO_PER_DIR_SSL_CA \
@@ -1981,6 +2195,15 @@ const char *ssl_cmd_SSLProxyCheckPeerName(cmd_parms *cmd, void *dcfg, int flag)
     return NULL;
 }
 
+const char *ssl_cmd_SSLProxySessionReuse(cmd_parms *cmd, void *dcfg, int flag)
+{
+    SSLDirConfigRec *dc = (SSLDirConfigRec *)dcfg;
+
+    dc->proxy->ssl_session_reuse = flag ? TRUE : FALSE;
+
+    return NULL;
+}
+
 const char  *ssl_cmd_SSLStrictSNIVHostCheck(cmd_parms *cmd, void *dcfg, int flag)
 {
 #ifdef HAVE_TLSEXT
@@ -2056,6 +2279,24 @@ const char *ssl_cmd_SSLStaplingCache(cmd_parms *cmd,
     return NULL;
 }
 
+const char *ssl_cmd_SSLStaplingBackgroundRefresh(cmd_parms *cmd, void *dcfg,
+                                                 int flag)
+{
+    SSLModConfigRec *mc = myModConfig(cmd->server);
+    const char *err;
+
+    if ((err = ap_check_cmd_context(cmd, GLOBAL_ONLY))) {
+        return err;
+    }
+    if (!mc) {
+        return "SSLStaplingBackgroundRefresh: cannot be used inside "
+               "SSLPolicyDefine";
+    }
+
+    mc->stapling_refresh_background = flag ? TRUE : FALSE;
+    return NULL;
+}
+
 const char *ssl_cmd_SSLUseStapling(cmd_parms *cmd, void *dcfg, int flag)
 {
     SSLSrvConfigRec *sc = mySrvConfig(cmd->server);
@@ -2625,6 +2866,7 @@ static void modssl_ctx_dump(modssl_ctx_t *ctx, apr_pool_t *p, int proxy,
         DMP_ON_OFF("SSLProxyCheckPeerCN", ctx->ssl_check_peer_cn);
         DMP_ON_OFF("SSLProxyCheckPeerName", ctx->ssl_check_peer_cn);
         DMP_ON_OFF("SSLProxyCheckPeerExpire", ctx->ssl_check_peer_expire);
+        DMP_ON_OFF("SSLProxySessionReuse", ctx->ssl_session_reuse);
     }
 }
 
@@ -2637,6 +2879,11 @@ static void ssl_srv_dump(SSLSrvConfigRec *sc, apr_pool_t *p,
 #ifndef OPENSSL_NO_COMP
     DMP_ON_OFF("SSLCompression", sc->compression);
 #endif
+#ifdef HAVE_SSL_KTLS_TX
+    DMP_ON_OFF("SSLKTLS", sc->ktls);
+#endif
+    DMP_ON_OFF("SSLAsyncHandshake", sc->async_handshake);
+    DMP_ON_OFF("SSLDynamicRecordSizing", sc->dynamic_records);
 
     modssl_ctx_dump(sc->server, p, 0, out, indent, psep);
 
@@ -392,6 +392,10 @@ apr_status_t ssl_init_Module(apr_pool_t *p, apr_pool_t *plog,
 
     pphrases = apr_array_make(ptemp, 2, sizeof(char *));
 
+#ifdef HAVE_SSL_CERT_RELOAD
+    ssl_reload_init(base_server, p);
+#endif
+
     /*
      *  initialize servers
      */
@@ -429,6 +433,11 @@ apr_status_t ssl_init_Module(apr_pool_t *p, apr_pool_t *plog,
         return rv;
     }
 
+#ifdef HAVE_OCSP_STAPLING
+    /* all certificates are registered for stapling by now */
+    ssl_stapling_refresh_init(base_server, p);
+#endif
+
     for (s = base_server; s; s = s->next) {
         SSLDirConfigRec *sdc = ap_get_module_config(s->lookup_defaults,
                                                     &ssl_module);
@@ -840,6 +849,24 @@ static apr_status_t ssl_init_ctx_protocol(server_rec *s,
     }
 #endif
 
+#ifdef HAVE_SSL_KTLS_TX
+    if (sc->ktls == TRUE && !mctx->pkp) {
+        SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+    }
+#endif
+
+#ifdef HAVE_SSL_ASYNC
+    if (sc->async_handshake == TRUE && !mctx->pkp) {
+        int async_mpm = 0;
+        /* Paused jobs can only be resumed by an async MPM, otherwise the
+         * handshake would have to block anyway, so let OpenSSL do so. */
+        if (ap_mpm_query(AP_MPMQ_IS_ASYNC, &async_mpm) == APR_SUCCESS
+            && async_mpm) {
+            SSL_CTX_set_mode(ctx, SSL_MODE_ASYNC);
+        }
+    }
+#endif
+
     SSL_CTX_set_app_data(ctx, s);
 
     /*
@@ -1402,7 +1429,7 @@ static apr_status_t ssl_init_server_certs(server_rec *s,
 {
     SSLModConfigRec *mc = myModConfig(s);
     const char *vhost_id = mctx->sc->vhost_id, *key_id, *certfile, *keyfile;
-    int i;
+    int i, reloadable = 1;
     X509 *cert;
     DH *dh;
 #ifdef HAVE_ECC
@@ -1417,6 +1444,32 @@ static apr_status_t ssl_init_server_certs(server_rec *s,
     /* no OpenSSL default prompts for any of the SSL_CTX_use_* calls, please */
     SSL_CTX_set_default_passwd_cb(mctx->ssl_ctx, ssl_no_passwd_prompt_cb);
 
+#ifdef HAVE_SSL_CERT_RELOAD
+    /*
+     * With SSLCertificateLazyLoad, only check that the files exist now,
+     * the children load them when a handshake needs them
+     */
+    if (mc->cert_lazy > 0 && mctx->pks->cert_files->nelts) {
+        for (i = 0; i < mctx->pks->cert_files->nelts; i++) {
+            if (modssl_is_engine_id(APR_ARRAY_IDX(mctx->pks->cert_files, i,
+                                                  const char *))) {
+                reloadable = 0;
+            }
+        }
+        for (i = 0; i < mctx->pks->key_files->nelts; i++) {
+            if (modssl_is_engine_id(APR_ARRAY_IDX(mctx->pks->key_files, i,
+                                                  const char *))) {
+                reloadable = 0;
+            }
+        }
+        if (reloadable) {
+            mctx->lazy_certs = 1;
+            SSL_CTX_set_dh_auto(mctx->ssl_ctx, 1);
+            return ssl_reload_register(s, p, mctx);
+        }
+    }
+#endif
+
     /* Iterate over the SSLCertificateFile array */
     for (i = 0; (i < mctx->pks->cert_files->nelts) &&
                 (certfile = APR_ARRAY_IDX(mctx->pks->cert_files, i,
@@ -1432,6 +1485,7 @@ static apr_status_t ssl_init_server_certs(server_rec *s,
         /* first the certificate (public key) */
         if (modssl_is_engine_id(certfile)) {
             engine_certfile = certfile;
+            reloadable = 0;
         }
         else if (mctx->cert_chain) {
             if ((SSL_CTX_use_certificate_file(mctx->ssl_ctx, certfile,
@@ -1466,6 +1520,7 @@ static apr_status_t ssl_init_server_certs(server_rec *s,
             apr_status_t rv;
 
             cert = NULL;
+            reloadable = 0;
             
             if ((rv = modssl_load_engine_keypair(s, ptemp, vhost_id,
                                                  engine_certfile, keyfile,
@@ -1505,8 +1560,10 @@ static apr_status_t ssl_init_server_certs(server_rec *s,
 
             ERR_clear_error();
 
-            /* perhaps it's an encrypted private key, so try again */
+            /* perhaps it's an encrypted private key, so try again
+             * (which can't be reloaded without the pass phrase dialog) */
             ssl_load_encrypted_pkey(s, ptemp, i, keyfile, &pphrases);
+            reloadable = 0;
 
             if (!(asn1 = ssl_asn1_table_get(mc->retained->privkeys, key_id)) ||
                 !(ptr = asn1->cpData) ||
@@ -1638,6 +1695,20 @@ static apr_status_t ssl_init_server_certs(server_rec *s,
     EC_GROUP_free(ecparams);
 #endif
 
+#ifdef HAVE_SSL_CERT_RELOAD
+    if (mc->cert_reload > 0) {
+        if (reloadable) {
+            ssl_reload_register(s, p, mctx);
+        }
+        else {
+            ap_log_error(APLOG_MARK, APLOG_INFO, 0, s, APLOGNO(10473)
+                         "Certificates of %s are loaded from an engine or "
+                         "have an encrypted private key, changes will only "
+                         "apply on restart (SSLCertificateReload)", vhost_id);
+        }
+    }
+#endif
+
     return APR_SUCCESS;
 }
 
@@ -1656,6 +1727,26 @@ static apr_status_t ssl_init_ticket_key(server_rec *s,
     int res;
 
     if (!ticket_key->file_path) {
+        SSLModConfigRec *mc = myModConfig(s);
+
+        if (mc->ticket_key_rotation <= 0) {
+            return APR_SUCCESS;
+        }
+        /* The keys rotated by the children (see ssl_scache.c) */
+#if OPENSSL_VERSION_NUMBER < 0x30000000L
+        res = SSL_CTX_set_tlsext_ticket_key_cb(mctx->ssl_ctx,
+                                               ssl_callback_SessionTicket);
+#else
+        res = SSL_CTX_set_tlsext_ticket_key_evp_cb(mctx->ssl_ctx,
+                                                   ssl_callback_SessionTicket);
+#endif
+        if (!res) {
+            ap_log_error(APLOG_MARK, APLOG_EMERG, 0, s, APLOGNO(10472)
+                         "Unable to initialize TLS session ticket key "
+                         "callback (incompatible OpenSSL version?)");
+            ssl_log_ssl_error(SSLLOG_MARK, APLOG_EMERG, s);
+            return ssl_die(s);
+        }
         return APR_SUCCESS;
     }
 
@@ -1981,6 +2072,18 @@ static apr_status_t ssl_init_proxy_ctx(server_rec *s,
         return rv;
     }
 
+    /*
+     * Client sessions go to the inter-process cache only, they are looked
+     * up by ssl_io_filter_handshake() before connecting.
+     */
+    if (proxy->ssl_session_reuse == TRUE && myModConfig(s)->sesscache) {
+        SSL_CTX_set_session_cache_mode(proxy->ssl_ctx,
+                                       SSL_SESS_CACHE_CLIENT |
+                                       SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(proxy->ssl_ctx,
+                                ssl_callback_NewProxySessionCacheEntry);
+    }
+
     return APR_SUCCESS;
 }
 
@@ -2067,7 +2170,12 @@ static apr_status_t ssl_init_server_ctx(server_rec *s,
     }
 #endif
 
-    if (SSL_CTX_check_private_key(sc->server->ssl_ctx) != 1) {
+    if (
+#ifdef HAVE_SSL_CERT_RELOAD
+        /* lazily loaded certificates are checked when loaded */
+        !sc->server->lazy_certs &&
+#endif
+        SSL_CTX_check_private_key(sc->server->ssl_ctx) != 1) {
         ap_log_error(APLOG_MARK, APLOG_EMERG, 0, s, APLOGNO(02572)
                      "Failed to configure at least one certificate and key "
                      "for %s", sc->vhost_id);
@@ -2366,6 +2474,9 @@ void ssl_init_Child(apr_pool_t *p, server_rec *s)
 #ifdef HAVE_OCSP_STAPLING
     ssl_stapling_mutex_reinit(s, p);
 #endif
+#ifdef HAVE_SSL_CERT_RELOAD
+    ssl_reload_child_init(p, s);
+#endif
 }
 
 apr_status_t ssl_init_ModuleKill(void *data)
@@ -32,6 +32,19 @@
 #include "mod_ssl_openssl.h"
 #include "apr_date.h"
 
+#ifdef HAVE_SSL_KTLS_TX
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/tls.h>
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+#endif
+
 APR_IMPLEMENT_OPTIONAL_HOOK_RUN_ALL(ssl, SSL, int, proxy_post_handshake,
                                     (conn_rec *c,SSL *ssl),
                                     (c,ssl),OK,DECLINED);
@@ -111,13 +124,49 @@ typedef struct {
     SSLConnRec         *config;
 } ssl_filter_ctx_t;
 
+/* Dynamic record sizing: after an idle period, the first bytes of the
+ * output are sent in records fitting a single TCP segment, which the client
+ * can decrypt as soon as they arrive (i.e. not depending on the next ones
+ * while the congestion window is small), then in full records for bulk.
+ */
+#define MODSSL_RECORD_SMALL      1369
+#define MODSSL_RECORD_MAX        SSL3_RT_MAX_PLAIN_LENGTH
+#define MODSSL_RECORD_RAMP_BYTES (1024 * 1024)
+#define MODSSL_RECORD_IDLE       apr_time_from_sec(1)
+
+/* The records encrypted by SSL_write() are gathered up to this size before
+ * being passed to the core, which can then send them in one writev().
+ */
+#define MODSSL_GATHER_BYTES      (4 * MODSSL_RECORD_MAX)
+
 typedef struct {
     ssl_filter_ctx_t *filter_ctx;
     conn_rec *c;
     apr_bucket_brigade *bb;    /* Brigade used as a buffer. */
     apr_status_t rc;
+#ifdef HAVE_SSL_KTLS_TX
+    int ktls_tx;               /* The kernel encrypts our output */
+    int ktls_record_type;      /* Next write is a control message */
+#endif
+    int gather;                /* Buffer the records of SSL_write() */
+    apr_size_t gathered;       /* Bytes of the records buffered in bb */
+    apr_size_t record_size;    /* Current max plaintext per record */
+    apr_off_t ramp_bytes;      /* Written with small records since idle */
+    apr_time_t last_write;
+    char *wbuf;                /* Small buckets joined for full records,
+                                * released while idle */
+    apr_size_t wlen;
 } bio_filter_out_ctx_t;
 
+static apr_status_t bio_filter_out_ctx_cleanup(void *data)
+{
+    bio_filter_out_ctx_t *outctx = data;
+
+    free(outctx->wbuf);
+    outctx->wbuf = NULL;
+    return APR_SUCCESS;
+}
+
 static bio_filter_out_ctx_t *bio_filter_out_ctx_new(ssl_filter_ctx_t *filter_ctx,
                                                     conn_rec *c)
 {
@@ -126,6 +175,19 @@ static bio_filter_out_ctx_t *bio_filter_out_ctx_new(ssl_filter_ctx_t *filter_ctx
     outctx->filter_ctx = filter_ctx;
     outctx->c = c;
     outctx->bb = apr_brigade_create(c->pool, c->bucket_alloc);
+#ifdef HAVE_SSL_KTLS_TX
+    outctx->ktls_tx = 0;
+    outctx->ktls_record_type = 0;
+#endif
+    outctx->gather = 0;
+    outctx->gathered = 0;
+    outctx->record_size = 0;
+    outctx->ramp_bytes = 0;
+    outctx->last_write = 0;
+    outctx->wbuf = NULL;
+    outctx->wlen = 0;
+    apr_pool_cleanup_register(c->pool, outctx, bio_filter_out_ctx_cleanup,
+                              apr_pool_cleanup_null);
 
     return outctx;
 }
@@ -143,9 +205,20 @@ static int bio_filter_out_pass(bio_filter_out_ctx_t *outctx)
         outctx->rc = APR_ECONNRESET;
     }
     apr_brigade_cleanup(outctx->bb);
+    outctx->gathered = 0;
     return (outctx->rc == APR_SUCCESS) ? 1 : -1;
 }
 
+/* Pass the records gathered so far, if any; returns 1 on success
+ * or -1 on failure. */
+static int bio_filter_out_pass_gathered(bio_filter_out_ctx_t *outctx)
+{
+    if (APR_BRIGADE_EMPTY(outctx->bb)) {
+        return 1;
+    }
+    return bio_filter_out_pass(outctx);
+}
+
 /* Send a FLUSH bucket down the output filter stack; returns 1 on
  * success, -1 on failure. */
 static int bio_filter_out_flush(BIO *bio)
@@ -156,14 +229,131 @@ static int bio_filter_out_flush(BIO *bio)
     ap_log_cerror(APLOG_MARK, APLOG_TRACE6, 0, outctx->c,
                   "bio_filter_out_write: flush");
 
-    AP_DEBUG_ASSERT(APR_BRIGADE_EMPTY(outctx->bb));
-
+    /* Gathered records (if any) go with the flush */
     e = apr_bucket_flush_create(outctx->bb->bucket_alloc);
     APR_BRIGADE_INSERT_TAIL(outctx->bb, e);
 
     return bio_filter_out_pass(outctx);
 }
 
+#ifdef HAVE_SSL_KTLS_TX
+/* Called by OpenSSL (BIO_CTRL_SET_KTLS) when the write keys are ready,
+ * after flushing everything it encrypted so far, to have the kernel
+ * encrypt what we write on the socket from now on.
+ */
+static int bio_filter_out_ktls_start(bio_filter_out_ctx_t *outctx,
+                                     const struct tls_crypto_info *info)
+{
+    apr_socket_t *sock = ap_get_conn_socket(outctx->c);
+    apr_os_sock_t fd;
+    socklen_t len;
+
+    switch (info->cipher_type) {
+    case TLS_CIPHER_AES_GCM_128:
+        len = sizeof(struct tls12_crypto_info_aes_gcm_128);
+        break;
+#ifdef TLS_CIPHER_AES_GCM_256
+    case TLS_CIPHER_AES_GCM_256:
+        len = sizeof(struct tls12_crypto_info_aes_gcm_256);
+        break;
+#endif
+#ifdef TLS_CIPHER_AES_CCM_128
+    case TLS_CIPHER_AES_CCM_128:
+        len = sizeof(struct tls12_crypto_info_aes_ccm_128);
+        break;
+#endif
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+    case TLS_CIPHER_CHACHA20_POLY1305:
+        len = sizeof(struct tls12_crypto_info_chacha20_poly1305);
+        break;
+#endif
+    default:
+        return 0;
+    }
+
+    if (!sock || apr_os_sock_get(&fd, sock) != APR_SUCCESS
+            || setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) < 0
+            || setsockopt(fd, SOL_TLS, TLS_TX, info, len) < 0) {
+        ap_log_cerror(APLOG_MARK, APLOG_DEBUG, errno, outctx->c,
+                      APLOGNO(10408) "kernel TLS not available, "
+                      "encrypting in userland");
+        return 0;
+    }
+
+    ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, outctx->c, APLOGNO(10409)
+                  "kernel TLS enabled for output");
+    outctx->ktls_tx = 1;
+    return 1;
+}
+
+/* Send a TLS control record (handshake, alert) of the ktls_record_type
+ * through the kernel, OpenSSL flushed all the prior output already. */
+static int bio_filter_out_ktls_ctrl_msg(bio_filter_out_ctx_t *outctx,
+                                        const char *in, int inl)
+{
+    apr_socket_t *sock = ap_get_conn_socket(outctx->c);
+    char cbuf[CMSG_SPACE(sizeof(unsigned char))];
+    apr_interval_time_t timeout;
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+    struct iovec iov;
+    apr_os_sock_t fd;
+    int sent = 0;
+
+    apr_os_sock_get(&fd, sock);
+    apr_socket_timeout_get(sock, &timeout);
+
+    while (sent < inl) {
+        ssize_t n;
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = cbuf;
+        msg.msg_controllen = sizeof(cbuf);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_TLS;
+        cmsg->cmsg_type = TLS_SET_RECORD_TYPE;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(unsigned char));
+        *((unsigned char *)CMSG_DATA(cmsg)) =
+            (unsigned char)outctx->ktls_record_type;
+        msg.msg_controllen = cmsg->cmsg_len;
+        iov.iov_base = (char *)in + sent;
+        iov.iov_len = inl - sent;
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+
+        n = sendmsg(fd, &msg, 0);
+        if (n >= 0) {
+            sent += n;
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            apr_pollfd_t pfd;
+            apr_int32_t nfd;
+            apr_status_t rv;
+
+            memset(&pfd, 0, sizeof(pfd));
+            pfd.reqevents = APR_POLLOUT;
+            pfd.desc_type = APR_POLL_SOCKET;
+            pfd.desc.s = sock;
+            pfd.p = outctx->c->pool;
+            do {
+                rv = apr_poll(&pfd, 1, &nfd, timeout);
+            } while (APR_STATUS_IS_EINTR(rv));
+            if (rv != APR_SUCCESS) {
+                outctx->rc = rv;
+                return -1;
+            }
+        }
+        else if (errno != EINTR) {
+            outctx->rc = APR_FROM_OS_ERROR(errno);
+            return -1;
+        }
+    }
+    outctx->ktls_record_type = 0;
+
+    return inl;
+}
+#endif /* HAVE_SSL_KTLS_TX */
+
 static int bio_filter_create(BIO *bio)
 {
     BIO_set_shutdown(bio, 1);
@@ -211,6 +401,29 @@ static int bio_filter_out_write(BIO *bio, const char *in, int inl)
     ap_log_cerror(APLOG_MARK, APLOG_TRACE6, 0, outctx->c,
                   "bio_filter_out_write: %i bytes", inl);
 
+#ifdef HAVE_SSL_KTLS_TX
+    if (outctx->ktls_record_type) {
+        if (bio_filter_out_pass_gathered(outctx) < 0) {
+            return -1;
+        }
+        return bio_filter_out_ktls_ctrl_msg(outctx, in, inl);
+    }
+#endif
+
+    if (outctx->gather) {
+        /* Application data from ssl_filter_write(), keep a copy of the
+         * record (OpenSSL reuses its buffer for the next one) to pass
+         * several of them at once. */
+        e = apr_bucket_heap_create(in, inl, NULL, outctx->bb->bucket_alloc);
+        APR_BRIGADE_INSERT_TAIL(outctx->bb, e);
+        outctx->gathered += inl;
+        if (outctx->gathered >= MODSSL_GATHER_BYTES
+                && bio_filter_out_pass(outctx) < 0) {
+            return -1;
+        }
+        return inl;
+    }
+
     /* Use a transient bucket for the output data - any downstream
      * filter must setaside if necessary. */
     e = apr_bucket_transient_create(in, inl, outctx->bb->bucket_alloc);
@@ -273,6 +486,21 @@ static long bio_filter_out_ctrl(BIO *bio, int cmd, long num, void *ptr)
       case BIO_CTRL_DUP:
         ret = 1;
         break;
+#ifdef HAVE_SSL_KTLS_TX
+      case BIO_CTRL_SET_KTLS:
+        /* num is "is_tx", we let OpenSSL decrypt the input */
+        ret = num ? bio_filter_out_ktls_start(outctx, ptr) : 0;
+        break;
+      case BIO_CTRL_GET_KTLS_SEND:
+        ret = outctx->ktls_tx;
+        break;
+      case BIO_CTRL_SET_KTLS_TX_SEND_CTRL_MSG:
+        outctx->ktls_record_type = (int)num;
+        break;
+      case BIO_CTRL_CLEAR_KTLS_TX_CTRL_MSG:
+        outctx->ktls_record_type = 0;
+        break;
+#endif
         /* N/A */
       case BIO_C_SET_BUF_MEM:
       case BIO_C_GET_BUF_MEM_PTR:
@@ -302,7 +530,7 @@ typedef struct {
     apr_bucket_brigade *bb;
     char_buffer_t cbuf;
     apr_pool_t *pool;
-    char buffer[AP_IOBUFSIZE];
+    char *buffer;              /* AP_IOBUFSIZE, released while idle */
     ssl_filter_ctx_t *filter_ctx;
 } bio_filter_in_ctx_t;
 
@@ -848,6 +1076,46 @@ static apr_status_t ssl_io_input_getline(bio_filter_in_ctx_t *inctx,
 }
 
 
+/* Adjust the size of the records to come (SSLDynamicRecordSizing) */
+static void ssl_filter_size_records(bio_filter_out_ctx_t *outctx,
+                                    apr_size_t len)
+{
+    SSL *ssl = outctx->filter_ctx->pssl;
+    apr_time_t now;
+
+    if (!outctx->record_size) {
+        SSLSrvConfigRec *sc = mySrvConfigFromConn(outctx->c);
+
+        if (sc->dynamic_records == FALSE || outctx->c->outgoing) {
+            outctx->record_size = MODSSL_RECORD_MAX;
+            outctx->last_write = -1; /* never resized */
+            return;
+        }
+        outctx->record_size = MODSSL_RECORD_SMALL;
+        SSL_set_max_send_fragment(ssl, MODSSL_RECORD_SMALL);
+    }
+    else if (outctx->last_write < 0) {
+        return;
+    }
+
+    now = apr_time_now();
+    if (outctx->record_size == MODSSL_RECORD_MAX) {
+        if (now - outctx->last_write > MODSSL_RECORD_IDLE) {
+            outctx->record_size = MODSSL_RECORD_SMALL;
+            outctx->ramp_bytes = 0;
+            SSL_set_max_send_fragment(ssl, MODSSL_RECORD_SMALL);
+        }
+    }
+    else if (outctx->ramp_bytes >= MODSSL_RECORD_RAMP_BYTES) {
+        outctx->record_size = MODSSL_RECORD_MAX;
+        SSL_set_max_send_fragment(ssl, MODSSL_RECORD_MAX);
+    }
+    if (outctx->record_size == MODSSL_RECORD_SMALL) {
+        outctx->ramp_bytes += len;
+    }
+    outctx->last_write = now;
+}
+
 static apr_status_t ssl_filter_write(ap_filter_t *f,
                                      const char *data,
                                      apr_size_t len)
@@ -870,7 +1138,10 @@ static apr_status_t ssl_filter_write(ap_filter_t *f,
     ERR_clear_error();
 
     outctx = (bio_filter_out_ctx_t *)BIO_get_data(filter_ctx->pbioWrite);
+    ssl_filter_size_records(outctx, len);
+    outctx->gather = 1;
     res = SSL_write(filter_ctx->pssl, (unsigned char *)data, len);
+    outctx->gather = 0;
 
     if (res < 0) {
         int ssl_err = SSL_get_error(filter_ctx->pssl, res);
@@ -1274,10 +1545,44 @@ static apr_status_t ssl_io_filter_handshake(ssl_filter_ctx_t *filter_ctx)
         }
 #endif /* defined HAVE_TLSEXT */
 
+        /*
+         * Try to resume a session previously established with this backend
+         * (by any process), keyed by the proxy context, the backend address
+         * and the SNI so that a session never crosses configurations.
+         */
+        if (dc->proxy->ssl_session_reuse == TRUE
+                && myModConfig(server)->sesscache) {
+            SSL_SESSION *session;
+
+            sslconn->proxy_session_key =
+                apr_psprintf(c->pool, "proxy:%pp:%pI:%s", dc->proxy,
+                             c->client_addr,
+                             hostname_note ? hostname_note : "");
+            session = ssl_scache_retrieve(server,
+                          (IDCONST UCHAR *)sslconn->proxy_session_key,
+                          strlen(sslconn->proxy_session_key), c->pool);
+            if (session) {
+                if (!SSL_set_session(filter_ctx->pssl, session)) {
+                    ssl_log_ssl_error(SSLLOG_MARK, APLOG_DEBUG, server);
+                }
+                SSL_SESSION_free(session);
+            }
+            ap_log_cerror(APLOG_MARK, APLOG_TRACE2, 0, c,
+                          "SSL Proxy: session for %s %s",
+                          sslconn->proxy_session_key,
+                          session ? "found" : "not found");
+        }
+
         if ((n = SSL_connect(filter_ctx->pssl)) <= 0) {
             ap_log_cerror(APLOG_MARK, APLOG_INFO, 0, c, APLOGNO(02003)
                           "SSL Proxy connect failed");
             ssl_log_ssl_error(SSLLOG_MARK, APLOG_INFO, server);
+            if (sslconn->proxy_session_key) {
+                /* Don't try to resume it again */
+                ssl_scache_remove(server,
+                                  (IDCONST UCHAR *)sslconn->proxy_session_key,
+                                  strlen(sslconn->proxy_session_key), c->pool);
+            }
             /* ensure that the SSL structures etc are freed, etc: */
             ssl_filter_io_shutdown(filter_ctx, c, 1);
             apr_table_setn(c->notes, "SSL_connect_rv", "err");
@@ -1432,6 +1737,17 @@ static apr_status_t ssl_io_filter_handshake(ssl_filter_ctx_t *filter_ctx)
             outctx->rc = APR_EAGAIN;
             return APR_EAGAIN;
         }
+#ifdef HAVE_SSL_ASYNC
+        else if (ssl_err == SSL_ERROR_WANT_ASYNC) {
+            /*
+             * A crypto operation (e.g. the private key signature) has been
+             * offloaded and its job paused, SSL_accept() must be called
+             * again once it completes, i.e. when SSL_get_all_async_fds()
+             * are readable (see ssl_hook_process_connection()).
+             */
+            return APR_EAGAIN;
+        }
+#endif
         else if (ERR_GET_LIB(ERR_peek_error()) == ERR_LIB_SSL &&
                  ERR_GET_REASON(ERR_peek_error()) == SSL_R_HTTP_REQUEST) {
             /*
@@ -1549,8 +1865,8 @@ static apr_status_t ssl_io_filter_input(ap_filter_t *f,
 {
     apr_status_t status;
     bio_filter_in_ctx_t *inctx = f->ctx;
-    const char *start = inctx->buffer; /* start of block to return */
-    apr_size_t len = sizeof(inctx->buffer); /* length of block to return */
+    const char *start; /* start of block to return */
+    apr_size_t len = AP_IOBUFSIZE; /* length of block to return */
     int is_init = (mode == AP_MODE_INIT);
     apr_bucket *bucket;
 
@@ -1610,6 +1926,11 @@ static apr_status_t ssl_io_filter_input(ap_filter_t *f,
         return APR_SUCCESS;
     }
 
+    if (!inctx->buffer) {
+        inctx->buffer = ap_malloc(AP_IOBUFSIZE);
+    }
+    start = inctx->buffer;
+
     if (inctx->mode == AP_MODE_READBYTES ||
         inctx->mode == AP_MODE_SPECULATIVE) {
         /* Protected from truncation, readbytes < MAX_SIZE_T
@@ -1905,6 +2226,19 @@ static apr_status_t ssl_io_filter_coalesce(ap_filter_t *f,
     return ap_pass_brigade(f->next, bb);
 }
 
+/* Write the small buckets joined so far (for full records), if any */
+static apr_status_t ssl_filter_write_joined(ap_filter_t *f,
+                                            bio_filter_out_ctx_t *outctx)
+{
+    apr_size_t len = outctx->wlen;
+
+    if (!len) {
+        return APR_SUCCESS;
+    }
+    outctx->wlen = 0;
+    return ssl_filter_write(f, outctx->wbuf, len);
+}
+
 static apr_status_t ssl_io_filter_output(ap_filter_t *f,
                                          apr_bucket_brigade *bb)
 {
@@ -1948,6 +2282,7 @@ static apr_status_t ssl_io_filter_output(ap_filter_t *f,
         /* if the core has set aside data, back off and try later */
         if (!flush_upto) {
             if (ap_filter_should_yield(f->next)) {
+                status = ssl_filter_write_joined(f, outctx);
                 break;
             }
         }
@@ -1955,6 +2290,25 @@ static apr_status_t ssl_io_filter_output(ap_filter_t *f,
             flush_upto = NULL;
         }
 
+#ifdef HAVE_SSL_KTLS_TX
+        if (outctx->ktls_tx && !AP_BUCKET_IS_EOC(bucket)) {
+            /* The kernel encrypts, pass everything up to the EOC (if any)
+             * as is, notably FILE buckets for the core to sendfile() them.
+             */
+            do {
+                APR_BUCKET_REMOVE(bucket);
+                APR_BRIGADE_INSERT_TAIL(outctx->bb, bucket);
+                bucket = APR_BRIGADE_FIRST(bb);
+            } while (bucket != APR_BRIGADE_SENTINEL(bb)
+                     && !AP_BUCKET_IS_EOC(bucket));
+            flush_upto = NULL;
+            if (bio_filter_out_pass(outctx) < 0) {
+                status = outctx->rc;
+            }
+            continue;
+        }
+#endif
+
         if (APR_BUCKET_IS_METADATA(bucket)) {
             /* Pass through metadata buckets untouched.  EOC is
              * special; terminate the SSL layer first. */
@@ -1981,6 +2335,9 @@ static apr_status_t ssl_io_filter_output(ap_filter_t *f,
 
             if (APR_STATUS_IS_EAGAIN(status)) {
                 /* No data available: flush... */
+                if ((status = ssl_filter_write_joined(f, outctx))) {
+                    break;
+                }
                 if (bio_filter_out_flush(filter_ctx->pbioWrite) < 0) {
                     status = outctx->rc;
                     break;
@@ -1997,12 +2354,49 @@ static apr_status_t ssl_io_filter_output(ap_filter_t *f,
                 break;
             }
 
+            if (outctx->record_size == MODSSL_RECORD_MAX
+                    && len < MODSSL_RECORD_MAX) {
+                /* Bulk, join the small buckets (e.g. file reads of
+                 * APR_BUCKET_BUFF_SIZE) to fill the records */
+                apr_bucket *next = APR_BUCKET_NEXT(bucket);
+                int more = (next != APR_BRIGADE_SENTINEL(bb)
+                            && !APR_BUCKET_IS_METADATA(next));
+
+                if (outctx->wlen + len > MODSSL_RECORD_MAX) {
+                    if ((status = ssl_filter_write_joined(f, outctx))) {
+                        break;
+                    }
+                }
+                if (more || outctx->wlen) {
+                    if (!outctx->wbuf) {
+                        outctx->wbuf = ap_malloc(MODSSL_RECORD_MAX);
+                    }
+                    memcpy(outctx->wbuf + outctx->wlen, data, len);
+                    outctx->wlen += len;
+                    apr_bucket_delete(bucket);
+                    status = APR_SUCCESS;
+                    if (!more || outctx->wlen == MODSSL_RECORD_MAX) {
+                        status = ssl_filter_write_joined(f, outctx);
+                    }
+                    continue;
+                }
+            }
+            else if ((status = ssl_filter_write_joined(f, outctx))) {
+                break;
+            }
+
             status = ssl_filter_write(f, data, len);
             apr_bucket_delete(bucket);
         }
 
     }
 
+    if (status == APR_SUCCESS) {
+        /* Pass the remaining records gathered by ssl_filter_write() */
+        if (bio_filter_out_pass_gathered(outctx) < 0) {
+            status = outctx->rc;
+        }
+    }
     if (status == APR_SUCCESS) {
         status = ap_filter_setaside_brigade(f, bb);
     }
@@ -2209,6 +2603,15 @@ static apr_status_t ssl_io_filter_buffer(ap_filter_t *f,
     return APR_SUCCESS;
 }
 
+static apr_status_t ssl_io_input_cleanup(void *data)
+{
+    bio_filter_in_ctx_t *inctx = data;
+
+    free(inctx->buffer);
+    inctx->buffer = NULL;
+    return APR_SUCCESS;
+}
+
 /* The request_rec pointer is passed in here only to ensure that the
  * filter chain is modified correctly when doing a TLS upgrade.  It
  * must *not* be used otherwise. */
@@ -2240,7 +2643,10 @@ static apr_status_t ssl_io_input_add_filter(ssl_filter_ctx_t *filter_ctx, conn_r
     inctx->bb = apr_brigade_create(c->pool, c->bucket_alloc);
     inctx->block = APR_BLOCK_READ;
     inctx->pool = c->pool;
+    inctx->buffer = NULL;
     inctx->filter_ctx = filter_ctx;
+    apr_pool_cleanup_register(c->pool, inctx, ssl_io_input_cleanup,
+                              apr_pool_cleanup_null);
     return APR_SUCCESS;
 }
 
@@ -2296,6 +2702,42 @@ apr_status_t ssl_io_filter_init(conn_rec *c, request_rec *r, SSL *ssl)
     return APR_SUCCESS;
 }
 
+/* Release the buffers of a connection which is idle between requests,
+ * i.e. waiting in the keep-alive queue of an async MPM: OpenSSL's read
+ * and write buffers (some 34KB) and our own input and records joining
+ * buffers, which are all allocated again on the next use.  Buffers
+ * still holding data are kept.
+ */
+void ssl_io_filter_idle(conn_rec *c)
+{
+    SSLConnRec *sslconn = myConnConfig(c);
+    bio_filter_in_ctx_t *inctx;
+    bio_filter_out_ctx_t *outctx;
+    BIO *bio;
+
+    if (!sslconn || !sslconn->ssl) {
+        return;
+    }
+
+    if ((bio = SSL_get_rbio(sslconn->ssl))
+            && (inctx = (bio_filter_in_ctx_t *)BIO_get_data(bio))
+            && inctx->buffer && !(inctx->cbuf.b && inctx->cbuf.b->length)) {
+        free(inctx->buffer);
+        inctx->buffer = NULL;
+    }
+    if ((bio = SSL_get_wbio(sslconn->ssl))
+            && (outctx = (bio_filter_out_ctx_t *)BIO_get_data(bio))
+            && outctx->wbuf && !outctx->wlen) {
+        free(outctx->wbuf);
+        outctx->wbuf = NULL;
+    }
+
+#ifdef HAVE_SSL_FREE_BUFFERS
+    /* Fails (harmlessly) if some record is partially read */
+    SSL_free_buffers(sslconn->ssl);
+#endif
+}
+
 void ssl_io_filter_register(apr_pool_t *p)
 {
     ap_register_input_filter  (ssl_io_filter, ssl_io_filter_input,  NULL, AP_FTYPE_CONNECTION + 5);
@@ -2130,6 +2130,49 @@ int ssl_callback_NewSessionCacheEntry(SSL *ssl, SSL_SESSION *session)
     return 0;
 }
 
+/*
+ *  This callback function is executed by OpenSSL whenever a new
+ *  SSL_SESSION (or TLSv1.3 ticket) is received from a remote server
+ *  when proxying with SSLProxySessionReuse. It is stored in the
+ *  inter-process cache under the key of the connection, so that any
+ *  process can resume it when it reconnects to the same backend.
+ */
+int ssl_callback_NewProxySessionCacheEntry(SSL *ssl, SSL_SESSION *session)
+{
+    conn_rec *conn      = (conn_rec *)SSL_get_app_data(ssl);
+    SSLConnRec *sslconn = myConnConfig(conn);
+    server_rec *s;
+    SSLSrvConfigRec *sc;
+    long timeout;
+    BOOL rc;
+
+    if (!sslconn || !sslconn->proxy_session_key) {
+        return 0;
+    }
+    s = mySrvFromConn(conn);
+    sc = mySrvConfig(s);
+
+    /* Don't keep it longer than the server allows, nor than we would */
+    timeout = SSL_SESSION_get_timeout(session);
+    if (timeout <= 0 || timeout > sc->session_cache_timeout) {
+        timeout = sc->session_cache_timeout;
+    }
+
+    rc = ssl_scache_store(s, (IDCONST UCHAR *)sslconn->proxy_session_key,
+                          strlen(sslconn->proxy_session_key),
+                          apr_time_from_sec(SSL_SESSION_get_time(session)
+                                          + timeout),
+                          session, conn->pool);
+
+    ap_log_cerror(APLOG_MARK, APLOG_TRACE2, 0, conn,
+                  "SSL Proxy: %s session for %s (timeout=%lds)",
+                  rc == TRUE ? "cached" : "failed to cache",
+                  sslconn->proxy_session_key, timeout);
+
+    /* Not retained by us */
+    return 0;
+}
+
 /*
  *  This callback function is executed by OpenSSL whenever a
  *  SSL_SESSION is looked up in the internal OpenSSL cache and it
@@ -2407,7 +2450,6 @@ static apr_status_t init_vhost(conn_rec *c, SSL *ssl, const char *servername)
                               servername);
 
                 sslcon->vhost_found = +1;
-                return APR_SUCCESS;
             }
             else {
                 ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, c, APLOGNO(02044)
@@ -2436,6 +2478,14 @@ static apr_status_t init_vhost(conn_rec *c, SSL *ssl, const char *servername)
                           "Server name not provided via TLS extension "
                           "(using default/first virtual host)");
         }
+
+#ifdef HAVE_SSL_CERT_RELOAD
+        /* the certificates of the vhost may have changed since startup */
+        ssl_reload_apply(c, ssl, mySrvConfig(sslcon->server)->server);
+#endif
+        if (sslcon->vhost_found > 0) {
+            return APR_SUCCESS;
+        }
     }
     
     return APR_NOTFOUND;
@@ -2613,10 +2663,84 @@ static int ssl_find_vhost(void *servername, conn_rec *c, server_rec *s)
 #endif /* HAVE_TLSEXT */
 
 #ifdef HAVE_TLS_SESSION_TICKETS
+/*
+ * Session ticket callback for the keys rotated in shared memory
+ * (SSLSessionTicketKeyRotation), when no SSLSessionTicketKeyFile is
+ * configured.
+ */
+static int ssl_callback_SessionTicketRotated(conn_rec *c,
+                                             server_rec *s,
+                                             unsigned char *keyname,
+                                             unsigned char *iv,
+                                             EVP_CIPHER_CTX *cipher_ctx,
+#if OPENSSL_VERSION_NUMBER < 0x30000000L
+                                             HMAC_CTX *hmac_ctx,
+#else
+                                             EVP_MAC_CTX *mac_ctx,
+#endif
+                                             int mode)
+{
+    SSLSrvConfigRec *sc = mySrvConfig(s);
+    modssl_ticket_rkey_t key;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    OSSL_PARAM mac_params[3];
+#endif
+    int rv;
+
+    if (mode == 1) {
+        if (!ssl_scache_ticket_key(s, NULL, &key)) {
+            /* no ticket */
+            return 0;
+        }
+        memcpy(keyname, key.key_name, 16);
+        if (RAND_bytes(iv, EVP_MAX_IV_LENGTH) != 1) {
+            OPENSSL_cleanse(&key, sizeof(key));
+            return -1;
+        }
+        EVP_EncryptInit_ex(cipher_ctx, EVP_aes_128_cbc(), NULL,
+                           key.aes_key, iv);
+        rv = 1;
+    }
+    else if (mode == 0) {
+        rv = ssl_scache_ticket_key(s, keyname, &key);
+        if (!rv) {
+            return 0;
+        }
+        EVP_DecryptInit_ex(cipher_ctx, EVP_aes_128_cbc(), NULL,
+                           key.aes_key, iv);
+    }
+    else {
+        return -1;
+    }
+
+#if OPENSSL_VERSION_NUMBER < 0x30000000L
+    HMAC_Init_ex(hmac_ctx, key.hmac_secret, 16, tlsext_tick_md(), NULL);
+#else
+    mac_params[0] =
+        OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY,
+                                          key.hmac_secret, 16);
+    mac_params[1] =
+        OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, "sha256", 0);
+    mac_params[2] =
+        OSSL_PARAM_construct_end();
+    EVP_MAC_CTX_set_params(mac_ctx, mac_params);
+#endif
+    OPENSSL_cleanse(&key, sizeof(key));
+
+    ap_log_cerror(APLOG_MARK, APLOG_TRACE1, 0, c,
+                  "TLS session ticket key for %s (rotated) successfully set, "
+                  "%s session ticket", sc->vhost_id,
+                  mode ? "creating new" : (rv == 2) ? "renewing existing"
+                                                    : "decrypting existing");
+    /* When decrypting with a previous key, 2 asks OpenSSL for a new ticket */
+    return rv;
+}
+
 /*
  * This callback function is executed when OpenSSL needs a key for encrypting/
  * decrypting a TLS session ticket (RFC 5077) and a ticket key file has been
- * configured through SSLSessionTicketKeyFile.
+ * configured through SSLSessionTicketKeyFile, or keys are rotated through
+ * SSLSessionTicketKeyRotation.
  */
 int ssl_callback_SessionTicket(SSL *ssl,
                                unsigned char *keyname,
@@ -2635,6 +2759,16 @@ int ssl_callback_SessionTicket(SSL *ssl,
     modssl_ctx_t *mctx = myConnCtxConfig(c, sc);
     modssl_ticket_key_t *ticket_key = mctx->ticket_key;
 
+    if (ticket_key && !ticket_key->file_path) {
+#if OPENSSL_VERSION_NUMBER < 0x30000000L
+        return ssl_callback_SessionTicketRotated(c, s, keyname, iv,
+                                                 cipher_ctx, hmac_ctx, mode);
+#else
+        return ssl_callback_SessionTicketRotated(c, s, keyname, iv,
+                                                 cipher_ctx, mac_ctx, mode);
+#endif
+    }
+
     if (mode == 1) {
         /* 
          * OpenSSL is asking for a key for encrypting a ticket,
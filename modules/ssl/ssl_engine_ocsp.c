@@ -154,7 +154,7 @@ static int verify_ocsp_status(X509 *cert, X509_STORE_CTX *ctx, conn_rec *c,
         apr_interval_time_t to = sc->server->ocsp_responder_timeout == UNSET ?
                                  apr_time_from_sec(DEFAULT_OCSP_TIMEOUT) :
                                  sc->server->ocsp_responder_timeout;
-        response = modssl_dispatch_ocsp_request(ruri, to, request, c, pool);
+        response = modssl_dispatch_ocsp_request(ruri, to, request, c, s, pool);
     }
 
     if (!request || !response) {
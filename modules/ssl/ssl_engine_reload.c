@@ -0,0 +1,792 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*                      _             _
+ *  _ __ ___   ___   __| |    ___ ___| |  mod_ssl
+ * | '_ ` _ \ / _ \ / _` |   / __/ __| |  Apache Interface to OpenSSL
+ * | | | | | | (_) | (_| |   \__ \__ \ |
+ * |_| |_| |_|\___/ \__,_|___|___/___/_|
+ *                      |_____|
+ *  ssl_engine_reload.c
+ *  Certificate Reload and Lazy Loading
+ */
+                             /* ``Certificates expire,
+                                  children shouldn't.''
+                                             -- Unknown */
+
+#include "ssl_private.h"
+
+#ifdef HAVE_SSL_CERT_RELOAD
+
+#include "apr_atomic.h"
+#include "apr_shm.h"
+
+/*
+ * SSLCertificateReload: the parent process, which can read the private
+ * keys, looks for changed certificate and key files of the server contexts
+ * at the configured interval (from the monitor hook). It checks the new
+ * files and appends them as one record per context to a ring in anonymous
+ * shared memory. Before the ClientHello is answered, each child picks up
+ * the records it has not seen yet, builds the certificates and keys of the
+ * context from them and publishes these with an atomic pointer swap, so
+ * that the handshakes which follow use them with SSL_use_cert_and_key().
+ * The sets replaced are freed after a grace period, when no handshake can
+ * still be using the pointer it read.
+ *
+ * Only the parent writes the ring, so there is no lock: the descriptor of
+ * a record is invalidated before its data is overwritten, and a child
+ * reading the record checks the descriptor again once it has copied the
+ * data. A child lapped by the writer misses the records overwritten, which
+ * is logged (the size of the ring is configurable).
+ *
+ * SSLCertificateLazyLoad: the startup only checks that the files of the
+ * server contexts exist, and a child loads the certificates of a context
+ * when a handshake first needs them, publishing them the same way. At most
+ * the configured number of contexts have their certificates loaded in a
+ * child, the least recently used ones being unloaded (retired) beyond.
+ */
+
+/* Records (contexts reloaded) a child may be behind at most */
+#define RELOAD_DESCS 1024
+
+/* Largest certificate or key file read */
+#define RELOAD_FILE_MAX (256 * 1024)
+
+/* Time after which a replaced set of certificates is no longer used */
+#define RELOAD_GRACE apr_time_from_sec(60)
+
+typedef struct {
+    apr_uint32_t seq;       /* record number + 1, or 0 when not valid */
+    apr_uint32_t id;        /* of the context reloaded */
+    apr_uint32_t offset;    /* of the data in the ring */
+    apr_uint32_t len;       /* of the data */
+} reload_desc_t;
+
+typedef struct {
+    apr_uint32_t count;     /* records published so far */
+    apr_uint32_t size;      /* of the data ring following this header */
+    reload_desc_t descs[RELOAD_DESCS];
+} reload_area_t;
+
+#define RELOAD_RING(area) ((char *)(area) + APR_ALIGN_DEFAULT(sizeof(*(area))))
+
+typedef struct {
+    X509 *cert;
+    STACK_OF(X509) *chain;  /* NULL for the SSLCertificateChainFile one */
+    EVP_PKEY *key;
+} reload_pair_t;
+
+typedef struct reload_certs_t reload_certs_t;
+struct reload_certs_t {
+    int count;
+    reload_pair_t *pairs;
+    apr_time_t retired;     /* when replaced */
+    reload_certs_t *next;   /* in the list of replaced sets */
+};
+
+struct modssl_reload_t {
+    apr_uint32_t id;
+    server_rec *s;
+    int count;              /* cert/key pairs */
+    const char **files;     /* certificate then key file of each pair */
+    apr_finfo_t *finfos;    /* their mtime and size when last read */
+    volatile void *certs;   /* reload_certs_t last reloaded by the child */
+    apr_uint32_t used;      /* last handshake using them (seconds), lazy */
+    apr_time_t failed;      /* last failure to load them, lazy */
+};
+
+/* Set up by the parent, inherited by the children */
+static apr_shm_t *reload_shm;
+static reload_area_t *reload_area;
+static apr_array_header_t *reload_ctxs;
+
+/* Parent only: writer state */
+static apr_time_t reload_next_check;
+static apr_uint32_t reload_head;    /* offset of the next record */
+static apr_uint32_t reload_oldest;  /* oldest record still valid */
+
+/* Child only: reader state, and the lazily loaded contexts */
+static apr_uint32_t reload_seen;
+static reload_certs_t *reload_retired;
+static apr_array_header_t *lazy_loaded;
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *reload_mutex;
+#endif
+
+/* Time before trying again to load certificates which failed, lazy */
+#define LAZY_RETRY apr_time_from_sec(60)
+
+static int reload_no_passwd_cb(char *buf, int size, int rwflag, void *u)
+{
+    return 0;
+}
+
+static void reload_certs_free(reload_certs_t *certs)
+{
+    int i;
+
+    for (i = 0; i < certs->count; i++) {
+        X509_free(certs->pairs[i].cert);
+        EVP_PKEY_free(certs->pairs[i].key);
+        if (certs->pairs[i].chain) {
+            sk_X509_pop_free(certs->pairs[i].chain, X509_free);
+        }
+    }
+    free(certs->pairs);
+    free(certs);
+}
+
+static const char *reload_pair_parse(modssl_ctx_t *mctx, reload_pair_t *pair,
+                                     const char *cert_pem, apr_uint32_t clen,
+                                     const char *key_pem, apr_uint32_t klen)
+{
+    const char *err = NULL;
+    BIO *bio;
+    X509 *x;
+
+    if (!(bio = BIO_new_mem_buf(cert_pem, (int)clen))) {
+        return "out of memory";
+    }
+    pair->cert = PEM_read_bio_X509_AUX(bio, NULL, reload_no_passwd_cb, NULL);
+    if (!pair->cert) {
+        BIO_free(bio);
+        return "no certificate found";
+    }
+    /* like SSL_CTX_use_certificate_chain_file(), unless the chain is
+     * configured separately and comes from the SSL_CTX */
+    if (!mctx->cert_chain) {
+        while ((x = PEM_read_bio_X509(bio, NULL, reload_no_passwd_cb, NULL))) {
+            if ((!pair->chain && !(pair->chain = sk_X509_new_null()))
+                || !sk_X509_push(pair->chain, x)) {
+                X509_free(x);
+                err = "out of memory";
+                break;
+            }
+        }
+    }
+    BIO_free(bio);
+    ERR_clear_error();
+    if (err) {
+        return err;
+    }
+
+    if (!(bio = BIO_new_mem_buf(key_pem, (int)klen))) {
+        return "out of memory";
+    }
+    pair->key = PEM_read_bio_PrivateKey(bio, NULL, reload_no_passwd_cb, NULL);
+    BIO_free(bio);
+    if (!pair->key) {
+        ERR_clear_error();
+        return "no (unencrypted) private key found";
+    }
+    if (X509_check_private_key(pair->cert, pair->key) < 1) {
+        ERR_clear_error();
+        return "certificate and private key do not match";
+    }
+    return NULL;
+}
+
+/* Build the certificates of mctx from a record's data: for each pair, the
+ * lengths of the certificate and key PEM followed by them. */
+static const char *reload_certs_parse(modssl_ctx_t *mctx, const char *data,
+                                      apr_size_t len, reload_certs_t **pcerts)
+{
+    modssl_reload_t *reload = mctx->reload;
+    reload_certs_t *certs;
+    apr_uint32_t clen, klen;
+    const char *err = NULL;
+    int i;
+
+    certs = ap_calloc(1, sizeof(*certs));
+    certs->pairs = ap_calloc(reload->count, sizeof(*certs->pairs));
+    certs->count = reload->count;
+
+    for (i = 0; i < reload->count && !err; i++) {
+        if (len < 2 * sizeof(apr_uint32_t)) {
+            err = "truncated record";
+            break;
+        }
+        memcpy(&clen, data, sizeof(clen));
+        memcpy(&klen, data + sizeof(clen), sizeof(klen));
+        data += 2 * sizeof(apr_uint32_t);
+        len -= 2 * sizeof(apr_uint32_t);
+        if (clen > len || klen > len - clen) {
+            err = "truncated record";
+            break;
+        }
+        err = reload_pair_parse(mctx, &certs->pairs[i],
+                                data, clen, data + clen, klen);
+        data += clen + klen;
+        len -= clen + klen;
+    }
+    if (err) {
+        reload_certs_free(certs);
+        certs = NULL;
+    }
+    *pcerts = certs;
+    return err;
+}
+
+void ssl_reload_init(server_rec *s, apr_pool_t *p)
+{
+    SSLModConfigRec *mc = myModConfig(s);
+    apr_size_t size;
+    apr_status_t rv;
+
+    reload_shm = NULL;
+    reload_area = NULL;
+    reload_ctxs = NULL;
+    reload_next_check = 0;
+    reload_head = reload_oldest = 0;
+    reload_seen = 0;
+
+    if ((mc->cert_reload <= 0 && mc->cert_lazy <= 0)
+        || ap_state_query(AP_SQ_RUN_MODE) != AP_SQ_RM_NORMAL) {
+        return;
+    }
+    reload_ctxs = apr_array_make(p, 16, sizeof(modssl_ctx_t *));
+    if (mc->cert_reload <= 0) {
+        return;
+    }
+
+    /* The children of the previous generations keep their own mapping
+     * after a restart, when the new one is created along with pconf: the
+     * certificates are all loaded again by then. */
+    size = APR_ALIGN_DEFAULT(sizeof(reload_area_t)) + mc->cert_reload_size;
+    rv = apr_shm_create(&reload_shm, size, NULL, p);
+    if (APR_STATUS_IS_ENOTIMPL(rv)) {
+        const char *fname = ap_runtime_dir_relative(p, "ssl_cert_reload");
+        apr_shm_remove(fname, p);
+        rv = apr_shm_create(&reload_shm, size, fname, p);
+    }
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10474)
+                     "Could not create the shared memory for reloading "
+                     "certificates, changes will only apply on restart "
+                     "(SSLCertificateReload)");
+        reload_shm = NULL;
+        return;
+    }
+    reload_area = apr_shm_baseaddr_get(reload_shm);
+    memset(reload_area, 0, sizeof(*reload_area));
+    reload_area->size = (apr_uint32_t)mc->cert_reload_size;
+
+    reload_next_check = apr_time_now() + mc->cert_reload;
+}
+
+apr_status_t ssl_reload_register(server_rec *s, apr_pool_t *p,
+                                 modssl_ctx_t *mctx)
+{
+    modssl_reload_t *reload;
+    apr_status_t rv;
+    int i, nkeys;
+
+    if (!reload_ctxs || !mctx->pks->cert_files->nelts) {
+        return APR_SUCCESS;
+    }
+
+    reload = apr_pcalloc(p, sizeof(*reload));
+    reload->id = (apr_uint32_t)reload_ctxs->nelts;
+    reload->s = s;
+    reload->count = mctx->pks->cert_files->nelts;
+    reload->files = apr_pcalloc(p, 2 * reload->count * sizeof(char *));
+    reload->finfos = apr_pcalloc(p, 2 * reload->count * sizeof(apr_finfo_t));
+
+    nkeys = mctx->pks->key_files->nelts;
+    for (i = 0; i < reload->count; i++) {
+        reload->files[2 * i] = APR_ARRAY_IDX(mctx->pks->cert_files, i,
+                                             const char *);
+        reload->files[2 * i + 1] = (i < nkeys)
+                                   ? APR_ARRAY_IDX(mctx->pks->key_files, i,
+                                                   const char *)
+                                   : reload->files[2 * i];
+    }
+    for (i = 0; i < 2 * reload->count; i++) {
+        rv = apr_stat(&reload->finfos[i], reload->files[i],
+                      APR_FINFO_MTIME | APR_FINFO_SIZE, p);
+        if (rv != APR_SUCCESS && mctx->lazy_certs) {
+            /* all that the startup checks */
+            ap_log_error(APLOG_MARK, APLOG_EMERG, rv, s, APLOGNO(10485)
+                         "Certificate %s:%d of %s is not accessible",
+                         mctx->sc->vhost_id, i / 2, reload->files[i]);
+            return rv;
+        }
+    }
+
+    mctx->reload = reload;
+    APR_ARRAY_PUSH(reload_ctxs, modssl_ctx_t *) = mctx;
+    return APR_SUCCESS;
+}
+
+void ssl_reload_child_init(apr_pool_t *p, server_rec *s)
+{
+    if (!reload_ctxs) {
+        return;
+    }
+    lazy_loaded = apr_array_make(p, 16, sizeof(modssl_ctx_t *));
+#if APR_HAS_THREADS
+    apr_thread_mutex_create(&reload_mutex, APR_THREAD_MUTEX_DEFAULT, p);
+#endif
+}
+
+static apr_status_t reload_read_file(const char *fname, apr_pool_t *p,
+                                     char **pdata, apr_uint32_t *plen);
+
+/* Read all the files of mctx in the layout of a record, for the pairs are
+ * replaced as a whole */
+static apr_status_t reload_record_read(modssl_ctx_t *mctx, apr_pool_t *p,
+                                       char **pdata, apr_uint32_t *plen,
+                                       int *pfailed)
+{
+    modssl_reload_t *reload = mctx->reload;
+    apr_uint32_t len = 0, clen, klen;
+    char *data = NULL, *pos, *cert, *key;
+    apr_status_t rv;
+    int i;
+
+    for (i = 0; i < reload->count; i++) {
+        *pfailed = i;
+        if ((rv = reload_read_file(reload->files[2 * i], p, &cert, &clen))
+            || (rv = reload_read_file(reload->files[2 * i + 1], p,
+                                      &key, &klen))) {
+            return rv;
+        }
+        pos = apr_palloc(p, len + 2 * sizeof(apr_uint32_t) + clen + klen);
+        if (data) {
+            memcpy(pos, data, len);
+        }
+        data = pos;
+        pos += len;
+        memcpy(pos, &clen, sizeof(clen));
+        memcpy(pos + sizeof(clen), &klen, sizeof(klen));
+        pos += 2 * sizeof(apr_uint32_t);
+        memcpy(pos, cert, clen);
+        memcpy(pos + clen, key, klen);
+        len += 2 * sizeof(apr_uint32_t) + clen + klen;
+    }
+    *pdata = data;
+    *plen = len;
+    return APR_SUCCESS;
+}
+
+/*  _________________________________________________________________
+**
+**  Parent: watching the files and writing the ring
+**  _________________________________________________________________
+*/
+
+/* Invalidate the oldest records in the ring while they overlap the region
+ * [offset, offset + len) about to be written */
+static void reload_ring_invalidate(apr_uint32_t offset, apr_uint32_t len)
+{
+    reload_desc_t *desc;
+
+    while (reload_oldest != reload_area->count) {
+        desc = &reload_area->descs[reload_oldest % RELOAD_DESCS];
+        if (desc->offset >= offset + len || desc->offset + desc->len <= offset) {
+            break;
+        }
+        apr_atomic_set32(&desc->seq, 0);
+        reload_oldest++;
+    }
+}
+
+static apr_status_t reload_ring_append(modssl_reload_t *reload,
+                                       const char *data, apr_uint32_t len)
+{
+    apr_uint32_t seq = reload_area->count, offset = reload_head;
+    reload_desc_t *desc;
+
+    if (len > reload_area->size) {
+        return APR_ENOSPC;
+    }
+    if (len > reload_area->size - offset) {
+        /* the end of the ring is skipped, so are the records there */
+        reload_ring_invalidate(offset, reload_area->size - offset);
+        offset = 0;
+    }
+    reload_ring_invalidate(offset, len);
+    if (seq - reload_oldest >= RELOAD_DESCS) {
+        desc = &reload_area->descs[reload_oldest % RELOAD_DESCS];
+        apr_atomic_set32(&desc->seq, 0);
+        reload_oldest++;
+    }
+
+    memcpy(RELOAD_RING(reload_area) + offset, data, len);
+    desc = &reload_area->descs[seq % RELOAD_DESCS];
+    desc->id = reload->id;
+    desc->offset = offset;
+    desc->len = len;
+    apr_atomic_set32(&desc->seq, seq + 1);
+    apr_atomic_set32(&reload_area->count, seq + 1);
+
+    reload_head = APR_ALIGN_DEFAULT(offset + len);
+    if (reload_head > reload_area->size) {
+        reload_head = reload_area->size;
+    }
+    return APR_SUCCESS;
+}
+
+static apr_status_t reload_read_file(const char *fname, apr_pool_t *p,
+                                     char **pdata, apr_uint32_t *plen)
+{
+    apr_file_t *fd;
+    apr_finfo_t finfo;
+    apr_size_t len;
+    apr_status_t rv;
+
+    if ((rv = apr_file_open(&fd, fname, APR_FOPEN_READ, 0, p))) {
+        return rv;
+    }
+    rv = apr_file_info_get(&finfo, APR_FINFO_SIZE, fd);
+    if (rv == APR_SUCCESS && finfo.size > RELOAD_FILE_MAX) {
+        rv = APR_EINVAL;
+    }
+    if (rv == APR_SUCCESS) {
+        len = (apr_size_t)finfo.size;
+        *pdata = apr_palloc(p, len + 1);
+        rv = apr_file_read_full(fd, *pdata, len, &len);
+        (*pdata)[len] = '\0';
+        *plen = (apr_uint32_t)len;
+    }
+    apr_file_close(fd);
+    return rv;
+}
+
+static void reload_check(modssl_ctx_t *mctx, apr_pool_t *ptemp)
+{
+    modssl_reload_t *reload = mctx->reload;
+    apr_finfo_t *finfos;
+    reload_certs_t *certs;
+    apr_uint32_t len;
+    char *data;
+    const char *err;
+    apr_status_t rv;
+    int i, failed, changed = 0;
+
+    finfos = apr_pcalloc(ptemp, 2 * reload->count * sizeof(apr_finfo_t));
+    for (i = 0; i < 2 * reload->count; i++) {
+        if (apr_stat(&finfos[i], reload->files[i],
+                     APR_FINFO_MTIME | APR_FINFO_SIZE, ptemp) != APR_SUCCESS) {
+            /* possibly being replaced, check again next time */
+            return;
+        }
+        if (finfos[i].mtime != reload->finfos[i].mtime
+            || finfos[i].size != reload->finfos[i].size) {
+            changed = 1;
+        }
+    }
+    if (!changed) {
+        return;
+    }
+    for (i = 0; i < 2 * reload->count; i++) {
+        reload->finfos[i].mtime = finfos[i].mtime;
+        reload->finfos[i].size = finfos[i].size;
+    }
+
+    if ((rv = reload_record_read(mctx, ptemp, &data, &len, &failed))) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, rv, reload->s, APLOGNO(10475)
+                     "Could not reload certificate %s:%d of %s",
+                     mctx->sc->vhost_id, failed, reload->files[2 * failed]);
+        return;
+    }
+
+    /* Don't bother the children with what they could not use */
+    if ((err = reload_certs_parse(mctx, data, len, &certs))) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, reload->s, APLOGNO(10476)
+                     "Changed certificates of %s not reloaded: %s",
+                     mctx->sc->vhost_id, err);
+        return;
+    }
+    reload_certs_free(certs);
+
+    if ((rv = reload_ring_append(reload, data, len))) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, reload->s, APLOGNO(10477)
+                     "Changed certificates of %s not reloaded: %u bytes "
+                     "don't fit in the shared memory (SSLCertificateReload)",
+                     mctx->sc->vhost_id, len);
+        return;
+    }
+    ap_log_error(APLOG_MARK, APLOG_NOTICE, 0, reload->s, APLOGNO(10478)
+                 "Certificates of %s changed and reloaded from %s",
+                 mctx->sc->vhost_id, reload->files[0]);
+}
+
+int ssl_reload_monitor(apr_pool_t *p, server_rec *s)
+{
+    SSLModConfigRec *mc;
+    apr_pool_t *ptemp;
+    apr_time_t now;
+    int i;
+
+    if (!reload_area || !reload_ctxs->nelts) {
+        return DECLINED;
+    }
+    now = apr_time_now();
+    if (now < reload_next_check) {
+        return DECLINED;
+    }
+    mc = myModConfig(s);
+    reload_next_check = now + mc->cert_reload;
+
+    apr_pool_create(&ptemp, p);
+    apr_pool_tag(ptemp, "ssl_reload");
+    for (i = 0; i < reload_ctxs->nelts; i++) {
+        reload_check(APR_ARRAY_IDX(reload_ctxs, i, modssl_ctx_t *), ptemp);
+        apr_pool_clear(ptemp);
+    }
+    apr_pool_destroy(ptemp);
+
+    return DECLINED;
+}
+
+/*  _________________________________________________________________
+**
+**  Child: reading the ring and using the certificates
+**  _________________________________________________________________
+*/
+
+static int reload_lock(int wait)
+{
+#if APR_HAS_THREADS
+    if (reload_mutex) {
+        return (wait ? apr_thread_mutex_lock(reload_mutex)
+                     : apr_thread_mutex_trylock(reload_mutex)) == APR_SUCCESS;
+    }
+#endif
+    return 1;
+}
+
+static void reload_unlock(void)
+{
+#if APR_HAS_THREADS
+    if (reload_mutex) {
+        apr_thread_mutex_unlock(reload_mutex);
+    }
+#endif
+}
+
+static void reload_retire(reload_certs_t *certs)
+{
+    if (certs) {
+        certs->retired = apr_time_now();
+        certs->next = reload_retired;
+        reload_retired = certs;
+    }
+}
+
+static void reload_update(conn_rec *c)
+{
+    apr_uint32_t count, seq, id, offset, len, missed = 0;
+    modssl_ctx_t *mctx;
+    reload_desc_t *desc;
+    reload_certs_t *certs, **prev;
+    char *data;
+    const char *err;
+    apr_time_t now;
+
+    if (!reload_lock(0)) {
+        /* another thread is at it */
+        return;
+    }
+
+    count = reload_area ? apr_atomic_read32(&reload_area->count) : 0;
+    for (seq = reload_seen; seq != count; seq++) {
+        desc = &reload_area->descs[seq % RELOAD_DESCS];
+        if (apr_atomic_read32(&desc->seq) != seq + 1) {
+            missed++;
+            continue;
+        }
+        id = desc->id;
+        offset = desc->offset;
+        len = desc->len;
+        if (id >= (apr_uint32_t)reload_ctxs->nelts
+            || offset > reload_area->size
+            || len > reload_area->size - offset) {
+            missed++;
+            continue;
+        }
+        mctx = APR_ARRAY_IDX(reload_ctxs, id, modssl_ctx_t *);
+        if (mctx->lazy_certs
+            && !apr_atomic_casptr(&mctx->reload->certs, NULL, NULL)) {
+            /* not loaded, the files will be read when needed */
+            continue;
+        }
+        data = ap_malloc(len ? len : 1);
+        memcpy(data, RELOAD_RING(reload_area) + offset, len);
+        if (apr_atomic_read32(&desc->seq) != seq + 1) {
+            free(data);
+            missed++;
+            continue;
+        }
+
+        err = reload_certs_parse(mctx, data, len, &certs);
+        free(data);
+        if (err) {
+            ap_log_cerror(APLOG_MARK, APLOG_ERR, 0, c, APLOGNO(10479)
+                          "Could not use the reloaded certificates of %s: %s",
+                          mctx->sc->vhost_id, err);
+            continue;
+        }
+
+        reload_retire(apr_atomic_xchgptr(&mctx->reload->certs, certs));
+        ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, c,
+                      "using the reloaded certificates of %s",
+                      mctx->sc->vhost_id);
+    }
+    reload_seen = count;
+
+    if (missed) {
+        ap_log_cerror(APLOG_MARK, APLOG_WARNING, 0, c, APLOGNO(10480)
+                      "%u reloaded certificate set(s) overwritten before "
+                      "this child could use them, the shared memory is "
+                      "too small (SSLCertificateReload)", missed);
+    }
+
+    /* Free the sets no handshake can still be using */
+    now = apr_time_now();
+    for (prev = &reload_retired; (certs = *prev);) {
+        if (now - certs->retired > RELOAD_GRACE) {
+            *prev = certs->next;
+            reload_certs_free(certs);
+        }
+        else {
+            prev = &certs->next;
+        }
+    }
+
+    reload_unlock();
+}
+
+/* Load the certificates of mctx in this child, unloading those of the least
+ * recently used context when SSLCertificateLazyLoad's maximum is reached */
+static reload_certs_t *lazy_load(conn_rec *c, modssl_ctx_t *mctx)
+{
+    modssl_reload_t *reload = mctx->reload;
+    SSLModConfigRec *mc = myModConfig(c->base_server);
+    reload_certs_t *certs = NULL, *old;
+    modssl_ctx_t **loaded;
+    apr_uint32_t len;
+    apr_pool_t *ptemp;
+    apr_time_t now;
+    apr_status_t rv;
+    char *data;
+    const char *err;
+    int i, n, lru, failed;
+
+    reload_lock(1);
+
+    /* another thread may have loaded them meanwhile */
+    if ((certs = apr_atomic_casptr(&reload->certs, NULL, NULL))) {
+        goto leave;
+    }
+    now = apr_time_now();
+    if (reload->failed && now - reload->failed < LAZY_RETRY) {
+        goto leave;
+    }
+
+    apr_pool_create(&ptemp, c->pool);
+    apr_pool_tag(ptemp, "ssl_lazy_load");
+    rv = reload_record_read(mctx, ptemp, &data, &len, &failed);
+    if (rv != APR_SUCCESS) {
+        ap_log_cerror(APLOG_MARK, APLOG_ERR, rv, c, APLOGNO(10486)
+                      "Could not load certificate %s:%d of %s",
+                      mctx->sc->vhost_id, failed, reload->files[2 * failed]);
+    }
+    else if ((err = reload_certs_parse(mctx, data, len, &certs))) {
+        ap_log_cerror(APLOG_MARK, APLOG_ERR, 0, c, APLOGNO(10487)
+                      "Could not load the certificates of %s: %s",
+                      mctx->sc->vhost_id, err);
+    }
+    apr_pool_destroy(ptemp);
+    if (!certs) {
+        /* the handshake fails with no certificate, keep retries rare */
+        reload->failed = now;
+        goto leave;
+    }
+    reload->failed = 0;
+
+    loaded = (modssl_ctx_t **)lazy_loaded->elts;
+    n = lazy_loaded->nelts;
+    if (n >= mc->cert_lazy) {
+        for (lru = 0, i = 1; i < n; i++) {
+            if (apr_atomic_read32(&loaded[i]->reload->used)
+                < apr_atomic_read32(&loaded[lru]->reload->used)) {
+                lru = i;
+            }
+        }
+        old = apr_atomic_xchgptr(&loaded[lru]->reload->certs, NULL);
+        reload_retire(old);
+        ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, c,
+                      "unloaded the certificates of %s",
+                      loaded[lru]->sc->vhost_id);
+        loaded[lru] = mctx;
+    }
+    else {
+        APR_ARRAY_PUSH(lazy_loaded, modssl_ctx_t *) = mctx;
+    }
+    apr_atomic_set32(&reload->used, (apr_uint32_t)apr_time_sec(now));
+    apr_atomic_xchgptr(&reload->certs, certs);
+    ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, c,
+                  "loaded the certificates of %s", mctx->sc->vhost_id);
+
+leave:
+    reload_unlock();
+    return certs;
+}
+
+void ssl_reload_apply(conn_rec *c, SSL *ssl, modssl_ctx_t *mctx)
+{
+    reload_certs_t *certs;
+    int i;
+
+    if (!reload_ctxs) {
+        return;
+    }
+    if ((reload_area
+         && apr_atomic_read32(&reload_area->count) != reload_seen)
+        || reload_retired) {
+        reload_update(c);
+    }
+    if (!mctx->reload) {
+        return;
+    }
+    certs = apr_atomic_casptr(&mctx->reload->certs, NULL, NULL);
+    if (mctx->lazy_certs) {
+        if (!certs && !(certs = lazy_load(c, mctx))) {
+            return;
+        }
+        apr_atomic_set32(&mctx->reload->used,
+                         (apr_uint32_t)apr_time_sec(apr_time_now()));
+    }
+    else if (!certs) {
+        return;
+    }
+
+    for (i = 0; i < certs->count; i++) {
+        reload_pair_t *pair = &certs->pairs[i];
+
+        if (SSL_use_cert_and_key(ssl, pair->cert, pair->key, pair->chain,
+                                 1) < 1) {
+            ap_log_cerror(APLOG_MARK, APLOG_INFO, 0, c, APLOGNO(10481)
+                          "Failed to use reloaded certificate %s:%d",
+                          mctx->sc->vhost_id, i);
+            ssl_log_ssl_error(SSLLOG_MARK, APLOG_INFO, mctx->reload->s);
+        }
+    }
+}
+
+#endif /* HAVE_SSL_CERT_RELOAD */
@@ -52,6 +52,7 @@
 #include "apr_fnmatch.h"
 #include "apr_strings.h"
 #include "apr_global_mutex.h"
+#include "apr_shm.h"
 #include "apr_optional.h"
 #include "ap_socache.h"
 #include "mod_auth.h"
@@ -227,6 +228,30 @@
 
 #endif /* !defined(OPENSSL_NO_TLSEXT) && defined(SSL_set_tlsext_host_name) */
 
+/* Kernel TLS (TX) offload, set up by OpenSSL through our output BIO */
+#if defined(__linux__) && !defined(OPENSSL_NO_KTLS) \
+    && defined(SSL_OP_ENABLE_KTLS) && defined(BIO_CTRL_SET_KTLS) \
+    && defined(BIO_CTRL_SET_KTLS_TX_SEND_CTRL_MSG)
+#define HAVE_SSL_KTLS_TX
+#endif
+
+/* Asynchronous (offloaded) crypto operations during the handshake,
+ * i.e. OpenSSL ASYNC jobs paused by an engine or provider */
+#if defined(SSL_MODE_ASYNC) && !defined(OPENSSL_NO_ASYNC)
+#define HAVE_SSL_ASYNC
+#endif
+
+/* Record buffers released on demand, for idle connections */
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L && !defined(LIBRESSL_VERSION_NUMBER)
+#define HAVE_SSL_FREE_BUFFERS
+#endif
+
+/* Certificates reloaded by the running children, swapped into each SSL
+ * with SSL_use_cert_and_key() before the ClientHello is answered */
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L && !defined(LIBRESSL_VERSION_NUMBER)
+#define HAVE_SSL_CERT_RELOAD
+#endif
+
 #if MODSSL_USE_OPENSSL_PRE_1_1_API
 #define BN_get_rfc2409_prime_768   get_rfc2409_prime_768
 #define BN_get_rfc2409_prime_1024  get_rfc2409_prime_1024
@@ -540,7 +565,8 @@ typedef enum {
     SSL_SHUTDOWN_TYPE_ACCURATE
 } ssl_shutdown_type_e;
 
-typedef struct {
+typedef struct SSLConnRec SSLConnRec;
+struct SSLConnRec {
     SSL *ssl;
     const char *client_dn;
     X509 *client_cert;
@@ -570,7 +596,14 @@ typedef struct {
     const char *cipher_suite; /* cipher suite used in last reneg */
     int service_unavailable;  /* thouugh we negotiate SSL, no requests will be served */
     int vhost_found;          /* whether we found vhost from SNI already */
-} SSLConnRec;
+    const char *proxy_session_key; /* session cache key of a proxy connection */
+    int async_handshake;      /* handshake in progress outside a worker */
+    int handshake_slot;       /* may handshake now (SSLHandshakeLimit) */
+    apr_time_t handshake_queued; /* waiting for a slot since, or zero */
+    APR_RING_ENTRY(SSLConnRec) handshake_link;
+    apr_pool_t *async_pool;   /* MPM poll callback data of the handshake */
+    conn_rec *c;              /* back pointer, for the handshake queue */
+};
 
 /* Private keys are retained across reloads, since decryption
  * passphrases can only be entered during startup (before detaching
@@ -582,7 +615,7 @@ typedef struct {
  *
  * All objects used here must be allocated from the process pool
  * (s->process->pool) so they also survives restarts. */
-#define MODSSL_RETAINED_KEY "mod_ssl-retained-1"
+#define MODSSL_RETAINED_KEY "mod_ssl-retained-2"
 
 typedef struct {
     /* A hash table of vhost key-IDs used to index the privkeys hash,
@@ -600,6 +633,11 @@ typedef struct {
      * indexed by key-IDs from the key_ids hash table. */
     apr_hash_t *privkeys;
 
+    /* The shared memory of the session ticket keys rotated by the children
+     * (SSLSessionTicketKeyRotation), kept across restarts for the tickets
+     * issued before to remain valid. */
+    apr_shm_t *ticket_keys_shm;
+
     /* Do NOT add fields here without changing the key name, as above. */
 } modssl_retained_data_t;
 
@@ -633,6 +671,7 @@ typedef struct {
     ap_socache_instance_t *stapling_cache_context;
     apr_global_mutex_t   *stapling_cache_mutex;
     apr_global_mutex_t   *stapling_refresh_mutex;
+    BOOL                  stapling_refresh_background;
 #endif
 
 #ifdef HAVE_OPENSSL_KEYLOG
@@ -643,6 +682,28 @@ typedef struct {
 #ifdef HAVE_FIPS
     BOOL             fips;
 #endif
+
+    /* Handshakes processed concurrently by the workers of a child, and
+     * new connections allowed to wait for one (SSLHandshakeLimit) */
+    int             handshake_limit;
+    int             handshake_queue;
+
+#ifdef HAVE_TLS_SESSION_TICKETS
+    /* SSLSessionTicketKeyRotation interval (seconds, 0 for none) and the
+     * number of previous keys still accepted for decryption */
+    int             ticket_key_rotation;
+    int             ticket_key_previous;
+#endif
+
+#ifdef HAVE_SSL_CERT_RELOAD
+    /* SSLCertificateReload interval (0 for none) and the size of the
+     * shared memory passing the reloaded certificates to the children */
+    apr_interval_time_t cert_reload;
+    apr_size_t      cert_reload_size;
+    /* SSLCertificateLazyLoad: most server contexts with their certificates
+     * loaded in a child (0 for loading them all at startup) */
+    int             cert_lazy;
+#endif
 } SSLModConfigRec;
 
 /** Structure representing configured filenames for certs and keys for
@@ -704,6 +765,17 @@ typedef struct {
 #endif
     unsigned char aes_key[16];
 } modssl_ticket_key_t;
+
+/* A rotated session ticket key, as shared by the children */
+typedef struct {
+    unsigned char key_name[16];
+    unsigned char hmac_secret[16];
+    unsigned char aes_key[16];
+} modssl_ticket_rkey_t;
+
+/* Maximum number of rotated ticket keys (SSLSessionTicketKeyRotation),
+ * current and previous ones */
+#define MODSSL_TICKET_RKEYS_MAX 16
 #endif
 
 #ifdef HAVE_SSL_CONF_CMD
@@ -713,6 +785,17 @@ typedef struct {
 } ssl_ctx_param_t;
 #endif
 
+#ifdef HAVE_SSL_CERT_RELOAD
+/* Watched certificate files of a server context (ssl_engine_reload.c) */
+typedef struct modssl_reload_t modssl_reload_t;
+
+/* Default size of the shared memory for reloaded certificates */
+#define MODSSL_RELOAD_SIZE_DEFAULT (1024 * 1024)
+
+/* Default maximum of lazily loaded server contexts per child */
+#define MODSSL_LAZY_MAX_DEFAULT 1000
+#endif
+
 typedef struct {
     SSLSrvConfigRec *sc; /** pointer back to server config */
     SSL_CTX *ssl_ctx;
@@ -725,6 +808,12 @@ typedef struct {
     modssl_ticket_key_t *ticket_key;
 #endif
 
+#ifdef HAVE_SSL_CERT_RELOAD
+    modssl_reload_t *reload;
+    /* certificates and keys loaded on first use, not in the SSL_CTX */
+    int lazy_certs;
+#endif
+
     ssl_proto_t  protocol;
     int protocol_set;
 
@@ -784,6 +873,7 @@ typedef struct {
     BOOL ssl_check_peer_cn;
     BOOL ssl_check_peer_name;
     BOOL ssl_check_peer_expire;
+    BOOL ssl_session_reuse;
 } modssl_ctx_t;
 
 struct SSLSrvConfigRec {
@@ -802,7 +892,9 @@ struct SSLSrvConfigRec {
     BOOL             compression;
 #endif
     BOOL             session_tickets;
-    
+    BOOL             ktls;
+    BOOL             async_handshake;
+    BOOL             dynamic_records;
 };
 
 /**
@@ -849,6 +941,7 @@ const char  *ssl_cmd_SSLPolicyApply(cmd_parms *, void *, const char *);
 const char  *ssl_cmd_SSLPassPhraseDialog(cmd_parms *, void *, const char *);
 const char  *ssl_cmd_SSLCryptoDevice(cmd_parms *, void *, const char *);
 const char  *ssl_cmd_SSLRandomSeed(cmd_parms *, void *, const char *, const char *, const char *);
+const char  *ssl_cmd_SSLHandshakeLimit(cmd_parms *, void *, const char *, const char *);
 const char  *ssl_cmd_SSLEngine(cmd_parms *, void *, const char *);
 const char  *ssl_cmd_SSLCipherSuite(cmd_parms *, void *, const char *, const char *);
 const char  *ssl_cmd_SSLCertificateFile(cmd_parms *, void *, const char *);
@@ -864,6 +957,9 @@ const char  *ssl_cmd_SSLCARevocationCheck(cmd_parms *, void *, const char *);
 const char  *ssl_cmd_SSLHonorCipherOrder(cmd_parms *cmd, void *dcfg, int flag);
 const char  *ssl_cmd_SSLCompression(cmd_parms *, void *, int flag);
 const char  *ssl_cmd_SSLSessionTickets(cmd_parms *, void *, int flag);
+const char  *ssl_cmd_SSLKTLS(cmd_parms *, void *, int flag);
+const char  *ssl_cmd_SSLAsyncHandshake(cmd_parms *, void *, int flag);
+const char  *ssl_cmd_SSLDynamicRecordSizing(cmd_parms *, void *, int flag);
 const char  *ssl_cmd_SSLVerifyClient(cmd_parms *, void *, const char *);
 const char  *ssl_cmd_SSLVerifyDepth(cmd_parms *, void *, const char *);
 const char  *ssl_cmd_SSLSessionCache(cmd_parms *, void *, const char *);
@@ -896,6 +992,7 @@ const char *ssl_cmd_SSLSessionTicketKeyFile(cmd_parms *cmd, void *dcfg, const ch
 const char  *ssl_cmd_SSLProxyCheckPeerExpire(cmd_parms *cmd, void *dcfg, int flag);
 const char  *ssl_cmd_SSLProxyCheckPeerCN(cmd_parms *cmd, void *dcfg, int flag);
 const char  *ssl_cmd_SSLProxyCheckPeerName(cmd_parms *cmd, void *dcfg, int flag);
+const char  *ssl_cmd_SSLProxySessionReuse(cmd_parms *cmd, void *dcfg, int flag);
 
 const char *ssl_cmd_SSLOCSPOverrideResponder(cmd_parms *cmd, void *dcfg, int flag);
 const char *ssl_cmd_SSLOCSPDefaultResponder(cmd_parms *cmd, void *dcfg, const char *arg);
@@ -955,6 +1052,7 @@ int          ssl_callback_SSLVerify(int, X509_STORE_CTX *);
 int          ssl_callback_SSLVerify_CRL(int, X509_STORE_CTX *, conn_rec *);
 int          ssl_callback_proxy_cert(SSL *ssl, X509 **x509, EVP_PKEY **pkey);
 int          ssl_callback_NewSessionCacheEntry(SSL *, SSL_SESSION *);
+int          ssl_callback_NewProxySessionCacheEntry(SSL *, SSL_SESSION *);
 SSL_SESSION *ssl_callback_GetSessionCacheEntry(SSL *, IDCONST unsigned char *, int, int *);
 void         ssl_callback_DelSessionCacheEntry(SSL_CTX *, SSL_SESSION *);
 void         ssl_callback_Info(const SSL *, int, int);
@@ -992,11 +1090,35 @@ BOOL         ssl_scache_store(server_rec *, IDCONST UCHAR *, int,
 SSL_SESSION *ssl_scache_retrieve(server_rec *, IDCONST UCHAR *, int, apr_pool_t *);
 void         ssl_scache_remove(server_rec *, IDCONST UCHAR *, int,
                                apr_pool_t *);
+#ifdef HAVE_TLS_SESSION_TICKETS
+/* Get the current rotated ticket key to encrypt a new ticket, or the one
+ * named key_name to decrypt, returning whether it's the current one (1), a
+ * previous one (2), or none is available (0). */
+int          ssl_scache_ticket_key(server_rec *, const unsigned char *key_name,
+                                   modssl_ticket_rkey_t *key);
+const char  *ssl_cmd_SSLSessionTicketKeyRotation(cmd_parms *, void *,
+                                                 const char *, const char *);
+#endif
+
+/**  Certificate Reload Support  */
+#ifdef HAVE_SSL_CERT_RELOAD
+const char  *ssl_cmd_SSLCertificateReload(cmd_parms *, void *,
+                                          const char *, const char *);
+const char  *ssl_cmd_SSLCertificateLazyLoad(cmd_parms *, void *,
+                                            const char *, const char *);
+void         ssl_reload_init(server_rec *, apr_pool_t *);
+apr_status_t ssl_reload_register(server_rec *, apr_pool_t *, modssl_ctx_t *);
+void         ssl_reload_child_init(apr_pool_t *, server_rec *);
+int          ssl_reload_monitor(apr_pool_t *, server_rec *);
+/* Use the latest reloaded certificates of mctx, if any, for the ssl */
+void         ssl_reload_apply(conn_rec *, SSL *, modssl_ctx_t *);
+#endif
 
 /** OCSP Stapling Support */
 #ifdef HAVE_OCSP_STAPLING
 const char *ssl_cmd_SSLStaplingCache(cmd_parms *, void *, const char *);
 const char *ssl_cmd_SSLUseStapling(cmd_parms *, void *, int);
+const char *ssl_cmd_SSLStaplingBackgroundRefresh(cmd_parms *, void *, int);
 const char *ssl_cmd_SSLStaplingResponseTimeSkew(cmd_parms *, void *, const char *);
 const char *ssl_cmd_SSLStaplingResponseMaxAge(cmd_parms *, void *, const char *);
 const char *ssl_cmd_SSLStaplingStandardCacheTimeout(cmd_parms *, void *, const char *);
@@ -1007,6 +1129,7 @@ const char *ssl_cmd_SSLStaplingResponderTimeout(cmd_parms *, void *, const char
 const char *ssl_cmd_SSLStaplingForceURL(cmd_parms *, void *, const char *);
 apr_status_t modssl_init_stapling(server_rec *, apr_pool_t *, apr_pool_t *, modssl_ctx_t *);
 void         ssl_stapling_certinfo_hash_init(apr_pool_t *);
+void         ssl_stapling_refresh_init(server_rec *, apr_pool_t *);
 int          ssl_stapling_init_cert(server_rec *, apr_pool_t *, apr_pool_t *,
                                     modssl_ctx_t *, X509 *);
 #endif
@@ -1022,6 +1145,7 @@ void         modssl_callback_keylog(const SSL *ssl, const char *line);
 /**  I/O  */
 apr_status_t ssl_io_filter_init(conn_rec *, request_rec *r, SSL *);
 void         ssl_io_filter_register(apr_pool_t *);
+void         ssl_io_filter_idle(conn_rec *);
 long         ssl_io_data_cb(BIO *, int, const char *, int, long, long);
 
 /* ssl_io_buffer_fill fills the setaside buffering of the HTTP request
@@ -1147,11 +1271,14 @@ int modssl_verify_ocsp(X509_STORE_CTX *ctx, SSLSrvConfigRec *sc,
 /* OCSP helper interface; dispatches the given OCSP request to the
  * responder at the given URI.  Returns the decoded OCSP response
  * object, or NULL on error (in which case, errors will have been
- * logged).  Pool 'p' is used for temporary allocations. */
+ * logged).  Pool 'p' is used for temporary allocations.  Connection
+ * 'c' may be NULL for requests not made on behalf of a client, in
+ * which case errors are logged against server 's'. */
 OCSP_RESPONSE *modssl_dispatch_ocsp_request(const apr_uri_t *uri,
                                             apr_interval_time_t timeout,
                                             OCSP_REQUEST *request,
-                                            conn_rec *c, apr_pool_t *p);
+                                            conn_rec *c, server_rec *s,
+                                            apr_pool_t *p);
 
 /* Initialize OCSP trusted certificate list */
 void ssl_init_ocsp_certificates(server_rec *s, modssl_ctx_t *mctx);
@@ -30,6 +30,7 @@
                                                  -- Unknown         */
 #include "ssl_private.h"
 #include "mod_status.h"
+#include "apr_atomic.h"
 
 /*  _________________________________________________________________
 **
@@ -37,6 +38,150 @@
 **  _________________________________________________________________
 */
 
+#ifdef HAVE_TLS_SESSION_TICKETS
+/*  _________________________________________________________________
+**
+**  Session Tickets: Keys Rotated in Shared Memory
+**  _________________________________________________________________
+*/
+
+/*
+ * With SSLSessionTicketKeyRotation, the key of each rotation interval
+ * ("epoch", from the wall clock) is generated at random by the first child
+ * which needs it and stored in the shared ring at (epoch % nkeys), so that
+ * all the children issue and accept the same tickets without any mutex.
+ * Each slot has a stamp (epoch << 1) updated atomically: the generating
+ * child marks it busy (low bit) while writing the key, and the readers copy
+ * the key and check that the stamp did not change meanwhile (seqlock).
+ * The first 4 bytes of the key name are the epoch, for lookups by name.
+ */
+typedef struct {
+    apr_uint32_t stamp;
+    modssl_ticket_rkey_t key;
+} ticket_rkey_slot_t;
+
+typedef struct {
+    ticket_rkey_slot_t slots[MODSSL_TICKET_RKEYS_MAX];
+} ticket_rkeys_t;
+
+static ticket_rkeys_t *ticket_rkeys;
+
+static apr_status_t ssl_scache_ticket_keys_init(server_rec *s)
+{
+    SSLModConfigRec *mc = myModConfig(s);
+    apr_shm_t *shm = mc->retained->ticket_keys_shm;
+    apr_status_t rv;
+
+    if (!shm) {
+        /* Allocated from the process pool to survive restarts, the keys
+         * must all be in the children so anonymous shm is enough. */
+        rv = apr_shm_create(&shm, sizeof(ticket_rkeys_t), NULL,
+                            s->process->pool);
+        if (APR_STATUS_IS_ENOTIMPL(rv)) {
+            const char *fname = ap_runtime_dir_relative(s->process->pool,
+                                                        "ssl_ticket_keys");
+            apr_shm_remove(fname, s->process->pool);
+            rv = apr_shm_create(&shm, sizeof(ticket_rkeys_t), fname,
+                                s->process->pool);
+        }
+        if (rv != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_EMERG, rv, s, APLOGNO(10471)
+                         "Could not create the shared memory for the "
+                         "rotated session ticket keys");
+            return ssl_die(s);
+        }
+        memset(apr_shm_baseaddr_get(shm), 0, sizeof(ticket_rkeys_t));
+        mc->retained->ticket_keys_shm = shm;
+    }
+    ticket_rkeys = apr_shm_baseaddr_get(shm);
+
+    return APR_SUCCESS;
+}
+
+/* Copy the key of the epoch, generating it if asked and not there yet */
+static int ticket_rkey_get(apr_uint32_t epoch, int nkeys, int create,
+                           modssl_ticket_rkey_t *key)
+{
+    ticket_rkey_slot_t *slot = &ticket_rkeys->slots[epoch % nkeys];
+    apr_uint32_t stamp = epoch << 1, cur;
+
+    for (;;) {
+        cur = apr_atomic_read32(&slot->stamp);
+        if (cur == stamp) {
+            memcpy(key, &slot->key, sizeof(*key));
+            if (apr_atomic_read32(&slot->stamp) == stamp) {
+                return 1;
+            }
+            continue;
+        }
+        if (cur == (stamp | 1) || !create) {
+            /* being generated by another child, or none */
+            return 0;
+        }
+        if (apr_atomic_cas32(&slot->stamp, stamp | 1, cur) == cur) {
+            break;
+        }
+    }
+
+    key->key_name[0] = (unsigned char)(epoch >> 24);
+    key->key_name[1] = (unsigned char)(epoch >> 16);
+    key->key_name[2] = (unsigned char)(epoch >> 8);
+    key->key_name[3] = (unsigned char)(epoch);
+    if (RAND_bytes(key->key_name + 4, sizeof(key->key_name) - 4) != 1
+        || RAND_bytes(key->hmac_secret, sizeof(key->hmac_secret)) != 1
+        || RAND_bytes(key->aes_key, sizeof(key->aes_key)) != 1) {
+        /* leave it to the next one */
+        OPENSSL_cleanse(key, sizeof(*key));
+        apr_atomic_set32(&slot->stamp, 0);
+        return 0;
+    }
+    memcpy(&slot->key, key, sizeof(*key));
+    apr_atomic_set32(&slot->stamp, stamp);
+
+    return 1;
+}
+
+int ssl_scache_ticket_key(server_rec *s, const unsigned char *key_name,
+                          modssl_ticket_rkey_t *key)
+{
+    SSLModConfigRec *mc = myModConfig(s);
+    int nkeys = mc->ticket_key_previous + 2;
+    apr_uint32_t now, epoch;
+
+    if (!ticket_rkeys || mc->ticket_key_rotation <= 0) {
+        return 0;
+    }
+    now = (apr_uint32_t)(apr_time_sec(apr_time_now())
+                         / mc->ticket_key_rotation);
+
+    if (!key_name) {
+        /* New ticket: the current key, or the previous one while another
+         * child is generating it */
+        if (ticket_rkey_get(now, nkeys, 1, key)
+            || ticket_rkey_get(now - 1, nkeys, 0, key)) {
+            return 1;
+        }
+        return 0;
+    }
+
+    epoch = ((apr_uint32_t)key_name[0] << 24) |
+            ((apr_uint32_t)key_name[1] << 16) |
+            ((apr_uint32_t)key_name[2] << 8) |
+            ((apr_uint32_t)key_name[3]);
+    /* Accept a key generated a bit ahead at the end of an interval */
+    if (epoch > now + 1 || (epoch < now && now - epoch >
+                                          (apr_uint32_t)mc->ticket_key_previous)) {
+        return 0;
+    }
+    if (!ticket_rkey_get(epoch, nkeys, 0, key)
+        || memcmp(key->key_name, key_name, sizeof(key->key_name))) {
+        OPENSSL_cleanse(key, sizeof(*key));
+        return 0;
+    }
+    return (epoch >= now) ? 1 : 2;
+}
+#endif /* HAVE_TLS_SESSION_TICKETS */
+
 apr_status_t ssl_scache_init(server_rec *s, apr_pool_t *p)
 {
     SSLModConfigRec *mc = myModConfig(s);
@@ -68,11 +213,24 @@ apr_status_t ssl_scache_init(server_rec *s, apr_pool_t *p)
     }
 #endif
 
+#ifdef HAVE_TLS_SESSION_TICKETS
+    if (mc->ticket_key_rotation > 0
+        && (rv = ssl_scache_ticket_keys_init(s)) != APR_SUCCESS) {
+        return rv;
+    }
+#endif
+
     /*
      * Warn the user that he should use the session cache.
-     * But we can operate without it, of course.
+     * But we can operate without it, of course, notably when
+     * resumption relies on (rotated) session tickets only.
      */
     if (mc->sesscache == NULL) {
+#ifdef HAVE_TLS_SESSION_TICKETS
+        if (mc->ticket_key_rotation > 0) {
+            return APR_SUCCESS;
+        }
+#endif
         ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s, APLOGNO(01873)
                      "Init: Session Cache is not configured "
                      "[hint: SSLSessionCache]");
@@ -69,7 +69,7 @@ static BIO *serialize_request(OCSP_REQUEST *req, const apr_uri_t *uri,
  * NULL on error. */
 static apr_socket_t *send_request(BIO *request, const apr_uri_t *uri,
                                   apr_interval_time_t timeout,
-                                  conn_rec *c, apr_pool_t *p,
+                                  conn_rec *c, server_rec *s, apr_pool_t *p,
                                   const apr_uri_t *proxy_uri)
 {
     apr_status_t rv;
@@ -89,7 +89,7 @@ static apr_socket_t *send_request(BIO *request, const apr_uri_t *uri,
     rv = apr_sockaddr_info_get(&sa, next_hop_uri->hostname, APR_UNSPEC,
                                next_hop_uri->port, 0, p);
     if (rv) {
-        ap_log_cerror(APLOG_MARK, APLOG_ERR, rv, c, APLOGNO(01972)
+        ap_log_cserror(APLOG_MARK, APLOG_ERR, rv, c, s, APLOGNO(01972)
                       "could not resolve address of %s %s",
                       proxy_uri ? "proxy" : "OCSP responder",
                       next_hop_uri->hostinfo);
@@ -97,7 +97,7 @@ static apr_socket_t *send_request(BIO *request, const apr_uri_t *uri,
     }
 
     /* establish a connection to the OCSP responder */
-    ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, c, APLOGNO(01973)
+    ap_log_cserror(APLOG_MARK, APLOG_DEBUG, 0, c, s, APLOGNO(01973)
                   "connecting to %s '%s'",
                   proxy_uri ? "proxy" : "OCSP responder",
                   uri->hostinfo);
@@ -117,7 +117,7 @@ static apr_socket_t *send_request(BIO *request, const apr_uri_t *uri,
     }
 
     if (sa == NULL) {
-        ap_log_cerror(APLOG_MARK, APLOG_ERR, rv, c, APLOGNO(01974)
+        ap_log_cserror(APLOG_MARK, APLOG_ERR, rv, c, s, APLOGNO(01974)
                       "could not connect to %s '%s'",
                       proxy_uri ? "proxy" : "OCSP responder",
                       next_hop_uri->hostinfo);
@@ -125,7 +125,7 @@ static apr_socket_t *send_request(BIO *request, const apr_uri_t *uri,
     }
 
     /* send the request and get a response */
-    ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, c, APLOGNO(01975)
+    ap_log_cserror(APLOG_MARK, APLOG_DEBUG, 0, c, s, APLOGNO(01975)
                  "sending request to OCSP responder");
 
     while ((len = BIO_read(request, buf, sizeof buf)) > 0) {
@@ -142,7 +142,7 @@ static apr_socket_t *send_request(BIO *request, const apr_uri_t *uri,
 
         if (rv) {
             apr_socket_close(sd);
-            ap_log_cerror(APLOG_MARK, APLOG_ERR, rv, c, APLOGNO(01976)
+            ap_log_cserror(APLOG_MARK, APLOG_ERR, rv, c, s, APLOGNO(01976)
                           "failed to send request to OCSP responder '%s'",
                           uri->hostinfo);
             return NULL;
@@ -155,7 +155,7 @@ static apr_socket_t *send_request(BIO *request, const apr_uri_t *uri,
 /* Return a pool-allocated NUL-terminated line, with CRLF stripped,
  * read from brigade 'bbin' using 'bbout' as temporary storage. */
 static char *get_line(apr_bucket_brigade *bbout, apr_bucket_brigade *bbin,
-                      conn_rec *c, apr_pool_t *p)
+                      conn_rec *c, server_rec *s, apr_pool_t *p)
 {
     apr_status_t rv;
     apr_size_t len;
@@ -165,26 +165,26 @@ static char *get_line(apr_bucket_brigade *bbout, apr_bucket_brigade *bbin,
 
     rv = apr_brigade_split_line(bbout, bbin, APR_BLOCK_READ, 8192);
     if (rv) {
-        ap_log_cerror(APLOG_MARK, APLOG_ERR, rv, c, APLOGNO(01977)
+        ap_log_cserror(APLOG_MARK, APLOG_ERR, rv, c, s, APLOGNO(01977)
                       "failed reading line from OCSP server");
         return NULL;
     }
 
     rv = apr_brigade_pflatten(bbout, &line, &len, p);
     if (rv) {
-        ap_log_cerror(APLOG_MARK, APLOG_ERR, rv, c, APLOGNO(01978)
+        ap_log_cserror(APLOG_MARK, APLOG_ERR, rv, c, s, APLOGNO(01978)
                       "failed reading line from OCSP server");
         return NULL;
     }
 
     if (len == 0) {
-        ap_log_cerror(APLOG_MARK, APLOG_ERR, rv, c, APLOGNO(02321)
+        ap_log_cserror(APLOG_MARK, APLOG_ERR, rv, c, s, APLOGNO(02321)
                       "empty response from OCSP server");
         return NULL;
     }
 
     if (line[len-1] != APR_ASCII_LF) {
-        ap_log_cerror(APLOG_MARK, APLOG_ERR, rv, c, APLOGNO(01979)
+        ap_log_cserror(APLOG_MARK, APLOG_ERR, rv, c, s, APLOGNO(01979)
                       "response header line too long from OCSP server");
         return NULL;
     }
@@ -205,8 +205,9 @@ static char *get_line(apr_bucket_brigade *bbout, apr_bucket_brigade *bbin,
  * BIO 'bio', and return the decoded OCSP response object, or NULL on
  * error. */
 static OCSP_RESPONSE *read_response(apr_socket_t *sd, BIO *bio, conn_rec *c,
-                                    apr_pool_t *p)
+                                    server_rec *s, apr_pool_t *p)
 {
+    apr_bucket_alloc_t *ba;
     apr_bucket_brigade *bb, *tmpbb;
     OCSP_RESPONSE *response;
     char *line;
@@ -214,16 +215,18 @@ static OCSP_RESPONSE *read_response(apr_socket_t *sd, BIO *bio, conn_rec *c,
     apr_int64_t code;
 
     /* Using brigades for response parsing is much simpler than using
-     * apr_socket_* directly. */
-    bb = apr_brigade_create(p, c->bucket_alloc);
-    tmpbb = apr_brigade_create(p, c->bucket_alloc);
-    APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_socket_create(sd, c->bucket_alloc));
-
-    line = get_line(tmpbb, bb, c, p);
+     * apr_socket_* directly.  Without a connection (a request made
+     * from a background task) the allocator lives in the pool. */
+    ba = c ? c->bucket_alloc : apr_bucket_alloc_create(p);
+    bb = apr_brigade_create(p, ba);
+    tmpbb = apr_brigade_create(p, ba);
+    APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_socket_create(sd, ba));
+
+    line = get_line(tmpbb, bb, c, s, p);
     if (!line || strncmp(line, "HTTP/", 5)
         || (line = ap_strchr(line, ' ')) == NULL
         || (code = apr_atoi64(++line)) < 200 || code > 299) {
-        ap_log_cerror(APLOG_MARK, APLOG_ERR, 0, c, APLOGNO(01980)
+        ap_log_cserror(APLOG_MARK, APLOG_ERR, 0, c, s, APLOGNO(01980)
                       "bad response from OCSP server: %s",
                       line ? line : "(none)");
         return NULL;
@@ -233,20 +236,20 @@ static OCSP_RESPONSE *read_response(apr_socket_t *sd, BIO *bio, conn_rec *c,
      * Content-Length since the server is obliged to close the
      * connection after the response anyway for HTTP/1.0. */
     count = 0;
-    while ((line = get_line(tmpbb, bb, c, p)) != NULL && line[0]
+    while ((line = get_line(tmpbb, bb, c, s, p)) != NULL && line[0]
            && ++count < MAX_HEADERS) {
-        ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, c, APLOGNO(01981)
+        ap_log_cserror(APLOG_MARK, APLOG_DEBUG, 0, c, s, APLOGNO(01981)
                       "OCSP response header: %s", line);
     }
 
     if (count == MAX_HEADERS) {
-        ap_log_cerror(APLOG_MARK, APLOG_ERR, 0, c, APLOGNO(01982)
+        ap_log_cserror(APLOG_MARK, APLOG_ERR, 0, c, s, APLOGNO(01982)
                       "could not read response headers from OCSP server, "
                       "exceeded maximum count (%u)", MAX_HEADERS);
         return NULL;
     }
     else if (!line) {
-        ap_log_cerror(APLOG_MARK, APLOG_ERR, 0, c, APLOGNO(01983)
+        ap_log_cserror(APLOG_MARK, APLOG_ERR, 0, c, s, APLOGNO(01983)
                       "could not read response header from OCSP server");
         return NULL;
     }
@@ -261,12 +264,12 @@ static OCSP_RESPONSE *read_response(apr_socket_t *sd, BIO *bio, conn_rec *c,
 
         rv = apr_bucket_read(e, &data, &len, APR_BLOCK_READ);
         if (rv == APR_EOF) {
-            ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, c, APLOGNO(01984)
+            ap_log_cserror(APLOG_MARK, APLOG_DEBUG, 0, c, s, APLOGNO(01984)
                           "OCSP response: got EOF");
             break;
         }
         if (rv != APR_SUCCESS) {
-            ap_log_cerror(APLOG_MARK, APLOG_ERR, rv, c, APLOGNO(01985)
+            ap_log_cserror(APLOG_MARK, APLOG_ERR, rv, c, s, APLOGNO(01985)
                           "error reading response from OCSP server");
             return NULL;
         }
@@ -278,12 +281,12 @@ static OCSP_RESPONSE *read_response(apr_socket_t *sd, BIO *bio, conn_rec *c,
         }
         count += len;
         if (count > MAX_CONTENT) {
-            ap_log_cerror(APLOG_MARK, APLOG_ERR, rv, c, APLOGNO(01986)
+            ap_log_cserror(APLOG_MARK, APLOG_ERR, rv, c, s, APLOGNO(01986)
                           "OCSP response size exceeds %u byte limit",
                           MAX_CONTENT);
             return NULL;
         }
-        ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, c, APLOGNO(01987)
+        ap_log_cserror(APLOG_MARK, APLOG_DEBUG, 0, c, s, APLOGNO(01987)
                       "OCSP response: got %" APR_SIZE_T_FMT
                       " bytes, %" APR_SIZE_T_FMT " total", len, count);
 
@@ -298,9 +301,9 @@ static OCSP_RESPONSE *read_response(apr_socket_t *sd, BIO *bio, conn_rec *c,
      * bio. */
     response = d2i_OCSP_RESPONSE_bio(bio, NULL);
     if (response == NULL) {
-        ap_log_cerror(APLOG_MARK, APLOG_ERR, 0, c, APLOGNO(01988)
+        ap_log_cserror(APLOG_MARK, APLOG_ERR, 0, c, s, APLOGNO(01988)
                       "failed to decode OCSP response data");
-        ssl_log_ssl_error(SSLLOG_MARK, APLOG_ERR, mySrvFromConn(c));
+        ssl_log_ssl_error(SSLLOG_MARK, APLOG_ERR, s);
     }
 
     return response;
@@ -309,23 +312,24 @@ static OCSP_RESPONSE *read_response(apr_socket_t *sd, BIO *bio, conn_rec *c,
 OCSP_RESPONSE *modssl_dispatch_ocsp_request(const apr_uri_t *uri,
                                             apr_interval_time_t timeout,
                                             OCSP_REQUEST *request,
-                                            conn_rec *c, apr_pool_t *p)
+                                            conn_rec *c, server_rec *s,
+                                            apr_pool_t *p)
 {
     OCSP_RESPONSE *response = NULL;
     apr_socket_t *sd;
     BIO *bio;
     const apr_uri_t *proxy_uri;
 
-    proxy_uri = (mySrvConfigFromConn(c))->server->proxy_uri;
+    proxy_uri = (mySrvConfig(s))->server->proxy_uri;
     bio = serialize_request(request, uri, proxy_uri);
     if (bio == NULL) {
-        ap_log_cerror(APLOG_MARK, APLOG_ERR, 0, c, APLOGNO(01989)
+        ap_log_cserror(APLOG_MARK, APLOG_ERR, 0, c, s, APLOGNO(01989)
                       "could not serialize OCSP request");
-        ssl_log_ssl_error(SSLLOG_MARK, APLOG_ERR, mySrvFromConn(c));
+        ssl_log_ssl_error(SSLLOG_MARK, APLOG_ERR, s);
         return NULL;
     }
 
-    sd = send_request(bio, uri, timeout, c, p, proxy_uri);
+    sd = send_request(bio, uri, timeout, c, s, p, proxy_uri);
     if (sd == NULL) {
         /* Errors already logged. */
         BIO_free(bio);
@@ -335,7 +339,7 @@ OCSP_RESPONSE *modssl_dispatch_ocsp_request(const apr_uri_t *uri,
     /* Clear the BIO contents, ready for the response. */
     (void)BIO_reset(bio);
 
-    response = read_response(sd, bio, c, p);
+    response = read_response(sd, bio, c, s, p);
 
     apr_socket_close(sd);
     BIO_free(bio);
@@ -32,6 +32,7 @@
 #include "ap_mpm.h"
 #include "apr_thread_mutex.h"
 #include "mod_ssl_openssl.h"
+#include "mod_watchdog.h"
 
 APR_IMPLEMENT_OPTIONAL_HOOK_RUN_ALL(ssl, SSL, int, init_stapling_status,
                                     (server_rec *s, apr_pool_t *p, 
@@ -70,6 +71,12 @@ typedef struct {
     OCSP_CERTID *cid;
     /* URI of the OCSP responder */
     char *uri;
+    /* Server and context which first registered the certificate, used
+     * by the background refresh where no connection is available */
+    server_rec *s;
+    modssl_ctx_t *mctx;
+    /* When the background refresh is next due */
+    apr_time_t next_refresh;
 } certinfo;
 
 static apr_status_t ssl_stapling_certid_free(void *data)
@@ -217,6 +224,8 @@ int ssl_stapling_init_cert(server_rec *s, apr_pool_t *p, apr_pool_t *ptemp,
     cinf = apr_pcalloc(p, sizeof(certinfo));
     memcpy (cinf->idx, idx, sizeof(idx));
     cinf->cid = cid;
+    cinf->s = s;
+    cinf->mctx = mctx;
     /* make sure cid is also freed at pool cleanup */
     apr_pool_cleanup_register(p, cid, ssl_stapling_certid_free,
                               apr_pool_cleanup_null);
@@ -476,7 +485,7 @@ static BOOL stapling_renew_response(server_rec *s, modssl_ctx_t *mctx, SSL *ssl,
                                     certinfo *cinf, OCSP_RESPONSE **prsp,
                                     BOOL *pok, apr_pool_t *pool)
 {
-    conn_rec *conn      = (conn_rec *)SSL_get_app_data(ssl);
+    conn_rec *conn      = ssl ? (conn_rec *)SSL_get_app_data(ssl) : NULL;
     apr_pool_t *vpool;
     OCSP_REQUEST *req = NULL;
     OCSP_CERTID *id = NULL;
@@ -500,12 +509,15 @@ static BOOL stapling_renew_response(server_rec *s, modssl_ctx_t *mctx, SSL *ssl,
     if (!OCSP_request_add0_id(req, id))
         goto err;
     id = NULL;
-    /* Add any extensions to the request */
-    SSL_get_tlsext_status_exts(ssl, &exts);
-    for (i = 0; i < sk_X509_EXTENSION_num(exts); i++) {
-        X509_EXTENSION *ext = sk_X509_EXTENSION_value(exts, i);
-        if (!OCSP_REQUEST_add_ext(req, ext, -1)) 
-            goto err;
+    /* Add any extensions to the request; a background refresh has
+     * no client whose status request extensions could be forwarded */
+    if (ssl) {
+        SSL_get_tlsext_status_exts(ssl, &exts);
+        for (i = 0; i < sk_X509_EXTENSION_num(exts); i++) {
+            X509_EXTENSION *ext = sk_X509_EXTENSION_value(exts, i);
+            if (!OCSP_REQUEST_add_ext(req, ext, -1)) 
+                goto err;
+        }
     }
 
     if (mctx->stapling_force_url)
@@ -520,7 +532,7 @@ static BOOL stapling_renew_response(server_rec *s, modssl_ctx_t *mctx, SSL *ssl,
     }
 
     /* Create a temporary pool to constrain memory use */
-    apr_pool_create(&vpool, conn->pool);
+    apr_pool_create(&vpool, pool);
     apr_pool_tag(vpool, "modssl_stapling_renew");
 
     if (apr_uri_parse(vpool, ocspuri, &uri) != APR_SUCCESS) {
@@ -542,7 +554,7 @@ static BOOL stapling_renew_response(server_rec *s, modssl_ctx_t *mctx, SSL *ssl,
     }
 
     *prsp = modssl_dispatch_ocsp_request(&uri, mctx->stapling_responder_timeout,
-                                         req, conn, vpool);
+                                         req, conn, s, vpool);
 
     apr_pool_destroy(vpool);
 
@@ -801,6 +813,7 @@ static int stapling_cb(SSL *ssl, void *arg)
     server_rec *s       = mySrvFromConn(conn);
     SSLSrvConfigRec *sc = mySrvConfig(s);
     modssl_ctx_t *mctx  = myConnCtxConfig(conn, sc);
+    SSLModConfigRec *mc = myModConfig(s);
     UCHAR idx[SHA_DIGEST_LENGTH];
     ocsp_resp resp;
     certinfo *cinf = NULL;
@@ -858,6 +871,15 @@ static int stapling_cb(SSL *ssl, void *arg)
         return rv;
     }
 
+    if (rsp == NULL && mc->stapling_refresh_background == TRUE) {
+        /* Responses are only fetched by the background refresh, a
+         * handshake never waits on the responder. */
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(10489)
+                     "stapling_cb: no cached response, waiting for "
+                     "background refresh");
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+
     if (rsp == NULL) {
         ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(01954)
                      "stapling_cb: renewing cached response");
@@ -920,6 +942,134 @@ static int stapling_cb(SSL *ssl, void *arg)
     return rv;
 }
 
+/*
+ * Background refresh of the stapled responses.  A singleton watchdog
+ * in one child walks all registered certificates and renews each
+ * response ahead of its cache expiry, or when it has gone missing
+ * from the cache, so that handshakes only ever read the cache.
+ */
+#define SSL_STAPLING_WATCHDOG_NAME      "_ssl_stapling_"
+#define SSL_STAPLING_WATCHDOG_INTERVAL  apr_time_from_sec(30)
+
+static APR_OPTIONAL_FN_TYPE(ap_watchdog_get_instance) *wd_get_instance;
+static APR_OPTIONAL_FN_TYPE(ap_watchdog_register_callback) *wd_register_callback;
+
+static void stapling_refresh_cert(certinfo *cinf, apr_time_t now,
+                                  apr_pool_t *p)
+{
+    server_rec *s = cinf->s;
+    SSLModConfigRec *mc = myModConfig(s);
+    modssl_ctx_t *mctx = cinf->mctx;
+    OCSP_RESPONSE *rsp = NULL;
+    BOOL ok = TRUE;
+    int timeout;
+
+    if (now < cinf->next_refresh || !cinf->next_refresh) {
+        /* Not due yet, unless the response was evicted from the cache
+         * or has become invalid.  On the first run in this process the
+         * age of a cached response is unknown, so look again soon. */
+        if (get_and_check_cached_response(s, mctx, &rsp, &ok, cinf, p)
+            || rsp) {
+            OCSP_RESPONSE_free(rsp); /* NULL safe */
+            if (!cinf->next_refresh) {
+                cinf->next_refresh = now + apr_time_from_sec(
+                                     mctx->stapling_errcache_timeout) / 4;
+            }
+            return;
+        }
+    }
+
+    if (mc->stapling_refresh_mutex) {
+        stapling_refresh_mutex_on(s);
+    }
+    if (stapling_renew_response(s, mctx, NULL, cinf, &rsp, &ok, p) == FALSE) {
+        ok = FALSE;
+    }
+    if (mc->stapling_refresh_mutex) {
+        stapling_refresh_mutex_off(s);
+    }
+    OCSP_RESPONSE_free(rsp); /* NULL safe */
+
+    /* Renew when three quarters of the cache lifetime have passed */
+    timeout = ok ? mctx->stapling_cache_timeout
+                 : mctx->stapling_errcache_timeout;
+    cinf->next_refresh = now + apr_time_from_sec(timeout) / 4 * 3;
+    ap_log_error(APLOG_MARK, APLOG_TRACE1, 0, s,
+                 "stapling_refresh_cert: response %s, next refresh in %ds",
+                 ok ? "ok" : "in error", timeout / 4 * 3);
+}
+
+static apr_status_t stapling_watchdog(int state, void *baton,
+                                      apr_pool_t *ptemp)
+{
+    apr_hash_index_t *hi;
+    apr_pool_t *p;
+    apr_time_t now;
+
+    if (state != AP_WATCHDOG_STATE_RUNNING) {
+        return APR_SUCCESS;
+    }
+
+    apr_pool_create(&p, ptemp);
+    apr_pool_tag(p, "modssl_stapling_refresh");
+    now = apr_time_now();
+    for (hi = apr_hash_first(ptemp, stapling_certinfo); hi;
+         hi = apr_hash_next(hi)) {
+        certinfo *cinf = apr_hash_this_val(hi);
+
+        if (cinf->cid && cinf->mctx) {
+            stapling_refresh_cert(cinf, now, p);
+            apr_pool_clear(p);
+        }
+    }
+    apr_pool_destroy(p);
+
+    return APR_SUCCESS;
+}
+
+void ssl_stapling_refresh_init(server_rec *s, apr_pool_t *p)
+{
+    SSLModConfigRec *mc = myModConfig(s);
+    ap_watchdog_t *wd;
+    apr_status_t rv;
+
+    if (mc->stapling_refresh_background != TRUE) {
+        return;
+    }
+    if (!apr_hash_count(stapling_certinfo)) {
+        /* no certificate uses mod_ssl's own stapling */
+        mc->stapling_refresh_background = FALSE;
+        return;
+    }
+
+    wd_get_instance = APR_RETRIEVE_OPTIONAL_FN(ap_watchdog_get_instance);
+    wd_register_callback =
+        APR_RETRIEVE_OPTIONAL_FN(ap_watchdog_register_callback);
+    if (!wd_get_instance || !wd_register_callback) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s, APLOGNO(10490)
+                     "SSLStaplingBackgroundRefresh requires mod_watchdog, "
+                     "responses are refreshed during handshakes instead");
+        mc->stapling_refresh_background = FALSE;
+        return;
+    }
+
+    if ((rv = wd_get_instance(&wd, SSL_STAPLING_WATCHDOG_NAME, 0, 1, p))
+            != APR_SUCCESS
+        || (rv = wd_register_callback(wd, SSL_STAPLING_WATCHDOG_INTERVAL, s,
+                                      stapling_watchdog)) != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, rv, s, APLOGNO(10491)
+                     "SSLStaplingBackgroundRefresh: cannot create watchdog, "
+                     "responses are refreshed during handshakes instead");
+        mc->stapling_refresh_background = FALSE;
+        return;
+    }
+
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(10492)
+                 "OCSP stapling responses for %u certificates are "
+                 "refreshed in the background",
+                 apr_hash_count(stapling_certinfo));
+}
+
 apr_status_t modssl_init_stapling(server_rec *s, apr_pool_t *p,
                                   apr_pool_t *ptemp, modssl_ctx_t *mctx)
 {
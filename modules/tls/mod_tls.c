@@ -213,6 +213,7 @@ static apr_status_t tls_post_config_proxy_ssl(
 static void tls_init_child(apr_pool_t *p, server_rec *s)
 {
     tls_cache_init_child(p, s);
+    tls_core_init_child(p, s);
 }
 
 static int hook_pre_connection(conn_rec *c, void *csd)
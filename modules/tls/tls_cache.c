@@ -37,6 +37,10 @@ APLOG_USE_MODULE(tls);
 #define TLS_CACHE_DEF_DIR           "tls"
 #define TLS_CACHE_DEF_FILE          "session_cache"
 #define TLS_CACHE_DEF_SIZE          512000
+/* stripes of a session cache needing a lock, and the least size of one */
+#define TLS_CACHE_DEF_STRIPES       8
+#define TLS_CACHE_MAX_STRIPES       64
+#define TLS_CACHE_MIN_STRIPE_SIZE   8192
 
 static const char *cache_provider_unknown(const char *name, apr_pool_t *p)
 {
@@ -62,23 +66,20 @@ void tls_cache_pre_config(apr_pool_t *pconf, apr_pool_t *plog, apr_pool_t *ptemp
     ap_mutex_register(pconf, TLS_SESSION_CACHE_MUTEX_TYPE, NULL, APR_LOCK_DEFAULT, 0);
 }
 
-static const char *cache_init(tls_conf_global_t *gconf, apr_pool_t *p, apr_pool_t *ptemp)
+/* A session cache instance, responsible for the keys hashing to it. Providers
+ * needing a global lock get several of them, so that the handshakes do not
+ * all queue on the same mutex. */
+struct tls_cache_stripe_t {
+    ap_socache_instance_t *cache;
+    apr_global_mutex_t *mutex;
+};
+
+static const char *cache_parse_spec(
+    tls_conf_global_t *gconf, apr_pool_t *p, const char **pargs)
 {
-    const char *err = NULL;
     const char *name, *args = NULL;
-    apr_status_t rv;
 
-    if (gconf->session_cache) {
-        goto cleanup;
-    }
-    else if (!apr_strnatcasecmp("none", gconf->session_cache_spec)) {
-        gconf->session_cache_provider = NULL;
-        gconf->session_cache = NULL;
-        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, gconf->ap_server, APLOGNO(10346)
-                     "session cache explicitly disabled");
-        goto cleanup;
-    }
-    else if (!apr_strnatcasecmp("default", gconf->session_cache_spec)) {
+    if (!apr_strnatcasecmp("default", gconf->session_cache_spec)) {
         const char *path = TLS_CACHE_DEF_DIR;
 
 #if AP_MODULE_MAGIC_AT_LEAST(20180906, 2)
@@ -89,40 +90,106 @@ static const char *cache_init(tls_conf_global_t *gconf, apr_pool_t *p, apr_pool_
         gconf->session_cache_spec = "shmcb:mod_tls-sesss(64000)";
     }
 
-    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, gconf->ap_server, APLOGNO(10347)
-                 "Using session cache: %s", gconf->session_cache_spec);
     name = gconf->session_cache_spec;
     args = ap_strchr((char*)name, ':');
     if (args) {
         name = apr_pstrmemdup(p, name, (apr_size_t)(args - name));
         ++args;
     }
+    *pargs = args;
+    return name;
+}
+
+/* The arguments for stripe <i> of <n>: the files get a suffix and the
+ * size, if given as in "path(size)", is shared among the stripes. */
+static const char *stripe_args(apr_pool_t *p, const char *args, int i, int n)
+{
+    const char *paren;
+    long size;
+
+    if (!args || !*args) return args;
+    paren = strrchr(args, '(');
+    if (paren && (size = atol(paren + 1)) > 0) {
+        return apr_psprintf(p, "%s.%d(%ld)",
+            apr_pstrmemdup(p, args, (apr_size_t)(paren - args)), i, size / n);
+    }
+    return apr_psprintf(p, "%s.%d", args, i);
+}
+
+static int stripe_count(tls_conf_global_t *gconf, const char *args)
+{
+    const char *paren = args? strrchr(args, '(') : NULL;
+    long size = paren? atol(paren + 1) : 0;
+    int n;
+
+    if (!(gconf->session_cache_provider->flags & AP_SOCACHE_FLAG_NOTMPSAFE)) {
+        /* no lock to spread */
+        return 1;
+    }
+    n = (gconf->session_cache_stripes > 0)?
+        gconf->session_cache_stripes : TLS_CACHE_DEF_STRIPES;
+    while (n > 1 && size > 0 && size / n < TLS_CACHE_MIN_STRIPE_SIZE) {
+        --n;
+    }
+    return n;
+}
+
+static const char *cache_init(tls_conf_global_t *gconf, apr_pool_t *p, apr_pool_t *ptemp)
+{
+    struct tls_cache_stripe_t *stripe;
+    const char *err = NULL;
+    const char *name, *args = NULL;
+    apr_status_t rv;
+    int i, n;
+
+    if (gconf->session_caches) {
+        goto cleanup;
+    }
+    else if (!apr_strnatcasecmp("none", gconf->session_cache_spec)) {
+        gconf->session_cache_provider = NULL;
+        gconf->session_cache_count = 0;
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, gconf->ap_server, APLOGNO(10346)
+                     "session cache explicitly disabled");
+        goto cleanup;
+    }
+
+    name = cache_parse_spec(gconf, p, &args);
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, gconf->ap_server, APLOGNO(10347)
+                 "Using session cache: %s", gconf->session_cache_spec);
     gconf->session_cache_provider = ap_lookup_provider(AP_SOCACHE_PROVIDER_GROUP,
                                                        name, AP_SOCACHE_PROVIDER_VERSION);
     if (!gconf->session_cache_provider) {
         err = cache_provider_unknown(name, p);
         goto cleanup;
     }
-    err = gconf->session_cache_provider->create(&gconf->session_cache, args, ptemp, p);
-    if (err != NULL) goto cleanup;
-
-    if (gconf->session_cache_provider->flags & AP_SOCACHE_FLAG_NOTMPSAFE
-        && !gconf->session_cache_mutex) {
-        /* we need a global lock to access the cache */
-        rv = ap_global_mutex_create(&gconf->session_cache_mutex, NULL,
-            TLS_SESSION_CACHE_MUTEX_TYPE, NULL, gconf->ap_server, p, 0);
-        if (APR_SUCCESS != rv) {
-            err = apr_psprintf(p, "error setting up global %s mutex: %d",
-                TLS_SESSION_CACHE_MUTEX_TYPE, rv);
-            gconf->session_cache_mutex = NULL;
-            goto cleanup;
+
+    n = stripe_count(gconf, args);
+    gconf->session_caches = apr_pcalloc(p, (apr_size_t)n * sizeof(*gconf->session_caches));
+    for (i = 0; i < n; ++i) {
+        stripe = &gconf->session_caches[i];
+        err = gconf->session_cache_provider->create(&stripe->cache,
+            (n > 1)? stripe_args(p, args, i, n) : args, ptemp, p);
+        if (err != NULL) goto cleanup;
+
+        if (gconf->session_cache_provider->flags & AP_SOCACHE_FLAG_NOTMPSAFE) {
+            /* we need a global lock to access the cache */
+            rv = ap_global_mutex_create(&stripe->mutex, NULL,
+                TLS_SESSION_CACHE_MUTEX_TYPE, (n > 1)? apr_itoa(p, i) : NULL,
+                gconf->ap_server, p, 0);
+            if (APR_SUCCESS != rv) {
+                err = apr_psprintf(p, "error setting up global %s mutex: %d",
+                    TLS_SESSION_CACHE_MUTEX_TYPE, rv);
+                goto cleanup;
+            }
         }
     }
+    gconf->session_cache_count = n;
 
 cleanup:
     if (NULL != err) {
         gconf->session_cache_provider = NULL;
-        gconf->session_cache = NULL;
+        gconf->session_caches = NULL;
+        gconf->session_cache_count = 0;
     }
     return err;
 }
@@ -130,8 +197,33 @@ cleanup:
 const char *tls_cache_set_specification(
     const char *spec, tls_conf_global_t *gconf, apr_pool_t *p, apr_pool_t *ptemp)
 {
+    const ap_socache_provider_t *provider;
+    ap_socache_instance_t *cache;
+    const char *name, *args;
+
     gconf->session_cache_spec = spec;
-    return cache_init(gconf, p, ptemp);
+    if (!apr_strnatcasecmp("none", spec)) return NULL;
+
+    /* Only check it now, the instances are created at the end of the
+     * configuration, when the number of stripes is known. */
+    name = cache_parse_spec(gconf, p, &args);
+    provider = ap_lookup_provider(AP_SOCACHE_PROVIDER_GROUP,
+                                  name, AP_SOCACHE_PROVIDER_VERSION);
+    if (!provider) return cache_provider_unknown(name, ptemp);
+    return provider->create(&cache, args, ptemp, ptemp);
+}
+
+const char *tls_cache_set_stripes(
+    const char *stripes, tls_conf_global_t *gconf, apr_pool_t *p)
+{
+    int n = atoi(stripes);
+
+    if (n < 1 || n > TLS_CACHE_MAX_STRIPES) {
+        return apr_psprintf(p, "number of stripes must be between 1 and %d: '%s'",
+                            TLS_CACHE_MAX_STRIPES, stripes);
+    }
+    gconf->session_cache_stripes = n;
+    return NULL;
 }
 
 apr_status_t tls_cache_post_config(apr_pool_t *p, apr_pool_t *ptemp, server_rec *s)
@@ -139,6 +231,7 @@ apr_status_t tls_cache_post_config(apr_pool_t *p, apr_pool_t *ptemp, server_rec
     tls_conf_server_t *sc = tls_conf_server_get(s);
     const char *err;
     apr_status_t rv = APR_SUCCESS;
+    int i;
 
     err = cache_init(sc->global, p, ptemp);
     if (err) {
@@ -149,21 +242,24 @@ apr_status_t tls_cache_post_config(apr_pool_t *p, apr_pool_t *ptemp, server_rec
                      "error was: %s", sc->global->session_cache_spec, err);
     }
 
-    if (sc->global->session_cache) {
+    for (i = 0; i < sc->global->session_cache_count; ++i) {
         struct ap_socache_hints hints;
 
-        ap_log_error(APLOG_MARK, APLOG_TRACE1, 0, s, "provider init session cache [%s]",
-                     sc->global->session_cache_spec);
+        ap_log_error(APLOG_MARK, APLOG_TRACE1, 0, s, "provider init session cache [%s] %d/%d",
+                     sc->global->session_cache_spec, i, sc->global->session_cache_count);
         memset(&hints, 0, sizeof(hints));
         hints.avg_obj_size = 100;
         hints.avg_id_len = 33;
         hints.expiry_interval = 30;
 
         rv = sc->global->session_cache_provider->init(
-            sc->global->session_cache, "mod_tls-sess", &hints, s, p);
+            sc->global->session_caches[i].cache,
+            (i > 0)? apr_psprintf(p, "mod_tls-sess-%d", i) : "mod_tls-sess",
+            &hints, s, p);
         if (APR_SUCCESS != rv) {
             ap_log_error(APLOG_MARK, APLOG_EMERG, 0, s, APLOGNO(10349)
                          "error initializing session cache.");
+            break;
         }
     }
     return rv;
@@ -172,12 +268,16 @@ apr_status_t tls_cache_post_config(apr_pool_t *p, apr_pool_t *ptemp, server_rec
 void tls_cache_init_child(apr_pool_t *p, server_rec *s)
 {
     tls_conf_server_t *sc = tls_conf_server_get(s);
+    struct tls_cache_stripe_t *stripe;
     const char *lockfile;
     apr_status_t rv;
+    int i;
 
-    if (sc->global->session_cache_mutex) {
-        lockfile = apr_global_mutex_lockfile(sc->global->session_cache_mutex);
-        rv = apr_global_mutex_child_init(&sc->global->session_cache_mutex, lockfile, p);
+    for (i = 0; i < sc->global->session_cache_count; ++i) {
+        stripe = &sc->global->session_caches[i];
+        if (!stripe->mutex) continue;
+        lockfile = apr_global_mutex_lockfile(stripe->mutex);
+        rv = apr_global_mutex_child_init(&stripe->mutex, lockfile, p);
         if (APR_SUCCESS != rv) {
             ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10350)
                          "Cannot reinit %s mutex (file `%s`)",
@@ -189,15 +289,31 @@ void tls_cache_init_child(apr_pool_t *p, server_rec *s)
 void tls_cache_free(server_rec *s)
 {
     tls_conf_server_t *sc = tls_conf_server_get(s);
+    int i;
+
     if (sc->global->session_cache_provider) {
-        sc->global->session_cache_provider->destroy(sc->global->session_cache, s);
+        for (i = 0; i < sc->global->session_cache_count; ++i) {
+            sc->global->session_cache_provider->destroy(
+                sc->global->session_caches[i].cache, s);
+        }
     }
 }
 
-static void tls_cache_lock(tls_conf_global_t *gconf)
+static struct tls_cache_stripe_t *tls_cache_stripe(
+    tls_conf_global_t *gconf, const rustls_slice_bytes *key)
+{
+    apr_ssize_t klen = (apr_ssize_t)key->len;
+    unsigned int hash;
+
+    if (gconf->session_cache_count <= 1) return gconf->session_caches;
+    hash = apr_hashfunc_default((const char*)key->data, &klen);
+    return &gconf->session_caches[hash % (unsigned int)gconf->session_cache_count];
+}
+
+static void tls_cache_lock(tls_conf_global_t *gconf, struct tls_cache_stripe_t *stripe)
 {
-    if (gconf->session_cache_mutex) {
-        apr_status_t rv = apr_global_mutex_lock(gconf->session_cache_mutex);
+    if (stripe->mutex) {
+        apr_status_t rv = apr_global_mutex_lock(stripe->mutex);
         if (APR_SUCCESS != rv) {
             ap_log_error(APLOG_MARK, APLOG_WARNING, rv, gconf->ap_server, APLOGNO(10351)
                          "Failed to acquire TLS session cache lock");
@@ -205,10 +321,10 @@ static void tls_cache_lock(tls_conf_global_t *gconf)
     }
 }
 
-static void tls_cache_unlock(tls_conf_global_t *gconf)
+static void tls_cache_unlock(tls_conf_global_t *gconf, struct tls_cache_stripe_t *stripe)
 {
-    if (gconf->session_cache_mutex) {
-        apr_status_t rv = apr_global_mutex_unlock(gconf->session_cache_mutex);
+    if (stripe->mutex) {
+        apr_status_t rv = apr_global_mutex_unlock(stripe->mutex);
         if (APR_SUCCESS != rv) {
             ap_log_error(APLOG_MARK, APLOG_WARNING, rv, gconf->ap_server, APLOGNO(10352)
                          "Failed to release TLS session cache lock");
@@ -227,18 +343,20 @@ static rustls_result tls_cache_get(
     conn_rec *c = userdata;
     tls_conf_conn_t *cc = tls_conf_conn_get(c);
     tls_conf_server_t *sc = tls_conf_server_get(cc->server);
+    struct tls_cache_stripe_t *stripe;
     apr_status_t rv = APR_ENOENT;
     unsigned int vlen, klen;
     const unsigned char *kdata;
 
-    if (!sc->global->session_cache) goto not_found;
-    tls_cache_lock(sc->global);
+    if (!sc->global->session_cache_count) goto not_found;
+    stripe = tls_cache_stripe(sc->global, key);
+    tls_cache_lock(sc->global, stripe);
 
     kdata = key->data;
     klen = (unsigned int)key->len;
     vlen = (unsigned int)count;
     rv = sc->global->session_cache_provider->retrieve(
-        sc->global->session_cache, cc->server, kdata, klen, buf, &vlen, c->pool);
+        stripe->cache, cc->server, kdata, klen, buf, &vlen, c->pool);
 
     if (APLOGctrace4(c)) {
         apr_ssize_t n = klen;
@@ -247,10 +365,10 @@ static rustls_result tls_cache_get(
     }
     if (remove_after || (APR_SUCCESS != rv && !APR_STATUS_IS_NOTFOUND(rv))) {
         sc->global->session_cache_provider->remove(
-            sc->global->session_cache, cc->server, key->data, klen, c->pool);
+            stripe->cache, cc->server, key->data, klen, c->pool);
     }
 
-    tls_cache_unlock(sc->global);
+    tls_cache_unlock(sc->global, stripe);
     if (APR_SUCCESS != rv) goto not_found;
     cc->session_id_cache_hit = 1;
     *out_n = count;
@@ -269,26 +387,28 @@ static rustls_result tls_cache_put(
     conn_rec *c = userdata;
     tls_conf_conn_t *cc = tls_conf_conn_get(c);
     tls_conf_server_t *sc = tls_conf_server_get(cc->server);
+    struct tls_cache_stripe_t *stripe;
     apr_status_t rv = APR_ENOENT;
     apr_time_t expires_at;
     unsigned int klen, vlen;
     const unsigned char *kdata;
 
-    if (!sc->global->session_cache) goto not_stored;
-    tls_cache_lock(sc->global);
+    if (!sc->global->session_cache_count) goto not_stored;
+    stripe = tls_cache_stripe(sc->global, key);
+    tls_cache_lock(sc->global, stripe);
 
     expires_at = apr_time_now() + apr_time_from_sec(300);
     kdata = key->data;
     klen = (unsigned int)key->len;
     vlen = (unsigned int)val->len;
-    rv = sc->global->session_cache_provider->store(sc->global->session_cache, cc->server,
+    rv = sc->global->session_cache_provider->store(stripe->cache, cc->server,
                                                    kdata, klen, expires_at,
                                                    (unsigned char*)val->data, vlen, c->pool);
     if (APLOGctrace4(c)) {
         ap_log_cerror(APLOG_MARK, APLOG_TRACE4, rv, c,
             "stored %d key bytes, with %d val bytes", klen, vlen);
     }
-    tls_cache_unlock(sc->global);
+    tls_cache_unlock(sc->global, stripe);
     if (APR_SUCCESS != rv) goto not_stored;
     return RUSTLS_RESULT_OK;
 
@@ -301,7 +421,7 @@ apr_status_t tls_cache_init_server(
 {
     tls_conf_server_t *sc = tls_conf_server_get(s);
 
-    if (sc && sc->global->session_cache) {
+    if (sc && sc->global->session_cache_count) {
         ap_log_error(APLOG_MARK, APLOG_TRACE3, 0, s, "adding session persistence to rustls");
         rustls_server_config_builder_set_persistence(
             builder, tls_cache_get, tls_cache_put);
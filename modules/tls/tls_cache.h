@@ -33,6 +33,18 @@
 const char *tls_cache_set_specification(
     const char *spec, tls_conf_global_t *gconf, apr_pool_t *p, apr_pool_t *ptemp);
 
+/**
+ * Set the number of stripes a session cache needing a global lock is split
+ * into, so that its accesses - by key hash - do not all wait on the same lock.
+ *
+ * @param stripes the number of stripes as given
+ * @param gconf the modules global configuration
+ * @param p pool for permanent allocations
+ * @return NULL on success or an error message
+ */
+const char *tls_cache_set_stripes(
+    const char *stripes, tls_conf_global_t *gconf, apr_pool_t *p);
+
 /**
  * Setup before configuration runs, announces our potential global mutex.
  */
@@ -589,6 +589,38 @@ cleanup:
     return err;
 }
 
+static const char *tls_conf_set_session_cache_stripes(
+    cmd_parms *cmd, void *dc, const char *value)
+{
+    tls_conf_server_t *sc = tls_conf_server_get(cmd->server);
+    const char *err = NULL;
+
+    (void)dc;
+    if ((err = ap_check_cmd_context(cmd, GLOBAL_ONLY))) goto cleanup;
+
+    err = tls_cache_set_stripes(value, sc->global, cmd->pool);
+cleanup:
+    return err;
+}
+
+static const char *tls_conf_set_cert_lazy_load(
+    cmd_parms *cmd, void *dc, const char *v)
+{
+    tls_conf_server_t *sc = tls_conf_server_get(cmd->server);
+    const char *err = NULL;
+    int flag = flag_value(v);
+
+    (void)dc;
+    if ((err = ap_check_cmd_context(cmd, GLOBAL_ONLY))) goto cleanup;
+    if (TLS_FLAG_UNSET == flag) {
+        err = flag_err(cmd, v);
+        goto cleanup;
+    }
+    sc->global->lazy_certs = (flag == TLS_FLAG_TRUE);
+cleanup:
+    return err;
+}
+
 static const char *tls_conf_set_proxy_engine(cmd_parms *cmd, void *dir_conf, int flag)
 {
     tls_conf_dir_t *dc = dir_conf;
@@ -754,6 +786,10 @@ const command_rec tls_conf_cmds[] = {
         "Set strictness of client server name (SNI) check against hosts, default on."),
     AP_INIT_TAKE1("TLSSessionCache", tls_conf_set_session_cache, NULL, RSRC_CONF,
         "Set which cache to use for TLS sessions."),
+    AP_INIT_TAKE1("TLSSessionCacheStripes", tls_conf_set_session_cache_stripes, NULL, RSRC_CONF,
+        "Set the number of stripes, each with its lock, the TLS session cache is split into."),
+    AP_INIT_TAKE1("TLSCertificateLazyLoad", tls_conf_set_cert_lazy_load, NULL, RSRC_CONF,
+        "Set 'on' to load server certificates in the child on first use, default off."),
     AP_INIT_FLAG("TLSProxyEngine", tls_conf_set_proxy_engine, NULL, RSRC_CONF|PROXY_CONF,
         "Enable TLS encryption of outgoing connections in this location/server."),
     AP_INIT_TAKE1("TLSProxyCA", tls_conf_set_proxy_ca, NULL, RSRC_CONF|PROXY_CONF,
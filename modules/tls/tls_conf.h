@@ -28,6 +28,7 @@ struct tls_cert_verifiers_t;
 struct ap_socache_instance_t;
 struct ap_socache_provider_t;
 struct apr_global_mutex_t;
+struct apr_thread_mutex_t;
 
 
 /* disabled, since rustls support is lacking
@@ -82,10 +83,15 @@ typedef struct {
 
     const char *session_cache_spec;   /* how the session cache was specified */
     const struct ap_socache_provider_t *session_cache_provider; /* provider used for session cache */
-    struct ap_socache_instance_t *session_cache; /* session cache instance */
-    struct apr_global_mutex_t *session_cache_mutex; /* global mutex for access to session cache */
+    int session_cache_stripes;        /* configured max number of session cache stripes */
+    int session_cache_count;          /* number of session cache instances, 0 if none */
+    struct tls_cache_stripe_t *session_caches; /* instances, by key hash, with their mutex */
 
     const rustls_server_config *rustls_hello_config; /* used for initial client hello parsing */
+
+    int lazy_certs;                   /* != 0 iff server certificates are loaded on first use */
+    struct tls_cert_reg_t *lazy_reg;  /* certified keys loaded on first use by the child */
+    struct apr_thread_mutex_t *lazy_mutex; /* serializes loading them in the child */
 } tls_conf_global_t;
 
 /* The module configuration for a server (vhost).
@@ -110,6 +116,7 @@ typedef struct {
     const char *var_user_name;        /* which SSL variable to use as user name */
 
     apr_array_header_t *certified_keys; /* rustls_certified_key list configured */
+    apr_array_header_t *lazy_cert_specs; /* (tls_cert_spec_t*) not loaded yet, TLSCertificateLazyLoad */
     int base_server;                  /* != 0 iff this is the base server */
     int service_unavailable;          /* TLS not trustworthy configured, return 503s */
 } tls_conf_server_t;
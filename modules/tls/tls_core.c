@@ -17,6 +17,7 @@
 #include <apr_lib.h>
 #include <apr_strings.h>
 #include <apr_network_io.h>
+#include <apr_thread_mutex.h>
 
 #include <httpd.h>
 #include <http_core.h>
@@ -321,6 +322,60 @@ static apr_array_header_t *complete_cert_specs(
     return specs;
 }
 
+static apr_status_t check_cert_specs(
+    server_rec *s, apr_array_header_t *cert_specs, apr_pool_t *ptemp)
+{
+    apr_status_t rv = APR_SUCCESS;
+    tls_cert_spec_t *spec;
+    apr_finfo_t finfo;
+    int i;
+
+    for (i = 0; i < cert_specs->nelts; ++i) {
+        spec = APR_ARRAY_IDX(cert_specs, i, tls_cert_spec_t*);
+        if ((spec->cert_file && APR_SUCCESS != (rv = apr_stat(
+                &finfo, spec->cert_file, APR_FINFO_TYPE, ptemp)))
+            || (spec->pkey_file && APR_SUCCESS != (rv = apr_stat(
+                &finfo, spec->pkey_file, APR_FINFO_TYPE, ptemp)))) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10488)
+                 "Certificate %d[cert=%s, key=%s] for %s is not accessible",
+                 i, spec->cert_file, spec->pkey_file, s->server_hostname);
+            break;
+        }
+    }
+    return rv;
+}
+
+/* Get the certified keys of a server, loading them in the child on
+ * first use with TLSCertificateLazyLoad. */
+static apr_array_header_t *get_certified_keys(tls_conf_server_t *sc)
+{
+    tls_conf_global_t *gc = sc->global;
+    apr_array_header_t *keys;
+
+    if (!gc->lazy_certs || !gc->lazy_reg) return sc->certified_keys;
+#if APR_HAS_THREADS
+    if (gc->lazy_mutex) apr_thread_mutex_lock(gc->lazy_mutex);
+#endif
+    if (sc->lazy_cert_specs) {
+        keys = apr_array_make(gc->lazy_reg->pool, sc->lazy_cert_specs->nelts,
+                              sizeof(rustls_certified_key *));
+        if (APR_SUCCESS == load_certified_keys(keys, sc->server,
+                                               sc->lazy_cert_specs, gc->lazy_reg)) {
+            sc->certified_keys = keys;
+            ap_log_error(APLOG_MARK, APLOG_TRACE1, 0, sc->server,
+                         "loaded %d certificates of %s on first use",
+                         keys->nelts, sc->server->server_hostname);
+        }
+        /* once: a failure stays until the next restart */
+        sc->lazy_cert_specs = NULL;
+    }
+    keys = sc->certified_keys;
+#if APR_HAS_THREADS
+    if (gc->lazy_mutex) apr_thread_mutex_unlock(gc->lazy_mutex);
+#endif
+    return keys;
+}
+
 static const rustls_certified_key *select_certified_key(
     void* userdata, const rustls_client_hello *hello)
 {
@@ -346,7 +401,7 @@ static const rustls_certified_key *select_certified_key(
         keys = cc->local_keys;
     }
     else {
-        keys = sc->certified_keys;
+        keys = get_certified_keys(sc);
     }
     if (!keys || keys->nelts <= 0) goto cleanup;
 
@@ -398,10 +453,19 @@ static apr_status_t server_conf_setup(
         rv = APR_EINVAL; goto cleanup;
     }
 
-    cert_specs = complete_cert_specs(ptemp, sc);
     sc->certified_keys = apr_array_make(p, 3, sizeof(rustls_certified_key *));
-    rv = load_certified_keys(sc->certified_keys, sc->server, cert_specs, gc->cert_reg);
-    if (APR_SUCCESS != rv) goto cleanup;
+    if (gc->lazy_certs) {
+        /* only check the files now, the children load them when needed */
+        cert_specs = complete_cert_specs(p, sc);
+        rv = check_cert_specs(sc->server, cert_specs, ptemp);
+        if (APR_SUCCESS != rv) goto cleanup;
+        sc->lazy_cert_specs = cert_specs;
+    }
+    else {
+        cert_specs = complete_cert_specs(ptemp, sc);
+        rv = load_certified_keys(sc->certified_keys, sc->server, cert_specs, gc->cert_reg);
+        if (APR_SUCCESS != rv) goto cleanup;
+    }
 
     rv = get_server_ciphersuites(&sc->ciphersuites, p, sc);
     if (APR_SUCCESS != rv) goto cleanup;
@@ -694,6 +758,20 @@ cleanup:
     return rv;
 }
 
+void tls_core_init_child(apr_pool_t *p, server_rec *s)
+{
+    tls_conf_server_t *sc = tls_conf_server_get(s);
+    tls_conf_global_t *gc = sc->global;
+
+    if (gc->lazy_certs) {
+        /* the keys loaded by this child go away with it */
+        gc->lazy_reg = tls_cert_reg_make(p);
+#if APR_HAS_THREADS
+        apr_thread_mutex_create(&gc->lazy_mutex, APR_THREAD_MUTEX_DEFAULT, p);
+#endif
+    }
+}
+
 static apr_status_t tls_core_conn_free(void *data)
 {
     tls_conf_conn_t *cc = data;
@@ -1308,6 +1386,7 @@ cleanup:
 static int tls_conn_compatible_for(tls_conf_conn_t *cc, server_rec *other)
 {
     tls_conf_server_t *oc, *sc;
+    apr_array_header_t *skeys, *okeys;
     const rustls_certified_key *sk, *ok;
     int i;
 
@@ -1324,10 +1403,12 @@ static int tls_conn_compatible_for(tls_conf_conn_t *cc, server_rec *other)
     if (!sc) return 0;
 
     /* same certified keys used? */
-    if (sc->certified_keys->nelts != oc->certified_keys->nelts) return 0;
-    for (i = 0; i < sc->certified_keys->nelts; ++i) {
-        sk = APR_ARRAY_IDX(sc->certified_keys, i, const rustls_certified_key*);
-        ok = APR_ARRAY_IDX(oc->certified_keys, i, const rustls_certified_key*);
+    skeys = get_certified_keys(sc);
+    okeys = get_certified_keys(oc);
+    if (skeys->nelts != okeys->nelts) return 0;
+    for (i = 0; i < skeys->nelts; ++i) {
+        sk = APR_ARRAY_IDX(skeys, i, const rustls_certified_key*);
+        ok = APR_ARRAY_IDX(okeys, i, const rustls_certified_key*);
         if (sk != ok) return 0;
     }
 
@@ -101,6 +101,12 @@ apr_status_t tls_core_init(apr_pool_t *p, apr_pool_t *ptemp, server_rec *base_se
  */
 apr_status_t tls_core_init_outgoing(apr_pool_t *p, apr_pool_t *ptemp, server_rec *base_server);
 
+/**
+ * Started a new child, set up the loading of certificates on first use
+ * (TLSCertificateLazyLoad).
+ */
+void tls_core_init_child(apr_pool_t *p, server_rec *s);
+
 /**
  * Supply a directory configuration for the connection to work with. This
  * maybe NULL. This can be called several times during the lifetime of a
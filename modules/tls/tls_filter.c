@@ -64,7 +64,7 @@ static apr_status_t read_tls_to_rustls(
     tls_filter_ctx_t *fctx, apr_size_t len, apr_read_type_e block, int errors_expected)
 {
     tls_data_t d;
-    apr_size_t rlen;
+    apr_size_t rlen, consumed;
     apr_off_t passed = 0;
     rustls_result rr = RUSTLS_RESULT_OK;
     int os_err;
@@ -105,26 +105,41 @@ static apr_status_t read_tls_to_rustls(
             /* got something, do not block on getting more */
             block = APR_NONBLOCK_READ;
 
-            os_err = rustls_connection_read_tls(fctx->cc->rustls_connection,
-                                tls_read_callback, &d, &rlen);
-            if (os_err) {
-                rv = APR_FROM_OS_ERROR(os_err);
-                goto cleanup;
+            /* hand rustls all of the bucket's data it takes, before
+             * looking at the bucket again */
+            consumed = 0;
+            while (consumed < d.len && passed < (apr_off_t)len) {
+                tls_data_t rest;
+
+                rest.data = d.data + consumed;
+                rest.len = d.len - consumed;
+                os_err = rustls_connection_read_tls(fctx->cc->rustls_connection,
+                                    tls_read_callback, &rest, &rlen);
+                if (os_err) {
+                    rv = APR_FROM_OS_ERROR(os_err);
+                    goto cleanup;
+                }
+                if (rlen == 0) break;
+                consumed += rlen;
+                passed += (apr_off_t)rlen;
             }
 
-            if (fctx->fin_tls_buffer_bb) {
+            if (fctx->fin_tls_buffer_bb && consumed > 0) {
                 /* we buffer for later replay on the 'real' rustls_connection */
-                apr_brigade_write(fctx->fin_tls_buffer_bb, NULL, NULL, (const char*)d.data, rlen);
+                apr_brigade_write(fctx->fin_tls_buffer_bb, NULL, NULL, (const char*)d.data, consumed);
             }
-            if (rlen >= d.len) {
+            if (consumed >= d.len) {
                 apr_bucket_delete(b);
             }
             else {
-                b->start += (apr_off_t)rlen;
-                b->length -= rlen;
+                b->start += (apr_off_t)consumed;
+                b->length -= consumed;
+            }
+            fctx->fin_bytes_in_rustls += (apr_off_t)consumed;
+            if (consumed < d.len) {
+                /* rustls takes no more before processing what it has */
+                break;
             }
-            fctx->fin_bytes_in_rustls += (apr_off_t)d.len;
-            passed += (apr_off_t)rlen;
         }
         else if (d.len == 0) {
             apr_bucket_delete(b);
@@ -422,27 +437,33 @@ static apr_status_t filter_conn_input(
      * c) go back to a) if b) added data.
      */
     while (APR_BRIGADE_EMPTY(fctx->fin_plain_bb)) {
-        apr_size_t rlen = 0;
+        apr_size_t rlen = 0, n;
         apr_bucket *b;
 
         if (fctx->fin_bytes_in_rustls > 0) {
-            in_buf_len = APR_BUCKET_BUFF_SIZE;
-            in_buf = ap_calloc(in_buf_len, sizeof(char));
-            rr = rustls_connection_read(fctx->cc->rustls_connection,
-                (unsigned char*)in_buf, in_buf_len, &rlen);
-            if (rr == RUSTLS_RESULT_PLAINTEXT_EMPTY) {
-                rr = RUSTLS_RESULT_OK;
-                rlen = 0;
-            }
-            if (rr != RUSTLS_RESULT_OK) goto cleanup;
+            /* Collect all the plain data rustls has, up to a full record's
+             * worth, in one buffer. It comes from the connection's bucket
+             * allocator, which recycles it when the bucket is gone. */
+            in_buf_len = TLS_PREF_PLAIN_CHUNK_SIZE;
+            in_buf = apr_bucket_alloc(in_buf_len, fctx->c->bucket_alloc);
+            do {
+                rr = rustls_connection_read(fctx->cc->rustls_connection,
+                    (unsigned char*)in_buf + rlen, in_buf_len - rlen, &n);
+                if (rr == RUSTLS_RESULT_PLAINTEXT_EMPTY) {
+                    rr = RUSTLS_RESULT_OK;
+                    n = 0;
+                }
+                if (rr != RUSTLS_RESULT_OK) goto cleanup;
+                rlen += n;
+            } while (n > 0 && rlen < in_buf_len);
             ap_log_cerror(APLOG_MARK, APLOG_TRACE2, rv, fctx->c,
                          "tls_filter_conn_input: got %ld plain bytes from rustls", (long)rlen);
             if (rlen > 0) {
-                b = apr_bucket_heap_create(in_buf, rlen, free, fctx->c->bucket_alloc);
+                b = apr_bucket_heap_create(in_buf, rlen, apr_bucket_free, fctx->c->bucket_alloc);
                 APR_BRIGADE_INSERT_TAIL(fctx->fin_plain_bb, b);
             }
             else {
-                free(in_buf);
+                apr_bucket_free(in_buf);
             }
             in_buf = NULL;
         }
@@ -485,7 +506,7 @@ static apr_status_t filter_conn_input(
     fout_pass_all_to_net(fctx, 0);
 
 cleanup:
-    if (NULL != in_buf) free(in_buf);
+    if (NULL != in_buf) apr_bucket_free(in_buf);
 
     if (APLOGctrace3(fctx->c)) {
         tls_util_bb_log(fctx->c, APLOG_TRACE3, "tls_input, fctx->fin_plain_bb", fctx->fin_plain_bb);
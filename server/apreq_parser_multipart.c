@@ -209,6 +209,37 @@ static apr_status_t split_on_bdry(apr_bucket_brigade *out,
 }
 
 
+/* Appends the data of an upload to it, spooling them to a tempfile beyond the
+ * brigade limit. The data are set aside only if they stay in memory, so that
+ * the (transient) buckets of large uploads are written to the spool file
+ * directly rather than copied beforehand.
+ */
+static apr_status_t upload_concat(apreq_parser_t *parser, apr_pool_t *pool,
+                                  apreq_param_t *param,
+                                  apr_bucket_brigade *bb)
+{
+    apr_bucket_brigade *upload = param->upload;
+    apr_bucket *last = APR_BRIGADE_LAST(upload), *e;
+    apr_status_t s;
+
+    s = apreq_brigade_concat(pool, parser->temp_dir, parser->brigade_limit,
+                             upload, bb);
+    if (s != APR_SUCCESS || apreq_brigade_spoolfile(upload) != NULL)
+        return s;
+
+    /* Still in memory, the buckets appended after last need setting aside */
+    for (e = APR_BUCKET_NEXT(last); e != APR_BRIGADE_SENTINEL(upload);
+         e = APR_BUCKET_NEXT(e))
+    {
+        s = apr_bucket_setaside(e, pool);
+        if (s != APR_SUCCESS)
+            return s;
+    }
+
+    return APR_SUCCESS;
+}
+
+
 static
 struct mfd_ctx * create_multipart_context(const char *content_type,
                                           apr_pool_t *pool,
@@ -616,11 +647,8 @@ APREQ_DECLARE_PARSER(apreq_parse_multipart)
                         return s;
                     }
                 }
-                apreq_brigade_setaside(ctx->bb, pool);
                 apreq_brigade_setaside(ctx->in, pool);
-                s = apreq_brigade_concat(pool, parser->temp_dir,
-                                         parser->brigade_limit,
-                                         param->upload, ctx->bb);
+                s = upload_concat(parser, pool, param, ctx->bb);
                 return (s == APR_SUCCESS) ? APR_INCOMPLETE : s;
 
             case APR_SUCCESS:
@@ -634,10 +662,7 @@ APREQ_DECLARE_PARSER(apreq_parse_multipart)
                     }
                 }
                 apreq_value_table_add(&param->v, t);
-                apreq_brigade_setaside(ctx->bb, pool);
-                s = apreq_brigade_concat(pool, parser->temp_dir,
-                                         parser->brigade_limit,
-                                         param->upload, ctx->bb);
+                s = upload_concat(parser, pool, param, ctx->bb);
 
                 if (s != APR_SUCCESS)
                     return s;
@@ -19,6 +19,9 @@
 #include "apreq_util.h"
 #include "apreq_error.h"
 
+#define APR_WANT_MEMFUNC
+#include "apr_want.h"
+
 
 #define PARSER_STATUS_CHECK(PREFIX)   do {         \
     if (ctx->status == PREFIX##_ERROR)             \
@@ -219,49 +222,52 @@ APREQ_DECLARE_PARSER(apreq_parse_urlencoded)
         switch (ctx->status) {
 
         case URL_NAME:
-            while (off < dlen) {
-                switch (data[off++]) {
-                case '=':
-                    apr_bucket_split(e, off);
-                    dlen -= off;
-                    data += off;
-                    off = 0;
-                    e = APR_BUCKET_NEXT(e);
-                    ctx->status = URL_VALUE;
-                    goto parse_url_bucket;
-                default:
-                    ++ctx->nlen;
+            if (off < dlen) {
+                const char *eq = memchr(data + off, '=', dlen - off);
+                if (eq == NULL) {
+                    ctx->nlen += dlen - off;
+                    break;
                 }
+                ctx->nlen += eq - (data + off);
+                off = eq - data + 1;
+                apr_bucket_split(e, off);
+                dlen -= off;
+                data += off;
+                off = 0;
+                e = APR_BUCKET_NEXT(e);
+                ctx->status = URL_VALUE;
+                goto parse_url_bucket;
             }
             break;
 
         case URL_VALUE:
-            while (off < dlen) {
-
-                switch (data[off++]) {
-                case '&':
-                case ';':
-                    apr_bucket_split(e, off);
-                    s = split_urlword(&param, pool, ctx->bb,
-                                      ctx->nlen, ctx->vlen);
-                    if (parser->hook != NULL && s == APR_SUCCESS)
-                        s = apreq_hook_run(parser->hook, param, NULL);
-
-                    if (s != APR_SUCCESS) {
-                        ctx->status = URL_ERROR;
-                        return s;
-                    }
+            if (off < dlen) {
+                apr_size_t start = off;
+
+                /* count the value's bytes up to the next separator */
+                while (off < dlen && data[off] != '&' && data[off] != ';')
+                    ++off;
+                ctx->vlen += off - start;
+                if (off == dlen)
+                    break;
+
+                apr_bucket_split(e, ++off);
+                s = split_urlword(&param, pool, ctx->bb,
+                                  ctx->nlen, ctx->vlen);
+                if (parser->hook != NULL && s == APR_SUCCESS)
+                    s = apreq_hook_run(parser->hook, param, NULL);
 
-                    apreq_value_table_add(&param->v, t);
-                    ctx->status = URL_NAME;
-                    ctx->nlen = 0;
-                    ctx->vlen = 0;
-                    e = APR_BRIGADE_SENTINEL(ctx->bb);
-                    goto parse_url_brigade;
-
-                default:
-                    ++ctx->vlen;
+                if (s != APR_SUCCESS) {
+                    ctx->status = URL_ERROR;
+                    return s;
                 }
+
+                apreq_value_table_add(&param->v, t);
+                ctx->status = URL_NAME;
+                ctx->nlen = 0;
+                ctx->vlen = 0;
+                e = APR_BRIGADE_SENTINEL(ctx->bb);
+                goto parse_url_brigade;
             }
             break;
         default:
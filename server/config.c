@@ -50,6 +50,7 @@
 #include "http_vhost.h"
 #include "util_cfgtree.h"
 #include "util_varbuf.h"
+#include "util_time.h"
 #include "mpm_common.h"
 
 #define APLOG_UNSET   (APLOG_NO_MODULE - 1)
@@ -393,6 +394,7 @@ AP_CORE_DECLARE(int) ap_invoke_handler(request_rec *r)
     int result;
     const char *old_handler = r->handler;
     const char *ignore;
+    apr_time_t start;
 
     /*
      * The new insert_filter stage makes the most sense here.  We only use
@@ -440,7 +442,11 @@ AP_CORE_DECLARE(int) ap_invoke_handler(request_rec *r)
         r->handler = handler;
     }
 
+    start = ap_time_monotonic();
+    ap_request_cpu_enter(r);
     result = ap_run_handler(r);
+    ap_request_cpu_leave(r);
+    ap_request_phase_add(r, AP_REQUEST_PHASE_HANDLER, start);
 
     r->handler = old_handler;
 
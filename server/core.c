@@ -142,6 +142,26 @@ AP_DECLARE_DATA int ap_main_state = AP_SQ_MS_INITIAL_STARTUP;
 AP_DECLARE_DATA int ap_run_mode = AP_SQ_RM_UNKNOWN;
 AP_DECLARE_DATA int ap_config_generation = 0;
 
+#ifdef _APACHE_USDT_H_
+/* The semaphores of the USDT probes, incremented by the tracers */
+#define AP_USDT_SEMAPHORE(name) \
+    AP_DECLARE_DATA unsigned short ap_##name##_semaphore \
+        __attribute__((section(".probes")))
+AP_USDT_SEMAPHORE(input__filter__entry);
+AP_USDT_SEMAPHORE(input__filter__return);
+AP_USDT_SEMAPHORE(output__filter__entry);
+AP_USDT_SEMAPHORE(output__filter__return);
+AP_USDT_SEMAPHORE(proxy__acquire__entry);
+AP_USDT_SEMAPHORE(proxy__acquire__return);
+AP_USDT_SEMAPHORE(proxy__connect__entry);
+AP_USDT_SEMAPHORE(proxy__connect__return);
+AP_USDT_SEMAPHORE(timeout__queue__append);
+AP_USDT_SEMAPHORE(timeout__queue__expire);
+AP_USDT_SEMAPHORE(timeout__queue__remove);
+AP_USDT_SEMAPHORE(worker__queue__pop);
+AP_USDT_SEMAPHORE(worker__queue__push);
+#endif
+
 typedef struct {
     apr_ipsubnet_t *subnet;
     struct ap_logconf log;
@@ -203,6 +223,9 @@ static void *create_core_dir_config(apr_pool_t *a, char *dir)
 
     conf->enable_mmap = ENABLE_MMAP_UNSET;
     conf->enable_sendfile = ENABLE_SENDFILE_UNSET;
+    conf->enable_precompressed = ENABLE_PRECOMPRESSED_UNSET;
+    conf->etag_digest_cache = ETAG_DIGEST_CACHE_UNSET;
+    conf->early_hints = EARLY_HINTS_UNSET;
     conf->allow_encoded_slashes = 0;
     conf->decode_encoded_slashes = 0;
 
@@ -405,6 +428,18 @@ static void *merge_core_dir_configs(apr_pool_t *a, void *basev, void *newv)
     if (new->enable_sendfile != ENABLE_SENDFILE_UNSET) {
         conf->enable_sendfile = new->enable_sendfile;
     }
+
+    if (new->enable_precompressed != ENABLE_PRECOMPRESSED_UNSET) {
+        conf->enable_precompressed = new->enable_precompressed;
+    }
+
+    if (new->etag_digest_cache != ETAG_DIGEST_CACHE_UNSET) {
+        conf->etag_digest_cache = new->etag_digest_cache;
+    }
+
+    if (new->early_hints != EARLY_HINTS_UNSET) {
+        conf->early_hints = new->early_hints;
+    }
  
     if (new->read_buf_size) {
         conf->read_buf_size = new->read_buf_size;
@@ -518,6 +553,9 @@ static void *create_core_server_config(apr_pool_t *a, server_rec *s)
     conf->async_filter = 0;
     conf->strict_host_check= AP_CORE_CONFIG_UNSET; 
     conf->merge_slashes    = AP_CORE_CONFIG_UNSET; 
+    conf->request_tables_autosize = AP_CORE_CONFIG_UNSET;
+    conf->request_tables_sizes = apr_pcalloc(a, AP_REQUEST_TABLES_NUM *
+                                    sizeof(*conf->request_tables_sizes));
 
     return (void *)conf;
 }
@@ -612,6 +650,8 @@ static void *merge_core_server_configs(apr_pool_t *p, void *basev, void *virtv)
     conf->flush_max_pipelined = (virt->flush_max_pipelined >= 0)
                                   ? virt->flush_max_pipelined
                                   : base->flush_max_pipelined;
+    /* global only */
+    conf->flush_max_memory = base->flush_max_memory;
 
     conf->strict_host_check = (virt->strict_host_check != AP_CORE_CONFIG_UNSET)
                               ? virt->strict_host_check 
@@ -619,6 +659,11 @@ static void *merge_core_server_configs(apr_pool_t *p, void *basev, void *virtv)
 
     AP_CORE_MERGE_FLAG(strict_host_check, conf, base, virt);
     AP_CORE_MERGE_FLAG(merge_slashes, conf, base, virt);
+    AP_CORE_MERGE_FLAG(request_tables_autosize, conf, base, virt);
+
+    /* Runtime state, per server */
+    conf->request_tables_sizes = apr_pcalloc(p, AP_REQUEST_TABLES_NUM *
+                                    sizeof(*conf->request_tables_sizes));
 
     return conf;
 }
@@ -2341,6 +2386,57 @@ static const char *set_enable_sendfile(cmd_parms *cmd, void *d_,
     return NULL;
 }
 
+static const char *set_enable_precompressed(cmd_parms *cmd, void *d_,
+                                            const char *arg)
+{
+    core_dir_config *d = d_;
+
+    if (ap_cstr_casecmp(arg, "on") == 0) {
+        d->enable_precompressed = ENABLE_PRECOMPRESSED_ON;
+    }
+    else if (ap_cstr_casecmp(arg, "off") == 0) {
+        d->enable_precompressed = ENABLE_PRECOMPRESSED_OFF;
+    }
+    else {
+        return "parameter must be 'on' or 'off'";
+    }
+
+    return NULL;
+}
+
+static const char *set_etag_digest_cache(cmd_parms *cmd, void *d_,
+                                         const char *arg)
+{
+    core_dir_config *d = d_;
+
+    if (ap_cstr_casecmp(arg, "xattr") == 0) {
+        d->etag_digest_cache = ETAG_DIGEST_CACHE_XATTR;
+    }
+    else if (ap_cstr_casecmp(arg, "off") == 0) {
+        d->etag_digest_cache = ETAG_DIGEST_CACHE_OFF;
+    }
+    else {
+        return "parameter must be 'XAttr' or 'Off'";
+    }
+
+    return NULL;
+}
+
+/* Whether any EarlyHints is on, for the child to set up its cache */
+static int early_hints_used = 0;
+
+static const char *set_early_hints(cmd_parms *cmd, void *d_, int arg)
+{
+    core_dir_config *d = d_;
+
+    d->early_hints = arg ? EARLY_HINTS_ON : EARLY_HINTS_OFF;
+    if (arg) {
+        early_hints_used = 1;
+    }
+
+    return NULL;
+}
+
 static const char *set_read_buf_size(cmd_parms *cmd, void *d_,
                                      const char *arg)
 {
@@ -2380,6 +2476,30 @@ static const char *set_flush_max_threshold(cmd_parms *cmd, void *d_,
     return NULL;
 }
 
+static const char *set_flush_max_memory(cmd_parms *cmd, void *d_,
+                                        const char *arg)
+{
+    core_server_config *conf =
+        ap_get_core_module_config(cmd->server->module_config);
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+    apr_off_t size;
+    char *end;
+
+    if (err != NULL) {
+        return err;
+    }
+
+    if (apr_strtoff(&size, arg, &end, 10)
+            || *end || size < 0 || size > APR_SIZE_MAX)
+        return apr_pstrcat(cmd->pool,
+                           "parameter must be a non-negative number of "
+                           "bytes: ", arg, NULL);
+
+    conf->flush_max_memory = (apr_size_t)size;
+
+    return NULL;
+}
+
 static const char *set_flush_max_pipelined(cmd_parms *cmd, void *d_,
                                            const char *arg)
 {
@@ -3049,6 +3169,61 @@ static const char *virtualhost_section(cmd_parms *cmd, void *dummy,
     return errmsg;
 }
 
+/* StatCache, see ap_stat_cached() */
+#define STAT_CACHE_DEFAULT_SIZE 8192
+static apr_interval_time_t stat_cache_ttl = 0;
+static int stat_cache_size = STAT_CACHE_DEFAULT_SIZE;
+
+static const char *set_stat_cache(cmd_parms *cmd, void *dummy,
+                                  const char *ttl, const char *size)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+    if (err != NULL) {
+        return err;
+    }
+
+    if (ap_timeout_parameter_parse(ttl, &stat_cache_ttl, "s") != APR_SUCCESS
+        || stat_cache_ttl < 0) {
+        return "StatCache TTL must be a positive duration, or 0 to disable";
+    }
+    if (size) {
+        stat_cache_size = atoi(size);
+        if (stat_cache_size <= 0) {
+            return "StatCache size must be a positive number of entries";
+        }
+    }
+    return NULL;
+}
+
+static int section_merge_cache = 0;
+
+static const char *set_section_merge_cache(cmd_parms *cmd, void *dummy,
+                                           const char *arg)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+    if (err != NULL) {
+        return err;
+    }
+
+    section_merge_cache = atoi(arg);
+    if (section_merge_cache < 0) {
+        return "SectionMergeCache must be a positive number of entries "
+               "or 0";
+    }
+    return NULL;
+}
+
+static const char *set_regex_jit(cmd_parms *cmd, void *dummy, int flag)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+    if (err != NULL) {
+        return err;
+    }
+
+    ap_regcomp_set_jit(flag);
+    return NULL;
+}
+
 static const char *set_regex_default_options(cmd_parms *cmd,
                                              void *dummy,
                                              const char *arg)
@@ -3323,6 +3498,35 @@ static const char *set_state_dir(cmd_parms *cmd, void *dummy, const char *arg)
     return NULL;
 }
 
+static int shm_options = 0;
+
+static const char *set_shm_options(cmd_parms *cmd, void *dummy,
+                                   const char *arg)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+
+    if (err != NULL) {
+        return err;
+    }
+
+    if (strcasecmp(arg, "HugePages") == 0) {
+        shm_options |= AP_SHM_HUGEPAGES;
+    }
+    else if (strcasecmp(arg, "Prefault") == 0) {
+        shm_options |= AP_SHM_PREFAULT;
+    }
+    else if (strcasecmp(arg, "None") == 0) {
+        shm_options = 0;
+    }
+    else {
+        return apr_pstrcat(cmd->pool, "SharedMemoryOptions: unknown option '",
+                           arg, "', use HugePages, Prefault or None", NULL);
+    }
+    ap_shm_set_flags(shm_options);
+
+    return NULL;
+}
+
 static const char *set_timeout(cmd_parms *cmd, void *dummy, const char *arg)
 {
     const char *err = ap_check_cmd_context(cmd, NOT_IN_DIR_CONTEXT);
@@ -4737,10 +4941,18 @@ AP_INIT_TAKE1("DefaultType", set_default_type, NULL, OR_FILEINFO,
   "the default media type for otherwise untyped files (DEPRECATED)"),
 AP_INIT_RAW_ARGS("FileETag", set_etag_bits, NULL, OR_FILEINFO,
   "Specify components used to construct a file's ETag"),
+AP_INIT_TAKE1("FileETagDigestCache", set_etag_digest_cache, NULL, OR_FILEINFO,
+  "Whether the digest of FileETag Digest is kept in an extended attribute"),
+AP_INIT_FLAG("EarlyHints", set_early_hints, NULL, OR_FILEINFO,
+  "Whether the preload links of the previous responses are sent in a "
+  "103 Early Hints response"),
 AP_INIT_TAKE1("EnableMMAP", set_enable_mmap, NULL, OR_FILEINFO,
   "Controls whether memory-mapping may be used to read files"),
 AP_INIT_TAKE1("EnableSendfile", set_enable_sendfile, NULL, OR_FILEINFO,
   "Controls whether sendfile may be used to transmit files"),
+AP_INIT_TAKE1("EnablePrecompressed", set_enable_precompressed, NULL,
+  OR_FILEINFO,
+  "Controls whether precompressed .br and .gz siblings of files are served"),
 AP_INIT_TAKE1("ReadBufferSize", set_read_buf_size, NULL, ACCESS_CONF|RSRC_CONF,
   "Size (in bytes) of the memory buffers used to read data"),
 AP_INIT_TAKE1("FlushMaxThreshold", set_flush_max_threshold, NULL, RSRC_CONF,
@@ -4748,6 +4960,9 @@ AP_INIT_TAKE1("FlushMaxThreshold", set_flush_max_threshold, NULL, RSRC_CONF,
 AP_INIT_TAKE1("FlushMaxPipelined", set_flush_max_pipelined, NULL, RSRC_CONF,
   "Maximum number of pipelined responses (pending) above which they are "
   "flushed to the network"),
+AP_INIT_TAKE1("FlushMaxMemory", set_flush_max_memory, NULL, RSRC_CONF,
+  "Maximum memory of the pending data of all the connections of a child, "
+  "above which they are flushed to the network, or closed"),
 
 /* Old server config file commands */
 
@@ -4774,11 +4989,22 @@ AP_INIT_TAKE1("DefaultRuntimeDir", set_runtime_dir, NULL, RSRC_CONF | EXEC_ON_RE
   "Common directory for run-time files (shared memory, locks, etc.)"),
 AP_INIT_TAKE1("DefaultStateDir", set_state_dir, NULL, RSRC_CONF | EXEC_ON_READ,
   "Common directory for persistent state (databases, long-lived caches, etc.)"),
+AP_INIT_ITERATE("SharedMemoryOptions", set_shm_options, NULL, RSRC_CONF,
+  "How to prepare the shared memory segments: HugePages, Prefault or None"),
 AP_INIT_TAKE12("ErrorLog", set_errorlog,
   (void *)APR_OFFSETOF(server_rec, error_fname), RSRC_CONF,
   "The filename of the error log"),
 AP_INIT_TAKE12("ErrorLogFormat", set_errorlog_format, NULL, RSRC_CONF,
   "Format string for the ErrorLog"),
+#if defined(AP_HAVE_RELIABLE_PIPED_LOGS) && APR_HAS_SHARED_MEMORY
+AP_INIT_TAKE1("PipedLogRing", ap_set_piped_log_ring, NULL, RSRC_CONF,
+  "Off or the size (bytes) of the shared memory ring to each piped logger"),
+#endif
+#if APR_HAS_THREADS
+AP_INIT_TAKE123("ErrorLogAsync", ap_set_error_log_async, NULL, RSRC_CONF,
+  "On or Off to write the error log from a dedicated thread, optionally "
+  "followed by the buffer size (bytes) and the repeated messages interval"),
+#endif
 AP_INIT_RAW_ARGS("ServerAlias", set_server_alias, NULL, RSRC_CONF,
   "A name or names alternately used to access the server"),
 AP_INIT_TAKE1("ServerPath", set_serverpath, NULL, RSRC_CONF,
@@ -4863,6 +5089,14 @@ AP_INIT_TAKE12("RLimitNPROC", no_set_limit, NULL,
 
 AP_INIT_RAW_ARGS("RegexDefaultOptions", set_regex_default_options, NULL, RSRC_CONF,
                  "default options for regexes (prefixed by '+' to add, '-' to del)"),
+AP_INIT_FLAG("RegexJIT", set_regex_jit, NULL, RSRC_CONF,
+             "'off' to not JIT compile the regexes configured afterward"),
+AP_INIT_TAKE12("StatCache", set_stat_cache, NULL, RSRC_CONF,
+               "how long each child keeps the stat() results of the walks, "
+               "and optionally their maximum number"),
+AP_INIT_TAKE1("SectionMergeCache", set_section_merge_cache, NULL, RSRC_CONF,
+              "maximum number of merged configuration sections each child "
+              "keeps, 0 to disable"),
 
 /* internal recursion stopper */
 AP_INIT_TAKE12("LimitInternalRecursion", set_recursion_limit, NULL, RSRC_CONF,
@@ -4897,8 +5131,10 @@ AP_INIT_TAKE1("AllowEncodedSlashes", set_allow2f, NULL, RSRC_CONF,
 /* scoreboard.c directives */
 AP_INIT_TAKE1("ScoreBoardFile", ap_set_scoreboard, NULL, RSRC_CONF,
               "A file for Apache to maintain runtime process management information"),
-AP_INIT_FLAG("ExtendedStatus", ap_set_extended_status, NULL, RSRC_CONF,
-             "\"On\" to track extended status information, \"Off\" to disable"),
+AP_INIT_TAKE1("ExtendedStatus", ap_set_extended_status, NULL, RSRC_CONF,
+              "\"On\" to track extended status information, \"Off\" to "
+              "disable, \"Lazy\" to only track the request strings while "
+              "the status is viewed"),
 AP_INIT_FLAG("SeeRequestTail", ap_set_reqtail, NULL, RSRC_CONF,
              "For extended status, \"On\" to see the last 63 chars of "
              "the request line, \"Off\" (default) to see the first 63"),
@@ -4922,6 +5158,12 @@ AP_INIT_TAKE1("MaxMemFree", ap_mpm_set_max_mem_free, NULL, RSRC_CONF,
               "Maximum number of 1k blocks a particular child's allocator may hold."),
 AP_INIT_TAKE1("ThreadStackSize", ap_mpm_set_thread_stacksize, NULL, RSRC_CONF,
               "Size in bytes of stack used by threads handling client connections"),
+AP_INIT_TAKE1("PriorityWorkers", ap_mpm_set_priority_workers, NULL, RSRC_CONF,
+              "Number of worker threads per child kept for the connections "
+              "of the priority listeners"),
+AP_INIT_TAKE_ARGV("ChildCPUAffinity", ap_mpm_set_child_cpu_affinity, NULL,
+                  RSRC_CONF, "'off', 'numa' or the CPU lists child processes "
+                  "are bound to (round-robin)"),
 #if AP_ENABLE_EXCEPTION_HOOK
 AP_INIT_TAKE1("EnableExceptionHook", ap_mpm_set_exception_hook, NULL, RSRC_CONF,
               "Controls whether exception hook may be called after a crash"),
@@ -4952,6 +5194,11 @@ AP_INIT_FLAG("MergeSlashes", set_core_server_flag,
              (void *)APR_OFFSETOF(core_server_config, merge_slashes),  
              RSRC_CONF,
              "Controls whether consecutive slashes in the URI path are merged"),
+AP_INIT_FLAG("RequestTablesAutoSize", set_core_server_flag,
+             (void *)APR_OFFSETOF(core_server_config, request_tables_autosize),
+             RSRC_CONF,
+             "Controls whether the request tables are initially sized from "
+             "the previous requests"),
 { NULL }
 };
 
@@ -5089,6 +5336,95 @@ static int core_override_type(request_rec *r)
     return OK;
 }
 
+/* Precompressed siblings of a file, in order of preference */
+static const struct {
+    const char *coding;
+    const char *suffix;
+} precompressed_codings[] = {
+    { "br", ".br" },
+    { "gzip", ".gz" },
+    { NULL, NULL }
+};
+
+/*
+ * Whether the request's Accept-Encoding allows the given coding, taking
+ * q-values and the wildcard into account.
+ */
+static int accepts_coding(request_rec *r, const char *coding)
+{
+    const char *field = ap_get_request_header(r, AP_HDR_ACCEPT_ENCODING);
+    const char *item;
+    int any = 0;
+
+    if (!field) {
+        return 0;
+    }
+
+    while ((item = ap_get_list_item(r->pool, &field))) {
+        const char *params = item;
+        const char *name = ap_getword(r->pool, &params, ';');
+        int acceptable = 1;
+
+        while (*params) {
+            const char *param = ap_getword(r->pool, &params, ';');
+            if (param[0] == 'q' && param[1] == '=') {
+                acceptable = (atof(param + 2) > 0);
+            }
+        }
+
+        if (!strcmp(name, coding)
+            || (!strcmp(coding, "gzip") && !strcmp(name, "x-gzip"))) {
+            return acceptable;
+        }
+        if (!strcmp(name, "*")) {
+            any = acceptable;
+        }
+    }
+
+    return any;
+}
+
+/*
+ * Look for a precompressed sibling of r->filename (file.br, file.gz) that
+ * is at least as recent as the file itself and acceptable to the client.
+ * Siblings which are out of date are ignored, so a stale one can never
+ * be served. Returns the coding of the chosen sibling, with its name and
+ * finfo, or NULL when the file itself is to be served.
+ */
+static const char *find_precompressed(request_rec *r, const char **fname,
+                                      apr_finfo_t *finfo)
+{
+    const char *coding = NULL;
+    int i, vary = 0;
+
+    for (i = 0; precompressed_codings[i].coding; i++) {
+        const char *name;
+        apr_finfo_t sb;
+
+        name = apr_pstrcat(r->pool, r->filename,
+                           precompressed_codings[i].suffix, NULL);
+        if (apr_stat(&sb, name, APR_FINFO_MIN, r->pool) != APR_SUCCESS
+            || sb.filetype != APR_REG || sb.mtime < r->finfo.mtime) {
+            continue;
+        }
+
+        /* the response now depends on Accept-Encoding, whatever is sent */
+        vary = 1;
+
+        if (!coding && accepts_coding(r, precompressed_codings[i].coding)) {
+            coding = precompressed_codings[i].coding;
+            *fname = name;
+            *finfo = sb;
+        }
+    }
+
+    if (vary) {
+        apr_table_mergen(r->headers_out, "Vary", "Accept-Encoding");
+    }
+
+    return coding;
+}
+
 static int default_handler(request_rec *r)
 {
     conn_rec *c = r->connection;
@@ -5098,6 +5434,9 @@ static int default_handler(request_rec *r)
     int errstatus;
     apr_file_t *fd = NULL;
     apr_status_t status;
+    const char *fname, *coding = NULL;
+    apr_finfo_t *finfo = &r->finfo;
+    apr_finfo_t sidecar;
 
     d = (core_dir_config *)ap_get_core_module_config(r->per_dir_config);
 
@@ -5161,21 +5500,60 @@ static int default_handler(request_rec *r)
         }
 
 
-        if ((status = apr_file_open(&fd, r->filename, APR_READ | APR_BINARY
+        /* Serve a precompressed sibling in place of the file if the
+         * client accepts it. Subrequests are left alone, since their
+         * output is usually embedded in another response.
+         */
+        fname = r->filename;
+        if (d->enable_precompressed == ENABLE_PRECOMPRESSED_ON
+            && r->method_number == M_GET && !r->main
+            && !r->content_encoding) {
+            coding = find_precompressed(r, &fname, &sidecar);
+            if (coding) {
+                finfo = &sidecar;
+            }
+        }
+
+        if ((status = apr_file_open(&fd, fname, APR_READ | APR_BINARY
 #if APR_HAS_SENDFILE
                             | AP_SENDFILE_ENABLED(d->enable_sendfile)
 #endif
                                     , 0, r->pool)) != APR_SUCCESS) {
             ap_log_rerror(APLOG_MARK, APLOG_ERR, status, r, APLOGNO(00132)
-                          "file permissions deny server access: %s", r->filename);
+                          "file permissions deny server access: %s", fname);
             return HTTP_FORBIDDEN;
         }
 
         ap_update_mtime(r, r->finfo.mtime);
         ap_set_last_modified(r);
-        ap_set_etag_fd(r, fd);
+        if (coding) {
+            etag_rec er;
+            char *etag;
+
+            ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r,
+                          "serving precompressed %s", fname);
+            r->content_encoding = coding;
+
+            /* the entity tag is the sibling's, so it differs per coding */
+            er.vlist_validator = r->vlist_validator;
+            er.request_time = r->request_time;
+            er.finfo = finfo;
+            er.pathname = NULL;
+            er.fd = fd;
+            er.force_weak = 0;
+            etag = ap_make_etag_ex(r, &er);
+            if (etag && etag[0]) {
+                apr_table_setn(r->headers_out, "ETag", etag);
+            }
+            else {
+                apr_table_setn(r->notes, "no-etag", "omit");
+            }
+        }
+        else {
+            ap_set_etag_fd(r, fd);
+        }
         ap_set_accept_ranges(r);
-        ap_set_content_length(r, r->finfo.size);
+        ap_set_content_length(r, finfo->size);
 
         bb = apr_brigade_create(r->pool, c->bucket_alloc);
 
@@ -5184,7 +5562,7 @@ static int default_handler(request_rec *r)
             r->status = errstatus;
         }
         else {
-            e = apr_brigade_insert_file(bb, fd, 0, r->finfo.size, r->pool);
+            e = apr_brigade_insert_file(bb, fd, 0, finfo->size, r->pool);
 
 #if APR_HAS_MMAP
             if (d->enable_mmap == ENABLE_MMAP_OFF) {
@@ -5306,6 +5684,13 @@ static int core_pre_config(apr_pool_t *pconf, apr_pool_t *plog, apr_pool_t *ptem
     apr_pool_cleanup_register(pconf, NULL, reset_config, apr_pool_cleanup_null);
 
     ap_regcomp_set_default_cflags(AP_REG_DEFAULT);
+    ap_regcomp_set_jit(1);
+    section_merge_cache = 0;
+    stat_cache_ttl = 0;
+    stat_cache_size = STAT_CACHE_DEFAULT_SIZE;
+    early_hints_used = 0;
+    shm_options = 0;
+    ap_shm_set_flags(0);
 
     mpm_common_pre_config(pconf);
 
@@ -5337,6 +5722,17 @@ static int core_post_config(apr_pool_t *pconf, apr_pool_t *plog, apr_pool_t *pte
     return OK;
 }
 
+static int core_post_config_last(apr_pool_t *pconf, apr_pool_t *plog,
+                                 apr_pool_t *ptemp, server_rec *s)
+{
+    /* After all the modules' post_config, once the configuration is final;
+     * nothing to share before the real startup */
+    if (ap_state_query(AP_SQ_MAIN_STATE) != AP_SQ_MS_CREATE_PRE_CONFIG) {
+        ap_preload_merge_cache(pconf, ptemp, s, section_merge_cache);
+    }
+    return OK;
+}
+
 static void core_insert_filter(request_rec *r)
 {
     core_dir_config *conf = (core_dir_config *)
@@ -5702,6 +6098,9 @@ static apr_random_t *rng = NULL;
 static apr_thread_mutex_t *rng_mutex = NULL;
 #endif
 
+static void stat_cache_child_init(apr_pool_t *pchild, server_rec *s);
+static void early_hints_child_init(apr_pool_t *pchild, server_rec *s);
+
 static void core_child_init(apr_pool_t *pchild, server_rec *s)
 {
     apr_proc_t proc;
@@ -5725,6 +6124,10 @@ static void core_child_init(apr_pool_t *pchild, server_rec *s)
      * connection socket. */
     apr_socket_create(&dummy_socket, APR_INET, SOCK_STREAM,
                       APR_PROTO_TCP, pchild);
+
+    ap_init_merge_cache(pchild, s, section_merge_cache);
+    stat_cache_child_init(pchild, s);
+    early_hints_child_init(pchild, s);
 }
 
 static void core_optional_fn_retrieve(void)
@@ -5827,10 +6230,472 @@ static apr_status_t core_insert_network_bucket(conn_rec *c,
     return APR_SUCCESS;
 }
 
+/*
+ * The child's stat() cache (StatCache).  A direct mapped table: a path
+ * replaces whatever was in its slot, so the memory stays bounded and no
+ * eviction is needed.  The results are copied out, nothing in the table
+ * is referenced after the slot's lock is released.
+ */
+typedef struct stat_cache_slot {
+    char *fname;              /* malloc()ed, NULL if the slot is free */
+    char *name;               /* malloc()ed copy of finfo.name, or NULL */
+    apr_uint32_t hash;
+    apr_int32_t wanted;
+    apr_status_t rv;
+    apr_time_t expires;
+    apr_finfo_t finfo;
+} stat_cache_slot;
+
+#define STAT_CACHE_LOCKS        64
+
+static stat_cache_slot *stat_cache = NULL;
+static apr_uint32_t stat_cache_mask;
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *stat_cache_locks[STAT_CACHE_LOCKS];
+#define stat_cache_lock(i) \
+    (stat_cache_locks[0] \
+     ? apr_thread_mutex_lock(stat_cache_locks[(i) % STAT_CACHE_LOCKS]) : 0)
+#define stat_cache_unlock(i) \
+    (stat_cache_locks[0] \
+     ? apr_thread_mutex_unlock(stat_cache_locks[(i) % STAT_CACHE_LOCKS]) : 0)
+#else
+#define stat_cache_lock(i) 0
+#define stat_cache_unlock(i) 0
+#endif
+
+static apr_status_t stat_cache_cleanup(void *dummy)
+{
+    apr_uint32_t i;
+
+    for (i = 0; i <= stat_cache_mask; ++i) {
+        free(stat_cache[i].fname);
+        free(stat_cache[i].name);
+    }
+    free(stat_cache);
+    stat_cache = NULL;
+
+    return APR_SUCCESS;
+}
+
+static void stat_cache_child_init(apr_pool_t *pchild, server_rec *s)
+{
+    apr_uint32_t size;
+
+    stat_cache = NULL;
+    if (stat_cache_ttl <= 0) {
+        return;
+    }
+
+    for (size = STAT_CACHE_LOCKS; size < (apr_uint32_t)stat_cache_size;
+         size <<= 1)
+        ;
+    stat_cache = calloc(size, sizeof(stat_cache_slot));
+    if (!stat_cache) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, APR_ENOMEM, s, APLOGNO(10419)
+                     "can't allocate the stat cache, it is disabled");
+        return;
+    }
+    stat_cache_mask = size - 1;
+
+#if APR_HAS_THREADS
+    memset(stat_cache_locks, 0, sizeof(stat_cache_locks));
+    {
+        int threaded_mpm, i;
+        if (ap_mpm_query(AP_MPMQ_IS_THREADED, &threaded_mpm) == APR_SUCCESS
+            && threaded_mpm) {
+            for (i = 0; i < STAT_CACHE_LOCKS; ++i) {
+                apr_thread_mutex_create(&stat_cache_locks[i],
+                                        APR_THREAD_MUTEX_DEFAULT, pchild);
+            }
+        }
+    }
+#endif
+
+    apr_pool_cleanup_register(pchild, NULL, stat_cache_cleanup,
+                              apr_pool_cleanup_null);
+}
+
+AP_DECLARE(apr_status_t) ap_stat_cached(apr_finfo_t *finfo, const char *fname,
+                                        apr_int32_t wanted, apr_pool_t *p)
+{
+    apr_ssize_t len = APR_HASH_KEY_STRING;
+    stat_cache_slot *slot;
+    apr_uint32_t h, i;
+    apr_time_t now;
+    apr_status_t rv;
+
+    if (!stat_cache) {
+        return apr_stat(finfo, fname, wanted, p);
+    }
+
+    h = apr_hashfunc_default(fname, &len) ^ (apr_uint32_t)wanted;
+    i = h & stat_cache_mask;
+    slot = &stat_cache[i];
+    now = apr_time_now();
+
+    stat_cache_lock(i);
+    if (slot->fname && slot->hash == h && slot->wanted == wanted
+        && now < slot->expires && !strcmp(slot->fname, fname)) {
+        *finfo = slot->finfo;
+        finfo->pool = p;
+        finfo->fname = fname;
+        finfo->name = slot->name ? apr_pstrdup(p, slot->name) : NULL;
+        rv = slot->rv;
+        stat_cache_unlock(i);
+        return rv;
+    }
+    stat_cache_unlock(i);
+
+    rv = apr_stat(finfo, fname, wanted, p);
+
+    /* Keep the answers the walks depend on, negative ones included, but
+     * not the transient errors.
+     */
+    if (rv == APR_SUCCESS || rv == APR_INCOMPLETE
+        || APR_STATUS_IS_ENOENT(rv) || APR_STATUS_IS_ENOTDIR(rv)) {
+        char *cfname = strdup(fname);
+        char *cname = NULL;
+
+        if (cfname && (finfo->valid & APR_FINFO_NAME) && finfo->name) {
+            cname = strdup(finfo->name);
+        }
+
+        stat_cache_lock(i);
+        free(slot->fname);
+        free(slot->name);
+        slot->fname = cfname;
+        slot->name = cname;
+        slot->hash = h;
+        slot->wanted = wanted;
+        slot->rv = rv;
+        slot->expires = now + stat_cache_ttl;
+        slot->finfo = *finfo;
+        slot->finfo.pool = NULL;
+        slot->finfo.fname = NULL;
+        slot->finfo.name = NULL;
+        slot->finfo.filehand = NULL;
+        stat_cache_unlock(i);
+    }
+
+    return rv;
+}
+
+/*
+ * EarlyHints: the child learns the preload and preconnect links of the
+ * responses and sends them in a 103 Early Hints response before running
+ * the handler of the next requests for the same URL.  Like the stat
+ * cache, a direct mapped table of malloc()ed strings bounds the memory.
+ */
+typedef struct early_hints_slot {
+    char *key;                /* malloc()ed, NULL if the slot is free */
+    char *links;              /* malloc()ed Link header value */
+    apr_uint32_t hash;
+} early_hints_slot;
+
+#define EARLY_HINTS_CACHE_SIZE  1024    /* a power of two */
+#define EARLY_HINTS_LOCKS       16
+
+static early_hints_slot *early_hints_cache = NULL;
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *early_hints_locks[EARLY_HINTS_LOCKS];
+#define early_hints_lock(i) \
+    (early_hints_locks[0] \
+     ? apr_thread_mutex_lock(early_hints_locks[(i) % EARLY_HINTS_LOCKS]) : 0)
+#define early_hints_unlock(i) \
+    (early_hints_locks[0] \
+     ? apr_thread_mutex_unlock(early_hints_locks[(i) % EARLY_HINTS_LOCKS]) : 0)
+#else
+#define early_hints_lock(i) 0
+#define early_hints_unlock(i) 0
+#endif
+
+static apr_status_t early_hints_cleanup(void *dummy)
+{
+    apr_uint32_t i;
+
+    for (i = 0; i < EARLY_HINTS_CACHE_SIZE; ++i) {
+        free(early_hints_cache[i].key);
+        free(early_hints_cache[i].links);
+    }
+    free(early_hints_cache);
+    early_hints_cache = NULL;
+
+    return APR_SUCCESS;
+}
+
+static void early_hints_child_init(apr_pool_t *pchild, server_rec *s)
+{
+    early_hints_cache = NULL;
+    if (!early_hints_used) {
+        return;
+    }
+
+    early_hints_cache = calloc(EARLY_HINTS_CACHE_SIZE,
+                               sizeof(early_hints_slot));
+    if (!early_hints_cache) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, APR_ENOMEM, s, APLOGNO(10574)
+                     "can't allocate the early hints cache, EarlyHints is "
+                     "disabled");
+        return;
+    }
+
+#if APR_HAS_THREADS
+    memset(early_hints_locks, 0, sizeof(early_hints_locks));
+    {
+        int threaded_mpm, i;
+        if (ap_mpm_query(AP_MPMQ_IS_THREADED, &threaded_mpm) == APR_SUCCESS
+            && threaded_mpm) {
+            for (i = 0; i < EARLY_HINTS_LOCKS; ++i) {
+                apr_thread_mutex_create(&early_hints_locks[i],
+                                        APR_THREAD_MUTEX_DEFAULT, pchild);
+            }
+        }
+    }
+#endif
+
+    apr_pool_cleanup_register(pchild, NULL, early_hints_cleanup,
+                              apr_pool_cleanup_null);
+}
+
+static int early_hints_enabled(request_rec *r)
+{
+    core_dir_config *d;
+
+    if (!early_hints_cache || r->main || r->method_number != M_GET
+        || r->proto_num < HTTP_VERSION(1,1)) {
+        return 0;
+    }
+    d = ap_get_core_module_config(r->per_dir_config);
+    return d->early_hints == EARLY_HINTS_ON;
+}
+
+static const char *early_hints_key(request_rec *r, apr_uint32_t *hash)
+{
+    apr_ssize_t len = APR_HASH_KEY_STRING;
+    const char *key = apr_pstrcat(r->pool, ap_get_server_name(r), r->uri,
+                                  NULL);
+
+    *hash = apr_hashfunc_default(key, &len);
+    return key;
+}
+
+static int early_hints_rel_type(const char *s, apr_size_t len)
+{
+    return (len == 7 && !ap_cstr_casecmpn(s, "preload", 7))
+        || (len == 10 && !ap_cstr_casecmpn(s, "preconnect", 10))
+        || (len == 13 && !ap_cstr_casecmpn(s, "modulepreload", 13));
+}
+
+/* The next ';' up to end outside a quoted string, or NULL */
+static const char *early_hints_param(const char *s, const char *end)
+{
+    for (; s < end; ++s) {
+        if (*s == ';') {
+            return s;
+        }
+        if (*s == '"') {
+            while (++s < end && *s != '"') {
+                if (*s == '\\') {
+                    ++s;
+                }
+            }
+        }
+    }
+    return NULL;
+}
+
+/* Whether the parameters of a link-value, up to end, have a hinted rel */
+static int early_hints_rel(const char *s, const char *end)
+{
+    const char *w;
+    int quoted;
+
+    while ((s = early_hints_param(s, end)) != NULL) {
+        for (++s; s < end && (*s == ' ' || *s == '\t'); ++s)
+            ;
+        if (end - s < 3 || ap_cstr_casecmpn(s, "rel", 3)) {
+            continue;
+        }
+        for (s += 3; s < end && (*s == ' ' || *s == '\t'); ++s)
+            ;
+        if (s == end || *s != '=') {
+            continue;
+        }
+        for (++s; s < end && (*s == ' ' || *s == '\t'); ++s)
+            ;
+        quoted = (s < end && *s == '"');
+        if (quoted) {
+            ++s;
+        }
+        /* a quoted rel is a space separated list of relation types */
+        for (;;) {
+            for (w = s; s < end && *s != ' ' && *s != '\t' && *s != ';'
+                        && *s != '"'; ++s)
+                ;
+            if (early_hints_rel_type(w, s - w)) {
+                return 1;
+            }
+            if (!quoted || s == end || (*s != ' ' && *s != '\t')) {
+                break;
+            }
+            while (s < end && (*s == ' ' || *s == '\t')) {
+                ++s;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Collect the link-values of a Link header worth an early hint */
+static int early_hints_collect(void *baton, const char *key,
+                               const char *value)
+{
+    apr_array_header_t *links = baton;
+    const char *s = value, *start, *params;
+
+    for (;;) {
+        while (*s == ',' || *s == ' ' || *s == '\t') {
+            ++s;
+        }
+        if (*s != '<' || !(params = ap_strchr_c(s, '>'))) {
+            /* not a link-value, skip it */
+            if (!*s || !(s = ap_strchr_c(s, ','))) {
+                break;
+            }
+            continue;
+        }
+        start = s;
+        /* the link-value ends at the next comma outside a quoted string */
+        for (s = params + 1; *s && *s != ','; ++s) {
+            if (*s == '"') {
+                while (s[1] && *++s != '"') {
+                    if (*s == '\\' && s[1]) {
+                        ++s;
+                    }
+                }
+            }
+        }
+        if (early_hints_rel(params, s)) {
+            const char *end = s;
+            while (end > start && (end[-1] == ' ' || end[-1] == '\t')) {
+                --end;
+            }
+            APR_ARRAY_PUSH(links, const char *) =
+                apr_pstrmemdup(links->pool, start, end - start);
+        }
+    }
+    return 1;
+}
+
+/* log_transaction: learn the hints of the final response */
+static int core_early_hints_learn(request_rec *r)
+{
+    request_rec *last = r;
+    apr_array_header_t *links;
+    early_hints_slot *slot;
+    const char *key;
+    char *value = NULL;
+    apr_uint32_t h, i;
+
+    if (r->prev || !early_hints_enabled(r)) {
+        return DECLINED;
+    }
+    while (last->next) {
+        last = last->next;
+    }
+    if (last->status != HTTP_OK) {
+        return DECLINED;
+    }
+
+    links = apr_array_make(r->pool, 4, sizeof(const char *));
+    apr_table_do(early_hints_collect, links, last->headers_out, "Link", NULL);
+    apr_table_do(early_hints_collect, links, last->err_headers_out, "Link",
+                 NULL);
+    if (links->nelts) {
+        value = apr_array_pstrcat(r->pool, links, ',');
+    }
+
+    key = early_hints_key(r, &h);
+    i = h & (EARLY_HINTS_CACHE_SIZE - 1);
+    slot = &early_hints_cache[i];
+
+    early_hints_lock(i);
+    if (slot->key && slot->hash == h && !strcmp(slot->key, key)) {
+        if (value && !strcmp(slot->links, value)) {
+            early_hints_unlock(i);
+            return DECLINED;
+        }
+    }
+    else if (!value) {
+        /* nothing to learn, keep the hints of the slot's URL */
+        early_hints_unlock(i);
+        return DECLINED;
+    }
+    free(slot->key);
+    free(slot->links);
+    slot->key = slot->links = NULL;
+    if (value) {
+        slot->key = strdup(key);
+        slot->links = strdup(value);
+        if (!slot->key || !slot->links) {
+            free(slot->key);
+            free(slot->links);
+            slot->key = slot->links = NULL;
+        }
+        slot->hash = h;
+    }
+    early_hints_unlock(i);
+
+    return DECLINED;
+}
+
+/* fixups: send the learned hints before the handler runs */
+static int core_early_hints(request_rec *r)
+{
+    apr_table_t *headers_out;
+    early_hints_slot *slot;
+    const char *key, *links = NULL, *status_line;
+    apr_uint32_t h, i;
+    int status;
+
+    if (r->prev || r->expecting_100 || !early_hints_enabled(r)) {
+        return DECLINED;
+    }
+
+    key = early_hints_key(r, &h);
+    i = h & (EARLY_HINTS_CACHE_SIZE - 1);
+    slot = &early_hints_cache[i];
+
+    early_hints_lock(i);
+    if (slot->key && slot->hash == h && !strcmp(slot->key, key)) {
+        links = apr_pstrdup(r->pool, slot->links);
+    }
+    early_hints_unlock(i);
+    if (!links) {
+        return DECLINED;
+    }
+
+    ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r,
+                  "sending early hints: %s", links);
+    headers_out = r->headers_out;
+    status = r->status;
+    status_line = r->status_line;
+    r->headers_out = apr_table_make(r->pool, 3);
+    apr_table_setn(r->headers_out, "Link", links);
+    r->status = 103;
+    r->status_line = "103 Early Hints";
+    ap_send_interim_response(r, 1);
+    r->headers_out = headers_out;
+    r->status = status;
+    r->status_line = status_line;
+
+    return DECLINED;
+}
+
 static apr_status_t core_dirwalk_stat(apr_finfo_t *finfo, request_rec *r,
                                       apr_int32_t wanted) 
 {
-    return apr_stat(finfo, r->filename, wanted, r->pool);
+    return ap_stat_cached(finfo, r->filename, wanted, r->pool);
 }
 
 static void core_dump_config(apr_pool_t *p, server_rec *s)
@@ -5883,9 +6748,9 @@ static int core_upgrade_handler(request_rec *r)
         return DECLINED;
     }
     
-    upgrade = apr_table_get(r->headers_in, "Upgrade");
+    upgrade = ap_get_request_header(r, AP_HDR_UPGRADE);
     if (upgrade && *upgrade) {
-        const char *conn = apr_table_get(r->headers_in, "Connection");
+        const char *conn = ap_get_request_header(r, AP_HDR_CONNECTION);
         if (ap_find_token(r->pool, conn, "upgrade")) {
             apr_array_header_t *offers = NULL;
             const char *err;
@@ -5967,6 +6832,7 @@ static void register_hooks(apr_pool_t *p)
 
     ap_hook_pre_config(core_pre_config, NULL, NULL, APR_HOOK_REALLY_FIRST);
     ap_hook_post_config(core_post_config,NULL,NULL,APR_HOOK_REALLY_FIRST);
+    ap_hook_post_config(core_post_config_last,NULL,NULL,APR_HOOK_REALLY_LAST);
     ap_hook_check_config(core_check_config,NULL,NULL,APR_HOOK_FIRST);
     ap_hook_test_config(core_dump_config,NULL,NULL,APR_HOOK_FIRST);
     ap_hook_translate_name(ap_core_translate,NULL,NULL,APR_HOOK_REALLY_LAST);
@@ -5980,6 +6846,8 @@ static void register_hooks(apr_pool_t *p)
     /* FIXME: I suspect we can eliminate the need for these do_nothings - Ben */
     ap_hook_type_checker(do_nothing,NULL,NULL,APR_HOOK_REALLY_LAST);
     ap_hook_fixups(core_override_type,NULL,NULL,APR_HOOK_REALLY_FIRST);
+    ap_hook_fixups(core_early_hints,NULL,NULL,APR_HOOK_REALLY_LAST);
+    ap_hook_log_transaction(core_early_hints_learn,NULL,NULL,APR_HOOK_MIDDLE);
     ap_hook_create_request(core_create_req, NULL, NULL, APR_HOOK_MIDDLE);
     APR_OPTIONAL_HOOK(proxy, create_req, core_create_proxy_req, NULL, NULL,
                       APR_HOOK_MIDDLE);
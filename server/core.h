@@ -31,6 +31,9 @@
 typedef struct conn_config_t {
     /** Socket belonging to the connection */
     apr_socket_t *socket;
+    /** Core output filter deferring its writes while requests are
+     * pipelined, if any */
+    ap_filter_t *deferred_output;
 } conn_config_t;
 
 #endif /* CORE_H */
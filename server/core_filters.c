@@ -54,6 +54,12 @@
 
 #include "mod_so.h" /* for ap_find_loaded_module_symbol */
 
+#ifdef HAVE_SPLICE
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#endif
+
 #define AP_MIN_SENDFILE_BYTES           (256)
 
 /**
@@ -80,6 +86,9 @@ typedef struct {
     apr_size_t bytes_written;
     struct iovec *vec;
     apr_size_t nvec;
+#ifdef HAVE_SPLICE
+    int no_splice;
+#endif
 } core_output_ctx_t;
 
 typedef struct {
@@ -87,6 +96,25 @@ typedef struct {
     apr_bucket_brigade *tmpbb;
 } core_input_ctx_t;
 
+/* Write what the core output filter deferred for pipelining (if anything),
+ * before a read on the socket which would block.
+ */
+static void flush_deferred_output(conn_rec *c, conn_config_t *cconf)
+{
+    ap_filter_t *of = cconf->deferred_output;
+    apr_bucket_brigade *bb;
+
+    cconf->deferred_output = NULL;
+
+    ap_log_cerror(APLOG_MARK, APLOG_TRACE6, 0, c,
+                  "core_input_filter: flushing deferred output before "
+                  "blocking read");
+    bb = ap_acquire_brigade(c);
+    APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_flush_create(c->bucket_alloc));
+    (void)ap_pass_brigade(of, bb);
+    ap_release_brigade(c, bb);
+}
+
 
 apr_status_t ap_core_input_filter(ap_filter_t *f, apr_bucket_brigade *b,
                                   ap_input_mode_t mode, apr_read_type_e block,
@@ -141,7 +169,19 @@ apr_status_t ap_core_input_filter(ap_filter_t *f, apr_bucket_brigade *b,
 
     if (mode == AP_MODE_GETLINE) {
         /* we are reading a single LF line, e.g. the HTTP headers */
-        rv = apr_brigade_split_line(b, ctx->bb, block, HUGE_STRING_LEN);
+        if (block == APR_BLOCK_READ && cconf->deferred_output) {
+            /* Don't block with pipelined responses still to be written */
+            rv = apr_brigade_split_line(b, ctx->bb, APR_NONBLOCK_READ,
+                                        HUGE_STRING_LEN);
+            if (APR_STATUS_IS_EAGAIN(rv)) {
+                flush_deferred_output(c, cconf);
+                rv = apr_brigade_split_line(b, ctx->bb, block,
+                                            HUGE_STRING_LEN);
+            }
+        }
+        else {
+            rv = apr_brigade_split_line(b, ctx->bb, block, HUGE_STRING_LEN);
+        }
         /* We should treat EAGAIN here the same as we do for EOF (brigade is
          * empty).  We do this by returning whatever we have read.  This may
          * or may not be bogus, but is consistent (for now) with EOF logic.
@@ -235,7 +275,17 @@ apr_status_t ap_core_input_filter(ap_filter_t *f, apr_bucket_brigade *b,
         AP_DEBUG_ASSERT(readbytes > 0);
 
         e = APR_BRIGADE_FIRST(ctx->bb);
-        rv = apr_bucket_read(e, &str, &len, block);
+        if (block == APR_BLOCK_READ && cconf->deferred_output) {
+            /* Don't block with pipelined responses still to be written */
+            rv = apr_bucket_read(e, &str, &len, APR_NONBLOCK_READ);
+            if (APR_STATUS_IS_EAGAIN(rv)) {
+                flush_deferred_output(c, cconf);
+                rv = apr_bucket_read(e, &str, &len, block);
+            }
+        }
+        else {
+            rv = apr_bucket_read(e, &str, &len, block);
+        }
         if (rv != APR_SUCCESS) {
             if (APR_STATUS_IS_EAGAIN(rv) && block == APR_NONBLOCK_READ) {
                 /* getting EAGAIN for a blocking read is an error; not for a
@@ -351,6 +401,14 @@ static apr_status_t sendfile_nonblocking(apr_socket_t *s,
                                          conn_rec *c);
 #endif
 
+#ifdef HAVE_SPLICE
+static apr_status_t splice_nonblocking(apr_socket_t *s,
+                                       apr_bucket *bucket,
+                                       apr_size_t bytes_to_write,
+                                       core_output_ctx_t *ctx,
+                                       conn_rec *c);
+#endif
+
 /* Optional function coming from mod_logio, used for logging of output
  * traffic
  */
@@ -392,6 +450,29 @@ apr_status_t ap_core_output_filter(ap_filter_t *f, apr_bucket_brigade *bb)
         return APR_SUCCESS;
     }
 
+    /* While requests are pipelined (i.e. more data are pending in the input
+     * filters), defer the writes until the last one is processed so that
+     * the responses get coalesced, unless the ap_filter_reinstate_brigade()
+     * rules (FLUSH, FlushMaxThreshold, FlushMaxPipelined) say otherwise.
+     * The MPM's write completion (WC bucket) is never deferred, and the
+     * core input filter writes the deferred data before blocking anyway.
+     */
+    cconf->deferred_output = NULL;
+    if (c->keepalive != AP_CONN_CLOSE
+            && !AP_BUCKET_IS_WC(APR_BRIGADE_LAST(bb))
+            && ap_filter_has_input_pending(c) == OK) {
+        apr_bucket *flush_upto;
+
+        ap_filter_reinstate_brigade(f, bb, &flush_upto);
+        if (!flush_upto) {
+            ap_log_cerror(APLOG_MARK, APLOG_TRACE6, 0, c,
+                          "core_output_filter: deferring write of "
+                          "pipelined response(s)");
+            cconf->deferred_output = f;
+            return ap_filter_setaside_brigade(f, bb);
+        }
+    }
+
     /* Non-blocking writes on the socket in any case. */
     apr_socket_timeout_get(sock, &sock_timeout);
     apr_socket_timeout_set(sock, 0);
@@ -481,6 +562,34 @@ static APR_INLINE int can_sendfile_bucket(apr_bucket *b)
 }
 #endif
 
+#ifdef HAVE_SPLICE
+static APR_INLINE apr_size_t can_splice_bucket(apr_bucket *b)
+{
+    /* Splice the data of a pipe bucket straight to the socket, that is the
+     * number of bytes currently readable from the pipe, unless:
+     *   - the bucket is not a pipe bucket, or
+     *   - the pipe is buffered by APR, or
+     *   - the pipe is not a fifo (e.g. mod_cgid's unix socket), or
+     *   - the pipe is empty, let the regular read path wait for the data
+     *     (or EOF) then.
+     */
+    if (APR_BUCKET_IS_PIPE(b)) {
+        apr_file_t *file = b->data;
+        apr_os_file_t fd;
+        struct stat st;
+        int avail = 0;
+
+        if (!(apr_file_flags_get(file) & APR_FOPEN_BUFFERED)
+                && apr_os_file_get(&fd, file) == APR_SUCCESS
+                && fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode)
+                && ioctl(fd, FIONREAD, &avail) == 0 && avail > 0) {
+            return avail;
+        }
+    }
+    return 0;
+}
+#endif
+
 static void delete_meta_bucket(apr_bucket *bucket)
 {
     if (AP_BUCKET_IS_EOR(bucket)) {
@@ -548,6 +657,26 @@ static apr_status_t send_brigade_nonblocking(apr_socket_t *s,
         }
 #endif /* APR_HAS_SENDFILE */
 
+#ifdef HAVE_SPLICE
+        if (!ctx->no_splice && (length = can_splice_bucket(bucket))) {
+            if (nvec > 0) {
+                rv = writev_nonblocking(s, bb, ctx, nbytes, nvec, c);
+                if (rv != APR_SUCCESS) {
+                    goto cleanup;
+                }
+                nbytes = 0;
+                nvec = 0;
+            }
+            rv = splice_nonblocking(s, bucket, length, ctx, c);
+            if (rv != APR_SUCCESS) {
+                goto cleanup;
+            }
+            /* The pipe bucket stays until it's read at EOF */
+            next = bucket;
+            continue;
+        }
+#endif /* HAVE_SPLICE */
+
         if (bucket->length) {
             /* Non-blocking read first, in case this is a morphing
              * bucket type. */
@@ -742,3 +871,55 @@ static apr_status_t sendfile_nonblocking(apr_socket_t *s,
 }
 
 #endif
+
+#ifdef HAVE_SPLICE
+
+static apr_status_t splice_nonblocking(apr_socket_t *s,
+                                       apr_bucket *bucket,
+                                       apr_size_t bytes_to_write,
+                                       core_output_ctx_t *ctx,
+                                       conn_rec *c)
+{
+    apr_status_t rv = APR_SUCCESS;
+    apr_size_t bytes_written = 0;
+    apr_os_file_t fd;
+    apr_os_sock_t sd;
+
+    apr_os_file_get(&fd, bucket->data);
+    apr_os_sock_get(&sd, s);
+
+    /* The data are readable from the pipe so EAGAIN means that the socket
+     * is full, and the pipe bucket can be read in the usual way afterward
+     * since splice()d data are consumed from the pipe.
+     */
+    while (bytes_written < bytes_to_write) {
+        ssize_t n = splice(fd, NULL, sd, NULL, bytes_to_write - bytes_written,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n > 0) {
+            bytes_written += n;
+        }
+        else if (n == 0) {
+            break;
+        }
+        else if (errno == EINVAL && !bytes_written) {
+            /* Not supported for this socket, don't try again */
+            ctx->no_splice = 1;
+            break;
+        }
+        else if (errno != EINTR) {
+            rv = APR_FROM_OS_ERROR(errno);
+            break;
+        }
+    }
+    if ((ap__logio_add_bytes_out != NULL) && (bytes_written > 0)) {
+        ap__logio_add_bytes_out(c, bytes_written);
+    }
+    ctx->bytes_written += bytes_written;
+
+    ap_log_cerror(APLOG_MARK, APLOG_TRACE6, rv, c,
+                  "splice_nonblocking: %" APR_SIZE_T_FMT "/%" APR_SIZE_T_FMT,
+                  bytes_written, bytes_to_write);
+    return rv;
+}
+
+#endif
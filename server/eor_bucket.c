@@ -35,6 +35,8 @@ static apr_status_t eor_bucket_cleanup(void *data)
          * eor_bucket_destroy from trying to destroy the pool again.
          */
         *rp = NULL;
+        /* The response is sent, update the timings */
+        ap_request_phase_sent(r);
         /* Update child status and log the transaction */
         ap_update_child_status(r->connection->sbh, SERVER_BUSY_LOG, r);
         ap_run_log_transaction(r);
@@ -16,6 +16,7 @@
 
 #include "apr_network_io.h"
 #include "apr_strings.h"
+#include "apr_lib.h"
 
 #define APR_WANT_STRFUNC
 #include "apr_want.h"
@@ -34,6 +35,19 @@
 #if APR_HAVE_UNISTD_H
 #include <unistd.h>
 #endif
+#if APR_HAVE_NETINET_TCP_H
+#include <netinet/tcp.h>    /* for TCP_NOTSENT_LOWAT, TCP_FASTOPEN */
+#endif
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+#include <linux/filter.h>   /* for the ListenCPUSteering program */
+#define HAVE_LISTEN_CPU_STEERING 1
+#endif
+#if defined(TCP_FASTOPEN) || defined(TCP_CONGESTION) || defined(SO_BUSY_POLL)
+#define HAVE_LISTEN_SOCKOPTS 1
+#endif
+
+/* The TCP_FASTOPEN queue length of a bare options=fastopen */
+#define DEFAULT_LISTEN_FASTOPEN 256
 
 /* we know core's module_index is 0 */
 #undef APLOG_MODULE_INDEX
@@ -63,10 +77,60 @@ static int ap_listenbacklog;
 static int ap_listencbratio;
 static int send_buffer_size;
 static int receive_buffer_size;
+static int send_lowat;
+static int listen_cpu_steering;
 #ifdef HAVE_SYSTEMD
 static int use_systemd = -1;
 #endif
 
+#ifdef HAVE_LISTEN_SOCKOPTS
+/* Set the valued options= of a Listen on its socket, before listen() for
+ * TCP_FASTOPEN. The accepted connections inherit them, the failures are
+ * not fatal (e.g. an unknown congestion control algorithm).
+ */
+static void set_listen_sockopt(apr_pool_t *p, ap_listen_rec *server,
+                               int level, int optname, const char *name,
+                               const void *val, int len)
+{
+    apr_os_sock_t thesock;
+
+    apr_os_sock_get(&thesock, server->sd);
+    if (setsockopt(thesock, level, optname, val, len) < 0) {
+        apr_status_t stat = apr_get_netos_error();
+        ap_log_perror(APLOG_MARK, APLOG_WARNING, stat, p, APLOGNO(10577)
+                      "make_sock: failed to set the Listen option '%s' "
+                      "for address %pI, using default",
+                      name, server->bind_addr);
+        /* not a fatal error */
+    }
+}
+
+static void set_listen_sockopts(apr_pool_t *p, ap_listen_rec *server)
+{
+    ap_listen_sockopts_t *opts = server->sockopts;
+
+#ifdef TCP_FASTOPEN
+    if (opts->fastopen) {
+        set_listen_sockopt(p, server, IPPROTO_TCP, TCP_FASTOPEN, "fastopen",
+                           &opts->fastopen, sizeof(int));
+    }
+#endif
+#ifdef TCP_CONGESTION
+    if (opts->congestion) {
+        set_listen_sockopt(p, server, IPPROTO_TCP, TCP_CONGESTION,
+                           "congestion", opts->congestion,
+                           (int)strlen(opts->congestion));
+    }
+#endif
+#ifdef SO_BUSY_POLL
+    if (opts->busy_poll) {
+        set_listen_sockopt(p, server, SOL_SOCKET, SO_BUSY_POLL, "busypoll",
+                           &opts->busy_poll, sizeof(int));
+    }
+#endif
+}
+#endif /* HAVE_LISTEN_SOCKOPTS */
+
 /* TODO: make_sock is just begging and screaming for APR abstraction */
 static apr_status_t make_sock(apr_pool_t *p, ap_listen_rec *server, int do_bind_listen)
 {
@@ -141,6 +205,38 @@ static apr_status_t make_sock(apr_pool_t *p, ap_listen_rec *server, int do_bind_
         }
     }
 
+#ifdef TCP_NOTSENT_LOWAT
+    /*
+     * Limit the amount of data not sent yet in the kernel (inherited by the
+     * accepted sockets), writes then report EAGAIN and poll() POLLOUT based
+     * on that rather than the whole send buffer. This keeps the data queued
+     * in the server, where the next responses or the write completion can
+     * use them, instead of bloating the socket while the network is slow.
+     */
+    if (send_lowat || (server->sockopts && server->sockopts->notsent_lowat)) {
+        int thesock, lowat = send_lowat;
+        if (server->sockopts && server->sockopts->notsent_lowat) {
+            lowat = server->sockopts->notsent_lowat;
+        }
+        apr_os_sock_get(&thesock, s);
+        if (setsockopt(thesock, IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+                       (void *)&lowat, sizeof(int)) < 0) {
+            stat = apr_get_netos_error();
+            ap_log_perror(APLOG_MARK, APLOG_WARNING, stat, p, APLOGNO(10493)
+                          "make_sock: failed to set SendLowat for "
+                          "address %pI, using default",
+                          server->bind_addr);
+            /* not a fatal error */
+        }
+    }
+#endif
+
+#ifdef HAVE_LISTEN_SOCKOPTS
+    if (server->sockopts) {
+        set_listen_sockopts(p, server);
+    }
+#endif
+
 #if APR_TCP_NODELAY_INHERITED
     ap_sock_disable_nagle(s);
 #endif
@@ -459,7 +555,8 @@ static int find_listeners(ap_listen_rec **from, ap_listen_rec **to,
 static const char *alloc_listener(process_rec *process, const char *addr,
                                   apr_port_t port, const char* proto,
                                   const char *scope_id, void *slave,
-                                  apr_pool_t *temp_pool, apr_uint32_t flags)
+                                  apr_pool_t *temp_pool, apr_uint32_t flags,
+                                  const ap_listen_sockopts_t *sockopts)
 {
     ap_listen_rec *last;
     apr_status_t status;
@@ -504,6 +601,13 @@ static const char *alloc_listener(process_rec *process, const char *addr,
         new->bind_addr = sa;
         new->protocol = apr_pstrdup(process->pool, proto);
         new->flags = flags;
+        new->sockopts = NULL;
+        if (sockopts) {
+            new->sockopts = apr_pmemdup(process->pool, sockopts,
+                                        sizeof(*sockopts));
+            new->sockopts->congestion = apr_pstrdup(process->pool,
+                                                    sockopts->congestion);
+        }
 
         /* Go to the next sockaddr. */
         sa = sa->next;
@@ -815,6 +919,88 @@ AP_DECLARE(int) ap_setup_listeners(server_rec *s)
     return num_listeners;
 }
 
+#ifdef HAVE_LISTEN_CPU_STEERING
+/* The sockets of a SO_REUSEPORT group are indexed in the order they
+ * started listening, that is by bucket. With ListenCPUSteering, attach to
+ * the group of each listener a (classic) BPF program which selects the
+ * bucket whose children are bound to the CPU that received the connection
+ * (ChildCPUAffinity), or the CPU number modulo the number of buckets for
+ * the CPUs not bound to any. An index out of the group (e.g. while the
+ * buckets of a graceful restart are being set up) makes the kernel fall
+ * back to its hash.
+ */
+static int bpf_insn(struct sock_filter *code, int n, __u16 op,
+                    __u8 jt, __u8 jf, __u32 k)
+{
+    code[n].code = op;
+    code[n].jt = jt;
+    code[n].jf = jf;
+    code[n].k = k;
+    return n + 1;
+}
+
+static void listen_steer_cpu(apr_pool_t *p, server_rec *s, int num_buckets)
+{
+    struct sock_filter *code;
+    struct sock_fprog prog;
+    ap_listen_rec *lr;
+    long ncpus;
+    int cpu, bucket, n, bound = 0;
+
+    if (num_buckets < 2) {
+        return;
+    }
+    if (!listen_cpu_steering) {
+#ifdef SO_DETACH_REUSEPORT_BPF
+        /* the program of a previous generation on the reused sockets */
+        for (lr = ap_listeners; lr; lr = lr->next) {
+            int fd, on = 1;
+            apr_os_sock_get(&fd, lr->sd);
+            (void)setsockopt(fd, SOL_SOCKET, SO_DETACH_REUSEPORT_BPF,
+                             (void *)&on, sizeof(on));
+        }
+#endif
+        return;
+    }
+
+    ncpus = sysconf(_SC_NPROCESSORS_CONF);
+    if (ncpus > (BPF_MAXINSNS - 3) / 2) {
+        ncpus = (BPF_MAXINSNS - 3) / 2;
+    }
+    code = apr_palloc(p, (ncpus * 2 + 3) * sizeof(*code));
+    /* A = cpu; if (A == cpu0) return bucket0; ...; return A % num_buckets */
+    n = bpf_insn(code, 0, BPF_LD | BPF_W | BPF_ABS, 0, 0,
+                 SKF_AD_OFF + SKF_AD_CPU);
+    for (cpu = 0; cpu < ncpus; ++cpu) {
+        if ((bucket = ap_mpm_cpu_bucket(cpu, num_buckets)) < 0) {
+            continue;
+        }
+        n = bpf_insn(code, n, BPF_JMP | BPF_JEQ | BPF_K, 0, 1, cpu);
+        n = bpf_insn(code, n, BPF_RET | BPF_K, 0, 0, bucket);
+        ++bound;
+    }
+    n = bpf_insn(code, n, BPF_ALU | BPF_MOD | BPF_K, 0, 0, num_buckets);
+    n = bpf_insn(code, n, BPF_RET | BPF_A, 0, 0, 0);
+    prog.len = n;
+    prog.filter = code;
+
+    for (lr = ap_listeners; lr; lr = lr->next) {
+        int fd;
+        apr_os_sock_get(&fd, lr->sd);
+        if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+                       (void *)&prog, sizeof(prog)) < 0) {
+            ap_log_error(APLOG_MARK, APLOG_WARNING, errno, s, APLOGNO(10575)
+                         "ListenCPUSteering: can't attach the program to "
+                         "the listener for %pI", lr->bind_addr);
+        }
+    }
+    ap_log_error(APLOG_MARK, APLOG_INFO, 0, s, APLOGNO(10576)
+                 "ListenCPUSteering: %d of %ld CPUs steered to the "
+                 "bucket of their ChildCPUAffinity, the others modulo %d "
+                 "buckets", bound, ncpus, num_buckets);
+}
+#endif
+
 AP_DECLARE(apr_status_t) ap_duplicate_listeners(apr_pool_t *p, server_rec *s,
                                                 ap_listen_rec ***buckets,
                                                 int *num_buckets)
@@ -891,6 +1077,7 @@ AP_DECLARE(apr_status_t) ap_duplicate_listeners(apr_pool_t *p, server_rec *s,
                 duplr->bind_addr = sa;
                 duplr->next = NULL;
                 duplr->flags = lr->flags;
+                duplr->sockopts = lr->sockopts;
                 stat = apr_socket_create(&duplr->sd, duplr->bind_addr->family,
                                          SOCK_STREAM, 0, p);
                 if (stat != APR_SUCCESS) {
@@ -926,6 +1113,9 @@ AP_DECLARE(apr_status_t) ap_duplicate_listeners(apr_pool_t *p, server_rec *s,
 
     ap_listen_buckets = *buckets;
     ap_num_listen_buckets = *num_buckets;
+#ifdef HAVE_LISTEN_CPU_STEERING
+    listen_steer_cpu(p, s, *num_buckets);
+#endif
     return APR_SUCCESS;
 }
 
@@ -978,6 +1168,7 @@ AP_DECLARE(void) ap_listen_pre_config(void)
     ap_num_listen_buckets = 0;
     ap_listenbacklog = DEFAULT_LISTENBACKLOG;
     ap_listencbratio = 0;
+    listen_cpu_steering = 0;
 
     /* Check once whether or not SO_REUSEPORT is supported. */
     if (ap_have_so_reuseport < 0) {
@@ -1021,23 +1212,68 @@ AP_DECLARE(int) ap_accept_error_is_nonfatal(apr_status_t status)
              || APR_STATUS_IS_ECONNRESET(status);
 }
 
-/* Parse optional flags argument for Listen.  Currently just boolean
- * flags handled; would need to be extended to incorporate
- * ListenBacklog */
+/* Parse optional flags argument for Listen.  The boolean flags go in
+ * *flags_out, the name=value ones in *sockopts_out which is allocated
+ * from temp_pool if any is used; would need to be extended to
+ * incorporate ListenBacklog */
 static const char *parse_listen_flags(apr_pool_t *temp_pool, const char *arg,
-                                      apr_uint32_t *flags_out)
+                                      apr_uint32_t *flags_out,
+                                      ap_listen_sockopts_t **sockopts_out)
 {
     apr_uint32_t flags = 0;
+    ap_listen_sockopts_t *opts = NULL;
     char *str = apr_pstrdup(temp_pool, arg), *token, *state = NULL;
+    char *val;
 
     token = apr_strtok(str, ",", &state);
     while (token) {
-        if (ap_cstr_casecmp(token, "freebind") == 0)
+        if ((val = strchr(token, '=')) != NULL) {
+            *val++ = '\0';
+            if (!opts) {
+                opts = apr_pcalloc(temp_pool, sizeof(*opts));
+            }
+        }
+
+        if (val) {
+            if (ap_cstr_casecmp(token, "congestion") == 0) {
+                if (!*val) {
+                    return "Listen option 'congestion' requires an "
+                           "algorithm name";
+                }
+                opts->congestion = val;
+            }
+            else {
+                int ival = atoi(val);
+                if (!apr_isdigit(*val)) {
+                    return apr_psprintf(temp_pool, "Invalid value for "
+                                        "Listen option '%s' in '%s'",
+                                        token, arg);
+                }
+                if (ap_cstr_casecmp(token, "fastopen") == 0)
+                    opts->fastopen = ival;
+                else if (ap_cstr_casecmp(token, "notsentlowat") == 0)
+                    opts->notsent_lowat = ival;
+                else if (ap_cstr_casecmp(token, "busypoll") == 0)
+                    opts->busy_poll = ival;
+                else
+                    return apr_psprintf(temp_pool, "Unknown Listen option "
+                                        "'%s' in '%s'", token, arg);
+            }
+        }
+        else if (ap_cstr_casecmp(token, "fastopen") == 0) {
+            if (!opts) {
+                opts = apr_pcalloc(temp_pool, sizeof(*opts));
+            }
+            opts->fastopen = DEFAULT_LISTEN_FASTOPEN;
+        }
+        else if (ap_cstr_casecmp(token, "freebind") == 0)
             flags |= AP_LISTEN_FREEBIND;
         else if (ap_cstr_casecmp(token, "reuseport") == 0)
             flags |= AP_LISTEN_REUSEPORT;
         else if (ap_cstr_casecmp(token, "v6only") == 0)
             flags |= AP_LISTEN_V6ONLY;
+        else if (ap_cstr_casecmp(token, "priority") == 0)
+            flags |= AP_LISTEN_PRIORITY;
         else
             return apr_psprintf(temp_pool, "Unknown Listen option '%s' in '%s'",
                                 token, arg);
@@ -1046,6 +1282,7 @@ static const char *parse_listen_flags(apr_pool_t *temp_pool, const char *arg,
     }
 
     *flags_out = flags;
+    *sockopts_out = opts;
 
     return NULL;
 }
@@ -1058,6 +1295,7 @@ AP_DECLARE_NONSTD(const char *) ap_set_listener(cmd_parms *cmd, void *dummy,
     apr_status_t rv;
     const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
     apr_uint32_t flags = 0;
+    ap_listen_sockopts_t *sockopts = NULL;
 #ifdef HAVE_SYSTEMD
     APR_OPTIONAL_FN_TYPE(ap_systemd_listen_fds) *systemd_listen_fds;
 #endif
@@ -1107,7 +1345,8 @@ AP_DECLARE_NONSTD(const char *) ap_set_listener(cmd_parms *cmd, void *dummy,
             return "Third argument to Listen must be options=...";
         }
 
-        err = parse_listen_flags(cmd->temp_pool, argv[2] + 8, &flags);
+        err = parse_listen_flags(cmd->temp_pool, argv[2] + 8, &flags,
+                                 &sockopts);
         if (err) {
             return err;
         }
@@ -1119,7 +1358,8 @@ AP_DECLARE_NONSTD(const char *) ap_set_listener(cmd_parms *cmd, void *dummy,
         /* 2-arg form is either 'Listen host:port options=...' or
          * 'Listen host:port protocol' */
         if (strncasecmp(argv[1], "options=", 8) == 0) {
-            err = parse_listen_flags(cmd->temp_pool, argv[1] + 8, &flags);
+            err = parse_listen_flags(cmd->temp_pool, argv[1] + 8, &flags,
+                                     &sockopts);
             if (err) {
                 return err;
             }
@@ -1153,7 +1393,7 @@ AP_DECLARE_NONSTD(const char *) ap_set_listener(cmd_parms *cmd, void *dummy,
 #endif
 
     return alloc_listener(cmd->server->process, host, port, proto,
-                          scope_id, NULL, cmd->temp_pool, flags);
+                          scope_id, NULL, cmd->temp_pool, flags, sockopts);
 }
 
 AP_DECLARE_NONSTD(const char *) ap_set_listenbacklog(cmd_parms *cmd,
@@ -1196,6 +1436,24 @@ AP_DECLARE_NONSTD(const char *) ap_set_listencbratio(cmd_parms *cmd,
     return NULL;
 }
 
+AP_DECLARE_NONSTD(const char *) ap_set_listen_cpu_steering(cmd_parms *cmd,
+                                                           void *dummy,
+                                                           int flag)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+
+    if (err != NULL) {
+        return err;
+    }
+#ifndef HAVE_LISTEN_CPU_STEERING
+    if (flag) {
+        return "ListenCPUSteering is not supported on this platform";
+    }
+#endif
+    listen_cpu_steering = flag;
+    return NULL;
+}
+
 AP_DECLARE_NONSTD(const char *) ap_set_send_buffer_size(cmd_parms *cmd,
                                                         void *dummy,
                                                         const char *arg)
@@ -1215,6 +1473,30 @@ AP_DECLARE_NONSTD(const char *) ap_set_send_buffer_size(cmd_parms *cmd,
     return NULL;
 }
 
+AP_DECLARE_NONSTD(const char *) ap_set_send_lowat(cmd_parms *cmd,
+                                                  void *dummy,
+                                                  const char *arg)
+{
+    int s = atoi(arg);
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+
+    if (err != NULL) {
+        return err;
+    }
+
+    if (s < 0) {
+        return "SendLowat must be >= 0 bytes, 0 for system default.";
+    }
+#ifndef TCP_NOTSENT_LOWAT
+    if (s) {
+        return "SendLowat is not supported on this platform.";
+    }
+#endif
+
+    send_lowat = s;
+    return NULL;
+}
+
 AP_DECLARE_NONSTD(const char *) ap_set_accept_errors_nonfatal(cmd_parms *cmd,
                                                            void *dummy,
                                                            int flag)
@@ -30,9 +30,14 @@
 #include "apr_signal.h"
 #include "apr_portable.h"
 #include "apr_base64.h"
+#if APR_HAS_THREADS
+#include "apr_thread_mutex.h"
+#include "apr_thread_cond.h"
+#endif
 
 #define APR_WANT_STDIO
 #define APR_WANT_STRFUNC
+#define APR_WANT_IOVEC
 #include "apr_want.h"
 
 #if APR_HAVE_STDARG_H
@@ -56,6 +61,14 @@
 #include "ap_provider.h"
 #include "ap_listen.h"
 
+#if defined(AP_HAVE_RELIABLE_PIPED_LOGS) && APR_HAS_SHARED_MEMORY
+#define AP_PIPED_LOG_RING
+#include "apr_shm.h"
+#include "apr_atomic.h"
+#include "apr_env.h"
+#include "ap_log_ring.h"
+#endif
+
 #ifdef HAVE_SYS_GETTID
 #include <sys/syscall.h>
 #include <sys/types.h>
@@ -113,6 +126,54 @@ typedef struct read_handle_t {
 
 static read_handle_t *read_handles;
 
+#if APR_HAS_THREADS
+/*
+ * ErrorLogAsync: in the children of threaded MPMs the lines for the error
+ * log files are queued and written by a dedicated thread, so that an error
+ * storm does not serialize the workers on the write(s), nor block them on
+ * a slow piped logger. A full queue drops the lines (and counts them), and
+ * an identical message repeated within the interval is logged only once.
+ */
+#define ASYNC_LOG_DEFAULT_SIZE      (128 * 1024)
+#define ASYNC_LOG_DEFAULT_REPEAT    apr_time_from_sec(1)
+#define ASYNC_LOG_MAX_IOVECS        64
+
+typedef struct {
+    const server_rec *s;
+    apr_file_t *logf;
+    apr_size_t len;             /* of the line, which follows */
+    apr_size_t msg_start;       /* the message within the line, if any */
+    apr_size_t msg_len;
+} async_line_t;
+
+#define ASYNC_LINE_HDR_LEN APR_ALIGN_DEFAULT(sizeof(async_line_t))
+
+typedef struct {
+    apr_thread_mutex_t *mutex;
+    apr_thread_cond_t *cond;
+    apr_thread_t *thread;
+    apr_os_thread_t writer;
+    /* buf[0] is filled by the workers while buf[1] is written */
+    char *buf[2];
+    apr_size_t len;
+    apr_uint32_t dropped;
+    int stopping;
+    /* the last message written, owned by the writer */
+    const server_rec *last_s;
+    apr_file_t *last_logf;
+    char *last_msg;
+    apr_size_t last_len;
+    apr_time_t last_time;
+    apr_uint32_t repeats;
+} async_log_t;
+
+static apr_size_t async_log_size = 0;
+static apr_interval_time_t async_log_repeat = ASYNC_LOG_DEFAULT_REPEAT;
+static async_log_t *async_log = NULL;
+
+static void async_log_start(apr_pool_t *p, server_rec *s);
+#endif
+
 /**
  * @brief The piped logging structure.
  *
@@ -132,6 +193,12 @@ struct piped_log {
     /** How to reinvoke program when it must be replaced */
     apr_cmdtype_e cmdtype;
 #endif
+#ifdef AP_PIPED_LOG_RING
+    /** The shared memory ring to the logging process, if any */
+    ap_log_ring_t *ring;
+    /** The name of the ring's segment, given to the logging process */
+    const char *ring_fname;
+#endif
 };
 
 AP_DECLARE(apr_file_t *) ap_piped_log_read_fd(piped_log *pl)
@@ -174,6 +241,12 @@ void ap_logs_child_init(apr_pool_t *p, server_rec *s)
         apr_file_close(cur->handle);
         cur = cur->next;
     }
+
+#if APR_HAS_THREADS
+    if (async_log_size) {
+        async_log_start(p, s);
+    }
+#endif
 }
 
 AP_DECLARE(void) ap_open_stderr_log(apr_pool_t *p)
@@ -1027,9 +1100,282 @@ static int do_errorlog_format(apr_array_header_t *fmt, ap_errorlog_info *info,
     return len;
 }
 
+#if APR_HAS_THREADS
+static apr_status_t reset_async_log_config(void *dummy)
+{
+    async_log_size = 0;
+    async_log_repeat = ASYNC_LOG_DEFAULT_REPEAT;
+    return APR_SUCCESS;
+}
+
+const char *ap_set_error_log_async(cmd_parms *cmd, void *dummy,
+                                   const char *arg1, const char *arg2,
+                                   const char *arg3)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+    if (err != NULL) {
+        return err;
+    }
+
+    if (!strcasecmp(arg1, "off")) {
+        if (arg2) {
+            return "ErrorLogAsync Off takes no other argument";
+        }
+        async_log_size = 0;
+        return NULL;
+    }
+    if (strcasecmp(arg1, "on")) {
+        return "ErrorLogAsync must be On or Off";
+    }
+
+    async_log_size = ASYNC_LOG_DEFAULT_SIZE;
+    async_log_repeat = ASYNC_LOG_DEFAULT_REPEAT;
+    if (arg2) {
+        apr_off_t size;
+        if (!ap_parse_strict_length(&size, arg2)
+            || size < 2 * MAX_STRING_LEN
+            || (apr_uint64_t)size > APR_SIZE_MAX) {
+            return apr_psprintf(cmd->pool, "ErrorLogAsync buffer size must "
+                                "be at least %d bytes", 2 * MAX_STRING_LEN);
+        }
+        async_log_size = (apr_size_t)size;
+    }
+    if (arg3) {
+        if (ap_timeout_parameter_parse(arg3, &async_log_repeat, "s")
+                != APR_SUCCESS || async_log_repeat < 0) {
+            return "ErrorLogAsync repeat interval must be a positive "
+                   "duration, or 0 to log all the repeated messages";
+        }
+    }
+    apr_pool_cleanup_register(cmd->pool, NULL, reset_async_log_config,
+                              apr_pool_cleanup_null);
+    return NULL;
+}
+
+static void async_log_repeated(async_log_t *al)
+{
+    if (al->repeats) {
+        /* logged synchronously, by the writer */
+        ap_log_error(APLOG_MARK, APLOG_NOTICE, 0, al->last_s, APLOGNO(10555)
+                     "last message repeated %" APR_UINT32_T_FMT " times",
+                     al->repeats);
+        al->repeats = 0;
+    }
+    al->last_logf = NULL;
+}
+
+static void async_log_flush(apr_file_t *logf, struct iovec *vec, int nvec)
+{
+    apr_size_t written;
+
+    apr_file_writev_full(logf, vec, nvec, &written);
+    apr_file_flush(logf);
+}
+
+static void async_log_write(async_log_t *al, const char *buf, apr_size_t len)
+{
+    struct iovec vec[ASYNC_LOG_MAX_IOVECS];
+    apr_time_t now = apr_time_now();
+    apr_file_t *logf = NULL;
+    apr_size_t off = 0;
+    int nvec = 0;
+
+    while (off < len) {
+        const async_line_t *l = (const async_line_t *)(buf + off);
+        const char *line = buf + off + ASYNC_LINE_HDR_LEN;
+
+        off += APR_ALIGN_DEFAULT(ASYNC_LINE_HDR_LEN + l->len);
+
+        if (l->msg_len && l->logf == al->last_logf
+                && l->msg_len == al->last_len
+                && now - al->last_time < async_log_repeat
+                && !memcmp(line + l->msg_start, al->last_msg, l->msg_len)) {
+            al->repeats++;
+            continue;
+        }
+
+        if (nvec && (l->logf != logf || al->repeats
+                     || nvec == ASYNC_LOG_MAX_IOVECS)) {
+            async_log_flush(logf, vec, nvec);
+            nvec = 0;
+        }
+        async_log_repeated(al);
+        if (l->msg_len && async_log_repeat > 0) {
+            al->last_s = l->s;
+            al->last_logf = l->logf;
+            memcpy(al->last_msg, line + l->msg_start, l->msg_len);
+            al->last_len = l->msg_len;
+            al->last_time = now;
+        }
+
+        logf = l->logf;
+        vec[nvec].iov_base = (void *)line;
+        vec[nvec].iov_len = l->len;
+        nvec++;
+    }
+    if (nvec) {
+        async_log_flush(logf, vec, nvec);
+    }
+}
+
+static void * APR_THREAD_FUNC async_log_thread(apr_thread_t *thd, void *data)
+{
+    async_log_t *al = data;
+    apr_uint32_t dropped;
+    apr_size_t len;
+    char *buf;
+
+    apr_thread_mutex_lock(al->mutex);
+    al->writer = apr_os_thread_current();
+    for (;;) {
+        while (!al->len && !al->dropped && !al->stopping) {
+            if (al->repeats) {
+                apr_interval_time_t left;
+                left = al->last_time + async_log_repeat - apr_time_now();
+                if (left <= 0) {
+                    apr_thread_mutex_unlock(al->mutex);
+                    async_log_repeated(al);
+                    apr_thread_mutex_lock(al->mutex);
+                    continue;
+                }
+                apr_thread_cond_timedwait(al->cond, al->mutex, left);
+            }
+            else {
+                apr_thread_cond_wait(al->cond, al->mutex);
+            }
+        }
+        if (!al->len && !al->dropped) {
+            /* stopping */
+            break;
+        }
+
+        buf = al->buf[0];
+        len = al->len;
+        dropped = al->dropped;
+        al->buf[0] = al->buf[1];
+        al->buf[1] = buf;
+        al->len = 0;
+        al->dropped = 0;
+        apr_thread_mutex_unlock(al->mutex);
+
+        async_log_write(al, buf, len);
+        if (dropped) {
+            async_log_repeated(al);
+            ap_log_error(APLOG_MARK, APLOG_NOTICE, 0, ap_server_conf,
+                         APLOGNO(10556) "%" APR_UINT32_T_FMT " error log "
+                         "lines dropped, the ErrorLogAsync buffer was full",
+                         dropped);
+        }
+
+        apr_thread_mutex_lock(al->mutex);
+    }
+    apr_thread_mutex_unlock(al->mutex);
+
+    async_log_repeated(al);
+    return NULL;
+}
+
+static apr_status_t async_log_stop(void *data)
+{
+    async_log_t *al = data;
+    apr_status_t rv;
+
+    apr_thread_mutex_lock(al->mutex);
+    al->stopping = 1;
+    apr_thread_cond_signal(al->cond);
+    apr_thread_mutex_unlock(al->mutex);
+
+    apr_thread_join(&rv, al->thread);
+    async_log = NULL;
+    return APR_SUCCESS;
+}
+
+static void async_log_start(apr_pool_t *p, server_rec *s)
+{
+    async_log_t *al;
+    apr_status_t rv;
+    int threaded;
+
+    if (ap_mpm_query(AP_MPMQ_IS_THREADED, &threaded) != APR_SUCCESS
+            || threaded == AP_MPMQ_NOT_SUPPORTED) {
+        return;
+    }
+
+    al = apr_pcalloc(p, sizeof(*al));
+    al->buf[0] = apr_palloc(p, async_log_size);
+    al->buf[1] = apr_palloc(p, async_log_size);
+    al->last_msg = apr_palloc(p, MAX_STRING_LEN);
+    if ((rv = apr_thread_mutex_create(&al->mutex, APR_THREAD_MUTEX_DEFAULT,
+                                      p)) != APR_SUCCESS
+            || (rv = apr_thread_cond_create(&al->cond, p)) != APR_SUCCESS
+            || (rv = apr_thread_create(&al->thread, NULL, async_log_thread,
+                                       al, p)) != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10557)
+                     "could not start the ErrorLogAsync writer, the error "
+                     "log is written synchronously");
+        return;
+    }
+
+    /* before the thread's subpool goes away */
+    apr_pool_pre_cleanup_register(p, al, async_log_stop);
+    async_log = al;
+}
+
+/* Returns zero when the line must be written synchronously */
+static int async_log_queue(const char *errstr, apr_size_t len,
+                           apr_file_t *logf, const server_rec *s,
+                           int msg_start, int msg_end)
+{
+    async_log_t *al = async_log;
+    apr_size_t need = APR_ALIGN_DEFAULT(ASYNC_LINE_HDR_LEN + len);
+    async_line_t *l;
+
+    apr_thread_mutex_lock(al->mutex);
+    if (al->stopping
+            || apr_os_thread_equal(al->writer, apr_os_thread_current())) {
+        apr_thread_mutex_unlock(al->mutex);
+        return 0;
+    }
+    if (al->len + need > async_log_size) {
+        al->dropped++;
+        apr_thread_mutex_unlock(al->mutex);
+        return 1;
+    }
+
+    l = (async_line_t *)(al->buf[0] + al->len);
+    l->s = s;
+    l->logf = logf;
+    l->len = len;
+    if (msg_end > msg_start) {
+        l->msg_start = msg_start;
+        l->msg_len = msg_end - msg_start;
+    }
+    else {
+        l->msg_start = l->msg_len = 0;
+    }
+    memcpy((char *)l + ASYNC_LINE_HDR_LEN, errstr, len);
+    if (!al->len) {
+        apr_thread_cond_signal(al->cond);
+    }
+    al->len += need;
+    apr_thread_mutex_unlock(al->mutex);
+    return 1;
+}
+#endif /* APR_HAS_THREADS */
+
 static void write_logline(char *errstr, apr_size_t len, apr_file_t *logf,
-                          int level)
+                          int level, const server_rec *s,
+                          int msg_start, int msg_end)
 {
+#if APR_HAS_THREADS
+    /* crit and worse are written right away, they may well be followed
+     * by the exit of the process
+     */
+    if (async_log && level > APLOG_CRIT
+            && async_log_queue(errstr, len, logf, s, msg_start, msg_end)) {
+        return;
+    }
+#endif
 
     apr_file_puts(errstr, logf);
     apr_file_flush(logf);
@@ -1234,7 +1580,8 @@ static void log_error_core(const char *file, int line, int module_index,
         }
 
         if (logf) {
-            write_logline(errstr, len, logf, level_and_mask);
+            write_logline(errstr, len, logf, level_and_mask, s,
+                          errstr_start, errstr_end);
         }
         else {
             errorlog_provider->writer(&info, errorlog_provider_handle,
@@ -1691,8 +2038,19 @@ static apr_status_t piped_log_spawn(piped_log *pl)
 
         apr_tokenize_to_argv(pl->program, &args, pl->p);
         procnew = apr_pcalloc(pl->p, sizeof(apr_proc_t));
+#ifdef AP_PIPED_LOG_RING
+        /* inherited by the program only (we are single threaded here) */
+        if (pl->ring) {
+            apr_env_set(AP_LOG_RING_ENV, pl->ring_fname, pl->p);
+        }
+#endif
         status = apr_proc_create(procnew, args[0], (const char * const *) args,
                                  NULL, procattr, pl->p);
+#ifdef AP_PIPED_LOG_RING
+        if (pl->ring) {
+            apr_env_delete(AP_LOG_RING_ENV, pl->p);
+        }
+#endif
 
         if (status == APR_SUCCESS) {
             pl->pid = procnew;
@@ -1730,6 +2088,12 @@ static void piped_log_maintenance(int reason, void *data, apr_wait_t status)
                          * tells other logic not to try to kill it
                          */
         apr_proc_other_child_unregister(pl);
+#ifdef AP_PIPED_LOG_RING
+        /* back to the pipe until the new program attaches */
+        if (pl->ring) {
+            apr_atomic_set32(&pl->ring->consumer, 0);
+        }
+#endif
         rv = ap_mpm_query(AP_MPMQ_MPM_STATE, &mpm_state);
         if (rv != APR_SUCCESS) {
             ap_log_error(APLOG_MARK, APLOG_STARTUP, 0, NULL, APLOGNO(00105)
@@ -1790,6 +2154,110 @@ static apr_status_t piped_log_cleanup(void *data)
 }
 
 
+#ifdef AP_PIPED_LOG_RING
+static apr_size_t piped_log_ring_size = 0;
+
+static apr_status_t reset_piped_log_ring(void *dummy)
+{
+    piped_log_ring_size = 0;
+    return APR_SUCCESS;
+}
+
+const char *ap_set_piped_log_ring(cmd_parms *cmd, void *dummy,
+                                  const char *arg)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+    apr_off_t size;
+
+    if (err != NULL) {
+        return err;
+    }
+
+    if (!strcasecmp(arg, "off")) {
+        piped_log_ring_size = 0;
+        return NULL;
+    }
+    if (!ap_parse_strict_length(&size, arg)
+            || size < 65536 || size > 1024 * 1024 * 1024) {
+        return "PipedLogRing must be Off or a size between 65536 and "
+               "1073741824 bytes";
+    }
+
+    /* a power of two, for the offsets to wrap with the counters */
+    piped_log_ring_size = 65536;
+    while (piped_log_ring_size < (apr_size_t)size) {
+        piped_log_ring_size <<= 1;
+    }
+    apr_pool_cleanup_register(cmd->pool, NULL, reset_piped_log_ring,
+                              apr_pool_cleanup_null);
+    return NULL;
+}
+
+static void piped_log_ring_create(piped_log *pl)
+{
+    static unsigned int num = 0;
+    apr_shm_t *shm;
+    apr_status_t rv;
+
+    pl->ring_fname = ap_runtime_dir_relative(pl->p,
+                        apr_psprintf(pl->p, "logring.%" APR_PID_T_FMT ".%u",
+                                     getpid(), num++));
+    if (!pl->ring_fname) {
+        return;
+    }
+
+    /* a previous instance may have left it behind */
+    apr_shm_remove(pl->ring_fname, pl->p);
+    rv = apr_shm_create(&shm, AP_LOG_RING_HDR_LEN + piped_log_ring_size,
+                        pl->ring_fname, pl->p);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_STARTUP|APLOG_WARNING, rv,
+                     ap_server_conf, APLOGNO(10558)
+                     "could not create the PipedLogRing of '%s' (%s), "
+                     "using the pipe only", pl->program, pl->ring_fname);
+        return;
+    }
+
+    pl->ring = apr_shm_baseaddr_get(shm);
+    memset(pl->ring, 0, AP_LOG_RING_HDR_LEN + piped_log_ring_size);
+    pl->ring->magic = AP_LOG_RING_MAGIC;
+    pl->ring->size = (apr_uint32_t)piped_log_ring_size;
+}
+
+/* Returns zero when the data must go through the pipe */
+static int piped_log_ring_put(ap_log_ring_t *ring, const char *buf,
+                              apr_size_t len)
+{
+    char *data = AP_LOG_RING_DATA(ring);
+    apr_uint32_t need, head, tail, pos, pad;
+
+    if (len > ring->size / 4 || !apr_atomic_read32(&ring->consumer)) {
+        return 0;
+    }
+
+    need = AP_LOG_RING_RECLEN(len);
+    do {
+        head = apr_atomic_read32(&ring->head);
+        tail = apr_atomic_read32(&ring->tail);
+        pos = head & (ring->size - 1);
+        /* records don't wrap, pad to the end of the ring if needed */
+        pad = (ring->size - pos < need) ? ring->size - pos : 0;
+        if (head - tail + pad + need > ring->size) {
+            return 0;
+        }
+    } while (apr_atomic_cas32(&ring->head, head + pad + need, head) != head);
+
+    if (pad) {
+        apr_atomic_set32((apr_uint32_t *)(data + pos), AP_LOG_RING_PAD);
+        pos = 0;
+    }
+    memcpy(data + pos + 4, buf, len);
+    /* publish the record, last */
+    apr_atomic_set32((apr_uint32_t *)(data + pos), (apr_uint32_t)len + 1);
+    return 1;
+}
+#endif /* AP_PIPED_LOG_RING */
+
 AP_DECLARE(piped_log *) ap_open_piped_log_ex(apr_pool_t *p,
                                              const char *program,
                                              apr_cmdtype_e cmdtype)
@@ -1801,6 +2269,12 @@ AP_DECLARE(piped_log *) ap_open_piped_log_ex(apr_pool_t *p,
     pl->program = apr_pstrdup(p, program);
     pl->pid = NULL;
     pl->cmdtype = cmdtype;
+#ifdef AP_PIPED_LOG_RING
+    pl->ring = NULL;
+    if (piped_log_ring_size) {
+        piped_log_ring_create(pl);
+    }
+#endif
     if (apr_file_pipe_create_ex(&pl->read_fd,
                                 &pl->write_fd,
                                 APR_FULL_BLOCK, p) != APR_SUCCESS) {
@@ -1874,6 +2348,17 @@ AP_DECLARE(piped_log *) ap_open_piped_log(apr_pool_t *p,
     return ap_open_piped_log_ex(p, program, cmdtype);
 }
 
+AP_DECLARE(apr_status_t) ap_piped_log_write(piped_log *pl, const char *buf,
+                                            apr_size_t len)
+{
+#ifdef AP_PIPED_LOG_RING
+    if (pl->ring && piped_log_ring_put(pl->ring, buf, len)) {
+        return APR_SUCCESS;
+    }
+#endif
+    return apr_file_write_full(pl->write_fd, buf, len, NULL);
+}
+
 AP_DECLARE(void) ap_close_piped_log(piped_log *pl)
 {
     apr_pool_cleanup_run(pl->p, pl, piped_log_cleanup);
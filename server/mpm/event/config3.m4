@@ -6,6 +6,19 @@ APACHE_CHECK_SERF
 if test "$ac_cv_serf" = yes ; then
     APR_ADDTO(MOD_MPM_EVENT_LDADD,[\$(SERF_LIBS)])
 fi
+
+dnl Optional io_uring listener engine (EventIOEngine io_uring)
+AC_ARG_WITH(liburing, APACHE_HELP_STRING(--with-liburing,
+            [Use liburing for the event MPM io_uring engine]),
+  [ap_liburing=$withval], [ap_liburing=no])
+if test "$ap_liburing" != "no"; then
+    AC_CHECK_HEADERS(liburing.h, [
+        AC_CHECK_LIB(uring, io_uring_queue_init, [
+            AC_DEFINE(HAVE_LIBURING, 1, [Define if liburing is available])
+            APR_ADDTO(MOD_MPM_EVENT_LDADD,[-luring])
+        ])
+    ])
+fi
 APACHE_SUBST(MOD_MPM_EVENT_LDADD)
 
 APACHE_MPM_MODULE(event, $enable_mpm_event, event.lo,[
@@ -55,6 +55,8 @@
 #include "apr_ring.h"
 #include "apr_queue.h"
 #include "apr_atomic.h"
+#include "apr_shm.h"
+#include "apr_hash.h"
 #define APR_WANT_STRFUNC
 #include "apr_want.h"
 #include "apr_version.h"
@@ -94,7 +96,6 @@
 #include "mpm_default.h"
 #include "http_vhost.h"
 #include "unixd.h"
-#include "apr_skiplist.h"
 #include "util_time.h"
 
 #include <signal.h>
@@ -106,6 +107,11 @@
 #include "serf.h"
 #endif
 
+#if HAVE_LIBURING
+#include <poll.h>
+#include <liburing.h>
+#endif
+
 /* Limit on the total --- clients will be locked out if more servers than
  * this are needed.  It is intended solely to keep the server from crashing
  * when things get out of hand.
@@ -165,10 +171,20 @@
 #define DEFAULT_WORKER_FACTOR 2
 #endif
 #define WORKER_FACTOR_SCALE   16  /* scale factor to allow fractional values */
+
+/* How long a worker thread above MinThreadsPerChild stays idle before it
+ * exits, and how often the start thread checks for those which did.
+ */
+#ifndef THREAD_IDLE_TIMEOUT
+#define THREAD_IDLE_TIMEOUT   apr_time_from_sec(10)
+#endif
+#define THREADS_SCALER_INTERVAL apr_time_from_sec(1)
+#define THREADS_SCALING()     (min_threads_per_child < threads_per_child)
 static unsigned int worker_factor = DEFAULT_WORKER_FACTOR * WORKER_FACTOR_SCALE;
     /* AsyncRequestWorkerFactor * 16 */
 
 static int threads_per_child = 0;           /* ThreadsPerChild */
+static int min_threads_per_child = 0;       /* MinThreadsPerChild */
 static int ap_daemons_to_start = 0;         /* StartServers */
 static int min_spare_threads = 0;           /* MinSpareThreads */
 static int max_spare_threads = 0;           /* MaxSpareThreads */
@@ -180,6 +196,9 @@ static int had_healthy_child = 0;
 static volatile int dying = 0;
 static volatile int workers_may_exit = 0;
 static volatile int start_thread_may_exit = 0;
+static apr_uint32_t threads_wanted = 0;     /* Listener out of idle workers */
+static apr_thread_mutex_t *threads_scaler_mtx;
+static apr_thread_cond_t *threads_scaler_cond;
 static volatile int listener_may_exit = 0;
 static int listener_is_wakeable = 0;        /* Pollset supports APR_POLLSET_WAKEABLE */
 static int num_listensocks = 0;
@@ -192,10 +211,15 @@ static apr_uint32_t clogged_count = 0;      /* Number of threads processing ssl
 static apr_uint32_t threads_shutdown = 0;   /* Number of threads that have shutdown
                                                early during graceful termination */
 static int resource_shortage = 0;
+static int io_engine = 0;                   /* EventIOEngine */
+static apr_interval_time_t admission_target = 0;   /* AdmissionTarget */
+static apr_interval_time_t admission_interval = 0; /* AdmissionInterval */
+static apr_interval_time_t header_timeout = 0; /* RequestHeaderTimeout */
+static int max_conns_per_ip = 0;            /* MaxConnectionsPerIP */
 static fd_queue_t *worker_queue;
 static fd_queue_info_t *worker_queue_info;
 
-static apr_thread_mutex_t *timeout_mutex;
+static apr_thread_mutex_t *timeout_mutex; /* for queues_next_expiry */
 
 module AP_MODULE_DECLARE_DATA mpm_event_module;
 
@@ -205,14 +229,45 @@ typedef struct event_srv_cfg_s event_srv_cfg;
 
 static apr_pollfd_t *listener_pollfd;
 
+/* EventIOEngine values */
+#define IO_ENGINE_POLL   0
+#define IO_ENGINE_URING  1
+
+#if HAVE_LIBURING
+/*
+ * With "EventIOEngine io_uring", accept()s on the listening sockets are
+ * submitted to an io_uring instead of being done one by one after the
+ * pollset reported the listener readable.  Each listener has a few accept
+ * requests in flight, and the ring's fd (readable when completions are
+ * available) is polled by the listener thread in place of the listening
+ * sockets, so that a single wakeup reaps a batch of accepted connections
+ * and a single io_uring_enter() re-arms them.
+ */
+#ifndef URING_ACCEPTS_PER_LISTENER
+#define URING_ACCEPTS_PER_LISTENER 16
+#endif
+
+typedef struct uring_accept_t {
+    ap_listen_rec *lr;
+    apr_os_sock_t sd;
+    struct sockaddr_storage sa;
+    socklen_t salen;
+    int armed;
+} uring_accept_t;
+
+static struct io_uring listener_ring;
+static int listener_ring_ok;                /* ring in use (child only) */
+static apr_pollfd_t listener_ring_pfd;
+static uring_accept_t *uring_accepts;
+static int num_uring_accepts;
+#endif
+
 /*
  * The pollset for sockets that are in any of the timeout queues. Currently
- * we use the timeout_mutex to make sure that connections are added/removed
- * atomically to/from both event_pollset and a timeout queue. Otherwise
- * some confusion can happen under high load if timeout queues and pollset
- * get out of sync.
- * XXX: It should be possible to make the lock unnecessary in many or even all
- * XXX: cases.
+ * we use the lock of the connection's timeout shard (see below) to make sure
+ * that connections are added/removed atomically to/from both event_pollset
+ * and a timeout queue. Otherwise some confusion can happen under high load
+ * if timeout queues and pollset get out of sync.
  */
 static apr_pollset_t *event_pollset;
 
@@ -254,15 +309,41 @@ struct event_conn_state_t {
     struct event_conn_state_t *chain;
     /** Is lingering close from defer_lingering_close()? */
     int deferred_linger;
+    /** timeout shard (of the last worker thread) for the timeout queues */
+    int shard;
+    /** Is it in header_q (protected by the shard lock)? */
+    int in_header_q;
 };
 
 APR_RING_HEAD(timeout_head_t, event_conn_state_t);
 
-struct timeout_queue {
+/*
+ * The timeout queues are sharded by worker thread, each shard having its
+ * own part of every queue and its own lock, so that workers queuing their
+ * connections contend with the listener (removing or expiring them) but
+ * not with each other.  The listener maintains the shards in turn.
+ */
+#ifndef MAX_TIMEOUT_SHARDS
+#define MAX_TIMEOUT_SHARDS 32
+#endif
+
+typedef struct timeout_shard_t {
+    apr_thread_mutex_t *mutex;
+    apr_uint32_t contended;     /* number of times the lock was busy */
+} timeout_shard_t;
+
+static timeout_shard_t *timeout_shards;
+static int num_timeout_shards;
+
+struct timeout_queue_shard {
     struct timeout_head_t head;
+    apr_uint32_t count;         /* for this shard of this queue */
+};
+
+struct timeout_queue {
+    struct timeout_queue_shard *shards; /* num_timeout_shards */
     apr_interval_time_t timeout;
-    apr_uint32_t count;         /* for this queue */
-    apr_uint32_t *total;        /* for all chained/related queues */
+    apr_uint32_t *total;        /* for all chained/related queues/shards */
     struct timeout_queue *next; /* chaining */
 };
 /*
@@ -272,11 +353,17 @@ struct timeout_queue {
  *   keepalive_q        uses vhost's KeepAliveTimeOut
  *   linger_q           uses MAX_SECS_TO_LINGER
  *   short_linger_q     uses SECONDS_TO_LINGER
+ *   header_q           uses RequestHeaderTimeout
+ *
+ * Unlike the others, the connections in header_q are held by a worker which
+ * reads their request headers, the listener only aborts that read (shutdown
+ * of the socket) on expiry.
  */
 static struct timeout_queue *write_completion_q,
                             *keepalive_q,
                             *linger_q,
-                            *short_linger_q;
+                            *short_linger_q,
+                            *header_q;
 static volatile apr_time_t  queues_next_expiry;
 
 /* Prevent extra poll/wakeup calls for timeouts close in the future (queues
@@ -285,27 +372,75 @@ static volatile apr_time_t  queues_next_expiry;
  */
 #define TIMEOUT_FUDGE_FACTOR apr_time_from_msec(100)
 
+/* Lock/unlock the timeout shard of a connection, accounting for contention.
+ */
+static void TO_SHARD_LOCK(int shard)
+{
+    timeout_shard_t *ts = &timeout_shards[shard];
+
+    if (apr_thread_mutex_trylock(ts->mutex) != APR_SUCCESS) {
+        apr_atomic_inc32(&ts->contended);
+        apr_thread_mutex_lock(ts->mutex);
+    }
+}
+
+static APR_INLINE void TO_SHARD_UNLOCK(int shard)
+{
+    apr_thread_mutex_unlock(timeout_shards[shard].mutex);
+}
+
+static apr_uint32_t TO_SHARDS_CONTENDED(void)
+{
+    apr_uint32_t total = 0;
+    int i;
+
+    for (i = 0; i < num_timeout_shards; ++i) {
+        total += apr_atomic_read32(&timeout_shards[i].contended);
+    }
+    return total;
+}
+
+/* Lower the global queues_next_expiry to 'elem_expiry' if it expires before,
+ * returning whether it was updated.
+ */
+static int TO_QUEUES_UPDATE_EXPIRY(apr_time_t elem_expiry)
+{
+    apr_time_t next_expiry = queues_next_expiry;
+    int updated = 0;
+
+    /* Cheap check first, the lock is needed only when it's updated */
+    if (!next_expiry || next_expiry > elem_expiry + TIMEOUT_FUDGE_FACTOR) {
+        apr_thread_mutex_lock(timeout_mutex);
+        next_expiry = queues_next_expiry;
+        if (!next_expiry || next_expiry > elem_expiry + TIMEOUT_FUDGE_FACTOR) {
+            queues_next_expiry = elem_expiry;
+            updated = 1;
+        }
+        apr_thread_mutex_unlock(timeout_mutex);
+    }
+    return updated;
+}
+
 /*
  * Macros for accessing struct timeout_queue.
- * For TO_QUEUE_APPEND and TO_QUEUE_REMOVE, timeout_mutex must be held.
+ * For TO_QUEUE_APPEND and TO_QUEUE_REMOVE, the lock of the element's shard
+ * (el->shard) must be held.
  */
 static void TO_QUEUE_APPEND(struct timeout_queue *q, event_conn_state_t *el)
 {
-    apr_time_t elem_expiry;
-    apr_time_t next_expiry;
+    struct timeout_queue_shard *qs = &q->shards[el->shard];
 
-    APR_RING_INSERT_TAIL(&q->head, el, event_conn_state_t, timeout_list);
-    ++*q->total;
-    ++q->count;
+    APR_RING_INSERT_TAIL(&qs->head, el, event_conn_state_t, timeout_list);
+    apr_atomic_inc32(q->total);
+    ++qs->count;
+    AP_TIMEOUT_QUEUE_APPEND((uintptr_t)el->c, (int)el->pub.state,
+                            apr_atomic_read32(q->total));
 
     /* Cheaply update the global queues_next_expiry with the one of the
      * first entry of this queue (oldest) if it expires before.
      */
-    el = APR_RING_FIRST(&q->head);
-    elem_expiry = el->queue_timestamp + q->timeout;
-    next_expiry = queues_next_expiry;
-    if (!next_expiry || next_expiry > elem_expiry + TIMEOUT_FUDGE_FACTOR) {
-        queues_next_expiry = elem_expiry;
+    el = APR_RING_FIRST(&qs->head);
+    if (TO_QUEUES_UPDATE_EXPIRY(el->queue_timestamp + q->timeout)) {
         /* Unblock the poll()ing listener for it to update its timeout. */
         if (listener_is_wakeable) {
             apr_pollset_wakeup(event_pollset);
@@ -317,17 +452,23 @@ static void TO_QUEUE_REMOVE(struct timeout_queue *q, event_conn_state_t *el)
 {
     APR_RING_REMOVE(el, timeout_list);
     APR_RING_ELEM_INIT(el, timeout_list);
-    --*q->total;
-    --q->count;
+    apr_atomic_dec32(q->total);
+    --q->shards[el->shard].count;
+    AP_TIMEOUT_QUEUE_REMOVE((uintptr_t)el->c, (int)el->pub.state,
+                            apr_atomic_read32(q->total));
 }
 
 static struct timeout_queue *TO_QUEUE_MAKE(apr_pool_t *p, apr_time_t t,
                                            struct timeout_queue *ref)
 {
     struct timeout_queue *q;
-                                           
+    int i;
+
     q = apr_pcalloc(p, sizeof *q);
-    APR_RING_INIT(&q->head, event_conn_state_t, timeout_list);
+    q->shards = apr_pcalloc(p, num_timeout_shards * sizeof *q->shards);
+    for (i = 0; i < num_timeout_shards; ++i) {
+        APR_RING_INIT(&q->shards[i].head, event_conn_state_t, timeout_list);
+    }
     q->total = (ref) ? ref->total : apr_pcalloc(p, sizeof *q->total);
     q->timeout = t;
 
@@ -370,6 +511,9 @@ typedef enum
     PT_ACCEPT
 #if HAVE_SERF
     , PT_SERF
+#endif
+#if HAVE_LIBURING
+    , PT_URING
 #endif
     , PT_USER
 } poll_type_e;
@@ -497,13 +641,143 @@ static apr_socket_t **worker_sockets;
 
 static volatile apr_uint32_t listensocks_disabled;
 
+/*
+ * PriorityWorkers: the last ap_priority_workers idle workers are kept for
+ * the connections of the Listen options=priority listeners, when there
+ * are such listeners in this child's bucket.  As long as no more workers
+ * are idle, the other listeners are out of the pollset (their connections
+ * wait in the backlog) while the priority ones keep being accepted.
+ */
+static int num_priority_listensocks = 0;
+static volatile apr_uint32_t normal_listensocks_disabled;
+
+static APR_INLINE int is_priority_pollfd(const apr_pollfd_t *pfd)
+{
+    listener_poll_type *pt = pfd->client_data;
+    return (((ap_listen_rec *)pt->baton)->flags & AP_LISTEN_PRIORITY) != 0;
+}
+
+/*
+ * Admission control, CoDel style (only used by the listener thread).
+ *
+ * Without it, when all the workers are busy the listener stops accepting
+ * and new connections wait in the listen backlog for as long as it takes.
+ * With AdmissionTarget, the listener measures how long the connections
+ * wait for a worker: the time it blocks waiting for an idle worker with a
+ * connection in hand, and the time the listening sockets stay disabled
+ * (what the head of the backlog waited).  Once that delay has been above
+ * the target for a whole AdmissionInterval, the listener keeps accepting
+ * while the workers are busy and sheds the new connections right away
+ * (a 503 response on plain HTTP listeners, a reset otherwise), until a
+ * connection gets a worker with a delay under target again.  Shedding
+ * resumes without waiting for an interval if the delay goes above target
+ * again within an interval.
+ */
+static struct {
+    apr_time_t first_above;     /* when the delay will have been above
+                                 * target for an interval, 0 if under */
+    apr_time_t disabled_since;  /* when the listeners got disabled */
+    apr_time_t shed_end;        /* when shedding stopped last */
+    apr_uint32_t shed_count;    /* connections shed since it started */
+    int shedding;
+} admission;
+
+#define DEFAULT_ADMISSION_INTERVAL apr_time_from_msec(100)
+
+static const char admission_response[] =
+    "HTTP/1.1 503 Service Unavailable" CRLF
+    "Connection: close" CRLF
+    "Content-Length: 0" CRLF
+    "Retry-After: 1" CRLF
+    CRLF;
+
+static void admission_sample(apr_interval_time_t delay, apr_time_t now)
+{
+    if (!admission_target) {
+        return;
+    }
+
+    if (delay < admission_target) {
+        admission.first_above = 0;
+        if (admission.shedding) {
+            admission.shedding = 0;
+            admission.shed_end = now;
+            ap_log_error(APLOG_MARK, APLOG_INFO, 0, ap_server_conf,
+                         APLOGNO(10526)
+                         "Queueing delay back under %" APR_TIME_T_FMT "ms, "
+                         "accepting new connections again (%u shed)",
+                         apr_time_as_msec(admission_target),
+                         admission.shed_count);
+        }
+        return;
+    }
+
+    if (!admission.first_above) {
+        /* The delay has been above target since the connection waited
+         * that long, or shedding resumes if it stopped just before */
+        if (admission.shed_end
+                && now - admission.shed_end < admission_interval) {
+            admission.first_above = now;
+        }
+        else {
+            admission.first_above = now - delay + admission_target
+                                    + admission_interval;
+        }
+    }
+    if (!admission.shedding && now >= admission.first_above) {
+        admission.shedding = 1;
+        admission.shed_count = 0;
+        ap_log_error(APLOG_MARK, APLOG_INFO, 0, ap_server_conf,
+                     APLOGNO(10527)
+                     "Queueing delay above %" APR_TIME_T_FMT "ms for "
+                     "%" APR_TIME_T_FMT "ms, shedding new connections "
+                     "while all workers are busy",
+                     apr_time_as_msec(admission_target),
+                     apr_time_as_msec(admission_interval));
+    }
+}
+
+/* Refuse a connection just accepted, without reading from it */
+static void admission_shed(apr_socket_t *csd, ap_listen_rec *lr)
+{
+#ifdef SO_LINGER
+    apr_os_sock_t fd = -1;
+#endif
+
+    apr_socket_timeout_set(csd, 0);
+    if (lr && lr->protocol && !ap_cstr_casecmp(lr->protocol, "http")) {
+        apr_size_t len = sizeof(admission_response) - 1;
+        apr_socket_send(csd, admission_response, &len);
+    }
+#ifdef SO_LINGER
+    else if (apr_os_sock_get(&fd, csd) == APR_SUCCESS && fd >= 0) {
+        struct linger lg = { 1, 0 }; /* reset on close */
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, (void *)&lg, sizeof(lg));
+    }
+#endif
+    apr_socket_close(csd);
+    admission.shed_count++;
+}
+
 static void disable_listensocks(void)
 {
     int i;
     if (apr_atomic_cas32(&listensocks_disabled, 1, 0) != 0) {
         return;
     }
+    if (admission_target) {
+        admission.disabled_since = apr_time_now();
+    }
     if (event_pollset) {
+#if HAVE_LIBURING
+        if (listener_ring_ok) {
+            /* Accepts already in flight will complete in the ring, they are
+             * reaped once the listeners are enabled again.
+             */
+            apr_pollset_remove(event_pollset, &listener_ring_pfd);
+        }
+        else
+#endif
         for (i = 0; i < num_listensocks; i++) {
             apr_pollset_remove(event_pollset, &listener_pollfd[i]);
         }
@@ -518,6 +792,11 @@ static void enable_listensocks(void)
             || apr_atomic_cas32(&listensocks_disabled, 0, 1) != 1) {
         return;
     }
+    if (admission_target && admission.disabled_since) {
+        apr_time_t now = apr_time_now();
+        admission_sample(now - admission.disabled_since, now);
+        admission.disabled_since = 0;
+    }
     ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf, APLOGNO(00457)
                  "Accepting new connections again: "
                  "%u active conns (%u lingering/%u clogged/%u suspended), "
@@ -527,8 +806,19 @@ static void enable_listensocks(void)
                  apr_atomic_read32(&clogged_count),
                  apr_atomic_read32(&suspended_count),
                  ap_queue_info_num_idlers(worker_queue_info));
-    for (i = 0; i < num_listensocks; i++)
+#if HAVE_LIBURING
+    if (listener_ring_ok) {
+        apr_pollset_add(event_pollset, &listener_ring_pfd);
+    }
+    else
+#endif
+    for (i = 0; i < num_listensocks; i++) {
+        if (apr_atomic_read32(&normal_listensocks_disabled)
+                && !is_priority_pollfd(&listener_pollfd[i])) {
+            continue;
+        }
         apr_pollset_add(event_pollset, &listener_pollfd[i]);
+    }
     /*
      * XXX: This is not yet optimal. If many workers suddenly become available,
      * XXX: the parent may kill some processes off too soon.
@@ -566,6 +856,58 @@ static APR_INLINE int should_enable_listensocks(void)
     return !dying && listeners_disabled() && !connections_above_limit(NULL);
 }
 
+/* Whether the idle workers left are those kept for the priority listeners */
+static APR_INLINE int reserved_workers_only(void)
+{
+    return (num_priority_listensocks > 0
+            && ap_queue_info_num_idlers(worker_queue_info)
+               <= (apr_uint32_t)ap_priority_workers);
+}
+
+static void disable_normal_listensocks(void)
+{
+    int i;
+    if (apr_atomic_cas32(&normal_listensocks_disabled, 1, 0) != 0) {
+        return;
+    }
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf, APLOGNO(10528)
+                 "Only %u idle workers left, accepting the connections "
+                 "of the priority listeners only",
+                 ap_queue_info_num_idlers(worker_queue_info));
+    if (listeners_disabled()) {
+        return;
+    }
+    for (i = 0; i < num_listensocks; i++) {
+        if (!is_priority_pollfd(&listener_pollfd[i])) {
+            apr_pollset_remove(event_pollset, &listener_pollfd[i]);
+        }
+    }
+}
+
+static void enable_normal_listensocks(void)
+{
+    int i;
+    if (listener_may_exit
+            || apr_atomic_cas32(&normal_listensocks_disabled, 0, 1) != 1) {
+        return;
+    }
+    if (listeners_disabled()) {
+        /* enable_listensocks() will add them all */
+        return;
+    }
+    for (i = 0; i < num_listensocks; i++) {
+        if (!is_priority_pollfd(&listener_pollfd[i])) {
+            apr_pollset_add(event_pollset, &listener_pollfd[i]);
+        }
+    }
+}
+
+static APR_INLINE int should_enable_normal_listensocks(void)
+{
+    return (!dying && apr_atomic_read32(&normal_listensocks_disabled)
+            && !reserved_workers_only());
+}
+
 static void close_socket_nonblocking_(apr_socket_t *csd,
                                       const char *from, int line)
 {
@@ -764,6 +1106,11 @@ static void event_note_child_stopped(int slot, pid_t pid, ap_generation_t gen)
         ps->not_accepting = 0;
         ps->quiescing = 0;
         ps->pid = 0;
+        if (conn_ip_counts) {
+            /* Whatever it counted is gone with it */
+            memset(&conn_ip_counts[slot * CONN_IP_BUCKETS], 0,
+                   CONN_IP_BUCKETS * sizeof(apr_uint32_t));
+        }
     }
     else {
         ap_run_child_status(ap_server_conf, pid, gen, -1, MPM_CHILD_EXITED);
@@ -966,6 +1313,19 @@ static apr_status_t event_request_cleanup(void *dummy)
     return APR_SUCCESS;
 }
 
+/* The request headers of cs were read (or failed to), leave header_q */
+static void header_q_leave(event_conn_state_t *cs)
+{
+    if (cs->in_header_q) {
+        TO_SHARD_LOCK(cs->shard);
+        if (cs->in_header_q) {
+            TO_QUEUE_REMOVE(header_q, cs);
+            cs->in_header_q = 0;
+        }
+        TO_SHARD_UNLOCK(cs->shard);
+    }
+}
+
 static void event_pre_read_request(request_rec *r, conn_rec *c)
 {
     event_conn_state_t *cs = ap_get_module_config(c->conn_config,
@@ -976,6 +1336,15 @@ static void event_pre_read_request(request_rec *r, conn_rec *c)
                                   &mpm_event_module);
     apr_pool_cleanup_register(r->pool, c, event_request_cleanup,
                               apr_pool_cleanup_null);
+
+    /* Let the listener bound the time to read the headers */
+    if (header_q && !c->master && !cs->in_header_q) {
+        cs->queue_timestamp = apr_time_now();
+        TO_SHARD_LOCK(cs->shard);
+        TO_QUEUE_APPEND(header_q, cs);
+        cs->in_header_q = 1;
+        TO_SHARD_UNLOCK(cs->shard);
+    }
 }
 
 /*
@@ -988,6 +1357,10 @@ static int event_post_read_request(request_rec *r)
     event_conn_state_t *cs = ap_get_module_config(c->conn_config,
                                                   &mpm_event_module);
 
+    if (!c->master) {
+        header_q_leave(cs);
+    }
+
     /* To preserve legacy behaviour (consistent with other MPMs), use
      * the keepalive timeout from the base server (first on this IP:port)
      * when none is explicitly configured on this server.
@@ -1104,6 +1477,8 @@ static void process_socket(apr_thread_t *thd, apr_pool_t * p, apr_socket_t * soc
         /* Subsequent request on a conn, and thread number is part of ID */
         c->id = conn_id;
     }
+    /* Queue to this worker's shard from now on (cs is in no queue here) */
+    cs->shard = my_thread_num % num_timeout_shards;
 
     if (c->aborted) {
         /* do lingering close below */
@@ -1127,6 +1502,7 @@ read_request:
                 apr_atomic_inc32(&clogged_count);
             }
             rc = ap_run_process_connection(c);
+            header_q_leave(cs);
             if (clogging) {
                 apr_atomic_dec32(&clogged_count);
             }
@@ -1191,6 +1567,15 @@ read_request:
             from_wc_q = 0; /* one shot */
             pending = ap_run_output_pending(c);
         }
+        else if (c->keepalive == AP_CONN_KEEPALIVE && !c->aborted
+                 && ap_run_input_pending(c) == OK) {
+            /* Requests are pipelined, process them first and let the core
+             * output filter coalesce the responses (it defers its writes
+             * until the last one, up to the FlushMax* limits).
+             */
+            cs->pub.state = CONN_STATE_READ_REQUEST_LINE;
+            goto read_request;
+        }
         else if (ap_filter_should_yield(c->output_filters)) {
             pending = OK;
         }
@@ -1204,13 +1589,13 @@ read_request:
             notify_suspend(cs);
 
             update_reqevents_from_sense(cs, -1);
-            apr_thread_mutex_lock(timeout_mutex);
+            TO_SHARD_LOCK(cs->shard);
             TO_QUEUE_APPEND(cs->sc->wc_q, cs);
             rv = apr_pollset_add(event_pollset, &cs->pfd);
             if (rv != APR_SUCCESS && !APR_STATUS_IS_EEXIST(rv)) {
                 AP_DEBUG_ASSERT(0);
                 TO_QUEUE_REMOVE(cs->sc->wc_q, cs);
-                apr_thread_mutex_unlock(timeout_mutex);
+                TO_SHARD_UNLOCK(cs->shard);
                 ap_log_error(APLOG_MARK, APLOG_ERR, rv, ap_server_conf, APLOGNO(03465)
                              "process_socket: apr_pollset_add failure for "
                              "write completion");
@@ -1218,7 +1603,7 @@ read_request:
                 signal_threads(ST_GRACEFUL);
             }
             else {
-                apr_thread_mutex_unlock(timeout_mutex);
+                TO_SHARD_UNLOCK(cs->shard);
             }
             return;
         }
@@ -1255,13 +1640,13 @@ read_request:
 
         /* Add work to pollset. */
         update_reqevents_from_sense(cs, CONN_SENSE_WANT_READ);
-        apr_thread_mutex_lock(timeout_mutex);
+        TO_SHARD_LOCK(cs->shard);
         TO_QUEUE_APPEND(cs->sc->ka_q, cs);
         rv = apr_pollset_add(event_pollset, &cs->pfd);
         if (rv != APR_SUCCESS && !APR_STATUS_IS_EEXIST(rv)) {
             AP_DEBUG_ASSERT(0);
             TO_QUEUE_REMOVE(cs->sc->ka_q, cs);
-            apr_thread_mutex_unlock(timeout_mutex);
+            TO_SHARD_UNLOCK(cs->shard);
             ap_log_error(APLOG_MARK, APLOG_ERR, rv, ap_server_conf, APLOGNO(03093)
                          "process_socket: apr_pollset_add failure for "
                          "keep alive");
@@ -1269,7 +1654,7 @@ read_request:
             signal_threads(ST_GRACEFUL);
         }
         else {
-            apr_thread_mutex_unlock(timeout_mutex);
+            TO_SHARD_UNLOCK(cs->shard);
         }
         return;
     }
@@ -1310,10 +1695,10 @@ static apr_status_t event_resume_suspended (conn_rec *c)
         notify_suspend(cs);
 
         update_reqevents_from_sense(cs, -1);
-        apr_thread_mutex_lock(timeout_mutex);
+        TO_SHARD_LOCK(cs->shard);
         TO_QUEUE_APPEND(cs->sc->wc_q, cs);
         apr_pollset_add(event_pollset, &cs->pfd);
-        apr_thread_mutex_unlock(timeout_mutex);
+        TO_SHARD_UNLOCK(cs->shard);
     }
     else {
         cs->pub.state = CONN_STATE_LINGER;
@@ -1339,7 +1724,11 @@ static void check_infinite_requests(void)
     }
 }
 
-static int close_listeners(int *closed)
+#if HAVE_LIBURING
+static void uring_teardown(int *have_idle_worker_p);
+#endif
+
+static int close_listeners(int *closed, int *have_idle_worker_p)
 {
     ap_log_error(APLOG_MARK, APLOG_TRACE6, 0, ap_server_conf,
                  "clos%s listeners (connection_count=%u)",
@@ -1347,6 +1736,9 @@ static int close_listeners(int *closed)
     if (!*closed) {
         int i;
 
+#if HAVE_LIBURING
+        uring_teardown(have_idle_worker_p);
+#endif
         ap_close_listeners_ex(my_bucket->listeners);
         *closed = 1; /* once */
 
@@ -1494,6 +1886,17 @@ static void get_worker(int *have_idle_worker_p, int blocking, int *all_busy)
         return;
     }
 
+    /* Taking the last idle worker, ask the start thread for more if we
+     * are still below ThreadsPerChild.
+     */
+    if (THREADS_SCALING() && !dying
+            && ap_queue_info_num_idlers(worker_queue_info) <= 1
+            && apr_atomic_cas32(&threads_wanted, 1, 0) == 0) {
+        apr_thread_mutex_lock(threads_scaler_mtx);
+        apr_thread_cond_signal(threads_scaler_cond);
+        apr_thread_mutex_unlock(threads_scaler_mtx);
+    }
+
     if (blocking)
         rc = ap_queue_info_wait_for_idler(worker_queue_info, all_busy);
     else
@@ -1513,11 +1916,33 @@ static void get_worker(int *have_idle_worker_p, int blocking, int *all_busy)
     }
 }
 
+/* get_worker() blocking for a new connection, which samples the time it
+ * waited for the admission control */
+static void get_worker_sampled(int *have_idle_worker_p, int *all_busy)
+{
+    apr_time_t start, now;
+
+    if (!admission_target || *have_idle_worker_p) {
+        get_worker(have_idle_worker_p, 1, all_busy);
+        return;
+    }
+    start = apr_time_now();
+    get_worker(have_idle_worker_p, 1, all_busy);
+    now = apr_time_now();
+    admission_sample(now - start, now);
+}
+
+static apr_status_t event_cleanup_poll_callback(void *data);
+
 /* Structures to reuse */
 static timer_event_t timer_free_ring;
+static apr_thread_mutex_t *g_timer_free_mtx;
+static apr_pool_t *ptimers;
 
-static apr_skiplist *timer_skiplist;
-static volatile apr_time_t timers_next_expiry;
+/* The next timer's expiry for the threads adding timers to know whether
+ * they should wake up the listener (0 if none).
+ */
+static volatile apr_uint64_t timers_next_expiry;
 
 /* Same goal as for TIMEOUT_FUDGE_FACTOR (avoid extra poll calls), but applied
  * to timers. Since their timeouts are custom (user defined), we can't be too
@@ -1525,28 +1950,261 @@ static volatile apr_time_t timers_next_expiry;
  */
 #define EVENT_FUDGE_FACTOR apr_time_from_msec(10)
 
-/* The following compare function is used by apr_skiplist_insert() to keep the
- * elements (timers) sorted and provide O(log n) complexity (this is also true
- * for apr_skiplist_{find,remove}(), but those are not used in MPM event where
- * inserted timers are not searched nor removed, but with apr_skiplist_pop()
- * which does use any compare function).  It is meant to return 0 when a == b,
- * <0 when a < b, and >0 when a > b.  However apr_skiplist_insert() will not
- * add duplicates (i.e. a == b), and apr_skiplist_add() is only available in
- * APR 1.6, yet multiple timers could possibly be created in the same micro-
- * second (duplicates with regard to apr_time_t); therefore we implement the
- * compare function to return +1 instead of 0 when compared timers are equal,
- * thus duplicates are still added after each other (in order of insertion).
+/*
+ * The timers are kept in a hierarchical timing wheel, owned by the listener:
+ * TIMER_WHEEL_LEVELS levels of TIMER_WHEEL_SLOTS rings, the slots of level 0
+ * covering TIMER_WHEEL_TICK each and those of level N the whole level N-1.
+ * Inserting (or cancelling, with the canceled flag) is O(1), and a slot of a
+ * higher level is cascaded (its timers re-inserted at lower levels) when the
+ * wheel gets there; timers beyond the last level wait in its farthest slot.
+ *
+ * The threads adding timers don't touch the wheel, they push them on the
+ * lock-free timers_pending stack (linked through their ring's next) which
+ * the listener moves to the wheel before running it.  Only the recycling of
+ * the timer_event_t structures (and their allocation) needs a lock.
  */
-static int timer_comp(void *a, void *b)
+#define TIMER_WHEEL_TICK    EVENT_FUDGE_FACTOR
+#define TIMER_WHEEL_BITS    8
+#define TIMER_WHEEL_SLOTS   (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK    (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_LEVELS  3
+#define TIMER_WHEEL_SPAN(level) ((apr_int64_t)1 << ((level) * TIMER_WHEEL_BITS))
+
+APR_RING_HEAD(timer_wheel_slot, timer_event_t);
+static struct {
+    struct timer_wheel_slot slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    apr_uint32_t count[TIMER_WHEEL_LEVELS];
+    apr_int64_t tick;           /* the (level 0) tick to run next */
+    apr_time_t next_expiry;     /* cached, 0 if unknown/none */
+} timer_wheel;
+
+static timer_event_t *volatile timers_pending;
+
+static void timer_wheel_init(apr_time_t now)
+{
+    int level, i;
+
+    for (level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        for (i = 0; i < TIMER_WHEEL_SLOTS; i++) {
+            APR_RING_INIT(&timer_wheel.slots[level][i], timer_event_t, link);
+        }
+        timer_wheel.count[level] = 0;
+    }
+    timer_wheel.tick = now / TIMER_WHEEL_TICK;
+    timer_wheel.next_expiry = 0;
+}
+
+static void timer_wheel_insert(timer_event_t *te)
+{
+    apr_int64_t tick = te->when / TIMER_WHEEL_TICK, delta;
+    int level;
+
+    if (tick < timer_wheel.tick) {
+        tick = timer_wheel.tick;
+    }
+    delta = tick - timer_wheel.tick;
+    if (delta >= TIMER_WHEEL_SPAN(TIMER_WHEEL_LEVELS)) {
+        delta = TIMER_WHEEL_SPAN(TIMER_WHEEL_LEVELS) - 1;
+        tick = timer_wheel.tick + delta;
+    }
+    for (level = 0; delta >= TIMER_WHEEL_SPAN(level + 1); level++)
+        ;
+    APR_RING_INSERT_TAIL(&timer_wheel.slots[level]
+                         [(tick >> (level * TIMER_WHEEL_BITS))
+                          & TIMER_WHEEL_MASK], te, timer_event_t, link);
+    timer_wheel.count[level]++;
+
+    if (!timer_wheel.next_expiry || te->when < timer_wheel.next_expiry) {
+        timer_wheel.next_expiry = te->when;
+    }
+}
+
+/* Re-insert the timers of the higher levels' slots reached by the tick */
+static void timer_wheel_cascade(void)
+{
+    int level;
+
+    for (level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+        apr_int64_t idx = (timer_wheel.tick >> (level * TIMER_WHEEL_BITS))
+                          & TIMER_WHEEL_MASK;
+        struct timer_wheel_slot *slot = &timer_wheel.slots[level][idx];
+        struct timer_wheel_slot moved;
+
+        APR_RING_INIT(&moved, timer_event_t, link);
+        APR_RING_CONCAT(&moved, slot, timer_event_t, link);
+        while (!APR_RING_EMPTY(&moved, timer_event_t, link)) {
+            timer_event_t *te = APR_RING_FIRST(&moved);
+            APR_RING_REMOVE(te, link);
+            timer_wheel.count[level]--;
+            timer_wheel_insert(te);
+        }
+        if (idx) {
+            break;
+        }
+    }
+}
+
+static int timer_wheel_expire_slot(struct timer_wheel_slot *slot,
+                                   apr_time_t now)
+{
+    timer_event_t *te, *next;
+    int n = 0;
+
+    for (te = APR_RING_FIRST(slot); te != APR_RING_SENTINEL(slot,
+                                                timer_event_t, link);
+         te = next) {
+        next = APR_RING_NEXT(te, link);
+        if (te->when > now) {
+            continue;
+        }
+        APR_RING_REMOVE(te, link);
+        timer_wheel.count[0]--;
+        n++;
+        if (!te->canceled) {
+            if (te->pfds) {
+                /* remove all sockets from the pollset */
+                apr_pool_cleanup_run(te->pfds->pool, te->pfds,
+                                     event_cleanup_poll_callback);
+            }
+            push_timer2worker(te);
+        }
+        else {
+            apr_thread_mutex_lock(g_timer_free_mtx);
+            APR_RING_INSERT_TAIL(&timer_free_ring.link, te,
+                                 timer_event_t, link);
+            apr_thread_mutex_unlock(g_timer_free_mtx);
+        }
+    }
+    return n;
+}
+
+static apr_time_t timer_wheel_next(void)
 {
-    apr_time_t t1 = (apr_time_t) ((timer_event_t *)a)->when;
-    apr_time_t t2 = (apr_time_t) ((timer_event_t *)b)->when;
-    AP_DEBUG_ASSERT(t1);
-    AP_DEBUG_ASSERT(t2);
-    return ((t1 < t2) ? -1 : 1);
+    apr_int64_t base;
+    int level, i;
+
+    if (!timer_wheel.count[0]) {
+        /* The next cascade of a non-empty slot */
+        for (level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+            if (!timer_wheel.count[level]) {
+                continue;
+            }
+            base = timer_wheel.tick >> (level * TIMER_WHEEL_BITS);
+            for (i = 1; i <= TIMER_WHEEL_SLOTS; i++) {
+                if (!APR_RING_EMPTY(&timer_wheel.slots[level]
+                                    [(base + i) & TIMER_WHEEL_MASK],
+                                    timer_event_t, link)) {
+                    return ((base + i) << (level * TIMER_WHEEL_BITS))
+                           * TIMER_WHEEL_TICK;
+                }
+            }
+        }
+        return 0;
+    }
+
+    /* The first expiring timer of the first non-empty slot */
+    for (i = 0; i < TIMER_WHEEL_SLOTS; i++) {
+        struct timer_wheel_slot *slot = &timer_wheel.slots[0]
+                                        [(timer_wheel.tick + i)
+                                         & TIMER_WHEEL_MASK];
+        if (!APR_RING_EMPTY(slot, timer_event_t, link)) {
+            apr_time_t expiry = 0;
+            timer_event_t *te;
+            for (te = APR_RING_FIRST(slot);
+                 te != APR_RING_SENTINEL(slot, timer_event_t, link);
+                 te = APR_RING_NEXT(te, link)) {
+                if (!expiry || te->when < expiry) {
+                    expiry = te->when;
+                }
+            }
+            return expiry;
+        }
+    }
+    return 0; /* not reached */
 }
 
-static apr_thread_mutex_t *g_timer_skiplist_mtx;
+/* Run the wheel up to now, returns the next expiry (0 if none) */
+static apr_time_t timer_wheel_run(apr_time_t now)
+{
+    apr_int64_t now_tick = now / TIMER_WHEEL_TICK;
+    int changed = 0;
+
+    while (timer_wheel.tick < now_tick) {
+        if (timer_wheel.count[0]) {
+            changed |= timer_wheel_expire_slot(&timer_wheel.slots[0]
+                                               [timer_wheel.tick
+                                                & TIMER_WHEEL_MASK], now);
+            timer_wheel.tick++;
+        }
+        else {
+            /* Skip to the next cascade, if any */
+            int level = 1;
+            while (level < TIMER_WHEEL_LEVELS && !timer_wheel.count[level]) {
+                level++;
+            }
+            if (level < TIMER_WHEEL_LEVELS) {
+                apr_int64_t mask = TIMER_WHEEL_SPAN(level) - 1;
+                timer_wheel.tick = (timer_wheel.tick | mask) + 1;
+                if (timer_wheel.tick > now_tick) {
+                    timer_wheel.tick = now_tick;
+                }
+            }
+            else {
+                timer_wheel.tick = now_tick;
+            }
+        }
+        if (!(timer_wheel.tick & TIMER_WHEEL_MASK)) {
+            timer_wheel_cascade();
+            changed = 1;
+        }
+    }
+    if (timer_wheel.count[0]) {
+        changed |= timer_wheel_expire_slot(&timer_wheel.slots[0]
+                                           [timer_wheel.tick
+                                            & TIMER_WHEEL_MASK], now);
+    }
+
+    if (changed || !timer_wheel.next_expiry
+            || timer_wheel.next_expiry <= now) {
+        timer_wheel.next_expiry = timer_wheel_next();
+    }
+    return timer_wheel.next_expiry;
+}
+
+/* Move the pending timers to the wheel, push the expired ones to a worker
+ * and return the next expiry, if any (listener only).
+ */
+static apr_time_t process_timers(apr_time_t now)
+{
+    apr_time_t next_expiry = timer_wheel.next_expiry;
+
+    /* Nothing new since the last run (timers_next_expiry is up to date) */
+    if (!timers_pending && (!next_expiry || next_expiry > now)) {
+        return next_expiry;
+    }
+
+    for (;;) {
+        timer_event_t *te = apr_atomic_xchgptr((void *)&timers_pending, NULL);
+        while (te) {
+            timer_event_t *next = APR_RING_NEXT(te, link);
+            APR_RING_ELEM_INIT(te, link);
+            timer_wheel_insert(te);
+            te = next;
+        }
+
+        next_expiry = timer_wheel_run(now);
+
+        /* Publish it before checking for new pending timers, those added
+         * concurrently either are seen here or see this expiry (and wake
+         * us up if they expire before).
+         */
+        apr_atomic_set64(&timers_next_expiry, (apr_uint64_t)next_expiry);
+        if (!apr_atomic_casptr((void *)&timers_pending, NULL, NULL)) {
+            break;
+        }
+    }
+    return next_expiry;
+}
 
 static timer_event_t * event_get_timer_event(apr_time_t t,
                                              ap_mpm_callback_fn_t *cbfn,
@@ -1557,18 +2215,16 @@ static timer_event_t * event_get_timer_event(apr_time_t t,
     timer_event_t *te;
     apr_time_t now = (t < 0) ? 0 : apr_time_now();
 
-    /* oh yeah, and make locking smarter/fine grained. */
-
-    apr_thread_mutex_lock(g_timer_skiplist_mtx);
-
+    apr_thread_mutex_lock(g_timer_free_mtx);
     if (!APR_RING_EMPTY(&timer_free_ring.link, timer_event_t, link)) {
         te = APR_RING_FIRST(&timer_free_ring.link);
         APR_RING_REMOVE(te, link);
     }
     else {
-        te = apr_skiplist_alloc(timer_skiplist, sizeof(timer_event_t));
-        APR_RING_ELEM_INIT(te, link);
+        te = apr_palloc(ptimers, sizeof(timer_event_t));
     }
+    apr_thread_mutex_unlock(g_timer_free_mtx);
+    APR_RING_ELEM_INIT(te, link);
 
     te->cbfunc = cbfn;
     te->baton = baton;
@@ -1579,22 +2235,27 @@ static timer_event_t * event_get_timer_event(apr_time_t t,
     if (insert) { 
         apr_time_t next_expiry;
 
-        /* Okay, add sorted by when.. */
-        apr_skiplist_insert(timer_skiplist, te);
+        for (;;) {
+            timer_event_t *head = timers_pending;
+            APR_RING_NEXT(te, link) = head;
+            if (apr_atomic_casptr((void *)&timers_pending, te,
+                                  head) == head) {
+                break;
+            }
+        }
 
         /* Cheaply update the global timers_next_expiry with this event's
          * if it expires before.
          */
-        next_expiry = timers_next_expiry;
+        next_expiry = (apr_time_t)apr_atomic_read64(&timers_next_expiry);
         if (!next_expiry || next_expiry > te->when + EVENT_FUDGE_FACTOR) {
-            timers_next_expiry = te->when;
+            apr_atomic_set64(&timers_next_expiry, (apr_uint64_t)te->when);
             /* Unblock the poll()ing listener for it to update its timeout. */
             if (listener_is_wakeable) {
                 apr_pollset_wakeup(event_pollset);
             }
         }
     }
-    apr_thread_mutex_unlock(g_timer_skiplist_mtx);
 
     return te;
 }
@@ -1708,7 +2369,7 @@ static apr_status_t event_register_poll_callback(apr_pool_t *p,
  * Only to be called in the worker thread, and since it's in immediate call
  * stack, we can afford a comfortable buffer size to consume data quickly.
  * Pre-condition: cs is not in any timeout queue and not in the pollset,
- *                timeout_mutex is not locked
+ *                its timeout shard is not locked
  */
 #define LINGERING_BUF_SIZE (32 * 1024)
 static void process_lingering_close(event_conn_state_t *cs)
@@ -1769,117 +2430,442 @@ static void process_lingering_close(event_conn_state_t *cs)
     /* (Re)queue the connection to come back when readable */
     update_reqevents_from_sense(cs, CONN_SENSE_WANT_READ);
     q = (cs->pub.state == CONN_STATE_LINGER_SHORT) ? short_linger_q : linger_q;
-    apr_thread_mutex_lock(timeout_mutex);
+    TO_SHARD_LOCK(cs->shard);
     TO_QUEUE_APPEND(q, cs);
     rv = apr_pollset_add(event_pollset, &cs->pfd);
     if (rv != APR_SUCCESS && !APR_STATUS_IS_EEXIST(rv)) {
         AP_DEBUG_ASSERT(0);
         TO_QUEUE_REMOVE(q, cs);
-        apr_thread_mutex_unlock(timeout_mutex);
+        TO_SHARD_UNLOCK(cs->shard);
         ap_log_error(APLOG_MARK, APLOG_ERR, rv, ap_server_conf, APLOGNO(03092)
                      "process_lingering_close: apr_pollset_add failure");
         close_connection(cs);
         signal_threads(ST_GRACEFUL);
         return;
     }
-    apr_thread_mutex_unlock(timeout_mutex);
+    TO_SHARD_UNLOCK(cs->shard);
+}
+
+/* call 'func' for all elements of 'q' above 'expiry'.
+ * Pre-condition: no timeout shard is locked (they are locked in turn)
+ */
+static void process_timeout_queue(struct timeout_queue *q, apr_time_t expiry,
+                                  int (*func)(event_conn_state_t *))
+{
+    apr_uint32_t total, count;
+    event_conn_state_t *first, *cs, *last;
+    struct event_conn_state_t trash;
+    struct timeout_queue *qp;
+    apr_status_t rv;
+    int shard;
+
+    for (shard = 0; shard < num_timeout_shards; ++shard) {
+        if (!apr_atomic_read32(q->total)) {
+            return;
+        }
+
+        total = 0;
+        APR_RING_INIT(&trash.timeout_list, event_conn_state_t, timeout_list);
+        TO_SHARD_LOCK(shard);
+        for (qp = q; qp; qp = qp->next) {
+            struct timeout_queue_shard *qs = &qp->shards[shard];
+
+            count = 0;
+            cs = first = last = APR_RING_FIRST(&qs->head);
+            while (cs != APR_RING_SENTINEL(&qs->head, event_conn_state_t,
+                                           timeout_list)) {
+                /* Trash the entry if:
+                 * - no expiry was given (zero means all), or
+                 * - it expired (according to the queue timeout), or
+                 * - the system clock skewed in the past: no entry should be
+                 *   registered above the given expiry (~now) + the queue
+                 *   timeout, we won't keep any here (eg. for centuries).
+                 *
+                 * Otherwise stop, no following entry will match thanks to the
+                 * single timeout per queue (entries are added to the end!).
+                 * This allows maintenance in O(1).
+                 */
+                if (expiry && cs->queue_timestamp + qp->timeout > expiry
+                           && cs->queue_timestamp < expiry + qp->timeout) {
+                    /* Since this is the next expiring entry of this queue
+                     * (shard), update the global queues_next_expiry if it's
+                     * later than this one.
+                     */
+                    TO_QUEUES_UPDATE_EXPIRY(cs->queue_timestamp + qp->timeout);
+                    break;
+                }
+
+                last = cs;
+                rv = apr_pollset_remove(event_pollset, &cs->pfd);
+                if (rv != APR_SUCCESS && !APR_STATUS_IS_NOTFOUND(rv)) {
+                    AP_DEBUG_ASSERT(0);
+                    ap_log_cerror(APLOG_MARK, APLOG_ERR, rv, cs->c, APLOGNO(00473)
+                                  "apr_pollset_remove failed");
+                }
+                cs = APR_RING_NEXT(cs, timeout_list);
+                count++;
+            }
+            if (!count)
+                continue;
+
+            APR_RING_UNSPLICE(first, last, timeout_list);
+            APR_RING_SPLICE_TAIL(&trash.timeout_list, first, last,
+                                 event_conn_state_t, timeout_list);
+            AP_DEBUG_ASSERT(apr_atomic_read32(q->total) >= count
+                            && qs->count >= count);
+            apr_atomic_sub32(q->total, count);
+            qs->count -= count;
+            total += count;
+        }
+        TO_SHARD_UNLOCK(shard);
+        if (!total)
+            continue;
+
+        first = APR_RING_FIRST(&trash.timeout_list);
+        do {
+            cs = APR_RING_NEXT(first, timeout_list);
+            TO_QUEUE_ELEM_INIT(first);
+            AP_TIMEOUT_QUEUE_EXPIRE((uintptr_t)first->c, (int)first->pub.state);
+            func(first);
+            first = cs;
+        } while (--total);
+    }
+}
+
+static void process_keepalive_queue(apr_time_t expiry)
+{
+    /* If all workers are busy, we kill older keep-alive connections so
+     * that they may connect to another process.
+     */
+    if (!expiry && apr_atomic_read32(keepalive_q->total)) {
+        ap_log_error(APLOG_MARK, APLOG_TRACE1, 0, ap_server_conf,
+                     "All workers are busy or dying, will shutdown %u "
+                     "keep-alive connections",
+                     apr_atomic_read32(keepalive_q->total));
+    }
+    process_timeout_queue(keepalive_q, expiry, shutdown_connection);
+}
+
+/* Abort the read of the request headers which did not complete within
+ * RequestHeaderTimeout, by shutting the socket down for reading: the worker
+ * holding the connection gets EOF and closes it.  This is done with the
+ * shard locked since the worker may remove the entry concurrently.
+ */
+static void process_header_queue(apr_time_t expiry)
+{
+    struct timeout_queue_shard *qs;
+    event_conn_state_t *cs;
+    int shard;
+
+    for (shard = 0; shard < num_timeout_shards; ++shard) {
+        if (!apr_atomic_read32(header_q->total)) {
+            return;
+        }
+
+        qs = &header_q->shards[shard];
+        TO_SHARD_LOCK(shard);
+        while (!APR_RING_EMPTY(&qs->head, event_conn_state_t, timeout_list)) {
+            cs = APR_RING_FIRST(&qs->head);
+            /* Same expiry/clock skew checks as process_timeout_queue() */
+            if (cs->queue_timestamp + header_q->timeout > expiry
+                    && cs->queue_timestamp < expiry + header_q->timeout) {
+                TO_QUEUES_UPDATE_EXPIRY(cs->queue_timestamp
+                                        + header_q->timeout);
+                break;
+            }
+            TO_QUEUE_REMOVE(header_q, cs);
+            cs->in_header_q = 0;
+            ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, cs->c, APLOGNO(10534)
+                          "Request headers not read within "
+                          "RequestHeaderTimeout, aborting the connection");
+            apr_socket_shutdown(ap_get_conn_socket(cs->c),
+                                APR_SHUTDOWN_READ);
+        }
+        TO_SHARD_UNLOCK(shard);
+    }
+}
+
+/*
+ * MaxConnectionsPerIP: the connections of each client address are counted
+ * in a table shared by the children, with one row per child slot (zeroed
+ * when a child starts, so that a crashed child leaks nothing) of
+ * CONN_IP_BUCKETS counters indexed by a hash of the address.  The listener
+ * sums the column of a new connection to refuse it above the limit, before
+ * any worker is involved.  Addresses whose hash collide share a counter,
+ * so the limit is approximate (never in favor of the client).
+ */
+#define CONN_IP_BUCKETS 16384
+static apr_uint32_t *conn_ip_counts;
+
+static apr_status_t conn_ip_release(void *counter)
+{
+    apr_atomic_dec32(counter);
+    return APR_SUCCESS;
+}
+
+/* Whether the new connection csd is admitted by MaxConnectionsPerIP, it's
+ * accounted until ptrans is cleared if so (listener only).
+ */
+static int conn_ip_admit(apr_socket_t *csd, apr_pool_t *ptrans)
+{
+    apr_sockaddr_t *sa;
+    apr_ssize_t len;
+    apr_uint32_t *counter, total = 0;
+    unsigned int bucket;
+    int i;
+
+    if (!conn_ip_counts
+            || apr_socket_addr_get(&sa, APR_REMOTE, csd) != APR_SUCCESS) {
+        return 1;
+    }
+    len = sa->ipaddr_len;
+    bucket = apr_hashfunc_default(sa->ipaddr_ptr, &len) % CONN_IP_BUCKETS;
+    for (i = 0; i < server_limit; i++) {
+        total += apr_atomic_read32(&conn_ip_counts[i * CONN_IP_BUCKETS
+                                                   + bucket]);
+    }
+    if (total >= (apr_uint32_t)max_conns_per_ip) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf,
+                     APLOGNO(10535) "MaxConnectionsPerIP reached for %pI, "
+                     "connection refused", sa);
+        return 0;
+    }
+
+    counter = &conn_ip_counts[ap_child_slot * CONN_IP_BUCKETS + bucket];
+    apr_atomic_inc32(counter);
+    apr_pool_cleanup_register(ptrans, counter, conn_ip_release,
+                              apr_pool_cleanup_null);
+    return 1;
+}
+
+/* Get a transaction pool for a new connection, either a recycled one or
+ * a newly created one.  Returns NULL on failure, in which case the child
+ * is already asked to stop gracefully.
+ */
+static apr_pool_t *get_ptrans(void)
+{
+    apr_pool_t *ptrans;
+    apr_status_t rc;
+
+    ap_queue_info_pop_pool(worker_queue_info, &ptrans);
+    if (ptrans == NULL) {
+        /* create a new transaction pool for each accepted socket */
+        apr_allocator_t *allocator = NULL;
+
+        rc = apr_allocator_create(&allocator);
+        if (rc == APR_SUCCESS) {
+            apr_allocator_max_free_set(allocator, ap_max_mem_free);
+            rc = apr_pool_create_ex(&ptrans, pconf, NULL, allocator);
+            if (rc == APR_SUCCESS) {
+                apr_pool_tag(ptrans, "transaction");
+                apr_allocator_owner_set(allocator, ptrans);
+            }
+        }
+        if (rc != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_CRIT, rc, ap_server_conf,
+                         APLOGNO(03097) "Failed to create transaction pool");
+            if (allocator) {
+                apr_allocator_destroy(allocator);
+            }
+            resource_shortage = 1;
+            signal_threads(ST_GRACEFUL);
+            return NULL;
+        }
+    }
+    return ptrans;
+}
+
+#if HAVE_LIBURING
+/* Queue an accept() request for ua to the ring (submitted by the caller).
+ * Only to be called by the listener.
+ */
+static int uring_arm_accept(uring_accept_t *ua)
+{
+    struct io_uring_sqe *sqe;
+
+    if (io_uring_sq_space_left(&listener_ring) < 2) {
+        return 0;
+    }
+
+    /* The listening sockets are nonblocking (and shared with the other
+     * children), so wait for readability first with a linked poll, an
+     * accept() that lost the race then fails with EAGAIN and is simply
+     * re-armed.  The poll's own completion carries no data.
+     */
+    sqe = io_uring_get_sqe(&listener_ring);
+    io_uring_prep_poll_add(sqe, ua->sd, POLLIN);
+    io_uring_sqe_set_data(sqe, NULL);
+    io_uring_sqe_set_flags(sqe, IOSQE_IO_LINK);
+
+    sqe = io_uring_get_sqe(&listener_ring);
+    ua->salen = sizeof(ua->sa);
+    io_uring_prep_accept(sqe, ua->sd, (struct sockaddr *)&ua->sa,
+                         &ua->salen, SOCK_CLOEXEC);
+    io_uring_sqe_set_data(sqe, ua);
+    ua->armed = 1;
+    return 1;
+}
+
+/* Hand the connection accepted by the ring for ua (res) to a worker, or
+ * shed or close it.
+ */
+static void uring_push_accepted(uring_accept_t *ua, int res, int shed,
+                                int *have_idle_worker_p,
+                                int *workers_were_busy)
+{
+    apr_pool_t *ptrans;
+    apr_socket_t *csd;
+    apr_os_sock_info_t info;
+    apr_status_t rc;
+
+    ptrans = get_ptrans();
+    if (ptrans == NULL) {
+        close(res);
+        return;
+    }
+
+    memset(&info, 0, sizeof(info));
+    info.os_sock = &res;
+    info.remote = (struct sockaddr *)&ua->sa;
+    info.local = NULL; /* like APR for wildcard listeners, looked up lazily */
+    info.family = ua->sa.ss_family;
+    info.type = SOCK_STREAM;
+    info.protocol = APR_PROTO_TCP;
+    rc = apr_os_sock_make(&csd, &info, ptrans);
+    if (rc != APR_SUCCESS) {
+        close(res);
+        ap_queue_info_push_pool(worker_queue_info, ptrans);
+        return;
+    }
+
+    if (shed) {
+        admission_shed(csd, ua->lr);
+        ap_queue_info_push_pool(worker_queue_info, ptrans);
+        return;
+    }
+    if (!conn_ip_admit(csd, ptrans)) {
+        apr_socket_close(csd);
+        ap_queue_info_push_pool(worker_queue_info, ptrans);
+        return;
+    }
+
+    get_worker_sampled(have_idle_worker_p, workers_were_busy);
+    conns_this_child--;
+    if (push2worker(NULL, csd, ptrans) == APR_SUCCESS) {
+        *have_idle_worker_p = 0;
+    }
+}
+
+/* Hand the connections accepted by the ring to the workers, and re-arm
+ * the accepts in a single submission.  Like for PT_ACCEPT, this stops
+ * (leaving the remaining completions in the ring) as soon as the process
+ * shouldn't accept more connections.
+ */
+static void uring_process_accepts(int *have_idle_worker_p,
+                                  int *workers_were_busy)
+{
+    struct io_uring_cqe *cqe;
+    int i, rearm = 0;
+
+    while (!listener_may_exit
+           && io_uring_peek_cqe(&listener_ring, &cqe) == 0) {
+        uring_accept_t *ua = io_uring_cqe_get_data(cqe);
+        int res = cqe->res;
+        apr_status_t rc;
+        int shed = 0;
+
+        if (!ua) {
+            /* linked poll completion */
+            io_uring_cqe_seen(&listener_ring, cqe);
+            continue;
+        }
+        if (res >= 0 && admission.shedding
+                && connections_above_limit(workers_were_busy)) {
+            shed = 1;
+        }
+        else if (res >= 0 && connections_above_limit(workers_were_busy)) {
+            disable_listensocks();
+            ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf,
+                         APLOGNO(10401)
+                         "Too many open connections (%u), "
+                         "not accepting new conns in this process",
+                         apr_atomic_read32(&connection_count));
+            break;
+        }
+
+        io_uring_cqe_seen(&listener_ring, cqe);
+        ua->armed = 0;
+        rearm = 1;
+
+        if (res < 0) {
+            rc = APR_FROM_OS_ERROR(-res);
+            if (res == -ECANCELED || APR_STATUS_IS_EAGAIN(rc)
+                    || APR_STATUS_IS_EINTR(rc)
+                    || ap_accept_error_is_nonfatal(rc)) {
+                ap_log_error(APLOG_MARK, APLOG_DEBUG, rc, ap_server_conf,
+                             "io_uring accept() on client socket failed");
+            }
+            else {
+                /* E[NM]FILE, ENOMEM, etc */
+                ap_log_error(APLOG_MARK, APLOG_ERR, rc, ap_server_conf,
+                             APLOGNO(10402)
+                             "io_uring accept() failed, attempting to "
+                             "shutdown process gracefully");
+                resource_shortage = 1;
+                signal_threads(ST_GRACEFUL);
+            }
+            continue;
+        }
+
+        uring_push_accepted(ua, res, shed, have_idle_worker_p,
+                            workers_were_busy);
+    }
+
+    if (rearm && !listener_may_exit) {
+        for (i = 0; i < num_uring_accepts; ++i) {
+            if (!uring_accepts[i].armed && !uring_arm_accept(&uring_accepts[i])) {
+                break;
+            }
+        }
+        io_uring_submit(&listener_ring);
+    }
 }
 
-/* call 'func' for all elements of 'q' above 'expiry'.
- * Pre-condition: timeout_mutex must already be locked
- * Post-condition: timeout_mutex will be locked again
+/* Stop the ring of the listener.  The connections it accepted but that
+ * were not reaped yet are handed to the workers on graceful stop, like the
+ * ones accept()ed by the epoll path before the listeners are closed, or
+ * closed otherwise since the workers may be gone already.  Accepts still
+ * in flight are canceled by io_uring_queue_exit().
  */
-static void process_timeout_queue(struct timeout_queue *q, apr_time_t expiry,
-                                  int (*func)(event_conn_state_t *))
+static void uring_teardown(int *have_idle_worker_p)
 {
-    apr_uint32_t total = 0, count;
-    event_conn_state_t *first, *cs, *last;
-    struct event_conn_state_t trash;
-    struct timeout_queue *qp;
-    apr_status_t rv;
+    struct io_uring_cqe *cqe;
+    int workers_were_busy = 0;
 
-    if (!*q->total) {
+    if (!listener_ring_ok) {
         return;
     }
+    listener_ring_ok = 0;
 
-    APR_RING_INIT(&trash.timeout_list, event_conn_state_t, timeout_list);
-    for (qp = q; qp; qp = qp->next) {
-        count = 0;
-        cs = first = last = APR_RING_FIRST(&qp->head);
-        while (cs != APR_RING_SENTINEL(&qp->head, event_conn_state_t,
-                                       timeout_list)) {
-            /* Trash the entry if:
-             * - no expiry was given (zero means all), or
-             * - it expired (according to the queue timeout), or
-             * - the system clock skewed in the past: no entry should be
-             *   registered above the given expiry (~now) + the queue
-             *   timeout, we won't keep any here (eg. for centuries).
-             *
-             * Otherwise stop, no following entry will match thanks to the
-             * single timeout per queue (entries are added to the end!).
-             * This allows maintenance in O(1).
-             */
-            if (expiry && cs->queue_timestamp + qp->timeout > expiry
-                       && cs->queue_timestamp < expiry + qp->timeout) {
-                /* Since this is the next expiring entry of this queue, update
-                 * the global queues_next_expiry if it's later than this one.
-                 */
-                apr_time_t elem_expiry = cs->queue_timestamp + qp->timeout;
-                apr_time_t next_expiry = queues_next_expiry;
-                if (!next_expiry
-                        || next_expiry > elem_expiry + TIMEOUT_FUDGE_FACTOR) {
-                    queues_next_expiry = elem_expiry;
-                }
-                break;
-            }
+    while (io_uring_peek_cqe(&listener_ring, &cqe) == 0) {
+        uring_accept_t *ua = io_uring_cqe_get_data(cqe);
+        int res = cqe->res;
 
-            last = cs;
-            rv = apr_pollset_remove(event_pollset, &cs->pfd);
-            if (rv != APR_SUCCESS && !APR_STATUS_IS_NOTFOUND(rv)) {
-                AP_DEBUG_ASSERT(0);
-                ap_log_cerror(APLOG_MARK, APLOG_ERR, rv, cs->c, APLOGNO(00473)
-                              "apr_pollset_remove failed");
-            }
-            cs = APR_RING_NEXT(cs, timeout_list);
-            count++;
-        }
-        if (!count)
+        io_uring_cqe_seen(&listener_ring, cqe);
+        if (!ua || res < 0) {
             continue;
-
-        APR_RING_UNSPLICE(first, last, timeout_list);
-        APR_RING_SPLICE_TAIL(&trash.timeout_list, first, last, event_conn_state_t,
-                             timeout_list);
-        AP_DEBUG_ASSERT(*q->total >= count && qp->count >= count);
-        *q->total -= count;
-        qp->count -= count;
-        total += count;
-    }
-    if (!total)
-        return;
-
-    apr_thread_mutex_unlock(timeout_mutex);
-    first = APR_RING_FIRST(&trash.timeout_list);
-    do {
-        cs = APR_RING_NEXT(first, timeout_list);
-        TO_QUEUE_ELEM_INIT(first);
-        func(first);
-        first = cs;
-    } while (--total);
-    apr_thread_mutex_lock(timeout_mutex);
-}
-
-static void process_keepalive_queue(apr_time_t expiry)
-{
-    /* If all workers are busy, we kill older keep-alive connections so
-     * that they may connect to another process.
-     */
-    if (!expiry && *keepalive_q->total) {
-        ap_log_error(APLOG_MARK, APLOG_TRACE1, 0, ap_server_conf,
-                     "All workers are busy or dying, will shutdown %u "
-                     "keep-alive connections", *keepalive_q->total);
+        }
+        if (terminate_mode == ST_UNGRACEFUL) {
+            close(res);
+        }
+        else {
+            uring_push_accepted(ua, res, 0, have_idle_worker_p,
+                                &workers_were_busy);
+        }
     }
-    process_timeout_queue(keepalive_q, expiry, shutdown_connection);
+    io_uring_queue_exit(&listener_ring);
 }
+#endif
 
 static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
 {
@@ -1917,7 +2903,7 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
             check_infinite_requests();
 
         if (listener_may_exit) {
-            int first_close = close_listeners(&closed);
+            int first_close = close_listeners(&closed, &have_idle_worker);
 
             if (terminate_mode == ST_UNGRACEFUL
                 || apr_atomic_read32(&connection_count) == 0)
@@ -1938,23 +2924,23 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
             /* trace log status every second */
             if (now - last_log > apr_time_from_sec(1)) {
                 last_log = now;
-                apr_thread_mutex_lock(timeout_mutex);
                 ap_log_error(APLOG_MARK, APLOG_TRACE6, 0, ap_server_conf,
                              "connections: %u (clogged: %u write-completion: %d "
-                             "keep-alive: %d lingering: %d suspended: %u)",
+                             "keep-alive: %d lingering: %d suspended: %u "
+                             "queues contention: %u)",
                              apr_atomic_read32(&connection_count),
                              apr_atomic_read32(&clogged_count),
                              apr_atomic_read32(write_completion_q->total),
                              apr_atomic_read32(keepalive_q->total),
                              apr_atomic_read32(&lingering_count),
-                             apr_atomic_read32(&suspended_count));
+                             apr_atomic_read32(&suspended_count),
+                             TO_SHARDS_CONTENDED());
                 if (dying) {
                     ap_log_error(APLOG_MARK, APLOG_TRACE6, 0, ap_server_conf,
                                  "%u/%u workers shutdown",
                                  apr_atomic_read32(&threads_shutdown),
                                  threads_per_child);
                 }
-                apr_thread_mutex_unlock(timeout_mutex);
             }
         }
 
@@ -1977,33 +2963,9 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
         /* Push expired timers to a worker, the first remaining one determines
          * the maximum time to poll() below, if any.
          */
-        expiry = timers_next_expiry;
-        if (expiry && expiry < now) {
-            apr_thread_mutex_lock(g_timer_skiplist_mtx);
-            while ((te = apr_skiplist_peek(timer_skiplist))) {
-                if (te->when > now) {
-                    timers_next_expiry = te->when;
-                    timeout = te->when - now;
-                    break;
-                }
-                apr_skiplist_pop(timer_skiplist, NULL);
-                if (!te->canceled) { 
-                    if (te->pfds) {
-                        /* remove all sockets from the pollset */
-                        apr_pool_cleanup_run(te->pfds->pool, te->pfds,
-                                             event_cleanup_poll_callback);
-                    }
-                    push_timer2worker(te);
-                }
-                else {
-                    APR_RING_INSERT_TAIL(&timer_free_ring.link, te,
-                                         timer_event_t, link);
-                }
-            }
-            if (!te) {
-                timers_next_expiry = 0;
-            }
-            apr_thread_mutex_unlock(g_timer_skiplist_mtx);
+        expiry = process_timers(now);
+        if (expiry) {
+            timeout = expiry > now ? expiry - now : 0;
         }
 
         /* Same for queues, use their next expiry, if any. */
@@ -2036,7 +2998,7 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
                      " queues_timeout=%" APR_TIME_T_FMT
                      " timers_timeout=%" APR_TIME_T_FMT,
                      timeout, queues_next_expiry - now,
-                     timers_next_expiry - now);
+                     timer_wheel.next_expiry - now);
 
         rc = apr_pollset_poll(event_pollset, timeout, &num, &out_pfd);
         if (rc != APR_SUCCESS) {
@@ -2058,7 +3020,7 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
                          " timers_timeout=%" APR_TIME_T_FMT,
                          num, listener_may_exit, dying,
                          apr_atomic_read32(&connection_count),
-                         queues_next_expiry - now, timers_next_expiry - now);
+                         queues_next_expiry - now, timer_wheel.next_expiry - now);
         }
 
         /* XXX possible optimization: stash the current time for use as
@@ -2103,10 +3065,10 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
                 }
 
                 if (remove_from_q) {
-                    apr_thread_mutex_lock(timeout_mutex);
+                    TO_SHARD_LOCK(cs->shard);
                     TO_QUEUE_REMOVE(remove_from_q, cs);
                     rc = apr_pollset_remove(event_pollset, &cs->pfd);
-                    apr_thread_mutex_unlock(timeout_mutex);
+                    TO_SHARD_UNLOCK(cs->shard);
                     /*
                      * Some of the pollset backends, like KQueue or Epoll
                      * automagically remove the FD if the socket is closed,
@@ -2140,7 +3102,36 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
             }
             else if (pt->type == PT_ACCEPT && !listeners_disabled()) {
                 /* A Listener Socket is ready for an accept() */
-                if (workers_were_busy) {
+                if (admission.shedding && !listener_may_exit
+                        && (workers_were_busy
+                            || connections_above_limit(&workers_were_busy))) {
+                    /* Overloaded, refuse it rather than let the backlog
+                     * (and its delay) grow */
+                    ap_listen_rec *lr = (ap_listen_rec *) pt->baton;
+                    apr_pool_t *ptrans = get_ptrans();
+                    void *csd = NULL;
+
+                    if (ptrans == NULL) {
+                        continue;
+                    }
+                    rc = lr->accept_func(&csd, lr, ptrans);
+                    if (rc == APR_EGENERAL) {
+                        resource_shortage = 1;
+                        signal_threads(ST_GRACEFUL);
+                    }
+                    if (csd != NULL) {
+                        admission_shed(csd, lr);
+                    }
+                    ap_queue_info_push_pool(worker_queue_info, ptrans);
+                }
+                else if (!workers_were_busy && reserved_workers_only()
+                         && !(((ap_listen_rec *)pt->baton)->flags
+                              & AP_LISTEN_PRIORITY)) {
+                    /* Leave the last idle workers to the priority
+                     * listeners, this one waits in the backlog */
+                    disable_normal_listensocks();
+                }
+                else if (workers_were_busy) {
                     disable_listensocks();
                     ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf,
                                  APLOGNO(03268)
@@ -2162,37 +3153,13 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
                     void *csd = NULL;
                     ap_listen_rec *lr = (ap_listen_rec *) pt->baton;
                     apr_pool_t *ptrans;         /* Pool for per-transaction stuff */
-                    ap_queue_info_pop_pool(worker_queue_info, &ptrans);
 
+                    ptrans = get_ptrans();
                     if (ptrans == NULL) {
-                        /* create a new transaction pool for each accepted socket */
-                        apr_allocator_t *allocator = NULL;
-
-                        rc = apr_allocator_create(&allocator);
-                        if (rc == APR_SUCCESS) {
-                            apr_allocator_max_free_set(allocator,
-                                                       ap_max_mem_free);
-                            rc = apr_pool_create_ex(&ptrans, pconf, NULL,
-                                                    allocator);
-                            if (rc == APR_SUCCESS) {
-                                apr_pool_tag(ptrans, "transaction");
-                                apr_allocator_owner_set(allocator, ptrans);
-                            }
-                        }
-                        if (rc != APR_SUCCESS) {
-                            ap_log_error(APLOG_MARK, APLOG_CRIT, rc,
-                                         ap_server_conf, APLOGNO(03097)
-                                         "Failed to create transaction pool");
-                            if (allocator) {
-                                apr_allocator_destroy(allocator);
-                            }
-                            resource_shortage = 1;
-                            signal_threads(ST_GRACEFUL);
-                            continue;
-                        }
+                        continue;
                     }
 
-                    get_worker(&have_idle_worker, 1, &workers_were_busy);
+                    get_worker_sampled(&have_idle_worker, &workers_were_busy);
                     rc = lr->accept_func(&csd, lr, ptrans);
 
                     /* later we trash rv and rely on csd to indicate
@@ -2210,6 +3177,10 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
                                      "accept() on client socket failed");
                     }
 
+                    if (csd != NULL && !conn_ip_admit(csd, ptrans)) {
+                        apr_socket_close(csd);
+                        csd = NULL;
+                    }
                     if (csd != NULL) {
                         conns_this_child--;
                         if (push2worker(NULL, csd, ptrans) == APR_SUCCESS) {
@@ -2221,6 +3192,22 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
                     }
                 }
             }               /* if:else on pt->type */
+#if HAVE_LIBURING
+            else if (pt->type == PT_URING && !listeners_disabled()) {
+                /* Accepted connections are waiting in the ring */
+                if (workers_were_busy && !admission.shedding) {
+                    disable_listensocks();
+                    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf,
+                                 APLOGNO(10400)
+                                 "All workers busy, not accepting new conns "
+                                 "in this process");
+                }
+                else if (!listener_may_exit) {
+                    uring_process_accepts(&have_idle_worker,
+                                          &workers_were_busy);
+                }
+            }
+#endif
 #if HAVE_SERF
             else if (pt->type == PT_SERF) {
                 /* send socket to serf. */
@@ -2280,10 +3267,13 @@ do_maintenance:
             ap_log_error(APLOG_MARK, APLOG_TRACE7, 0, ap_server_conf,
                          "queues maintenance with timeout=%" APR_TIME_T_FMT,
                          expiry > 0 ? expiry - now : -1);
-            apr_thread_mutex_lock(timeout_mutex);
 
-            /* Steps below will recompute this. */
+            /* Steps below will recompute this (as well as the workers
+             * queuing concurrently to the shards already maintained).
+             */
+            apr_thread_mutex_lock(timeout_mutex);
             queues_next_expiry = 0;
+            apr_thread_mutex_unlock(timeout_mutex);
 
             /* Step 1: keepalive timeouts */
             if (workers_were_busy || dying) {
@@ -2303,8 +3293,11 @@ do_maintenance:
             process_timeout_queue(linger_q, now, shutdown_connection);
             /* Step 4: (short) lingering close completion timeouts */
             process_timeout_queue(short_linger_q, now, shutdown_connection);
+            /* Step 5: request headers timeouts */
+            if (header_q) {
+                process_header_queue(now);
+            }
 
-            apr_thread_mutex_unlock(timeout_mutex);
             ap_log_error(APLOG_MARK, APLOG_TRACE7, 0, ap_server_conf,
                          "queues maintained with timeout=%" APR_TIME_T_FMT,
                          queues_next_expiry > now ? queues_next_expiry - now
@@ -2315,12 +3308,12 @@ do_maintenance:
             ps->connections = apr_atomic_read32(&connection_count);
             ps->suspended = apr_atomic_read32(&suspended_count);
             ps->lingering_close = apr_atomic_read32(&lingering_count);
+            ps->queues_contention = TO_SHARDS_CONTENDED();
+            ps->setaside_bytes = ap_filter_child_setaside_bytes();
         }
         else if ((workers_were_busy || dying)
                  && apr_atomic_read32(keepalive_q->total)) {
-            apr_thread_mutex_lock(timeout_mutex);
             process_keepalive_queue(0); /* kill'em all \m/ */
-            apr_thread_mutex_unlock(timeout_mutex);
             ps->keep_alive = 0;
         }
 
@@ -2345,6 +3338,9 @@ do_maintenance:
         if (!workers_were_busy && should_enable_listensocks()) {
             enable_listensocks();
         }
+        if (should_enable_normal_listensocks()) {
+            enable_normal_listensocks();
+        }
     } /* listener main loop */
 
     ap_queue_term(worker_queue);
@@ -2395,6 +3391,7 @@ static void *APR_THREAD_FUNC worker_thread(apr_thread_t * thd, void *dummy)
     int thread_slot = ti->tslot;
     apr_status_t rv;
     int is_idle = 0;
+    int idle_exit = 0;
 
     free(ti);
 
@@ -2423,7 +3420,8 @@ static void *APR_THREAD_FUNC worker_thread(apr_thread_t * thd, void *dummy)
             /* A new idler may have changed connections_above_limit(),
              * let the listener know and decide.
              */
-            if (listener_is_wakeable && should_enable_listensocks()) {
+            if (listener_is_wakeable && (should_enable_listensocks()
+                                         || should_enable_normal_listensocks())) {
                 apr_pollset_wakeup(event_pollset);
             }
             is_idle = 1;
@@ -2440,8 +3438,25 @@ static void *APR_THREAD_FUNC worker_thread(apr_thread_t * thd, void *dummy)
             break;
         }
 
-        rv = ap_queue_pop_something(worker_queue, &csd, (void **)&cs,
-                                    &ptrans, &te);
+        if (thread_slot >= min_threads_per_child && !dying) {
+            /* Above MinThreadsPerChild, don't stay idle for too long */
+            rv = ap_queue_pop_something_timeout(worker_queue, thread_slot,
+                                                THREAD_IDLE_TIMEOUT, &csd,
+                                                (void **)&cs, &ptrans, &te);
+            if (APR_STATUS_IS_TIMEUP(rv)) {
+                /* Not if the listener reserved all the idle workers */
+                if (ap_queue_info_try_get_idler(worker_queue_info)
+                        == APR_SUCCESS) {
+                    idle_exit = 1;
+                    break;
+                }
+                goto worker_pop;
+            }
+        }
+        else {
+            rv = ap_queue_pop_something_ex(worker_queue, thread_slot,
+                                           &csd, (void **)&cs, &ptrans, &te);
+        }
 
         if (rv != APR_SUCCESS) {
             /* We get APR_EOF during a graceful shutdown once all the
@@ -2474,9 +3489,9 @@ static void *APR_THREAD_FUNC worker_thread(apr_thread_t * thd, void *dummy)
         if (te != NULL) {
             te->cbfunc(te->baton);
             {
-                apr_thread_mutex_lock(g_timer_skiplist_mtx);
+                apr_thread_mutex_lock(g_timer_free_mtx);
                 APR_RING_INSERT_TAIL(&timer_free_ring.link, te, timer_event_t, link);
-                apr_thread_mutex_unlock(g_timer_skiplist_mtx);
+                apr_thread_mutex_unlock(g_timer_free_mtx);
             }
         }
         else {
@@ -2508,9 +3523,11 @@ static void *APR_THREAD_FUNC worker_thread(apr_thread_t * thd, void *dummy)
         }
     }
 
+    /* SERVER_DEAD after an idle exit tells the start thread to join us */
     ap_update_child_status_from_indexes(process_slot, thread_slot,
-                                        dying ? SERVER_DEAD
-                                              : SERVER_GRACEFUL, NULL);
+                                        (dying || idle_exit) ? SERVER_DEAD
+                                                             : SERVER_GRACEFUL,
+                                        NULL);
 
     apr_thread_exit(thd, APR_SUCCESS);
     return NULL;
@@ -2547,11 +3564,76 @@ static void create_listener_thread(thread_starter * ts)
     apr_os_thread_get(&listener_os_thread, ts->listener);
 }
 
+#if HAVE_LIBURING
+/* Create the listener's ring and arm the accepts of all the listeners,
+ * returning 0 if anything fails so that the pollset is used instead.
+ */
+static int uring_setup(void)
+{
+    ap_listen_rec *lr;
+    apr_file_t *ring_file = NULL;
+    listener_poll_type *pt;
+    apr_status_t rv;
+    int i, j, ret;
+
+    num_uring_accepts = num_listensocks * URING_ACCEPTS_PER_LISTENER;
+    ret = io_uring_queue_init(num_uring_accepts * 2, &listener_ring, 0);
+    if (ret < 0) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, APR_FROM_OS_ERROR(-ret),
+                     ap_server_conf, APLOGNO(10403)
+                     "io_uring_queue_init() failed, EventIOEngine falls "
+                     "back to poll");
+        return 0;
+    }
+
+    uring_accepts = apr_pcalloc(pruntime, num_uring_accepts *
+                                          sizeof(*uring_accepts));
+    for (i = 0, lr = my_bucket->listeners; lr; lr = lr->next) {
+        apr_os_sock_t sd;
+
+        apr_os_sock_get(&sd, lr->sd);
+        for (j = 0; j < URING_ACCEPTS_PER_LISTENER; ++j, ++i) {
+            uring_accepts[i].lr = lr;
+            uring_accepts[i].sd = sd;
+            uring_arm_accept(&uring_accepts[i]);
+        }
+    }
+    ret = io_uring_submit(&listener_ring);
+    if (ret < 0) {
+        rv = APR_FROM_OS_ERROR(-ret);
+        goto fail;
+    }
+
+    apr_os_file_put(&ring_file, &listener_ring.ring_fd, APR_FOPEN_READ,
+                    pruntime);
+    pt = apr_pcalloc(pruntime, sizeof(*pt));
+    pt->type = PT_URING;
+    listener_ring_pfd.desc_type = APR_POLL_FILE;
+    listener_ring_pfd.desc.f = ring_file;
+    listener_ring_pfd.reqevents = APR_POLLIN | APR_POLLERR;
+    listener_ring_pfd.client_data = pt;
+    rv = apr_pollset_add(event_pollset, &listener_ring_pfd);
+    if (rv != APR_SUCCESS) {
+        goto fail;
+    }
+
+    listener_ring_ok = 1;
+    return 1;
+
+fail:
+    ap_log_error(APLOG_MARK, APLOG_WARNING, rv, ap_server_conf,
+                 APLOGNO(10404)
+                 "io_uring setup of the listeners failed, EventIOEngine "
+                 "falls back to poll");
+    io_uring_queue_exit(&listener_ring);
+    return 0;
+}
+#endif
+
 static void setup_threads_runtime(void)
 {
     apr_status_t rv;
     ap_listen_rec *lr;
-    apr_pool_t *pskip = NULL;
     int max_recycled_pools = -1, i;
     const int good_methods[] = { APR_POLLSET_KQUEUE,
                                  APR_POLLSET_PORT,
@@ -2563,20 +3645,21 @@ static void setup_threads_runtime(void)
                                       (async_factor > 2 ? async_factor : 2);
     int pollset_flags;
 
-    /* Event's skiplist operations will happen concurrently with other modules'
+    /* Event's timers operations will happen concurrently with other modules'
      * runtime so they need their own pool for allocations, and its lifetime
-     * should be at least the one of the connections (ptrans). Thus pskip is
+     * should be at least the one of the connections (ptrans). Thus ptimers is
      * created as a subpool of pconf like/before ptrans (before so that it's
      * destroyed after). In forked mode pconf is never destroyed so we are good
-     * anyway, but in ONE_PROCESS mode this ensures that the skiplist works
+     * anyway, but in ONE_PROCESS mode this ensures that the timers work
      * from connection/ptrans cleanups (even after pchild is destroyed).
      */
-    apr_pool_create(&pskip, pconf);
-    apr_pool_tag(pskip, "mpm_skiplist");
-    apr_thread_mutex_create(&g_timer_skiplist_mtx, APR_THREAD_MUTEX_DEFAULT, pskip);
+    apr_pool_create(&ptimers, pconf);
+    apr_pool_tag(ptimers, "mpm_timers");
+    apr_thread_mutex_create(&g_timer_free_mtx, APR_THREAD_MUTEX_DEFAULT, ptimers);
     APR_RING_INIT(&timer_free_ring.link, timer_event_t, link);
-    apr_skiplist_init(&timer_skiplist, pskip);
-    apr_skiplist_set_compare(timer_skiplist, timer_comp, timer_comp);
+    timer_wheel_init(apr_time_now());
+    timers_pending = NULL;
+    timers_next_expiry = 0;
 
     /* All threads (listener, workers) and synchronization objects (queues,
      * pollset, mutexes...) created here should have at least the lifetime of
@@ -2615,7 +3698,12 @@ static void setup_threads_runtime(void)
         clean_child_exit(APEXIT_CHILDFATAL);
     }
 
-    /* Create the timeout mutex and main pollset before the listener
+    apr_thread_mutex_create(&threads_scaler_mtx, APR_THREAD_MUTEX_DEFAULT,
+                            pruntime);
+    apr_thread_cond_create(&threads_scaler_cond, pruntime);
+    threads_wanted = 0;
+
+    /* Create the timeout mutexes and main pollset before the listener
      * thread starts.
      */
     rv = apr_thread_mutex_create(&timeout_mutex, APR_THREAD_MUTEX_DEFAULT,
@@ -2625,6 +3713,17 @@ static void setup_threads_runtime(void)
                      "creation of the timeout mutex failed.");
         clean_child_exit(APEXIT_CHILDFATAL);
     }
+    timeout_shards = apr_pcalloc(pruntime, num_timeout_shards *
+                                           sizeof(*timeout_shards));
+    for (i = 0; i < num_timeout_shards; ++i) {
+        rv = apr_thread_mutex_create(&timeout_shards[i].mutex,
+                                     APR_THREAD_MUTEX_DEFAULT, pruntime);
+        if (rv != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, rv, ap_server_conf, APLOGNO(10405)
+                         "creation of the timeout shards mutexes failed.");
+            clean_child_exit(APEXIT_CHILDFATAL);
+        }
+    }
 
     /* Create the main pollset */
     pollset_flags = APR_POLLSET_THREADSAFE | APR_POLLSET_NOCOPY |
@@ -2685,12 +3784,23 @@ static void setup_threads_runtime(void)
         pfd->client_data = pt;
         pt->type = PT_ACCEPT;
         pt->baton = lr;
+        if (ap_priority_workers > 0 && (lr->flags & AP_LISTEN_PRIORITY)) {
+            num_priority_listensocks++;
+        }
 
         apr_socket_opt_set(pfd->desc.s, APR_SO_NONBLOCK, 1);
-        apr_pollset_add(event_pollset, pfd);
 
         lr->accept_func = ap_unixd_accept;
     }
+#if HAVE_LIBURING
+    if (io_engine == IO_ENGINE_URING && uring_setup()) {
+        /* listeners are polled through the ring */
+    }
+    else
+#endif
+    for (i = 0; i < num_listensocks; i++) {
+        apr_pollset_add(event_pollset, &listener_pollfd[i]);
+    }
 
     worker_sockets = apr_pcalloc(pruntime, threads_per_child *
                                            sizeof(apr_socket_t *));
@@ -2701,28 +3811,130 @@ static void setup_threads_runtime(void)
  *     never be cleaned up; for now there is an APLOG_DEBUG message issued
  *     every so often when this condition occurs
  */
+static apr_status_t create_worker_thread(thread_starter *ts, int i)
+{
+    int my_child_num = ts->child_num_arg;
+    proc_info *my_info;
+    apr_status_t rv;
+
+    my_info = (proc_info *) ap_malloc(sizeof(proc_info));
+    my_info->pslot = my_child_num;
+    my_info->tslot = i;
+
+    /* We are creating threads right now */
+    ap_update_child_status_from_indexes(my_child_num, i,
+                                        SERVER_STARTING, NULL);
+    /* We let each thread update its own scoreboard entry.  This is
+     * done because it lets us deal with tid better.
+     */
+    rv = ap_thread_create(&ts->threads[i], ts->threadattr,
+                          worker_thread, my_info, pruntime);
+    if (rv != APR_SUCCESS) {
+        ap_update_child_status_from_indexes(my_child_num, i,
+                                            SERVER_DEAD, NULL);
+        ts->threads[i] = NULL;
+        free(my_info);
+    }
+    return rv;
+}
+
+/* Once MinThreadsPerChild workers are running, the start thread grows them
+ * (by half) up to ThreadsPerChild whenever the listener runs out of idle
+ * ones, and joins those which exited after THREAD_IDLE_TIMEOUT.
+ */
+static void scale_threads(thread_starter *ts)
+{
+    apr_thread_t **threads = ts->threads;
+    int my_child_num = ts->child_num_arg;
+    apr_status_t rv, thread_rv;
+    int i, live, grow;
+
+    while (!start_thread_may_exit && !dying) {
+        apr_thread_mutex_lock(threads_scaler_mtx);
+        if (!start_thread_may_exit && !apr_atomic_read32(&threads_wanted)) {
+            apr_thread_cond_timedwait(threads_scaler_cond, threads_scaler_mtx,
+                                      THREADS_SCALER_INTERVAL);
+        }
+        apr_thread_mutex_unlock(threads_scaler_mtx);
+        if (start_thread_may_exit || dying) {
+            break;
+        }
+
+        live = min_threads_per_child;
+        for (i = min_threads_per_child; i < threads_per_child; i++) {
+            if (!threads[i]) {
+                continue;
+            }
+            if (ap_scoreboard_image->servers[my_child_num][i].status
+                    != SERVER_DEAD) {
+                live++;
+                continue;
+            }
+            rv = apr_thread_join(&thread_rv, threads[i]);
+            if (rv != APR_SUCCESS) {
+                ap_log_error(APLOG_MARK, APLOG_CRIT, rv, ap_server_conf,
+                             APLOGNO(10543) "apr_thread_join: unable to "
+                             "join idle worker thread %d", i);
+            }
+            threads[i] = NULL;
+        }
+
+        if (!apr_atomic_xchg32(&threads_wanted, 0)) {
+            continue;
+        }
+        grow = (live + 1) / 2;
+        for (i = min_threads_per_child; grow > 0 && i < threads_per_child;
+             i++) {
+            int status = ap_scoreboard_image->servers[my_child_num][i].status;
+
+            /* Skip the slots still used by a previous generation */
+            if (threads[i] || status != SERVER_DEAD) {
+                continue;
+            }
+            rv = create_worker_thread(ts, i);
+            if (rv != APR_SUCCESS) {
+                ap_log_error(APLOG_MARK, APLOG_ERR, rv, ap_server_conf,
+                             APLOGNO(10544) "ap_thread_create: unable to "
+                             "grow worker threads above %d", live);
+                break;
+            }
+            live++;
+            grow--;
+        }
+        ap_log_error(APLOG_MARK, APLOG_TRACE1, 0, ap_server_conf,
+                     "worker threads grown to %d of %d", live,
+                     threads_per_child);
+    }
+}
+
 static void *APR_THREAD_FUNC start_threads(apr_thread_t * thd, void *dummy)
 {
     thread_starter *ts = dummy;
-    apr_thread_t **threads = ts->threads;
-    apr_threadattr_t *thread_attr = ts->threadattr;
     int my_child_num = ts->child_num_arg;
-    proc_info *my_info;
     apr_status_t rv;
     int threads_created = 0;
     int listener_started = 0;
     int prev_threads_created;
     int loops, i;
+    const char *io_engine_desc = "";
 
+#if HAVE_LIBURING
+    if (listener_ring_ok) {
+        io_engine_desc = ", accepting with io_uring";
+    }
+#endif
     ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf, APLOGNO(02471)
-                 "start_threads: Using %s (%swakeable)",
+                 "start_threads: Using %s (%swakeable)%s",
                  apr_pollset_method_name(event_pollset),
-                 listener_is_wakeable ? "" : "not ");
+                 listener_is_wakeable ? "" : "not ",
+                 io_engine_desc);
 
     loops = prev_threads_created = 0;
     while (1) {
-        /* threads_per_child does not include the listener thread */
-        for (i = 0; i < threads_per_child; i++) {
+        /* min_threads_per_child does not include the listener thread, the
+         * others up to threads_per_child are created on demand
+         */
+        for (i = 0; i < min_threads_per_child; i++) {
             int status =
                 ap_scoreboard_image->servers[my_child_num][i].status;
 
@@ -2730,18 +3942,7 @@ static void *APR_THREAD_FUNC start_threads(apr_thread_t * thd, void *dummy)
                 continue;
             }
 
-            my_info = (proc_info *) ap_malloc(sizeof(proc_info));
-            my_info->pslot = my_child_num;
-            my_info->tslot = i;
-
-            /* We are creating threads right now */
-            ap_update_child_status_from_indexes(my_child_num, i,
-                                                SERVER_STARTING, NULL);
-            /* We let each thread update its own scoreboard entry.  This is
-             * done because it lets us deal with tid better.
-             */
-            rv = ap_thread_create(&threads[i], thread_attr,
-                                  worker_thread, my_info, pruntime);
+            rv = create_worker_thread(ts, i);
             if (rv != APR_SUCCESS) {
                 ap_log_error(APLOG_MARK, APLOG_ALERT, rv, ap_server_conf,
                              APLOGNO(03104)
@@ -2759,7 +3960,8 @@ static void *APR_THREAD_FUNC start_threads(apr_thread_t * thd, void *dummy)
         }
 
 
-        if (start_thread_may_exit || threads_created == threads_per_child) {
+        if (start_thread_may_exit
+                || threads_created == min_threads_per_child) {
             break;
         }
         /* wait for previous generation to clean up an entry */
@@ -2772,12 +3974,16 @@ static void *APR_THREAD_FUNC start_threads(apr_thread_t * thd, void *dummy)
                              "child %" APR_PID_T_FMT " isn't taking over "
                              "slots very quickly (%d of %d)",
                              ap_my_pid, threads_created,
-                             threads_per_child);
+                             min_threads_per_child);
             }
             prev_threads_created = threads_created;
         }
     }
 
+    if (THREADS_SCALING()) {
+        scale_threads(ts);
+    }
+
     /* What state should this child_main process be listed as in the
      * scoreboard...?
      *  ap_update_child_status_from_indexes(my_child_num, i, SERVER_STARTING,
@@ -2852,6 +4058,11 @@ static void join_start_thread(apr_thread_t * start_thread_id)
                                  * trying to take over slots from a
                                  * previous generation
                                  */
+    if (THREADS_SCALING()) {
+        apr_thread_mutex_lock(threads_scaler_mtx);
+        apr_thread_cond_signal(threads_scaler_cond);
+        apr_thread_mutex_unlock(threads_scaler_mtx);
+    }
     rv = apr_thread_join(&thread_rv, start_thread_id);
     if (rv != APR_SUCCESS) {
         ap_log_error(APLOG_MARK, APLOG_CRIT, rv, ap_server_conf, APLOGNO(00478)
@@ -2876,9 +4087,15 @@ static void child_main(int child_num_arg, int child_bucket)
     ap_fatal_signal_child_setup(ap_server_conf);
 
     /* Get a sub context for global allocations in this child, so that
-     * we can have cleanups occur when the child exits.
+     * we can have cleanups occur when the child exits. When bound to a
+     * CPU set (e.g. a NUMA node), use a new allocator so that the child's
+     * memory is node local rather than recycled from the parent's.
      */
-    apr_pool_create(&pchild, pconf);
+    if (!ap_mpm_child_cpu_affinity(ap_server_conf, child_num_arg,
+                                   child_bucket, retained->mpm->num_buckets)
+            || ap_mpm_create_local_pool(&pchild, pconf) != APR_SUCCESS) {
+        apr_pool_create(&pchild, pconf);
+    }
     apr_pool_tag(pchild, "pchild");
 
 #if AP_HAS_THREAD_LOCAL
@@ -3206,7 +4423,7 @@ static void perform_idle_server_maintenance(int child_bucket,
                 }
             }
             active_thread_count += child_threads_active;
-            if (child_threads_active == threads_per_child) {
+            if (child_threads_active >= min_threads_per_child) {
                 had_healthy_child = 1;
             }
             last_non_dead = i;
@@ -3578,6 +4795,24 @@ static int event_run(apr_pool_t * _pconf, apr_pool_t * plog, server_rec * s)
         return !OK;
     }
 
+    /* The MaxConnectionsPerIP counters of this generation's children */
+    conn_ip_counts = NULL;
+    if (max_conns_per_ip > 0) {
+        apr_shm_t *shm;
+        rv = apr_shm_create(&shm, (apr_size_t)server_limit * CONN_IP_BUCKETS
+                                  * sizeof(apr_uint32_t),
+                            NULL, retained->gen_pool);
+        if (rv == APR_SUCCESS) {
+            conn_ip_counts = apr_shm_baseaddr_get(shm);
+            memset(conn_ip_counts, 0, apr_shm_size_get(shm));
+        }
+        else {
+            ap_log_error(APLOG_MARK, APLOG_WARNING, rv, ap_server_conf,
+                         APLOGNO(10536) "Can't create the shared memory "
+                         "for MaxConnectionsPerIP, no limit applied");
+        }
+    }
+
     retained->buckets = apr_pcalloc(retained->gen_pool,
                                     num_buckets * sizeof(event_child_bucket));
     for (i = 0; i < num_buckets; i++) {
@@ -3944,6 +5179,7 @@ static int event_pre_config(apr_pool_t * pconf, apr_pool_t * plog,
     thread_limit = DEFAULT_THREAD_LIMIT;
     active_daemons_limit = server_limit;
     threads_per_child = DEFAULT_THREADS_PER_CHILD;
+    min_threads_per_child = 0;
     max_workers = active_daemons_limit * threads_per_child;
     defer_linger_chain = NULL;
     had_healthy_child = 0;
@@ -3953,7 +5189,16 @@ static int event_pre_config(apr_pool_t * pconf, apr_pool_t * plog,
     worker_queue_info = NULL;
     listener_os_thread = NULL;
     listensocks_disabled = 0;
+    normal_listensocks_disabled = 0;
     listener_is_wakeable = 0;
+    io_engine = IO_ENGINE_POLL;
+#if HAVE_LIBURING
+    listener_ring_ok = 0;
+#endif
+    admission_target = 0;
+    admission_interval = DEFAULT_ADMISSION_INTERVAL;
+    header_timeout = 0;
+    max_conns_per_ip = 0;
 
     return OK;
 }
@@ -3975,10 +5220,21 @@ static int event_post_config(apr_pool_t *pconf, apr_pool_t *plog,
     wc.hash = apr_hash_make(ptemp);
     ka.hash = apr_hash_make(ptemp);
 
+    /* One timeout shard per worker thread, up to MAX_TIMEOUT_SHARDS */
+    num_timeout_shards = threads_per_child;
+    if (num_timeout_shards > MAX_TIMEOUT_SHARDS) {
+        num_timeout_shards = MAX_TIMEOUT_SHARDS;
+    }
+    else if (num_timeout_shards < 1) {
+        num_timeout_shards = 1;
+    }
+
     linger_q = TO_QUEUE_MAKE(pconf, apr_time_from_sec(MAX_SECS_TO_LINGER),
                              NULL);
     short_linger_q = TO_QUEUE_MAKE(pconf, apr_time_from_sec(SECONDS_TO_LINGER),
                                    NULL);
+    header_q = (header_timeout > 0) ? TO_QUEUE_MAKE(pconf, header_timeout, NULL)
+                                    : NULL;
 
     for (; s; s = s->next) {
         event_srv_cfg *sc = apr_pcalloc(pconf, sizeof *sc);
@@ -4143,6 +5399,29 @@ static int event_check_config(apr_pool_t *p, apr_pool_t *plog,
         threads_per_child = 1;
     }
 
+    if (ap_priority_workers >= threads_per_child) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING | APLOG_STARTUP, 0, NULL,
+                     APLOGNO(10529) "PriorityWorkers of %d is not less than "
+                     "ThreadsPerChild of %d, decreasing to %d",
+                     ap_priority_workers, threads_per_child,
+                     threads_per_child - 1);
+        ap_priority_workers = threads_per_child - 1;
+    }
+
+    if (min_threads_per_child <= 0 || min_threads_per_child > threads_per_child) {
+        if (min_threads_per_child > threads_per_child) {
+            ap_log_error(APLOG_MARK, APLOG_WARNING | APLOG_STARTUP, 0, NULL,
+                         APLOGNO(10545) "MinThreadsPerChild of %d exceeds "
+                         "ThreadsPerChild of %d, decreasing to match",
+                         min_threads_per_child, threads_per_child);
+        }
+        min_threads_per_child = threads_per_child;
+    }
+    if (min_threads_per_child <= ap_priority_workers) {
+        /* Don't let the reserved workers exit when idle */
+        min_threads_per_child = ap_priority_workers + 1;
+    }
+
     if (max_workers < threads_per_child) {
         if (startup) {
             ap_log_error(APLOG_MARK, APLOG_WARNING | APLOG_STARTUP, 0, NULL, APLOGNO(00511)
@@ -4333,6 +5612,21 @@ static const char *set_threads_per_child(cmd_parms * cmd, void *dummy,
     threads_per_child = atoi(arg);
     return NULL;
 }
+static const char *set_min_threads_per_child(cmd_parms * cmd, void *dummy,
+                                             const char *arg)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+    if (err != NULL) {
+        return err;
+    }
+
+    min_threads_per_child = atoi(arg);
+    if (min_threads_per_child < 1) {
+        return "MinThreadsPerChild must be a positive number";
+    }
+    return NULL;
+}
+
 static const char *set_server_limit (cmd_parms *cmd, void *dummy, const char *arg)
 {
     const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
@@ -4380,6 +5674,88 @@ static const char *set_worker_factor(cmd_parms * cmd, void *dummy,
     return NULL;
 }
 
+static const char *set_io_engine(cmd_parms *cmd, void *dummy,
+                                 const char *arg)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+    if (err != NULL) {
+        return err;
+    }
+
+    if (!ap_cstr_casecmp(arg, "poll")) {
+        io_engine = IO_ENGINE_POLL;
+    }
+    else if (!ap_cstr_casecmp(arg, "io_uring")) {
+#if HAVE_LIBURING
+        io_engine = IO_ENGINE_URING;
+#else
+        return "EventIOEngine io_uring is not available, httpd was built "
+               "without liburing";
+#endif
+    }
+    else {
+        return "EventIOEngine must be one of: poll, io_uring";
+    }
+    return NULL;
+}
+
+static const char *set_admission_time(cmd_parms *cmd, void *dummy,
+                                      const char *arg)
+{
+    apr_interval_time_t t;
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+    if (err != NULL) {
+        return err;
+    }
+
+    if (ap_timeout_parameter_parse(arg, &t, "ms") != APR_SUCCESS || t < 0) {
+        return apr_pstrcat(cmd->pool, cmd->cmd->name,
+                           " must be a positive time (in ms by default)",
+                           NULL);
+    }
+    if (cmd->info) {
+        if (!t) {
+            return "AdmissionInterval can't be zero";
+        }
+        admission_interval = t;
+    }
+    else {
+        admission_target = t;
+    }
+    return NULL;
+}
+
+static const char *set_header_timeout(cmd_parms *cmd, void *dummy,
+                                      const char *arg)
+{
+    apr_interval_time_t t;
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+    if (err != NULL) {
+        return err;
+    }
+
+    if (ap_timeout_parameter_parse(arg, &t, "s") != APR_SUCCESS || t < 0) {
+        return "RequestHeaderTimeout must be a positive time (in seconds "
+               "by default)";
+    }
+    header_timeout = t;
+    return NULL;
+}
+
+static const char *set_max_conns_per_ip(cmd_parms *cmd, void *dummy,
+                                        const char *arg)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+    if (err != NULL) {
+        return err;
+    }
+
+    max_conns_per_ip = atoi(arg);
+    if (max_conns_per_ip < 0) {
+        return "MaxConnectionsPerIP must be a positive number or 0";
+    }
+    return NULL;
+}
 
 static const command_rec event_cmds[] = {
     LISTEN_COMMANDS,
@@ -4397,12 +5773,30 @@ static const command_rec event_cmds[] = {
                   "Maximum number of threads alive at the same time"),
     AP_INIT_TAKE1("ThreadsPerChild", set_threads_per_child, NULL, RSRC_CONF,
                   "Number of threads each child creates"),
+    AP_INIT_TAKE1("MinThreadsPerChild", set_min_threads_per_child, NULL,
+                  RSRC_CONF, "Number of threads each child keeps running, "
+                  "the others up to ThreadsPerChild are created on demand"),
     AP_INIT_TAKE1("ThreadLimit", set_thread_limit, NULL, RSRC_CONF,
                   "Maximum number of worker threads per child process for this "
                   "run of Apache - Upper limit for ThreadsPerChild"),
     AP_INIT_TAKE1("AsyncRequestWorkerFactor", set_worker_factor, NULL, RSRC_CONF,
                   "How many additional connects will be accepted per idle "
                   "worker thread"),
+    AP_INIT_TAKE1("AdmissionTarget", set_admission_time, NULL, RSRC_CONF,
+                  "Queueing delay for a worker above which new connections "
+                  "are shed, 0 (default) to never shed"),
+    AP_INIT_TAKE1("AdmissionInterval", set_admission_time, (void *)1,
+                  RSRC_CONF, "How long the queueing delay must stay above "
+                  "AdmissionTarget before shedding"),
+    AP_INIT_TAKE1("RequestHeaderTimeout", set_header_timeout, NULL, RSRC_CONF,
+                  "Maximum time to read the request headers, "
+                  "the connection is aborted after it"),
+    AP_INIT_TAKE1("MaxConnectionsPerIP", set_max_conns_per_ip, NULL,
+                  RSRC_CONF, "Maximum number of concurrent connections "
+                  "from a client IP address"),
+    AP_INIT_TAKE1("EventIOEngine", set_io_engine, NULL, RSRC_CONF,
+                  "How the listener accepts new connections: poll (default) "
+                  "or io_uring"),
     AP_GRACEFUL_SHUTDOWN_TIMEOUT_COMMAND,
     {NULL}
 };
@@ -45,14 +45,28 @@ static int my_child_num;
 static motorz_child_bucket *all_buckets, /* All listeners buckets */
                             *my_bucket;   /* Current child bucket */
 
-static void clean_child_exit(int code) __attribute__ ((noreturn));
+/* volatile because they're updated from a signal handler or another
+ * thread: die_now asks the threads to stop accepting and exit once their
+ * connections are done, terminate_now to exit right away.
+ */
+static int volatile die_now = 0;
+static int volatile terminate_now = 0;
+static int volatile resource_shortage = 0;
+
+/* connections accepted by all the threads, for MaxConnectionsPerChild */
+static apr_uint32_t conns_this_child;
+
+#define MOTORZ_POLL_TIMEOUT apr_time_from_msec(500)
 
+#define ID_FROM_CHILD_THREAD(c, t)    ((c * thread_limit) + t)
+
+/* Same as SECONDS_TO_LINGER and MAX_SECS_TO_LINGER in server/connection.c */
+#define MOTORZ_SHORT_LINGER_TIMEOUT apr_time_from_sec(2)
+#define MOTORZ_LINGER_TIMEOUT apr_time_from_sec(MAX_SECS_TO_LINGER)
 
-static apr_status_t motorz_io_process(motorz_conn_t *scon);
 static void clean_child_exit(int code) __attribute__ ((noreturn));
 
-static apr_pollset_t *motorz_pollset;
-static apr_skiplist *motorz_timer_ring;
+static void motorz_io_process(motorz_conn_t *scon);
 
 static motorz_core_t *motorz_core_get(void)
 {
@@ -65,20 +79,31 @@ static int timer_comp(void *a, void *b)
     apr_time_t t2 = (apr_time_t) (((motorz_timer_t *) b)->expires);
     AP_DEBUG_ASSERT(t1);
     AP_DEBUG_ASSERT(t2);
-    return ((t1 < t2) ? -1 : 1);
+    if (a == b) {
+        /* for apr_skiplist_remove() to find it */
+        return 0;
+    }
+    if (t1 != t2) {
+        return ((t1 < t2) ? -1 : 1);
+    }
+    return ((a < b) ? -1 : 1);
+}
+
+static void motorz_unregister_timeout(motorz_conn_t *scon)
+{
+    if (scon->timer.expires) {
+        apr_skiplist_remove(scon->mt->timeout_ring, &scon->timer, NULL);
+        scon->timer.expires = 0;
+    }
 }
 
 static apr_status_t motorz_conn_pool_cleanup(void *baton)
 {
     motorz_conn_t *scon = (motorz_conn_t *)baton;
 
-    if (scon->timer.expires) {
-        motorz_core_t *mz = scon->mz;
-
-        apr_thread_mutex_lock(mz->mtx);
-        apr_skiplist_remove(mz->timeout_ring, &scon->timer, NULL);
-        apr_thread_mutex_unlock(mz->mtx);
-    }
+    /* the pool is destroyed by the thread owning the connection */
+    motorz_unregister_timeout(scon);
+    scon->mt->conns--;
 
     return APR_SUCCESS;
 }
@@ -105,46 +130,179 @@ motorz_get_keep_alive_timeout(motorz_conn_t *scon)
     }
 }
 
-static void motorz_io_timeout_cb(motorz_core_t *mz, void *baton)
+static void motorz_register_timeout(motorz_conn_t *scon,
+                                    motorz_timer_cb cb,
+                                    apr_interval_time_t relative_time)
+{
+    apr_time_t t = apr_time_now() + relative_time;
+    motorz_timer_t *elem = &scon->timer;
+    motorz_thread_t *mt = scon->mt;
+
+    motorz_unregister_timeout(scon);
+
+    elem->expires = t;
+    elem->cb = cb;
+    elem->baton = scon;
+    elem->pool = scon->pool;
+    elem->mt = mt;
+
+    ap_log_error(APLOG_MARK, APLOG_TRACE6, 0, ap_server_conf, APLOGNO(03324)
+                         "motorz_register_timer(): insert ELEM: %pp", elem);
+
+#ifdef AP_DEBUG
+    ap_assert(apr_skiplist_insert(mt->timeout_ring, elem));
+#else
+    apr_skiplist_insert(mt->timeout_ring, elem);
+#endif
+}
+
+/* Wait for the connection to be readable (or writable if CONN_SENSE_WANT_WRITE
+ * or want_write), until the timeout.
+ */
+static apr_status_t motorz_conn_wait(motorz_conn_t *scon, int want_write,
+                                     motorz_timer_cb cb,
+                                     apr_interval_time_t timeout)
 {
+    apr_status_t rv;
 
+    motorz_register_timeout(scon, cb, timeout);
+
+    if (scon->cs.sense == CONN_SENSE_WANT_READ) {
+        want_write = 0;
+    }
+    else if (scon->cs.sense == CONN_SENSE_WANT_WRITE) {
+        want_write = 1;
+    }
+    scon->cs.sense = CONN_SENSE_DEFAULT;
+    scon->pfd.reqevents = (want_write ? APR_POLLOUT : APR_POLLIN)
+                          | APR_POLLHUP | APR_POLLERR;
+
+    rv = apr_pollset_add(scon->mt->pollset, &scon->pfd);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, ap_server_conf, APLOGNO(02850)
+                     "motorz_conn_wait: apr_pollset_add failure");
+        scon->pfd.reqevents = 0;
+        motorz_unregister_timeout(scon);
+    }
+    return rv;
+}
+
+/* Done with the connection, its socket is closed with its pool */
+static void motorz_conn_close(motorz_conn_t *scon)
+{
+    ap_log_error(APLOG_MARK, APLOG_TRACE6, 0, ap_server_conf, APLOGNO(03332)
+                 "motorz_conn_close(): scon: %pp", scon);
+
+    if (scon->pfd.reqevents != 0) {
+        apr_pollset_remove(scon->mt->pollset, &scon->pfd);
+        scon->pfd.reqevents = 0;
+    }
+    apr_pool_destroy(scon->pool);
+}
+
+static void motorz_io_timeout_cb(motorz_thread_t *mt, void *baton)
+{
     motorz_conn_t *scon = (motorz_conn_t *) baton;
     conn_rec *c = scon->c;
-    scon->cs.state = CONN_STATE_LINGER;
-    ap_lingering_close(c);
 
-    ap_log_error(APLOG_MARK, APLOG_WARNING, 0, ap_server_conf, APLOGNO(02842)
-                 "io timeout hit (?) scon: %pp, c: %pp", scon, c);
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf, APLOGNO(02842)
+                 "io timeout hit scon: %pp, c: %pp, state: %d",
+                 scon, c, (int)scon->cs.state);
+
+    /* Lingering or (idle) keepalive connections are done, others timed out
+     * in the middle of something and are aborted.
+     */
+    if (scon->cs.state != CONN_STATE_CHECK_REQUEST_LINE_READABLE
+            && scon->cs.state != CONN_STATE_LINGER_NORMAL
+            && scon->cs.state != CONN_STATE_LINGER_SHORT) {
+        c->aborted = 1;
+    }
+    motorz_conn_close(scon);
 }
 
-static void *motorz_io_setup_conn(apr_thread_t *thread, void *baton)
+/* Lingering close without blocking the thread: the read side is drained
+ * from the pollset until the client closes or the linger timeout.
+ */
+static void motorz_start_lingering_close(motorz_conn_t *scon)
+{
+    conn_rec *c = scon->c;
+    apr_interval_time_t timeout;
+
+    if (ap_start_lingering_close(c)) {
+        motorz_conn_close(scon);
+        return;
+    }
+
+    if (apr_table_get(c->notes, "short-lingering-close")) {
+        scon->cs.state = CONN_STATE_LINGER_SHORT;
+        timeout = MOTORZ_SHORT_LINGER_TIMEOUT;
+    }
+    else {
+        scon->cs.state = CONN_STATE_LINGER_NORMAL;
+        timeout = MOTORZ_LINGER_TIMEOUT;
+    }
+    apr_socket_timeout_set(scon->sock, 0);
+    apr_socket_opt_set(scon->sock, APR_INCOMPLETE_READ, 1);
+    scon->cs.sense = CONN_SENSE_DEFAULT;
+    if (motorz_conn_wait(scon, 0, motorz_io_timeout_cb, timeout)) {
+        motorz_conn_close(scon);
+    }
+}
+
+static void motorz_lingering_read(motorz_conn_t *scon)
+{
+    char dummybuf[512];
+    apr_size_t nbytes;
+    apr_status_t rv;
+
+    do {
+        nbytes = sizeof(dummybuf);
+        rv = apr_socket_recv(scon->sock, dummybuf, &nbytes);
+    } while (rv == APR_SUCCESS && nbytes);
+
+    if (APR_STATUS_IS_EAGAIN(rv)) {
+        /* still lingering, keep the current timer */
+        scon->pfd.reqevents = APR_POLLIN | APR_POLLHUP | APR_POLLERR;
+        if (apr_pollset_add(scon->mt->pollset, &scon->pfd) == APR_SUCCESS) {
+            return;
+        }
+        scon->pfd.reqevents = 0;
+    }
+    motorz_conn_close(scon);
+}
+
+static void motorz_io_setup_conn(motorz_thread_t *mt, motorz_conn_t *scon)
 {
     apr_status_t status;
     ap_sb_handle_t *sbh;
-    long conn_id = 0;
+    long conn_id = ID_FROM_CHILD_THREAD(my_child_num, mt->tid);
     motorz_sb_t *sb;
-    motorz_conn_t *scon = (motorz_conn_t *) baton;
 
-    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf, APLOGNO(03316)
+    ap_log_error(APLOG_MARK, APLOG_TRACE6, 0, ap_server_conf, APLOGNO(03316)
                          "motorz_io_setup_conn(): entered");
 
-    ap_create_sb_handle(&sbh, scon->pool, 0, 0);
+    ap_create_sb_handle(&sbh, scon->pool, my_child_num, mt->tid);
     scon->sbh = sbh;
     scon->ba = apr_bucket_alloc_create(scon->pool);
 
     scon->c = ap_run_create_connection(scon->pool, ap_server_conf, scon->sock,
                                        conn_id, sbh, scon->ba);
-    /* XXX: handle failure */
+    if (!scon->c) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf, APLOGNO(02843)
+                     "motorz_io_setup_conn: connection aborted");
+        apr_pool_destroy(scon->pool);
+        return;
+    }
 
     scon->c->cs = &scon->cs;
     sb = apr_pcalloc(scon->pool, sizeof(motorz_sb_t));
 
-    scon->c->current_thread = thread;
+    scon->c->current_thread = mt->thd;
 
     scon->pfd.p = scon->pool;
     scon->pfd.desc_type = APR_POLL_SOCKET;
     scon->pfd.desc.s = scon->sock;
-    scon->pfd.reqevents = APR_POLLIN;
+    scon->pfd.reqevents = 0;
 
     sb->type = PT_CSD;
     sb->baton = scon;
@@ -153,391 +311,315 @@ static void *motorz_io_setup_conn(apr_thread_t *thread, void *baton)
     ap_update_vhost_given_ip(scon->c);
 
     status = ap_pre_connection(scon->c, scon->sock);
-    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf, APLOGNO(03317)
-                         "motorz_io_setup_conn(): did pre-conn");
     if (status != OK && status != DONE) {
-        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf, APLOGNO(02843)
-                     "motorz_io_setup_conn: connection aborted");
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf, APLOGNO(03317)
+                     "motorz_io_setup_conn: pre_connection failed");
+        scon->c->aborted = 1;
     }
 
     scon->cs.state = CONN_STATE_READ_REQUEST_LINE;
     scon->cs.sense = CONN_SENSE_DEFAULT;
 
-    status = motorz_io_process(scon);
-
-    if (1) {
-        ap_log_error(APLOG_MARK, APLOG_DEBUG, status, ap_server_conf, APLOGNO(02844)
-                     "motorz_io_setup_conn: motorz_io_process status: %d", (int)status);
-    }
-    return NULL;
+    motorz_io_process(scon);
 }
 
-static apr_status_t motorz_io_user(motorz_core_t *mz, motorz_sb_t *sb)
+static apr_status_t motorz_io_user(motorz_thread_t *mt, motorz_sb_t *sb)
 {
     /* TODO */
     return APR_SUCCESS;
 }
 
-static apr_status_t motorz_io_accept(motorz_core_t *mz, motorz_sb_t *sb)
+static apr_status_t motorz_io_accept(motorz_thread_t *mt, motorz_sb_t *sb)
 {
     apr_status_t rv;
     apr_pool_t *ptrans;
-    apr_socket_t *socket;
+    apr_socket_t *socket = NULL;
     ap_listen_rec *lr = (ap_listen_rec *) sb->baton;
     apr_allocator_t *allocator;
 
     apr_allocator_create(&allocator);
     apr_allocator_max_free_set(allocator, ap_max_mem_free);
-    apr_pool_create_ex(&ptrans, pconf, NULL, allocator);
+    apr_pool_create_ex(&ptrans, mt->pool, NULL, allocator);
     apr_allocator_owner_set(allocator, ptrans);
     apr_pool_tag(ptrans, "transaction");
 
-    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf, APLOGNO(03318)
-                         "motorz_io_accept(): entered");
-
     rv = lr->accept_func((void *)&socket, lr, ptrans);
-    if (rv != APR_SUCCESS) {
-        ap_log_error(APLOG_MARK, APLOG_CRIT, rv, NULL, APLOGNO(02845)
+    if (rv == APR_EGENERAL) {
+        /* E[NM]FILE, ENOMEM, etc */
+        ap_log_error(APLOG_MARK, APLOG_CRIT, rv, ap_server_conf, APLOGNO(02845)
                      "motorz_io_accept failed");
-        clean_child_exit(APEXIT_CHILDSICK);
-    }
-    else if (ap_accept_error_is_nonfatal(rv)) {
-        ap_log_error(APLOG_MARK, APLOG_DEBUG, rv, ap_server_conf,
-                "accept() on client socket failed");
+        resource_shortage = 1;
+        die_now = 1;
     }
-
-    else {
+    else if (rv == APR_SUCCESS && socket) {
         motorz_conn_t *scon = apr_pcalloc(ptrans, sizeof(motorz_conn_t));
         scon->pool = ptrans;
         scon->sock = socket;
-        scon->mz = mz;
+        scon->mt = mt;
+        mt->conns++;
 
         apr_pool_cleanup_register(scon->pool, scon, motorz_conn_pool_cleanup,
                                   apr_pool_cleanup_null);
 
-        rv = apr_thread_pool_push(mz->workers,
-                                  motorz_io_setup_conn,
-                                  scon,
-                                  APR_THREAD_TASK_PRIORITY_HIGHEST, NULL);
-    }
-    ap_log_error(APLOG_MARK, APLOG_DEBUG, rv, ap_server_conf, APLOGNO(03319)
-                         "motorz_io_accept(): exited: %d", (int)rv);
-
-    return rv;
-}
-
-static void *motorz_timer_invoke(apr_thread_t *thread, void *baton)
-{
-    motorz_timer_t *ep = (motorz_timer_t *)baton;
-    motorz_conn_t *scon = (motorz_conn_t *)ep->baton;
-
-    scon->c->current_thread = thread;
-
-    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf, APLOGNO(03320)
-                         "motorz_timer_invoke(): entered");
-
-    ep->cb(ep->mz, ep->baton);
-
-    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf, APLOGNO(03321)
-                         "motorz_timer_invoke(): exited");
-
-    return NULL;
-}
-
-static apr_status_t motorz_timer_event_process(motorz_core_t *mz, motorz_timer_t *te)
-{
-    motorz_conn_t *scon = (motorz_conn_t *)te->baton;
-    scon->timer.expires = 0;
-
-    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf, APLOGNO(03322)
-                         "motorz_timer_event_process(): entered");
-
-    return apr_thread_pool_push(mz->workers,
-                                motorz_timer_invoke,
-                                te, APR_THREAD_TASK_PRIORITY_NORMAL, NULL);
-}
-
-static void *motorz_io_invoke(apr_thread_t *thread, void *baton)
-{
-    motorz_sb_t *sb = (motorz_sb_t *) baton;
-    motorz_conn_t *scon = (motorz_conn_t *) sb->baton;
-    apr_status_t rv;
-
-    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf, APLOGNO(03323)
-                         "motorz_io_invoke(): entered");
-    scon->c->current_thread = thread;
-
-    rv = motorz_io_process(scon);
+        if (ap_max_requests_per_child > 0
+                && apr_atomic_inc32(&conns_this_child) + 1
+                   >= (apr_uint32_t)ap_max_requests_per_child) {
+            /* MaxConnectionsPerChild reached, stop gracefully */
+            die_now = 1;
+        }
 
-    if (rv != APR_SUCCESS) {
-        ap_log_error(APLOG_MARK, APLOG_DEBUG, rv, ap_server_conf, APLOGNO(02846)
-                     "motorz_io_invoke: motorz_io_process failed (?)");
+        motorz_io_setup_conn(mt, scon);
+        return APR_SUCCESS;
     }
-    return NULL;
-}
 
-static apr_status_t motorz_io_event_process(motorz_core_t *mz, motorz_sb_t *sb)
-{
-    return apr_thread_pool_push(mz->workers,
-                                motorz_io_invoke,
-                                sb, APR_THREAD_TASK_PRIORITY_NORMAL, NULL);
+    /* Nothing to accept (another thread got it first), or a nonfatal
+     * error that won't repeat for the next connection.
+     */
+    apr_pool_destroy(ptrans);
+    return APR_SUCCESS;
 }
 
-static apr_status_t motorz_io_callback(void *baton, const apr_pollfd_t *pfd)
+static apr_status_t motorz_io_callback(motorz_thread_t *mt,
+                                       const apr_pollfd_t *pfd)
 {
     apr_status_t status = APR_SUCCESS;
-    motorz_core_t *mz = (motorz_core_t *) baton;
     motorz_sb_t *sb = pfd->client_data;
 
-
     if (sb->type == PT_ACCEPT) {
-        status = motorz_io_accept(mz, sb);
+        status = motorz_io_accept(mt, sb);
     }
     else if (sb->type == PT_CSD) {
-        status = motorz_io_event_process(mz, sb);
+        motorz_conn_t *scon = (motorz_conn_t *) sb->baton;
+
+        /* Some of the pollset backends, like KQueue or Epoll
+         * automagically remove the FD if the socket is closed,
+         * therefore, we can accept _SUCCESS or _NOTFOUND,
+         * and we still want to keep going
+         */
+        status = apr_pollset_remove(mt->pollset, &scon->pfd);
+        if (status != APR_SUCCESS && !APR_STATUS_IS_NOTFOUND(status)) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, status, ap_server_conf, APLOGNO(02847)
+                         "motorz_io_callback: apr_pollset_remove failure");
+        }
+        scon->pfd.reqevents = 0;
+
+        if (scon->cs.state == CONN_STATE_LINGER_NORMAL
+                || scon->cs.state == CONN_STATE_LINGER_SHORT) {
+            motorz_lingering_read(scon);
+        }
+        else {
+            motorz_unregister_timeout(scon);
+            motorz_io_process(scon);
+        }
+        status = APR_SUCCESS;
     }
     else if (sb->type == PT_USER) {
-        status = motorz_io_user(mz, sb);
+        status = motorz_io_user(mt, sb);
     }
     return status;
 }
 
-static void motorz_register_timeout(motorz_conn_t *scon,
-                                    motorz_timer_cb cb,
-                                    apr_interval_time_t relative_time)
-{
-    apr_time_t t = apr_time_now() + relative_time;
-    motorz_timer_t *elem = &scon->timer;
-    motorz_core_t *mz = scon->mz;
-
-    elem->expires = t;
-    elem->cb = cb;
-    elem->baton = scon;
-    elem->pool = scon->pool;
-    elem->mz = mz;
-
-    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf, APLOGNO(03324)
-                         "motorz_register_timer(): insert ELEM: %pp", elem);
-
-    apr_thread_mutex_lock(mz->mtx);
-#ifdef AP_DEBUG
-    ap_assert(apr_skiplist_insert(mz->timeout_ring, elem));
-#else
-    apr_skiplist_insert(mz->timeout_ring, elem);
-#endif
-    apr_thread_mutex_unlock(mz->mtx);
-}
-
-static apr_status_t motorz_io_process(motorz_conn_t *scon)
+/* Process the connection up to the point where it has to wait for the
+ * network, in the thread owning it.
+ */
+static void motorz_io_process(motorz_conn_t *scon)
 {
-    apr_status_t rv;
-    motorz_core_t *mz;
-    conn_rec *c;
+    conn_rec *c = scon->c;
 
-    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf, APLOGNO(03325)
-                         "motorz_io_process(): entered");
+    ap_log_error(APLOG_MARK, APLOG_TRACE6, 0, ap_server_conf, APLOGNO(03325)
+                         "motorz_io_process(): entered, state: %d",
+                         (int)scon->cs.state);
 
-    if (scon->c->clogging_input_filters && !scon->c->aborted) {
+    if (c->clogging_input_filters && !c->aborted) {
         /* Since we have an input filter which 'clogs' the input stream,
          * like mod_ssl used to, lets just do the normal read from input
          * filters, like the Worker MPM does. Filters that need to write
          * where they would otherwise read, or read where they would
          * otherwise write, should set the sense appropriately.
          */
-        ap_run_process_connection(scon->c);
+        ap_run_process_connection(c);
         if (scon->cs.state != CONN_STATE_SUSPENDED) {
             scon->cs.state = CONN_STATE_LINGER;
         }
     }
 
-    mz = scon->mz;
-    c = scon->c;
-
-    if (!c->aborted) {
-
-        if (scon->pfd.reqevents != 0) {
-            /*
-             * Some of the pollset backends, like KQueue or Epoll
-             * automagically remove the FD if the socket is closed,
-             * therefore, we can accept _SUCCESS or _NOTFOUND,
-             * and we still want to keep going
-             */
-            ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf, APLOGNO(03326)
-                                 "motorz_io_process(): apr_pollset_remove");
-
-            rv = apr_pollset_remove(mz->pollset, &scon->pfd);
-            if (rv != APR_SUCCESS && !APR_STATUS_IS_NOTFOUND(rv)) {
-                ap_log_error(APLOG_MARK, APLOG_ERR, rv, ap_server_conf, APLOGNO(02847)
-                             "motorz_io_process: apr_pollset_remove failure");
-                /*AP_DEBUG_ASSERT(rv == APR_SUCCESS);*/
-            }
-            scon->pfd.reqevents = 0;
-        }
+    if (c->aborted) {
+        scon->cs.state = CONN_STATE_LINGER;
+    }
 
-        if (scon->cs.state == CONN_STATE_CHECK_REQUEST_LINE_READABLE) {
-            ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf, APLOGNO(03327)
-                                 "motorz_io_process(): Set to CONN_STATE_READ_REQUEST_LINE");
-            scon->cs.state = CONN_STATE_READ_REQUEST_LINE;
-        }
+    if (scon->cs.state == CONN_STATE_CHECK_REQUEST_LINE_READABLE) {
+        scon->cs.state = CONN_STATE_READ_REQUEST_LINE;
+    }
 
 read_request:
-        if (scon->cs.state == CONN_STATE_READ_REQUEST_LINE) {
-            ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf, APLOGNO(03328)
-                                 "motorz_io_process(): CONN_STATE_READ_REQUEST_LINE");
-            if (!c->aborted) {
-                ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf, APLOGNO(03329)
-                                     "motorz_io_process(): !aborted");
-                ap_run_process_connection(c);
-                /* state will be updated upon return
-                 * fall thru to either wait for readability/timeout or
-                 * do lingering close
-                 */
-            }
-            else {
-                ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf, APLOGNO(03330)
-                                     "motorz_io_process(): aborted");
-                scon->cs.state = CONN_STATE_LINGER;
-            }
+    if (scon->cs.state == CONN_STATE_READ_REQUEST_LINE) {
+        ap_run_process_connection(c);
+        /* state will be updated upon return
+         * fall thru to either wait for readability/timeout or
+         * do lingering close
+         */
+        if (c->aborted) {
+            scon->cs.state = CONN_STATE_LINGER;
         }
+    }
 
-        if (scon->cs.state == CONN_STATE_WRITE_COMPLETION) {
-            int pending;
-
-            ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf, APLOGNO(03331)
-                                  "motorz_io_process(): CONN_STATE_WRITE_COMPLETION");
-
-            ap_update_child_status(scon->sbh, SERVER_BUSY_WRITE, NULL);
-
-            pending = ap_run_output_pending(c);
-            if (pending == OK) {
-                /* Still in WRITE_COMPLETION_STATE:
-                 * Set a write timeout for this connection, and let the
-                 * event thread poll for writeability.
-                 */
-                motorz_register_timeout(scon,
-                                      motorz_io_timeout_cb,
-                                      motorz_get_timeout(scon));
-
-                scon->pfd.reqevents = (
-                                       scon->cs.sense == CONN_SENSE_WANT_READ ? APR_POLLIN :
-                                       APR_POLLOUT) | APR_POLLHUP | APR_POLLERR;
-                scon->cs.sense = CONN_SENSE_DEFAULT;
+    if (scon->cs.state == CONN_STATE_WRITE_COMPLETION) {
+        int pending;
 
-                rv = apr_pollset_add(mz->pollset, &scon->pfd);
+        ap_update_child_status(scon->sbh, SERVER_BUSY_WRITE, NULL);
 
-                if (rv != APR_SUCCESS) {
-                    ap_log_error(APLOG_MARK, APLOG_WARNING, rv,
-                                 ap_server_conf, APLOGNO(02849)
-                                 "apr_pollset_add: failed in write completion");
-                }
-                return APR_SUCCESS;
-            }
-            if (pending != DECLINED
-                    || c->keepalive != AP_CONN_KEEPALIVE
-                    || c->aborted) {
-                scon->cs.state = CONN_STATE_LINGER;
-            }
-            else if (ap_run_input_pending(c) == OK) {
-                scon->cs.state = CONN_STATE_READ_REQUEST_LINE;
-                goto read_request;
-            }
-            else {
-                scon->cs.state = CONN_STATE_CHECK_REQUEST_LINE_READABLE;
+        pending = ap_run_output_pending(c);
+        if (pending == OK) {
+            /* Still in WRITE_COMPLETION_STATE:
+             * Set a write timeout for this connection, and let the
+             * event loop poll for writeability.
+             */
+            if (motorz_conn_wait(scon, 1, motorz_io_timeout_cb,
+                                 motorz_get_timeout(scon)) == APR_SUCCESS) {
+                return;
             }
+            c->aborted = 1;
         }
+        if (pending != DECLINED
+                || c->keepalive != AP_CONN_KEEPALIVE
+                || c->aborted) {
+            scon->cs.state = CONN_STATE_LINGER;
+        }
+        else if (ap_run_input_pending(c) == OK) {
+            scon->cs.state = CONN_STATE_READ_REQUEST_LINE;
+            goto read_request;
+        }
+        else {
+            scon->cs.state = CONN_STATE_CHECK_REQUEST_LINE_READABLE;
+        }
+    }
 
-        if (scon->cs.state == CONN_STATE_LINGER) {
-            ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf, APLOGNO(03332)
-                                  "motorz_io_process(): CONN_STATE_LINGER");
-            ap_lingering_close(c);
+    if (scon->cs.state == CONN_STATE_CHECK_REQUEST_LINE_READABLE) {
+        /* no keepalive while stopping */
+        if (!die_now
+                && motorz_conn_wait(scon, 0, motorz_io_timeout_cb,
+                                    motorz_get_keep_alive_timeout(scon))
+                   == APR_SUCCESS) {
+            ap_update_child_status(scon->sbh, SERVER_BUSY_KEEPALIVE, NULL);
+            return;
         }
+        scon->cs.state = CONN_STATE_LINGER;
+    }
 
-        if (scon->cs.state == CONN_STATE_CHECK_REQUEST_LINE_READABLE) {
-            ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf, APLOGNO(03333)
-                                  "motorz_io_process(): CONN_STATE_CHECK_REQUEST_LINE_READABLE");
-            motorz_register_timeout(scon,
-                                  motorz_io_timeout_cb,
-                                  motorz_get_keep_alive_timeout(scon));
+    if (scon->cs.state == CONN_STATE_SUSPENDED) {
+        /* some module took it over */
+        return;
+    }
 
-            scon->pfd.reqevents = APR_POLLIN | APR_POLLHUP | APR_POLLERR;
-            scon->cs.sense = CONN_SENSE_DEFAULT;
+    /* Anything else is the end */
+    motorz_start_lingering_close(scon);
+}
 
-            rv = apr_pollset_add(mz->pollset, &scon->pfd);
+/* Stop (or restart) polling the listeners of the thread */
+static void motorz_thread_listen(motorz_thread_t *mt, int on)
+{
+    int i;
 
-            if (rv != APR_SUCCESS) {
-                ap_log_error(APLOG_MARK, APLOG_ERR, rv, ap_server_conf, APLOGNO(02850)
-                             "process_socket: apr_pollset_add failure in read request line");
-                return rv;
-            }
+    if (mt->listening == on) {
+        return;
+    }
+    for (i = 0; i < mt->num_listen_pfds; i++) {
+        if (on) {
+            apr_pollset_add(mt->pollset, &mt->listen_pfds[i]);
+        }
+        else {
+            apr_pollset_remove(mt->pollset, &mt->listen_pfds[i]);
         }
-    } else {
-        ap_lingering_close(c);
     }
-    return APR_SUCCESS;
+    mt->listening = on;
 }
 
-static apr_status_t motorz_pollset_cb(motorz_core_t *mz, apr_interval_time_t timeout)
+static void motorz_process_timers(motorz_thread_t *mt, apr_time_t now)
 {
-    apr_status_t rc;
-    const apr_pollfd_t *out_pfd = NULL;
-    apr_int32_t num = 0;
-
-    rc = apr_pollset_poll(mz->pollset, timeout, &num, &out_pfd);
-    if (rc != APR_SUCCESS) {
-        if (APR_STATUS_IS_EINTR(rc) || APR_STATUS_IS_TIMEUP(rc)) {
-                return APR_SUCCESS;
-        } else {
-            return rc;
-        }
-    }
-    while (num > 0) {
-        rc = motorz_io_callback(mz, out_pfd);
-        if (rc != APR_SUCCESS) {
-            ap_log_error(APLOG_MARK, APLOG_CRIT, rc, NULL, APLOGNO(03334)
-                         "Call to motorz_io_callback() failed");
-        }
-        out_pfd++;
-        num--;
+    motorz_timer_t *te;
+
+    while ((te = apr_skiplist_peek(mt->timeout_ring)) && te->expires <= now) {
+        apr_skiplist_pop(mt->timeout_ring, NULL);
+        te->expires = 0;
+        te->cb(mt, te->baton);
     }
-    return APR_SUCCESS;
 }
 
-/**
- * Create worker thread pool.
- */
-static apr_status_t motorz_setup_workers(motorz_core_t *mz)
+static void *APR_THREAD_FUNC motorz_thread_main(apr_thread_t *thd, void *baton)
 {
+    motorz_thread_t *mt = baton;
     apr_status_t rv;
 
-    rv = apr_thread_pool_create(&mz->workers,
-                                threads_per_child,
-                                threads_per_child, mz->pool);
+    mt->thd = thd;
+    ap_update_child_status(mt->sbh, SERVER_READY, NULL);
+    motorz_thread_listen(mt, 1);
+
+    while (!terminate_now) {
+        const apr_pollfd_t *out_pfd = NULL;
+        apr_interval_time_t timeout = MOTORZ_POLL_TIMEOUT;
+        apr_int32_t num = 0;
+        motorz_timer_t *te;
+        apr_time_t now;
+
+        if (die_now) {
+            /* graceful stop, finish the connections we have */
+            motorz_thread_listen(mt, 0);
+            if (!mt->conns) {
+                break;
+            }
+        }
 
-    if (rv != APR_SUCCESS) {
-        ap_log_error(APLOG_MARK, APLOG_CRIT, rv, NULL, APLOGNO(02851)
-                     "motorz_setup_workers: apr_thread_pool_create with %d threads failed",
-                     threads_per_child);
-        return rv;
+        te = apr_skiplist_peek(mt->timeout_ring);
+        if (te) {
+            now = apr_time_now();
+            if (te->expires <= now) {
+                timeout = 0;
+            }
+            else if (te->expires - now < timeout) {
+                timeout = te->expires - now;
+            }
+        }
+
+        rv = apr_pollset_poll(mt->pollset, timeout, &num, &out_pfd);
+        if (rv != APR_SUCCESS
+                && !APR_STATUS_IS_EINTR(rv) && !APR_STATUS_IS_TIMEUP(rv)) {
+            ap_log_error(APLOG_MARK, APLOG_CRIT, rv, ap_server_conf, APLOGNO(03117)
+                         "motorz_thread_main: apr_pollset_poll failed");
+            resource_shortage = 1;
+            die_now = 1;
+            break;
+        }
+        for (; num > 0; num--, out_pfd++) {
+            rv = motorz_io_callback(mt, out_pfd);
+            if (rv != APR_SUCCESS) {
+                ap_log_error(APLOG_MARK, APLOG_CRIT, rv, ap_server_conf, APLOGNO(03334)
+                             "Call to motorz_io_callback() failed");
+            }
+        }
+
+        motorz_process_timers(mt, apr_time_now());
     }
 
-    return APR_SUCCESS;
+    ap_update_child_status(mt->sbh, SERVER_GRACEFUL, NULL);
+    apr_thread_exit(thd, APR_SUCCESS);
+    return NULL;
 }
 
-static int motorz_setup_pollset(motorz_core_t *mz)
+static int motorz_setup_pollset(motorz_thread_t *mt)
 {
     int i;
     apr_status_t rv;
     int good_methods[] = {APR_POLLSET_KQUEUE, APR_POLLSET_PORT, APR_POLLSET_EPOLL};
 
     for (i = 0; i < sizeof(good_methods) / sizeof(good_methods[0]); i++) {
-        rv = apr_pollset_create_ex(&mz->pollset,
+        rv = apr_pollset_create_ex(&mt->pollset,
                                   512,
-                                  mz->pool,
+                                  mt->pool,
                                   APR_POLLSET_NODEFAULT,
                                   good_methods[i]);
         if (rv == APR_SUCCESS) {
             ap_log_error(APLOG_MARK, APLOG_DEBUG, rv, ap_server_conf, APLOGNO(02852)
-                         "motorz_setup_pollset: apr_pollset_create_ex using %s", apr_pollset_method_name(mz->pollset));
+                         "motorz_setup_pollset: apr_pollset_create_ex using %s", apr_pollset_method_name(mt->pollset));
 
             break;
         }
@@ -545,17 +627,18 @@ static int motorz_setup_pollset(motorz_core_t *mz)
     if (rv != APR_SUCCESS) {
         ap_log_error(APLOG_MARK, APLOG_INFO, rv, ap_server_conf, APLOGNO(02853)
                      "motorz_setup_pollset: apr_pollset_create_ex failed for all possible backends!");
-        rv = apr_pollset_create(&mz->pollset,
+        rv = apr_pollset_create(&mt->pollset,
                                     512,
-                                    mz->pool,
+                                    mt->pool,
                                     0);
     }
     if (rv != APR_SUCCESS) {
         ap_log_error(APLOG_MARK, APLOG_CRIT, rv, ap_server_conf, APLOGNO(02854)
                      "motorz_setup_pollset: apr_pollset_create failed for all possible backends!");
+        return rv;
     }
     ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf, APLOGNO(03335)
-                 "motorz_setup_pollset: Using %s", apr_pollset_method_name(mz->pollset));
+                 "motorz_setup_pollset: Using %s", apr_pollset_method_name(mt->pollset));
     return rv;
 }
 
@@ -724,32 +807,50 @@ static const char *motorz_get_name(void)
 
 static void just_die(int sig)
 {
-    clean_child_exit(0);
+    /* exit without waiting for the connections */
+    terminate_now = 1;
+    die_now = 1;
 }
 
-/* volatile because it's updated from a signal handler */
-static int volatile die_now = 0;
-
 static void stop_listening(int sig)
 {
     motorz_core_t *mz = motorz_core_get();
 
     mz->mpm->mpm_state = AP_MPMQ_STOPPING;
-    ap_close_listeners_ex(my_bucket->listeners);
 
-    /* For a graceful stop, we want the child to exit when done */
+    /* For a graceful stop, we want the child to exit when done, each thread
+     * stops polling its listeners and exits once its connections are done.
+     */
     die_now = 1;
 }
 
+static void unblock_signal(int sig)
+{
+    sigset_t sig_mask;
+
+    sigemptyset(&sig_mask);
+    sigaddset(&sig_mask, sig);
+#if defined(SIGPROCMASK_SETS_THREAD_MASK)
+    sigprocmask(SIG_UNBLOCK, &sig_mask, NULL);
+#else
+    pthread_sigmask(SIG_UNBLOCK, &sig_mask, NULL);
+#endif
+}
+
 /*****************************************************************
  * Child process main loop.
- * The following vars are static to avoid getting clobbered by longjmp();
- * they are really private to child_main.
  */
 
-static int requests_this_child;
 static int num_listensocks = 0;
 
+/* The listeners bucket of thread tid of child slot, spreading the threads
+ * of all the children over the buckets.
+ */
+static APR_INLINE int thread_bucket(motorz_core_t *mz, int slot, int tid)
+{
+    return (slot * threads_per_child + tid) % mz->mpm->num_buckets;
+}
+
 static void child_main(motorz_core_t *mz, int child_num_arg, int child_bucket)
 {
 #if APR_HAS_THREADS
@@ -759,15 +860,17 @@ static void child_main(motorz_core_t *mz, int child_num_arg, int child_bucket)
     apr_status_t status;
     int i;
     ap_listen_rec *lr;
-    ap_sb_handle_t *sbh;
     const char *lockfile;
+    motorz_thread_t *mts;
+    apr_thread_t **threads;
+    apr_threadattr_t *thread_attr;
+    char *used_buckets;
 
     /* for benefit of any hooks that run as this child initializes */
     mz->mpm->mpm_state = AP_MPMQ_STARTING;
 
     my_child_num = child_num_arg;
     ap_my_pid = getpid();
-    requests_this_child = 0;
 
     ap_fatal_signal_child_setup(ap_server_conf);
 
@@ -782,10 +885,18 @@ static void child_main(motorz_core_t *mz, int child_num_arg, int child_bucket)
     apr_os_thread_put(&thd, &osthd, pchild);
 #endif
 
-    /* close unused listeners and pods */
+    /* close unused listeners and pods, the threads of this child may use
+     * several listeners buckets but only the child's pod.
+     */
+    used_buckets = apr_pcalloc(pchild, mz->mpm->num_buckets);
+    for (i = 0; i < threads_per_child; i++) {
+        used_buckets[thread_bucket(mz, child_num_arg, i)] = 1;
+    }
     for (i = 0; i < mz->mpm->num_buckets; i++) {
-        if (i != child_bucket) {
+        if (!used_buckets[i]) {
             ap_close_listeners_ex(all_buckets[i].listeners);
+        }
+        if (i != child_bucket) {
             ap_mpm_pod_close(all_buckets[i].pod);
         }
     }
@@ -809,129 +920,119 @@ static void child_main(motorz_core_t *mz, int child_num_arg, int child_bucket)
         clean_child_exit(APEXIT_CHILDFATAL);
     }
 
-    ap_run_child_init(pchild, ap_server_conf);
-
-    ap_create_sb_handle(&sbh, pchild, my_child_num, 0);
-
-    ap_update_child_status(sbh, SERVER_READY, NULL);
-
-    apr_skiplist_init(&mz->timeout_ring, mz->pool);
-    apr_skiplist_set_compare(mz->timeout_ring, timer_comp, timer_comp);
-    status = motorz_setup_workers(mz);
+    /* Block all the signals in the threads (created by the child_init
+     * hooks or below), only the main thread handles them.
+     */
+    status = apr_setup_signal_thread();
     if (status != APR_SUCCESS) {
-        ap_log_error(APLOG_MARK, APLOG_CRIT, status, ap_server_conf, APLOGNO(02868)
-                     "child_main: motorz_setup_workers failed");
-        clean_child_exit(APEXIT_CHILDSICK);
+        ap_log_error(APLOG_MARK, APLOG_EMERG, status, ap_server_conf, APLOGNO(10540)
+                     "Couldn't initialize signal thread");
+        clean_child_exit(APEXIT_CHILDFATAL);
     }
 
-    status = motorz_setup_pollset(mz);
-    if (status != APR_SUCCESS) {
-        ap_log_error(APLOG_MARK, APLOG_EMERG, status, ap_server_conf, APLOGNO(02869)
-                     "Couldn't setup pollset in child; check system or user limits");
-        clean_child_exit(APEXIT_CHILDSICK); /* assume temporary resource issue */
-    }
+    ap_run_child_init(pchild, ap_server_conf);
 
-    for (lr = my_bucket->listeners, i = num_listensocks; i--; lr = lr->next) {
-        apr_pollfd_t *pfd = apr_pcalloc(mz->pool, sizeof *pfd);
-        motorz_sb_t *sb = apr_pcalloc(mz->pool, sizeof(motorz_sb_t));
+    for (i = 0; i < mz->mpm->num_buckets; i++) {
+        if (!used_buckets[i]) {
+            continue;
+        }
+        for (lr = all_buckets[i].listeners; lr; lr = lr->next) {
+            status = apr_socket_opt_set(lr->sd, APR_SO_NONBLOCK, 1);
+            if (status != APR_SUCCESS) {
+                ap_log_error(APLOG_MARK, APLOG_CRIT, status, NULL, APLOGNO(02870)
+                             "apr_socket_opt_set(APR_SO_NONBLOCK = 1) failed on %pI",
+                             lr->bind_addr);
+                clean_child_exit(0);
+            }
+            lr->accept_func = ap_unixd_accept;
+        }
+    }
 
-        pfd->desc_type = APR_POLL_SOCKET;
-        pfd->desc.s = lr->sd;
-        pfd->reqevents = APR_POLLIN;
-        pfd->p = mz->pool;
-        pfd->client_data = sb;
+    /* Setup the threads, each with its own pollset, timers and listeners */
+    mts = apr_pcalloc(pchild, threads_per_child * sizeof(motorz_thread_t));
+    threads = apr_pcalloc(pchild, threads_per_child * sizeof(apr_thread_t *));
+    for (i = 0; i < threads_per_child; i++) {
+        motorz_thread_t *mt = &mts[i];
+        int n;
 
-        sb->type = PT_ACCEPT;
-        sb->baton = lr;
+        mt->mz = mz;
+        mt->tid = i;
+        apr_pool_create(&mt->pool, pchild);
+        apr_pool_tag(mt->pool, "motorz_thread");
+        apr_skiplist_init(&mt->timeout_ring, mt->pool);
+        apr_skiplist_set_compare(mt->timeout_ring, timer_comp, timer_comp);
+        ap_create_sb_handle(&mt->sbh, pchild, my_child_num, i);
 
-        status = apr_socket_opt_set(pfd->desc.s, APR_SO_NONBLOCK, 1);
+        status = motorz_setup_pollset(mt);
         if (status != APR_SUCCESS) {
-            ap_log_error(APLOG_MARK, APLOG_CRIT, status, NULL, APLOGNO(02870)
-                         "apr_socket_opt_set(APR_SO_NONBLOCK = 1) failed on %pI",
-                         lr->bind_addr);
-            clean_child_exit(0);
+            ap_log_error(APLOG_MARK, APLOG_EMERG, status, ap_server_conf, APLOGNO(02869)
+                         "Couldn't setup pollset in child; check system or user limits");
+            clean_child_exit(APEXIT_CHILDSICK); /* assume temporary resource issue */
         }
 
-        status = apr_pollset_add(mz->pollset, pfd);
+        mt->listeners = all_buckets[thread_bucket(mz, my_child_num, i)].listeners;
+        for (n = 0, lr = mt->listeners; lr; lr = lr->next) {
+            n++;
+        }
+        mt->listen_pfds = apr_pcalloc(mt->pool, n * sizeof(apr_pollfd_t));
+        for (n = 0, lr = mt->listeners; lr; lr = lr->next, n++) {
+            apr_pollfd_t *pfd = &mt->listen_pfds[n];
+            motorz_sb_t *sb = apr_pcalloc(mt->pool, sizeof(motorz_sb_t));
+
+            pfd->desc_type = APR_POLL_SOCKET;
+            pfd->desc.s = lr->sd;
+            pfd->reqevents = APR_POLLIN;
+            pfd->p = mt->pool;
+            pfd->client_data = sb;
+
+            sb->type = PT_ACCEPT;
+            sb->baton = lr;
+        }
+        mt->num_listen_pfds = n;
+    }
+
+    apr_threadattr_create(&thread_attr, pchild);
+    /* 0 means PTHREAD_CREATE_JOINABLE */
+    apr_threadattr_detach_set(thread_attr, 0);
+    if (ap_thread_stacksize != 0) {
+        status = apr_threadattr_stacksize_set(thread_attr, ap_thread_stacksize);
+        if (status != APR_SUCCESS && status != APR_ENOTIMPL) {
+            ap_log_error(APLOG_MARK, APLOG_WARNING, status, ap_server_conf, APLOGNO(10541)
+                         "WARNING: ThreadStackSize of %" APR_SIZE_T_FMT " is "
+                         "inappropriate, using default",
+                         ap_thread_stacksize);
+        }
+    }
+    for (i = 0; i < threads_per_child; i++) {
+        status = ap_thread_create(&threads[i], thread_attr, motorz_thread_main,
+                                  &mts[i], pchild);
         if (status != APR_SUCCESS) {
-            /* If the child processed a SIGWINCH before setting up the
-             * pollset, this error path is expected and harmless,
-             * since the listener fd was already closed; so don't
-             * pollute the logs in that case. */
-            if (!die_now) {
-                ap_log_error(APLOG_MARK, APLOG_EMERG, status, ap_server_conf, APLOGNO(02871)
-                             "Couldn't add listener to pollset; check system or user limits");
-                clean_child_exit(APEXIT_CHILDSICK);
-            }
-            clean_child_exit(0);
+            ap_log_error(APLOG_MARK, APLOG_ALERT, status, ap_server_conf, APLOGNO(10542)
+                         "ap_thread_create: unable to create worker thread");
+            /* let the parent decide how bad this really is */
+            resource_shortage = 1;
+            die_now = 1;
+            break;
         }
-
-        lr->accept_func = ap_unixd_accept;
     }
 
     mz->mpm->mpm_state = AP_MPMQ_RUNNING;
 
-    /* die_now is set when AP_SIG_GRACEFUL is received in the child;
+    /* This thread handles the signals and watches for the parent asking
+     * this child to stop; die_now is set when AP_SIG_GRACEFUL is received,
      * {shutdown,restart}_pending are set when a signal is received while
      * running in single process mode.
      */
-    while (!die_now
-           && !mz->mpm->shutdown_pending
-           && !mz->mpm->restart_pending) {
-        /*
-         * (Re)initialize this child to a pre-connection state.
-         */
-
-        if ((ap_max_requests_per_child > 0
-             && requests_this_child++ >= ap_max_requests_per_child)) {
-            clean_child_exit(0);
-        }
-
-        ap_update_child_status(sbh, SERVER_READY, NULL);
-        {
-            apr_time_t tnow = apr_time_now();
-            motorz_timer_t *te;
-            apr_interval_time_t timeout = apr_time_from_msec(500);
-
-            apr_thread_mutex_lock(mz->mtx);
-            te = apr_skiplist_peek(mz->timeout_ring);
-
-            if (te) {
-                if (tnow < te->expires) {
-                    timeout = (te->expires - tnow);
-                    if (timeout > apr_time_from_msec(500)) {
-                        timeout = apr_time_from_msec(500);
-                    }
-                }
-                else {
-                    timeout = 0;
-                }
-            }
-            apr_thread_mutex_unlock(mz->mtx);
-
-            status = motorz_pollset_cb(mz, timeout);
-
-            tnow = apr_time_now();
-
-            if (status != APR_SUCCESS) {
-                if (!APR_STATUS_IS_EINTR(status) && !APR_STATUS_IS_TIMEUP(status)) {
-                    ap_log_error(APLOG_MARK, APLOG_CRIT, status, NULL, APLOGNO(03117)
-                                 "motorz_main_loop: apr_pollcb_poll failed");
-                    clean_child_exit(0);
-                }
-            }
-
-            apr_thread_mutex_lock(mz->mtx);
-
-            /* now iterate any timers and push to worker pool */
-            while (te && te->expires < tnow) {
-                apr_skiplist_pop(mz->timeout_ring, NULL);
-                motorz_timer_event_process(mz, te);
-                te = apr_skiplist_peek(mz->timeout_ring);
-            }
+    unblock_signal(SIGHUP);
+    unblock_signal(SIGTERM);
+    unblock_signal(AP_SIG_GRACEFUL);
+    if (one_process) {
+        unblock_signal(SIGINT);
+        unblock_signal(AP_SIG_GRACEFUL_STOP);
+    }
+    while (!die_now) {
+        apr_sleep(MOTORZ_POLL_TIMEOUT);
 
-            apr_thread_mutex_unlock(mz->mtx);
-        }
         if (ap_mpm_pod_check(my_bucket->pod) == APR_SUCCESS) { /* selected as idle? */
             die_now = 1;
         }
@@ -942,9 +1043,21 @@ static void child_main(motorz_core_t *mz, int child_num_arg, int child_bucket)
              */
             die_now = 1;
         }
+        else if (mz->mpm->shutdown_pending || mz->mpm->restart_pending) {
+            if (mz->mpm->is_ungraceful) {
+                terminate_now = 1;
+            }
+            die_now = 1;
+        }
+    }
+    mz->mpm->mpm_state = AP_MPMQ_STOPPING;
+
+    for (i = 0; i < threads_per_child && threads[i]; i++) {
+        apr_status_t thread_rv;
+        apr_thread_join(&thread_rv, threads[i]);
     }
 
-    clean_child_exit(0);
+    clean_child_exit(resource_shortage ? APEXIT_CHILDSICK : 0);
 }
 
 static int make_child(motorz_core_t *mz, server_rec *s, int slot)
@@ -1050,7 +1163,7 @@ static void perform_idle_server_maintenance(motorz_core_t *mz, apr_pool_t *p)
     int i;
     worker_score *ws;
 
-    int active = 0;
+    int active = 0, last_active = -1;
     free_length = 0;
     free_slots[0] = 0;
 
@@ -1064,16 +1177,16 @@ static void perform_idle_server_maintenance(motorz_core_t *mz, apr_pool_t *p)
         }
         if (status >= SERVER_READY) {
             active++;
+            last_active = i;
         }
     }
     if (active > ap_num_kids) {
-        static int bucket_kill_child_record = -1;
         /* kill off one child... we use the pod because that'll cause it to
          * shut down gracefully, in case it happened to pick up a request
-         * while we were counting
+         * while we were counting; the pod of a bucket with an active child
+         * (there may be more buckets than children).
          */
-        bucket_kill_child_record = (bucket_kill_child_record + 1) % mz->mpm->num_buckets;
-        ap_mpm_pod_signal(all_buckets[bucket_kill_child_record].pod);
+        ap_mpm_pod_signal(all_buckets[last_active % mz->mpm->num_buckets].pod);
     }
     else if (active < ap_num_kids) {
         make_child(mz, ap_server_conf, free_slots[0]);
@@ -1115,10 +1228,12 @@ static int motorz_run(apr_pool_t *_pconf, apr_pool_t *plog, server_rec *s)
     }
 
     /* Don't thrash since num_buckets depends on the
-     * system and the number of online CPU cores...
+     * system and the number of online CPU cores, each
+     * thread of each child uses a bucket...
      */
-    if (ap_num_kids < mz->mpm->num_buckets)
-        ap_num_kids = mz->mpm->num_buckets;
+    if (ap_num_kids * threads_per_child < mz->mpm->num_buckets)
+        ap_num_kids = (mz->mpm->num_buckets + threads_per_child - 1)
+                      / threads_per_child;
 
     /* If we're doing a graceful_restart then we're going to see a lot
      * of children exiting immediately when we get into the main loop
@@ -1477,8 +1592,6 @@ static int motorz_pre_config(apr_pool_t *p, apr_pool_t *plog, apr_pool_t *ptemp)
         mz->mpm = ap_unixd_mpm_get_retained_data();
         mz->mpm->baton = mz;
         mz->max_daemons_limit = -1;
-        mz->timeout_ring = motorz_timer_ring;
-        mz->pollset = motorz_pollset;
     }
     else if (mz->mpm->baton != mz) {
         /* If the MPM changes on restart, be ungraceful */
@@ -1501,14 +1614,6 @@ static int motorz_pre_config(apr_pool_t *p, apr_pool_t *plog, apr_pool_t *ptemp)
                 return HTTP_INTERNAL_SERVER_ERROR;
             }
         }
-        apr_pool_create(&mz->pool, ap_pglobal);
-        apr_pool_tag(mz->pool, "motorz-mpm-core");
-        rv = apr_thread_mutex_create(&mz->mtx, 0, mz->pool);
-        if (rv != APR_SUCCESS) {
-            ap_log_error(APLOG_MARK, APLOG_CRIT, rv, NULL, APLOGNO(02966)
-                         "motorz_pre_config: apr_thread_mutex_create failed");
-            return rv;
-        }
     }
 
     parent_pid = ap_my_pid = getpid();
@@ -49,7 +49,7 @@
 #include "ap_mmn.h"
 #include "apr_poll.h"
 #include "apr_skiplist.h"
-#include "apr_thread_pool.h"
+#include "apr_atomic.h"
 #include "util_time.h"
 
 #include <stdlib.h>
@@ -125,11 +125,6 @@ struct motorz_core_t {
      * use this value to optimize routines that have to scan the entire scoreboard.
      */
     int max_daemons_limit;
-    apr_pool_t *pool;
-    apr_thread_mutex_t *mtx;
-    apr_pollset_t *pollset;
-    apr_skiplist *timeout_ring;
-    apr_thread_pool_t *workers;
 };
 
 typedef struct motorz_child_bucket motorz_child_bucket;
@@ -153,10 +148,36 @@ struct motorz_sb_t
     void *baton;
 };
 
-typedef void (*motorz_timer_cb) (motorz_core_t *mz, void *baton);
-typedef void (*motorz_io_sock_cb) (motorz_core_t *mz, apr_socket_t *sock,
+/* Each thread of a child runs its own event loop, with its own pollset,
+ * timers and listeners bucket, and processes the connections it accepted
+ * up to completion: nothing is shared nor handed off between the threads,
+ * which thus need no locking.
+ */
+typedef struct motorz_thread_t motorz_thread_t;
+struct motorz_thread_t
+{
+    motorz_core_t *mz;
+    /** index of the thread in the child (and scoreboard) */
+    int tid;
+    apr_thread_t *thd;
+    /** parent of the connections' pools, used by this thread only */
+    apr_pool_t *pool;
+    apr_pollset_t *pollset;
+    apr_skiplist *timeout_ring;
+    /** the listeners bucket of the thread, and their poll descriptors */
+    ap_listen_rec *listeners;
+    apr_pollfd_t *listen_pfds;
+    int num_listen_pfds;
+    int listening;
+    /** number of connections owned by the thread */
+    int conns;
+    ap_sb_handle_t *sbh;
+};
+
+typedef void (*motorz_timer_cb) (motorz_thread_t *mt, void *baton);
+typedef void (*motorz_io_sock_cb) (motorz_thread_t *mt, apr_socket_t *sock,
                                    int flags, void *baton);
-typedef void (*motorz_io_file_cb) (motorz_core_t *mz, apr_socket_t *sock,
+typedef void (*motorz_io_file_cb) (motorz_thread_t *mt, apr_socket_t *sock,
                                    int flags, void *baton);
 
 
@@ -167,14 +188,14 @@ struct motorz_timer_t
     motorz_timer_cb cb;
     void *baton;
     apr_pool_t *pool;
-    motorz_core_t *mz;
+    motorz_thread_t *mt;
 };
 
 typedef struct motorz_conn_t motorz_conn_t;
 struct motorz_conn_t
 {
     apr_pool_t *pool;
-    motorz_core_t *mz;
+    motorz_thread_t *mt;
     apr_socket_t *sock;
     apr_bucket_alloc_t *ba;
     ap_sb_handle_t *sbh;
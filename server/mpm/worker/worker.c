@@ -28,6 +28,8 @@
 #include "apr_thread_proc.h"
 #include "apr_signal.h"
 #include "apr_thread_mutex.h"
+#include "apr_thread_cond.h"
+#include "apr_atomic.h"
 #include "apr_proc_mutex.h"
 #include "apr_poll.h"
 
@@ -113,11 +115,21 @@
 #define MAX_THREAD_LIMIT 20000
 #endif
 
+/* How long a worker thread above MinThreadsPerChild stays idle before it
+ * exits, and how often the start thread checks for those which did.
+ */
+#ifndef THREAD_IDLE_TIMEOUT
+#define THREAD_IDLE_TIMEOUT   apr_time_from_sec(10)
+#endif
+#define THREADS_SCALER_INTERVAL apr_time_from_sec(1)
+#define THREADS_SCALING()     (min_threads_per_child < threads_per_child)
+
 /*
  * Actual definitions of config globals
  */
 
 static int threads_per_child = 0;     /* Worker threads per child */
+static int min_threads_per_child = 0; /* MinThreadsPerChild */
 static int ap_daemons_to_start = 0;
 static int min_spare_threads = 0;
 static int max_spare_threads = 0;
@@ -129,6 +141,9 @@ static int had_healthy_child = 0;
 static int dying = 0;
 static int workers_may_exit = 0;
 static int start_thread_may_exit = 0;
+static apr_uint32_t threads_wanted = 0; /* Listener out of idle workers */
+static apr_thread_mutex_t *threads_scaler_mtx;
+static apr_thread_cond_t *threads_scaler_cond;
 static int listener_may_exit = 0;
 static int requests_this_child;
 static int num_listensocks = 0;
@@ -137,6 +152,14 @@ static fd_queue_t *worker_queue;
 static fd_queue_info_t *worker_queue_info;
 static apr_pollset_t *worker_pollset;
 
+/* With PriorityWorkers, the pollset of the Listen options=priority
+ * listeners only, polled (for PRIORITY_POLL_TIMEOUT at most, before the
+ * accept mutex is released and the idle workers re-counted) when the
+ * remaining idle workers are those kept for them.
+ */
+static apr_pollset_t *priority_pollset;
+#define PRIORITY_POLL_TIMEOUT apr_time_from_msec(100)
+
 typedef struct worker_child_bucket {
     ap_pod_t *pod;
     ap_listen_rec *listeners;
@@ -558,6 +581,7 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t *thd, void * dummy)
     ap_listen_rec *lr = NULL;
     int have_idle_worker = 0;
     int last_poll_idx = 0;
+    int last_priority_idx = 0;
 
     free(ti);
 
@@ -577,6 +601,16 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t *thd, void * dummy)
         if (listener_may_exit) break;
 
         if (!have_idle_worker) {
+            /* Taking the last idle worker, ask the start thread for more
+             * if we are still below ThreadsPerChild.
+             */
+            if (THREADS_SCALING() && !dying
+                    && ap_queue_info_num_idlers(worker_queue_info) <= 1
+                    && apr_atomic_cas32(&threads_wanted, 1, 0) == 0) {
+                apr_thread_mutex_lock(threads_scaler_mtx);
+                apr_thread_cond_signal(threads_scaler_cond);
+                apr_thread_mutex_unlock(threads_scaler_mtx);
+            }
             rv = ap_queue_info_wait_for_idler(worker_queue_info, NULL);
             if (APR_STATUS_IS_EOF(rv)) {
                 break; /* we've been signaled to die now */
@@ -608,11 +642,34 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t *thd, void * dummy)
             lr = my_bucket->listeners;
         }
         else {
+            lr = NULL;
             while (!listener_may_exit) {
                 apr_int32_t numdesc;
                 const apr_pollfd_t *pdesc;
-
-                rv = apr_pollset_poll(worker_pollset, -1, &numdesc, &pdesc);
+                int reserved = (priority_pollset
+                                && ap_queue_info_num_idlers(worker_queue_info)
+                                   < (apr_uint32_t)ap_priority_workers);
+
+                if (reserved) {
+                    /* Only the priority listeners may use this worker */
+                    rv = apr_pollset_poll(priority_pollset,
+                                          PRIORITY_POLL_TIMEOUT,
+                                          &numdesc, &pdesc);
+                    if (rv == APR_SUCCESS) {
+                        if (last_priority_idx >= numdesc)
+                            last_priority_idx = 0;
+                        lr = pdesc[last_priority_idx++].client_data;
+                        break;
+                    }
+                    if (APR_STATUS_IS_TIMEUP(rv)) {
+                        /* Let the other children accept meanwhile */
+                        break;
+                    }
+                }
+                else {
+                    rv = apr_pollset_poll(worker_pollset, -1, &numdesc,
+                                          &pdesc);
+                }
                 if (rv != APR_SUCCESS) {
                     if (APR_STATUS_IS_EINTR(rv)) {
                         continue;
@@ -652,6 +709,16 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t *thd, void * dummy)
 
             } /* while */
 
+            if (lr == NULL && !listener_may_exit) {
+                /* Timed out waiting for a priority connection, count the
+                 * idle workers again (the worker is still reserved) */
+                if ((rv = SAFE_ACCEPT(apr_proc_mutex_unlock(my_bucket->mutex)))
+                    != APR_SUCCESS) {
+                    accept_mutex_error("unlock", rv, process_slot);
+                }
+                continue;
+            }
+
         } /* if/else */
 
         if (!listener_may_exit) {
@@ -748,11 +815,13 @@ static void * APR_THREAD_FUNC worker_thread(apr_thread_t *thd, void * dummy)
     int process_slot = ti->pid;
     int thread_slot = ti->tid;
     apr_socket_t *csd = NULL;
-    apr_bucket_alloc_t *bucket_alloc;
+    apr_allocator_t *bucket_allocator = NULL;
+    apr_bucket_alloc_t *bucket_alloc = NULL;
     apr_pool_t *last_ptrans = NULL;
     apr_pool_t *ptrans;                /* Pool for per-transaction stuff */
     apr_status_t rv;
     int is_idle = 0;
+    int idle_exit = 0;
 
     free(ti);
 
@@ -787,7 +856,25 @@ worker_pop:
         if (workers_may_exit) {
             break;
         }
-        rv = ap_queue_pop_socket(worker_queue, &csd, &ptrans);
+        if (thread_slot >= min_threads_per_child && !dying) {
+            /* Above MinThreadsPerChild, don't stay idle for too long */
+            rv = ap_queue_pop_socket_timeout(worker_queue, thread_slot,
+                                             THREAD_IDLE_TIMEOUT, &csd,
+                                             &ptrans);
+            if (APR_STATUS_IS_TIMEUP(rv)) {
+                /* Not if the listener reserved all the idle workers */
+                if (ap_queue_info_try_get_idler(worker_queue_info)
+                        == APR_SUCCESS) {
+                    idle_exit = 1;
+                    break;
+                }
+                goto worker_pop;
+            }
+        }
+        else {
+            rv = ap_queue_pop_socket_ex(worker_queue, thread_slot, &csd,
+                                        &ptrans);
+        }
 
         if (rv != APR_SUCCESS) {
             /* We get APR_EOF during a graceful shutdown once all the connections
@@ -819,7 +906,16 @@ worker_pop:
         }
         is_idle = 0;
         worker_sockets[thread_slot] = csd;
-        bucket_alloc = apr_bucket_alloc_create(ptrans);
+        if (!bucket_alloc) {
+            /* Connections are processed from start to end by this thread,
+             * so its bucket allocator (and freelists) can be reused for all
+             * of them, like prefork does per child. It has its own (lock
+             * free) allocator since only this thread uses it.
+             */
+            apr_allocator_create(&bucket_allocator);
+            apr_allocator_max_free_set(bucket_allocator, ap_max_mem_free);
+            bucket_alloc = apr_bucket_alloc_create_ex(bucket_allocator);
+        }
         process_socket(thd, ptrans, csd, process_slot, thread_slot, bucket_alloc);
         worker_sockets[thread_slot] = NULL;
         requests_this_child--;
@@ -827,9 +923,16 @@ worker_pop:
         last_ptrans = ptrans;
     }
 
+    /* SERVER_DEAD after an idle exit tells the start thread to join us */
     ap_update_child_status_from_indexes(process_slot, thread_slot,
-                                        dying ? SERVER_DEAD
-                                              : SERVER_GRACEFUL, NULL);
+                                        (dying || idle_exit) ? SERVER_DEAD
+                                                             : SERVER_GRACEFUL,
+                                        NULL);
+
+    if (bucket_alloc) {
+        apr_bucket_alloc_destroy(bucket_alloc);
+        apr_allocator_destroy(bucket_allocator);
+    }
 
     apr_thread_exit(thd, APR_SUCCESS);
     return NULL;
@@ -902,6 +1005,11 @@ static void setup_threads_runtime(void)
         clean_child_exit(APEXIT_CHILDFATAL);
     }
 
+    apr_thread_mutex_create(&threads_scaler_mtx, APR_THREAD_MUTEX_DEFAULT,
+                            pruntime);
+    apr_thread_cond_create(&threads_scaler_cond, pruntime);
+    threads_wanted = 0;
+
     /* Create the main pollset */
     rv = apr_pollset_create(&worker_pollset, num_listensocks, pruntime,
                             APR_POLLSET_NOCOPY);
@@ -933,6 +1041,43 @@ static void setup_threads_runtime(void)
         lr->accept_func = ap_unixd_accept;
     }
 
+    /* Keep PriorityWorkers for the priority listeners, if any, unless all
+     * the listeners are (nothing to keep them from then)
+     */
+    priority_pollset = NULL;
+    if (ap_priority_workers > 0) {
+        int num_priority = 0, num_bucket = 0;
+        for (lr = my_bucket->listeners; lr != NULL; lr = lr->next) {
+            if (lr->flags & AP_LISTEN_PRIORITY) {
+                num_priority++;
+            }
+            num_bucket++;
+        }
+        if (num_priority > 0 && num_priority < num_bucket) {
+            rv = apr_pollset_create(&priority_pollset, num_priority,
+                                    pruntime, APR_POLLSET_NOCOPY);
+            if (rv != APR_SUCCESS) {
+                ap_log_error(APLOG_MARK, APLOG_EMERG, rv, ap_server_conf,
+                             APLOGNO(10530) "Couldn't create priority "
+                             "pollset in thread; check system or user limits");
+                clean_child_exit(APEXIT_CHILDSICK);
+            }
+            for (lr = my_bucket->listeners; lr != NULL; lr = lr->next) {
+                apr_pollfd_t *pfd;
+
+                if (!(lr->flags & AP_LISTEN_PRIORITY)) {
+                    continue;
+                }
+                pfd = apr_pcalloc(pruntime, sizeof *pfd);
+                pfd->desc_type = APR_POLL_SOCKET;
+                pfd->desc.s = lr->sd;
+                pfd->reqevents = APR_POLLIN;
+                pfd->client_data = lr;
+                apr_pollset_add(priority_pollset, pfd);
+            }
+        }
+    }
+
     worker_sockets = apr_pcalloc(pruntime, threads_per_child *
                                            sizeof(apr_socket_t *));
 }
@@ -942,13 +1087,108 @@ static void setup_threads_runtime(void)
  *     never be cleaned up; for now there is an APLOG_DEBUG message issued
  *     every so often when this condition occurs
  */
+static apr_status_t create_worker_thread(thread_starter *ts, int i)
+{
+    int my_child_num = ts->child_num_arg;
+    proc_info *my_info;
+    apr_status_t rv;
+
+    my_info = (proc_info *)ap_malloc(sizeof(proc_info));
+    my_info->pid = my_child_num;
+    my_info->tid = i;
+    my_info->sd = 0;
+
+    /* We are creating threads right now */
+    ap_update_child_status_from_indexes(my_child_num, i,
+                                        SERVER_STARTING, NULL);
+    /* We let each thread update its own scoreboard entry.  This is
+     * done because it lets us deal with tid better.
+     */
+    rv = ap_thread_create(&ts->threads[i], ts->threadattr,
+                          worker_thread, my_info, pruntime);
+    if (rv != APR_SUCCESS) {
+        ap_update_child_status_from_indexes(my_child_num, i,
+                                            SERVER_DEAD, NULL);
+        ts->threads[i] = NULL;
+        free(my_info);
+    }
+    return rv;
+}
+
+/* Once MinThreadsPerChild workers are running, the start thread grows them
+ * (by half) up to ThreadsPerChild whenever the listener runs out of idle
+ * ones, and joins those which exited after THREAD_IDLE_TIMEOUT.
+ */
+static void scale_threads(thread_starter *ts)
+{
+    apr_thread_t **threads = ts->threads;
+    int my_child_num = ts->child_num_arg;
+    apr_status_t rv, thread_rv;
+    int i, live, grow;
+
+    while (!start_thread_may_exit && !dying) {
+        apr_thread_mutex_lock(threads_scaler_mtx);
+        if (!start_thread_may_exit && !apr_atomic_read32(&threads_wanted)) {
+            apr_thread_cond_timedwait(threads_scaler_cond, threads_scaler_mtx,
+                                      THREADS_SCALER_INTERVAL);
+        }
+        apr_thread_mutex_unlock(threads_scaler_mtx);
+        if (start_thread_may_exit || dying) {
+            break;
+        }
+
+        live = min_threads_per_child;
+        for (i = min_threads_per_child; i < threads_per_child; i++) {
+            if (!threads[i]) {
+                continue;
+            }
+            if (ap_scoreboard_image->servers[my_child_num][i].status
+                    != SERVER_DEAD) {
+                live++;
+                continue;
+            }
+            rv = apr_thread_join(&thread_rv, threads[i]);
+            if (rv != APR_SUCCESS) {
+                ap_log_error(APLOG_MARK, APLOG_CRIT, rv, ap_server_conf,
+                             APLOGNO(10546) "apr_thread_join: unable to "
+                             "join idle worker thread %d", i);
+            }
+            threads[i] = NULL;
+        }
+
+        if (!apr_atomic_xchg32(&threads_wanted, 0)) {
+            continue;
+        }
+        grow = (live + 1) / 2;
+        for (i = min_threads_per_child; grow > 0 && i < threads_per_child;
+             i++) {
+            int status = ap_scoreboard_image->servers[my_child_num][i].status;
+
+            /* Skip the slots still used by a previous generation */
+            if (threads[i] || (status != SERVER_GRACEFUL
+                               && status != SERVER_DEAD)) {
+                continue;
+            }
+            rv = create_worker_thread(ts, i);
+            if (rv != APR_SUCCESS) {
+                ap_log_error(APLOG_MARK, APLOG_ERR, rv, ap_server_conf,
+                             APLOGNO(10547) "ap_thread_create: unable to "
+                             "grow worker threads above %d", live);
+                break;
+            }
+            live++;
+            grow--;
+        }
+        ap_log_error(APLOG_MARK, APLOG_TRACE1, 0, ap_server_conf,
+                     "worker threads grown to %d of %d", live,
+                     threads_per_child);
+    }
+}
+
 static void * APR_THREAD_FUNC start_threads(apr_thread_t *thd, void *dummy)
 {
     thread_starter *ts = dummy;
-    apr_thread_t **threads = ts->threads;
-    apr_threadattr_t *thread_attr = ts->threadattr;
     int my_child_num = ts->child_num_arg;
-    proc_info *my_info;
     apr_status_t rv;
     int threads_created = 0;
     int listener_started = 0;
@@ -957,27 +1197,17 @@ static void * APR_THREAD_FUNC start_threads(apr_thread_t *thd, void *dummy)
 
     loops = prev_threads_created = 0;
     while (1) {
-        /* threads_per_child does not include the listener thread */
-        for (i = 0; i < threads_per_child; i++) {
+        /* min_threads_per_child does not include the listener thread, the
+         * others up to threads_per_child are created on demand
+         */
+        for (i = 0; i < min_threads_per_child; i++) {
             int status = ap_scoreboard_image->servers[my_child_num][i].status;
 
             if (status != SERVER_GRACEFUL && status != SERVER_DEAD) {
                 continue;
             }
 
-            my_info = (proc_info *)ap_malloc(sizeof(proc_info));
-            my_info->pid = my_child_num;
-            my_info->tid = i;
-            my_info->sd = 0;
-
-            /* We are creating threads right now */
-            ap_update_child_status_from_indexes(my_child_num, i,
-                                                SERVER_STARTING, NULL);
-            /* We let each thread update its own scoreboard entry.  This is
-             * done because it lets us deal with tid better.
-             */
-            rv = ap_thread_create(&threads[i], thread_attr,
-                                  worker_thread, my_info, pruntime);
+            rv = create_worker_thread(ts, i);
             if (rv != APR_SUCCESS) {
                 ap_log_error(APLOG_MARK, APLOG_ALERT, rv, ap_server_conf, APLOGNO(03142)
                              "ap_thread_create: unable to create worker thread");
@@ -991,7 +1221,8 @@ static void * APR_THREAD_FUNC start_threads(apr_thread_t *thd, void *dummy)
             create_listener_thread(ts);
             listener_started = 1;
         }
-        if (start_thread_may_exit || threads_created == threads_per_child) {
+        if (start_thread_may_exit
+                || threads_created == min_threads_per_child) {
             break;
         }
         /* wait for previous generation to clean up an entry */
@@ -1002,12 +1233,17 @@ static void * APR_THREAD_FUNC start_threads(apr_thread_t *thd, void *dummy)
                 ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, ap_server_conf, APLOGNO(03289)
                              "child %" APR_PID_T_FMT " isn't taking over "
                              "slots very quickly (%d of %d)",
-                             ap_my_pid, threads_created, threads_per_child);
+                             ap_my_pid, threads_created,
+                             min_threads_per_child);
             }
             prev_threads_created = threads_created;
         }
     }
 
+    if (THREADS_SCALING()) {
+        scale_threads(ts);
+    }
+
     /* What state should this child_main process be listed as in the
      * scoreboard...?
      *  ap_update_child_status_from_indexes(my_child_num, i, SERVER_STARTING,
@@ -1095,6 +1331,11 @@ static void join_start_thread(apr_thread_t *start_thread_id)
                                 * trying to take over slots from a
                                 * previous generation
                                 */
+    if (THREADS_SCALING()) {
+        apr_thread_mutex_lock(threads_scaler_mtx);
+        apr_thread_cond_signal(threads_scaler_cond);
+        apr_thread_mutex_unlock(threads_scaler_mtx);
+    }
     rv = apr_thread_join(&thread_rv, start_thread_id);
     if (rv != APR_SUCCESS) {
         ap_log_error(APLOG_MARK, APLOG_CRIT, rv, ap_server_conf, APLOGNO(00279)
@@ -1119,9 +1360,15 @@ static void child_main(int child_num_arg, int child_bucket)
     ap_fatal_signal_child_setup(ap_server_conf);
 
     /* Get a sub context for global allocations in this child, so that
-     * we can have cleanups occur when the child exits.
+     * we can have cleanups occur when the child exits. When bound to a
+     * CPU set (e.g. a NUMA node), use a new allocator so that the child's
+     * memory is node local rather than recycled from the parent's.
      */
-    apr_pool_create(&pchild, pconf);
+    if (!ap_mpm_child_cpu_affinity(ap_server_conf, child_num_arg,
+                                   child_bucket, retained->mpm->num_buckets)
+            || ap_mpm_create_local_pool(&pchild, pconf) != APR_SUCCESS) {
+        apr_pool_create(&pchild, pconf);
+    }
     apr_pool_tag(pchild, "pchild");
 
 #if AP_HAS_THREAD_LOCAL
@@ -1482,7 +1729,7 @@ static void perform_idle_server_maintenance(int child_bucket)
             }
             ++free_length;
         }
-        else if (child_threads_active == threads_per_child) {
+        else if (child_threads_active >= min_threads_per_child) {
             had_healthy_child = 1;
         }
         /* XXX if (!ps->quiescing)     is probably more reliable  GLA */
@@ -2121,6 +2368,7 @@ static int worker_pre_config(apr_pool_t *pconf, apr_pool_t *plog,
     thread_limit = DEFAULT_THREAD_LIMIT;
     ap_daemons_limit = server_limit;
     threads_per_child = DEFAULT_THREADS_PER_CHILD;
+    min_threads_per_child = 0;
     max_workers = ap_daemons_limit * threads_per_child;
     had_healthy_child = 0;
     ap_extended_status = 0;
@@ -2250,6 +2498,29 @@ static int worker_check_config(apr_pool_t *p, apr_pool_t *plog,
         threads_per_child = 1;
     }
 
+    if (ap_priority_workers >= threads_per_child) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING | APLOG_STARTUP, 0, NULL,
+                     APLOGNO(10531) "PriorityWorkers of %d is not less than "
+                     "ThreadsPerChild of %d, decreasing to %d",
+                     ap_priority_workers, threads_per_child,
+                     threads_per_child - 1);
+        ap_priority_workers = threads_per_child - 1;
+    }
+
+    if (min_threads_per_child <= 0 || min_threads_per_child > threads_per_child) {
+        if (min_threads_per_child > threads_per_child) {
+            ap_log_error(APLOG_MARK, APLOG_WARNING | APLOG_STARTUP, 0, NULL,
+                         APLOGNO(10548) "MinThreadsPerChild of %d exceeds "
+                         "ThreadsPerChild of %d, decreasing to match",
+                         min_threads_per_child, threads_per_child);
+        }
+        min_threads_per_child = threads_per_child;
+    }
+    if (min_threads_per_child <= ap_priority_workers) {
+        /* Don't let the reserved workers exit when idle */
+        min_threads_per_child = ap_priority_workers + 1;
+    }
+
     if (max_workers < threads_per_child) {
         if (startup) {
             ap_log_error(APLOG_MARK, APLOG_WARNING | APLOG_STARTUP, 0, NULL, APLOGNO(00314)
@@ -2427,6 +2698,21 @@ static const char *set_threads_per_child (cmd_parms *cmd, void *dummy,
     return NULL;
 }
 
+static const char *set_min_threads_per_child (cmd_parms *cmd, void *dummy,
+                                              const char *arg)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+    if (err != NULL) {
+        return err;
+    }
+
+    min_threads_per_child = atoi(arg);
+    if (min_threads_per_child < 1) {
+        return "MinThreadsPerChild must be a positive number";
+    }
+    return NULL;
+}
+
 static const char *set_server_limit (cmd_parms *cmd, void *dummy, const char *arg)
 {
     const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
@@ -2463,6 +2749,9 @@ AP_INIT_TAKE1("MaxClients", set_max_workers, NULL, RSRC_CONF,
   "Deprecated name of MaxRequestWorkers"),
 AP_INIT_TAKE1("ThreadsPerChild", set_threads_per_child, NULL, RSRC_CONF,
   "Number of threads each child creates"),
+AP_INIT_TAKE1("MinThreadsPerChild", set_min_threads_per_child, NULL, RSRC_CONF,
+  "Number of threads each child keeps running, the others up to "
+  "ThreadsPerChild are created on demand"),
 AP_INIT_TAKE1("ServerLimit", set_server_limit, NULL, RSRC_CONF,
   "Maximum number of child processes for this run of Apache"),
 AP_INIT_TAKE1("ThreadLimit", set_thread_limit, NULL, RSRC_CONF,
@@ -34,6 +34,8 @@
 #include "apr_getopt.h"
 #include "apr_optional.h"
 #include "apr_allocator.h"
+#include "apr_file_io.h"
+#include "apr_lib.h"
 
 #include "httpd.h"
 #include "http_config.h"
@@ -57,6 +59,9 @@
 #if APR_HAVE_UNISTD_H
 #include <unistd.h>
 #endif
+#ifdef HAVE_SCHED_SETAFFINITY
+#include <sched.h>
+#endif
 
 /* we know core's module_index is 0 */
 #undef APLOG_MODULE_INDEX
@@ -181,10 +186,16 @@ AP_DECLARE_DATA char ap_coredump_dir[MAX_STRING_LEN];
 AP_DECLARE_DATA int ap_coredumpdir_configured;
 AP_DECLARE_DATA int ap_graceful_shutdown_timeout;
 AP_DECLARE_DATA apr_size_t ap_thread_stacksize;
+AP_DECLARE_DATA int ap_priority_workers;
 
 #define ALLOCATOR_MAX_FREE_DEFAULT (2048*1024)
 AP_DECLARE_DATA apr_uint32_t ap_max_mem_free = ALLOCATOR_MAX_FREE_DEFAULT;
 
+#ifdef HAVE_SCHED_SETAFFINITY
+/* ChildCPUAffinity sets (of cpu_set_t), children are bound round-robin */
+static apr_array_header_t *child_cpu_sets;
+#endif
+
 /* Set defaults for config directives implemented here.  This is
  * called from core's pre-config hook, so MPMs which need to override
  * one of these should run their pre-config hook after that of core.
@@ -198,6 +209,10 @@ void mpm_common_pre_config(apr_pool_t *pconf)
     ap_graceful_shutdown_timeout = 0; /* unlimited */
     ap_max_mem_free = ALLOCATOR_MAX_FREE_DEFAULT;
     ap_thread_stacksize = 0; /* use system default */
+    ap_priority_workers = 0;
+#ifdef HAVE_SCHED_SETAFFINITY
+    child_cpu_sets = NULL;
+#endif
 }
 
 /* number of calls to wait_or_timeout between writable probes */
@@ -446,6 +461,275 @@ const char *ap_mpm_set_thread_stacksize(cmd_parms *cmd, void *dummy,
     return NULL;
 }
 
+const char *ap_mpm_set_priority_workers(cmd_parms *cmd, void *dummy,
+                                        const char *arg)
+{
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+    if (err != NULL) {
+        return err;
+    }
+
+    ap_priority_workers = atoi(arg);
+    if (ap_priority_workers < 0) {
+        return "PriorityWorkers must be a positive number or 0";
+    }
+
+    return NULL;
+}
+
+#ifdef HAVE_SCHED_SETAFFINITY
+/* Parse a Linux style cpulist (e.g. "0-3,8-11") */
+static const char *parse_cpu_list(const char *list, cpu_set_t *set)
+{
+    const char *s = list;
+
+    CPU_ZERO(set);
+    while (*s) {
+        char *end;
+        long first, last;
+
+        first = last = strtol(s, &end, 10);
+        if (end == s || first < 0) {
+            return "invalid CPU list";
+        }
+        if (*end == '-') {
+            s = end + 1;
+            last = strtol(s, &end, 10);
+            if (end == s || last < first) {
+                return "invalid CPU range";
+            }
+        }
+        if (last >= CPU_SETSIZE) {
+            return "CPU number too high";
+        }
+        for (; first <= last; ++first) {
+            CPU_SET((int)first, set);
+        }
+        s = end;
+        if (*s == ',') {
+            s++;
+        }
+        else if (*s && !apr_isspace(*s)) {
+            return "invalid CPU list";
+        }
+        else {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+/* Read a sysfs file (a single line) into buf, NUL terminated */
+static apr_status_t read_sysfs_file(const char *fname, char *buf,
+                                    apr_size_t size, apr_pool_t *p)
+{
+    apr_file_t *f;
+    apr_size_t len = size - 1;
+    apr_status_t rv;
+
+    rv = apr_file_open(&f, fname, APR_FOPEN_READ, APR_OS_DEFAULT, p);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+    apr_file_read_full(f, buf, len, &len);
+    apr_file_close(f);
+    buf[len] = '\0';
+
+    return APR_SUCCESS;
+}
+
+/* One set per online NUMA node, from sysfs.  Node numbers may be sparse,
+ * and memory-only nodes (e.g. CXL or HBM) have no CPUs, so skip those.
+ */
+static const char *add_numa_cpu_sets(cmd_parms *cmd)
+{
+    const char *fname = "/sys/devices/system/node/online";
+    char buf[1024];
+    cpu_set_t nodes;
+    const char *err;
+    int node;
+
+    if (read_sysfs_file(fname, buf, sizeof(buf),
+                        cmd->temp_pool) != APR_SUCCESS) {
+        return "ChildCPUAffinity numa: no NUMA node found in sysfs";
+    }
+    /* same format as a cpulist, for node numbers */
+    if ((err = parse_cpu_list(buf, &nodes))) {
+        return apr_pstrcat(cmd->pool, fname, ": ", err, NULL);
+    }
+
+    for (node = 0; node < CPU_SETSIZE; ++node) {
+        const char *s;
+        cpu_set_t *set;
+
+        if (!CPU_ISSET(node, &nodes)) {
+            continue;
+        }
+        fname = apr_psprintf(cmd->temp_pool,
+                             "/sys/devices/system/node/node%d/cpulist", node);
+        if (read_sysfs_file(fname, buf, sizeof(buf),
+                            cmd->temp_pool) != APR_SUCCESS) {
+            continue;
+        }
+        for (s = buf; apr_isspace(*s); ++s)
+            ;
+        if (!*s) {
+            continue; /* memory-only node */
+        }
+
+        set = apr_array_push(child_cpu_sets);
+        if ((err = parse_cpu_list(s, set))) {
+            return apr_pstrcat(cmd->pool, fname, ": ", err, NULL);
+        }
+    }
+    if (!child_cpu_sets->nelts) {
+        return "ChildCPUAffinity numa: no NUMA node found in sysfs";
+    }
+
+    return NULL;
+}
+#endif /* HAVE_SCHED_SETAFFINITY */
+
+const char *ap_mpm_set_child_cpu_affinity(cmd_parms *cmd, void *dummy,
+                                          int argc, char *const argv[])
+{
+#ifdef HAVE_SCHED_SETAFFINITY
+    int i;
+#endif
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+    if (err != NULL) {
+        return err;
+    }
+    if (argc < 1) {
+        return "ChildCPUAffinity requires at least one argument";
+    }
+
+#ifdef HAVE_SCHED_SETAFFINITY
+    child_cpu_sets = NULL;
+    if (argc == 1 && !ap_cstr_casecmp(argv[0], "off")) {
+        return NULL;
+    }
+
+    child_cpu_sets = apr_array_make(cmd->pool, argc, sizeof(cpu_set_t));
+    if (argc == 1 && !ap_cstr_casecmp(argv[0], "numa")) {
+        return add_numa_cpu_sets(cmd);
+    }
+    for (i = 0; i < argc; ++i) {
+        cpu_set_t *set = apr_array_push(child_cpu_sets);
+        if ((err = parse_cpu_list(argv[i], set))) {
+            return apr_pstrcat(cmd->pool, "ChildCPUAffinity ", argv[i],
+                               ": ", err, NULL);
+        }
+    }
+    return NULL;
+#else
+    if (argc == 1 && !ap_cstr_casecmp(argv[0], "off")) {
+        return NULL;
+    }
+    return "ChildCPUAffinity is not supported on this platform";
+#endif
+}
+
+int ap_mpm_child_cpu_affinity(server_rec *s, int child_slot,
+                              int child_bucket, int num_buckets)
+{
+#ifdef HAVE_SCHED_SETAFFINITY
+    const cpu_set_t *set;
+    int idx;
+
+    if (!child_cpu_sets || !child_cpu_sets->nelts) {
+        return 0;
+    }
+
+    /* With SO_REUSEPORT buckets, keep all the children of a bucket (hence
+     * the connections of its listeners) on the same CPU set.
+     */
+    idx = (num_buckets > 1) ? child_bucket : child_slot;
+    idx %= child_cpu_sets->nelts;
+    set = &APR_ARRAY_IDX(child_cpu_sets, idx, cpu_set_t);
+    if (sched_setaffinity(0, sizeof(cpu_set_t), set) < 0) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, errno, s, APLOGNO(10406)
+                     "sched_setaffinity() failed for child %d (set #%d)",
+                     child_slot, idx);
+        return 0;
+    }
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(10407)
+                 "child %d bound to CPU set #%d (%d CPUs)",
+                 child_slot, idx, CPU_COUNT(set));
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+int ap_mpm_cpu_bucket(int cpu, int num_buckets)
+{
+#ifdef HAVE_SCHED_SETAFFINITY
+    const cpu_set_t *set;
+    int idx, nsets, count, rank, i;
+
+    if (!child_cpu_sets || !child_cpu_sets->nelts || num_buckets < 2
+            || cpu < 0 || cpu >= CPU_SETSIZE) {
+        return -1;
+    }
+    nsets = child_cpu_sets->nelts;
+    for (idx = 0; idx < nsets; ++idx) {
+        set = &APR_ARRAY_IDX(child_cpu_sets, idx, cpu_set_t);
+        if (CPU_ISSET(cpu, set)) {
+            break;
+        }
+    }
+    if (idx == nsets || idx >= num_buckets) {
+        return -1;
+    }
+
+    /* Buckets idx, idx + nsets, ... are bound to this set (see
+     * ap_mpm_child_cpu_affinity()), give each one its share of the CPUs.
+     */
+    count = (num_buckets - idx + nsets - 1) / nsets;
+    for (rank = 0, i = 0; i < cpu; ++i) {
+        if (CPU_ISSET(i, set)) {
+            ++rank;
+        }
+    }
+    return idx + (rank % count) * nsets;
+#else
+    return -1;
+#endif
+}
+
+apr_status_t ap_mpm_create_local_pool(apr_pool_t **pool, apr_pool_t *parent)
+{
+    apr_allocator_t *allocator;
+#if APR_HAS_THREADS
+    apr_thread_mutex_t *mutex;
+#endif
+    apr_status_t rv;
+
+    if ((rv = apr_allocator_create(&allocator)) != APR_SUCCESS) {
+        return rv;
+    }
+    apr_allocator_max_free_set(allocator, ap_max_mem_free);
+    if ((rv = apr_pool_create_ex(pool, parent, NULL,
+                                 allocator)) != APR_SUCCESS) {
+        apr_allocator_destroy(allocator);
+        return rv;
+    }
+    apr_allocator_owner_set(allocator, *pool);
+#if APR_HAS_THREADS
+    rv = apr_thread_mutex_create(&mutex, APR_THREAD_MUTEX_DEFAULT, *pool);
+    if (rv != APR_SUCCESS) {
+        apr_pool_destroy(*pool);
+        *pool = NULL;
+        return rv;
+    }
+    apr_allocator_mutex_set(allocator, mutex);
+#endif
+
+    return APR_SUCCESS;
+}
+
 AP_DECLARE(apr_status_t) ap_mpm_query(int query_code, int *result)
 {
     apr_status_t rv;
@@ -311,6 +311,62 @@ apr_status_t ap_queue_info_term(fd_queue_info_t *queue_info)
     return apr_thread_mutex_unlock(queue_info->idlers_mutex);
 }
 
+/**
+ * A worker blocked in ap_queue_pop_something_ex(), waiting on its own
+ * condition variable (under one_big_mutex) for a pusher to hand it off
+ * an element directly.
+ */
+#define WAITER_IDLE        0
+#define WAITER_WAITING     1
+#define WAITER_FILLED      2
+#define WAITER_INTERRUPTED 3
+
+struct fd_queue_waiter_t
+{
+    fd_queue_waiter_t *next;
+    apr_thread_cond_t *cond;
+    fd_queue_elem_t elem;
+    timer_event_t *te;
+    int want_te;
+    int state;
+};
+
+/* Pop the most recently blocked waiter (the likeliest to be cache warm),
+ * called with one_big_mutex held.
+ */
+static APR_INLINE fd_queue_waiter_t *pop_idle_waiter(fd_queue_t *queue)
+{
+    fd_queue_waiter_t *w = queue->idle_waiters;
+    if (w) {
+        queue->idle_waiters = w->next;
+        w->next = NULL;
+    }
+    return w;
+}
+
+/* Pop the most recently blocked waiter which takes timers, skipping the
+ * ones popping sockets only, called with one_big_mutex held.
+ */
+static APR_INLINE fd_queue_waiter_t *pop_idle_waiter_te(fd_queue_t *queue)
+{
+    fd_queue_waiter_t **pw, *w;
+
+    for (pw = &queue->idle_waiters; (w = *pw); pw = &w->next) {
+        if (w->want_te) {
+            *pw = w->next;
+            w->next = NULL;
+            return w;
+        }
+    }
+    return NULL;
+}
+
+static void interrupt_waiter(fd_queue_waiter_t *w)
+{
+    w->state = WAITER_INTERRUPTED;
+    apr_thread_cond_signal(w->cond);
+}
+
 /**
  * Detects when the fd_queue_t is full. This utility function is expected
  * to be called from within critical sections, and is not threadsafe.
@@ -332,10 +388,16 @@ apr_status_t ap_queue_info_term(fd_queue_info_t *queue_info)
 static apr_status_t ap_queue_destroy(void *data)
 {
     fd_queue_t *queue = data;
+    int i;
 
     /* Ignore errors here, we can't do anything about them anyway.
      * XXX: We should at least try to signal an error here, it is
      * indicative of a programmer error. -aaron */
+    for (i = 0; i < queue->bounds; ++i) {
+        if (queue->waiters[i].cond) {
+            apr_thread_cond_destroy(queue->waiters[i].cond);
+        }
+    }
     apr_thread_cond_destroy(queue->not_empty);
     apr_thread_mutex_destroy(queue->one_big_mutex);
 
@@ -349,6 +411,7 @@ apr_status_t ap_queue_create(fd_queue_t **pqueue, int capacity, apr_pool_t *p)
 {
     apr_status_t rv;
     fd_queue_t *queue;
+    int i;
 
     queue = apr_pcalloc(p, sizeof *queue);
 
@@ -368,6 +431,14 @@ apr_status_t ap_queue_create(fd_queue_t **pqueue, int capacity, apr_pool_t *p)
 
     apr_pool_cleanup_register(p, queue, ap_queue_destroy,
                               apr_pool_cleanup_null);
+
+    queue->waiters = apr_pcalloc(p, capacity * sizeof(fd_queue_waiter_t));
+    for (i = 0; i < capacity; ++i) {
+        rv = apr_thread_cond_create(&queue->waiters[i].cond, p);
+        if (rv != APR_SUCCESS) {
+            return rv;
+        }
+    }
     *pqueue = queue;
 
     return APR_SUCCESS;
@@ -384,6 +455,7 @@ apr_status_t ap_queue_push_socket(fd_queue_t *queue,
                                   apr_pool_t *p)
 {
     fd_queue_elem_t *elem;
+    fd_queue_waiter_t *w;
     apr_status_t rv;
 
     if ((rv = apr_thread_mutex_lock(queue->one_big_mutex)) != APR_SUCCESS) {
@@ -393,6 +465,21 @@ apr_status_t ap_queue_push_socket(fd_queue_t *queue,
     AP_DEBUG_ASSERT(!queue->terminated);
     AP_DEBUG_ASSERT(!ap_queue_full(queue));
 
+    /* Hand off to a blocked worker directly if any, waking up only this
+     * one rather than whichever thread gets not_empty's signal.
+     */
+    w = pop_idle_waiter(queue);
+    if (w) {
+        w->elem.sd = sd;
+        w->elem.sd_baton = sd_baton;
+        w->elem.p = p;
+        w->te = NULL;
+        w->state = WAITER_FILLED;
+        AP_WORKER_QUEUE_PUSH((uintptr_t)queue, (uintptr_t)sd, queue->nelts);
+        apr_thread_cond_signal(w->cond);
+        return apr_thread_mutex_unlock(queue->one_big_mutex);
+    }
+
     elem = &queue->data[queue->in++];
     if (queue->in >= queue->bounds)
         queue->in -= queue->bounds;
@@ -400,6 +487,7 @@ apr_status_t ap_queue_push_socket(fd_queue_t *queue,
     elem->sd_baton = sd_baton;
     elem->p = p;
     queue->nelts++;
+    AP_WORKER_QUEUE_PUSH((uintptr_t)queue, (uintptr_t)sd, queue->nelts);
 
     apr_thread_cond_signal(queue->not_empty);
 
@@ -408,6 +496,7 @@ apr_status_t ap_queue_push_socket(fd_queue_t *queue,
 
 apr_status_t ap_queue_push_timer(fd_queue_t *queue, timer_event_t *te)
 {
+    fd_queue_waiter_t *w;
     apr_status_t rv;
 
     if ((rv = apr_thread_mutex_lock(queue->one_big_mutex)) != APR_SUCCESS) {
@@ -416,6 +505,14 @@ apr_status_t ap_queue_push_timer(fd_queue_t *queue, timer_event_t *te)
 
     AP_DEBUG_ASSERT(!queue->terminated);
 
+    w = pop_idle_waiter_te(queue);
+    if (w) {
+        w->te = te;
+        w->state = WAITER_FILLED;
+        apr_thread_cond_signal(w->cond);
+        return apr_thread_mutex_unlock(queue->one_big_mutex);
+    }
+
     APR_RING_INSERT_TAIL(&queue->timers, te, timer_event_t, link);
 
     apr_thread_cond_signal(queue->not_empty);
@@ -423,6 +520,44 @@ apr_status_t ap_queue_push_timer(fd_queue_t *queue, timer_event_t *te)
     return apr_thread_mutex_unlock(queue->one_big_mutex);
 }
 
+/**
+ * Takes the next timer (if wanted) or socket out of the non-empty queue,
+ * called with one_big_mutex held.
+ */
+static void queue_take(fd_queue_t *queue,
+                       apr_socket_t **sd, void **sd_baton,
+                       apr_pool_t **p, timer_event_t **te_out)
+{
+    fd_queue_elem_t *elem;
+    timer_event_t *te;
+
+    te = NULL;
+    if (te_out) {
+        if (!APR_RING_EMPTY(&queue->timers, timer_event_t, link)) {
+            te = APR_RING_FIRST(&queue->timers);
+            APR_RING_REMOVE(te, link);
+        }
+        *te_out = te;
+    }
+    if (!te) {
+        elem = &queue->data[queue->out++];
+        if (queue->out >= queue->bounds)
+            queue->out -= queue->bounds;
+        queue->nelts--;
+
+        *sd = elem->sd;
+        if (sd_baton) {
+            *sd_baton = elem->sd_baton;
+        }
+        *p = elem->p;
+        AP_WORKER_QUEUE_POP((uintptr_t)queue, (uintptr_t)*sd, queue->nelts);
+#ifdef AP_DEBUG
+        elem->sd = NULL;
+        elem->p = NULL;
+#endif /* AP_DEBUG */
+    }
+}
+
 /**
  * Retrieves the next available socket from the queue. If there are no
  * sockets available, it will block until one becomes available.
@@ -433,8 +568,6 @@ apr_status_t ap_queue_pop_something(fd_queue_t *queue,
                                     apr_socket_t **sd, void **sd_baton,
                                     apr_pool_t **p, timer_event_t **te_out)
 {
-    fd_queue_elem_t *elem;
-    timer_event_t *te;
     apr_status_t rv;
 
     if ((rv = apr_thread_mutex_lock(queue->one_big_mutex)) != APR_SUCCESS) {
@@ -461,30 +594,124 @@ apr_status_t ap_queue_pop_something(fd_queue_t *queue,
         }
     }
 
-    te = NULL;
-    if (te_out) {
-        if (!APR_RING_EMPTY(&queue->timers, timer_event_t, link)) {
-            te = APR_RING_FIRST(&queue->timers);
-            APR_RING_REMOVE(te, link);
+    queue_take(queue, sd, sd_baton, p, te_out);
+
+    return apr_thread_mutex_unlock(queue->one_big_mutex);
+}
+
+/* Unlink a waiter that is still in the idle list, called with
+ * one_big_mutex held.
+ */
+static void unlink_idle_waiter(fd_queue_t *queue, fd_queue_waiter_t *w)
+{
+    fd_queue_waiter_t **pw;
+
+    for (pw = &queue->idle_waiters; *pw; pw = &(*pw)->next) {
+        if (*pw == w) {
+            *pw = w->next;
+            w->next = NULL;
+            break;
         }
-        *te_out = te;
     }
-    if (!te) {
-        elem = &queue->data[queue->out++];
-        if (queue->out >= queue->bounds)
-            queue->out -= queue->bounds;
-        queue->nelts--;
+}
 
-        *sd = elem->sd;
+/**
+ * Same as ap_queue_pop_something() but if the queue is empty the worker
+ * blocks on its own condition variable, and is the first one to get the
+ * next pushed element if it's the last one to have blocked.
+ */
+apr_status_t ap_queue_pop_something_ex(fd_queue_t *queue, int worker,
+                                       apr_socket_t **sd, void **sd_baton,
+                                       apr_pool_t **p, timer_event_t **te_out)
+{
+    return ap_queue_pop_something_timeout(queue, worker, -1,
+                                          sd, sd_baton, p, te_out);
+}
+
+/**
+ * Same as ap_queue_pop_something_ex() but if nothing was handed off to the
+ * worker within the (non-negative) timeout, it gives up with APR_TIMEUP.
+ */
+apr_status_t ap_queue_pop_something_timeout(fd_queue_t *queue, int worker,
+                                            apr_interval_time_t timeout,
+                                            apr_socket_t **sd, void **sd_baton,
+                                            apr_pool_t **p,
+                                            timer_event_t **te_out)
+{
+    fd_queue_waiter_t *w;
+    apr_time_t deadline = 0;
+    apr_status_t rv;
+
+    if (worker < 0 || worker >= queue->bounds) {
+        return ap_queue_pop_something(queue, sd, sd_baton, p, te_out);
+    }
+
+    if ((rv = apr_thread_mutex_lock(queue->one_big_mutex)) != APR_SUCCESS) {
+        return rv;
+    }
+
+    if (!ap_queue_empty(queue)) {
+        queue_take(queue, sd, sd_baton, p, te_out);
+        return apr_thread_mutex_unlock(queue->one_big_mutex);
+    }
+
+    w = &queue->waiters[worker];
+    if (!queue->terminated) {
+        w->want_te = (te_out != NULL);
+        w->state = WAITER_WAITING;
+        w->next = queue->idle_waiters;
+        queue->idle_waiters = w;
+        if (timeout >= 0) {
+            deadline = apr_time_now() + timeout;
+        }
+        do {
+            if (timeout < 0) {
+                apr_thread_cond_wait(w->cond, queue->one_big_mutex);
+                continue;
+            }
+            timeout = deadline - apr_time_now();
+            if (timeout <= 0) {
+                /* Nobody handed us anything, leave the idle list */
+                unlink_idle_waiter(queue, w);
+                w->state = WAITER_IDLE;
+                rv = apr_thread_mutex_unlock(queue->one_big_mutex);
+                if (rv != APR_SUCCESS) {
+                    return rv;
+                }
+                return APR_TIMEUP;
+            }
+            apr_thread_cond_timedwait(w->cond, queue->one_big_mutex,
+                                      timeout);
+        } while (w->state == WAITER_WAITING);
+    }
+
+    if (w->state != WAITER_FILLED) {
+        /* Interrupted (or terminated), the pusher/interrupter unlinked us */
+        w->state = WAITER_IDLE;
+        rv = apr_thread_mutex_unlock(queue->one_big_mutex);
+        if (rv != APR_SUCCESS) {
+            return rv;
+        }
+        return queue->terminated ? APR_EOF : APR_EINTR;
+    }
+    w->state = WAITER_IDLE;
+
+    if (te_out) {
+        *te_out = w->te;
+    }
+    if (!w->te) {
+        *sd = w->elem.sd;
         if (sd_baton) {
-            *sd_baton = elem->sd_baton;
+            *sd_baton = w->elem.sd_baton;
         }
-        *p = elem->p;
+        *p = w->elem.p;
+        AP_WORKER_QUEUE_POP((uintptr_t)queue, (uintptr_t)*sd, queue->nelts);
+    }
+    w->te = NULL;
 #ifdef AP_DEBUG
-        elem->sd = NULL;
-        elem->p = NULL;
+    w->elem.sd = NULL;
+    w->elem.p = NULL;
 #endif /* AP_DEBUG */
-    }
 
     return apr_thread_mutex_unlock(queue->one_big_mutex);
 }
@@ -508,10 +735,22 @@ static apr_status_t queue_interrupt(fd_queue_t *queue, int all, int term)
     if (term) {
         queue->terminated = 1;
     }
-    if (all)
+    if (all) {
+        fd_queue_waiter_t *w;
+        while ((w = pop_idle_waiter(queue))) {
+            interrupt_waiter(w);
+        }
         apr_thread_cond_broadcast(queue->not_empty);
-    else
-        apr_thread_cond_signal(queue->not_empty);
+    }
+    else {
+        fd_queue_waiter_t *w = pop_idle_waiter(queue);
+        if (w) {
+            interrupt_waiter(w);
+        }
+        else {
+            apr_thread_cond_signal(queue->not_empty);
+        }
+    }
 
     return apr_thread_mutex_unlock(queue->one_big_mutex);
 }
@@ -42,8 +42,10 @@
 
 struct fd_queue_info_t; /* opaque */
 struct fd_queue_elem_t; /* opaque */
+struct fd_queue_waiter_t; /* opaque */
 typedef struct fd_queue_info_t fd_queue_info_t;
 typedef struct fd_queue_elem_t fd_queue_elem_t;
+typedef struct fd_queue_waiter_t fd_queue_waiter_t;
 
 AP_DECLARE(apr_status_t) ap_queue_info_create(fd_queue_info_t **queue_info,
                                               apr_pool_t *pool, int max_idlers,
@@ -84,6 +86,8 @@ struct fd_queue_t
     apr_thread_mutex_t *one_big_mutex;
     apr_thread_cond_t *not_empty;
     volatile int terminated;
+    fd_queue_waiter_t *waiters;      /* one per worker (capacity) */
+    fd_queue_waiter_t *idle_waiters; /* LIFO of the ones blocked in pop */
 };
 typedef struct fd_queue_t fd_queue_t;
 
@@ -100,6 +104,36 @@ AP_DECLARE(apr_status_t) ap_queue_pop_something(fd_queue_t *queue,
 #define                  ap_queue_pop_socket(q_, s_, p_) \
                             ap_queue_pop_something((q_), (s_), NULL, (p_), NULL)
 
+/* Same as ap_queue_pop_something() for the given worker (< capacity), which
+ * when blocked gets pushed sockets or timers handed off directly, the most
+ * recently blocked worker first.
+ */
+AP_DECLARE(apr_status_t) ap_queue_pop_something_ex(fd_queue_t *queue,
+                                                   int worker,
+                                                   apr_socket_t **sd,
+                                                   void **sd_baton,
+                                                   apr_pool_t **p,
+                                                   timer_event_t **te);
+#define                  ap_queue_pop_socket_ex(q_, w_, s_, p_) \
+                            ap_queue_pop_something_ex((q_), (w_), (s_), NULL, \
+                                                      (p_), NULL)
+
+/* Same as ap_queue_pop_something_ex() but when the timeout (if not negative)
+ * expires before anything is handed off to the worker, APR_TIMEUP is
+ * returned (the worker is no longer an idle waiter then).
+ */
+AP_DECLARE(apr_status_t) ap_queue_pop_something_timeout(fd_queue_t *queue,
+                                                        int worker,
+                                                        apr_interval_time_t timeout,
+                                                        apr_socket_t **sd,
+                                                        void **sd_baton,
+                                                        apr_pool_t **p,
+                                                        timer_event_t **te);
+#define                  ap_queue_pop_socket_timeout(q_, w_, t_, s_, p_) \
+                            ap_queue_pop_something_timeout((q_), (w_), (t_), \
+                                                           (s_), NULL, (p_), \
+                                                           NULL)
+
 AP_DECLARE(apr_status_t) ap_queue_interrupt_all(fd_queue_t *queue);
 AP_DECLARE(apr_status_t) ap_queue_interrupt_one(fd_queue_t *queue);
 AP_DECLARE(apr_status_t) ap_queue_term(fd_queue_t *queue);
@@ -27,6 +27,7 @@
 #include "apr_lib.h"
 #include "apr_signal.h"
 #include "apr_strmatch.h"
+#include "apr_atomic.h"
 
 #define APR_WANT_STDIO          /* for sscanf */
 #define APR_WANT_STRFUNC
@@ -726,7 +727,7 @@ AP_DECLARE(int) ap_check_request_header(request_rec *r)
 
     if ((!r->hostname && (r->proto_num >= HTTP_VERSION(1, 1)))
         || ((r->proto_num == HTTP_VERSION(1, 1))
-            && !apr_table_get(r->headers_in, "Host"))) {
+            && !ap_get_request_header(r, AP_HDR_HOST))) {
         /*
          * Client sent us an HTTP/1.1 or later request without telling us the
          * hostname, either with a full URL or a Host: header. We therefore
@@ -744,7 +745,7 @@ AP_DECLARE(int) ap_check_request_header(request_rec *r)
     /* we may have switched to another server */
     conf = ap_get_core_module_config(r->server->module_config);
 
-    if (((expect = apr_table_get(r->headers_in, "Expect")) != NULL)
+    if (((expect = ap_get_request_header(r, AP_HDR_EXPECT)) != NULL)
         && (expect[0] != '\0')) {
         /*
          * The Expect header field was added to HTTP/1.1 after RFC 2068
@@ -788,6 +789,121 @@ static int table_do_fn_check_lengths(void *r_, const char *key,
     return 0;
 }
 
+/* Well-known header fields, in ap_header_id_e order */
+static const struct {
+    const char *name;
+    apr_size_t len;
+} header_names[AP_HDR_COUNT] = {
+#define HEADER_NAME(s) { s, sizeof(s) - 1 }
+    HEADER_NAME("Accept-Encoding"),
+    HEADER_NAME("Authorization"),
+    HEADER_NAME("Cache-Control"),
+    HEADER_NAME("Connection"),
+    HEADER_NAME("Content-Length"),
+    HEADER_NAME("Content-Type"),
+    HEADER_NAME("Cookie"),
+    HEADER_NAME("Expect"),
+    HEADER_NAME("Host"),
+    HEADER_NAME("If-Match"),
+    HEADER_NAME("If-Modified-Since"),
+    HEADER_NAME("If-None-Match"),
+    HEADER_NAME("If-Range"),
+    HEADER_NAME("If-Unmodified-Since"),
+    HEADER_NAME("Pragma"),
+    HEADER_NAME("Range"),
+    HEADER_NAME("Referer"),
+    HEADER_NAME("Transfer-Encoding"),
+    HEADER_NAME("Upgrade"),
+    HEADER_NAME("User-Agent"),
+    HEADER_NAME("Via")
+#undef HEADER_NAME
+};
+
+/* Positions (+1, 0 when absent) of the well-known fields in headers_in.
+ * The index is valid for the table it was built for as long as no entry
+ * was added or removed, which (entries being appended) is told by the
+ * number of entries and the key of the last one, both unchanged. Entries
+ * moved otherwise (apr_table_compress()) are told by their key, compared
+ * by address since the table never copies them.
+ */
+struct ap_header_index_t {
+    const apr_table_t *table;
+    int nelts;
+    const char *last;
+    int pos[AP_HDR_COUNT];
+    const char *key[AP_HDR_COUNT];
+};
+
+static struct ap_header_index_t *index_request_headers(request_rec *r)
+{
+    struct ap_header_index_t *idx = r->headers_in_index;
+    const apr_array_header_t *arr = apr_table_elts(r->headers_in);
+    const apr_table_entry_t *elts = (const apr_table_entry_t *)arr->elts;
+    int i, id;
+
+    if (!idx) {
+        idx = r->headers_in_index = apr_palloc(r->pool, sizeof(*idx));
+    }
+    memset(idx->pos, 0, sizeof(idx->pos));
+    idx->table = r->headers_in;
+    idx->nelts = arr->nelts;
+    idx->last = arr->nelts ? elts[arr->nelts - 1].key : NULL;
+
+    for (i = 0; i < arr->nelts; ++i) {
+        apr_size_t len = strlen(elts[i].key);
+
+        for (id = 0; id < AP_HDR_COUNT; ++id) {
+            if (header_names[id].len == len
+                    && !ap_cstr_casecmp(header_names[id].name, elts[i].key)) {
+                if (!idx->pos[id]) {
+                    idx->pos[id] = i + 1;
+                    idx->key[id] = elts[i].key;
+                }
+                break;
+            }
+        }
+    }
+
+    return idx;
+}
+
+AP_DECLARE(const char *) ap_get_request_header(request_rec *r,
+                                               ap_header_id_e id)
+{
+    struct ap_header_index_t *idx = r->headers_in_index;
+    const apr_array_header_t *arr;
+    const apr_table_entry_t *elts;
+    int pos;
+
+    if (id < 0 || id >= AP_HDR_COUNT) {
+        return NULL;
+    }
+
+    arr = apr_table_elts(r->headers_in);
+    elts = (const apr_table_entry_t *)arr->elts;
+    if (!idx || idx->table != r->headers_in || idx->nelts != arr->nelts
+            || (arr->nelts && idx->last != elts[arr->nelts - 1].key)) {
+        idx = index_request_headers(r);
+    }
+
+    pos = idx->pos[id];
+    if (pos && elts[pos - 1].key != idx->key[id]) {
+        /* Moved */
+        idx = index_request_headers(r);
+        pos = idx->pos[id];
+    }
+
+    return pos ? elts[pos - 1].val : NULL;
+}
+
+AP_DECLARE(const char *) ap_get_request_header_name(ap_header_id_e id)
+{
+    if (id < 0 || id >= AP_HDR_COUNT) {
+        return NULL;
+    }
+    return header_names[id].name;
+}
+
 AP_DECLARE(void) ap_get_mime_headers_core(request_rec *r, apr_bucket_brigade *bb)
 {
     char *last_field = NULL;
@@ -797,7 +913,7 @@ AP_DECLARE(void) ap_get_mime_headers_core(request_rec *r, apr_bucket_brigade *bb
     char *value;
     apr_size_t len;
     int fields_read = 0;
-    char *tmp_field;
+    apr_size_t value_len;
     core_server_config *conf = ap_get_core_module_config(r->server->module_config);
     int strict = (conf->http_conformance != AP_HTTP_CONFORMANCE_UNSAFE);
 
@@ -997,15 +1113,18 @@ AP_DECLARE(void) ap_get_mime_headers_core(request_rec *r, apr_bucket_brigade *bb
                     ++value;     /* Skip LWS of value */
                 }
 
-                /* Find invalid, non-HT ctrl char, or the trailing NULL */
-                tmp_field = (char *)ap_scan_http_field_content(value);
+                /* Find invalid, non-HT ctrl char, or the end of the line
+                 * (whose length is known, no need to look for the NUL)
+                 */
+                value_len = last_len - (value - last_field);
 
                 /* Reject value for all garbage input (CTRLs excluding HT)
                  * e.g. only VCHAR / SP / HT / obs-text are allowed per
                  * RFC7230 3.2.6 - leave all more explicit rule enforcement
                  * for specific header handler logic later in the cycle
                  */
-                if (*tmp_field != '\0') {
+                if (ap_scan_http_field_content_len(value, value_len)
+                        < value_len) {
                     r->status = HTTP_BAD_REQUEST;
                     ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(02427)
                                   "Request header value is malformed: "
@@ -1043,6 +1162,9 @@ AP_DECLARE(void) ap_get_mime_headers_core(request_rec *r, apr_bucket_brigade *bb
 
     /* enforce LimitRequestFieldSize for merged headers */
     apr_table_do(table_do_fn_check_lengths, r, r->headers_in, NULL);
+
+    /* index the well-known fields while the table is hot */
+    index_request_headers(r);
 }
 
 AP_DECLARE(void) ap_get_mime_headers(request_rec *r)
@@ -1053,8 +1175,76 @@ AP_DECLARE(void) ap_get_mime_headers(request_rec *r)
     apr_brigade_destroy(tmp_bb);
 }
 
+/* The request tables sized by RequestTablesAutoSize, indexes in
+ * core_server_config->request_tables_sizes[AP_REQUEST_TABLES_NUM].
+ */
+#define REQ_TABLE_HEADERS_IN     0
+#define REQ_TABLE_SUBPROCESS_ENV 1
+#define REQ_TABLE_HEADERS_OUT    2
+#define REQ_TABLE_NOTES          3
+
+/* Default (and minimal) initial sizes of the above tables */
+static const int request_tables_min[AP_REQUEST_TABLES_NUM] = {
+    25, 25, 12, 5
+};
+
+/* Maximal initial size of the tables, whatever the previous requests */
+#define REQ_TABLE_MAX_NELTS 256
+
+/* Initial size of the request table i, that is the moving average of
+ * the previous requests plus 25%, kept between the default and the max.
+ */
+static int request_table_size(core_server_config *conf, int i)
+{
+    /* The average is scaled by 8 (see record_request_tables()) */
+    int n = (int)(apr_atomic_read32(&conf->request_tables_sizes[i]) / 8);
+
+    n += n / 4;
+    if (n < request_tables_min[i]) {
+        return request_tables_min[i];
+    }
+    if (n > REQ_TABLE_MAX_NELTS) {
+        return REQ_TABLE_MAX_NELTS;
+    }
+    return n;
+}
+
+/* Pre-cleanup of r->pool, recording the number of entries in the tables */
+static apr_status_t record_request_tables(void *data)
+{
+    request_rec *r = data;
+    core_server_config *conf =
+        ap_get_core_module_config(r->connection->base_server->module_config);
+    const apr_table_t *t[AP_REQUEST_TABLES_NUM];
+    int i;
+
+    t[REQ_TABLE_HEADERS_IN] = r->headers_in;
+    t[REQ_TABLE_SUBPROCESS_ENV] = r->subprocess_env;
+    t[REQ_TABLE_HEADERS_OUT] = r->headers_out;
+    t[REQ_TABLE_NOTES] = r->notes;
+
+    for (i = 0; i < AP_REQUEST_TABLES_NUM; ++i) {
+        apr_uint32_t *avg = &conf->request_tables_sizes[i];
+        apr_uint32_t old = apr_atomic_read32(avg);
+
+        if (!t[i]) {
+            continue;
+        }
+        /* Exponential moving average with a 1/8 weight, scaled by 8.
+         * Concurrent updates may be lost, harmless for a sizing hint.
+         */
+        apr_atomic_set32(avg, old - old / 8
+                              + (apr_uint32_t)apr_table_elts(t[i])->nelts);
+    }
+
+    return APR_SUCCESS;
+}
+
 AP_DECLARE(request_rec *) ap_create_request(conn_rec *conn)
 {
+    core_server_config *conf =
+        ap_get_core_module_config(conn->base_server->module_config);
+    int autosize = (conf->request_tables_autosize == AP_CORE_CONFIG_ON);
     request_rec *r;
     apr_pool_t *p;
 
@@ -1071,13 +1261,26 @@ AP_DECLARE(request_rec *) ap_create_request(conn_rec *conn)
 
     r->allowed_methods = ap_make_method_list(p, 2);
 
-    r->headers_in      = apr_table_make(r->pool, 25);
+    if (autosize) {
+        r->headers_in  = apr_table_make(r->pool,
+                            request_table_size(conf, REQ_TABLE_HEADERS_IN));
+        r->subprocess_env = apr_table_make(r->pool,
+                            request_table_size(conf, REQ_TABLE_SUBPROCESS_ENV));
+        r->headers_out = apr_table_make(r->pool,
+                            request_table_size(conf, REQ_TABLE_HEADERS_OUT));
+        r->notes       = apr_table_make(r->pool,
+                            request_table_size(conf, REQ_TABLE_NOTES));
+        apr_pool_pre_cleanup_register(p, r, record_request_tables);
+    }
+    else {
+        r->headers_in      = apr_table_make(r->pool, 25);
+        r->subprocess_env  = apr_table_make(r->pool, 25);
+        r->headers_out     = apr_table_make(r->pool, 12);
+        r->notes           = apr_table_make(r->pool, 5);
+    }
     r->trailers_in     = apr_table_make(r->pool, 5);
-    r->subprocess_env  = apr_table_make(r->pool, 25);
-    r->headers_out     = apr_table_make(r->pool, 12);
     r->err_headers_out = apr_table_make(r->pool, 5);
     r->trailers_out    = apr_table_make(r->pool, 5);
-    r->notes           = apr_table_make(r->pool, 5);
 
     r->request_config  = ap_create_request_config(r->pool);
     /* Must be set before we run create request hook */
@@ -1423,7 +1626,7 @@ AP_DECLARE(request_rec *) ap_read_request(conn_rec *conn)
     apply_server_config(r);
 
     if (!r->assbackwards) {
-        const char *clen = apr_table_get(r->headers_in, "Content-Length");
+        const char *clen = ap_get_request_header(r, AP_HDR_CONTENT_LENGTH);
         if (clen) {
             apr_off_t cl;
 
@@ -1756,9 +1959,34 @@ struct content_length_ctx {
                      * least one bucket on to the next output filter
                      * for this request
                      */
+    int pass_pipes; /* true if the pipe buckets go unread to the next
+                     * output filter (see can_pass_pipe())
+                     */
     apr_bucket_brigade *tmpbb;
 };
 
+/* Whether the pipe buckets of the response can be passed unread, which
+ * lets the core output filter splice() them to the socket. This needs the
+ * length of the response to be declared already, and a connection whose
+ * core output filter sees the buckets (HTTP/1.x).
+ */
+static int can_pass_pipe(request_rec *r)
+{
+    const char *cl;
+    apr_off_t len;
+
+    if (r->header_only || r->connection->master) {
+        return 0;
+    }
+    cl = apr_table_get(r->headers_out, "Content-Length");
+    if (!cl || !ap_parse_strict_length(&len, cl)) {
+        return 0;
+    }
+    /* The body is not counted from here */
+    r->bytes_sent = len;
+    return 1;
+}
+
 /* This filter computes the content length, but it also computes the number
  * of bytes sent to the client.  This means that this filter will always run
  * through all of the buckets in all brigades
@@ -1777,8 +2005,12 @@ AP_CORE_DECLARE_NONSTD(apr_status_t) ap_content_length_filter(
     if (!ctx) {
         f->ctx = ctx = apr_palloc(r->pool, sizeof(*ctx));
         ctx->data_sent = 0;
+        ctx->pass_pipes = 0;
         ctx->tmpbb = apr_brigade_create(r->pool, r->connection->bucket_alloc);
     }
+    if (ctx->pass_pipes) {
+        return ap_pass_brigade(f->next, b);
+    }
 
     /* Loop through the brigade to count the length. To avoid
      * arbitrary memory consumption with morphing bucket types, this
@@ -1808,6 +2040,12 @@ AP_CORE_DECLARE_NONSTD(apr_status_t) ap_content_length_filter(
             e = APR_BUCKET_NEXT(e);
             continue;
         }
+        /* For a pipe bucket of a response with a declared length, pass
+         * on everything unread. */
+        else if (APR_BUCKET_IS_PIPE(e) && can_pass_pipe(r)) {
+            ctx->pass_pipes = 1;
+            break;
+        }
         /* For indeterminate length data buckets, perform one read. */
         else /* e->length == (apr_size_t)-1 */ {
             apr_size_t len;
@@ -1965,9 +2203,17 @@ AP_DECLARE(apr_size_t) ap_send_mmap(apr_mmap_t *mm,
 }
 #endif /* APR_HAS_MMAP */
 
+/* Amount of data buffered by the ap_r* functions beyond which it's passed
+ * down the chain, in the heap buckets of the buffer. This bounds the memory
+ * used by handlers writing large responses (like mod_status or
+ * mod_autoindex), without sending them in many small pieces either.
+ */
+#define OLD_WRITE_MAX_BUFFER (8 * APR_BUCKET_BUFF_SIZE)
+
 typedef struct {
     apr_bucket_brigade *bb;
     apr_bucket_brigade *tmpbb;
+    apr_size_t buffered;
 } old_write_filter_ctx;
 
 AP_CORE_DECLARE_NONSTD(apr_status_t) ap_old_write_filter(
@@ -1983,6 +2229,7 @@ AP_CORE_DECLARE_NONSTD(apr_status_t) ap_old_write_filter(
          * pass the whole bundle down the chain.
          */
         APR_BRIGADE_PREPEND(bb, ctx->bb);
+        ctx->buffered = 0;
     }
 
     return ap_pass_brigade(f->next, bb);
@@ -2045,6 +2292,23 @@ static apr_status_t buffer_output(request_rec *r,
         ctx->bb = apr_brigade_create(r->pool, c->bucket_alloc);
     }
 
+    /* The brigade is flushed by ap_fwrite() for writes larger than a heap
+     * bucket, otherwise the data are copied into the last one (or a new one)
+     * and we pass them down ourselves once there are enough.
+     */
+    if (len > APR_BUCKET_BUFF_SIZE) {
+        ctx->buffered = 0;
+    }
+    else if ((ctx->buffered += len) > OLD_WRITE_MAX_BUFFER) {
+        apr_status_t rv;
+
+        ctx->buffered = 0;
+        rv = ap_filter_flush(ctx->bb, f->next);
+        if (rv != APR_SUCCESS) {
+            return rv;
+        }
+    }
+
     return ap_fwrite(f->next, ctx->bb, str, len);
 }
 
@@ -28,6 +28,10 @@
 #include "apr_strings.h"
 #include "apr_file_io.h"
 #include "apr_fnmatch.h"
+#include "apr_hash.h"
+#if APR_HAS_THREADS
+#include "apr_thread_rwlock.h"
+#endif
 
 #define APR_WANT_STRFUNC
 #include "apr_want.h"
@@ -41,9 +45,12 @@
 #include "http_protocol.h"
 #include "http_log.h"
 #include "http_main.h"
+#include "ap_mpm.h"
 #include "util_filter.h"
 #include "util_charset.h"
 #include "util_script.h"
+#include "util_time.h"
+#include "scoreboard.h"
 #include "ap_expr.h"
 #include "mod_request.h"
 
@@ -181,12 +188,215 @@ static int walk_location_and_if(request_rec *r)
     return OK;
 }
 
+static const char *const phase_names[AP_REQUEST_PHASE_COUNT] = {
+    "translate",
+    "map_to_storage",
+    "header_parser",
+    "access",
+    "authn",
+    "authz",
+    "type",
+    "fixups",
+    "handler",
+    "output",
+    "write"
+};
+
+static core_request_config *phases_config(const request_rec *r)
+{
+    /* internal redirects account to the initial request */
+    while (r->prev) {
+        r = r->prev;
+    }
+    return r->request_config ? ap_get_core_module_config(r->request_config)
+                             : NULL;
+}
+
+AP_DECLARE(apr_time_t) ap_request_phase_add(request_rec *r,
+                                            ap_request_phase_e phase,
+                                            apr_time_t start)
+{
+    apr_time_t now = ap_time_monotonic();
+    core_request_config *req_cfg = phases_config(r);
+
+    if (req_cfg && phase >= 0 && phase < AP_REQUEST_PHASE_COUNT) {
+        if (!req_cfg->phase_times) {
+            int i;
+
+            /* the times, then the start of the first run of the phases */
+            req_cfg->phase_times = apr_palloc(r->pool,
+                                              2 * AP_REQUEST_PHASE_COUNT
+                                              * sizeof(apr_interval_time_t));
+            for (i = 0; i < AP_REQUEST_PHASE_COUNT; ++i) {
+                req_cfg->phase_times[i] = -1;
+            }
+        }
+        if (req_cfg->phase_times[phase] < 0) {
+            req_cfg->phase_times[phase] = 0;
+            req_cfg->phase_times[AP_REQUEST_PHASE_COUNT + phase] = start;
+        }
+        if (now > start) {
+            req_cfg->phase_times[phase] += now - start;
+        }
+        if (phase == AP_REQUEST_PHASE_HANDLER) {
+            req_cfg->handler_end = now;
+        }
+    }
+    return now;
+}
+
+AP_DECLARE(void) ap_request_phase_sent(request_rec *r)
+{
+    core_request_config *req_cfg = phases_config(r);
+
+    if (req_cfg && req_cfg->handler_end) {
+        ap_request_phase_add(r, AP_REQUEST_PHASE_WRITE, req_cfg->handler_end);
+        req_cfg->handler_end = 0;
+    }
+}
+
+AP_DECLARE(apr_interval_time_t) ap_request_phase_time(const request_rec *r,
+                                                      ap_request_phase_e phase)
+{
+    core_request_config *req_cfg = phases_config(r);
+
+    if (!req_cfg || !req_cfg->phase_times
+            || phase < 0 || phase >= AP_REQUEST_PHASE_COUNT) {
+        return -1;
+    }
+    return req_cfg->phase_times[phase];
+}
+
+AP_DECLARE(apr_time_t) ap_request_phase_start(const request_rec *r,
+                                              ap_request_phase_e phase)
+{
+    if (ap_request_phase_time(r, phase) < 0) {
+        return 0;
+    }
+    return phases_config(r)->phase_times[AP_REQUEST_PHASE_COUNT + phase];
+}
+
+AP_DECLARE(const char *) ap_request_phase_name(ap_request_phase_e phase)
+{
+    if (phase < 0 || phase >= AP_REQUEST_PHASE_COUNT) {
+        return NULL;
+    }
+    return phase_names[phase];
+}
+
+static core_request_config *cpu_config(const request_rec *r)
+{
+    for (;;) {
+        if (r->prev) {
+            r = r->prev;
+        }
+        else if (r->main) {
+            r = r->main;
+        }
+        else {
+            break;
+        }
+    }
+    return r->request_config ? ap_get_core_module_config(r->request_config)
+                             : NULL;
+}
+
+AP_DECLARE(void) ap_request_cpu_enter(request_rec *r)
+{
+    core_request_config *req_cfg;
+
+    if (!ap_extended_status || !(req_cfg = cpu_config(r))) {
+        return;
+    }
+    if (req_cfg->cpu_depth++ == 0) {
+        req_cfg->cpu_start = ap_time_thread_cpu();
+        if (!req_cfg->cpu_handler) {
+            req_cfg->cpu_handler = r->handler ? r->handler : "";
+        }
+    }
+}
+
+AP_DECLARE(void) ap_request_cpu_leave(request_rec *r)
+{
+    core_request_config *req_cfg = cpu_config(r);
+
+    if (req_cfg && req_cfg->cpu_depth && --req_cfg->cpu_depth == 0
+            && req_cfg->cpu_start >= 0) {
+        apr_interval_time_t now = ap_time_thread_cpu();
+
+        if (now > req_cfg->cpu_start) {
+            req_cfg->cpu_time += now - req_cfg->cpu_start;
+        }
+    }
+}
+
+AP_DECLARE(apr_interval_time_t) ap_request_cpu_time(const request_rec *r,
+                                                    const char **handler)
+{
+    core_request_config *req_cfg = cpu_config(r);
+
+    if (!req_cfg || !req_cfg->cpu_handler || req_cfg->cpu_start < 0) {
+        return -1;
+    }
+    if (handler) {
+        *handler = req_cfg->cpu_handler;
+    }
+    return req_cfg->cpu_time;
+}
+
+AP_DECLARE(int) ap_request_phase_lookup(const char *name)
+{
+    int i;
+
+    for (i = 0; i < AP_REQUEST_PHASE_COUNT; ++i) {
+        if (!ap_cstr_casecmp(name, phase_names[i])) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* The running phase of ap_process_request_internal() */
+typedef struct {
+    request_rec *r;
+    ap_request_phase_e phase;
+    apr_time_t start;
+} phase_timer_t;
+
+static APR_INLINE void phase_timer_next(phase_timer_t *timer,
+                                        ap_request_phase_e next)
+{
+    if (timer->phase != next) {
+        timer->start = ap_request_phase_add(timer->r, timer->phase,
+                                            timer->start);
+        timer->phase = next;
+    }
+}
+
+static int process_request_phases(request_rec *r, phase_timer_t *timer);
+
 /* This is the master logic for processing requests.  Do NOT duplicate
  * this logic elsewhere, or the security model will be broken by future
  * API changes.  Each phase must be individually optimized to pick up
  * redundant/duplicate calls by subrequests, and redirects.
  */
 AP_DECLARE(int) ap_process_request_internal(request_rec *r)
+{
+    phase_timer_t timer;
+    int access_status;
+
+    timer.r = r;
+    timer.phase = AP_REQUEST_PHASE_TRANSLATE;
+    timer.start = ap_time_monotonic();
+
+    access_status = process_request_phases(r, &timer);
+
+    /* account for the last phase, whether it failed or not */
+    ap_request_phase_add(r, timer.phase, timer.start);
+    return access_status;
+}
+
+static int process_request_phases(request_rec *r, phase_timer_t *timer)
 {
     int access_status = DECLINED;
     int file_req = (r->main && r->filename);
@@ -284,6 +494,7 @@ AP_DECLARE(int) ap_process_request_internal(request_rec *r)
 
     /* Reset to the server default config prior to running map_to_storage
      */
+    phase_timer_next(timer, AP_REQUEST_PHASE_MAP_TO_STORAGE);
     r->per_dir_config = r->server->lookup_defaults;
 
     if ((access_status = ap_run_map_to_storage(r))) {
@@ -303,6 +514,7 @@ AP_DECLARE(int) ap_process_request_internal(request_rec *r)
 
     /* Only on the main request! */
     if (r->main == NULL) {
+        phase_timer_next(timer, AP_REQUEST_PHASE_HEADER_PARSER);
         if ((access_status = ap_run_header_parser(r))) {
             return access_status;
         }
@@ -330,6 +542,7 @@ AP_DECLARE(int) ap_process_request_internal(request_rec *r)
             r->user = NULL;
         }
 
+        phase_timer_next(timer, AP_REQUEST_PHASE_ACCESS);
         switch (ap_satisfies(r)) {
         case SATISFY_ALL:
         case SATISFY_NOSPEC:
@@ -341,6 +554,7 @@ AP_DECLARE(int) ap_process_request_internal(request_rec *r)
             access_status = ap_run_access_checker_ex(r);
             if (access_status == DECLINED
                 || (access_status == OK && ap_run_force_authn(r) == OK)) {
+                phase_timer_next(timer, AP_REQUEST_PHASE_AUTHN);
                 if ((access_status = ap_run_check_user_id(r)) != OK) {
                     return decl_die(access_status, "check user", r);
                 }
@@ -354,6 +568,7 @@ AP_DECLARE(int) ap_process_request_internal(request_rec *r)
                     access_status = HTTP_INTERNAL_SERVER_ERROR;
                     return decl_die(access_status, "check user", r);
                 }
+                phase_timer_next(timer, AP_REQUEST_PHASE_AUTHZ);
                 if ((access_status = ap_run_auth_checker(r)) != OK) {
                     return decl_die(access_status, "check authorization", r);
                 }
@@ -379,6 +594,7 @@ AP_DECLARE(int) ap_process_request_internal(request_rec *r)
             access_status = ap_run_access_checker_ex(r);
             if (access_status == DECLINED
                 || (access_status == OK && ap_run_force_authn(r) == OK)) {
+                phase_timer_next(timer, AP_REQUEST_PHASE_AUTHN);
                 if ((access_status = ap_run_check_user_id(r)) != OK) {
                     return decl_die(access_status, "check user", r);
                 }
@@ -392,6 +608,7 @@ AP_DECLARE(int) ap_process_request_internal(request_rec *r)
                     access_status = HTTP_INTERNAL_SERVER_ERROR;
                     return decl_die(access_status, "check user", r);
                 }
+                phase_timer_next(timer, AP_REQUEST_PHASE_AUTHZ);
                 if ((access_status = ap_run_auth_checker(r)) != OK) {
                     return decl_die(access_status, "check authorization", r);
                 }
@@ -411,10 +628,12 @@ AP_DECLARE(int) ap_process_request_internal(request_rec *r)
      * in mod-proxy for r->proxyreq && r->parsed_uri.scheme
      *                              && !strcmp(r->parsed_uri.scheme, "http")
      */
+    phase_timer_next(timer, AP_REQUEST_PHASE_TYPE);
     if ((access_status = ap_run_type_checker(r)) != OK) {
         return decl_die(access_status, "find types", r);
     }
 
+    phase_timer_next(timer, AP_REQUEST_PHASE_FIXUPS);
     if ((access_status = ap_run_fixups(r)) != OK) {
         ap_log_rerror(APLOG_MARK, APLOG_TRACE3, 0, r, "fixups hook gave %d: %s",
                       access_status, r->uri);
@@ -502,6 +721,324 @@ static walk_cache_t *prep_walk_cache(apr_size_t t, request_rec *r)
     return cache;
 }
 
+/*****************************************************************
+ *
+ * The child's cache of merged configuration sections.
+ *
+ * The walk cache above only helps between a request and its subrequests
+ * or redirects, every new request merges its sections again.  But merging
+ * two sections which both live as long as the configuration always gives
+ * the same result, so the result can be kept for the life of the child and
+ * used as an input of the next merge in turn.  Vectors allocated from a
+ * request (.htaccess sections and whatever was merged with them) never
+ * enter the cache.
+ *
+ * Entries can't be evicted, since requests running concurrently may hold
+ * any of them, so the cache simply stops growing once full and the merges
+ * happen in the request pool as before.  The cache dies with the child,
+ * hence with the configuration generation.
+ *
+ * The merges most requests need (each vhost's defaults with its sections
+ * and with the <Directory>s enclosing its DocumentRoot) are preloaded by
+ * the parent after post_config.  The children only read them, so they
+ * share those pages with the parent instead of each merging its own copy.
+ */
+
+typedef struct merge_cache_key {
+    const ap_conf_vector_t *base;
+    const ap_conf_vector_t *add;
+} merge_cache_key;
+
+static struct {
+    apr_pool_t *pool;
+    apr_hash_t *stable;  /* vectors living as long as the configuration */
+    apr_hash_t *merged;  /* merge_cache_key => merged vector */
+    int max;
+#if APR_HAS_THREADS
+    apr_thread_rwlock_t *lock;
+#endif
+} merge_cache;
+
+/* The merges done by the parent, read-only in the children */
+static struct {
+    apr_pool_t *pool;
+    apr_hash_t *stable;
+    apr_hash_t *merged;
+    int max;
+} merge_preload;
+
+static void merge_cache_set_stable(apr_pool_t *p, apr_hash_t *stable,
+                                   ap_conf_vector_t *conf)
+{
+    ap_conf_vector_t **key;
+
+    key = apr_pmemdup(p, &conf, sizeof(conf));
+    apr_hash_set(stable, key, sizeof(*key), conf);
+}
+
+static void merge_cache_add_stable(apr_pool_t *p, apr_hash_t *stable,
+                                   ap_conf_vector_t *conf)
+{
+    core_dir_config *dconf;
+    int i;
+
+    merge_cache_set_stable(p, stable, conf);
+
+    dconf = ap_get_core_module_config(conf);
+    if (dconf->sec_file) {
+        for (i = 0; i < dconf->sec_file->nelts; ++i) {
+            merge_cache_add_stable(p, stable,
+                                   APR_ARRAY_IDX(dconf->sec_file, i,
+                                                 ap_conf_vector_t *));
+        }
+    }
+    if (dconf->sec_if) {
+        for (i = 0; i < dconf->sec_if->nelts; ++i) {
+            merge_cache_add_stable(p, stable,
+                                   APR_ARRAY_IDX(dconf->sec_if, i,
+                                                 ap_conf_vector_t *));
+        }
+    }
+}
+
+/* Add the vectors of all the servers and their sections to stable */
+static void merge_cache_add_servers(apr_pool_t *p, apr_hash_t *stable,
+                                    server_rec *s)
+{
+    for (; s; s = s->next) {
+        core_server_config *sconf = ap_get_core_module_config(s->module_config);
+        int i;
+
+        merge_cache_add_stable(p, stable, s->lookup_defaults);
+        for (i = 0; i < sconf->sec_dir->nelts; ++i) {
+            merge_cache_add_stable(p, stable,
+                                   APR_ARRAY_IDX(sconf->sec_dir, i,
+                                                 ap_conf_vector_t *));
+        }
+        for (i = 0; i < sconf->sec_url->nelts; ++i) {
+            merge_cache_add_stable(p, stable,
+                                   APR_ARRAY_IDX(sconf->sec_url, i,
+                                                 ap_conf_vector_t *));
+        }
+    }
+}
+
+static apr_status_t merge_preload_cleanup(void *dummy)
+{
+    memset(&merge_preload, 0, sizeof(merge_preload));
+    return APR_SUCCESS;
+}
+
+/* Preload the merge of base and add, NULL if the preload is full */
+static ap_conf_vector_t *merge_preload_pair(ap_conf_vector_t *base,
+                                            ap_conf_vector_t *add)
+{
+    merge_cache_key key, *k;
+    ap_conf_vector_t *merged;
+
+    key.base = base;
+    key.add = add;
+    merged = apr_hash_get(merge_preload.merged, &key, sizeof(key));
+    if (merged) {
+        return merged;
+    }
+    if (apr_hash_count(merge_preload.merged) >= merge_preload.max) {
+        return NULL;
+    }
+
+    merged = ap_merge_per_dir_configs(merge_preload.pool, base, add);
+    k = apr_pmemdup(merge_preload.pool, &key, sizeof(key));
+    apr_hash_set(merge_preload.merged, k, sizeof(*k), merged);
+    merge_cache_set_stable(merge_preload.pool, merge_preload.stable, merged);
+
+    return merged;
+}
+
+AP_DECLARE(void) ap_preload_merge_cache(apr_pool_t *pconf,
+                                        apr_pool_t *ptemp,
+                                        server_rec *s, int max_entries)
+{
+    memset(&merge_preload, 0, sizeof(merge_preload));
+    if (max_entries <= 0) {
+        return;
+    }
+
+    apr_pool_create(&merge_preload.pool, pconf);
+    apr_pool_tag(merge_preload.pool, "merge_preload");
+    apr_pool_cleanup_register(merge_preload.pool, NULL,
+                              merge_preload_cleanup, apr_pool_cleanup_null);
+    merge_preload.stable = apr_hash_make(merge_preload.pool);
+    merge_preload.merged = apr_hash_make(merge_preload.pool);
+    merge_preload.max = max_entries;
+
+    merge_cache_add_servers(merge_preload.pool, merge_preload.stable, s);
+
+    for (; s; s = s->next) {
+        core_server_config *sconf = ap_get_core_module_config(s->module_config);
+        ap_conf_vector_t *dir_merged = NULL, *per_dir = s->lookup_defaults;
+        const char *root = NULL;
+        int i;
+
+        if (sconf->ap_document_root) {
+            root = apr_pstrcat(ptemp, sconf->ap_document_root, "/", NULL);
+        }
+
+        /* What the directory walk merges for the files of the DocumentRoot
+         * (the literal sections enclosing it, in the walk's order), unless
+         * a regex or wildcard section or an .htaccess is involved */
+        for (i = 0; root && i < sconf->sec_dir->nelts; ++i) {
+            ap_conf_vector_t *entry = APR_ARRAY_IDX(sconf->sec_dir, i,
+                                                    ap_conf_vector_t *);
+            core_dir_config *entry_core = ap_get_core_module_config(entry);
+
+            if (entry_core->r || entry_core->d_is_fnmatch || !entry_core->d
+                || strncmp(entry_core->d, root, strlen(entry_core->d))) {
+                continue;
+            }
+            dir_merged = dir_merged ? merge_preload_pair(dir_merged, entry)
+                                    : entry;
+            if (!dir_merged) {
+                break;
+            }
+        }
+        if (dir_merged) {
+            per_dir = merge_preload_pair(s->lookup_defaults, dir_merged);
+        }
+
+        /* Then a single <Location>, before and after the directory walk */
+        for (i = 0; i < sconf->sec_url->nelts; ++i) {
+            ap_conf_vector_t *entry = APR_ARRAY_IDX(sconf->sec_url, i,
+                                                    ap_conf_vector_t *);
+
+            if (!merge_preload_pair(s->lookup_defaults, entry)
+                || (per_dir && per_dir != s->lookup_defaults
+                    && !merge_preload_pair(per_dir, entry))) {
+                break;
+            }
+        }
+
+        if (apr_hash_count(merge_preload.merged) >= merge_preload.max) {
+            break;
+        }
+    }
+}
+
+AP_DECLARE(void) ap_init_merge_cache(apr_pool_t *pchild, server_rec *s,
+                                     int max_entries)
+{
+    merge_cache.max = 0;
+    if (max_entries <= 0) {
+        return;
+    }
+
+    apr_pool_create(&merge_cache.pool, pchild);
+    apr_pool_tag(merge_cache.pool, "merge_cache");
+    merge_cache.stable = apr_hash_make(merge_cache.pool);
+    merge_cache.merged = apr_hash_make(merge_cache.pool);
+#if APR_HAS_THREADS
+    {
+        int threaded_mpm;
+        merge_cache.lock = NULL;
+        if (ap_mpm_query(AP_MPMQ_IS_THREADED, &threaded_mpm) == APR_SUCCESS
+            && threaded_mpm
+            && apr_thread_rwlock_create(&merge_cache.lock,
+                                        merge_cache.pool) != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s, APLOGNO(10418)
+                         "can't create the configuration merge cache lock, "
+                         "the cache is disabled");
+            return;
+        }
+    }
+#endif
+
+    /* The configuration's vectors are known stable already when the
+     * parent preloaded the cache */
+    if (!merge_preload.stable) {
+        merge_cache_add_servers(merge_cache.pool, merge_cache.stable, s);
+    }
+
+    merge_cache.max = max_entries;
+}
+
+#if APR_HAS_THREADS
+#define merge_cache_rdlock() \
+    (merge_cache.lock ? apr_thread_rwlock_rdlock(merge_cache.lock) : 0)
+#define merge_cache_wrlock() \
+    (merge_cache.lock ? apr_thread_rwlock_wrlock(merge_cache.lock) : 0)
+#define merge_cache_unlock() \
+    (merge_cache.lock ? apr_thread_rwlock_unlock(merge_cache.lock) : 0)
+#else
+#define merge_cache_rdlock() 0
+#define merge_cache_wrlock() 0
+#define merge_cache_unlock() 0
+#endif
+
+static APR_INLINE int merge_cache_is_stable(const ap_conf_vector_t *conf)
+{
+    return (merge_preload.stable
+            && apr_hash_get(merge_preload.stable, &conf, sizeof(conf)))
+           || apr_hash_get(merge_cache.stable, &conf, sizeof(conf)) != NULL;
+}
+
+/* ap_merge_per_dir_configs() for the walks, through the merge cache */
+static ap_conf_vector_t *merge_walk_configs(request_rec *r,
+                                            ap_conf_vector_t *base,
+                                            ap_conf_vector_t *add)
+{
+    ap_conf_vector_t *merged;
+    merge_cache_key key;
+    int cacheable;
+
+    if (!merge_cache.max) {
+        return ap_merge_per_dir_configs(r->pool, base, add);
+    }
+
+    key.base = base;
+    key.add = add;
+
+    if (merge_preload.merged) {
+        merged = apr_hash_get(merge_preload.merged, &key, sizeof(key));
+        if (merged) {
+            return merged;
+        }
+    }
+
+    merge_cache_rdlock();
+    merged = apr_hash_get(merge_cache.merged, &key, sizeof(key));
+    cacheable = (!merged
+                 && apr_hash_count(merge_cache.merged) < merge_cache.max
+                 && merge_cache_is_stable(base)
+                 && merge_cache_is_stable(add));
+    merge_cache_unlock();
+
+    if (merged) {
+        return merged;
+    }
+    if (!cacheable) {
+        return ap_merge_per_dir_configs(r->pool, base, add);
+    }
+
+    merge_cache_wrlock();
+    merged = apr_hash_get(merge_cache.merged, &key, sizeof(key));
+    if (!merged && apr_hash_count(merge_cache.merged) < merge_cache.max) {
+        merge_cache_key *k = apr_pmemdup(merge_cache.pool, &key, sizeof(key));
+        ap_conf_vector_t **sk;
+
+        merged = ap_merge_per_dir_configs(merge_cache.pool, base, add);
+        apr_hash_set(merge_cache.merged, k, sizeof(*k), merged);
+
+        sk = apr_pmemdup(merge_cache.pool, &merged, sizeof(merged));
+        apr_hash_set(merge_cache.stable, sk, sizeof(*sk), merged);
+    }
+    merge_cache_unlock();
+
+    if (!merged) {
+        merged = ap_merge_per_dir_configs(r->pool, base, add);
+    }
+
+    return merged;
+}
+
 /*****************************************************************
  *
  * Getting and checking directory configuration.  Also checks the
@@ -1053,9 +1590,9 @@ AP_DECLARE(int) ap_directory_walk(request_rec *r)
                 }
 
                 if (now_merged) {
-                    now_merged = ap_merge_per_dir_configs(r->pool,
-                                                          now_merged,
-                                                          sec_ent[sec_idx]);
+                    now_merged = merge_walk_configs(r,
+                                                    now_merged,
+                                                    sec_ent[sec_idx]);
                 }
                 else {
                     now_merged = sec_ent[sec_idx];
@@ -1123,9 +1660,9 @@ AP_DECLARE(int) ap_directory_walk(request_rec *r)
                 }
 
                 if (now_merged) {
-                    now_merged = ap_merge_per_dir_configs(r->pool,
-                                                          now_merged,
-                                                          htaccess_conf);
+                    now_merged = merge_walk_configs(r,
+                                                    now_merged,
+                                                    htaccess_conf);
                 }
                 else {
                     now_merged = htaccess_conf;
@@ -1362,9 +1899,9 @@ AP_DECLARE(int) ap_directory_walk(request_rec *r)
             }
 
             if (now_merged) {
-                now_merged = ap_merge_per_dir_configs(r->pool,
-                                                      now_merged,
-                                                      sec_ent[sec_idx]);
+                now_merged = merge_walk_configs(r,
+                                                now_merged,
+                                                sec_ent[sec_idx]);
             }
             else {
                 now_merged = sec_ent[sec_idx];
@@ -1441,9 +1978,9 @@ AP_DECLARE(int) ap_directory_walk(request_rec *r)
      * and note the end result to (potentially) skip this step next time.
      */
     if (now_merged) {
-        r->per_dir_config = ap_merge_per_dir_configs(r->pool,
-                                                     r->per_dir_config,
-                                                     now_merged);
+        r->per_dir_config = merge_walk_configs(r,
+                                               r->per_dir_config,
+                                               now_merged);
     }
     cache->per_dir_result = r->per_dir_config;
 
@@ -1602,9 +2139,9 @@ AP_DECLARE(int) ap_location_walk(request_rec *r)
             }
 
             if (now_merged) {
-                now_merged = ap_merge_per_dir_configs(r->pool,
-                                                      now_merged,
-                                                      sec_ent[sec_idx]);
+                now_merged = merge_walk_configs(r,
+                                                now_merged,
+                                                sec_ent[sec_idx]);
             }
             else {
                 now_merged = sec_ent[sec_idx];
@@ -1645,9 +2182,9 @@ AP_DECLARE(int) ap_location_walk(request_rec *r)
      * and note the end result to (potentially) skip this step next time.
      */
     if (now_merged) {
-        r->per_dir_config = ap_merge_per_dir_configs(r->pool,
-                                                     r->per_dir_config,
-                                                     now_merged);
+        r->per_dir_config = merge_walk_configs(r,
+                                               r->per_dir_config,
+                                               now_merged);
     }
     cache->per_dir_result = r->per_dir_config;
 
@@ -1799,9 +2336,9 @@ AP_DECLARE(int) ap_file_walk(request_rec *r)
             }
 
             if (now_merged) {
-                now_merged = ap_merge_per_dir_configs(r->pool,
-                                                      now_merged,
-                                                      sec_ent[sec_idx]);
+                now_merged = merge_walk_configs(r,
+                                                now_merged,
+                                                sec_ent[sec_idx]);
             }
             else {
                 now_merged = sec_ent[sec_idx];
@@ -1842,9 +2379,9 @@ AP_DECLARE(int) ap_file_walk(request_rec *r)
      * and note the end result to (potentially) skip this step next time.
      */
     if (now_merged) {
-        r->per_dir_config = ap_merge_per_dir_configs(r->pool,
-                                                     r->per_dir_config,
-                                                     now_merged);
+        r->per_dir_config = merge_walk_configs(r,
+                                               r->per_dir_config,
+                                               now_merged);
     }
     cache->per_dir_result = r->per_dir_config;
 
@@ -1935,9 +2472,9 @@ static int ap_if_walk_sub(request_rec *r, core_dir_config* dconf)
         }
 
         if (now_merged) {
-            now_merged = ap_merge_per_dir_configs(r->pool,
-                                                  now_merged,
-                                                  sec_ent[sec_idx]);
+            now_merged = merge_walk_configs(r,
+                                            now_merged,
+                                            sec_ent[sec_idx]);
         }
         else {
             now_merged = sec_ent[sec_idx];
@@ -1973,9 +2510,9 @@ static int ap_if_walk_sub(request_rec *r, core_dir_config* dconf)
      * and note the end result to (potentially) skip this step next time.
      */
     if (now_merged) {
-        r->per_dir_config = ap_merge_per_dir_configs(r->pool,
-                                                     r->per_dir_config,
-                                                     now_merged);
+        r->per_dir_config = merge_walk_configs(r,
+                                               r->per_dir_config,
+                                               now_merged);
     }
     cache->per_dir_result = r->per_dir_config;
 
@@ -2369,16 +2906,17 @@ AP_DECLARE(request_rec *) ap_sub_req_lookup_dirent(const apr_finfo_t *dirent,
          */
         apr_status_t rv;
         if (ap_allow_options(rnew) & OPT_SYM_LINKS) {
-            if (((rv = apr_stat(&rnew->finfo, rnew->filename,
-                                APR_FINFO_MIN, rnew->pool)) != APR_SUCCESS)
+            if (((rv = ap_stat_cached(&rnew->finfo, rnew->filename,
+                                      APR_FINFO_MIN,
+                                      rnew->pool)) != APR_SUCCESS)
                 && (rv != APR_INCOMPLETE)) {
                 rnew->finfo.filetype = APR_NOFILE;
             }
         }
         else {
-            if (((rv = apr_stat(&rnew->finfo, rnew->filename,
-                                APR_FINFO_LINK | APR_FINFO_MIN,
-                                rnew->pool)) != APR_SUCCESS)
+            if (((rv = ap_stat_cached(&rnew->finfo, rnew->filename,
+                                      APR_FINFO_LINK | APR_FINFO_MIN,
+                                      rnew->pool)) != APR_SUCCESS)
                 && (rv != APR_INCOMPLETE)) {
                 rnew->finfo.filetype = APR_NOFILE;
             }
@@ -2475,16 +3013,17 @@ AP_DECLARE(request_rec *) ap_sub_req_lookup_file(const char *new_file,
         && ap_strchr_c(rnew->filename + fdirlen, '/') == NULL) {
         apr_status_t rv;
         if (ap_allow_options(rnew) & OPT_SYM_LINKS) {
-            if (((rv = apr_stat(&rnew->finfo, rnew->filename,
-                                APR_FINFO_MIN, rnew->pool)) != APR_SUCCESS)
+            if (((rv = ap_stat_cached(&rnew->finfo, rnew->filename,
+                                      APR_FINFO_MIN,
+                                      rnew->pool)) != APR_SUCCESS)
                 && (rv != APR_INCOMPLETE)) {
                 rnew->finfo.filetype = APR_NOFILE;
             }
         }
         else {
-            if (((rv = apr_stat(&rnew->finfo, rnew->filename,
-                                APR_FINFO_LINK | APR_FINFO_MIN,
-                                rnew->pool)) != APR_SUCCESS)
+            if (((rv = ap_stat_cached(&rnew->finfo, rnew->filename,
+                                      APR_FINFO_LINK | APR_FINFO_MIN,
+                                      rnew->pool)) != APR_SUCCESS)
                 && (rv != APR_INCOMPLETE)) {
                 rnew->finfo.filetype = APR_NOFILE;
             }
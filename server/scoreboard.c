@@ -18,6 +18,7 @@
 #include "apr_strings.h"
 #include "apr_portable.h"
 #include "apr_lib.h"
+#include "apr_atomic.h"
 
 #define APR_WANT_STRFUNC
 #include "apr_want.h"
@@ -60,13 +61,25 @@ const char * ap_set_scoreboard(cmd_parms *cmd, void *dummy,
 /* Default to false when mod_status is not loaded */
 AP_DECLARE_DATA int ap_extended_status = 0;
 
-const char *ap_set_extended_status(cmd_parms *cmd, void *dummy, int arg)
+const char *ap_set_extended_status(cmd_parms *cmd, void *dummy,
+                                   const char *arg)
 {
     const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
     if (err != NULL) {
         return err;
     }
-    ap_extended_status = arg;
+    if (!strcasecmp(arg, "On")) {
+        ap_extended_status = 1;
+    }
+    else if (!strcasecmp(arg, "Off")) {
+        ap_extended_status = 0;
+    }
+    else if (!strcasecmp(arg, "Lazy")) {
+        ap_extended_status = AP_EXTENDED_STATUS_LAZY;
+    }
+    else {
+        return "ExtendedStatus must be On, Off or Lazy";
+    }
     return NULL;
 }
 
@@ -135,13 +148,19 @@ static apr_status_t ap_cleanup_shared_mem(void *d)
 #define SIZE_OF_process_score APR_ALIGN_DEFAULT(sizeof(process_score))
 #define SIZE_OF_worker_score  APR_ALIGN_DEFAULT(sizeof(worker_score))
 
+/* The workers start on a cache line of their own, after the global and
+ * process scores written by the parent and the async MPMs children
+ */
+#define SIZE_OF_sb_header \
+    APR_ALIGN(SIZE_OF_global_score + SIZE_OF_process_score * server_limit, \
+              AP_SB_CACHELINE_SIZE)
+
 AP_DECLARE(int) ap_calc_scoreboard_size(void)
 {
     ap_mpm_query(AP_MPMQ_HARD_LIMIT_THREADS, &thread_limit);
     ap_mpm_query(AP_MPMQ_HARD_LIMIT_DAEMONS, &server_limit);
 
-    scoreboard_size  = SIZE_OF_global_score;
-    scoreboard_size += SIZE_OF_process_score * server_limit;
+    scoreboard_size  = SIZE_OF_sb_header;
     scoreboard_size += SIZE_OF_worker_score * server_limit * thread_limit;
 
     return scoreboard_size;
@@ -164,7 +183,7 @@ AP_DECLARE(void) ap_init_scoreboard(void *shared_score)
     ap_scoreboard_image->global = (global_score *)more_storage;
     more_storage += SIZE_OF_global_score;
     ap_scoreboard_image->parent = (process_score *)more_storage;
-    more_storage += SIZE_OF_process_score * server_limit;
+    more_storage = (char *)shared_score + SIZE_OF_sb_header;
     ap_scoreboard_image->servers =
         (worker_score **)((char*)ap_scoreboard_image + SIZE_OF_scoreboard);
     for (i = 0; i < server_limit; i++) {
@@ -197,6 +216,8 @@ static apr_status_t create_namebased_scoreboard(apr_pool_t *pool,
                      "(name-based shared memory failure)", fname);
         return rv;
     }
+    ap_shm_advise(apr_shm_baseaddr_get(ap_scoreboard_shm),
+                  apr_shm_size_get(ap_scoreboard_shm));
 #endif /* APR_HAS_SHARED_MEMORY */
     return APR_SUCCESS;
 }
@@ -245,6 +266,8 @@ static apr_status_t open_scoreboard(apr_pool_t *pconf)
 
             return create_namebased_scoreboard(global_pool, fname);
         }
+        ap_shm_advise(apr_shm_baseaddr_get(ap_scoreboard_shm),
+                      apr_shm_size_get(ap_scoreboard_shm));
     }
 #endif /* APR_HAS_SHARED_MEMORY */
     return APR_SUCCESS;
@@ -373,6 +396,7 @@ AP_DECLARE(void) ap_increment_counts(ap_sb_handle_t *sb, request_rec *r)
 {
     worker_score *ws;
     apr_off_t bytes;
+    int i;
 
     if (!sb)
         return;
@@ -391,12 +415,21 @@ AP_DECLARE(void) ap_increment_counts(ap_sb_handle_t *sb, request_rec *r)
 #ifdef HAVE_TIMES
     times(&ws->times);
 #endif
+    ap_sb_hist_add(&ws->bytes_hist, bytes > 0 ? (apr_uint64_t)bytes : 0);
     ws->access_count++;
     ws->my_access_count++;
     ws->conn_count++;
     ws->bytes_served += bytes;
     ws->my_bytes_served += bytes;
     ws->conn_bytes += bytes;
+
+    for (i = 0; i < AP_REQUEST_PHASE_COUNT; ++i) {
+        apr_interval_time_t t = ap_request_phase_time(r, i);
+        if (t >= 0) {
+            ws->phase_time[i] += t;
+            ws->phase_count[i]++;
+        }
+    }
 }
 
 AP_DECLARE(int) ap_find_child_by_pid(apr_proc_t *pid)
@@ -519,6 +552,13 @@ static int update_child_status_internal(int child_num,
             ws->last_used = apr_time_now();
         }
 
+        if (ap_extended_status == AP_EXTENDED_STATUS_LAZY
+            && apr_time_now() - ap_scoreboard_image->global->status_time
+               > AP_SB_LAZY_STATUS_WINDOW) {
+            /* nobody is looking */
+            return old_status;
+        }
+
         if (descr) {
             apr_cpystrn(ws->request, descr, sizeof(ws->request));
         }
@@ -651,7 +691,133 @@ AP_DECLARE(void) ap_time_process_request(ap_sb_handle_t *sbh, int status)
         if (ap_extended_status) {
             ws->duration += ws->stop_time - ws->start_time;
         }
+        if (ws->stop_time > ws->start_time) {
+            ap_sb_hist_add(&ws->req_time_hist,
+                           ws->stop_time - ws->start_time);
+        }
+    }
+}
+
+#define SB_HIST_SUB_BUCKETS (1 << AP_SB_HIST_SUB_BITS)
+
+static int sb_hist_bucket(apr_uint64_t value)
+{
+    int msb = 0, bucket;
+
+    if (value < 2 * SB_HIST_SUB_BUCKETS) {
+        return (int)value;
+    }
+    while (value >> (msb + 1)) {
+        msb++;
+    }
+    bucket = (msb - AP_SB_HIST_SUB_BITS + 1) * SB_HIST_SUB_BUCKETS
+             + (int)((value >> (msb - AP_SB_HIST_SUB_BITS))
+                     & (SB_HIST_SUB_BUCKETS - 1));
+    return bucket < AP_SB_HIST_BUCKETS ? bucket : AP_SB_HIST_BUCKETS - 1;
+}
+
+/* The largest value counted in the bucket */
+static apr_uint64_t sb_hist_bucket_max(int bucket)
+{
+    int shift, sub;
+
+    if (bucket < 2 * SB_HIST_SUB_BUCKETS) {
+        return bucket;
+    }
+    shift = bucket / SB_HIST_SUB_BUCKETS - 1;
+    sub = bucket % SB_HIST_SUB_BUCKETS;
+    return ((apr_uint64_t)(SB_HIST_SUB_BUCKETS + sub + 1) << shift) - 1;
+}
+
+AP_DECLARE(void) ap_sb_hist_add(ap_sb_histogram *hist, apr_uint64_t value)
+{
+    hist->count[sb_hist_bucket(value)]++;
+}
+
+AP_DECLARE(apr_uint64_t) ap_sb_hist_percentile(const ap_sb_histogram *hist,
+                                               double fraction)
+{
+    apr_uint64_t total = 0, rank, seen = 0;
+    int i;
+
+    for (i = 0; i < AP_SB_HIST_BUCKETS; i++) {
+        total += hist->count[i];
+    }
+    if (!total) {
+        return 0;
+    }
+    rank = (apr_uint64_t)(fraction * (double)total + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+    for (i = 0; i < AP_SB_HIST_BUCKETS; i++) {
+        seen += hist->count[i];
+        if (seen >= rank) {
+            break;
+        }
+    }
+    return sb_hist_bucket_max(i < AP_SB_HIST_BUCKETS ? i
+                                                     : AP_SB_HIST_BUCKETS - 1);
+}
+
+/* How often ap_sb_busy_percent() walks the scoreboard */
+#define SB_BUSY_INTERVAL apr_time_from_msec(100)
+
+static apr_uint32_t sb_busy_percent;
+static apr_uint32_t sb_busy_stamp;
+
+AP_DECLARE(int) ap_sb_busy_percent(void)
+{
+    apr_uint32_t stamp, busy = 0, total;
+    int max_daemons = 0, max_threads = 0;
+    int i, j;
+
+    if (ap_scoreboard_image == NULL) {
+        return 0;
+    }
+
+    /* One caller per interval refreshes the value, the others (and the
+     * concurrent ones) get the previous one.
+     */
+    stamp = (apr_uint32_t)(apr_time_now() / SB_BUSY_INTERVAL);
+    if (apr_atomic_read32(&sb_busy_stamp) == stamp
+        || apr_atomic_xchg32(&sb_busy_stamp, stamp) == stamp) {
+        return (int)apr_atomic_read32(&sb_busy_percent);
+    }
+
+    ap_mpm_query(AP_MPMQ_MAX_DAEMONS, &max_daemons);
+    ap_mpm_query(AP_MPMQ_MAX_THREADS, &max_threads);
+    if (max_daemons <= 0 || max_daemons > server_limit) {
+        max_daemons = server_limit;
+    }
+    if (max_threads <= 0 || max_threads > thread_limit) {
+        max_threads = thread_limit;
+    }
+    total = (apr_uint32_t)max_daemons * (apr_uint32_t)max_threads;
+
+    for (i = 0; i < server_limit; i++) {
+        process_score *ps = &ap_scoreboard_image->parent[i];
+
+        if (!ps->pid || ps->quiescing) {
+            continue;
+        }
+        for (j = 0; j < thread_limit; j++) {
+            switch (ap_scoreboard_image->servers[i][j].status) {
+            case SERVER_DEAD:
+            case SERVER_STARTING:
+            case SERVER_READY:
+            case SERVER_IDLE_KILL:
+                break;
+            default:
+                busy++;
+                break;
+            }
+        }
     }
+
+    busy = total ? (busy >= total ? 100 : busy * 100 / total) : 0;
+    apr_atomic_set32(&sb_busy_percent, busy);
+    return (int)busy;
 }
 
 AP_DECLARE(int) ap_update_global_status()
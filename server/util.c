@@ -67,6 +67,9 @@
 #ifdef HAVE_SYS_LOADAVG_H
 #include <sys/loadavg.h>
 #endif
+#if APR_HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
 
 #include "ap_mpm.h"
 #include "mpm_common.h"         /* for ap_max_mem_free */
@@ -1671,6 +1674,50 @@ AP_DECLARE(const char *) ap_scan_http_field_content(const char *ptr)
     return ptr;
 }
 
+#if !APR_CHARSET_EBCDIC
+/* Word at a time (SWAR) tests, nonzero if any byte of the 64bit word
+ * is below n (n <= 0x80, bytes from 0x80 never match), or equals c.
+ */
+#define SWAR_ONES           (~(apr_uint64_t)0 / 255)
+#define SWAR_HIGHS          (SWAR_ONES * 0x80)
+#define SWAR_HAS_LESS(x, n) (((x) - SWAR_ONES * (n)) & ~(x) & SWAR_HIGHS)
+#define SWAR_HAS_BYTE(x, c) ((((x) ^ (SWAR_ONES * (c))) - SWAR_ONES) \
+                             & ~((x) ^ (SWAR_ONES * (c))) & SWAR_HIGHS)
+#endif
+
+/* Scan len bytes for HTTP field content, as ap_scan_http_field_content()
+ * but without relying on a NUL terminator, returning the offset of the
+ * first non-HT ASCII ctrl character or len.
+ */
+AP_DECLARE(apr_size_t) ap_scan_http_field_content_len(const char *ptr,
+                                                      apr_size_t len)
+{
+    apr_size_t i = 0;
+
+#if !APR_CHARSET_EBCDIC
+    /* Skip valid bytes eight at a time, a word with any C0 ctrl (HT
+     * included) or DEL is left to the table.
+     */
+    for ( ; i + 8 <= len; i += 8) {
+        apr_uint64_t w;
+
+        memcpy(&w, ptr + i, 8);
+        if (SWAR_HAS_LESS(w, 0x20) || SWAR_HAS_BYTE(w, 0x7F)) {
+            apr_size_t end = i + 8;
+            for ( ; i < end; ++i) {
+                if (TEST_CHAR(ptr[i], T_HTTP_CTRLS)) {
+                    return i;
+                }
+            }
+            i -= 8;
+        }
+    }
+#endif
+    for ( ; i < len && !TEST_CHAR(ptr[i], T_HTTP_CTRLS); ++i) ;
+
+    return i;
+}
+
 /* Scan a string for HTTP token characters, returning the pointer to
  * the first non-token character.
  */
@@ -1910,7 +1957,12 @@ static int unescape_url(char *url, const char *forbid, const char *reserved,
     }
     for (x = y; *y; ++x, ++y) {
         if (*y != '%') {
-            *x = *y;
+            /* move the run up to the next '%' at once */
+            const char *z = strchr(y, '%');
+            apr_size_t n = z ? (apr_size_t)(z - y) : strlen(y);
+            memmove(x, y, n);
+            x += n - 1;
+            y += n - 1;
         }
         else {
             if (!apr_isxdigit(*(y + 1)) || !apr_isxdigit(*(y + 2))) {
@@ -2048,6 +2100,110 @@ static APR_INLINE unsigned char *c2x(unsigned what, unsigned char prefix,
     return where;
 }
 
+/*
+ * The escaping functions below copy the runs of characters which need no
+ * escaping at once, finding their end with span_plain(). With SSE2 (the
+ * baseline of x86_64, so no runtime dispatch is needed), 16 characters are
+ * classified at a time, from aligned loads which can't cross the page
+ * of the terminating NUL; elsewhere the test_char table is used.
+ */
+#define SPAN_LOGITEM        0   /* !T_ESCAPE_LOGITEM */
+#define SPAN_PATH_SEGMENT   1   /* !T_ESCAPE_PATH_SEGMENT */
+#define SPAN_HTML           2   /* ap_escape_html2(), toasc = 0 */
+#define SPAN_HTML_ASCII     3   /* ap_escape_html2(), toasc = 1 */
+
+#if defined(__SSE2__) && defined(__GNUC__) && !APR_CHARSET_EBCDIC
+#include <emmintrin.h>
+
+/* 0xff where lo <= c <= hi, for hi < 0x80 */
+#define SSE2_IN_RANGE(v, lo, hi) \
+    _mm_andnot_si128(_mm_cmplt_epi8((v), _mm_set1_epi8(lo)), \
+                     _mm_cmplt_epi8((v), _mm_set1_epi8((hi) + 1)))
+#define SSE2_EQ(v, c) _mm_cmpeq_epi8((v), _mm_set1_epi8(c))
+
+/* The bits of the characters of v which need no escaping (never NUL) */
+static APR_INLINE unsigned int sse2_plain(__m128i v, int what)
+{
+    __m128i plain, special;
+
+    switch (what) {
+    case SPAN_LOGITEM:
+        /* 0x20..0x7e (signed, so the high bit fails) but " and \ */
+        plain = _mm_andnot_si128(SSE2_EQ(v, 0x7f),
+                                 _mm_cmpgt_epi8(v, _mm_set1_epi8(0x1f)));
+        special = _mm_or_si128(SSE2_EQ(v, '"'), SSE2_EQ(v, '\\'));
+        return _mm_movemask_epi8(_mm_andnot_si128(special, plain));
+
+    case SPAN_PATH_SEGMENT:
+        /* alnum and $-_.+!*'(),:@&=~ */
+        plain = _mm_or_si128(_mm_or_si128(SSE2_IN_RANGE(v, '0', '9'),
+                                          SSE2_IN_RANGE(v, 'A', 'Z')),
+                             _mm_or_si128(SSE2_IN_RANGE(v, 'a', 'z'),
+                                          SSE2_IN_RANGE(v, '&', '.')));
+        special = _mm_or_si128(_mm_or_si128(SSE2_EQ(v, '!'), SSE2_EQ(v, '$')),
+                               _mm_or_si128(SSE2_EQ(v, ':'), SSE2_EQ(v, '=')));
+        special = _mm_or_si128(special,
+                               _mm_or_si128(SSE2_EQ(v, '@'), SSE2_EQ(v, '_')));
+        special = _mm_or_si128(special, SSE2_EQ(v, '~'));
+        return _mm_movemask_epi8(_mm_or_si128(plain, special));
+
+    default:
+        /* not NUL, <, >, & or ", and for SPAN_HTML_ASCII not 8-bit */
+        special = _mm_or_si128(_mm_or_si128(SSE2_EQ(v, '<'), SSE2_EQ(v, '>')),
+                               _mm_or_si128(SSE2_EQ(v, '&'), SSE2_EQ(v, '"')));
+        special = _mm_or_si128(special, SSE2_EQ(v, 0));
+        if (what == SPAN_HTML_ASCII) {
+            special = _mm_or_si128(special,
+                                   _mm_cmplt_epi8(v, _mm_setzero_si128()));
+        }
+        return ~_mm_movemask_epi8(special) & 0xffff;
+    }
+}
+
+static APR_INLINE apr_size_t span_plain(const unsigned char *s, int what)
+{
+    const unsigned char *p = (const unsigned char *)
+                             ((apr_uintptr_t)s & ~(apr_uintptr_t)15);
+    unsigned int stop;
+
+    stop = ~sse2_plain(_mm_load_si128((const __m128i *)p), what) & 0xffff;
+    stop &= 0xffffu << (s - p);
+    while (!stop) {
+        p += 16;
+        stop = ~sse2_plain(_mm_load_si128((const __m128i *)p), what) & 0xffff;
+    }
+    return p + __builtin_ctz(stop) - s;
+}
+
+#else /* __SSE2__ */
+
+static APR_INLINE apr_size_t span_plain(const unsigned char *s, int what)
+{
+    const unsigned char *p = s;
+
+    switch (what) {
+    case SPAN_LOGITEM:
+        while (*p && !TEST_CHAR(*p, T_ESCAPE_LOGITEM)) {
+            ++p;
+        }
+        break;
+    case SPAN_PATH_SEGMENT:
+        while (*p && !TEST_CHAR(*p, T_ESCAPE_PATH_SEGMENT)) {
+            ++p;
+        }
+        break;
+    default:
+        while (*p && *p != '<' && *p != '>' && *p != '&' && *p != '"'
+               && (what != SPAN_HTML_ASCII || apr_isascii(*p))) {
+            ++p;
+        }
+        break;
+    }
+    return p - s;
+}
+
+#endif /* __SSE2__ */
+
 /*
  * escape_path_segment() escapes a path segment, as defined in RFC 1808. This
  * routine is (should be) OS independent.
@@ -2067,16 +2223,17 @@ AP_DECLARE(char *) ap_escape_path_segment_buffer(char *copy, const char *segment
 {
     const unsigned char *s = (const unsigned char *)segment;
     unsigned char *d = (unsigned char *)copy;
-    unsigned c;
+    apr_size_t n;
 
-    while ((c = *s)) {
-        if (TEST_CHAR(c, T_ESCAPE_PATH_SEGMENT)) {
-            d = c2x(c, '%', d);
-        }
-        else {
-            *d++ = c;
+    for (;;) {
+        n = span_plain(s, SPAN_PATH_SEGMENT);
+        memcpy(d, s, n);
+        d += n;
+        s += n;
+        if (!*s) {
+            break;
         }
-        ++s;
+        d = c2x(*s++, '%', d);
     }
     *d = '\0';
     return copy;
@@ -2151,11 +2308,16 @@ AP_DECLARE(char *) ap_escape_urlencoded(apr_pool_t *p, const char *buffer)
 
 AP_DECLARE(char *) ap_escape_html2(apr_pool_t *p, const char *s, int toasc)
 {
-    apr_size_t i, j;
+    const int what = toasc ? SPAN_HTML_ASCII : SPAN_HTML;
+    apr_size_t i, j, n;
     char *x;
 
     /* first, count the number of extra characters */
-    for (i = 0, j = 0; s[i] != '\0'; i++) {
+    for (i = 0, j = 0; ; i++) {
+        i += span_plain((const unsigned char *)s + i, what);
+        if (s[i] == '\0') {
+            break;
+        }
         if (i + j > APR_SIZE_MAX - 6) {
             abort();
         }
@@ -2163,17 +2325,24 @@ AP_DECLARE(char *) ap_escape_html2(apr_pool_t *p, const char *s, int toasc)
             j += 3;
         else if (s[i] == '&')
             j += 4;
-        else if (s[i] == '"')
-            j += 5;
-        else if (toasc && !apr_isascii(s[i]))
+        else /* '"' or !apr_isascii() */
             j += 5;
     }
 
     if (j == 0)
         return apr_pstrmemdup(p, s, i);
+    if (i + j > APR_SIZE_MAX - 1) {
+        abort();
+    }
 
     x = apr_palloc(p, i + j + 1);
-    for (i = 0, j = 0; s[i] != '\0'; i++, j++)
+    for (i = 0, j = 0; ; i++, j++) {
+        n = span_plain((const unsigned char *)s + i, what);
+        memcpy(&x[j], &s[i], n);
+        i += n;
+        j += n;
+        if (s[i] == '\0')
+            break;
         if (s[i] == '<') {
             memcpy(&x[j], "&lt;", 4);
             j += 3;
@@ -2190,13 +2359,17 @@ AP_DECLARE(char *) ap_escape_html2(apr_pool_t *p, const char *s, int toasc)
             memcpy(&x[j], "&quot;", 6);
             j += 5;
         }
-        else if (toasc && !apr_isascii(s[i])) {
-            char *esc = apr_psprintf(p, "&#%3.3d;", (unsigned char)s[i]);
-            memcpy(&x[j], esc, 6);
-            j += 5;
+        else {
+            /* "&#%3.3d;" of a character above 127 */
+            unsigned char c = s[i];
+            x[j++] = '&';
+            x[j++] = '#';
+            x[j++] = '0' + c / 100;
+            x[j++] = '0' + c / 10 % 10;
+            x[j++] = '0' + c % 10;
+            x[j] = ';';
         }
-        else
-            x[j] = s[i];
+    }
 
     x[j] = '\0';
     return x;
@@ -2214,10 +2387,13 @@ AP_DECLARE(char *) ap_escape_logitem(apr_pool_t *p, const char *str)
 
     /* Compute how many characters need to be escaped */
     s = (const unsigned char *)str;
-    for (; *s; ++s) {
-        if (TEST_CHAR(*s, T_ESCAPE_LOGITEM)) {
-            escapes++;
+    for (;;) {
+        s += span_plain(s, SPAN_LOGITEM);
+        if (!*s) {
+            break;
         }
+        escapes++;
+        ++s;
     }
     
     /* Compute the length of the input string, including NULL */
@@ -2232,37 +2408,40 @@ AP_DECLARE(char *) ap_escape_logitem(apr_pool_t *p, const char *str)
     ret = apr_palloc(p, length + 3 * escapes);
     d = (unsigned char *)ret;
     s = (const unsigned char *)str;
-    for (; *s; ++s) {
-        if (TEST_CHAR(*s, T_ESCAPE_LOGITEM)) {
-            *d++ = '\\';
-            switch(*s) {
-            case '\b':
-                *d++ = 'b';
-                break;
-            case '\n':
-                *d++ = 'n';
-                break;
-            case '\r':
-                *d++ = 'r';
-                break;
-            case '\t':
-                *d++ = 't';
-                break;
-            case '\v':
-                *d++ = 'v';
-                break;
-            case '\\':
-            case '"':
-                *d++ = *s;
-                break;
-            default:
-                c2x(*s, 'x', d);
-                d += 3;
-            }
+    for (;;) {
+        apr_size_t n = span_plain(s, SPAN_LOGITEM);
+        memcpy(d, s, n);
+        d += n;
+        s += n;
+        if (!*s) {
+            break;
         }
-        else {
+        *d++ = '\\';
+        switch(*s) {
+        case '\b':
+            *d++ = 'b';
+            break;
+        case '\n':
+            *d++ = 'n';
+            break;
+        case '\r':
+            *d++ = 'r';
+            break;
+        case '\t':
+            *d++ = 't';
+            break;
+        case '\v':
+            *d++ = 'v';
+            break;
+        case '\\':
+        case '"':
             *d++ = *s;
+            break;
+        default:
+            c2x(*s, 'x', d);
+            d += 3;
         }
+        ++s;
     }
     *d = '\0';
 
@@ -2798,8 +2977,8 @@ AP_DECLARE(int) ap_request_has_body(request_rec *r)
 
     return (!r->header_only
             && (r->kept_body
-                || apr_table_get(r->headers_in, "Transfer-Encoding")
-                || ((cls = apr_table_get(r->headers_in, "Content-Length"))
+                || ap_get_request_header(r, AP_HDR_TRANSFER_ENCODING)
+                || ((cls = ap_get_request_header(r, AP_HDR_CONTENT_LENGTH))
                     && ap_parse_strict_length(&cl, cls) && cl > 0)));
 }
 
@@ -2913,7 +3092,7 @@ AP_DECLARE(int) ap_parse_form_data(request_rec *r, ap_filter_t *f,
     *ptr = pairs;
 
     /* sanity check - we only support forms for now */
-    ct = apr_table_get(r->headers_in, "Content-Type");
+    ct = ap_get_request_header(r, AP_HDR_CONTENT_TYPE);
     if (!ct || ap_cstr_casecmpn("application/x-www-form-urlencoded", ct, 33)) {
         return ap_discard_request_body(r);
     }
@@ -3284,6 +3463,62 @@ AP_DECLARE(void *) ap_realloc(void *ptr, size_t size)
     return p;
 }
 
+static int shm_flags = 0;
+
+AP_DECLARE(void) ap_shm_set_flags(int flags)
+{
+    shm_flags = flags;
+}
+
+AP_DECLARE(void) ap_shm_advise(void *base, apr_size_t size)
+{
+    apr_size_t pagesize = 4096, off;
+    char *start, *end;
+
+    if (!shm_flags || !base || !size) {
+        return;
+    }
+#if defined(_SC_PAGESIZE)
+    {
+        long n = sysconf(_SC_PAGESIZE);
+        if (n > 0) {
+            pagesize = n;
+        }
+    }
+#endif
+    /* madvise() wants whole pages, the segment's data may not
+     * start at its mapping
+     */
+    start = (char *)(((apr_uintptr_t)base + pagesize - 1) & ~(pagesize - 1));
+    end = (char *)(((apr_uintptr_t)base + size) & ~(pagesize - 1));
+
+#ifdef MADV_HUGEPAGE
+    if ((shm_flags & AP_SHM_HUGEPAGES) && start < end
+        && madvise(start, end - start, MADV_HUGEPAGE) != 0) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, errno, ap_server_conf,
+                     APLOGNO(10585) "SharedMemoryOptions: huge pages not "
+                     "available for a segment of %" APR_SIZE_T_FMT " bytes",
+                     size);
+    }
+#endif
+
+    if (shm_flags & AP_SHM_PREFAULT) {
+#ifdef MADV_POPULATE_WRITE
+        if (start < end
+            && madvise(start, end - start, MADV_POPULATE_WRITE) == 0) {
+            return;
+        }
+#endif
+        /* Nothing else uses the segment yet, write each page
+         * with what it holds
+         */
+        for (off = 0; off < size; off += pagesize) {
+            volatile char *c = (char *)base + off;
+            *c = *c;
+        }
+    }
+}
+
 #if APR_HAS_THREADS
 
 #if AP_HAS_THREAD_LOCAL && !APR_VERSION_AT_LEAST(1,8,0)
@@ -35,6 +35,13 @@
 #include "apr_mmap.h"
 #endif /* APR_HAS_MMAP */
 
+#if defined(__linux__) && defined(HAVE_SYS_XATTR_H) \
+    && defined(HAVE_FGETXATTR) && defined(HAVE_FSETXATTR)
+#include "apr_portable.h"       /* for apr_os_file_get() */
+#include <sys/xattr.h>
+#define ETAG_DIGEST_XATTR 1
+#endif
+
 #define SHA1_DIGEST_BASE64_LEN 4*(APR_SHA1_DIGESTSIZE/3)
 
 /* Generate the human-readable hex representation of an apr_uint64_t
@@ -88,6 +95,96 @@ static void etag_end(char *next, const char *vlv, apr_size_t vlv_len)
     }
 }
 
+#ifdef ETAG_DIGEST_XATTR
+/*
+ * With FileETagDigestCache XAttr, the digest is kept in an extended
+ * attribute of the file along with the mtime, size and inode of the file
+ * it was computed for, and used as long as they match. The record is in
+ * the native byte order: one written by another architecture mismatches,
+ * and is replaced.
+ */
+#define ETAG_XATTR_NAME "user.httpd.etag.sha1"
+#define ETAG_XATTR_VERSION 1
+
+typedef struct etag_xattr_t {
+    apr_uint32_t version;
+    apr_uint32_t reserved;
+    apr_int64_t mtime;
+    apr_int64_t size;
+    apr_uint64_t inode;
+    unsigned char digest[APR_SHA1_DIGESTSIZE];
+} etag_xattr_t;
+
+#define ETAG_XATTR_FINFO (APR_FINFO_MTIME | APR_FINFO_SIZE | APR_FINFO_INODE)
+
+static int etag_xattr_usable(request_rec *r, etag_rec *er)
+{
+    core_dir_config *cfg;
+
+    cfg = (core_dir_config *)ap_get_core_module_config(r->per_dir_config);
+    if (cfg->etag_digest_cache != ETAG_DIGEST_CACHE_XATTR) {
+        return 0;
+    }
+
+    /* A file modified during the last second may still be written to, and
+     * then modified again without its mtime changing (see the weak ETags
+     * below).
+     */
+    return (er->finfo->valid & ETAG_XATTR_FINFO) == ETAG_XATTR_FINFO
+           && er->request_time - er->finfo->mtime >= APR_USEC_PER_SEC;
+}
+
+static void etag_xattr_record(etag_xattr_t *rec, const apr_finfo_t *finfo)
+{
+    memset(rec, 0, sizeof(*rec));
+    rec->version = ETAG_XATTR_VERSION;
+    rec->mtime = finfo->mtime;
+    rec->size = finfo->size;
+    rec->inode = finfo->inode;
+}
+
+static int etag_xattr_get(request_rec *r, etag_rec *er, apr_file_t *fd,
+                          unsigned char *digest)
+{
+    apr_os_file_t osfd;
+    etag_xattr_t rec, stored;
+
+    if (apr_os_file_get(&osfd, fd) != APR_SUCCESS
+            || fgetxattr(osfd, ETAG_XATTR_NAME, &stored, sizeof(stored))
+               != sizeof(stored)) {
+        return 0;
+    }
+
+    etag_xattr_record(&rec, er->finfo);
+    if (memcmp(&rec, &stored, APR_OFFSETOF(etag_xattr_t, digest))) {
+        return 0;
+    }
+
+    memcpy(digest, stored.digest, APR_SHA1_DIGESTSIZE);
+    return 1;
+}
+
+static void etag_xattr_set(request_rec *r, etag_rec *er, apr_file_t *fd,
+                           const unsigned char *digest)
+{
+    apr_os_file_t osfd;
+    etag_xattr_t rec;
+
+    if (apr_os_file_get(&osfd, fd) != APR_SUCCESS) {
+        return;
+    }
+
+    etag_xattr_record(&rec, er->finfo);
+    memcpy(rec.digest, digest, APR_SHA1_DIGESTSIZE);
+    if (fsetxattr(osfd, ETAG_XATTR_NAME, &rec, sizeof(rec), 0) != 0) {
+        /* typically not permitted, or not supported by the file system */
+        ap_log_rerror(APLOG_MARK, APLOG_TRACE1, apr_get_os_error(), r,
+                      "Make etag: could not store the digest of %s",
+                      er->pathname ? er->pathname : r->filename);
+    }
+}
+#endif /* ETAG_DIGEST_XATTR */
+
 /*
  * Construct a strong ETag by creating a SHA1 hash across the file content.
  */
@@ -105,6 +202,9 @@ static char *make_digest_etag(request_rec *r, etag_rec *er, char *vlv,
     apr_size_t nbytes;
     apr_off_t offset = 0, zero = 0, len = 0;
     apr_status_t status;
+#ifdef ETAG_DIGEST_XATTR
+    int use_xattr;
+#endif
 
     cfg = (core_dir_config *)ap_get_core_module_config(r->per_dir_config);
 
@@ -123,6 +223,13 @@ static char *make_digest_etag(request_rec *r, etag_rec *er, char *vlv,
         return "";
     }
 
+#ifdef ETAG_DIGEST_XATTR
+    use_xattr = etag_xattr_usable(r, er);
+    if (use_xattr && etag_xattr_get(r, er, fd, digest)) {
+        goto digested;
+    }
+#endif
+
     if ((status = apr_file_seek(fd, APR_CUR, &offset)) != APR_SUCCESS) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, status, r, APLOGNO(10252)
                       "Make etag: could not seek");
@@ -191,6 +298,13 @@ static char *make_digest_etag(request_rec *r, etag_rec *er, char *vlv,
     }
     apr_sha1_final(digest, &context);
 
+#ifdef ETAG_DIGEST_XATTR
+    if (use_xattr) {
+        etag_xattr_set(r, er, fd, digest);
+    }
+
+digested:
+#endif
     etag = apr_palloc(r->pool, weak_len + sizeof("\"\"") +
             SHA1_DIGEST_BASE64_LEN + vlv_len + 4);
 
@@ -80,6 +80,9 @@ static const char *ap_expr_regexec(const char *subject,
 static apr_array_header_t *ap_expr_list_make(ap_expr_eval_ctx_t *ctx,
                                              const ap_expr_t *node);
 
+static void expr_fold(const ap_expr_info_t *info, apr_pool_t *p,
+                      ap_expr_t *node);
+
 /* define AP_EXPR_DEBUG to log the parse tree when parsing an expression */
 #ifdef AP_EXPR_DEBUG
 static void expr_dump_tree(const ap_expr_t *e, const server_rec *s,
@@ -614,6 +617,9 @@ AP_DECLARE(const char *) ap_expr_parse(apr_pool_t *pool, apr_pool_t *ptemp,
     if (rc) /* XXX can this happen? */
         return "syntax error";
 
+    if (ctx.expr)
+        expr_fold(info, pool, ctx.expr);
+
 #ifdef AP_EXPR_DEBUG
     if (ctx.expr)
         expr_dump_tree(ctx.expr, NULL, APLOG_NOTICE, 2);
@@ -817,6 +823,166 @@ ap_expr_t *ap_expr_backref_make(int num, ap_expr_parse_ctx_t *ctx)
     return ap_expr_make(op_Backref, n, NULL, ctx);
 }
 
+/*
+ * Constant folding, run once on the fresh parse tree.
+ *
+ * Variables, functions and regexes are already resolved or compiled by
+ * the parser, what is left to save at evaluation time is the work on the
+ * literal parts: concatenations, comparisons and boolean operations of
+ * constants are replaced by their result, and the && / || whose left
+ * side is constant are short circuited.  Since the tree lives in the
+ * configuration pool, the nodes are rewritten in place.  Nothing which
+ * could have a side effect (function and operator calls, regex matches
+ * setting the back references) is evaluated here.
+ */
+#define EXPR_IS_CONST_WORD(e) ((e)->node_op == op_String \
+                               || (e)->node_op == op_Digit)
+#define EXPR_IS_CONST_COND(e) ((e)->node_op == op_True \
+                               || (e)->node_op == op_False)
+
+static int expr_fold_eval(const ap_expr_info_t *info, apr_pool_t *p,
+                          const ap_expr_t *node, const char **word)
+{
+    ap_expr_eval_ctx_t ctx;
+    const char *err = NULL;
+    int rc = 0;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.p = p;
+    ctx.err = &err;
+    ctx.info = info;
+
+    if (word) {
+        *word = ap_expr_eval_word(&ctx, node);
+    }
+    else {
+        rc = ap_expr_eval_cond(&ctx, node);
+    }
+
+    return err ? -1 : rc;
+}
+
+static void expr_fold(const ap_expr_info_t *info, apr_pool_t *p,
+                      ap_expr_t *node)
+{
+    ap_expr_t *e1 = (ap_expr_t *)node->node_arg1;
+    ap_expr_t *e2 = (ap_expr_t *)node->node_arg2;
+    const char *word;
+    int rc;
+
+    switch (node->node_op) {
+    case op_Not:
+    case op_Comp:
+    case op_Word:
+    case op_Bool:
+        expr_fold(info, p, e1);
+        break;
+    case op_Or:
+    case op_And:
+    case op_EQ:
+    case op_NE:
+    case op_LT:
+    case op_LE:
+    case op_GT:
+    case op_GE:
+    case op_STR_EQ:
+    case op_STR_NE:
+    case op_STR_LT:
+    case op_STR_LE:
+    case op_STR_GT:
+    case op_STR_GE:
+    case op_IN:
+    case op_REG:
+    case op_NRE:
+    case op_Concat:
+    case op_Sub:
+    case op_Split:
+    case op_BinaryOpArgs:
+        expr_fold(info, p, e1);
+        expr_fold(info, p, e2);
+        break;
+    case op_ListElement:
+    case op_Join:
+        expr_fold(info, p, e1);
+        if (e2)
+            expr_fold(info, p, e2);
+        break;
+    case op_UnaryOpCall:
+    case op_BinaryOpCall:
+    case op_StringFuncCall:
+    case op_ListFuncCall:
+        expr_fold(info, p, e2);
+        return;
+    default:
+        /* leaves */
+        return;
+    }
+
+    switch (node->node_op) {
+    case op_Concat:
+        if (EXPR_IS_CONST_WORD(e1) && EXPR_IS_CONST_WORD(e2)
+            && expr_fold_eval(info, p, node, &word) == 0) {
+            node->node_op = op_String;
+            node->node_arg1 = word;
+            node->node_arg2 = NULL;
+        }
+        break;
+    case op_Word:
+        if (EXPR_IS_CONST_WORD(e1)) {
+            *node = *e1;
+        }
+        break;
+    case op_Bool:
+        if (EXPR_IS_CONST_COND(e1)) {
+            node->node_op = op_String;
+            node->node_arg1 = e1->node_op == op_True ? "true" : "false";
+            node->node_arg2 = NULL;
+        }
+        break;
+    case op_Not:
+        if (EXPR_IS_CONST_COND(e1)) {
+            node->node_op = e1->node_op == op_True ? op_False : op_True;
+            node->node_arg1 = node->node_arg2 = NULL;
+        }
+        break;
+    case op_And:
+    case op_Or:
+        if (EXPR_IS_CONST_COND(e1)) {
+            /* true && X, false || X: X;  false && X, true || X: e1 */
+            if ((e1->node_op == op_True) == (node->node_op == op_And)) {
+                *node = *e2;
+            }
+            else {
+                *node = *e1;
+            }
+        }
+        else if (EXPR_IS_CONST_COND(e2)
+                 && (e2->node_op == op_True) == (node->node_op == op_And)) {
+            /* X && true, X || false: X (which is still evaluated) */
+            *node = *e1;
+        }
+        break;
+    case op_Comp:
+        switch (e1->node_op) {
+        case op_IN:
+        case op_REG:
+        case op_NRE:
+            break;
+        default:
+            if (EXPR_IS_CONST_WORD((const ap_expr_t *)e1->node_arg1)
+                && EXPR_IS_CONST_WORD((const ap_expr_t *)e1->node_arg2)
+                && (rc = expr_fold_eval(info, p, node, NULL)) >= 0) {
+                node->node_op = rc ? op_True : op_False;
+                node->node_arg1 = node->node_arg2 = NULL;
+            }
+            break;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
 #ifdef AP_EXPR_DEBUG
 
 #define MARK                        APLOG_MARK,loglevel,0,s
@@ -19,6 +19,7 @@
 #include "apr_lib.h"
 #include "apr_hash.h"
 #include "apr_strings.h"
+#include "apr_atomic.h"
 
 #include "httpd.h"
 #include "http_config.h"
@@ -26,6 +27,7 @@
 #include "http_log.h"
 #include "http_request.h"
 #include "util_filter.h"
+#include "util_time.h"
 
 /* NOTE: Apache's current design doesn't allow a pool to be passed thru,
    so we depend on a global to hold the correct pool
@@ -62,6 +64,8 @@ struct ap_filter_private {
     apr_bucket_brigade *bb;
     /* Dedicated pool to use for deferred writes. */
     apr_pool_t *deferred_pool;
+    /* Memory bytes in bb, accounted in the connection and the child */
+    apr_size_t setaside_bytes;
 };
 APR_RING_HEAD(pending_ring, ap_filter_private);
 
@@ -79,8 +83,14 @@ struct ap_filter_conn_ctx {
                       *spare_brigades,
                       *spare_filters,
                       *dead_filters;
+
+    /* Memory bytes set aside by all the filters of the connection */
+    apr_size_t setaside_bytes;
 };
 
+/* Memory bytes set aside by all the connections of the child */
+static apr_uint64_t child_setaside_bytes;
+
 typedef struct filter_trie_node filter_trie_node;
 
 typedef struct {
@@ -321,6 +331,49 @@ static struct ap_filter_conn_ctx *get_conn_ctx(conn_rec *c)
     return x;
 }
 
+/* Morphing buckets (FILE and opaque) use no memory until read, so like for
+ * FlushMaxThreshold they don't account for the memory set aside.
+ */
+static APR_INLINE apr_size_t bucket_memory_bytes(apr_bucket *e)
+{
+    if (e->length == (apr_size_t)-1 || APR_BUCKET_IS_FILE(e)
+        || AP_BUCKET_IS_WC(e)) {
+        return 0;
+    }
+    return e->length;
+}
+
+static void account_setaside(ap_filter_t *f, apr_size_t bytes)
+{
+    struct ap_filter_private *fp = f->priv;
+    struct ap_filter_conn_ctx *x = f->c->filter_conn_ctx;
+
+    if (bytes == fp->setaside_bytes || !x) {
+        return;
+    }
+    if (bytes > fp->setaside_bytes) {
+        apr_atomic_add64(&child_setaside_bytes, bytes - fp->setaside_bytes);
+        x->setaside_bytes += bytes - fp->setaside_bytes;
+    }
+    else {
+        apr_atomic_sub64(&child_setaside_bytes, fp->setaside_bytes - bytes);
+        x->setaside_bytes -= fp->setaside_bytes - bytes;
+    }
+    fp->setaside_bytes = bytes;
+}
+
+AP_DECLARE(apr_size_t) ap_filter_conn_setaside_bytes(conn_rec *c)
+{
+    struct ap_filter_conn_ctx *x = c->filter_conn_ctx;
+
+    return x ? x->setaside_bytes : 0;
+}
+
+AP_DECLARE(apr_uint64_t) ap_filter_child_setaside_bytes(void)
+{
+    return apr_atomic_read64(&child_setaside_bytes);
+}
+
 static APR_INLINE
 void make_spare_ring(struct spare_ring **ring, apr_pool_t *p)
 {
@@ -616,6 +669,7 @@ static apr_status_t pending_filter_cleanup(void *arg)
     }
 
     if (fp->bb) {
+        account_setaside(f, 0);
         ap_release_brigade(f->c, fp->bb);
         fp->bb = NULL;
     }
@@ -661,6 +715,7 @@ AP_DECLARE(void) ap_remove_output_filter(ap_filter_t *f)
 
     if (fp->deferred_pool) {
         AP_DEBUG_ASSERT(fp->bb);
+        account_setaside(f, 0);
         apr_brigade_cleanup(fp->bb);
         apr_pool_destroy(fp->deferred_pool);
         fp->deferred_pool = NULL;
@@ -742,8 +797,21 @@ AP_DECLARE(apr_status_t) ap_get_brigade(ap_filter_t *next,
                                         apr_off_t readbytes)
 {
     if (next) {
-        return next->frec->filter_func.in_func(next, bb, mode, block,
-                                               readbytes);
+        apr_status_t rv;
+
+        AP_INPUT_FILTER_ENTRY((uintptr_t)next, (char *)next->frec->name,
+                              (int)mode, (apr_int64_t)readbytes);
+        rv = next->frec->filter_func.in_func(next, bb, mode, block,
+                                             readbytes);
+        if (AP_INPUT_FILTER_RETURN_ENABLED()) {
+            apr_off_t len = -1;
+
+            /* without reading the buckets, so -1 if some length is unknown */
+            apr_brigade_length(bb, 0, &len);
+            AP_INPUT_FILTER_RETURN((uintptr_t)next, (char *)next->frec->name,
+                                   rv, (apr_int64_t)len);
+        }
+        return rv;
     }
     return AP_NOBODY_READ;
 }
@@ -758,6 +826,7 @@ AP_DECLARE(apr_status_t) ap_pass_brigade(ap_filter_t *next,
 {
     if (next) {
         apr_bucket *e = APR_BRIGADE_LAST(bb);
+        apr_status_t rv;
 
         if (e != APR_BRIGADE_SENTINEL(bb) && APR_BUCKET_IS_EOS(e) && next->r) {
             /* This is only safe because HTTP_HEADER filter is always in
@@ -780,7 +849,27 @@ AP_DECLARE(apr_status_t) ap_pass_brigade(ap_filter_t *next,
                 }
             }
         }
-        return next->frec->filter_func.out_func(next, bb);
+        if (AP_OUTPUT_FILTER_ENTRY_ENABLED()) {
+            apr_off_t len = -1;
+
+            apr_brigade_length(bb, 0, &len);
+            AP_OUTPUT_FILTER_ENTRY((uintptr_t)next, (char *)next->frec->name,
+                                   (apr_int64_t)len);
+        }
+        if (next->r && next == next->r->output_filters) {
+            /* the entry of the request's chain, the handler's time in there */
+            apr_time_t start = ap_time_monotonic();
+
+            ap_request_cpu_enter(next->r);
+            rv = next->frec->filter_func.out_func(next, bb);
+            ap_request_cpu_leave(next->r);
+            ap_request_phase_add(next->r, AP_REQUEST_PHASE_OUTPUT, start);
+        }
+        else {
+            rv = next->frec->filter_func.out_func(next, bb);
+        }
+        AP_OUTPUT_FILTER_RETURN((uintptr_t)next, (char *)next->frec->name, rv);
+        return rv;
     }
     return AP_NOBODY_WROTE;
 }
@@ -934,13 +1023,40 @@ AP_DECLARE(int) ap_filter_prepare_brigade(ap_filter_t *f)
 }
 
 static apr_status_t save_aside_brigade(struct ap_filter_private *fp,
-                                       apr_bucket_brigade *bb)
+                                       apr_bucket_brigade *bb,
+                                       apr_size_t bytes)
 {
+    ap_filter_t *f = fp->f;
+    struct ap_filter_conn_ctx *x = f->c->filter_conn_ctx;
+    core_server_config *conf;
+    apr_status_t rv;
+
+    /* Shed the connection rather than letting it grow the child beyond
+     * FlushMaxMemory, once it holds more than the FlushMaxThreshold which
+     * should have been written already.
+     */
+    conf = ap_get_core_module_config(f->c->base_server->module_config);
+    if (bytes && conf->flush_max_memory
+        && ap_filter_child_setaside_bytes() + bytes > conf->flush_max_memory
+        && x->setaside_bytes + bytes > conf->flush_max_threshold) {
+        ap_log_cerror(APLOG_MARK, APLOG_INFO, 0, f->c, APLOGNO(10594)
+                      "closing connection holding %" APR_SIZE_T_FMT
+                      " bytes, the child is over FlushMaxMemory "
+                      "(%" APR_UINT64_T_FMT " bytes set aside)",
+                      x->setaside_bytes + bytes,
+                      ap_filter_child_setaside_bytes());
+        return APR_ENOMEM;
+    }
+
     if (!fp->deferred_pool) {
-        apr_pool_create(&fp->deferred_pool, fp->f->c->pool);
+        apr_pool_create(&fp->deferred_pool, f->c->pool);
         apr_pool_tag(fp->deferred_pool, "deferred_pool");
     }
-    return ap_save_brigade(fp->f, &fp->bb, &bb, fp->deferred_pool);
+    rv = ap_save_brigade(f, &fp->bb, &bb, fp->deferred_pool);
+    if (APR_BRIGADE_EMPTY(bb)) {
+        account_setaside(f, fp->setaside_bytes + bytes);
+    }
+    return rv;
 }
 
 AP_DECLARE(apr_status_t) ap_filter_setaside_brigade(ap_filter_t *f,
@@ -964,6 +1080,7 @@ AP_DECLARE(apr_status_t) ap_filter_setaside_brigade(ap_filter_t *f,
     if (!APR_BRIGADE_EMPTY(bb)) {
         apr_bucket_brigade *tmp_bb = NULL;
         int batched_buckets = 0;
+        apr_size_t batched_bytes = 0;
         apr_bucket *e, *next;
 
         /*
@@ -995,7 +1112,8 @@ AP_DECLARE(apr_status_t) ap_filter_setaside_brigade(ap_filter_t *f,
                         tmp_bb = ap_acquire_brigade(f->c);
                     }
                     apr_brigade_split_ex(bb, e, tmp_bb);
-                    rv = save_aside_brigade(fp, bb);
+                    rv = save_aside_brigade(fp, bb, batched_bytes);
+                    batched_bytes = 0;
                     APR_BRIGADE_CONCAT(bb, tmp_bb);
                     if (rv != APR_SUCCESS) {
                         break;
@@ -1008,6 +1126,7 @@ AP_DECLARE(apr_status_t) ap_filter_setaside_brigade(ap_filter_t *f,
             else {
                 /* Batch successive buckets to save. */
                 batched_buckets = 1;
+                batched_bytes += bucket_memory_bytes(e);
             }
         }
         if (tmp_bb) {
@@ -1015,7 +1134,7 @@ AP_DECLARE(apr_status_t) ap_filter_setaside_brigade(ap_filter_t *f,
         }
         if (batched_buckets) {
             /* Save any remainder. */
-            rv = save_aside_brigade(fp, bb);
+            rv = save_aside_brigade(fp, bb, batched_bytes);
         }
         if (!APR_BRIGADE_EMPTY(bb)) {
             /* Anything left in bb is what we could not save (error), clean up.
@@ -1037,6 +1156,7 @@ AP_DECLARE(apr_status_t) ap_filter_setaside_brigade(ap_filter_t *f,
          * pool.
          */
         AP_DEBUG_ASSERT(fp->bb);
+        account_setaside(f, 0);
         apr_brigade_cleanup(fp->bb);
         apr_pool_clear(fp->deferred_pool);
     }
@@ -1057,8 +1177,17 @@ AP_DECLARE(void) ap_filter_adopt_brigade(ap_filter_t *f,
                   f->frec->direction == AP_FILTER_INPUT ? "in" : "out");
 
     if (!APR_BRIGADE_EMPTY(bb)) {
+        apr_size_t bytes = fp->setaside_bytes;
+        apr_bucket *e;
+
+        for (e = APR_BRIGADE_FIRST(bb);
+             e != APR_BRIGADE_SENTINEL(bb);
+             e = APR_BUCKET_NEXT(e)) {
+            bytes += bucket_memory_bytes(e);
+        }
         ap_filter_prepare_brigade(f);
         APR_BRIGADE_CONCAT(fp->bb, bb);
+        account_setaside(f, bytes);
     }
 }
 
@@ -1071,7 +1200,7 @@ AP_DECLARE(apr_status_t) ap_filter_reinstate_brigade(ap_filter_t *f,
     int eor_buckets_in_brigade, opaque_buckets_in_brigade;
     struct ap_filter_private *fp = f->priv;
     core_server_config *conf;
-    int is_flush;
+    int is_flush, over_memory;
  
     ap_log_cerror(APLOG_MARK, APLOG_TRACE6, 0, f->c,
                   "reinstate %s brigade to %s brigade in '%s' %sput filter",
@@ -1090,6 +1219,7 @@ AP_DECLARE(apr_status_t) ap_filter_reinstate_brigade(ap_filter_t *f,
      */
     if (fp->bb) {
         APR_BRIGADE_PREPEND(bb, fp->bb);
+        account_setaside(f, 0);
     }
     if (!flush_upto) {
         /* Just prepend all. */
@@ -1117,8 +1247,13 @@ AP_DECLARE(apr_status_t) ap_filter_reinstate_brigade(ap_filter_t *f,
      *     (The point of this rule is to prevent too many FDs being kept open
      *     by pipelined requests, possibly allowing a DoS).
      *
+     *  d) The child holds more than flush_max_memory bytes set aside by all
+     *     its connections: do blocking writes of everything up to the last
+     *     bucket in memory, so that the connections slow down the handlers
+     *     rather than growing the child.
+     *
      * Morphing buckets (opaque and FILE) use no memory until read, so they
-     * don't account for point b) above. Both ap_filter_reinstate_brigade()
+     * don't account for points b) and d) above. Both ap_filter_reinstate_brigade()
      * and setaside_brigade() assume that opaque buckets have an appropriate
      * lifetime (until next EOR for instance), so they are simply setaside or
      * reinstated by moving them from/to fp->bb to/from user bb.
@@ -1130,6 +1265,9 @@ AP_DECLARE(apr_status_t) ap_filter_reinstate_brigade(ap_filter_t *f,
     opaque_buckets_in_brigade = 0;
 
     conf = ap_get_core_module_config(f->c->base_server->module_config);
+    over_memory = (conf->flush_max_memory
+                   && ap_filter_child_setaside_bytes()
+                      > conf->flush_max_memory);
 
     for (bucket = APR_BRIGADE_FIRST(bb); bucket != APR_BRIGADE_SENTINEL(bb);
          bucket = next) {
@@ -1158,6 +1296,7 @@ AP_DECLARE(apr_status_t) ap_filter_reinstate_brigade(ap_filter_t *f,
 
         if (is_flush
             || (memory_bytes_in_brigade > conf->flush_max_threshold)
+            || (over_memory && memory_bytes_in_brigade)
             || (conf->flush_max_pipelined >= 0
                 && eor_buckets_in_brigade > conf->flush_max_pipelined)) {
             /* this segment of the brigade MUST be sent before returning. */
@@ -1166,7 +1305,9 @@ AP_DECLARE(apr_status_t) ap_filter_reinstate_brigade(ap_filter_t *f,
                 char *reason = is_flush ?
                                "FLUSH bucket" :
                                (memory_bytes_in_brigade > conf->flush_max_threshold) ?
-                               "max threshold" : "max requests in pipeline";
+                               "max threshold" :
+                               (over_memory && memory_bytes_in_brigade) ?
+                               "max memory" : "max requests in pipeline";
                 ap_log_cerror(APLOG_MARK, APLOG_TRACE6, 0, f->c,
                               "will flush because of %s", reason);
                 ap_log_cerror(APLOG_MARK, APLOG_TRACE8, 0, f->c,
@@ -1316,14 +1457,13 @@ cleanup:
     return rc;
 }
 
-AP_DECLARE_NONSTD(int) ap_filter_input_pending(conn_rec *c)
+AP_DECLARE(int) ap_filter_has_input_pending(conn_rec *c)
 {
     struct ap_filter_conn_ctx *x = c->filter_conn_ctx;
     struct ap_filter_private *fp;
-    int rc = DECLINED;
 
     if (!x || !x->pending_input_filters) {
-        goto cleanup;
+        return DECLINED;
     }
 
     for (fp = APR_RING_LAST(x->pending_input_filters);
@@ -1339,12 +1479,17 @@ AP_DECLARE_NONSTD(int) ap_filter_input_pending(conn_rec *c)
         e = APR_BRIGADE_FIRST(fp->bb);
         if (e != APR_BRIGADE_SENTINEL(fp->bb)
                 && e->length != (apr_size_t)(-1)) {
-            rc = OK;
-            break;
+            return OK;
         }
     }
 
-cleanup:
+    return DECLINED;
+}
+
+AP_DECLARE_NONSTD(int) ap_filter_input_pending(conn_rec *c)
+{
+    int rc = ap_filter_has_input_pending(c);
+
     /* All filters have returned, time to recycle/unleak ap_filter_t-s
      * before leaving (i.e. make them reusable).
      */
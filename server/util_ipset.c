@@ -0,0 +1,314 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * The subnets of a set are stored in a hash table per prefix length,
+ * keyed by the prefix bytes, so that an address is tested by masking it
+ * with each of the lengths in use and looking the result up. Entries that
+ * can't be represented by a prefix (non contiguous masks, unusual forms)
+ * are tested with apr_ipsubnet_test(), in order.
+ */
+
+#include "apr_strings.h"
+#include "apr_lib.h"
+#include "apr_hash.h"
+
+#define APR_WANT_MEMFUNC
+#include "apr_want.h"
+
+#include "httpd.h"
+#include "util_ipset.h"
+
+#if APR_HAVE_NETINET_IN_H
+#include <netinet/in.h>
+#endif
+
+#define IPSET_V4_BITS 32
+#define IPSET_V6_BITS 128
+
+typedef struct {
+    int order;
+    const void *data;
+} ipset_entry_t;
+
+typedef struct {
+    apr_ipsubnet_t *ip;
+    ipset_entry_t *entry;
+} ipset_other_t;
+
+typedef struct {
+    apr_hash_t **prefixes;  /* by length, allocated on first use */
+    int *lens;              /* the lengths in use, ascending */
+    int nlens;
+} ipset_family_t;
+
+struct ap_ipset_t {
+    apr_pool_t *pool;
+    ipset_family_t v4;
+#if APR_HAVE_IPV6
+    ipset_family_t v6;
+#endif
+    apr_array_header_t *others;
+    int count;
+};
+
+AP_DECLARE(ap_ipset_t *) ap_ipset_make(apr_pool_t *p)
+{
+    ap_ipset_t *set = apr_pcalloc(p, sizeof(*set));
+
+    set->pool = p;
+    set->others = apr_array_make(p, 1, sizeof(ipset_other_t));
+    return set;
+}
+
+AP_DECLARE(int) ap_ipset_count(const ap_ipset_t *set)
+{
+    return set->count;
+}
+
+/* Parse a decimal number up to max, the whole string */
+static int parse_number(const char *s, int max)
+{
+    int n = 0;
+
+    if (!*s) {
+        return -1;
+    }
+    for (; *s; ++s) {
+        if (!apr_isdigit(*s) || (n = n * 10 + (*s - '0')) > max) {
+            return -1;
+        }
+    }
+    return n;
+}
+
+/* Parse a (partial) dotted IPv4 address into addr, returning the number of
+ * octets parsed or -1 if it isn't one.
+ */
+static int parse_ipv4(const char *s, unsigned char addr[4])
+{
+    int n = 0;
+
+    memset(addr, 0, 4);
+    while (n < 4) {
+        int v = 0, digits = 0;
+
+        while (apr_isdigit(*s) && digits < 3) {
+            v = v * 10 + (*s++ - '0');
+            ++digits;
+        }
+        if (!digits || v > 255) {
+            return -1;
+        }
+        addr[n++] = (unsigned char)v;
+        if (!*s) {
+            return n;
+        }
+        if (*s++ != '.') {
+            return -1;
+        }
+    }
+    return -1;
+}
+
+/* Number of leading one bits of a contiguous mask, or -1 */
+static int mask_to_bits(const unsigned char *mask, int len)
+{
+    int i, bits = 0;
+
+    for (i = 0; i < len && mask[i] == 0xFF; ++i) {
+        bits += 8;
+    }
+    if (i < len) {
+        unsigned char m = mask[i++];
+        while (m & 0x80) {
+            m <<= 1;
+            ++bits;
+        }
+        if (m) {
+            return -1;
+        }
+        for (; i < len; ++i) {
+            if (mask[i]) {
+                return -1;
+            }
+        }
+    }
+    return bits;
+}
+
+static void add_prefix(apr_pool_t *p, ipset_family_t *fam, int maxbits,
+                       const unsigned char *addr, int bits,
+                       ipset_entry_t *entry)
+{
+    apr_size_t klen = (bits + 7) / 8;
+    unsigned char *key;
+    int i;
+
+    if (!fam->prefixes) {
+        fam->prefixes = apr_pcalloc(p, (maxbits + 1) * sizeof(apr_hash_t *));
+        fam->lens = apr_palloc(p, (maxbits + 1) * sizeof(int));
+    }
+    if (!fam->prefixes[bits]) {
+        fam->prefixes[bits] = apr_hash_make(p);
+        for (i = fam->nlens; i > 0 && fam->lens[i - 1] > bits; --i) {
+            fam->lens[i] = fam->lens[i - 1];
+        }
+        fam->lens[i] = bits;
+        fam->nlens++;
+    }
+
+    key = apr_pmemdup(p, addr, klen ? klen : 1);
+    if (bits % 8) {
+        key[klen - 1] &= (unsigned char)(0xFF << (8 - bits % 8));
+    }
+    /* keep the first entry added for a subnet */
+    if (!apr_hash_get(fam->prefixes[bits], key, klen)) {
+        apr_hash_set(fam->prefixes[bits], key, klen, entry);
+    }
+}
+
+AP_DECLARE(apr_status_t) ap_ipset_add(ap_ipset_t *set, const char *ipstr,
+                                      const char *mask_or_numbits,
+                                      const void *data)
+{
+    ipset_entry_t *entry;
+    apr_ipsubnet_t *ip;
+    unsigned char addr[16];
+    apr_status_t rv;
+    int bits = -1;
+
+    /* let APR validate the syntax, and handle the forms not parsed here */
+    rv = apr_ipsubnet_create(&ip, ipstr, mask_or_numbits, set->pool);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+
+    entry = apr_palloc(set->pool, sizeof(*entry));
+    entry->order = set->count++;
+    entry->data = data;
+
+    if (!ap_strchr_c(ipstr, ':')) {
+        int octets = parse_ipv4(ipstr, addr);
+
+        if (octets > 0) {
+            if (!mask_or_numbits) {
+                bits = octets * 8;
+            }
+            else if (octets == 4) {
+                unsigned char mask[4];
+
+                bits = parse_number(mask_or_numbits, IPSET_V4_BITS);
+                if (bits < 0 && parse_ipv4(mask_or_numbits, mask) == 4) {
+                    bits = mask_to_bits(mask, 4);
+                }
+            }
+        }
+        if (bits >= 0) {
+            add_prefix(set->pool, &set->v4, IPSET_V4_BITS, addr, bits, entry);
+            return APR_SUCCESS;
+        }
+    }
+#if APR_HAVE_IPV6
+    else {
+        apr_sockaddr_t *sa;
+
+        bits = mask_or_numbits ? parse_number(mask_or_numbits, IPSET_V6_BITS)
+                               : IPSET_V6_BITS;
+        /* a valid numeric address, so no name resolution here */
+        if (bits >= 0 && !ap_strchr_c(ipstr, '%')
+            && apr_sockaddr_info_get(&sa, ipstr, APR_INET6, 0, 0,
+                                     set->pool) == APR_SUCCESS
+            && sa->family == APR_INET6) {
+            memcpy(addr, sa->sa.sin6.sin6_addr.s6_addr, 16);
+            add_prefix(set->pool, &set->v6, IPSET_V6_BITS, addr, bits, entry);
+            return APR_SUCCESS;
+        }
+    }
+#endif
+
+    {
+        ipset_other_t *other = apr_array_push(set->others);
+        other->ip = ip;
+        other->entry = entry;
+    }
+
+    return APR_SUCCESS;
+}
+
+static const ipset_entry_t *match_prefix(const ipset_family_t *fam,
+                                         const unsigned char *addr,
+                                         const ipset_entry_t *best)
+{
+    unsigned char key[16];
+    int i;
+
+    for (i = 0; i < fam->nlens; ++i) {
+        int bits = fam->lens[i];
+        apr_size_t klen = (bits + 7) / 8;
+        const ipset_entry_t *entry;
+
+        memcpy(key, addr, klen);
+        if (bits % 8) {
+            key[klen - 1] &= (unsigned char)(0xFF << (8 - bits % 8));
+        }
+        entry = apr_hash_get(fam->prefixes[bits], key, klen);
+        if (entry && (!best || entry->order < best->order)) {
+            best = entry;
+        }
+    }
+
+    return best;
+}
+
+AP_DECLARE(int) ap_ipset_match(const ap_ipset_t *set, apr_sockaddr_t *sa,
+                               const void **data)
+{
+    const ipset_entry_t *best = NULL;
+    int i;
+
+    if (sa->family == APR_INET) {
+        best = match_prefix(&set->v4, (const unsigned char *)
+                                      &sa->sa.sin.sin_addr, best);
+    }
+#if APR_HAVE_IPV6
+    else if (sa->family == APR_INET6) {
+        const unsigned char *addr = sa->sa.sin6.sin6_addr.s6_addr;
+
+        if (IN6_IS_ADDR_V4MAPPED(&sa->sa.sin6.sin6_addr)) {
+            best = match_prefix(&set->v4, addr + 12, best);
+        }
+        best = match_prefix(&set->v6, addr, best);
+    }
+#endif
+
+    for (i = 0; i < set->others->nelts; ++i) {
+        const ipset_other_t *other = &APR_ARRAY_IDX(set->others, i,
+                                                    ipset_other_t);
+        if (best && best->order < other->entry->order) {
+            break;
+        }
+        if (apr_ipsubnet_test(other->ip, sa)) {
+            best = other->entry;
+            break;
+        }
+    }
+
+    if (best && data) {
+        *data = best->data;
+    }
+    return best != NULL;
+}
@@ -169,6 +169,7 @@ AP_DECLARE(void) ap_regfree(ap_regex_t *preg)
  *************************************************/
 
 static int default_cflags = AP_REG_DEFAULT;
+static int regcomp_jit = 1;
 
 AP_DECLARE(int) ap_regcomp_get_default_cflags(void)
 {
@@ -180,6 +181,11 @@ AP_DECLARE(void) ap_regcomp_set_default_cflags(int cflags)
     default_cflags = cflags;
 }
 
+AP_DECLARE(void) ap_regcomp_set_jit(int onoff)
+{
+    regcomp_jit = onoff;
+}
+
 AP_DECLARE(int) ap_regcomp_default_cflag_by_name(const char *name)
 {
     int cflag = 0;
@@ -251,6 +257,13 @@ AP_DECLARE(int) ap_regcomp(ap_regex_t * preg, const char *pattern, int cflags)
     }
 
 #ifdef HAVE_PCRE2
+    if (regcomp_jit && !(cflags & AP_REG_NO_JIT)) {
+        /* Failure (e.g. no JIT support in the library) is not an error,
+         * pcre2_match() will then use the interpreter.
+         */
+        (void)pcre2_jit_compile(preg->re_pcre, PCRE2_JIT_COMPLETE);
+    }
+
     pcre2_pattern_info((const pcre2_code *)preg->re_pcre,
                        PCRE2_INFO_CAPTURECOUNT, &capcount);
     preg->re_nsub = capcount;
@@ -297,6 +310,25 @@ typedef int*        match_vector_pt;
 static AP_THREAD_LOCAL apr_pool_t *thread_pool;
 #endif
 
+#ifdef HAVE_PCRE2
+/* The JIT stack used by pcre2_match() for JIT compiled patterns, the
+ * default (32K on the machine stack) is too small for some patterns.
+ */
+#ifndef AP_PCRE_JIT_STACK_MIN
+#define AP_PCRE_JIT_STACK_MIN (32 * 1024)
+#endif
+#ifndef AP_PCRE_JIT_STACK_MAX
+#define AP_PCRE_JIT_STACK_MAX (512 * 1024)
+#endif
+#if APREG_USE_THREAD_LOCAL
+struct match_jit_state {
+    pcre2_match_context *mctx;
+    pcre2_jit_stack *stack;
+};
+static AP_THREAD_LOCAL struct match_jit_state *thread_jit;
+#endif
+#endif
+
 struct match_data_state {
     /* keep first, struct aligned */
     char buf[AP_PCRE_STACKBUF_SIZE];
@@ -401,6 +433,51 @@ int setup_state(struct match_data_state *state, apr_uint32_t ncaps)
     return 1;
 }
 
+#if defined(HAVE_PCRE2) && APREG_USE_THREAD_LOCAL
+static apr_status_t match_jit_cleanup(void *data)
+{
+    struct match_jit_state *jit = data;
+
+    pcre2_match_context_free(jit->mctx);
+    pcre2_jit_stack_free(jit->stack);
+    return APR_SUCCESS;
+}
+
+/* Per-thread match context with its JIT stack, created on first use and
+ * destroyed with the thread's pool.
+ */
+static pcre2_match_context *get_match_context(struct match_data_state *state)
+{
+    struct match_jit_state *jit = thread_jit;
+
+    if (!jit && regcomp_jit && state->thd) {
+        apr_pool_t *tp = apr_thread_pool_get(state->thd);
+
+        jit = apr_pcalloc(tp, sizeof(*jit));
+        jit->mctx = pcre2_match_context_create(NULL);
+        jit->stack = pcre2_jit_stack_create(AP_PCRE_JIT_STACK_MIN,
+                                            AP_PCRE_JIT_STACK_MAX, NULL);
+        if (jit->mctx && jit->stack) {
+            pcre2_jit_stack_assign(jit->mctx, NULL, jit->stack);
+        }
+        else {
+            /* Use the default JIT stack, don't retry */
+            pcre2_match_context_free(jit->mctx);
+            pcre2_jit_stack_free(jit->stack);
+            jit->mctx = NULL;
+            jit->stack = NULL;
+        }
+        apr_pool_cleanup_register(tp, jit, match_jit_cleanup,
+                                  apr_pool_cleanup_null);
+        thread_jit = jit;
+    }
+
+    return jit ? jit->mctx : NULL;
+}
+#elif defined(HAVE_PCRE2)
+#define get_match_context(state) NULL
+#endif
+
 static APR_INLINE
 void cleanup_state(struct match_data_state *state)
 {
@@ -483,7 +560,15 @@ AP_DECLARE(int) ap_regexec_len(const ap_regex_t *preg, const char *buff,
 #ifdef HAVE_PCRE2
     rc = pcre2_match((const pcre2_code *)preg->re_pcre,
                      (const unsigned char *)buff, len, 0, options,
-                     state.match_data, NULL);
+                     state.match_data, get_match_context(&state));
+#ifdef PCRE2_NO_JIT
+    if (rc == PCRE2_ERROR_JIT_STACKLIMIT) {
+        /* Too deep for the JIT stack, the interpreter uses the heap */
+        rc = pcre2_match((const pcre2_code *)preg->re_pcre,
+                         (const unsigned char *)buff, len, 0,
+                         options | PCRE2_NO_JIT, state.match_data, NULL);
+    }
+#endif
     ovector = pcre2_get_ovector_pointer(state.match_data);
 #else
     ovector = state.match_data;
@@ -17,6 +17,10 @@
 #include "util_time.h"
 #include "apr_env.h"
 
+#if HAVE_CLOCK_GETTIME
+#include <time.h>
+#endif
+
 
 
 /* Number of characters needed to format the microsecond part of a timestamp.
@@ -325,3 +329,27 @@ AP_DECLARE(void) ap_force_set_tz(apr_pool_t *p) {
         apr_env_set("TZ", "UTC+0", p);
     }
 }
+
+AP_DECLARE(apr_time_t) ap_time_monotonic(void)
+{
+#if HAVE_CLOCK_GETTIME && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+        return apr_time_from_sec(ts.tv_sec) + ts.tv_nsec / 1000;
+    }
+#endif
+    return apr_time_now();
+}
+
+AP_DECLARE(apr_interval_time_t) ap_time_thread_cpu(void)
+{
+#if HAVE_CLOCK_GETTIME && defined(CLOCK_THREAD_CPUTIME_ID)
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+        return apr_time_from_sec(ts.tv_sec) + ts.tv_nsec / 1000;
+    }
+#endif
+    return -1;
+}
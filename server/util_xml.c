@@ -43,6 +43,18 @@ AP_DECLARE(int) ap_xml_parse_input(request_rec * r, apr_xml_doc **pdoc)
     apr_size_t total_read = 0;
     apr_size_t limit_xml_body = ap_get_limit_xml_body(r);
     int result = HTTP_BAD_REQUEST;
+    const char *clen = apr_table_get(r->headers_in, "Content-Length");
+    apr_off_t length;
+
+    /* don't parse (and build the tree of) what is known to be too large */
+    if (clen && ap_parse_strict_length(&length, clen)
+        && (apr_uint64_t)length > limit_xml_body) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(10518)
+                      "XML request body length %s is larger than the "
+                      "configured limit of %lu", clen,
+                      (unsigned long)limit_xml_body);
+        return HTTP_REQUEST_ENTITY_TOO_LARGE;
+    }
 
     parser = apr_xml_parser_create(r->pool);
     brigade = apr_brigade_create(r->pool, r->connection->bucket_alloc);
@@ -23,6 +23,7 @@
 #include "apr.h"
 #include "apr_strings.h"
 #include "apr_lib.h"
+#include "apr_hash.h"
 #include "apr_version.h"
 
 #define APR_WANT_STRFUNC
@@ -54,13 +55,41 @@
  * lists of name-vhosts.
  */
 typedef struct name_chain name_chain;
+typedef struct name_index name_index;
 struct name_chain {
     name_chain *next;
     server_addr_rec *sar;       /* the record causing it to be in
                                  * this chain (needed for port comparisons) */
     server_rec *server;         /* the server to use on a match */
+    name_index *index;          /* set on the head of long chains only */
 };
 
+/* Config time index of a long name_chain, so that the lookup does not
+ * have to compare the Host with every name of every vhost.  The chain is
+ * flattened into an array, and each table maps a name to the ascending
+ * positions of the entries it matches, so the first match in chain order
+ * still wins.  "*.suffix" aliases are looked up by each ".suffix" of the
+ * host, the other wildcards are still matched one by one.
+ */
+typedef struct name_wild {
+    int pos;
+    const char *pattern;
+} name_wild;
+
+struct name_index {
+    name_chain **entries;       /* the chain, in order */
+    int nelts;
+    apr_hash_t *names;          /* ServerName and ServerAlias => positions */
+    apr_hash_t *suffixes;       /* ".suffix" of "*.suffix" => positions */
+    apr_hash_t *virthosts;      /* VirtualHost address names => positions */
+    apr_array_header_t *wild;   /* other wildcards, as name_wild */
+};
+
+/* Minimum length of a name_chain for it to get a name_index */
+#ifndef VHOST_NAME_INDEX_MIN
+#define VHOST_NAME_INDEX_MIN 16
+#endif
+
 /* meta-list of ip addresses.  Each server_rec can be in possibly multiple
  * hash chains since it can have multiple ips.
  */
@@ -130,6 +159,26 @@ AP_DECLARE(void) ap_init_vhost_config(apr_pool_t *p)
 }
 
 
+/*
+ * The addresses resolved for the <VirtualHost>s, keyed by the address and
+ * port as written.  Configurations with many vhosts usually repeat the same
+ * few addresses, so each one is resolved only once per generation; the
+ * cache is attached to the configuration pool and so goes away with it.
+ */
+#define VHOST_ADDR_CACHE_KEY "ap_vhost_addr_cache"
+
+static apr_hash_t *vhost_addr_cache(apr_pool_t *p)
+{
+    void *cache;
+
+    apr_pool_userdata_get(&cache, VHOST_ADDR_CACHE_KEY, p);
+    if (!cache) {
+        cache = apr_hash_make(p);
+        apr_pool_userdata_setn(cache, VHOST_ADDR_CACHE_KEY, NULL, p);
+    }
+    return cache;
+}
+
 /*
  * Parses a host of the form <address>[:port]
  * paddr is used to create a list in the order of input
@@ -143,6 +192,8 @@ static const char *get_addresses(apr_pool_t *p, const char *w_,
 {
     apr_sockaddr_t *my_addr;
     server_addr_rec *sar;
+    apr_hash_t *cache;
+    const char *key;
     char *w, *host, *scope_id;
     int wild_port;
     apr_size_t wlen;
@@ -187,31 +238,40 @@ static const char *get_addresses(apr_pool_t *p, const char *w_,
         port = default_port;
     }
 
-    if (strcmp(host, "*") == 0 || strcasecmp(host, "_default_") == 0) {
-        rv = apr_sockaddr_info_get(&my_addr, NULL, APR_UNSPEC, port, 0, p);
-        if (rv) {
-            return "Could not determine a wildcard address ('0.0.0.0') -- "
-                "check resolver configuration.";
-        }
-    }
-    else {
-        rv = apr_sockaddr_info_get(&my_addr, host, APR_UNSPEC, port, 0, p);
-        if (rv != APR_SUCCESS) {
-            ap_log_error(APLOG_MARK, APLOG_ERR, rv, NULL, APLOGNO(00547)
-                "Could not resolve host name %s -- ignoring!", host);
-            return NULL;
-        }
-#if APR_VERSION_AT_LEAST(1,7,0)
-        if (scope_id) {
-            rv = apr_sockaddr_zone_set(my_addr, scope_id);
+    cache = vhost_addr_cache(p);
+    key = apr_psprintf(p, "%s%%%s:%u", host, scope_id ? scope_id : "",
+                       (unsigned int)port);
+    my_addr = apr_hash_get(cache, key, APR_HASH_KEY_STRING);
+    if (!my_addr) {
+        if (strcmp(host, "*") == 0 || strcasecmp(host, "_default_") == 0) {
+            rv = apr_sockaddr_info_get(&my_addr, NULL, APR_UNSPEC, port,
+                                       0, p);
             if (rv) {
-                ap_log_error(APLOG_MARK, APLOG_ERR, rv, NULL, APLOGNO(10103)
-                             "Could not set scope ID %s for %pI -- ignoring!",
-                             scope_id, my_addr);
-                return NULL;
+                return "Could not determine a wildcard address ('0.0.0.0') -- "
+                    "check resolver configuration.";
             }
         }
+        else {
+            rv = apr_sockaddr_info_get(&my_addr, host, APR_UNSPEC, port,
+                                       0, p);
+            if (rv != APR_SUCCESS) {
+                ap_log_error(APLOG_MARK, APLOG_ERR, rv, NULL, APLOGNO(00547)
+                    "Could not resolve host name %s -- ignoring!", host);
+                return NULL;
+            }
+#if APR_VERSION_AT_LEAST(1,7,0)
+            if (scope_id) {
+                rv = apr_sockaddr_zone_set(my_addr, scope_id);
+                if (rv) {
+                    ap_log_error(APLOG_MARK, APLOG_ERR, rv, NULL,
+                                 APLOGNO(10103) "Could not set scope ID %s "
+                                 "for %pI -- ignoring!", scope_id, my_addr);
+                    return NULL;
+                }
+            }
 #endif
+        }
+        apr_hash_set(cache, key, APR_HASH_KEY_STRING, my_addr);
     }
 
     /* Remember all addresses for the host */
@@ -383,6 +443,7 @@ static name_chain *new_name_chain(apr_pool_t *p,
     new->server = s;
     new->sar = sar;
     new->next = NULL;
+    new->index = NULL;
     return new;
 }
 
@@ -469,6 +530,13 @@ static void dump_a_vhost(apr_file_t *f, ipaddr_chain *ic)
                     "%8s default server %s (%s:%u)\n",
                     buf, "", ic->server->server_hostname,
                     ic->server->defn_name, ic->server->defn_line_number);
+    if (ic->names->index) {
+        name_index *ni = ic->names->index;
+        apr_file_printf(f, "%8s name index: %d entries, %u names, "
+                        "%u wildcard suffixes, %d other wildcards\n",
+                        "", ni->nelts, apr_hash_count(ni->names),
+                        apr_hash_count(ni->suffixes), ni->wild->nelts);
+    }
     for (nc = ic->names; nc; nc = nc->next) {
         if (nc->sar->host_port) {
             apr_file_printf(f, "%8s port %u ", "", nc->sar->host_port);
@@ -561,6 +629,86 @@ static void add_name_vhost_config(apr_pool_t *p, server_rec *main_s,
    }
 }
 
+static void name_index_add(apr_pool_t *p, apr_hash_t *h, const char *name,
+                           int pos)
+{
+    apr_array_header_t *arr;
+    char *key;
+
+    key = apr_pstrdup(p, name);
+    ap_str_tolower(key);
+    arr = apr_hash_get(h, key, APR_HASH_KEY_STRING);
+    if (!arr) {
+        arr = apr_array_make(p, 1, sizeof(int));
+        apr_hash_set(h, key, APR_HASH_KEY_STRING, arr);
+    }
+    else if (APR_ARRAY_IDX(arr, arr->nelts - 1, int) == pos) {
+        return;
+    }
+    APR_ARRAY_PUSH(arr, int) = pos;
+}
+
+static void build_name_index(apr_pool_t *p, name_chain *head)
+{
+    name_index *ni;
+    name_chain *nc;
+    int n, pos, i;
+
+    for (n = 0, nc = head; nc; nc = nc->next) {
+        ++n;
+    }
+    if (n < VHOST_NAME_INDEX_MIN) {
+        return;
+    }
+
+    ni = apr_pcalloc(p, sizeof(*ni));
+    ni->entries = apr_palloc(p, n * sizeof(name_chain *));
+    ni->nelts = n;
+    ni->names = apr_hash_make(p);
+    ni->suffixes = apr_hash_make(p);
+    ni->virthosts = apr_hash_make(p);
+    ni->wild = apr_array_make(p, 0, sizeof(name_wild));
+
+    for (pos = 0, nc = head; nc; nc = nc->next, ++pos) {
+        server_rec *s = nc->server;
+
+        ni->entries[pos] = nc;
+        if (nc->sar->virthost) {
+            name_index_add(p, ni->virthosts, nc->sar->virthost, pos);
+        }
+        if (s->server_hostname) {
+            name_index_add(p, ni->names, s->server_hostname, pos);
+        }
+        if (s->names) {
+            char **name = (char **)s->names->elts;
+            for (i = 0; i < s->names->nelts; ++i) {
+                if (name[i]) {
+                    name_index_add(p, ni->names, name[i], pos);
+                }
+            }
+        }
+        if (s->wild_names) {
+            char **name = (char **)s->wild_names->elts;
+            for (i = 0; i < s->wild_names->nelts; ++i) {
+                if (!name[i]) {
+                    continue;
+                }
+                if (name[i][0] == '*' && name[i][1] == '.'
+                    && !strpbrk(name[i] + 1, "*?")) {
+                    name_index_add(p, ni->suffixes, name[i] + 1, pos);
+                }
+                else {
+                    name_wild *w = apr_array_push(ni->wild);
+                    w->pos = pos;
+                    w->pattern = name[i];
+                }
+            }
+        }
+    }
+
+    head->index = ni;
+}
+
 /* compile the tables and such we need to do the run-time vhost lookups */
 AP_DECLARE(void) ap_fini_vhost_config(apr_pool_t *p, server_rec *main_s)
 {
@@ -569,6 +717,8 @@ AP_DECLARE(void) ap_fini_vhost_config(apr_pool_t *p, server_rec *main_s)
     server_rec *s;
     int i;
     ipaddr_chain **iphash_table_tail[IPHASH_TABLE_SIZE];
+    /* reverse lookups by address, shared by the vhosts without a name */
+    apr_hash_t *reverse_names = apr_hash_make(p);
 
     /* Main host first */
     s = main_s;
@@ -652,19 +802,27 @@ AP_DECLARE(void) ap_fini_vhost_config(apr_pool_t *p, server_rec *main_s)
                     apr_pstrdup(p, "bogus_host_without_forward_dns");
             }
             else {
-                apr_status_t rv;
-                char *hostname;
-
-                rv = apr_getnameinfo(&hostname, s->addrs->host_addr, 0);
-                if (rv == APR_SUCCESS) {
-                    s->server_hostname = apr_pstrdup(p, hostname);
+                apr_status_t rv = APR_SUCCESS;
+                char *hostname, *ipaddr_str;
+
+                apr_sockaddr_ip_get(&ipaddr_str, s->addrs->host_addr);
+                hostname = apr_hash_get(reverse_names, ipaddr_str,
+                                        APR_HASH_KEY_STRING);
+                if (!hostname) {
+                    char *name;
+
+                    rv = apr_getnameinfo(&name, s->addrs->host_addr, 0);
+                    hostname = (rv == APR_SUCCESS) ? apr_pstrdup(p, name)
+                                                   : "";
+                    apr_hash_set(reverse_names, ipaddr_str,
+                                 APR_HASH_KEY_STRING, hostname);
+                }
+                if (*hostname) {
+                    s->server_hostname = hostname;
                 }
                 else {
                     /* again, what can we do?  They didn't specify a
                        ServerName, and their DNS isn't working. -djg */
-                    char *ipaddr_str;
-
-                    apr_sockaddr_ip_get(&ipaddr_str, s->addrs->host_addr);
                     ap_log_error(APLOG_MARK, APLOG_ERR, rv, main_s, APLOGNO(00549)
                                  "Failed to resolve server name "
                                  "for %s (check DNS) -- or specify an explicit "
@@ -677,6 +835,23 @@ AP_DECLARE(void) ap_fini_vhost_config(apr_pool_t *p, server_rec *main_s)
         }
     }
 
+    for (i = 0; i < IPHASH_TABLE_SIZE; ++i) {
+        ipaddr_chain *ic;
+        for (ic = iphash_table[i]; ic; ic = ic->next) {
+            if (ic->names) {
+                build_name_index(p, ic->names);
+            }
+        }
+    }
+    {
+        ipaddr_chain *ic;
+        for (ic = default_list; ic; ic = ic->next) {
+            if (ic->names) {
+                build_name_index(p, ic->names);
+            }
+        }
+    }
+
 #ifdef IPHASH_STATISTICS
     dump_iphash_statistics(main_s);
 #endif
@@ -977,6 +1152,83 @@ AP_DECLARE(int) ap_matches_request_vhost(request_rec *r, const char *host,
 }
 
 
+/* first position before limit in positions whose address has the port */
+static APR_INLINE int name_index_first(name_index *ni,
+                                       const apr_array_header_t *positions,
+                                       apr_port_t port, int limit)
+{
+    int i;
+
+    if (positions) {
+        for (i = 0; i < positions->nelts; ++i) {
+            int pos = APR_ARRAY_IDX(positions, i, int);
+            server_addr_rec *sar;
+
+            if (pos >= limit) {
+                break;
+            }
+            sar = ni->entries[pos]->sar;
+            if (sar->host_port == 0 || port == sar->host_port) {
+                return pos;
+            }
+        }
+    }
+    return limit;
+}
+
+/* the name_index equivalent of the name_chain walk below */
+static server_rec *name_index_lookup(request_rec *r, name_index *ni,
+                                     const char *host, apr_port_t port)
+{
+    const char *lhost = host, *q;
+    int best, i;
+
+    for (q = host; *q; ++q) {
+        if (apr_isupper(*q)) {
+            char *l = apr_pstrdup(r->pool, host);
+            ap_str_tolower(l);
+            lhost = l;
+            break;
+        }
+    }
+
+    best = name_index_first(ni, apr_hash_get(ni->names, lhost,
+                                             APR_HASH_KEY_STRING),
+                            port, ni->nelts);
+    for (q = strchr(lhost, '.'); q; q = strchr(q + 1, '.')) {
+        best = name_index_first(ni, apr_hash_get(ni->suffixes, q,
+                                                 APR_HASH_KEY_STRING),
+                                port, best);
+    }
+    for (i = 0; i < ni->wild->nelts; ++i) {
+        name_wild *w = &APR_ARRAY_IDX(ni->wild, i, name_wild);
+        server_addr_rec *sar;
+
+        if (w->pos >= best) {
+            break;
+        }
+        sar = ni->entries[w->pos]->sar;
+        if ((sar->host_port == 0 || port == sar->host_port)
+            && !ap_strcasecmp_match(host, w->pattern)) {
+            best = w->pos;
+            break;
+        }
+    }
+    if (best < ni->nelts) {
+        return ni->entries[best]->server;
+    }
+
+    /* Fallback: the first matching virthost */
+    best = name_index_first(ni, apr_hash_get(ni->virthosts, lhost,
+                                             APR_HASH_KEY_STRING),
+                            port, ni->nelts);
+    if (best < ni->nelts) {
+        return ni->entries[best]->server;
+    }
+
+    return NULL;
+}
+
 /*
  * Updates r->server from ServerName/ServerAlias. Per the interaction
  * of ip and name-based vhosts, it only looks in the best match from the
@@ -1010,6 +1262,15 @@ static int update_server_from_aliases(request_rec *r)
 
     port = r->connection->local_addr->port;
 
+    src = r->connection->vhost_lookup_data;
+    if (src && src->index) {
+        s = name_index_lookup(r, src->index, host, port);
+        if (s) {
+            goto found;
+        }
+        return HTTP_BAD_REQUEST;
+    }
+
     /* Recall that the name_chain is a list of server_addr_recs, some of
      * whose ports may not match.  Also each server may appear more than
      * once in the chain -- specifically, it will appear once for each
@@ -1160,7 +1421,7 @@ AP_DECLARE(void) ap_update_vhost_from_headers(request_rec *r)
 AP_DECLARE(int) ap_update_vhost_from_headers_ex(request_rec *r, int require_match)
 {
     core_server_config *conf = ap_get_core_module_config(r->server->module_config);
-    const char *host_header = apr_table_get(r->headers_in, "Host");
+    const char *host_header = ap_get_request_header(r, AP_HDR_HOST);
     int is_v6literal = 0;
     int have_hostname_from_url = 0;
     int rc = HTTP_OK;
@@ -299,6 +299,9 @@ struct connection {
                endwrite,        /* Request written */
                beginread,       /* First byte of input */
                end;             /* Connection closed */
+    apr_time_t intended;        /* Scheduled start of request (-O) */
+    const char *request;        /* request being sent */
+    apr_size_t reqlen;
 
     apr_size_t keptalive;       /* subsequent keepalive requests */
 #ifdef USE_SSL
@@ -313,6 +316,22 @@ struct data {
     apr_interval_time_t time;     /* time for connection */
 };
 
+/* the times measured for each request, see hist_log2() */
+enum {
+    HIST_CONNECT = 0,
+    HIST_PROCESSING,
+    HIST_WAITING,
+    HIST_TOTAL,
+    HIST_COUNT
+};
+
+struct histogram {
+    apr_uint64_t *counts;
+    apr_int64_t total;            /* number of values recorded */
+    apr_interval_time_t min, max;
+    double sum, sumsq;            /* for the mean and standard deviation */
+};
+
 struct metrics {
     apr_size_t doclen;          /* the length the document should be */
     apr_int64_t totalread;      /* total number of bytes read */
@@ -351,8 +370,12 @@ struct worker {
     int concurrency;
     int succeeded_once;  /* response header received once */
     apr_int64_t started; /* number of requests started, so no excess */
+    apr_interval_time_t interval; /* between scheduled requests (-O) */
+    apr_time_t next_send;         /* next scheduled request (-O) */
+    apr_uint32_t seed;            /* for picking the URLs (-L) */
 
     struct data *stats;
+    struct histogram hists[HIST_COUNT];
     struct connection *conns;
     struct delayed_ring_t delayed_ring;
 
@@ -363,6 +386,7 @@ struct worker {
 
 /* global metrics (consolidated from workers') */
 static struct metrics metrics;
+static struct histogram hists[HIST_COUNT];
 static void consolidate_metrics(void);
 
 #define ap_min(a,b) (((a)<(b))?(a):(b))
@@ -406,12 +430,15 @@ const char *myhost;
 apr_port_t connectport;
 const char *gnuplot;          /* GNUplot file */
 const char *csvperc;          /* CSV Percentile file */
+const char *jsonfile;         /* JSON summary file */
+const char *urlfile;          /* URL list file */
 const char *fullurl;
 const char *colonhost;
 int isproxy = 0;
 apr_interval_time_t hbperiod = 0; /* heartbeat period (when time limited) */
 apr_interval_time_t aprtimeout = apr_time_from_sec(30); /* timeout value */
 apr_interval_time_t ramp = apr_time_from_msec(0); /* ramp delay */
+double rate = 0;        /* requests per second, open-loop (-O) */
 int pollset_wakeable = 0;
 
 /* overrides for ab-generated common headers */
@@ -443,16 +470,30 @@ apr_time_t start, logtime;
 volatile apr_time_t lasttime, stoptime;
 
 /* global request (and its length) */
-char _request[8192];
-char *request = _request;
+char *request;
 apr_size_t reqlen;
 
+/* requests of the URL list (-L), picked by their weight */
+struct url_request {
+    const char *path;
+    char *request;
+    apr_size_t reqlen;
+    apr_uint32_t weight;        /* cumulated with the previous ones' */
+};
+apr_array_header_t *urls;
+
 /* interesting percentiles */
-int percs[] = {50, 66, 75, 80, 90, 95, 98, 99, 100};
+double percs[] = {50, 66, 75, 80, 90, 95, 98, 99, 99.9, 99.99, 99.999, 100};
+
+/* histograms' precision (significant digits) and layout */
+int hist_digits = 3;
+int hist_shift;             /* log2 of the counts per power of two */
+apr_size_t hist_len;        /* number of counts */
+#define HIST_MAX_VALUE apr_time_from_sec(3600)
 
 struct worker *workers;     /* worker threads */
 struct connection *conns;   /* connection array */
-struct data *stats;         /* data for each request */
+struct data *stats;         /* data for each request (gnuplot only) */
 apr_pool_t *cntxt;
 
 apr_sockaddr_t *mysa;
@@ -498,6 +539,7 @@ static APR_INLINE void abort_connection(struct connection *c)
 
 static void output_results(void);
 static void output_html_results(void);
+static void output_json(double timetaken);
 
 /* --------------------------------------------------------- */
 
@@ -596,8 +638,8 @@ static void set_polled_events(struct connection *c, apr_int16_t new_reqevents)
             }
         }
 
+        c->pollfd.reqevents = new_reqevents;
         if (new_reqevents != 0) {
-            c->pollfd.reqevents = new_reqevents;
             rv = apr_pollset_add(c->worker->pollset, &c->pollfd);
             if (rv != APR_SUCCESS) {
                 apr_err("apr_pollset_add()", rv);
@@ -615,6 +657,47 @@ static void set_conn_state(struct connection *c, connect_state_e new_state,
     set_polled_events(c, events);
 }
 
+/* --------------------------------------------------------- */
+
+/* choose the request to send on the connection, by weight from the URL list
+ * if any.
+ */
+static void pick_request(struct connection *c)
+{
+    struct worker *worker = c->worker;
+    const struct url_request *u;
+    apr_uint32_t n;
+    int lo, hi;
+
+    if (!urls) {
+        c->request = request;
+        c->reqlen = reqlen;
+        return;
+    }
+
+    /* xorshift32 */
+    n = worker->seed;
+    n ^= n << 13;
+    n ^= n >> 17;
+    n ^= n << 5;
+    worker->seed = n;
+
+    u = &APR_ARRAY_IDX(urls, urls->nelts - 1, struct url_request);
+    n %= u->weight;
+    for (lo = 0, hi = urls->nelts - 1; lo < hi;) {
+        int mid = (lo + hi) / 2;
+        if (APR_ARRAY_IDX(urls, mid, struct url_request).weight > n) {
+            hi = mid;
+        }
+        else {
+            lo = mid + 1;
+        }
+    }
+    u = &APR_ARRAY_IDX(urls, lo, struct url_request);
+    c->request = u->request;
+    c->reqlen = u->reqlen;
+}
+
 /* --------------------------------------------------------- */
 /* write out request to a connection - assumes we can write
  * (small) request out in one go into our new socket buffer
@@ -916,7 +999,8 @@ static void write_request(struct connection * c)
                 c->start = tnow;
             c->connect = tnow;
             c->rwrote = 0;
-            c->rwrite = reqlen;
+            pick_request(c);
+            c->rwrite = c->reqlen;
             if (send_body)
                 c->rwrite += postlen;
             l = c->rwrite;
@@ -929,7 +1013,7 @@ static void write_request(struct connection * c)
 
 #ifdef USE_SSL
         if (c->ssl) {
-            e = SSL_write(c->ssl, request + c->rwrote, l);
+            e = SSL_write(c->ssl, c->request + c->rwrote, l);
             if (e <= 0) {
                 switch (SSL_get_error(c->ssl, e)) {
                 case SSL_ERROR_WANT_READ:
@@ -951,7 +1035,7 @@ static void write_request(struct connection * c)
         else
 #endif
         {
-            e = apr_socket_send(c->aprsock, request + c->rwrote, &l);
+            e = apr_socket_send(c->aprsock, c->request + c->rwrote, &l);
             if (e != APR_SUCCESS && !l) {
                 if (APR_STATUS_IS_EAGAIN(e)) {
                     set_conn_state(c, STATE_WRITE, APR_POLLOUT);
@@ -979,47 +1063,137 @@ static void write_request(struct connection * c)
 
 /* calculate and output results */
 
-static int compradre(struct data * a, struct data * b)
+/*
+ * The times are recorded in log-linear histograms (a la HdrHistogram):
+ * the values below (2 << hist_shift) have a count each, then each power
+ * of two range above is divided in (1 << hist_shift) counts, so that the
+ * relative error is below 10^-hist_digits whatever the magnitude. The
+ * histograms of the workers are merged by adding up their counts.
+ */
+
+static int hist_log2(apr_uint64_t v)
 {
-    if ((a->ctime) < (b->ctime))
-        return -1;
-    if ((a->ctime) > (b->ctime))
-        return +1;
-    return 0;
+    int n = 0, s;
+
+    for (s = 32; s; s >>= 1) {
+        if (v >> s) {
+            v >>= s;
+            n += s;
+        }
+    }
+    return n;
 }
 
-static int comprando(struct data * a, struct data * b)
+static void hist_setup(void)
 {
-    if ((a->time) < (b->time))
-        return -1;
-    if ((a->time) > (b->time))
-        return +1;
-    return 0;
+    apr_uint64_t sub = 2;
+    int i;
+
+    for (i = 0; i < hist_digits; i++) {
+        sub *= 10;
+    }
+    hist_shift = hist_log2(sub - 1);
+    hist_len = (apr_size_t)(hist_log2(HIST_MAX_VALUE) - hist_shift + 2)
+               << hist_shift;
 }
 
-static int compri(struct data * a, struct data * b)
+static void hist_init(struct histogram *h, apr_pool_t *p)
 {
-    apr_interval_time_t p = a->time - a->ctime;
-    apr_interval_time_t q = b->time - b->ctime;
-    if (p < q)
-        return -1;
-    if (p > q)
-        return +1;
-    return 0;
+    h->counts = apr_pcalloc(p, hist_len * sizeof(*h->counts));
+    h->min = AB_MAX;
 }
 
-static int compwait(struct data * a, struct data * b)
+static apr_size_t hist_index(apr_interval_time_t v)
 {
-    if ((a->waittime) < (b->waittime))
-        return -1;
-    if ((a->waittime) > (b->waittime))
-        return 1;
-    return 0;
+    apr_uint64_t u = (apr_uint64_t)ap_min(v, HIST_MAX_VALUE);
+    int b = hist_log2(u | ((APR_UINT64_C(2) << hist_shift) - 1)) - hist_shift;
+
+    return ((apr_size_t)b << hist_shift) + (apr_size_t)(u >> b);
+}
+
+/* highest value recorded in the count at index i */
+static apr_interval_time_t hist_value(apr_size_t i)
+{
+    int b = (i >> hist_shift) < 2 ? 0 : (int)(i >> hist_shift) - 1;
+    apr_uint64_t sub = i - ((apr_size_t)b << hist_shift);
+
+    return (apr_interval_time_t)(((sub + 1) << b) - 1);
+}
+
+static void hist_record(struct histogram *h, apr_interval_time_t v)
+{
+    v = ap_max(v, 0);
+    h->counts[hist_index(v)]++;
+    h->total++;
+    h->min = ap_min(h->min, v);
+    h->max = ap_max(h->max, v);
+    h->sum += v;
+    h->sumsq += (double)v * v;
+}
+
+static void hist_merge(struct histogram *h, const struct histogram *from)
+{
+    apr_size_t i;
+
+    if (!from->total) {
+        return;
+    }
+    if (!h->counts) {
+        hist_init(h, cntxt);
+    }
+    for (i = 0; i < hist_len; i++) {
+        h->counts[i] += from->counts[i];
+    }
+    h->total += from->total;
+    h->min = ap_min(h->min, from->min);
+    h->max = ap_max(h->max, from->max);
+    h->sum += from->sum;
+    h->sumsq += from->sumsq;
+}
+
+static double hist_mean(const struct histogram *h)
+{
+    return h->total ? h->sum / h->total : 0;
+}
+
+/* the sample standard deviation */
+static double hist_sd(const struct histogram *h)
+{
+    double var;
+
+    if (h->total < 2) {
+        return 0;
+    }
+    var = (h->sumsq - h->sum * h->sum / h->total) / (h->total - 1);
+    return var > 0 ? sqrt(var) : 0;
+}
+
+/* the time within which p percent of the values are */
+static apr_interval_time_t hist_percentile(const struct histogram *h,
+                                           double p)
+{
+    apr_uint64_t target, seen = 0;
+    apr_size_t i;
+
+    if (!h->total || p >= 100) {
+        return h->max;
+    }
+    target = (apr_uint64_t)ceil(p * h->total / 100);
+    if (!target) {
+        target = 1;
+    }
+    for (i = 0; i < hist_len; i++) {
+        seen += h->counts[i];
+        if (seen >= target) {
+            return ap_max(h->min, ap_min(hist_value(i), h->max));
+        }
+    }
+    return h->max;
 }
 
 static void consolidate_metrics(void)
 {
-    int i;
+    int i, j;
 
     for (i = 0; i < num_workers; i++) {
         struct worker *worker = &workers[i];
@@ -1045,6 +1219,10 @@ static void consolidate_metrics(void)
             metrics.doclen = worker->metrics.doclen;
         }
 
+        for (j = 0; j < HIST_COUNT; j++) {
+            hist_merge(&hists[j], &worker->hists[j]);
+        }
+
 #ifdef USE_SSL
         if (is_ssl && !metrics.ssl_info[0] && worker->metrics.ssl_info[0]) {
             apr_cpystrn(metrics.ssl_info, worker->metrics.ssl_info,
@@ -1085,6 +1263,8 @@ static void output_results(void)
 #endif
     printf("\n");
     printf("Document Path:          %s\n", path);
+    if (urls)
+        printf("URL list:               %s (%d paths)\n", urlfile, urls->nelts);
     if (nolength)
         printf("Document Length:        Variable\n");
     else
@@ -1094,6 +1274,8 @@ static void output_results(void)
     printf("Concurrency Level:      %d\n", concurrency);
     printf("Concurrency achieved:   %d\n", metrics.concurrent);
     printf("Rampup delay:           %" APR_TIME_T_FMT " [ms]\n", apr_time_as_msec(ramp));
+    if (rate)
+        printf("Scheduled rate:         %.2f [#/sec] (open-loop)\n", rate);
     printf("Time taken for tests:   %.3f seconds\n", timetaken);
     printf("Complete requests:      %" APR_INT64_T_FMT "\n", metrics.done);
     printf("Failed requests:        %" APR_INT64_T_FMT "\n", metrics.bad);
@@ -1132,113 +1314,40 @@ static void output_results(void)
     if (metrics.done > 0) {
         /* work out connection times */
         apr_int64_t i, count = ap_min(metrics.done, requests);
-        apr_time_t totalcon = 0, total = 0, totald = 0, totalwait = 0;
+        const struct histogram *hcon = &hists[HIST_CONNECT],
+                               *hd = &hists[HIST_PROCESSING],
+                               *hwait = &hists[HIST_WAITING],
+                               *htot = &hists[HIST_TOTAL];
         apr_time_t meancon, meantot, meand, meanwait;
-        apr_interval_time_t mincon = AB_MAX, mintot = AB_MAX, mind = AB_MAX,
-                            minwait = AB_MAX;
-        apr_interval_time_t maxcon = 0, maxtot = 0, maxd = 0, maxwait = 0;
-        apr_interval_time_t mediancon = 0, mediantot = 0, mediand = 0, medianwait = 0;
-        double sdtot = 0, sdcon = 0, sdd = 0, sdwait = 0;
-
-        for (i = 0; i < count; i++) {
-            struct data *s = &stats[i];
-            mincon = ap_min(mincon, s->ctime);
-            mintot = ap_min(mintot, s->time);
-            mind = ap_min(mind, s->time - s->ctime);
-            minwait = ap_min(minwait, s->waittime);
-
-            maxcon = ap_max(maxcon, s->ctime);
-            maxtot = ap_max(maxtot, s->time);
-            maxd = ap_max(maxd, s->time - s->ctime);
-            maxwait = ap_max(maxwait, s->waittime);
-
-            totalcon += s->ctime;
-            total += s->time;
-            totald += s->time - s->ctime;
-            totalwait += s->waittime;
-        }
-        meancon = totalcon / count;
-        meantot = total / count;
-        meand = totald / count;
-        meanwait = totalwait / count;
-
-        /* calculating the sample variance: the sum of the squared deviations, divided by n-1 */
-        for (i = 0; i < count; i++) {
-            struct data *s = &stats[i];
-            double a;
-            a = ((double)s->time - meantot);
-            sdtot += a * a;
-            a = ((double)s->ctime - meancon);
-            sdcon += a * a;
-            a = ((double)s->time - (double)s->ctime - meand);
-            sdd += a * a;
-            a = ((double)s->waittime - meanwait);
-            sdwait += a * a;
-        }
-
-        sdtot = (count > 1) ? sqrt(sdtot / (count - 1)) : 0;
-        sdcon = (count > 1) ? sqrt(sdcon / (count - 1)) : 0;
-        sdd = (count > 1) ? sqrt(sdd / (count - 1)) : 0;
-        sdwait = (count > 1) ? sqrt(sdwait / (count - 1)) : 0;
-
-        /*
-         * XXX: what is better; this hideous cast of the compradre function; or
-         * the four warnings during compile ? dirkx just does not know and
-         * hates both/
-         */
-        qsort(stats, count, sizeof(struct data),
-              (int (*) (const void *, const void *)) compradre);
-        if ((count > 1) && (count % 2))
-            mediancon = (stats[count / 2].ctime + stats[count / 2 + 1].ctime) / 2;
-        else
-            mediancon = stats[count / 2].ctime;
-
-        qsort(stats, count, sizeof(struct data),
-              (int (*) (const void *, const void *)) compri);
-        if ((count > 1) && (count % 2))
-            mediand = (stats[count / 2].time + stats[count / 2 + 1].time \
-                       -stats[count / 2].ctime - stats[count / 2 + 1].ctime) / 2;
-        else
-            mediand = stats[count / 2].time - stats[count / 2].ctime;
-
-        qsort(stats, count, sizeof(struct data),
-              (int (*) (const void *, const void *)) compwait);
-        if ((count > 1) && (count % 2))
-            medianwait = (stats[count / 2].waittime + stats[count / 2 + 1].waittime) / 2;
-        else
-            medianwait = stats[count / 2].waittime;
-
-        qsort(stats, count, sizeof(struct data),
-              (int (*) (const void *, const void *)) comprando);
-        if ((count > 1) && (count % 2))
-            mediantot = (stats[count / 2].time + stats[count / 2 + 1].time) / 2;
-        else
-            mediantot = stats[count / 2].time;
+        apr_interval_time_t mincon, mintot, mind, minwait;
+        apr_interval_time_t maxcon, maxtot, maxd, maxwait;
+        apr_interval_time_t mediancon, mediantot, mediand, medianwait;
+        double sdtot, sdcon, sdd, sdwait;
 
         printf("\nConnection Times (ms)\n");
         /*
          * Reduce stats from apr time to milliseconds
          */
-        mincon     = ap_round_ms(mincon);
-        mind       = ap_round_ms(mind);
-        minwait    = ap_round_ms(minwait);
-        mintot     = ap_round_ms(mintot);
-        meancon    = ap_round_ms(meancon);
-        meand      = ap_round_ms(meand);
-        meanwait   = ap_round_ms(meanwait);
-        meantot    = ap_round_ms(meantot);
-        mediancon  = ap_round_ms(mediancon);
-        mediand    = ap_round_ms(mediand);
-        medianwait = ap_round_ms(medianwait);
-        mediantot  = ap_round_ms(mediantot);
-        maxcon     = ap_round_ms(maxcon);
-        maxd       = ap_round_ms(maxd);
-        maxwait    = ap_round_ms(maxwait);
-        maxtot     = ap_round_ms(maxtot);
-        sdcon      = ap_double_ms(sdcon);
-        sdd        = ap_double_ms(sdd);
-        sdwait     = ap_double_ms(sdwait);
-        sdtot      = ap_double_ms(sdtot);
+        mincon     = ap_round_ms(hcon->min);
+        mind       = ap_round_ms(hd->min);
+        minwait    = ap_round_ms(hwait->min);
+        mintot     = ap_round_ms(htot->min);
+        meancon    = ap_round_ms(hist_mean(hcon));
+        meand      = ap_round_ms(hist_mean(hd));
+        meanwait   = ap_round_ms(hist_mean(hwait));
+        meantot    = ap_round_ms(hist_mean(htot));
+        mediancon  = ap_round_ms(hist_percentile(hcon, 50));
+        mediand    = ap_round_ms(hist_percentile(hd, 50));
+        medianwait = ap_round_ms(hist_percentile(hwait, 50));
+        mediantot  = ap_round_ms(hist_percentile(htot, 50));
+        maxcon     = ap_round_ms(hcon->max);
+        maxd       = ap_round_ms(hd->max);
+        maxwait    = ap_round_ms(hwait->max);
+        maxtot     = ap_round_ms(htot->max);
+        sdcon      = ap_double_ms(hist_sd(hcon));
+        sdd        = ap_double_ms(hist_sd(hd));
+        sdwait     = ap_double_ms(hist_sd(hwait));
+        sdtot      = ap_double_ms(hist_sd(htot));
 
         if (confidence) {
 #define CONF_FMT_STRING "%5" APR_TIME_T_FMT " %4" APR_TIME_T_FMT " %5.1f %6" APR_TIME_T_FMT " %7" APR_TIME_T_FMT "\n"
@@ -1280,18 +1389,18 @@ static void output_results(void)
         }
 
 
-        /* Sorted on total connect times */
-        if (percentile && (count > 1)) {
+        /* Percentiles of the total times */
+        if (percentile && (htot->total > 1)) {
             printf("\nPercentage of the requests served within a certain time (ms)\n");
-            for (i = 0; i < sizeof(percs) / sizeof(int); i++) {
+            for (i = 0; i < sizeof(percs) / sizeof(percs[0]); i++) {
                 if (percs[i] <= 0)
                     printf(" 0%%  <0> (never)\n");
                 else if (percs[i] >= 100)
                     printf(" 100%%  %5" APR_TIME_T_FMT " (longest request)\n",
-                           ap_round_ms(stats[count - 1].time));
+                           ap_round_ms(htot->max));
                 else
-                    printf("  %d%%  %5" APR_TIME_T_FMT "\n", percs[i],
-                           ap_round_ms(stats[(unsigned long)count * percs[i] / 100].time));
+                    printf("  %g%%  %5" APR_TIME_T_FMT "\n", percs[i],
+                           ap_round_ms(hist_percentile(htot, percs[i])));
             }
         }
         if (csvperc) {
@@ -1304,11 +1413,11 @@ static void output_results(void)
             for (i = 0; i <= 100; i++) {
                 double t;
                 if (i == 0)
-                    t = ap_double_ms(stats[0].time);
+                    t = ap_double_ms(htot->min);
                 else if (i == 100)
-                    t = ap_double_ms(stats[count - 1].time);
+                    t = ap_double_ms(htot->max);
                 else
-                    t = ap_double_ms(stats[(unsigned long) (0.5 + (double)count * i / 100.0)].time);
+                    t = ap_double_ms(hist_percentile(htot, i));
                 fprintf(out, "%" APR_INT64_T_FMT ",%.3f\n", i, t);
             }
             fclose(out);
@@ -1335,6 +1444,8 @@ static void output_results(void)
             fclose(out);
         }
     }
+
+    output_json(timetaken);
 }
 
 /* --------------------------------------------------------- */
@@ -1358,6 +1469,10 @@ static void output_html_results(void)
     printf("<tr %s><th colspan=2 %s>Document Path:</th>"
        "<td colspan=2 %s>%s</td></tr>\n",
        trstring, tdstring, tdstring, path);
+    if (urls)
+        printf("<tr %s><th colspan=2 %s>URL list:</th>"
+           "<td colspan=2 %s>%s (%d paths)</td></tr>\n",
+           trstring, tdstring, tdstring, urlfile, urls->nelts);
     if (nolength)
         printf("<tr %s><th colspan=2 %s>Document Length:</th>"
             "<td colspan=2 %s>Variable</td></tr>\n",
@@ -1378,6 +1493,10 @@ static void output_html_results(void)
     printf("<tr %s><th colspan=2 %s>Rampup delay:</th>"
        "<td colspan=2 %s>%" APR_TIME_T_FMT " [ms]</td></tr>\n",
        trstring, tdstring, tdstring, apr_time_as_msec(ramp));
+    if (rate)
+        printf("<tr %s><th colspan=2 %s>Scheduled rate:</th>"
+           "<td colspan=2 %s>%.2f [#/sec] (open-loop)</td></tr>\n",
+           trstring, tdstring, tdstring, rate);
     printf("<tr %s><th colspan=2 %s>Time taken for tests:</th>"
        "<td colspan=2 %s>%.3f seconds</td></tr>\n",
        trstring, tdstring, tdstring, timetaken);
@@ -1430,31 +1549,11 @@ static void output_html_results(void)
     }
     {
         /* work out connection times */
-        apr_int64_t i, count = ap_min(metrics.done, requests);
-        apr_interval_time_t totalcon = 0, total = 0;
-        apr_interval_time_t mincon = AB_MAX, mintot = AB_MAX;
-        apr_interval_time_t maxcon = 0, maxtot = 0;
-
-        for (i = 0; i < count; i++) {
-            struct data *s = &stats[i];
-            mincon = ap_min(mincon, s->ctime);
-            mintot = ap_min(mintot, s->time);
-            maxcon = ap_max(maxcon, s->ctime);
-            maxtot = ap_max(maxtot, s->time);
-            totalcon += s->ctime;
-            total    += s->time;
-        }
-        /*
-         * Reduce stats from apr time to milliseconds
-         */
-        mincon   = ap_round_ms(mincon);
-        mintot   = ap_round_ms(mintot);
-        maxcon   = ap_round_ms(maxcon);
-        maxtot   = ap_round_ms(maxtot);
-        totalcon = ap_round_ms(totalcon);
-        total    = ap_round_ms(total);
-
-        if (count > 0) { /* avoid division by zero (if 0 count) */
+        const struct histogram *hcon = &hists[HIST_CONNECT],
+                               *hd = &hists[HIST_PROCESSING],
+                               *htot = &hists[HIST_TOTAL];
+
+        if (htot->total > 0) {
             printf("<tr %s><th %s colspan=4>Connection Times (ms)</th></tr>\n",
                trstring, tdstring);
             printf("<tr %s><th %s>&nbsp;</th> <th %s>min</th>   <th %s>avg</th>   <th %s>max</th></tr>\n",
@@ -1463,27 +1562,116 @@ static void output_html_results(void)
                "<td %s>%5" APR_TIME_T_FMT "</td>"
                "<td %s>%5" APR_TIME_T_FMT "</td>"
                "<td %s>%5" APR_TIME_T_FMT "</td></tr>\n",
-               trstring, tdstring, tdstring, mincon, tdstring, totalcon / count, tdstring, maxcon);
+               trstring, tdstring, tdstring, ap_round_ms(hcon->min),
+               tdstring, ap_round_ms(hist_mean(hcon)),
+               tdstring, ap_round_ms(hcon->max));
             printf("<tr %s><th %s>Processing:</th>"
                "<td %s>%5" APR_TIME_T_FMT "</td>"
                "<td %s>%5" APR_TIME_T_FMT "</td>"
                "<td %s>%5" APR_TIME_T_FMT "</td></tr>\n",
-               trstring, tdstring, tdstring, mintot - mincon, tdstring,
-               (total / count) - (totalcon / count), tdstring, maxtot - maxcon);
+               trstring, tdstring, tdstring, ap_round_ms(hd->min),
+               tdstring, ap_round_ms(hist_mean(hd)),
+               tdstring, ap_round_ms(hd->max));
             printf("<tr %s><th %s>Total:</th>"
                "<td %s>%5" APR_TIME_T_FMT "</td>"
                "<td %s>%5" APR_TIME_T_FMT "</td>"
                "<td %s>%5" APR_TIME_T_FMT "</td></tr>\n",
-               trstring, tdstring, tdstring, mintot, tdstring, total / count, tdstring, maxtot);
+               trstring, tdstring, tdstring, ap_round_ms(htot->min),
+               tdstring, ap_round_ms(hist_mean(htot)),
+               tdstring, ap_round_ms(htot->max));
         }
         printf("</table>\n");
     }
+
+    output_json(timetaken);
+}
+
+/* --------------------------------------------------------- */
+
+/* output a JSON summary of the results */
+
+static void output_json_times(FILE *out, const char *name,
+                              const struct histogram *h, int last)
+{
+    apr_size_t i;
+
+    fprintf(out, "  \"%s\": {\n", name);
+    fprintf(out, "    \"min\": %.3f,\n", h->total ? ap_double_ms(h->min) : 0);
+    fprintf(out, "    \"mean\": %.3f,\n", ap_double_ms(hist_mean(h)));
+    fprintf(out, "    \"sd\": %.3f,\n", ap_double_ms(hist_sd(h)));
+    fprintf(out, "    \"max\": %.3f,\n", ap_double_ms(h->max));
+    fprintf(out, "    \"percentiles\": {");
+    for (i = 0; i < sizeof(percs) / sizeof(percs[0]); i++) {
+        fprintf(out, "%s\n      \"%g\": %.3f", i ? "," : "", percs[i],
+                ap_double_ms(hist_percentile(h, percs[i])));
+    }
+    fprintf(out, "\n    }\n  }%s\n", last ? "" : ",");
+}
+
+static void output_json(double timetaken)
+{
+    FILE *out;
+
+    if (!jsonfile) {
+        return;
+    }
+    out = fopen(jsonfile, "w");
+    if (!out) {
+        perror("Cannot open JSON output file");
+        exit(1);
+    }
+    fprintf(out, "{\n");
+    fprintf(out, "  \"workers\": %d,\n", num_workers);
+    fprintf(out, "  \"concurrency\": %d,\n", concurrency);
+    fprintf(out, "  \"rate\": %.2f,\n", rate);
+    fprintf(out, "  \"time_taken\": %.3f,\n", timetaken);
+    fprintf(out, "  \"complete_requests\": %" APR_INT64_T_FMT ",\n", metrics.done);
+    fprintf(out, "  \"failed_requests\": %" APR_INT64_T_FMT ",\n", metrics.bad);
+    fprintf(out, "  \"non_2xx_responses\": %d,\n", metrics.err_response);
+    fprintf(out, "  \"keepalive_requests\": %" APR_INT64_T_FMT ",\n", metrics.doneka);
+    fprintf(out, "  \"total_transferred\": %" APR_INT64_T_FMT ",\n", metrics.totalread);
+    fprintf(out, "  \"requests_per_second\": %.2f,\n",
+            timetaken ? (double) metrics.done / timetaken : 0);
+    fprintf(out, "  \"precision\": %d,\n", hist_digits);
+    output_json_times(out, "connect", &hists[HIST_CONNECT], 0);
+    output_json_times(out, "processing", &hists[HIST_PROCESSING], 0);
+    output_json_times(out, "waiting", &hists[HIST_WAITING], 0);
+    output_json_times(out, "total", &hists[HIST_TOTAL], 1);
+    fprintf(out, "}\n");
+    fclose(out);
 }
 
 /* --------------------------------------------------------- */
 
 /* start asnchronous non-blocking connection */
 
+/*
+ * In open-loop mode (-O), give the next request of the connection its slot
+ * on the worker's timeline and delay it until then, returning non-zero if
+ * so. A late request is sent immediately, but its time is still measured
+ * from its slot so that waiting for a free connection is accounted for.
+ */
+static int schedule_request(struct connection *c)
+{
+    struct worker *worker = c->worker;
+
+    if (!rate || worker_should_stop(worker)) {
+        return 0;
+    }
+
+    c->intended = worker->next_send;
+    worker->next_send += worker->interval;
+    if (c->intended <= apr_time_now()) {
+        return 0;
+    }
+
+    /* slots are increasing so the delayed ring stays sorted */
+    set_polled_events(c, 0);
+    c->delay = c->intended;
+    APR_RING_INSERT_TAIL(&worker->delayed_ring, c, connection, delay_list);
+    return 1;
+}
+
 static void start_connection(struct connection * c)
 {
     struct worker *worker = c->worker;
@@ -1651,6 +1839,7 @@ static void cleanup_connection(struct connection *c, int reuse)
 {
     struct worker *worker = c->worker;
     int good = (c->gotheader && c->bread >= c->length);
+    int resend = 0;
 
     /* close before measuring, to account for shutdown time */
     if (!reuse || !good) {
@@ -1664,17 +1853,30 @@ static void cleanup_connection(struct connection *c, int reuse)
          * as per RFC7230 6.3.1, revert previous accounting (not an error).
          */
         worker->metrics.doneka--;
+        resend = 1; /* in the same slot */
     }
     else {
         /* save out time */
         if (tlimit || worker->metrics.done < worker->requests) {
             apr_time_t tnow = lasttime = c->end = apr_time_now();
-            struct data *s = &worker->stats[worker->metrics.done++ % worker->requests];
-
-            s->starttime = c->start;
-            s->time      = ap_max(0, c->end - c->start);
-            s->ctime     = ap_max(0, c->connect - c->start);
-            s->waittime  = ap_max(0, c->beginread - c->endwrite);
+            apr_time_t start = c->intended ? c->intended : c->start;
+            apr_interval_time_t time = ap_max(0, c->end - start);
+            apr_interval_time_t ctime = ap_max(0, c->connect - c->start);
+            apr_interval_time_t waittime = ap_max(0, c->beginread - c->endwrite);
+
+            hist_record(&worker->hists[HIST_CONNECT], ctime);
+            hist_record(&worker->hists[HIST_PROCESSING], time - ctime);
+            hist_record(&worker->hists[HIST_WAITING], waittime);
+            hist_record(&worker->hists[HIST_TOTAL], time);
+            if (worker->stats) {
+                struct data *s = &worker->stats[worker->metrics.done % worker->requests];
+
+                s->starttime = start;
+                s->time      = time;
+                s->ctime     = ctime;
+                s->waittime  = waittime;
+            }
+            worker->metrics.done++;
 
             if (heartbeatres) {
                 static apr_int64_t reqs_count64;
@@ -1747,7 +1949,9 @@ static void cleanup_connection(struct connection *c, int reuse)
     }
 
     if (!reuse) {
-        start_connection(c); /* nop if worker_should_stop() */
+        if (resend || !schedule_request(c)) {
+            start_connection(c); /* nop if worker_should_stop() */
+        }
     }
     else if (!worker_should_stop(worker)) {
         c->read = 0;
@@ -1760,7 +1964,9 @@ static void cleanup_connection(struct connection *c, int reuse)
 
         c->keptalive++;
         worker->metrics.doneka++;
-        write_request(c);
+        if (!schedule_request(c)) {
+            write_request(c);
+        }
     }
     else {
         shutdown_connection(c);
@@ -1955,6 +2161,9 @@ read_more:
                 int i;
                 apr_time_t now = apr_time_now();
                 for (i = 1; i < worker->concurrency; i++) {
+                    if (schedule_request(&worker->conns[i])) {
+                        continue;
+                    }
                     worker->conns[i].delay = now + (i * ramp);
                     APR_RING_INSERT_TAIL(&worker->delayed_ring, &worker->conns[i],
                                          connection, delay_list);
@@ -2072,15 +2281,75 @@ static void block_signals(int block)
 }
 #endif /* APR_HAS_THREADS */
 
-static void test(void)
+/* build the request for uri, and its (optional) post file */
+static char *build_request(const char *uri, apr_size_t *len)
 {
-    apr_status_t rv;
-    int i, j;
-    int snprintf_res = 0;
+    char *req;
 #ifdef NOT_ASCII
+    apr_status_t rv;
     apr_size_t inbytes_left, outbytes_left;
 #endif
 
+    if (!send_body) {
+        req = apr_psprintf(cntxt,
+            "%s %s HTTP/1.0\r\n"
+            "%s" "%s" "%s"
+            "%s" "\r\n",
+            method_str[method], uri,
+            keepalive ? "Connection: Keep-Alive\r\n" : "",
+            cookie, auth, hdrs);
+    }
+    else {
+        req = apr_psprintf(cntxt,
+            "%s %s HTTP/1.0\r\n"
+            "%s" "%s" "%s"
+            "Content-length: %" APR_SIZE_T_FMT "\r\n"
+            "Content-type: %s\r\n"
+            "%s"
+            "\r\n",
+            method_str[method], uri,
+            keepalive ? "Connection: Keep-Alive\r\n" : "",
+            cookie, auth,
+            postlen,
+            (content_type != NULL) ? content_type : "text/plain", hdrs);
+    }
+
+    if (verbosity >= 2)
+        printf("INFO: %s header == \n---\n%s\n---\n",
+               method_str[method], req);
+
+    *len = strlen(req);
+
+    /*
+     * Combine headers and (optional) post file into one continuous buffer
+     */
+    if (send_body) {
+        char *buff = apr_palloc(cntxt, postlen + *len + 1);
+        memcpy(buff, req, *len);
+        memcpy(buff + *len, postdata, postlen);
+        req = buff;
+    }
+
+#ifdef NOT_ASCII
+    inbytes_left = outbytes_left = *len;
+    rv = apr_xlate_conv_buffer(to_ascii, req, &inbytes_left,
+                   req, &outbytes_left);
+    if (rv || inbytes_left || outbytes_left) {
+        fprintf(stderr, "only simple translation is supported (%d/%"
+                        APR_SIZE_T_FMT "/%" APR_SIZE_T_FMT ")\n",
+                        rv, inbytes_left, outbytes_left);
+        exit(1);
+    }
+#endif              /* NOT_ASCII */
+
+    return req;
+}
+
+static void test(void)
+{
+    apr_status_t rv;
+    int i, j;
+
     if (isproxy) {
         connecthost = apr_pstrdup(cntxt, proxyhost);
         connectport = proxyport;
@@ -2136,63 +2405,23 @@ static void test(void)
         /* Header overridden, no need to add, as it is already in hdrs */
     }
 
-    /* setup request */
-    if (!send_body) {
-        snprintf_res = apr_snprintf(request, sizeof(_request),
-            "%s %s HTTP/1.0\r\n"
-            "%s" "%s" "%s"
-            "%s" "\r\n",
-            method_str[method],
-            (isproxy) ? fullurl : path,
-            keepalive ? "Connection: Keep-Alive\r\n" : "",
-            cookie, auth, hdrs);
-    }
-    else {
-        snprintf_res = apr_snprintf(request,  sizeof(_request),
-            "%s %s HTTP/1.0\r\n"
-            "%s" "%s" "%s"
-            "Content-length: %" APR_SIZE_T_FMT "\r\n"
-            "Content-type: %s\r\n"
-            "%s"
-            "\r\n",
-            method_str[method],
-            (isproxy) ? fullurl : path,
-            keepalive ? "Connection: Keep-Alive\r\n" : "",
-            cookie, auth,
-            postlen,
-            (content_type != NULL) ? content_type : "text/plain", hdrs);
-    }
-    if (snprintf_res >= sizeof(_request)) {
-        err("Request too long\n");
-    }
-
-    if (verbosity >= 2)
-        printf("INFO: %s header == \n---\n%s\n---\n",
-               method_str[method], request);
+    /* setup request(s) */
+    request = build_request(isproxy ? fullurl : path, &reqlen);
+    if (urls) {
+        /* the proxy needs the full URLs, from the same scheme and host */
+        apr_size_t prefix = strlen(fullurl) - strlen(path);
 
-    reqlen = strlen(request);
-
-    /*
-     * Combine headers and (optional) post file into one continuous buffer
-     */
-    if (send_body) {
-        char *buff = apr_palloc(cntxt, postlen + reqlen + 1);
-        strcpy(buff, request);
-        memcpy(buff + reqlen, postdata, postlen);
-        request = buff;
-    }
+        for (i = 0; i < urls->nelts; i++) {
+            struct url_request *u = &APR_ARRAY_IDX(urls, i, struct url_request);
+            const char *uri = u->path;
 
-#ifdef NOT_ASCII
-    inbytes_left = outbytes_left = reqlen;
-    rv = apr_xlate_conv_buffer(to_ascii, request, &inbytes_left,
-                   request, &outbytes_left);
-    if (rv || inbytes_left || outbytes_left) {
-        fprintf(stderr, "only simple translation is supported (%d/%"
-                        APR_SIZE_T_FMT "/%" APR_SIZE_T_FMT ")\n",
-                        rv, inbytes_left, outbytes_left);
-        exit(1);
+            if (isproxy) {
+                uri = apr_pstrcat(cntxt, apr_pstrmemdup(cntxt, fullurl, prefix),
+                                  u->path, NULL);
+            }
+            u->request = build_request(uri, &u->reqlen);
+        }
     }
-#endif              /* NOT_ASCII */
 
     if (myhost) {
         /* This only needs to be done once */
@@ -2214,11 +2443,12 @@ static void test(void)
         apr_err(buf, rv);
     }
 
-    /*
-     * XXX: a way to calculate the stats without requiring O(requests) memory
-     * XXX: would be nice.
+    /* The times of each request are only kept for the gnuplot output, the
+     * other results come from the (fixed size) histograms.
      */
-    stats = apr_pcalloc(cntxt, requests * sizeof(struct data));
+    if (gnuplot) {
+        stats = apr_pcalloc(cntxt, requests * sizeof(struct data));
+    }
 
     conns = apr_pcalloc(cntxt, concurrency * sizeof(struct connection));
 
@@ -2231,7 +2461,17 @@ static void test(void)
         worker->destsa = destsa;
         worker->requests = requests / num_workers;
         worker->concurrency = concurrency / num_workers;
-        worker->stats = &stats[i * worker->requests];
+        worker->seed = 0x9e3779b9 * (apr_uint32_t)(i + 1);
+        if (rate) {
+            worker->interval = ap_max(1, (apr_interval_time_t)
+                                         (APR_USEC_PER_SEC * num_workers / rate));
+        }
+        if (stats) {
+            worker->stats = &stats[i * worker->requests];
+        }
+        for (j = 0; j < HIST_COUNT; j++) {
+            hist_init(&worker->hists[j], cntxt);
+        }
         worker->conns = &conns[i * worker->concurrency];
         for (j = 0; j < worker->concurrency; j++) {
             worker->conns[j].worker = worker;
@@ -2327,6 +2567,8 @@ static void worker_test(struct worker *worker)
 
     /* initialise first connection to determine destination socket address
      * which should be used for next connections. */
+    worker->next_send = apr_time_now();
+    schedule_request(&worker->conns[0]); /* first slot is now (-O) */
     start_connection(&worker->conns[0]);
 
     do {
@@ -2341,7 +2583,15 @@ static void worker_test(struct worker *worker)
                 APR_RING_REMOVE(c, delay_list);
                 APR_RING_ELEM_INIT(c, delay_list);
                 c->delay = 0;
-                start_connection(c);
+                if (c->state == STATE_UNCONNECTED) {
+                    start_connection(c);
+                }
+                else if (!worker_should_stop(worker)) {
+                    write_request(c); /* kept alive, scheduled (-O) */
+                }
+                else {
+                    shutdown_connection(c);
+                }
             }
             else {
                 t = c->delay - now;
@@ -2581,6 +2831,8 @@ static void usage(const char *progname)
     fprintf(stderr, "                    Default is 30 seconds\n");
     fprintf(stderr, "    -R rampdelay    Milliseconds in between each new connection when starting up\n");
     fprintf(stderr, "                    Default is no delay\n");
+    fprintf(stderr, "    -O rate         Send rate requests per second regardless of the responses\n");
+    fprintf(stderr, "                    (open-loop), timing them from their scheduled start\n");
     fprintf(stderr, "    -b windowsize   Size of TCP send/receive buffer, in bytes\n");
     fprintf(stderr, "    -B address      Address to bind to when making outgoing connections\n");
     fprintf(stderr, "    -p postfile     File containing data to POST. Remember also to set -T\n");
@@ -2610,6 +2862,11 @@ static void usage(const char *progname)
     fprintf(stderr, "    -l              Accept variable document length (use this for dynamic pages)\n");
     fprintf(stderr, "    -g filename     Output collected data to gnuplot format file.\n");
     fprintf(stderr, "    -e filename     Output CSV file with percentages served\n");
+    fprintf(stderr, "    -j filename     Output JSON file with a summary of the results\n");
+    fprintf(stderr, "    -L filename     File of paths to request (one per line, with an optional\n");
+    fprintf(stderr, "                    weight) instead of the URL's path. This implies -l\n");
+    fprintf(stderr, "    -D digits       Precision of the times' percentiles (1 to 5)\n");
+    fprintf(stderr, "                    Default is 3 significant digits\n");
     fprintf(stderr, "    -r              Don't exit on socket receive errors.\n");
     fprintf(stderr, "    -m method       Method name\n");
     fprintf(stderr, "    -h              Display usage information (this message)\n");
@@ -2756,6 +3013,63 @@ static apr_status_t open_postfile(const char *pfile)
     return APR_SUCCESS;
 }
 
+/* read the URL list: a path and its (optional) weight per line */
+static apr_status_t open_urlfile(const char *ufile)
+{
+    apr_file_t *urlfd;
+    apr_status_t rv;
+    apr_uint32_t total = 0;
+    char errmsg[120], line[8192];
+    int lineno = 0;
+
+    rv = apr_file_open(&urlfd, ufile, APR_READ | APR_BUFFERED,
+                       APR_OS_DEFAULT, cntxt);
+    if (rv != APR_SUCCESS) {
+        fprintf(stderr, "ab: Could not open URL list file (%s): %s\n", ufile,
+                apr_strerror(rv, errmsg, sizeof errmsg));
+        return rv;
+    }
+
+    urls = apr_array_make(cntxt, 16, sizeof(struct url_request));
+    while ((rv = apr_file_gets(line, sizeof(line), urlfd)) == APR_SUCCESS) {
+        struct url_request *u;
+        char *last, *p, *w, *end = "";
+        long weight = 1;
+
+        ++lineno;
+        p = apr_strtok(line, " \t\r\n", &last);
+        if (!p || *p == '#') {
+            continue;
+        }
+        if ((w = apr_strtok(NULL, " \t\r\n", &last)) != NULL) {
+            weight = strtol(w, &end, 10);
+        }
+        if (*p != '/' || *end || weight < 1 || weight > 1000000
+            || weight > APR_UINT32_MAX - total) {
+            fprintf(stderr, "ab: Invalid line %d of URL list file (%s)\n",
+                    lineno, ufile);
+            apr_file_close(urlfd);
+            return APR_EINVAL;
+        }
+        total += (apr_uint32_t)weight;
+
+        u = apr_array_push(urls);
+        u->path = apr_pstrdup(cntxt, p);
+        u->weight = total;
+    }
+    apr_file_close(urlfd);
+    if (!APR_STATUS_IS_EOF(rv)) {
+        fprintf(stderr, "ab: Could not read URL list file: %s\n",
+                apr_strerror(rv, errmsg, sizeof errmsg));
+        return rv;
+    }
+    if (!urls->nelts) {
+        fprintf(stderr, "ab: No URL in URL list file (%s)\n", ufile);
+        return APR_EINVAL;
+    }
+    return APR_SUCCESS;
+}
+
 /* ------------------------------------------------------- */
 
 /* sort out command-line args and call test */
@@ -2811,7 +3125,7 @@ int main(int argc, const char * const argv[])
     myhost = NULL; /* 0.0.0.0 or :: */
 
     apr_getopt_init(&opt, cntxt, argc, argv);
-    while ((status = apr_getopt(opt, "n:c:t:s:b:T:p:u:v:lrkVhwiIx:y:z:C:H:P:A:g:X:de:SqB:m:R:"
+    while ((status = apr_getopt(opt, "n:c:t:s:b:T:p:u:v:lrkVhwiIx:y:z:C:H:P:A:g:X:de:SqB:m:R:O:j:D:L:"
 #if APR_HAS_THREADS
             "W:"
 #endif
@@ -2863,6 +3177,21 @@ int main(int argc, const char * const argv[])
             case 'e':
                 csvperc = apr_pstrdup(cntxt, opt_arg);
                 break;
+            case 'j':
+                jsonfile = apr_pstrdup(cntxt, opt_arg);
+                break;
+            case 'L':
+                if (open_urlfile(opt_arg) != APR_SUCCESS) {
+                    exit(1);
+                }
+                urlfile = apr_pstrdup(cntxt, opt_arg);
+                nolength = 1; /* the documents differ */
+                break;
+            case 'D':
+                hist_digits = atoi(opt_arg);
+                if (hist_digits < 1 || hist_digits > 5)
+                    err("Invalid precision, must be 1 to 5 digits\n");
+                break;
             case 'S':
                 confidence = 0;
                 break;
@@ -2872,6 +3201,11 @@ int main(int argc, const char * const argv[])
             case 'R':
                 ramp = apr_time_from_msec(atoi(opt_arg)); /* ramp delay */
                 break;
+            case 'O':
+                rate = atof(opt_arg);
+                if (rate <= 0)
+                    err("Invalid request rate\n");
+                break;
             case 'p':
                 if (method != NO_METH)
                     err("Cannot mix POST with other methods\n");
@@ -3141,6 +3475,8 @@ int main(int argc, const char * const argv[])
     else
         heartbeatres = 0;
 
+    hist_setup();
+
 #ifdef USE_SSL
 #ifdef RSAREF
     R_malloc_init();
@@ -69,6 +69,8 @@
 #define MBYTE         1048576
 #define GBYTE         1073741824
 
+#define JOURNAL_LINE  8192      /* longest journal line */
+
 #define DIRINFO (APR_FINFO_MTIME|APR_FINFO_SIZE|APR_FINFO_TYPE|APR_FINFO_LINK)
 
 typedef struct _direntry {
@@ -111,6 +113,7 @@ static apr_file_t *outfile;   /* stdout file handle */
 static apr_off_t unsolicited; /* file size summary for deleted unsolicited
                                  files */
 static ENTRY root; /* ENTRY ring anchor */
+static apr_hash_t *journal_entries; /* -j: the ENTRYs by basename */
 
 /* short program name as called */
 static const char *shortname = "htcacheclean";
@@ -317,6 +320,50 @@ static void delete_parent(const char *path, const char *basename,
 
 }
 
+/*
+ * add a cache entry to the tail of the ring; with -j the entries outlive
+ * the runs, so they are allocated (or moved, if known) one by one
+ */
+static ENTRY *add_entry(apr_pool_t *pool, const char *basename)
+{
+    ENTRY *e;
+
+    if (!journal_entries) {
+        e = apr_palloc(pool, sizeof(ENTRY));
+        e->basename = apr_pstrdup(pool, basename);
+    }
+    else if ((e = apr_hash_get(journal_entries, basename,
+                               APR_HASH_KEY_STRING))) {
+        APR_RING_REMOVE(e, link);
+    }
+    else {
+        apr_size_t len = strlen(basename) + 1;
+
+        e = malloc(sizeof(ENTRY) + len);
+        if (!e) {
+            oom(APR_ENOMEM);
+        }
+        e->basename = (char *)(e + 1);
+        memcpy(e->basename, basename, len);
+        apr_hash_set(journal_entries, e->basename, APR_HASH_KEY_STRING, e);
+    }
+    APR_RING_INSERT_TAIL(&root.link, e, _entry, link);
+
+    return e;
+}
+
+/*
+ * remove a cache entry from the ring
+ */
+static void remove_entry(ENTRY *e)
+{
+    APR_RING_REMOVE(e, link);
+    if (journal_entries) {
+        apr_hash_set(journal_entries, e->basename, APR_HASH_KEY_STRING, NULL);
+        free(e);
+    }
+}
+
 /*
  * delete a single file
  */
@@ -783,15 +830,13 @@ static int process_dir(char *path, apr_pool_t *pool, apr_off_t *nodes)
                         if (apr_file_read_full(fd, &disk_info, len,
                                                &len) == APR_SUCCESS) {
                             apr_file_close(fd);
-                            e = apr_palloc(pool, sizeof(ENTRY));
-                            APR_RING_INSERT_TAIL(&root.link, e, _entry, link);
+                            e = add_entry(pool, d->basename);
                             e->expire = disk_info.expire;
                             e->response_time = disk_info.response_time;
                             e->htime = d->htime;
                             e->dtime = d->dtime;
                             e->hsize = d->hsize;
                             e->dsize = d->dsize;
-                            e->basename = apr_pstrdup(pool, d->basename);
                             if (!disk_info.has_body) {
                                 delete_file(path, apr_pstrcat(p, path, "/",
                                         d->basename, CACHE_DATA_SUFFIX, NULL),
@@ -899,15 +944,13 @@ static int process_dir(char *path, apr_pool_t *pool, apr_off_t *nodes)
                         if (apr_file_read_full(fd, &disk_info, len,
                                                &len) == APR_SUCCESS) {
                             apr_file_close(fd);
-                            e = apr_palloc(pool, sizeof(ENTRY));
-                            APR_RING_INSERT_TAIL(&root.link, e, _entry, link);
+                            e = add_entry(pool, d->basename);
                             e->expire = disk_info.expire;
                             e->response_time = disk_info.response_time;
                             e->htime = d->htime;
                             e->dtime = d->dtime;
                             e->hsize = d->hsize;
                             e->dsize = d->dsize;
-                            e->basename = apr_pstrdup(pool, d->basename);
                             break;
                         }
                         else {
@@ -972,7 +1015,7 @@ static int process_dir(char *path, apr_pool_t *pool, apr_off_t *nodes)
  * purge cache entries
  */
 static void purge(char *path, apr_pool_t *pool, apr_off_t max,
-        apr_off_t inodes, apr_off_t nodes, apr_off_t round)
+        apr_off_t inodes, apr_off_t *nodes, apr_off_t round)
 {
     ENTRY *e, *n, *oldest;
 
@@ -983,9 +1026,9 @@ static void purge(char *path, apr_pool_t *pool, apr_off_t max,
     s.dexpired = 0;
     s.dfresh = 0;
     s.max = max;
-    s.nodes = nodes;
+    s.nodes = *nodes;
     s.inodes = inodes;
-    s.ntotal = nodes;
+    s.ntotal = *nodes;
 
     for (e = APR_RING_FIRST(&root.link);
          e != APR_RING_SENTINEL(&root.link, _entry, link);
@@ -1016,8 +1059,9 @@ static void purge(char *path, apr_pool_t *pool, apr_off_t max,
             s.sum -= round_up((apr_size_t)e->dsize, round);
             s.entries--;
             s.dfuture++;
-            APR_RING_REMOVE(e, link);
+            remove_entry(e);
             if ((!s.max || s.sum <= s.max) && (!s.inodes || s.nodes <= s.inodes)) {
+                *nodes = s.nodes;
                 if (!interrupted) {
                     printstats(path, &s);
                 }
@@ -1028,6 +1072,7 @@ static void purge(char *path, apr_pool_t *pool, apr_off_t max,
     }
 
     if (interrupted) {
+        *nodes = s.nodes;
         return;
     }
 
@@ -1041,8 +1086,9 @@ static void purge(char *path, apr_pool_t *pool, apr_off_t max,
             s.sum -= round_up((apr_size_t)e->dsize, round);
             s.entries--;
             s.dexpired++;
-            APR_RING_REMOVE(e, link);
+            remove_entry(e);
             if ((!s.max || s.sum <= s.max) && (!s.inodes || s.nodes <= s.inodes)) {
+                *nodes = s.nodes;
                 if (!interrupted) {
                     printstats(path, &s);
                 }
@@ -1053,6 +1099,7 @@ static void purge(char *path, apr_pool_t *pool, apr_off_t max,
     }
 
     if (interrupted) {
+         *nodes = s.nodes;
          return;
     }
 
@@ -1065,8 +1112,10 @@ static void purge(char *path, apr_pool_t *pool, apr_off_t max,
             && !interrupted && !APR_RING_EMPTY(&root.link, _entry, link)) {
         oldest = APR_RING_FIRST(&root.link);
 
+        /* with -j the ring is kept ordered */
         for (e = APR_RING_NEXT(oldest, link);
-             e != APR_RING_SENTINEL(&root.link, _entry, link);
+             !journal_entries
+             && e != APR_RING_SENTINEL(&root.link, _entry, link);
              e = APR_RING_NEXT(e, link)) {
             if (e->dtime < oldest->dtime) {
                 oldest = e;
@@ -1078,14 +1127,175 @@ static void purge(char *path, apr_pool_t *pool, apr_off_t max,
         s.sum -= round_up((apr_size_t)oldest->dsize, round);
         s.entries--;
         s.dfresh++;
-        APR_RING_REMOVE(oldest, link);
+        remove_entry(oldest);
     }
 
+    *nodes = s.nodes;
     if (!interrupted) {
         printstats(path, &s);
     }
 }
 
+static int entry_cmp(const void *a, const void *b)
+{
+    const ENTRY *e1 = *(const ENTRY * const *)a;
+    const ENTRY *e2 = *(const ENTRY * const *)b;
+
+    return (e1->dtime > e2->dtime) - (e1->dtime < e2->dtime);
+}
+
+/*
+ * -j: order the ring oldest first
+ */
+static void sort_entries(void)
+{
+    ENTRY *e, **v;
+    apr_size_t n = 0, i;
+
+    for (e = APR_RING_FIRST(&root.link);
+         e != APR_RING_SENTINEL(&root.link, _entry, link);
+         e = APR_RING_NEXT(e, link)) {
+        n++;
+    }
+    if (!n) {
+        return;
+    }
+    v = malloc(n * sizeof(ENTRY *));
+    if (!v) {
+        oom(APR_ENOMEM);
+    }
+    for (i = 0, e = APR_RING_FIRST(&root.link); i < n;
+         i++, e = APR_RING_NEXT(e, link)) {
+        v[i] = e;
+    }
+    qsort(v, n, sizeof(ENTRY *), entry_cmp);
+    APR_RING_INIT(&root.link, _entry, link);
+    for (i = 0; i < n; i++) {
+        APR_RING_INSERT_TAIL(&root.link, v[i], _entry, link);
+    }
+    free(v);
+}
+
+/*
+ * -j: forget everything and start over from a scan of the whole cache,
+ * the events journaled during the scan are applied on top of it
+ */
+static int journal_rescan(char *path, apr_pool_t *pool, apr_off_t *nodes)
+{
+    char *journal = apr_pstrcat(pool, path, "/" CACHE_JOURNAL_FILE, NULL);
+
+    while (!APR_RING_EMPTY(&root.link, _entry, link)) {
+        remove_entry(APR_RING_FIRST(&root.link));
+    }
+    apr_file_remove(journal, pool);
+    apr_file_remove(apr_pstrcat(pool, journal, CACHE_JOURNAL_WORK, NULL),
+                    pool);
+
+    *nodes = 0;
+    if (process_dir(path, pool, nodes)) {
+        return 1;
+    }
+    sort_entries();
+
+    return 0;
+}
+
+/*
+ * -j: apply the events journaled since the last run; returns the number
+ * of events, or -1 if the cache has to be rescanned
+ */
+static int process_journal(char *path, apr_pool_t *pool, apr_off_t *nodes)
+{
+    char line[JOURNAL_LINE];
+    char *journal, *work, *p, *end;
+    apr_int64_t v[5];
+    apr_file_t *fd;
+    apr_status_t status;
+    apr_size_t len;
+    ENTRY *e;
+    int events = 0, overflow = 0, fields, i;
+
+    journal = apr_pstrcat(pool, path, "/" CACHE_JOURNAL_FILE, NULL);
+    work = apr_pstrcat(pool, journal, CACHE_JOURNAL_WORK, NULL);
+
+    /* mod_cache_disk opens the journal for each event, the next ones
+     * go to a new journal */
+    status = apr_file_rename(journal, work, pool);
+    if (APR_STATUS_IS_ENOENT(status)) {
+        return 0;
+    }
+    if (status != APR_SUCCESS) {
+        return -1;
+    }
+    /* let the events already on their way land */
+    apr_sleep(NICE_DELAY);
+
+    if (apr_file_open(&fd, work, APR_FOPEN_READ | APR_FOPEN_BUFFERED
+                      | APR_FOPEN_BINARY, APR_OS_DEFAULT, pool)
+            != APR_SUCCESS) {
+        return -1;
+    }
+
+    while (!interrupted && !overflow
+           && apr_file_gets(line, sizeof(line), fd) == APR_SUCCESS) {
+        len = strlen(line);
+        if (!len || line[len - 1] != '\n') {
+            /* truncated */
+            continue;
+        }
+        line[--len] = '\0';
+
+        if (line[0] == CACHE_JOURNAL_OVERFLOW) {
+            overflow = 1;
+            continue;
+        }
+        if (line[0] == CACHE_JOURNAL_STORE) {
+            fields = 5;
+        }
+        else if (line[0] == CACHE_JOURNAL_REMOVE) {
+            fields = 1;
+        }
+        else {
+            continue;
+        }
+
+        for (i = 0, p = line + 1; i < fields && *p == ' '; i++, p = end) {
+            v[i] = apr_strtoi64(p + 1, &end, 10);
+            if (end == p + 1) {
+                break;
+            }
+        }
+        if (i < fields || *p != ' ' || !p[1]) {
+            continue;
+        }
+        p++;
+
+        e = apr_hash_get(journal_entries, p, APR_HASH_KEY_STRING);
+        if (line[0] == CACHE_JOURNAL_STORE) {
+            if (e) {
+                *nodes -= e->dsize ? 2 : 1;
+            }
+            e = add_entry(pool, p);
+            e->htime = e->dtime = v[0];
+            e->hsize = v[1];
+            e->dsize = v[2];
+            e->expire = v[3];
+            e->response_time = v[4];
+            *nodes += e->dsize ? 2 : 1;
+        }
+        else if (e) {
+            *nodes -= e->dsize ? 2 : 1;
+            remove_entry(e);
+        }
+        events++;
+    }
+
+    apr_file_close(fd);
+    apr_file_remove(work, pool);
+
+    return overflow ? -1 : events;
+}
+
 static apr_status_t remove_directory(apr_pool_t *pool, const char *dir)
 {
     apr_status_t rv;
@@ -1286,6 +1496,7 @@ static void usage(const char *error)
     "%s -- program for cleaning the disk cache."                             NL
     "Usage: %s [-Dvtrn] -pPATH [-lLIMIT] [-LLIMIT] [-PPIDFILE]"              NL
     "       %s [-nti] -dINTERVAL -pPATH [-lLIMIT] [-LLIMIT] [-PPIDFILE]"     NL
+    "       %s [-ntj] -dINTERVAL -pPATH [-lLIMIT] [-LLIMIT] [-PPIDFILE]"     NL
     "       %s [-Dvt] -pPATH URL ..."                                        NL
                                                                              NL
     "Options:"                                                               NL
@@ -1330,6 +1541,11 @@ static void usage(const char *error)
     "       the disk cache. This option is only possible together with the"  NL
     "       -d option."                                                      NL
                                                                              NL
+    "  -j   Scan the disk cache once, then only apply the changes recorded"  NL
+    "       in the journal written by mod_cache_disk (CacheDiskJournal On)." NL
+    "       This option is only possible together with the -d option and"    NL
+    "       is mutually exclusive with the -i option."                       NL
+                                                                             NL
     "  -a   List the URLs currently stored in the cache. Variants of the"    NL
     "       same URL will be listed once for each variant."                  NL
                                                                              NL
@@ -1347,6 +1563,7 @@ static void usage(const char *error)
     shortname,
     shortname,
     shortname,
+    shortname,
     shortname
     );
 
@@ -1395,6 +1612,8 @@ int main(int argc, const char * const argv[])
     apr_finfo_t info;
     apr_file_t *pidfile;
     int retries, isdaemon, limit_found, inodes_found, intelligent, dowork;
+    int journal, journal_scanned;
+    apr_off_t journal_nodes;
     char opt;
     const char *arg;
     char *proxypath, *path, *pidfilename;
@@ -1413,6 +1632,9 @@ int main(int argc, const char * const argv[])
     benice = 0;
     deldirs = 0;
     intelligent = 0;
+    journal = 0;
+    journal_scanned = 0;
+    journal_nodes = 0;
     previous = 0; /* avoid compiler warning */
     proxypath = NULL;
     pidfilename = NULL;
@@ -1438,7 +1660,7 @@ int main(int argc, const char * const argv[])
     apr_getopt_init(&o, pool, argc, argv);
 
     while (1) {
-        status = apr_getopt(o, "iDnvrtd:l:L:p:P:R:aA", &opt, &arg);
+        status = apr_getopt(o, "iDnvrtjd:l:L:p:P:R:aA", &opt, &arg);
         if (status == APR_EOF) {
             break;
         }
@@ -1456,6 +1678,13 @@ int main(int argc, const char * const argv[])
                 intelligent = 1;
                 break;
 
+            case 'j':
+                if (journal) {
+                    usage_repeated_arg(pool, opt);
+                }
+                journal = 1;
+                break;
+
             case 'D':
                 if (dryrun) {
                     usage_repeated_arg(pool, opt);
@@ -1637,6 +1866,9 @@ int main(int argc, const char * const argv[])
         if (intelligent) {
             usage("Option -i cannot be used with URL arguments, aborting");
         }
+        if (journal) {
+            usage("Option -j cannot be used with URL arguments, aborting");
+        }
         if (limit_found) {
             usage("Option -l and -L cannot be used with URL arguments, aborting");
         }
@@ -1679,6 +1911,14 @@ int main(int argc, const char * const argv[])
          usage("Option -i cannot be used without -d");
     }
 
+    if (!isdaemon && journal) {
+         usage("Option -j cannot be used without -d");
+    }
+
+    if (journal && intelligent) {
+         usage("Option -j cannot be used with -i");
+    }
+
     if (!listurls && max <= 0 && inodes <= 0) {
          usage("At least one of option -l or -L must be greater than zero");
     }
@@ -1713,75 +1953,66 @@ int main(int argc, const char * const argv[])
     }
 #endif
 
+    if (journal) {
+        APR_RING_INIT(&root.link, _entry, link);
+        journal_entries = apr_hash_make(pool);
+    }
+
     do {
         apr_pool_create(&instance, pool);
 
         now = apr_time_now();
-        APR_RING_INIT(&root.link, _entry, link);
+        if (!journal) {
+            APR_RING_INIT(&root.link, _entry, link);
+        }
         delcount = 0;
         unsolicited = 0;
         dowork = 0;
 
-        switch (intelligent) {
-        case 0:
-            dowork = 1;
-            break;
-
-        case 1:
-            retries = STAT_ATTEMPTS;
-            status = APR_SUCCESS;
-
-            do {
-                if (status != APR_SUCCESS) {
-                    apr_sleep(STAT_DELAY);
-                }
-                status = apr_stat(&info, path, APR_FINFO_MTIME, instance);
-            } while (status != APR_SUCCESS && !interrupted && --retries);
+        if (journal) {
+            int events = -1;
 
-            if (status == APR_SUCCESS) {
-                previous = info.mtime;
-                intelligent = 2;
+            if (journal_scanned) {
+                events = process_journal(path, instance, &journal_nodes);
+                now = apr_time_now();
             }
-            dowork = 1;
-            break;
+            if (events < 0 && !interrupted) {
+                journal_scanned = !journal_rescan(path, instance,
+                                                  &journal_nodes);
+                events = journal_scanned;
+            }
+            if (events > 0 && !interrupted) {
+                purge(path, instance, max, inodes, &journal_nodes, round);
+            }
+        }
+        else {
+            switch (intelligent) {
+            case 0:
+                dowork = 1;
+                break;
 
-        case 2:
-            retries = STAT_ATTEMPTS;
-            status = APR_SUCCESS;
+            case 1:
+                retries = STAT_ATTEMPTS;
+                status = APR_SUCCESS;
 
-            do {
-                if (status != APR_SUCCESS) {
-                    apr_sleep(STAT_DELAY);
-                }
-                status = apr_stat(&info, path, APR_FINFO_MTIME, instance);
-            } while (status != APR_SUCCESS && !interrupted && --retries);
+                do {
+                    if (status != APR_SUCCESS) {
+                        apr_sleep(STAT_DELAY);
+                    }
+                    status = apr_stat(&info, path, APR_FINFO_MTIME, instance);
+                } while (status != APR_SUCCESS && !interrupted && --retries);
 
-            if (status == APR_SUCCESS) {
-                if (previous != info.mtime) {
-                    dowork = 1;
+                if (status == APR_SUCCESS) {
+                    previous = info.mtime;
+                    intelligent = 2;
                 }
-                previous = info.mtime;
+                dowork = 1;
                 break;
-            }
-            intelligent = 1;
-            dowork = 1;
-            break;
-        }
-
-        if (dowork && !interrupted) {
-            apr_off_t nodes = 0;
-            if (!process_dir(path, instance, &nodes) && !interrupted) {
-                purge(path, instance, max, inodes, nodes, round);
-            }
-            else if (!isdaemon && !interrupted) {
-                apr_file_printf(errfile, "An error occurred, cache cleaning "
-                                         "aborted." APR_EOL_STR);
-                return 1;
-            }
 
-            if (intelligent && !interrupted) {
+            case 2:
                 retries = STAT_ATTEMPTS;
                 status = APR_SUCCESS;
+
                 do {
                     if (status != APR_SUCCESS) {
                         apr_sleep(STAT_DELAY);
@@ -1790,11 +2021,45 @@ int main(int argc, const char * const argv[])
                 } while (status != APR_SUCCESS && !interrupted && --retries);
 
                 if (status == APR_SUCCESS) {
+                    if (previous != info.mtime) {
+                        dowork = 1;
+                    }
                     previous = info.mtime;
-                    intelligent = 2;
+                    break;
                 }
-                else {
-                    intelligent = 1;
+                intelligent = 1;
+                dowork = 1;
+                break;
+            }
+
+            if (dowork && !interrupted) {
+                apr_off_t nodes = 0;
+                if (!process_dir(path, instance, &nodes) && !interrupted) {
+                    purge(path, instance, max, inodes, &nodes, round);
+                }
+                else if (!isdaemon && !interrupted) {
+                    apr_file_printf(errfile, "An error occurred, cache cleaning "
+                                             "aborted." APR_EOL_STR);
+                    return 1;
+                }
+
+                if (intelligent && !interrupted) {
+                    retries = STAT_ATTEMPTS;
+                    status = APR_SUCCESS;
+                    do {
+                        if (status != APR_SUCCESS) {
+                            apr_sleep(STAT_DELAY);
+                        }
+                        status = apr_stat(&info, path, APR_FINFO_MTIME, instance);
+                    } while (status != APR_SUCCESS && !interrupted && --retries);
+
+                    if (status == APR_SUCCESS) {
+                        previous = info.mtime;
+                        intelligent = 2;
+                    }
+                    else {
+                        intelligent = 1;
+                    }
                 }
             }
         }
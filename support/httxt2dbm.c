@@ -27,6 +27,7 @@
 #include "apr_file_info.h"
 #include "apr_pools.h"
 #include "apr_getopt.h"
+#include "apr_tables.h"
 #include "apu.h"
 #include "apr_dbm.h"
 
@@ -46,6 +47,32 @@ static int verbose;
 #define REWRITE_MAX_TXT_MAP_LINE 1024
 #endif
 
+/* idx: map layout, from mod_rewrite.c */
+#define REWRITE_IDX_MAGIC     "RWMAPIDX"
+#define REWRITE_IDX_BYTEORDER 0x01020304
+#define REWRITE_IDX_VERSION   1
+
+typedef struct {
+    char        magic[8];
+    apr_uint32_t byteorder;
+    apr_uint32_t version;
+    apr_uint32_t nslots;
+    apr_uint32_t nkeys;
+} rewrite_idx_header;
+
+typedef struct {
+    apr_uint32_t hash;
+    apr_uint32_t offset;
+} rewrite_idx_slot;
+
+typedef struct {
+    const char *key;
+    apr_size_t klen;
+    const char *val;
+    apr_size_t vlen;
+    int dup;
+} idx_record;
+
 #define NL APR_EOL_STR
 
 #define AVAIL "available"
@@ -95,6 +122,7 @@ static void usage(void)
     "           SDBM for SDBM files (%s)" NL
     "           DB   for berkeley DB files (%s)" NL
     "           NDBM for NDBM files (%s)" NL
+    "           IDX  for a memory mapped index, RewriteMap idx: (available)" NL
     "           default for the default DBM type" NL
     NL,
     shortname,
@@ -106,68 +134,257 @@ static void usage(void)
 }
 
 
+/* FNV-1a, must match mod_rewrite's idx_hash() */
+static apr_uint32_t idx_hash(const char *key, apr_size_t len)
+{
+    apr_uint32_t h = 2166136261U;
+
+    while (len--) {
+        h ^= (unsigned char)*key++;
+        h *= 16777619U;
+    }
+
+    return h;
+}
+
+/*
+ * Split a map line into its key and value, terminating both in place.
+ * Returns 0 for comments, blank lines and lines without a value.
+ */
+static int split_line(char *line, char **key, apr_size_t *klen,
+                      char **val, apr_size_t *vlen)
+{
+    char *c;
+
+    if (*line == '#' || apr_isspace(*line)) {
+        return 0;
+    }
+
+    c = line;
+
+    while (*c && !apr_isspace(*c)) {
+        ++c;
+    }
+
+    if (!*c) {
+        /* no value. solid line of data. */
+        return 0;
+    }
+
+    *key = line;
+    *klen = c - line;
+
+    while (apr_isspace(*c)) {
+        ++c;
+    }
+
+    if (!*c) {
+        return 0;
+    }
+
+    *val = c;
+
+    while (*c && !apr_isspace(*c)) {
+        ++c;
+    }
+
+    *vlen = c - *val;
+    (*key)[*klen] = '\0';
+    *c = '\0';
+
+    return 1;
+}
+
 static apr_status_t to_dbm(apr_dbm_t *dbm, apr_file_t *fp, apr_pool_t *pool)
 {
     apr_status_t rv = APR_SUCCESS;
     char line[REWRITE_MAX_TXT_MAP_LINE + 1]; /* +1 for \0 */
     apr_datum_t dbmkey;
     apr_datum_t dbmval;
-    apr_pool_t* p;
-
-    apr_pool_create(&p, pool);
 
     while (apr_file_gets(line, sizeof(line), fp) == APR_SUCCESS) {
-        char *c, *value;
+        apr_size_t klen, vlen;
+        char *key, *value;
 
-        if (*line == '#' || apr_isspace(*line)) {
+        if (!split_line(line, &key, &klen, &value, &vlen)) {
             continue;
         }
 
-        c = line;
+        dbmkey.dptr = key;
+        dbmkey.dsize = klen;
+        dbmval.dptr = value;
+        dbmval.dsize = vlen;
 
-        while (*c && !apr_isspace(*c)) {
-            ++c;
+        if (verbose) {
+            apr_file_printf(errfile, "    '%s' -> '%s'" NL,
+                            dbmkey.dptr, dbmval.dptr);
         }
 
-        if (!*c) {
-            /* no value. solid line of data. */
-            continue;
+        rv = apr_dbm_store(dbm, dbmkey, dbmval);
+
+        if (rv != APR_SUCCESS) {
+            break;
         }
+    }
 
-        dbmkey.dptr = apr_pstrmemdup(p, line,  c - line);
-        dbmkey.dsize = (c - line);
+    return rv;
+}
 
-        while (apr_isspace(*c)) {
-            ++c;
+static apr_status_t write_idx(apr_array_header_t *recs, apr_file_t *out,
+                              apr_pool_t *pool)
+{
+    rewrite_idx_header hdr;
+    rewrite_idx_slot *slots;
+    int *owner;
+    apr_uint64_t offset;
+    apr_uint32_t nslots, mask;
+    apr_status_t rv;
+    int i, nkeys = 0;
+
+    /* keep the table at most 3/4 full so that probe sequences stay short */
+    nslots = 16;
+    while ((apr_uint64_t)nslots * 3 < (apr_uint64_t)recs->nelts * 4) {
+        if (nslots >= APR_UINT32_MAX / 2 / sizeof(rewrite_idx_slot)) {
+            return APR_ENOSPC;
+        }
+        nslots <<= 1;
+    }
+    mask = nslots - 1;
+    slots = apr_pcalloc(pool, nslots * sizeof(rewrite_idx_slot));
+    owner = apr_palloc(pool, nslots * sizeof(int));
+
+    offset = sizeof(hdr) + (apr_uint64_t)nslots * sizeof(rewrite_idx_slot);
+    for (i = 0; i < recs->nelts; ++i) {
+        idx_record *rec = &APR_ARRAY_IDX(recs, i, idx_record);
+        apr_uint32_t h = idx_hash(rec->key, rec->klen);
+        apr_uint32_t j = h & mask;
+
+        while (slots[j].offset) {
+            idx_record *other = &APR_ARRAY_IDX(recs, owner[j], idx_record);
+
+            if (slots[j].hash == h && other->klen == rec->klen
+                && !memcmp(other->key, rec->key, rec->klen)) {
+                break;
+            }
+            j = (j + 1) & mask;
         }
 
-        if (!*c) {
-            apr_pool_clear(p);
+        /* like a txt: map, the first line for a key wins */
+        if (slots[j].offset) {
+            if (verbose) {
+                apr_file_printf(errfile, "    '%s' duplicate, ignored" NL,
+                                rec->key);
+            }
+            rec->dup = 1;
             continue;
         }
 
-        value = c;
+        if (offset + rec->klen + rec->vlen + 2 > APR_UINT32_MAX) {
+            return APR_ENOSPC;
+        }
+        slots[j].hash = h;
+        slots[j].offset = (apr_uint32_t)offset;
+        owner[j] = i;
+        offset += rec->klen + rec->vlen + 2;
+        ++nkeys;
+    }
+
+    memcpy(hdr.magic, REWRITE_IDX_MAGIC, sizeof(hdr.magic));
+    hdr.byteorder = REWRITE_IDX_BYTEORDER;
+    hdr.version = REWRITE_IDX_VERSION;
+    hdr.nslots = nslots;
+    hdr.nkeys = nkeys;
 
-        while (*c && !apr_isspace(*c)) {
-            ++c;
+    rv = apr_file_write_full(out, &hdr, sizeof(hdr), NULL);
+    if (rv == APR_SUCCESS) {
+        rv = apr_file_write_full(out, slots,
+                                 nslots * sizeof(rewrite_idx_slot), NULL);
+    }
+    for (i = 0; rv == APR_SUCCESS && i < recs->nelts; ++i) {
+        idx_record *rec = &APR_ARRAY_IDX(recs, i, idx_record);
+
+        if (rec->dup) {
+            continue;
         }
+        /* both strings were terminated in place by split_line() */
+        rv = apr_file_write_full(out, rec->key, rec->klen + 1, NULL);
+        if (rv == APR_SUCCESS) {
+            rv = apr_file_write_full(out, rec->val, rec->vlen + 1, NULL);
+        }
+    }
+
+    if (verbose && rv == APR_SUCCESS) {
+        apr_file_printf(errfile, "Index: %d keys in %u slots" NL,
+                        nkeys, nslots);
+    }
 
-        dbmval.dptr = apr_pstrmemdup(p, value,  c - value);
-        dbmval.dsize = (c - value);
+    return rv;
+}
+
+/*
+ * Build the whole index in a temporary file next to the output and rename
+ * it into place, so that a running httpd never maps a half written file.
+ */
+static apr_status_t to_idx(const char *path, apr_file_t *fp, apr_pool_t *pool)
+{
+    apr_status_t rv;
+    apr_array_header_t *recs;
+    char line[REWRITE_MAX_TXT_MAP_LINE + 1]; /* +1 for \0 */
+    apr_file_t *out;
+    char *tmpname;
+
+    recs = apr_array_make(pool, 1024, sizeof(idx_record));
+
+    while (apr_file_gets(line, sizeof(line), fp) == APR_SUCCESS) {
+        idx_record *rec;
+        apr_size_t klen, vlen;
+        char *key, *value;
+
+        if (!split_line(line, &key, &klen, &value, &vlen)) {
+            continue;
+        }
 
         if (verbose) {
-            apr_file_printf(errfile, "    '%s' -> '%s'" NL,
-                            dbmkey.dptr, dbmval.dptr);
+            apr_file_printf(errfile, "    '%s' -> '%s'" NL, key, value);
         }
 
-        rv = apr_dbm_store(dbm, dbmkey, dbmval);
+        rec = apr_array_push(recs);
+        rec->key = apr_pstrmemdup(pool, key, klen);
+        rec->klen = klen;
+        rec->val = apr_pstrmemdup(pool, value, vlen);
+        rec->vlen = vlen;
+        rec->dup = 0;
+    }
 
-        apr_pool_clear(p);
+    tmpname = apr_pstrcat(pool, path, ".XXXXXX", NULL);
+    rv = apr_file_mktemp(&out, tmpname, APR_FOPEN_CREATE | APR_FOPEN_READ
+                         | APR_FOPEN_WRITE | APR_FOPEN_EXCL
+                         | APR_FOPEN_BUFFERED, pool);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
 
-        if (rv != APR_SUCCESS) {
-            break;
+    rv = write_idx(recs, out, pool);
+    if (rv == APR_SUCCESS) {
+        rv = apr_file_close(out);
+    }
+    else {
+        apr_file_close(out);
+    }
+    if (rv == APR_SUCCESS) {
+        /* mktemp creates the file private to us, httpd must read it */
+        rv = apr_file_perms_set(tmpname, APR_FPROT_UREAD | APR_FPROT_UWRITE
+                                | APR_FPROT_GREAD | APR_FPROT_WREAD);
+        if (APR_STATUS_IS_ENOTIMPL(rv)) {
+            rv = APR_SUCCESS;
         }
     }
+    if (rv == APR_SUCCESS) {
+        rv = apr_file_rename(tmpname, path, pool);
+    }
+    if (rv != APR_SUCCESS) {
+        apr_file_remove(tmpname, pool);
+    }
 
     return rv;
 }
@@ -294,6 +511,23 @@ int main(int argc, const char *const argv[])
         apr_file_printf(errfile, "Input File: %s" NL, input);
     }
 
+    if (!strcasecmp(format, "idx")) {
+        rv = to_idx(output, infile, pool);
+
+        if (rv != APR_SUCCESS) {
+            apr_file_printf(errfile,
+                            "Error: Writing index '%s': (%d) %pm" NL NL,
+                             output, rv, &rv);
+            return 1;
+        }
+
+        if (verbose) {
+            apr_file_printf(errfile, "Conversion Complete." NL);
+        }
+
+        return 0;
+    }
+
     rv = apr_dbm_open_ex(&outdbm, format, output, APR_DBM_RWCREATE,
                     APR_OS_DEFAULT, pool);
 
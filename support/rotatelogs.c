@@ -28,15 +28,50 @@
 #if APR_FILES_AS_SOCKETS
 #include "apr_poll.h"
 #endif
+#if APR_HAS_SHARED_MEMORY && APR_FILES_AS_SOCKETS
+#define ROTATELOGS_RING
+#include "apr_shm.h"
+#include "apr_atomic.h"
+#include "apr_env.h"
+#include "ap_log_ring.h"
+#endif
 
 #if APR_HAVE_STDLIB_H
 #include <stdlib.h>
 #endif
+#if APR_HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#if !defined(WIN32) && !defined(NETWARE)
+#include "ap_config_auto.h"
+#endif
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 #define APR_WANT_STRFUNC
 #include "apr_want.h"
 
 #define BUFSIZE         65536
 
+#ifdef HAVE_ZLIB
+/* Default amount of log data per gzip member, and how long the data can
+ * stay in an incomplete member while no more comes */
+#define GZ_FRAME_SIZE       (1024 * 1024)
+#define GZ_IDLE_FLUSH       apr_time_from_sec(1)
+#define OPT_COMPRESS        "zZ:"
+#define USAGE_COMPRESS      "[-z] [-Z size] "
+#else
+#define OPT_COMPRESS        ""
+#define USAGE_COMPRESS      ""
+#endif
+
+#ifdef ROTATELOGS_RING
+/* How long to wait on stdin while the ring is empty */
+#define RING_POLL_INTERVAL  apr_time_from_msec(10)
+/* How long an unpublished record can block the ring */
+#define RING_STALL_TIMEOUT  apr_time_from_sec(2)
+#endif
+
 #define ROTATE_NONE     0
 #define ROTATE_NEW      1
 #define ROTATE_TIME     2
@@ -72,6 +107,10 @@ struct rotate_config {
 #endif
     int num_files;
     int create_path;
+#ifdef HAVE_ZLIB
+    int compress;
+    apr_size_t frame_size;
+#endif
 };
 
 typedef struct rotate_status rotate_status_t;
@@ -88,6 +127,10 @@ struct logfile {
     apr_pool_t *pool;
     apr_file_t *fd;
     char name[APR_PATH_MAX];
+#ifdef HAVE_ZLIB
+    z_stream *gz;       /* NULL unless compressing */
+    apr_size_t gz_in;   /* data in the current gzip member */
+#endif
 };
 
 struct rotate_status {
@@ -109,10 +152,11 @@ static void usage(const char *argv0, const char *reason)
     }
     fprintf(stderr,
 #if APR_FILES_AS_SOCKETS
-            "Usage: %s [-v] [-l] [-L linkname] [-p prog] [-f] [-D] [-t] [-e] [-c] [-n number] <logfile> "
+            "Usage: %s [-v] [-l] [-L linkname] [-p prog] [-f] [-D] [-t] [-e] [-c] [-n number] "
 #else
-            "Usage: %s [-v] [-l] [-L linkname] [-p prog] [-f] [-D] [-t] [-e] [-n number] <logfile> "
+            "Usage: %s [-v] [-l] [-L linkname] [-p prog] [-f] [-D] [-t] [-e] [-n number] "
 #endif
+            USAGE_COMPRESS "<logfile> "
             "{<rotation time in seconds>|<rotation size>(B|K|M|G)} "
             "[offset minutes from UTC]\n\n",
             argv0);
@@ -150,6 +194,10 @@ static void usage(const char *argv0, const char *reason)
             "  -c       Create log even if it is empty.\n"
 #endif
             "  -n num   Rotate file by adding suffixes '.1', '.2', ..., '.num'.\n"
+#ifdef HAVE_ZLIB
+            "  -z       Compress the logs with gzip, adding '.gz' to the file names.\n"
+            "  -Z size  Size of the log data per gzip member (default 1M).\n"
+#endif
             "\n"
             "The program for '-p' is invoked as \"[prog] <curfile> [<prevfile>]\"\n"
             "where <curfile> is the filename of the newly opened logfile, and\n"
@@ -185,6 +233,86 @@ static adjusted_time_t get_now(rotate_config_t *config, apr_int32_t *offset)
     return apr_time_sec(tNow) + utc_offset;
 }
 
+#ifdef HAVE_ZLIB
+static apr_status_t gz_deflate(struct logfile *logfile, int flush)
+{
+    char out[BUFSIZE];
+    apr_size_t len;
+    apr_status_t rv;
+    int zrv;
+
+    do {
+        logfile->gz->next_out = (Bytef *)out;
+        logfile->gz->avail_out = sizeof(out);
+        zrv = deflate(logfile->gz, flush);
+        if (zrv == Z_STREAM_ERROR) {
+            return APR_EGENERAL;
+        }
+        len = sizeof(out) - logfile->gz->avail_out;
+        if (len) {
+            rv = apr_file_write_full(logfile->fd, out, len, NULL);
+            if (rv != APR_SUCCESS) {
+                return rv;
+            }
+        }
+    } while (logfile->gz->avail_out == 0
+             || (flush == Z_FINISH && zrv != Z_STREAM_END));
+
+    return APR_SUCCESS;
+}
+
+/*
+ * Complete the current gzip member, the file is then a whole gzip file
+ * (one member after the other).
+ */
+static apr_status_t gz_finish(struct logfile *logfile)
+{
+    apr_status_t rv;
+
+    if (!logfile->gz || !logfile->gz_in) {
+        return APR_SUCCESS;
+    }
+    rv = gz_deflate(logfile, Z_FINISH);
+    deflateReset(logfile->gz);
+    logfile->gz_in = 0;
+    return rv;
+}
+#endif
+
+/*
+ * Write to a log file, compressed with -z.
+ */
+static apr_status_t log_write(struct logfile *logfile, const char *buf,
+                              apr_size_t len, apr_size_t *written)
+{
+#ifdef HAVE_ZLIB
+    if (logfile->gz) {
+        apr_size_t done = 0;
+        apr_status_t rv = APR_SUCCESS;
+
+        while (done < len && rv == APR_SUCCESS) {
+            apr_size_t n = config.frame_size - logfile->gz_in;
+            if (n > len - done) {
+                n = len - done;
+            }
+            logfile->gz->next_in = (Bytef *)buf + done;
+            logfile->gz->avail_in = n;
+            rv = gz_deflate(logfile, Z_NO_FLUSH);
+            logfile->gz_in += n;
+            done += n;
+            if (rv == APR_SUCCESS && logfile->gz_in >= config.frame_size) {
+                rv = gz_finish(logfile);
+            }
+        }
+        if (written) {
+            *written = rv == APR_SUCCESS ? len : 0;
+        }
+        return rv;
+    }
+#endif
+    return apr_file_write_full(logfile->fd, buf, len, written);
+}
+
 /*
  * Close a file and destroy the associated pool.
  */
@@ -193,6 +321,12 @@ static void close_logfile(rotate_config_t *config, struct logfile *logfile)
     if (config->verbose) {
         fprintf(stderr, "Closing file %s\n", logfile->name);
     }
+#ifdef HAVE_ZLIB
+    if (logfile->gz) {
+        gz_finish(logfile);
+        deflateEnd(logfile->gz);
+    }
+#endif
     apr_file_close(logfile->fd);
     apr_pool_destroy(logfile->pool);
 }
@@ -209,6 +343,13 @@ static void dumpConfig (rotate_config_t *config)
     fprintf(stderr, "Rotation file date pattern:  %12s\n", config->use_strftime ? "yes" : "no");
     fprintf(stderr, "Rotation file forced open:   %12s\n", config->force_open ? "yes" : "no");
     fprintf(stderr, "Create parent directories:   %12s\n", config->create_path ? "yes" : "no");
+#ifdef HAVE_ZLIB
+    fprintf(stderr, "Compress with gzip:          %12s\n", config->compress ? "yes" : "no");
+    if (config->compress) {
+        fprintf(stderr, "Compressed member size:      %12" APR_SIZE_T_FMT "\n",
+                config->frame_size);
+    }
+#endif
     fprintf(stderr, "Rotation verbose:            %12s\n", config->verbose ? "yes" : "no");
 #if APR_FILES_AS_SOCKETS
     fprintf(stderr, "Rotation create empty logs:  %12s\n", config->create_empty ? "yes" : "no");
@@ -353,7 +494,18 @@ static void truncate_and_write_error(rotate_status_t *status, const char *messag
         fprintf(stderr, "Error truncating the file %s\n", status->current.name);
         exit(2);
     }
-    if (apr_file_write_full(status->current.fd, message, buflen, NULL) != APR_SUCCESS) {
+#ifdef HAVE_ZLIB
+    if (status->current.gz) {
+        /* start over with a new member */
+        deflateReset(status->current.gz);
+        status->current.gz_in = 0;
+    }
+#endif
+    if (log_write(&status->current, message, buflen, NULL) != APR_SUCCESS
+#ifdef HAVE_ZLIB
+        || gz_finish(&status->current) != APR_SUCCESS
+#endif
+        ) {
         fprintf(stderr, "Error writing error (%s) to the file %s\n", 
                 message, status->current.name);
         exit(2);
@@ -436,6 +588,14 @@ static void doRotate(rotate_config_t *config, rotate_status_t *status)
                          tLogStart);
         }
     }
+#ifdef HAVE_ZLIB
+    newlog.gz = NULL;
+    newlog.gz_in = 0;
+    if (config->compress) {
+        apr_size_t len = strlen(newlog.name);
+        apr_snprintf(newlog.name + len, sizeof(newlog.name) - len, ".gz");
+    }
+#endif
     apr_pool_create(&newlog.pool, status->pool);
     if (config->create_path) {
         char *ptr = strrchr(newlog.name, '/');
@@ -460,6 +620,18 @@ static void doRotate(rotate_config_t *config, rotate_status_t *status)
     rv = apr_file_open(&newlog.fd, newlog.name, APR_WRITE | APR_CREATE | APR_APPEND
                        | (config->truncate || (config->num_files > 0 && status->current.fd) ? APR_TRUNCATE : 0), 
                        APR_OS_DEFAULT, newlog.pool);
+#ifdef HAVE_ZLIB
+    if (rv == APR_SUCCESS && config->compress) {
+        newlog.gz = apr_pcalloc(newlog.pool, sizeof(z_stream));
+        /* 16 + MAX_WBITS: with a gzip header and trailer */
+        if (deflateInit2(newlog.gz, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                         16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            fprintf(stderr, "Could not initialize the compression of '%s'\n",
+                    newlog.name);
+            exit(2);
+        }
+    }
+#endif
     if (rv == APR_SUCCESS) {
         /* Handle post-rotate processing. */
         post_rotate(newlog.pool, &newlog, config, status);
@@ -556,10 +728,225 @@ static const char *get_time_or_size(rotate_config_t *config,
     return NULL;
 }
 
+static void write_buffer(apr_file_t *f_stdout, const char *buf,
+                         apr_size_t nRead)
+{
+    apr_size_t nWrite;
+    apr_status_t rv;
+
+    checkRotate(&config, &status);
+    if (status.rotateReason != ROTATE_NONE) {
+        doRotate(&config, &status);
+    }
+
+    nWrite = nRead;
+    rv = log_write(&status.current, buf, nWrite, &nWrite);
+    if (nWrite != nRead) {
+        apr_off_t cur_offset;
+        apr_pool_t *pool;
+        char *error;
+
+        cur_offset = 0;
+        if (apr_file_seek(status.current.fd, APR_CUR, &cur_offset) != APR_SUCCESS) {
+            cur_offset = -1;
+        }
+        status.nMessCount++;
+        apr_pool_create(&pool, status.pool);
+        error = apr_psprintf(pool, "Error %d writing to log file at offset %"
+                             APR_OFF_T_FMT ". %10d messages lost (%pm)\n",
+                             rv, cur_offset, status.nMessCount, &rv);
+
+        truncate_and_write_error(&status, error);
+        apr_pool_destroy(pool);
+    }
+    else {
+        status.nMessCount++;
+    }
+    if (config.echo) {
+        if (apr_file_write_full(f_stdout, buf, nRead, NULL)) {
+            fprintf(stderr, "Unable to write to stdout\n");
+            exit(4);
+        }
+    }
+}
+
+#ifdef ROTATELOGS_RING
+/*
+ * Attach to the shared memory ring of httpd's PipedLogRing, if any; the
+ * pipe (stdin) is still read for the lines which don't go to the ring.
+ */
+static ap_log_ring_t *ring_attach(void)
+{
+    char *fname;
+    apr_shm_t *shm;
+    ap_log_ring_t *ring;
+
+    if (apr_env_get(&fname, AP_LOG_RING_ENV, status.pool) != APR_SUCCESS
+            || !*fname) {
+        return NULL;
+    }
+    /* not for the programs we run */
+    apr_env_delete(AP_LOG_RING_ENV, status.pool);
+
+    if (apr_atomic_init(status.pool) != APR_SUCCESS
+            || apr_shm_attach(&shm, fname, status.pool) != APR_SUCCESS) {
+        fprintf(stderr, "Unable to attach to the log ring %s\n", fname);
+        return NULL;
+    }
+    ring = apr_shm_baseaddr_get(shm);
+    if (ring->magic != AP_LOG_RING_MAGIC
+            || apr_shm_size_get(shm) < AP_LOG_RING_HDR_LEN + ring->size) {
+        fprintf(stderr, "Invalid log ring %s\n", fname);
+        apr_shm_detach(shm);
+        return NULL;
+    }
+    apr_atomic_set32(&ring->consumer, (apr_uint32_t)getpid());
+    if (config.verbose) {
+        fprintf(stderr, "Reading the log ring %s (%u bytes)\n", fname,
+                ring->size);
+    }
+    return ring;
+}
+
+/* Read the records published in the ring, up to len bytes */
+static apr_size_t ring_read(ap_log_ring_t *ring, char *buf, apr_size_t len)
+{
+    char *data = AP_LOG_RING_DATA(ring);
+    apr_uint32_t head = apr_atomic_read32(&ring->head);
+    apr_uint32_t tail = ring->tail;
+    apr_size_t n = 0;
+
+    while (tail != head) {
+        apr_uint32_t pos = tail & (ring->size - 1);
+        apr_uint32_t word = apr_atomic_read32((apr_uint32_t *)(data + pos));
+        apr_uint32_t reclen;
+
+        if (!word) {
+            /* not published yet */
+            break;
+        }
+        if (word == AP_LOG_RING_PAD) {
+            reclen = ring->size - pos;
+        }
+        else {
+            if (n + word - 1 > len) {
+                break;
+            }
+            memcpy(buf + n, data + pos + 4, word - 1);
+            n += word - 1;
+            reclen = AP_LOG_RING_RECLEN(word - 1);
+        }
+        /* the writers expect zeroes where they reserve */
+        memset(data + pos, 0, reclen);
+        tail += reclen;
+    }
+    apr_atomic_set32(&ring->tail, tail);
+    return n;
+}
+
+/*
+ * A writer died before publishing its record: detach so that the others
+ * use the pipe, give the writers in flight some time to complete, and
+ * start over with an empty ring (the records published after the stalled
+ * one are lost).
+ */
+static void ring_recover(ap_log_ring_t *ring)
+{
+    apr_atomic_set32(&ring->consumer, 0);
+    apr_sleep(apr_time_from_msec(100));
+    memset(AP_LOG_RING_DATA(ring), 0, ring->size);
+    apr_atomic_set32(&ring->tail, apr_atomic_read32(&ring->head));
+    apr_atomic_set32(&ring->consumer, (apr_uint32_t)getpid());
+    fprintf(stderr, "The log ring was stalled, some lines may be lost\n");
+}
+
+/* The main loop when reading the ring, returns at stdin EOF */
+static void ring_loop(ap_log_ring_t *ring, apr_file_t *f_stdin,
+                      apr_file_t *f_stdout)
+{
+    char buf[BUFSIZE];
+    apr_pollfd_t pollfd = { 0 };
+    apr_time_t stalled = 0, last = 0;
+    apr_size_t nRead;
+    apr_status_t rv;
+    apr_int32_t n;
+
+    pollfd.p = status.pool;
+    pollfd.desc_type = APR_POLL_FILE;
+    pollfd.reqevents = APR_POLLIN;
+    pollfd.desc.f = f_stdin;
+
+    for (;;) {
+        nRead = ring_read(ring, buf, sizeof(buf));
+        if (nRead) {
+            write_buffer(f_stdout, buf, nRead);
+            stalled = 0;
+            last = 0;
+        }
+        else if (apr_atomic_read32(&ring->head) != ring->tail) {
+            if (!stalled) {
+                stalled = apr_time_now();
+            }
+            else if (apr_time_now() - stalled > RING_STALL_TIMEOUT) {
+                ring_recover(ring);
+                stalled = 0;
+            }
+        }
+
+        /* don't wait while the ring is busy */
+        rv = apr_poll(&pollfd, 1, &n, nRead ? 0 : RING_POLL_INTERVAL);
+        if (rv == APR_SUCCESS) {
+            nRead = sizeof(buf);
+            rv = apr_file_read(f_stdin, buf, &nRead);
+            if (APR_STATUS_IS_EOF(rv)) {
+                break;
+            }
+            else if (rv != APR_SUCCESS) {
+                exit(3);
+            }
+            write_buffer(f_stdout, buf, nRead);
+            last = 0;
+        }
+        else if (APR_STATUS_IS_TIMEUP(rv) || APR_STATUS_IS_EINTR(rv)) {
+#ifdef HAVE_ZLIB
+            /* don't keep an incomplete member for long */
+            if (!nRead && status.current.gz_in) {
+                if (!last) {
+                    last = apr_time_now();
+                }
+                else if (apr_time_now() - last > GZ_IDLE_FLUSH) {
+                    gz_finish(&status.current);
+                    last = 0;
+                }
+            }
+#endif
+            if (!nRead && config.create_empty && config.tRotation
+                    && status.tLogEnd
+                    && get_now(&config, NULL) >= status.tLogEnd) {
+                write_buffer(f_stdout, buf, 0);
+            }
+        }
+        else {
+            fprintf(stderr, "Unable to poll stdin\n");
+            exit(5);
+        }
+    }
+
+    /* httpd is gone, whatever it left in the ring is complete */
+    apr_atomic_set32(&ring->consumer, 0);
+    while ((nRead = ring_read(ring, buf, sizeof(buf)))) {
+        write_buffer(f_stdout, buf, nRead);
+    }
+#ifdef HAVE_ZLIB
+    gz_finish(&status.current);
+#endif
+}
+#endif /* ROTATELOGS_RING */
+
 int main (int argc, const char * const argv[])
 {
     char buf[BUFSIZE];
-    apr_size_t nRead, nWrite;
+    apr_size_t nRead;
     apr_file_t *f_stdin;
     apr_file_t *f_stdout;
     apr_getopt_t *opt;
@@ -570,7 +957,7 @@ int main (int argc, const char * const argv[])
 #if APR_FILES_AS_SOCKETS
     apr_pollfd_t pollfd = { 0 };
     apr_status_t pollret = APR_SUCCESS;
-    long polltimeout;
+    apr_interval_time_t polltimeout;
 #endif
 
     apr_app_initialize(&argc, &argv, NULL);
@@ -582,10 +969,13 @@ int main (int argc, const char * const argv[])
 
     apr_pool_create(&status.pool, NULL);
     apr_getopt_init(&opt, status.pool, argc, argv);
+#ifdef HAVE_ZLIB
+    config.frame_size = GZ_FRAME_SIZE;
+#endif
 #if APR_FILES_AS_SOCKETS
-    while ((rv = apr_getopt(opt, "lL:p:fDtvecn:", &c, &opt_arg)) == APR_SUCCESS) {
+    while ((rv = apr_getopt(opt, "lL:p:fDtvecn:" OPT_COMPRESS, &c, &opt_arg)) == APR_SUCCESS) {
 #else
-    while ((rv = apr_getopt(opt, "lL:p:fDtven:", &c, &opt_arg)) == APR_SUCCESS) {
+    while ((rv = apr_getopt(opt, "lL:p:fDtven:" OPT_COMPRESS, &c, &opt_arg)) == APR_SUCCESS) {
 #endif
         switch (c) {
         case 'l':
@@ -625,6 +1015,29 @@ int main (int argc, const char * const argv[])
             config.num_files = atoi(opt_arg);
             status.fileNum = -1;
             break;
+#ifdef HAVE_ZLIB
+        case 'z':
+            config.compress = 1;
+            break;
+        case 'Z': {
+            char *end;
+            apr_int64_t size = apr_strtoi64(opt_arg, &end, 10);
+
+            if (*end == 'K') {
+                size *= 1024;
+                end++;
+            }
+            else if (*end == 'M') {
+                size *= 1024 * 1024;
+                end++;
+            }
+            if (*end || size < 1024 || size > 1024 * 1024 * 1024) {
+                usage(argv[0], "Invalid -Z size, between 1K and 1024M");
+            }
+            config.frame_size = (apr_size_t)size;
+            break;
+        }
+#endif
         }
     }
 
@@ -667,6 +1080,13 @@ int main (int argc, const char * const argv[])
         exit(1);
     }
 
+#ifdef HAVE_ZLIB
+    if (config.compress && config.truncate) {
+        fprintf(stderr, "Cannot use -t with -z\n");
+        exit(1);
+    }
+#endif
+
     if (apr_file_open_stdin(&f_stdin, status.pool) != APR_SUCCESS) {
         fprintf(stderr, "Unable to open stdin\n");
         exit(1);
@@ -685,12 +1105,10 @@ int main (int argc, const char * const argv[])
     }
 
 #if APR_FILES_AS_SOCKETS
-    if (config.create_empty && config.tRotation) {
-        pollfd.p = status.pool;
-        pollfd.desc_type = APR_POLL_FILE;
-        pollfd.reqevents = APR_POLLIN;
-        pollfd.desc.f = f_stdin;
-    }
+    pollfd.p = status.pool;
+    pollfd.desc_type = APR_POLL_FILE;
+    pollfd.reqevents = APR_POLLIN;
+    pollfd.desc.f = f_stdin;
 #endif
 
     /*
@@ -701,18 +1119,45 @@ int main (int argc, const char * const argv[])
         doRotate(&config, &status);
     }
 
+#ifdef ROTATELOGS_RING
+    {
+        ap_log_ring_t *ring = ring_attach();
+        if (ring) {
+            ring_loop(ring, f_stdin, f_stdout);
+            return 0;
+        }
+    }
+#endif
+
     for (;;) {
         nRead = sizeof(buf);
 #if APR_FILES_AS_SOCKETS
+        polltimeout = -1;
         if (config.create_empty && config.tRotation) {
             polltimeout = status.tLogEnd ? status.tLogEnd - get_now(&config, NULL) : config.tRotation;
             if (polltimeout <= 0) {
-                pollret = APR_TIMEUP;
+                polltimeout = 0;
             }
             else {
-                pollret = apr_poll(&pollfd, 1, &pollret, apr_time_from_sec(polltimeout));
+                polltimeout = apr_time_from_sec(polltimeout);
             }
         }
+#ifdef HAVE_ZLIB
+        /* don't keep an incomplete member for long */
+        if (status.current.gz_in
+                && (polltimeout < 0 || polltimeout > GZ_IDLE_FLUSH)) {
+            polltimeout = GZ_IDLE_FLUSH;
+        }
+#endif
+        if (polltimeout == 0) {
+            pollret = APR_TIMEUP;
+        }
+        else if (polltimeout > 0) {
+            pollret = apr_poll(&pollfd, 1, &pollret, polltimeout);
+        }
+        else {
+            pollret = APR_SUCCESS;
+        }
         if (pollret == APR_SUCCESS) {
             rv = apr_file_read(f_stdin, buf, &nRead);
             if (APR_STATUS_IS_EOF(rv)) {
@@ -725,6 +1170,9 @@ int main (int argc, const char * const argv[])
         else if (pollret == APR_TIMEUP) {
             *buf = 0;
             nRead = 0;
+#ifdef HAVE_ZLIB
+            gz_finish(&status.current);
+#endif
         }
         else {
             fprintf(stderr, "Unable to poll stdin\n");
@@ -739,41 +1187,11 @@ int main (int argc, const char * const argv[])
             exit(3);
         }
 #endif /* APR_FILES_AS_SOCKETS */
-        checkRotate(&config, &status);
-        if (status.rotateReason != ROTATE_NONE) {
-            doRotate(&config, &status);
-        }
-
-        nWrite = nRead;
-        rv = apr_file_write_full(status.current.fd, buf, nWrite, &nWrite);
-        if (nWrite != nRead) {
-            apr_off_t cur_offset;
-            apr_pool_t *pool;
-            char *error;
-
-            cur_offset = 0;
-            if (apr_file_seek(status.current.fd, APR_CUR, &cur_offset) != APR_SUCCESS) {
-                cur_offset = -1;
-            }
-            status.nMessCount++;
-            apr_pool_create(&pool, status.pool);
-            error = apr_psprintf(pool, "Error %d writing to log file at offset %"
-                                 APR_OFF_T_FMT ". %10d messages lost (%pm)\n",
-                                 rv, cur_offset, status.nMessCount, &rv);
-
-            truncate_and_write_error(&status, error);
-            apr_pool_destroy(pool);
-        }
-        else {
-            status.nMessCount++;
-        }
-        if (config.echo) {
-            if (apr_file_write_full(f_stdout, buf, nRead, NULL)) {
-                fprintf(stderr, "Unable to write to stdout\n");
-                exit(4);
-            }
-        }
+        write_buffer(f_stdout, buf, nRead);
     }
 
+#ifdef HAVE_ZLIB
+    gz_finish(&status.current);
+#endif
     return 0; /* reached only at stdin EOF. */
 }
@@ -0,0 +1,583 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * httpdbench.c: micro-benchmarks of some hot paths of the core, reported in
+ * nanoseconds per operation.
+ *
+ * Usage: httpdbench [-b baseline] [-o output] [-r percent] [name...]
+ *
+ * Each benchmark is calibrated to run for about BENCH_TIME, and the best of
+ * BENCH_RUNS runs is reported. The output can be saved (-o) and given back
+ * later as a baseline (-b), in which case the benchmarks slower than their
+ * baseline by more than the given percentage (-r, 10% by default) are
+ * reported as regressions and make the program exit with a non-zero status.
+ * Only the benchmarks whose name starts with one of the given names are run.
+ *
+ * Like the unit tests, the benchmarks stub out just enough of the request
+ * and connection structures for the functions being measured.
+ */
+
+#include "apr_general.h"
+#include "apr_getopt.h"
+#include "apr_hooks.h"
+#include "apr_strings.h"
+#include "apr_tables.h"
+#include "apr_time.h"
+
+#include "httpd.h"
+#include "http_config.h"
+#include "http_log.h"
+#include "http_protocol.h"
+#include "util_filter.h"
+#include "ap_expr.h"
+#include "ap_regex.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BENCH_TIME  apr_time_from_msec(200)
+#define BENCH_RUNS  3
+
+typedef struct {
+    const char *name;
+    void (*setup)(void);
+    void (*run)(apr_int64_t n);   /* run the operation n times */
+} bench_t;
+
+static apr_pool_t *g_pool;      /* for the setups */
+static apr_pool_t *g_scratch;   /* for the operations, cleared regularly */
+static request_rec *g_request;
+static struct ap_logconf g_log;
+
+/* clear the scratch pool every so many operations allocating from it */
+#define SCRATCH_OPS 1024
+
+static void bench_request(void)
+{
+    server_rec *s;
+    conn_rec *c;
+
+    g_log.level = APLOG_WARNING;
+
+    s = apr_pcalloc(g_pool, sizeof(*s));
+    s->log = g_log;
+
+    c = apr_pcalloc(g_pool, sizeof(*c));
+    c->pool = g_pool;
+    c->base_server = s;
+    c->bucket_alloc = apr_bucket_alloc_create(g_pool);
+    c->log = &g_log;
+
+    g_request = apr_pcalloc(g_pool, sizeof(*g_request));
+    g_request->pool = g_scratch;
+    g_request->connection = c;
+    g_request->server = s;
+    g_request->log = &g_log;
+    g_request->method = "GET";
+    g_request->uri = "/static/css/site.min.css";
+    g_request->headers_in = apr_table_make(g_pool, 16);
+    g_request->headers_out = apr_table_make(g_pool, 16);
+    g_request->subprocess_env = apr_table_make(g_pool, 16);
+    g_request->notes = apr_table_make(g_pool, 16);
+}
+
+static const char * const g_headers[][2] = {
+    { "Host",                      "www.example.com" },
+    { "User-Agent",                "Mozilla/5.0 (X11; Linux x86_64; rv:109.0) "
+                                   "Gecko/20100101 Firefox/115.0" },
+    { "Accept",                    "text/html,application/xhtml+xml,"
+                                   "application/xml;q=0.9,*/*;q=0.8" },
+    { "Accept-Language",           "en-US,en;q=0.5" },
+    { "Accept-Encoding",           "gzip, deflate, br" },
+    { "Referer",                   "https://www.example.com/index.html" },
+    { "Connection",                "keep-alive" },
+    { "Cookie",                    "session=0123456789abcdef; theme=dark" },
+    { "Upgrade-Insecure-Requests", "1" },
+    { "Cache-Control",             "max-age=0" },
+};
+#define NUM_HEADERS (sizeof(g_headers) / sizeof(g_headers[0]))
+
+/*
+ * ap_rgetline(): the header lines of a request, served by an input filter
+ * which returns them one at a time like the core input filter does.
+ */
+
+static const char *g_header_block;
+static apr_size_t g_header_len, g_header_pos;
+
+static apr_status_t header_input_filter(ap_filter_t *f, apr_bucket_brigade *bb,
+                                        ap_input_mode_t mode,
+                                        apr_read_type_e block,
+                                        apr_off_t readbytes)
+{
+    const char *line = g_header_block + g_header_pos;
+    const char *lf = memchr(line, '\n', g_header_len - g_header_pos);
+    apr_size_t len = lf + 1 - line;
+
+    APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_immortal_create(line, len,
+                                                           bb->bucket_alloc));
+    g_header_pos = (g_header_pos + len) % g_header_len;
+    return APR_SUCCESS;
+}
+
+static ap_filter_rec_t g_header_frec;
+static ap_filter_t g_header_filter;
+static apr_bucket_brigade *g_bb;
+
+static void rgetline_setup(void)
+{
+    char *block = "";
+    int i;
+
+    for (i = 0; i < NUM_HEADERS; i++) {
+        block = apr_pstrcat(g_pool, block, g_headers[i][0], ": ",
+                            g_headers[i][1], "\r\n", NULL);
+    }
+    g_header_block = block;
+    g_header_len = strlen(block);
+    g_header_pos = 0;
+
+    g_header_frec.name = "BENCH_HEADERS";
+    g_header_frec.filter_func.in_func = header_input_filter;
+    g_header_frec.ftype = AP_FTYPE_NETWORK;
+    g_header_filter.frec = &g_header_frec;
+    g_header_filter.r = g_request;
+    g_header_filter.c = g_request->connection;
+    g_request->input_filters = &g_header_filter;
+    g_request->proto_input_filters = &g_header_filter;
+
+    g_bb = apr_brigade_create(g_pool, g_request->connection->bucket_alloc);
+}
+
+static void rgetline_run(apr_int64_t n)
+{
+    char buf[HUGE_STRING_LEN];
+    apr_int64_t i;
+
+    for (i = 0; i < n; i++) {
+        char *line = buf;
+        apr_size_t len;
+
+        ap_rgetline(&line, sizeof(buf), &len, g_request, 0, g_bb);
+    }
+    apr_brigade_cleanup(g_bb);
+}
+
+/*
+ * Escaping and unescaping (server/util.c).
+ */
+
+static const char g_path[] = "/files/Annual Report 2023 (final)/summary & "
+                             "notes/caf\xc3\xa9-menu.html";
+static const char g_escaped[] = "/files/Annual%20Report%202023%20%28final%29/"
+                                "summary%20%26%20notes/caf%C3%A9-menu.html";
+static const char g_html[] = "<a href=\"/search?q=apache&lang=en\">Search "
+                             "results for 'apache' & friends</a>";
+static const char g_logitem[] = "Mozilla/5.0 (X11; Linux x86_64)\t\"quoted\" "
+                                "\\ and \x01\x7f control characters";
+
+static void escape_uri_run(apr_int64_t n)
+{
+    apr_int64_t i;
+
+    for (i = 0; i < n; i++) {
+        ap_escape_uri(g_scratch, g_path);
+        if (!(i % SCRATCH_OPS)) {
+            apr_pool_clear(g_scratch);
+        }
+    }
+}
+
+static void escape_html_run(apr_int64_t n)
+{
+    apr_int64_t i;
+
+    for (i = 0; i < n; i++) {
+        ap_escape_html(g_scratch, g_html);
+        if (!(i % SCRATCH_OPS)) {
+            apr_pool_clear(g_scratch);
+        }
+    }
+}
+
+static void escape_logitem_run(apr_int64_t n)
+{
+    apr_int64_t i;
+
+    for (i = 0; i < n; i++) {
+        ap_escape_logitem(g_scratch, g_logitem);
+        if (!(i % SCRATCH_OPS)) {
+            apr_pool_clear(g_scratch);
+        }
+    }
+}
+
+static void unescape_url_run(apr_int64_t n)
+{
+    char buf[sizeof(g_escaped)];
+    apr_int64_t i;
+
+    for (i = 0; i < n; i++) {
+        memcpy(buf, g_escaped, sizeof(buf));
+        ap_unescape_url(buf);
+    }
+}
+
+/*
+ * ap_regexec(), with captures as e.g. mod_rewrite or mod_alias use them.
+ */
+
+static ap_regex_t *g_regex;
+
+static void regexec_setup(void)
+{
+    g_regex = ap_pregcomp(g_pool, "^/static/([a-z]+)/(.+)\\.(css|js)$",
+                          AP_REG_EXTENDED);
+    if (!g_regex) {
+        fprintf(stderr, "httpdbench: cannot compile regex\n");
+        exit(1);
+    }
+}
+
+static void regexec_run(apr_int64_t n)
+{
+    ap_regmatch_t pmatch[AP_MAX_REG_MATCH];
+    apr_int64_t i;
+
+    for (i = 0; i < n; i++) {
+        ap_regexec(g_regex, g_request->uri, AP_MAX_REG_MATCH, pmatch, 0);
+    }
+}
+
+/*
+ * ap_expr_exec(), with the core's variables and functions.
+ */
+
+static ap_expr_info_t g_expr;
+
+static void expr_setup(void)
+{
+    const char *err;
+
+    apr_table_setn(g_request->headers_in, "Host", "www.example.com");
+    apr_table_setn(g_request->headers_in, "Accept-Encoding", "gzip, br");
+
+    ap_expr_init(g_pool);
+    g_expr.filename = "httpdbench";
+    g_expr.line_number = __LINE__;
+    g_expr.flags = AP_EXPR_FLAG_DONT_VARY;
+    g_expr.module_index = APLOG_NO_MODULE;
+    err = ap_expr_parse(g_pool, g_pool, &g_expr,
+                        "%{HTTP:Host} == 'www.example.com' "
+                        "&& %{REQUEST_URI} =~ m#^/static/# "
+                        "&& %{HTTP:Accept-Encoding} =~ /\\bgzip\\b/ "
+                        "&& !(%{REQUEST_METHOD} in {'POST', 'PUT'})", NULL);
+    if (err) {
+        fprintf(stderr, "httpdbench: cannot parse expression: %s\n", err);
+        exit(1);
+    }
+}
+
+static void expr_run(apr_int64_t n)
+{
+    apr_int64_t i;
+
+    for (i = 0; i < n; i++) {
+        const char *err;
+
+        ap_expr_exec(g_request, &g_expr, &err);
+        if (!(i % SCRATCH_OPS)) {
+            apr_pool_clear(g_scratch);
+        }
+    }
+}
+
+/*
+ * apr_table_get() of the request headers, for present and absent ones.
+ */
+
+static apr_table_t *g_table;
+
+static void table_setup(void)
+{
+    int i;
+
+    g_table = apr_table_make(g_pool, NUM_HEADERS);
+    for (i = 0; i < NUM_HEADERS; i++) {
+        apr_table_setn(g_table, g_headers[i][0], g_headers[i][1]);
+    }
+}
+
+static void table_get_run(apr_int64_t n)
+{
+    apr_int64_t i;
+
+    for (i = 0; i < n; i++) {
+        apr_table_get(g_table, "accept-encoding");
+    }
+}
+
+static void table_get_missing_run(apr_int64_t n)
+{
+    apr_int64_t i;
+
+    for (i = 0; i < n; i++) {
+        apr_table_get(g_table, "If-None-Match");
+    }
+}
+
+/*
+ * ap_pass_brigade() of a data bucket through a few filters looking at the
+ * buckets, down to one dropping them.
+ */
+
+#define NUM_FILTERS 4
+
+static ap_filter_rec_t g_pass_frec, g_sink_frec;
+static ap_filter_t g_filters[NUM_FILTERS + 1];
+
+static apr_status_t pass_output_filter(ap_filter_t *f, apr_bucket_brigade *bb)
+{
+    apr_bucket *e;
+
+    for (e = APR_BRIGADE_FIRST(bb); e != APR_BRIGADE_SENTINEL(bb);
+         e = APR_BUCKET_NEXT(e)) {
+        if (APR_BUCKET_IS_EOS(e)) {
+            break;
+        }
+    }
+    return ap_pass_brigade(f->next, bb);
+}
+
+static apr_status_t sink_output_filter(ap_filter_t *f, apr_bucket_brigade *bb)
+{
+    apr_brigade_cleanup(bb);
+    return APR_SUCCESS;
+}
+
+static void pass_brigade_setup(void)
+{
+    int i;
+
+    g_pass_frec.name = "BENCH_PASS";
+    g_pass_frec.filter_func.out_func = pass_output_filter;
+    g_pass_frec.ftype = AP_FTYPE_RESOURCE;
+    g_sink_frec.name = "BENCH_SINK";
+    g_sink_frec.filter_func.out_func = sink_output_filter;
+    g_sink_frec.ftype = AP_FTYPE_NETWORK;
+
+    for (i = 0; i <= NUM_FILTERS; i++) {
+        g_filters[i].frec = i < NUM_FILTERS ? &g_pass_frec : &g_sink_frec;
+        g_filters[i].next = i < NUM_FILTERS ? &g_filters[i + 1] : NULL;
+        g_filters[i].r = g_request;
+        g_filters[i].c = g_request->connection;
+    }
+
+    g_bb = apr_brigade_create(g_pool, g_request->connection->bucket_alloc);
+}
+
+static void pass_brigade_run(apr_int64_t n)
+{
+    static const char data[] = "<html><body>Hello, world!</body></html>";
+    apr_int64_t i;
+
+    for (i = 0; i < n; i++) {
+        APR_BRIGADE_INSERT_TAIL(g_bb, apr_bucket_immortal_create(data,
+                                          sizeof(data) - 1, g_bb->bucket_alloc));
+        ap_pass_brigade(g_filters, g_bb);
+    }
+}
+
+static const bench_t g_benches[] = {
+    { "ap_rgetline/header",     rgetline_setup,     rgetline_run },
+    { "ap_escape_uri",          NULL,               escape_uri_run },
+    { "ap_escape_html",         NULL,               escape_html_run },
+    { "ap_escape_logitem",      NULL,               escape_logitem_run },
+    { "ap_unescape_url",        NULL,               unescape_url_run },
+    { "ap_regexec/captures",    regexec_setup,      regexec_run },
+    { "ap_expr_exec",           expr_setup,         expr_run },
+    { "apr_table_get",          table_setup,        table_get_run },
+    { "apr_table_get/missing",  table_setup,        table_get_missing_run },
+    { "ap_pass_brigade/filters", pass_brigade_setup, pass_brigade_run },
+};
+#define NUM_BENCHES (sizeof(g_benches) / sizeof(g_benches[0]))
+
+/* nanoseconds per operation of the best run */
+static double bench_measure(const bench_t *b)
+{
+    apr_int64_t n = 1;
+    apr_interval_time_t elapsed, best = 0;
+    apr_time_t start;
+    int i;
+
+    /* calibrate the number of operations for BENCH_TIME */
+    for (;;) {
+        start = apr_time_now();
+        b->run(n);
+        elapsed = apr_time_now() - start;
+        if (elapsed >= BENCH_TIME / 10) {
+            n = (apr_int64_t)((double)n * BENCH_TIME / (elapsed ? elapsed : 1));
+            break;
+        }
+        n *= 10;
+    }
+    if (n < 1) {
+        n = 1;
+    }
+
+    for (i = 0; i < BENCH_RUNS; i++) {
+        start = apr_time_now();
+        b->run(n);
+        elapsed = apr_time_now() - start;
+        if (!i || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    apr_pool_clear(g_scratch);
+
+    return (double)best * 1000.0 / n;
+}
+
+/* read "name ns/op" lines */
+static apr_table_t *read_baseline(apr_pool_t *p, const char *fname)
+{
+    apr_table_t *t = apr_table_make(p, NUM_BENCHES);
+    char line[256], name[128];
+    double ns;
+    FILE *in;
+
+    if (!(in = fopen(fname, "r"))) {
+        perror("httpdbench: cannot open baseline");
+        exit(1);
+    }
+    while (fgets(line, sizeof(line), in)) {
+        if (sscanf(line, "%127s %lf", name, &ns) == 2 && name[0] != '#') {
+            apr_table_set(t, name, apr_psprintf(p, "%f", ns));
+        }
+    }
+    fclose(in);
+    return t;
+}
+
+static int selected(const char *name, int argc, const char * const *argv)
+{
+    int i;
+
+    if (!argc) {
+        return 1;
+    }
+    for (i = 0; i < argc; i++) {
+        if (!strncmp(name, argv[i], strlen(argv[i]))) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void usage(const char *progname)
+{
+    fprintf(stderr, "Usage: %s [-b baseline] [-o output] [-r percent] "
+                    "[name...]\n", progname);
+    exit(2);
+}
+
+int main(int argc, const char * const argv[])
+{
+    apr_getopt_t *opt;
+    apr_status_t rv;
+    const char *arg, *baseline = NULL, *output = NULL;
+    apr_table_t *base = NULL;
+    double threshold = 10;
+    FILE *out = NULL;
+    int i, regressions = 0;
+    char ch;
+
+    apr_app_initialize(&argc, &argv, NULL);
+    atexit(apr_terminate);
+
+    apr_pool_create(&g_pool, NULL);
+    apr_pool_create(&g_scratch, g_pool);
+    apr_hook_global_pool = g_pool;
+
+    apr_getopt_init(&opt, g_pool, argc, argv);
+    while ((rv = apr_getopt(opt, "b:o:r:h", &ch, &arg)) == APR_SUCCESS) {
+        switch (ch) {
+        case 'b':
+            baseline = arg;
+            break;
+        case 'o':
+            output = arg;
+            break;
+        case 'r':
+            threshold = atof(arg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (rv != APR_EOF) {
+        usage(argv[0]);
+    }
+
+    if (baseline) {
+        base = read_baseline(g_pool, baseline);
+    }
+    if (output && !(out = fopen(output, "w"))) {
+        perror("httpdbench: cannot open output");
+        exit(1);
+    }
+
+    bench_request();
+    for (i = 0; i < NUM_BENCHES; i++) {
+        const bench_t *b = &g_benches[i];
+        const char *was;
+        double ns;
+
+        if (!selected(b->name, opt->argc - opt->ind, opt->argv + opt->ind)) {
+            continue;
+        }
+        if (b->setup) {
+            b->setup();
+        }
+        ns = bench_measure(b);
+
+        printf("%-28s %10.1f ns/op", b->name, ns);
+        if (base && (was = apr_table_get(base, b->name)) && atof(was) > 0) {
+            double change = (ns - atof(was)) * 100 / atof(was);
+
+            printf("  %+6.1f%%", change);
+            if (change > threshold) {
+                printf("  REGRESSION");
+                regressions++;
+            }
+        }
+        printf("\n");
+        if (out) {
+            fprintf(out, "%s %.1f\n", b->name, ns);
+        }
+    }
+
+    if (out) {
+        fclose(out);
+    }
+    if (regressions) {
+        fprintf(stderr, "httpdbench: %d regression(s) above %.1f%%\n",
+                regressions, threshold);
+        return 1;
+    }
+    return 0;
+}
@@ -116,6 +116,126 @@ cleanup:
     return DECLINED;
 }
 
+/* Size of the pipe_handler response, which must fit in a pipe */
+#define H1TEST_PIPE_LEN     (32 * 1024)
+
+static int h1test_pipe_handler(request_rec *r)
+{
+    conn_rec *c = r->connection;
+    apr_bucket_brigade *bb;
+    apr_bucket *b;
+    apr_file_t *pipe_in, *pipe_out;
+    apr_status_t rv;
+    char buffer[8192];
+    apr_size_t i;
+
+    if (strcmp(r->handler, "h1test-pipe")) {
+        return DECLINED;
+    }
+    if (r->method_number != M_GET) {
+        return DECLINED;
+    }
+
+    ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r, "pipe_handler: processing request");
+    /* write the whole body into a pipe and respond with its read end, for
+     * the core output filter to splice() it */
+    rv = apr_file_pipe_create_ex(&pipe_in, &pipe_out, APR_FULL_BLOCK, r->pool);
+    if (APR_SUCCESS != rv) goto fail;
+    for (i = 0; i < sizeof(buffer); ++i) {
+        buffer[i] = 'a' + (i % 26);
+    }
+    for (i = 0; i < H1TEST_PIPE_LEN; i += sizeof(buffer)) {
+        rv = apr_file_write_full(pipe_out, buffer, sizeof(buffer), NULL);
+        if (APR_SUCCESS != rv) goto fail;
+    }
+    apr_file_close(pipe_out);
+
+    r->status = 200;
+    ap_set_content_type(r, "application/octet-stream");
+    ap_set_content_length(r, H1TEST_PIPE_LEN);
+
+    bb = apr_brigade_create(r->pool, c->bucket_alloc);
+    b = apr_bucket_pipe_create(pipe_in, c->bucket_alloc);
+    APR_BRIGADE_INSERT_TAIL(bb, b);
+    b = apr_bucket_eos_create(c->bucket_alloc);
+    APR_BRIGADE_INSERT_TAIL(bb, b);
+    rv = ap_pass_brigade(r->output_filters, bb);
+    if (rv == APR_SUCCESS || c->aborted) {
+        ap_log_rerror(APLOG_MARK, APLOG_TRACE1, rv, r, "pipe_handler: request handled");
+        return OK;
+    }
+    ap_log_rerror(APLOG_MARK, APLOG_TRACE1, rv, r, "h1test_pipe_handler failed");
+    return AP_FILTER_ERROR;
+
+fail:
+    ap_log_rerror(APLOG_MARK, APLOG_TRACE1, rv, r, "h1test_pipe_handler: pipe setup failed");
+    return HTTP_INTERNAL_SERVER_ERROR;
+}
+
+
+static int h1test_chunks_handler(request_rec *r)
+{
+    conn_rec *c = r->connection;
+    apr_bucket_brigade *bb;
+    apr_bucket *b;
+    apr_status_t rv = APR_SUCCESS;
+    char buffer[8192], *end = NULL;
+    apr_int64_t count = 0, size = 0, i;
+    int flush = 0;
+
+    if (strcmp(r->handler, "h1test-chunks")) {
+        return DECLINED;
+    }
+    if (r->method_number != M_GET) {
+        return DECLINED;
+    }
+
+    /* ?<count>,<size>[,flush]: pass count pieces of size bytes each,
+     * followed by a FLUSH if asked to */
+    if (r->args) {
+        count = apr_strtoi64(r->args, &end, 10);
+        if (*end == ',') {
+            size = apr_strtoi64(end + 1, &end, 10);
+        }
+        flush = !strcmp(end, ",flush");
+    }
+    if (count <= 0 || size <= 0 || size > (apr_int64_t)sizeof(buffer)
+        || (*end && !flush)) {
+        return HTTP_BAD_REQUEST;
+    }
+
+    ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r, "chunks_handler: processing request");
+    for (i = 0; i < size; ++i) {
+        buffer[i] = 'a' + (i % 26);
+    }
+    r->status = 200;
+    ap_set_content_type(r, "application/octet-stream");
+
+    bb = apr_brigade_create(r->pool, c->bucket_alloc);
+    for (i = 0; i < count && rv == APR_SUCCESS; ++i) {
+        rv = apr_brigade_write(bb, NULL, NULL, buffer, (apr_size_t)size);
+        if (APR_SUCCESS != rv) break;
+        if (flush) {
+            b = apr_bucket_flush_create(c->bucket_alloc);
+            APR_BRIGADE_INSERT_TAIL(bb, b);
+        }
+        rv = ap_pass_brigade(r->output_filters, bb);
+        apr_brigade_cleanup(bb);
+    }
+    if (APR_SUCCESS == rv) {
+        b = apr_bucket_eos_create(c->bucket_alloc);
+        APR_BRIGADE_INSERT_TAIL(bb, b);
+        rv = ap_pass_brigade(r->output_filters, bb);
+    }
+
+    if (rv == APR_SUCCESS || c->aborted) {
+        ap_log_rerror(APLOG_MARK, APLOG_TRACE1, rv, r, "chunks_handler: request handled");
+        return OK;
+    }
+    ap_log_rerror(APLOG_MARK, APLOG_TRACE1, rv, r, "h1test_chunks_handler failed");
+    return AP_FILTER_ERROR;
+}
+
 
 /* Install this module into the apache2 infrastructure.
  */
@@ -125,5 +245,7 @@ static void h1test_hooks(apr_pool_t *pool)
 
     /* test h1 handlers */
     ap_hook_handler(h1test_echo_handler, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_handler(h1test_pipe_handler, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_handler(h1test_chunks_handler, NULL, NULL, APR_HOOK_MIDDLE);
 }
 
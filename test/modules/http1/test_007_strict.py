@@ -67,3 +67,30 @@ class TestRequestStrict:
                     assert int(m.group(1)) == status, f"{rlines}"
                 else:
                     assert int(m.group(1)) >= 400, f"{rlines}"
+
+    # control chars (but HT) and DEL are rejected anywhere in a header value,
+    # within or across the words of the scan, and so are NULs (which the line
+    # reading rejects first), whereas HT and obs-text are accepted
+    @pytest.mark.parametrize(["vlen", "offset"], [
+        [1, 0], [5, 4], [7, 6], [8, 7], [9, 8], [16, 15], [17, 16],
+        [24, 0], [24, 1], [24, 7], [24, 8], [24, 9], [24, 15], [24, 16],
+        [24, 17], [24, 23],
+    ])
+    @pytest.mark.parametrize(["char", "status"], [
+        [0x00, 400], [0x01, 400], [0x1f, 400], [0x7f, 400],
+        [0x09, 200], [0x7e, 200], [0x80, 200], [0xff, 200],
+    ])
+    def test_h1_007_02(self, env, vlen, offset, char, status):
+        value = bytearray(b'a' * vlen)
+        value[offset] = char
+        with socket.create_connection(('localhost', int(env.http_port))) as sock:
+            sock.sendall(b"GET / HTTP/1.0\r\nHost: localhost\r\n"
+                         b"X-Test: " + bytes(value) + b"\r\n\r\n")
+            sock.shutdown(socket.SHUT_WR)
+            buff = sock.recv(1024)
+            msg = buff.decode('latin-1')
+            assert len(msg) > 0, "no answer from server"
+            rlines = msg.splitlines()
+            m = re.match(r'^HTTP/1.1 (\d+)\s+(\S+)', rlines[0])
+            assert m, f"unrecognized response: {rlines}"
+            assert int(m.group(1)) == status, f"{value}: {rlines}"
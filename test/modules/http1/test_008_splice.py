@@ -0,0 +1,52 @@
+import platform
+import re
+import string
+
+import pytest
+
+from .env import H1Conf
+
+
+# The core output filter splice()s pipe buckets to the client socket on
+# Linux, when the response length is declared and nothing reads the pipe
+# on the way (so not through TLS or HTTP/2).
+@pytest.mark.skipif(condition=platform.system() != "Linux",
+                    reason="splice() is linux only")
+class TestSplice:
+
+    @pytest.fixture(autouse=True, scope='class')
+    def _class_scope(self, env):
+        conf = H1Conf(env)
+        conf.add([
+            "LogLevel core:trace6",
+            "<Location \"/h1test/pipe\">",
+            "    SetHandler h1test-pipe",
+            "</Location>",
+        ])
+        conf.add_vhost_cgi().install()
+        assert env.apache_restart() == 0
+
+    def expected_body(self):
+        letters = string.ascii_lowercase
+        chunk = "".join(letters[i % 26] for i in range(8192))
+        return chunk * 4
+
+    # the pipe of a response with a Content-Length gets spliced
+    def test_h1_008_01(self, env):
+        url = env.mkurl("http", "cgi", "/h1test/pipe")
+        r = env.curl_get(url)
+        assert r.exit_code == 0, f"{r}"
+        assert r.response["status"] == 200
+        assert r.response["header"]["content-length"] == "32768"
+        assert r.stdout == self.expected_body()
+        assert env.httpd_error_log.scan_recent(
+            re.compile(r'.*splice_nonblocking: \d+/\d+'), timeout=5)
+
+    # through TLS, the pipe is read and the response is the same
+    def test_h1_008_02(self, env):
+        url = env.mkurl("https", "cgi", "/h1test/pipe")
+        r = env.curl_get(url)
+        assert r.exit_code == 0, f"{r}"
+        assert r.response["status"] == 200
+        assert r.response["header"]["content-length"] == "32768"
+        assert r.stdout == self.expected_body()
@@ -0,0 +1,159 @@
+import re
+import socket
+import time
+from typing import List, Tuple
+
+import pytest
+
+from .env import H1Conf
+
+
+class TestChunked:
+
+    @pytest.fixture(autouse=True, scope='class')
+    def _class_scope(self, env):
+        conf = H1Conf(env)
+        conf.add([
+            "<Location \"/h1test/echo\">",
+            "    SetHandler h1test-echo",
+            "</Location>",
+            "<Location \"/h1test/chunks\">",
+            "    SetHandler h1test-chunks",
+            "</Location>",
+        ])
+        conf.add_vhost_cgi().install()
+        assert env.apache_restart() == 0
+
+    # send the parts on a plain connection, pausing in between so that the
+    # server sees them in separate reads, and return the whole response
+    def send_raw(self, env, parts: List[bytes], pause: float = 0.0) -> bytes:
+        with socket.create_connection(('localhost', int(env.http_port))) as sock:
+            sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+            sock.settimeout(10)
+            for i, part in enumerate(parts):
+                if i and pause:
+                    time.sleep(pause)
+                sock.sendall(part)
+            sock.shutdown(socket.SHUT_WR)
+            resp = b''
+            while True:
+                buff = sock.recv(65536)
+                if not buff:
+                    return resp
+                resp += buff
+
+    def post_chunked(self, env, parts: List[bytes], pause: float = 0.0) -> bytes:
+        head = "POST /h1test/echo HTTP/1.1\r\n" \
+               f"Host: cgi.{env.http_tld}\r\n" \
+               "Transfer-Encoding: chunked\r\n" \
+               "Connection: close\r\n\r\n"
+        return self.send_raw(env, [head.encode()] + parts, pause=pause)
+
+    def get_chunks(self, env, args: str) -> bytes:
+        req = f"GET /h1test/chunks?{args} HTTP/1.1\r\n" \
+              f"Host: cgi.{env.http_tld}\r\n" \
+              "Connection: close\r\n\r\n"
+        return self.send_raw(env, [req.encode()])
+
+    @staticmethod
+    def status_of(resp: bytes) -> int:
+        m = re.match(rb'^HTTP/1.1 (\d+)', resp)
+        assert m, f"unrecognized response: {resp[:200]}"
+        return int(m.group(1))
+
+    # return the sizes of the chunks and the decoded body of a response
+    @staticmethod
+    def dechunk(resp: bytes) -> Tuple[List[int], bytes]:
+        head, _, data = resp.partition(b"\r\n\r\n")
+        assert re.search(rb'(?i)\r\ntransfer-encoding:\s*chunked', head), \
+            f"not chunked: {head}"
+        sizes = []
+        body = b''
+        while True:
+            line, _, data = data.partition(b"\r\n")
+            size = int(line.split(b';')[0], 16)
+            if size == 0:
+                return sizes, body
+            sizes.append(size)
+            body += data[:size]
+            assert data[size:size + 2] == b"\r\n", f"bad chunk end: {data[:size + 2]}"
+            data = data[size + 2:]
+
+    # chunk size lines, of the fast path or not, decode the same
+    @pytest.mark.parametrize(["body", "expected"], [
+        # leading zeros, also more than the digits of an apr_off_t
+        [b"005\r\nhello\r\n0\r\n\r\n", b"hello"],
+        [b"0000000000000000000005\r\nhello\r\n0000\r\n\r\n", b"hello"],
+        # hex digits in both cases
+        [b"A\r\n0123456789\r\na\r\n9876543210\r\n0\r\n\r\n", b"01234567899876543210"],
+        [b"1F\r\n" + b"x" * 31 + b"\r\n0\r\n\r\n", b"x" * 31],
+        # extensions and BWS take the state machine
+        [b"5;ext=1\r\nhello\r\n0\r\n\r\n", b"hello"],
+        [b"5 \r\nhello\r\n0\r\n\r\n", b"hello"],
+        [b"5 ;ext\r\nhello\r\n0\r\n\r\n", b"hello"],
+    ])
+    def test_h1_009_01(self, env, body, expected):
+        resp = self.post_chunked(env, [body])
+        assert self.status_of(resp) == 200, f"{resp}"
+        sizes, data = self.dechunk(resp)
+        assert data == expected
+
+    # invalid chunk size lines
+    @pytest.mark.parametrize(["body"], [
+        [b"5x\r\nhello\r\n0\r\n\r\n"],
+        [b"g\r\nhello\r\n0\r\n\r\n"],
+        [b"\r\nhello\r\n0\r\n\r\n"],
+        [b"-5\r\nhello\r\n0\r\n\r\n"],
+    ])
+    def test_h1_009_02(self, env, body):
+        resp = self.post_chunked(env, [body])
+        assert self.status_of(resp) == 400, f"{resp}"
+
+    # 15 significant hex digits are accepted (the body is then cut short, so
+    # the response is partial), 16 overflow whatever the path
+    @pytest.mark.parametrize(["size", "status"], [
+        [b"100000000000000", 200],
+        [b"fffffffffffffff", 200],
+        [b"0100000000000000", 200],
+        [b"1000000000000000", 413],
+        [b"ffffffffffffffff", 413],
+        [b"1000000000000000;ext", 413],
+        [b"10000000000000000", 413],
+    ])
+    def test_h1_009_03(self, env, size, status):
+        resp = self.post_chunked(env, [size + b"\r\nhello"])
+        assert self.status_of(resp) == status, f"{resp}"
+        if status == 200:
+            assert b"hello" in resp
+
+    # a chunk size line split across reads
+    @pytest.mark.parametrize(["parts"], [
+        [[b"1", b"0\r\n" + b"y" * 16 + b"\r\n0\r\n\r\n"]],
+        [[b"10", b"\r\n" + b"y" * 16 + b"\r\n0\r\n\r\n"]],
+        [[b"10\r", b"\n" + b"y" * 16 + b"\r\n0\r\n\r\n"]],
+        [[b"0", b"0", b"10\r\n" + b"y" * 16 + b"\r\n0\r\n\r\n"]],
+        [[b"10;e", b"xt\r\n" + b"y" * 16 + b"\r\n0\r\n\r\n"]],
+    ])
+    def test_h1_009_04(self, env, parts):
+        resp = self.post_chunked(env, parts, pause=0.2)
+        assert self.status_of(resp) == 200, f"{resp}"
+        sizes, data = self.dechunk(resp)
+        assert data == b"y" * 16
+
+    # small writes are coalesced in chunks of CHUNK_MIN_BYTES or more, until
+    # FLUSH or EOS
+    @pytest.mark.parametrize(["args", "expected"], [
+        ["10,100", [1000]],
+        ["10,100,flush", [100] * 10],
+        ["10,1000", [5000, 5000]],
+        ["1,5000", [5000]],
+        ["3,4096", [4096] * 3],
+        ["3,4095", [8190, 4095]],
+    ])
+    def test_h1_009_05(self, env, args, expected):
+        resp = self.get_chunks(env, args)
+        assert self.status_of(resp) == 200, f"{resp}"
+        count, size = [int(x) for x in args.split(',')[:2]]
+        sizes, data = self.dechunk(resp)
+        assert sizes == expected
+        assert len(data) == count * size
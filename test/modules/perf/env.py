@@ -0,0 +1,236 @@
+import inspect
+import json
+import logging
+import os
+import re
+from typing import Dict, Any, Optional
+
+from pyhttpd.certs import CertificateSpec
+from pyhttpd.conf import HttpdConf
+from pyhttpd.env import HttpdTestEnv, HttpdTestSetup
+
+log = logging.getLogger(__name__)
+
+
+class PerfTestSetup(HttpdTestSetup):
+
+    def __init__(self, env: 'HttpdTestEnv'):
+        super().__init__(env=env)
+        self.add_source_dir(os.path.dirname(inspect.getfile(PerfTestSetup)))
+        self.add_modules(["ssl"])
+        self.add_optional_modules(["http2"])
+
+    def make(self):
+        super().make()
+        self._setup_data()
+
+    def _setup_data(self):
+        docs_dir = os.path.join(self.env.server_docs_dir, 'perf')
+        if not os.path.exists(docs_dir):
+            os.makedirs(docs_dir)
+        s90 = "01234567890123456789012345678901234567890123456789012345678901234567890123456789012345678\n"
+        with open(os.path.join(docs_dir, "data-1k"), 'w') as f:
+            for i in range(10):
+                f.write(f"{i:09d}-{s90}")
+        with open(os.path.join(docs_dir, "data-100k"), 'w') as f:
+            for i in range(1000):
+                f.write(f"{i:09d}-{s90}")
+
+
+class PerfTestEnv(HttpdTestEnv):
+
+    # the metrics compared to the baseline, and whether more is better
+    METRICS = {
+        "rps": True,
+        "p99_ms": False,
+        "cpu_us_per_req": False,
+    }
+
+    def __init__(self, pytestconfig=None):
+        super().__init__(pytestconfig=pytestconfig)
+        self._d_perf = f"perf.{self.http_tld}"
+        self.add_httpd_log_modules(["http", "core"])
+        self.add_cert_specs([
+            CertificateSpec(domains=[self._d_perf]),
+        ])
+        self._ab = os.path.join(self.bin_dir, 'ab')
+        self._requests = int(os.environ.get('PERF_REQUESTS', '20000'))
+        self._tolerance = float(os.environ.get('PERF_TOLERANCE', '10'))
+        self._baseline_file = os.environ.get('PERF_BASELINE', os.path.join(
+            os.path.dirname(inspect.getfile(PerfTestEnv)), 'baseline.json'))
+        self._baseline_update = os.environ.get('PERF_BASELINE_UPDATE', '') != ''
+
+    def setup_httpd(self, setup: HttpdTestSetup = None):
+        super().setup_httpd(setup=PerfTestSetup(env=self))
+
+    @property
+    def d_perf(self) -> str:
+        return self._d_perf
+
+    @property
+    def ab(self) -> str:
+        return self._ab
+
+    def has_ab(self) -> bool:
+        return os.access(self._ab, os.X_OK)
+
+    def has_h2(self) -> bool:
+        return self.has_shared_module("http2") \
+            and self.mpm_module != 'mpm_prefork' \
+            and self.h2load_is_at_least('1.41.0')
+
+    @property
+    def requests(self) -> int:
+        return self._requests
+
+    @property
+    def baseline_file(self) -> str:
+        return self._baseline_file
+
+    def server_cpu_seconds(self) -> Optional[float]:
+        """The user and system CPU time used so far by the server, its
+           children included, or None if it can't be read from /proc."""
+        pid_file = os.path.join(self.server_logs_dir, 'httpd.pid')
+        try:
+            with open(pid_file) as fd:
+                ppid = int(fd.read().strip())
+        except (OSError, ValueError):
+            return None
+        ticks = 0
+        for name in os.listdir('/proc'):
+            if not name.isdigit():
+                continue
+            try:
+                with open(f"/proc/{name}/stat") as fd:
+                    stat = fd.read()
+            except OSError:
+                continue
+            # the command name may contain spaces, skip past it
+            fields = stat[stat.rindex(')') + 2:].split()
+            pid = int(name)
+            if pid == ppid:
+                # include the children already reaped by the parent
+                ticks += sum(int(v) for v in fields[11:15])
+            elif int(fields[1]) == ppid:
+                ticks += sum(int(v) for v in fields[11:13])
+        return ticks / os.sysconf('SC_CLK_TCK')
+
+    def run_ab(self, url: str, host: str, concurrency: int = 16):
+        """Run ab on url with keep-alive connections and return its
+           JSON results."""
+        json_file = os.path.join(self.gen_dir, 'ab.json')
+        args = [self._ab, '-q', '-k', '-n', f"{self._requests}",
+                '-c', f"{concurrency}", '-H', f"Host: {host}",
+                '-j', json_file, url]
+        r = self.run(args)
+        assert r.exit_code == 0, f"ab failed: {r.stderr}"
+        with open(json_file) as fd:
+            results = json.load(fd)
+        assert results["failed_requests"] == 0
+        assert results["non_2xx_responses"] == 0
+        return results
+
+    @staticmethod
+    def _h2load_ms(value: str) -> float:
+        m = re.match(r'^([\d.]+)(us|ms|s)$', value)
+        assert m, f"unexpected h2load time: {value}"
+        scale = {'us': 0.001, 'ms': 1.0, 's': 1000.0}[m.group(2)]
+        return float(m.group(1)) * scale
+
+    def run_h2load(self, url: str, clients: int = 4, streams: int = 16):
+        """Run h2load on url with multiplexed streams and return the
+           requests per second and the request time statistics, in ms;
+           h2load reports no percentiles, so max stands in for p99."""
+        args = [self.h2load, '-n', f"{self._requests}", '-c', f"{clients}",
+                '-m', f"{streams}", f"--connect-to=localhost:{self.https_port}",
+                url]
+        r = self.run(args)
+        assert r.exit_code == 0, f"h2load failed: {r.stderr}"
+        r = self.h2load_status(r)
+        assert r.results["h2load"]["requests"]["succeeded"] == self._requests
+        m = re.search(r'finished in [^,]+, ([\d.]+) req/s', r.stdout)
+        assert m, f"no rate in h2load output: {r.stdout}"
+        rps = float(m.group(1))
+        m = re.search(r'time for request:\s+(\S+)\s+(\S+)\s+(\S+)\s+(\S+)',
+                      r.stdout)
+        assert m, f"no request times in h2load output: {r.stdout}"
+        return {
+            "rps": rps,
+            "min": self._h2load_ms(m.group(1)),
+            "max": self._h2load_ms(m.group(2)),
+            "mean": self._h2load_ms(m.group(3)),
+        }
+
+    def _load_baseline(self) -> Dict[str, Any]:
+        if os.path.exists(self._baseline_file):
+            with open(self._baseline_file) as fd:
+                return json.load(fd)
+        return {}
+
+    def check_baseline(self, name: str, metrics: Dict[str, float]):
+        """Compare the metrics of a run to the stored baseline, failing when
+           one regressed by more than the tolerance. A run without a baseline,
+           or with PERF_BASELINE_UPDATE set, is stored as the new baseline."""
+        metrics = {k: v for k, v in metrics.items() if v is not None}
+        baseline = self._load_baseline()
+        log.info(f"perf {name}: {metrics}, baseline: {baseline.get(name)}")
+        if self._baseline_update or name not in baseline:
+            baseline[name] = metrics
+            with open(self._baseline_file, 'w') as fd:
+                json.dump(baseline, fd, indent=2, sort_keys=True)
+                fd.write('\n')
+            return
+        regressions = []
+        for key, higher_better in PerfTestEnv.METRICS.items():
+            if key not in metrics or key not in baseline[name]:
+                continue
+            base = baseline[name][key]
+            value = metrics[key]
+            if higher_better:
+                limit = base * (100 - self._tolerance) / 100
+                ok = value >= limit
+            else:
+                limit = base * (100 + self._tolerance) / 100
+                ok = value <= limit
+            if not ok:
+                regressions.append(f"{key}: {value:.3f} (baseline {base:.3f})")
+        assert not regressions, \
+            f"{name} regressed by more than {self._tolerance}%: "\
+            f"{', '.join(regressions)}"
+
+
+class PerfConf(HttpdConf):
+
+    def __init__(self, env: PerfTestEnv, extras: Dict[str, Any] = None):
+        super().__init__(env=env, extras=extras)
+
+    def add_vhost_perf(self, h2: bool = False):
+        domain = self.env.d_perf
+        backend = f"http://127.0.0.1:{self.env.http_port}"
+        lines = [
+            "EnableSendfile on",
+            "EnableMMAP on",
+            # a local backend, the plain static files of this same host
+            f"ProxyPass /proxy/ {backend}/perf/",
+            f"ProxyPass /cached/ {backend}/perf/",
+            "<Location /cached/>",
+            "    CacheEnable socache",
+            "</Location>",
+            "CacheSocache shmcb",
+            "CacheSocacheMaxSize 131072",
+            "CacheQuickHandler on",
+            "CacheHeader on",
+            "CacheDefaultExpire 3600",
+            "CacheIgnoreNoLastMod on",
+        ]
+        self.start_vhost(domains=[domain], port=self.env.http_port,
+                         doc_root="htdocs")
+        self.add(lines)
+        self.end_vhost()
+        self.start_vhost(domains=[domain], port=self.env.https_port,
+                         doc_root="htdocs")
+        if h2:
+            self.add("Protocols h2 http/1.1")
+        self.add(lines)
+        self.end_vhost()
+        return self
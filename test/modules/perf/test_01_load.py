@@ -0,0 +1,71 @@
+import pytest
+
+from .env import PerfConf, PerfTestEnv
+
+
+@pytest.mark.skipif(not PerfTestEnv().has_ab(), reason="ab not installed")
+class TestLoad:
+
+    @pytest.fixture(autouse=True, scope='class')
+    def _class_scope(self, env):
+        PerfConf(env).add_vhost_perf(h2=env.has_h2()).install()
+        assert env.apache_restart() == 0
+
+    def measure_ab(self, env, name, url):
+        cpu_start = env.server_cpu_seconds()
+        results = env.run_ab(url, host=env.d_perf)
+        cpu_end = env.server_cpu_seconds()
+        assert results["complete_requests"] == env.requests
+        cpu = None
+        if cpu_start is not None and cpu_end is not None:
+            cpu = (cpu_end - cpu_start) * 1000000 / env.requests
+        env.check_baseline(name, {
+            "rps": results["requests_per_second"],
+            "p99_ms": results["total"]["percentiles"]["99"],
+            "cpu_us_per_req": cpu,
+        })
+
+    # static file over plain http, sent with sendfile
+    @pytest.mark.parametrize("path", ["data-1k", "data-100k"])
+    def test_perf_001_static(self, env, path):
+        url = f"http://127.0.0.1:{env.http_port}/perf/{path}"
+        self.measure_ab(env, f"static-{path}", url)
+
+    # static file over TLS
+    @pytest.mark.parametrize("path", ["data-1k", "data-100k"])
+    def test_perf_002_tls_static(self, env, path):
+        url = f"https://127.0.0.1:{env.https_port}/perf/{path}"
+        self.measure_ab(env, f"tls-static-{path}", url)
+
+    # reverse proxy to a local backend
+    def test_perf_003_proxy(self, env):
+        url = f"http://127.0.0.1:{env.http_port}/proxy/data-1k"
+        self.measure_ab(env, "proxy-data-1k", url)
+
+    # mod_cache hits, served by the quick handler
+    def test_perf_004_cache_hit(self, env):
+        url = f"http://{env.d_perf}:{env.http_port}/cached/data-1k"
+        r = env.curl_get(url)
+        assert r.response["status"] == 200
+        r = env.curl_get(url)
+        assert r.response["status"] == 200
+        assert r.response["header"]["x-cache"].startswith("HIT")
+        url = f"http://127.0.0.1:{env.http_port}/cached/data-1k"
+        self.measure_ab(env, "cache-hit-data-1k", url)
+
+    # h2 with multiplexed streams on a few connections
+    @pytest.mark.skipif(not PerfTestEnv().has_h2(),
+                        reason="mod_http2 or h2load with --connect-to missing")
+    def test_perf_005_h2(self, env):
+        url = env.mkurl('https', 'perf', '/perf/data-1k')
+        cpu_start = env.server_cpu_seconds()
+        results = env.run_h2load(url)
+        cpu_end = env.server_cpu_seconds()
+        cpu = None
+        if cpu_start is not None and cpu_end is not None:
+            cpu = (cpu_end - cpu_start) * 1000000 / env.requests
+        env.check_baseline("h2-data-1k", {
+            "rps": results["rps"],
+            "p99_ms": results["max"],
+            "cpu_us_per_req": cpu,
+        })
@@ -0,0 +1,207 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "../httpdunit.h"
+
+#include "httpd.h"
+#include "util_ipset.h"
+
+/*
+ * Test Fixture -- runs once per test
+ */
+
+static apr_pool_t *g_pool;
+
+static void util_ipset_setup(void)
+{
+    if (apr_pool_create(&g_pool, NULL) != APR_SUCCESS) {
+        exit(1);
+    }
+}
+
+static void util_ipset_teardown(void)
+{
+    apr_pool_destroy(g_pool);
+}
+
+/*
+ * ap_ipset_match()
+ */
+
+#define IPSET_MAX_SUBNETS 3
+
+struct ap_ipset_case {
+    /* ipstr and mask_or_numbits of the subnets, in the order added */
+    const char *subnets[IPSET_MAX_SUBNETS][2];
+    const char *client;
+    int expected;   /* index of the matching subnet, or -1 */
+};
+
+const struct ap_ipset_case ap_ipset_cases[] = {
+    /* partial IPv4 addresses match on whole octets */
+    { { { "10.1", NULL } },                         "10.1.2.3",     0 },
+    { { { "10.1", NULL } },                         "10.2.1.1",    -1 },
+    { { { "10.1", NULL } },                         "10.10.0.1",   -1 },
+    { { { "10", NULL } },                           "10.255.0.1",   0 },
+    { { { "10.1.2.3", NULL } },                     "10.1.2.3",     0 },
+    { { { "10.1.2.3", NULL } },                     "10.1.2.4",    -1 },
+
+    /* netmask and /bits forms are the same subnet */
+    { { { "192.168.0.0", "255.255.0.0" } },         "192.168.7.7",  0 },
+    { { { "192.168.0.0", "16" } },                  "192.168.7.7",  0 },
+    { { { "192.168.0.0", "255.255.0.0" } },         "192.169.0.1", -1 },
+    { { { "192.168.0.0", "16" } },                  "192.169.0.1", -1 },
+    { { { "172.16.0.0", "255.240.0.0" } },          "172.31.1.1",   0 },
+    { { { "172.16.0.0", "12" } },                   "172.31.1.1",   0 },
+    { { { "172.16.0.0", "12" } },                   "172.32.0.1",  -1 },
+    { { { "192.168.1.5", "32" } },                  "192.168.1.5",  0 },
+    { { { "192.168.1.5", "255.255.255.255" } },     "192.168.1.6", -1 },
+
+    /* /0 matches the whole family (as a netmask, APR rejects 0 bits) */
+    { { { "0.0.0.0", "0.0.0.0" } },                 "203.0.113.9",  0 },
+    { { { "10.1.2.3", "0.0.0.0" } },                "203.0.113.9",  0 },
+
+    /* non contiguous masks, tested in order with apr_ipsubnet_test() */
+    { { { "10.0.0.1", "255.0.255.255" } },          "10.9.0.1",     0 },
+    { { { "10.0.0.1", "255.0.255.255" } },          "10.9.0.2",    -1 },
+    { { { "10.0.0.1", "255.0.255.255" } },          "11.9.0.1",    -1 },
+
+    /* the first subnet added wins, whatever its length or kind */
+    { { { "10.0.0.0", "8" },
+        { "10.1.0.0", "16" } },                     "10.1.2.3",     0 },
+    { { { "10.1.0.0", "16" },
+        { "10.0.0.0", "8" } },                      "10.1.2.3",     0 },
+    { { { "10.1.0.0", "16" },
+        { "10.0.0.0", "8" } },                      "10.2.0.1",     1 },
+    { { { "10.0.0.0", "8" },
+        { "10.0.0.0", "255.0.0.0" } },              "10.1.2.3",     0 },
+    { { { "192.168.0.0", "16" },
+        { "10.0.0.1", "255.0.255.255" },
+        { "10.0.0.0", "8" } },                      "10.9.0.1",     1 },
+    { { { "192.168.0.0", "16" },
+        { "10.0.0.0", "8" },
+        { "10.0.0.1", "255.0.255.255" } },          "10.9.0.1",     1 },
+    { { { "10.0.0.1", "255.0.255.255" },
+        { "10.9.0.0", "16" } },                     "10.9.0.2",     1 },
+
+#if APR_HAVE_IPV6
+    { { { "2001:db8::", "32" } },                   "2001:db8:1::1",  0 },
+    { { { "2001:db8::", "32" } },                   "2001:db9::1",   -1 },
+    { { { "2001:db8::1", NULL } },                  "2001:db8::1",    0 },
+    { { { "2001:db8::1", NULL } },                  "2001:db8::2",   -1 },
+    { { { "::", "1" } },                            "2001:db8::1",    0 },
+    { { { "::", "1" } },                            "8001:db8::1",   -1 },
+
+    /* an IPv4 subnet doesn't match the IPv6 clients, nor the reverse */
+    { { { "0.0.0.0", "0.0.0.0" } },                 "2001:db8::1",   -1 },
+    { { { "::", "1" } },                            "203.0.113.9",   -1 },
+
+    /* IPv4-mapped IPv6 clients match the IPv4 subnets */
+    { { { "10.0.0.0", "8" } },                      "::ffff:10.1.2.3",  0 },
+    { { { "10.1", NULL } },                         "::ffff:10.1.2.3",  0 },
+    { { { "10.0.0.0", "255.0.0.0" } },              "::ffff:11.1.2.3", -1 },
+    { { { "10.0.0.1", "255.0.255.255" } },          "::ffff:10.9.0.1",  0 },
+    { { { "0.0.0.0", "0.0.0.0" } },                 "::ffff:10.1.2.3",  0 },
+    { { { "2001:db8::", "32" },
+        { "10.0.0.0", "8" } },                      "::ffff:10.1.2.3",  1 },
+#endif
+};
+
+const size_t ap_ipset_cases_len = sizeof(ap_ipset_cases) /
+    sizeof(ap_ipset_cases[0]);
+
+static const int subnet_ids[IPSET_MAX_SUBNETS] = { 0, 1, 2 };
+
+HTTPD_START_LOOP_TEST(ipset_match_works, ap_ipset_cases_len)
+{
+    const struct ap_ipset_case *c = &ap_ipset_cases[_i];
+    ap_ipset_t *set = ap_ipset_make(g_pool);
+    apr_sockaddr_t *sa;
+    const void *data = NULL;
+    apr_status_t status;
+    int i, matched;
+
+    for (i = 0; i < IPSET_MAX_SUBNETS && c->subnets[i][0]; ++i) {
+        status = ap_ipset_add(set, c->subnets[i][0], c->subnets[i][1],
+                              &subnet_ids[i]);
+        ck_assert_int_eq(status, APR_SUCCESS);
+    }
+    ck_assert_int_eq(ap_ipset_count(set), i);
+
+    status = apr_sockaddr_info_get(&sa, c->client, APR_UNSPEC, 0, 0, g_pool);
+    ck_assert_int_eq(status, APR_SUCCESS);
+
+    matched = ap_ipset_match(set, sa, &data);
+    if (c->expected < 0) {
+        ck_assert_msg(!matched, "%s matched subnet %d", c->client,
+                      data ? *(const int *)data : -1);
+    }
+    else {
+        ck_assert_msg(matched, "%s did not match", c->client);
+        ck_assert_int_eq(*(const int *)data, c->expected);
+    }
+
+    /* must match the same without asking for the data */
+    ck_assert_int_eq(ap_ipset_match(set, sa, NULL), matched);
+}
+END_TEST
+
+START_TEST(ipset_empty_matches_nothing)
+{
+    ap_ipset_t *set = ap_ipset_make(g_pool);
+    apr_sockaddr_t *sa;
+    apr_status_t status;
+
+    status = apr_sockaddr_info_get(&sa, "10.1.2.3", APR_INET, 0, 0, g_pool);
+    ck_assert_int_eq(status, APR_SUCCESS);
+
+    ck_assert_int_eq(ap_ipset_count(set), 0);
+    ck_assert(!ap_ipset_match(set, sa, NULL));
+}
+END_TEST
+
+static const char * const invalid_subnets[][2] = {
+    { "10.1.2",      "16" },    /* mask with a partial address */
+    { "10.0.0.0",    "33" },
+    { "0.0.0.0",     "0" },     /* /0 only as a netmask */
+    { "::",          "0" },
+    { "10.0.0.0",    "255.0.0" },
+    { "256.0.0.0",   NULL },
+    { "10.0.0.0",    "bits" },
+    { "example.com", NULL },
+};
+static const size_t invalid_subnets_len = sizeof(invalid_subnets) /
+                                          sizeof(invalid_subnets[0]);
+
+HTTPD_START_LOOP_TEST(ipset_add_rejects_invalid_subnets, invalid_subnets_len)
+{
+    ap_ipset_t *set = ap_ipset_make(g_pool);
+    apr_status_t status;
+
+    status = ap_ipset_add(set, invalid_subnets[_i][0], invalid_subnets[_i][1],
+                          NULL);
+
+    ck_assert_int_ne(status, APR_SUCCESS);
+    ck_assert_int_eq(ap_ipset_count(set), 0);
+}
+END_TEST
+
+/*
+ * Test Case Boilerplate
+ */
+HTTPD_BEGIN_TEST_CASE_WITH_FIXTURE(util_ipset, util_ipset_setup, util_ipset_teardown)
+#include "test/unit/util_ipset.tests"
+HTTPD_END_TEST_CASE